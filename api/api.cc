@@ -29,6 +29,7 @@
 #include "failure_detector.hh"
 #include "column_family.hh"
 #include "lsa.hh"
+#include "reactor.hh"
 #include "messaging_service.hh"
 #include "storage_proxy.hh"
 #include "cache_service.hh"
@@ -38,6 +39,8 @@
 #include "hinted_handoff.hh"
 #include "http/exception.hh"
 #include "stream_manager.hh"
+#include "cql.hh"
+#include "batchlog_manager.hh"
 
 namespace api {
 
@@ -79,6 +82,9 @@ future<> set_server(http_context& ctx) {
         rb->register_function(r, "lsa", "Log-structured allocator API");
         set_lsa(ctx, r);
 
+        rb->register_function(r, "reactor", "The reactor API");
+        set_reactor(ctx, r);
+
         rb->register_function(r, "failure_detector",
                                 "The failure detector API");
         set_failure_detector(ctx,r);
@@ -108,6 +114,12 @@ future<> set_server(http_context& ctx) {
         rb->register_function(r, "stream_manager",
                 "The stream manager API");
         set_stream_manager(ctx, r);
+        rb->register_function(r, "cql",
+                "The CQL API");
+        set_cql(ctx, r);
+        rb->register_function(r, "batchlog_manager",
+                "The batchlog manager API");
+        set_batchlog_manager(ctx, r);
     });
 }
 
@@ -172,6 +172,33 @@ future<json::json_return_type>  sum_histogram_stats(distributed<T>& d, utils::ih
     });
 }
 
+inline utils::decaying_histogram merge_decaying_histograms(utils::decaying_histogram a,
+        const utils::decaying_histogram& b) {
+    a.merge(b);
+    return a;
+}
+
+inline httpd::utils_json::latency_percentiles latency_percentiles(const utils::decaying_histogram& h) {
+    httpd::utils_json::latency_percentiles res;
+    res.count = h.count();
+    res.p50 = h.percentile(0.5);
+    res.p75 = h.percentile(0.75);
+    res.p95 = h.percentile(0.95);
+    res.p98 = h.percentile(0.98);
+    res.p99 = h.percentile(0.99);
+    res.p999 = h.percentile(0.999);
+    return res;
+}
+
+// Percentiles of the latencies of all shards, from the merge of their histograms
+template<class T, class F>
+future<json::json_return_type> sum_latency_percentiles(distributed<T>& d, utils::decaying_histogram F::*f) {
+    return d.map_reduce0([f](const T& p) {return p.get_stats().*f;}, utils::decaying_histogram(),
+            merge_decaying_histograms).then([](const utils::decaying_histogram& val) {
+        return make_ready_future<json::json_return_type>(latency_percentiles(val));
+    });
+}
+
 inline int64_t min_int64(int64_t a, int64_t b) {
     return std::min(a,b);
 }
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "api/batchlog_manager.hh"
+#include "api/api-doc/batchlog_manager.json.hh"
+#include "db/batchlog_manager.hh"
+
+namespace api {
+
+namespace bm = httpd::batchlog_manager_json;
+
+// Replay goes round-robin between the shards, each keeping the metrics of
+// the replays it ran.
+template<typename T, typename Func>
+static future<json::json_return_type> sum_batchlog(Func f) {
+    return db::get_batchlog_manager().map_reduce0([f] (db::batchlog_manager& bm) {
+        return T(f(bm));
+    }, T(0), std::plus<T>()).then([] (T v) {
+        return make_ready_future<json::json_return_type>(v);
+    });
+}
+
+void set_batchlog_manager(http_context& ctx, routes& r) {
+    bm::get_all_batches_count.set(r, [] (std::unique_ptr<request> req) {
+        return db::get_local_batchlog_manager().count_all_batches().then([] (size_t count) {
+            return make_ready_future<json::json_return_type>(uint64_t(count));
+        });
+    });
+
+    bm::force_batchlog_replay.set(r, [] (std::unique_ptr<request> req) {
+        return db::get_local_batchlog_manager().do_batch_log_replay().then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
+    bm::get_total_batches_replayed.set(r, [] (std::unique_ptr<request> req) {
+        return sum_batchlog<uint64_t>([] (const db::batchlog_manager& bm) {
+            return bm.get_total_batches_replayed();
+        });
+    });
+
+    bm::get_total_batches_failed.set(r, [] (std::unique_ptr<request> req) {
+        return sum_batchlog<uint64_t>([] (const db::batchlog_manager& bm) {
+            return bm.get_total_batches_failed();
+        });
+    });
+
+    bm::get_total_bytes_replayed.set(r, [] (std::unique_ptr<request> req) {
+        return sum_batchlog<uint64_t>([] (const db::batchlog_manager& bm) {
+            return bm.get_total_bytes_replayed();
+        });
+    });
+
+    bm::get_replaying.set(r, [] (std::unique_ptr<request> req) {
+        return db::get_batchlog_manager().map_reduce0([] (db::batchlog_manager& bm) {
+            return bm.is_replaying();
+        }, false, std::logical_or<bool>()).then([] (bool replaying) {
+            return make_ready_future<json::json_return_type>(replaying);
+        });
+    });
+
+    bm::get_replay_rate.set(r, [] (std::unique_ptr<request> req) {
+        return sum_batchlog<double>([] (const db::batchlog_manager& bm) {
+            return bm.get_replay_rate();
+        });
+    });
+}
+
+}
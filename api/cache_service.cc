@@ -22,36 +22,69 @@
 #include "cache_service.hh"
 #include "api/api-doc/cache_service.json.hh"
 #include "column_family.hh"
+#include "sstables/key_cache.hh"
+#include "db/saved_caches_manager.hh"
 
 namespace api {
 using namespace json;
 namespace cs = httpd::cache_service_json;
 
+// The key cache is shared by all column families of a shard.
+template<typename Func>
+static future<json::json_return_type> map_reduce_key_cache(http_context& ctx, Func f) {
+    return ctx.db.map_reduce0([f] (database&) {
+        return uint64_t(f(sstables::global_key_cache()));
+    }, uint64_t(0), std::plus<uint64_t>()).then([] (uint64_t res) {
+        return make_ready_future<json::json_return_type>(res);
+    });
+}
+
+using cache_type = db::saved_caches_manager::cache_type;
+
+static future<json::json_return_type> get_save_period(cache_type type) {
+    auto& m = db::get_saved_caches_manager().local();
+    return make_ready_future<json::json_return_type>(m.save_period(type).count());
+}
+
+static future<json::json_return_type> set_save_period(cache_type type, const sstring& param) {
+    auto period = std::chrono::seconds(boost::lexical_cast<uint32_t>(param));
+    return db::get_saved_caches_manager().invoke_on_all([type, period] (db::saved_caches_manager& m) {
+        m.set_save_period(type, period);
+    }).then([] {
+        return make_ready_future<json::json_return_type>(json_void());
+    });
+}
+
+static future<json::json_return_type> get_keys_to_save(cache_type type) {
+    auto& m = db::get_saved_caches_manager().local();
+    return make_ready_future<json::json_return_type>(m.keys_to_save(type));
+}
+
+static future<json::json_return_type> set_keys_to_save(cache_type type, const sstring& param) {
+    auto keys = boost::lexical_cast<uint32_t>(param);
+    return db::get_saved_caches_manager().invoke_on_all([type, keys] (db::saved_caches_manager& m) {
+        m.set_keys_to_save(type, keys);
+    }).then([] {
+        return make_ready_future<json::json_return_type>(json_void());
+    });
+}
+
 void set_cache_service(http_context& ctx, routes& r) {
+    // Origin uses 0 for never
     cs::get_row_cache_save_period_in_seconds.set(r, [](std::unique_ptr<request> req) {
-        // We never save the cache
-        // Origin uses 0 for never
-        return make_ready_future<json::json_return_type>(0);
+        return get_save_period(cache_type::row_cache);
     });
 
     cs::set_row_cache_save_period_in_seconds.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        auto period = req->get_query_param("period");
-        return make_ready_future<json::json_return_type>(json_void());
+        return set_save_period(cache_type::row_cache, req->get_query_param("period"));
     });
 
     cs::get_key_cache_save_period_in_seconds.set(r, [](std::unique_ptr<request> req) {
-        // We never save the cache
-        // Origin uses 0 for never
-        return make_ready_future<json::json_return_type>(0);
+        return get_save_period(cache_type::key_cache);
     });
 
     cs::set_key_cache_save_period_in_seconds.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        auto period = req->get_query_param("period");
-        return make_ready_future<json::json_return_type>(json_void());
+        return set_save_period(cache_type::key_cache, req->get_query_param("period"));
     });
 
     cs::get_counter_cache_save_period_in_seconds.set(r, [](std::unique_ptr<request> req) {
@@ -68,29 +101,19 @@ void set_cache_service(http_context& ctx, routes& r) {
     });
 
     cs::get_row_cache_keys_to_save.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+        return get_keys_to_save(cache_type::row_cache);
     });
 
     cs::set_row_cache_keys_to_save.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        auto rckts = req->get_query_param("rckts");
-        return make_ready_future<json::json_return_type>(json_void());
+        return set_keys_to_save(cache_type::row_cache, req->get_query_param("rckts"));
     });
 
     cs::get_key_cache_keys_to_save.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+        return get_keys_to_save(cache_type::key_cache);
     });
 
     cs::set_key_cache_keys_to_save.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        auto kckts = req->get_query_param("kckts");
-        return make_ready_future<json::json_return_type>(json_void());
+        return set_keys_to_save(cache_type::key_cache, req->get_query_param("kckts"));
     });
 
     cs::get_counter_cache_keys_to_save.set(r, [](std::unique_ptr<request> req) {
@@ -106,10 +129,12 @@ void set_cache_service(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(json_void());
     });
 
-    cs::invalidate_key_cache.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(json_void());
+    cs::invalidate_key_cache.set(r, [&ctx](std::unique_ptr<request> req) {
+        return ctx.db.invoke_on_all([] (database&) {
+            sstables::global_key_cache().clear();
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     cs::invalidate_counter_cache.set(r, [](std::unique_ptr<request> req) {
@@ -125,11 +150,13 @@ void set_cache_service(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(json_void());
     });
 
-    cs::set_key_cache_capacity_in_mb.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        auto period = req->get_query_param("period");
-        return make_ready_future<json::json_return_type>(json_void());
+    cs::set_key_cache_capacity_in_mb.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto capacity = boost::lexical_cast<uint64_t>(req->get_query_param("capacity"));
+        return ctx.db.invoke_on_all([capacity] (database&) {
+            sstables::global_key_cache().set_capacity((capacity << 20) / smp::count);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     cs::set_counter_cache_capacity_in_mb.set(r, [](std::unique_ptr<request> req) {
@@ -140,57 +167,48 @@ void set_cache_service(http_context& ctx, routes& r) {
     });
 
     cs::save_caches.set(r, [](std::unique_ptr<request> req) {
-        // TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(json_void());
+        return db::get_saved_caches_manager().invoke_on_all(&db::saved_caches_manager::save_all).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
-    cs::get_key_capacity.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for capacity is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_capacity.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return kc.capacity();
+        });
     });
 
-    cs::get_key_hits.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for hits is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_hits.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return kc.get_stats().hits;
+        });
     });
 
-    cs::get_key_requests.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for request is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_requests.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return kc.get_stats().hits + kc.get_stats().misses;
+        });
     });
 
-    cs::get_key_hit_rate.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for rate is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_hit_rate.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database&) {
+            auto& stats = sstables::global_key_cache().get_stats();
+            return ratio_holder(stats.hits + stats.misses, stats.hits);
+        }, ratio_holder(), std::plus<ratio_holder>()).then([] (const ratio_holder& res) {
+            return make_ready_future<json::json_return_type>(res);
+        });
     });
 
-    cs::get_key_size.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for size is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_size.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return kc.region().occupancy().used_space();
+        });
     });
 
-    cs::get_key_entries.set(r, [] (std::unique_ptr<request> req) {
-        // TBD
-        // FIXME
-        // we don't support keys cache,
-        // so currently returning a 0 for key entries is ok
-        return make_ready_future<json::json_return_type>(0);
+    cs::get_key_entries.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_key_cache(ctx, [] (const sstables::key_cache& kc) {
+            return kc.get_stats().entries;
+        });
     });
 
     cs::get_row_capacity.set(r, [&ctx] (std::unique_ptr<request> req) {
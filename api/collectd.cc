@@ -23,8 +23,11 @@
 #include "api/api-doc/collectd.json.hh"
 #include "core/scollectd.hh"
 #include "core/scollectd_api.hh"
+#include "http/function_handlers.hh"
 #include "endian.h"
 #include <boost/range/irange.hpp>
+#include <cctype>
+#include <sstream>
 
 namespace api {
 
@@ -49,6 +52,69 @@ static auto transformer(const std::vector<collectd_value>& values) {
     return collected_value;
 }
 
+// Metric names of the Prometheus text format: [a-zA-Z0-9_] only.
+static void write_metric_name(std::ostream& out, const std::string& name) {
+    for (auto c : name) {
+        out << (std::isalnum(static_cast<unsigned char>(c)) ? c : '_');
+    }
+}
+
+static void write_label(std::ostream& out, const char* label, const std::string& value) {
+    out << ',' << label << "=\"";
+    for (auto c : value) {
+        if (c == '\\' || c == '"') {
+            out << '\\' << c;
+        } else if (c == '\n') {
+            out << "\\n";
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+// All the metrics of this shard, in the Prometheus text format, a line per
+// value. Read in one pass, without leaving the shard.
+static sstring shard_metrics() {
+    std::ostringstream out;
+    auto shard = engine().cpu_id();
+    for (auto&& id : scollectd::get_collectd_ids()) {
+        auto values = scollectd::get_collectd_value(id);
+        for (size_t i = 0; i < values.size(); ++i) {
+            out << "scylla_";
+            write_metric_name(out, id.plugin());
+            out << '_';
+            write_metric_name(out, id.type());
+            out << "{shard=\"" << shard << '"';
+            if (!id.plugin_instance().empty()) {
+                write_label(out, "instance", id.plugin_instance());
+            }
+            if (!id.type_instance().empty()) {
+                write_label(out, "type_instance", id.type_instance());
+            }
+            if (values.size() > 1) {
+                out << ",index=\"" << i << '"';
+            }
+            out << "} ";
+            auto& v = values[i];
+            switch (v._type) {
+            case scollectd::data_type::GAUGE:
+                out << v.u._d;
+                break;
+            case scollectd::data_type::DERIVE:
+                out << v.u._i;
+                break;
+            default:
+                out << v.u._ui;
+                break;
+            }
+            out << '\n';
+        }
+    }
+    auto s = out.str();
+    return sstring(s.data(), s.size());
+}
+
 void set_collectd(http_context& ctx, routes& r) {
     cd::get_collectd.set(r, [&ctx](std::unique_ptr<request> req) {
 
@@ -84,6 +150,33 @@ void set_collectd(http_context& ctx, routes& r) {
         }
         return res;
     });
+
+    // All the metrics of all the shards at once, for scrapers, with a
+    // single request to each shard rather than one per metric. An exact
+    // path, so that it is matched before /collectd/{pluginid}.
+    r.put(GET, "/collectd/metrics", new function_handler([] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+        return do_with(std::vector<sstring>(smp::count), [rep = std::move(rep)] (auto& metrics) mutable {
+            return parallel_for_each(boost::irange(0u, smp::count), [&metrics] (auto cpu) {
+                return smp::submit_to(cpu, [] {
+                    return shard_metrics();
+                }).then([&metrics, cpu] (sstring m) {
+                    metrics[cpu] = std::move(m);
+                });
+            }).then([&metrics, rep = std::move(rep)] () mutable {
+                size_t size = 0;
+                for (auto&& m : metrics) {
+                    size += m.size();
+                }
+                sstring content(sstring::initialized_later(), size);
+                auto out = content.begin();
+                for (auto&& m : metrics) {
+                    out = std::copy(m.begin(), m.end(), out);
+                }
+                rep->_content = std::move(content);
+                return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+            });
+        });
+    }, "txt"));
 }
 
 }
@@ -26,6 +26,8 @@
 #include "sstables/sstables.hh"
 #include "sstables/estimated_histogram.hh"
 #include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include "core/sleep.hh"
 
 namespace api {
 using namespace httpd;
@@ -117,6 +119,17 @@ static future<json::json_return_type>  get_cf_histogram(http_context& ctx, const
     });
 }
 
+static future<json::json_return_type> get_cf_latency_percentiles(http_context& ctx, const sstring& name,
+        utils::decaying_histogram column_family::stats::*f) {
+    utils::UUID uuid = get_uuid(name, ctx.db.local());
+    return ctx.db.map_reduce0([f, uuid](const database& p) {return p.find_column_family(uuid).get_stats().*f;},
+            utils::decaying_histogram(),
+            merge_decaying_histograms)
+            .then([](const utils::decaying_histogram& val) {
+                return make_ready_future<json::json_return_type>(latency_percentiles(val));
+    });
+}
+
 static future<json::json_return_type> get_cf_histogram(http_context& ctx, utils::ihistogram column_family::stats::*f) {
     std::function<httpd::utils_json::histogram(const database&)> fun = [f] (const database& db)  {
         httpd::utils_json::histogram res;
@@ -130,6 +143,14 @@ static future<json::json_return_type> get_cf_histogram(http_context& ctx, utils:
     });
 }
 
+static future<json::json_return_type> get_flush_stats(http_context& ctx, uint64_t flush_scheduler::stats::*f) {
+    return ctx.db.map_reduce0([f](const database& db) {
+        return db.get_flush_scheduler().get_stats().*f;
+    }, uint64_t(0), std::plus<uint64_t>()).then([](uint64_t res) {
+        return make_ready_future<json::json_return_type>(res);
+    });
+}
+
 static future<json::json_return_type> get_cf_unleveled_sstables(http_context& ctx, const sstring& name) {
     return map_reduce_cf(ctx, name, 0, [](const column_family& cf) {
         return cf.get_unleveled_sstables();
@@ -337,6 +358,26 @@ void set_column_family(http_context& ctx, routes& r) {
         return get_cf_stats(ctx, &column_family::stats::pending_flushes);
     });
 
+    cf::get_flush_queue_depth.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_flush_stats(ctx, &flush_scheduler::stats::queued);
+    });
+
+    cf::get_running_flushes.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_flush_stats(ctx, &flush_scheduler::stats::running);
+    });
+
+    cf::get_flushed_bytes.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_flush_stats(ctx, &flush_scheduler::stats::bytes_flushed);
+    });
+
+    cf::get_flush_time.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([](database& db) {
+            return db.get_flush_scheduler().get_stats().flush_time_ns / 1000;
+        }, uint64_t(0), std::plus<uint64_t>()).then([](uint64_t res) {
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
     cf::get_read.set(r, [&ctx] (std::unique_ptr<request> req) {
         return get_cf_stats_count(ctx,req->param["name"] ,&column_family::stats::reads);
     });
@@ -537,20 +578,20 @@ void set_column_family(http_context& ctx, routes& r) {
         }, std::plus<uint64_t>());
     });
 
-    cf::get_index_summary_off_heap_memory_used.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        // FIXME
-        // We are missing the off heap memory calculation
-        // Return 0 is the wrong value. It's a work around
-        // until the memory calculation will be available
-        //auto id = get_uuid(req->param["name"], ctx.db.local());
-        return make_ready_future<json::json_return_type>(0);
+    cf::get_index_summary_off_heap_memory_used.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, req->param["name"], uint64_t(0), [] (column_family& cf) {
+            return std::accumulate(cf.get_sstables()->begin(), cf.get_sstables()->end(), uint64_t(0), [](uint64_t s, auto& sst) {
+                return s + sst.second->summary_memory();
+            });
+        }, std::plus<uint64_t>());
     });
 
-    cf::get_all_index_summary_off_heap_memory_used.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    cf::get_all_index_summary_off_heap_memory_used.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, uint64_t(0), [] (column_family& cf) {
+            return std::accumulate(cf.get_sstables()->begin(), cf.get_sstables()->end(), uint64_t(0), [](uint64_t s, auto& sst) {
+                return s + sst.second->summary_memory();
+            });
+        }, std::plus<uint64_t>());
     });
 
     cf::get_compression_metadata_off_heap_memory_used.set(r, [] (std::unique_ptr<request> req) {
@@ -669,18 +710,12 @@ void set_column_family(http_context& ctx, routes& r) {
         sstables::merge, utils_json::estimated_histogram());
     });
 
-    cf::get_tombstone_scanned_histogram.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        // FIXME
-        //auto id = get_uuid(req->param["name"], ctx.db.local());
-        httpd::utils_json::histogram res;
-        res.count = 0;
-        res.mean = 0;
-        res.max = 0;
-        res.min = 0;
-        res.sum = 0;
-        res.variance = 0;
-        return make_ready_future<json::json_return_type>(res);
+    cf::get_tombstone_scanned_histogram.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_histogram(ctx, req->param["name"], &column_family::stats::tombstones_scanned);
+    });
+
+    cf::get_read_admission_wait.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_cf_histogram(ctx, req->param["name"], &column_family::stats::read_admission_waits);
     });
 
     cf::get_live_scanned_histogram.set(r, [] (std::unique_ptr<request> req) {
@@ -755,6 +790,113 @@ void set_column_family(http_context& ctx, routes& r) {
         sstables::merge, utils_json::estimated_histogram());
     });
 
+    cf::get_read_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return get_cf_latency_percentiles(ctx, req->param["name"], &column_family::stats::read_latencies);
+    });
+
+    cf::get_write_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return get_cf_latency_percentiles(ctx, req->param["name"], &column_family::stats::write_latencies);
+    });
+
+    cf::get_read_bytes.set(r, [&ctx](std::unique_ptr<request> req) {
+        return get_cf_stats(ctx, req->param["name"], &column_family::stats::read_bytes);
+    });
+
+    cf::get_bytes_per_read_histogram.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return map_reduce_cf(ctx, req->param["name"], sstables::estimated_histogram(0), [](column_family& cf) {
+            return cf.get_stats().estimated_bytes_per_read;
+        },
+        sstables::merge, utils_json::estimated_histogram());
+    });
+
+    cf::get_per_shard_stats.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto uuid = get_uuid(req->param["name"], ctx.db.local());
+        std::function<cf::shard_stats(database&)> fun = [uuid] (database& db) {
+            auto& cf = db.find_column_family(uuid);
+            auto& stats = cf.get_stats();
+            cf::shard_stats res;
+            res.shard = engine().cpu_id();
+            res.reads = stats.reads.count;
+            res.writes = stats.writes.count;
+            res.pending_reads = stats.pending_reads;
+            res.read_bytes = stats.read_bytes;
+            res.sstables_per_read = stats.estimated_sstable_per_read.count() ? stats.estimated_sstable_per_read.mean() : 0;
+            res.live_sstable_count = stats.live_sstable_count;
+            res.live_disk_space_used = stats.live_disk_space_used;
+            res.memtable_live_data_size = cf.active_memtable().region().occupancy().used_space();
+            return res;
+        };
+        return ctx.db.map(fun).then([](const std::vector<cf::shard_stats>& res) {
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
+    cf::get_toppartitions.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto uuid = get_uuid(req->param["name"], ctx.db.local());
+        auto param = [&req] (const char* name, int64_t def) {
+            auto value = req->get_query_param(name);
+            if (value.empty()) {
+                return def;
+            }
+            int64_t res;
+            try {
+                res = boost::lexical_cast<int64_t>(value);
+            } catch (boost::bad_lexical_cast&) {
+                throw httpd::bad_param_exception(sprint("Invalid %s %s", name, value));
+            }
+            if (res < 0) {
+                throw httpd::bad_param_exception(sprint("%s %s is negative", name, value));
+            }
+            return res;
+        };
+        auto duration = std::chrono::milliseconds(param("duration", 0));
+        size_t capacity = param("capacity", 256);
+        size_t list_size = param("list_size", 10);
+        return ctx.db.invoke_on_all([uuid, capacity] (database& db) {
+            db.find_column_family(uuid).start_top_partitions_sampling(capacity);
+        }).then([duration] {
+            return sleep(duration);
+        }).then([&ctx, uuid, list_size] {
+            std::function<column_family::top_partitions(database&)> fun = [uuid, list_size] (database& db) {
+                return db.find_column_family(uuid).stop_top_partitions_sampling(list_size);
+            };
+            return ctx.db.map(fun);
+        }).then([list_size] (std::vector<column_family::top_partitions> shards) {
+            // A partition is only ever accessed on its shard, so the lists
+            // of the shards don't overlap.
+            auto merge = [list_size, &shards] (std::vector<column_family::top_partition> column_family::top_partitions::*list) {
+                std::vector<column_family::top_partition> all;
+                for (auto&& shard : shards) {
+                    auto& l = shard.*list;
+                    std::move(l.begin(), l.end(), std::back_inserter(all));
+                }
+                std::sort(all.begin(), all.end(), [] (auto& a, auto& b) {
+                    return a.count > b.count;
+                });
+                if (all.size() > list_size) {
+                    all.resize(list_size);
+                }
+                std::vector<cf::toppartitions_record> res;
+                for (auto&& p : all) {
+                    cf::toppartitions_record r;
+                    r.partition = p.key;
+                    r.count = p.count;
+                    r.error = p.error;
+                    res.push_back(std::move(r));
+                }
+                return res;
+            };
+            cf::toppartitions_result res;
+            for (auto&& r : merge(&column_family::top_partitions::reads)) {
+                res.read.push(r);
+            }
+            for (auto&& r : merge(&column_family::top_partitions::writes)) {
+                res.write.push(r);
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
     cf::set_compaction_strategy_class.set(r, [&ctx](std::unique_ptr<request> req) {
         sstring strategy = req->get_query_param("class_name");
         return foreach_column_family(ctx, req->param["name"], [strategy](column_family& cf) {
@@ -40,6 +40,18 @@ static auto acquire_cl_metric(http_context& ctx, Func&& func) {
     });
 }
 
+template<typename Func>
+static future<json::json_return_type> acquire_cl_histogram(http_context& ctx, Func&& func) {
+    return ctx.db.map_reduce0([func = std::forward<Func>(func)](database& db) {
+        if (db.commitlog() == nullptr) {
+            return utils::ihistogram();
+        }
+        return func(db.commitlog());
+    }, httpd::utils_json::histogram(), add_histogram).then([](const httpd::utils_json::histogram& res) {
+        return make_ready_future<json::json_return_type>(res);
+    });
+}
+
 void set_commitlog(http_context& ctx, routes& r) {
     httpd::commitlog_json::get_active_segment_names.set(r,
             [&ctx](std::unique_ptr<request> req) {
@@ -73,6 +85,18 @@ void set_commitlog(http_context& ctx, routes& r) {
     httpd::commitlog_json::get_total_commit_log_size.set(r, [&ctx](std::unique_ptr<request> req) {
         return acquire_cl_metric(ctx, std::bind(&db::commitlog::get_total_size, std::placeholders::_1));
     });
+
+    httpd::commitlog_json::get_batch_size.set(r, [&ctx](std::unique_ptr<request> req) {
+        return acquire_cl_histogram(ctx, [](db::commitlog* cl) {
+            return cl->get_batch_size_histogram();
+        });
+    });
+
+    httpd::commitlog_json::get_batch_sync_latency.set(r, [&ctx](std::unique_ptr<request> req) {
+        return acquire_cl_histogram(ctx, [](db::commitlog* cl) {
+            return cl->get_batch_sync_latency_histogram();
+        });
+    });
 }
 
 }
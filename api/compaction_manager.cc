@@ -21,6 +21,7 @@
 
 #include "compaction_manager.hh"
 #include "api/api-doc/compaction_manager.json.hh"
+#include <boost/range/adaptor/map.hpp>
 
 namespace api {
 
@@ -37,6 +38,21 @@ static future<json::json_return_type> get_cm_stats(http_context& ctx,
     });
 }
 
+struct resharding_progress {
+    int64_t pending_sstables = 0;
+    int64_t pending_bytes = 0;
+    int64_t resharded_sstables = 0;
+    int64_t resharded_bytes = 0;
+};
+
+static resharding_progress add_resharding_progress(resharding_progress a, const resharding_progress& b) {
+    a.pending_sstables += b.pending_sstables;
+    a.pending_bytes += b.pending_bytes;
+    a.resharded_sstables += b.resharded_sstables;
+    a.resharded_bytes += b.resharded_bytes;
+    return a;
+}
+
 void set_compaction_manager(http_context& ctx, routes& r) {
     cm::get_compactions.set(r, [] (std::unique_ptr<request> req) {
         //TBD
@@ -64,7 +80,55 @@ void set_compaction_manager(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>("");
     });
 
-    cm::get_pending_tasks.set(r, [&ctx] (std::unique_ptr<request> req) {
+    cm::get_compaction_throughput.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(ctx.db.local().compaction_throughput_mb_per_sec());
+    });
+
+    cm::set_compaction_throughput.set(r, [&ctx] (std::unique_ptr<request> req) {
+        auto value = boost::lexical_cast<uint32_t>(req->get_query_param("value"));
+        return ctx.db.invoke_on_all([value] (database& db) {
+            db.set_compaction_throughput_mb_per_sec(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
+    cm::is_adaptive_throttle_enabled.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(ctx.db.local().get_compaction_manager().throttle().adaptive());
+    });
+
+    cm::set_adaptive_throttle_enabled.set(r, [&ctx] (std::unique_ptr<request> req) {
+        auto val_str = req->get_query_param("value");
+        bool value = (val_str == "True") || (val_str == "true") || (val_str == "1");
+        return ctx.db.invoke_on_all([value] (database& db) {
+            db.get_compaction_manager().throttle().set_adaptive(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
+    cm::get_resharding_progress.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database& db) {
+            resharding_progress p;
+            for (auto&& cf : db.get_column_families() | boost::adaptors::map_values) {
+                auto shared = cf->shared_sstables();
+                p.pending_sstables += shared.first;
+                p.pending_bytes += shared.second;
+                p.resharded_sstables += cf->get_stats().resharded_sstables;
+                p.resharded_bytes += cf->get_stats().resharded_bytes;
+            }
+            return p;
+        }, resharding_progress(), add_resharding_progress).then([] (const resharding_progress& p) {
+            cm::resharding_progress res;
+            res.pending_sstables = p.pending_sstables;
+            res.pending_bytes = p.pending_bytes;
+            res.resharded_sstables = p.resharded_sstables;
+            res.resharded_bytes = p.resharded_bytes;
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
+        cm::get_pending_tasks.set(r, [&ctx] (std::unique_ptr<request> req) {
         return get_cm_stats(ctx, &compaction_manager::stats::pending_tasks);
     });
 
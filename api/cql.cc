@@ -0,0 +1,95 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "api/cql.hh"
+#include "api/api-doc/cql.json.hh"
+#include "cql3/query_processor.hh"
+
+namespace api {
+
+namespace cj = httpd::cql_json;
+
+template<typename Func>
+static future<json::json_return_type> sum_statements(Func f) {
+    return cql3::get_query_processor().map_reduce0([f] (cql3::query_processor& qp) {
+        return uint64_t(f(qp));
+    }, uint64_t(0), std::plus<uint64_t>()).then([] (uint64_t v) {
+        return make_ready_future<json::json_return_type>(v);
+    });
+}
+
+void set_cql(http_context& ctx, routes& r) {
+    cj::get_prepared_statements_count.set(r, [] (std::unique_ptr<request> req) {
+        return sum_statements([] (cql3::query_processor& qp) {
+            return qp.prepared_statements().count();
+        });
+    });
+
+    cj::get_prepared_statements_size.set(r, [] (std::unique_ptr<request> req) {
+        return sum_statements([] (cql3::query_processor& qp) {
+            return qp.prepared_statements().size();
+        });
+    });
+
+    cj::get_prepared_statements_evicted.set(r, [] (std::unique_ptr<request> req) {
+        return sum_statements([] (cql3::query_processor& qp) {
+            return qp.prepared_statements().get_stats().evictions;
+        });
+    });
+
+    cj::get_prepared_statements_not_found.set(r, [] (std::unique_ptr<request> req) {
+        return sum_statements([] (cql3::query_processor& qp) {
+            return qp.prepared_statements().get_stats().misses;
+        });
+    });
+
+    cj::get_unprepared_statements_count.set(r, [] (std::unique_ptr<request> req) {
+        return sum_statements([] (cql3::query_processor& qp) {
+            return qp.unprepared_statements().count();
+        });
+    });
+
+    cj::get_unprepared_statements_size.set(r, [] (std::unique_ptr<request> req) {
+        return sum_statements([] (cql3::query_processor& qp) {
+            return qp.unprepared_statements().size();
+        });
+    });
+
+    cj::get_unprepared_statements_evicted.set(r, [] (std::unique_ptr<request> req) {
+        return sum_statements([] (cql3::query_processor& qp) {
+            return qp.unprepared_statements().get_stats().evictions;
+        });
+    });
+
+    cj::get_unprepared_statements_hits.set(r, [] (std::unique_ptr<request> req) {
+        return sum_statements([] (cql3::query_processor& qp) {
+            return qp.unprepared_statements().get_stats().hits;
+        });
+    });
+
+    cj::get_unprepared_statements_misses.set(r, [] (std::unique_ptr<request> req) {
+        return sum_statements([] (cql3::query_processor& qp) {
+            return qp.unprepared_statements().get_stats().misses;
+        });
+    });
+}
+
+}
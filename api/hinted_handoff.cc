@@ -21,6 +21,10 @@
 
 #include "hinted_handoff.hh"
 #include "api/api-doc/hinted_handoff.json.hh"
+#include "service/storage_proxy.hh"
+#include "db/hints/manager.hh"
+#include <boost/lexical_cast.hpp>
+#include <set>
 
 namespace api {
 
@@ -28,47 +32,75 @@ using namespace scollectd;
 using namespace json;
 namespace hh = httpd::hinted_handoff_json;
 
+template<typename Func>
+static future<json::json_return_type> sum_hints(http_context& ctx, Func f) {
+    return ctx.sp.map_reduce0([f] (service::storage_proxy& p) {
+        return f(p.get_hints_manager());
+    }, uint64_t(0), std::plus<uint64_t>()).then([] (uint64_t v) {
+        return make_ready_future<json::json_return_type>(v);
+    });
+}
+
 void set_hinted_handoff(http_context& ctx, routes& r) {
-    hh::list_endpoints_pending_hints.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        std::vector<sstring> res;
-        return make_ready_future<json::json_return_type>(res);
+    hh::list_endpoints_pending_hints.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return ctx.sp.map_reduce0([] (service::storage_proxy& p) {
+            auto eps = p.get_hints_manager().endpoints_pending_hints();
+            return std::set<gms::inet_address>(eps.begin(), eps.end());
+        }, std::set<gms::inet_address>(), [] (std::set<gms::inet_address> a, const std::set<gms::inet_address>& b) {
+            a.insert(b.begin(), b.end());
+            return a;
+        }).then([] (std::set<gms::inet_address> eps) {
+            std::vector<sstring> res;
+            for (auto& ep : eps) {
+                res.push_back(boost::lexical_cast<std::string>(ep));
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
     });
 
-    hh::truncate_all_hints.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
+    hh::truncate_all_hints.set(r, [&ctx] (std::unique_ptr<request> req) {
         sstring host = req->get_query_param("host");
-        return make_ready_future<json::json_return_type>(json_void());
+        return ctx.sp.invoke_on_all([host] (service::storage_proxy& p) {
+            if (host.empty()) {
+                return p.get_hints_manager().truncate_all();
+            }
+            return p.get_hints_manager().truncate(gms::inet_address(host));
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
-    hh::schedule_hint_delivery.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        sstring host = req->get_query_param("host");
-        return make_ready_future<json::json_return_type>(json_void());
+    hh::schedule_hint_delivery.set(r, [&ctx] (std::unique_ptr<request> req) {
+        gms::inet_address host(req->get_query_param("host"));
+        return ctx.sp.invoke_on_all([host] (service::storage_proxy& p) {
+            p.get_hints_manager().schedule_delivery(host);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
-    hh::pause_hints_delivery.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        sstring pause = req->get_query_param("pause");
-        return make_ready_future<json::json_return_type>(json_void());
+    hh::pause_hints_delivery.set(r, [&ctx] (std::unique_ptr<request> req) {
+        sstring val_str = req->get_query_param("pause");
+        bool pause = (val_str == "True") || (val_str == "true") || (val_str == "1");
+        return ctx.sp.invoke_on_all([pause] (service::storage_proxy& p) {
+            p.get_hints_manager().pause_delivery(pause);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
-    hh::get_create_hint_count.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        sstring host = req->get_query_param("host");
-        return make_ready_future<json::json_return_type>(0);
+    hh::get_create_hint_count.set(r, [&ctx] (std::unique_ptr<request> req) {
+        gms::inet_address host(req->get_query_param("host"));
+        return sum_hints(ctx, [host] (const db::hints::manager& m) {
+            return m.written_hints(host);
+        });
     });
 
-    hh::get_not_stored_hints_count.set(r, [] (std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        sstring host = req->get_query_param("host");
-        return make_ready_future<json::json_return_type>(0);
+    hh::get_not_stored_hints_count.set(r, [&ctx] (std::unique_ptr<request> req) {
+        gms::inet_address host(req->get_query_param("host"));
+        return sum_hints(ctx, [host] (const db::hints::manager& m) {
+            return m.dropped_hints(host);
+        });
     });
 }
 
@@ -20,17 +20,53 @@
  */
 
 #include "api/api-doc/lsa.json.hh"
+#include "api/api-doc/utils.json.hh"
 #include "api/lsa.hh"
 #include "api/api.hh"
 
 #include "http/exception.hh"
 #include "utils/logalloc.hh"
+#include "row_cache.hh"
+#include "service/storage_proxy.hh"
+#include "cql3/query_processor.hh"
 #include "log.hh"
 
 namespace api {
 
 static logging::logger logger("lsa-api");
 
+namespace lj = httpd::lsa_json;
+
+// Most of the values are kept up to date by their subsystems as they
+// allocate and free; those of the sstables are summed over them.
+static lj::memory_usage shard_memory_usage(database& db) {
+    lj::memory_usage m;
+    auto stats = memory::stats();
+    auto lsa = logalloc::shard_tracker().occupancy();
+    m.shard = engine().cpu_id();
+    m.total = stats.total_memory();
+    m.free = stats.free_memory();
+    m.memtables = db.dirty_memory_region_group().memory_used();
+    m.row_cache = global_cache_tracker().region().occupancy().total_space();
+    m.row_cache_compression_saving = global_cache_tracker().compression_saving();
+    m.lsa_free = lsa.free_space();
+    m.non_lsa = stats.allocated_memory() - lsa.total_space();
+    uint64_t summaries = 0;
+    uint64_t filters = 0;
+    for (auto&& cf : db.get_column_families()) {
+        for (auto&& sst : *cf.second->get_sstables()) {
+            summaries += sst.second->summary_memory();
+            filters += sst.second->filter_memory_size();
+        }
+    }
+    m.sstable_summaries = summaries;
+    m.bloom_filters = filters;
+    auto& qp = cql3::get_local_query_processor();
+    m.prepared_statements = qp.prepared_statements().size() + qp.unprepared_statements().size();
+    m.write_bytes_in_flight = service::get_local_storage_proxy().get_stats().write_bytes_in_flight;
+    return m;
+}
+
 void set_lsa(http_context& ctx, routes& r) {
     httpd::lsa_json::lsa_compact.set(r, [&ctx](std::unique_ptr<request> req) {
         logger.info("Triggering compaction");
@@ -40,6 +76,33 @@ void set_lsa(http_context& ctx, routes& r) {
             return json::json_return_type(json::json_void());
         });
     });
+
+    httpd::lsa_json::get_reclaim_latency_histogram.set(r, [&ctx](std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database&) {
+            return logalloc::shard_tracker().reclaim_histogram();
+        }, httpd::utils_json::histogram(), add_histogram).then([] (const httpd::utils_json::histogram& val) {
+            return make_ready_future<json::json_return_type>(val);
+        });
+    });
+
+    httpd::lsa_json::get_background_reclaim_latency_histogram.set(r, [&ctx](std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database&) {
+            return logalloc::shard_tracker().background_reclaim_histogram();
+        }, httpd::utils_json::histogram(), add_histogram).then([] (const httpd::utils_json::histogram& val) {
+            return make_ready_future<json::json_return_type>(val);
+        });
+    });
+
+    lj::get_memory_usage.set(r, [&ctx](std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([] (database& db) {
+            return std::vector<lj::memory_usage>{shard_memory_usage(db)};
+        }, std::vector<lj::memory_usage>(), [] (std::vector<lj::memory_usage> a, std::vector<lj::memory_usage> b) {
+            std::move(b.begin(), b.end(), std::back_inserter(a));
+            return a;
+        }).then([] (std::vector<lj::memory_usage> res) {
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
 }
 
 }
@@ -53,14 +53,34 @@ std::vector<message_counter> map_to_message_counters(
  * according to a function that it gets as a parameter.
  *
  */
+static std::experimental::optional<connection_class> get_connection_class(const request& req) {
+    auto name = req.get_query_param("connection_class");
+    if (name.empty()) {
+        return {};
+    }
+    for (unsigned c = 0; c < static_cast<unsigned>(connection_class::LAST); ++c) {
+        auto cls = static_cast<connection_class>(c);
+        if (boost::lexical_cast<sstring>(cls) == name) {
+            return cls;
+        }
+    }
+    throw bad_param_exception("Unknown connection class " + name);
+}
+
 future_json_function get_client_getter(std::function<uint64_t(const shard_info&)> f) {
     return [f](std::unique_ptr<request> req) {
         using map_type = std::unordered_map<gms::inet_address, uint64_t>;
-        auto get_shard_map = [f](messaging_service& ms) {
+        auto cls = get_connection_class(*req);
+        auto get_shard_map = [f, cls](messaging_service& ms) {
             std::unordered_map<gms::inet_address, unsigned long> map;
-            ms.foreach_client([&map, f] (const shard_id& id, const shard_info& info) {
-                map[id.addr] = f(info);
-            });
+            auto add = [&map, f] (const shard_id& id, const shard_info& info) {
+                map[id.addr] += f(info);
+            };
+            if (cls) {
+                ms.foreach_client(*cls, add);
+            } else {
+                ms.foreach_client(add);
+            }
             return map;
         };
         return  get_messaging_service().map_reduce0(get_shard_map, map_type(), map_sum<map_type>).
@@ -88,6 +108,30 @@ void set_messaging_service(http_context& ctx, routes& r) {
         return c.get_stats().wait_reply;
     }));
 
+    get_compression_stats.set(r, [](std::unique_ptr<request> req) {
+        using map_type = std::unordered_map<gms::inet_address, payload_compression_stats>;
+        return get_messaging_service().map_reduce0([](messaging_service& ms) {
+            return ms.get_compression_stats();
+        }, map_type(), [](map_type a, const map_type& b) {
+            for (auto&& e : b) {
+                a[e.first].uncompressed_bytes += e.second.uncompressed_bytes;
+                a[e.first].compressed_bytes += e.second.compressed_bytes;
+            }
+            return a;
+        }).then([](map_type&& map) {
+            std::vector<compression_counter> res;
+            for (auto&& e : map) {
+                compression_counter c;
+                c.ip = boost::lexical_cast<sstring>(e.first);
+                c.uncompressed = e.second.uncompressed_bytes;
+                c.compressed = e.second.compressed_bytes;
+                c.ratio = e.second.uncompressed_bytes ? double(e.second.compressed_bytes) / e.second.uncompressed_bytes : 1.0;
+                res.push_back(c);
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
     get_dropped_messages.set(r, [](std::unique_ptr<request> req) {
         shared_ptr<std::vector<uint64_t>> map = make_shared<std::vector<uint64_t>>(num_verb, 0);
 
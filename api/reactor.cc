@@ -0,0 +1,98 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "api/api-doc/reactor.json.hh"
+#include "api/reactor.hh"
+#include "api/api.hh"
+
+#include "http/exception.hh"
+#include "utils/stall_detector.hh"
+
+namespace api {
+
+namespace rj = httpd::reactor_json;
+
+void set_reactor(http_context& ctx, routes& r) {
+    rj::get_stalls.set(r, [](std::unique_ptr<request> req) {
+        return utils::get_stall_detector().map_reduce0([] (utils::stall_detector& sd) {
+            std::vector<rj::stall_site> res;
+            auto ms = [] (utils::stall_detector::clock::duration d) {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+            };
+            for (auto&& s : sd.sites()) {
+                rj::stall_site site;
+                site.shard = engine().cpu_id();
+                site.backtrace = s.first;
+                site.count = s.second.count;
+                site.total = ms(s.second.total);
+                site.max = ms(s.second.max);
+                res.push_back(std::move(site));
+            }
+            return res;
+        }, std::vector<rj::stall_site>(), [] (std::vector<rj::stall_site> a, std::vector<rj::stall_site> b) {
+            std::move(b.begin(), b.end(), std::back_inserter(a));
+            return a;
+        }).then([] (std::vector<rj::stall_site> res) {
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
+    rj::reset_stalls.set(r, [](std::unique_ptr<request> req) {
+        return utils::get_stall_detector().invoke_on_all([] (utils::stall_detector& sd) {
+            sd.reset();
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json::json_void());
+        });
+    });
+
+    rj::get_stall_count.set(r, [](std::unique_ptr<request> req) {
+        return utils::get_stall_detector().map_reduce0([] (utils::stall_detector& sd) {
+            return sd.get_stats().stalls;
+        }, uint64_t(0), std::plus<uint64_t>()).then([] (uint64_t count) {
+            return make_ready_future<json::json_return_type>(count);
+        });
+    });
+
+    rj::get_stall_threshold.set(r, [](std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(utils::get_stall_detector().local().get_threshold().count());
+    });
+
+    rj::set_stall_threshold.set(r, [](std::unique_ptr<request> req) {
+        auto threshold = req->get_query_param("threshold");
+        int64_t ms;
+        try {
+            ms = boost::lexical_cast<int64_t>(threshold);
+        } catch (boost::bad_lexical_cast&) {
+            throw httpd::bad_param_exception(sprint("Invalid threshold %s", threshold));
+        }
+        if (ms < 0) {
+            throw httpd::bad_param_exception(sprint("Threshold %s is negative", threshold));
+        }
+        return utils::get_stall_detector().invoke_on_all([ms] (utils::stall_detector& sd) {
+            sd.set_threshold(std::chrono::milliseconds(ms));
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json::json_void());
+        });
+    });
+}
+
+}
@@ -21,6 +21,8 @@
 
 #include "storage_proxy.hh"
 #include "service/storage_proxy.hh"
+#include "db/hints/manager.hh"
+#include "db/config.hh"
 #include "api/api-doc/storage_proxy.json.hh"
 #include "api/api-doc/utils.json.hh"
 
@@ -31,16 +33,16 @@ using proxy = service::storage_proxy;
 using namespace json;
 
 void set_storage_proxy(http_context& ctx, routes& r) {
-    sp::get_total_hints.set(r, [](std::unique_ptr<request> req)  {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    sp::get_total_hints.set(r, [&ctx](std::unique_ptr<request> req)  {
+        return ctx.sp.map_reduce0([](proxy& p) {
+            return p.get_hints_manager().get_stats().written;
+        }, uint64_t(0), std::plus<uint64_t>()).then([](uint64_t val) {
+            return make_ready_future<json::json_return_type>(val);
+        });
     });
 
-    sp::get_hinted_handoff_enabled.set(r, [](std::unique_ptr<request> req)  {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(false);
+    sp::get_hinted_handoff_enabled.set(r, [&ctx](std::unique_ptr<request> req)  {
+        return make_ready_future<json::json_return_type>(ctx.db.local().get_config().hinted_handoff_enabled());
     });
 
     sp::set_hinted_handoff_enabled.set(r, [](std::unique_ptr<request> req)  {
@@ -192,22 +194,16 @@ void set_storage_proxy(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(json_void());
     });
 
-    sp::get_read_repair_attempted.set(r, [](std::unique_ptr<request> req)  {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    sp::get_read_repair_attempted.set(r, [&ctx](std::unique_ptr<request> req)  {
+        return sum_stats(ctx.sp, &proxy::stats::read_repair_attempted);
     });
 
-    sp::get_read_repair_repaired_blocking.set(r, [](std::unique_ptr<request> req)  {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    sp::get_read_repair_repaired_blocking.set(r, [&ctx](std::unique_ptr<request> req)  {
+        return sum_stats(ctx.sp, &proxy::stats::read_repair_repaired_blocking);
     });
 
-    sp::get_read_repair_repaired_background.set(r, [](std::unique_ptr<request> req)  {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    sp::get_read_repair_repaired_background.set(r, [&ctx](std::unique_ptr<request> req)  {
+        return sum_stats(ctx.sp, &proxy::stats::read_repair_repaired_background);
     });
 
     sp::get_schema_versions.set(r, [](std::unique_ptr<request> req)  {
@@ -316,6 +312,18 @@ void set_storage_proxy(http_context& ctx, routes& r) {
     sp::get_read_metrics_latency_histogram.set(r, [&ctx](std::unique_ptr<request> req) {
         return sum_histogram_stats(ctx.sp, &proxy::stats::read);
     });
+
+    sp::get_read_metrics_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return sum_latency_percentiles(ctx.sp, &proxy::stats::read_latencies);
+    });
+
+    sp::get_write_metrics_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return sum_latency_percentiles(ctx.sp, &proxy::stats::write_latencies);
+    });
+
+    sp::get_range_metrics_latency_percentiles.set(r, [&ctx](std::unique_ptr<request> req) {
+        return sum_latency_percentiles(ctx.sp, &proxy::stats::range_latencies);
+    });
 }
 
 }
@@ -28,10 +28,13 @@
 #include <db/system_keyspace.hh>
 #include "http/exception.hh"
 #include "repair/repair.hh"
+#include "streaming/stream_manager.hh"
+#include "streaming/sstable_loader.hh"
 #include "locator/snitch_base.hh"
 #include "column_family.hh"
 #include <unordered_map>
 #include "utils/fb_utilities.hh"
+#include "tracing/tracing.hh"
 
 namespace api {
 
@@ -218,6 +221,31 @@ void set_storage_service(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(0);
     });
 
+    ss::get_snapshot_diff.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto keyspace = validate_keyspace(ctx, req->param);
+        auto column_families = split_cf(req->get_query_param("cf"));
+        if (column_families.empty()) {
+            column_families = map_keys(ctx.db.local().find_keyspace(keyspace).metadata().get()->cf_meta_data());
+        }
+        auto from = req->get_query_param("from");
+        auto to = req->get_query_param("to");
+        if (to.empty()) {
+            throw httpd::bad_param_exception("A snapshot to list the files of must be given");
+        }
+        // The shards snapshot their sstables into the same directories, so
+        // any of them sees all the files.
+        return do_with(std::move(column_families), [&ctx, keyspace, from, to] (std::vector<sstring>& column_families) {
+            return map_reduce(column_families.begin(), column_families.end(), [&ctx, keyspace, from, to] (const sstring& cf) {
+                return ctx.db.local().find_column_family(keyspace, cf).snapshot_diff(from, to);
+            }, std::vector<sstring>(), [] (std::vector<sstring> res, std::vector<sstring> files) {
+                std::move(files.begin(), files.end(), std::back_inserter(res));
+                return res;
+            }).then([] (std::vector<sstring> res) {
+                return make_ready_future<json::json_return_type>(res);
+            });
+        });
+    });
+
     ss::force_keyspace_compaction.set(r, [&ctx](std::unique_ptr<request> req) {
         auto keyspace = validate_keyspace(ctx, req->param);
         auto column_families = split_cf(req->get_query_param("cf"));
@@ -238,11 +266,25 @@ void set_storage_service(http_context& ctx, routes& r) {
     });
 
     ss::force_keyspace_cleanup.set(r, [&ctx](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
         auto keyspace = validate_keyspace(ctx, req->param);
-        auto column_family = req->get_query_param("cf");
-        return make_ready_future<json::json_return_type>(json_void());
+        auto column_families = split_cf(req->get_query_param("cf"));
+        if (column_families.empty()) {
+            column_families = map_keys(ctx.db.local().find_keyspace(keyspace).metadata().get()->cf_meta_data());
+        }
+        // Each shard cleans its own sstables up.
+        return ctx.db.invoke_on_all([keyspace, column_families] (database& db) {
+            auto& rs = db.find_keyspace(keyspace).get_replication_strategy();
+            auto owned_ranges = rs.get_ranges(utils::fb_utilities::get_broadcast_address());
+            std::vector<column_family*> column_families_vec;
+            for (auto cf : column_families) {
+                column_families_vec.push_back(&db.find_column_family(keyspace, cf));
+            }
+            return parallel_for_each(column_families_vec, [owned_ranges] (column_family* cf) {
+                return cf->cleanup_sstables(owned_ranges);
+            });
+        }).then([]{
+            return make_ready_future<json::json_return_type>(0);
+        });
     });
 
     ss::scrub.set(r, [&ctx](std::unique_ptr<request> req) {
@@ -318,6 +360,24 @@ void set_storage_service(http_context& ctx, routes& r) {
         });
     });
 
+    ss::repair_async_progress.set(r, [&ctx](std::unique_ptr<request> req) {
+        return repair_get_progress(ctx.db, boost::lexical_cast<int>( req->get_query_param("id")))
+                .then_wrapped([] (future<repair_progress>&& fut) {
+            ss::repair_progress res;
+            try {
+                auto p = fut.get0();
+                res.ranges = p.ranges;
+                res.ranges_done = p.ranges_done;
+                res.ranges_failed = p.ranges_failed;
+                res.rows_sent = p.rows_sent;
+                res.rows_received = p.rows_received;
+            } catch(std::runtime_error& e) {
+                return make_ready_future<json::json_return_type>(json_exception(httpd::bad_param_exception(e.what())));
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
     ss::force_terminate_all_repair_sessions.set(r, [](std::unique_ptr<request> req) {
         //TBD
         unimplemented();
@@ -489,29 +549,29 @@ void set_storage_service(http_context& ctx, routes& r) {
     });
 
     ss::set_stream_throughput_mb_per_sec.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        auto value = req->get_query_param("value");
-        return make_ready_future<json::json_return_type>(json_void());
+        auto value = boost::lexical_cast<uint32_t>(req->get_query_param("value"));
+        return streaming::get_stream_manager().invoke_on_all([value] (streaming::stream_manager& sm) {
+            sm.set_throughput_mbits_per_sec(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     ss::get_stream_throughput_mb_per_sec.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+        return make_ready_future<json::json_return_type>(streaming::get_local_stream_manager().throughput_mbits_per_sec());
     });
 
-    ss::get_compaction_throughput_mb_per_sec.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    ss::get_compaction_throughput_mb_per_sec.set(r, [&ctx](std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(ctx.db.local().compaction_throughput_mb_per_sec());
     });
 
-    ss::set_compaction_throughput_mb_per_sec.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        auto value = req->get_query_param("value");
-        return make_ready_future<json::json_return_type>(json_void());
+    ss::set_compaction_throughput_mb_per_sec.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto value = boost::lexical_cast<uint32_t>(req->get_query_param("value"));
+        return ctx.db.invoke_on_all([value] (database& db) {
+            db.set_compaction_throughput_mb_per_sec(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     ss::is_incremental_backups_enabled.set(r, [](std::unique_ptr<request> req) {
@@ -584,6 +644,18 @@ void set_storage_service(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(json_void());
     });
 
+    ss::load_and_stream.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto keyspace = validate_keyspace(ctx, req->param);
+        auto column_family = req->get_query_param("cf");
+        auto dir = req->get_query_param("dir");
+        if (!ctx.db.local().has_schema(keyspace, column_family)) {
+            throw httpd::bad_param_exception("Column family " + column_family + " does not exist in keyspace " + keyspace);
+        }
+        return streaming::load_and_stream(ctx.db, keyspace, column_family, dir).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
     ss::sample_key_range.set(r, [](std::unique_ptr<request> req) {
         //TBD
         unimplemented();
@@ -598,16 +670,88 @@ void set_storage_service(http_context& ctx, routes& r) {
     });
 
     ss::set_trace_probability.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
         auto probability = req->get_query_param("probability");
-        return make_ready_future<json::json_return_type>(json_void());
+        double p;
+        try {
+            p = boost::lexical_cast<double>(probability);
+        } catch (boost::bad_lexical_cast&) {
+            throw httpd::bad_param_exception(sprint("Invalid probability %s", probability));
+        }
+        if (p < 0 || p > 1) {
+            throw httpd::bad_param_exception(sprint("Probability %s is not between 0 and 1", probability));
+        }
+        return tracing::get_tracing().invoke_on_all([p] (tracing::tracing& t) {
+            t.set_trace_probability(p);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     ss::get_trace_probability.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+        return make_ready_future<json::json_return_type>(tracing::get_tracing().local().get_trace_probability());
+    });
+
+    ss::set_slow_query.set(r, [](std::unique_ptr<request> req) {
+        auto threshold = req->get_query_param("threshold");
+        int64_t ms;
+        try {
+            ms = boost::lexical_cast<int64_t>(threshold);
+        } catch (boost::bad_lexical_cast&) {
+            throw httpd::bad_param_exception(sprint("Invalid threshold %s", threshold));
+        }
+        if (ms < 0) {
+            throw httpd::bad_param_exception(sprint("Threshold %s is negative", threshold));
+        }
+        return tracing::get_tracing().invoke_on_all([ms] (tracing::tracing& t) {
+            t.set_slow_query_threshold(std::chrono::milliseconds(ms));
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
+    ss::get_slow_query.set(r, [](std::unique_ptr<request> req) {
+        auto threshold = tracing::get_tracing().local().get_slow_query_threshold();
+        return make_ready_future<json::json_return_type>(std::chrono::duration_cast<std::chrono::milliseconds>(threshold).count());
+    });
+
+    ss::get_slow_query_log.set(r, [](std::unique_ptr<request> req) {
+        using record = tracing::tracing::slow_query_record;
+        return tracing::get_tracing().map_reduce0([] (tracing::tracing& t) {
+            return std::vector<record>(t.slow_queries().begin(), t.slow_queries().end());
+        }, std::vector<record>(), [] (std::vector<record> a, std::vector<record> b) {
+            std::move(b.begin(), b.end(), std::back_inserter(a));
+            return a;
+        }).then([] (std::vector<record> records) {
+            std::sort(records.begin(), records.end(), [] (const record& a, const record& b) {
+                return a.started_at < b.started_at;
+            });
+            auto to_mapper = [] (auto&& key, auto&& value) {
+                ss::mapper m;
+                m.key = boost::lexical_cast<std::string>(key);
+                m.value = boost::lexical_cast<std::string>(value);
+                return m;
+            };
+            std::vector<ss::slow_query> res;
+            for (auto&& r : records) {
+                ss::slow_query q;
+                q.id = r.id.to_sstring();
+                q.session_id = r.session_id ? r.session_id->to_sstring() : sstring();
+                q.request = r.request;
+                q.started_at = std::chrono::duration_cast<std::chrono::milliseconds>(r.started_at.time_since_epoch()).count();
+                q.duration = r.duration;
+                for (auto&& p : r.params) {
+                    q.parameters.push(to_mapper(p.first, p.second));
+                }
+                for (size_t i = 0; i < tracing::stage_count; ++i) {
+                    q.stage_durations.push(to_mapper(tracing::stage_name(tracing::stage(i)), r.stage_times[i]));
+                }
+                for (auto&& rt : r.replica_times) {
+                    q.replica_durations.push(to_mapper(rt.first, rt.second));
+                }
+                res.push_back(std::move(q));
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
     });
 
     ss::enable_auto_compaction.set(r, [&ctx](std::unique_ptr<request> req) {
@@ -645,30 +789,30 @@ void set_storage_service(http_context& ctx, routes& r) {
         return make_ready_future<json::json_return_type>(json_void());
     });
 
-    ss::get_tombstone_warn_threshold.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    ss::get_tombstone_warn_threshold.set(r, [&ctx](std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(ctx.db.local().get_tombstone_thresholds().warn);
     });
 
-    ss::set_tombstone_warn_threshold.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        auto debug_threshold = req->get_query_param("debug_threshold");
-        return make_ready_future<json::json_return_type>(json_void());
+    ss::set_tombstone_warn_threshold.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto value = boost::lexical_cast<uint32_t>(req->get_query_param("debug_threshold"));
+        return ctx.db.invoke_on_all([value] (database& db) {
+            db.set_tombstone_warn_threshold(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
-    ss::get_tombstone_failure_threshold.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        return make_ready_future<json::json_return_type>(0);
+    ss::get_tombstone_failure_threshold.set(r, [&ctx](std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(ctx.db.local().get_tombstone_thresholds().failure);
     });
 
-    ss::set_tombstone_failure_threshold.set(r, [](std::unique_ptr<request> req) {
-        //TBD
-        unimplemented();
-        auto debug_threshold = req->get_query_param("debug_threshold");
-        return make_ready_future<json::json_return_type>(json_void());
+    ss::set_tombstone_failure_threshold.set(r, [&ctx](std::unique_ptr<request> req) {
+        auto value = boost::lexical_cast<uint32_t>(req->get_query_param("debug_threshold"));
+        return ctx.db.invoke_on_all([value] (database& db) {
+            db.set_tombstone_failure_threshold(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
     });
 
     ss::get_batch_size_failure_threshold.set(r, [](std::unique_ptr<request> req) {
@@ -97,6 +97,58 @@ void set_stream_manager(http_context& ctx, routes& r) {
                     return make_ready_future<json::json_return_type>(res);
                 });
             });
+
+    hs::get_peer_throughput.set(r, [] (std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(streaming::get_local_stream_manager().peer_throughput_mbits_per_sec());
+    });
+
+    hs::set_peer_throughput.set(r, [] (std::unique_ptr<request> req) {
+        auto value = boost::lexical_cast<uint32_t>(req->get_query_param("value"));
+        return streaming::get_stream_manager().invoke_on_all([value] (streaming::stream_manager& sm) {
+            sm.set_peer_throughput_mbits_per_sec(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
+    hs::get_inter_dc_throughput.set(r, [] (std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(streaming::get_local_stream_manager().inter_dc_throughput_mbits_per_sec());
+    });
+
+    hs::set_inter_dc_throughput.set(r, [] (std::unique_ptr<request> req) {
+        auto value = boost::lexical_cast<uint32_t>(req->get_query_param("value"));
+        return streaming::get_stream_manager().invoke_on_all([value] (streaming::stream_manager& sm) {
+            sm.set_inter_dc_throughput_mbits_per_sec(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
+    hs::get_inbound_throughput.set(r, [] (std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(streaming::get_local_stream_manager().inbound_throughput_mbits_per_sec());
+    });
+
+    hs::set_inbound_throughput.set(r, [] (std::unique_ptr<request> req) {
+        auto value = boost::lexical_cast<uint32_t>(req->get_query_param("value"));
+        return streaming::get_stream_manager().invoke_on_all([value] (streaming::stream_manager& sm) {
+            sm.set_inbound_throughput_mbits_per_sec(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
+
+    hs::get_load_throughput.set(r, [] (std::unique_ptr<request> req) {
+        return make_ready_future<json::json_return_type>(streaming::get_local_stream_manager().load_throughput_mbits_per_sec());
+    });
+
+    hs::set_load_throughput.set(r, [] (std::unique_ptr<request> req) {
+        auto value = boost::lexical_cast<uint32_t>(req->get_query_param("value"));
+        return streaming::get_stream_manager().invoke_on_all([value] (streaming::stream_manager& sm) {
+            sm.set_load_throughput_mbits_per_sec(value);
+        }).then([] {
+            return make_ready_future<json::json_return_type>(json_void());
+        });
+    });
 }
 
 }
@@ -51,12 +51,19 @@ class atomic_cell_or_collection;
  *
  *  <live>  := <int8_t:flags><int64_t:timestamp>(<int32_t:expiry><int32_t:ttl>)?<value>
  *  <dead>  := <int8_t:    0><int64_t:timestamp><int32_t:deletion_time>
+ *
+ * The value of a counter update is <int64_t:delta>, see counters.hh.
+ *
+ * The value of a compressed cell, which only the row cache holds, is
+ * <int32_t:uncompressed size><LZ4 block>.
  */
 class atomic_cell_type final {
 private:
     static constexpr int8_t DEAD_FLAGS = 0;
     static constexpr int8_t LIVE_FLAG = 0x01;
     static constexpr int8_t EXPIRY_FLAG = 0x02; // When present, expiry field is present. Set only for live cells
+    static constexpr int8_t COUNTER_UPDATE_FLAG = 0x04; // Set only for live cells of counter columns, never with EXPIRY_FLAG
+    static constexpr int8_t COMPRESSED_FLAG = 0x08; // Set only for live cells in the row cache, never with COUNTER_UPDATE_FLAG
     static constexpr unsigned flags_size = 1;
     static constexpr unsigned timestamp_offset = flags_size;
     static constexpr unsigned timestamp_size = 8;
@@ -76,6 +83,12 @@ class atomic_cell_type final {
     static bool is_dead(const bytes_view& cell) {
         return cell[0] == DEAD_FLAGS;
     }
+    static bool is_counter_update(const bytes_view& cell) {
+        return cell[0] & COUNTER_UPDATE_FLAG;
+    }
+    static bool is_compressed(const bytes_view& cell) {
+        return cell[0] & COMPRESSED_FLAG;
+    }
     // Can be called on live and dead cells
     static api::timestamp_type timestamp(const bytes_view& cell) {
         return get_field<api::timestamp_type>(cell, timestamp_offset);
@@ -119,6 +132,14 @@ class atomic_cell_type final {
         std::copy_n(value.begin(), value.size(), b.begin() + value_offset);
         return b;
     }
+    static managed_bytes make_live_counter_update(api::timestamp_type timestamp, int64_t delta) {
+        auto value_offset = flags_size + timestamp_size;
+        managed_bytes b(managed_bytes::initialized_later(), value_offset + sizeof(delta));
+        b[0] = LIVE_FLAG | COUNTER_UPDATE_FLAG;
+        set_field(b, timestamp_offset, timestamp);
+        set_field(b, value_offset, delta);
+        return b;
+    }
     static managed_bytes make_live(api::timestamp_type timestamp, bytes_view value, gc_clock::time_point expiry, gc_clock::duration ttl) {
         auto value_offset = flags_size + timestamp_size + expiry_size + ttl_size;
         managed_bytes b(managed_bytes::initialized_later(), value_offset + value.size());
@@ -129,6 +150,16 @@ class atomic_cell_type final {
         std::copy_n(value.begin(), value.size(), b.begin() + value_offset);
         return b;
     }
+    // Can be called on live cells only
+    static managed_bytes with_value(bytes_view cell, bytes_view value, bool compressed) {
+        auto expiry_field_size = bool(cell[0] & EXPIRY_FLAG) * (expiry_size + ttl_size);
+        auto value_offset = flags_size + timestamp_size + expiry_field_size;
+        managed_bytes b(managed_bytes::initialized_later(), value_offset + value.size());
+        std::copy_n(cell.begin(), value_offset, b.begin());
+        b[0] = compressed ? (cell[0] | COMPRESSED_FLAG) : (cell[0] & ~COMPRESSED_FLAG);
+        std::copy_n(value.begin(), value.size(), b.begin() + value_offset);
+        return b;
+    }
     template<typename ByteContainer>
     friend class atomic_cell_base;
     friend class atomic_cell;
@@ -154,6 +185,18 @@ class atomic_cell_base {
     bool is_live_and_has_ttl() const {
         return atomic_cell_type::is_live_and_has_ttl(_data);
     }
+    // Can be called on live and dead cells
+    bool is_counter_update() const {
+        return atomic_cell_type::is_counter_update(_data);
+    }
+    // Can be called on live and dead cells
+    bool is_compressed() const {
+        return atomic_cell_type::is_compressed(_data);
+    }
+    // Can be called only when is_counter_update()
+    int64_t counter_update_delta() const {
+        return get_field<int64_t>(value(), 0);
+    }
     bool is_dead(gc_clock::time_point now) const {
         return atomic_cell_type::is_dead(_data) || has_expired(now);
     }
@@ -223,6 +266,13 @@ class atomic_cell final : public atomic_cell_base<managed_bytes> {
     {
         return atomic_cell_type::make_live(timestamp, value, expiry, ttl);
     }
+    static atomic_cell make_live_counter_update(api::timestamp_type timestamp, int64_t delta) {
+        return atomic_cell_type::make_live_counter_update(timestamp, delta);
+    }
+    // A copy of a live cell with another value, compressed or not.
+    static atomic_cell with_value(atomic_cell_view cell, bytes_view value, bool compressed) {
+        return atomic_cell_type::with_value(cell._data, value, compressed);
+    }
     static atomic_cell make_live(api::timestamp_type timestamp, bytes_view value, ttl_opt ttl) {
         if (!ttl) {
             return atomic_cell_type::make_live(timestamp, value);
@@ -287,6 +337,16 @@ class atomic_cell_or_collection final {
     bytes_view serialize() const {
         return _data;
     }
+    // Replaces the value with one of the same serialized size in place,
+    // without a new allocation. Returns false, leaving the value unchanged,
+    // if the sizes differ.
+    bool overwrite(bytes_view data) {
+        if (data.size() != _data.size()) {
+            return false;
+        }
+        std::copy(data.begin(), data.end(), _data.begin());
+        return true;
+    }
     bool operator==(const atomic_cell_or_collection& other) const {
         return _data == other._data;
     }
@@ -44,9 +44,10 @@ class bytes_ostream {
         value_type data[0];
         void operator delete(void* ptr) { free(ptr); }
     };
-    // FIXME: consider increasing chunk size as the buffer grows
+    // Chunks double in size as the buffer grows, up to max_chunk_size, so
+    // that large buffers are made of few fragments.
     static constexpr size_type chunk_size{512};
-    static constexpr size_type usable_chunk_size{chunk_size - sizeof(chunk)};
+    static constexpr size_type max_chunk_size{128 * 1024};
 private:
     std::unique_ptr<chunk> _begin;
     chunk* _current;
@@ -87,6 +88,10 @@ class bytes_ostream {
         }
         return _current->size - _current->offset;
     }
+    size_type next_alloc_size(size_type data_size) const {
+        auto next_chunk_size = _current ? std::min<size_type>(max_chunk_size, (_current->size + sizeof(chunk)) * 2) : chunk_size;
+        return std::max<size_type>(next_chunk_size, data_size + sizeof(chunk));
+    }
     // Makes room for a contiguous region of given size.
     // The region is accounted for as already written.
     // size must not be zero.
@@ -97,7 +102,7 @@ class bytes_ostream {
             _size += size;
             return ret;
         } else {
-            auto alloc_size = size <= usable_chunk_size ? chunk_size : (size + sizeof(chunk));
+            auto alloc_size = next_alloc_size(size);
             auto space = malloc(alloc_size);
             if (!space) {
                 throw std::bad_alloc();
@@ -22,6 +22,8 @@
 #pragma once
 #include <core/sstring.hh>
 #include <boost/lexical_cast.hpp>
+#include <limits>
+#include <chrono>
 #include "exceptions/exceptions.hh"
 #include "json.hh"
 
@@ -31,23 +33,45 @@ class caching_options {
     // For Origin, the default value for the row is "NONE". However, since our
     // row_cache will cache both keys and rows, we will default to ALL.
     //
-    // FIXME: We don't yet make any changes to our caching policies based on
-    // this (and maybe we shouldn't)
+    // The "keys" setting controls the sstable key cache, and
+    // "rows_per_partition" how many of the first rows of each partition the
+    // row_cache holds. With "cell_compression_threshold_in_kb", the
+    // row_cache keeps the values of cells of at least that size compressed.
+    // With "result_cache_ttl_in_ms", coordinators keep the results of reads
+    // by prepared statements for that long, see cql3::result_cache.
     static constexpr auto default_key = "ALL";
     static constexpr auto default_row = "ALL";
 
     sstring _key_cache;
     sstring _row_cache;
-    caching_options(sstring k, sstring r) : _key_cache(k), _row_cache(r) {
+    uint64_t _rows_per_partition = std::numeric_limits<uint64_t>::max();
+    // In KB, 0 if disabled.
+    uint64_t _cell_compression_threshold = 0;
+    // 0 if disabled.
+    uint32_t _result_cache_ttl_ms = 0;
+    caching_options(sstring k, sstring r, sstring c = "0", sstring t = "0") : _key_cache(k), _row_cache(r) {
+        try {
+            _cell_compression_threshold = boost::lexical_cast<uint64_t>(c);
+        } catch (boost::bad_lexical_cast& e) {
+            throw exceptions::configuration_exception("Invalid cell_compression_threshold_in_kb value: " + c);
+        }
+        try {
+            _result_cache_ttl_ms = boost::lexical_cast<uint32_t>(t);
+        } catch (boost::bad_lexical_cast& e) {
+            throw exceptions::configuration_exception("Invalid result_cache_ttl_in_ms value: " + t);
+        }
+
         if ((k != "ALL") && (k != "NONE")) {
             throw exceptions::configuration_exception("Invalid key value: " + k); 
         }
 
-        if ((r == "ALL") || (r == "NONE")) {
+        if (r == "ALL") {
             return;
+        } else if (r == "NONE") {
+            _rows_per_partition = 0;
         } else {
             try {
-                boost::lexical_cast<unsigned long>(r);
+                _rows_per_partition = boost::lexical_cast<unsigned long>(r);
             } catch (boost::bad_lexical_cast& e) {
                 throw exceptions::configuration_exception("Invalid key value: " + r);
             }
@@ -58,14 +82,55 @@ class caching_options {
     caching_options() : _key_cache(default_key), _row_cache(default_row) {}
 public:
 
+    bool key_cache_enabled() const {
+        return _key_cache == "ALL";
+    }
+
+    bool row_cache_enabled() const {
+        return _rows_per_partition != 0;
+    }
+
+    // Most rows of a partition the row cache holds, the first ones in
+    // clustering order. The static row and tombstones are always cached.
+    uint64_t rows_per_partition() const {
+        return _rows_per_partition;
+    }
+
+    // Size in bytes from which the row cache compresses the values of
+    // cells, 0 if it doesn't.
+    size_t cell_compression_threshold() const {
+        return _cell_compression_threshold * 1024;
+    }
+
+    // How long coordinators may serve the results of a prepared read again,
+    // 0 if they don't.
+    std::chrono::milliseconds result_cache_ttl() const {
+        return std::chrono::milliseconds(_result_cache_ttl_ms);
+    }
+
     sstring to_sstring() const {
-        return json::to_json(std::map<sstring, sstring>({{ "keys", _key_cache }, { "rows_per_partition", _row_cache }}));
+        std::map<sstring, sstring> map({{ "keys", _key_cache }, { "rows_per_partition", _row_cache }});
+        // Left out when disabled, not to change the schema of every table.
+        if (_cell_compression_threshold) {
+            map.emplace("cell_compression_threshold_in_kb", ::to_sstring(_cell_compression_threshold));
+        }
+        if (_result_cache_ttl_ms) {
+            map.emplace("result_cache_ttl_in_ms", ::to_sstring(_result_cache_ttl_ms));
+        }
+        return json::to_json(map);
     }
 
     static caching_options from_sstring(const sstring& str) {
-        auto map = json::to_map(str);
-        if (map.size() > 2) {
-            throw exceptions::configuration_exception("Invalid map: " + str); 
+        return from_map(json::to_map(str));
+    }
+
+    // As the caching property of a table is given in CQL.
+    static caching_options from_map(const std::map<sstring, sstring>& map) {
+        for (auto&& e : map) {
+            if (e.first != "keys" && e.first != "rows_per_partition"
+                    && e.first != "cell_compression_threshold_in_kb" && e.first != "result_cache_ttl_in_ms") {
+                throw exceptions::configuration_exception("Invalid caching option: " + e.first);
+            }
         }
         sstring k;
         sstring r;
@@ -80,7 +145,10 @@ class caching_options {
         } else {
             r = default_row;
         }
-        return caching_options(k, r);
+
+        sstring c = map.count("cell_compression_threshold_in_kb") ? map.at("cell_compression_threshold_in_kb") : "0";
+        sstring t = map.count("result_cache_ttl_in_ms") ? map.at("result_cache_ttl_in_ms") : "0";
+        return caching_options(k, r, c, t);
     }
 };
 
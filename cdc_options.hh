@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <core/sstring.hh>
+#include <boost/lexical_cast.hpp>
+#include <map>
+#include "exceptions/exceptions.hh"
+#include "gc_clock.hh"
+#include "json.hh"
+
+// Change data capture of a table: whether the writes to it are recorded in
+// its log table, and for how long the log keeps them.
+class cdc_options {
+    static constexpr gc_clock::rep default_ttl = 24 * 60 * 60;
+
+    bool _enabled = false;
+    gc_clock::duration _ttl = gc_clock::duration(default_ttl);
+public:
+    cdc_options() = default;
+
+    bool enabled() const {
+        return _enabled;
+    }
+
+    gc_clock::duration ttl() const {
+        return _ttl;
+    }
+
+    bool operator==(const cdc_options& o) const {
+        return _enabled == o._enabled && _ttl == o._ttl;
+    }
+    bool operator!=(const cdc_options& o) const {
+        return !(*this == o);
+    }
+
+    std::map<sstring, sstring> to_map() const {
+        return {{ "enabled", _enabled ? "true" : "false" }, { "ttl", ::to_sstring(_ttl.count()) }};
+    }
+
+    sstring to_sstring() const {
+        return json::to_json(to_map());
+    }
+
+    static cdc_options from_map(const std::map<sstring, sstring>& map) {
+        cdc_options opts;
+        for (auto&& e : map) {
+            if (e.first == "enabled") {
+                if (e.second != "true" && e.second != "false") {
+                    throw exceptions::configuration_exception("Invalid value for cdc option 'enabled': " + e.second);
+                }
+                opts._enabled = e.second == "true";
+            } else if (e.first == "ttl") {
+                try {
+                    opts._ttl = gc_clock::duration(boost::lexical_cast<gc_clock::rep>(e.second));
+                } catch (boost::bad_lexical_cast& ex) {
+                    throw exceptions::configuration_exception("Invalid value for cdc option 'ttl': " + e.second);
+                }
+                if (opts._ttl.count() <= 0) {
+                    throw exceptions::configuration_exception("cdc option 'ttl' must be positive: " + e.second);
+                }
+            } else {
+                throw exceptions::configuration_exception("Unknown cdc option: " + e.first);
+            }
+        }
+        return opts;
+    }
+
+    static cdc_options from_sstring(const sstring& str) {
+        return from_map(json::to_map(str));
+    }
+};
@@ -30,7 +30,7 @@ enum class compaction_strategy_type {
     major,
     size_tiered,
     leveled,
-    // FIXME: Add support to DateTiered.
+    date_tiered,
 };
 
 class compaction_strategy_impl;
@@ -57,6 +57,8 @@ class compaction_strategy {
             return "SizeTieredCompactionStrategy";
         case compaction_strategy_type::leveled:
             return "LeveledCompactionStrategy";
+        case compaction_strategy_type::date_tiered:
+            return "DateTieredCompactionStrategy";
         default:
             throw std::runtime_error("Invalid Compaction Strategy");
         }
@@ -71,6 +73,8 @@ class compaction_strategy {
             return compaction_strategy_type::size_tiered;
         } else if (name == "LeveledCompactionStrategy") {
             return compaction_strategy_type::leveled;
+        } else if (name == "DateTieredCompactionStrategy") {
+            return compaction_strategy_type::date_tiered;
         } else {
             throw exceptions::configuration_exception(sprint("Unable to find compaction strategy class 'org.apache.cassandra.db.compaction.%s", name));
         }
@@ -55,6 +55,10 @@ template<allow_prefixes AllowPrefixes = allow_prefixes::no>
 class compound_type final {
 private:
     const std::vector<data_type> _types;
+    // Of the types, in the same order, which compare() compares the
+    // components with.
+    const std::vector<type_comparator> _comparators;
+    const bool _has_comparable_bytes;
     const bool _byte_order_equal;
     const bool _byte_order_comparable;
     const bool _is_reversed;
@@ -65,6 +69,10 @@ class compound_type final {
 
     compound_type(std::vector<data_type> types)
         : _types(std::move(types))
+        , _comparators(make_comparators(_types))
+        , _has_comparable_bytes(!_comparators.empty() && std::all_of(_comparators.begin(), _comparators.end(), [] (auto&& c) {
+                return c.has_byte_comparable_encoding();
+            }))
         , _byte_order_equal(std::all_of(_types.begin(), _types.end(), [] (auto t) {
                 return t->is_byte_order_equal();
             }))
@@ -73,6 +81,16 @@ class compound_type final {
     { }
 
     compound_type(compound_type&&) = default;
+private:
+    static std::vector<type_comparator> make_comparators(const std::vector<data_type>& types) {
+        std::vector<type_comparator> comparators;
+        comparators.reserve(types.size());
+        for (auto&& t : types) {
+            comparators.emplace_back(*t);
+        }
+        return comparators;
+    }
+public:
 
     auto const& types() const {
         return _types;
@@ -272,11 +290,40 @@ class compound_type final {
                 return compare_unsigned(b1, b2);
             }
         }
-        return lexicographical_tri_compare(_types.begin(), _types.end(),
-            begin(b1), end(b1), begin(b2), end(b2), [] (auto&& type, auto&& v1, auto&& v2) {
-                return type->compare(v1, v2);
+        return lexicographical_tri_compare(_comparators.begin(), _comparators.end(),
+            begin(b1), end(b1), begin(b2), end(b2), [] (const type_comparator& c, auto&& v1, auto&& v2) {
+                return c.compare(v1, v2);
             });
     }
+    // Whether to_comparable_bytes() can encode values of this type.
+    bool has_comparable_bytes() const {
+        return _has_comparable_bytes;
+    }
+    // Encodes a value into bytes which compare with compare_unsigned() as
+    // the values compare with compare(), prefixes included, for comparing
+    // keys many times over. Returns disengaged when the types or the value
+    // have no such encoding.
+    bytes_opt to_comparable_bytes(bytes_view v) const {
+        if (!_has_comparable_bytes) {
+            return {};
+        }
+        size_t size = 0;
+        auto c = _comparators.begin();
+        for (auto&& component : components(v)) {
+            auto s = (c++)->encoded_size(component);
+            if (!s) {
+                return {};
+            }
+            size += *s;
+        }
+        bytes b(bytes::initialized_later(), size);
+        auto out = b.begin();
+        c = _comparators.begin();
+        for (auto&& component : components(v)) {
+            (c++)->encode(component, out);
+        }
+        return { std::move(b) };
+    }
     bytes from_string(sstring_view s) {
         throw std::runtime_error("not implemented");
     }
@@ -28,20 +28,30 @@ enum class compressor {
     lz4,
     snappy,
     deflate,
+    zstd,
 };
 
 class compression_parameters {
 public:
     static constexpr int32_t DEFAULT_CHUNK_LENGTH = 64 * 1024;
     static constexpr double DEFAULT_CRC_CHECK_CHANCE = 1.0;
+    static constexpr int DEFAULT_COMPRESSION_LEVEL = 3;
+    // Dictionaries are stored in a CompressionInfo option, whose values
+    // are at most 64KB long.
+    static constexpr int MAX_DICTIONARY_SIZE_KB = 63;
 
     static constexpr auto SSTABLE_COMPRESSION = "sstable_compression";
     static constexpr auto CHUNK_LENGTH_KB = "chunk_length_kb";
     static constexpr auto CRC_CHECK_CHANCE = "crc_check_chance";
+    // Zstd only.
+    static constexpr auto COMPRESSION_LEVEL = "compression_level";
+    static constexpr auto DICTIONARY_SIZE_KB = "dictionary_size_kb";
 private:
     compressor _compressor = compressor::none;
     std::experimental::optional<int> _chunk_length;
     std::experimental::optional<double> _crc_check_chance;
+    std::experimental::optional<int> _compression_level;
+    std::experimental::optional<int> _dictionary_size;
 public:
     compression_parameters() = default;
     compression_parameters(compressor c) : _compressor(c) { }
@@ -59,6 +69,8 @@ class compression_parameters {
             _compressor = compressor::snappy;
         } else if (is_compressor_class(compressor_class, "DeflateCompressor")) {
             _compressor = compressor::deflate;
+        } else if (is_compressor_class(compressor_class, "ZstdCompressor")) {
+            _compressor = compressor::zstd;
         } else {
             throw exceptions::configuration_exception(sstring("Unsupported compression class '") + compressor_class + "'.");
         }
@@ -78,11 +90,30 @@ class compression_parameters {
                 throw exceptions::syntax_exception(sstring("Invalid double value ") + crc_chance->second + "for " + CRC_CHECK_CHANCE);
             }
         }
+        auto level = options.find(COMPRESSION_LEVEL);
+        if (level != options.end()) {
+            try {
+                _compression_level = std::stoi(level->second);
+            } catch (const std::exception& e) {
+                throw exceptions::syntax_exception(sstring("Invalid integer value ") + level->second + " for " + COMPRESSION_LEVEL);
+            }
+        }
+        auto dictionary_size = options.find(DICTIONARY_SIZE_KB);
+        if (dictionary_size != options.end()) {
+            try {
+                _dictionary_size = std::stoi(dictionary_size->second) * 1024;
+            } catch (const std::exception& e) {
+                throw exceptions::syntax_exception(sstring("Invalid integer value ") + dictionary_size->second + " for " + DICTIONARY_SIZE_KB);
+            }
+        }
     }
 
     compressor get_compressor() const { return _compressor; }
     int32_t chunk_length() const { return _chunk_length.value_or(int(DEFAULT_CHUNK_LENGTH)); }
     double crc_check_chance() const { return _crc_check_chance.value_or(double(DEFAULT_CRC_CHECK_CHANCE)); }
+    int compression_level() const { return _compression_level.value_or(int(DEFAULT_COMPRESSION_LEVEL)); }
+    // In bytes; 0 when chunks are compressed without a trained dictionary.
+    int dictionary_size() const { return _dictionary_size.value_or(0); }
 
     void validate() {
         if (_chunk_length) {
@@ -98,6 +129,15 @@ class compression_parameters {
         if (_crc_check_chance && (_crc_check_chance.value() < 0.0 || _crc_check_chance.value() > 1.0)) {
             throw exceptions::configuration_exception(sstring(CRC_CHECK_CHANCE) + " must be between 0.0 and 1.0.");
         }
+        if ((_compression_level || _dictionary_size) && _compressor != compressor::zstd) {
+            throw exceptions::configuration_exception(sprint("%s and %s are only supported by ZstdCompressor.", COMPRESSION_LEVEL, DICTIONARY_SIZE_KB));
+        }
+        if (_compression_level && (_compression_level.value() < 1 || _compression_level.value() > 22)) {
+            throw exceptions::configuration_exception(sstring(COMPRESSION_LEVEL) + " must be between 1 and 22.");
+        }
+        if (_dictionary_size && (_dictionary_size.value() < 0 || _dictionary_size.value() > MAX_DICTIONARY_SIZE_KB * 1024)) {
+            throw exceptions::configuration_exception(sprint("%s must be between 0 and %d.", DICTIONARY_SIZE_KB, MAX_DICTIONARY_SIZE_KB));
+        }
     }
 
     std::map<sstring, sstring> get_options() const {
@@ -112,15 +152,23 @@ class compression_parameters {
         if (_crc_check_chance) {
             opts.emplace(sstring(CRC_CHECK_CHANCE), std::to_string(_crc_check_chance.value()));
         }
+        if (_compression_level) {
+            opts.emplace(sstring(COMPRESSION_LEVEL), std::to_string(_compression_level.value()));
+        }
+        if (_dictionary_size) {
+            opts.emplace(sstring(DICTIONARY_SIZE_KB), std::to_string(_dictionary_size.value() / 1024));
+        }
         return opts;
     }
 private:
     void validate_options(const std::map<sstring, sstring>& options) {
-        // currently, there are no options specific to a particular compressor
+        // options specific to a particular compressor are checked by validate()
         static std::set<sstring> keywords({
             sstring(SSTABLE_COMPRESSION),
             sstring(CHUNK_LENGTH_KB),
             sstring(CRC_CHECK_CHANCE),
+            sstring(COMPRESSION_LEVEL),
+            sstring(DICTIONARY_SIZE_KB),
         });
         for (auto&& opt : options) {
             if (!keywords.count(opt.first)) {
@@ -140,6 +188,8 @@ class compression_parameters {
             return "org.apache.cassandra.io.compress.SnappyCompressor";
         case compressor::deflate:
             return "org.apache.cassandra.io.compress.DeflateCompressor";
+        case compressor::zstd:
+            return "org.apache.cassandra.io.compress.ZstdCompressor";
         default:
             abort();
         }
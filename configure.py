@@ -145,10 +145,19 @@ scylla_tests = [
     'tests/row_cache_alloc_stress',
     'tests/perf_row_cache_update',
     'tests/perf/perf_hash',
+    'tests/perf/perf_bloom_filter',
     'tests/perf/perf_cql_parser',
     'tests/perf/perf_simple_query',
+    'tests/perf/perf_cql_load',
+    'tests/perf/perf_compaction',
+    'tests/perf/perf_row_cache',
+    'tests/perf/perf_commitlog',
+    'tests/perf/perf_thrift',
     'tests/memory_footprint',
     'tests/perf/perf_sstable',
+    'tests/perf/perf_combined_reader',
+    'tests/perf/perf_checksum',
+    'tests/perf/perf_utf8',
     'tests/cql_query_test',
     'tests/storage_proxy_test',
     'tests/mutation_reader_test',
@@ -177,11 +186,26 @@ scylla_tests = [
     'tests/bytes_ostream_test',
     'tests/UUID_test',
     'tests/murmur_hash_test',
+    'tests/bloom_filter_test',
     'tests/allocation_strategy_test',
     'tests/logalloc_test',
     'tests/managed_vector_test',
+    'tests/intrusive_btree_test',
+    'tests/histogram_test',
     'tests/crc_test',
     'tests/flush_queue_test',
+    'tests/merkle_tree_test',
+    'tests/failure_detector_test',
+    'tests/tracing_test',
+    'tests/stall_detector_test',
+    'tests/space_saving_test',
+    'tests/hints_manager_test',
+    'tests/log_test',
+    'tests/stream_transfer_task_test',
+    'tests/thrift_test',
+    'tests/api_test',
+    'tests/paxos_test',
+    'tests/cql_compression_test',
 ]
 
 apps = [
@@ -225,13 +249,14 @@ add_tristate(arg_parser, name = 'xen', dest = 'xen', help = 'Xen support')
 args = arg_parser.parse_args()
 
 defines = []
-scylla_libs = '-llz4 -lsnappy -lz -lboost_thread -lcryptopp -lrt -lyaml-cpp -lboost_date_time'
+scylla_libs = '-llz4 -lsnappy -lz -lzstd -lboost_thread -lcryptopp -lrt -lyaml-cpp -lboost_date_time'
 
 extra_cxxflags = {}
 
 cassandra_interface = Thrift(source = 'interface/cassandra.thrift', service = 'Cassandra')
 
 scylla_core = (['database.cc',
+                 'lister.cc',
                  'schema.cc',
                  'bytes.cc',
                  'mutation.cc',
@@ -241,11 +266,15 @@ scylla_core = (['database.cc',
                  'release.cc',
                  'utils/logalloc.cc',
                  'utils/large_bitset.cc',
+                 'utils/utf8.cc',
+                 'utils/intrusive_btree.cc',
                  'mutation_partition.cc',
                  'mutation_partition_view.cc',
                  'mutation_partition_serializer.cc',
                  'mutation_reader.cc',
+                 'key_reader.cc',
                  'mutation_query.cc',
+                 'counters.cc',
                  'keys.cc',
                  'sstables/sstables.cc',
                  'sstables/compress.cc',
@@ -254,6 +283,10 @@ scylla_core = (['database.cc',
                  'sstables/partition.cc',
                  'sstables/filter.cc',
                  'sstables/compaction.cc',
+                 'sstables/key_cache.cc',
+                 'sstables/index_page_cache.cc',
+                 'sstables/summary_entries.cc',
+                 'sstables/read_ahead.cc',
                  'log.cc',
                  'transport/event.cc',
                  'transport/event_notifier.cc',
@@ -273,6 +306,8 @@ scylla_core = (['database.cc',
                  'cql3/statements/create_table_statement.cc',
                  'cql3/statements/drop_keyspace_statement.cc',
                  'cql3/statements/drop_table_statement.cc',
+                 'cql3/statements/create_view_statement.cc',
+                 'cql3/statements/drop_view_statement.cc',
                  'cql3/statements/schema_altering_statement.cc',
                  'cql3/statements/ks_prop_defs.cc',
                  'cql3/statements/modification_statement.cc',
@@ -298,12 +333,18 @@ scylla_core = (['database.cc',
                  'validation.cc',
                  'service/migration_manager.cc',
                  'service/storage_proxy.cc',
+                 'service/admission_queue.cc',
+                 'service/service_level_controller.cc',
+                 'service/pager/paging_state.cc',
+                 'service/paxos/proposal.cc',
+                 'service/paxos/paxos_state.cc',
                  'cql3/operator.cc',
                  'cql3/relation.cc',
                  'cql3/column_identifier.cc',
                  'cql3/constants.cc',
                  'cql3/query_processor.cc',
                  'cql3/query_options.cc',
+                 'cql3/result_cache.cc',
                  'cql3/single_column_relation.cc',
                  'cql3/token_relation.cc',
                  'cql3/column_condition.cc',
@@ -324,16 +365,31 @@ scylla_core = (['database.cc',
                  'db/serializer.cc',
                  'db/config.cc',
                  'db/index/secondary_index.cc',
+                 'db/view/view.cc',
+                 'db/cdc/log.cc',
                  'db/marshal/type_parser.cc',
                  'db/batchlog_manager.cc',
+                 'db/size_estimates_recorder.cc',
+                 'db/saved_caches_manager.cc',
+                 'db/index_summary_manager.cc',
+                 'db/data_directories.cc',
+                 'db/hints/manager.cc',
                  'io/io.cc',
                  'utils/utils.cc',
                  'utils/UUID_gen.cc',
                  'utils/i_filter.cc',
                  'utils/bloom_filter.cc',
+                 'utils/blocked_bloom_filter.cc',
                  'utils/bloom_calculations.cc',
                  'utils/rate_limiter.cc',
                  'utils/compaction_manager.cc',
+                 'utils/compaction_throttle.cc',
+                 'utils/flush_scheduler.cc',
+                 'utils/reader_concurrency_semaphore.cc',
+                 'utils/io_queue.cc',
+                 'utils/mapped_file.cc',
+                 'utils/cpu_scheduler.cc',
+                 'utils/stall_detector.cc',
                  'utils/file_lock.cc',
                  'gms/version_generator.cc',
                  'gms/versioned_value.cc',
@@ -358,6 +414,7 @@ scylla_core = (['database.cc',
                  'locator/token_metadata.cc',
                  'locator/locator.cc',
                  'locator/snitch_base.cc',
+                 'locator/dynamic_snitch.cc',
                  'locator/simple_snitch.cc',
                  'locator/rack_inferring_snitch.cc',
                  'locator/gossiping_property_file_snitch.cc',
@@ -372,6 +429,7 @@ scylla_core = (['database.cc',
                  'streaming/stream_request.cc',
                  'streaming/stream_summary.cc',
                  'streaming/stream_transfer_task.cc',
+                 'streaming/sstable_loader.cc',
                  'streaming/stream_receive_task.cc',
                  'streaming/stream_plan.cc',
                  'streaming/progress_info.cc',
@@ -390,6 +448,9 @@ scylla_core = (['database.cc',
                  'partition_slice_builder.cc',
                  'init.cc',
                  'repair/repair.cc',
+                 'repair/merkle_tree.cc',
+                 'repair/row_level.cc',
+                 'tracing/tracing.cc',
                  'exceptions/exceptions.cc',
                  ]
                 + [Antlr3Grammar('cql3/Cql.g')]
@@ -424,8 +485,14 @@ api = ['api/api.cc',
        'api/hinted_handoff.cc',
        'api/api-doc/utils.json',
        'api/lsa.cc',
+       'api/api-doc/reactor.json',
+       'api/reactor.cc',
        'api/api-doc/stream_manager.json',
        'api/stream_manager.cc',
+       'api/api-doc/cql.json',
+       'api/cql.cc',
+       'api/api-doc/batchlog_manager.json',
+       'api/batchlog_manager.cc',
        ]
 
 scylla_tests_dependencies = scylla_core + [
@@ -457,9 +524,17 @@ tests_not_using_seastar_test_framework = set([
     'tests/perf_row_cache_update',
     'tests/cartesian_product_test',
     'tests/perf/perf_hash',
+    'tests/perf/perf_checksum',
+    'tests/perf/perf_utf8',
+    'tests/perf/perf_bloom_filter',
     'tests/perf/perf_cql_parser',
     'tests/message',
     'tests/perf/perf_simple_query',
+    'tests/perf/perf_cql_load',
+    'tests/perf/perf_compaction',
+    'tests/perf/perf_row_cache',
+    'tests/perf/perf_commitlog',
+    'tests/perf/perf_thrift',
     'tests/memory_footprint',
     'tests/test-serialization',
     'tests/gossip',
@@ -467,7 +542,16 @@ tests_not_using_seastar_test_framework = set([
     'tests/range_test',
     'tests/crc_test',
     'tests/perf/perf_sstable',
+    'tests/perf/perf_combined_reader',
     'tests/managed_vector_test',
+    'tests/intrusive_btree_test',
+    'tests/histogram_test',
+    'tests/bloom_filter_test',
+    'tests/merkle_tree_test',
+    'tests/failure_detector_test',
+    'tests/space_saving_test',
+    'tests/stream_transfer_task_test',
+    'tests/cql_compression_test',
 ])
 
 for t in tests_not_using_seastar_test_framework:
@@ -480,9 +564,12 @@ for t in scylla_tests:
         deps[t] += scylla_tests_seastar_deps
 
 deps['tests/sstable_test'] += ['tests/sstable_datafile_test.cc']
+deps['tests/api_test'] += api
 
 deps['tests/bytes_ostream_test'] = ['tests/bytes_ostream_test.cc']
 deps['tests/UUID_test'] = ['utils/UUID_gen.cc', 'tests/UUID_test.cc']
+deps['tests/histogram_test'] = ['tests/histogram_test.cc']
+deps['tests/space_saving_test'] = ['tests/space_saving_test.cc']
 deps['tests/murmur_hash_test'] = ['bytes.cc', 'utils/murmur_hash.cc', 'tests/murmur_hash_test.cc']
 deps['tests/allocation_strategy_test'] = ['tests/allocation_strategy_test.cc', 'utils/logalloc.cc', 'log.cc']
 
@@ -570,7 +657,7 @@ for mode in build_modes:
 seastar_deps = 'practically_anything_can_change_so_lets_run_it_every_time_and_restat.'
 
 args.user_cflags += " " + pkg_config("--cflags", "jsoncpp")
-libs = "-lyaml-cpp -llz4 -lz -lsnappy " + pkg_config("--libs", "jsoncpp") + ' -lboost_filesystem'
+libs = "-lyaml-cpp -llz4 -lz -lsnappy -lzstd " + pkg_config("--libs", "jsoncpp") + ' -lboost_filesystem'
 user_cflags = args.user_cflags
 user_ldflags = args.user_ldflags
 if args.staticcxx:
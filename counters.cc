@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "counters.hh"
+#include "mutation.hh"
+#include "types.hh"
+
+std::ostream& operator<<(std::ostream& os, const counter_shard& s) {
+    return os << "{" << s.id << ": " << s.value << " @" << s.clock << "}";
+}
+
+counter_cell_view::counter_cell_view(bytes_view value)
+    : _value(value)
+{
+    if (value.size() % counter_shard::serialized_size) {
+        throw marshal_exception();
+    }
+}
+
+counter_shard counter_cell_view::shard_at(size_t i) const {
+    auto p = _value.begin() + i * counter_shard::serialized_size;
+    auto field = [&p] {
+        auto v = net::ntoh(*reinterpret_cast<const net::packed<int64_t>*>(p));
+        p += sizeof(int64_t);
+        return v;
+    };
+    auto msb = field();
+    auto lsb = field();
+    auto value = field();
+    auto clock = field();
+    return { utils::UUID(msb, lsb), value, clock };
+}
+
+std::experimental::optional<counter_shard> counter_cell_view::find_shard(const utils::UUID& id) const {
+    for (size_t i = 0; i < shard_count(); ++i) {
+        auto s = shard_at(i);
+        if (s.id == id) {
+            return s;
+        }
+    }
+    return {};
+}
+
+int64_t counter_cell_view::total_value() const {
+    int64_t total = 0;
+    for (size_t i = 0; i < shard_count(); ++i) {
+        total += shard_at(i).value;
+    }
+    return total;
+}
+
+bytes serialize_counter_shards(const std::vector<counter_shard>& shards) {
+    bytes b(bytes::initialized_later(), shards.size() * counter_shard::serialized_size);
+    auto out = b.begin();
+    for (auto&& s : shards) {
+        for (int64_t v : { s.id.get_most_significant_bits(), s.id.get_least_significant_bits(), s.value, s.clock }) {
+            auto n = net::hton(v);
+            out = std::copy_n(reinterpret_cast<const int8_t*>(&n), sizeof(n), out);
+        }
+    }
+    return b;
+}
+
+bytes counter_total_value(atomic_cell_view cell) {
+    auto total = cell.is_counter_update() ? cell.counter_update_delta() : counter_cell_view(cell.value()).total_value();
+    return long_type->decompose(total);
+}
+
+atomic_cell merge_counter_cells(atomic_cell_view a, atomic_cell_view b) {
+    // Updates are turned into shards before being applied to replicas, so
+    // only the cells of a mutation being built can be updates, and then
+    // all of them are.
+    if (!a.is_live() || !b.is_live() || a.is_counter_update() != b.is_counter_update()) {
+        return compare_atomic_cell_for_merge(a, b) < 0 ? atomic_cell(b) : atomic_cell(a);
+    }
+    auto timestamp = std::max(a.timestamp(), b.timestamp());
+    if (a.is_counter_update()) {
+        return atomic_cell::make_live_counter_update(timestamp, a.counter_update_delta() + b.counter_update_delta());
+    }
+    counter_cell_view ca(a.value());
+    counter_cell_view cb(b.value());
+    std::vector<counter_shard> shards;
+    shards.reserve(ca.shard_count() + cb.shard_count());
+    size_t i = 0;
+    size_t j = 0;
+    while (i < ca.shard_count() && j < cb.shard_count()) {
+        auto sa = ca.shard_at(i);
+        auto sb = cb.shard_at(j);
+        if (sa.id == sb.id) {
+            auto a_wins = sa.clock != sb.clock ? sa.clock > sb.clock : sa.value >= sb.value;
+            shards.push_back(a_wins ? sa : sb);
+            ++i;
+            ++j;
+        } else if (sa.id < sb.id) {
+            shards.push_back(sa);
+            ++i;
+        } else {
+            shards.push_back(sb);
+            ++j;
+        }
+    }
+    for (; i < ca.shard_count(); ++i) {
+        shards.push_back(ca.shard_at(i));
+    }
+    for (; j < cb.shard_count(); ++j) {
+        shards.push_back(cb.shard_at(j));
+    }
+    return atomic_cell::make_live(timestamp, serialize_counter_shards(shards));
+}
+
+static void transform_counter_updates_to_shards(row& cells, const row* current_cells, tombstone current_tomb, const utils::UUID& local_id) {
+    cells.for_each_cell_until([&] (column_id id, atomic_cell_or_collection& c) {
+        auto cell = c.as_atomic_cell();
+        if (!cell.is_live() || !cell.is_counter_update()) {
+            return stop_iteration::no;
+        }
+        counter_shard shard{local_id, 0, 0};
+        auto old = current_cells ? current_cells->find_cell(id) : nullptr;
+        if (old) {
+            auto old_cell = old->as_atomic_cell();
+            if (old_cell.is_live() && !old_cell.is_counter_update()) {
+                if (auto s = counter_cell_view(old_cell.value()).find_shard(local_id)) {
+                    // A deleted counter starts over, but its clock goes on
+                    // for the new shard to win over the deleted one.
+                    shard.clock = s->clock;
+                    if (old_cell.is_live(current_tomb)) {
+                        shard.value = s->value;
+                    }
+                }
+            }
+        }
+        shard.value += cell.counter_update_delta();
+        ++shard.clock;
+        c = atomic_cell::make_live(cell.timestamp(), serialize_counter_shards({ shard }));
+        return stop_iteration::no;
+    });
+}
+
+void transform_counter_updates_to_shards(mutation& m, const mutation_partition* current, const utils::UUID& local_id) {
+    auto& s = *m.schema();
+    auto& p = m.partition();
+    transform_counter_updates_to_shards(p.static_row(), current ? &current->static_row() : nullptr,
+            current ? current->partition_tombstone() : tombstone(), local_id);
+    for (rows_entry& e : p.clustered_rows()) {
+        transform_counter_updates_to_shards(e.row().cells(), current ? current->find_row(e.key()) : nullptr,
+                current ? current->tombstone_for_row(s, e.key()) : tombstone(), local_id);
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+#include "atomic_cell.hh"
+#include "utils/UUID.hh"
+
+class mutation;
+class mutation_partition;
+
+// Counters are made of shards, one for each node which took increments of
+// the counter, holding the sum of these increments and a logical clock
+// bumped by each of them. Only the node a shard belongs to writes it, from
+// the shard it has, so replicas merge the shards of a counter by keeping
+// the one with the highest clock of each node. The value of the counter is
+// the sum of its shards.
+//
+// Increments are written as counter updates, holding their delta only,
+// which the replica leading the write turns into its own shard before the
+// mutation is applied anywhere, see transform_counter_updates_to_shards().
+//
+// Layout of the value of a live counter cell, with shards ordered by id:
+//
+//  <counter> := <shard>*
+//  <shard>   := <int64_t:id msb><int64_t:id lsb><int64_t:value><int64_t:clock>
+struct counter_shard {
+    utils::UUID id;
+    int64_t value;
+    int64_t clock;
+
+    static constexpr size_t serialized_size = 4 * sizeof(int64_t);
+
+    friend std::ostream& operator<<(std::ostream& os, const counter_shard& s);
+};
+
+// Reads the value of a live counter cell, other than a counter update.
+class counter_cell_view {
+    bytes_view _value;
+public:
+    explicit counter_cell_view(bytes_view value);
+
+    size_t shard_count() const {
+        return _value.size() / counter_shard::serialized_size;
+    }
+    counter_shard shard_at(size_t i) const;
+    std::experimental::optional<counter_shard> find_shard(const utils::UUID& id) const;
+    int64_t total_value() const;
+};
+
+// Shards must be ordered by id.
+bytes serialize_counter_shards(const std::vector<counter_shard>& shards);
+
+// The value of the counter a live cell holds, serialized as a bigint.
+bytes counter_total_value(atomic_cell_view cell);
+
+// Reconciles two cells of a counter column. Live counters merge their
+// shards, counter updates add up, and deletions win over the cells they
+// are not older than.
+atomic_cell merge_counter_cells(atomic_cell_view a, atomic_cell_view b);
+
+// Turns the counter updates of m into the shards of the node with the given
+// id, by adding their deltas to the shards the node has in current, the
+// partition as the replica applying m has it, if any.
+void transform_counter_updates_to_shards(mutation& m, const mutation_partition* current, const utils::UUID& local_id);
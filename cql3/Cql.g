@@ -37,6 +37,8 @@ options {
 #include "cql3/statements/create_table_statement.hh"
 #include "cql3/statements/property_definitions.hh"
 #include "cql3/statements/drop_table_statement.hh"
+#include "cql3/statements/create_view_statement.hh"
+#include "cql3/statements/drop_view_statement.hh"
 #include "cql3/statements/truncate_statement.hh"
 #include "cql3/statements/select_statement.hh"
 #include "cql3/statements/update_statement.hh"
@@ -267,6 +269,8 @@ cqlStatement returns [shared_ptr<parsed_statement> stmt]
     | st10=createIndexStatement        { $stmt = st10; }
     | st11=dropKeyspaceStatement       { $stmt = st11; }
     | st12=dropTableStatement          { $stmt = st12; }
+    | st32=createViewStatement         { $stmt = st32; }
+    | st33=dropViewStatement           { $stmt = st33; }
 #if 0
     | st13=dropIndexStatement          { $stmt = st13; }
     | st14=alterTableStatement         { $stmt = st14; }
@@ -692,6 +696,37 @@ cfamOrdering[shared_ptr<cql3::statements::create_table_statement::raw_statement>
     ;
 
 
+/**
+ * CREATE MATERIALIZED VIEW [IF NOT EXISTS] <viewName> AS
+ *     SELECT <column>, ... | * FROM <CF>
+ *     WHERE <column> IS NOT NULL AND ...
+ *     PRIMARY KEY (<column>, ...)
+ *     WITH <property> = <value> AND ...;
+ */
+createViewStatement returns [::shared_ptr<create_view_statement> expr]
+    @init {
+        bool if_not_exists = false;
+        std::vector<::shared_ptr<cql3::column_identifier::raw>> selected;
+        std::vector<::shared_ptr<cql3::column_identifier::raw>> partition_keys;
+        std::vector<::shared_ptr<cql3::column_identifier::raw>> clustering_keys;
+        std::vector<::shared_ptr<cql3::column_identifier::raw>> not_null;
+        auto props = make_shared<cql3::statements::cf_prop_defs>();
+    }
+    : K_CREATE K_MATERIALIZED K_VIEW (K_IF K_NOT K_EXISTS { if_not_exists = true; } )? cf=columnFamilyName K_AS
+        K_SELECT ( '*' | c1=cident { selected.push_back(c1); } ( ',' cn=cident { selected.push_back(cn); } )* )
+        K_FROM basecf=columnFamilyName
+        K_WHERE n1=cident K_IS K_NOT K_NULL { not_null.push_back(n1); } ( K_AND nn=cident K_IS K_NOT K_NULL { not_null.push_back(nn); } )*
+        K_PRIMARY K_KEY '(' viewPartitionKey[partition_keys] ( ',' c=cident { clustering_keys.push_back(c); } )* ')'
+        ( K_WITH property[props] ( K_AND property[props] )* )?
+      { $expr = ::make_shared<create_view_statement>(cf, basecf, std::move(selected), std::move(partition_keys),
+                std::move(clustering_keys), std::move(not_null), props, if_not_exists); }
+    ;
+
+viewPartitionKey[std::vector<::shared_ptr<cql3::column_identifier::raw>>& keys]
+    : k=cident { keys.push_back(k); }
+    | '(' k1=cident { keys.push_back(k1); } ( ',' kn=cident { keys.push_back(kn); } )* ')'
+    ;
+
 #if 0
 /**
  * CREATE TYPE foo (
@@ -833,6 +868,14 @@ dropTableStatement returns [::shared_ptr<drop_table_statement> stmt]
     : K_DROP K_COLUMNFAMILY (K_IF K_EXISTS { if_exists = true; } )? cf=columnFamilyName { $stmt = ::make_shared<drop_table_statement>(cf, if_exists); }
     ;
 
+/**
+ * DROP MATERIALIZED VIEW [IF EXISTS] <view_name>;
+ */
+dropViewStatement returns [::shared_ptr<drop_view_statement> stmt]
+    @init { bool if_exists = false; }
+    : K_DROP K_MATERIALIZED K_VIEW (K_IF K_EXISTS { if_exists = true; } )? cf=columnFamilyName { $stmt = ::make_shared<drop_view_statement>(cf, if_exists); }
+    ;
+
 #if 0
 /**
  * DROP TYPE <name>;
@@ -1440,6 +1483,8 @@ basic_unreserved_keyword returns [sstring str]
         | K_LANGUAGE
         | K_NON
         | K_DETERMINISTIC
+        | K_MATERIALIZED
+        | K_VIEW
         ) { $str = $k.text; }
     ;
 
@@ -1537,6 +1582,7 @@ K_WRITETIME:   W R I T E T I M E;
 
 K_NULL:        N U L L;
 K_NOT:         N O T;
+K_IS:          I S;
 K_EXISTS:      E X I S T S;
 
 K_MAP:         M A P;
@@ -1547,6 +1593,8 @@ K_TUPLE:       T U P L E;
 
 K_TRIGGER:     T R I G G E R;
 K_STATIC:      S T A T I C;
+K_MATERIALIZED:M A T E R I A L I Z E D;
+K_VIEW:        V I E W;
 K_FROZEN:      F R O Z E N;
 
 K_FUNCTION:    F U N C T I O N;
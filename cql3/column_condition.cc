@@ -74,7 +74,67 @@ void column_condition::collect_marker_specificaton(::shared_ptr<variable_specifi
             value->collect_marker_specification(bound_names);
         }
     }
-    _value->collect_marker_specification(bound_names);
+    if (_value) {
+        _value->collect_marker_specification(bound_names);
+    }
+}
+
+// Whether "current op value" holds, with a null value or current value
+// only ever equal to another null.
+static bool compare_with_operator(const column_definition& column, const operator_type& op, const bytes_view_opt& value, const bytes_opt& current) {
+    if (!value) {
+        if (op == operator_type::EQ) {
+            return !current;
+        } else if (op == operator_type::NEQ) {
+            return bool(current);
+        }
+        throw exceptions::invalid_request_exception(sprint("Invalid comparison with null for operator \"%s\"", op));
+    }
+    if (!current) {
+        // the condition value is not null, so only NEQ can return true
+        return op == operator_type::NEQ;
+    }
+    auto comparison = column.type->compare(*current, *value);
+    if (op == operator_type::EQ) {
+        return comparison == 0;
+    } else if (op == operator_type::LT) {
+        return comparison < 0;
+    } else if (op == operator_type::LTE) {
+        return comparison <= 0;
+    } else if (op == operator_type::GT) {
+        return comparison > 0;
+    } else if (op == operator_type::GTE) {
+        return comparison >= 0;
+    } else if (op == operator_type::NEQ) {
+        return comparison != 0;
+    }
+    // we shouldn't get IN, CONTAINS, or CONTAINS KEY here
+    abort();
+}
+
+bool
+column_condition::applies_to(const bytes_opt& current, const query_options& options) {
+    if (_collection_element) {
+        throw exceptions::invalid_request_exception(sprint("Conditions on elements of collection column %s are not supported", column.name_as_text()));
+    }
+    if (_op != operator_type::IN) {
+        return compare_with_operator(column, _op, _value->bind_and_get(options), current);
+    }
+    if (!_in_values.empty()) {
+        return std::any_of(_in_values.begin(), _in_values.end(), [&] (auto&& value) {
+            return compare_with_operator(column, operator_type::EQ, value->bind_and_get(options), current);
+        });
+    }
+    auto in_values = dynamic_pointer_cast<multi_item_terminal>(_value->bind(options));
+    if (!in_values) {
+        return false;
+    }
+    for (auto&& value : in_values->get_elements()) {
+        if (compare_with_operator(column, operator_type::EQ, value ? bytes_view_opt(*value) : bytes_view_opt(), current)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 ::shared_ptr<column_condition>
@@ -83,6 +143,10 @@ column_condition::raw::prepare(database& db, const sstring& keyspace, const colu
         throw exceptions::invalid_request_exception("Conditions on counters are not supported");
     }
 
+    if (receiver.type->is_collection() && receiver.type->is_multi_cell()) {
+        throw exceptions::invalid_request_exception(sprint("Conditions on non-frozen collection column %s are not supported", receiver.name_as_text()));
+    }
+
     if (!_collection_element) {
         if (_op == operator_type::IN) {
             if (_in_values.empty()) { // ?
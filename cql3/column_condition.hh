@@ -115,6 +115,14 @@ class column_condition final {
      */
     void collect_marker_specificaton(::shared_ptr<variable_specifications> bound_names);
 
+    /**
+     * Validates whether this condition applies to the current value of the
+     * column, disengaged when the column has no live value. Conditions are
+     * only on whole values, of columns other than non-frozen collections.
+     * Throws for conditions on collection elements.
+     */
+    bool applies_to(const bytes_opt& current, const query_options& options);
+
 #if 0
     public ColumnCondition.Bound bind(QueryOptions options) throws InvalidRequestException
     {
@@ -153,6 +153,30 @@ constants::literal::prepare(database& db, const sstring& keyspace, ::shared_ptr<
     return ::make_shared<value>(std::experimental::make_optional(parsed_value(receiver->type)));
 }
 
+static int64_t bind_counter_increment(::shared_ptr<term> t, const update_parameters& params) {
+    auto value = t->bind_and_get(params._options);
+    if (!value) {
+        throw exceptions::invalid_request_exception("Invalid null value for counter increment");
+    }
+    if (value->size() != sizeof(int64_t)) {
+        throw exceptions::invalid_request_exception("Invalid counter increment, a bigint was expected");
+    }
+    return boost::any_cast<int64_t>(long_type->deserialize(*value));
+}
+
+void constants::adder::execute(mutation& m, const exploded_clustering_prefix& prefix, const update_parameters& params) {
+    auto increment = bind_counter_increment(_t, params);
+    m.set_cell(prefix, column, params.make_counter_update_cell(increment));
+}
+
+void constants::subtracter::execute(mutation& m, const exploded_clustering_prefix& prefix, const update_parameters& params) {
+    auto increment = bind_counter_increment(_t, params);
+    if (increment == std::numeric_limits<int64_t>::min()) {
+        throw exceptions::invalid_request_exception(sprint("The negation of %d overflows supported counter precision (signed 8 bytes integer)", increment));
+    }
+    m.set_cell(prefix, column, params.make_counter_update_cell(-increment));
+}
+
 void constants::deleter::execute(mutation& m, const exploded_clustering_prefix& prefix, const update_parameters& params) {
     if (column.type->is_multi_cell()) {
         collection_type_impl::mutation coll_m;
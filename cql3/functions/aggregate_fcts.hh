@@ -41,6 +41,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstring>
 #include "aggregate_function.hh"
 #include "native_aggregate_function.hh"
 
@@ -52,6 +54,55 @@ namespace functions {
  */
 namespace aggregate_fcts {
 
+/**
+ * Decodes the non-null values of a batch of values of Type, for the kernels
+ * of the aggregates to run over contiguous values rather than over each
+ * value through boost::any.
+ */
+template <typename Type>
+struct batch_values {
+    static void decode(const std::vector<bytes_opt>& values, std::vector<Type>& out) {
+        auto type = data_type_for<Type>();
+        for (auto&& v : values) {
+            if (v) {
+                out.push_back(boost::any_cast<Type>(type->deserialize(*v)));
+            }
+        }
+    }
+};
+
+// The fixed-size numeric types are decoded straight from their big-endian
+// form, read as an integer of their size.
+template <typename Type, typename Int>
+struct fixed_size_batch_values {
+    static_assert(sizeof(Type) == sizeof(Int), "size mismatch");
+
+    static void decode(const std::vector<bytes_opt>& values, std::vector<Type>& out) {
+        out.reserve(out.size() + values.size());
+        for (auto&& v : values) {
+            // An empty value is a null, which deserialize() would return.
+            if (v && !v->empty()) {
+                auto i = read_simple_exactly<Int>(*v);
+                Type x;
+                std::memcpy(&x, &i, sizeof(x));
+                out.push_back(x);
+            }
+        }
+    }
+};
+
+template <>
+struct batch_values<int32_t> : fixed_size_batch_values<int32_t, int32_t> {};
+
+template <>
+struct batch_values<int64_t> : fixed_size_batch_values<int64_t, int64_t> {};
+
+template <>
+struct batch_values<float> : fixed_size_batch_values<float, uint32_t> {};
+
+template <>
+struct batch_values<double> : fixed_size_batch_values<double, uint64_t> {};
+
 class impl_count_function : public aggregate_function::aggregate {
     int64_t _count;
 public:
@@ -64,6 +115,9 @@ class impl_count_function : public aggregate_function::aggregate {
     virtual void add_input(serialization_format sf, const std::vector<opt_bytes>& values) override {
         ++_count;
     }
+    virtual void add_rows(serialization_format sf, size_t rows) override {
+        _count += rows;
+    }
 };
 
     /**
@@ -79,6 +133,7 @@ make_count_rows_function() {
 template <typename Type>
 class impl_sum_function_for final : public aggregate_function::aggregate {
    Type _sum{};
+   std::vector<Type> _batch;
 public:
     virtual void reset() override {
         _sum = {};
@@ -92,6 +147,17 @@ class impl_sum_function_for final : public aggregate_function::aggregate {
         }
         _sum += boost::any_cast<Type>(data_type_for<Type>()->deserialize(*values[0]));
     }
+    virtual void add_batch(serialization_format sf, const std::vector<opt_bytes>& values) override {
+        _batch.clear();
+        batch_values<Type>::decode(values, _batch);
+        // Vectorized by the compiler for the integers. Floating-point values
+        // are added in order, to the same sum as one row at a time.
+        Type sum = _sum;
+        for (auto v : _batch) {
+            sum += v;
+        }
+        _sum = sum;
+    }
 };
 
 template <typename Type>
@@ -115,6 +181,7 @@ template <typename Type>
 class impl_avg_function_for final : public aggregate_function::aggregate {
    Type _sum{};
    int64_t _count = 0;
+   std::vector<Type> _batch;
 public:
     virtual void reset() override {
         _sum = {};
@@ -134,6 +201,16 @@ class impl_avg_function_for final : public aggregate_function::aggregate {
         ++_count;
         _sum += boost::any_cast<Type>(data_type_for<Type>()->deserialize(*values[0]));
     }
+    virtual void add_batch(serialization_format sf, const std::vector<opt_bytes>& values) override {
+        _batch.clear();
+        batch_values<Type>::decode(values, _batch);
+        Type sum = _sum;
+        for (auto v : _batch) {
+            sum += v;
+        }
+        _sum = sum;
+        _count += _batch.size();
+    }
 };
 
 template <typename Type>
@@ -155,6 +232,7 @@ make_avg_function() {
 template <typename Type>
 class impl_max_function_for final : public aggregate_function::aggregate {
    std::experimental::optional<Type> _max{};
+   std::vector<Type> _batch;
 public:
     virtual void reset() override {
         _max = {};
@@ -176,6 +254,18 @@ class impl_max_function_for final : public aggregate_function::aggregate {
             _max = std::max(*_max, val);
         }
     }
+    virtual void add_batch(serialization_format sf, const std::vector<opt_bytes>& values) override {
+        _batch.clear();
+        batch_values<Type>::decode(values, _batch);
+        if (_batch.empty()) {
+            return;
+        }
+        Type max = _max ? *_max : _batch.front();
+        for (auto v : _batch) {
+            max = std::max(max, v);
+        }
+        _max = max;
+    }
 };
 
 template <typename Type>
@@ -202,6 +292,7 @@ make_max_function() {
 template <typename Type>
 class impl_min_function_for final : public aggregate_function::aggregate {
    std::experimental::optional<Type> _min{};
+   std::vector<Type> _batch;
 public:
     virtual void reset() override {
         _min = {};
@@ -223,6 +314,18 @@ class impl_min_function_for final : public aggregate_function::aggregate {
             _min = std::min(*_min, val);
         }
     }
+    virtual void add_batch(serialization_format sf, const std::vector<opt_bytes>& values) override {
+        _batch.clear();
+        batch_values<Type>::decode(values, _batch);
+        if (_batch.empty()) {
+            return;
+        }
+        Type min = _min ? *_min : _batch.front();
+        for (auto v : _batch) {
+            min = std::min(min, v);
+        }
+        _min = min;
+    }
 };
 
 template <typename Type>
@@ -264,6 +367,9 @@ class impl_count_function_for final : public aggregate_function::aggregate {
         }
         ++_count;
     }
+    virtual void add_batch(serialization_format sf, const std::vector<opt_bytes>& values) override {
+        _count += std::count_if(values.begin(), values.end(), [] (const opt_bytes& v) { return bool(v); });
+    }
 };
 
 template <typename Type>
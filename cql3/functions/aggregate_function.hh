@@ -79,6 +79,32 @@ class aggregate_function : public virtual function {
          */
         virtual void add_input(serialization_format sf, const std::vector<opt_bytes>& values) = 0;
 
+        /**
+         * Adds rows to this aggregate, which takes no argument.
+         *
+         * @param rows the number of rows
+         */
+        virtual void add_rows(serialization_format sf, size_t rows) {
+            std::vector<opt_bytes> args;
+            for (size_t i = 0; i < rows; ++i) {
+                add_input(sf, args);
+            }
+        }
+
+        /**
+         * Adds the values of the only argument of this aggregate for a batch of rows, as add_input() would
+         * one row at a time.
+         *
+         * @param values the value of the argument for each row
+         */
+        virtual void add_batch(serialization_format sf, const std::vector<opt_bytes>& values) {
+            std::vector<opt_bytes> args(1);
+            for (auto&& v : values) {
+                args[0] = v;
+                add_input(sf, args);
+            }
+        }
+
         /**
          * Computes and returns the aggregate current value.
          *
@@ -325,11 +325,12 @@ lists::do_append(shared_ptr<term> t,
         auto&& to_add = list_value->_elements;
         collection_type_impl::mutation appended;
         appended.cells.reserve(to_add.size());
-        for (auto&& e : to_add) {
-            auto uuid1 = utils::UUID_gen::get_time_UUID_bytes();
+        auto uuids = utils::UUID_gen::get_time_UUIDs(to_add.size());
+        for (size_t i = 0; i < to_add.size(); ++i) {
+            auto uuid1 = utils::UUID_gen::decompose(uuids[i]);
             auto uuid = bytes(reinterpret_cast<const int8_t*>(uuid1.data()), uuid1.size());
             // FIXME: can e be empty?
-            appended.cells.emplace_back(std::move(uuid), params.make_cell(*e));
+            appended.cells.emplace_back(std::move(uuid), params.make_cell(*to_add[i]));
         }
         m.set_cell(prefix, column, ltype->serialize_mutation_form(appended));
     } else {
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include "core/shared_ptr.hh"
+#include "cql3/statements/parsed_statement.hh"
+
+namespace cql3 {
+
+/**
+ * Prepared statements, bounded by the memory they are estimated to take.
+ * The least recently used statements are evicted to make room for new ones.
+ * Evicted statements which are still being executed stay alive until their
+ * executions complete.
+ */
+template <typename Key>
+class prepared_statements_cache {
+public:
+    using prepared_ptr = ::shared_ptr<statements::parsed_statement::prepared>;
+
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+private:
+    struct entry {
+        Key key;
+        prepared_ptr prepared;
+        size_t size;
+    };
+    using lru_type = std::list<entry>;
+
+    // Most recently used first.
+    lru_type _lru;
+    std::unordered_map<Key, typename lru_type::iterator> _index;
+    size_t _size = 0;
+    size_t _max_size;
+    stats _stats;
+private:
+    void evict() {
+        // Never evicts the statement just inserted.
+        while (_size > _max_size && _lru.size() > 1) {
+            auto& e = _lru.back();
+            _size -= e.size;
+            _index.erase(e.key);
+            _lru.pop_back();
+            ++_stats.evictions;
+        }
+    }
+public:
+    explicit prepared_statements_cache(size_t max_size) : _max_size(max_size) {}
+
+    // Returns the statement, made the most recently used one, or null if it
+    // is not cached. Counts as a hit or a miss.
+    prepared_ptr get(const Key& key) {
+        auto p = find(key);
+        if (p) {
+            ++_stats.hits;
+        } else {
+            ++_stats.misses;
+        }
+        return p;
+    }
+
+    // Like get(), without being accounted.
+    prepared_ptr find(const Key& key) {
+        auto it = _index.find(key);
+        if (it == _index.end()) {
+            return prepared_ptr();
+        }
+        _lru.splice(_lru.begin(), _lru, it->second);
+        return it->second->prepared;
+    }
+
+    void insert(Key key, prepared_ptr prepared, size_t size) {
+        if (_index.count(key)) {
+            return;
+        }
+        _lru.push_front(entry{key, std::move(prepared), size});
+        _index.emplace(std::move(key), _lru.begin());
+        _size += size;
+        evict();
+    }
+
+    void erase(const Key& key) {
+        auto it = _index.find(key);
+        if (it != _index.end()) {
+            _size -= it->second->size;
+            _lru.erase(it->second);
+            _index.erase(it);
+        }
+    }
+
+    template <typename Predicate>
+    void remove_if(Predicate pred) {
+        for (auto it = _lru.begin(); it != _lru.end();) {
+            if (pred(it->prepared)) {
+                _size -= it->size;
+                _index.erase(it->key);
+                it = _lru.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    size_t count() const {
+        return _index.size();
+    }
+
+    // The estimated memory taken by the statements.
+    size_t size() const {
+        return _size;
+    }
+
+    size_t max_size() const {
+        return _max_size;
+    }
+
+    const stats& get_stats() const {
+        return _stats;
+    }
+};
+
+}
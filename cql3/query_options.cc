@@ -201,19 +201,21 @@ void query_options::prepare(const std::vector<::shared_ptr<column_specification>
         return;
     }
 
+    // Reorders the views, which point into the request, or into _values,
+    // whose elements don't move.
     auto& names = *_names;
-    std::vector<bytes_opt> ordered_values;
+    std::vector<bytes_view_opt> ordered_values;
     ordered_values.reserve(specs.size());
     for (auto&& spec : specs) {
         auto& spec_name = spec->name->text();
         for (size_t j = 0; j < names.size(); j++) {
             if (names[j] == spec_name) {
-                ordered_values.emplace_back(_values[j]);
+                ordered_values.emplace_back(_value_views[j]);
                 break;
             }
         }
     }
-    _values = std::move(ordered_values);
+    _value_views = std::move(ordered_values);
 }
 
 }
@@ -45,6 +45,9 @@
 #include "cql3/statements/batch_statement.hh"
 
 #include "transport/messages/result_message.hh"
+#include "db/config.hh"
+#include "core/memory.hh"
+#include "utils/cpu_scheduler.hh"
 
 #define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
 #include <cryptopp/md5.h>
@@ -89,11 +92,30 @@ api::timestamp_type query_processor::next_timestamp() {
     return _internal_state->next_timestamp();
 }
 
+// 0 means the given fraction of the shard's memory.
+static size_t cache_size(uint32_t size_in_mb, size_t memory_fraction)
+{
+    if (size_in_mb) {
+        return size_t(size_in_mb) << 20;
+    }
+    return std::max<size_t>(memory::stats().total_memory() / memory_fraction, 1 << 20);
+}
+
+// Statements can't be measured, so this goes by the length of their text,
+// which the size of the parsed statement grows with, and by their bound
+// variables.
+static size_t estimate_prepared_size(const std::experimental::string_view& query_string, const parsed_statement::prepared& prepared)
+{
+    return 1024 + 16 * query_string.size() + 256 * prepared.bound_names.size();
+}
+
 query_processor::query_processor(distributed<service::storage_proxy>& proxy,
         distributed<database>& db)
     : _migration_subscriber{std::make_unique<migration_subscriber>(this)}
     , _proxy(proxy)
     , _db(db)
+    , _prepared_statements(cache_size(db.local().get_config().prepared_statements_cache_size_in_mb(), 256))
+    , _unprepared_statements(cache_size(db.local().get_config().unprepared_statements_cache_size_in_mb(), 512))
     , _internal_state(new internal_state())
 {
     service::get_local_migration_manager().register_listener(_migration_subscriber.get());
@@ -111,7 +133,11 @@ future<> query_processor::stop()
 future<::shared_ptr<result_message>>
 query_processor::process(const sstring_view& query_string, service::query_state& query_state, query_options& options)
 {
-    auto p = get_statement(query_string, query_state.get_client_state());
+    auto start = std::chrono::steady_clock::now();
+    auto p = get_cached_statement(query_string, query_state.get_client_state());
+    if (auto& trace_state = query_state.get_trace_state()) {
+        trace_state->add_stage_time(tracing::stage::parse, std::chrono::steady_clock::now() - start);
+    }
     options.prepare(p->bound_names);
     auto cql_statement = p->statement;
     if (cql_statement->get_bound_terms() != options.get_values_count()) {
@@ -134,6 +160,8 @@ query_processor::process_statement(::shared_ptr<cql_statement> statement, servic
         logger.trace("Process {} @CL.{}", statement, options.getConsistency());
 #endif
     auto& client_state = query_state.get_client_state();
+    // Background work yields to client statements while they are processed.
+    auto fg = local_cpu_scheduler().start_foreground();
     statement->check_access(client_state);
     statement->validate(_proxy, client_state);
 
@@ -144,12 +172,13 @@ query_processor::process_statement(::shared_ptr<cql_statement> statement, servic
         fut = statement->execute(_proxy, query_state, options);
     }
 
-    return fut.then([statement] (auto msg) {
+    return fut.then([statement, fg = std::move(fg)] (auto msg) {
         if (msg) {
             return make_ready_future<::shared_ptr<result_message>>(std::move(msg));
         }
-        return make_ready_future<::shared_ptr<result_message>>(
-            ::make_shared<result_message::void_message>());
+        // A void message carries nothing, so all statements share one.
+        static thread_local ::shared_ptr<result_message> void_msg = ::make_shared<result_message::void_message>();
+        return make_ready_future<::shared_ptr<result_message>>(void_msg);
     });
 }
 
@@ -188,11 +217,11 @@ query_processor::get_stored_prepared_statement(const std::experimental::string_v
 #endif
     } else {
         auto statement_id = compute_id(query_string, keyspace);
-        auto it = _prepared_statements.find(statement_id);
-        if (it == _prepared_statements.end()) {
+        auto prepared = _prepared_statements.find(statement_id);
+        if (!prepared) {
             return ::shared_ptr<result_message::prepared>();
         }
-        return ::make_shared<result_message::prepared>(statement_id, it->second);
+        return ::make_shared<result_message::prepared>(statement_id, std::move(prepared));
     }
 }
 
@@ -200,16 +229,14 @@ future<::shared_ptr<transport::messages::result_message::prepared>>
 query_processor::store_prepared_statement(const std::experimental::string_view& query_string, const sstring& keyspace,
         ::shared_ptr<statements::parsed_statement::prepared> prepared, bool for_thrift)
 {
-#if 0
     // Concatenate the current keyspace so we don't mix prepared statements between keyspace (#5352).
     // (if the keyspace is null, queryString has to have a fully-qualified keyspace so it's fine.
-    long statementSize = measure(prepared.statement);
+    auto statement_size = estimate_prepared_size(query_string, *prepared);
     // don't execute the statement if it's bigger than the allowed threshold
-    if (statementSize > MAX_CACHE_PREPARED_MEMORY)
-        throw new InvalidRequestException(String.format("Prepared statement of size %d bytes is larger than allowed maximum of %d bytes.",
-                                                        statementSize,
-                                                        MAX_CACHE_PREPARED_MEMORY));
-#endif
+    if (statement_size > _prepared_statements.max_size()) {
+        throw exceptions::invalid_request_exception(sprint("Prepared statement of size %d bytes is larger than allowed maximum of %d bytes.",
+                statement_size, _prepared_statements.max_size()));
+    }
     if (for_thrift) {
         throw std::runtime_error("not implemented");
 #if 0
@@ -219,15 +246,19 @@ query_processor::store_prepared_statement(const std::experimental::string_view&
 #endif
     } else {
         auto statement_id = compute_id(query_string, keyspace);
-        _prepared_statements.emplace(statement_id, prepared);
+        _prepared_statements.insert(statement_id, prepared, statement_size);
         auto msg = ::make_shared<result_message::prepared>(statement_id, prepared);
         return make_ready_future<::shared_ptr<result_message::prepared>>(std::move(msg));
     }
 }
 
-void query_processor::invalidate_prepared_statement(bytes statement_id)
+void query_processor::invalidate_statements(const sstring& ks_name, const std::experimental::optional<sstring>& cf_name)
 {
-    _prepared_statements.erase(statement_id);
+    auto invalid = [&] (const ::shared_ptr<parsed_statement::prepared>& p) {
+        return migration_subscriber::should_invalidate(ks_name, cf_name, p->statement);
+    };
+    _prepared_statements.remove_if(invalid);
+    _unprepared_statements.remove_if(invalid);
 }
 
 static bytes md5_calculate(const std::experimental::string_view& s)
@@ -249,6 +280,22 @@ bytes query_processor::compute_id(const std::experimental::string_view& query_st
     return md5_calculate(to_hash);
 }
 
+::shared_ptr<parsed_statement::prepared>
+query_processor::get_cached_statement(const sstring_view& query, const service::client_state& client_state)
+{
+    // ':' can't appear in keyspace names, so keys can't collide.
+    auto key = client_state.get_raw_keyspace() + ":" + query.to_string();
+    auto p = _unprepared_statements.get(key);
+    if (!p) {
+        p = get_statement(query, client_state);
+        auto size = estimate_prepared_size(query, *p);
+        if (size <= _unprepared_statements.max_size()) {
+            _unprepared_statements.insert(std::move(key), p, size);
+        }
+    }
+    return p;
+}
+
 ::shared_ptr<parsed_statement::prepared>
 query_processor::get_statement(const sstring_view& query, const service::client_state& client_state)
 {
@@ -427,21 +474,12 @@ void query_processor::migration_subscriber::on_drop_aggregate(const sstring& ks_
     log.warn("{} event ignored", __func__);
 }
 
+// Each shard caches the statements it saw by itself.
 void query_processor::migration_subscriber::remove_invalid_prepared_statements(sstring ks_name, std::experimental::optional<sstring> cf_name)
 {
-    std::vector<bytes> invalid;
-    for (auto& kv : _qp->_prepared_statements) {
-        auto id   = kv.first;
-        auto stmt = kv.second;
-        if (should_invalidate(ks_name, cf_name, stmt->statement)) {
-            invalid.emplace_back(id);
-        }
-    }
-    for (auto& id : invalid) {
-        get_query_processor().invoke_on_all([id] (auto& qp) {
-            qp.invalidate_prepared_statement(id);
-        });
-    }
+    get_query_processor().invoke_on_all([ks_name, cf_name] (auto& qp) {
+        qp.invalidate_statements(ks_name, cf_name);
+    });
 }
 
 bool query_processor::migration_subscriber::should_invalidate(sstring ks_name, std::experimental::optional<sstring> cf_name, ::shared_ptr<cql_statement> statement)
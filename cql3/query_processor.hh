@@ -48,6 +48,7 @@
 #include "exceptions/exceptions.hh"
 #include "cql3/query_options.hh"
 #include "cql3/statements/cf_statement.hh"
+#include "cql3/prepared_statements_cache.hh"
 #include "service/migration_manager.hh"
 #include "service/query_state.hh"
 #include "log.hh"
@@ -112,7 +113,16 @@ class query_processor {
     };
 #endif
 
-    std::unordered_map<bytes, ::shared_ptr<statements::parsed_statement::prepared>> _prepared_statements;
+private:
+    // Keyed by statement id. Misses are executions of statements not, or no
+    // longer, prepared on this shard, which the client then has to prepare
+    // again.
+    prepared_statements_cache<bytes> _prepared_statements;
+    // The statements parsed for unprepared queries, keyed by the current
+    // keyspace and the query text, so that clients sending the same literal
+    // queries over and over don't have them parsed each time. Kept apart
+    // from the prepared statements so that they can't evict those.
+    prepared_statements_cache<sstring> _unprepared_statements;
     std::unordered_map<sstring, ::shared_ptr<statements::parsed_statement::prepared>> _internal_statements;
 #if 0
     private static final ConcurrentLinkedHashMap<Integer, ParsedStatement.Prepared> thriftPreparedStatements;
@@ -206,11 +216,15 @@ class query_processor {
 #endif
 public:
     ::shared_ptr<statements::parsed_statement::prepared> get_prepared(const bytes& id) {
-        auto it = _prepared_statements.find(id);
-        if (it == _prepared_statements.end()) {
-            return ::shared_ptr<statements::parsed_statement::prepared>{};
-        }
-        return it->second;
+        return _prepared_statements.get(id);
+    }
+
+    const prepared_statements_cache<bytes>& prepared_statements() const {
+        return _prepared_statements;
+    }
+
+    const prepared_statements_cache<sstring>& unprepared_statements() const {
+        return _unprepared_statements;
     }
 
 #if 0
@@ -427,7 +441,12 @@ class query_processor {
     future<::shared_ptr<transport::messages::result_message::prepared>>
     store_prepared_statement(const std::experimental::string_view& query_string, const sstring& keyspace, ::shared_ptr<statements::parsed_statement::prepared> prepared, bool for_thrift);
 
-    void invalidate_prepared_statement(bytes statement_id);
+    // Drops the statements, prepared or not, which depend on the table, or
+    // on the whole keyspace when cf_name is not set.
+    void invalidate_statements(const sstring& ks_name, const std::experimental::optional<sstring>& cf_name);
+
+    ::shared_ptr<statements::parsed_statement::prepared> get_cached_statement(const std::experimental::string_view& query,
+            const service::client_state& client_state);
 
 #if 0
     public ResultMessage processPrepared(CQLStatement statement, QueryState queryState, QueryOptions options)
@@ -498,7 +517,8 @@ class query_processor::migration_subscriber : public service::migration_listener
     virtual void on_drop_aggregate(const sstring& ks_name, const sstring& aggregate_name) override;
 private:
     void remove_invalid_prepared_statements(sstring ks_name, std::experimental::optional<sstring> cf_name);
-    bool should_invalidate(sstring ks_name, std::experimental::optional<sstring> cf_name, ::shared_ptr<cql_statement> statement);
+public:
+    static bool should_invalidate(sstring ks_name, std::experimental::optional<sstring> cf_name, ::shared_ptr<cql_statement> statement);
 };
 
 extern distributed<query_processor> _the_query_processor;
@@ -239,15 +239,26 @@ class single_column_primary_key_restrictions : public primary_key_restrictions<V
                     return std::move(ranges);
                 }
 
+                // Bound once, not for each prefix.
+                auto bind_bound = [r, &options] (statements::bound bound) -> bytes_opt {
+                    if (!r->has_bound(bound)) {
+                        return {};
+                    }
+                    auto value = std::move(r->bounds(bound, options)[0]);
+                    if (!value) {
+                        throw exceptions::invalid_request_exception(sprint(invalid_null_msg, r->to_string()));
+                    }
+                    return value;
+                };
+                auto start = bind_bound(statements::bound::START);
+                auto end = bind_bound(statements::bound::END);
+
                 ranges.reserve(cartesian_product_size(vec_of_values));
                 for (auto&& prefix : make_cartesian_product(vec_of_values)) {
-                    auto read_bound = [r, &prefix, &options, this](statements::bound bound) -> range_bound {
-                        if (r->has_bound(bound)) {
-                            auto value = std::move(r->bounds(bound, options)[0]);
-                            if (!value) {
-                                throw exceptions::invalid_request_exception(sprint(invalid_null_msg, r->to_string()));
-                            }
-                            prefix.emplace_back(std::move(value));
+                    auto read_bound = [r, &prefix, &start, &end, this](statements::bound bound) -> range_bound {
+                        auto& value = bound == statements::bound::START ? start : end;
+                        if (value) {
+                            prefix.emplace_back(value);
                             auto val = ValueType::from_optional_exploded(*_schema, prefix);
                             prefix.pop_back();
                             return range_bound(std::move(val), r->is_inclusive(bound));
@@ -277,6 +288,17 @@ class single_column_primary_key_restrictions : public primary_key_restrictions<V
             if (values.empty()) {
                 return {};
             }
+            if (std::is_same<ValueType, clustering_key_prefix>::value) {
+                // With the values of each column in clustering order, the
+                // product comes out in clustering order, and without
+                // duplicates, so its ranges need no sorting.
+                std::sort(values.begin(), values.end(), [def] (const bytes_opt& a, const bytes_opt& b) {
+                    return def->type->less(*a, *b);
+                });
+                values.erase(std::unique(values.begin(), values.end(), [def] (const bytes_opt& a, const bytes_opt& b) {
+                    return def->type->equal(*a, *b);
+                }), values.end());
+            }
             vec_of_values.emplace_back(std::move(values));
         }
 
@@ -334,17 +356,18 @@ class single_column_primary_key_restrictions : public primary_key_restrictions<V
 template<>
 std::vector<query::partition_range>
 single_column_primary_key_restrictions<partition_key>::bounds_ranges(const query_options& options) const {
-    std::vector<query::partition_range> ranges;
-    ranges.reserve(size());
+    std::vector<partition_key> keys;
     for (query::range<partition_key>& r : compute_bounds(options)) {
         if (!r.is_singular()) {
             throw exceptions::invalid_request_exception("Range queries on partition key values not supported.");
         }
-        ranges.emplace_back(std::move(r).transform<query::ring_position>(
-            [this] (partition_key&& k) -> query::ring_position {
-                auto token = dht::global_partitioner().get_token(*_schema, k);
-                return { std::move(token), std::move(k) };
-            }));
+        keys.push_back(r.start()->value());
+    }
+    // The keys of an IN are hashed together.
+    std::vector<query::partition_range> ranges;
+    ranges.reserve(keys.size());
+    for (auto&& dk : dht::global_partitioner().decorate_keys(*_schema, std::move(keys))) {
+        ranges.emplace_back(query::partition_range::make_singular(std::move(dk)));
     }
     return ranges;
 }
@@ -352,31 +375,8 @@ single_column_primary_key_restrictions<partition_key>::bounds_ranges(const query
 template<>
 std::vector<query::clustering_range>
 single_column_primary_key_restrictions<clustering_key_prefix>::bounds_ranges(const query_options& options) const {
-    auto bounds = compute_bounds(options);
-    auto less_cmp = clustering_key_prefix::less_compare(*_schema);
-    std::sort(bounds.begin(), bounds.end(), [&] (query::clustering_range& x, query::clustering_range& y) {
-        if (!x.start() && !y.start()) {
-            return false;
-        }
-        if (!x.start()) {
-            return true;
-        }
-        if (!y.start()) {
-            return false;
-        }
-        return less_cmp(x.start()->value(), y.start()->value());
-    });
-    auto eq_cmp = clustering_key_prefix::equality(*_schema);
-    bounds.erase(std::unique(bounds.begin(), bounds.end(), [&] (query::clustering_range& x, query::clustering_range& y) {
-        if (!x.start() && !y.start()) {
-            return true;
-        }
-        if (!x.start() || !y.start()) {
-            return false;
-        }
-        return eq_cmp(x.start()->value(), y.start()->value());
-    }), bounds.end());
-    return bounds;
+    // Already sorted and distinct, see compute_bounds().
+    return compute_bounds(options);
 }
 
 }
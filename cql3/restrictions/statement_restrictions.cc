@@ -23,6 +23,7 @@
 #include <boost/range/algorithm/transform.hpp>
 #include <boost/range/algorithm.hpp>
 #include <boost/range/adaptors.hpp>
+#include <boost/algorithm/cxx11/all_of.hpp>
 
 #include "statement_restrictions.hh"
 #include "single_column_primary_key_restrictions.hh"
@@ -153,15 +154,9 @@ statement_restrictions::statement_restrictions(database& db,
         }
     }
 
-    warn(unimplemented::cause::INDEXES);
-#if 0
-    ColumnFamilyStore cfs = Keyspace.open(cfm.ks_name).getColumnFamilyStore(cfm.cfName);
-    secondary_index_manager secondaryIndexManager = cfs.index_manager;
-#endif
-    bool has_queriable_clustering_column_index = false; /*_clustering_columns_restrictions->has_supporting_index(secondaryIndexManager);*/
-    bool has_queriable_index = false; /*has_queriable_clustering_column_index
-            || _partition_key_restrictions->has_supporting_index(secondaryIndexManager)
-            || nonprimary_key_restrictions->has_supporting_index(secondaryIndexManager);*/
+    // Only regular columns can be indexed, and only looked up by EQ.
+    bool has_queriable_clustering_column_index = false;
+    bool has_queriable_index = bool(get_indexed_restriction());
 
     // At this point, the select statement if fully constructed, but we still have a few things to validate
     process_partition_key_restrictions(has_queriable_index);
@@ -212,19 +207,101 @@ statement_restrictions::statement_restrictions(database& db,
         uses_secondary_indexing = true;
 #endif
     }
-    // Even if uses_secondary_indexing is false at this point, we'll still have to use one if
-    // there is restrictions not covered by the PK.
+    // Restrictions not covered by the PK are looked up in an index if one
+    // supports them, and checked by the replicas against the rows they read
+    // otherwise.
     if (!_nonprimary_key_restrictions->empty()) {
-        _uses_secondary_indexing = true;
+        _uses_secondary_indexing = _uses_secondary_indexing || has_queriable_index;
         _index_restrictions.push_back(_nonprimary_key_restrictions);
+        for (auto&& def : _nonprimary_key_restrictions->get_column_defs()) {
+            auto r = _nonprimary_key_restrictions->get_restriction(*def);
+            if (r.get() == get_indexed_restriction().get()) {
+                continue;
+            }
+            if (def->is_static() || !def->is_atomic() || r->is_contains()) {
+                throw exceptions::invalid_request_exception(sprint(
+                    "Cannot filter on column %s: only non-collection regular columns can be filtered on, by equality, IN or inequality relations",
+                    def->name_as_text()));
+            }
+        }
     }
 
     if (_uses_secondary_indexing) {
-        fail(unimplemented::cause::INDEXES);
-#if 0
         validate_secondary_index_selections(selects_only_static_columns);
-#endif
+        // The index is looked up for a single value, the other restrictions
+        // not covered by the PK being checked by the replicas.
+        bool only_indexed = boost::algorithm::all_of(_index_restrictions, [this] (auto&& r) {
+            return r.get() == _nonprimary_key_restrictions.get() || r->empty();
+        });
+        if (!only_indexed) {
+            throw exceptions::invalid_request_exception(
+                "Only queries restricting the primary key as without an index can use a secondary index");
+        }
+    }
+}
+
+::shared_ptr<restriction> statement_restrictions::get_indexed_restriction() const {
+    for (auto&& def : _nonprimary_key_restrictions->get_column_defs()) {
+        auto r = _nonprimary_key_restrictions->get_restriction(*def);
+        if (r->is_EQ() && def->idx_info.index_type != index_type::none) {
+            return r;
+        }
+    }
+    return {};
+}
+
+std::experimental::optional<query::index_restriction>
+statement_restrictions::get_index_restriction(const query_options& options) const {
+    if (!_uses_secondary_indexing) {
+        return {};
+    }
+    auto r = static_pointer_cast<single_column_restriction>(get_indexed_restriction());
+    auto value = r->value(options);
+    if (!value) {
+        throw exceptions::invalid_request_exception(sprint("Unsupported null value for indexed column %s",
+                r->get_column_def().name_as_text()));
+    }
+    return query::index_restriction{r->get_column_def().name(), std::move(*value)};
+}
+
+bool statement_restrictions::has_filtering_restrictions() const {
+    return _nonprimary_key_restrictions->size() > (_uses_secondary_indexing ? 1 : 0);
+}
+
+std::vector<query::column_filter> statement_restrictions::get_filters(const query_options& options) const {
+    std::vector<query::column_filter> filters;
+    auto indexed = _uses_secondary_indexing ? get_indexed_restriction() : ::shared_ptr<restriction>();
+    auto value_of = [] (const column_definition& def, bytes_opt v) {
+        if (!v) {
+            throw exceptions::invalid_request_exception(sprint("Unsupported null value for column %s", def.name_as_text()));
+        }
+        return std::move(*v);
+    };
+    for (auto&& def : _nonprimary_key_restrictions->get_column_defs()) {
+        auto r = _nonprimary_key_restrictions->get_restriction(*def);
+        if (r.get() == indexed.get()) {
+            continue;
+        }
+        if (r->is_EQ()) {
+            filters.push_back({def->id, query::column_filter::op::EQ, { value_of(*def, r->value(options)) }});
+        } else if (r->is_IN()) {
+            query::column_filter f{def->id, query::column_filter::op::IN, {}};
+            for (auto&& v : r->values(options)) {
+                f.values.push_back(value_of(*def, std::move(v)));
+            }
+            filters.push_back(std::move(f));
+        } else if (r->is_slice()) {
+            if (r->has_bound(statements::bound::START)) {
+                auto op = r->is_inclusive(statements::bound::START) ? query::column_filter::op::GTE : query::column_filter::op::GT;
+                filters.push_back({def->id, op, { value_of(*def, r->bounds(statements::bound::START, options)[0]) }});
+            }
+            if (r->has_bound(statements::bound::END)) {
+                auto op = r->is_inclusive(statements::bound::END) ? query::column_filter::op::LTE : query::column_filter::op::LT;
+                filters.push_back({def->id, op, { value_of(*def, r->bounds(statements::bound::END, options)[0]) }});
+            }
+        }
     }
+    return filters;
 }
 
 void statement_restrictions::add_restriction(::shared_ptr<restriction> restriction) {
@@ -44,6 +44,7 @@
 #include <vector>
 #include "to_string.hh"
 #include "schema.hh"
+#include "query-request.hh"
 #include "cql3/restrictions/restrictions.hh"
 #include "cql3/restrictions/primary_key_restrictions.hh"
 #include "cql3/restrictions/single_column_restrictions.hh"
@@ -147,7 +148,38 @@ class statement_restrictions {
         return _uses_secondary_indexing;
     }
 
+    /**
+     * Returns the restriction the secondary index is to be looked up for.
+     *
+     * @param options the query options
+     * @return the restriction on the indexed column, if the secondary index need to be queried.
+     * @throws InvalidRequestException if the value of the indexed column is null
+     */
+    std::experimental::optional<query::index_restriction> get_index_restriction(const query_options& options) const;
+
+    /**
+     * Checks if some restrictions on non-primary key columns are not looked up in a secondary index, but have the
+     * replicas filter the rows they read.
+     *
+     * @return <code>true</code> if the replicas need to filter rows, <code>false</code> otherwise.
+     */
+    bool has_filtering_restrictions() const;
+
+    /**
+     * Returns the filters the replicas are to check the rows against.
+     *
+     * @param options the query options
+     * @return the filters of the restrictions on non-primary key columns no index is looked up for
+     * @throws InvalidRequestException if a value is null
+     */
+    std::vector<query::column_filter> get_filters(const query_options& options) const;
+
 private:
+    /**
+     * Returns the EQ restriction on an indexed non-primary key column, if any.
+     */
+    ::shared_ptr<restriction> get_indexed_restriction() const;
+
     void process_partition_key_restrictions(bool has_queriable_index);
 
     /**
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/range/irange.hpp>
+#include <seastar/core/smp.hh>
+
+#include "cql3/result_cache.hh"
+
+namespace cql3 {
+
+result_cache& global_result_cache() {
+    static thread_local result_cache instance;
+    return instance;
+}
+
+result_cache::result_cache() {
+    setup_collectd();
+}
+
+void
+result_cache::setup_collectd() {
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("cql_result_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "used")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _memory)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cql_result_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "results")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _entries.size(); })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cql_result_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.hits)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cql_result_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "misses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.misses)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cql_result_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "insertions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.insertions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cql_result_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "invalidations")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.invalidations)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cql_result_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.evictions)
+        ),
+    }));
+}
+
+uint64_t result_cache::partition_hash(const utils::UUID& cf_id, const dht::token& t) {
+    return dht::token_prefix(t) ^ std::hash<utils::UUID>()(cf_id);
+}
+
+std::experimental::optional<std::vector<uint64_t>>
+result_cache::partitions_of(const schema& s, const std::vector<query::partition_range>& ranges) {
+    std::vector<uint64_t> partitions;
+    partitions.reserve(ranges.size());
+    for (auto&& r : ranges) {
+        if (!query::is_single_partition(r)) {
+            return {};
+        }
+        partitions.push_back(partition_hash(s.id(), r.start()->value().token()));
+    }
+    return std::move(partitions);
+}
+
+uint64_t result_cache::generation(const std::vector<uint64_t>& partitions) const {
+    // The counters only grow, so that the sum changes with any of them.
+    auto g = _clears;
+    for (auto p : partitions) {
+        g += _generations[p % generation_slots];
+    }
+    return g;
+}
+
+void result_cache::set_max_memory(size_t bytes) {
+    _max_memory = bytes;
+    while (_memory > _max_memory && !_lru.empty()) {
+        ++_stats.evictions;
+        erase(_lru.front());
+    }
+}
+
+lw_shared_ptr<query::result> result_cache::find(const key& k) {
+    auto i = _entries.find(k);
+    if (i == _entries.end()) {
+        ++_stats.misses;
+        return {};
+    }
+    auto& e = *i->second;
+    if (e.expiry <= lowres_clock::now()) {
+        ++_stats.misses;
+        erase(e);
+        return {};
+    }
+    ++_stats.hits;
+    e.unlink();
+    _lru.push_back(e);
+    return e.result;
+}
+
+void result_cache::insert(key k, const query::result& result, std::vector<uint64_t> partitions,
+        std::chrono::milliseconds ttl, uint64_t generation) {
+    if (generation != this->generation(partitions)) {
+        return;
+    }
+    auto memory = sizeof(entry) + k.values.size() + partitions.size() * sizeof(uint64_t) + result.serialized_size();
+    if (memory > _max_memory) {
+        return;
+    }
+    auto i = _entries.find(k);
+    if (i != _entries.end()) {
+        erase(*i->second);
+    }
+    while (_memory + memory > _max_memory) {
+        ++_stats.evictions;
+        erase(_lru.front());
+    }
+
+    // The result may be merged from parts of other shards, which must not
+    // be touched from here.
+    bytes_ostream buf;
+    result.for_each_view([&buf] (bytes_view v) {
+        buf.write(v);
+    });
+
+    auto e = std::make_unique<entry>();
+    e->key = k;
+    e->result = make_lw_shared<query::result>(std::move(buf));
+    e->partitions = std::move(partitions);
+    e->expiry = lowres_clock::now() + std::chrono::duration_cast<lowres_clock::duration>(ttl);
+    e->memory = memory;
+    for (auto p : e->partitions) {
+        _by_partition.emplace(p, e.get());
+    }
+    _lru.push_back(*e);
+    _memory += memory;
+    _entries.emplace(std::move(k), std::move(e));
+    ++_stats.insertions;
+}
+
+void result_cache::erase(entry& e) {
+    for (auto p : e.partitions) {
+        auto range = _by_partition.equal_range(p);
+        for (auto i = range.first; i != range.second; ++i) {
+            if (i->second == &e) {
+                _by_partition.erase(i);
+                break;
+            }
+        }
+    }
+    _memory -= e.memory;
+    _entries.erase(_entries.find(e.key));
+}
+
+void result_cache::invalidate(uint64_t partition) {
+    ++_generations[partition % generation_slots];
+    std::vector<entry*> entries;
+    auto range = _by_partition.equal_range(partition);
+    for (auto i = range.first; i != range.second; ++i) {
+        entries.push_back(i->second);
+    }
+    for (auto e : entries) {
+        ++_stats.invalidations;
+        erase(*e);
+    }
+}
+
+void result_cache::invalidate(const void* statement) {
+    std::vector<entry*> entries;
+    for (auto&& e : _entries) {
+        if (e.first.statement == statement) {
+            entries.push_back(e.second.get());
+        }
+    }
+    for (auto e : entries) {
+        erase(*e);
+    }
+}
+
+void result_cache::clear() {
+    ++_clears;
+    while (!_lru.empty()) {
+        erase(_lru.front());
+    }
+}
+
+future<> result_cache::invalidate_on_all_shards(const schema& s, const dht::token& t) {
+    if (!s.caching_options().result_cache_ttl().count()) {
+        return make_ready_future<>();
+    }
+    return invalidate_on_all_shards(std::vector<uint64_t>{partition_hash(s.id(), t)});
+}
+
+future<> result_cache::invalidate_on_all_shards(std::vector<uint64_t> partitions) {
+    if (partitions.empty()) {
+        return make_ready_future<>();
+    }
+    return do_with(std::move(partitions), [] (const std::vector<uint64_t>& partitions) {
+        return parallel_for_each(boost::irange<unsigned>(0, smp::count), [&partitions] (unsigned shard) {
+            return smp::submit_to(shard, [&partitions] {
+                for (auto p : partitions) {
+                    global_result_cache().invalidate(p);
+                }
+            });
+        });
+    });
+}
+
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <experimental/optional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <boost/intrusive/list.hpp>
+#include <seastar/core/future.hh>
+#include <seastar/core/scollectd.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/timer.hh>
+
+#include "bytes.hh"
+#include "schema.hh"
+#include "query-request.hh"
+#include "query-result.hh"
+
+namespace cql3 {
+
+namespace bi = boost::intrusive;
+
+/**
+ * The results of reads by prepared statements, which a coordinator serves
+ * again to identical reads for a while, on tables whose caching options set
+ * result_cache_ttl_in_ms.
+ *
+ * A result is keyed by the statement and by what its reads depend on: the
+ * bound values, the consistency level and the page size. Only first pages
+ * of reads of given partitions are cached, so that writes can invalidate
+ * them: once a write of a partition is applied by this node, as a replica or
+ * as the coordinator of the write, the results of reads of it are dropped on
+ * every shard. Writes coordinated elsewhere to other replicas are seen when
+ * the results expire.
+ *
+ * Each shard caches the results of the statements it executes, up to its
+ * share of query_result_cache_size_in_mb, evicting the least recently used
+ * first.
+ */
+class result_cache {
+public:
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t invalidations = 0;
+        uint64_t evictions = 0;
+    };
+
+    struct key {
+        const void* statement;
+        // The consistency level, page size and bound values, serialized.
+        bytes values;
+
+        bool operator==(const key& o) const {
+            return statement == o.statement && values == o.values;
+        }
+        struct hash {
+            size_t operator()(const key& k) const {
+                return std::hash<const void*>()(k.statement) ^ std::hash<bytes>()(k.values);
+            }
+        };
+    };
+private:
+    struct entry : public bi::list_base_hook<bi::link_mode<bi::auto_unlink>> {
+        result_cache::key key;
+        lw_shared_ptr<query::result> result;
+        // Of the partitions read, see partition_hash().
+        std::vector<uint64_t> partitions;
+        lowres_clock::time_point expiry;
+        size_t memory;
+    };
+    using lru_type = bi::list<entry, bi::constant_time_size<false>>;
+
+    std::unordered_map<key, std::unique_ptr<entry>, key::hash> _entries;
+    std::unordered_multimap<uint64_t, entry*> _by_partition;
+    lru_type _lru;
+    size_t _memory = 0;
+    size_t _max_memory = 0;
+    // Bumped by invalidations of the partitions hashing to them, so that the
+    // results of reads they overlapped are not cached, while reads of other
+    // partitions still are. Bounded, at the price of a few reads of unrelated
+    // partitions not cached.
+    static constexpr size_t generation_slots = 1024;
+    std::array<uint64_t, generation_slots> _generations = {};
+    // Bumped by clear().
+    uint64_t _clears = 0;
+    stats _stats;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+private:
+    void erase(entry& e);
+    void setup_collectd();
+public:
+    result_cache();
+
+    // Of a partition of a table, in the invalidation index. Partitions
+    // sharing one are invalidated together.
+    static uint64_t partition_hash(const utils::UUID& cf_id, const dht::token& t);
+
+    // The partitions the ranges read, or nothing if they are not all
+    // single partitions.
+    static std::experimental::optional<std::vector<uint64_t>> partitions_of(const schema& s,
+            const std::vector<query::partition_range>& ranges);
+
+    void set_max_memory(size_t bytes);
+
+    // Of the partitions, which changes once any of them is invalidated.
+    uint64_t generation(const std::vector<uint64_t>& partitions) const;
+
+    // The result of an unexpired read with the key, if any.
+    lw_shared_ptr<query::result> find(const key& k);
+
+    // Caches a copy of the result of a read of the partitions, unless a
+    // write invalidated them since the read started at their generation.
+    void insert(key k, const query::result& result, std::vector<uint64_t> partitions,
+            std::chrono::milliseconds ttl, uint64_t generation);
+
+    // Drops the results of reads of the partition.
+    void invalidate(uint64_t partition);
+    // Drops the results of reads by the statement.
+    void invalidate(const void* statement);
+    void clear();
+
+    // Drops the results of reads of the partition on all shards, once
+    // written to.
+    static future<> invalidate_on_all_shards(const schema& s, const dht::token& t);
+    // Likewise, for the partitions, see partition_hash().
+    static future<> invalidate_on_all_shards(std::vector<uint64_t> partitions);
+
+    size_t memory() const {
+        return _memory;
+    }
+    size_t size() const {
+        return _entries.size();
+    }
+    const struct stats& get_stats() const {
+        return _stats;
+    }
+};
+
+result_cache& global_result_cache();
+
+}
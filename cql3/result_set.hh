@@ -46,6 +46,7 @@
 #include "enum_set.hh"
 #include "service/pager/paging_state.hh"
 #include "schema.hh"
+#include "bytes_ostream.hh"
 
 namespace cql3 {
 
@@ -346,6 +347,10 @@ class result_set {
         return *_metadata;
     }
 
+    metadata& get_metadata() {
+        return *_metadata;
+    }
+
     // Returns a range of rows. A row is a range of bytes_opt.
     auto const& rows() const {
         return _rows;
@@ -502,4 +507,19 @@ class result_set {
 #endif
 };
 
+/**
+ * Produces the rows of a result on demand, for results which can be
+ * serialized straight from what the replicas returned, without building
+ * a result_set first.
+ */
+class result_generator {
+public:
+    virtual ~result_generator() {}
+    virtual const metadata& get_metadata() const = 0;
+    // Writes the rows the way the native protocol encodes them, a [value]
+    // per column, and returns how many rows were written.
+    virtual uint32_t write_rows(bytes_ostream& out) const = 0;
+    virtual std::unique_ptr<result_set> build() const = 0;
+};
+
 }
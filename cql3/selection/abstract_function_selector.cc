@@ -41,6 +41,7 @@
 #include "aggregate_function_selector.hh"
 #include "scalar_function_selector.hh"
 #include "to_string.hh"
+#include <unordered_set>
 
 namespace cql3 {
 
@@ -97,6 +98,23 @@ abstract_function_selector::new_factory(shared_ptr<functions::function> fun, sha
         virtual bool is_aggregate_selector_factory() override {
             return _fun->is_aggregate() || _factories->contains_only_aggregate_functions();
         }
+
+        // The partial results of these can be merged with an aggregate.
+        virtual std::experimental::optional<partial_aggregate> get_partial_aggregate() override {
+            static const std::unordered_set<sstring> mergeable = { "countRows", "count", "sum", "min", "max" };
+            auto& name = _fun->name();
+            if (!_fun->is_aggregate() || name.keyspace != db::system_keyspace::NAME || !mergeable.count(name.name)) {
+                return {};
+            }
+            if (_factories->size() == 0) {
+                return partial_aggregate{name.name, {}};
+            }
+            auto idx = (*_factories->begin())->get_column_index();
+            if (_factories->size() != 1 || !idx) {
+                return {};
+            }
+            return partial_aggregate{name.name, idx};
+        }
     };
 
     return make_shared<fun_selector_factory>(std::move(fun), std::move(factories));
@@ -38,6 +38,7 @@
  */
 
 #include "abstract_function_selector.hh"
+#include "simple_selector.hh"
 #include "cql3/functions/aggregate_function.hh"
 
 #pragma once
@@ -48,6 +49,10 @@ namespace selection {
 
 class aggregate_function_selector : public abstract_function_selector_for<functions::aggregate_function> {
     std::unique_ptr<functions::aggregate_function::aggregate> _aggregate;
+    // Aggregates of no argument, or of a column as is, are fed batches:
+    // the column of the argument, if any.
+    bool _supports_batches = false;
+    std::experimental::optional<uint32_t> _batch_column;
 public:
     virtual bool is_aggregate() override {
         return true;
@@ -65,6 +70,18 @@ class aggregate_function_selector : public abstract_function_selector_for<functi
         _aggregate->add_input(sf, _args);
     }
 
+    virtual bool supports_batches() override {
+        return _supports_batches;
+    }
+
+    virtual void add_input_batch(serialization_format sf, const column_batch& batch) override {
+        if (_batch_column) {
+            _aggregate->add_batch(sf, batch.columns[*_batch_column]);
+        } else {
+            _aggregate->add_rows(sf, batch.rows);
+        }
+    }
+
     virtual bytes_opt get_output(serialization_format sf) override {
         return _aggregate->compute(sf);
     }
@@ -78,6 +95,15 @@ class aggregate_function_selector : public abstract_function_selector_for<functi
             : abstract_function_selector_for<functions::aggregate_function>(
                     dynamic_pointer_cast<functions::aggregate_function>(func), std::move(arg_selectors))
             , _aggregate(fun()->new_aggregate()) {
+        if (_arg_selectors.empty()) {
+            _supports_batches = true;
+        } else if (_arg_selectors.size() == 1) {
+            auto s = dynamic_pointer_cast<simple_selector>(_arg_selectors[0]);
+            if (s) {
+                _supports_batches = true;
+                _batch_column = s->column_index();
+            }
+        }
     }
 
     virtual sstring assignment_testable_source_context() const override {
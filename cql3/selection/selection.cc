@@ -42,6 +42,7 @@
 #include "cql3/selection/selection.hh"
 #include "cql3/selection/selector_factories.hh"
 #include "cql3/result_set.hh"
+#include "cql3/functions/functions.hh"
 
 namespace cql3 {
 
@@ -102,6 +103,7 @@ class simple_selection : public selection {
     { }
 
     virtual bool is_wildcard() const override { return _is_wildcard; }
+    virtual bool is_trivial() const override { return true; }
     virtual bool is_aggregate() const override { return false; }
 protected:
     class simple_selectors : public selectors {
@@ -159,15 +161,44 @@ class selection_with_processing : public selection {
     virtual bool is_aggregate() const override {
         return _factories->contains_only_aggregate_functions();
     }
+
+    virtual std::experimental::optional<std::vector<query::aggregate>> get_partial_aggregates() override {
+        if (!is_aggregate()) {
+            return {};
+        }
+        std::vector<query::aggregate> aggregates;
+        for (auto&& factory : *_factories) {
+            auto pa = factory->get_partial_aggregate();
+            if (!pa) {
+                return {};
+            }
+            bytes column;
+            if (pa->column_index) {
+                auto&& def = *get_columns()[*pa->column_index];
+                if (def.type->is_multi_cell() || def.type->is_counter()) {
+                    return {};
+                }
+                // Replicas look the function up by the type of the column.
+                if (!functions::functions::find(functions::function_name::native_function(pa->function), { def.type })) {
+                    return {};
+                }
+                column = def.name();
+            }
+            aggregates.emplace_back(query::aggregate{std::move(pa->function), std::move(column)});
+        }
+        return aggregates;
+    }
 protected:
     class selectors_with_processing : public selectors {
     private:
         ::shared_ptr<selector_factories> _factories;
         std::vector<::shared_ptr<selector>> _selectors;
+        bool _supports_batches;
     public:
         selectors_with_processing(::shared_ptr<selector_factories> factories)
             : _factories(std::move(factories))
             , _selectors(_factories->new_instances())
+            , _supports_batches(is_aggregate() && std::all_of(_selectors.begin(), _selectors.end(), [] (auto&& s) { return s->supports_batches(); }))
         { }
 
         virtual void reset() override {
@@ -194,6 +225,16 @@ class selection_with_processing : public selection {
                 s->add_input(sf, rs);
             }
         }
+
+        virtual bool supports_batches() override {
+            return _supports_batches;
+        }
+
+        virtual void add_input_batch(serialization_format sf, const column_batch& batch) override {
+            for (auto&& s : _selectors) {
+                s->add_input_batch(sf, batch);
+            }
+        }
     };
 
     std::unique_ptr<selectors> new_selectors() {
@@ -255,6 +296,7 @@ selection::collect_metadata(schema_ptr schema, const std::vector<::shared_ptr<ra
 result_set_builder::result_set_builder(selection& s, db_clock::time_point now, serialization_format sf)
     : _result_set(std::make_unique<result_set>(::make_shared<metadata>(*(s.get_result_metadata()))))
     , _selectors(s.new_selectors())
+    , _batched(_selectors->supports_batches())
     , _now(now)
     , _serialization_format(sf)
 {
@@ -280,6 +322,10 @@ void result_set_builder::add(bytes_opt value) {
     current->emplace_back(std::move(value));
 }
 
+void result_set_builder::add(bytes_view value) {
+    current->emplace_back(to_bytes(value));
+}
+
 void result_set_builder::add(const column_definition& def, const query::result_atomic_cell_view& c) {
     current->emplace_back(get_value(def.type, c));
     if (!_timestamps.empty()) {
@@ -301,9 +347,37 @@ void result_set_builder::add(const column_definition& def, collection_mutation::
     // timestamps, ttls meaningless for collections
 }
 
+void result_set_builder::add_current_to_batch() {
+    auto& row = *current;
+    if (_batch.columns.size() < row.size()) {
+        _batch.columns.resize(row.size());
+    }
+    for (size_t i = 0; i < row.size(); ++i) {
+        _batch.columns[i].emplace_back(std::move(row[i]));
+    }
+    if (++_batch.rows == batch_size) {
+        flush_batch();
+    }
+}
+
+void result_set_builder::flush_batch() {
+    if (!_batch.rows) {
+        return;
+    }
+    _selectors->add_input_batch(_serialization_format, _batch);
+    for (auto&& c : _batch.columns) {
+        c.clear();
+    }
+    _batch.rows = 0;
+}
+
 void result_set_builder::new_row() {
     if (current) {
-        _selectors->add_input_row(_serialization_format, *this);
+        if (_batched) {
+            add_current_to_batch();
+        } else {
+            _selectors->add_input_row(_serialization_format, *this);
+        }
         if (!_selectors->is_aggregate()) {
             _result_set->add_row(_selectors->get_output_row(_serialization_format));
             _selectors->reset();
@@ -319,7 +393,12 @@ void result_set_builder::new_row() {
 
 std::unique_ptr<result_set> result_set_builder::build() {
     if (current) {
-        _selectors->add_input_row(_serialization_format, *this);
+        if (_batched) {
+            add_current_to_batch();
+            flush_batch();
+        } else {
+            _selectors->add_input_row(_serialization_format, *this);
+        }
         _result_set->add_row(_selectors->get_output_row(_serialization_format));
         _selectors->reset();
         current = std::experimental::nullopt;
@@ -339,12 +418,7 @@ int32_t result_set_builder::ttl_of(size_t idx) {
 }
 
 bytes_opt result_set_builder::get_value(data_type t, query::result_atomic_cell_view c) {
-    if (t->is_counter()) {
-        fail(unimplemented::cause::COUNTERS);
-#if 0
-                ByteBufferUtil.bytes(CounterContext.instance().total(c.value()))
-#endif
-    }
+    // Replicas send the total of counters as their value.
     return {to_bytes(c.value())};
 }
 
@@ -44,6 +44,7 @@
 #include "bytes.hh"
 #include "schema.hh"
 #include "query-result-reader.hh"
+#include "query-request.hh"
 #include "cql3/column_specification.hh"
 #include "exceptions/exceptions.hh"
 #include "cql3/selection/raw_selector.hh"
@@ -71,6 +72,20 @@ class selectors {
     */
     virtual void add_input_row(serialization_format sf, result_set_builder& rs) = 0;
 
+    /**
+     * Checks if the rows can be added in batches with <code>add_input_batch</code>.
+     */
+    virtual bool supports_batches() {
+        return false;
+    }
+
+    /**
+     * Adds the rows of the specified batch, as <code>add_input_row</code> would one row at a time.
+     */
+    virtual void add_input_batch(serialization_format sf, const column_batch& batch) {
+        throw std::logic_error("selectors do not support batches");
+    }
+
     virtual std::vector<bytes_opt> get_output_row(serialization_format sf) = 0;
 
     virtual void reset() = 0;
@@ -98,6 +113,18 @@ class selection {
         return false;
     }
 
+    // Whether the rows are made of the selected columns as they are, with
+    // no function applied to them. Overriden by SimpleSelection.
+    virtual bool is_trivial() const {
+        return false;
+    }
+
+    // The aggregates this selection is made of, if the replicas can compute
+    // partial results of all of them. Overriden by SelectionWithProcessing.
+    virtual std::experimental::optional<std::vector<query::aggregate>> get_partial_aggregates() {
+        return {};
+    }
+
     /**
      * Checks if this selection contains static columns.
      * @return <code>true</code> if this selection contains static columns, <code>false</code> otherwise;
@@ -228,8 +255,13 @@ class selection {
 
 class result_set_builder {
 private:
+    // Rows of aggregates fed batches, added once this many are gathered.
+    static constexpr size_t batch_size = 1024;
+
     std::unique_ptr<result_set> _result_set;
     std::unique_ptr<selectors> _selectors;
+    const bool _batched;
+    column_batch _batch;
 public:
     std::experimental::optional<std::vector<bytes_opt>> current;
 private:
@@ -241,6 +273,7 @@ class result_set_builder {
     result_set_builder(selection& s, db_clock::time_point now, serialization_format sf);
     void add_empty();
     void add(bytes_opt value);
+    void add(bytes_view value);
     void add(const column_definition& def, const query::result_atomic_cell_view& c);
     void add(const column_definition& def, collection_mutation::view c);
     void new_row();
@@ -249,6 +282,8 @@ class result_set_builder {
     int32_t ttl_of(size_t idx);
 private:
     bytes_opt get_value(data_type t, query::result_atomic_cell_view c);
+    void add_current_to_batch();
+    void flush_batch();
 };
 
 }
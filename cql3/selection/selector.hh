@@ -42,6 +42,7 @@
 #pragma once
 
 #include <vector>
+#include <experimental/optional>
 #include "cql3/assignment_testable.hh"
 #include "types.hh"
 #include "schema.hh"
@@ -52,6 +53,24 @@ namespace selection {
 
 class result_set_builder;
 
+/**
+ * An aggregate the replicas can compute partial results of, for the coordinator to merge.
+ */
+struct partial_aggregate {
+    sstring function;
+    // The index of the argument among the columns of the selection, if the
+    // function takes one.
+    std::experimental::optional<uint32_t> column_index;
+};
+
+/**
+ * Rows of the selection given column by column: for each column of the selection, its value in each row.
+ */
+struct column_batch {
+    std::vector<std::vector<bytes_opt>> columns;
+    size_t rows = 0;
+};
+
 /**
  * A <code>selector</code> is used to convert the data returned by the storage engine into the data requested by the
  * user. They correspond to the &lt;selector&gt; elements from the select clause.
@@ -73,6 +92,24 @@ class selector : public assignment_testable {
      */
     virtual void add_input(serialization_format sf, result_set_builder& rs) = 0;
 
+    /**
+     * Checks if this <code>selector</code> can be fed batches of rows with <code>add_input_batch</code>
+     * instead of one row at a time.
+     */
+    virtual bool supports_batches() {
+        return false;
+    }
+
+    /**
+     * Adds the rows of the specified batch, as <code>add_input</code> would one row at a time.
+     *
+     * @param protocol_version protocol version used for serialization
+     * @param batch the rows, column by column
+     */
+    virtual void add_input_batch(serialization_format sf, const column_batch& batch) {
+        throw std::logic_error("selector does not support batches");
+    }
+
     /**
      * Returns the selector output.
      *
@@ -172,6 +209,22 @@ class selector::factory {
         return false;
     }
 
+    /**
+     * Returns the index, among the columns of the selection, of the column the selector instances created by
+     * this factory return as is, if they do.
+     */
+    virtual std::experimental::optional<uint32_t> get_column_index() {
+        return {};
+    }
+
+    /**
+     * Returns the aggregate the selector instances created by this factory compute, if the replicas can
+     * compute partial results of it: COUNT, SUM, MIN or MAX of a column, or the number of rows.
+     */
+    virtual std::experimental::optional<partial_aggregate> get_partial_aggregate() {
+        return {};
+    }
+
     /**
      * Returns the name of the column corresponding to the output value of the selector instances created by
      * this factory.
@@ -157,6 +157,10 @@ class selector_factories {
         return _factories.end();
     }
 
+    size_t size() const {
+        return _factories.size();
+    }
+
     /**
      * Returns the names of the columns corresponding to the output values of the selector instances created by
      * these factories.
@@ -68,6 +68,10 @@ class simple_selector_factory : public selector::factory {
         return _type;
     }
 
+    virtual std::experimental::optional<uint32_t> get_column_index() override {
+        return _idx;
+    }
+
     virtual ::shared_ptr<selector> new_instance() override;
 };
 
@@ -105,6 +109,10 @@ class simple_selector : public selector {
         return _type;
     }
 
+    uint32_t column_index() const {
+        return _idx;
+    }
+
     virtual sstring assignment_testable_source_context() const override {
         return _column_name;
     }
@@ -45,6 +45,32 @@ namespace statements {
 
 logging::logger batch_statement::_logger("BatchStatement");
 
+std::vector<mutation> batch_statement::merge_mutations(std::vector<mutation> mutations) {
+    if (mutations.size() < 2) {
+        return mutations;
+    }
+    std::sort(mutations.begin(), mutations.end(), [] (const mutation& m1, const mutation& m2) {
+        if (!(m1.token() == m2.token())) {
+            return m1.token() < m2.token();
+        }
+        if (!(m1.schema()->id() == m2.schema()->id())) {
+            return m1.schema()->id() < m2.schema()->id();
+        }
+        return m1.decorated_key().less_compare(*m1.schema(), m2.decorated_key());
+    });
+    std::vector<mutation> merged;
+    merged.reserve(mutations.size());
+    for (auto&& m : mutations) {
+        if (!merged.empty() && merged.back().schema()->id() == m.schema()->id()
+                && merged.back().decorated_key().equal(*m.schema(), m.decorated_key())) {
+            merged.back().partition().apply(*m.schema(), std::move(m.partition()));
+        } else {
+            merged.emplace_back(std::move(m));
+        }
+    }
+    return merged;
+}
+
 bool batch_statement::depends_on_keyspace(const sstring& ks_name) const
 {
     return false;
@@ -44,6 +44,7 @@
 #include "timestamp.hh"
 #include "log.hh"
 #include "to_string.hh"
+#include <unordered_map>
 #include <boost/algorithm/cxx11/any_of.hpp>
 #include <boost/algorithm/cxx11/all_of.hpp>
 #include <boost/range/adaptor/transformed.hpp>
@@ -176,19 +177,62 @@ class batch_statement : public cql_statement {
                 std::move(more.begin(), more.end(), std::back_inserter(_result));
             }
         };
+        // The statements requiring a read of the same table share a single
+        // one, rather than each reading the rows it writes to on its own.
+        std::vector<std::vector<size_t>> reading;
+        std::unordered_map<utils::UUID, size_t> reading_of_table;
+        std::vector<size_t> others;
+        for (size_t i = 0; i < _statements.size(); ++i) {
+            auto&& statement = _statements[i];
+            if (!statement->requires_read()) {
+                others.push_back(i);
+                continue;
+            }
+            auto r = reading_of_table.emplace(statement->s->id(), reading.size());
+            if (r.second) {
+                reading.emplace_back();
+            }
+            reading[r.first->second].push_back(i);
+        }
         auto get_mutations_for_statement = [this, &storage, &options, now, local] (size_t i) {
             auto&& statement = _statements[i];
             auto&& statement_options = options.for_statement(i);
             auto timestamp = _attrs->get_timestamp(now, statement_options);
             return statement->get_mutations(storage, statement_options, local, timestamp);
         };
-        // FIXME: origin tries hard to merge mutations to same keyspace, for
-        //        some reason.
-        return map_reduce(
-                boost::make_counting_iterator<size_t>(0),
-                boost::make_counting_iterator<size_t>(_statements.size()),
-                get_mutations_for_statement,
-                collector());
+        auto get_mutations_for_table = [this, &storage, &options, now] (const std::vector<size_t>& indices) {
+            auto s = _statements[indices.front()]->s;
+            std::vector<std::vector<partition_key>> keys;
+            std::vector<exploded_clustering_prefix> prefixes;
+            std::vector<partition_key> all_keys;
+            for (auto i : indices) {
+                auto&& statement_options = options.for_statement(i);
+                keys.push_back(_statements[i]->build_partition_keys(statement_options));
+                prefixes.push_back(_statements[i]->create_exploded_clustering_prefix(statement_options));
+                all_keys.insert(all_keys.end(), keys.back().begin(), keys.back().end());
+            }
+            return modification_statement::read_required_rows(storage, s, all_keys, prefixes, options.get_consistency()).then(
+                    [this, &options, now, indices, keys = std::move(keys), prefixes = std::move(prefixes)] (auto prefetched) mutable {
+                std::vector<mutation> mutations;
+                for (size_t j = 0; j < indices.size(); ++j) {
+                    auto&& statement_options = options.for_statement(indices[j]);
+                    auto timestamp = _attrs->get_timestamp(now, statement_options);
+                    auto more = _statements[indices[j]]->get_mutations(statement_options, timestamp, std::move(keys[j]), prefixes[j], prefetched);
+                    std::move(more.begin(), more.end(), std::back_inserter(mutations));
+                }
+                return mutations;
+            });
+        };
+        return do_with(std::move(reading), std::move(others), [get_mutations_for_statement, get_mutations_for_table] (auto& reading, auto& others) {
+            auto read = map_reduce(reading.begin(), reading.end(), get_mutations_for_table, collector());
+            return read.then([&others, get_mutations_for_statement] (std::vector<mutation> mutations) {
+                return map_reduce(others.begin(), others.end(), get_mutations_for_statement, collector()).then(
+                        [mutations = std::move(mutations)] (std::vector<mutation> more) mutable {
+                    std::move(more.begin(), more.end(), std::back_inserter(mutations));
+                    return std::move(mutations);
+                });
+            });
+        });
     }
 
 public:
@@ -196,6 +240,12 @@ class batch_statement : public cql_statement {
      * Checks batch size to ensure threshold is met. If not, a warning is logged.
      * @param cfs ColumnFamilies that will store the batch's mutations.
      */
+    /**
+     * Merges the mutations of the same partition, for the replicas to apply them at once, and orders them by
+     * token, which keeps together the mutations going to the same replicas and shards.
+     */
+    static std::vector<mutation> merge_mutations(std::vector<mutation> mutations);
+
     static void verify_batch_size(const std::vector<mutation>& mutations) {
         size_t warn_threshold = 1000; // FIXME: database_descriptor::get_batch_size_warn_threshold();
         size_t fail_threshold = 2000; // FIXME: database_descriptor::get_batch_size_fail_threshold();
@@ -237,8 +287,8 @@ class batch_statement : public cql_statement {
             return execute_with_conditions(storage, options, query_state);
         }
 
-        return get_mutations(storage, options, local, now).then([this, &storage, &options] (std::vector<mutation> ms) {
-            return execute_without_conditions(storage, std::move(ms), options.get_consistency());
+        return get_mutations(storage, options, local, now).then([this, &storage, &query_state, &options] (std::vector<mutation> ms) {
+            return execute_without_conditions(storage, std::move(ms), options.get_consistency(), query_state.get_trace_state());
         }).then([] {
             return make_ready_future<shared_ptr<transport::messages::result_message>>(
                     make_shared<transport::messages::result_message::void_message>());
@@ -248,7 +298,8 @@ class batch_statement : public cql_statement {
     future<> execute_without_conditions(
             distributed<service::storage_proxy>& storage,
             std::vector<mutation> mutations,
-            db::consistency_level cl) {
+            db::consistency_level cl,
+            tracing::trace_state_ptr trace_state) {
         // FIXME: do we need to do this?
 #if 0
         // Extract each collection of cfs from it's IMutation and then lazily concatenate all of them into a single Iterable.
@@ -261,9 +312,10 @@ class batch_statement : public cql_statement {
         }));
 #endif
         verify_batch_size(mutations);
+        mutations = merge_mutations(std::move(mutations));
 
         bool mutate_atomic = _type == type::LOGGED && mutations.size() > 1;
-        return storage.local().mutate_with_triggers(std::move(mutations), cl, mutate_atomic);
+        return storage.local().mutate_with_triggers(std::move(mutations), cl, mutate_atomic, std::move(trace_state));
     }
 
     future<shared_ptr<transport::messages::result_message>> execute_with_conditions(
@@ -57,7 +57,9 @@ const sstring cf_prop_defs::KW_MIN_INDEX_INTERVAL = "min_index_interval";
 const sstring cf_prop_defs::KW_MAX_INDEX_INTERVAL = "max_index_interval";
 const sstring cf_prop_defs::KW_SPECULATIVE_RETRY = "speculative_retry";
 const sstring cf_prop_defs::KW_BF_FP_CHANCE = "bloom_filter_fp_chance";
+const sstring cf_prop_defs::KW_BF_FORMAT = "bloom_filter_format";
 const sstring cf_prop_defs::KW_MEMTABLE_FLUSH_PERIOD = "memtable_flush_period_in_ms";
+const sstring cf_prop_defs::KW_CDC = "cdc";
 
 const sstring cf_prop_defs::KW_COMPACTION = "compaction";
 const sstring cf_prop_defs::KW_COMPRESSION = "compression";
@@ -75,8 +77,8 @@ void cf_prop_defs::validate() {
         KW_COMMENT, KW_READREPAIRCHANCE, KW_DCLOCALREADREPAIRCHANCE,
         KW_GCGRACESECONDS, KW_CACHING, KW_DEFAULT_TIME_TO_LIVE,
         KW_MIN_INDEX_INTERVAL, KW_MAX_INDEX_INTERVAL, KW_SPECULATIVE_RETRY,
-        KW_BF_FP_CHANCE, KW_MEMTABLE_FLUSH_PERIOD, KW_COMPACTION,
-        KW_COMPRESSION,
+        KW_BF_FP_CHANCE, KW_BF_FORMAT, KW_MEMTABLE_FLUSH_PERIOD, KW_COMPACTION,
+        KW_COMPRESSION, KW_CDC,
     });
     static std::set<sstring> obsolete_keywords({
         sstring("index_interval"),
@@ -121,6 +123,19 @@ void cf_prop_defs::validate() {
     }
 
     speculative_retry::from_sstring(get_string(KW_SPECULATIVE_RETRY, speculative_retry(speculative_retry::type::NONE, 0).to_sstring()));
+
+    if (has_property(KW_BF_FORMAT)) {
+        try {
+            utils::filter_format_from_sstring(get_string(KW_BF_FORMAT, ""));
+        } catch (std::invalid_argument& e) {
+            throw exceptions::configuration_exception(e.what());
+        }
+    }
+
+    auto cdc = get_map(KW_CDC);
+    if (cdc) {
+        cdc_options::from_map(*cdc);
+    }
 }
 
 std::map<sstring, sstring> cf_prop_defs::get_compaction_options() const {
@@ -201,14 +216,20 @@ void cf_prop_defs::apply_to_builder(schema_builder& builder) {
     }
 
     builder.set_bloom_filter_fp_chance(get_double(KW_BF_FP_CHANCE, builder.get_bloom_filter_fp_chance()));
+    if (has_property(KW_BF_FORMAT)) {
+        builder.set_bloom_filter_format(utils::filter_format_from_sstring(get_string(KW_BF_FORMAT, "")));
+    }
     if (!get_compression_options().empty()) {
         builder.set_compressor_params(compression_parameters(get_compression_options()));
     }
-#if 0
-    CachingOptions cachingOptions = getCachingOptions();
-    if (cachingOptions != null)
-        cfm.caching(cachingOptions);
-#endif
+    auto cdc = get_map(KW_CDC);
+    if (cdc) {
+        builder.set_cdc_options(cdc_options::from_map(*cdc));
+    }
+    auto caching = get_map(KW_CACHING);
+    if (caching) {
+        builder.set_caching_options(caching_options::from_map(*caching));
+    }
 }
 
 void cf_prop_defs::validate_minimum_int(const sstring& field, int32_t minimum_value, int32_t default_value) const
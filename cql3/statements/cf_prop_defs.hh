@@ -66,7 +66,9 @@ class cf_prop_defs : public property_definitions {
     static const sstring KW_MAX_INDEX_INTERVAL;
     static const sstring KW_SPECULATIVE_RETRY;
     static const sstring KW_BF_FP_CHANCE;
+    static const sstring KW_BF_FORMAT;
     static const sstring KW_MEMTABLE_FLUSH_PERIOD;
+    static const sstring KW_CDC;
 
     static const sstring KW_COMPACTION;
     static const sstring KW_COMPRESSION;
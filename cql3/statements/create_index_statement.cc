@@ -166,6 +166,12 @@ cql3::statements::create_index_statement::validate(distributed<service::storage_
                         "Cannot create secondary index on partition key column %s",
                         target->column->name()));
     }
+    // The local indexes only know of the values of whole cells.
+    if (cd->kind != column_kind::regular_column || (cd->type->is_collection() && cd->type->is_multi_cell())) {
+        throw exceptions::invalid_request_exception(
+                sprint("Secondary indexes are only supported on regular columns, other than non-frozen collections (%s)",
+                        target->column->name()));
+    }
 }
 
 future<bool>
@@ -197,7 +203,10 @@ cql3::statements::create_index_statement::announce_migration(distributed<service
         idx.index_options = index_options_map();
     }
 
-    idx.index_name = _index_name;
+    if (!_index_name.empty()) {
+        idx.index_name = _index_name;
+    }
+    cfm.find_column(*target->column).idx_info = idx;
     cfm.add_default_index_names(proxy.local().get_db().local());
 
     return service::get_local_migration_manager().announce_column_family_update(
@@ -44,6 +44,8 @@
 #include <regex>
 
 #include <boost/range/adaptor/map.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
+#include <boost/algorithm/cxx11/all_of.hpp>
 
 #include "cql3/statements/create_table_statement.hh"
 
@@ -190,10 +192,6 @@ ::shared_ptr<parsed_statement::prepared> create_table_statement::raw_statement::
     for (auto&& entry : _definitions) {
         ::shared_ptr<column_identifier> id = entry.first;
         ::shared_ptr<cql3_type> pt = entry.second->prepare(db, keyspace());
-        // FIXME: remove this check once we support counters
-        if (pt->is_counter()) {
-            fail(unimplemented::cause::COUNTERS);
-        }
         if (pt->is_collection() && pt->get_type()->is_multi_cell()) {
             if (!defined_multi_cell_collections) {
                 defined_multi_cell_collections = std::map<bytes, data_type>{};
@@ -279,6 +277,11 @@ ::shared_ptr<parsed_statement::prepared> create_table_statement::raw_statement::
         }
     }
 
+    auto is_counter = [] (auto&& column) { return column.second->is_counter(); };
+    if (boost::algorithm::any_of(stmt->_columns, is_counter) && !boost::algorithm::all_of(stmt->_columns, is_counter)) {
+        throw exceptions::invalid_request_exception("Cannot mix counter and non counter columns in the same table");
+    }
+
     if (!_static_columns.empty()) {
         // Only CQL3 tables can have static columns
         if (_use_compact_storage) {
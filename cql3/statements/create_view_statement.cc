@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <regex>
+#include <unordered_set>
+
+#include "cql3/statements/create_view_statement.hh"
+
+#include "service/migration_manager.hh"
+#include "service/storage_proxy.hh"
+#include "schema_builder.hh"
+#include "validation.hh"
+
+namespace cql3 {
+
+namespace statements {
+
+create_view_statement::create_view_statement(::shared_ptr<cf_name> view_name,
+                                             ::shared_ptr<cf_name> base_name,
+                                             raw_columns selected,
+                                             raw_columns partition_keys,
+                                             raw_columns clustering_keys,
+                                             raw_columns not_null,
+                                             ::shared_ptr<cf_prop_defs> properties,
+                                             bool if_not_exists)
+    : schema_altering_statement{std::move(view_name)}
+    , _base_name{std::move(base_name)}
+    , _selected{std::move(selected)}
+    , _partition_keys{std::move(partition_keys)}
+    , _clustering_keys{std::move(clustering_keys)}
+    , _not_null{std::move(not_null)}
+    , _properties{std::move(properties)}
+    , _if_not_exists{if_not_exists}
+{
+}
+
+void create_view_statement::prepare_keyspace(const service::client_state& state) {
+    schema_altering_statement::prepare_keyspace(state);
+    if (!_base_name->has_keyspace()) {
+        _base_name->set_keyspace(keyspace(), true);
+    }
+}
+
+void create_view_statement::prepare_keyspace(sstring keyspace) {
+    schema_altering_statement::prepare_keyspace(keyspace);
+    if (!_base_name->has_keyspace()) {
+        _base_name->set_keyspace(keyspace, true);
+    }
+}
+
+void create_view_statement::check_access(const service::client_state& state) {
+    warn(unimplemented::cause::PERMISSIONS);
+}
+
+void create_view_statement::validate(distributed<service::storage_proxy>&, const service::client_state& state) {
+    // validated in announce_migration()
+}
+
+schema_ptr create_view_statement::get_view_schema(database& db) {
+    const sstring& view_name = column_family();
+    std::regex name_regex("\\w+");
+    if (!std::regex_match(std::string(view_name), name_regex)) {
+        throw exceptions::invalid_request_exception(sprint("\"%s\" is not a valid materialized view name (must be alphanumeric character only: [0-9A-Za-z]+)", view_name));
+    }
+    if (view_name.size() > size_t(schema::NAME_LENGTH)) {
+        throw exceptions::invalid_request_exception(sprint("Materialized view names shouldn't be more than %d characters long (got \"%s\")", schema::NAME_LENGTH, view_name));
+    }
+    if (_base_name->get_keyspace() != keyspace()) {
+        throw exceptions::invalid_request_exception("Cannot create a materialized view on a table in a separate keyspace");
+    }
+
+    auto base = validation::validate_column_family(db, keyspace(), _base_name->get_column_family());
+    if (base->is_view()) {
+        throw exceptions::invalid_request_exception("Materialized views cannot be created against other materialized views");
+    }
+    if (base->is_counter()) {
+        throw exceptions::invalid_request_exception("Materialized views are not supported on counter tables");
+    }
+    if (base->is_dense() || !base->is_compound()) {
+        throw exceptions::invalid_request_exception("Materialized views are not supported on COMPACT STORAGE tables");
+    }
+
+    auto resolve = [&base] (const ::shared_ptr<column_identifier::raw>& raw) -> const column_definition& {
+        auto id = raw->prepare_column_identifier(base);
+        auto def = base->get_column_definition(id->name());
+        if (!def) {
+            throw exceptions::invalid_request_exception(sprint("Unknown column name detected in CREATE MATERIALIZED VIEW statement: %s", id->text()));
+        }
+        if (def->is_static()) {
+            throw exceptions::invalid_request_exception(sprint("Static columns are not supported in materialized views (%s)", id->text()));
+        }
+        return *def;
+    };
+
+    std::vector<const column_definition*> selected;
+    bool include_all_columns = _selected.empty();
+    if (include_all_columns) {
+        if (base->has_static_columns()) {
+            throw exceptions::invalid_request_exception("Static columns are not supported in materialized views");
+        }
+        for (auto&& def : base->all_columns_in_select_order()) {
+            selected.push_back(&def);
+        }
+    } else {
+        for (auto&& raw : _selected) {
+            auto& def = resolve(raw);
+            if (std::find(selected.begin(), selected.end(), &def) != selected.end()) {
+                throw exceptions::invalid_request_exception(sprint("Multiple definition of identifier %s", def.name_as_text()));
+            }
+            selected.push_back(&def);
+        }
+    }
+
+    std::unordered_set<bytes> not_null;
+    for (auto&& raw : _not_null) {
+        not_null.insert(resolve(raw).name());
+    }
+
+    std::vector<const column_definition*> key_columns;
+    auto add_key_column = [&] (const ::shared_ptr<column_identifier::raw>& raw) -> const column_definition& {
+        auto& def = resolve(raw);
+        if (std::find(key_columns.begin(), key_columns.end(), &def) != key_columns.end()) {
+            throw exceptions::invalid_request_exception(sprint("Duplicate entry found in PRIMARY KEY: %s", def.name_as_text()));
+        }
+        if (def.type->is_collection() && def.type->is_multi_cell()) {
+            throw exceptions::invalid_request_exception(sprint("Cannot use non-frozen collection %s in materialized view primary key", def.name_as_text()));
+        }
+        if (!not_null.count(def.name())) {
+            throw exceptions::invalid_request_exception(sprint("Primary key column '%s' is required to be filtered by 'IS NOT NULL'", def.name_as_text()));
+        }
+        key_columns.push_back(&def);
+        return def;
+    };
+
+    schema_builder builder{keyspace(), view_name};
+    for (auto&& raw : _partition_keys) {
+        auto& def = add_key_column(raw);
+        builder.with_column(def.name(), def.type->underlying_type(), column_kind::partition_key);
+    }
+    for (auto&& raw : _clustering_keys) {
+        auto& def = add_key_column(raw);
+        builder.with_column(def.name(), def.type, column_kind::clustering_key);
+    }
+    if (not_null.size() != key_columns.size()) {
+        throw exceptions::invalid_request_exception("Only the columns of the primary key of the materialized view may be filtered by 'IS NOT NULL'");
+    }
+
+    const column_definition* non_key_column = nullptr;
+    for (auto def : key_columns) {
+        if (def->is_primary_key()) {
+            continue;
+        }
+        if (non_key_column) {
+            throw exceptions::invalid_request_exception(sprint("Cannot include more than one non-primary key column in materialized view primary key (got %s and %s)",
+                    non_key_column->name_as_text(), def->name_as_text()));
+        }
+        non_key_column = def;
+    }
+    for (auto&& def : boost::join(base->partition_key_columns(), base->clustering_key_columns())) {
+        if (std::find(key_columns.begin(), key_columns.end(), &def) == key_columns.end()) {
+            throw exceptions::invalid_request_exception(sprint("Cannot create materialized view %s without primary key column %s of base table %s",
+                    view_name, def.name_as_text(), base->cf_name()));
+        }
+    }
+
+    for (auto def : selected) {
+        if (std::find(key_columns.begin(), key_columns.end(), def) == key_columns.end()) {
+            builder.with_column(def->name(), def->type, column_kind::regular_column);
+        }
+    }
+
+    if (_properties->has_property(cf_prop_defs::KW_DEFAULT_TIME_TO_LIVE)) {
+        throw exceptions::invalid_request_exception("Cannot set default_time_to_live for a materialized view: its data expires with that of the base table");
+    }
+    if (_properties->has_property(cf_prop_defs::KW_CDC)) {
+        throw exceptions::invalid_request_exception("Cannot enable change data capture on a materialized view: it is enabled on the base table");
+    }
+    _properties->validate();
+    _properties->apply_to_builder(builder);
+    builder.set_view_info(view_info{base->id(), base->cf_name(), include_all_columns});
+    return builder.build();
+}
+
+future<bool> create_view_statement::announce_migration(distributed<service::storage_proxy>& proxy, bool is_local_only) {
+    return make_ready_future<>().then([this, &proxy, is_local_only] {
+        auto view = get_view_schema(proxy.local().get_db().local());
+        return service::get_local_migration_manager().announce_new_column_family(std::move(view), is_local_only);
+    }).then_wrapped([this] (auto&& f) {
+        try {
+            f.get();
+            return true;
+        } catch (const exceptions::already_exists_exception& e) {
+            if (_if_not_exists) {
+                return false;
+            }
+            throw e;
+        }
+    });
+}
+
+shared_ptr<transport::event::schema_change> create_view_statement::change_event() {
+    return make_shared<transport::event::schema_change>(transport::event::schema_change::change_type::CREATED, transport::event::schema_change::target_type::TABLE, keyspace(), column_family());
+}
+
+}
+
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "cql3/statements/schema_altering_statement.hh"
+#include "cql3/statements/cf_prop_defs.hh"
+#include "cql3/column_identifier.hh"
+#include "cql3/cf_name.hh"
+#include "schema.hh"
+
+#include "core/shared_ptr.hh"
+
+#include <vector>
+
+class database;
+
+namespace cql3 {
+
+namespace statements {
+
+/**
+ * A <code>CREATE MATERIALIZED VIEW</code> parsed from a CQL query statement.
+ *
+ * The view's primary key must hold all the columns of the primary key of
+ * its base table, and at most one other column of it, which can't be a
+ * non-frozen collection. The columns of the primary key must all be
+ * filtered by IS NOT NULL.
+ */
+class create_view_statement : public schema_altering_statement {
+    using raw_columns = std::vector<::shared_ptr<column_identifier::raw>>;
+    ::shared_ptr<cf_name> _base_name;
+    // Empty for SELECT *.
+    raw_columns _selected;
+    raw_columns _partition_keys;
+    raw_columns _clustering_keys;
+    raw_columns _not_null;
+    ::shared_ptr<cf_prop_defs> _properties;
+    bool _if_not_exists;
+public:
+    create_view_statement(::shared_ptr<cf_name> view_name,
+                          ::shared_ptr<cf_name> base_name,
+                          raw_columns selected,
+                          raw_columns partition_keys,
+                          raw_columns clustering_keys,
+                          raw_columns not_null,
+                          ::shared_ptr<cf_prop_defs> properties,
+                          bool if_not_exists);
+
+    virtual void prepare_keyspace(const service::client_state& state) override;
+
+    virtual void prepare_keyspace(sstring keyspace) override;
+
+    virtual void check_access(const service::client_state& state) override;
+
+    virtual void validate(distributed<service::storage_proxy>&, const service::client_state& state) override;
+
+    virtual future<bool> announce_migration(distributed<service::storage_proxy>& proxy, bool is_local_only) override;
+
+    virtual shared_ptr<transport::event::schema_change> change_event() override;
+
+    // The schema of the view over the base table as the database has it.
+    schema_ptr get_view_schema(database& db);
+};
+
+}
+
+}
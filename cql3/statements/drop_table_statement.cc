@@ -42,6 +42,7 @@
 #include "cql3/statements/drop_table_statement.hh"
 
 #include "service/migration_manager.hh"
+#include "service/storage_proxy.hh"
 
 namespace cql3 {
 
@@ -76,7 +77,18 @@ void drop_table_statement::validate(distributed<service::storage_proxy>&, const
 
 future<bool> drop_table_statement::announce_migration(distributed<service::storage_proxy>& proxy, bool is_local_only)
 {
-    return make_ready_future<>().then([this, is_local_only] {
+    return make_ready_future<>().then([this, &proxy, is_local_only] {
+        auto& db = proxy.local().get_db().local();
+        if (db.has_schema(keyspace(), column_family())) {
+            auto& cf = db.find_column_family(keyspace(), column_family());
+            if (cf.schema()->is_view()) {
+                throw exceptions::invalid_request_exception(sprint("Cannot use DROP TABLE on materialized view %s; use DROP MATERIALIZED VIEW instead", column_family()));
+            }
+            if (!cf.views().empty()) {
+                throw exceptions::invalid_request_exception(sprint("Cannot drop table %s while materialized views still depend on it, such as %s",
+                        column_family(), cf.views().front()->cf_name()));
+            }
+        }
         return service::get_local_migration_manager().announce_column_family_drop(keyspace(), column_family(), is_local_only);
     }).then_wrapped([this] (auto&& f) {
         try {
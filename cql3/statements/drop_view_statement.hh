@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "cql3/statements/schema_altering_statement.hh"
+
+#include "cql3/cf_name.hh"
+
+namespace cql3 {
+
+namespace statements {
+
+/** A <code>DROP MATERIALIZED VIEW</code> parsed from a CQL query statement. */
+class drop_view_statement : public schema_altering_statement {
+    bool _if_exists;
+public:
+    drop_view_statement(::shared_ptr<cf_name> view_name, bool if_exists);
+
+    virtual void check_access(const service::client_state& state) override;
+
+    virtual void validate(distributed<service::storage_proxy>&, const service::client_state& state) override;
+
+    virtual future<bool> announce_migration(distributed<service::storage_proxy>& proxy, bool is_local_only) override;
+
+    virtual shared_ptr<transport::event::schema_change> change_event() override;
+};
+
+}
+
+}
@@ -48,6 +48,12 @@
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/range/algorithm_ext/push_back.hpp>
 #include <boost/range/adaptor/filtered.hpp>
+#include <boost/range/adaptor/map.hpp>
+#include <boost/range/algorithm/for_each.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
+#include <boost/algorithm/cxx11/all_of.hpp>
+#include <boost/algorithm/cxx11/none_of.hpp>
+#include <boost/range/algorithm/sort.hpp>
 
 namespace cql3 {
 
@@ -79,8 +85,8 @@ modification_statement::get_mutations(distributed<service::storage_proxy>& proxy
             [this, keys, prefix, now] (auto params_ptr) {
                 std::vector<mutation> mutations;
                 mutations.reserve(keys->size());
-                for (auto key : *keys) {
-                    mutations.emplace_back(std::move(key), s);
+                for (auto&& dk : dht::global_partitioner().decorate_keys(*s, std::move(*keys))) {
+                    mutations.emplace_back(std::move(dk), s);
                     auto& m = mutations.back();
                     this->add_update_for_key(m, *prefix, *params_ptr);
                 }
@@ -88,6 +94,19 @@ modification_statement::get_mutations(distributed<service::storage_proxy>& proxy
             });
 }
 
+std::vector<mutation>
+modification_statement::get_mutations(const query_options& options, int64_t now, std::vector<partition_key> keys,
+        const exploded_clustering_prefix& prefix, update_parameters::prefetched_rows_type prefetched) {
+    update_parameters params(s, options, get_timestamp(now, options), get_time_to_live(options), std::move(prefetched));
+    std::vector<mutation> mutations;
+    mutations.reserve(keys.size());
+    for (auto&& dk : dht::global_partitioner().decorate_keys(*s, std::move(keys))) {
+        mutations.emplace_back(std::move(dk), s);
+        add_update_for_key(mutations.back(), prefix, params);
+    }
+    return mutations;
+}
+
 future<std::unique_ptr<update_parameters>>
 modification_statement::make_update_parameters(
         distributed<service::storage_proxy>& proxy,
@@ -96,8 +115,10 @@ modification_statement::make_update_parameters(
         const query_options& options,
         bool local,
         int64_t now) {
-    return read_required_rows(proxy, std::move(keys), std::move(prefix), local, options.get_consistency()).then(
-            [this, &options, now] (auto rows) {
+    auto read = requires_read()
+            ? read_required_rows(proxy, s, *keys, {*prefix}, options.get_consistency())
+            : make_ready_future<update_parameters::prefetched_rows_type>();
+    return read.then([this, &options, now] (auto rows) {
                 return make_ready_future<std::unique_ptr<update_parameters>>(
                         std::make_unique<update_parameters>(s, options,
                                 this->get_timestamp(now, options),
@@ -159,16 +180,12 @@ class prefetch_data_builder {
 future<update_parameters::prefetched_rows_type>
 modification_statement::read_required_rows(
         distributed<service::storage_proxy>& proxy,
-        lw_shared_ptr<std::vector<partition_key>> keys,
-        lw_shared_ptr<exploded_clustering_prefix> prefix,
-        bool local,
+        schema_ptr s,
+        const std::vector<partition_key>& keys,
+        const std::vector<exploded_clustering_prefix>& prefixes,
         db::consistency_level cl) {
-    if (!requires_read()) {
-        return make_ready_future<update_parameters::prefetched_rows_type>(
-                update_parameters::prefetched_rows_type{});
-    }
     try {
-        validate_for_read(keyspace(), cl);
+        validate_for_read(s->ks_name(), cl);
     } catch (exceptions::invalid_request_exception& e) {
         throw exceptions::invalid_request_exception(sprint("Write operation require a read but consistency %s is not supported on reads", cl));
     }
@@ -184,27 +201,52 @@ modification_statement::read_required_rows(
     std::vector<column_id> regular_cols;
     boost::range::push_back(regular_cols, s->regular_columns()
         | boost::adaptors::filtered(is_collection) | boost::adaptors::transformed([] (auto&& col) { return col.id; }));
+    // The prefixes within other ones are read with them, which leaves
+    // ranges which don't overlap, sorted as the slice needs them.
+    std::vector<clustering_key_prefix> ckps;
+    for (auto&& prefix : prefixes) {
+        ckps.push_back(clustering_key_prefix::from_clustering_prefix(*s, prefix));
+    }
+    boost::sort(ckps, [&s] (const clustering_key_prefix& a, const clustering_key_prefix& b) {
+        return a.explode(*s).size() < b.explode(*s).size();
+    });
+    std::vector<clustering_key_prefix> disjoint;
+    for (auto&& ckp : ckps) {
+        auto within = [&s, &ckp] (const clustering_key_prefix& other) {
+            return ckp.is_prefixed_by(*s, other);
+        };
+        if (boost::algorithm::none_of(disjoint, within)) {
+            disjoint.push_back(std::move(ckp));
+        }
+    }
+    boost::sort(disjoint, clustering_key_prefix::less_compare(*s));
+    std::vector<query::clustering_range> ranges;
+    for (auto&& ckp : disjoint) {
+        ranges.emplace_back(std::move(ckp));
+    }
     query::partition_slice ps(
-            {query::clustering_range(clustering_key_prefix::from_clustering_prefix(*s, *prefix))},
+            std::move(ranges),
             std::move(static_cols),
             std::move(regular_cols),
             query::partition_slice::option_set::of<
                 query::partition_slice::option::send_partition_key,
                 query::partition_slice::option::send_clustering_key>());
+    // Partitions written to by several statements are read once.
+    auto dks = dht::global_partitioner().decorate_keys(*s, keys);
+    dht::decorated_key::less_comparator less(s);
+    boost::sort(dks, less);
+    dks.erase(std::unique(dks.begin(), dks.end(), [&s] (const dht::decorated_key& a, const dht::decorated_key& b) {
+        return a.equal(*s, b);
+    }), dks.end());
     std::vector<query::partition_range> pr;
-    for (auto&& pk : *keys) {
-        pr.emplace_back(dht::global_partitioner().decorate_key(*s, pk));
+    for (auto&& dk : dks) {
+        pr.emplace_back(std::move(dk));
     }
     query::read_command cmd(s->id(), ps, std::numeric_limits<uint32_t>::max());
-    // FIXME: ignoring "local"
-    return proxy.local().query(s, make_lw_shared(std::move(cmd)), std::move(pr), cl).then([this, ps] (auto result) {
-        // FIXME: copying
-        // FIXME: Use scattered_reader to avoid copying
-        bytes_ostream buf(result->buf());
-        query::result_view v(buf.linearize());
-        auto prefetched_rows = update_parameters::prefetched_rows_type({update_parameters::prefetch_data(s)});
-        v.consume(ps, prefetch_data_builder(prefetched_rows.value(), ps));
-        return prefetched_rows;
+    return proxy.local().query(s, make_lw_shared(std::move(cmd)), std::move(pr), cl).then([s, ps] (auto result) {
+        auto prefetched_rows = make_lw_shared<update_parameters::prefetch_data>(s);
+        query::result_view::consume(*result, ps, prefetch_data_builder(*prefetched_rows, ps));
+        return update_parameters::prefetched_rows_type(std::move(prefetched_rows));
     });
 }
 
@@ -244,11 +286,11 @@ modification_statement::create_exploded_clustering_prefix_internal(const query_o
         } else {
             auto values = i->second->values(options);
             assert(values.size() == 1);
-            auto val = values[0];
+            auto& val = values[0];
             if (!val) {
                 throw exceptions::invalid_request_exception(sprint("Invalid null value for clustering key part %s", def.name_as_text()));
             }
-            components.push_back(*val);
+            components.push_back(std::move(*val));
         }
     }
     return exploded_clustering_prefix(std::move(components));
@@ -309,12 +351,12 @@ modification_statement::build_partition_keys(const query_options& options) {
 
         if (remaining == 1) {
             if (values.size() == 1) {
-                auto val = values[0];
+                auto& val = values[0];
                 if (!val) {
                     throw exceptions::invalid_request_exception(sprint("Invalid null value for partition key part %s", def.name_as_text()));
                 }
-                components.push_back(*val);
-                auto key = partition_key::from_exploded(*s, components);
+                components.push_back(std::move(*val));
+                auto key = partition_key::from_exploded(*s, std::move(components));
                 validation::validate_cql_key(s, key);
                 result.emplace_back(std::move(key));
             } else {
@@ -324,9 +366,9 @@ modification_statement::build_partition_keys(const query_options& options) {
                     }
                     std::vector<bytes> full_components;
                     full_components.reserve(components.size() + 1);
-                    auto i = std::copy(components.begin(), components.end(), std::back_inserter(full_components));
-                    *i = *val;
-                    auto key = partition_key::from_exploded(*s, full_components);
+                    full_components = components;
+                    full_components.push_back(std::move(*val));
+                    auto key = partition_key::from_exploded(*s, std::move(full_components));
                     validation::validate_cql_key(s, key);
                     result.emplace_back(std::move(key));
                 }
@@ -335,11 +377,11 @@ modification_statement::build_partition_keys(const query_options& options) {
             if (values.size() != 1) {
                 throw exceptions::invalid_request_exception("IN is only supported on the last column of the partition key");
             }
-            auto val = values[0];
+            auto& val = values[0];
             if (!val) {
                 throw exceptions::invalid_request_exception(sprint("Invalid null value for partition key part %s", def.name_as_text()));
             }
-            components.push_back(*val);
+            components.push_back(std::move(*val));
         }
 
         remaining--;
@@ -372,40 +414,228 @@ modification_statement::execute_without_condition(distributed<service::storage_p
         db::validate_for_write(s->ks_name(), cl);
     }
 
-    return get_mutations(proxy, options, false, options.get_timestamp(qs)).then([cl, &proxy] (auto mutations) {
+    return get_mutations(proxy, options, false, options.get_timestamp(qs)).then([cl, &proxy, &qs] (auto mutations) {
         if (mutations.empty()) {
             return now();
         }
-        return proxy.local().mutate_with_triggers(std::move(mutations), cl, false);
+        return proxy.local().mutate_with_triggers(std::move(mutations), cl, false, qs.get_trace_state());
     });
 }
 
+// The conditional update of a single row. Keeps the values of the row it
+// last read, for the result of the statement.
+class modification_statement::cas_request : public service::cas_request {
+    modification_statement& _stmt;
+    const query_options& _options;
+    const partition_key _key;
+    const exploded_clustering_prefix _prefix;
+    bool _row_exists = false;
+    std::unordered_map<column_id, bytes_opt> _static_values;
+    std::unordered_map<column_id, bytes_opt> _regular_values;
+public:
+    cas_request(modification_statement& stmt, const query_options& options, partition_key key, exploded_clustering_prefix prefix)
+        : _stmt(stmt)
+        , _options(options)
+        , _key(std::move(key))
+        , _prefix(std::move(prefix))
+    { }
+
+    const partition_key& key() const {
+        return _key;
+    }
+
+    const exploded_clustering_prefix& prefix() const {
+        return _prefix;
+    }
+
+    bool row_exists() const {
+        return _row_exists;
+    }
+
+    bytes_opt value(const column_definition& def) const {
+        auto& values = def.is_static() ? _static_values : _regular_values;
+        auto i = values.find(def.id);
+        if (i == values.end()) {
+            return {};
+        }
+        return i->second;
+    }
+
+    // If only static columns are set, the row is the static part of the
+    // partition.
+    bool exists() const {
+        if (_stmt._sets_static_columns && !_stmt._sets_regular_columns) {
+            return boost::algorithm::any_of(_static_values | boost::adaptors::map_values, [] (auto&& v) { return bool(v); });
+        }
+        return _row_exists;
+    }
+
+    bool applies() const {
+        if (_stmt._if_not_exists) {
+            return !exists();
+        }
+        if (_stmt._if_exists) {
+            return exists();
+        }
+        auto holds = [this] (auto&& cond) {
+            return cond->applies_to(this->value(cond->column), _options);
+        };
+        return boost::algorithm::all_of(_stmt._column_conditions, holds)
+                && boost::algorithm::all_of(_stmt._static_conditions, holds);
+    }
+
+    virtual std::experimental::optional<mutation> apply(const query::result& current,
+            const query::partition_slice& slice, api::timestamp_type ts) override {
+        read(current, slice);
+        if (!applies()) {
+            return {};
+        }
+        mutation m(_key, _stmt.s);
+        update_parameters params(_stmt.s, _options, ts, _stmt.get_time_to_live(_options), {});
+        _stmt.add_update_for_key(m, _prefix, params);
+        return std::move(m);
+    }
+private:
+    // Implements ResultVisitor concept from query.hh
+    class row_reader {
+        cas_request& _request;
+        const query::partition_slice& _slice;
+    public:
+        row_reader(cas_request& request, const query::partition_slice& slice)
+            : _request(request)
+            , _slice(slice)
+        { }
+
+        void accept_new_partition(const partition_key_view& key, uint32_t row_count) { }
+
+        void accept_new_partition(uint32_t row_count) { }
+
+        void accept_new_row(const clustering_key_view& key, const query::result_row_view& static_row,
+                        const query::result_row_view& row) {
+            accept_new_row(static_row, row);
+        }
+
+        void accept_new_row(const query::result_row_view& static_row, const query::result_row_view& row) {
+            _request._row_exists = true;
+            read_row(row, _slice.regular_columns, _request._regular_values);
+        }
+
+        void accept_partition_end(const query::result_row_view& static_row) {
+            read_row(static_row, _slice.static_columns, _request._static_values);
+        }
+    private:
+        static void read_row(const query::result_row_view& row, const std::vector<column_id>& columns,
+                std::unordered_map<column_id, bytes_opt>& values) {
+            auto i = row.iterator();
+            for (auto&& id : columns) {
+                auto cell = i.next_atomic_cell();
+                values[id] = cell ? bytes_opt(to_bytes(cell->value())) : bytes_opt();
+            }
+        }
+    };
+
+    void read(const query::result& current, const query::partition_slice& slice) {
+        _row_exists = false;
+        _static_values.clear();
+        _regular_values.clear();
+        query::result_view::consume(current, slice, row_reader(*this, slice));
+    }
+};
+
+std::vector<const column_definition*>
+modification_statement::get_columns_for_cas_result() const {
+    std::vector<const column_definition*> columns;
+    if (_if_not_exists || _if_exists) {
+        for (auto&& def : s->all_columns_in_select_order()) {
+            if (def.is_atomic()) {
+                columns.push_back(&def);
+            }
+        }
+        return columns;
+    }
+    // There may be several conditions on a column, which appears once, in
+    // the order of the conditions.
+    auto add = [&columns] (auto&& cond) {
+        if (std::find(columns.begin(), columns.end(), &cond->column) == columns.end()) {
+            columns.push_back(&cond->column);
+        }
+    };
+    boost::for_each(_column_conditions, add);
+    boost::for_each(_static_conditions, add);
+    return columns;
+}
+
+std::unique_ptr<result_set>
+modification_statement::build_cas_result_set(const cas_request& request, bool applied) const {
+    std::vector<::shared_ptr<column_specification>> specs;
+    specs.push_back(::make_shared<column_specification>(keyspace(), column_family(), CAS_RESULT_COLUMN, boolean_type));
+    std::vector<bytes_opt> row;
+    row.push_back(boolean_type->decompose(applied));
+    // The row which failed the conditions is returned along, when there
+    // is one.
+    if (!applied && (request.row_exists() || request.exists())) {
+        auto pk = request.key().explode(*s);
+        auto& ck = request.prefix().components();
+        for (auto&& def : get_columns_for_cas_result()) {
+            specs.push_back(def->column_specification);
+            if (def->is_partition_key()) {
+                row.push_back(pk[def->component_index()]);
+            } else if (def->is_clustering_key()) {
+                auto i = def->component_index();
+                row.push_back(i < ck.size() ? bytes_opt(ck[i]) : bytes_opt());
+            } else {
+                row.push_back(request.value(*def));
+            }
+        }
+    }
+    auto rs = std::make_unique<result_set>(std::move(specs));
+    rs->add_row(std::move(row));
+    return rs;
+}
+
 future<::shared_ptr<transport::messages::result_message>>
 modification_statement::execute_with_condition(distributed<service::storage_proxy>& proxy, service::query_state& qs, const query_options& options) {
-    fail(unimplemented::cause::LWT);
-#if 0
-        List<ByteBuffer> keys = buildPartitionKeyNames(options);
-        // We don't support IN for CAS operation so far
-        if (keys.size() > 1)
-            throw new InvalidRequestException("IN on the partition key is not supported with conditional updates");
-
-        ByteBuffer key = keys.get(0);
-        long now = options.getTimestamp(queryState);
-        Composite prefix = createClusteringPrefix(options);
-
-        CQL3CasRequest request = new CQL3CasRequest(cfm, key, false);
-        addConditions(prefix, request, options);
-        request.addRowUpdate(prefix, this, options, now);
-
-        ColumnFamily result = StorageProxy.cas(keyspace(),
-                                               columnFamily(),
-                                               key,
-                                               request,
-                                               options.getSerialConsistency(),
-                                               options.getConsistency(),
-                                               queryState.getClientState());
-        return new ResultMessage.Rows(buildCasResultSet(key, result, options));
-#endif
+    auto cl_for_paxos = options.get_serial_consistency().value_or(db::consistency_level::SERIAL);
+    auto cl_for_commit = options.get_consistency();
+    db::validate_for_cas(cl_for_paxos);
+    db::validate_for_cas_commit(keyspace(), cl_for_commit);
+
+    auto keys = build_partition_keys(options);
+    // We don't support IN for CAS operation so far
+    if (keys.size() > 1) {
+        throw exceptions::invalid_request_exception("IN on the partition key is not supported with conditional updates");
+    }
+    if (requires_read()) {
+        throw exceptions::invalid_request_exception("Operations on lists requiring a read are not supported with conditional updates");
+    }
+    auto prefix = create_exploded_clustering_prefix(options);
+
+    // The whole row is read, as IF NOT EXISTS returns it when it fails. A
+    // single row will do, for the static part of the partition.
+    std::vector<column_id> static_cols;
+    boost::range::push_back(static_cols, s->static_columns()
+        | boost::adaptors::filtered([] (auto&& col) { return col.is_atomic(); })
+        | boost::adaptors::transformed([] (auto&& col) { return col.id; }));
+    std::vector<column_id> regular_cols;
+    boost::range::push_back(regular_cols, s->regular_columns()
+        | boost::adaptors::filtered([] (auto&& col) { return col.is_atomic(); })
+        | boost::adaptors::transformed([] (auto&& col) { return col.id; }));
+    query::partition_slice ps(
+            {query::clustering_range(clustering_key_prefix::from_clustering_prefix(*s, prefix))},
+            std::move(static_cols),
+            std::move(regular_cols),
+            query::partition_slice::option_set::of<
+                query::partition_slice::option::send_partition_key,
+                query::partition_slice::option::send_clustering_key>());
+    auto cmd = make_lw_shared<query::read_command>(s->id(), std::move(ps), 1);
+
+    query::partition_range pr(dht::global_partitioner().decorate_key(*s, keys[0]));
+    auto request = ::make_shared<cas_request>(*this, options, std::move(keys[0]), std::move(prefix));
+    return proxy.local().cas(s, request, cmd, std::move(pr), cl_for_paxos, cl_for_commit).then([this, request] (bool applied) {
+        auto rs = this->build_cas_result_set(*request, applied);
+        return ::shared_ptr<transport::messages::result_message>(
+                ::make_shared<transport::messages::result_message::rows>(std::move(rs)));
+    });
 }
 
 future<::shared_ptr<transport::messages::result_message>>
@@ -539,6 +769,10 @@ modification_statement::validate(distributed<service::storage_proxy>&, const ser
     if (is_counter() && attrs->is_time_to_live_set()) {
         throw exceptions::invalid_request_exception("Cannot provide custom TTL for counter updates");
     }
+
+    if (s->is_view()) {
+        throw exceptions::invalid_request_exception(sprint("Cannot directly modify a materialized view (%s)", s->cf_name()));
+    }
 }
 
 bool modification_statement::depends_on_keyspace(const sstring& ks_name) const {
@@ -49,6 +49,7 @@
 #include "cql3/cql_statement.hh"
 #include "cql3/attributes.hh"
 #include "cql3/operation.hh"
+#include "cql3/result_set.hh"
 #include "cql3/relation.hh"
 
 #include "db/consistency_level.hh"
@@ -201,16 +202,6 @@ class modification_statement : public cql_statement {
         _column_operations.push_back(std::move(op));
     }
 
-#if 0
-    public Iterable<ColumnDefinition> getColumnsWithConditions()
-    {
-        if (ifNotExists || ifExists)
-            return null;
-
-        return Iterables.concat(columnConditions == null ? Collections.<ColumnDefinition>emptyList() : Iterables.transform(columnConditions, getColumnForCondition),
-                                staticConditions == null ? Collections.<ColumnDefinition>emptyList() : Iterables.transform(staticConditions, getColumnForCondition));
-    }
-#endif
 public:
     void add_condition(::shared_ptr<column_condition> cond) {
         if (cond->column.is_static()) {
@@ -245,9 +236,9 @@ class modification_statement : public cql_statement {
     void add_key_value(const column_definition& def, ::shared_ptr<term> value);
     void process_where_clause(database& db, std::vector<relation_ptr> where_clause, ::shared_ptr<variable_specifications> names);
     std::vector<partition_key> build_partition_keys(const query_options& options);
+    exploded_clustering_prefix create_exploded_clustering_prefix(const query_options& options);
 
 private:
-    exploded_clustering_prefix create_exploded_clustering_prefix(const query_options& options);
     exploded_clustering_prefix create_exploded_clustering_prefix_internal(const query_options& options);
 
 protected:
@@ -260,12 +251,16 @@ class modification_statement : public cql_statement {
         });
     }
 
-protected:
-    future<update_parameters::prefetched_rows_type> read_required_rows(
+    /**
+     * Reads the rows which statements of the table s requiring a read write
+     * to, those at each of the prefixes in each of the partitions of keys, in
+     * a single query, so that the statements of a batch can share it.
+     */
+    static future<update_parameters::prefetched_rows_type> read_required_rows(
                 distributed<service::storage_proxy>& proxy,
-                lw_shared_ptr<std::vector<partition_key>> keys,
-                lw_shared_ptr<exploded_clustering_prefix> prefix,
-                bool local,
+                schema_ptr s,
+                const std::vector<partition_key>& keys,
+                const std::vector<exploded_clustering_prefix>& prefixes,
                 db::consistency_level cl);
 
 public:
@@ -286,119 +281,14 @@ class modification_statement : public cql_statement {
     future<::shared_ptr<transport::messages::result_message>>
     execute_with_condition(distributed<service::storage_proxy>& proxy, service::query_state& qs, const query_options& options);
 
-#if 0
-    public void addConditions(Composite clusteringPrefix, CQL3CasRequest request, QueryOptions options) throws InvalidRequestException
-    {
-        if (ifNotExists)
-        {
-            // If we use ifNotExists, if the statement applies to any non static columns, then the condition is on the row of the non-static
-            // columns and the prefix should be the clusteringPrefix. But if only static columns are set, then the ifNotExists apply to the existence
-            // of any static columns and we should use the prefix for the "static part" of the partition.
-            request.addNotExist(clusteringPrefix);
-        }
-        else if (ifExists)
-        {
-            request.addExist(clusteringPrefix);
-        }
-        else
-        {
-            if (columnConditions != null)
-                request.addConditions(clusteringPrefix, columnConditions, options);
-            if (staticConditions != null)
-                request.addConditions(cfm.comparator.staticPrefix(), staticConditions, options);
-        }
-    }
-
-    private ResultSet buildCasResultSet(ByteBuffer key, ColumnFamily cf, QueryOptions options) throws InvalidRequestException
-    {
-        return buildCasResultSet(keyspace(), key, columnFamily(), cf, getColumnsWithConditions(), false, options);
-    }
-
-    public static ResultSet buildCasResultSet(String ksName, ByteBuffer key, String cfName, ColumnFamily cf, Iterable<ColumnDefinition> columnsWithConditions, boolean isBatch, QueryOptions options)
-    throws InvalidRequestException
-    {
-        boolean success = cf == null;
+    class cas_request;
 
-        ColumnSpecification spec = new ColumnSpecification(ksName, cfName, CAS_RESULT_COLUMN, BooleanType.instance);
-        ResultSet.Metadata metadata = new ResultSet.Metadata(Collections.singletonList(spec));
-        List<List<ByteBuffer>> rows = Collections.singletonList(Collections.singletonList(BooleanType.instance.decompose(success)));
+    // The columns of the result of a conditional update which did not
+    // apply, after "[applied]": those with conditions, or the whole row
+    // for IF EXISTS and IF NOT EXISTS.
+    std::vector<const column_definition*> get_columns_for_cas_result() const;
 
-        ResultSet rs = new ResultSet(metadata, rows);
-        return success ? rs : merge(rs, buildCasFailureResultSet(key, cf, columnsWithConditions, isBatch, options));
-    }
-
-    private static ResultSet merge(ResultSet left, ResultSet right)
-    {
-        if (left.size() == 0)
-            return right;
-        else if (right.size() == 0)
-            return left;
-
-        assert left.size() == 1;
-        int size = left.metadata.names.size() + right.metadata.names.size();
-        List<ColumnSpecification> specs = new ArrayList<ColumnSpecification>(size);
-        specs.addAll(left.metadata.names);
-        specs.addAll(right.metadata.names);
-        List<List<ByteBuffer>> rows = new ArrayList<>(right.size());
-        for (int i = 0; i < right.size(); i++)
-        {
-            List<ByteBuffer> row = new ArrayList<ByteBuffer>(size);
-            row.addAll(left.rows.get(0));
-            row.addAll(right.rows.get(i));
-            rows.add(row);
-        }
-        return new ResultSet(new ResultSet.Metadata(specs), rows);
-    }
-
-    private static ResultSet buildCasFailureResultSet(ByteBuffer key, ColumnFamily cf, Iterable<ColumnDefinition> columnsWithConditions, boolean isBatch, QueryOptions options)
-    throws InvalidRequestException
-    {
-        CFMetaData cfm = cf.metadata();
-        Selection selection;
-        if (columnsWithConditions == null)
-        {
-            selection = Selection.wildcard(cfm);
-        }
-        else
-        {
-            // We can have multiple conditions on the same columns (for collections) so use a set
-            // to avoid duplicate, but preserve the order just to it follows the order of IF in the query in general
-            Set<ColumnDefinition> defs = new LinkedHashSet<>();
-            // Adding the partition key for batches to disambiguate if the conditions span multipe rows (we don't add them outside
-            // of batches for compatibility sakes).
-            if (isBatch)
-            {
-                defs.addAll(cfm.partitionKeyColumns());
-                defs.addAll(cfm.clusteringColumns());
-            }
-            for (ColumnDefinition def : columnsWithConditions)
-                defs.add(def);
-            selection = Selection.forColumns(cfm, new ArrayList<>(defs));
-
-        }
-
-        long now = System.currentTimeMillis();
-        Selection.ResultSetBuilder builder = selection.resultSetBuilder(now);
-        SelectStatement.forSelection(cfm, selection).processColumnFamily(key, cf, options, now, builder);
-
-        return builder.build(options.getProtocolVersion());
-    }
-
-    public ResultMessage executeInternal(QueryState queryState, QueryOptions options) throws RequestValidationException, RequestExecutionException
-    {
-        if (hasConditions())
-            throw new UnsupportedOperationException();
-
-        for (IMutation mutation : getMutations(options, true, queryState.getTimestamp()))
-        {
-            // We don't use counters internally.
-            assert mutation instanceof Mutation;
-
-            ((Mutation) mutation).apply();
-        }
-        return null;
-    }
-#endif
+    std::unique_ptr<result_set> build_cas_result_set(const cas_request& request, bool applied) const;
 
 public:
     /**
@@ -413,6 +303,11 @@ class modification_statement : public cql_statement {
      */
     future<std::vector<mutation>> get_mutations(distributed<service::storage_proxy>& proxy, const query_options& options, bool local, int64_t now);
 
+    // The mutations of the statement to the partitions of keys at prefix,
+    // given the rows it requires read, if it does, in prefetched.
+    std::vector<mutation> get_mutations(const query_options& options, int64_t now, std::vector<partition_key> keys,
+            const exploded_clustering_prefix& prefix, update_parameters::prefetched_rows_type prefetched);
+
 public:
     future<std::unique_ptr<update_parameters>> make_update_parameters(
                 distributed<service::storage_proxy>& proxy,
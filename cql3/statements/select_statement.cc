@@ -46,6 +46,8 @@
 #include "core/shared_ptr.hh"
 #include "query-result-reader.hh"
 #include "query_result_merger.hh"
+#include "cql3/result_cache.hh"
+#include "utils/serialization.hh"
 
 namespace cql3 {
 
@@ -73,6 +75,59 @@ select_statement::select_statement(schema_ptr schema,
     _opts = _selection->get_query_options();
 }
 
+select_statement::~select_statement() {
+    if (_results_cached) {
+        global_result_cache().invalidate(this);
+    }
+}
+
+// What, besides the statement, its reads depend on.
+static bytes result_cache_key(const query_options& options) {
+    size_t size = serialize_int8_size + serialize_int32_size;
+    for (size_t i = 0; i < options.get_values_count(); ++i) {
+        auto v = options.get_value_at(i);
+        size += serialize_int32_size + (v ? v->size() : 0);
+    }
+    bytes key(bytes::initialized_later(), size);
+    auto out = key.begin();
+    serialize_int8(out, uint8_t(options.get_consistency()));
+    serialize_int32(out, options.get_page_size());
+    for (size_t i = 0; i < options.get_values_count(); ++i) {
+        auto v = options.get_value_at(i);
+        serialize_int32(out, v ? v->size() : uint32_t(-1));
+        if (v) {
+            out = std::copy(v->begin(), v->end(), out);
+        }
+    }
+    return key;
+}
+
+future<foreign_ptr<lw_shared_ptr<query::result>>>
+select_statement::query(distributed<service::storage_proxy>& proxy, lw_shared_ptr<query::read_command> cmd,
+        std::vector<query::partition_range>&& partition_ranges, service::query_state& state, const query_options& options) {
+    auto ttl = _schema->caching_options().result_cache_ttl();
+    // Only first pages of reads of given partitions, which writes of the
+    // partitions invalidate.
+    auto partitions = ttl.count() && !options.get_paging_state() && !cmd->index
+            ? result_cache::partitions_of(*_schema, partition_ranges) : std::experimental::optional<std::vector<uint64_t>>();
+    if (!partitions) {
+        return proxy.local().query(_schema, cmd, std::move(partition_ranges), options.get_consistency(), state.get_trace_state());
+    }
+    auto& cache = global_result_cache();
+    result_cache::key key{this, result_cache_key(options)};
+    auto cached = cache.find(key);
+    if (cached) {
+        return make_ready_future<foreign_ptr<lw_shared_ptr<query::result>>>(make_foreign(std::move(cached)));
+    }
+    _results_cached = true;
+    auto generation = cache.generation(*partitions);
+    return proxy.local().query(_schema, cmd, std::move(partition_ranges), options.get_consistency(), state.get_trace_state())
+            .then([key = std::move(key), partitions = std::move(*partitions), ttl, generation] (foreign_ptr<lw_shared_ptr<query::result>> result) mutable {
+        global_result_cache().insert(std::move(key), *result, std::move(partitions), ttl, generation);
+        return std::move(result);
+    });
+}
+
 bool select_statement::uses_function(const sstring& ks_name, const sstring& function_name) const {
     return _selection->uses_function(ks_name, function_name)
         || _restrictions->uses_function(ks_name, function_name)
@@ -123,7 +178,9 @@ select_statement::make_partition_slice(const query_options& options) {
         static_columns.reserve(_selection->get_column_count());
     }
 
-    regular_columns.reserve(_selection->get_column_count());
+    if (!_parameters->is_distinct()) {
+        regular_columns.reserve(_selection->get_column_count());
+    }
 
     for (auto&& col : _selection->get_columns()) {
         if (col->is_static()) {
@@ -144,8 +201,10 @@ select_statement::make_partition_slice(const query_options& options) {
         _opts.set(query::partition_slice::option::reversed);
         std::reverse(bounds.begin(), bounds.end());
     }
-    return query::partition_slice(std::move(bounds),
+    query::partition_slice slice(std::move(bounds),
         std::move(static_columns), std::move(regular_columns), _opts);
+    slice.filters = _restrictions->get_filters(options);
+    return slice;
 }
 
 int32_t select_statement::get_limit(const query_options& options) const {
@@ -185,47 +244,129 @@ select_statement::execute(distributed<service::storage_proxy>& proxy, service::q
     auto now = db_clock::now();
 
     auto command = ::make_lw_shared<query::read_command>(_schema->id(), make_partition_slice(options), limit, to_gc_clock(now));
+    command->index = _restrictions->get_index_restriction(options);
 
     int32_t page_size = options.get_page_size();
 
-    // An aggregation query will never be paged for the user, but we always page it internally to avoid OOM.
-    // If we user provided a page_size we'll use that to page internally (because why not), otherwise we use our default
-    // Note that if there are some nodes in the cluster with a version less than 2.0, we can't use paging (CASSANDRA-6707).
-    if (_selection->is_aggregate() && page_size <= 0) {
-        page_size = DEFAULT_COUNT_PAGE_SIZE;
+    // Aggregates are computed over all the rows at once, and the rows of
+    // queries sorted after the query are all needed before the first page.
+    // Replicas read the rows an index selects in one go.
+    if (page_size <= 0 || _selection->is_aggregate() || needs_post_query_ordering() || _restrictions->uses_secondary_indexing()) {
+        return execute(proxy, command, _restrictions->get_partition_key_ranges(options), state, options, now);
     }
+    return execute_paged(proxy, command, state, options, page_size, now);
+}
 
-    warn(unimplemented::cause::PAGING);
-    return execute(proxy, command, _restrictions->get_partition_key_ranges(options), state, options, now);
-
-#if 0
-    if (page_size <= 0 || !command || !query_pagers::may_need_paging(command, page_size)) {
-        return execute(proxy, command, state, options, now);
+// The ranges left to read from the partition the previous page stopped in.
+// Ranges are read in order, so the ones before it are done, as is the
+// partition itself unless the page stopped within it.
+static std::vector<query::partition_range> remaining_ranges(const schema& s,
+        std::vector<query::partition_range> ranges, const service::pager::paging_state& state) {
+    auto pos = dht::ring_position(dht::global_partitioner().decorate_key(s, state.get_partition_key()));
+    auto i = std::find_if(ranges.begin(), ranges.end(), [&] (const query::partition_range& r) {
+        return r.contains(pos, dht::ring_position_comparator(s));
+    });
+    ranges.erase(ranges.begin(), i);
+    if (ranges.empty()) {
+        return ranges;
+    }
+    auto& first = ranges.front();
+    auto within_partition = bool(state.get_clustering_key());
+    if (first.is_singular()) {
+        if (!within_partition) {
+            ranges.erase(ranges.begin());
+        }
+    } else {
+        first = query::partition_range(query::partition_range::bound(pos, within_partition), first.end());
     }
+    return ranges;
+}
 
-    auto pager = query_pagers::pager(command, cl, state.get_client_state(), options.get_paging_state());
+// Finds the partition and row a page ends with, among the first row_limit
+// rows of the results. The keys are copied, since the views a merged result
+// is visited through don't outlive result_view::consume().
+class page_end_visitor : public query::result_visitor {
+    uint32_t _row_limit;
+    uint32_t _rows = 0;
+public:
+    std::experimental::optional<partition_key> last_key;
+    std::experimental::optional<clustering_key> last_row;
+public:
+    page_end_visitor(uint32_t row_limit) : _row_limit(row_limit) { }
 
-    if (selection->isAggregate()) {
-        return page_aggregate_query(pager, options, page_size, now);
+    uint32_t rows() const {
+        return _rows;
     }
 
-    // We can't properly do post-query ordering if we page (see #6722)
-    if (needs_post_query_ordering()) {
-        throw exceptions::invalid_request_exception(
-              "Cannot page queries with both ORDER BY and a IN restriction on the partition key;"
-              " you must either remove the ORDER BY or the IN and sort client side, or disable paging for this query");
+    void accept_new_partition(const partition_key_view& key, uint32_t row_count) {
+        if (_rows < _row_limit) {
+            last_key = partition_key(key);
+            last_row = {};
+            // A partition with only the static row live counts as a row.
+            if (!row_count) {
+                ++_rows;
+            }
+        }
+    }
+
+    void accept_new_row(const clustering_key_view& key, const query::result_row_view& static_row, const query::result_row_view& row) {
+        if (_rows < _row_limit) {
+            last_row = clustering_key(key);
+            ++_rows;
+        }
     }
+};
 
-    return pager->fetch_page(page_size).then([this, pager, &options, limit, now] (auto page) {
-        auto msg = process_results(page, options, limit, now);
+// The paging state the next page starts from, or null if this one was the
+// last. remaining is what was left of the query limit for this page.
+static ::shared_ptr<service::pager::paging_state> next_paging_state(const query::result& results,
+        const query::read_command& cmd, uint32_t remaining) {
+    page_end_visitor visitor(cmd.row_limit);
+    query::result_view::consume(results, cmd.slice, visitor);
+    // A page cut short by its size limit ends early rather than the query.
+    auto short_page = visitor.rows() < cmd.row_limit && !cmd.is_size_limited(results.serialized_size());
+    if (short_page || visitor.rows() == remaining || !visitor.last_key) {
+        return {};
+    }
+    std::experimental::optional<clustering_key> ck;
+    if (!cmd.slice.options.contains(query::partition_slice::option::distinct)) {
+        ck = std::move(visitor.last_row);
+    }
+    return ::make_shared<service::pager::paging_state>(std::move(*visitor.last_key), std::move(ck),
+            remaining - visitor.rows(), cmd.query_uuid);
+}
 
-        if (!pager->is_exhausted()) {
-            msg->result->metadata->set_has_more_pages(pager->state());
+future<shared_ptr<transport::messages::result_message>>
+select_statement::execute_paged(distributed<service::storage_proxy>& proxy, lw_shared_ptr<query::read_command> cmd,
+        service::query_state& state, const query_options& options, int32_t page_size, db_clock::time_point now) {
+    auto ranges = _restrictions->get_partition_key_ranges(options);
+    uint32_t remaining = cmd->row_limit;
+    auto paging_state = options.get_paging_state();
+    if (paging_state) {
+        remaining = paging_state->get_remaining();
+        cmd->query_uuid = paging_state->get_query_uuid();
+        cmd->is_first_page = false;
+        if (paging_state->get_clustering_key()) {
+            cmd->resume_after = query::row_position{paging_state->get_partition_key(), *paging_state->get_clustering_key()};
         }
+        ranges = remaining_ranges(*_schema, std::move(ranges), *paging_state);
+    } else {
+        cmd->query_uuid = utils::make_random_uuid();
+    }
+    cmd->row_limit = std::min(remaining, uint32_t(page_size));
+    auto max_size_in_kb = proxy.local().get_db().local().get_config().paged_result_size_limit_in_kb();
+    if (max_size_in_kb) {
+        cmd->max_result_size = std::min<uint64_t>(uint64_t(max_size_in_kb) * 1024, query::no_result_size_limit - 1);
+    }
+    // The keys of the last row tell where the next page starts.
+    cmd->slice.options.set(query::partition_slice::option::send_partition_key);
+    cmd->slice.options.set(query::partition_slice::option::send_clustering_key);
 
-        return msg;
+    return query(proxy, cmd, std::move(ranges), state, options)
+            .then([this, &options, now, cmd, remaining] (foreign_ptr<lw_shared_ptr<query::result>> result) {
+        auto state = next_paging_state(*result, *cmd, remaining);
+        return this->process_results(std::move(result), cmd, options, now, std::move(state));
     });
-#endif
 }
 
 future<shared_ptr<transport::messages::result_message>>
@@ -236,19 +377,31 @@ select_statement::execute(distributed<service::storage_proxy>& proxy, lw_shared_
     // is specified we need to get "limit" rows from each partition since there
     // is no way to tell which of these rows belong to the query result before
     // doing post-query ordering.
+    // Aggregates the replicas can compute parts of are computed there, only
+    // the partial results being sent back rather than the rows.
+    auto aggregates = _selection->get_partial_aggregates();
+    if (aggregates && !_limit && !needs_post_query_ordering()) {
+        return proxy.local().query_aggregates(_schema, cmd, std::move(partition_ranges), std::move(*aggregates), options.get_consistency())
+            .then([this] (std::vector<bytes_opt> values) {
+                auto rs = std::make_unique<result_set>(::make_shared<metadata>(*_selection->get_result_metadata()));
+                rs->add_row(std::move(values));
+                return ::shared_ptr<transport::messages::result_message>(::make_shared<transport::messages::result_message::rows>(std::move(rs)));
+            });
+    }
+
     if (needs_post_query_ordering() && _limit) {
         return do_with(std::forward<std::vector<query::partition_range>>(partition_ranges), [this, &proxy, &state, &options, cmd](auto prs) {
             query::result_merger merger;
             return map_reduce(prs.begin(), prs.end(), [this, &proxy, &state, &options, cmd] (auto pr) {
                 std::vector<query::partition_range> prange { pr };
                 auto command = ::make_lw_shared<query::read_command>(*cmd);
-                return proxy.local().query(_schema, command, std::move(prange), options.get_consistency());
+                return proxy.local().query(_schema, command, std::move(prange), options.get_consistency(), state.get_trace_state());
             }, std::move(merger));
         }).then([this, &options, now, cmd] (auto result) {
             return this->process_results(std::move(result), cmd, options, now);
         });
     } else {
-        return proxy.local().query(_schema, cmd, std::move(partition_ranges), options.get_consistency())
+        return query(proxy, cmd, std::move(partition_ranges), state, options)
             .then([this, &options, now, cmd] (auto result) {
                 return this->process_results(std::move(result), cmd, options, now);
             });
@@ -261,6 +414,7 @@ select_statement::execute_internal(distributed<service::storage_proxy>& proxy, s
     int32_t limit = get_limit(options);
     auto now = db_clock::now();
     auto command = ::make_lw_shared<query::read_command>(_schema->id(), make_partition_slice(options), limit);
+    command->index = _restrictions->get_index_restriction(options);
     auto partition_ranges = _restrictions->get_partition_key_ranges(options);
 
     if (needs_post_query_ordering() && _limit) {
@@ -282,16 +436,22 @@ select_statement::execute_internal(distributed<service::storage_proxy>& proxy, s
 }
 
 // Implements ResultVisitor concept from query.hh
+//
+// Builder is either a result_set_builder or a result_set_writer.
+template <typename Builder>
 class result_set_building_visitor {
-    cql3::selection::result_set_builder& builder;
-    select_statement& stmt;
+    Builder& builder;
+    const schema& _schema;
+    selection::selection& _selection;
     uint32_t _row_count;
-    std::vector<bytes> _partition_key;
-    std::vector<bytes> _clustering_key;
+    // Point into the results being visited.
+    std::vector<bytes_view> _partition_key;
+    std::vector<bytes_view> _clustering_key;
 public:
-    result_set_building_visitor(cql3::selection::result_set_builder& builder, select_statement& stmt)
+    result_set_building_visitor(Builder& builder, const schema& s, selection::selection& selection)
         : builder(builder)
-        , stmt(stmt)
+        , _schema(s)
+        , _selection(selection)
         , _row_count(0)
     { }
 
@@ -313,8 +473,8 @@ class result_set_building_visitor {
         }
     };
 
-    void accept_new_partition(const partition_key& key, uint32_t row_count) {
-        _partition_key = key.explode(*stmt._schema);
+    void accept_new_partition(const partition_key_view& key, uint32_t row_count) {
+        _partition_key.assign(key.begin(_schema), key.end(_schema));
         _row_count = row_count;
     }
 
@@ -322,9 +482,9 @@ class result_set_building_visitor {
         _row_count = row_count;
     }
 
-    void accept_new_row(const clustering_key& key, const query::result_row_view& static_row,
+    void accept_new_row(const clustering_key_view& key, const query::result_row_view& static_row,
             const query::result_row_view& row) {
-        _clustering_key = key.explode(*stmt._schema);
+        _clustering_key.assign(key.begin(_schema), key.end(_schema));
         accept_new_row(static_row, row);
     }
 
@@ -332,7 +492,7 @@ class result_set_building_visitor {
         auto static_row_iterator = static_row.iterator();
         auto row_iterator = row.iterator();
         builder.new_row();
-        for (auto&& def : stmt._selection->get_columns()) {
+        for (auto&& def : _selection.get_columns()) {
             switch (def->kind) {
                 case column_kind::partition_key:
                     builder.add(_partition_key[def->component_index()]);
@@ -359,7 +519,7 @@ class result_set_building_visitor {
         if (_row_count == 0) {
             builder.new_row();
             auto static_row_iterator = static_row.iterator();
-            for (auto&& def : stmt._selection->get_columns()) {
+            for (auto&& def : _selection.get_columns()) {
                 if (def->is_partition_key()) {
                     builder.add(_partition_key[def->component_index()]);
                 } else if (def->is_static()) {
@@ -372,22 +532,136 @@ class result_set_building_visitor {
     }
 };
 
+// Writes the rows in the native protocol format as they are visited, in
+// place of a result_set_builder, for selections which return the columns
+// as they are. Only the first row_limit rows are written.
+class result_set_writer {
+    bytes_ostream& _out;
+    serialization_format _serialization_format;
+    uint32_t _row_limit;
+    uint32_t _column_count;
+    uint32_t _rows = 0;
+    uint32_t _column = 0;
+private:
+    // Columns added only for ordering are not part of the result.
+    bool next_value() {
+        return _rows <= _row_limit && _column++ < _column_count;
+    }
+    void write_value(bytes_view v) {
+        _out.write<int32_t>(v.size());
+        _out.write(v);
+    }
+public:
+    result_set_writer(bytes_ostream& out, serialization_format sf, uint32_t row_limit, uint32_t column_count)
+        : _out(out)
+        , _serialization_format(sf)
+        , _row_limit(row_limit)
+        , _column_count(column_count)
+    { }
+
+    void new_row() {
+        ++_rows;
+        _column = 0;
+    }
+
+    void add_empty() {
+        if (next_value()) {
+            _out.write<int32_t>(-1);
+        }
+    }
+
+    void add(bytes_view value) {
+        if (next_value()) {
+            write_value(value);
+        }
+    }
+
+    void add(const column_definition& def, const query::result_atomic_cell_view& c) {
+        if (next_value()) {
+            write_value(c.value());
+        }
+    }
+
+    void add(const column_definition& def, collection_mutation::view c) {
+        if (next_value()) {
+            auto&& ctype = static_cast<const collection_type_impl*>(def.type.get());
+            write_value(ctype->to_value(c, _serialization_format));
+        }
+    }
+
+    uint32_t rows() const {
+        return std::min(_rows, _row_limit);
+    }
+};
+
+template <typename Builder>
+static void consume_results(const query::result& results, const query::read_command& cmd,
+        const schema& s, selection::selection& selection, Builder& builder) {
+    query::result_view::consume(results, cmd.slice, result_set_building_visitor<Builder>(builder, s, selection));
+}
+
+// Keeps the query results until they are serialized, so that the CQL
+// server can write them straight into its response, while the rest of the
+// consumers still see a result_set.
+class select_result_generator : public result_generator {
+    schema_ptr _schema;
+    ::shared_ptr<selection::selection> _selection;
+    foreign_ptr<lw_shared_ptr<query::result>> _results;
+    lw_shared_ptr<query::read_command> _cmd;
+    serialization_format _serialization_format;
+    db_clock::time_point _now;
+    ::shared_ptr<metadata> _metadata;
+public:
+    select_result_generator(schema_ptr s, ::shared_ptr<selection::selection> selection,
+            foreign_ptr<lw_shared_ptr<query::result>> results, lw_shared_ptr<query::read_command> cmd,
+            serialization_format sf, db_clock::time_point now, ::shared_ptr<service::pager::paging_state> paging_state)
+        : _schema(std::move(s))
+        , _selection(std::move(selection))
+        , _results(std::move(results))
+        , _cmd(std::move(cmd))
+        , _serialization_format(sf)
+        , _now(now)
+        , _metadata(_selection->get_result_metadata())
+    {
+        // The metadata of the selection is shared unless this page has to
+        // tell where the next one starts.
+        if (paging_state) {
+            _metadata = ::make_shared<metadata>(*_metadata);
+            _metadata->set_has_more_pages(std::move(paging_state));
+        }
+    }
+
+    virtual const metadata& get_metadata() const override {
+        return *_metadata;
+    }
+
+    virtual uint32_t write_rows(bytes_ostream& out) const override {
+        result_set_writer writer(out, _serialization_format, _cmd->row_limit, _metadata->column_count());
+        consume_results(*_results, *_cmd, *_schema, *_selection, writer);
+        return writer.rows();
+    }
+
+    virtual std::unique_ptr<result_set> build() const override {
+        selection::result_set_builder builder(*_selection, _now, _serialization_format);
+        consume_results(*_results, *_cmd, *_schema, *_selection, builder);
+        auto rs = builder.build();
+        rs->trim(_cmd->row_limit);
+        rs->get_metadata().set_has_more_pages(_metadata->paging_state());
+        return rs;
+    }
+};
+
 shared_ptr<transport::messages::result_message>
 select_statement::process_results(foreign_ptr<lw_shared_ptr<query::result>> results, lw_shared_ptr<query::read_command> cmd,
-        const query_options& options, db_clock::time_point now) {
-    cql3::selection::result_set_builder builder(*_selection, now, options.get_serialization_format());
-
-    // FIXME: This special casing saves us the cost of copying an already
-    // linearized response. When we switch views to scattered_reader this will go away.
-    if (results->buf().is_linearized()) {
-        query::result_view view(results->buf().view());
-        view.consume(cmd->slice, result_set_building_visitor(builder, *this));
-    } else {
-        bytes_ostream w(results->buf());
-        query::result_view view(w.linearize());
-        view.consume(cmd->slice, result_set_building_visitor(builder, *this));
+        const query_options& options, db_clock::time_point now, ::shared_ptr<service::pager::paging_state> paging_state) {
+    if (!needs_post_query_ordering() && _selection->is_trivial()) {
+        return ::make_shared<transport::messages::result_message::rows>(std::make_unique<select_result_generator>(
+                _schema, _selection, std::move(results), cmd, options.get_serialization_format(), now, std::move(paging_state)));
     }
 
+    cql3::selection::result_set_builder builder(*_selection, now, options.get_serialization_format());
+    consume_results(*results, *cmd, *_schema, *_selection, builder);
+
     auto rs = builder.build();
     if (needs_post_query_ordering()) {
         rs->sort(_ordering_comparator);
@@ -396,6 +670,7 @@ select_statement::process_results(foreign_ptr<lw_shared_ptr<query::result>> resu
         }
     }
     rs->trim(cmd->row_limit);
+    rs->get_metadata().set_has_more_pages(std::move(paging_state));
     return ::make_shared<transport::messages::result_message::rows>(std::move(rs));
 }
 
@@ -488,6 +763,10 @@ void select_statement::raw_statement::validate_distinct_selection(schema_ptr sch
         }
     }
 
+    if (restrictions->has_filtering_restrictions()) {
+        throw exceptions::invalid_request_exception("SELECT DISTINCT queries cannot filter on non primary key columns");
+    }
+
     // If it's a key range, we require that all partition key columns are selected so we don't have to bother
     // with post-query grouping.
     if (!restrictions->is_key_range()) {
@@ -616,12 +895,15 @@ bool select_statement::raw_statement::is_reversed(schema_ptr schema) {
 void select_statement::raw_statement::check_needs_filtering(
     ::shared_ptr<restrictions::statement_restrictions> restrictions)
 {
-    // non-key-range non-indexed queries cannot involve filtering underneath
-    if (!_parameters->allow_filtering() && (restrictions->is_key_range() || restrictions->uses_secondary_indexing())) {
+    // non-key-range non-indexed queries cannot involve filtering underneath,
+    // but for the restrictions on regular columns the replicas check
+    if (!_parameters->allow_filtering() && (restrictions->is_key_range() || restrictions->uses_secondary_indexing()
+            || restrictions->has_filtering_restrictions())) {
         // We will potentially filter data if either:
         //  - Have more than one IndexExpression
         //  - Have no index expression and the column filter is not the identity
-        if (restrictions->need_filtering()) {
+        //  - Have restrictions on regular columns no index is looked up for
+        if (restrictions->need_filtering() || restrictions->has_filtering_restrictions()) {
             throw exceptions::invalid_request_exception(
                 "Cannot execute this query as it might involve data filtering and "
                     "thus may have unpredictable performance. If you want to execute "
@@ -63,7 +63,6 @@ namespace statements {
  *
  */
 class select_statement : public cql_statement {
-    friend class result_set_building_visitor;
 public:
     class parameters final {
     public:
@@ -111,6 +110,14 @@ class select_statement : public cql_statement {
     ordering_comparator_type _ordering_comparator;
 
     query::partition_slice::option_set _opts;
+    // Whether the result cache may hold results of this statement.
+    bool _results_cached = false;
+private:
+    // Reads the ranges, or serves the result of an identical earlier read
+    // from the result cache if the table has one.
+    future<foreign_ptr<lw_shared_ptr<query::result>>> query(distributed<service::storage_proxy>& proxy,
+        lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges,
+        service::query_state& state, const query_options& options);
 public:
     select_statement(schema_ptr schema,
             uint32_t bound_terms,
@@ -120,6 +127,7 @@ class select_statement : public cql_statement {
             bool is_reversed,
             ordering_comparator_type ordering_comparator,
             ::shared_ptr<term> limit);
+    ~select_statement();
 
     virtual bool uses_function(const sstring& ks_name, const sstring& function_name) const override;
 
@@ -145,8 +153,15 @@ class select_statement : public cql_statement {
         lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges, service::query_state& state,
          const query_options& options, db_clock::time_point now);
 
+    // Reads a page of at most page_size rows, starting where the paging
+    // state of the options says the previous page stopped.
+    future<::shared_ptr<transport::messages::result_message>> execute_paged(distributed<service::storage_proxy>& proxy,
+        lw_shared_ptr<query::read_command> cmd, service::query_state& state, const query_options& options, int32_t page_size,
+        db_clock::time_point now);
+
     shared_ptr<transport::messages::result_message> process_results(foreign_ptr<lw_shared_ptr<query::result>> results,
-        lw_shared_ptr<query::read_command> cmd, const query_options& options, db_clock::time_point now);
+        lw_shared_ptr<query::read_command> cmd, const query_options& options, db_clock::time_point now,
+        ::shared_ptr<service::pager::paging_state> paging_state = {});
 #if 0
     private ResultMessage.Rows pageAggregateQuery(QueryPager pager, QueryOptions options, int pageSize, long now)
             throws RequestValidationException, RequestExecutionException
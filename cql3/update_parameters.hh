@@ -94,7 +94,8 @@ class update_parameters final {
         prefetch_data(schema_ptr schema);
     };
     // Note: value (mutation) only required to contain the rows we are interested in
-    using prefetched_rows_type = std::experimental::optional<prefetch_data>;
+    // Shared by the statements of a batch which read the same table.
+    using prefetched_rows_type = lw_shared_ptr<const prefetch_data>;
 private:
     const gc_clock::duration _ttl;
     const prefetched_rows_type _prefetched; // For operation that require a read-before-write
@@ -139,13 +140,9 @@ class update_parameters final {
         }
     };
 
-#if 0
-     public Cell makeCounter(CellName name, long delta) throws InvalidRequestException
-     {
-         QueryProcessor.validateCellName(name, metadata.comparator);
-         return new BufferCounterUpdateCell(name, delta, FBUtilities.timestampMicros());
-     }
-#endif
+    atomic_cell make_counter_update_cell(int64_t delta) const {
+        return atomic_cell::make_live_counter_update(_timestamp, delta);
+    }
 
     tombstone make_tombstone() const {
         return {_timestamp, _local_deletion_time};
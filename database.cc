@@ -38,6 +38,8 @@
 #include <boost/algorithm/string/split.hpp>
 #include "sstables/sstables.hh"
 #include "sstables/compaction.hh"
+#include "sstables/key_cache.hh"
+#include "sstables/index_page_cache.hh"
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/range/adaptor/map.hpp>
 #include "locator/simple_snitch.hh"
@@ -45,6 +47,9 @@
 #include <boost/function_output_iterator.hpp>
 #include <boost/range/algorithm/heap_algorithm.hpp>
 #include <boost/range/algorithm/find.hpp>
+#include <boost/range/algorithm/find_if.hpp>
+#include <boost/range/algorithm/count_if.hpp>
+#include <boost/range/algorithm/sort.hpp>
 #include "frozen_mutation.hh"
 #include "mutation_partition_applier.hh"
 #include "core/do_with.hh"
@@ -55,6 +60,13 @@
 #include <core/fstream.hh>
 #include "utils/latency.hh"
 #include "utils/flush_queue.hh"
+#include "utils/io_queue.hh"
+#include "utils/cpu_scheduler.hh"
+#include "lister.hh"
+#include "db/index/secondary_index.hh"
+#include "db/view/view.hh"
+#include "counters.hh"
+#include "cql3/result_cache.hh"
 
 using namespace std::chrono_literals;
 
@@ -72,8 +84,12 @@ column_family::column_family(schema_ptr schema, config config, db::commitlog& cl
     , _commitlog(&cl)
     , _compaction_manager(compaction_manager)
     , _flush_queue(std::make_unique<memtable_flush_queue>())
+    , _querier_expiry([this] { expire_queriers(); })
+    , _index_manager(*this, compaction_manager)
+    , _pending_writes_timer([this] { apply_pending_writes(); })
 {
     add_memtable();
+    setup_collectd();
     if (!_config.enable_disk_writes) {
         dblog.warn("Writes disabled, column family no durable.");
     }
@@ -88,13 +104,53 @@ column_family::column_family(schema_ptr schema, config config, no_commitlog cl,
     , _commitlog(nullptr)
     , _compaction_manager(compaction_manager)
     , _flush_queue(std::make_unique<memtable_flush_queue>())
+    , _querier_expiry([this] { expire_queriers(); })
+    , _index_manager(*this, compaction_manager)
+    , _pending_writes_timer([this] { apply_pending_writes(); })
 {
     add_memtable();
+    setup_collectd();
     if (!_config.enable_disk_writes) {
         dblog.warn("Writes disabled, column family no durable.");
     }
 }
 
+// Per shard metrics of the table, under its keyspace and name, so that
+// hot shards and tables reading many sstables stand out.
+void
+column_family::setup_collectd() {
+    auto name = _schema->ks_name() + "." + _schema->cf_name();
+    auto add = [this, &name] (sstring type, sstring metric, scollectd::data_type dt, std::function<int64_t ()> f) {
+        _collectd.push_back(
+            scollectd::add_polled_metric(scollectd::type_instance_id("column_family"
+                    , scollectd::per_cpu_plugin_instance
+                    , type, name + "." + metric)
+                    , scollectd::make_typed(dt, std::move(f))));
+    };
+    add("total_operations", "reads", scollectd::data_type::DERIVE, [this] {
+        return _stats.reads.count;
+    });
+    add("total_operations", "writes", scollectd::data_type::DERIVE, [this] {
+        return _stats.writes.count;
+    });
+    add("queue_length", "pending_reads", scollectd::data_type::GAUGE, [this] {
+        return _stats.pending_reads;
+    });
+    add("total_bytes", "read_bytes", scollectd::data_type::DERIVE, [this] {
+        return _stats.read_bytes;
+    });
+    add("gauge", "sstables_per_read", scollectd::data_type::GAUGE, [this] {
+        auto& h = _stats.estimated_sstable_per_read;
+        return h.count() ? h.mean() : 0;
+    });
+    add("gauge", "live_sstables", scollectd::data_type::GAUGE, [this] {
+        return _stats.live_sstable_count;
+    });
+    add("bytes", "live_disk_space", scollectd::data_type::GAUGE, [this] {
+        return _stats.live_disk_space_used;
+    });
+}
+
 partition_presence_checker
 column_family::make_partition_presence_checker(lw_shared_ptr<sstable_list> old_sstables) {
     return [this, old_sstables = std::move(old_sstables)] (const partition_key& key) {
@@ -127,6 +183,14 @@ logalloc::occupancy_stats column_family::occupancy() const {
     return res;
 }
 
+api::timestamp_type column_family::min_memtable_timestamp() const {
+    auto min = api::max_timestamp;
+    for (auto&& m : *_memtables) {
+        min = std::min(min, m->min_timestamp());
+    }
+    return min;
+}
+
 static
 bool belongs_to_current_shard(const mutation& m) {
     return dht::shard_of(m.token()) == engine().cpu_id();
@@ -161,27 +225,160 @@ class range_sstable_reader final : public mutation_reader::impl {
 };
 
 class single_key_sstable_reader final : public mutation_reader::impl {
+    // The sstables the key may be in are read concurrently, so that a read
+    // takes about the time of the slowest of them rather than their sum,
+    // but no more than this many at a time, so that a partition spread over
+    // many sstables doesn't flood the disk.
+    static constexpr size_t max_concurrent_reads = 8;
+
     schema_ptr _schema;
     sstables::key _key;
     mutation_opt _m;
     bool _done = false;
     lw_shared_ptr<sstable_list> _sstables;
+    // Rows outside of them may be left out.
+    std::vector<query::clustering_range> _row_ranges;
+    // Whether sstables holding no rows in _row_ranges may be skipped, which
+    // they may not when the static row is read.
+    bool _skip_sstables;
+    sstables::estimated_histogram& _sstables_per_read;
 public:
-    single_key_sstable_reader(schema_ptr schema, lw_shared_ptr<sstable_list> sstables, const partition_key& key)
+    single_key_sstable_reader(schema_ptr schema, lw_shared_ptr<sstable_list> sstables, const partition_key& key,
+            sstables::estimated_histogram& sstables_per_read,
+            std::vector<query::clustering_range> row_ranges = { query::clustering_range::make_open_ended_both_sides() },
+            bool skip_sstables = false)
         : _schema(std::move(schema))
         , _key(sstables::key::from_partition_key(*_schema, key))
         , _sstables(std::move(sstables))
+        , _row_ranges(std::move(row_ranges))
+        , _skip_sstables(skip_sstables)
+        , _sstables_per_read(sstables_per_read)
     { }
 
     virtual future<mutation_opt> operator()() override {
         if (_done) {
             return make_ready_future<mutation_opt>();
         }
-        return parallel_for_each(*_sstables | boost::adaptors::map_values, [this](const lw_shared_ptr<sstables::sstable>& sstable) {
-            return sstable->read_row(_schema, _key).then([this](mutation_opt mo) {
-                apply(_m, std::move(mo));
-            });
-        }).then([this] {
+        auto read = make_lw_shared<int64_t>(0);
+        auto reads = make_lw_shared<semaphore>(max_concurrent_reads);
+        return parallel_for_each(*_sstables | boost::adaptors::map_values, [this, read, reads](const lw_shared_ptr<sstables::sstable>& sstable) {
+            if (_skip_sstables && !sstable->may_contain_rows(*_schema, _row_ranges)) {
+                return make_ready_future<>();
+            }
+            ++*read;
+            auto read_row = [this, sstable] {
+                return sstable->read_row(_schema, _key, _row_ranges).then([this](mutation_opt mo) {
+                    apply(_m, std::move(mo));
+                });
+            };
+            // Those the filter rules out are answered without a disk read.
+            if (!sstable->filter_has_key(_key)) {
+                return read_row();
+            }
+            return with_semaphore(*reads, 1, std::move(read_row));
+        }).then([this, read, reads] {
+            _sstables_per_read.add(*read);
+            _done = true;
+            return std::move(_m);
+        });
+    }
+};
+
+// Reads a single row from the sstables holding the newest data first, and
+// stops once what was read shadows whatever the sstables left may hold: when
+// the partition or the row was deleted after their newest write, or the row
+// marker and each column read were written after it. Without a newer live
+// marker, an older one could still be what keeps the row alive.
+class timestamp_ordered_sstable_reader final : public mutation_reader::impl {
+    schema_ptr _schema;
+    sstables::key _key;
+    std::vector<query::clustering_range> _row_ranges;
+    clustering_key _ck;
+    std::vector<column_id> _columns;
+    // Newest first.
+    std::vector<lw_shared_ptr<sstables::sstable>> _sstables;
+    mutation_opt _m;
+    bool _done = false;
+    sstables::estimated_histogram& _sstables_per_read;
+private:
+    bool shadows(api::timestamp_type max_timestamp) const {
+        if (!_m) {
+            return false;
+        }
+        auto& p = _m->partition();
+        if (p.partition_tombstone().timestamp > max_timestamp
+                || p.range_tombstone_for_row(*_schema, _ck).timestamp > max_timestamp) {
+            return true;
+        }
+        auto e = p.find_entry(*_schema, _ck);
+        if (!e) {
+            return false;
+        }
+        auto& row = e->row();
+        if (row.deleted_at().timestamp > max_timestamp) {
+            return true;
+        }
+        if (!row.marker().is_live(tombstone(), gc_clock::now()) || row.marker().timestamp() <= max_timestamp) {
+            return false;
+        }
+        return std::all_of(_columns.begin(), _columns.end(), [&row, max_timestamp] (column_id id) {
+            auto cell = row.cells().find_cell(id);
+            return cell && cell->as_atomic_cell().timestamp() > max_timestamp;
+        });
+    }
+
+    future<> read_from(size_t i) {
+        if (i == _sstables.size() || shadows(_sstables[i]->get_stats_metadata().max_timestamp)) {
+            _sstables_per_read.add(i);
+            return make_ready_future<>();
+        }
+        return _sstables[i]->read_row(_schema, _key, _row_ranges).then([this, i] (mutation_opt mo) {
+            apply(_m, std::move(mo));
+            return read_from(i + 1);
+        });
+    }
+public:
+    timestamp_ordered_sstable_reader(schema_ptr schema, const sstable_list& sstables, const partition_key& key,
+            const query::partition_slice& slice, sstables::estimated_histogram& sstables_per_read)
+        : _schema(std::move(schema))
+        , _key(sstables::key::from_partition_key(*_schema, key))
+        , _row_ranges(slice.row_ranges)
+        , _ck(_row_ranges[0].start()->value().to_full(*_schema))
+        , _columns(slice.regular_columns)
+        , _sstables_per_read(sstables_per_read)
+    {
+        for (auto&& sst : sstables | boost::adaptors::map_values) {
+            if (sst->may_contain_rows(*_schema, _row_ranges)) {
+                _sstables.push_back(sst);
+            }
+        }
+        std::sort(_sstables.begin(), _sstables.end(), [] (auto& a, auto& b) {
+            return a->get_stats_metadata().max_timestamp > b->get_stats_metadata().max_timestamp;
+        });
+    }
+
+    // Whether the slice reads a single whole row, of atomic cells only. The
+    // shards of a counter cell are merged across sstables whatever their
+    // timestamps, so counters are never shadowed.
+    static bool can_read(const schema& s, const query::partition_slice& slice) {
+        if (!slice.static_columns.empty() || slice.row_ranges.size() != 1 || !s.clustering_key_size()) {
+            return false;
+        }
+        auto& r = slice.row_ranges[0];
+        if (!r.is_singular() || !r.start()->value().is_full(s)) {
+            return false;
+        }
+        return std::all_of(slice.regular_columns.begin(), slice.regular_columns.end(), [&s] (column_id id) {
+            auto& def = s.regular_column_at(id);
+            return def.is_atomic() && !def.type->is_counter();
+        });
+    }
+
+    virtual future<mutation_opt> operator()() override {
+        if (_done) {
+            return make_ready_future<mutation_opt>();
+        }
+        return read_from(0).then([this] {
             _done = true;
             return std::move(_m);
         });
@@ -195,13 +392,31 @@ column_family::make_sstable_reader(const query::partition_range& pr) const {
         if (dht::shard_of(pos.token()) != engine().cpu_id()) {
             return make_empty_reader(); // range doesn't belong to this shard
         }
-        return make_mutation_reader<single_key_sstable_reader>(_schema, _sstables, *pos.key());
+        return make_mutation_reader<single_key_sstable_reader>(_schema, _sstables, *pos.key(),
+                _stats.estimated_sstable_per_read);
     } else {
         // range_sstable_reader is not movable so we need to wrap it
         return make_mutation_reader<range_sstable_reader>(_schema, _sstables, pr);
     }
 }
 
+mutation_reader
+column_family::make_sstable_reader(const query::partition_range& pr, const query::partition_slice& slice) const {
+    if (pr.is_singular() && pr.start()->value().has_key()) {
+        const dht::ring_position& pos = pr.start()->value();
+        if (dht::shard_of(pos.token()) != engine().cpu_id()) {
+            return make_empty_reader(); // range doesn't belong to this shard
+        }
+        if (timestamp_ordered_sstable_reader::can_read(*_schema, slice)) {
+            return make_mutation_reader<timestamp_ordered_sstable_reader>(_schema, *_sstables, *pos.key(), slice,
+                    _stats.estimated_sstable_per_read);
+        }
+        return make_mutation_reader<single_key_sstable_reader>(_schema, _sstables, *pos.key(),
+                _stats.estimated_sstable_per_read, slice.row_ranges, slice.static_columns.empty());
+    }
+    return make_sstable_reader(pr);
+}
+
 // Exposed for testing, not performance critical.
 future<column_family::const_mutation_partition_ptr>
 column_family::find_partition(const dht::decorated_key& key) const {
@@ -217,11 +432,120 @@ column_family::find_partition(const dht::decorated_key& key) const {
     });
 }
 
+future<column_family::const_mutation_partition_ptr>
+column_family::find_partition(const dht::decorated_key& key, query::partition_slice slice) const {
+    return do_with(query::partition_range::make_singular(key), std::move(slice), [this] (auto& range, auto& slice) {
+        return do_with(this->make_reader(range, slice, query::max_rows, gc_clock::now()), [] (mutation_reader& reader) {
+            return reader().then([] (mutation_opt&& mo) -> std::unique_ptr<const mutation_partition> {
+                if (!mo) {
+                    return {};
+                }
+                return std::make_unique<const mutation_partition>(std::move(mo->partition()));
+            });
+        });
+    });
+}
+
 future<column_family::const_mutation_partition_ptr>
 column_family::find_partition_slow(const partition_key& key) const {
     return find_partition(dht::global_partitioner().decorate_key(*_schema, key));
 }
 
+future<>
+column_family::with_partition_lock(const partition_key& key, std::function<future<> ()> func) {
+    auto k = to_bytes(key.representation());
+    auto& lock = _partition_locks[k];
+    if (!lock) {
+        lock = make_lw_shared<semaphore>(1);
+    }
+    auto sem = lock;
+    return sem->wait().then([func = std::move(func)] {
+        return func();
+    }).finally([this, sem, k = std::move(k)] {
+        sem->signal();
+        // Held by the map and by us only when nobody waits.
+        if (sem.use_count() == 2) {
+            _partition_locks.erase(k);
+        }
+    });
+}
+
+future<>
+column_family::apply_coalesced(const frozen_mutation& m, const db::replay_position& rp) {
+    if (rp < _highest_flushed_rp) {
+        return make_exception_future<>(replay_position_reordered_exception());
+    }
+    if (!_index_manager.empty()) {
+        _index_manager.apply(m);
+    }
+    sample_write(m.key(*_schema).representation());
+    _pending_writes.emplace_back(m, rp);
+    auto f = _pending_writes.back().done.get_future();
+    if (!_pending_writes_timer.armed()) {
+        _pending_writes_timer.arm(std::chrono::steady_clock::duration(0));
+    }
+    return f;
+}
+
+void
+column_family::apply_pending_writes() {
+    auto writes = std::move(_pending_writes);
+    _pending_writes.clear();
+    if (writes.empty()) {
+        return;
+    }
+    utils::latency_counter lc;
+    lc.start();
+
+    // A memtable may have been flushed since the writes were queued.
+    std::vector<std::pair<dht::decorated_key, pending_write*>> keyed;
+    db::replay_position rp;
+    for (auto&& w : writes) {
+        if (w.rp < _highest_flushed_rp) {
+            w.done.set_exception(replay_position_reordered_exception());
+            continue;
+        }
+        rp = std::max(rp, w.rp);
+        keyed.emplace_back(w.m->decorated_key(*_schema), &w);
+    }
+    dht::decorated_key::less_comparator less(_schema);
+    std::stable_sort(keyed.begin(), keyed.end(), [&less] (auto&& a, auto&& b) {
+        return less(a.first, b.first);
+    });
+
+    std::vector<memtable::partition_update> updates;
+    for (auto i = keyed.begin(); i != keyed.end();) {
+        auto j = std::find_if(i + 1, keyed.end(), [&] (auto&& e) {
+            return !e.first.equal(*_schema, i->first);
+        });
+        memtable::partition_update u{std::move(i->first)};
+        for (auto k = i; k != j; ++k) {
+            u.frozen.push_back(k->second->m);
+        }
+        updates.emplace_back(std::move(u));
+        i = j;
+    }
+
+    try {
+        active_memtable().apply(updates, rp);
+    } catch (...) {
+        auto ex = std::current_exception();
+        for (auto&& e : keyed) {
+            e.second->done.set_exception(ex);
+        }
+        return;
+    }
+    seal_on_overflow();
+    for (auto&& e : keyed) {
+        e.second->done.set_value();
+        _stats.writes.mark(lc);
+        _stats.write_latencies.mark(lc.latency_in_micro());
+    }
+    if (lc.is_start()) {
+        _stats.estimated_write.add(lc.latency_in_nano(), _stats.writes.count);
+    }
+}
+
 future<column_family::const_row_ptr>
 column_family::find_row(const dht::decorated_key& partition_key, clustering_key clustering_key) const {
     return find_partition(partition_key).then([clustering_key = std::move(clustering_key)] (const_mutation_partition_ptr p) {
@@ -281,6 +605,104 @@ column_family::make_reader(const query::partition_range& range) const {
     return make_combined_reader(std::move(readers));
 }
 
+// Keeps the sstable of its key_reader alive.
+class sstable_keys final : public key_reader::impl {
+    sstables::shared_sstable _sst;
+    key_reader _reader;
+public:
+    sstable_keys(sstables::shared_sstable sst, schema_ptr s, const query::partition_range& range)
+        : _sst(std::move(sst))
+        , _reader(_sst->read_range_keys(std::move(s), range))
+    { }
+    virtual future<partition_key_entry_opt> operator()() override {
+        return _reader();
+    }
+};
+
+key_reader
+column_family::make_key_reader(const query::partition_range& range) const {
+    if (query::is_wrap_around(range, *_schema)) {
+        fail(unimplemented::cause::WRAP_AROUND);
+    }
+
+    std::vector<key_reader> readers;
+    readers.reserve(_memtables->size() + _sstables->size());
+    for (auto&& mt : *_memtables) {
+        readers.emplace_back(make_key_reader_from_mutations(mt->make_reader(range)));
+    }
+    for (auto&& sst : *_sstables | boost::adaptors::map_values) {
+        readers.emplace_back(::make_key_reader<sstable_keys>(sst, _schema, range));
+    }
+    return make_combined_key_reader(_schema, std::move(readers));
+}
+
+// Only for traced reads, as it looks up the bloom filters of all sstables.
+void column_family::trace_sources(const tracing::trace_state_ptr& trace_state, const query::partition_range& range,
+        bool through_cache) const {
+    tracing::trace(trace_state, "Merging %d memtables with %s", _memtables->size(), through_cache ? "cache" : "sstables");
+    if (!query::is_single_partition(range)) {
+        tracing::trace(trace_state, "Scanning %d sstables", _sstables->size());
+        return;
+    }
+    auto& key = range.start()->value().as_decorated_key().key();
+    auto candidates = boost::count_if(*_sstables | boost::adaptors::map_values, [this, &key] (const sstables::shared_sstable& sst) {
+        return sst->filter_has_key(*_schema, key);
+    });
+    tracing::trace(trace_state, "Bloom filters of %d of %d sstables may hold the partition", candidates, _sstables->size());
+}
+
+mutation_reader
+column_family::make_reader(const query::partition_range& range, const query::partition_slice& slice,
+        uint32_t row_limit, gc_clock::time_point now, tracing::trace_state_ptr trace_state) const {
+    auto single_partition = query::is_single_partition(range);
+    auto bypass_cache = slice.options.contains(query::partition_slice::option::bypass_cache);
+    // A partition which doesn't go through the cache can be read from the
+    // sstables just for the rows of the slice, skipping over the blocks of
+    // wide partitions which hold none of them. The cache can only take
+    // partitions read whole, or prefixes of them.
+    auto through_cache = _config.enable_cache && !bypass_cache && _schema->caching_options().row_cache_enabled();
+    if (trace_state) {
+        trace_sources(trace_state, range, through_cache);
+    }
+    if (single_partition && !through_cache) {
+        std::vector<mutation_reader> readers;
+        readers.reserve(_memtables->size() + 1);
+        for (auto&& mt : *_memtables) {
+            readers.emplace_back(mt->make_reader(range));
+        }
+        readers.emplace_back(make_sstable_reader(range, slice));
+        return make_combined_reader(std::move(readers));
+    }
+    if (!_config.enable_cache || (!single_partition && !bypass_cache)) {
+        return make_reader(range);
+    }
+    if (query::is_wrap_around(range, *_schema)) {
+        fail(unimplemented::cause::WRAP_AROUND);
+    }
+
+    std::vector<mutation_reader> readers;
+    readers.reserve(_memtables->size() + 1);
+
+    // Rows hidden by memtable data make the query look further into the
+    // partition than row_limit, so a partially cached partition must hold
+    // that many more live rows to serve it.
+    uint64_t cache_row_limit = row_limit;
+    for (auto&& mt : *_memtables) {
+        readers.emplace_back(mt->make_reader(range));
+        if (single_partition) {
+            cache_row_limit += mt->max_shadowed_rows(range.start()->value().as_decorated_key());
+        }
+    }
+    cache_row_limit = std::min(cache_row_limit, uint64_t(query::max_rows));
+    auto hits = _cache.stats().hits;
+    readers.emplace_back(_cache.make_reader(range, slice, cache_row_limit, now));
+    if (single_partition) {
+        tracing::trace(trace_state, _cache.stats().hits != hits ? "Partition found in cache" : "Partition missing from cache");
+    }
+
+    return make_combined_reader(std::move(readers));
+}
+
 template <typename Func>
 future<bool>
 column_family::for_all_partitions(Func&& func) const {
@@ -320,56 +742,69 @@ column_family::for_all_partitions_slow(std::function<bool (const dht::decorated_
     return for_all_partitions(std::move(func));
 }
 
-class lister {
-    file _f;
-    std::function<future<> (directory_entry de)> _walker;
-    directory_entry_type _expected_type;
-    subscription<directory_entry> _listing;
-    sstring _dirname;
+// Loads of sstables from disk at once on each shard, over all tables.
+static constexpr size_t max_concurrent_sstable_loads = 16;
+static thread_local semaphore sstable_load_concurrency(max_concurrent_sstable_loads);
 
-public:
-    lister(file f, directory_entry_type type, std::function<future<> (directory_entry)> walker, sstring dirname)
-            : _f(std::move(f))
-            , _walker(std::move(walker))
-            , _expected_type(type)
-            , _listing(_f.list_directory([this] (directory_entry de) { return _visit(de); }))
-            , _dirname(dirname) {
-    }
-
-    static future<> scan_dir(sstring name, directory_entry_type type, std::function<future<> (directory_entry)> walker);
-protected:
-    future<> _visit(directory_entry de) {
+// The first and last of the shards owning partitions of the sstable, which
+// needs only its summary loaded. Shards own contiguous ranges of tokens, so
+// all those in between own some too.
+static std::pair<unsigned, unsigned> owning_shards(const schema& s, const sstables::sstable& sst) {
+    auto key_shard = [&s] (const partition_key& pk) {
+        auto token = dht::global_partitioner().get_token(s, pk);
+        return dht::shard_of(token);
+    };
+    return { key_shard(sst.get_first_partition_key(s)), key_shard(sst.get_last_partition_key(s)) };
+}
 
-        return guarantee_type(std::move(de)).then([this] (directory_entry de) {
-            // Hide all synthetic directories and hidden files.
-            if ((de.type != _expected_type) || (de.name[0] == '.')) {
-                return make_ready_future<>();
-            }
-            return _walker(de);
-        });
+// Whether the partitions of the sstable, which needs only its summary
+// loaded, include some of the current shard.
+static bool belongs_to_current_shard(const schema& s, const sstables::sstable& sst) {
+    auto shards = owning_shards(s, sst);
+    auto me = engine().cpu_id();
+    return (shards.first <= me) && (me <= shards.second);
+}
 
-    }
-    future<> done() { return _listing.done(); }
-private:
-    future<directory_entry> guarantee_type(directory_entry de) {
-        if (de.type) {
-            return make_ready_future<directory_entry>(std::move(de));
-        } else {
-            auto f = engine().file_type(_dirname + "/" + de.name);
-            return f.then([de = std::move(de)] (std::experimental::optional<directory_entry_type> t) mutable {
-                de.type = t;
-                return make_ready_future<directory_entry>(std::move(de));
-            });
+// Of an sstable every shard found, with only its summary loaded, whether
+// this shard keeps it. An sstable of a single shard, as those written under
+// the current shard count, is kept and deleted by that shard alone. One
+// spanning several, as after the shard count changed, is kept by each of
+// them until resharded, and deleted once every shard agreed to, which those
+// that don't keep it do at once.
+static bool claim_sstable(const schema& s, sstables::sstable& sst) {
+    auto shards = owning_shards(s, sst);
+    auto me = engine().cpu_id();
+    if (shards.first == shards.second) {
+        if (shards.first != me) {
+            return false;
         }
+        sst.set_unshared();
+        return true;
     }
-};
-
-
-future<> lister::scan_dir(sstring name, directory_entry_type type, std::function<future<> (directory_entry)> walker) {
-
-    return engine().open_directory(name).then([type, walker = std::move(walker), name] (file f) {
-        auto l = make_lw_shared<lister>(std::move(f), type, walker, name);
-        return l->done().then([l] { });
+    if (me < shards.first || me > shards.second) {
+        dblog.info("sstable {} not relevant for this shard, ignoring", sst.get_filename());
+        sst.mark_for_deletion();
+        return false;
+    }
+    return true;
+}
+
+// Waits for all the futures, failing with the exception of the first which
+// failed, if any.
+static future<> wait_for_all(std::vector<future<>> futures) {
+    return when_all(futures.begin(), futures.end()).then([] (std::vector<future<>> results) {
+        std::exception_ptr ex;
+        for (auto&& f : results) {
+            if (f.failed()) {
+                auto e = f.get_exception();
+                if (!ex) {
+                    ex = std::move(e);
+                }
+            }
+        }
+        if (ex) {
+            std::rethrow_exception(std::move(ex));
+        }
     });
 }
 
@@ -396,11 +831,22 @@ future<sstables::entry_descriptor> column_family::probe_file(sstring sstdir, sst
     _sstable_generation = std::max<uint64_t>(_sstable_generation, comps.generation /  smp::count + 1);
     assert(_sstables->count(comps.generation) == 0);
 
-    auto sst = std::make_unique<sstables::sstable>(_schema->ks_name(), _schema->cf_name(), sstdir, comps.generation, comps.version, comps.format);
-    auto fut = sst->load();
-    return std::move(fut).then([this, sst = std::move(sst)] () mutable {
-        add_sstable(std::move(*sst));
-        return make_ready_future<>();
+    auto sst = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(), sstdir, comps.generation, comps.version, comps.format);
+    return sstable_load_concurrency.wait().then([this, sst] {
+        return sst->load_summary().then([this, sst] {
+            if (!claim_sstable(*_schema, *sst)) {
+                return make_ready_future<bool>(false);
+            }
+            return sst->load_components().then([] {
+                return true;
+            });
+        }).finally([] {
+            sstable_load_concurrency.signal();
+        });
+    }).then([this, sst] (bool claimed) {
+        if (claimed) {
+            add_sstable(sst);
+        }
     }).then_wrapped([fname, comps = std::move(comps)] (future<> f) {
         try {
             f.get();
@@ -426,19 +872,16 @@ void column_family::add_sstable(sstables::sstable&& sstable) {
 }
 
 void column_family::add_sstable(lw_shared_ptr<sstables::sstable> sstable) {
-    auto key_shard = [this] (const partition_key& pk) {
-        auto token = dht::global_partitioner().get_token(*_schema, pk);
-        return dht::shard_of(token);
-    };
-    auto s1 = key_shard(sstable->get_first_partition_key(*_schema));
-    auto s2 = key_shard(sstable->get_last_partition_key(*_schema));
-    auto me = engine().cpu_id();
-    auto included = (s1 <= me) && (me <= s2);
-    if (!included) {
+    if (!belongs_to_current_shard(*_schema, *sstable)) {
         dblog.info("sstable {} not relevant for this shard, ignoring", sstable->get_filename());
         sstable->mark_for_deletion();
         return;
     }
+    // Until a compaction trains a new one, keep compressing with the
+    // dictionary of the sstables found on disk.
+    if (_compression_dictionary.empty()) {
+        _compression_dictionary = bytes(sstable->get_compression_dictionary());
+    }
     auto generation = sstable->generation();
     // allow in-progress reads to continue using old list
     _sstables = make_lw_shared<sstable_list>(*_sstables);
@@ -483,11 +926,17 @@ column_family::seal_active_memtable() {
     );
     _highest_flushed_rp = old->replay_position();
 
-    return _flush_queue->run_with_ordered_post_op(old->replay_position(), [old, this] {
+    auto flush = [this, old] {
         return repeat([this, old] {
             _flush_queue->check_open_gate();
             return try_flush_memtable_to_sstable(old);
         });
+    };
+    return _flush_queue->run_with_ordered_post_op(old->replay_position(), [old, this, flush = std::move(flush)] {
+        if (!_config.memtable_flush_scheduler) {
+            return flush();
+        }
+        return _config.memtable_flush_scheduler->schedule(old->occupancy().used_space(), old->replay_position(), std::move(flush));
     }, [old, this] {
         if (_commitlog) {
             _commitlog->discard_completed_segments(_schema->id(), old->replay_position());
@@ -501,16 +950,20 @@ future<stop_iteration>
 column_family::try_flush_memtable_to_sstable(lw_shared_ptr<memtable> old) {
     // FIXME: better way of ensuring we don't attempt to
     //        overwrite an existing table.
-    auto gen = _sstable_generation++ * smp::count + engine().cpu_id();
+    auto gen = calculate_generation_for_new_table();
+    auto dir = start_sstable_write();
 
     auto newtab = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(),
-        _config.datadir, gen,
+        dir, gen,
         sstables::sstable::version_types::ka,
         sstables::sstable::format_types::big);
 
     newtab->set_unshared();
+    newtab->set_compression_dictionary(_compression_dictionary);
     dblog.debug("Flushing to {}", newtab->get_filename());
-    return newtab->write_components(*old).then([this, newtab, old] {
+    return newtab->write_components(*old, memtable_flush_priority()).finally([this, dir] {
+        sstable_written(dir);
+    }).then([this, newtab, old] {
         return newtab->open_data().then([this, newtab] {
             // Note that due to our sharded architecture, it is possible that
             // in the face of a value change some shards will backup sstables
@@ -561,73 +1014,271 @@ void
 column_family::start() {
     // FIXME: add option to disable automatic compaction.
     start_compaction();
+    _index_manager.update();
 }
 
 future<>
 column_family::stop() {
+    _querier_expiry.cancel();
+    _queriers.clear();
+    _pending_writes_timer.cancel();
+    apply_pending_writes();
     seal_active_memtable();
-    return _compaction_manager.remove(this).then([this] {
+    return _index_manager.stop().then([this] {
+        return _compaction_manager.remove(this);
+    }).then([this] {
         return _flush_queue->close();
     });
 }
 
+void column_family::set_schema(schema_ptr s) {
+    _schema = std::move(s);
+    _index_manager.update();
+}
+
+void column_family::add_or_update_view(schema_ptr v) {
+    auto i = boost::find_if(_views, [&v] (const schema_ptr& x) { return x->id() == v->id(); });
+    if (i != _views.end()) {
+        *i = std::move(v);
+    } else {
+        _views.push_back(std::move(v));
+    }
+}
+
+void column_family::remove_view(const schema_ptr& v) {
+    _views.erase(std::remove_if(_views.begin(), _views.end(), [&v] (const schema_ptr& x) {
+        return x->id() == v->id();
+    }), _views.end());
+}
+
+sstables::shared_sstable column_family::make_compaction_output() {
+    auto gen = calculate_generation_for_new_table();
+    // FIXME: use "tmp" marker in names of incomplete sstable
+    auto sst = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(), start_sstable_write(), gen,
+            sstables::sstable::version_types::ka,
+            sstables::sstable::format_types::big);
+    sst->set_unshared();
+    return sst;
+}
+
 future<>
 column_family::compact_sstables(sstables::compaction_descriptor descriptor) {
+    return compact_sstables(std::move(descriptor), { query::full_partition_range });
+}
+
+future<>
+column_family::compact_sstables(sstables::compaction_descriptor descriptor, std::vector<query::partition_range> ranges) {
     if (!descriptor.sstables.size()) {
         // if there is nothing to compact, just return.
         return make_ready_future<>();
     }
 
     auto sstables_to_compact = make_lw_shared<std::vector<sstables::shared_sstable>>(std::move(descriptor.sstables));
+    auto ranges_to_compact = make_lw_shared<std::vector<query::partition_range>>(std::move(ranges));
 
     auto new_tables = make_lw_shared<std::vector<
             std::pair<unsigned, sstables::shared_sstable>>>();
     auto create_sstable = [this, new_tables] {
-            // FIXME: this generation calculation should be in a function.
-            auto gen = _sstable_generation++ * smp::count + engine().cpu_id();
-            // FIXME: use "tmp" marker in names of incomplete sstable
-            auto sst = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(), _config.datadir, gen,
-                    sstables::sstable::version_types::ka,
-                    sstables::sstable::format_types::big);
-            sst->set_unshared();
-            new_tables->emplace_back(gen, sst);
+            auto sst = make_compaction_output();
+            new_tables->emplace_back(sst->generation(), sst);
             return sst;
     };
-    return sstables::compact_sstables(*sstables_to_compact, *this,
-            create_sstable, descriptor.max_sstable_bytes, descriptor.level).then([this, new_tables, sstables_to_compact] {
-        // Build a new list of _sstables: We remove from the existing list the
-        // tables we compacted (by now, there might be more sstables flushed
-        // later), and we add the new tables generated by the compaction.
-        // We create a new list rather than modifying it in-place, so that
-        // on-going reads can continue to use the old list.
-        auto current_sstables = _sstables;
-        _sstables = make_lw_shared<sstable_list>();
-
-        // zeroing live_disk_space_used and live_sstable_count because the
-        // sstable list is re-created below.
-        _stats.live_disk_space_used = 0;
-        _stats.live_sstable_count = 0;
-
-        std::unordered_set<sstables::shared_sstable> s(
-                sstables_to_compact->begin(), sstables_to_compact->end());
-        for (const auto& oldtab : *current_sstables) {
-            if (!s.count(oldtab.second)) {
-                update_stats_for_new_sstable(oldtab.second->data_size());
-                _sstables->emplace(oldtab.first, oldtab.second);
-            }
+    // Input sstables are only replaced after every range is compacted,
+    // unless the full range is compacted at once. The compaction may then
+    // replace them piecemeal, as its new sstables are sealed.
+    auto replacer = [this, new_tables, sstables_to_compact] (std::vector<sstables::shared_sstable> sealed,
+            std::vector<sstables::shared_sstable> released) {
+        auto is_sealed = [&sealed] (const std::pair<unsigned, sstables::shared_sstable>& t) {
+            return std::find(sealed.begin(), sealed.end(), t.second) != sealed.end();
+        };
+        for (auto&& sst : sealed) {
+            sstable_written(sst->get_dir());
+        }
+        new_tables->erase(std::remove_if(new_tables->begin(), new_tables->end(), is_sealed), new_tables->end());
+        auto is_released = [&released] (const sstables::shared_sstable& sst) {
+            return std::find(released.begin(), released.end(), sst) != released.end();
+        };
+        sstables_to_compact->erase(std::remove_if(sstables_to_compact->begin(), sstables_to_compact->end(), is_released),
+                sstables_to_compact->end());
+        rebuild_sstable_list(sealed, released);
+    };
+    auto max_sstable_bytes = descriptor.max_sstable_bytes;
+    auto level = descriptor.level;
+    return parallel_for_each(*ranges_to_compact, [this, sstables_to_compact, create_sstable, max_sstable_bytes, level, replacer] (const query::partition_range& range) {
+        return sstables::compact_sstables(*sstables_to_compact, *this,
+                create_sstable, max_sstable_bytes, level, range, replacer);
+    }).finally([this, new_tables] {
+        for (auto&& t : *new_tables) {
+            sstable_written(t.second->get_dir());
         }
+    }).then([this, new_tables, sstables_to_compact, ranges_to_compact] {
+        // FIXME: rename the new sstable(s). Verify a rename doesn't cause
+        // problems for the sstable object.
+        auto new_sstables = boost::copy_range<std::vector<sstables::shared_sstable>>(*new_tables | boost::adaptors::map_values);
+        rebuild_sstable_list(new_sstables, *sstables_to_compact);
+    });
+}
 
-        for (const auto& newtab : *new_tables) {
-            // FIXME: rename the new sstable(s). Verify a rename doesn't cause
-            // problems for the sstable object.
-            update_stats_for_new_sstable(newtab.second->data_size());
-            _sstables->emplace(newtab.first, newtab.second);
+void
+column_family::rebuild_sstable_list(const std::vector<sstables::shared_sstable>& new_sstables,
+                                    const std::vector<sstables::shared_sstable>& sstables_to_remove) {
+    // Build a new list of _sstables: We remove from the existing list the
+    // tables we compacted (by now, there might be more sstables flushed
+    // later), and we add the new tables generated by the compaction.
+    // We create a new list rather than modifying it in-place, so that
+    // on-going reads can continue to use the old list.
+    auto current_sstables = _sstables;
+    _sstables = make_lw_shared<sstable_list>();
+
+    // zeroing live_disk_space_used and live_sstable_count because the
+    // sstable list is re-created below.
+    _stats.live_disk_space_used = 0;
+    _stats.live_sstable_count = 0;
+
+    std::unordered_set<sstables::shared_sstable> s(
+            sstables_to_remove.begin(), sstables_to_remove.end());
+    for (const auto& oldtab : *current_sstables) {
+        if (!s.count(oldtab.second)) {
+            update_stats_for_new_sstable(oldtab.second->data_size());
+            _sstables->emplace(oldtab.first, oldtab.second);
         }
+    }
+
+    for (const auto& newtab : new_sstables) {
+        update_stats_for_new_sstable(newtab->data_size());
+        _sstables->emplace(newtab->generation(), newtab);
+    }
 
-        for (const auto& oldtab : *sstables_to_compact) {
-            oldtab->mark_for_deletion();
+    for (const auto& oldtab : sstables_to_remove) {
+        oldtab->mark_for_deletion();
+    }
+}
+
+future<>
+column_family::drop_sstables(std::vector<sstables::shared_sstable> sstables) {
+    for (auto& sst : sstables) {
+        dblog.info("Dropping fully expired sstable {}", sst->get_filename());
+    }
+    rebuild_sstable_list({}, sstables);
+    return make_ready_future<>();
+}
+
+future<> column_family::cleanup_sstables(std::vector<query::range<dht::token>> owned_ranges) {
+    std::vector<query::range<dht::token>> ranges;
+    for (auto&& r : owned_ranges) {
+        if (r.is_wrap_around(dht::token_comparator())) {
+            auto unwrapped = r.unwrap();
+            ranges.push_back(std::move(unwrapped.first));
+            ranges.push_back(std::move(unwrapped.second));
+        } else {
+            ranges.push_back(std::move(r));
+        }
+    }
+    std::sort(ranges.begin(), ranges.end(), [] (const query::range<dht::token>& a, const query::range<dht::token>& b) {
+        if (!a.start()) {
+            return bool(b.start());
         }
+        return b.start() && a.start()->value() < b.start()->value();
     });
+    // Adjacent ranges, as of consecutive vnodes of this node, are merged, so
+    // that an sstable spanning several of them counts as inside.
+    std::vector<query::range<dht::token>> merged;
+    for (auto&& r : ranges) {
+        if (!merged.empty() && merged.back().end() && r.start()
+                && merged.back().end()->value() == r.start()->value()
+                && merged.back().end()->is_inclusive() != r.start()->is_inclusive()) {
+            merged.back() = query::range<dht::token>(merged.back().start(), r.end());
+        } else {
+            merged.push_back(std::move(r));
+        }
+    }
+
+    auto sstables = boost::copy_range<std::vector<sstables::shared_sstable>>(*_sstables | boost::adaptors::map_values);
+    return do_with(std::move(merged), std::move(sstables), [this] (auto& ranges, auto& sstables) {
+        return do_for_each(sstables, [this, &ranges] (const sstables::shared_sstable& sst) {
+            if (!_sstables->count(sst->generation())) {
+                // Compacted meanwhile.
+                return make_ready_future<>();
+            }
+            auto span = query::range<dht::token>::make(sst->get_first_decorated_key(*_schema)._token,
+                    sst->get_last_decorated_key(*_schema)._token);
+            std::vector<query::partition_range> overlapping;
+            for (auto&& r : ranges) {
+                if (r.contains(span, dht::token_comparator())) {
+                    return make_ready_future<>();
+                }
+                if (r.overlap(span, dht::token_comparator())) {
+                    overlapping.push_back(query::to_partition_range(r));
+                }
+            }
+            if (overlapping.empty()) {
+                dblog.info("Cleanup: dropping {}, which holds no owned partitions", sst->get_filename());
+                rebuild_sstable_list({}, { sst });
+                return make_ready_future<>();
+            }
+            dblog.info("Cleanup: rewriting {} without the partitions outside {} owned ranges", sst->get_filename(),
+                    overlapping.size());
+            auto new_tables = make_lw_shared<std::vector<sstables::shared_sstable>>();
+            auto create_sstable = [this, new_tables] {
+                auto sst = make_compaction_output();
+                new_tables->push_back(sst);
+                return sst;
+            };
+            return sstables::cleanup_sstable(sst, *this, std::move(create_sstable), std::move(overlapping)).finally([this, new_tables] {
+                for (auto&& t : *new_tables) {
+                    sstable_written(t->get_dir());
+                }
+            }).then([this, new_tables, sst] {
+                rebuild_sstable_list(*new_tables, { sst });
+            });
+        });
+    });
+}
+
+// Splits the token range spanned by sstables into at most n disjoint ranges,
+// which together cover the whole ring, by repeatedly bisecting it.
+static std::vector<query::partition_range>
+split_range_for_compaction(const schema& s, const std::vector<sstables::shared_sstable>& sstables, unsigned n) {
+    auto& partitioner = dht::global_partitioner();
+    auto first = sstables.front()->get_first_decorated_key(s)._token;
+    auto last = sstables.front()->get_last_decorated_key(s)._token;
+    for (auto&& sst : sstables) {
+        first = std::min(first, sst->get_first_decorated_key(s)._token);
+        last = std::max(last, sst->get_last_decorated_key(s)._token);
+    }
+
+    std::vector<dht::token> tokens = { first, last };
+    bool progress = true;
+    while (tokens.size() < n + 1 && progress) {
+        progress = false;
+        std::vector<dht::token> split;
+        split.reserve(std::min<size_t>(tokens.size() * 2, n + 1));
+        for (size_t i = 0; i < tokens.size(); i++) {
+            split.push_back(tokens[i]);
+            auto remaining = tokens.size() - i - 1;
+            if (remaining && split.size() + remaining < n + 1) {
+                auto mid = partitioner.midpoint(tokens[i], tokens[i + 1]);
+                if (tokens[i] < mid && mid < tokens[i + 1]) {
+                    split.push_back(std::move(mid));
+                    progress = true;
+                }
+            }
+        }
+        tokens = std::move(split);
+    }
+
+    // The first and last ranges are left open, so that the ranges cover
+    // every partition of the input sstables no matter how split points fall.
+    using bound = query::partition_range::bound;
+    std::vector<query::partition_range> ranges;
+    std::experimental::optional<bound> start;
+    for (size_t i = 1; i + 1 < tokens.size(); i++) {
+        auto end = bound(dht::ring_position::ending_at(tokens[i]), true);
+        ranges.emplace_back(start, end);
+        start = bound(dht::ring_position::ending_at(tokens[i]), false);
+    }
+    ranges.emplace_back(std::move(start), std::experimental::optional<bound>());
+    return ranges;
 }
 
 // FIXME: this is just an example, should be changed to something more general
@@ -641,7 +1292,14 @@ column_family::compact_all_sstables() {
     }
     // FIXME: check if the lower bound min_compaction_threshold() from schema
     // should be taken into account before proceeding with compaction.
-    return compact_sstables(sstables::compaction_descriptor(std::move(sstables)));
+    auto parallelism = _compaction_manager.major_compaction_parallelism();
+    auto descriptor = sstables::compaction_descriptor(std::move(sstables), 0, _compaction_manager.major_compaction_sstable_size());
+    if (parallelism <= 1 || descriptor.sstables.empty()) {
+        return compact_sstables(std::move(descriptor));
+    }
+    auto ranges = split_range_for_compaction(*_schema, descriptor.sstables, parallelism);
+    dblog.debug("Major compaction of {} split into {} ranges", *this, ranges.size());
+    return compact_sstables(std::move(descriptor), std::move(ranges));
 }
 
 void column_family::start_compaction() {
@@ -656,10 +1314,53 @@ void column_family::trigger_compaction() {
     }
 }
 
+// Each sstable shared with other shards is compacted alone, into sstables
+// of the partitions of this shard only, see sstables::compact_sstables().
+// Until it is replaced, it is read through a filter of the partitions of
+// this shard, so reads are correct meanwhile.
+future<> column_family::reshard_sstables() {
+    std::vector<sstables::shared_sstable> shared;
+    for (auto&& sst : *_sstables | boost::adaptors::map_values) {
+        if (sst->is_shared()) {
+            shared.push_back(sst);
+        }
+    }
+    return do_with(std::move(shared), [this] (std::vector<sstables::shared_sstable>& shared) {
+        return do_for_each(shared, [this] (const sstables::shared_sstable& sst) {
+            if (!_sstables->count(sst->generation())) {
+                // Compacted meanwhile.
+                return make_ready_future<>();
+            }
+            dblog.info("Resharding {}", sst->get_filename());
+            auto size = sst->data_size();
+            auto descriptor = sstables::compaction_descriptor({ sst }, sst->get_sstable_level(),
+                    std::numeric_limits<uint64_t>::max());
+            return compact_sstables(std::move(descriptor)).then([this, size] {
+                _stats.resharded_sstables++;
+                _stats.resharded_bytes += size;
+            });
+        });
+    });
+}
+
+std::pair<size_t, uint64_t> column_family::shared_sstables() const {
+    std::pair<size_t, uint64_t> shared;
+    for (auto&& sst : *_sstables | boost::adaptors::map_values) {
+        if (sst->is_shared()) {
+            shared.first++;
+            shared.second += sst->data_size();
+        }
+    }
+    return shared;
+}
+
 future<> column_family::run_compaction() {
     sstables::compaction_strategy strategy = _compaction_strategy;
     return do_with(std::move(strategy), [this] (sstables::compaction_strategy& cs) {
-        return cs.compact(*this).then([this] {
+        // Resharded first, so that the strategy doesn't pick them.
+        return reshard_sstables().then([this, &cs] {
+            return cs.compact(*this);
+        }).then([this] {
             _stats.pending_compactions--;
         });
     });
@@ -692,6 +1393,39 @@ int64_t column_family::get_unleveled_sstables() const {
     return 0;
 }
 
+sstring column_family::start_sstable_write() {
+    if (!_config.data_directories || _config.all_datadirs.size() < 2) {
+        return _config.datadir;
+    }
+    auto& dir = _config.data_directories->pick(_config.all_datadirs);
+    _config.data_directories->write_started(dir);
+    return dir;
+}
+
+void column_family::sstable_written(const sstring& dir) {
+    if (_config.data_directories && _config.all_datadirs.size() >= 2) {
+        _config.data_directories->write_finished(dir);
+    }
+}
+
+unsigned long column_family::calculate_generation_for_new_table() {
+    return _sstable_generation++ * smp::count + engine().cpu_id();
+}
+
+future<> column_family::add_streamed_sstable(unsigned long generation, sstables::sstable::version_types v,
+        sstables::sstable::format_types f) {
+    auto sst = make_lw_shared<sstables::sstable>(_schema->ks_name(), _schema->cf_name(), _config.datadir, generation, v, f);
+    return sst->load().then([this, sst] {
+        if (!claim_sstable(*_schema, *sst)) {
+            return;
+        }
+        add_sstable(sst);
+        // The cache covers the sstables, and may hold partitions of this one
+        // as they were before it came.
+        _cache.clear();
+    });
+}
+
 lw_shared_ptr<sstable_list> column_family::get_sstables() {
     return _sstables;
 }
@@ -715,10 +1449,13 @@ future<> column_family::populate(sstring sstdir) {
 
     auto verifier = make_lw_shared<std::unordered_map<unsigned long, status>>();
     auto descriptor = make_lw_shared<sstable_descriptor>();
+    auto probes = make_lw_shared<std::vector<future<>>>();
 
-    return lister::scan_dir(sstdir, directory_entry_type::regular, [this, sstdir, verifier, descriptor] (directory_entry de) {
+    return lister::scan_dir(sstdir, directory_entry_type::regular, [this, sstdir, verifier, descriptor, probes] (directory_entry de) {
         // FIXME: The secondary indexes are in this level, but with a directory type, (starting with ".")
-        return probe_file(sstdir, de.name).then([verifier, descriptor] (auto entry) {
+        // The listing goes on while the sstable loads, as many load at once
+        // as sstable_load_concurrency lets.
+        probes->push_back(probe_file(sstdir, de.name).then([verifier, descriptor] (auto entry) {
             if (verifier->count(entry.generation)) {
                 if (verifier->at(entry.generation) == status::has_toc_file) {
                     if (entry.component == sstables::sstable::component_type::TOC) {
@@ -748,7 +1485,10 @@ future<> column_family::populate(sstring sstdir) {
             if (!descriptor->format) {
                 descriptor->format = entry.format;
             }
-        });
+        }));
+        return make_ready_future<>();
+    }).then([probes] {
+        return wait_for_all(std::move(*probes));
     }).then([verifier, sstdir, descriptor, this] {
         return parallel_for_each(*verifier, [sstdir = std::move(sstdir), descriptor, this] (auto v) {
             if (v.second == status::has_temporary_toc_file) {
@@ -769,40 +1509,344 @@ future<> column_family::populate(sstring sstdir) {
             }
             return make_ready_future<>();
         });
+    }).then([this] {
+        // The indexes built before the sstables were loaded miss their rows.
+        _index_manager.rebuild();
+        auto shared = shared_sstables().first;
+        if (shared) {
+            dblog.info("{} sstables of {}.{} are shared with other shards, resharding them", shared,
+                    _schema->ks_name(), _schema->cf_name());
+            trigger_compaction();
+        }
     });
 }
 
+// The limit applies to the whole node, and each shard compacts independently.
+void database::set_compaction_throughput_mb_per_sec(uint32_t value) {
+    _compaction_manager.throttle().set_bytes_per_second((uint64_t(value) << 20) / smp::count);
+}
+
+uint32_t database::compaction_throughput_mb_per_sec() const {
+    return (_compaction_manager.throttle().bytes_per_second() * smp::count) >> 20;
+}
+
+void database::setup_compaction_throttle() {
+    auto& throttle = _compaction_manager.throttle();
+    set_compaction_throughput_mb_per_sec(_cfg->compaction_throughput_mb_per_sec());
+    throttle.set_read_latency_target(std::chrono::milliseconds(_cfg->compaction_adaptive_throttle_read_latency_ms()));
+    throttle.set_pending_reads_target(_cfg->compaction_adaptive_throttle_pending_reads());
+    throttle.set_load_source([this] {
+        compaction_throttle::foreground_load load;
+        for (auto&& cf : _column_families | boost::adaptors::map_values) {
+            auto& stats = cf->get_stats();
+            load.sampled_reads += stats.reads.total;
+            load.read_latency_sum += stats.reads.sum;
+            load.pending_reads += stats.pending_reads;
+        }
+        return load;
+    });
+    throttle.set_adaptive(_cfg->compaction_adaptive_throttle());
+}
+
+// Each data directory with a queue of its own, being on a disk of its own,
+// gets the depth and shares of the shard's queue.
+void database::setup_io_queue() {
+    auto setup = [this] (io_queue& queue) {
+        queue.set_max_outstanding(std::max(_cfg->max_io_requests() / smp::count, 1u));
+        queue.set_shares(query_priority(), _cfg->query_io_shares());
+        queue.set_shares(commitlog_priority(), _cfg->commitlog_io_shares());
+        queue.set_shares(memtable_flush_priority(), _cfg->memtable_flush_io_shares());
+        queue.set_shares(compaction_priority(), _cfg->compaction_io_shares());
+        queue.set_shares(streaming_priority(), _cfg->streaming_io_shares());
+    };
+    setup(local_io_queue());
+    for (auto&& d : directory_io_queues()) {
+        setup(*d.second);
+    }
+}
+
+void database::setup_cpu_scheduler() {
+    auto& scheduler = local_cpu_scheduler();
+    scheduler.set_shares(statement_group(), _cfg->statement_cpu_shares());
+    scheduler.set_shares(compaction_group(), _cfg->compaction_cpu_shares());
+    scheduler.set_shares(streaming_group(), _cfg->streaming_cpu_shares());
+    scheduler.set_shares(memtable_flush_group(), _cfg->memtable_flush_cpu_shares());
+    scheduler.set_shares(maintenance_group(), _cfg->maintenance_cpu_shares());
+}
+
+void database::setup_background_reclaim() {
+    _lsa_reclaim_reserve = (size_t(_cfg->lsa_reclaim_reserve_in_mb()) << 20) / smp::count;
+    _lsa_reclaim_budget = std::chrono::microseconds(_cfg->lsa_reclaim_step_budget_in_us());
+    if (_lsa_reclaim_reserve && _lsa_reclaim_budget.count()) {
+        _lsa_reclaim_timer.arm_periodic(std::chrono::milliseconds(std::max(_cfg->lsa_reclaim_period_in_ms(), 1u)));
+    }
+}
+
 utils::UUID database::empty_version = utils::UUID_gen::get_name_UUID(bytes{});
 
 database::database() : database(db::config())
 {}
 
+// Of the buffers of the readers of a shard.
+static size_t reader_memory_limit(const db::config& cfg) {
+    auto limit = size_t(cfg.reader_concurrency_memory_in_mb()) << 20;
+    return limit ? limit / smp::count : memory::stats().total_memory() / 50;
+}
+
 database::database(const db::config& cfg)
     : _cfg(std::make_unique<db::config>(cfg))
     , _version(empty_version)
+    , _read_concurrency_sem(_cfg->concurrent_reads(), reader_memory_limit(*_cfg), _cfg->max_queued_reads(),
+            std::chrono::milliseconds(_cfg->read_request_timeout_in_ms()))
 {
     _memtable_total_space = size_t(_cfg->memtable_total_space_in_mb()) << 20;
     if (!_memtable_total_space) {
         _memtable_total_space = memory::stats().total_memory() / 2;
     }
+    auto soft_threshold = _cfg->memtable_soft_throttle_threshold();
+    _memtable_soft_limit = soft_threshold > 0 && soft_threshold < 1 ? size_t(_memtable_total_space * soft_threshold) : _memtable_total_space;
     bool durable = cfg.data_file_directories().size() > 0;
     db::system_keyspace::make(*this, durable, _cfg->volatile_system_keyspace_for_testing());
     // Start compaction manager with two tasks for handling compaction jobs.
     _compaction_manager.start(2);
+    _compaction_manager.set_major_compaction_parallelism(_cfg->major_compaction_parallelism());
+    _compaction_manager.set_major_compaction_sstable_size(uint64_t(_cfg->major_compaction_sstable_size_in_mb()) << 20);
+    setup_compaction_throttle();
+    _tombstone_thresholds.warn = _cfg->tombstone_warn_threshold();
+    _tombstone_thresholds.failure = _cfg->tombstone_failure_threshold();
+    _flush_scheduler.set_max_concurrent(_cfg->memtable_flush_writers());
+    _flush_scheduler.set_pressure_source([this] {
+        return !_throttled_requests.empty();
+    });
+    sstables::global_key_cache().set_capacity((size_t(_cfg->key_cache_size_in_mb()) << 20) / smp::count);
+    sstables::global_index_page_cache().set_capacity((size_t(_cfg->index_page_cache_size_in_mb()) << 20) / smp::count);
+    auto& read_ahead = sstables::default_read_ahead_options();
+    read_ahead.max_depth = std::max(_cfg->sstable_read_ahead_depth(), 1u);
+    read_ahead.buffer_size = std::max(size_t(_cfg->sstable_read_ahead_buffer_size_in_kb()) << 10, size_t(4096));
+    auto& write_options = sstables::default_write_options();
+    write_options.column_index_size = size_t(_cfg->column_index_size_in_kb()) << 10;
+    write_options.flush_buffer_size = std::max(size_t(_cfg->memtable_flush_buffer_size_in_kb()) << 10, size_t(4096));
+    auto& load_options = sstables::default_load_options();
+    load_options.map_filter = _cfg->sstable_map_filters_and_summaries();
+    load_options.map_summary = _cfg->sstable_map_filters_and_summaries();
+    for (auto&& dir : _cfg->data_file_directories()) {
+        _data_directories.add(dir);
+    }
+    setup_io_queue();
+    setup_cpu_scheduler();
+    setup_background_reclaim();
     setup_collectd();
 
-    dblog.info("Row: max_vector_size: {}, internal_count: {}", size_t(row::max_vector_size), size_t(row::internal_count));
-}
+    dblog.info("Row: max_vector_size: {}, internal_count: {}", size_t(row::max_vector_size), size_t(row::internal_count));
+}
+
+// The path, its slashes replaced, for the name of the metrics of a directory.
+static sstring metric_prefix_of(const sstring& path) {
+    sstring prefix = path;
+    std::replace(prefix.begin(), prefix.end(), '/', '_');
+    return prefix + ".";
+}
+
+void
+database::setup_collectd() {
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "dirty")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+            return _dirty_memory_region_group.memory_used();
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "soft_throttled_writes")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _throttle_stats.soft_throttled)));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "blocked_writes")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _throttle_stats.hard_throttled)));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+                , scollectd::per_cpu_plugin_instance
+                , "total_time_in_ms", "write_throttle")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, [this] {
+            return _throttle_stats.throttle_time_ns / 1000000;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memtable"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "pending_flushes")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+            return _flush_scheduler.get_stats().queued;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("memtable"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "running_flushes")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+            return _flush_scheduler.get_stats().running;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "active_reads")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+            return _read_concurrency_sem.get_stats().active;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", "queued_reads")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+            return _read_concurrency_sem.get_stats().queued;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "reader_memory")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+            return _read_concurrency_sem.get_stats().memory;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "rejected_reads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, [this] {
+            return _read_concurrency_sem.get_stats().rejected + _read_concurrency_sem.get_stats().timed_out;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "filtered_rows")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, [this] {
+            int64_t filtered = 0;
+            for (auto&& cf : _column_families) {
+                filtered += cf.second->get_stats().filtered_rows;
+            }
+            return filtered;
+    })));
+
+    _collectd.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id("database"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "abandoned_reads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, [this] {
+            int64_t abandoned = 0;
+            for (auto&& cf : _column_families) {
+                abandoned += cf.second->get_stats().abandoned_reads;
+            }
+            return abandoned;
+    })));
 
-void
-database::setup_collectd() {
     _collectd.push_back(
-        scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+        scollectd::add_polled_metric(scollectd::type_instance_id("memtable"
                 , scollectd::per_cpu_plugin_instance
-                , "bytes", "dirty")
-                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
-            return _dirty_memory_region_group.memory_used();
+                , "total_bytes", "flushed")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, [this] {
+            return _flush_scheduler.get_stats().bytes_flushed;
     })));
+
+    // Of the shard's queue, and of the queue of each data directory with one
+    // of its own, its metrics prefixed by the directory.
+    std::vector<std::pair<sstring, io_queue*>> queues = { { "", &local_io_queue() } };
+    for (auto&& d : directory_io_queues()) {
+        queues.emplace_back(metric_prefix_of(d.first), d.second);
+    }
+    for (auto&& q : queues) {
+        auto& queue = *q.second;
+        auto prefix = q.first;
+        _collectd.push_back(
+            scollectd::add_polled_metric(scollectd::type_instance_id("io_queue"
+                    , scollectd::per_cpu_plugin_instance
+                    , "queue_length", prefix + "outstanding")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE, [&queue] {
+                return queue.outstanding();
+        })));
+
+        // Per I/O priority class.
+        for (auto pc : queue.priority_classes()) {
+            auto add = [this, &queue, prefix, pc] (sstring type, sstring metric, scollectd::data_type dt, std::function<int64_t (const io_queue::class_stats&)> f) {
+                _collectd.push_back(
+                    scollectd::add_polled_metric(scollectd::type_instance_id("io_queue"
+                            , scollectd::per_cpu_plugin_instance
+                            , type, prefix + queue.name(pc) + "." + metric)
+                            , scollectd::make_typed(dt, [&queue, pc, f = std::move(f)] {
+                        return f(queue.get_stats(pc));
+                })));
+            };
+            add("total_operations", "requests", scollectd::data_type::DERIVE, [] (const io_queue::class_stats& s) {
+                return s.requests;
+            });
+            add("total_bytes", "bytes", scollectd::data_type::DERIVE, [] (const io_queue::class_stats& s) {
+                return s.bytes;
+            });
+            add("queue_length", "queued", scollectd::data_type::GAUGE, [] (const io_queue::class_stats& s) {
+                return s.queued;
+            });
+            add("total_time_in_ms", "queue_time", scollectd::data_type::DERIVE, [] (const io_queue::class_stats& s) {
+                return s.queue_time_ns / 1000000;
+            });
+        }
+    }
+
+    // Per data directory.
+    for (size_t i = 0; i < _data_directories.size(); ++i) {
+        auto add = [this, i] (sstring type, sstring metric, scollectd::data_type dt, std::function<int64_t (const db::data_directories::stats&)> f) {
+            _collectd.push_back(
+                scollectd::add_polled_metric(scollectd::type_instance_id("data_directory"
+                        , scollectd::per_cpu_plugin_instance
+                        , type, metric_prefix_of(_data_directories.path(i)) + metric)
+                        , scollectd::make_typed(dt, [this, i, f = std::move(f)] {
+                    return f(_data_directories.get_stats(i));
+            })));
+        };
+        add("bytes", "free_space", scollectd::data_type::GAUGE, [] (const db::data_directories::stats& s) {
+            return s.free_space;
+        });
+        add("bytes", "total_space", scollectd::data_type::GAUGE, [] (const db::data_directories::stats& s) {
+            return s.total_space;
+        });
+        add("queue_length", "pending_writes", scollectd::data_type::GAUGE, [] (const db::data_directories::stats& s) {
+            return s.pending_writes;
+        });
+        add("total_operations", "sstables_written", scollectd::data_type::DERIVE, [] (const db::data_directories::stats& s) {
+            return s.sstables_written;
+        });
+    }
+
+    // Per CPU scheduling group.
+    auto& scheduler = local_cpu_scheduler();
+    for (auto sg : scheduler.groups()) {
+        auto add = [this, &scheduler, sg] (sstring type, sstring metric, scollectd::data_type dt, std::function<int64_t (const cpu_scheduler::group_stats&)> f) {
+            _collectd.push_back(
+                scollectd::add_polled_metric(scollectd::type_instance_id("cpu_scheduler"
+                        , scollectd::per_cpu_plugin_instance
+                        , type, scheduler.name(sg) + "." + metric)
+                        , scollectd::make_typed(dt, [&scheduler, sg, f = std::move(f)] {
+                    return f(scheduler.get_stats(sg));
+            })));
+        };
+        add("total_time_in_ms", "runtime", scollectd::data_type::DERIVE, [] (const cpu_scheduler::group_stats& s) {
+            return s.runtime_ns / 1000000;
+        });
+        add("total_time_in_ms", "deferred", scollectd::data_type::DERIVE, [] (const cpu_scheduler::group_stats& s) {
+            return s.deferred_ns / 1000000;
+        });
+        add("total_operations", "slices", scollectd::data_type::DERIVE, [] (const cpu_scheduler::group_stats& s) {
+            return s.slices;
+        });
+    }
 }
 
 database::~database() {
@@ -823,7 +1867,10 @@ future<> database::populate_keyspace(sstring datadir, sstring ks_name) {
         dblog.warn("Skipping undefined keyspace: {}", ks_name);
     } else {
         dblog.info("Populating Keyspace {}", ks_name);
-        return lister::scan_dir(ksdir, directory_entry_type::directory, [this, ksdir, ks_name] (directory_entry de) {
+        auto start = std::chrono::steady_clock::now();
+        // The tables load at once, sharing sstable_load_concurrency.
+        auto populates = make_lw_shared<std::vector<future<>>>();
+        return lister::scan_dir(ksdir, directory_entry_type::directory, [this, ksdir, ks_name, populates] (directory_entry de) {
             auto comps = parse_fname(de.name);
             if (comps.size() < 2) {
                 dblog.error("Keyspace {}: Skipping malformed CF {} ", ksdir, de.name);
@@ -836,24 +1883,35 @@ future<> database::populate_keyspace(sstring datadir, sstring ks_name) {
             try {
                 auto& cf = find_column_family(ks_name, cfname);
                 dblog.info("Keyspace {}: Reading CF {} ", ksdir, cfname);
-                // FIXME: Increase parallelism.
-                return cf.populate(sstdir);
+                populates->push_back(cf.populate(sstdir));
             } catch (no_such_column_family&) {
                 dblog.warn("{}, CF {}: schema not loaded!", ksdir, comps[0]);
-                return make_ready_future<>();
             }
+            return make_ready_future<>();
+        }).then([populates] {
+            return wait_for_all(std::move(*populates));
+        }).then([ks_name, start] {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            dblog.info("Populated Keyspace {} in {} ms", ks_name, elapsed.count());
         });
     }
     return make_ready_future<>();
 }
 
 future<> database::populate(sstring datadir) {
-    return lister::scan_dir(datadir, directory_entry_type::directory, [this, datadir] (directory_entry de) {
+    auto start = std::chrono::steady_clock::now();
+    auto populates = make_lw_shared<std::vector<future<>>>();
+    return lister::scan_dir(datadir, directory_entry_type::directory, [this, datadir, populates] (directory_entry de) {
         auto& ks_name = de.name;
-        if (ks_name == "system") {
-            return make_ready_future<>();
+        if (ks_name != "system") {
+            populates->push_back(populate_keyspace(datadir, ks_name));
         }
-        return populate_keyspace(datadir, ks_name);
+        return make_ready_future<>();
+    }).then([populates] {
+        return wait_for_all(std::move(*populates));
+    }).then([start] {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        dblog.info("Loaded the sstables of all keyspaces in {} ms", elapsed.count());
     });
 }
 
@@ -915,7 +1973,6 @@ future<> database::parse_system_tables(distributed<service::storage_proxy>& prox
 
 future<>
 database::init_system_keyspace() {
-    // FIXME support multiple directories
     return touch_directory(_cfg->data_file_directories()[0] + "/" + db::system_keyspace::NAME).then([this] {
         return populate_keyspace(_cfg->data_file_directories()[0], db::system_keyspace::NAME).then([this]() {
             return init_commitlog();
@@ -925,9 +1982,21 @@ database::init_system_keyspace() {
 
 future<>
 database::load_sstables(distributed<service::storage_proxy>& proxy) {
-	return parse_system_tables(proxy).then([this] {
-		return populate(_cfg->data_file_directories()[0]);
-	});
+    return parse_system_tables(proxy).then([this] {
+        // The tables have no directory yet in data directories added since
+        // they were created.
+        return parallel_for_each(_column_families | boost::adaptors::map_values, [this] (const lw_shared_ptr<column_family>& cf) {
+            auto s = cf->schema();
+            if (s->ks_name() == db::system_keyspace::NAME) {
+                return make_ready_future<>();
+            }
+            return find_keyspace(s->ks_name()).make_directory_for_column_family(s->cf_name(), s->id());
+        });
+    }).then([this] {
+        return do_for_each(_cfg->data_file_directories(), [this] (const sstring& dir) {
+            return populate(dir);
+        });
+    });
 }
 
 future<>
@@ -957,11 +2026,11 @@ database::shard_of(const mutation& m) {
 
 unsigned
 database::shard_of(const frozen_mutation& m) {
-    // FIXME: This lookup wouldn't be necessary if we
-    // sent the partition key in legacy form or together
-    // with token.
+    if (m.carried_token()) {
+        return shard_of(*m.carried_token());
+    }
     schema_ptr schema = find_schema(m.column_family_id());
-    return shard_of(dht::global_partitioner().get_token(*schema, m.key(*schema)));
+    return shard_of(m.token(*schema));
 }
 
 void database::add_keyspace(sstring name, keyspace k) {
@@ -1001,6 +2070,20 @@ void database::add_column_family(schema_ptr schema, column_family::config cfg) {
     }
     ks->second.add_column_family(schema);
     cf->start();
+    // A view may be loaded before its base table, or after.
+    if (schema->is_view()) {
+        auto base = _column_families.find(schema->get_view_info().base_id);
+        if (base != _column_families.end()) {
+            base->second->add_or_update_view(schema);
+        }
+    } else {
+        for (auto&& e : _column_families) {
+            auto s = e.second->schema();
+            if (s->is_view() && s->get_view_info().base_id == uuid) {
+                cf->add_or_update_view(s);
+            }
+        }
+    }
     _column_families.emplace(uuid, std::move(cf));
     _ks_cf_to_uuid.emplace(std::move(kscf), uuid);
 }
@@ -1008,11 +2091,26 @@ void database::add_column_family(schema_ptr schema, column_family::config cfg) {
 future<> database::update_column_family(const sstring& ks_name, const sstring& cf_name) {
     auto& proxy = service::get_storage_proxy();
     auto old_cfm = find_schema(ks_name, cf_name);
-    return db::schema_tables::create_table_from_name(proxy, ks_name, cf_name).then([old_cfm] (auto&& new_cfm) {
+    return db::schema_tables::create_table_from_name(proxy, ks_name, cf_name).then([this, old_cfm] (auto&& new_cfm) {
         if (old_cfm->id() != new_cfm->id()) {
             return make_exception_future<>(exceptions::configuration_exception(sprint("Column family ID mismatch (found %s; expected %s)", new_cfm->id(), old_cfm->id())));
         }
-        return make_exception_future<>(std::runtime_error("update column family not implemented"));
+        // Changes to the indexes leave the data alone, so the column family
+        // can switch schemas in place. Others are not supported yet.
+        if (!equal_except_indexes(*old_cfm, *new_cfm)) {
+            return make_exception_future<>(std::runtime_error("update column family not implemented"));
+        }
+        auto& ksm = this->find_keyspace(new_cfm->ks_name()).metadata();
+        ksm->remove_column_family(old_cfm);
+        ksm->add_column_family(new_cfm);
+        this->find_column_family(new_cfm->id()).set_schema(new_cfm);
+        if (new_cfm->is_view()) {
+            auto base = _column_families.find(new_cfm->get_view_info().base_id);
+            if (base != _column_families.end()) {
+                base->second->add_or_update_view(new_cfm);
+            }
+        }
+        return make_ready_future<>();
     });
 }
 
@@ -1021,6 +2119,12 @@ future<> database::drop_column_family(db_clock::time_point dropped_at, const sst
     auto& ks = find_keyspace(ks_name);
     auto cf = _column_families.at(uuid);
     _column_families.erase(uuid);
+    if (cf->schema()->is_view()) {
+        auto base = _column_families.find(cf->schema()->get_view_info().base_id);
+        if (base != _column_families.end()) {
+            base->second->remove_view(cf->schema());
+        }
+    }
     ks.metadata()->remove_column_family(cf->schema());
     _ks_cf_to_uuid.erase(std::make_pair(ks_name, cf_name));
     return truncate(dropped_at, ks, *cf).then([this, cf] {
@@ -1130,28 +2234,41 @@ keyspace::set_replication_strategy(std::unique_ptr<locator::abstract_replication
 column_family::config
 keyspace::make_column_family_config(const schema& s) const {
     column_family::config cfg;
-    cfg.datadir = column_family_directory(s.cf_name(), s.id());
+    cfg.datadir = column_family_directory(_config.datadir, s.cf_name(), s.id());
+    for (auto&& dir : _config.all_datadirs) {
+        cfg.all_datadirs.push_back(column_family_directory(dir, s.cf_name(), s.id()));
+    }
+    cfg.data_directories = _config.data_directories;
     cfg.enable_disk_reads = _config.enable_disk_reads;
     cfg.enable_disk_writes = _config.enable_disk_writes;
     cfg.enable_commitlog = _config.enable_commitlog;
     cfg.enable_cache = _config.enable_cache;
     cfg.max_memtable_size = _config.max_memtable_size;
     cfg.dirty_memory_region_group = _config.dirty_memory_region_group;
+    cfg.memtable_flush_scheduler = _config.memtable_flush_scheduler;
     cfg.enable_incremental_backups = _config.enable_incremental_backups;
+    cfg.paged_reader_ttl = _config.paged_reader_ttl;
+    cfg.tombstone_limits = _config.tombstone_limits;
+    cfg.read_concurrency_sem = _config.read_concurrency_sem;
 
     return cfg;
 }
 
 sstring
-keyspace::column_family_directory(const sstring& name, utils::UUID uuid) const {
+keyspace::column_family_directory(const sstring& datadir, const sstring& name, utils::UUID uuid) const {
     auto uuid_sstring = uuid.to_sstring();
     boost::erase_all(uuid_sstring, "-");
-    return sprint("%s/%s-%s", _config.datadir, name, uuid_sstring);
+    return sprint("%s/%s-%s", datadir, name, uuid_sstring);
 }
 
 future<>
 keyspace::make_directory_for_column_family(const sstring& name, utils::UUID uuid) {
-    return touch_directory(column_family_directory(name, uuid));
+    if (_config.all_datadirs.empty()) {
+        return touch_directory(column_family_directory(_config.datadir, name, uuid));
+    }
+    return parallel_for_each(_config.all_datadirs, [this, name, uuid] (const sstring& dir) {
+        return touch_directory(column_family_directory(dir, name, uuid));
+    });
 }
 
 no_such_keyspace::no_such_keyspace(const sstring& ks_name)
@@ -1169,6 +2286,16 @@ no_such_column_family::no_such_column_family(const sstring& ks_name, const sstri
 {
 }
 
+tombstone_overwhelming_exception::tombstone_overwhelming_exception(const schema& s, uint64_t tombstones)
+    : runtime_error{sprint("Query of %s.%s aborted after reading %d tombstones", s.ks_name(), s.cf_name(), tombstones)}
+{
+}
+
+read_deadline_exceeded_exception::read_deadline_exceeded_exception(const schema& s)
+    : runtime_error{sprint("Query of %s.%s abandoned past its deadline", s.ks_name(), s.cf_name())}
+{
+}
+
 column_family& database::find_column_family(const schema_ptr& schema) throw (no_such_column_family) {
     return find_column_family(schema->id());
 }
@@ -1215,9 +2342,13 @@ database::create_keyspace(const lw_shared_ptr<keyspace_metadata>& ksm) {
     }
 
     create_in_memory_keyspace(ksm);
-    auto& datadir = _keyspaces.at(ksm->name()).datadir();
-    if (datadir != "") {
-        return touch_directory(datadir);
+    auto& ks = _keyspaces.at(ksm->name());
+    if (ks.datadir() != "") {
+        return touch_directory(ks.datadir()).then([&ks] {
+            return parallel_for_each(ks.all_datadirs(), [] (const sstring& dir) {
+                return touch_directory(dir);
+            });
+        });
     } else {
         return make_ready_future<>();
     }
@@ -1277,60 +2408,447 @@ compare_atomic_cell_for_merge(atomic_cell_view left, atomic_cell_view right) {
     return 0;
 }
 
+// The reader of a query over one of its ranges. The reader a page of a
+// paged query stopped at is kept for the next page to continue it, so the
+// querier of a paged query owns what its reader refers to.
+class querier {
+    std::experimental::optional<query::partition_slice> _own_slice;
+    std::experimental::optional<query::partition_range> _own_range;
+    const query::partition_range* _range;
+public:
+    mutation_reader reader;
+    // The partition the page stopped within, with rows left to return.
+    mutation_opt partition;
+    // The last partition the page returned, and the row it ended with.
+    std::experimental::optional<dht::decorated_key> last_key;
+    std::experimental::optional<clustering_key> last_row;
+    lowres_clock::time_point expiry;
+public:
+    querier(const column_family& cf, const query::read_command& cmd, const query::partition_range& range,
+            tracing::trace_state_ptr trace_state = nullptr) {
+        const query::partition_slice* slice = &cmd.slice;
+        _range = &range;
+        if (cmd.is_paged()) {
+            _own_slice = cmd.slice;
+            _own_range = range;
+            slice = &*_own_slice;
+            _range = &*_own_range;
+        }
+        // The partition a page stops within is what the next one continues
+        // from, so a paged query reads partitions whole rather than just
+        // the rows the page can take from them.
+        // Nor can the rows a filtering query leaves out count towards it.
+        auto whole = cmd.is_paged() || !cmd.slice.filters.empty();
+        reader = cf.make_reader(*_range, *slice, whole ? query::max_rows : cmd.row_limit, cmd.timestamp, std::move(trace_state));
+    }
+
+    // Whether range starts where the page stopped, and ends where the
+    // reader would have gone on to.
+    bool continued_by(const schema& s, const query::read_command& cmd, const query::partition_range& range) const {
+        if (!last_key || !range.start() || !range.start()->value().equal(s, dht::ring_position(*last_key))) {
+            return false;
+        }
+        auto&& end = range.end();
+        auto&& our_end = _range->end();
+        if (bool(end) != bool(our_end)
+                || (end && (end->is_inclusive() != our_end->is_inclusive() || !end->value().equal(s, our_end->value())))) {
+            return false;
+        }
+        if (cmd.resume_after) {
+            return last_row && cmd.resume_after->key.equal(s, last_key->_key) && cmd.resume_after->row.equal(s, *last_row);
+        }
+        return true;
+    }
+};
+
 struct query_state {
-    explicit query_state(const query::read_command& cmd, const std::vector<query::partition_range>& ranges)
+    explicit query_state(const query::read_command& cmd, const query::partition_range* ranges_begin, const query::partition_range* ranges_end,
+            const tombstone_thresholds* limits = nullptr)
             : cmd(cmd)
-            , builder(cmd.slice)
+            , builder(cmd.slice, cmd.max_result_size)
             , limit(cmd.row_limit)
-            , current_partition_range(ranges.begin())
-            , range_end(ranges.end()){
+            , current_partition_range(ranges_begin)
+            , range_end(ranges_end)
+            , limits(limits)
+            , trace_state(tracing::make_replica_trace_state(cmd.trace_session)) {
     }
     const query::read_command& cmd;
     query::result::builder builder;
     uint32_t limit;
     bool range_empty = false;   // Avoid ubsan false-positive when moving after construction
-    std::vector<query::partition_range>::const_iterator current_partition_range;
-    std::vector<query::partition_range>::const_iterator range_end;
-    mutation_reader reader;
+    const query::partition_range* current_partition_range;
+    const query::partition_range* range_end;
+    // Reads the range before current_partition_range.
+    std::unique_ptr<querier> q;
+    // Live rows read but left out by the filters of the slice.
+    uint64_t filtered_rows = 0;
+    // Dead rows and range tombstones read.
+    uint64_t tombstones = 0;
+    // Partitions a keys-only query read, as their keys alone didn't tell
+    // whether they are live.
+    uint64_t keys_read = 0;
+    const tombstone_thresholds* limits;
+    tracing::trace_state_ptr trace_state;
+    bool page_ended() const {
+        return !limit || builder.is_full();
+    }
     bool done() const {
-        return !limit || current_partition_range == range_end;
+        return page_ended() || (current_partition_range == range_end && !q);
     }
 };
 
-future<lw_shared_ptr<query::result>>
-column_family::query(const query::read_command& cmd, const std::vector<query::partition_range>& partition_ranges) {
-    utils::latency_counter lc;
-    _stats.reads.set_latency(lc);
-    return do_with(query_state(cmd, partition_ranges), [this] (query_state& qs) {
-        return do_until(std::bind(&query_state::done, &qs), [this, &qs] {
-            auto&& range = *qs.current_partition_range++;
-            qs.reader = make_reader(range);
-            qs.range_empty = false;
-            return do_until([&qs] { return !qs.limit || qs.range_empty; }, [this, &qs] {
-                return qs.reader().then([this, &qs](mutation_opt mo) {
-                    if (mo) {
-                        auto p_builder = qs.builder.add_partition(mo->key());
-                        auto is_distinct = qs.cmd.slice.options.contains(query::partition_slice::option::distinct);
-                        auto limit = !is_distinct ? qs.limit : 1;
-                        mo->partition().query(p_builder, *_schema, qs.cmd.timestamp, limit);
-                        qs.limit -= p_builder.row_count();
-                    } else {
-                        qs.range_empty = true;
+void column_family::save_querier(const utils::UUID& query_uuid, std::unique_ptr<querier> q) {
+    if (_queriers.size() >= max_queriers && !_queriers.count(query_uuid)) {
+        return;
+    }
+    q->expiry = lowres_clock::now() + _config.paged_reader_ttl;
+    if (!_querier_expiry.armed()) {
+        _querier_expiry.arm(q->expiry);
+    }
+    _queriers[query_uuid] = std::move(q);
+}
+
+std::unique_ptr<querier>
+column_family::take_querier(const query::read_command& cmd, const query::partition_range& range) {
+    auto i = _queriers.find(cmd.query_uuid);
+    if (i == _queriers.end()) {
+        ++_stats.paged_reader_misses;
+        return {};
+    }
+    auto q = std::move(i->second);
+    _queriers.erase(i);
+    if (!q->continued_by(*_schema, cmd, range)) {
+        ++_stats.paged_reader_misses;
+        return {};
+    }
+    ++_stats.paged_reader_hits;
+    return q;
+}
+
+// All readers are kept for the same time, so the timer only needs to be
+// armed for the oldest one.
+void column_family::expire_queriers() {
+    auto now = lowres_clock::now();
+    auto next = lowres_clock::time_point::max();
+    for (auto i = _queriers.begin(); i != _queriers.end();) {
+        if (i->second->expiry <= now) {
+            ++_stats.paged_readers_evicted;
+            i = _queriers.erase(i);
+        } else {
+            next = std::min(next, i->second->expiry);
+            ++i;
+        }
+    }
+    if (!_queriers.empty()) {
+        _querier_expiry.arm(next);
+    }
+}
+
+static void query_partition(const schema& s, query_state& qs, mutation&& m) {
+    auto is_distinct = qs.cmd.slice.options.contains(query::partition_slice::option::distinct);
+    const clustering_key* resume_after = nullptr;
+    if (qs.cmd.resume_after && !is_distinct && m.key().equal(s, qs.cmd.resume_after->key)) {
+        resume_after = &qs.cmd.resume_after->row;
+    }
+    auto p_builder = qs.builder.add_partition(m.key());
+    auto limit = !is_distinct ? qs.limit : 1;
+    m.partition().query(p_builder, s, qs.cmd.timestamp, limit, resume_after);
+    qs.limit -= p_builder.row_count();
+    qs.filtered_rows += p_builder.filtered_row_count();
+    qs.tombstones += p_builder.tombstone_count();
+    if (qs.limits && qs.tombstones > qs.limits->failure) {
+        throw tombstone_overwhelming_exception(s, qs.tombstones);
+    }
+    // The page ends with this partition.
+    if (qs.cmd.is_paged() && qs.page_ended() && qs.q) {
+        qs.q->last_key = m.decorated_key();
+        qs.q->last_row = {};
+        if (p_builder.last_row() && !is_distinct) {
+            qs.q->last_row = *p_builder.last_row();
+            qs.q->partition = std::move(m);
+        }
+    }
+}
+
+future<>
+column_family::query_by_index(query_state& qs) {
+    auto& restriction = *qs.cmd.index;
+    auto cd = _schema->get_column_definition(restriction.column);
+    if (!cd) {
+        return make_ready_future<>();
+    }
+    std::vector<query::partition_range> ranges(qs.current_partition_range, qs.range_end);
+    qs.current_partition_range = qs.range_end;
+    auto idx = _index_manager.find(restriction.column);
+    auto f = idx && idx->is_built()
+            ? idx->lookup(restriction.value, std::move(ranges), qs.cmd.timestamp)
+            : make_ready_future<std::vector<query::partition_range>>(std::move(ranges));
+    return f.then([this, &qs, id = cd->id] (std::vector<query::partition_range> ranges) {
+        return do_with(std::move(ranges), size_t(0), [this, &qs, id] (auto& ranges, size_t& i) {
+            return do_until([&qs, &ranges, &i] { return qs.page_ended() || i == ranges.size(); }, [this, &qs, &ranges, &i, id] {
+                auto& restriction = *qs.cmd.index;
+                auto reader = make_lw_shared(db::index::make_index_filtering_reader(make_reader(ranges[i++]), id,
+                        restriction.value, qs.cmd.timestamp));
+                return consume(*reader, [this, &qs] (mutation&& m) {
+                    sample_read(m.key());
+                    query_partition(*_schema, qs, std::move(m));
+                    return stop_iteration(qs.page_ended());
+                }).finally([reader] { });
+            });
+        });
+    });
+}
+
+// A DISTINCT query of the partition keys alone, without static columns or
+// filters, needs nothing of the data of partitions known to be live. They
+// are returned without rows, as partitions with nothing live but the static
+// row are, whatever their rows, so that the digests of replicas holding the
+// same partitions agree.
+static bool needs_keys_only(const query::read_command& cmd) {
+    auto& slice = cmd.slice;
+    return slice.options.contains(query::partition_slice::option::distinct)
+            && slice.static_columns.empty() && slice.regular_columns.empty() && slice.filters.empty()
+            && !cmd.index && !cmd.resume_after;
+}
+
+future<>
+column_family::query_keys(query_state& qs) {
+    auto add_key = [this, &qs] (const dht::decorated_key& key) {
+        sample_read(key.key());
+        auto p_builder = qs.builder.add_partition(key.key());
+        p_builder.finish();
+        qs.limit -= p_builder.row_count();
+    };
+    return do_until([&qs] { return qs.page_ended() || qs.current_partition_range == qs.range_end; }, [this, &qs, add_key] {
+        auto reader = make_lw_shared(make_key_reader(*qs.current_partition_range++));
+        return repeat([this, &qs, add_key, reader] {
+            if (qs.cmd.is_expired()) {
+                ++_stats.abandoned_reads;
+                return make_exception_future<stop_iteration>(read_deadline_exceeded_exception(*_schema));
+            }
+            return (*reader)().then([this, &qs, add_key] (partition_key_entry_opt e) {
+                if (!e) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                if (!e->maybe_dead) {
+                    add_key(e->key);
+                    return make_ready_future<stop_iteration>(stop_iteration(qs.page_ended()));
+                }
+                ++qs.keys_read;
+                auto range = make_lw_shared(query::partition_range::make_singular(e->key));
+                auto partition = make_lw_shared(make_reader(*range));
+                return (*partition)().then([this, &qs, add_key] (mutation_opt mo) {
+                    if (mo && mo->partition().live_row_count(*_schema, qs.cmd.timestamp)) {
+                        add_key(mo->decorated_key());
                     }
-                });
+                    return stop_iteration(qs.page_ended());
+                }).finally([range, partition] { });
             });
-        }).then([&qs] {
+        }).finally([reader] { });
+    });
+}
+
+future<lw_shared_ptr<query::result>>
+column_family::query(const query::read_command& cmd, const std::vector<query::partition_range>& partition_ranges) {
+    return query(cmd, partition_ranges.data(), partition_ranges.data() + partition_ranges.size());
+}
+
+future<lw_shared_ptr<query::result>>
+column_family::query(const query::read_command& cmd, const query::partition_range& partition_range) {
+    return query(cmd, &partition_range, &partition_range + 1);
+}
+
+future<lw_shared_ptr<query::result>>
+column_family::do_query(query_state& qs) {
+    tracing::trace(qs.trace_state, "Reading %d ranges of %s.%s", qs.range_end - qs.current_partition_range,
+            _schema->ks_name(), _schema->cf_name());
+    if (qs.cmd.index) {
+        return query_by_index(qs).then([this, &qs] {
+            _stats.filtered_rows += qs.filtered_rows;
+            return make_ready_future<lw_shared_ptr<query::result>>(
+                    make_lw_shared<query::result>(qs.builder.build()));
+        });
+    }
+    if (needs_keys_only(qs.cmd)) {
+        return query_keys(qs).then([this, &qs] {
+            tracing::trace(qs.trace_state, "Read keys done%s, %d partitions read to tell whether they are live",
+                    qs.page_ended() ? ", page full" : "", qs.keys_read);
             return make_ready_future<lw_shared_ptr<query::result>>(
                     make_lw_shared<query::result>(qs.builder.build()));
         });
+    }
+    if (!qs.cmd.is_first_page && !qs.done()) {
+        qs.q = take_querier(qs.cmd, *qs.current_partition_range);
+        if (qs.q) {
+            tracing::trace(qs.trace_state, "Continuing the reader of the previous page");
+            ++qs.current_partition_range;
+            auto mo = std::move(qs.q->partition);
+            if (mo && qs.cmd.resume_after) {
+                query_partition(*_schema, qs, std::move(*mo));
+            }
+        }
+    }
+    return do_until(std::bind(&query_state::done, &qs), [this, &qs] {
+        if (!qs.q) {
+            qs.q = std::make_unique<querier>(*this, qs.cmd, *qs.current_partition_range++, qs.trace_state);
+        }
+        qs.range_empty = false;
+        return do_until([&qs] { return qs.page_ended() || qs.range_empty; }, [this, &qs] {
+            if (qs.cmd.is_expired()) {
+                ++_stats.abandoned_reads;
+                return make_exception_future<>(read_deadline_exceeded_exception(*_schema));
+            }
+            return qs.q->reader().then([this, &qs](mutation_opt mo) {
+                if (mo) {
+                    sample_read(mo->key());
+                    query_partition(*_schema, qs, std::move(*mo));
+                } else {
+                    qs.range_empty = true;
+                    qs.q = {};
+                }
+            });
+        });
+    }).then([this, &qs] {
+        if (qs.q && qs.cmd.is_paged() && _config.paged_reader_ttl.count()) {
+            save_querier(qs.cmd.query_uuid, std::move(qs.q));
+        }
+        tracing::trace(qs.trace_state, "Read done%s, %d rows left out by filters, %d tombstones read",
+                qs.page_ended() ? ", page full" : "", qs.filtered_rows, qs.tombstones);
+        _stats.filtered_rows += qs.filtered_rows;
+        return make_ready_future<lw_shared_ptr<query::result>>(
+                make_lw_shared<query::result>(qs.builder.build()));
+    });
+}
+
+size_t column_family::estimate_reader_memory(const query::partition_range* ranges_begin, const query::partition_range* ranges_end) const {
+    // The ranges are read one after the other, so the readers of the
+    // largest are all open at once. Reads of a single partition open
+    // readers only on the sstables which may have it.
+    size_t readers = 1;
+    for (auto r = ranges_begin; r != ranges_end; ++r) {
+        size_t n = 0;
+        if (r->is_singular() && r->start()->value().has_key()) {
+            auto& key = *r->start()->value().key();
+            for (auto&& sst : *_sstables | boost::adaptors::map_values) {
+                n += sst->filter_has_key(*_schema, key);
+            }
+        } else {
+            n = _sstables->size();
+        }
+        readers = std::max(readers, n);
+    }
+    return readers * sstables::default_read_ahead_options().buffer_size;
+}
+
+future<lw_shared_ptr<query::result>>
+column_family::query(const query::read_command& cmd, const query::partition_range* ranges_begin, const query::partition_range* ranges_end) {
+    if (cmd.is_expired()) {
+        ++_stats.abandoned_reads;
+        return make_exception_future<lw_shared_ptr<query::result>>(read_deadline_exceeded_exception(*_schema));
+    }
+    if (!_config.read_concurrency_sem) {
+        return run_query(cmd, ranges_begin, ranges_end);
+    }
+    utils::latency_counter lc;
+    lc.start();
+    auto memory = estimate_reader_memory(ranges_begin, ranges_end);
+    return _config.read_concurrency_sem->with_admission(memory, cmd.deadline, [this, &cmd, ranges_begin, ranges_end, lc] () mutable {
+        _stats.read_admission_waits.mark(lc);
+        return run_query(cmd, ranges_begin, ranges_end);
+    });
+}
+
+future<lw_shared_ptr<query::result>>
+column_family::run_query(const query::read_command& cmd, const query::partition_range* ranges_begin, const query::partition_range* ranges_end) {
+    utils::latency_counter lc;
+    lc.start();
+    _stats.pending_reads++;
+    return do_with(query_state(cmd, ranges_begin, ranges_end, _config.tombstone_limits), [this] (query_state& qs) {
+        // do_query() throws, rather than fails, when the partition the
+        // previous page stopped within already has too many tombstones.
+        return futurize<lw_shared_ptr<query::result>>::apply([this, &qs] {
+            return do_query(qs);
+        }).finally([this, &qs] {
+            _stats.tombstones_scanned.mark(qs.tombstones);
+            if (!qs.limits) {
+                return;
+            }
+            if (qs.tombstones > qs.limits->failure) {
+                ++_stats.tombstone_failures;
+                dblog.error("Query of {}.{} aborted after reading {} tombstones (see tombstone_failure_threshold)",
+                        _schema->ks_name(), _schema->cf_name(), qs.tombstones);
+            } else if (qs.tombstones > qs.limits->warn) {
+                dblog.warn("Read {} live rows and {} tombstones for a query of {}.{} (see tombstone_warn_threshold)",
+                        qs.cmd.row_limit - qs.limit, qs.tombstones, _schema->ks_name(), _schema->cf_name());
+            }
+        });
+    }).then([this] (lw_shared_ptr<query::result> result) {
+        auto size = result->buf().size();
+        _stats.read_bytes += size;
+        _stats.estimated_bytes_per_read.add(size);
+        return result;
     }).finally([lc, this]() mutable {
+        _stats.pending_reads--;
         _stats.reads.mark(lc);
+        _stats.read_latencies.mark(lc.latency_in_micro());
         if (lc.is_start()) {
             _stats.estimated_read.add(lc.latency_in_nano(), _stats.reads.count);
         }
     });
 }
 
+void
+column_family::start_top_partitions_sampling(size_t capacity) {
+    _top_partitions = std::make_unique<top_partitions_sampler>(capacity);
+}
+
+column_family::top_partitions
+column_family::stop_top_partitions_sampling(size_t list_size) {
+    top_partitions res;
+    if (!_top_partitions) {
+        return res;
+    }
+    auto sampler = std::move(_top_partitions);
+    auto to_top_partitions = [this, list_size] (const partition_counter& counter) {
+        std::vector<top_partition> list;
+        for (auto&& c : counter.top(list_size)) {
+            auto key = partition_key_view::from_bytes(c.key);
+            auto&& components = key.explode(*_schema);
+            auto column = _schema->partition_key_columns().begin();
+            sstring str;
+            for (auto&& component : components) {
+                if (!str.empty()) {
+                    str += ":";
+                }
+                str += column++->type->to_string(component);
+            }
+            list.push_back(top_partition{std::move(str), c.count, c.error});
+        }
+        return list;
+    };
+    res.reads = to_top_partitions(sampler->reads);
+    res.writes = to_top_partitions(sampler->writes);
+    return res;
+}
+
+std::experimental::optional<std::chrono::microseconds>
+column_family::speculative_retry_delay() const {
+    // Fewer reads than that make for a noisy high percentile.
+    static constexpr uint64_t min_samples = 100;
+    auto& retry = _schema->speculative_retry();
+    switch (retry.get_type()) {
+    case speculative_retry::type::CUSTOM:
+        return std::chrono::microseconds(int64_t(retry.get_value() * 1000));
+    case speculative_retry::type::PERCENTILE:
+        if (_stats.coordinator_reads.count() >= min_samples) {
+            return std::chrono::microseconds(_stats.coordinator_reads.percentile(retry.get_value()));
+        }
+        return {};
+    default:
+        return {};
+    }
+}
+
 mutation_source
 column_family::as_mutation_source() const {
     return [this] (const query::partition_range& range) {
@@ -1346,18 +2864,47 @@ database::query(const query::read_command& cmd, const std::vector<query::partiti
 
     try {
         column_family& cf = find_column_family(cmd.cf_id);
-        return cf.query(cmd, ranges);
+        auto fg = local_cpu_scheduler().start_foreground();
+        return cf.query(cmd, ranges).finally([fg = std::move(fg)] {});
     } catch (const no_such_column_family&) {
         // FIXME: load from sstables
         return make_empty();
     }
 }
 
+future<lw_shared_ptr<query::result>>
+database::query(const query::read_command& cmd, const query::partition_range& range) {
+    try {
+        column_family& cf = find_column_family(cmd.cf_id);
+        auto fg = local_cpu_scheduler().start_foreground();
+        return cf.query(cmd, range).finally([fg = std::move(fg)] {});
+    } catch (const no_such_column_family&) {
+        // FIXME: load from sstables
+        return make_ready_future<lw_shared_ptr<query::result>>(make_lw_shared(query::result()));
+    }
+}
+
 future<reconcilable_result>
 database::query_mutations(const query::read_command& cmd, const query::partition_range& range) {
     try {
         column_family& cf = find_column_family(cmd.cf_id);
-        return mutation_query(cf.as_mutation_source(), range, cmd.slice, cmd.row_limit, cmd.timestamp);
+        if (cmd.is_expired()) {
+            return make_exception_future<reconcilable_result>(read_deadline_exceeded_exception(*cf.schema()));
+        }
+        auto source = cf.as_mutation_source();
+        if (cmd.index) {
+            // Reconciles the rows the replicas found through their indexes.
+            auto cd = cf.schema()->get_column_definition(cmd.index->column);
+            if (!cd) {
+                return make_ready_future<reconcilable_result>(reconcilable_result());
+            }
+            source = [&cf, id = cd->id, value = cmd.index->value, now = cmd.timestamp] (const query::partition_range& range) {
+                return db::index::make_index_filtering_reader(cf.make_reader(range), id, value, now);
+            };
+        }
+        auto fg = local_cpu_scheduler().start_foreground();
+        return mutation_query(source, range, cmd.slice, cmd.row_limit, cmd.timestamp,
+                cmd.resume_after ? &*cmd.resume_after : nullptr).finally([fg = std::move(fg)] {});
     } catch (const no_such_column_family&) {
         // FIXME: load from sstables
         return make_ready_future<reconcilable_result>(reconcilable_result());
@@ -1393,8 +2940,8 @@ future<> database::apply_in_memory(const frozen_mutation& m, const db::replay_po
         auto& cf = find_column_family(m.column_family_id());
         cf.apply(m, rp);
     } catch (no_such_column_family&) {
-        // TODO: log a warning
-        // FIXME: load keyspace meta-data from storage
+        // The table was dropped; the caller counts the mutation as skipped.
+        return make_exception_future<>(std::current_exception());
     }
     return make_ready_future<>();
 }
@@ -1409,34 +2956,64 @@ future<> database::do_apply(const frozen_mutation& m) {
         bytes_view repr = m.representation();
         auto write_repr = [repr] (data_output& out) { out.write(repr.begin(), repr.end()); };
         return cf.commitlog()->add_mutation(uuid, repr.size(), write_repr).then([&m, this](auto rp) {
+            auto f = make_ready_future<>();
             try {
-                return this->apply_in_memory(m, rp);
-            } catch (replay_position_reordered_exception&) {
-                // expensive, but we're assuming this is super rare.
-                // if we failed to apply the mutation due to future re-ordering
-                // (which should be the ever only reason for rp mismatch in CF)
-                // let's just try again, add the mutation to the CL once more,
-                // and assume success in inevitable eventually.
-                dblog.debug("replay_position reordering detected");
-                return this->apply(m);
+                f = this->find_column_family(m.column_family_id()).apply_coalesced(m, rp);
+            } catch (no_such_column_family&) {
+                // TODO: log a warning
             }
+            return f.then_wrapped([&m, this] (future<> f) {
+                try {
+                    f.get();
+                    return make_ready_future<>();
+                } catch (replay_position_reordered_exception&) {
+                    // expensive, but we're assuming this is super rare.
+                    // if we failed to apply the mutation due to future re-ordering
+                    // (which should be the ever only reason for rp mismatch in CF)
+                    // let's just try again, add the mutation to the CL once more,
+                    // and assume success in inevitable eventually.
+                    dblog.debug("replay_position reordering detected");
+                    return this->do_apply(m);
+                }
+            });
         });
     }
-    return apply_in_memory(m, db::replay_position());
+    // Not durable: no replay position to track.
+    cf.apply(m);
+    return make_ready_future<>();
 }
 
+// Delay of the writes when dirty memory is just below the hard limit.
+static constexpr std::chrono::microseconds max_soft_throttle_delay = 10ms;
+
 future<> database::throttle() {
-    if (_dirty_memory_region_group.memory_used() < _memtable_total_space
-            && _throttled_requests.empty()) {
+    auto used = _dirty_memory_region_group.memory_used();
+    if (used < _memtable_soft_limit && _throttled_requests.empty()) {
         // All is well, go ahead
         return make_ready_future<>();
     }
+    if (used < _memtable_total_space && _throttled_requests.empty()) {
+        // Getting there: slow writers down, quadratically with how far into
+        // the soft limit we are, to give flushes a chance to catch up.
+        auto x = double(used - _memtable_soft_limit) / (_memtable_total_space - _memtable_soft_limit);
+        auto delay = std::chrono::microseconds(int64_t(max_soft_throttle_delay.count() * x * x));
+        if (delay.count() == 0) {
+            return make_ready_future<>();
+        }
+        ++_throttle_stats.soft_throttled;
+        _throttle_stats.throttle_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count();
+        return sleep(delay);
+    }
     // We must throttle, wait a bit
     if (_throttled_requests.empty()) {
         _throttling_timer.arm_periodic(10ms);
     }
+    ++_throttle_stats.hard_throttled;
     _throttled_requests.emplace_back();
-    return _throttled_requests.back().get_future();
+    auto start = std::chrono::steady_clock::now();
+    return _throttled_requests.back().get_future().then([this, start] {
+        _throttle_stats.throttle_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    });
 }
 
 void database::unthrottle() {
@@ -1456,18 +3033,125 @@ void database::unthrottle() {
     }
 }
 
+// The slice of the current partition an update needs to be read against: the
+// rows it writes to, or all of them when it deletes ranges of rows, with
+// either all the columns or only those it writes.
+static query::partition_slice make_update_slice(const mutation& m, bool written_columns_only) {
+    auto& s = *m.schema();
+    auto& p = m.partition();
+    std::vector<query::clustering_range> row_ranges;
+    if (p.partition_tombstone() || !p.row_tombstones().empty()) {
+        row_ranges.emplace_back(query::clustering_range::make_open_ended_both_sides());
+    } else {
+        for (auto&& e : p.clustered_rows()) {
+            row_ranges.emplace_back(query::clustering_range::make_singular(e.key()));
+        }
+    }
+    std::vector<column_id> static_columns;
+    std::vector<column_id> regular_columns;
+    if (written_columns_only) {
+        p.static_row().for_each_cell([&] (column_id id, const atomic_cell_or_collection&) {
+            static_columns.push_back(id);
+        });
+        std::set<column_id> written;
+        for (auto&& e : p.clustered_rows()) {
+            e.row().cells().for_each_cell([&] (column_id id, const atomic_cell_or_collection&) {
+                written.insert(id);
+            });
+        }
+        regular_columns.assign(written.begin(), written.end());
+    } else {
+        for (auto&& def : s.static_columns()) {
+            static_columns.push_back(def.id);
+        }
+        for (auto&& def : s.regular_columns()) {
+            regular_columns.push_back(def.id);
+        }
+    }
+    return query::partition_slice(std::move(row_ranges), std::move(static_columns), std::move(regular_columns),
+            query::partition_slice::option_set());
+}
+
+future<> database::apply_with_views(column_family& cf, const frozen_mutation& fm) {
+    auto m = make_lw_shared<mutation>(fm.unfreeze(cf.schema()));
+    if (!db::view::may_update_view(*m)) {
+        return do_apply(fm);
+    }
+    auto updates = make_lw_shared<std::vector<mutation>>();
+    // The partition is read and written under its lock, so that the view
+    // updates of concurrent writes to it are made from what each of them
+    // actually overwrote.
+    return cf.with_partition_lock(m->key(), [this, &cf, &fm, m, updates] {
+        return cf.find_partition(m->decorated_key(), make_update_slice(*m, false)).then([this, &cf, &fm, m, updates] (column_family::const_mutation_partition_ptr current) {
+            auto now = gc_clock::now();
+            for (auto&& view : cf.views()) {
+                auto u = db::view::make_view_updates(cf.schema(), view, *m, current.get(), now);
+                std::move(u.begin(), u.end(), std::back_inserter(*updates));
+            }
+            return do_apply(fm);
+        });
+    }).then([this, &cf, m, updates] {
+        if (updates->empty()) {
+            return make_ready_future<>();
+        }
+        if (!_view_update_sender) {
+            dblog.warn("Dropping {} view updates of {}.{}: no one sends them", updates->size(), cf.schema()->ks_name(), cf.schema()->cf_name());
+            return make_ready_future<>();
+        }
+        return _view_update_sender(cf.schema(), m->token(), std::move(*updates));
+    });
+}
+
 future<> database::apply(const frozen_mutation& m) {
     return throttle().then([this, &m] {
-        return do_apply(m);
+        auto fg = local_cpu_scheduler().start_foreground();
+        auto& cf = find_column_family(m.column_family_id());
+        auto f = cf.views().empty() ? do_apply(m) : apply_with_views(cf, m);
+        return f.finally([fg = std::move(fg)] {}).then([&m, s = cf.schema()] {
+            return cql3::result_cache::invalidate_on_all_shards(*s, m.token(*s));
+        });
+    });
+}
+
+future<> database::apply(const mutation& m) {
+    auto& cf = find_column_family(m.schema());
+    if (cf.commitlog() != nullptr || !cf.views().empty()) {
+        return do_with(freeze(m), [this] (const frozen_mutation& fm) {
+            return apply(fm);
+        });
+    }
+    return throttle().then([this, &m] {
+        find_column_family(m.schema()).apply(m);
+        return cql3::result_cache::invalidate_on_all_shards(*m.schema(), m.token());
+    });
+}
+
+future<mutation> database::apply_counter_update(const frozen_mutation& fm, utils::UUID counter_id) {
+    auto& cf = find_column_family(fm.column_family_id());
+    auto m = make_lw_shared<mutation>(fm.unfreeze(cf.schema()));
+    return cf.with_partition_lock(m->key(), [this, &cf, m, counter_id] {
+        return cf.find_partition(m->decorated_key(), make_update_slice(*m, true)).then([this, m, counter_id] (column_family::const_mutation_partition_ptr current) {
+            transform_counter_updates_to_shards(*m, current.get(), counter_id);
+            return apply(*m);
+        });
+    }).then([m] {
+        return std::move(*m);
     });
 }
 
 keyspace::config
 database::make_keyspace_config(const keyspace_metadata& ksm) {
-    // FIXME support multiple directories
     keyspace::config cfg;
     if (_cfg->data_file_directories().size() > 0) {
         cfg.datadir = sprint("%s/%s", _cfg->data_file_directories()[0], ksm.name());
+        // The system tables stay in the first directory, where they are
+        // loaded from before the others.
+        if (ksm.name() != db::system_keyspace::NAME) {
+            for (auto&& dir : _cfg->data_file_directories()) {
+                cfg.all_datadirs.push_back(sprint("%s/%s", dir, ksm.name()));
+            }
+            cfg.data_directories = &_data_directories;
+        }
         cfg.enable_disk_writes = !_cfg->enable_in_memory_data_store();
         cfg.enable_disk_reads = true; // we allways read from disk
         cfg.enable_commitlog = ksm.durable_writes() && _cfg->enable_commitlog() && !_cfg->enable_in_memory_data_store();
@@ -1482,7 +3166,14 @@ database::make_keyspace_config(const keyspace_metadata& ksm) {
         cfg.max_memtable_size = std::numeric_limits<size_t>::max();
     }
     cfg.dirty_memory_region_group = &_dirty_memory_region_group;
+    cfg.memtable_flush_scheduler = &_flush_scheduler;
     cfg.enable_incremental_backups = _cfg->incremental_backups();
+    cfg.paged_reader_ttl = std::chrono::milliseconds(_cfg->paged_reader_ttl_in_ms());
+    cfg.tombstone_limits = &_tombstone_thresholds;
+    // Internal reads of the system tables must not queue behind client reads.
+    if (ksm.name() != db::system_keyspace::NAME) {
+        cfg.read_concurrency_sem = &_read_concurrency_sem;
+    }
     return cfg;
 }
 
@@ -1535,6 +3226,7 @@ operator<<(std::ostream& os, const atomic_cell& ac) {
 
 future<>
 database::stop() {
+    _lsa_reclaim_timer.cancel();
     return _compaction_manager.stop().then([this] {
         // try to ensure that CL has done disk flushing
         if (_commitlog != nullptr) {
@@ -1589,7 +3281,10 @@ future<> database::truncate(db_clock::time_point truncated_at, const keyspace& k
             }
             return f.then([&cf, truncated_at] {
                 return cf.discard_sstables(truncated_at).then([&cf, truncated_at](db::replay_position rp) {
-                    // TODO: indexes.
+                    cf.index_manager().clear();
+                    if (cf.schema()->caching_options().result_cache_ttl().count()) {
+                        cql3::global_result_cache().clear();
+                    }
                     return db::system_keyspace::save_truncation_record(cf, truncated_at, rp);
                 });
             });
@@ -1682,25 +3377,37 @@ seal_snapshot(sstring jsondir) {
     });
 }
 
+// The number of sstables a shard links into a snapshot at once, which keeps
+// snapshots of tables with many sstables from issuing all their links at once.
+static constexpr size_t max_concurrent_snapshot_links = 64;
+
 future<> column_family::snapshot(sstring name) {
     return flush().then([this, name = std::move(name)]() {
         auto tables = boost::copy_range<std::vector<sstables::shared_sstable>>(*_sstables | boost::adaptors::map_values);
-        return do_with(std::move(tables), [this, name](std::vector<sstables::shared_sstable> & tables) {
+        std::set<sstring> dirs;
+        for (auto& sst : tables) {
+            dirs.insert(sst->get_dir() + "/snapshots/" + name);
+        }
+        return do_with(std::move(tables), std::move(dirs), semaphore(max_concurrent_snapshot_links),
+                [this, name](std::vector<sstables::shared_sstable> & tables, std::set<sstring>& dirs, semaphore& links) {
             auto jsondir = _config.datadir + "/snapshots/" + name;
 
-            return parallel_for_each(tables, [name](sstables::shared_sstable sstable) {
-                auto dir = sstable->get_dir() + "/snapshots/" + name;
-                return recursive_touch_directory(dir).then([sstable, dir] {
-                    return sstable->create_links(dir);
+            // The directories are created before, and synced after, the
+            // links of all of their sstables, rather than with each of them.
+            return parallel_for_each(dirs, [] (const sstring& dir) {
+                return recursive_touch_directory(dir);
+            }).then([&tables, &links, name] {
+                return parallel_for_each(tables, [&links, name](sstables::shared_sstable sstable) {
+                    return with_semaphore(links, 1, [sstable, name] {
+                        return sstable->link_components(sstable->get_dir() + "/snapshots/" + name);
+                    });
+                });
+            }).then([&dirs] {
+                // If we have no files, the directories may not have been
+                // created, and sync_directory would throw.
+                return parallel_for_each(dirs, [] (const sstring& dir) {
+                    return sync_directory(dir);
                 });
-            }).then([jsondir, &tables] {
-                // This is not just an optimization. If we have no files, jsondir may not have been created,
-                // and sync_directory would throw.
-                if (tables.size()) {
-                    return sync_directory(std::move(jsondir));
-                } else {
-                    return make_ready_future<>();
-                }
             }).then([this, &tables, jsondir] {
                 auto shard = std::hash<sstring>()(jsondir) % smp::count;
                 std::unordered_set<sstring> table_names;
@@ -1740,6 +3447,37 @@ future<> column_family::snapshot(sstring name) {
     });
 }
 
+future<std::vector<sstring>> column_family::snapshot_diff(sstring from, sstring to) const {
+    auto snapshots = _config.datadir + "/snapshots/";
+    auto list = [] (sstring dir, std::unordered_set<sstring>& files) {
+        return lister::scan_dir(dir, directory_entry_type::regular, [&files] (directory_entry de) {
+            if (de.name != "manifest.json") {
+                files.insert(de.name);
+            }
+            return make_ready_future<>();
+        });
+    };
+    auto full = from.empty();
+    return do_with(std::unordered_set<sstring>(), std::unordered_set<sstring>(),
+            [list, full, from = snapshots + from, to = snapshots + to] (auto& old_files, auto& new_files) {
+        auto f = full ? make_ready_future<>() : list(from, old_files);
+        return f.then([list, to, &new_files] {
+            return list(to, new_files);
+        }).then([to, &old_files, &new_files] {
+            // The sstables in both snapshots are links to the same files:
+            // sstable generations are never reused.
+            std::vector<sstring> added;
+            for (auto&& name : new_files) {
+                if (!old_files.count(name)) {
+                    added.push_back(to + "/" + name);
+                }
+            }
+            boost::sort(added);
+            return added;
+        });
+    });
+}
+
 future<> column_family::flush() {
     // FIXME: this will synchronously wait for this write to finish, but doesn't guarantee
     // anything about previous writes.
@@ -46,6 +46,8 @@
 #include "compound.hh"
 #include "core/future.hh"
 #include "core/gate.hh"
+#include "core/timer.hh"
+#include "core/semaphore.hh"
 #include "cql3/column_specification.hh"
 #include "db/commitlog/replay_position.hh"
 #include <limits>
@@ -61,13 +63,19 @@
 #include "memtable.hh"
 #include <list>
 #include "mutation_reader.hh"
+#include "key_reader.hh"
 #include "row_cache.hh"
 #include "compaction_strategy.hh"
 #include "utils/compaction_manager.hh"
 #include "utils/exponential_backoff_retry.hh"
 #include "utils/histogram.hh"
+#include "utils/flush_scheduler.hh"
+#include "db/data_directories.hh"
+#include "utils/reader_concurrency_semaphore.hh"
+#include "utils/space_saving.hh"
 #include "sstables/estimated_histogram.hh"
 #include "sstables/compaction.hh"
+#include "tracing/tracing.hh"
 
 class frozen_mutation;
 class reconcilable_result;
@@ -92,6 +100,10 @@ class config;
 namespace system_keyspace {
 void make(database& db, bool durable, bool volatile_testing_only);
 }
+
+namespace index {
+class secondary_index;
+}
 }
 
 class replay_position_reordered_exception : public std::exception {};
@@ -99,10 +111,68 @@ class replay_position_reordered_exception : public std::exception {};
 using memtable_list = std::vector<lw_shared_ptr<memtable>>;
 using sstable_list = sstables::sstable_list;
 
+class querier;
+struct query_state;
+
+// The secondary indexes of a column family on this shard, one per indexed
+// column, following its schema.
+class secondary_index_manager {
+    column_family& _cf;
+    compaction_manager& _compaction_manager;
+    // By the name of the indexed column.
+    std::unordered_map<bytes, lw_shared_ptr<db::index::secondary_index>> _indexes;
+    // Index builds, and the stopping of dropped indexes.
+    seastar::gate _background;
+private:
+    void start_build(lw_shared_ptr<db::index::secondary_index> idx);
+public:
+    secondary_index_manager(column_family& cf, compaction_manager& cm);
+    ~secondary_index_manager();
+    // Creates the indexes of the columns the schema newly indexes, starting
+    // their build, and drops those of the columns it no longer indexes.
+    void update();
+    // Builds all indexes again, as after sstables were loaded.
+    void rebuild();
+    // Drops all entries and builds the indexes again, as after truncation.
+    void clear();
+    bool empty() const {
+        return _indexes.empty();
+    }
+    void apply(const mutation& m);
+    void apply(const frozen_mutation& m);
+    // The index of the column, or null if it has none.
+    lw_shared_ptr<db::index::secondary_index> find(const bytes& column) const;
+    future<> stop();
+};
+
+// How many tombstones a query may read on a shard before a warning is
+// logged, and before it is aborted.
+struct tombstone_thresholds {
+    uint32_t warn = std::numeric_limits<uint32_t>::max();
+    uint32_t failure = std::numeric_limits<uint32_t>::max();
+};
+
+// Thrown by a query which read more tombstones than the failure threshold.
+class tombstone_overwhelming_exception : public std::runtime_error {
+public:
+    tombstone_overwhelming_exception(const schema& s, uint64_t tombstones);
+};
+
+// Thrown by a query still running when its coordinator gave up on it.
+class read_deadline_exceeded_exception : public std::runtime_error {
+public:
+    read_deadline_exceeded_exception(const schema& s);
+};
+
 class column_family {
 public:
     struct config {
         sstring datadir;
+        // The directories of the table in each data directory, datadir
+        // first, which new sstables are placed across.
+        std::vector<sstring> all_datadirs;
+        // Picks among all_datadirs; new sstables go to datadir when null.
+        db::data_directories* data_directories = nullptr;
         bool enable_disk_writes = true;
         bool enable_disk_reads = true;
         bool enable_cache = true;
@@ -110,8 +180,27 @@ class column_family {
         bool enable_incremental_backups = false;
         size_t max_memtable_size = 5'000'000;
         logalloc::region_group* dirty_memory_region_group = nullptr;
+        // Memtables are flushed as soon as they are sealed when null.
+        flush_scheduler* memtable_flush_scheduler = nullptr;
+        // How long the reader of a paged query is kept for its next page.
+        std::chrono::milliseconds paged_reader_ttl = std::chrono::seconds(10);
+        // The database's, which may change them at runtime; no limits when null.
+        const tombstone_thresholds* tombstone_limits = nullptr;
+        // Admits the reads of the shard; reads are admitted at once when null.
+        reader_concurrency_semaphore* read_concurrency_sem = nullptr;
     };
     struct no_commitlog {};
+    struct top_partition {
+        // The partition key, its components separated by colons.
+        sstring key;
+        uint64_t count;
+        // How much of the count may be other partitions'.
+        uint64_t error;
+    };
+    struct top_partitions {
+        std::vector<top_partition> reads;
+        std::vector<top_partition> writes;
+    };
     struct stats {
         /** Number of times flush has resulted in the memtable being switched out. */
         int64_t memtable_switch_count = 0;
@@ -122,17 +211,47 @@ class column_family {
         int64_t live_sstable_count = 0;
         /** Estimated number of compactions pending for this column family */
         int64_t pending_compactions = 0;
+        /** Sstables shared with other shards compacted into sstables of this shard, and their size */
+        int64_t resharded_sstables = 0;
+        int64_t resharded_bytes = 0;
+        /** Number of reads in progress for this column family */
+        int64_t pending_reads = 0;
         utils::ihistogram reads{256};
         utils::ihistogram writes{256};
         sstables::estimated_histogram estimated_read;
         sstables::estimated_histogram estimated_write;
+        /** Sstables read by each single partition read which got past the cache */
         sstables::estimated_histogram estimated_sstable_per_read;
+        /** Bytes of query results read from this shard, in all and per query */
+        int64_t read_bytes = 0;
+        sstables::estimated_histogram estimated_bytes_per_read;
+        /** Latency, in microseconds, of reads coordinated by this shard */
+        utils::decaying_histogram coordinator_reads;
+        /** Latency, in microseconds, of every read and write, for percentiles */
+        utils::decaying_histogram read_latencies;
+        utils::decaying_histogram write_latencies;
+        /** Pages of paged queries which continued the reader of the previous page */
+        int64_t paged_reader_hits = 0;
+        /** Pages of paged queries which had to read from where the previous page stopped */
+        int64_t paged_reader_misses = 0;
+        /** Readers of paged queries dropped as the next page didn't come in time */
+        int64_t paged_readers_evicted = 0;
+        /** Live rows read by filtering queries but left out of their results */
+        int64_t filtered_rows = 0;
+        /** Tombstones read by each query, and queries aborted for reading too many */
+        utils::ihistogram tombstones_scanned{256};
+        int64_t tombstone_failures = 0;
+        /** Time reads waited for admission to the shard */
+        utils::ihistogram read_admission_waits{256};
+        /** Reads abandoned as their coordinators gave up on them */
+        int64_t abandoned_reads = 0;
     };
 
 private:
     schema_ptr _schema;
     config _config;
-    stats _stats;
+    // Mutable as reads, which are const, record how many sstables they read.
+    mutable stats _stats;
     lw_shared_ptr<memtable_list> _memtables;
     // generation -> sstable. Ordered by key so we can easily get the most recent.
     lw_shared_ptr<sstable_list> _sstables;
@@ -149,19 +268,107 @@ class column_family {
     int _compaction_disabled = 0;
     class memtable_flush_queue;
     std::unique_ptr<memtable_flush_queue> _flush_queue;
+    // Zstd dictionary new sstables are compressed with, when the table's
+    // compression has dictionary_size_kb set. Trained by compactions.
+    bytes _compression_dictionary;
+    // The readers the last pages of paged queries stopped at, by query uuid.
+    std::unordered_map<utils::UUID, std::unique_ptr<querier>> _queriers;
+    timer<lowres_clock> _querier_expiry;
+    static constexpr size_t max_queriers = 1000;
+    secondary_index_manager _index_manager;
+    // The materialized views of the table, which its writes update.
+    std::vector<schema_ptr> _views;
+    // Counter updates and Paxos state changes of a partition read it
+    // before writing it, so they go one at a time. By partition key, while
+    // in use.
+    std::unordered_map<bytes, lw_shared_ptr<semaphore>> _partition_locks;
+    // Writes waiting for apply_pending_writes(), which merges those of the
+    // same partition, so that a hot partition is looked up and updated once
+    // per batch.
+    struct pending_write {
+        const frozen_mutation* m;
+        db::replay_position rp;
+        promise<> done;
+
+        pending_write(const frozen_mutation& m, const db::replay_position& rp)
+            : m(&m), rp(rp)
+        { }
+    };
+    std::vector<pending_write> _pending_writes;
+    timer<> _pending_writes_timer;
+    std::vector<scollectd::registration> _collectd;
+    // Counts the partitions read and written, by key, while the hottest
+    // ones are looked for. Null otherwise, which is all reads and writes
+    // then pay for it.
+    using partition_counter = utils::space_saving<bytes, std::hash<bytes_view>>;
+    struct top_partitions_sampler {
+        partition_counter reads;
+        partition_counter writes;
+        explicit top_partitions_sampler(size_t capacity) : reads(capacity), writes(capacity) { }
+    };
+    std::unique_ptr<top_partitions_sampler> _top_partitions;
 private:
+    void apply_pending_writes();
+    void setup_collectd();
+    void sample_write(bytes_view key) {
+        if (_top_partitions) {
+            _top_partitions->writes.add(bytes(key.begin(), key.size()));
+        }
+    }
     void update_stats_for_new_sstable(uint64_t new_sstable_data_size);
     void add_sstable(sstables::sstable&& sstable);
     void add_sstable(lw_shared_ptr<sstables::sstable> sstable);
     void add_memtable();
+    // Compact the sstables of descriptor, each of the given disjoint ranges
+    // concurrently into its own set of sstables.
+    future<> compact_sstables(sstables::compaction_descriptor descriptor, std::vector<query::partition_range> ranges);
+    // A new sstable for a compaction to write to, which is being written
+    // until sstable_written() is called with its directory.
+    sstables::shared_sstable make_compaction_output();
+    // Replace the current sstable list with one where sstables_to_remove are
+    // taken out and new_sstables are added in.
+    void rebuild_sstable_list(const std::vector<sstables::shared_sstable>& new_sstables,
+                              const std::vector<sstables::shared_sstable>& sstables_to_remove);
     future<stop_iteration> try_flush_memtable_to_sstable(lw_shared_ptr<memtable> memt);
+    // The directory to write a new sstable to, which is then being written
+    // until sstable_written() is called with it.
+    sstring start_sstable_write();
+    void sstable_written(const sstring& dir);
     future<> update_cache(memtable&, lw_shared_ptr<sstable_list> old_sstables);
     struct merge_comparator;
+    // Takes out the reader of the previous page of cmd, provided the
+    // page stopped at the start of range.
+    std::unique_ptr<querier> take_querier(const query::read_command& cmd, const query::partition_range& range);
+    void save_querier(const utils::UUID& query_uuid, std::unique_ptr<querier> q);
+    void expire_queriers();
+    // Reads the rows holding the value the query restricts an indexed
+    // column to, through the index once it is built.
+    future<> query_by_index(query_state& qs);
+    // Of a DISTINCT query of the partition keys alone, read from the index
+    // files of the sstables rather than their data.
+    future<> query_keys(query_state& qs);
+    future<lw_shared_ptr<query::result>> do_query(query_state& qs);
+    // Admits the query to the shard first, when reads have admission control.
+    future<lw_shared_ptr<query::result>> query(const query::read_command& cmd, const query::partition_range* ranges_begin,
+            const query::partition_range* ranges_end);
+    future<lw_shared_ptr<query::result>> run_query(const query::read_command& cmd, const query::partition_range* ranges_begin,
+            const query::partition_range* ranges_end);
+    // Of the buffers of the sstable readers the query opens.
+    size_t estimate_reader_memory(const query::partition_range* ranges_begin, const query::partition_range* ranges_end) const;
 private:
     // Creates a mutation reader which covers sstables.
     // Caller needs to ensure that column_family remains live (FIXME: relax this).
     // The 'range' parameter must be live as long as the reader is used.
     mutation_reader make_sstable_reader(const query::partition_range& range) const;
+    // As above, but of a single partition only the rows in the ranges of the
+    // slice, and the static row, need be read. Sstables holding no rows in
+    // them are skipped when the slice selects no static columns.
+    mutation_reader make_sstable_reader(const query::partition_range& range,
+            const query::partition_slice& slice) const;
+
+    // Records the data sources a read of the range goes through.
+    void trace_sources(const tracing::trace_state_ptr& trace_state, const query::partition_range& range,
+            bool through_cache) const;
 
     mutation_source sstables_as_mutation_source();
     partition_presence_checker make_partition_presence_checker(lw_shared_ptr<sstable_list> old_sstables);
@@ -172,6 +379,18 @@ class column_family {
     // The 'range' parameter must be live as long as the reader is used.
     mutation_reader make_reader(const query::partition_range& range = query::full_partition_range) const;
 
+    // Like make_reader(), for a read needing only what is selected by the
+    // slice, up to row_limit rows, so that a partially cached partition can
+    // serve it. The slice must be live as long as the reader is used.
+    mutation_reader make_reader(const query::partition_range& range, const query::partition_slice& slice,
+            uint32_t row_limit, gc_clock::time_point now, tracing::trace_state_ptr trace_state = nullptr) const;
+
+    // Creates a key_reader of the keys of the partitions in the range, of
+    // all data sources for this column family. The sstables are read
+    // through their index files, bypassing the cache. The 'range'
+    // parameter must be live as long as the reader is used.
+    key_reader make_key_reader(const query::partition_range& range) const;
+
     mutation_source as_mutation_source() const;
 
     // Queries can be satisfied from multiple data sources, so they are returned
@@ -186,21 +405,42 @@ class column_family {
     }
 
     logalloc::occupancy_stats occupancy() const;
+    // The smallest timestamp of the data in the memtables, those being
+    // flushed included.
+    api::timestamp_type min_memtable_timestamp() const;
 public:
     column_family(schema_ptr schema, config cfg, db::commitlog& cl, compaction_manager&);
     column_family(schema_ptr schema, config cfg, no_commitlog, compaction_manager&);
     column_family(column_family&&) = delete; // 'this' is being captured during construction
     ~column_family();
     schema_ptr schema() const { return _schema; }
+    // Switches to a schema which differs from the current one only in the
+    // secondary indexes of its columns, updating the indexes.
+    void set_schema(schema_ptr s);
     db::commitlog* commitlog() { return _commitlog; }
+    secondary_index_manager& index_manager() { return _index_manager; }
+    const std::vector<schema_ptr>& views() const { return _views; }
+    void add_or_update_view(schema_ptr v);
+    void remove_view(const schema_ptr& v);
     future<const_mutation_partition_ptr> find_partition(const dht::decorated_key& key) const;
+    // Like find_partition(), for only what the slice selects, and possibly
+    // some more.
+    future<const_mutation_partition_ptr> find_partition(const dht::decorated_key& key, query::partition_slice slice) const;
     future<const_mutation_partition_ptr> find_partition_slow(const partition_key& key) const;
     future<const_row_ptr> find_row(const dht::decorated_key& partition_key, clustering_key clustering_key) const;
     void apply(const frozen_mutation& m, const db::replay_position& = db::replay_position());
     void apply(const mutation& m, const db::replay_position& = db::replay_position());
+    // Applies the mutation along with the other writes arriving before the
+    // reactor next polls. The mutation must be kept alive until the returned
+    // future resolves.
+    future<> apply_coalesced(const frozen_mutation& m, const db::replay_position& rp);
+    // Runs func once no other read-modify-write of the partition is running.
+    future<> with_partition_lock(const partition_key& key, std::function<future<> ()> func);
 
     // Returns at most "cmd.limit" rows
     future<lw_shared_ptr<query::result>> query(const query::read_command& cmd, const std::vector<query::partition_range>& ranges);
+    // Same, of a single range, which is not copied.
+    future<lw_shared_ptr<query::result>> query(const query::read_command& cmd, const query::partition_range& range);
 
     future<> populate(sstring datadir);
 
@@ -218,8 +458,33 @@ class column_family {
     future<> compact_all_sstables();
     // Compact all sstables provided in the vector.
     future<> compact_sstables(sstables::compaction_descriptor descriptor);
+    // Remove the given sstables from the live set without rewriting them, and
+    // delete their files. Used for sstables whose whole content has expired.
+    future<> drop_sstables(std::vector<sstables::shared_sstable> sstables);
+    // Rewrites the sstables without the partitions outside of owned_ranges,
+    // the ranges the node replicates, as after new nodes took some of them
+    // over. Sstables inside the owned ranges are left alone, and those
+    // entirely outside of them are dropped without being read.
+    future<> cleanup_sstables(std::vector<query::range<dht::token>> owned_ranges);
 
     future<> snapshot(sstring name);
+    // The paths of the files of snapshot to which aren't in snapshot from, all
+    // of them if from is empty: what to copy to back up to after from.
+    future<std::vector<sstring>> snapshot_diff(sstring from, sstring to) const;
+
+    // A generation for an sstable created on this shard, which no sstable
+    // of the column family has on any shard.
+    unsigned long calculate_generation_for_new_table();
+    // Adds the sstable of the generation, which another node streamed into
+    // the directory of the column family. Must be called on all shards: like
+    // the sstables found on startup, each shard keeps it only if it holds
+    // some of its partitions.
+    future<> add_streamed_sstable(unsigned long generation, sstables::sstable::version_types v,
+            sstables::sstable::format_types f);
+
+    const sstring& dir() const {
+        return _config.datadir;
+    }
 
     const bool incremental_backups_enabled() const {
         return _config.enable_incremental_backups;
@@ -235,7 +500,12 @@ class column_family {
 
     void start_compaction();
     void trigger_compaction();
+    // Compacts the sstables shared with other shards into sstables of this
+    // shard. Run before every compaction.
+    future<> reshard_sstables();
     future<> run_compaction();
+    // Sstables shared with other shards, still to be resharded, and their size.
+    std::pair<size_t, uint64_t> shared_sstables() const;
     void set_compaction_strategy(sstables::compaction_strategy_type strategy);
     const sstables::compaction_strategy& get_compaction_strategy() const {
         return _compaction_strategy;
@@ -253,6 +523,42 @@ class column_family {
         return _stats;
     }
 
+    // Starts counting the partitions read and written, at most capacity of
+    // each, for finding the hottest ones. Starting again restarts it.
+    void start_top_partitions_sampling(size_t capacity);
+    // Stops it, returning the list_size most read and written partitions
+    // since it started.
+    top_partitions stop_top_partitions_sampling(size_t list_size);
+    void sample_read(const partition_key& key) const {
+        if (_top_partitions) {
+            auto r = key.representation();
+            _top_partitions->reads.add(bytes(r.begin(), r.size()));
+        }
+    }
+
+    void on_coordinator_read(std::chrono::microseconds latency) {
+        _stats.coordinator_reads.mark(latency.count());
+    }
+
+    // How long to wait for the replicas of a read before sending it to one
+    // more, as set by the speculative_retry schema option. Disengaged if
+    // there is no such delay, or not enough reads yet to estimate a
+    // percentile.
+    std::experimental::optional<std::chrono::microseconds> speculative_retry_delay() const;
+
+    const bytes& get_compression_dictionary() const {
+        return _compression_dictionary;
+    }
+
+    void set_compression_dictionary(bytes dictionary) {
+        _compression_dictionary = std::move(dictionary);
+    }
+
+    // Rate limiter shared by all compactions of this shard.
+    compaction_throttle& get_compaction_throttle() {
+        return _compaction_manager.throttle();
+    }
+
     template<typename Func, typename Result = futurize_t<std::result_of_t<Func()>>>
     Result run_with_compaction_disabled(Func && func) {
         ++_compaction_disabled;
@@ -284,6 +590,9 @@ class column_family {
     template <typename Func>
     future<bool> for_all_partitions(Func&& func) const;
     future<sstables::entry_descriptor> probe_file(sstring sstdir, sstring fname);
+    // The segments a write which finds the active memtable full compacts
+    // at most.
+    static constexpr size_t memtable_compaction_step = 4;
     void seal_on_overflow();
     void check_valid_rp(const db::replay_position&) const;
 public:
@@ -381,6 +690,10 @@ class keyspace {
 public:
     struct config {
         sstring datadir;
+        // The directories of the keyspace in each data directory, datadir
+        // first.
+        std::vector<sstring> all_datadirs;
+        db::data_directories* data_directories = nullptr;
         bool enable_commitlog = true;
         bool enable_disk_reads = true;
         bool enable_disk_writes = true;
@@ -388,6 +701,14 @@ class keyspace {
         bool enable_incremental_backups = false;
         size_t max_memtable_size = 5'000'000;
         logalloc::region_group* dirty_memory_region_group = nullptr;
+        // Memtables are flushed as soon as they are sealed when null.
+        flush_scheduler* memtable_flush_scheduler = nullptr;
+        // How long the reader of a paged query is kept for its next page.
+        std::chrono::milliseconds paged_reader_ttl = std::chrono::seconds(10);
+        // The database's, which may change them at runtime; no limits when null.
+        const tombstone_thresholds* tombstone_limits = nullptr;
+        // Admits the reads of the shard; reads are admitted at once when null.
+        reader_concurrency_semaphore* read_concurrency_sem = nullptr;
     };
 private:
     std::unique_ptr<locator::abstract_replication_strategy> _replication_strategy;
@@ -425,8 +746,11 @@ class keyspace {
     const sstring& datadir() const {
         return _config.datadir;
     }
+    const std::vector<sstring>& all_datadirs() const {
+        return _config.all_datadirs;
+    }
 private:
-    sstring column_family_directory(const sstring& name, utils::UUID uuid) const;
+    sstring column_family_directory(const sstring& datadir, const sstring& name, utils::UUID uuid) const;
 };
 
 class no_such_keyspace : public std::runtime_error {
@@ -445,6 +769,10 @@ class no_such_column_family : public std::runtime_error {
 //   local metadata reads
 //   use shard_of() for data
 
+// Sends the updates of its views a write to the base table makes, given the
+// token of the base partition.
+using view_update_sender = std::function<future<> (schema_ptr base, dht::token base_token, std::vector<mutation> updates)>;
+
 class database {
     logalloc::region_group _dirty_memory_region_group;
     std::unordered_map<sstring, keyspace> _keyspaces;
@@ -453,15 +781,37 @@ class database {
     std::unique_ptr<db::commitlog> _commitlog;
     std::unique_ptr<db::config> _cfg;
     size_t _memtable_total_space = 500 << 20;
+    // Dirty memory above which writes get delayed, increasingly as it gets
+    // closer to _memtable_total_space, where they are blocked.
+    size_t _memtable_soft_limit = 500 << 20;
+    struct throttle_stats {
+        uint64_t soft_throttled = 0;
+        uint64_t hard_throttled = 0;
+        uint64_t throttle_time_ns = 0;
+    } _throttle_stats;
     utils::UUID _version;
     // compaction_manager object is referenced by all column families of a database.
     compaction_manager _compaction_manager;
+    // So is the flush scheduler.
+    flush_scheduler _flush_scheduler;
+    // And the data directories new sstables are placed across.
+    db::data_directories _data_directories;
+    // And the limits on the tombstones queries read.
+    tombstone_thresholds _tombstone_thresholds;
+    // And the admission of reads.
+    reader_concurrency_semaphore _read_concurrency_sem;
     std::vector<scollectd::registration> _collectd;
     timer<> _throttling_timer{[this] { unthrottle(); }};
     circular_buffer<promise<>> _throttled_requests;
+    // Keeps LSA free memory above _lsa_reclaim_reserve between allocations.
+    size_t _lsa_reclaim_reserve = 0;
+    std::chrono::microseconds _lsa_reclaim_budget;
+    view_update_sender _view_update_sender;
+    timer<> _lsa_reclaim_timer{[this] {
+        logalloc::shard_tracker().reclaim_in_background(_lsa_reclaim_reserve, _lsa_reclaim_budget);
+    }};
 
     future<> init_commitlog();
-    future<> apply_in_memory(const frozen_mutation&, const db::replay_position&);
     future<> populate(sstring datadir);
     future<> populate_keyspace(sstring datadir, sstring ks_name);
 
@@ -472,8 +822,15 @@ class database {
     void create_in_memory_keyspace(const lw_shared_ptr<keyspace_metadata>& ksm);
     friend void db::system_keyspace::make(database& db, bool durable, bool volatile_testing_only);
     void setup_collectd();
+    void setup_compaction_throttle();
+    void setup_io_queue();
+    void setup_cpu_scheduler();
+    void setup_background_reclaim();
     future<> throttle();
     future<> do_apply(const frozen_mutation&);
+    // Applies a write to a table with materialized views, and sends the
+    // view updates it makes.
+    future<> apply_with_views(column_family& cf, const frozen_mutation&);
     void unthrottle();
 public:
     static utils::UUID empty_version;
@@ -496,6 +853,23 @@ class database {
         return _compaction_manager;
     }
 
+    compaction_manager& get_compaction_manager() {
+        return _compaction_manager;
+    }
+
+    void set_compaction_throughput_mb_per_sec(uint32_t value);
+    uint32_t compaction_throughput_mb_per_sec() const;
+
+    const tombstone_thresholds& get_tombstone_thresholds() const {
+        return _tombstone_thresholds;
+    }
+    void set_tombstone_warn_threshold(uint32_t value) {
+        _tombstone_thresholds.warn = value;
+    }
+    void set_tombstone_failure_threshold(uint32_t value) {
+        _tombstone_thresholds.failure = value;
+    }
+
     future<> init_system_keyspace();
     future<> load_sstables(distributed<service::storage_proxy>& p); // after init_system_keyspace()
 
@@ -537,8 +911,25 @@ class database {
     unsigned shard_of(const mutation& m);
     unsigned shard_of(const frozen_mutation& m);
     future<lw_shared_ptr<query::result>> query(const query::read_command& cmd, const std::vector<query::partition_range>& ranges);
+    future<lw_shared_ptr<query::result>> query(const query::read_command& cmd, const query::partition_range& range);
     future<reconcilable_result> query_mutations(const query::read_command& cmd, const query::partition_range& range);
     future<> apply(const frozen_mutation&);
+    // For mutations owned by this shard. Mutations of tables which don't
+    // write to the commitlog are applied without being frozen first.
+    future<> apply(const mutation&);
+    // Applies to the memtables only, bypassing the commitlog, as replayed
+    // mutations must be. Fails with no_such_column_family if the table is gone.
+    future<> apply_in_memory(const frozen_mutation&, const db::replay_position&);
+    // Turns the counter updates of a mutation owned by this shard into the
+    // shards of the node with the given id, and applies it. Returns the
+    // mutation as applied, for the other replicas to apply.
+    future<mutation> apply_counter_update(const frozen_mutation&, utils::UUID counter_id);
+    // Set by the storage proxy, which sends the updates writes to base tables
+    // make of their views to the view replicas. The returned future resolves
+    // once the write may complete, the updates being sent in the background.
+    void set_view_update_sender(view_update_sender sender) {
+        _view_update_sender = std::move(sender);
+    }
     keyspace::config make_keyspace_config(const keyspace_metadata& ksm);
     const sstring& get_snitch_name() const;
 
@@ -576,19 +967,33 @@ class database {
     const logalloc::region_group& dirty_memory_region_group() const {
         return _dirty_memory_region_group;
     }
+    flush_scheduler& get_flush_scheduler() {
+        return _flush_scheduler;
+    }
+    const db::data_directories& get_data_directories() const {
+        return _data_directories;
+    }
+    const flush_scheduler& get_flush_scheduler() const {
+        return _flush_scheduler;
+    }
+    reader_concurrency_semaphore& get_read_concurrency_semaphore() {
+        return _read_concurrency_sem;
+    }
 };
 
-// FIXME: stub
-class secondary_index_manager {};
-
 inline
 void
 column_family::apply(const mutation& m, const db::replay_position& rp) {
     utils::latency_counter lc;
-    _stats.writes.set_latency(lc);
+    lc.start();
+    if (!_index_manager.empty()) {
+        _index_manager.apply(m);
+    }
     active_memtable().apply(m, rp);
+    sample_write(m.key().representation());
     seal_on_overflow();
     _stats.writes.mark(lc);
+    _stats.write_latencies.mark(lc.latency_in_micro());
     if (lc.is_start()) {
         _stats.estimated_write.add(lc.latency_in_nano(), _stats.writes.count);
     }
@@ -598,8 +1003,20 @@ inline
 void
 column_family::seal_on_overflow() {
     ++_mutation_count;
-    if (active_memtable().occupancy().total_space() >= _config.max_memtable_size) {
-        // FIXME: if sparse, do some in-memory compaction first
+    auto& mt = active_memtable();
+    if (mt.occupancy().total_space() >= _config.max_memtable_size) {
+        // A memtable whose rows keep being overwritten is mostly free space,
+        // which compaction returns without a flush, so that it is flushed
+        // for the live data it holds rather than for the space its
+        // overwritten values took. Each write finding it full compacts a
+        // few segments only, so that none of them stalls, for as long as
+        // that keeps the memtable from growing well past its size.
+        auto occupancy = mt.occupancy();
+        auto overflow = occupancy.total_space() - _config.max_memtable_size;
+        if (occupancy.used_space() < _config.max_memtable_size / 2 && overflow < _config.max_memtable_size / 2
+                && mt.compact(memtable_compaction_step)) {
+            return;
+        }
         // FIXME: maybe merge with other in-memory memtables
         _mutation_count = 0;
         seal_active_memtable();
@@ -618,11 +1035,16 @@ inline
 void
 column_family::apply(const frozen_mutation& m, const db::replay_position& rp) {
     utils::latency_counter lc;
-    _stats.writes.set_latency(lc);
+    lc.start();
     check_valid_rp(rp);
+    if (!_index_manager.empty()) {
+        _index_manager.apply(m);
+    }
     active_memtable().apply(m, rp);
+    sample_write(m.key(*_schema).representation());
     seal_on_overflow();
     _stats.writes.mark(lc);
+    _stats.write_latencies.mark(lc.latency_in_micro());
     if (lc.is_start()) {
         _stats.estimated_write.add(lc.latency_in_nano(), _stats.writes.count);
     }
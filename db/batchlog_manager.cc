@@ -61,6 +61,7 @@ static logging::logger logger("batchlog_manager");
 
 const uint32_t db::batchlog_manager::replay_interval;
 const uint32_t db::batchlog_manager::page_size;
+const uint32_t db::batchlog_manager::replay_concurrency;
 
 db::batchlog_manager::batchlog_manager(cql3::query_processor& qp)
         : _qp(qp)
@@ -113,18 +114,30 @@ mutation db::batchlog_manager::get_batch_log_mutation_for(const std::vector<muta
 }
 
 mutation db::batchlog_manager::get_batch_log_mutation_for(const std::vector<mutation>& mutations, const utils::UUID& id, int32_t version, db_clock::time_point now) {
+    std::vector<lw_shared_ptr<const frozen_mutation>> fm;
+    fm.reserve(mutations.size());
+    for (auto& m : mutations) {
+        fm.emplace_back(make_lw_shared<const frozen_mutation>(m));
+    }
+    return get_batch_log_mutation_for(fm, id, version, now);
+}
+
+mutation db::batchlog_manager::get_batch_log_mutation_for(const std::vector<lw_shared_ptr<const frozen_mutation>>& mutations, const utils::UUID& id, int32_t version) {
+    return get_batch_log_mutation_for(mutations, id, version, db_clock::now());
+}
+
+mutation db::batchlog_manager::get_batch_log_mutation_for(const std::vector<lw_shared_ptr<const frozen_mutation>>& mutations, const utils::UUID& id, int32_t version, db_clock::time_point now) {
     auto schema = _qp.db().local().find_schema(system_keyspace::NAME, system_keyspace::BATCHLOG);
     auto key = partition_key::from_singular(*schema, id);
     auto timestamp = db_clock::now_in_usecs();
     auto data = [this, &mutations] {
-        std::vector<frozen_mutation> fm(mutations.begin(), mutations.end());
-        const auto size = std::accumulate(fm.begin(), fm.end(), size_t(0), [](size_t s, auto& m) {
-            return s + serializer<frozen_mutation>{m}.size();
+        const auto size = std::accumulate(mutations.begin(), mutations.end(), size_t(0), [](size_t s, auto& m) {
+            return s + serializer<frozen_mutation>{*m}.size();
         });
         bytes buf(bytes::initialized_later(), size);
         data_output out(buf);
-        for (auto& m : fm) {
-            serializer<frozen_mutation>{m}(out);
+        for (auto& m : mutations) {
+            serializer<frozen_mutation>{*m}(out);
         }
         return buf;
     }();
@@ -142,107 +155,152 @@ db_clock::duration db::batchlog_manager::get_batch_log_timeout() const {
     return db_clock::duration(_qp.db().local().get_config().write_request_timeout_in_ms()) * 2;
 }
 
-future<> db::batchlog_manager::replay_all_failed_batches() {
-    typedef db_clock::rep clock_type;
+double db::batchlog_manager::get_replay_rate() const {
+    if (!_replay_started_at) {
+        return 0;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(db_clock::now() - *_replay_started_at);
+    return elapsed.count() > 0 ? _replay_bytes / elapsed.count() : 0;
+}
 
-    // rate limit is in bytes per second. Uses Double.MAX_VALUE if disabled (set to 0 in cassandra.yaml).
-    // max rate is scaled by the number of nodes in the cluster (same as for HHOM - see CASSANDRA-5272).
-    auto throttle_in_kb = _qp.db().local().get_config().batchlog_replay_throttle_in_kb() / service::get_storage_service().local().get_token_metadata().get_all_endpoints().size();
-    auto limiter = make_lw_shared<utils::rate_limiter>(throttle_in_kb * 1000);
+// Resolves with whether the batch can be removed from the batchlog, which
+// it can unless replaying it failed.
+future<bool> db::batchlog_manager::replay_batch(const cql3::untyped_result_set::row& row, lw_shared_ptr<utils::rate_limiter> limiter) {
+    typedef db_clock::rep clock_type;
 
-    auto batch = [this, limiter](const cql3::untyped_result_set::row& row) {
-        auto written_at = row.get_as<db_clock::time_point>("written_at");
-        // enough time for the actual write + batchlog entry mutation delivery (two separate requests).
-        // enough time for the actual write + batchlog entry mutation delivery (two separate requests).
-        auto timeout = get_batch_log_timeout();
-        if (db_clock::now() < written_at + timeout) {
-            return make_ready_future<>();
-        }
-        // not used currently. ever?
-        //auto version = row.has("version") ? row.get_as<uint32_t>("version") : /*MessagingService.VERSION_12*/6u;
-        auto id = row.get_as<utils::UUID>("id");
-        auto data = row.get_blob("data");
+    auto written_at = row.get_as<db_clock::time_point>("written_at");
+    // enough time for the actual write + batchlog entry mutation delivery (two separate requests).
+    auto timeout = get_batch_log_timeout();
+    if (db_clock::now() < written_at + timeout) {
+        return make_ready_future<bool>(false);
+    }
+    // not used currently. ever?
+    //auto version = row.has("version") ? row.get_as<uint32_t>("version") : /*MessagingService.VERSION_12*/6u;
+    auto id = row.get_as<utils::UUID>("id");
+    auto data = row.get_blob("data");
 
-        logger.debug("Replaying batch {}", id);
+    logger.debug("Replaying batch {}", id);
 
-        auto fms = make_lw_shared<std::deque<frozen_mutation>>();
-        data_input in(data);
-        while (in.has_next()) {
-            fms->emplace_back(serializer<frozen_mutation>::read(in));
-        }
+    auto fms = make_lw_shared<std::deque<frozen_mutation>>();
+    data_input in(data);
+    while (in.has_next()) {
+        fms->emplace_back(serializer<frozen_mutation>::read(in));
+    }
 
-        auto mutations = make_lw_shared<std::vector<mutation>>();
-        auto size = data.size();
+    auto mutations = make_lw_shared<std::vector<mutation>>();
+    auto size = data.size();
 
-        return repeat([this, fms = std::move(fms), written_at, mutations]() mutable {
-            if (fms->empty()) {
-                return make_ready_future<stop_iteration>(stop_iteration::yes);
-            }
-            auto& fm = fms->front();
-            auto mid = fm.column_family_id();
-            return system_keyspace::get_truncated_at(mid).then([this, &fm, written_at, mutations](db_clock::time_point t) {
+    return repeat([this, fms = std::move(fms), written_at, mutations]() mutable {
+        if (fms->empty()) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        auto& fm = fms->front();
+        auto mid = fm.column_family_id();
+        return system_keyspace::get_truncated_at(mid).then([this, &fm, written_at, mutations](db_clock::time_point t) {
+            if (written_at > t) {
                 auto schema = _qp.db().local().find_schema(fm.column_family_id());
-                if (written_at > t) {
-                    auto schema = _qp.db().local().find_schema(fm.column_family_id());
-                    mutations->emplace_back(fm.unfreeze(schema));
-                }
-            }).then([fms] {
-                fms->pop_front();
-                return make_ready_future<stop_iteration>(stop_iteration::no);
-            });
-        }).then([this, id, mutations, limiter, written_at, size] {
-            if (mutations->empty()) {
-                return make_ready_future<>();
+                mutations->emplace_back(fm.unfreeze(schema));
             }
-            const auto ttl = [this, mutations, written_at]() -> clock_type {
-                /*
-                 * Calculate ttl for the mutations' hints (and reduce ttl by the time the mutations spent in the batchlog).
-                 * This ensures that deletes aren't "undone" by an old batch replay.
-                 */
-                auto unadjusted_ttl = std::numeric_limits<gc_clock::rep>::max();
-                warn(unimplemented::cause::HINT);
+        }).then([fms] {
+            fms->pop_front();
+            return make_ready_future<stop_iteration>(stop_iteration::no);
+        });
+    }).then([this, id, mutations, limiter, written_at, size] {
+        if (mutations->empty()) {
+            return make_ready_future<>();
+        }
+        const auto ttl = [this, mutations, written_at]() -> clock_type {
+            /*
+             * Calculate ttl for the mutations' hints (and reduce ttl by the time the mutations spent in the batchlog).
+             * This ensures that deletes aren't "undone" by an old batch replay.
+             */
+            auto unadjusted_ttl = std::numeric_limits<gc_clock::rep>::max();
+            warn(unimplemented::cause::HINT);
 #if 0
-                for (auto& m : *mutations) {
-                    unadjustedTTL = Math.min(unadjustedTTL, HintedHandOffManager.calculateHintTTL(mutation));
-                }
+            for (auto& m : *mutations) {
+                unadjustedTTL = Math.min(unadjustedTTL, HintedHandOffManager.calculateHintTTL(mutation));
+            }
 #endif
-                return unadjusted_ttl - std::chrono::duration_cast<gc_clock::duration>(db_clock::now() - written_at).count();
-            }();
+            return unadjusted_ttl - std::chrono::duration_cast<gc_clock::duration>(db_clock::now() - written_at).count();
+        }();
+
+        if (ttl <= 0) {
+            return make_ready_future<>();
+        }
+        // Origin does the send manually, however I can't see a super great reason to do so.
+        // Our normal write path does not add much redundancy to the dispatch, and rate is handled after send
+        // in both cases.
+        // FIXME: verify that the above is reasonably true.
+        return limiter->reserve(size).then([this, mutations, id] {
+            return _qp.proxy().local().mutate(std::move(*mutations), db::consistency_level::ANY);
+        });
+    }).then_wrapped([this, id, size] (future<> f) {
+        try {
+            f.get();
+            ++_total_batches_replayed;
+            _total_bytes_replayed += size;
+            _replay_bytes += size;
+            return true;
+        } catch (...) {
+            // Kept for the next replay.
+            ++_total_batches_failed;
+            logger.warn("Failed to replay batch {}: {}", id, std::current_exception());
+            return false;
+        }
+    });
+}
+
+future<> db::batchlog_manager::replay_all_failed_batches() {
+    // rate limit is in bytes per second. Uses Double.MAX_VALUE if disabled (set to 0 in cassandra.yaml).
+    // max rate is scaled by the number of nodes in the cluster (same as for HHOM - see CASSANDRA-5272).
+    auto endpoints = std::max(service::get_storage_service().local().get_token_metadata().get_all_endpoints().size(), size_t(1));
+    auto throttle_in_kb = _qp.db().local().get_config().batchlog_replay_throttle_in_kb() / endpoints;
+    auto limiter = make_lw_shared<utils::rate_limiter>(throttle_in_kb * 1000);
 
-            if (ttl <= 0) {
+    // Replays the batches of a page, at most replay_concurrency of them at a
+    // time, then removes the replayed ones from the batchlog at once.
+    auto replay_page = [this, limiter] (const cql3::untyped_result_set& page) {
+        auto concurrency = make_lw_shared<semaphore>(replay_concurrency);
+        auto removed = make_lw_shared<std::vector<mutation>>();
+        return parallel_for_each(page, [this, limiter, concurrency, removed] (const cql3::untyped_result_set::row& row) {
+            return concurrency->wait().then([this, &row, limiter, removed] {
+                return replay_batch(row, limiter).then([this, &row, removed] (bool replayed) {
+                    if (replayed) {
+                        // Each batch is a partition of its own.
+                        auto schema = _qp.db().local().find_schema(system_keyspace::NAME, system_keyspace::BATCHLOG);
+                        auto key = partition_key::from_singular(*schema, row.get_as<utils::UUID>("id"));
+                        mutation m(key, schema);
+                        auto now = service::client_state(service::client_state::internal_tag()).get_timestamp();
+                        m.partition().apply(tombstone(now, gc_clock::now()));
+                        removed->emplace_back(std::move(m));
+                    }
+                });
+            }).finally([concurrency] {
+                concurrency->signal();
+            });
+        }).then([this, removed] {
+            if (removed->empty()) {
                 return make_ready_future<>();
             }
-            // Origin does the send manually, however I can't see a super great reason to do so.
-            // Our normal write path does not add much redundancy to the dispatch, and rate is handled after send
-            // in both cases.
-            // FIXME: verify that the above is reasonably true.
-            return limiter->reserve(size).then([this, mutations, id] {
-                return _qp.proxy().local().mutate(std::move(*mutations), db::consistency_level::ANY);
-            });
-        }).then([this, id] {
-            // delete batch
-            auto schema = _qp.db().local().find_schema(system_keyspace::NAME, system_keyspace::BATCHLOG);
-            auto key = partition_key::from_singular(*schema, id);
-            mutation m(key, schema);
-            auto now = service::client_state(service::client_state::internal_tag()).get_timestamp();
-            m.partition().apply_delete(*schema, {}, tombstone(now, gc_clock::now()));
-            return _qp.proxy().local().mutate_locally(m);
+            return _qp.proxy().local().mutate_locally(std::move(*removed));
         });
     };
 
-    return seastar::with_gate(_gate, [this, batch = std::move(batch)] {
+    return seastar::with_gate(_gate, [this, replay_page = std::move(replay_page)] {
         logger.debug("Started replayAllFailedBatches (cpu {})", engine().cpu_id());
+        _replay_started_at = db_clock::now();
+        _replay_bytes = 0;
 
         typedef ::shared_ptr<cql3::untyped_result_set> page_ptr;
         sstring query = sprint("SELECT id, data, written_at, version FROM %s.%s LIMIT %d", system_keyspace::NAME, system_keyspace::BATCHLOG, page_size);
-        return _qp.execute_internal(query).then([this, batch = std::move(batch)](page_ptr page) {
-            return do_with(std::move(page), [this, batch = std::move(batch)](page_ptr & page) mutable {
-                return repeat([this, &page, batch = std::move(batch)]() mutable {
-                    if (page->empty()) {
+        return _qp.execute_internal(query).then([this, replay_page = std::move(replay_page)](page_ptr page) {
+            return do_with(std::move(page), [this, replay_page = std::move(replay_page)](page_ptr & page) mutable {
+                return repeat([this, &page, replay_page = std::move(replay_page)]() mutable {
+                    if (page->empty() || _stop) {
                         return make_ready_future<stop_iteration>(stop_iteration::yes);
                     }
                     auto id = page->back().get_as<utils::UUID>("id");
-                    return parallel_for_each(*page, batch).then([this, &page, id]() {
+                    return replay_page(*page).then([this, &page, id]() {
                         if (page->size() < page_size) {
                             return make_ready_future<stop_iteration>(stop_iteration::yes); // we've exhausted the batchlog, next query would be empty.
                         }
@@ -270,7 +328,8 @@ future<> db::batchlog_manager::replay_all_failed_batches() {
 
 #endif
 
-        }).then([this] {
+        }).finally([this] {
+            _replay_started_at = {};
             logger.debug("Finished replayAllFailedBatches");
         });
     });
@@ -42,6 +42,7 @@
 #pragma once
 
 #include <unordered_map>
+#include <experimental/optional>
 #include <seastar/core/future.hh>
 #include <seastar/core/distributed.hh>
 #include <seastar/core/timer.hh>
@@ -50,6 +51,13 @@
 #include "cql3/query_processor.hh"
 #include "gms/inet_address.hh"
 #include "db_clock.hh"
+#include "frozen_mutation.hh"
+
+namespace utils {
+
+class rate_limiter;
+
+}
 
 namespace db {
 
@@ -57,10 +65,16 @@ class batchlog_manager {
 private:
     static constexpr uint32_t replay_interval = 60 * 1000; // milliseconds
     static constexpr uint32_t page_size = 128; // same as HHOM, for now, w/out using any heuristics. TODO: set based on avg batch size.
+    static constexpr uint32_t replay_concurrency = 16; // batches of a page replayed at the same time
 
     using clock_type = lowres_clock;
 
     size_t _total_batches_replayed = 0;
+    size_t _total_batches_failed = 0;
+    uint64_t _total_bytes_replayed = 0;
+    // Of the replay in progress.
+    std::experimental::optional<db_clock::time_point> _replay_started_at;
+    uint64_t _replay_bytes = 0;
     cql3::query_processor& _qp;
     timer<clock_type> _timer;
     seastar::gate _gate;
@@ -69,6 +83,7 @@ class batchlog_manager {
     std::random_device _rd;
     std::default_random_engine _e1;
 
+    future<bool> replay_batch(const cql3::untyped_result_set::row& row, lw_shared_ptr<utils::rate_limiter> limiter);
     future<> replay_all_failed_batches();
 public:
     // Takes a QP, not a distributes. Because this object is supposed
@@ -90,8 +105,23 @@ class batchlog_manager {
     size_t get_total_batches_replayed() const {
         return _total_batches_replayed;
     }
+    size_t get_total_batches_failed() const {
+        return _total_batches_failed;
+    }
+    uint64_t get_total_bytes_replayed() const {
+        return _total_bytes_replayed;
+    }
+    bool is_replaying() const {
+        return bool(_replay_started_at);
+    }
+    // In bytes per second, since the replay in progress started. 0 when
+    // not replaying.
+    double get_replay_rate() const;
     mutation get_batch_log_mutation_for(const std::vector<mutation>&, const utils::UUID&, int32_t);
     mutation get_batch_log_mutation_for(const std::vector<mutation>&, const utils::UUID&, int32_t, db_clock::time_point);
+    // For mutations already frozen for sending them to their replicas.
+    mutation get_batch_log_mutation_for(const std::vector<lw_shared_ptr<const frozen_mutation>>&, const utils::UUID&, int32_t);
+    mutation get_batch_log_mutation_for(const std::vector<lw_shared_ptr<const frozen_mutation>>&, const utils::UUID&, int32_t, db_clock::time_point);
     db_clock::duration get_batch_log_timeout() const;
 
     std::unordered_set<gms::inet_address> endpoint_filter(const sstring&, const std::unordered_map<sstring, std::unordered_set<gms::inet_address>>&);
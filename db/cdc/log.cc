@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "db/cdc/log.hh"
+#include "database.hh"
+#include "frozen_mutation.hh"
+#include "schema_builder.hh"
+#include "dht/i_partitioner.hh"
+#include "utils/UUID_gen.hh"
+
+namespace db {
+namespace cdc {
+
+sstring log_name(const sstring& table_name) {
+    return table_name + "_scylla_cdc_log";
+}
+
+schema_ptr make_log_schema(const schema& base) {
+    schema_builder b(base.ks_name(), log_name(base.cf_name()));
+    b.with_column("stream_id", int32_type, column_kind::partition_key);
+    b.with_column("bucket", timestamp_type, column_kind::partition_key);
+    b.with_column("time", timeuuid_type, column_kind::clustering_key);
+    // Time UUIDs are unique only to the shard which made them.
+    b.with_column("coordinator_shard", int32_type, column_kind::clustering_key);
+    // The partition key of the write, and the write itself, in the format
+    // of frozen_mutation.
+    b.with_column("key", bytes_type);
+    b.with_column("mutation", bytes_type);
+    b.set_comment(sprint("Change data capture log of %s.%s", base.ks_name(), base.cf_name()));
+    b.set_default_time_to_live(base.cdc_options().ttl());
+    return b.build();
+}
+
+std::vector<mutation> make_log_mutations(const database& db, const std::vector<mutation>& mutations) {
+    std::vector<mutation> log_mutations;
+    auto now = db_clock::now();
+    auto bucket = db_clock::time_point(std::chrono::duration_cast<db_clock::duration>(
+            std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()) / bucket_size.count() * bucket_size.count()));
+    auto ts = api::new_timestamp();
+    for (auto&& m : mutations) {
+        auto& base = *m.schema();
+        if (!base.cdc_options().enabled()) {
+            continue;
+        }
+        schema_ptr log;
+        try {
+            log = db.find_schema(base.ks_name(), log_name(base.cf_name()));
+        } catch (const no_such_column_family&) {
+            // Dropped along with the table.
+            continue;
+        }
+        auto ttl = base.cdc_options().ttl();
+        int32_t stream_id = dht::shard_of(m.token());
+        auto pk = partition_key::from_exploded(*log, {int32_type->decompose(stream_id), timestamp_type->decompose(bucket)});
+        auto ck = clustering_key::from_exploded(*log, {timeuuid_type->decompose(utils::UUID_gen::get_time_UUID()),
+                int32_type->decompose(int32_t(engine().cpu_id()))});
+        mutation lm(std::move(pk), log);
+        lm.set_clustered_cell(ck, "key", bytes(m.key().representation()), ts, ttl);
+        lm.set_clustered_cell(ck, "mutation", bytes(freeze(m).representation()), ts, ttl);
+        log_mutations.push_back(std::move(lm));
+    }
+    return log_mutations;
+}
+
+}
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "schema.hh"
+#include "mutation.hh"
+#include <vector>
+
+class database;
+
+namespace db {
+namespace cdc {
+
+/**
+ * The log table of a table with change data capture enabled holds a change
+ * record for each write to it, which is written along with it.
+ *
+ * The log is partitioned by stream and by time bucket. The changes of a
+ * partition of the table all go to the same stream, the one of the shard
+ * which owns the partition, so that streams 0 to the number of shards minus
+ * one hold all the changes, and a stream read bucket after bucket yields
+ * them in the order they were made. The records expire after the ttl of the
+ * table's cdc options, which keeps the log bounded.
+ */
+
+// The width of the time buckets.
+static constexpr std::chrono::seconds bucket_size{60};
+
+sstring log_name(const sstring& table_name);
+
+schema_ptr make_log_schema(const schema& base);
+
+// The change records of those of mutations which are written to tables with
+// change data capture enabled.
+std::vector<mutation> make_log_mutations(const database& db, const std::vector<mutation>& mutations);
+
+}
+}
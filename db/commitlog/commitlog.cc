@@ -56,12 +56,14 @@
 #include <core/gate.hh>
 #include <core/fstream.hh>
 #include <net/byteorder.hh>
+#include <lz4.h>
 
 #include "commitlog.hh"
 #include "db/config.hh"
 #include "utils/data_input.hh"
 #include "utils/crc.hh"
 #include "utils/runtime.hh"
+#include "utils/io_queue.hh"
 #include "log.hh"
 
 static logging::logger logger("commitlog");
@@ -87,11 +89,26 @@ class crc32_nbo {
     }
 };
 
+static bool parse_commitlog_compression(const sstring& name) {
+    if (name.empty()) {
+        return false;
+    }
+    if (name == "LZ4Compressor" || name == "org.apache.cassandra.io.compress.LZ4Compressor") {
+        return true;
+    }
+    throw std::invalid_argument("Unsupported commitlog_compression: " + name);
+}
+
 db::commitlog::config::config(const db::config& cfg)
     : commit_log_location(cfg.commitlog_directory())
     , commitlog_total_space_in_mb(cfg.commitlog_total_space_in_mb())
     , commitlog_segment_size_in_mb(cfg.commitlog_segment_size_in_mb())
-    , commitlog_sync_period_in_ms(cfg.commitlog_sync_batch_window_in_ms())
+    , commitlog_sync_period_in_ms(cfg.commitlog_sync_period_in_ms())
+    , commitlog_sync_batch_window_in_ms(cfg.commitlog_sync_batch_window_in_ms())
+    , commitlog_sync_batch_max_size_in_kb(cfg.commitlog_sync_batch_max_size_in_kb())
+    , buffer_pool_size_in_kb(cfg.commitlog_buffer_pool_size_in_kb())
+    , compression(parse_commitlog_compression(cfg.commitlog_compression()))
+    , max_pending_writes_in_kb(cfg.commitlog_max_pending_writes_in_kb())
     , mode(cfg.commitlog_sync() == "batch" ? sync_mode::BATCH : sync_mode::PERIODIC)
 {}
 
@@ -169,17 +186,33 @@ class db::commitlog::segment_manager {
         uint64_t bytes_slack = 0;
         uint64_t segments_created = 0;
         uint64_t segments_destroyed = 0;
+        uint64_t segments_recycled = 0;
         uint64_t pending_operations = 0;
         uint64_t total_size = 0;
         uint64_t buffer_list_bytes = 0;
+        uint64_t buffer_pool_hits = 0;
+        uint64_t buffer_pool_misses = 0;
         uint64_t total_size_on_disk = 0;
+        // Chunk payload bytes before and after compression, and the time
+        // spent compressing them.
+        uint64_t compression_bytes_in = 0;
+        uint64_t compression_bytes_out = 0;
+        uint64_t compression_time_ns = 0;
+        // Segment writes issued but not completed yet, and the writers
+        // made to wait for them.
+        uint64_t pending_write_bytes = 0;
+        uint64_t pending_write_stalls = 0;
+        uint64_t pending_write_stall_time_ns = 0;
     };
 
     stats totals;
+    utils::ihistogram batch_sizes;
+    utils::ihistogram batch_sync_latencies;
 
     segment_manager(config c)
             : cfg(c), max_size(
-                    std::min<size_t>(std::numeric_limits<position_type>::max(),
+                    // The top bit of a chunk's "next" position flags compressed chunks.
+                    std::min<size_t>(std::numeric_limits<position_type>::max() >> 1,
                             std::max<size_t>(cfg.commitlog_segment_size_in_mb,
                                     1) * 1024 * 1024)), max_mutation_size(
                     max_size >> 1), max_disk_size(
@@ -194,7 +227,9 @@ class db::commitlog::segment_manager {
         }
         logger.trace("Commitlog maximum disk size: {} MB / cpu ({} cpus)",
                 max_disk_size / (1024*1024), smp::count);
-        _regs = create_counters();
+        if (cfg.register_metrics) {
+            _regs = create_counters();
+        }
     }
 
     uint64_t next_id() {
@@ -205,6 +240,8 @@ class db::commitlog::segment_manager {
     future<sseg_ptr> new_segment();
     future<sseg_ptr> active_segment();
     future<sseg_ptr> allocate_segment(bool active);
+    void add_reserve_segment(sseg_ptr);
+    void recycle_segment(sseg_ptr);
 
     future<> clear();
     future<> sync_all_segments();
@@ -228,6 +265,14 @@ class db::commitlog::segment_manager {
     buffer_type acquire_buffer(size_t s);
     void release_buffer(buffer_type&&);
 
+    // Resolves once the segment writes in flight are below
+    // cfg.max_pending_writes_in_kb.
+    future<> wait_for_pending_writes();
+    void begin_write(size_t size) {
+        totals.pending_write_bytes += size;
+    }
+    void end_write(size_t size);
+
     future<std::vector<descriptor>> list_descriptors(sstring dir);
 
     flush_handler_id add_flush_handler(flush_handler h) {
@@ -245,12 +290,16 @@ class db::commitlog::segment_manager {
     segment_id_type _ids = 0;
     std::vector<sseg_ptr> _segments;
     std::deque<sseg_ptr> _reserve_segments;
+    // Write buffers released by segments, by increasing size, kept for
+    // reuse up to cfg.buffer_pool_size_in_kb.
     std::vector<buffer_type> _temp_buffers;
     std::unordered_map<flush_handler_id, flush_handler> _flush_handlers;
     flush_handler_id _flush_ids = 0;
     replay_position _flush_position;
     timer<clock_type> _timer;
     size_t _reserve_allocating = 0;
+    // # discarded segments being turned into reserve ones.
+    size_t _reserve_recycling = 0;
     // # segments to try to keep available in reserve
     // i.e. the amount of segments we expect to consume inbetween timer
     // callbacks.
@@ -259,6 +308,7 @@ class db::commitlog::segment_manager {
     size_t _num_reserve_segments = 0;
     seastar::gate _gate;
     uint64_t _new_counter = 0;
+    std::vector<promise<>> _pending_write_waiters;
 };
 
 /*
@@ -273,10 +323,17 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     descriptor _desc;
     file _file;
 
+    // Replay positions are in the uncompressed ("logical") space of the
+    // segment, _pos, which is the same as the file offset, _file_pos,
+    // unless the chunks are compressed.
+    uint64_t _pos = 0;
     uint64_t _file_pos = 0;
     uint64_t _flush_pos = 0;
     uint64_t _buf_pos = 0;
     bool _closed = false;
+    // Set when the file was handed over to a new segment, and must not
+    // be deleted with this one.
+    bool _recycled = false;
 
     using buffer_type = segment_manager::buffer_type;
     using sseg_ptr = segment_manager::sseg_ptr;
@@ -288,6 +345,11 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     std::unordered_map<cf_id_type, position_type> _cf_dirty;
     time_point _sync_time;
     seastar::gate _gate;
+    // BATCH mode: writers waiting for the next flush, the amount they
+    // wrote and the timer closing their batch.
+    std::vector<promise<>> _batch_waiters;
+    size_t _batch_bytes = 0;
+    timer<clock_type> _batch_timer;
 
     friend std::ostream& operator<<(std::ostream&, const segment&);
     friend class segment_manager;
@@ -301,6 +363,10 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     static constexpr size_t entry_overhead_size = 3 * sizeof(uint32_t);
     static constexpr size_t segment_overhead_size = 2 * sizeof(uint32_t);
     static constexpr size_t descriptor_header_size = 4 * sizeof(uint32_t);
+    // A compressed chunk header adds (int: logical position of the payload + int: uncompressed
+    // length + int: compressed length) to the regular one, and flags the next position.
+    static constexpr size_t compressed_segment_overhead_size = 5 * sizeof(uint32_t);
+    static constexpr uint32_t compressed_chunk_flag = 0x80000000;
 
     // The commit log (chained) sync marker/header size in bytes (int: length + int: checksum [segmentId, position])
     static constexpr size_t sync_marker_size = 2 * sizeof(uint32_t);
@@ -311,28 +377,30 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
 
     segment(segment_manager* m, const descriptor& d, file && f, bool active)
             : _segment_manager(m), _desc(std::move(d)), _file(std::move(f)), _sync_time(
-                    clock_type::now())
+                    clock_type::now()), _batch_timer([this] {
+                        // failures are logged by flush() and reported to the writers.
+                        sync_batch().handle_exception([](auto ep) {});
+                    })
     {
         ++_segment_manager->totals.segments_created;
         logger.debug("Created new {} segment {}", active ? "active" : "reserve", *this);
     }
     ~segment() {
         if (is_clean()) {
-            logger.debug("Segment {} is no longer active and will be deleted now", *this);
-            ++_segment_manager->totals.segments_destroyed;
             _segment_manager->totals.total_size_on_disk -= size_on_disk();
             _segment_manager->totals.total_size -= (size_on_disk() + _buffer.size());
-            ::unlink(
-                    (_segment_manager->cfg.commit_log_location + "/" + _desc.filename()).c_str());
+            if (!_recycled) {
+                logger.debug("Segment {} is no longer active and will be deleted now", *this);
+                ++_segment_manager->totals.segments_destroyed;
+                ::unlink(
+                        (_segment_manager->cfg.commit_log_location + "/" + _desc.filename()).c_str());
+            }
         } else {
             logger.warn("Segment {} is dirty and is left on disk.", *this);
         }
     }
 
     bool must_sync() {
-        if (_segment_manager->cfg.mode == sync_mode::BATCH) {
-            return true;
-        }
         auto now = clock_type::now();
         auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
                 now - _sync_time).count();
@@ -347,7 +415,7 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
      */
     future<sseg_ptr> finish_and_get_new() {
         _closed = true;
-        sync();
+        sync_batch();
         return _segment_manager->active_segment();
     }
     void reset_sync_time() {
@@ -366,13 +434,62 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
             return seg->flush();
         });
     }
+    /**
+     * Joins the current batch of writes, which will be acknowledged together
+     * by a single flush once the batch window closes or the batch gets big.
+     */
+    future<> add_to_batch(size_t size) {
+        _batch_waiters.emplace_back();
+        auto f = _batch_waiters.back().get_future();
+        _batch_bytes += size;
+        auto& cfg = _segment_manager->cfg;
+        if (cfg.commitlog_sync_batch_window_in_ms == 0
+                || _batch_bytes >= cfg.commitlog_sync_batch_max_size_in_kb * 1024) {
+            sync_batch();
+        } else if (!_batch_timer.armed()) {
+            _batch_timer.arm(std::chrono::milliseconds(cfg.commitlog_sync_batch_window_in_ms));
+        }
+        return f;
+    }
+    /**
+     * Syncs, and acknowledges the writes of the current batch, if any.
+     */
+    future<sseg_ptr> sync_batch() {
+        _batch_timer.cancel();
+        if (_batch_waiters.empty()) {
+            return sync();
+        }
+        auto waiters = std::move(_batch_waiters);
+        _batch_waiters.clear();
+        _batch_bytes = 0;
+        auto sm = _segment_manager;
+        sm->batch_sizes.mark(waiters.size());
+        utils::latency_counter lc;
+        lc.start();
+        return sync().then_wrapped([sm, waiters = std::move(waiters), lc](future<sseg_ptr> f) mutable {
+            sm->batch_sync_latencies.mark(lc);
+            try {
+                auto me = std::get<0>(f.get());
+                for (auto& w : waiters) {
+                    w.set_value();
+                }
+                return me;
+            } catch (...) {
+                auto ep = std::current_exception();
+                for (auto& w : waiters) {
+                    w.set_exception(ep);
+                }
+                throw;
+            }
+        });
+    }
     future<> shutdown() {
         return _gate.close();
     }
     future<sseg_ptr> flush(uint64_t pos = 0) {
         auto me = shared_from_this();
         if (pos == 0) {
-            pos = _file_pos;
+            pos = _pos;
         }
         if (pos != 0 && pos <= _flush_pos) {
             logger.trace("{} already synced! ({} < {})", *this, pos, _flush_pos);
@@ -385,7 +502,7 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
         return _dwrite.write_lock().then(
                 [this, me = std::move(me), pos]() mutable {
                     _dwrite.write_unlock(); // release it already.
-                    pos = std::max(pos, _file_pos);
+                    pos = std::max(pos, _pos);
                     if (pos <= _flush_pos) {
                         logger.trace("{} already synced! ({} < {})", *this, pos, _flush_pos);
                         return make_ready_future<sseg_ptr>(std::move(me));
@@ -413,6 +530,34 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
                             });
                 });
     }
+    /**
+     * Replaces the entries of a chunk buffer with their LZ4 compressed form,
+     * leaving zeroed header space in front of them. Entries which don't
+     * compress are left as they are (compressed length == uncompressed length).
+     * Returns the uncompressed and the compressed lengths of the entries.
+     */
+    std::pair<uint32_t, uint32_t> compress_chunk(buffer_type& buf, size_t header_size) {
+        auto start = header_size + compressed_segment_overhead_size;
+        uint32_t ulen = _buf_pos - start;
+        uint32_t clen = ulen;
+
+        auto t = std::chrono::steady_clock::now();
+        auto out = _segment_manager->acquire_buffer(align_up(start + LZ4_COMPRESSBOUND(ulen), alignment));
+        auto ret = LZ4_compress(buf.get() + start, out.get_write() + start, ulen);
+        if (ret > 0 && uint32_t(ret) < ulen) {
+            clen = ret;
+            std::fill(out.get_write(), out.get_write() + start, 0);
+            std::fill(out.get_write() + start + clen, out.get_write() + align_up(start + clen, alignment), 0);
+            std::swap(buf, out);
+        }
+        _segment_manager->release_buffer(std::move(out));
+
+        auto& totals = _segment_manager->totals;
+        totals.compression_bytes_in += ulen;
+        totals.compression_bytes_out += clen;
+        totals.compression_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t).count();
+        return { ulen, clen };
+    }
     /**
      * Send any buffer contents to disk and get a new tmp buffer
      */
@@ -420,14 +565,21 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
         auto size = clear_buffer_slack();
         auto buf = std::move(_buffer);
         auto off = _file_pos;
-
+        auto logical = _pos;
+        auto compressed = _segment_manager->cfg.compression;
+        uint32_t ulen = 0, clen = 0;
+
+        _pos += size;
+        if (size > 0 && compressed) {
+            std::tie(ulen, clen) = compress_chunk(buf, off == 0 ? descriptor_header_size : 0);
+            size = align_up((off == 0 ? descriptor_header_size : 0) + compressed_segment_overhead_size + clen, alignment);
+        }
         _file_pos += size;
         _buf_pos = 0;
 
         // if we need new buffer, get one.
-        // TODO: keep a queue of available buffers?
         if (s > 0) {
-            auto overhead = segment_overhead_size;
+            auto overhead = compressed ? compressed_segment_overhead_size : segment_overhead_size;
             if (_file_pos == 0) {
                 overhead += descriptor_header_size;
             }
@@ -450,9 +602,8 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
                 }
             }
             _buf_pos = overhead;
-            auto * p = reinterpret_cast<uint32_t *>(_buffer.get_write());
-            std::fill(p, p + overhead, 0);
-            _segment_manager->totals.total_size += k;
+            std::fill(_buffer.get_write(), _buffer.get_write() + overhead, 0);
+            _segment_manager->totals.total_size += _buffer.size();
         }
         auto me = shared_from_this();
         if (size == 0) {
@@ -460,7 +611,7 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
         }
 
         auto * p = buf.get_write();
-        assert(std::count(p, p + 2 * sizeof(uint32_t), 0) == 2 * sizeof(uint32_t));
+        assert(std::count(p, p + segment_overhead_size, 0) == segment_overhead_size);
 
         data_output out(p, p + buf.size());
 
@@ -484,16 +635,31 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
         crc.process<int32_t>(_desc.id >> 32);
         crc.process(uint32_t(off + header_size));
 
-        out.write(uint32_t(_file_pos));
-        out.write(crc.checksum());
+        if (compressed) {
+            auto payload = uint32_t(logical + header_size + compressed_segment_overhead_size);
+            crc.process(payload);
+            crc.process(ulen);
+            crc.process(clen);
+            out.write(uint32_t(_file_pos) | compressed_chunk_flag);
+            out.write(crc.checksum());
+            out.write(payload);
+            out.write(ulen);
+            out.write(clen);
+        } else {
+            out.write(uint32_t(_file_pos));
+            out.write(crc.checksum());
+        }
 
         // acquire read lock
+        _segment_manager->begin_write(size);
         return _dwrite.read_lock().then([this, size, off, buf = std::move(buf), me]() mutable {
             ++_segment_manager->totals.pending_operations;
             auto written = make_lw_shared<size_t>(0);
             auto p = buf.get();
             return repeat([this, size, off, written, p]() mutable {
-                return _file.dma_write(off + *written, p + *written, size - *written).then_wrapped([this, size, written](auto&& f) {
+                return local_io_queue().queue_request(commitlog_priority(), size - *written, [this, size, off, written, p] {
+                    return _file.dma_write(off + *written, p + *written, size - *written);
+                }).then_wrapped([this, size, written](auto&& f) {
                     try {
                         auto bytes = std::get<0>(f.get());
                         *written += bytes;
@@ -520,9 +686,10 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
             });
         }).then([me] {
             return make_ready_future<sseg_ptr>(std::move(me));
-        }).finally([me, this]() {
+        }).finally([me, this, size]() {
             --_segment_manager->totals.pending_operations;
             _dwrite.read_unlock(); // release
+            _segment_manager->end_write(size);
         });
     }
 
@@ -550,8 +717,8 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
             }
             // enough data?
             if (s > (_buffer.size() - _buf_pos)) {
-                // TODO: iff we have to many writes running, maybe we should
-                // wait for this?
+                // Writers are held back in commitlog::add() if too many
+                // writes are running.
                 cycle(s);
                 continue; // re-check file size overflow
             }
@@ -588,6 +755,11 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
         _gate.leave();
 
         // finally, check if we're required to sync.
+        if (_segment_manager->cfg.mode == sync_mode::BATCH) {
+            return add_to_batch(s).then([rp] {
+                return make_ready_future<replay_position>(rp);
+            });
+        }
         if (must_sync()) {
             return sync().then([rp](auto seg) {
                 return make_ready_future<replay_position>(rp);
@@ -598,7 +770,7 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     }
 
     position_type position() const {
-        return position_type(_file_pos + _buf_pos);
+        return position_type(_pos + _buf_pos);
     }
 
     size_t size_on_disk() const {
@@ -745,6 +917,10 @@ scollectd::registrations db::commitlog::segment_manager::create_counters() {
                                     });
                         })
         ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_operations", "segments_recycled")
+                , make_typed(data_type::DERIVE, totals.segments_recycled)
+        ),
         add_polled_metric(type_instance_id("commitlog"
                         , per_cpu_plugin_instance, "total_operations", "alloc")
                 , make_typed(data_type::DERIVE, totals.allocation_count)
@@ -766,11 +942,41 @@ scollectd::registrations db::commitlog::segment_manager::create_counters() {
                         , per_cpu_plugin_instance, "total_bytes", "slack")
                 , make_typed(data_type::DERIVE, totals.bytes_slack)
         ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_bytes", "compression_in")
+                , make_typed(data_type::DERIVE, totals.compression_bytes_in)
+        ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_bytes", "compression_out")
+                , make_typed(data_type::DERIVE, totals.compression_bytes_out)
+        ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_time_in_ms", "compression")
+                , make_typed(data_type::DERIVE, [this] { return totals.compression_time_ns / 1000000; })
+        ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "ratio", "compression")
+                , make_typed(data_type::GAUGE, [this] {
+                            return totals.compression_bytes_in ? double(totals.compression_bytes_out) / totals.compression_bytes_in : 1.0;
+                        })
+        ),
 
         add_polled_metric(type_instance_id("commitlog"
                         , per_cpu_plugin_instance, "queue_length", "pending_operations")
                 , make_typed(data_type::GAUGE, totals.pending_operations)
         ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "memory", "pending_write_bytes")
+                , make_typed(data_type::GAUGE, totals.pending_write_bytes)
+        ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_operations", "pending_write_stalls")
+                , make_typed(data_type::DERIVE, totals.pending_write_stalls)
+        ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_time_in_ms", "pending_write_stall")
+                , make_typed(data_type::DERIVE, [this] { return totals.pending_write_stall_time_ns / 1000000; })
+        ),
         add_polled_metric(type_instance_id("commitlog"
                         , per_cpu_plugin_instance, "memory", "total_size")
                 , make_typed(data_type::GAUGE, totals.total_size)
@@ -779,6 +985,14 @@ scollectd::registrations db::commitlog::segment_manager::create_counters() {
                         , per_cpu_plugin_instance, "memory", "buffer_list_bytes")
                 , make_typed(data_type::GAUGE, totals.buffer_list_bytes)
         ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_operations", "buffer_pool_hits")
+                , make_typed(data_type::DERIVE, totals.buffer_pool_hits)
+        ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_operations", "buffer_pool_misses")
+                , make_typed(data_type::DERIVE, totals.buffer_pool_misses)
+        ),
     };
 }
 
@@ -824,14 +1038,76 @@ void db::commitlog::segment_manager::flush_segments(bool force) {
 future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager::allocate_segment(bool active) {
     descriptor d(next_id());
     return engine().open_file_dma(cfg.commit_log_location + "/" + d.filename(), open_flags::wo | open_flags::create).then([this, d, active](file f) {
-        // xfs doesn't like files extended betond eof, so enlarge the file
-        return f.truncate(max_size).then([this, d, active, f] () mutable {
+        // Allocate the extents up front, so that writes don't have to
+        // (xfs doesn't like files extended betond eof either).
+        return f.allocate(0, max_size).then([f] () mutable {
+            return f.truncate(max_size);
+        }).then([this, d, active, f] () mutable {
             auto s = make_lw_shared<segment>(this, d, std::move(f), active);
             return make_ready_future<sseg_ptr>(s);
         });
     });
 }
 
+void db::commitlog::segment_manager::add_reserve_segment(sseg_ptr s) {
+    // insertion sort.
+    auto i = std::upper_bound(_reserve_segments.begin(), _reserve_segments.end(), s, [](auto s1, auto s2) {
+        const descriptor& d1 = s1->_desc;
+        const descriptor& d2 = s2->_desc;
+        return d1.id < d2.id;
+    });
+    i = _reserve_segments.emplace(i, std::move(s));
+    logger.trace("Added reserve segment {}", *i);
+}
+
+/**
+ * Turns the file of a discarded segment into a reserve segment, by
+ * renaming it rather than deleting it and creating a new one.
+ * Its first block is zeroed, so that until it is written it reads as
+ * a pre-allocated file; beyond what the new segment writes, the old
+ * chunks are ignored by readers as they belong to another segment id.
+ */
+void db::commitlog::segment_manager::recycle_segment(sseg_ptr s) {
+    ++_reserve_recycling;
+    // As far as its users are concerned, the segment is gone already.
+    ++totals.segments_destroyed;
+    s->_recycled = true;
+    descriptor d(next_id());
+    auto from = cfg.commit_log_location + "/" + s->_desc.filename();
+    auto to = cfg.commit_log_location + "/" + d.filename();
+    seastar::with_gate(_gate, [this, s, d, from, to] {
+        // Let in-flight writes to the old segment land before reusing it.
+        return s->_dwrite.write_lock().then([this, s] {
+            s->_dwrite.write_unlock();
+            auto buf = make_lw_shared<buffer_type>(acquire_buffer(segment::alignment));
+            std::fill(buf->get_write(), buf->get_write() + segment::alignment, 0);
+            return local_io_queue().queue_request(commitlog_priority(), segment::alignment, [s, buf] {
+                return s->_file.dma_write(0, buf->get(), segment::alignment);
+            }).then([this, s](size_t) {
+                return s->_file.flush();
+            }).finally([this, buf] {
+                release_buffer(std::move(*buf));
+            });
+        }).then([from, to] {
+            return engine().rename_file(from, to);
+        }).then([this, s, d] {
+            auto ns = make_lw_shared<segment>(this, d, file(s->_file), false);
+            ++totals.segments_recycled;
+            if (_shutdown) {
+                ns->mark_clean();
+            } else {
+                add_reserve_segment(std::move(ns));
+            }
+        });
+    }).handle_exception([this, s, from, to](auto ep) {
+        logger.warn("Could not recycle segment {}: {}", from, ep);
+        ::unlink(from.c_str());
+        ::unlink(to.c_str());
+    }).finally([this, s] {
+        --_reserve_recycling;
+    });
+}
+
 future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager::new_segment() {
     if (_shutdown) {
         throw std::runtime_error("Commitlog has been shut down. Cannot add data");
@@ -910,6 +1186,11 @@ void db::commitlog::segment_manager::discard_unused_segments() {
         return false;
     });
     if (i != _segments.end()) {
+        for (auto j = i; j != _segments.end(); ++j) {
+            if (!_shutdown && _reserve_segments.size() + _reserve_allocating + _reserve_recycling < _num_reserve_segments) {
+                recycle_segment(*j);
+            }
+        }
         _segments.erase(i, _segments.end());
     }
 }
@@ -917,7 +1198,7 @@ void db::commitlog::segment_manager::discard_unused_segments() {
 future<> db::commitlog::segment_manager::sync_all_segments() {
     logger.debug("Issuing sync for all segments");
     return parallel_for_each(_segments, [this](sseg_ptr s) {
-        return s->sync().then([](sseg_ptr s) {
+        return s->sync_batch().then([](sseg_ptr s) {
             logger.debug("Synced segment {}", *s);
         });
     });
@@ -985,19 +1266,12 @@ void db::commitlog::segment_manager::on_timer() {
         // take outstanding allocations into regard. This is paranoid,
         // but if for some reason the file::open takes longer than timer period,
         // we could flood the reserve list with new segments
-        auto n = _reserve_segments.size() + _reserve_allocating;
+        auto n = _reserve_segments.size() + _reserve_allocating + _reserve_recycling;
         return parallel_for_each(boost::irange(n, _num_reserve_segments), [this, n](auto i) {
             ++_reserve_allocating;
             return this->allocate_segment(false).then([this](sseg_ptr s) {
                 if (!_shutdown) {
-                    // insertion sort.
-                    auto i = std::upper_bound(_reserve_segments.begin(), _reserve_segments.end(), s, [](auto s1, auto s2) {
-                        const descriptor& d1 = s1->_desc;
-                        const descriptor& d2 = s2->_desc;
-                        return d1.id < d2.id;
-                    });
-                    i = _reserve_segments.emplace(i, std::move(s));
-                    logger.trace("Added reserve segment {}", *i);
+                    add_reserve_segment(std::move(s));
                 }
             }).finally([this] {
                 --_reserve_allocating;
@@ -1021,18 +1295,18 @@ std::vector<sstring> db::commitlog::segment_manager::get_active_names() const {
 }
 
 db::commitlog::segment_manager::buffer_type db::commitlog::segment_manager::acquire_buffer(size_t s) {
-    auto i = _temp_buffers.begin();
-    auto e = _temp_buffers.end();
-
-    while (i != e) {
-        if (i->size() >= s) {
-            auto r = std::move(*i);
-            _temp_buffers.erase(i);
-            totals.buffer_list_bytes -= r.size();
-            return r;
-        }
-        ++i;
+    // The smallest buffer that fits.
+    auto i = std::lower_bound(_temp_buffers.begin(), _temp_buffers.end(), s, [](const buffer_type& b, size_t s) {
+        return b.size() < s;
+    });
+    if (i != _temp_buffers.end()) {
+        auto r = std::move(*i);
+        _temp_buffers.erase(i);
+        totals.buffer_list_bytes -= r.size();
+        ++totals.buffer_pool_hits;
+        return r;
     }
+    ++totals.buffer_pool_misses;
     auto a = ::memalign(segment::alignment, s);
     if (a == nullptr) {
         throw std::bad_alloc();
@@ -1042,19 +1316,50 @@ db::commitlog::segment_manager::buffer_type db::commitlog::segment_manager::acqu
 }
 
 void db::commitlog::segment_manager::release_buffer(buffer_type&& b) {
-    _temp_buffers.emplace_back(std::move(b));
-    std::sort(_temp_buffers.begin(), _temp_buffers.end(), [](const buffer_type& b1, const buffer_type& b2) {
-        return b1.size() < b2.size();
+    // Small buffers, like the ones zeroing recycled segment headers, are
+    // no use to segments.
+    if (b.size() < segment::default_size) {
+        return;
+    }
+    auto i = std::upper_bound(_temp_buffers.begin(), _temp_buffers.end(), b.size(), [](size_t s, const buffer_type& b) {
+        return s < b.size();
     });
+    totals.buffer_list_bytes += b.size();
+    _temp_buffers.emplace(i, std::move(b));
+
+    // Over the cap, drop the largest buffers first: they are the ones
+    // allocated for unusually large mutations.
+    auto max_bytes = cfg.buffer_pool_size_in_kb * 1024;
+    while (totals.buffer_list_bytes > max_bytes) {
+        logger.trace("Deleting {} k buffer", _temp_buffers.back().size() / 1024);
+        totals.buffer_list_bytes -= _temp_buffers.back().size();
+        _temp_buffers.pop_back();
+    }
+}
 
-    constexpr const size_t max_temp_buffers = 4;
+future<> db::commitlog::segment_manager::wait_for_pending_writes() {
+    auto max = cfg.max_pending_writes_in_kb * 1024;
+    if (max == 0 || totals.pending_write_bytes < max) {
+        return make_ready_future<>();
+    }
+    ++totals.pending_write_stalls;
+    logger.debug("Write blocked: {} bytes of segment writes pending", totals.pending_write_bytes);
+    _pending_write_waiters.emplace_back();
+    auto start = std::chrono::steady_clock::now();
+    return _pending_write_waiters.back().get_future().then([this, start] {
+        totals.pending_write_stall_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    });
+}
 
-    if (_temp_buffers.size() > max_temp_buffers) {
-        logger.trace("Deleting {} buffers", _temp_buffers.size() - max_temp_buffers);
-        _temp_buffers.erase(_temp_buffers.begin() + max_temp_buffers, _temp_buffers.end());
+void db::commitlog::segment_manager::end_write(size_t size) {
+    totals.pending_write_bytes -= size;
+    if (_pending_write_waiters.empty() || totals.pending_write_bytes >= cfg.max_pending_writes_in_kb * 1024) {
+        return;
+    }
+    auto waiters = std::exchange(_pending_write_waiters, {});
+    for (auto& w : waiters) {
+        w.set_value();
     }
-    totals.buffer_list_bytes = std::accumulate(_temp_buffers.begin(),
-            _temp_buffers.end(), size_t(0), std::plus<size_t>());
 }
 
 /**
@@ -1062,8 +1367,10 @@ void db::commitlog::segment_manager::release_buffer(buffer_type&& b) {
  */
 future<db::replay_position> db::commitlog::add(const cf_id_type& id,
         size_t size, serializer_func func) {
-    return _segment_manager->active_segment().then([=](auto s) {
-        return s->allocate(id, size, std::move(func));
+    return _segment_manager->wait_for_pending_writes().then([this, id, size, func = std::move(func)]() mutable {
+        return _segment_manager->active_segment().then([id, size, func = std::move(func)](auto s) {
+            return s->allocate(id, size, std::move(func));
+        });
     });
 }
 
@@ -1166,6 +1473,11 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
         size_t next = 0;
         size_t start_off = 0;
         size_t skip_to = 0;
+        // The entries of the current compressed chunk and the logical
+        // position of each of them.
+        temporary_buffer<char> chunk;
+        size_t chunk_pos = 0;
+        size_t chunk_logical = 0;
         bool eof = false;
         bool header = true;
 
@@ -1259,7 +1571,16 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
 
                 auto cs = crc.checksum();
                 if (cs != checksum) {
-                    throw std::runtime_error("Checksum error in chunk header");
+                    // A chunk left over from the previous use of a recycled
+                    // segment file: its checksum is that of another segment
+                    // id. This means eof too.
+                    logger.debug("Chunk header at {} does not belong to segment {}, assuming end of segment", start, id);
+                    return stop();
+                }
+
+                if (next & segment::compressed_chunk_flag) {
+                    this->next = next & ~segment::compressed_chunk_flag;
+                    return read_compressed_chunk(std::move(crc), checksum);
                 }
 
                 this->next = next;
@@ -1271,6 +1592,98 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
                 return do_until(std::bind(&work::end_of_chunk, this), std::bind(&work::read_entry, this));
             });
         }
+        future<> read_compressed_chunk(crc32_nbo crc, uint32_t checksum) {
+            static constexpr size_t extra_header_size = segment::compressed_segment_overhead_size - segment::segment_overhead_size;
+            return fin.read_exactly(extra_header_size).then([this, crc, checksum](temporary_buffer<char> buf) mutable {
+                if (!advance(buf)) {
+                    return make_ready_future<>();
+                }
+
+                data_input in(buf);
+                auto logical = in.read<uint32_t>();
+                auto ulen = in.read<uint32_t>();
+                auto clen = in.read<uint32_t>();
+
+                crc.process(logical);
+                crc.process(ulen);
+                crc.process(clen);
+
+                if (crc.checksum() != checksum) {
+                    logger.debug("Chunk header at {} does not belong to segment {}, assuming end of segment", pos - segment::compressed_segment_overhead_size, id);
+                    return stop();
+                }
+                if (clen > ulen || pos + clen > next) {
+                    throw std::runtime_error("Invalid compressed chunk size");
+                }
+                if (start_off >= logical + ulen) {
+                    return skip(next - pos);
+                }
+
+                return fin.read_exactly(clen).then([this, logical, ulen, clen](temporary_buffer<char> buf) {
+                    if (!advance(buf)) {
+                        return make_ready_future<>();
+                    }
+                    if (clen == ulen) {
+                        chunk = std::move(buf);
+                    } else {
+                        chunk = temporary_buffer<char>(ulen);
+                        auto ret = LZ4_decompress_safe(buf.get(), chunk.get_write(), clen, ulen);
+                        if (ret < 0 || uint32_t(ret) != ulen) {
+                            throw std::runtime_error("Corrupt compressed chunk");
+                        }
+                    }
+                    chunk_pos = 0;
+                    chunk_logical = logical;
+                    return do_until([this] { return chunk_pos == chunk.size(); }, std::bind(&work::read_compressed_entry, this)).then([this] {
+                        chunk = temporary_buffer<char>();
+                        return skip(next - pos);
+                    });
+                });
+            });
+        }
+        future<> read_compressed_entry() {
+            replay_position rp(id, position_type(chunk_logical + chunk_pos));
+
+            if (chunk.size() - chunk_pos < segment::entry_overhead_size) {
+                throw std::runtime_error("Invalid entry size");
+            }
+
+            auto entry = chunk.share(chunk_pos, chunk.size() - chunk_pos);
+            data_input in(entry);
+
+            auto size = in.read<uint32_t>();
+            auto checksum = in.read<uint32_t>();
+
+            if (size < segment::entry_overhead_size || size > chunk.size() - chunk_pos) {
+                throw std::runtime_error("Invalid entry size");
+            }
+
+            auto start = chunk_pos;
+            chunk_pos += size;
+
+            crc32_nbo crc;
+            crc.process(size);
+            if (crc.checksum() != checksum) {
+                throw std::runtime_error("Checksum error in data entry");
+            }
+
+            if (start_off > rp.pos) {
+                return make_ready_future<>();
+            }
+
+            auto data_size = size - segment::entry_overhead_size;
+            auto data = start + 2 * sizeof(uint32_t);
+            in.skip(data_size);
+            auto tail_checksum = in.read<uint32_t>();
+
+            crc.process_bytes(chunk.get() + data, data_size);
+
+            if (crc.checksum() != tail_checksum) {
+                throw std::runtime_error("Checksum error in data entry");
+            }
+
+            return s.produce(chunk.share(data, data_size), rp);
+        }
         future<> read_entry() {
             static constexpr size_t entry_header_size = segment::entry_overhead_size - sizeof(uint32_t);
             return fin.read_exactly(entry_header_size).then([this](temporary_buffer<char> buf) {
@@ -1348,6 +1761,14 @@ uint64_t db::commitlog::get_total_size() const {
     return _segment_manager->totals.total_size;
 }
 
+const utils::ihistogram& db::commitlog::get_batch_size_histogram() const {
+    return _segment_manager->batch_sizes;
+}
+
+const utils::ihistogram& db::commitlog::get_batch_sync_latency_histogram() const {
+    return _segment_manager->batch_sync_latencies;
+}
+
 uint64_t db::commitlog::get_completed_tasks() const {
     return _segment_manager->totals.allocation_count;
 }
@@ -1360,10 +1781,46 @@ uint64_t db::commitlog::get_num_segments_created() const {
     return _segment_manager->totals.segments_created;
 }
 
+uint64_t db::commitlog::get_buffer_pool_hits() const {
+    return _segment_manager->totals.buffer_pool_hits;
+}
+
+uint64_t db::commitlog::get_buffer_pool_misses() const {
+    return _segment_manager->totals.buffer_pool_misses;
+}
+
+uint64_t db::commitlog::get_compression_bytes_in() const {
+    return _segment_manager->totals.compression_bytes_in;
+}
+
+uint64_t db::commitlog::get_compression_bytes_out() const {
+    return _segment_manager->totals.compression_bytes_out;
+}
+
+uint64_t db::commitlog::get_pending_write_stalls() const {
+    return _segment_manager->totals.pending_write_stalls;
+}
+
+uint64_t db::commitlog::get_pending_write_stall_time() const {
+    return _segment_manager->totals.pending_write_stall_time_ns;
+}
+
+uint64_t db::commitlog::get_num_segments_recycled() const {
+    return _segment_manager->totals.segments_recycled;
+}
+
 uint64_t db::commitlog::get_num_segments_destroyed() const {
     return _segment_manager->totals.segments_destroyed;
 }
 
+uint64_t db::commitlog::get_flush_count() const {
+    return _segment_manager->totals.flush_count;
+}
+
+uint64_t db::commitlog::get_bytes_written() const {
+    return _segment_manager->totals.bytes_written;
+}
+
 future<std::vector<db::commitlog::descriptor>> db::commitlog::list_existing_descriptors() const {
     return list_existing_descriptors(active_config().commit_log_location);
 }
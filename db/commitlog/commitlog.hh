@@ -47,6 +47,7 @@
 #include "core/shared_ptr.hh"
 #include "core/stream.hh"
 #include "utils/UUID.hh"
+#include "utils/histogram.hh"
 #include "replay_position.hh"
 
 class file;
@@ -71,8 +72,11 @@ using cf_id_type = utils::UUID;
  * periodically (or always), ensuring all data is written + writes are
  * complete.
  *
- * In BATCH mode, every write to the log will also send the data to disk
- * + issue a flush and wait for both to complete.
+ * In BATCH mode, every write to the log waits for its data to be sent to
+ * disk and flushed. Writes to a segment are grouped: the first write of a
+ * batch starts a window of commitlog_sync_batch_window_in_ms (or until
+ * commitlog_sync_batch_max_size_in_kb were written), after which a single
+ * flush acknowledges all the writes of the batch.
  *
  * In PERIODIC mode, most writes will only add to the internal memory
  * buffers. If the mem buffer is saturated, data is sent to disk, but we
@@ -84,6 +88,10 @@ using cf_id_type = utils::UUID;
  * (due to the above). The actual order in the commitlog is however
  * identified by the replay_position returned.
  *
+ * Segment files are pre-allocated, a few of them are kept in reserve for
+ * the segment switches, and the files of discarded segments are renamed
+ * and reused for reserve segments rather than deleted.
+ *
  * Like the stock cl, the log segments keep track of the highest dirty
  * (added) internal position for a given table id (cf_id_type / UUID).
  * Code should ensure to use discard_completed_segments with UUID +
@@ -111,9 +119,22 @@ class commitlog {
         uint64_t commitlog_total_space_in_mb = 0;
         uint64_t commitlog_segment_size_in_mb = 32;
         uint64_t commitlog_sync_period_in_ms = 10 * 1000; //TODO: verify default!
+        // BATCH mode only.
+        uint64_t commitlog_sync_batch_window_in_ms = 2;
+        uint64_t commitlog_sync_batch_max_size_in_kb = 1024;
+        // Cap on the segment write buffers kept, per shard, for reuse.
+        uint64_t buffer_pool_size_in_kb = 1024;
+        // LZ4 compress the segment chunks.
+        bool compression = false;
+        // Cap on the segment writes in flight, per shard. New writes wait
+        // for some of them to complete beyond it. 0 means no limit.
+        uint64_t max_pending_writes_in_kb = 8 * 1024;
         // Max number of segments to keep in pre-alloc reserve.
         // Not (yet) configurable from scylla.conf.
         uint64_t max_reserve_segments = 12;
+        // Register the per shard collectd counters. Only one commitlog
+        // per shard can do so.
+        bool register_metrics = true;
 
         sync_mode mode = sync_mode::PERIODIC;
     };
@@ -234,6 +255,25 @@ class commitlog {
     uint64_t get_pending_tasks() const;
     uint64_t get_num_segments_created() const;
     uint64_t get_num_segments_destroyed() const;
+    // Discarded segments whose file was reused for a new segment.
+    uint64_t get_num_segments_recycled() const;
+    // Flushes (fsyncs) of segment files, and bytes written to them.
+    uint64_t get_flush_count() const;
+    uint64_t get_bytes_written() const;
+    // Segment write buffers reused from the pool, or allocated.
+    uint64_t get_buffer_pool_hits() const;
+    uint64_t get_buffer_pool_misses() const;
+    // Chunk payload bytes given to, and produced by, the compressor.
+    uint64_t get_compression_bytes_in() const;
+    uint64_t get_compression_bytes_out() const;
+    // Writes made to wait for the segment writes in flight, and the time
+    // they waited, in nanoseconds.
+    uint64_t get_pending_write_stalls() const;
+    uint64_t get_pending_write_stall_time() const;
+    // BATCH mode: number of writes acknowledged by each flush, and latency
+    // of these flushes, in nanoseconds.
+    const utils::ihistogram& get_batch_size_histogram() const;
+    const utils::ihistogram& get_batch_sync_latency_histogram() const;
 
     /**
      * Returns the largest amount of data that can be written in a single "mutation".
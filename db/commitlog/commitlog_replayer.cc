@@ -44,9 +44,11 @@
 #include <algorithm>
 #include <unordered_map>
 #include <boost/range/adaptor/map.hpp>
+#include <boost/range/irange.hpp>
 
 #include <core/future.hh>
 #include <core/sharded.hh>
+#include <core/future-util.hh>
 
 #include "commitlog.hh"
 #include "commitlog_replayer.hh"
@@ -71,8 +73,23 @@ class db::commitlog_replayer::impl {
         uint64_t applied_mutations = 0;
     };
 
-    future<> process(stats*, temporary_buffer<char> buf, replay_position rp);
-    future<stats> recover(sstring file);
+    // Both may run on any shard: the positions gathered by init() are
+    // only read.
+    future<> process(stats*, temporary_buffer<char> buf, replay_position rp) const;
+    future<stats> recover(sstring file) const;
+
+    replay_position min_pos(unsigned shard) const {
+        auto i = _min_pos.find(shard);
+        return i != _min_pos.end() ? i->second : replay_position();
+    }
+    replay_position cf_pos(unsigned shard, const utils::UUID& uuid) const {
+        auto i = _rpm.find(shard);
+        if (i == _rpm.end()) {
+            return replay_position();
+        }
+        auto j = i->second.find(uuid);
+        return j != i->second.end() ? j->second : replay_position();
+    }
 
     typedef std::unordered_map<utils::UUID, replay_position> rp_map;
     typedef std::unordered_map<unsigned, rp_map> shard_rpm_map;
@@ -146,11 +163,11 @@ future<> db::commitlog_replayer::impl::init() {
 }
 
 future<db::commitlog_replayer::impl::stats>
-db::commitlog_replayer::impl::recover(sstring file) {
+db::commitlog_replayer::impl::recover(sstring file) const {
     logger.info("Replaying {}", file);
 
     replay_position rp{commitlog::descriptor(file)};
-    auto gp = _min_pos[rp.shard_id()];
+    auto gp = min_pos(rp.shard_id());
 
     if (rp.id < gp.id) {
         logger.debug("skipping replay of fully-flushed {}", file);
@@ -173,9 +190,9 @@ db::commitlog_replayer::impl::recover(sstring file) {
     });
 }
 
-future<> db::commitlog_replayer::impl::process(stats* s, temporary_buffer<char> buf, replay_position rp) {
+future<> db::commitlog_replayer::impl::process(stats* s, temporary_buffer<char> buf, replay_position rp) const {
     auto shard = rp.shard_id();
-    if (rp < _min_pos[shard]) {
+    if (rp < min_pos(shard)) {
         logger.trace("entry {} is less than global min position. skipping", rp);
         s->skipped_mutations++;
         return make_ready_future<>();
@@ -186,40 +203,47 @@ future<> db::commitlog_replayer::impl::process(stats* s, temporary_buffer<char>
         frozen_mutation fm(bytes(reinterpret_cast<const int8_t *>(buf.get()), buf.size()));
 
         auto uuid = fm.column_family_id();
-        auto& map = _rpm[shard];
-        auto i = map.find(uuid);
-        if (i != map.end() && rp <= i->second) {
-            logger.trace("entry {} at {} is younger than recorded replay position {}. skipping", fm.column_family_id(), rp, i->second);
+        auto cp = cf_pos(shard, uuid);
+        if (cp != replay_position() && rp <= cp) {
+            logger.trace("entry {} at {} is younger than recorded replay position {}. skipping", fm.column_family_id(), rp, cp);
             s->skipped_mutations++;
             return make_ready_future<>();
         }
 
-        auto shard = _qp.local().db().local().shard_of(fm);
-        return _qp.local().db().invoke_on(shard, [fm = std::move(fm), rp, shard, s] (database& db) -> future<> {
-            // TODO: might need better verification that the deserialized mutation
-            // is schema compatible. My guess is that just applying the mutation
-            // will not do this.
-            auto& cf = db.find_column_family(fm.column_family_id());
-
-            if (logger.is_enabled(logging::log_level::debug)) {
-                logger.debug("replaying at {} {}:{} at {}", fm.column_family_id(),
-                        cf.schema()->ks_name(), cf.schema()->cf_name(), rp);
-            }
-            // Removed forwarding "new" RP. Instead give none/empty.
-            // This is what origin does, and it should be fine.
-            // The end result should be that once sstables are flushed out
-            // their "replay_position" attribute will be empty, which is
-            // lower than anything the new session will produce.
-            cf.apply(fm);
+        // TODO: might need better verification that the deserialized mutation
+        // is schema compatible. My guess is that just applying the mutation
+        // will not do this.
+        // Removed forwarding "new" RP. Instead give none/empty.
+        // This is what origin does, and it should be fine.
+        // The end result should be that once sstables are flushed out
+        // their "replay_position" attribute will be empty, which is
+        // lower than anything the new session will produce.
+        auto& db = _qp.local().db();
+        auto owner = db.local().shard_of(fm);
+        logger.trace("replaying {} at {} on shard {}", uuid, rp, owner);
+        auto f = owner == engine().cpu_id()
+                ? db.local().apply_in_memory(fm, replay_position())
+                : db.invoke_on(owner, [fm = std::move(fm)] (database& db) {
+                    return db.apply_in_memory(fm, replay_position());
+                });
+        // The stats belong to this shard.
+        return f.then([s] {
             s->applied_mutations++;
-            return make_ready_future<>();
         }).handle_exception([s](auto ep) {
-            s->invalid_mutations++;
-            // TODO: write mutation to file like origin.
-            logger.warn("error replaying: {}", ep);
+            try {
+                std::rethrow_exception(ep);
+            } catch (no_such_column_family&) {
+                // Of a dropped table.
+                s->skipped_mutations++;
+            } catch (...) {
+                s->invalid_mutations++;
+                // TODO: write mutation to file like origin.
+                logger.warn("error replaying: {}", ep);
+            }
         });
     } catch (no_such_column_family&) {
         // No such CF now? Origin just ignores this.
+        s->skipped_mutations++;
     } catch (...) {
         s->invalid_mutations++;
         // TODO: write mutation to file like origin.
@@ -252,22 +276,50 @@ future<db::commitlog_replayer> db::commitlog_replayer::create_replayer(seastar::
 future<> db::commitlog_replayer::recover(std::vector<sstring> files) {
     logger.info("Replaying {}", files);
 
-    return parallel_for_each(files, [this](auto f) {
-        return this->recover(f).handle_exception([f](auto ep) {
-            logger.error("Error recovering {}: {}", f, ep);
-            std::rethrow_exception(ep);
+    struct progress {
+        size_t segments;
+        size_t replayed = 0;
+        impl::stats totals;
+    };
+    // Each shard reads a share of the segments, sequentially, and sends the
+    // mutations straight to their owners; replay thus scales with the
+    // number of shards rather than being bound by the one reading.
+    auto segments = files.size();
+    return do_with(std::move(files), progress{segments}, [this](auto& files, auto& p) {
+        return parallel_for_each(boost::irange(0u, smp::count), [this, &files, &p](unsigned shard) {
+            return do_for_each(boost::irange<size_t>(shard, files.size(), smp::count), [this, &files, &p, shard](size_t i) {
+                auto f = files[i];
+                return smp::submit_to(shard, [this, f] {
+                    return _impl->recover(f);
+                }).then([f, &p](impl::stats stats) {
+                    ++p.replayed;
+                    p.totals.applied_mutations += stats.applied_mutations;
+                    p.totals.invalid_mutations += stats.invalid_mutations;
+                    p.totals.skipped_mutations += stats.skipped_mutations;
+                    logger.info("Log replay of {} complete ({}/{} segments), {} replayed mutations ({} invalid, {} skipped)"
+                            , f
+                            , p.replayed
+                            , p.segments
+                            , stats.applied_mutations
+                            , stats.invalid_mutations
+                            , stats.skipped_mutations
+                            );
+                }).handle_exception([f](auto ep) {
+                    logger.error("Error recovering {}: {}", f, ep);
+                    std::rethrow_exception(ep);
+                });
+            });
+        }).then([&p] {
+            logger.info("Log replay complete, {} replayed mutations ({} invalid, {} skipped)"
+                    , p.totals.applied_mutations
+                    , p.totals.invalid_mutations
+                    , p.totals.skipped_mutations
+                    );
         });
     });
 }
 
 future<> db::commitlog_replayer::recover(sstring file) {
-    return _impl->recover(file).then([file](impl::stats stats) {
-        logger.info("Log replay of {} complete, {} replayed mutations ({} invalid, {} skipped)"
-                , file
-                , stats.applied_mutations
-                , stats.invalid_mutations
-                , stats.skipped_mutations
-                );
-    });
+    return recover(std::vector<sstring>{file});
 }
 
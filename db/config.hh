@@ -195,9 +195,12 @@ class config {
             "The directory where the commit log is stored. For optimal write performance, it is recommended the commit log be on a separate disk partition (ideally, a separate physical device) from the data file directories."   \
     )                                           \
     val(data_file_directories, string_list, { "/var/lib/scylla/data" }, Used,   \
-            "The directory location where table data (SSTables) is stored"   \
+            "The directory location where table data (SSTables) is stored. New SSTables are placed across the directories by their free space and the SSTables being written to them, and each directory but a lone one gets a disk I/O queue of its own, so that each may be on a disk of its own rather than on a RAID0 volume. The system tables stay in the first directory."   \
     )                                           \
-    val(saved_caches_directory, sstring, "/var/lib/scylla/saved_caches", Unused, \
+    val(hints_directory, sstring, "/var/lib/scylla/hints", Used,   \
+            "The directory where hints for unavailable nodes are stored, in a sub directory per shard and target node."   \
+    )                                           \
+    val(saved_caches_directory, sstring, "/var/lib/scylla/saved_caches", Used, \
             "The directory location where table key and row caches are stored."  \
     )                                                   \
     /* Commonly used properties */  \
@@ -259,8 +262,8 @@ class config {
             "Related information: Initializing a multiple node cluster (single data center) and Initializing a multiple node cluster (multiple data centers)."  \
     )                                                   \
     /* Common compaction settings */    \
-    val(compaction_throughput_mb_per_sec, uint32_t, 16, Unused,     \
-            "Throttles compaction to the specified total throughput across the entire system. The faster you insert data, the faster you need to compact in order to keep the SSTable count down. The recommended Value is 16 to 32 times the rate of write throughput (in MBs/second). Setting the value to 0 disables compaction throttling.\n"  \
+    val(compaction_throughput_mb_per_sec, uint32_t, 0, Used,     \
+            "Throttles compaction to the specified total throughput across the entire system. The faster you insert data, the faster you need to compact in order to keep the SSTable count down. The recommended Value is 16 to 32 times the rate of write throughput (in MBs/second). Setting the value to 0, the default, disables compaction throttling.\n"  \
             "Related information: Configuring compaction"   \
     )                                                   \
     val(compaction_large_partition_warning_threshold_mb, uint32_t, 100, Unused, \
@@ -271,8 +274,14 @@ class config {
             "Specifies the total memory used for all memtables on a node. This replaces the per-table storage settings memtable_operations_in_millions and memtable_throughput_in_mb."  \
     )                                                   \
     /* Common disk settings */  \
-    val(concurrent_reads, uint32_t, 32, Invalid,     \
-            "For workloads with more data than can fit in memory, the bottleneck is reads fetching data from disk. Setting to (16 × number_of_drives) allows operations to queue low enough in the stack so that the OS and drives can reorder them."  \
+    val(concurrent_reads, uint32_t, 32, Used,     \
+            "Most reads each shard runs at a time. The others wait for admission, within reader_concurrency_memory_in_mb and max_queued_reads, for at most read_request_timeout_in_ms."  \
+    )                                                   \
+    val(reader_concurrency_memory_in_mb, uint32_t, 0, Used,     \
+            "Most memory the buffers of the sstable readers of the running reads may take, shared by all shards. Reads past it wait for admission. Leave at 0 for 2% of the memory."  \
+    )                                                   \
+    val(max_queued_reads, uint32_t, 1000, Used,     \
+            "Most reads each shard keeps waiting for admission. Reads beyond it fail at once."  \
     )                                                   \
     val(concurrent_writes, uint32_t, 32, Invalid,     \
             "Writes in Cassandra are rarely I/O bound, so the ideal number of concurrent writes depends on the number of CPU cores in your system. The recommended value is (8 x number_of_cpu_cores)."  \
@@ -290,10 +299,13 @@ class config {
             "Related information: Configuring compaction"   \
     )                                                   \
     /* Common fault detection setting */    \
-    val(phi_convict_threshold, uint32_t, 8, Unused,     \
-            "Adjusts the sensitivity of the failure detector on an exponential scale. Generally this setting never needs adjusting.\n"  \
+    val(phi_convict_threshold, uint32_t, 8, Used,     \
+            "Adjusts the sensitivity of the failure detector on an exponential scale: a node is marked down once the probability that its next heartbeat is still to come falls below 10^-phi_convict_threshold. Values outside 5 to 16 are clamped. Generally this setting never needs adjusting.\n"  \
             "Related information: Failure detection and recovery"  \
     )                                                   \
+    val(phi_min_interval_in_ms, uint32_t, 1000, Used,     \
+            "The shortest interval between heartbeats, and the smallest standard deviation of these intervals, the failure detector assumes. Raise it to keep nodes with very regular heartbeats from being marked down by short pauses."  \
+    )                                                   \
     /* Performance tuning properties */ \
     /* Tuning performance and system reso   urce utilization, including commit log, compaction, memory, disk I/O, CPU, reads, and writes. */    \
     /* Commit log settings */   \
@@ -313,8 +325,20 @@ class config {
             "Controls how long the system waits for other writes before performing a sync in \"periodic\" mode."    \
     )   \
     /* Note: does not exist on the listing page other than in above comment, wtf? */    \
-    val(commitlog_sync_batch_window_in_ms, uint32_t, 10000, Used,     \
-            "Controls how long the system waits for other writes before performing a sync in \"batch\" mode."    \
+    val(commitlog_sync_batch_window_in_ms, uint32_t, 2, Used,     \
+            "Controls how long the system waits for other writes before performing a sync in \"batch\" mode. All the writes of the window are acknowledged by a single sync. 0 syncs every write on its own."    \
+    )   \
+    val(commitlog_sync_batch_max_size_in_kb, uint32_t, 1024, Used,     \
+            "In \"batch\" mode, sync as soon as the writes waiting for the sync add up to this size, rather than waiting for the end of commitlog_sync_batch_window_in_ms."    \
+    )   \
+    val(commitlog_buffer_pool_size_in_kb, uint32_t, 1024, Used,     \
+            "Amount of commitlog segment write buffers kept, on each shard, for reuse by the next segment writes instead of being freed."    \
+    )   \
+    val(commitlog_compression, sstring, "", Used,     \
+            "Compressor used for the commitlog segments. Empty (the default) leaves them uncompressed. Only LZ4Compressor is supported."    \
+    )   \
+    val(commitlog_max_pending_writes_in_kb, uint32_t, 8192, Used,     \
+            "Amount of commitlog segment writes allowed in flight on each shard. Beyond it, new writes wait for the disk to catch up instead of queuing more buffers in memory. 0 disables the limit."    \
     )   \
     val(commitlog_total_space_in_mb, uint32_t, 8192, Used,     \
             "Total space used for commitlogs. If the used space goes above this value, Cassandra rounds up to the next nearest segment multiple and flushes memtables to disk for the oldest commitlog segments, removing those log segments. This reduces the amount of data to replay on startup, and prevents infrequently-updated tables from indefinitely keeping commitlog segments. A small total commitlog space tends to cause more flush activity on less-active tables.\n"  \
@@ -344,6 +368,9 @@ class config {
             "\toffheap_buffers  Off heap (direct) NIO buffers.\n"   \
             "\toffheap_objects  Native memory, eliminating NIO buffer heap overhead."   \
     )                                                   \
+    val(memtable_soft_throttle_threshold, double, .75, Used, \
+            "Fraction of memtable_total_space_in_mb above which writes are delayed, by up to 10ms as memtables get closer to the limit, rather than left at full speed until they get blocked. 0 or 1 disables the delays." \
+    )   \
     val(memtable_cleanup_threshold, double, .11, Used, \
             "Ratio of occupied non-flushing memtable size to total permitted size for triggering a flush of the largest memtable. Larger values mean larger flushes and less compaction, but also less concurrent flush activity, which can make it difficult to keep your disks saturated under heavy write load." \
     )   \
@@ -354,8 +381,8 @@ class config {
             "The number of full memtables to allow pending flush (memtables waiting for a write thread). At a minimum, set to the maximum number of indexes created on a single table.\n"  \
             "Related information: Flushing data from the memtable"  \
     )   \
-    val(memtable_flush_writers, uint32_t, 1, Invalid,     \
-            "Sets the number of memtable flush writer threads. These threads are blocked by disk I/O, and each one holds a memtable in memory while blocked. If you have a large Java heap size and many data directories, you can increase the value for better flush performance."  \
+    val(memtable_flush_writers, uint32_t, 2, Used,     \
+            "Sets the number of memtable flushes each shard runs concurrently. Each one holds a memtable in memory while blocked on disk I/O. Flushes waiting for a slot are ordered by the memory they free when writes are blocked on memtable space, and by the age of their commitlog data otherwise."  \
     )   \
     val(memtable_heap_space_in_mb, uint32_t, 0, Unused,     \
             "Total permitted memory to use for memtables. Triggers a flush based on memtable_cleanup_threshold. Cassandra stops accepting writes when the limit is exceeded until a flush completes. If unset, sets to default."  \
@@ -364,13 +391,13 @@ class config {
             "See memtable_heap_space_in_mb"  \
     )   \
     /* Cache and index settings */  \
-    val(column_index_size_in_kb, uint32_t, 64, Unused,     \
+    val(column_index_size_in_kb, uint32_t, 64, Used,     \
             "Granularity of the index of rows within a partition. For huge rows, decrease this setting to improve seek time. If you use key cache, be careful not to make this setting too large because key cache will be overwhelmed. If you're unsure of the size of the rows, it's best to use the default setting."  \
     )   \
-    val(index_summary_capacity_in_mb, uint32_t, 0, Unused,     \
-            "Fixed memory pool size in MB for SSTable index summaries. If the memory usage of all index summaries exceeds this limit, any SSTables with low read rates shrink their index summaries to meet this limit. This is a best-effort process. In extreme conditions, Cassandra may need to use more than this amount of memory."  \
+    val(index_summary_capacity_in_mb, uint32_t, 0, Used,     \
+            "Fixed memory pool size in MB for SSTable index summaries, 0 for 5% of the memory. If the memory usage of all index summaries exceeds this limit, any SSTables with low read rates shrink their index summaries to meet this limit. This is a best-effort process. In extreme conditions, Cassandra may need to use more than this amount of memory."  \
     )   \
-    val(index_summary_resize_interval_in_minutes, uint32_t, 60, Unused,     \
+    val(index_summary_resize_interval_in_minutes, uint32_t, 60, Used,     \
             "How frequently index summaries should be re-sampled. This is done periodically to redistribute memory from the fixed-size pool to SSTables proportional their recent read rates. To disable, set to -1. This leaves existing index summaries at their current sampling level."  \
     )   \
     val(reduce_cache_capacity_to, double, .6, Invalid,     \
@@ -380,11 +407,20 @@ class config {
             "When Java heap usage (after a full concurrent mark sweep (CMS) garbage collection) exceeds this percentage, Cassandra reduces the cache capacity to the fraction of the current size as specified by reduce_cache_capacity_to. To disable, set the value to 1.0."  \
     )   \
     /* Disks settings */    \
-    val(stream_throughput_outbound_megabits_per_sec, uint32_t, 400, Unused,     \
-            "Throttles all outbound streaming file transfers on a node to the specified throughput. Cassandra does mostly sequential I/O when streaming data during bootstrap or repair, which can lead to saturating the network connection and degrading client (RPC) performance."  \
+    val(stream_throughput_outbound_megabits_per_sec, uint32_t, 400, Used,     \
+            "Throttles all outbound streaming transfers on a node to the specified throughput, including the rows row-level repair sends. Streaming data during bootstrap or repair can saturate the network connection and degrade client (RPC) performance. Set to 0 to disable throttling."  \
+    )   \
+    val(stream_throughput_outbound_megabits_per_sec_per_peer, uint32_t, 0, Used,     \
+            "Throttles the outbound streaming transfers from a node to each other node, in addition to throttling all of them as configured with stream_throughput_outbound_megabits_per_sec. Set to 0 to disable throttling."  \
     )   \
-    val(inter_dc_stream_throughput_outbound_megabits_per_sec, uint32_t, 0, Unused,     \
-            "Throttles all streaming file transfer between the data centers. This setting allows throttles streaming throughput betweens data centers in addition to throttling all network stream traffic as configured with stream_throughput_outbound_megabits_per_sec."  \
+    val(inter_dc_stream_throughput_outbound_megabits_per_sec, uint32_t, 0, Used,     \
+            "Throttles all streaming file transfer between the data centers. This setting allows throttles streaming throughput betweens data centers in addition to throttling all network stream traffic as configured with stream_throughput_outbound_megabits_per_sec. Set to 0 to disable throttling."  \
+    )   \
+    val(stream_throughput_inbound_megabits_per_sec, uint32_t, 0, Used,     \
+            "Throttles all inbound streaming transfers on a node, including the rows row-level repair receives, by holding back their acknowledgement. Set to 0 to disable throttling."  \
+    )   \
+    val(load_and_stream_throughput_megabits_per_sec, uint32_t, 0, Used,     \
+            "Throttles the streaming of sstables loaded from a directory to the nodes which own their data, in addition to throttling all outbound streaming as configured with stream_throughput_outbound_megabits_per_sec. Set to 0 to disable throttling."  \
     )   \
     val(trickle_fsync, bool, false, Unused,     \
             "When doing sequential writing, enabling this option tells fsync to force the operating system to flush the dirty buffers at a set interval trickle_fsync_interval_in_kb. Enable this parameter to avoid sudden dirty buffer flushing from impacting read latencies. Recommended to use on SSDs, but not on HDDs."  \
@@ -440,25 +476,28 @@ class config {
     /* Key caches and global row properties */  \
     /* When creating or modifying tables, you enable or disable the key cache (partition key cache) or row cache for that table by setting the caching parameter. Other row and key cache tuning and configuration options are set at the global (node) level. Cassandra uses these settings to automatically distribute memory for each table on the node based on the overall workload and specific table usage. You can also configure the save periods for these caches globally. */    \
     /* Related information: Configuring caches */   \
-    val(key_cache_keys_to_save, uint32_t, 0, Unused,                \
+    val(key_cache_keys_to_save, uint32_t, 0, Used,                \
             "Number of keys from the key cache to save. (0: all)"  \
     )   \
-    val(key_cache_save_period, uint32_t, 14400, Unused,                \
+    val(key_cache_save_period, uint32_t, 14400, Used,                \
             "Duration in seconds that keys are saved in cache. Caches are saved to saved_caches_directory. Saved caches greatly improve cold-start speeds and has relatively little effect on I/O."  \
     )   \
-    val(key_cache_size_in_mb, uint32_t, 100, Unused,                \
+    val(key_cache_size_in_mb, uint32_t, 100, Used,                \
             "A global cache setting for tables. It is the maximum size of the key cache in memory. To disable set to 0.\n"  \
             "Related information: nodetool setcachecapacity."   \
     )   \
-    val(row_cache_keys_to_save, uint32_t, 0, Unused,                \
-            "Number of keys from the row cache to save."  \
+    val(row_cache_keys_to_save, uint32_t, 0, Used,                \
+            "Number of keys from the row cache to save. (0: all)"  \
     )   \
     val(row_cache_size_in_mb, uint32_t, 0, Unused,                \
             "Maximum size of the row cache in memory. Row cache can save more time than key_cache_size_in_mb, but is space-intensive because it contains the entire row. Use the row cache only for hot rows or static rows. If you reduce the size, you may not get you hottest keys loaded on start up."  \
     )   \
-    val(row_cache_save_period, uint32_t, 0, Unused,     \
+    val(row_cache_save_period, uint32_t, 0, Used,     \
             "Duration in seconds that rows are saved in cache. Caches are saved to saved_caches_directory."  \
     )   \
+    val(cache_warmup_keys, uint32_t, 100000, Used,     \
+            "Number of keys of the hottest partitions in the row caches of the nodes a bootstrapping or replacing node streams from, which it reads into its own row cache before it starts serving reads. 0 disables the warm-up."  \
+    )   \
     val(memory_allocator, sstring, "NativeAllocator", Invalid,     \
             "The off-heap memory allocator. In addition to caches, this property affects storage engine meta data. Supported values:\n"  \
             "\tNativeAllocator\n"  \
@@ -478,15 +517,24 @@ class config {
     val(counter_cache_keys_to_save, uint32_t, 0, Unused,     \
             "Number of keys from the counter cache to save. When disabled all keys are saved."  \
     )   \
+    val(prepared_statements_cache_size_in_mb, uint32_t, 0, Used,     \
+            "The memory each shard may use for the statements clients prepared, beyond which the least recently used ones are evicted. 0 means 1/256th of the shard's memory, and at least 1MB."  \
+    )   \
+    val(unprepared_statements_cache_size_in_mb, uint32_t, 0, Used,     \
+            "The memory each shard may use for caching the statements parsed for unprepared queries, so that repeated ones are not parsed again. 0 means 1/512th of the shard's memory, and at least 1MB."  \
+    )   \
     /* Tombstone settings */    \
     /* When executing a scan, within or across a partition, tombstones must be kept in memory to allow returning them to the coordinator. The coordinator uses them to ensure other replicas know about the deleted rows. Workloads that generate numerous tombstones may cause performance problems and exhaust the server heap. See Cassandra anti-patterns: Queues and queue-like datasets. Adjust these thresholds only if you understand the impact and want to scan more tombstones. Additionally, you can adjust these thresholds at runtime using the StorageServiceMBean. */   \
     /* Related information: Cassandra anti-patterns: Queues and queue-like datasets */  \
-    val(tombstone_warn_threshold, uint32_t, 1000, Unused,     \
+    val(tombstone_warn_threshold, uint32_t, 1000, Used,     \
             "The maximum number of tombstones a query can scan before warning."  \
     )   \
-    val(tombstone_failure_threshold, uint32_t, 100000, Unused,     \
+    val(tombstone_failure_threshold, uint32_t, 100000, Used,     \
             "The maximum number of tombstones a query can scan before aborting."  \
     )   \
+    val(max_concurrent_partition_reads, uint32_t, 128, Used,     \
+            "The maximum number of partitions of a multi-partition query (e.g. SELECT ... WHERE pk IN (...)) the coordinator reads concurrently."  \
+    )   \
     /* Network timeout settings */  \
     val(range_request_timeout_in_ms, uint32_t, 10000, Unused,     \
             "The time in milliseconds that the coordinator waits for sequential or index scans to complete."  \
@@ -507,6 +555,21 @@ class config {
             "The time in milliseconds that the coordinator waits for write operations to complete.\n"  \
             "Related information: About hinted handoff writes"  \
     )   \
+    val(max_coordinator_writes_in_flight, uint32_t, 10000, Used,     \
+            "Maximum number of writes a shard coordinates at the same time, including the ones which already reached their consistency level but still wait for some replicas. Writes beyond it wait for admission, see coordinator_queue_timeout_in_ms. 0 means no limit."  \
+    )   \
+    val(max_coordinator_write_memory_in_mb, uint32_t, 0, Used,     \
+            "Maximum memory the mutations of the writes a shard coordinates may take. Writes beyond it wait for admission, see coordinator_queue_timeout_in_ms. 0 means a tenth of the memory of the shard."  \
+    )   \
+    val(max_coordinator_reads_in_flight, uint32_t, 10000, Used,     \
+            "Maximum number of reads a shard coordinates at the same time. Reads beyond it wait for admission, see coordinator_queue_timeout_in_ms. 0 means no limit."  \
+    )   \
+    val(coordinator_queue_timeout_in_ms, uint32_t, 100, Used,     \
+            "How long a request beyond the coordinator limits may wait for admission before failing as overloaded. 0 makes such requests fail right away."  \
+    )   \
+    val(max_view_update_backlog_in_mb, uint32_t, 32, Used,     \
+            "Maximum memory the materialized view updates a shard sends to view replicas, and which they haven't acknowledged yet, may take. Writes to base tables which would exceed it wait for the backlog to drain."  \
+    )   \
     val(request_timeout_in_ms, uint32_t, 10000, Unused,     \
             "The default timeout for other, miscellaneous operations.\n"  \
             "Related information: About hinted handoff writes"  \
@@ -529,16 +592,36 @@ class config {
     val(internode_recv_buff_size_in_bytes, uint32_t, 0, Unused,     \
             "Sets the receiving socket buffer size in bytes for inter-node calls."  \
     )   \
-    val(internode_compression, sstring, "all", Unused,     \
+    val(internode_compression, sstring, "all", Used,     \
             "Controls whether traffic between nodes is compressed. The valid values are:\n" \
             "\n"    \
             "\tall: All traffic is compressed.\n"   \
             "\tdc : Traffic between data centers is compressed.\n"  \
-            "\tnone : No compression."  \
+            "\tnone : No compression.\n"  \
+            "\n"    \
+            "The mutations sent to other nodes, by writes, hints, streaming and repair, are compressed with LZ4 when at least internode_compression_threshold_in_bytes large."  \
+    )   \
+    val(internode_compression_threshold_in_bytes, uint32_t, 512, Used,     \
+            "The size from which a mutation sent to another node is compressed, when internode_compression says to compress the traffic to that node."  \
     )   \
     val(inter_dc_tcp_nodelay, bool, false, Unused,     \
             "Enable or disable tcp_nodelay for inter-data center communication. When disabled larger, but fewer, network packets are sent. This reduces overhead from the TCP protocol itself. However, if cross data-center responses are blocked, it will increase latency."  \
     )   \
+    val(internode_gossip_connections, uint32_t, 1, Used,     \
+            "The number of connections to each shard of each other node over which gossip is sent."  \
+    )   \
+    val(internode_request_response_connections, uint32_t, 1, Used,     \
+            "The number of connections to each shard of each other node over which reads, writes and other requests of clients are sent. With more than one, one-way messages of this kind may arrive out of order."  \
+    )   \
+    val(internode_streaming_connections, uint32_t, 1, Used,     \
+            "The number of connections to each shard of each other node over which streaming messages are sent."  \
+    )   \
+    val(internode_repair_connections, uint32_t, 1, Used,     \
+            "The number of connections to each shard of each other node over which repair messages are sent."  \
+    )   \
+    val(shard_aware_storage_port, uint16_t, 17000, Used,     \
+            "Shard n of each node also listens for internode messages on this port + n. Other nodes send the writes and reads of a token to the shard owning it over it, so that they are handled there without crossing cores. 0 disables it."  \
+    )   \
     val(streaming_socket_timeout_in_ms, uint32_t, 0, Unused,     \
             "Enable or disable socket timeout for streaming operations. When a timeout occurs during streaming, streaming is retried from the start of the current file. Avoid setting this value too low, as it can result in a significant amount of data re-streaming."  \
     )   \
@@ -549,12 +632,35 @@ class config {
     val(native_transport_port, uint16_t, 9042, Used,                \
             "Port on which the CQL native transport listens for clients."  \
     )   \
+    val(native_shard_aware_transport_port, uint16_t, 19042, Used,                \
+            "Base port of the shard-aware CQL native transport: shard N also listens on this port + N, so that drivers can send each request directly to the shard owning its token. Set to 0 to disable."  \
+    )   \
     val(native_transport_max_threads, uint32_t, 128, Invalid,                \
             "The maximum number of thread handling requests. The meaning is the same as rpc_max_threads.\n"  \
             "Default is different (128 versus unlimited).\n"  \
             "No corresponding native_transport_min_threads.\n"  \
             "Idle threads are stopped after 30 seconds.\n"  \
     )   \
+    val(native_transport_max_requests_per_connection, uint32_t, 1024, Used,                \
+            "The maximum number of requests a client connection may have in flight. No more requests are read from the connection until some of these completed and their responses were written."  \
+    )   \
+    val(native_transport_max_request_memory_per_connection_in_mb, uint32_t, 16, Used,                \
+            "The maximum size of the requests a client connection may have in flight. No more requests are read from the connection until some of these completed and their responses were written. A request larger than this is processed alone."  \
+    )   \
+    val(native_transport_max_concurrent_requests_per_shard, uint32_t, 256, Used,                \
+            "The maximum number of client requests a shard processes at a time. Requests beyond it wait, and are let in by the shares of their service levels."  \
+    )   \
+    val(service_levels, string_map, /* none */, Used,                \
+            "Service levels clients can choose when they connect, through the SERVICE_LEVEL option of STARTUP, mapped to their options, e.g.\n"  \
+            "\n"  \
+            "\tbatch: shares=200,requests_per_second=5000,bytes_per_second=10485760\n"  \
+            "\n"  \
+            "shares:\n"  \
+            "\tThe share of the requests let in the level gets while requests wait for admission (1000 for the default level).\n"  \
+            "requests_per_second, bytes_per_second:\n"  \
+            "\tThe most requests, and request bytes, the level may send to the node per second. 0 or omitted for no limit.\n"  \
+            "Clients which don't choose run under the 'default' level, which can be configured too."  \
+    )   \
     val(native_transport_max_frame_size_in_mb, uint32_t, 256, Unused,                \
             "The maximum size of allowed frame. Frame (requests) larger than this are rejected as invalid."  \
     )   \
@@ -594,33 +700,39 @@ class config {
     )   \
     /* Advanced fault detection settings */ \
     /* Settings to handle poorly performing or failing nodes. */    \
-    val(dynamic_snitch_badness_threshold, double, 0, Unused,     \
+    val(dynamic_snitch, bool, true, Used,     \
+            "Whether to order the replicas of reads by how fast they have lately been answering, on top of the order endpoint_snitch gives them in."  \
+    )   \
+    val(dynamic_snitch_badness_threshold, double, 0.1, Used,     \
             "Sets the performance threshold for dynamically routing requests away from a poorly performing node. A value of 0.2 means Cassandra continues to prefer the static snitch values until the node response time is 20% worse than the best performing node. Until the threshold is reached, incoming client requests are statically routed to the closest replica (as determined by the snitch). Having requests consistently routed to a given replica can help keep a working set of data hot when read repair is less than 1."  \
     )   \
-    val(dynamic_snitch_reset_interval_in_ms, uint32_t, 60000, Unused,     \
+    val(dynamic_snitch_reset_interval_in_ms, uint32_t, 60000, Used,     \
             "Time interval in milliseconds to reset all node scores, which allows a bad node to recover."  \
     )   \
-    val(dynamic_snitch_update_interval_in_ms, uint32_t, 100, Unused,     \
+    val(dynamic_snitch_update_interval_in_ms, uint32_t, 100, Used,     \
             "The time interval for how often the snitch calculates node scores. Because score calculation is CPU intensive, be careful when reducing this interval."  \
     )   \
-    val(hinted_handoff_enabled, bool, true, Unused,     \
+    val(hinted_handoff_enabled, bool, true, Used,     \
             "Enable or disable hinted handoff. To enable per data center, add data center list. For example: hinted_handoff_enabled: DC1,DC2. A hint indicates that the write needs to be replayed to an unavailable node. Where Cassandra writes the hint depends on the version:\n"  \
             "\n"    \
             "\tPrior to 1.0: Writes to a live replica node.\n"  \
             "\t1.0 and later: Writes to the coordinator node.\n"  \
             "Related information: About hinted handoff writes"  \
     )   \
-    val(hinted_handoff_throttle_in_kb, uint32_t, 1024, Unused,     \
+    val(hinted_handoff_throttle_in_kb, uint32_t, 1024, Used,     \
             "Maximum throttle per delivery thread in kilobytes per second. This rate reduces proportionally to the number of nodes in the cluster. For example, if there are two nodes in the cluster, each delivery thread will use the maximum rate. If there are three, each node will throttle to half of the maximum, since the two nodes are expected to deliver hints simultaneously."  \
     )   \
-    val(max_hint_window_in_ms, uint32_t, 10800000, Unused,     \
+    val(max_hint_window_in_ms, uint32_t, 10800000, Used,     \
             "Maximum amount of time that hints are generates hints for an unresponsive node. After this interval, new hints are no longer generated until the node is back up and responsive. If the node goes down again, a new interval begins. This setting can prevent a sudden demand for resources when a node is brought back online and the rest of the cluster attempts to replay a large volume of hinted writes.\n"  \
             "Related information: Failure detection and recovery"  \
     )   \
+    val(max_hints_size_per_endpoint_in_mb, uint32_t, 10240, Used,     \
+            "Maximum disk space taken, per node, by the hints kept for a single unavailable node. Hints for it are no longer stored beyond it."  \
+    )   \
     val(max_hints_delivery_threads, uint32_t, 2, Invalid,     \
             "Number of threads with which to deliver hints. In multiple data-center deployments, consider increasing this number because cross data-center handoff is generally slower."  \
     )   \
-    val(batchlog_replay_throttle_in_kb, uint32_t, 1024, Unused,     \
+    val(batchlog_replay_throttle_in_kb, uint32_t, 1024, Used,     \
             "Total maximum throttle. Throttling is reduced proportionally to the number of nodes in the cluster."  \
     )   \
     /* Request scheduler properties */  \
@@ -734,9 +846,41 @@ class config {
             "Use --help-loggers for a list of logger names") \
     val(log_to_stdout, bool, true, Used, "Send log output to stdout") \
     val(log_to_syslog, bool, false, Used, "Send log output to syslog") \
+    val(log_buffer_size_in_kb, uint32_t, 1024, Used, "Size of the buffer each shard copies its log messages to, for a thread of their own to write them to stdout and syslog, so that logging doesn't stall the shard. Messages logged while the buffer is full are dropped, and counted. Set to 0 to write each message out as it is logged.") \
+    val(log_rate_limit, uint32_t, 0, Used, "Log messages each logger may log per second, beyond which they are suppressed, and counted. Errors are never suppressed. Set to 0 for no limit.") \
     val(enable_in_memory_data_store, bool, false, Used, "Enable in memory mode (system tables are always persisted)") \
     val(enable_cache, bool, true, Used, "Enable cache") \
     val(enable_commitlog, bool, true, Used, "Enable commitlog") \
+    val(major_compaction_parallelism, uint32_t, 1, Used, "Number of disjoint token sub-ranges a major compaction is split into. Sub-ranges are compacted concurrently into non-overlapping sstables.") \
+    val(major_compaction_sstable_size_in_mb, uint32_t, 0, Used, "Size of the sstables a major compaction splits its output into. Compacted sstables are then deleted as soon as the output covers them, which bounds the free disk space a major compaction of a single token range needs. To leave the output whole set to 0.") \
+    val(compaction_adaptive_throttle, bool, false, Used, "Scale compaction throughput down from compaction_throughput_mb_per_sec while foreground reads are slow or queued, and back up once they recover.") \
+    val(compaction_adaptive_throttle_read_latency_ms, uint32_t, 10, Used, "Mean read latency above which adaptive compaction throttling backs off.") \
+    val(compaction_adaptive_throttle_pending_reads, uint32_t, 64, Used, "Number of in-progress reads per shard above which adaptive compaction throttling backs off.") \
+    val(index_page_cache_size_in_mb, uint32_t, 100, Used, "Maximum size of the cache of parsed Index.db pages, shared by all tables. To disable set to 0.") \
+    val(sstable_read_ahead_depth, uint32_t, 4, Used, "Maximum number of data file reads kept in flight ahead of a sequential sstable scan. The actual depth adapts to how fast the scan consumes data. To disable read-ahead set to 1.") \
+    val(sstable_read_ahead_buffer_size_in_kb, uint32_t, 128, Used, "Size of each read issued by sequential scans of uncompressed sstables. Compressed sstables are read a chunk at a time.") \
+    val(max_io_requests, uint32_t, 128, Used, "Most disk requests in flight at a time, shared by all shards. The requests beyond it are queued by I/O priority class, so this should be the depth which saturates the disk, and no more.") \
+    val(query_io_shares, uint32_t, 1000, Used, "Share of the disk the reads of queries get when other I/O is queued with them.") \
+    val(commitlog_io_shares, uint32_t, 1000, Used, "Share of the disk commitlog writes get when other I/O is queued with them.") \
+    val(memtable_flush_io_shares, uint32_t, 1000, Used, "Share of the disk memtable flushes get when other I/O is queued with them.") \
+    val(compaction_io_shares, uint32_t, 200, Used, "Share of the disk compaction gets when other I/O is queued with it.") \
+    val(streaming_io_shares, uint32_t, 200, Used, "Share of the disk streaming gets when other I/O is queued with it.") \
+    val(statement_cpu_shares, uint32_t, 1000, Used, "Share of the CPU statements get while background work competes with them. The shares of the background groups are relative to it.") \
+    val(compaction_cpu_shares, uint32_t, 200, Used, "Share of the CPU compaction gets while statements are being processed. Compaction takes the CPU freely when no statement is.") \
+    val(streaming_cpu_shares, uint32_t, 200, Used, "Share of the CPU streaming gets while statements are being processed.") \
+    val(memtable_flush_cpu_shares, uint32_t, 250, Used, "Share of the CPU merging flushed memtables into the cache gets while statements are being processed.") \
+    val(maintenance_cpu_shares, uint32_t, 100, Used, "Share of the CPU maintenance, such as building the hash trees of repair, gets while statements are being processed.") \
+    val(sstable_map_filters_and_summaries, bool, false, Used, "Read the bloom filters and the summary keys of sstables in place in read-only mappings of their Filter.db and Summary.db, rather than loading them into memory. Loading an sstable then reads little, and the kernel can drop the pages of cold sstables under memory pressure, but a lookup touching a page which isn't in memory stalls the shard until it is read.") \
+    val(memtable_flush_buffer_size_in_kb, uint32_t, 1024, Used, "Most memtable data copied out at a time when flushing a partition to an sstable. Wide partitions are written in pieces of this size.") \
+    val(lsa_reclaim_reserve_in_mb, uint32_t, 64, Used, "Free memory the background reclaimer tries to keep, shared by all shards, so that allocations rarely have to compact or evict in-memory data synchronously. To disable background reclamation set to 0.") \
+    val(lsa_reclaim_period_in_ms, uint32_t, 10, Used, "How often the background reclaimer checks free memory.") \
+    val(lsa_reclaim_step_budget_in_us, uint32_t, 200, Used, "Longest the background reclaimer runs at a time before yielding.") \
+    val(paged_reader_ttl_in_ms, uint32_t, 10000, Used, "How long a replica keeps the reader a page of a paged query stopped at, for the next page to continue it. To disable set to 0.") \
+    val(paged_result_size_limit_in_kb, uint32_t, 1024, Used, "Largest result a page of a paged query may have, a page reaching it ending early. Applies to the result of each replica as to the page as a whole. To disable set to 0.") \
+    val(query_result_cache_size_in_mb, uint32_t, 64, Used, "Memory, shared by all shards, holding the results of reads by prepared statements which the node serves again to identical reads, on tables whose caching options set result_cache_ttl_in_ms. To disable set to 0.") \
+    val(slow_query_log_threshold_in_ms, uint32_t, 0, Used, "Client requests taking at least this long are logged with the time spent in each of their stages: parsing, coordinating, reading storage and serializing the response, and with the response time of each replica. The latest are kept in memory, all in system_traces.node_slow_log. To disable set to 0.") \
+    val(reactor_stall_threshold_in_ms, uint32_t, 0, Used, "Tasks running this long without yielding are reported as reactor stalls, with the backtrace of where they were, and counted by call site. To disable set to 0.") \
+    val(stream_sstable_files, bool, true, Used, "Stream the sstables a node sends for bootstrap and rebuild which lie entirely within the streamed ranges as files, rather than mutation by mutation. The data of other sstables is still sent as mutations.") \
     val(volatile_system_keyspace_for_testing, bool, false, Used, "Don't persist system keyspace - testing only!") \
     val(api_port, uint16_t, 10000, Used, "Http Rest API port") \
     val(api_address, sstring, "", Used, "Http Rest API address") \
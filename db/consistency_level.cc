@@ -276,30 +276,21 @@ void validate_for_write(const sstring& keyspace_name, consistency_level cl) {
     }
 }
 
-#if 0
-    // This is the same than validateForWrite really, but we include a slightly different error message for SERIAL/LOCAL_SERIAL
-    public void validateForCasCommit(String keyspaceName) throws InvalidRequestException
-    {
-        switch (this)
-        {
-            case EACH_QUORUM:
-                requireNetworkTopologyStrategy(keyspaceName);
-                break;
-            case SERIAL:
-            case LOCAL_SERIAL:
-                throw new InvalidRequestException(this + " is not supported as conditional update commit consistency. Use ANY if you mean \"make sure it is accepted but I don't care how many replicas commit it for non-SERIAL reads\"");
-        }
-    }
+bool is_serial_consistency(consistency_level cl) {
+    return cl == consistency_level::SERIAL || cl == consistency_level::LOCAL_SERIAL;
+}
 
-    public void validateForCas() throws InvalidRequestException
-    {
-        if (!isSerialConsistency())
-            throw new InvalidRequestException("Invalid consistency for conditional update. Must be one of SERIAL or LOCAL_SERIAL");
+// This is the same than validate_for_write really, but we include a slightly different error message for SERIAL/LOCAL_SERIAL
+void validate_for_cas_commit(const sstring& keyspace_name, consistency_level cl) {
+    if (is_serial_consistency(cl)) {
+        throw exceptions::invalid_request_exception(sprint("%s is not supported as conditional update commit consistency. Use ANY if you mean \"make sure it is accepted but I don't care how many replicas commit it for non-SERIAL reads\"", cl));
     }
-#endif
+}
 
-bool is_serial_consistency(consistency_level cl) {
-    return cl == consistency_level::SERIAL || cl == consistency_level::LOCAL_SERIAL;
+void validate_for_cas(consistency_level cl) {
+    if (!is_serial_consistency(cl)) {
+        throw exceptions::invalid_request_exception("Invalid consistency for conditional update. Must be one of SERIAL or LOCAL_SERIAL");
+    }
 }
 
 void validate_counter_for_write(schema_ptr s, consistency_level cl) {
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/statvfs.h>
+#include <tuple>
+
+#include "db/data_directories.hh"
+#include "utils/io_queue.hh"
+#include "log.hh"
+
+static logging::logger logger("data_directories");
+
+namespace db {
+
+constexpr std::chrono::seconds data_directories::refresh_period;
+
+data_directories::data_directories()
+    : _refresh_timer([this] { refresh_free_space(); })
+{ }
+
+static bool is_under(const sstring& path, const sstring& dir) {
+    return path.size() >= dir.size() && std::equal(dir.begin(), dir.end(), path.begin())
+        && (path.size() == dir.size() || path[dir.size()] == '/');
+}
+
+data_directories::directory* data_directories::find(const sstring& path) {
+    return const_cast<directory*>(const_cast<const data_directories*>(this)->find(path));
+}
+
+const data_directories::directory* data_directories::find(const sstring& path) const {
+    for (auto&& d : _dirs) {
+        if (is_under(path, d.path)) {
+            return &d;
+        }
+    }
+    return nullptr;
+}
+
+void data_directories::add(sstring path) {
+    while (path.size() > 1 && path[path.size() - 1] == '/') {
+        path.resize(path.size() - 1);
+    }
+    if (find(path)) {
+        return;
+    }
+    _dirs.push_back(directory{std::move(path), {}});
+    if (_dirs.size() > 1) {
+        for (auto&& d : _dirs) {
+            add_directory_io_queue(d.path);
+        }
+    }
+    if (!_refresh_timer.armed()) {
+        _refresh_timer.arm_periodic(refresh_period);
+    }
+    refresh_free_space();
+}
+
+void data_directories::refresh_free_space() {
+    for (auto&& d : _dirs) {
+        // The file system answers from memory; this doesn't wait for a disk.
+        struct statvfs st;
+        if (::statvfs(d.path.c_str(), &st) != 0) {
+            logger.debug("Can't get the free space of {}: {}", d.path, strerror(errno));
+            continue;
+        }
+        d.stats.free_space = uint64_t(st.f_bavail) * st.f_frsize;
+        d.stats.total_space = uint64_t(st.f_blocks) * st.f_frsize;
+    }
+}
+
+const sstring& data_directories::pick(const std::vector<sstring>& dirs) const {
+    // Most free space per write in progress first, then fewest writes in
+    // progress, then fewest sstables written, which goes round-robin when
+    // the free space is unknown.
+    auto key = [this] (const sstring& dir) {
+        auto d = find(dir);
+        if (!d) {
+            return std::make_tuple(false, 0.0, 0, int64_t(0));
+        }
+        auto& st = d->stats;
+        return std::make_tuple(true, double(st.free_space) / (1 + st.pending_writes),
+                -int(st.pending_writes), -int64_t(st.sstables_written));
+    };
+    auto best = dirs.begin();
+    auto best_key = key(*best);
+    for (auto i = std::next(best); i != dirs.end(); ++i) {
+        auto k = key(*i);
+        if (k > best_key) {
+            best = i;
+            best_key = k;
+        }
+    }
+    return *best;
+}
+
+void data_directories::write_started(const sstring& dir) {
+    auto d = find(dir);
+    if (d) {
+        ++d->stats.pending_writes;
+        ++d->stats.sstables_written;
+    }
+}
+
+void data_directories::write_finished(const sstring& dir) {
+    auto d = find(dir);
+    if (d && d->stats.pending_writes) {
+        --d->stats.pending_writes;
+    }
+}
+
+}
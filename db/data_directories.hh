@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <seastar/core/sstring.hh>
+#include <seastar/core/timer.hh>
+
+namespace db {
+
+/**
+ * The data_file_directories as seen by a shard, which places the sstables
+ * it writes across them.
+ *
+ * A new sstable goes to the directory with the most free space per sstable
+ * being written to it, so that directories on disks of their own, rather
+ * than merged into one RAID0 volume, fill up evenly and share the writes of
+ * flushes and compactions, and with them the reads of the sstables. Free
+ * space is refreshed periodically, not on each pick.
+ *
+ * With more than one directory, each also gets a queue of disk I/O of its
+ * own, see add_directory_io_queue(), so that each disk is kept at its own
+ * queue depth.
+ */
+class data_directories {
+public:
+    static constexpr std::chrono::seconds refresh_period{30};
+
+    struct stats {
+        uint64_t free_space = 0;
+        uint64_t total_space = 0;
+        unsigned pending_writes = 0;
+        uint64_t sstables_written = 0;
+    };
+private:
+    struct directory {
+        sstring path;
+        struct stats stats;
+    };
+    std::vector<directory> _dirs;
+    timer<lowres_clock> _refresh_timer;
+private:
+    directory* find(const sstring& path);
+    const directory* find(const sstring& path) const;
+public:
+    data_directories();
+
+    // Adds a data directory. Directories added after the first get a queue
+    // of disk I/O of their own, and so does the first when they do.
+    void add(sstring path);
+
+    size_t size() const {
+        return _dirs.size();
+    }
+    const sstring& path(size_t i) const {
+        return _dirs[i].path;
+    }
+    const struct stats& get_stats(size_t i) const {
+        return _dirs[i].stats;
+    }
+
+    // Reads the free space of the directories from their file systems.
+    void refresh_free_space();
+
+    // Of directories under distinct data directories, such as the
+    // directories of a table in each, the one to write a new sstable to.
+    // Directories under none of the data directories are never picked
+    // unless all are.
+    const sstring& pick(const std::vector<sstring>& dirs) const;
+
+    // The writing of an sstable to a directory under a data directory
+    // started or ended.
+    void write_started(const sstring& dir);
+    void write_finished(const sstring& dir);
+};
+
+}
@@ -0,0 +1,475 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <boost/range/adaptor/map.hpp>
+#include <boost/range/algorithm/count_if.hpp>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/scollectd.hh>
+#include <seastar/core/seastar.hh>
+
+#include "manager.hh"
+#include "database.hh"
+#include "db/config.hh"
+#include "db_clock.hh"
+#include "gms/failure_detector.hh"
+#include "lister.hh"
+#include "log.hh"
+#include "service/storage_proxy.hh"
+#include "service/storage_service.hh"
+#include "utils/data_input.hh"
+#include "utils/rate_limiter.hh"
+
+static logging::logger logger("hints_manager");
+
+namespace db {
+
+namespace hints {
+
+constexpr std::chrono::seconds manager::delivery_period;
+
+manager::config::config(const db::config& cfg)
+    : hints_directory(cfg.hints_directory())
+    , max_size_per_endpoint(uint64_t(cfg.max_hints_size_per_endpoint_in_mb()) * 1024 * 1024 / smp::count)
+    , throttle_in_kb(cfg.hinted_handoff_throttle_in_kb())
+    , max_hint_window(cfg.max_hint_window_in_ms())
+    , segment_size_in_mb(cfg.commitlog_segment_size_in_mb())
+    , sync_period_in_ms(cfg.commitlog_sync_period_in_ms())
+{}
+
+manager::manager(service::storage_proxy& proxy, config cfg)
+    : _proxy(proxy)
+    , _cfg(std::move(cfg))
+    , _timer(std::bind(&manager::on_timer, this))
+{}
+
+manager::~manager() {}
+
+void manager::setup_collectd() {
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("hints"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "written")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.written)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("hints"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "dropped")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.dropped)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("hints"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "sent")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.sent)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("hints"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "expired")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.expired)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("hints"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "send_errors")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.send_errors)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("hints"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "size_on_disk")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return size_on_disk(); })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("hints"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "endpoints")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _endpoints.size(); })
+        ),
+    }));
+}
+
+sstring manager::shard_directory() const {
+    return _cfg.hints_directory + "/" + to_sstring(engine().cpu_id());
+}
+
+manager::endpoint_hints_ptr manager::get_endpoint(gms::inet_address ep) {
+    auto i = _endpoints.find(ep);
+    if (i == _endpoints.end()) {
+        auto eh = make_lw_shared<endpoint_hints>(ep, sprint("%s/%s", shard_directory(), ep));
+        i = _endpoints.emplace(ep, std::move(eh)).first;
+    }
+    return i->second;
+}
+
+uint64_t manager::size_on_disk(const endpoint_hints& eh) const {
+    // Segments are pre-allocated, so a closed one takes its full size.
+    auto size = eh.segments.size() * _cfg.segment_size_in_mb * 1024 * 1024;
+    if (eh.log) {
+        size += eh.log->get_total_size();
+    }
+    return size;
+}
+
+uint64_t manager::size_on_disk() const {
+    uint64_t size = 0;
+    for (auto& eh : _endpoints | boost::adaptors::map_values) {
+        size += size_on_disk(*eh);
+    }
+    return size;
+}
+
+commitlog::config manager::log_config(const endpoint_hints& eh) const {
+    commitlog::config cfg;
+    cfg.commit_log_location = eh.dir;
+    // Hints are never flushed anywhere, segments go away once delivered.
+    cfg.commitlog_total_space_in_mb = 0;
+    cfg.commitlog_segment_size_in_mb = _cfg.segment_size_in_mb;
+    cfg.commitlog_sync_period_in_ms = _cfg.sync_period_in_ms;
+    cfg.max_reserve_segments = 0;
+    cfg.register_metrics = false;
+    cfg.mode = commitlog::sync_mode::PERIODIC;
+    return cfg;
+}
+
+future<commitlog*> manager::get_log(endpoint_hints_ptr eh) {
+    if (eh->log) {
+        return make_ready_future<commitlog*>(eh->log.get());
+    }
+    return eh->log_create.wait().then([this, eh] {
+        if (eh->log) {
+            return make_ready_future<commitlog*>(eh->log.get());
+        }
+        return recursive_touch_directory(eh->dir).then([this, eh] {
+            return commitlog::create_commitlog(log_config(*eh));
+        }).then([eh] (commitlog log) {
+            eh->log = std::make_unique<commitlog>(std::move(log));
+            return eh->log.get();
+        });
+    }).finally([eh] {
+        eh->log_create.signal();
+    });
+}
+
+future<std::deque<sstring>> manager::list_segments(sstring dir) {
+    auto segments = make_lw_shared<std::vector<std::pair<segment_id_type, sstring>>>();
+    return lister::scan_dir(dir, directory_entry_type::regular, [dir, segments] (directory_entry de) {
+        try {
+            commitlog::descriptor d(de.name);
+            segments->emplace_back(d.id, dir + "/" + de.name);
+        } catch (std::domain_error& e) {
+            logger.warn("Ignoring {} in {}: {}", de.name, dir, e.what());
+        }
+        return make_ready_future<>();
+    }).then([segments] {
+        std::sort(segments->begin(), segments->end());
+        std::deque<sstring> paths;
+        for (auto& s : *segments) {
+            paths.emplace_back(std::move(s.second));
+        }
+        return paths;
+    });
+}
+
+// Closes the active segments of the endpoint, if any, so that all of its
+// hints are in closed segments, and refreshes the list of them.
+future<> manager::close_log(endpoint_hints_ptr eh) {
+    return eh->log_lock.write_lock().then([this, eh] {
+        auto f = make_ready_future<>();
+        if (eh->log) {
+            auto log = std::move(eh->log);
+            auto l = log.get();
+            f = l->shutdown().finally([log = std::move(log)] {});
+        }
+        return f.then([this, eh] {
+            return list_segments(eh->dir);
+        }).then([eh] (std::deque<sstring> segments) {
+            eh->segments = std::move(segments);
+        }).finally([eh] {
+            eh->log_lock.write_unlock();
+        });
+    });
+}
+
+future<> manager::start() {
+    return recursive_touch_directory(shard_directory()).then([this] {
+        return lister::scan_dir(shard_directory(), directory_entry_type::directory, [this] (directory_entry de) {
+            gms::inet_address ep;
+            try {
+                ep = gms::inet_address(de.name);
+            } catch (...) {
+                logger.warn("Ignoring {} in {}", de.name, shard_directory());
+                return make_ready_future<>();
+            }
+            auto eh = get_endpoint(ep);
+            return list_segments(eh->dir).then([eh] (std::deque<sstring> segments) {
+                eh->segments = std::move(segments);
+            });
+        });
+    }).then([this] {
+        auto pending = boost::count_if(_endpoints | boost::adaptors::map_values, [] (auto& eh) {
+            return !eh->segments.empty();
+        });
+        if (pending) {
+            logger.info("Found hints for {} endpoints", pending);
+        }
+        setup_collectd();
+        _started = true;
+        _timer.arm(clock_type::now() + delivery_period);
+    });
+}
+
+future<> manager::stop() {
+    _stopping = true;
+    _timer.cancel();
+    return _gate.close().then([this] {
+        return parallel_for_each(_endpoints | boost::adaptors::map_values, [this] (endpoint_hints_ptr eh) {
+            return eh->log_lock.write_lock().then([eh] {
+                if (!eh->log) {
+                    return make_ready_future<>();
+                }
+                return eh->log->shutdown();
+            }).finally([eh] {
+                eh->log_lock.write_unlock();
+            });
+        });
+    });
+}
+
+bool manager::can_hint(gms::inet_address ep) {
+    if (!_started || _stopping) {
+        return false;
+    }
+    auto i = _endpoints.find(ep);
+    if (i == _endpoints.end()) {
+        return true;
+    }
+    auto& eh = *i->second;
+    if (eh.down_since && clock_type::now() - *eh.down_since > _cfg.max_hint_window) {
+        logger.trace("Not hinting {}, down for longer than the hint window", ep);
+        return false;
+    }
+    if (_cfg.max_size_per_endpoint && size_on_disk(eh) >= _cfg.max_size_per_endpoint) {
+        logger.trace("Not hinting {}, its hints take {} bytes already", ep, size_on_disk(eh));
+        return false;
+    }
+    return true;
+}
+
+future<> manager::store_hint(gms::inet_address ep, lw_shared_ptr<const frozen_mutation> fm) {
+    auto eh = get_endpoint(ep);
+    if (!eh->down_since && !gms::get_local_failure_detector().is_alive(ep)) {
+        eh->down_since = clock_type::now();
+    }
+    return seastar::with_gate(_gate, [this, eh, fm] {
+        return eh->log_lock.read_lock().then([this, eh, fm] {
+            return get_log(eh).then([fm] (commitlog* log) {
+                int64_t written_at = db_clock::now().time_since_epoch().count();
+                auto size = sizeof(int64_t) + fm->representation().size();
+                return log->add_mutation(fm->column_family_id(), size, [fm, written_at] (data_output& out) {
+                    auto repr = fm->representation();
+                    out.write(written_at);
+                    out.write(repr.begin(), repr.end());
+                });
+            }).finally([eh] {
+                eh->log_lock.read_unlock();
+            });
+        });
+    }).then_wrapped([this, eh] (future<replay_position> f) {
+        try {
+            f.get();
+            ++_stats.written;
+            ++eh->written;
+        } catch (...) {
+            ++_stats.dropped;
+            ++eh->dropped;
+            logger.warn("Could not store a hint for {}: {}", eh->ep, std::current_exception());
+        }
+    });
+}
+
+// The rate is split between the nodes expected to deliver hints at the same
+// time, as in origin, and between the shards of this one.
+size_t manager::throttle() const {
+    if (!_cfg.throttle_in_kb) {
+        return 0;
+    }
+    auto nodes = service::get_local_storage_service().get_token_metadata().get_all_endpoints().size();
+    auto senders = std::max<size_t>(nodes, 2) - 1;
+    return std::max<size_t>(size_t(_cfg.throttle_in_kb) * 1024 / senders / smp::count, 1);
+}
+
+bool manager::can_send(const endpoint_hints& eh) const {
+    return !_stopping && !_paused && gms::get_local_failure_detector().is_alive(eh.ep);
+}
+
+void manager::on_timer() {
+    for (auto& eh : _endpoints | boost::adaptors::map_values) {
+        if (!gms::get_local_failure_detector().is_alive(eh->ep)) {
+            if (!eh->down_since) {
+                eh->down_since = clock_type::now();
+            }
+            continue;
+        }
+        eh->down_since = {};
+        send_hints(eh);
+    }
+    _timer.arm(clock_type::now() + delivery_period);
+}
+
+void manager::schedule_delivery(gms::inet_address ep) {
+    auto i = _endpoints.find(ep);
+    if (i != _endpoints.end()) {
+        send_hints(i->second);
+    }
+}
+
+void manager::send_hints(endpoint_hints_ptr eh) {
+    if (eh->sending || !can_send(*eh) || (eh->segments.empty() && !eh->log)) {
+        return;
+    }
+    eh->sending = true;
+    logger.debug("Sending hints to {}", eh->ep);
+    seastar::with_gate(_gate, [this, eh] {
+        return close_log(eh).then([this, eh] {
+            return send_segments(eh, make_lw_shared<utils::rate_limiter>(throttle()));
+        });
+    }).handle_exception([eh] (auto ep) {
+        logger.warn("Stopped sending hints to {}: {}", eh->ep, ep);
+    }).finally([eh] {
+        eh->sending = false;
+    });
+}
+
+future<> manager::send_segments(endpoint_hints_ptr eh, lw_shared_ptr<utils::rate_limiter> limiter) {
+    return repeat([this, eh, limiter] {
+        if (eh->segments.empty() || !can_send(*eh)) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        auto path = eh->segments.front();
+        return send_segment(eh, path, limiter).then([eh, path] {
+            logger.debug("Sent the hints of {} to {}", path, eh->ep);
+            // Unless truncated meanwhile.
+            if (!eh->segments.empty() && eh->segments.front() == path) {
+                eh->segments.pop_front();
+                return remove_file(path);
+            }
+            return make_ready_future<>();
+        }).then([] {
+            return stop_iteration::no;
+        });
+    }).finally([limiter] {});
+}
+
+future<> manager::send_segment(endpoint_hints_ptr eh, sstring path, lw_shared_ptr<utils::rate_limiter> limiter) {
+    return commitlog::read_log_file(path, [this, eh, limiter] (temporary_buffer<char> buf, replay_position) {
+        return send_one(eh, std::move(buf), limiter);
+    }).then([] (auto s) {
+        auto f = s.done();
+        return f.finally([s = std::move(s)] {});
+    });
+}
+
+// Throws if the hint could not be delivered, so that the segment is kept
+// and delivered again, from its start, by a later round.
+future<> manager::send_one(endpoint_hints_ptr eh, temporary_buffer<char> buf, lw_shared_ptr<utils::rate_limiter> limiter) {
+    if (!can_send(*eh)) {
+        return make_exception_future<>(std::runtime_error(sprint("%s is not available", eh->ep)));
+    }
+    data_input in(buf);
+    auto written_at = db_clock::time_point(db_clock::duration(in.read<int64_t>()));
+    auto repr = in.read_view(in.avail());
+    frozen_mutation fm(bytes(repr.data(), repr.size()));
+
+    schema_ptr s;
+    try {
+        s = _proxy.get_db().local().find_schema(fm.column_family_id());
+    } catch (no_such_column_family&) {
+        ++_stats.expired;
+        return make_ready_future<>();
+    }
+    if (db_clock::now() - written_at > s->gc_grace_seconds()) {
+        ++_stats.expired;
+        return make_ready_future<>();
+    }
+    return limiter->reserve(buf.size()).then([this, eh, fm = std::move(fm)] () mutable {
+        return _proxy.send_hint(std::move(fm), eh->ep);
+    }).then_wrapped([this] (future<> f) {
+        try {
+            f.get();
+            ++_stats.sent;
+        } catch (...) {
+            ++_stats.send_errors;
+            throw;
+        }
+    });
+}
+
+future<> manager::truncate(gms::inet_address ep) {
+    auto i = _endpoints.find(ep);
+    if (i == _endpoints.end()) {
+        return make_ready_future<>();
+    }
+    auto eh = i->second;
+    if (eh->segments.empty() && !eh->log) {
+        return make_ready_future<>();
+    }
+    return close_log(eh).then([eh] {
+        return do_with(std::move(eh->segments), [eh] (std::deque<sstring>& segments) {
+            eh->segments.clear();
+            return parallel_for_each(segments, [] (const sstring& path) {
+                return remove_file(path);
+            });
+        });
+    }).then([eh] {
+        logger.info("Dropped all the hints for {}", eh->ep);
+    });
+}
+
+future<> manager::truncate_all() {
+    auto eps = boost::copy_range<std::vector<gms::inet_address>>(_endpoints | boost::adaptors::map_keys);
+    return do_with(std::move(eps), [this] (auto& eps) {
+        return parallel_for_each(eps, [this] (gms::inet_address ep) {
+            return this->truncate(ep);
+        });
+    });
+}
+
+std::vector<gms::inet_address> manager::endpoints_pending_hints() const {
+    std::vector<gms::inet_address> eps;
+    for (auto& eh : _endpoints | boost::adaptors::map_values) {
+        if (!eh->segments.empty() || eh->log) {
+            eps.push_back(eh->ep);
+        }
+    }
+    return eps;
+}
+
+uint64_t manager::written_hints(gms::inet_address ep) const {
+    auto i = _endpoints.find(ep);
+    return i == _endpoints.end() ? 0 : i->second->written;
+}
+
+uint64_t manager::dropped_hints(gms::inet_address ep) const {
+    auto i = _endpoints.find(ep);
+    return i == _endpoints.end() ? 0 : i->second->dropped;
+}
+
+}
+
+}
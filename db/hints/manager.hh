@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <experimental/optional>
+#include <seastar/core/future.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/rwlock.hh>
+#include <seastar/core/shared_ptr.hh>
+
+#include "db/commitlog/commitlog.hh"
+#include "gms/inet_address.hh"
+#include "frozen_mutation.hh"
+
+namespace scollectd {
+
+struct registrations;
+
+}
+
+namespace service {
+
+class storage_proxy;
+
+}
+
+namespace utils {
+
+class rate_limiter;
+
+}
+
+namespace db {
+
+class config;
+
+namespace hints {
+
+/**
+ * Keeps the writes which could not be delivered to a replica, and
+ * delivers them once the replica is seen alive again.
+ *
+ * Each shard keeps the hints it wrote, in a commitlog per target endpoint
+ * living in <hints_directory>/<shard>/<endpoint>. A hint is the time it was
+ * written at, in milliseconds, followed by the frozen mutation.
+ *
+ * Delivery closes the active segments of an endpoint and replays the
+ * closed ones, oldest first, throttled, deleting each of them once all of
+ * its hints were acknowledged. Hints older than the gc grace period of
+ * their table are dropped rather than delivered, so that they can't bring
+ * back data deleted in the meantime.
+ */
+class manager {
+public:
+    struct config {
+        sstring hints_directory;
+        // Disk space the hints of a single endpoint may take on this shard.
+        // 0 means no limit.
+        uint64_t max_size_per_endpoint = 0;
+        // For the whole node, in kilobytes per second. 0 disables throttling.
+        uint32_t throttle_in_kb = 1024;
+        // Hints are no longer stored for endpoints down for longer.
+        std::chrono::milliseconds max_hint_window = std::chrono::hours(3);
+        uint64_t segment_size_in_mb = 32;
+        uint64_t sync_period_in_ms = 10 * 1000;
+
+        config() = default;
+        config(const db::config&);
+    };
+
+    struct stats {
+        uint64_t written = 0;
+        // Hints which could not be stored.
+        uint64_t dropped = 0;
+        uint64_t sent = 0;
+        // Hints dropped on replay, as older than their gc grace period or
+        // belonging to a table which is gone.
+        uint64_t expired = 0;
+        uint64_t send_errors = 0;
+    };
+private:
+    using clock_type = lowres_clock;
+    static constexpr std::chrono::seconds delivery_period = std::chrono::seconds(10);
+
+    struct endpoint_hints {
+        gms::inet_address ep;
+        sstring dir;
+        // Created by the first hint stored, dropped when its segments are
+        // closed for delivery.
+        std::unique_ptr<commitlog> log;
+        semaphore log_create{1};
+        // Held for reading while storing a hint, and for writing while
+        // closing the log.
+        rwlock log_lock;
+        // Paths of the closed segments, oldest first.
+        std::deque<sstring> segments;
+        // When this shard first saw the endpoint down.
+        std::experimental::optional<clock_type::time_point> down_since;
+        bool sending = false;
+        uint64_t written = 0;
+        uint64_t dropped = 0;
+
+        endpoint_hints(gms::inet_address e, sstring d)
+            : ep(e), dir(std::move(d)) {}
+    };
+    using endpoint_hints_ptr = lw_shared_ptr<endpoint_hints>;
+
+    service::storage_proxy& _proxy;
+    config _cfg;
+    stats _stats;
+    std::unordered_map<gms::inet_address, endpoint_hints_ptr> _endpoints;
+    timer<clock_type> _timer;
+    seastar::gate _gate;
+    bool _started = false;
+    bool _stopping = false;
+    bool _paused = false;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+private:
+    sstring shard_directory() const;
+    endpoint_hints_ptr get_endpoint(gms::inet_address ep);
+    uint64_t size_on_disk(const endpoint_hints& eh) const;
+    commitlog::config log_config(const endpoint_hints& eh) const;
+    future<commitlog*> get_log(endpoint_hints_ptr eh);
+    future<> close_log(endpoint_hints_ptr eh);
+    future<std::deque<sstring>> list_segments(sstring dir);
+    size_t throttle() const;
+    bool can_send(const endpoint_hints& eh) const;
+    void on_timer();
+    void send_hints(endpoint_hints_ptr eh);
+    future<> send_segments(endpoint_hints_ptr eh, lw_shared_ptr<utils::rate_limiter> limiter);
+    future<> send_segment(endpoint_hints_ptr eh, sstring path, lw_shared_ptr<utils::rate_limiter> limiter);
+    future<> send_one(endpoint_hints_ptr eh, temporary_buffer<char> buf, lw_shared_ptr<utils::rate_limiter> limiter);
+    void setup_collectd();
+public:
+    manager(service::storage_proxy& proxy, config cfg);
+    ~manager();
+
+    // Picks up the hints left on disk by a previous run, and starts
+    // delivering them.
+    future<> start();
+    future<> stop();
+
+    // Whether a hint for ep should be stored now: the endpoint was not
+    // down for longer than the hint window, and its hints fit the cap.
+    bool can_hint(gms::inet_address ep);
+    // Resolves once the hint is on its way to disk. Failures are
+    // accounted as dropped hints, not reported to the caller.
+    future<> store_hint(gms::inet_address ep, lw_shared_ptr<const frozen_mutation> fm);
+
+    // Starts delivering the hints of ep now rather than at the next
+    // delivery round, provided it is alive.
+    void schedule_delivery(gms::inet_address ep);
+    void pause_delivery(bool pause) {
+        _paused = pause;
+    }
+    // Drops all the hints stored for ep.
+    future<> truncate(gms::inet_address ep);
+    future<> truncate_all();
+
+    std::vector<gms::inet_address> endpoints_pending_hints() const;
+    uint64_t written_hints(gms::inet_address ep) const;
+    uint64_t dropped_hints(gms::inet_address ep) const;
+    uint64_t size_on_disk() const;
+
+    const stats& get_stats() const {
+        return _stats;
+    }
+};
+
+}
+
+}
@@ -40,9 +40,315 @@
  */
 
 #include "secondary_index.hh"
+#include "database.hh"
+#include "frozen_mutation.hh"
+#include "schema_builder.hh"
+#include "log.hh"
+#include "core/future-util.hh"
+#include "core/do_with.hh"
+#include <boost/range/algorithm/sort.hpp>
+#include <boost/range/algorithm/unique.hpp>
+#include <boost/range/algorithm_ext/erase.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
+
+static logging::logger logger("secondary_index");
 
 const sstring db::index::secondary_index::custom_index_option_name = "class_name";
 const sstring db::index::secondary_index::index_keys_option_name = "index_keys";
 const sstring db::index::secondary_index::index_values_option_name = "index_values";
 const sstring db::index::secondary_index::index_entries_option_name = "index_keys_and_values";
 
+namespace db {
+namespace index {
+
+static sstring index_name(const column_definition& cd) {
+    return cd.idx_info.index_name ? *cd.idx_info.index_name : cd.name_as_text();
+}
+
+schema_ptr secondary_index::make_index_schema(const schema& base, const column_definition& cd) {
+    // Named as Origin names the column families of its KEYS indexes.
+    auto cf_name = base.cf_name() + "." + index_name(cd);
+    schema_builder builder(base.ks_name(), cf_name, generate_legacy_id(base.ks_name(), cf_name));
+    builder.with_column(cd.name(), cd.type, column_kind::partition_key);
+    builder.with_column(to_bytes("partition_key"), bytes_type, column_kind::clustering_key);
+    builder.with_column(to_bytes("clustering_key"), bytes_type, column_kind::clustering_key);
+    builder.set_comment(sprint("Secondary index %s of %s.%s", index_name(cd), base.ks_name(), base.cf_name()));
+    return builder.build();
+}
+
+secondary_index::secondary_index(column_family& base, const column_definition& cd, compaction_manager& cm)
+    : _base(base)
+    , _column(cd.name())
+    , _name(index_name(cd))
+    , _schema(make_index_schema(*base.schema(), cd))
+{
+    column_family::config cfg;
+    cfg.enable_disk_writes = false;
+    cfg.enable_disk_reads = false;
+    cfg.enable_commitlog = false;
+    cfg.enable_cache = false;
+    // Never flushed, so kept out of the dirty memory accounting, lest the
+    // index block writes.
+    cfg.max_memtable_size = std::numeric_limits<size_t>::max();
+    cfg.dirty_memory_region_group = nullptr;
+    _cf = make_lw_shared<column_family>(_schema, std::move(cfg), column_family::no_commitlog(), cm);
+}
+
+secondary_index::~secondary_index() {
+}
+
+void secondary_index::apply(const mutation& m) {
+    auto cd = m.schema()->get_column_definition(_column);
+    if (!cd) {
+        return;
+    }
+    auto pk = to_bytes(m.key().representation());
+    for (const rows_entry& e : m.partition().clustered_rows()) {
+        auto c = e.row().cells().find_cell(cd->id);
+        if (!c) {
+            continue;
+        }
+        auto cell = c->as_atomic_cell();
+        // Empty values are no partition keys, so they cannot be looked up.
+        if (!cell.is_live() || cell.value().empty()) {
+            continue;
+        }
+        mutation entry(partition_key::from_single_value(*_schema, to_bytes(cell.value())), _schema);
+        auto ck = clustering_key::from_exploded(*_schema, { pk, to_bytes(e.key().representation()) });
+        auto& row = entry.partition().clustered_row(std::move(ck));
+        if (cell.is_live_and_has_ttl()) {
+            row.apply(row_marker(cell.timestamp(), cell.ttl(), cell.expiry()));
+        } else {
+            row.apply(row_marker(cell.timestamp()));
+        }
+        _cf->apply(entry);
+    }
+}
+
+future<> secondary_index::build() {
+    auto generation = ++_build_generation;
+    _built = false;
+    logger.info("Building index {} of {}.{}", _name, _base.schema()->ks_name(), _base.schema()->cf_name());
+    auto reader = make_lw_shared(_base.make_reader());
+    auto self = shared_from_this();
+    return consume(*reader, [this, self, generation] (mutation&& m) {
+        if (_stopped || generation != _build_generation) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        this->apply(m);
+        // The partitions of memtables come ready, so let others run.
+        return later().then([] {
+            return stop_iteration::no;
+        });
+    }).then([this, self, reader, generation] {
+        if (!_stopped && generation == _build_generation) {
+            _built = true;
+            logger.info("Index {} of {}.{} built", _name, _base.schema()->ks_name(), _base.schema()->cf_name());
+        }
+    });
+}
+
+void secondary_index::clear() {
+    _built = false;
+    _cf->clear();
+}
+
+future<> secondary_index::stop() {
+    _stopped = true;
+    _built = false;
+    return _cf->stop();
+}
+
+future<std::vector<query::partition_range>>
+secondary_index::lookup(bytes value, std::vector<query::partition_range> ranges, gc_clock::time_point now) const {
+    auto key = dht::global_partitioner().decorate_key(*_schema, partition_key::from_single_value(*_schema, std::move(value)));
+    auto range = make_lw_shared(query::partition_range::make_singular(dht::ring_position(key)));
+    auto reader = make_lw_shared(_cf->make_reader(*range));
+    auto self = shared_from_this();
+    return (*reader)().then([this, self, range, reader, ranges = std::move(ranges), now] (mutation_opt mo) {
+        std::vector<dht::decorated_key> keys;
+        if (!mo) {
+            return std::vector<query::partition_range>();
+        }
+        auto base = _base.schema();
+        dht::ring_position_comparator cmp(*base);
+        auto& p = mo->partition();
+        for (const rows_entry& e : p.clustered_rows()) {
+            if (!e.row().marker().is_live(p.tombstone_for_row(*_schema, e), now)) {
+                continue;
+            }
+            auto pk = partition_key::from_bytes(std::move(e.key().explode(*_schema)[0]));
+            // The entries of the rows of a partition are adjacent.
+            if (!keys.empty() && keys.back().key().equal(*base, pk)) {
+                continue;
+            }
+            auto dk = dht::global_partitioner().decorate_key(*base, std::move(pk));
+            dht::ring_position pos(dk);
+            if (boost::algorithm::any_of(ranges, [&] (const query::partition_range& r) { return r.contains(pos, cmp); })) {
+                keys.emplace_back(std::move(dk));
+            }
+        }
+        boost::sort(keys, dht::decorated_key::less_comparator(base));
+        boost::erase(keys, boost::unique<boost::return_found_end>(keys, [&base] (auto& k1, auto& k2) {
+            return k1.equal(*base, k2);
+        }));
+        std::vector<query::partition_range> result;
+        result.reserve(keys.size());
+        for (auto&& dk : keys) {
+            result.emplace_back(query::partition_range::make_singular(dht::ring_position(std::move(dk))));
+        }
+        return result;
+    });
+}
+
+class index_filtering_reader final : public mutation_reader::impl {
+    mutation_reader _rd;
+    column_id _column;
+    bytes _value;
+    gc_clock::time_point _now;
+    mutation_opt _current;
+private:
+    // The rows of m holding the value, with the static row and the
+    // tombstones covering them, or nothing if there is none.
+    mutation_opt select_rows(mutation&& m) const {
+        auto& s = *m.schema();
+        auto& p = m.partition();
+        mutation_opt r;
+        for (const rows_entry& e : p.clustered_rows()) {
+            auto c = e.row().cells().find_cell(_column);
+            if (!c) {
+                continue;
+            }
+            auto cell = c->as_atomic_cell();
+            auto t = p.tombstone_for_row(s, e);
+            if (!cell.is_live(t, _now) || cell.value() != bytes_view(_value)) {
+                continue;
+            }
+            if (!r) {
+                r = mutation(m.decorated_key(), m.schema());
+                r->partition().apply(p.partition_tombstone());
+                r->partition().static_row() = row(p.static_row());
+            }
+            auto& selected = r->partition().clustered_row(e.key());
+            selected = deletable_row(e.row());
+            selected.apply(t);
+        }
+        return r;
+    }
+public:
+    index_filtering_reader(mutation_reader rd, column_id column, bytes value, gc_clock::time_point now)
+        : _rd(std::move(rd))
+        , _column(column)
+        , _value(std::move(value))
+        , _now(now)
+    { }
+    virtual future<mutation_opt> operator()() override {
+        return repeat([this] {
+            return _rd().then([this] (mutation_opt&& mo) {
+                if (!mo) {
+                    _current = {};
+                    return stop_iteration::yes;
+                }
+                _current = select_rows(std::move(*mo));
+                return stop_iteration(bool(_current));
+            });
+        }).then([this] {
+            return make_ready_future<mutation_opt>(std::move(_current));
+        });
+    }
+};
+
+mutation_reader make_index_filtering_reader(mutation_reader rd, column_id column, bytes value, gc_clock::time_point now) {
+    return make_mutation_reader<index_filtering_reader>(std::move(rd), column, std::move(value), now);
+}
+
+}
+}
+
+secondary_index_manager::secondary_index_manager(column_family& cf, compaction_manager& cm)
+    : _cf(cf)
+    , _compaction_manager(cm)
+{ }
+
+secondary_index_manager::~secondary_index_manager() {
+}
+
+void secondary_index_manager::start_build(lw_shared_ptr<db::index::secondary_index> idx) {
+    with_gate(_background, [idx] {
+        return idx->build();
+    }).handle_exception([idx] (std::exception_ptr ep) {
+        logger.error("Failed to build index {}: {}", idx->name(), ep);
+    });
+}
+
+void secondary_index_manager::update() {
+    if (_background.is_closed()) {
+        return;
+    }
+    auto& s = *_cf.schema();
+    for (auto i = _indexes.begin(); i != _indexes.end();) {
+        auto cd = s.get_column_definition(i->first);
+        if (cd && cd->idx_info.index_type != index_type::none) {
+            ++i;
+            continue;
+        }
+        logger.info("Dropping index {} of {}.{}", i->second->name(), s.ks_name(), s.cf_name());
+        with_gate(_background, [idx = i->second] {
+            return idx->stop();
+        });
+        i = _indexes.erase(i);
+    }
+    for (auto&& cd : s.regular_columns()) {
+        if (cd.idx_info.index_type == index_type::none || _indexes.count(cd.name())) {
+            continue;
+        }
+        auto idx = make_lw_shared<db::index::secondary_index>(_cf, cd, _compaction_manager);
+        _indexes.emplace(cd.name(), idx);
+        start_build(std::move(idx));
+    }
+}
+
+void secondary_index_manager::rebuild() {
+    if (_background.is_closed()) {
+        return;
+    }
+    for (auto&& e : _indexes) {
+        start_build(e.second);
+    }
+}
+
+void secondary_index_manager::clear() {
+    for (auto&& e : _indexes) {
+        e.second->clear();
+    }
+    rebuild();
+}
+
+void secondary_index_manager::apply(const mutation& m) {
+    for (auto&& e : _indexes) {
+        e.second->apply(m);
+    }
+}
+
+void secondary_index_manager::apply(const frozen_mutation& m) {
+    apply(m.unfreeze(_cf.schema()));
+}
+
+lw_shared_ptr<db::index::secondary_index> secondary_index_manager::find(const bytes& column) const {
+    auto i = _indexes.find(column);
+    if (i == _indexes.end()) {
+        return {};
+    }
+    return i->second;
+}
+
+future<> secondary_index_manager::stop() {
+    auto indexes = std::move(_indexes);
+    for (auto&& e : indexes) {
+        with_gate(_background, [idx = e.second] {
+            return idx->stop();
+        });
+    }
+    return _background.close();
+}
+
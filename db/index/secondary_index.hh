@@ -42,17 +42,78 @@
 #pragma once
 
 #include "core/sstring.hh"
+#include "core/shared_ptr.hh"
+#include "core/future.hh"
+#include "database_fwd.hh"
+#include "schema.hh"
+#include "query-request.hh"
+#include "mutation_reader.hh"
+
+class column_family;
+class compaction_manager;
 
 namespace db {
 namespace index {
 
 /**
- * Abstract base class for different types of secondary indexes.
+ * A local secondary index of a regular column.
+ *
+ * Indexes the rows of this shard only. Its entries live in a hidden,
+ * memory-only column family, partitioned by the indexed value and clustered
+ * by the keys of the base rows holding it. Entries are added as the base
+ * table is written to, but not removed when the value is overwritten or
+ * deleted: readers check the base rows the entries lead to, and skip the
+ * stale ones.
  *
- * Do not extend this directly, please pick from PerColumnSecondaryIndex or PerRowSecondaryIndex
+ * Being in memory only, the index is built from the base table anew
+ * whenever it is created, in the background. Until it is built, lookups
+ * scan the base table instead.
  */
-class secondary_index {
+class secondary_index : public enable_lw_shared_from_this<secondary_index> {
+    column_family& _base;
+    bytes _column;
+    sstring _name;
+    schema_ptr _schema;
+    lw_shared_ptr<column_family> _cf;
+    bool _built = false;
+    bool _stopped = false;
+    // Bumped on each (re)build, stopping the previous one.
+    unsigned _build_generation = 0;
 public:
+    secondary_index(column_family& base, const column_definition& cd, compaction_manager& cm);
+    ~secondary_index();
+
+    // The schema of the hidden column family of the index of cd.
+    static schema_ptr make_index_schema(const schema& base, const column_definition& cd);
+
+    const sstring& name() const {
+        return _name;
+    }
+    const bytes& column() const {
+        return _column;
+    }
+    bool is_built() const {
+        return _built;
+    }
+
+    // Adds the entries of the rows whose indexed cell m writes.
+    void apply(const mutation& m);
+
+    // Indexes all of the base table, then marks the index built. Writes
+    // made meanwhile are indexed by apply(). A later build() stops this one.
+    future<> build();
+
+    // Drops all entries, as after the base table is truncated.
+    void clear();
+
+    future<> stop();
+
+    // The singular ranges of the partitions within ranges holding rows
+    // with the value, in ring order, according to the entries of the index.
+    // Can be called only when is_built().
+    future<std::vector<query::partition_range>> lookup(bytes value, std::vector<query::partition_range> ranges,
+            gc_clock::time_point now) const;
+
     static const sstring custom_index_option_name;
 
     /**
@@ -384,5 +445,10 @@ class secondary_index {
 
 };
 
+// Leaves out of the stream the rows in which the column does not hold the
+// value, as well as the partitions left with no row. What the query does
+// with the indexed rows, it does with the rows returned.
+mutation_reader make_index_filtering_reader(mutation_reader rd, column_id column, bytes value, gc_clock::time_point now);
+
 }
 }
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <numeric>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/do_with.hh>
+#include <seastar/core/memory.hh>
+#include <boost/range/adaptor/map.hpp>
+#include <boost/range/algorithm/stable_partition.hpp>
+#include <boost/range/algorithm/sort.hpp>
+
+#include "db/index_summary_manager.hh"
+#include "db/config.hh"
+#include "sstables/sstables.hh"
+#include "database.hh"
+#include "log.hh"
+
+static logging::logger logger("index_summary_manager");
+
+namespace db {
+
+distributed<index_summary_manager> _the_index_summary_manager;
+
+index_summary_manager::index_summary_manager(distributed<database>& db)
+    : _db(db)
+{
+    auto& cfg = db.local().get_config();
+    auto capacity_in_mb = cfg.index_summary_capacity_in_mb();
+    // 0 is 5% of the memory.
+    _capacity = capacity_in_mb ? (uint64_t(capacity_in_mb) << 20) / smp::count : memory::stats().total_memory() / 20;
+    auto interval = cfg.index_summary_resize_interval_in_minutes();
+    // -1, read as unsigned, disables the resampling.
+    _interval = std::chrono::minutes(interval == std::numeric_limits<uint32_t>::max() ? 0 : interval);
+}
+
+future<> index_summary_manager::start() {
+    if (_interval.count() == 0) {
+        return make_ready_future<>();
+    }
+    _timer.set_callback([this] {
+        if (_stop) {
+            return;
+        }
+        redistribute_summaries().handle_exception([] (auto ep) {
+            logger.warn("Failed to redistribute index summaries: {}", ep);
+        }).finally([this] {
+            if (!_stop) {
+                _timer.arm(lowres_clock::now() + _interval);
+            }
+        });
+    });
+    _timer.arm(lowres_clock::now() + _interval);
+    return make_ready_future<>();
+}
+
+future<> index_summary_manager::stop() {
+    _stop = true;
+    _timer.cancel();
+    return _gate.close();
+}
+
+void index_summary_manager::redistribute(std::vector<sstable_summary>& summaries, uint64_t capacity) {
+    uint64_t total = 0;
+    for (auto&& s : summaries) {
+        total += s.memory;
+    }
+    if (total <= capacity) {
+        for (auto&& s : summaries) {
+            s.downsampling = 1;
+        }
+        return;
+    }
+    // Each summary is given a share of what is left in proportion to its
+    // reads, but no more than it needs at full sampling. Those needing the
+    // least for their reads are given theirs first, so what they leave goes
+    // to the others.
+    auto weight = [] (const sstable_summary& s) {
+        return double(s.reads + 1);
+    };
+    std::vector<sstable_summary*> order;
+    double weights = 0;
+    for (auto&& s : summaries) {
+        order.push_back(&s);
+        weights += weight(s);
+    }
+    boost::sort(order, [&] (const sstable_summary* a, const sstable_summary* b) {
+        return a->memory / weight(*a) < b->memory / weight(*b);
+    });
+    double left = capacity;
+    for (auto s : order) {
+        auto share = std::min(double(s->memory), left * weight(*s) / weights);
+        weights -= weight(*s);
+        // A power of two, so that going to a sparser sampling needn't read
+        // Summary.db again.
+        unsigned step = 1;
+        while (step < s->max_downsampling && step * share < s->memory) {
+            step *= 2;
+        }
+        s->downsampling = std::min(step, s->max_downsampling);
+        left = std::max(0.0, left - double(s->memory / s->downsampling));
+    }
+}
+
+future<> index_summary_manager::redistribute_summaries() {
+    return seastar::with_gate(_gate, [this] {
+        std::vector<sstables::shared_sstable> sstables;
+        std::vector<sstable_summary> summaries;
+        for (auto&& cf : _db.local().get_column_families() | boost::adaptors::map_values) {
+            auto& s = *cf->schema();
+            unsigned max_downsampling = std::max(1, s.max_index_interval() / s.min_index_interval());
+            for (auto&& sst : *cf->get_sstables() | boost::adaptors::map_values) {
+                sstables.push_back(sst);
+                summaries.push_back({sst->full_summary_memory(), sst->take_index_reads(), max_downsampling});
+            }
+        }
+        redistribute(summaries, _capacity);
+        // The summaries to be downsampled first, to free memory before the
+        // others take it.
+        std::vector<size_t> order(sstables.size());
+        std::iota(order.begin(), order.end(), 0);
+        boost::stable_partition(order, [&] (size_t i) {
+            return summaries[i].downsampling >= sstables[i]->summary_downsampling();
+        });
+        logger.debug("Resampling the summaries of {} sstables to fit {} bytes", sstables.size(), _capacity);
+        return do_with(std::move(sstables), std::move(summaries), std::move(order),
+                [] (auto& sstables, auto& summaries, auto& order) {
+            return do_for_each(order, [&sstables, &summaries] (size_t i) {
+                auto sst = sstables[i];
+                return sst->resample_summary(summaries[i].downsampling).handle_exception([sst] (auto ep) {
+                    logger.warn("Failed to resample the summary of {}: {}", sst->get_filename(), ep);
+                });
+            });
+        });
+    });
+}
+
+}
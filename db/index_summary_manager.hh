@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <seastar/core/future.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/gate.hh>
+
+class database;
+
+namespace db {
+
+/**
+ * Keeps the index summaries of the sstables of a shard within its share of
+ * index_summary_capacity_in_mb, by resampling them every
+ * index_summary_resize_interval_in_minutes according to how many lookups
+ * went through each since the last time.
+ *
+ * The budget is split among the sstables in proportion to their reads, so
+ * hot sstables keep dense summaries, and a lookup in them reads few index
+ * entries, while cold ones keep only one in every few entries, down to
+ * max_index_interval / min_index_interval of their table. No summary grows
+ * past the sampling it was written with. Only when the summaries don't all
+ * fit at full sampling are any downsampled.
+ */
+class index_summary_manager {
+public:
+    // What a redistribution is given of each sstable, and decides.
+    struct sstable_summary {
+        // At full sampling.
+        uint64_t memory;
+        uint64_t reads;
+        unsigned max_downsampling;
+        unsigned downsampling = 1;
+    };
+private:
+    distributed<database>& _db;
+    uint64_t _capacity;
+    std::chrono::minutes _interval;
+    timer<lowres_clock> _timer;
+    seastar::gate _gate;
+    bool _stop = false;
+public:
+    index_summary_manager(distributed<database>& db);
+
+    future<> start();
+    future<> stop();
+
+    // Resamples the summaries of the sstables of this shard now.
+    future<> redistribute_summaries();
+
+    // Of this shard, in bytes.
+    uint64_t capacity() const {
+        return _capacity;
+    }
+
+    // Sets the downsampling of each summary so that, as far as their
+    // max_downsampling allows, they fit the capacity.
+    static void redistribute(std::vector<sstable_summary>& summaries, uint64_t capacity);
+};
+
+extern distributed<index_summary_manager> _the_index_summary_manager;
+
+inline distributed<index_summary_manager>& get_index_summary_manager() {
+    return _the_index_summary_manager;
+}
+
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unordered_map>
+#include <unordered_set>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/do_with.hh>
+#include <core/fstream.hh>
+#include <core/reactor.hh>
+#include <boost/range/adaptor/map.hpp>
+#include <boost/range/irange.hpp>
+
+#include "db/saved_caches_manager.hh"
+#include "db/config.hh"
+#include "message/messaging_service.hh"
+#include "sstables/key_cache.hh"
+#include "utils/data_input.hh"
+#include "utils/data_output.hh"
+#include "database.hh"
+#include "log.hh"
+
+static logging::logger logger("saved_caches");
+
+namespace db {
+
+constexpr uint32_t saved_caches_manager::format_version;
+constexpr size_t saved_caches_manager::load_concurrency;
+
+distributed<saved_caches_manager> _the_saved_caches_manager;
+
+namespace {
+
+const char* cache_name(saved_caches_manager::cache_type type) {
+    return type == saved_caches_manager::cache_type::key_cache ? "key_cache" : "row_cache";
+}
+
+future<bytes> read_file(sstring path) {
+    return engine().open_file_dma(path, open_flags::ro).then([] (file f) {
+        return f.size().then([f] (size_t size) {
+            return do_with(make_file_input_stream(f), [size] (input_stream<char>& in) {
+                return in.read_exactly(size).then([] (temporary_buffer<char> buf) {
+                    return bytes(reinterpret_cast<const int8_t*>(buf.get()), buf.size());
+                });
+            });
+        });
+    });
+}
+
+// Written to a temporary file first, so that a crash leaves the previous
+// file in place.
+future<> write_file(sstring directory, sstring path, bytes data) {
+    auto tmp = path + ".tmp";
+    return engine().open_file_dma(tmp, open_flags::wo | open_flags::create | open_flags::truncate).then([data = std::move(data)] (file f) mutable {
+        return do_with(make_file_output_stream(std::move(f)), std::move(data), [] (output_stream<char>& out, const bytes& data) {
+            return out.write(reinterpret_cast<const char*>(data.data()), data.size()).then([&out] {
+                return out.flush();
+            }).then([&out] {
+                return out.close();
+            });
+        });
+    }).then([tmp, path] {
+        return engine().rename_file(tmp, path);
+    }).then([directory] {
+        return sync_directory(directory);
+    });
+}
+
+}
+
+saved_caches_manager::saved_caches_manager(distributed<database>& db)
+    : _db(db)
+{
+    auto& cfg = _db.local().get_config();
+    _directory = cfg.saved_caches_directory();
+    _key_cache.type = cache_type::key_cache;
+    _key_cache.save_period = std::chrono::seconds(cfg.key_cache_save_period());
+    _key_cache.keys_to_save = cfg.key_cache_keys_to_save();
+    _row_cache.type = cache_type::row_cache;
+    _row_cache.save_period = std::chrono::seconds(cfg.row_cache_save_period());
+    _row_cache.keys_to_save = cfg.row_cache_keys_to_save();
+}
+
+saved_caches_manager::saved_cache& saved_caches_manager::get(cache_type type) {
+    return type == cache_type::key_cache ? _key_cache : _row_cache;
+}
+
+const saved_caches_manager::saved_cache& saved_caches_manager::get(cache_type type) const {
+    return type == cache_type::key_cache ? _key_cache : _row_cache;
+}
+
+sstring saved_caches_manager::path(cache_type type) const {
+    return sprint("%s/%s-%d.db", _directory, cache_name(type), engine().cpu_id());
+}
+
+void saved_caches_manager::arm(saved_cache& c) {
+    c.save_timer.cancel();
+    if (!_stop && c.save_period.count()) {
+        c.save_timer.arm(lowres_clock::now() + c.save_period);
+    }
+}
+
+void saved_caches_manager::set_save_period(cache_type type, std::chrono::seconds period) {
+    auto& c = get(type);
+    c.save_period = period;
+    arm(c);
+}
+
+future<> saved_caches_manager::start() {
+    for (auto c : { &_key_cache, &_row_cache }) {
+        c->save_timer.set_callback([this, c] {
+            save(c->type).handle_exception([c] (auto ep) {
+                logger.warn("Failed to save the {}: {}", cache_name(c->type), ep);
+            }).finally([this, c] {
+                arm(*c);
+            });
+        });
+        arm(*c);
+    }
+    // The row cache goes first: reading its partitions also brings the
+    // keys of most of them into the key cache.
+    load(cache_type::row_cache).then([this] {
+        return load(cache_type::key_cache);
+    }).handle_exception([] (auto ep) {
+        logger.warn("Failed to load the saved caches: {}", ep);
+    });
+    return make_ready_future<>();
+}
+
+future<> saved_caches_manager::stop() {
+    _stop = true;
+    _key_cache.save_timer.cancel();
+    _row_cache.save_timer.cancel();
+    return _gate.close();
+}
+
+std::vector<saved_caches_manager::saved_key> saved_caches_manager::hot_keys(cache_type type, size_t max) {
+    std::vector<saved_key> keys;
+    auto full = [&keys, max] {
+        return max && keys.size() == max;
+    };
+    auto& db = _db.local();
+    if (type == cache_type::row_cache) {
+        // The cache has a single LRU across all tables, but keeps its
+        // entries by table, so the protected ones, which were hit since they
+        // were cached, are taken first.
+        for (bool protected_entries : { true, false }) {
+            for (auto&& e : db.get_column_families()) {
+                for (auto&& k : e.second->get_row_cache().keys(protected_entries)) {
+                    if (full()) {
+                        return keys;
+                    }
+                    auto b = k.representation();
+                    keys.push_back({e.first, bytes(b.begin(), b.end())});
+                }
+            }
+        }
+        return keys;
+    }
+    std::unordered_map<uint64_t, utils::UUID> tables;
+    for (auto&& e : db.get_column_families()) {
+        for (auto&& sst : *e.second->get_sstables() | boost::adaptors::map_values) {
+            tables.emplace(sst->cache_id(), e.first);
+        }
+    }
+    // A key cached for several sstables of a table is saved once, since it
+    // is looked up in all of them when loaded.
+    std::unordered_map<utils::UUID, std::unordered_set<bytes>> seen;
+    for (auto&& e : sstables::global_key_cache().keys(0)) {
+        if (full()) {
+            break;
+        }
+        auto i = tables.find(e.first);
+        if (i == tables.end() || !seen[i->second].insert(e.second).second) {
+            continue;
+        }
+        keys.push_back({i->second, std::move(e.second)});
+    }
+    return keys;
+}
+
+std::vector<saved_caches_manager::saved_key> saved_caches_manager::hot_keys_in(const std::vector<query::range<dht::token>>& ranges, size_t max) {
+    std::vector<saved_key> keys;
+    auto& db = _db.local();
+    auto non_system = db.get_non_system_keyspaces();
+    std::unordered_set<sstring> keyspaces(non_system.begin(), non_system.end());
+    auto in_ranges = [&ranges] (const dht::token& t) {
+        return std::any_of(ranges.begin(), ranges.end(), [&t] (const query::range<dht::token>& r) {
+            return r.contains(t, dht::token_comparator());
+        });
+    };
+    for (bool protected_entries : { true, false }) {
+        for (auto&& e : db.get_column_families()) {
+            auto& s = *e.second->schema();
+            if (!keyspaces.count(s.ks_name())) {
+                continue;
+            }
+            for (auto&& k : e.second->get_row_cache().keys(protected_entries)) {
+                if (max && keys.size() == max) {
+                    return keys;
+                }
+                if (!in_ranges(dht::global_partitioner().get_token(s, k))) {
+                    continue;
+                }
+                auto b = k.representation();
+                keys.push_back({e.first, bytes(b.begin(), b.end())});
+            }
+        }
+    }
+    return keys;
+}
+
+size_t saved_caches_manager::serialized_size(const std::vector<saved_key>& keys) {
+    size_t size = data_output::serialized_size<uint32_t>();
+    for (auto&& k : keys) {
+        size += 2 * data_output::serialized_size<int64_t>() + data_output::serialized_size(k.key);
+    }
+    return size;
+}
+
+bytes saved_caches_manager::serialize(const std::vector<saved_key>& keys) {
+    bytes b(bytes::initialized_later(), serialized_size(keys));
+    data_output out(b);
+    out.write<uint32_t>(format_version);
+    for (auto&& k : keys) {
+        out.write(k.cf_id.get_most_significant_bits());
+        out.write(k.cf_id.get_least_significant_bits());
+        out.write(k.key);
+    }
+    return b;
+}
+
+std::vector<saved_caches_manager::saved_key> saved_caches_manager::deserialize(bytes_view v) {
+    std::vector<saved_key> keys;
+    data_input in(v);
+    try {
+        if (!in.has_next() || in.read<uint32_t>() != format_version) {
+            return keys;
+        }
+        while (in.has_next()) {
+            auto msb = in.read<int64_t>();
+            auto lsb = in.read<int64_t>();
+            keys.push_back({utils::UUID(msb, lsb), in.read<bytes>()});
+        }
+    } catch (std::out_of_range&) {
+        logger.warn("Saved cache truncated after {} keys", keys.size());
+    }
+    return keys;
+}
+
+future<> saved_caches_manager::save(cache_type type) {
+    return seastar::with_gate(_gate, [this, type] {
+        auto keys_to_save = get(type).keys_to_save;
+        // Each shard saves its share of the keys.
+        size_t max = keys_to_save ? std::max<size_t>(keys_to_save / smp::count, 1) : 0;
+        auto keys = hot_keys(type, max);
+        logger.debug("Saving {} keys of the {}", keys.size(), cache_name(type));
+        return write_file(_directory, path(type), serialize(keys));
+    });
+}
+
+future<> saved_caches_manager::save_all() {
+    return save(cache_type::row_cache).then([this] {
+        return save(cache_type::key_cache);
+    });
+}
+
+future<> saved_caches_manager::load_key(cache_type type, const saved_key& k) {
+    auto& cfs = _db.local().get_column_families();
+    auto i = cfs.find(k.cf_id);
+    if (i == cfs.end()) {
+        // Dropped since.
+        return make_ready_future<>();
+    }
+    auto cf = i->second;
+    auto s = cf->schema();
+    if (type == cache_type::row_cache) {
+        auto dk = dht::global_partitioner().decorate_key(*s, partition_key::from_bytes(k.key));
+        if (dht::shard_of(dk.token()) != engine().cpu_id()) {
+            return make_ready_future<>();
+        }
+        return do_with(query::partition_range::make_singular(std::move(dk)), [cf] (const query::partition_range& pr) {
+            return do_with(cf->make_reader(pr), [] (mutation_reader& reader) {
+                return reader().discard_result();
+            });
+        });
+    }
+    auto key = sstables::key::from_bytes(k.key);
+    if (dht::shard_of(dht::global_partitioner().get_token(sstables::key_view(key))) != engine().cpu_id()) {
+        return make_ready_future<>();
+    }
+    auto sstables = cf->get_sstables();
+    return do_with(std::move(key), [s, sstables] (const sstables::key& key) {
+        return parallel_for_each(*sstables | boost::adaptors::map_values, [s, &key] (const sstables::shared_sstable& sst) {
+            if (!sst->filter_has_key(key)) {
+                return make_ready_future<>();
+            }
+            return sst->read_row(s, key).discard_result();
+        });
+    });
+}
+
+future<> saved_caches_manager::load_keys(cache_type type, std::vector<saved_key> keys) {
+    return do_with(std::move(keys), size_t(0), [this, type] (const std::vector<saved_key>& keys, size_t& next) {
+        return do_until([this, &keys, &next] { return _stop || next == keys.size(); }, [this, type, &keys, &next] {
+            auto begin = keys.begin() + next;
+            auto end = begin + std::min(load_concurrency, keys.size() - next);
+            next = end - keys.begin();
+            return parallel_for_each(begin, end, [this, type] (const saved_key& k) {
+                return load_key(type, k).handle_exception([type] (auto ep) {
+                    logger.debug("Failed to load a key of the {}: {}", cache_name(type), ep);
+                });
+            });
+        });
+    });
+}
+
+future<> saved_caches_manager::load(cache_type type) {
+    return seastar::with_gate(_gate, [this, type] {
+        return read_file(path(type)).then_wrapped([this, type] (future<bytes> f) {
+            bytes data;
+            try {
+                data = f.get0();
+            } catch (std::system_error& e) {
+                // Nothing was saved yet.
+                logger.debug("No saved {}: {}", cache_name(type), e.what());
+                return make_ready_future<>();
+            }
+            auto keys = deserialize(data);
+            auto count = keys.size();
+            logger.info("Loading {} saved keys of the {}", count, cache_name(type));
+            return load_keys(type, std::move(keys)).then([type, count] {
+                logger.info("Loaded {} saved keys of the {}", count, cache_name(type));
+            });
+        });
+    });
+}
+
+future<> saved_caches_manager::init_messaging_service_handler() {
+    net::get_local_messaging_service().register_cache_hot_keys([] (std::vector<query::range<dht::token>> ranges, uint32_t limit) {
+        return do_with(std::move(ranges), [limit] (const std::vector<query::range<dht::token>>& ranges) {
+            // Each shard sends its share of the keys.
+            size_t max = limit ? std::max<size_t>(limit / smp::count, 1) : 0;
+            return get_saved_caches_manager().map_reduce0([&ranges, max] (saved_caches_manager& m) {
+                return m.hot_keys_in(ranges, max);
+            }, cache_hot_keys(), [] (cache_hot_keys all, std::vector<saved_key> keys) {
+                std::move(keys.begin(), keys.end(), std::back_inserter(all.keys));
+                return all;
+            });
+        });
+    });
+    return make_ready_future<>();
+}
+
+future<> saved_caches_manager::uninit_messaging_service_handler() {
+    net::get_local_messaging_service().unregister_cache_hot_keys();
+    return make_ready_future<>();
+}
+
+future<> saved_caches_manager::warm_up_from(std::unordered_map<gms::inet_address, std::vector<query::range<dht::token>>> sources) {
+    auto total = _db.local().get_config().cache_warmup_keys();
+    if (!total || sources.empty()) {
+        return make_ready_future<>();
+    }
+    uint32_t limit = std::max<uint32_t>(total / sources.size(), 1);
+    return seastar::with_gate(_gate, [this, limit, sources = std::move(sources)] () mutable {
+        return do_with(std::move(sources), [this, limit] (auto& sources) {
+            return do_for_each(sources, [this, limit] (auto& source) {
+                auto& ms = net::get_local_messaging_service();
+                return ms.send_cache_hot_keys(net::messaging_service::shard_id{source.first, 0}, source.second, limit).then([this, &source] (cache_hot_keys hot) {
+                    logger.info("Warming the row cache up with {} keys from {}", hot.keys.size(), source.first);
+                    // Read on the shards which own the partitions.
+                    std::vector<std::vector<saved_key>> by_shard(smp::count);
+                    for (auto&& k : hot.keys) {
+                        auto& cfs = _db.local().get_column_families();
+                        auto i = cfs.find(k.cf_id);
+                        if (i == cfs.end()) {
+                            continue;
+                        }
+                        auto token = dht::global_partitioner().get_token(*i->second->schema(), partition_key_view::from_bytes(k.key));
+                        by_shard[dht::shard_of(token)].push_back(std::move(k));
+                    }
+                    return parallel_for_each(boost::irange<unsigned>(0, smp::count), [by_shard = std::move(by_shard)] (unsigned shard) mutable {
+                        return get_saved_caches_manager().invoke_on(shard, [keys = std::move(by_shard[shard])] (saved_caches_manager& m) mutable {
+                            return m.load_keys(cache_type::row_cache, std::move(keys));
+                        });
+                    });
+                }).handle_exception([&source] (auto ep) {
+                    logger.warn("Failed to warm the row cache up with keys from {}: {}", source.first, ep);
+                });
+            });
+        });
+    });
+}
+
+size_t cache_hot_keys::serialized_size() const {
+    return saved_caches_manager::serialized_size(keys);
+}
+
+void cache_hot_keys::serialize(bytes::iterator& out) const {
+    auto b = saved_caches_manager::serialize(keys);
+    out = std::copy(b.begin(), b.end(), out);
+}
+
+cache_hot_keys cache_hot_keys::deserialize(bytes_view& v) {
+    cache_hot_keys hot;
+    hot.keys = saved_caches_manager::deserialize(v);
+    v.remove_prefix(v.size());
+    return hot;
+}
+
+}
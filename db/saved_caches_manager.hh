@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <seastar/core/future.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/gate.hh>
+
+#include "bytes.hh"
+#include "utils/UUID.hh"
+#include "gms/inet_address.hh"
+#include "query-request.hh"
+
+class database;
+
+namespace db {
+
+/**
+ * Saves the keys of the hottest partitions of the row cache and of the key
+ * cache of a shard to saved_caches_directory, every save period of each
+ * cache, and warms the caches up from them when the node starts, so that a
+ * restarted node doesn't serve all its reads from disk until its caches
+ * fill again.
+ *
+ * Only keys are saved, never data: the row cache is warmed up by reading
+ * the saved partitions through it, and the key cache by looking the saved
+ * keys up in the sstables of their tables. The warm-up runs in the
+ * background, a few partitions at a time, so it doesn't compete much with
+ * the node's own reads.
+ *
+ * Each shard saves and loads its own files. Keys of partitions the shard
+ * doesn't own, as when the shard count changed, are skipped.
+ *
+ * A bootstrapping or replacing node, which has no saved caches, instead
+ * asks the nodes it streams from for the keys of the hottest partitions of
+ * their row caches in the ranges it streams, and reads them into its row
+ * cache before it starts serving reads.
+ */
+class saved_caches_manager {
+public:
+    enum class cache_type { key_cache, row_cache };
+
+    // A key of a partition of the table of the given id: its partition key
+    // for the row cache, its sstable key for the key cache.
+    struct saved_key {
+        utils::UUID cf_id;
+        bytes key;
+    };
+private:
+    static constexpr uint32_t format_version = 1;
+    // Partitions read at once by the warm-up.
+    static constexpr size_t load_concurrency = 4;
+
+    struct saved_cache {
+        cache_type type;
+        std::chrono::seconds save_period;
+        // Of the whole node, 0 for all.
+        uint32_t keys_to_save;
+        timer<lowres_clock> save_timer;
+    };
+
+    distributed<database>& _db;
+    sstring _directory;
+    saved_cache _key_cache;
+    saved_cache _row_cache;
+    seastar::gate _gate;
+    bool _stop = false;
+private:
+    saved_cache& get(cache_type);
+    const saved_cache& get(cache_type) const;
+    void arm(saved_cache&);
+    sstring path(cache_type) const;
+    std::vector<saved_key> hot_keys(cache_type, size_t max);
+    // Of the row cache of the non-system tables, in the ranges.
+    std::vector<saved_key> hot_keys_in(const std::vector<query::range<dht::token>>& ranges, size_t max);
+    future<> load_key(cache_type, const saved_key&);
+    // A few at a time.
+    future<> load_keys(cache_type, std::vector<saved_key>);
+public:
+    saved_caches_manager(distributed<database>& db);
+
+    // Arms the periodic saves and starts warming the caches up in the
+    // background.
+    future<> start();
+    future<> stop();
+
+    future<> init_messaging_service_handler();
+    future<> uninit_messaging_service_handler();
+
+    future<> save(cache_type);
+    future<> save_all();
+    future<> load(cache_type);
+
+    // Warms the row cache up with the hottest partitions of the sources in
+    // the ranges fetched from each, up to cache_warmup_keys in all. Failures
+    // to get keys from a source are logged, not propagated.
+    future<> warm_up_from(std::unordered_map<gms::inet_address, std::vector<query::range<dht::token>>> sources);
+
+    std::chrono::seconds save_period(cache_type type) const {
+        return get(type).save_period;
+    }
+    // 0 disables the periodic saves.
+    void set_save_period(cache_type, std::chrono::seconds);
+
+    uint32_t keys_to_save(cache_type type) const {
+        return get(type).keys_to_save;
+    }
+    void set_keys_to_save(cache_type type, uint32_t keys) {
+        get(type).keys_to_save = keys;
+    }
+
+    static size_t serialized_size(const std::vector<saved_key>&);
+    static bytes serialize(const std::vector<saved_key>&);
+    // Of a truncated file, the keys before the truncation. Of a file of
+    // another format, none.
+    static std::vector<saved_key> deserialize(bytes_view);
+};
+
+// The keys a node sends a joining node to warm its row cache up with, in
+// the format of the saved caches.
+class cache_hot_keys {
+public:
+    std::vector<saved_caches_manager::saved_key> keys;
+public:
+    size_t serialized_size() const;
+    void serialize(bytes::iterator& out) const;
+    static cache_hot_keys deserialize(bytes_view& v);
+};
+
+extern distributed<saved_caches_manager> _the_saved_caches_manager;
+
+inline distributed<saved_caches_manager>& get_saved_caches_manager() {
+    return _the_saved_caches_manager;
+}
+
+inline saved_caches_manager& get_local_saved_caches_manager() {
+    return _the_saved_caches_manager.local();
+}
+
+}
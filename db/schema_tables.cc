@@ -106,8 +106,12 @@ using days = std::chrono::duration<int, std::ratio<24 * 3600>>;
         {{"columnfamily_name", utf8_type}},
         // regular columns
         {
+            {"base_table_id", uuid_type},
+            {"base_table_name", utf8_type},
             {"bloom_filter_fp_chance", double_type},
+            {"bloom_filter_format", utf8_type},
             {"caching", utf8_type},
+            {"cdc", utf8_type},
             {"cf_id", uuid_type},
             {"comment", utf8_type},
             {"compaction_strategy_class", utf8_type},
@@ -118,6 +122,7 @@ using days = std::chrono::duration<int, std::ratio<24 * 3600>>;
             {"default_validator", utf8_type},
             {"dropped_columns",  map_type_impl::get_instance(utf8_type, long_type, true)},
             {"gc_grace_seconds", int32_type},
+            {"include_all_columns", boolean_type},
             {"is_dense", boolean_type},
             {"key_validator", utf8_type},
             {"local_read_repair_chance", double_type},
@@ -381,6 +386,69 @@ future<std::vector<frozen_mutation>> convert_schema_to_mutations(distributed<ser
     return map_reduce(ALL.begin(), ALL.end(), map, std::move(std::vector<frozen_mutation>{}), reduce);
 }
 
+future<std::map<sstring, utils::UUID>> calculate_keyspace_schema_digests(distributed<service::storage_proxy>& proxy)
+{
+    return do_with(std::map<sstring, CryptoPP::Weak::MD5>{}, [&proxy] (auto& hashes) {
+        return do_for_each(ALL.begin(), ALL.end(), [&proxy, &hashes] (sstring table) {
+            return db::system_keyspace::query_mutations(proxy, table).then([&proxy, &hashes, table] (auto rs) {
+                auto s = proxy.local().get_db().local().find_schema(system_keyspace::NAME, table);
+                for (auto&& p : rs->partitions()) {
+                    auto mut = p.mut().unfreeze(s);
+                    auto partition_key = boost::any_cast<sstring>(utf8_type->deserialize(mut.key().get_component(*s, 0)));
+                    if (partition_key == system_keyspace::NAME) {
+                        continue;
+                    }
+                    auto& hash = hashes[partition_key];
+                    auto slice = partition_slice_builder(*s).build();
+                    for (auto&& f : mut.query(slice).buf().fragments()) {
+                        hash.Update(reinterpret_cast<const unsigned char*>(f.begin()), f.size());
+                    }
+                }
+            });
+        }).then([&hashes] {
+            std::map<sstring, utils::UUID> digests;
+            for (auto&& e : hashes) {
+                bytes digest{bytes::initialized_later(), CryptoPP::Weak::MD5::DIGESTSIZE};
+                e.second.Final(reinterpret_cast<unsigned char*>(digest.begin()));
+                digests.emplace(e.first, utils::UUID_gen::get_name_UUID(digest));
+            }
+            return digests;
+        });
+    });
+}
+
+future<std::vector<frozen_mutation>> convert_schema_to_mutations(distributed<service::storage_proxy>& proxy,
+        std::map<sstring, utils::UUID> their_digests)
+{
+    return calculate_keyspace_schema_digests(proxy).then([&proxy, their_digests = std::move(their_digests)] (auto our_digests) {
+        std::set<sstring> differing;
+        for (auto&& e : our_digests) {
+            auto it = their_digests.find(e.first);
+            if (it == their_digests.end() || it->second != e.second) {
+                differing.insert(e.first);
+            }
+        }
+        auto map = [&proxy, differing] (sstring table) {
+            return db::system_keyspace::query_mutations(proxy, table).then([&proxy, table, differing] (auto rs) {
+                auto s = proxy.local().get_db().local().find_schema(system_keyspace::NAME, table);
+                std::vector<frozen_mutation> results;
+                for (auto&& p : rs->partitions()) {
+                    auto partition_key = boost::any_cast<sstring>(utf8_type->deserialize(p.mut().key(*s).get_component(*s, 0)));
+                    if (differing.count(partition_key)) {
+                        results.emplace_back(p.mut());
+                    }
+                }
+                return results;
+            });
+        };
+        auto reduce = [] (auto&& result, auto&& mutations) {
+            std::copy(mutations.begin(), mutations.end(), std::back_inserter(result));
+            return std::move(result);
+        };
+        return map_reduce(ALL.begin(), ALL.end(), map, std::vector<frozen_mutation>{}, reduce);
+    });
+}
+
 future<schema_result>
 read_schema_for_keyspaces(distributed<service::storage_proxy>& proxy, const sstring& schema_table_name, const std::set<sstring>& keyspace_names)
 {
@@ -418,6 +486,38 @@ read_schema_partition_for_table(distributed<service::storage_proxy>& proxy, cons
     });
 }
 
+// The rows of a partition of a schema table, by the table they describe.
+static std::map<sstring, std::vector<const query::result_set_row*>> rows_by_table(const schema_result& result, const sstring& keyspace) {
+    std::map<sstring, std::vector<const query::result_set_row*>> rows;
+    auto it = result.find(keyspace);
+    if (it != result.end()) {
+        for (auto&& row : it->second->rows()) {
+            rows[row.get_nonnull<sstring>("columnfamily_name")].push_back(&row);
+        }
+    }
+    return rows;
+}
+
+// Adds the tables of the keyspace whose rows differ between before and after.
+static void add_changed_tables(const schema_result& before, const schema_result& after, const sstring& keyspace, std::set<sstring>& tables) {
+    auto rows_before = rows_by_table(before, keyspace);
+    auto rows_after = rows_by_table(after, keyspace);
+    auto equal = [] (const std::vector<const query::result_set_row*>& x, const std::vector<const query::result_set_row*>& y) {
+        return x.size() == y.size() && std::equal(x.begin(), x.end(), y.begin(), [] (auto a, auto b) { return *a == *b; });
+    };
+    for (auto&& e : rows_before) {
+        auto it = rows_after.find(e.first);
+        if (it == rows_after.end() || !equal(e.second, it->second)) {
+            tables.insert(e.first);
+        }
+    }
+    for (auto&& e : rows_after) {
+        if (!rows_before.count(e.first)) {
+            tables.insert(e.first);
+        }
+    }
+}
+
 static semaphore the_merge_lock;
 
 future<> merge_lock() {
@@ -472,6 +572,7 @@ future<> do_merge_schema(distributed<service::storage_proxy>& proxy, std::vector
        // current state of the schema
        auto&& old_keyspaces = read_schema_for_keyspaces(proxy, KEYSPACES, keyspaces).get0();
        auto&& old_column_families = read_schema_for_keyspaces(proxy, COLUMNFAMILIES, keyspaces).get0();
+       auto&& old_columns = read_schema_for_keyspaces(proxy, COLUMNS, keyspaces).get0();
        /*auto& old_types = */read_schema_for_keyspaces(proxy, USERTYPES, keyspaces).get0();
 #if 0 // not in 2.1.8
        /*auto& old_functions = */read_schema_for_keyspaces(proxy, FUNCTIONS, keyspaces).get0();
@@ -492,6 +593,7 @@ future<> do_merge_schema(distributed<service::storage_proxy>& proxy, std::vector
       // with new data applied
        auto&& new_keyspaces = read_schema_for_keyspaces(proxy, KEYSPACES, keyspaces).get0();
        auto&& new_column_families = read_schema_for_keyspaces(proxy, COLUMNFAMILIES, keyspaces).get0();
+       auto&& new_columns = read_schema_for_keyspaces(proxy, COLUMNS, keyspaces).get0();
        /*auto& new_types = */read_schema_for_keyspaces(proxy, USERTYPES, keyspaces).get0();
 #if 0 // not in 2.1.8
        /*auto& new_functions = */read_schema_for_keyspaces(proxy, FUNCTIONS, keyspaces).get0();
@@ -499,7 +601,16 @@ future<> do_merge_schema(distributed<service::storage_proxy>& proxy, std::vector
 #endif
 
        std::set<sstring> keyspaces_to_drop = merge_keyspaces(proxy, std::move(old_keyspaces), std::move(new_keyspaces)).get0();
-       merge_tables(proxy, std::move(old_column_families), std::move(new_column_families)).get0();
+       // Only the tables whose rows changed are created again from them.
+       // Tables altered only in their columns, as by CREATE INDEX, leave
+       // their rows in COLUMNFAMILIES alone.
+       changed_tables_map changed;
+       for (auto&& keyspace : keyspaces) {
+           auto& tables = changed[keyspace];
+           add_changed_tables(old_column_families, new_column_families, keyspace, tables);
+           add_changed_tables(old_columns, new_columns, keyspace, tables);
+       }
+       merge_tables(proxy, std::move(old_column_families), std::move(new_column_families), std::move(changed)).get0();
 #if 0
        mergeTypes(oldTypes, newTypes);
        mergeFunctions(oldFunctions, newFunctions);
@@ -596,20 +707,25 @@ future<std::set<sstring>> merge_keyspaces(distributed<service::storage_proxy>& p
 }
 
 // see the comments for merge_keyspaces()
-future<> merge_tables(distributed<service::storage_proxy>& proxy, schema_result&& before, schema_result&& after)
+future<> merge_tables(distributed<service::storage_proxy>& proxy, schema_result&& before, schema_result&& after, changed_tables_map changed_tables)
 {
-    return do_with(std::make_pair(std::move(after), std::move(before)), [&proxy] (auto& pair) {
+    return do_with(std::make_pair(std::move(after), std::move(before)), std::move(changed_tables), [&proxy] (auto& pair, auto& changed_tables) {
         auto& after = pair.first;
         auto& before = pair.second;
         auto changed_at = db_clock::now();
-        return proxy.local().get_db().invoke_on_all([changed_at, &proxy, &before, &after] (database& db) {
-            return seastar::async([changed_at, &proxy, &db, &before, &after] {
+        return proxy.local().get_db().invoke_on_all([changed_at, &proxy, &before, &after, &changed_tables] (database& db) {
+            return seastar::async([changed_at, &proxy, &db, &before, &after, &changed_tables] {
                 std::vector<schema_ptr> created;
                 std::vector<schema_ptr> altered;
                 std::vector<schema_ptr> dropped;
                 auto diff = difference(before, after, [](const auto& x, const auto& y) -> bool {
                     return *x == *y;
                 });
+                for (auto&& e : changed_tables) {
+                    if (!e.second.empty() && before.count(e.first) && after.count(e.first)) {
+                        diff.entries_differing.insert(e.first);
+                    }
+                }
                 for (auto&& key : diff.entries_only_on_left) {
                     auto&& rs = before[key];
                     for (const query::result_set_row& row : rs->rows()) {
@@ -633,7 +749,23 @@ future<> merge_tables(distributed<service::storage_proxy>& proxy, schema_result&
 
                     if (!pre->empty() && !post->empty()) {
                         auto before = db.find_keyspace(keyspace_name).metadata()->cf_meta_data();
-                        auto after = create_tables_from_tables_partition(proxy, post).get0();
+                        std::map<sstring, schema_ptr> after;
+                        auto changed = changed_tables.find(keyspace_name);
+                        if (changed == changed_tables.end()) {
+                            after = create_tables_from_tables_partition(proxy, post).get0();
+                        } else {
+                            // The tables whose rows are the same are as the
+                            // database has them already.
+                            for (auto it = before.begin(); it != before.end();) {
+                                it = changed->second.count(it->first) ? std::next(it) : before.erase(it);
+                            }
+                            for (auto&& row : post->rows()) {
+                                if (changed->second.count(row.get_nonnull<sstring>("columnfamily_name"))) {
+                                    auto cfm = create_table_from_table_row(proxy, row).get0();
+                                    after.emplace(cfm->cf_name(), std::move(cfm));
+                                }
+                            }
+                        }
                         auto delta = difference(std::map<sstring, schema_ptr>{before.begin(), before.end()}, after, [](const schema_ptr& x, const schema_ptr& y) -> bool {
                             return *x == *y;
                         });
@@ -1000,6 +1132,17 @@ std::vector<mutation> make_create_table_mutations(lw_shared_ptr<keyspace_metadat
     return mutations;
 }
 
+std::vector<mutation> make_update_table_mutations(lw_shared_ptr<keyspace_metadata> keyspace, schema_ptr old_table, schema_ptr new_table, api::timestamp_type timestamp)
+{
+    // Only the indexes of the columns can be altered yet, which rewriting
+    // the table with its columns covers.
+    auto mutations = make_create_keyspace_mutations(keyspace, timestamp, false);
+    schema_ptr s = keyspaces();
+    auto pkey = partition_key::from_singular(*s, keyspace->name());
+    add_table_to_schema_mutation(new_table, timestamp, true, pkey, mutations);
+    return mutations;
+}
+
 void add_table_to_schema_mutation(schema_ptr table, api::timestamp_type timestamp, bool with_columns_and_triggers, const partition_key& pkey, std::vector<mutation>& mutations)
 {
     // For property that can be null (and can be changed), we insert tombstones, to make sure
@@ -1024,7 +1167,9 @@ void add_table_to_schema_mutation(schema_ptr table, api::timestamp_type timestam
     }
 
     m.set_clustered_cell(ckey, "bloom_filter_fp_chance", table->bloom_filter_fp_chance(), timestamp);
+    m.set_clustered_cell(ckey, "bloom_filter_format", utils::to_sstring(table->bloom_filter_format()), timestamp);
     m.set_clustered_cell(ckey, "caching", table->caching_options().to_sstring(), timestamp);
+    m.set_clustered_cell(ckey, "cdc", table->cdc_options().to_sstring(), timestamp);
     m.set_clustered_cell(ckey, "comment", table->comment(), timestamp);
 
     m.set_clustered_cell(ckey, "compaction_strategy_class", sstables::compaction_strategy::name(table->compaction_strategy()), timestamp);
@@ -1035,6 +1180,12 @@ void add_table_to_schema_mutation(schema_ptr table, api::timestamp_type timestam
     m.set_clustered_cell(ckey, "default_time_to_live", table->default_time_to_live().count(), timestamp);
     m.set_clustered_cell(ckey, "default_validator", table->default_validator()->name(), timestamp);
     m.set_clustered_cell(ckey, "gc_grace_seconds", table->gc_grace_seconds().count(), timestamp);
+    if (table->is_view()) {
+        auto& view = table->get_view_info();
+        m.set_clustered_cell(ckey, "base_table_id", view.base_id, timestamp);
+        m.set_clustered_cell(ckey, "base_table_name", view.base_name, timestamp);
+        m.set_clustered_cell(ckey, "include_all_columns", view.include_all_columns, timestamp);
+    }
     m.set_clustered_cell(ckey, "key_validator", table->thrift_key_validator(), timestamp);
     m.set_clustered_cell(ckey, "local_read_repair_chance", table->dc_local_read_repair_chance(), timestamp);
     m.set_clustered_cell(ckey, "min_compaction_threshold", table->min_compaction_threshold(), timestamp);
@@ -1319,6 +1470,10 @@ void create_table_from_table_row_and_column_rows(schema_builder& builder, const
         builder.set_caching_options(caching_options::from_sstring(table_row.get_nonnull<sstring>("caching")));
     }
 
+    if (table_row.has("cdc")) {
+        builder.set_cdc_options(cdc_options::from_sstring(table_row.get_nonnull<sstring>("cdc")));
+    }
+
     if (table_row.has("default_time_to_live")) {
         builder.set_default_time_to_live(gc_clock::duration(table_row.get_nonnull<gc_clock::rep>("default_time_to_live")));
     }
@@ -1356,6 +1511,18 @@ void create_table_from_table_row_and_column_rows(schema_builder& builder, const
         builder.set_bloom_filter_fp_chance(builder.get_bloom_filter_fp_chance());
     }
 
+    if (table_row.has("bloom_filter_format")) {
+        builder.set_bloom_filter_format(utils::filter_format_from_sstring(table_row.get_nonnull<sstring>("bloom_filter_format")));
+    }
+
+    if (table_row.has("base_table_id")) {
+        view_info view;
+        view.base_id = table_row.get_nonnull<utils::UUID>("base_table_id");
+        view.base_name = table_row.get_nonnull<sstring>("base_table_name");
+        view.include_all_columns = table_row.get_nonnull<bool>("include_all_columns");
+        builder.set_view_info(std::move(view));
+    }
+
 #if 0
     if (result.has("dropped_columns"))
         cfm.droppedColumns(convertDroppedColumns(result.getMap("dropped_columns", UTF8Type.instance, LongType.instance)));
@@ -1393,11 +1560,16 @@ void add_column_to_schema_mutation(schema_ptr table,
     if (!column.is_on_all_components()) {
         m.set_clustered_cell(ckey, "component_index", int32_t(table->position(column)), timestamp);
     }
-#if 0
-    adder.add("index_name", column.getIndexName());
-    adder.add("index_type", column.getIndexType() == null ? null : column.getIndexType().toString());
-    adder.add("index_options", json(column.getIndexOptions()));
-#endif
+    if (column.idx_info.index_type != index_type::none) {
+        if (column.idx_info.index_name) {
+            m.set_clustered_cell(ckey, "index_name", *column.idx_info.index_name, timestamp);
+        }
+        m.set_clustered_cell(ckey, "index_type", to_sstring(column.idx_info.index_type), timestamp);
+        if (column.idx_info.index_options) {
+            auto& options = *column.idx_info.index_options;
+            m.set_clustered_cell(ckey, "index_options", json::to_json(std::map<sstring, sstring>(options.begin(), options.end())), timestamp);
+        }
+    }
     mutations.emplace_back(std::move(m));
 }
 
@@ -1413,6 +1585,18 @@ sstring serialize_kind(column_kind kind)
     }
 }
 
+static index_type deserialize_index_type(const sstring& type) {
+    if (type == "KEYS") {
+        return index_type::keys;
+    } else if (type == "CUSTOM") {
+        return index_type::custom;
+    } else if (type == "COMPOSITES") {
+        return index_type::composites;
+    } else {
+        throw std::invalid_argument("unknown index type: " + type);
+    }
+}
+
 column_kind deserialize_kind(sstring kind) {
     if (kind == "partition_key") {
         return column_kind::partition_key;
@@ -1483,20 +1667,18 @@ column_definition create_column_from_column_row(const query::result_set_row& row
 
     auto validator = parse_type(row.get_nonnull<sstring>("validator"));
 
-#if 0
-    IndexType indexType = null;
-    if (row.has("index_type"))
-        indexType = IndexType.valueOf(row.getString("index_type"));
-
-    Map<String, String> indexOptions = null;
-    if (row.has("index_options"))
-        indexOptions = fromJsonMap(row.getString("index_options"));
-
-    String indexName = null;
-    if (row.has("index_name"))
-        indexName = row.getString("index_name");
-#endif
-    auto c = column_definition{utf8_type->decompose(name), validator, kind, component_index};
+    index_info idx;
+    if (row.has("index_type")) {
+        idx.index_type = deserialize_index_type(row.get_nonnull<sstring>("index_type"));
+    }
+    if (row.has("index_options")) {
+        auto options = json::to_map(row.get_nonnull<sstring>("index_options"));
+        idx.index_options = index_options_map(options.begin(), options.end());
+    }
+    if (row.has("index_name")) {
+        idx.index_name = row.get_nonnull<sstring>("index_name");
+    }
+    auto c = column_definition{utf8_type->decompose(name), validator, kind, component_index, std::move(idx)};
     return c;
 }
 
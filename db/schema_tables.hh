@@ -74,6 +74,15 @@ future<utils::UUID> calculate_schema_digest(distributed<service::storage_proxy>&
 
 future<std::vector<frozen_mutation>> convert_schema_to_mutations(distributed<service::storage_proxy>& proxy);
 
+// The digest of the schema of each keyspace, dropped ones included, as
+// calculate_schema_digest() calculates that of all keyspaces.
+future<std::map<sstring, utils::UUID>> calculate_keyspace_schema_digests(distributed<service::storage_proxy>& proxy);
+
+// The schema of the keyspaces whose digests differ from their_digests, or
+// which are not in it.
+future<std::vector<frozen_mutation>> convert_schema_to_mutations(distributed<service::storage_proxy>& proxy,
+        std::map<sstring, utils::UUID> their_digests);
+
 future<schema_result::value_type>
 read_schema_partition_for_keyspace(distributed<service::storage_proxy>& proxy, const sstring& schema_table_name, const sstring& keyspace_name);
 
@@ -91,7 +100,14 @@ std::vector<mutation> make_drop_keyspace_mutations(lw_shared_ptr<keyspace_metada
 
 lw_shared_ptr<keyspace_metadata> create_keyspace_from_schema_partition(const schema_result::value_type& partition);
 
-future<> merge_tables(distributed<service::storage_proxy>& proxy, schema_result&& before, schema_result&& after);
+// The tables of each keyspace whose rows, or those of their columns, differ
+// between two reads of the schema tables.
+using changed_tables_map = std::map<sstring, std::set<sstring>>;
+
+// Only the tables in changed_tables are compared of the keyspaces it holds,
+// even if their rows in before and after are equal, as their columns
+// changed. All tables are compared of the keyspaces it does not hold.
+future<> merge_tables(distributed<service::storage_proxy>& proxy, schema_result&& before, schema_result&& after, changed_tables_map changed_tables = {});
 
 lw_shared_ptr<keyspace_metadata> create_keyspace_from_schema_partition(const schema_result::value_type& partition);
 
@@ -99,6 +115,8 @@ mutation make_create_keyspace_mutation(lw_shared_ptr<keyspace_metadata> keyspace
 
 std::vector<mutation> make_create_table_mutations(lw_shared_ptr<keyspace_metadata> keyspace, schema_ptr table, api::timestamp_type timestamp);
 
+std::vector<mutation> make_update_table_mutations(lw_shared_ptr<keyspace_metadata> keyspace, schema_ptr old_table, schema_ptr new_table, api::timestamp_type timestamp);
+
 future<std::map<sstring, schema_ptr>> create_tables_from_tables_partition(distributed<service::storage_proxy>& proxy, const schema_result::mapped_type& result);
 
 void add_table_to_schema_mutation(schema_ptr table, api::timestamp_type timestamp, bool with_columns_and_triggers, const partition_key& pkey, std::vector<mutation>& mutations);
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <seastar/core/future-util.hh>
+#include <seastar/core/do_with.hh>
+#include <boost/range/adaptor/map.hpp>
+
+#include "db/size_estimates_recorder.hh"
+#include "db/system_keyspace.hh"
+#include "service/storage_service.hh"
+#include "utils/fb_utilities.hh"
+#include "database.hh"
+#include "log.hh"
+
+static logging::logger logger("size_estimates_recorder");
+
+namespace db {
+
+constexpr std::chrono::minutes size_estimates_recorder::update_interval;
+
+distributed<size_estimates_recorder> _the_size_estimates_recorder;
+
+namespace {
+
+struct partition_estimate {
+    uint64_t partitions = 0;
+    // Of all the partitions, from the mean size of those of each sstable.
+    uint64_t total_size = 0;
+};
+
+using token_range = query::range<dht::token>;
+
+// The estimates of the sstables of the table on this shard, by range.
+std::vector<partition_estimate> estimate_locally(column_family& cf, const std::vector<token_range>& ranges) {
+    std::vector<partition_estimate> estimates(ranges.size());
+    auto sstables = cf.get_sstables();
+    for (auto&& sst : *sstables | boost::adaptors::map_values) {
+        auto mean_size = sst->estimated_mean_partition_size();
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            auto keys = sst->estimated_keys_for_range(ranges[i]);
+            estimates[i].partitions += keys;
+            estimates[i].total_size += keys * mean_size;
+        }
+    }
+    return estimates;
+}
+
+future<> record_table(distributed<database>& db, schema_ptr s, const std::vector<token_range>& ranges) {
+    auto id = s->id();
+    return db.map_reduce0([id, &ranges] (database& db) {
+        try {
+            return estimate_locally(db.find_column_family(id), ranges);
+        } catch (no_such_column_family&) {
+            return std::vector<partition_estimate>(ranges.size());
+        }
+    }, std::vector<partition_estimate>(ranges.size()), [] (std::vector<partition_estimate> all, std::vector<partition_estimate> shard) {
+        for (size_t i = 0; i < all.size(); ++i) {
+            all[i].partitions += shard[i].partitions;
+            all[i].total_size += shard[i].total_size;
+        }
+        return all;
+    }).then([s, &ranges] (std::vector<partition_estimate> estimates) {
+        std::vector<system_keyspace::range_estimates> rows;
+        rows.reserve(ranges.size());
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            auto& e = estimates[i];
+            auto mean_size = e.partitions ? e.total_size / e.partitions : 0;
+            rows.push_back({ranges[i], int64_t(e.partitions), int64_t(mean_size)});
+        }
+        return system_keyspace::update_size_estimates(s->ks_name(), s->cf_name(), std::move(rows));
+    });
+}
+
+}
+
+size_estimates_recorder::size_estimates_recorder(distributed<database>& db)
+    : _db(db)
+{}
+
+future<> size_estimates_recorder::start() {
+    // The estimates are of the whole node, so one shard records them.
+    if (engine().cpu_id() == 0) {
+        _timer.set_callback([this] {
+            if (_stop) {
+                return;
+            }
+            record_size_estimates().handle_exception([] (auto ep) {
+                logger.warn("Failed to record size estimates: {}", ep);
+            }).finally([this] {
+                if (!_stop) {
+                    _timer.arm(lowres_clock::now() + update_interval);
+                }
+            });
+        });
+        _timer.arm(lowres_clock::now() + update_interval);
+    }
+    return make_ready_future<>();
+}
+
+future<> size_estimates_recorder::stop() {
+    _stop = true;
+    _timer.cancel();
+    return _gate.close();
+}
+
+future<> size_estimates_recorder::record_size_estimates() {
+    return seastar::with_gate(_gate, [this] {
+        auto& tm = service::get_local_storage_service().get_token_metadata();
+        auto tokens = tm.get_tokens(utils::fb_utilities::get_broadcast_address());
+        if (tokens.empty()) {
+            // Not in the ring yet.
+            return make_ready_future<>();
+        }
+        auto ranges = tm.get_primary_ranges_for(std::unordered_set<dht::token>(tokens.begin(), tokens.end()));
+        std::vector<schema_ptr> tables;
+        auto& db = _db.local();
+        for (auto&& ks_name : db.get_non_system_keyspaces()) {
+            for (auto&& s : db.find_keyspace(ks_name).metadata()->cf_meta_data() | boost::adaptors::map_values) {
+                tables.push_back(s);
+            }
+        }
+        logger.debug("Recording size estimates of {} tables in {} ranges", tables.size(), ranges.size());
+        return do_with(std::move(ranges), std::move(tables), [this] (const std::vector<token_range>& ranges, const std::vector<schema_ptr>& tables) {
+            return do_for_each(tables, [this, &ranges] (const schema_ptr& s) {
+                return record_table(_db, s, ranges);
+            });
+        });
+    });
+}
+
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <seastar/core/future.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/gate.hh>
+
+class database;
+
+namespace db {
+
+/**
+ * Periodically records in system.size_estimates how many partitions each
+ * table has in each of the primary ranges of this node, and their mean size,
+ * for clients to plan splits of full scans without sampling the data.
+ *
+ * The estimates come from the summaries and partition size histograms of
+ * the sstables of all shards; memtables aren't counted. Only shard 0 records
+ * them.
+ */
+class size_estimates_recorder {
+    static constexpr std::chrono::minutes update_interval{5};
+
+    distributed<database>& _db;
+    timer<lowres_clock> _timer;
+    seastar::gate _gate;
+    bool _stop = false;
+public:
+    size_estimates_recorder(distributed<database>& db);
+
+    future<> start();
+    future<> stop();
+
+    // Records the estimates of all tables now.
+    future<> record_size_estimates();
+};
+
+extern distributed<size_estimates_recorder> _the_size_estimates_recorder;
+
+inline distributed<size_estimates_recorder>& get_size_estimates_recorder() {
+    return _the_size_estimates_recorder;
+}
+
+}
@@ -398,6 +398,27 @@ schema_ptr size_estimates() {
     return size_estimates;
 }
 
+schema_ptr available_ranges() {
+    static thread_local auto available_ranges = [] {
+        schema_builder builder(make_lw_shared(schema(generate_legacy_id(NAME, AVAILABLE_RANGES), NAME, AVAILABLE_RANGES,
+            // partition key
+            {{"keyspace_name", utf8_type}},
+            // clustering key
+            {{"table_name", utf8_type}},
+            // regular columns
+            {{"ranges", set_type_impl::get_instance(bytes_type, true)}},
+            // static columns
+            {},
+            // regular column name type
+            utf8_type,
+            // comment
+            "ranges streamed to this node by an unfinished bootstrap"
+            )));
+        return builder.build(schema_builder::compact_storage::no);
+    }();
+    return available_ranges;
+}
+
 static future<> setup_version() {
     sstring req = "INSERT INTO system.%s (key, release_version, cql_version, thrift_version, native_protocol_version, data_center, rack, partitioner, rpc_address, broadcast_address, listen_address) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
     auto& snitch = locator::i_endpoint_snitch::get_local_snitch_ptr();
@@ -878,6 +899,81 @@ future<> set_bootstrap_state(bootstrap_state state) {
     });
 }
 
+future<> update_available_ranges(sstring keyspace, sstring table, std::vector<query::range<dht::token>> ranges) {
+    set_type_impl::native_type rset;
+    for (auto&& r : ranges) {
+        bytes b(bytes::initialized_later(), r.serialized_size());
+        auto out = b.begin();
+        r.serialize(out);
+        rset.push_back(boost::any(std::move(b)));
+    }
+    sstring req = "UPDATE system.%s SET ranges = ranges + ? WHERE keyspace_name = ? AND table_name = ?";
+    return execute_cql(req, AVAILABLE_RANGES, rset, keyspace, table).discard_result().then([] {
+        return force_blocking_flush(AVAILABLE_RANGES);
+    });
+}
+
+future<std::unordered_map<sstring, std::vector<query::range<dht::token>>>> get_available_ranges(sstring keyspace) {
+    sstring req = "SELECT table_name, ranges FROM system.%s WHERE keyspace_name = ?";
+    return execute_cql(req, AVAILABLE_RANGES, keyspace).then([] (::shared_ptr<cql3::untyped_result_set> msg) {
+        std::unordered_map<sstring, std::vector<query::range<dht::token>>> ret;
+        for (auto& row : *msg) {
+            if (!row.has("ranges")) {
+                continue;
+            }
+            auto cdef = available_ranges()->get_column_definition("ranges");
+            auto rset = boost::any_cast<set_type_impl::native_type>(cdef->type->deserialize(row.get_blob("ranges")));
+            auto& ranges = ret[row.template get_as<sstring>("table_name")];
+            for (auto& r : rset) {
+                auto b = boost::any_cast<bytes>(r);
+                bytes_view v(b);
+                ranges.push_back(query::range<dht::token>::deserialize(v));
+            }
+        }
+        return ret;
+    });
+}
+
+future<> update_size_estimates(sstring ks_name, sstring cf_name, std::vector<range_estimates> estimates) {
+    auto schema = size_estimates();
+    auto timestamp = api::new_timestamp();
+    mutation m(partition_key::from_singular(*schema, ks_name), schema);
+    // The ranges this node owns may have changed since the last update, so
+    // the estimates of the ranges it no longer has go too.
+    auto table = utf8_type->decompose(cf_name);
+    m.partition().apply_delete(*schema, exploded_clustering_prefix({table}), tombstone(timestamp - 1, gc_clock::now()));
+    auto to_string = [] (const std::experimental::optional<query::range<dht::token>::bound>& b) {
+        return b ? dht::global_partitioner().to_sstring(b->value()) : dht::global_partitioner().to_sstring(dht::minimum_token());
+    };
+    for (auto&& e : estimates) {
+        auto ck = clustering_key::from_exploded(*schema, {table,
+                utf8_type->decompose(to_string(e.range.start())), utf8_type->decompose(to_string(e.range.end()))});
+        m.set_clustered_cell(ck, "mean_partition_size", e.mean_partition_size, timestamp);
+        m.set_clustered_cell(ck, "partitions_count", e.partitions_count, timestamp);
+    }
+    return do_with(std::move(m), [] (const mutation& m) {
+        return qctx->proxy().mutate_locally(m);
+    });
+}
+
+future<> reset_available_ranges() {
+    sstring req = "SELECT keyspace_name FROM system.%s";
+    return execute_cql(req, AVAILABLE_RANGES).then([] (::shared_ptr<cql3::untyped_result_set> msg) {
+        std::unordered_set<sstring> keyspaces;
+        for (auto& row : *msg) {
+            keyspaces.insert(row.template get_as<sstring>("keyspace_name"));
+        }
+        return do_with(std::move(keyspaces), [] (const std::unordered_set<sstring>& keyspaces) {
+            return do_for_each(keyspaces, [] (const sstring& keyspace) {
+                sstring req = "DELETE FROM system.%s WHERE keyspace_name = ?";
+                return execute_cql(req, AVAILABLE_RANGES, keyspace).discard_result();
+            });
+        });
+    }).then([] {
+        return force_blocking_flush(AVAILABLE_RANGES);
+    });
+}
+
 std::vector<schema_ptr> all_tables() {
     std::vector<schema_ptr> r;
     auto legacy_tables = db::schema_tables::all_tables();
@@ -894,6 +990,7 @@ std::vector<schema_ptr> all_tables() {
     r.push_back(compaction_history());
     r.push_back(sstable_activity());
     r.push_back(size_estimates());
+    r.push_back(available_ranges());
     return r;
 }
 
@@ -78,10 +78,12 @@ static constexpr auto COMPACTIONS_IN_PROGRESS = "compactions_in_progress";
 static constexpr auto COMPACTION_HISTORY = "compaction_history";
 static constexpr auto SSTABLE_ACTIVITY = "sstable_activity";
 static constexpr auto SIZE_ESTIMATES = "size_estimates";
+static constexpr auto AVAILABLE_RANGES = "available_ranges";
 
 
 extern schema_ptr hints();
 extern schema_ptr batchlog();
+extern schema_ptr paxos();
 extern schema_ptr built_indexes(); // TODO (from Cassandra): make private
 
 // Only for testing.
@@ -520,6 +522,23 @@ bool bootstrap_in_progress();
 bootstrap_state get_bootstrap_state();
 future<> set_bootstrap_state(bootstrap_state state);
 
+// The ranges of each table of the keyspace streamed to this node by an
+// unfinished bootstrap, so that a new attempt needs only the others.
+future<> update_available_ranges(sstring keyspace, sstring table, std::vector<query::range<dht::token>> ranges);
+future<std::unordered_map<sstring, std::vector<query::range<dht::token>>>> get_available_ranges(sstring keyspace);
+future<> reset_available_ranges();
+
+// The estimated number of partitions of a table in a range of the ring
+// owned by this node, and their mean size in bytes.
+struct range_estimates {
+    query::range<dht::token> range;
+    int64_t partitions_count;
+    int64_t mean_partition_size;
+};
+
+// Replaces the estimates of the table in system.size_estimates.
+future<> update_size_estimates(sstring ks_name, sstring cf_name, std::vector<range_estimates> estimates);
+
 #if 0
     public static boolean isIndexBuilt(String keyspaceName, String indexName)
     {
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "db/view/view.hh"
+#include "types.hh"
+#include <set>
+
+namespace db {
+namespace view {
+
+namespace {
+
+using view_key = std::pair<partition_key, clustering_key>;
+
+// The row of p with the given key, alone in a partition, with the
+// tombstones of p covering it as its own.
+mutation_partition extract_row(const schema_ptr& s, const mutation_partition& p, const clustering_key& key) {
+    mutation_partition r(s);
+    auto& row = r.clustered_row(key);
+    row.apply(p.tombstone_for_row(*s, key));
+    if (auto e = p.find_entry(*s, key)) {
+        row.apply(e->row().marker());
+        row.cells() = ::row(e->row().cells());
+    }
+    return r;
+}
+
+// The regular column of the base table in the view's primary key, if any.
+const column_definition* view_key_column(const schema& base, const schema& view) {
+    for (auto&& vdef : boost::join(view.partition_key_columns(), view.clustering_key_columns())) {
+        auto bdef = base.get_column_definition(vdef.name());
+        if (bdef->is_regular()) {
+            return bdef;
+        }
+    }
+    return nullptr;
+}
+
+// The live cell of an atomic column of the row, if any.
+std::experimental::optional<atomic_cell_view> live_cell(const column_definition& def, const deletable_row& r, gc_clock::time_point now) {
+    auto c = r.cells().find_cell(def.id);
+    if (!c || !c->as_atomic_cell().is_live(r.deleted_at(), now)) {
+        return {};
+    }
+    return c->as_atomic_cell();
+}
+
+// The key of the view row of a base row, or nothing if it has none.
+std::experimental::optional<view_key> make_view_key(const schema& base, const schema& view,
+        const partition_key& pk, const clustering_key& ck, const deletable_row& r, gc_clock::time_point now) {
+    if (!r.is_live(base, tombstone(), now)) {
+        return {};
+    }
+    auto pk_values = pk.explode(base);
+    auto ck_values = ck.explode(base);
+    auto value_of = [&] (const column_definition& vdef) -> bytes_opt {
+        auto& bdef = *base.get_column_definition(vdef.name());
+        if (bdef.is_partition_key()) {
+            return pk_values[bdef.id];
+        }
+        if (bdef.is_clustering_key()) {
+            return ck_values[bdef.id];
+        }
+        auto cell = live_cell(bdef, r, now);
+        if (!cell) {
+            return {};
+        }
+        return bytes(cell->value().begin(), cell->value().end());
+    };
+    std::vector<bytes> view_pk;
+    for (auto&& vdef : view.partition_key_columns()) {
+        auto v = value_of(vdef);
+        if (!v || v->empty()) {
+            return {};
+        }
+        view_pk.push_back(std::move(*v));
+    }
+    std::vector<bytes> view_ck;
+    for (auto&& vdef : view.clustering_key_columns()) {
+        auto v = value_of(vdef);
+        if (!v) {
+            return {};
+        }
+        view_ck.push_back(std::move(*v));
+    }
+    return view_key(partition_key::from_exploded(view, std::move(view_pk)),
+            clustering_key::from_exploded(view, std::move(view_ck)));
+}
+
+// The newest timestamp of anything in the row.
+api::timestamp_type max_timestamp(const schema& s, const deletable_row& r) {
+    auto ts = std::max(r.deleted_at().timestamp, r.marker().timestamp());
+    r.cells().for_each_cell([&] (column_id id, const atomic_cell_or_collection& c) {
+        auto& def = s.regular_column_at(id);
+        if (def.is_atomic()) {
+            ts = std::max(ts, c.as_atomic_cell().timestamp());
+        } else {
+            auto ctype = static_pointer_cast<const collection_type_impl>(def.type);
+            auto mv = ctype->deserialize_mutation_form(c.as_collection_mutation());
+            ts = std::max(ts, mv.tomb.timestamp);
+            for (auto&& e : mv.cells) {
+                ts = std::max(ts, e.second.timestamp());
+            }
+        }
+    });
+    return ts;
+}
+
+// The marker keeping the view row of a live base row alive for as long as
+// the base row is: as long as the value the view row is keyed by, if any,
+// or else as long as the base row's marker or its cells the view lacks.
+std::experimental::optional<row_marker> make_view_marker(const schema& base, const schema& view,
+        const column_definition* key_column, const deletable_row& r, gc_clock::time_point now) {
+    if (key_column) {
+        auto cell = *live_cell(*key_column, r, now);
+        if (cell.is_live_and_has_ttl()) {
+            return row_marker(cell.timestamp(), cell.ttl(), cell.expiry());
+        }
+        return row_marker(cell.timestamp());
+    }
+    if (r.marker().is_live(r.deleted_at(), now)) {
+        return r.marker();
+    }
+    if (view.get_view_info().include_all_columns) {
+        return {};
+    }
+    return row_marker(max_timestamp(base, r));
+}
+
+// Writes the cells of the base row the view has columns for to the view row.
+void project_cells(const schema& base, const schema& view, const deletable_row& from, deletable_row& to) {
+    for (auto&& vdef : view.regular_columns()) {
+        auto bdef = base.get_column_definition(vdef.name());
+        if (auto c = from.cells().find_cell(bdef->id)) {
+            to.cells().apply(vdef, *c);
+        }
+    }
+}
+
+}
+
+bool may_update_view(const mutation& m) {
+    return !m.partition().clustered_rows().empty()
+        || m.partition().partition_tombstone()
+        || !m.partition().row_tombstones().empty();
+}
+
+std::vector<mutation> make_view_updates(const schema_ptr& base, const schema_ptr& view,
+        const mutation& m, const mutation_partition* existing, gc_clock::time_point now) {
+    auto& s = *base;
+    auto key_column = view_key_column(s, *view);
+    std::vector<mutation> updates;
+
+    // The rows the write touches: those it writes to, and those of the
+    // partition its partition and range tombstones cover.
+    clustering_key::less_compare less(s);
+    std::set<clustering_key, clustering_key::less_compare> keys(less);
+    for (auto&& e : m.partition().clustered_rows()) {
+        keys.insert(e.key());
+    }
+    if (existing && (m.partition().partition_tombstone() || !m.partition().row_tombstones().empty())) {
+        for (auto&& e : existing->clustered_rows()) {
+            if (m.partition().range_tombstone_for_row(s, e.key())) {
+                keys.insert(e.key());
+            }
+        }
+    }
+
+    mutation_partition empty(base);
+    auto& current = existing ? *existing : empty;
+    for (auto&& key : keys) {
+        auto before = extract_row(base, current, key);
+        auto written = extract_row(base, m.partition(), key);
+        auto after = before;
+        after.apply(s, written);
+        auto& before_row = before.clustered_row(key);
+        auto& written_row = written.clustered_row(key);
+        auto& after_row = after.clustered_row(key);
+
+        auto old_key = make_view_key(s, *view, m.key(), key, before_row, now);
+        auto new_key = make_view_key(s, *view, m.key(), key, after_row, now);
+        bool same_key = old_key && new_key
+                && old_key->first.equal(*view, new_key->first)
+                && old_key->second.equal(*view, new_key->second);
+
+        if (old_key && !same_key) {
+            // Deleted as of the newest of what it was made of, and of what
+            // changed its key.
+            mutation update(std::move(old_key->first), view);
+            update.partition().apply_delete(*view, std::move(old_key->second), tombstone(max_timestamp(s, after_row), now));
+            updates.push_back(std::move(update));
+        }
+        if (new_key) {
+            mutation update(std::move(new_key->first), view);
+            auto& view_row = update.partition().clustered_row(std::move(new_key->second));
+            auto& source = same_key ? written_row : after_row;
+            view_row.apply(source.deleted_at());
+            if (auto marker = make_view_marker(s, *view, key_column, after_row, now)) {
+                view_row.apply(*marker);
+            }
+            project_cells(s, *view, source, view_row);
+            updates.push_back(std::move(update));
+        }
+    }
+    return updates;
+}
+
+}
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "schema.hh"
+#include "mutation.hh"
+#include "gc_clock.hh"
+#include <vector>
+
+namespace db {
+namespace view {
+
+/**
+ * The writes to a materialized view which bring it in line with a write to
+ * its base table.
+ *
+ * A row of the base table has a row in the view while it is live and, when
+ * the view's primary key has a regular column of the base table, while that
+ * column has a live value, which the view row is keyed by. Of the rows the
+ * write touches, those whose view key changed or which died are deleted from
+ * the view, those which got a new view key are written there in full, and
+ * the others get the part of the write the view has columns for.
+ *
+ * existing is the partition written to as it was before the write, or null
+ * if it had no data.
+ */
+std::vector<mutation> make_view_updates(const schema_ptr& base, const schema_ptr& view,
+        const mutation& m, const mutation_partition* existing, gc_clock::time_point now);
+
+// Whether writes to the base table may have to update the view, i.e. whether
+// the write has rows or row tombstones.
+bool may_update_view(const mutation& m);
+
+}
+}
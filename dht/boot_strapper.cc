@@ -40,6 +40,8 @@
 #include "service/storage_service.hh"
 #include "dht/range_streamer.hh"
 #include "gms/failure_detector.hh"
+#include "db/system_keyspace.hh"
+#include "db/saved_caches_manager.hh"
 #include "log.hh"
 
 static logging::logger logger("boot_strapper");
@@ -49,24 +51,36 @@ namespace dht {
 future<> boot_strapper::bootstrap() {
     logger.debug("Beginning bootstrap process: sorted_tokens={}", _token_metadata.sorted_tokens());
 
-    range_streamer streamer(_db, _token_metadata, _tokens, _address, "Bootstrap");
-    streamer.add_source_filter(std::make_unique<range_streamer::failure_detector_source_filter>(gms::get_local_failure_detector()));
+    auto streamer = make_lw_shared<range_streamer>(_db, _token_metadata, _tokens, _address, "Bootstrap");
+    streamer->add_source_filter(std::make_unique<range_streamer::failure_detector_source_filter>(gms::get_local_failure_detector()));
+    // Keyspaces replicated alike have the same pending ranges.
+    std::map<locator::replication_params, std::vector<range<token>>> pending_ranges;
     for (const auto& keyspace_name : _db.local().get_non_system_keyspaces()) {
         auto& ks = _db.local().find_keyspace(keyspace_name);
         auto& strategy = ks.get_replication_strategy();
-        std::vector<range<token>> ranges = strategy.get_pending_address_ranges(_token_metadata, _tokens, _address);
+        auto params = strategy.get_replication_params();
+        auto it = pending_ranges.find(params);
+        if (it == pending_ranges.end()) {
+            it = pending_ranges.emplace(std::move(params), strategy.get_pending_address_ranges(_token_metadata, _tokens, _address)).first;
+        }
+        auto& ranges = it->second;
         logger.debug("Will stream keyspace={}, ranges={}", keyspace_name, ranges);
-        streamer.add_ranges(keyspace_name, ranges);
+        streamer->add_ranges(keyspace_name, ranges);
     }
 
-    return streamer.fetch_async().then_wrapped([this] (auto&& f) {
+    return streamer->fetch_async().then_wrapped([this, streamer] (auto&& f) {
         try {
             auto state = f.get0();
         } catch (...) {
             throw std::runtime_error(sprint("Error during boostrap: %s", std::current_exception()));
         }
-        service::get_local_storage_service().finish_bootstrapping();
-        return make_ready_future<>();
+        // What was received is only of use to a new attempt.
+        return db::system_keyspace::reset_available_ranges().then([streamer] {
+            // Before serving reads, so that they don't all go to disk.
+            return db::get_local_saved_caches_manager().warm_up_from(streamer->ranges_by_source());
+        }).then([] {
+            service::get_local_storage_service().finish_bootstrapping();
+        });
     });
 }
 
@@ -43,12 +43,12 @@ token byte_ordered_partitioner::midpoint(const token& t1, const token& t2) const
 }
 
 unsigned
-byte_ordered_partitioner::shard_of(const token& t) const {
+byte_ordered_partitioner::shard_of(const token& t, unsigned shard_count) const {
     if (t._data.empty()) {
         return 0;
     }
     // treat first byte as a fraction in the range [0, 1) and divide it evenly:
-    return (uint8_t(t._data[0]) * smp::count) >> 8;
+    return (uint8_t(t._data[0]) * shard_count) >> 8;
 }
 
 using registry = class_registrator<i_partitioner, byte_ordered_partitioner>;
@@ -65,7 +65,9 @@ class byte_ordered_partitioner final : public i_partitioner {
             return token(token::kind::key, bytes(data.begin(), data.end()));
         }
     }
-    virtual unsigned shard_of(const token& t) const override;
+    using i_partitioner::shard_of;
+    virtual unsigned shard_of(const token& t, unsigned shard_count) const override;
+    virtual const sstring sharding_algorithm() const override { return "first-byte-range"; }
 };
 
 }
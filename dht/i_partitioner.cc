@@ -111,6 +111,25 @@ static inline unsigned char get_byte(bytes_view b, size_t off) {
     }
 }
 
+std::vector<token> i_partitioner::get_tokens(const schema& s, const std::vector<partition_key>& keys) {
+    std::vector<token> tokens;
+    tokens.reserve(keys.size());
+    for (auto&& key : keys) {
+        tokens.push_back(get_token(s, key));
+    }
+    return tokens;
+}
+
+std::vector<decorated_key> i_partitioner::decorate_keys(const schema& s, std::vector<partition_key> keys) {
+    auto tokens = get_tokens(s, keys);
+    std::vector<decorated_key> dks;
+    dks.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        dks.push_back({ std::move(tokens[i]), std::move(keys[i]) });
+    }
+    return dks;
+}
+
 int i_partitioner::tri_compare(const token& t1, const token& t2) {
     size_t sz = std::max(t1._data.size(), t2._data.size());
 
@@ -126,6 +145,27 @@ int i_partitioner::tri_compare(const token& t1, const token& t2) {
     return 0;
 }
 
+// The first 8 bytes of the binary fraction, big endian.
+uint64_t i_partitioner::prefix(const token& t) {
+    uint64_t p = 0;
+    for (size_t i = 0; i < sizeof(p); i++) {
+        p = (p << 8) | get_byte(t._data, i);
+    }
+    return p;
+}
+
+uint64_t token_prefix(const token& t) {
+    switch (t._kind) {
+    case token::kind::before_all_keys:
+        return 0;
+    case token::kind::after_all_keys:
+        return std::numeric_limits<uint64_t>::max();
+    case token::kind::key:
+        return global_partitioner().prefix(t);
+    }
+    abort();
+}
+
 int tri_compare(const token& t1, const token& t2) {
     if (t1._kind == t2._kind) {
         return global_partitioner().tri_compare(t1, t2);
@@ -289,6 +329,10 @@ ring_position ring_position::deserialize(bytes_view& in) {
     }
 }
 
+unsigned i_partitioner::shard_of(const token& t) const {
+    return shard_of(t, smp::count);
+}
+
 unsigned shard_of(const token& t) {
     return global_partitioner().shard_of(t);
 }
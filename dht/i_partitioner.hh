@@ -110,6 +110,9 @@ token maximum_token();
 bool operator==(const token& t1, const token& t2);
 bool operator<(const token& t1, const token& t2);
 int tri_compare(const token& t1, const token& t2);
+// Maps tokens to integers preserving their order, though not telling all
+// of them apart, so that tokens can mostly be ordered by integer compares.
+uint64_t token_prefix(const token& t);
 inline bool operator!=(const token& t1, const token& t2) { return std::rel_ops::operator!=(t1, t2); }
 inline bool operator>(const token& t1, const token& t2) { return std::rel_ops::operator>(t1, t2); }
 inline bool operator<=(const token& t1, const token& t2) { return std::rel_ops::operator<=(t1, t2); }
@@ -184,6 +187,15 @@ class i_partitioner {
         return { std::move(token), std::move(key) };
     }
 
+    /**
+     * Transform keys to object representation of the on-disk format, as
+     * decorate_key() does each of them.
+     *
+     * @param keys the raw, client-facing keys
+     * @return decorated versions of keys, in the same order
+     */
+    std::vector<decorated_key> decorate_keys(const schema& s, std::vector<partition_key> keys);
+
     /**
      * Calculate a token representing the approximate "middle" of the given
      * range.
@@ -208,6 +220,12 @@ class i_partitioner {
     virtual token get_token(const schema& s, partition_key_view key) = 0;
     virtual token get_token(const sstables::key_view& key) = 0;
 
+    /**
+     * @return the tokens of the keys, in the same order, which partitioners
+     * may compute faster than one at a time, as when routing a batch.
+     */
+    virtual std::vector<token> get_tokens(const schema& s, const std::vector<partition_key>& keys);
+
 
     /**
      * @return a partitioner-specific string representation of this token
@@ -252,7 +270,19 @@ class i_partitioner {
     /**
      * Calculates the shard that handles a particular token.
      */
-    virtual unsigned shard_of(const token& t) const = 0;
+    unsigned shard_of(const token& t) const;
+
+    /**
+     * Calculates the shard that handles a particular token on a node with
+     * shard_count shards, such as another node of the cluster.
+     */
+    virtual unsigned shard_of(const token& t, unsigned shard_count) const = 0;
+
+    /**
+     * @return name of the algorithm implemented by shard_of(), advertised to
+     * clients so that they can compute the owning shard of a token by themselves.
+     */
+    virtual const sstring sharding_algorithm() const = 0;
 
     /**
      * @return bytes that represent the token as required by get_token_validator().
@@ -277,10 +307,16 @@ class i_partitioner {
     bool is_less(const token& t1, const token& t2) {
         return tri_compare(t1, t2) < 0;
     }
+    /**
+     * @return a 64-bit integer such that if t1's _data array is less than t2's,
+     * prefix(t1) <= prefix(t2). _kind should be accounted for separately.
+     */
+    virtual uint64_t prefix(const token& t);
 
     friend bool operator==(const token& t1, const token& t2);
     friend bool operator<(const token& t1, const token& t2);
     friend int tri_compare(const token& t1, const token& t2);
+    friend uint64_t token_prefix(const token& t);
 };
 
 //
@@ -395,6 +431,17 @@ struct token_comparator {
     int operator()(const token& t1, const token& t2) const;
 };
 
+// Maps decorated keys and ring positions to the token_prefix() of their
+// tokens, which is consistent with their ordering.
+struct token_prefix_of {
+    uint64_t operator()(const decorated_key& k) const {
+        return token_prefix(k._token);
+    }
+    uint64_t operator()(const ring_position& p) const {
+        return token_prefix(p.token());
+    }
+};
+
 std::ostream& operator<<(std::ostream& out, const token& t);
 
 std::ostream& operator<<(std::ostream& out, const decorated_key& t);
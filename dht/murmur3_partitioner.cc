@@ -69,6 +69,28 @@ murmur3_partitioner::get_token(const schema& s, partition_key_view key) {
     return get_token(hash[0]);
 }
 
+std::vector<token>
+murmur3_partitioner::get_tokens(const schema& s, const std::vector<partition_key>& keys) {
+    // The legacy form of a single-component key is the component, which is
+    // how the key is stored: the keys are hashed in place, together.
+    if (!s.partition_key_type()->is_singular()) {
+        return i_partitioner::get_tokens(s, keys);
+    }
+    std::vector<bytes_view> legacy;
+    legacy.reserve(keys.size());
+    for (auto&& key : keys) {
+        legacy.emplace_back(key.representation());
+    }
+    std::vector<std::array<uint64_t, 2>> hashes;
+    utils::murmur_hash::hash3_x64_128(legacy, 0, hashes);
+    std::vector<token> tokens;
+    tokens.reserve(keys.size());
+    for (auto&& hash : hashes) {
+        tokens.push_back(get_token(hash[0]));
+    }
+    return tokens;
+}
+
 token murmur3_partitioner::get_random_token() {
     auto rand = dht::get_random_number<uint64_t>();
     return get_token(rand);
@@ -119,6 +141,11 @@ int murmur3_partitioner::tri_compare(const token& t1, const token& t2) {
     }
 }
 
+uint64_t murmur3_partitioner::prefix(const token& t) {
+    // Flipping the sign bit maps the signed order onto the unsigned one.
+    return uint64_t(long_token(t)) ^ 0x8000'0000'0000'0000;
+}
+
 token murmur3_partitioner::midpoint(const token& t1, const token& t2) const {
     auto l1 = long_token(t1);
     auto l2 = long_token(t2);
@@ -177,12 +204,12 @@ murmur3_partitioner::get_token_validator() {
 }
 
 unsigned
-murmur3_partitioner::shard_of(const token& t) const {
+murmur3_partitioner::shard_of(const token& t, unsigned shard_count) const {
     int64_t l = long_token(t);
     // treat l as a fraction between 0 and 1 and use 128-bit arithmetic to
     // divide that range evenly among shards:
     uint64_t adjusted = uint64_t(l) + uint64_t(std::numeric_limits<int64_t>::min());
-    return (__int128(adjusted) * smp::count) >> 64;
+    return (__int128(adjusted) * shard_count) >> 64;
 }
 
 using registry = class_registrator<i_partitioner, murmur3_partitioner>;
@@ -31,15 +31,19 @@ class murmur3_partitioner final : public i_partitioner {
     virtual const sstring name() { return "org.apache.cassandra.dht.Murmur3Partitioner"; }
     virtual token get_token(const schema& s, partition_key_view key) override;
     virtual token get_token(const sstables::key_view& key) override;
+    virtual std::vector<token> get_tokens(const schema& s, const std::vector<partition_key>& keys) override;
     virtual token get_random_token() override;
     virtual bool preserves_order() override { return false; }
     virtual std::map<token, float> describe_ownership(const std::vector<token>& sorted_tokens) override;
     virtual data_type get_token_validator() override;
     virtual int tri_compare(const token& t1, const token& t2) override;
+    virtual uint64_t prefix(const token& t) override;
     virtual token midpoint(const token& t1, const token& t2) const override;
     virtual sstring to_sstring(const dht::token& t) const override;
     virtual dht::token from_sstring(const sstring& t) const override;
-    virtual unsigned shard_of(const token& t) const override;
+    using i_partitioner::shard_of;
+    virtual unsigned shard_of(const token& t, unsigned shard_count) const override;
+    virtual const sstring sharding_algorithm() const override { return "biased-token-range"; }
 private:
     static int64_t normalize(int64_t in);
     token get_token(bytes_view key);
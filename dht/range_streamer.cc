@@ -40,10 +40,12 @@
 #include "utils/fb_utilities.hh"
 #include "locator/snitch_base.hh"
 #include "database.hh"
+#include "db/config.hh"
 #include "gms/gossiper.hh"
 #include "log.hh"
 #include "streaming/stream_plan.hh"
 #include "streaming/stream_state.hh"
+#include "db/system_keyspace.hh"
 
 namespace dht {
 
@@ -67,15 +69,31 @@ unordered_multimap_to_unordered_map(const std::unordered_multimap<range<token>,
     return ret;
 }
 
+// How far the source is from this node: 0 in its rack, 1 in its
+// datacenter, 2 elsewhere.
+static int distance_to(inet_address source) {
+    auto& snitch = locator::i_endpoint_snitch::get_local_snitch_ptr();
+    auto local = utils::fb_utilities::get_broadcast_address();
+    if (snitch->get_datacenter(source) != snitch->get_datacenter(local)) {
+        return 2;
+    }
+    return snitch->get_rack(source) == snitch->get_rack(local) ? 0 : 1;
+}
+
 std::unordered_multimap<inet_address, range<token>>
 range_streamer::get_range_fetch_map(const std::unordered_multimap<range<token>, inet_address>& ranges_with_sources,
                                     const std::unordered_set<std::unique_ptr<i_source_filter>>& source_filters,
-                                    const sstring& keyspace) {
+                                    const sstring& keyspace,
+                                    std::unordered_map<inet_address, size_t>& ranges_per_source) {
     std::unordered_multimap<inet_address, range<token>> range_fetch_map_map;
     for (auto x : unordered_multimap_to_unordered_map(ranges_with_sources)) {
         const range<token>& range_ = x.first;
         const std::unordered_set<inet_address>& addresses = x.second;
         bool found_source = false;
+        // Of the nearest sources, the one streaming the fewest ranges so far,
+        // so that the ranges are streamed from as many nodes as possible.
+        std::experimental::optional<inet_address> source;
+        int source_distance = 0;
         for (auto address : addresses) {
             if (address == utils::fb_utilities::get_broadcast_address()) {
                 // If localhost is a source, we have found one, but we don't add it to the map to avoid streaming locally
@@ -95,9 +113,19 @@ range_streamer::get_range_fetch_map(const std::unordered_multimap<range<token>,
                 continue;
             }
 
-            range_fetch_map_map.emplace(address, range_);
+            auto distance = distance_to(address);
+            if (!source || distance < source_distance
+                    || (distance == source_distance && ranges_per_source[address] < ranges_per_source[*source])) {
+                source = address;
+                source_distance = distance;
+            }
+        }
+
+        if (source) {
+            // ensure we only stream from one other node for each range
+            range_fetch_map_map.emplace(*source, range_);
+            ++ranges_per_source[*source];
             found_source = true;
-            break; // ensure we only stream from one other node for each range
         }
 
         if (!found_source) {
@@ -108,6 +136,50 @@ range_streamer::get_range_fetch_map(const std::unordered_multimap<range<token>,
     return range_fetch_map_map;
 }
 
+const range_streamer::range_addresses_map&
+range_streamer::get_range_addresses(const locator::abstract_replication_strategy& strat) {
+    auto params = strat.get_replication_params();
+    auto it = _range_addresses.find(params);
+    if (it == _range_addresses.end()) {
+        auto tm = _metadata.clone_only_token_map();
+        it = _range_addresses.emplace(std::move(params), unordered_multimap_to_unordered_map(strat.get_range_addresses(tm))).first;
+    }
+    return it->second;
+}
+
+const range_streamer::range_addresses_map&
+range_streamer::get_pending_range_addresses(const locator::abstract_replication_strategy& strat) {
+    auto params = strat.get_replication_params();
+    auto it = _pending_range_addresses.find(params);
+    if (it == _pending_range_addresses.end()) {
+        auto tm = _metadata.clone_only_token_map();
+        tm.update_normal_tokens(_tokens, _address);
+        it = _pending_range_addresses.emplace(std::move(params), unordered_multimap_to_unordered_map(strat.get_range_addresses(tm))).first;
+    }
+    return it->second;
+}
+
+std::vector<const range_streamer::range_addresses_map::value_type*>
+range_streamer::find_containing(const range_addresses_map& range_addresses, const range<token>& desired_range) {
+    std::vector<const range_addresses_map::value_type*> ret;
+    // A range the ring is split into by more tokens lies in the range of the
+    // ring ending at the first token at or after its end.
+    if (desired_range.end() && !_metadata.sorted_tokens().empty()) {
+        auto& end = desired_range.end()->value();
+        auto it = range_addresses.find(_metadata.get_primary_range_for(_metadata.first_token(end)));
+        if (it != range_addresses.end() && it->first.contains(desired_range, dht::tri_compare)) {
+            ret.push_back(&*it);
+            return ret;
+        }
+    }
+    for (auto& x : range_addresses) {
+        if (x.first.contains(desired_range, dht::tri_compare)) {
+            ret.push_back(&x);
+        }
+    }
+    return ret;
+}
+
 std::unordered_multimap<range<token>, inet_address>
 range_streamer::get_all_ranges_with_sources_for(const sstring& keyspace_name, std::vector<range<token>> desired_ranges) {
     logger.debug("{} ks={}", __func__, keyspace_name);
@@ -115,24 +187,19 @@ range_streamer::get_all_ranges_with_sources_for(const sstring& keyspace_name, st
     auto& ks = _db.local().find_keyspace(keyspace_name);
     auto& strat = ks.get_replication_strategy();
 
-    // std::unordered_multimap<range<token>, inet_address>
-    auto tm = _metadata.clone_only_token_map();
-    auto range_addresses = unordered_multimap_to_unordered_map(strat.get_range_addresses(tm));
+    auto& range_addresses = get_range_addresses(strat);
 
     std::unordered_multimap<range<token>, inet_address> range_sources;
     auto& snitch = locator::i_endpoint_snitch::get_local_snitch_ptr();
     for (auto& desired_range : desired_ranges) {
         auto found = false;
-        for (auto& x : range_addresses) {
-            const range<token>& src_range = x.first;
-            if (src_range.contains(desired_range, dht::tri_compare)) {
-                std::unordered_set<inet_address>& addresses = x.second;
-                auto preferred = snitch->get_sorted_list_by_proximity(_address, addresses);
-                for (inet_address& p : preferred) {
-                    range_sources.emplace(desired_range, p);
-                }
-                found = true;
+        for (auto x : find_containing(range_addresses, desired_range)) {
+            auto& addresses = x->second;
+            auto preferred = snitch->get_sorted_list_by_proximity(_address, addresses);
+            for (inet_address& p : preferred) {
+                range_sources.emplace(desired_range, p);
             }
+            found = true;
         }
 
         if (!found) {
@@ -152,38 +219,33 @@ range_streamer::get_all_ranges_with_strict_sources_for(const sstring& keyspace_n
     auto& strat = ks.get_replication_strategy();
 
     //Active ranges
-    auto metadata_clone = _metadata.clone_only_token_map();
-    auto range_addresses = unordered_multimap_to_unordered_map(strat.get_range_addresses(metadata_clone));
+    auto& range_addresses = get_range_addresses(strat);
 
     //Pending ranges
-    metadata_clone.update_normal_tokens(_tokens, _address);
-    auto pending_range_addresses  = unordered_multimap_to_unordered_map(strat.get_range_addresses(metadata_clone));
+    auto& pending_range_addresses = get_pending_range_addresses(strat);
 
     //Collects the source that will have its range moved to the new node
     std::unordered_multimap<range<token>, inet_address> range_sources;
 
     for (auto& desired_range : desired_ranges) {
-        for (auto& x : range_addresses) {
-            const range<token>& src_range = x.first;
-            if (src_range.contains(desired_range, dht::tri_compare)) {
-                auto old_endpoints = x.second;
-                auto it = pending_range_addresses.find(desired_range);
-                assert (it != pending_range_addresses.end());
-                auto new_endpoints = it->second;
-
-                //Due to CASSANDRA-5953 we can have a higher RF then we have endpoints.
-                //So we need to be careful to only be strict when endpoints == RF
-                if (old_endpoints.size() == strat.get_replication_factor()) {
-                    std::unordered_set<inet_address> diff;
-                    std::set_difference(old_endpoints.begin(), old_endpoints.end(),
-                            new_endpoints.begin(), new_endpoints.end(), std::inserter(diff, diff.begin()));
-                    old_endpoints = std::move(diff);
-                    if (old_endpoints.size() != 1) {
-                        throw std::runtime_error(sprint("Expected 1 endpoint but found ", old_endpoints.size()));
-                    }
+        for (auto x : find_containing(range_addresses, desired_range)) {
+            auto old_endpoints = x->second;
+            auto it = pending_range_addresses.find(desired_range);
+            assert (it != pending_range_addresses.end());
+            auto& new_endpoints = it->second;
+
+            //Due to CASSANDRA-5953 we can have a higher RF then we have endpoints.
+            //So we need to be careful to only be strict when endpoints == RF
+            if (old_endpoints.size() == strat.get_replication_factor()) {
+                std::unordered_set<inet_address> diff;
+                std::set_difference(old_endpoints.begin(), old_endpoints.end(),
+                        new_endpoints.begin(), new_endpoints.end(), std::inserter(diff, diff.begin()));
+                old_endpoints = std::move(diff);
+                if (old_endpoints.size() != 1) {
+                    throw std::runtime_error(sprint("Expected 1 endpoint but found ", old_endpoints.size()));
                 }
-                range_sources.emplace(desired_range, *(old_endpoints.begin()));
             }
+            range_sources.emplace(desired_range, *(old_endpoints.begin()));
         }
 
         //Validate
@@ -231,7 +293,7 @@ void range_streamer::add_ranges(const sstring& keyspace_name, std::vector<range<
 
     // TODO: share code with unordered_multimap_to_unordered_map
     std::unordered_map<inet_address, std::vector<range<token>>> tmp;
-    for (auto& x : get_range_fetch_map(ranges_for_keyspace, _source_filters, keyspace_name)) {
+    for (auto& x : get_range_fetch_map(ranges_for_keyspace, _source_filters, keyspace_name, _ranges_per_source)) {
         auto& addr = x.first;
         auto& range_ = x.second;
         auto it = tmp.find(addr);
@@ -250,23 +312,79 @@ void range_streamer::add_ranges(const sstring& keyspace_name, std::vector<range<
     _to_fetch.emplace(keyspace_name, std::move(tmp));
 }
 
-future<streaming::stream_state> range_streamer::fetch_async() {
-    for (auto& fetch : _to_fetch) {
-        const auto& keyspace = fetch.first;
-        for (auto& x : fetch.second) {
-            auto& source = x.first;
-            auto& ranges = x.second;
-            // FIXME InetAddress preferred = SystemKeyspace.getPreferredIP(source);
-            auto preferred = source;
-            /* Send messages to respective folks to stream data over to me */
-            if (logger.is_enabled(logging::log_level::debug)) {
-                logger.debug("{}ing from {} ranges {}", _description, source, ranges);
+void range_streamer::stream_state_store::handle_stream_event(streaming::table_received_event event) {
+    _written = _written.then([event = std::move(event)] () mutable {
+        return db::system_keyspace::update_available_ranges(event.keyspace, event.table, std::move(event.ranges));
+    }).handle_exception([] (auto ep) {
+        logger.warn("Fail to record the ranges received: {}", ep);
+    });
+}
+
+void range_streamer::request_ranges(const sstring& keyspace, inet_address source, const std::vector<range<token>>& ranges,
+        const std::unordered_map<sstring, std::vector<range<token>>>& available) {
+    // FIXME InetAddress preferred = SystemKeyspace.getPreferredIP(source);
+    auto preferred = source;
+    if (available.empty()) {
+        /* Send messages to respective folks to stream data over to me */
+        if (logger.is_enabled(logging::log_level::debug)) {
+            logger.debug("{}ing from {} ranges {}", _description, source, ranges);
+        }
+        _stream_plan.request_ranges(source, preferred, keyspace, ranges);
+        return;
+    }
+    // Each table needs the ranges no earlier attempt received of it.
+    for (auto&& cf : _db.local().find_keyspace(keyspace).metadata()->cf_meta_data()) {
+        auto it = available.find(cf.first);
+        std::vector<range<token>> needed;
+        for (auto&& r : ranges) {
+            bool received = it != available.end() && std::any_of(it->second.begin(), it->second.end(), [&r] (const range<token>& a) {
+                return a.contains(r, dht::tri_compare);
+            });
+            if (!received) {
+                needed.push_back(r);
+            }
+        }
+        logger.info("{}: {} of {} ranges of {}.{} from {} were received by an earlier attempt",
+                _description, ranges.size() - needed.size(), ranges.size(), keyspace, cf.first, source);
+        if (!needed.empty()) {
+            _stream_plan.request_ranges(source, preferred, keyspace, std::move(needed), {cf.first});
+        }
+    }
+}
+
+std::unordered_map<inet_address, std::vector<range<token>>> range_streamer::ranges_by_source() const {
+    std::unordered_map<inet_address, std::vector<range<token>>> sources;
+    for (auto&& fetch : _to_fetch) {
+        for (auto&& x : fetch.second) {
+            auto& ranges = sources[x.first];
+            for (auto&& r : x.second) {
+                // Keyspaces replicated alike fetch the same ranges.
+                if (std::find(ranges.begin(), ranges.end(), r) == ranges.end()) {
+                    ranges.push_back(r);
+                }
             }
-            _stream_plan.request_ranges(source, preferred, keyspace, ranges);
         }
     }
+    return sources;
+}
 
-    return _stream_plan.execute();
+future<streaming::stream_state> range_streamer::fetch_async() {
+    _stream_plan.sstable_files(_db.local().get_config().stream_sstable_files());
+    return do_for_each(_to_fetch, [this] (auto& fetch) {
+        return db::system_keyspace::get_available_ranges(fetch.first).then([this, &fetch] (auto available) {
+            for (auto& x : fetch.second) {
+                this->request_ranges(fetch.first, x.first, x.second, available);
+            }
+        });
+    }).then([this] {
+        auto store = make_lw_shared<stream_state_store>();
+        _stream_plan.listeners({store.get()});
+        return _stream_plan.execute().then_wrapped([store] (future<streaming::stream_state> f) {
+            return store->flush().then([f = std::move(f)] () mutable {
+                return std::move(f);
+            });
+        });
+    });
 }
 
 } // dht
@@ -39,8 +39,10 @@
 #pragma once
 
 #include "locator/token_metadata.hh"
+#include "locator/abstract_replication_strategy.hh"
 #include "streaming/stream_plan.hh"
 #include "streaming/stream_state.hh"
+#include "streaming/stream_event_handler.hh"
 #include "gms/inet_address.hh"
 #include "gms/i_failure_detector.hh"
 #include "range.hh"
@@ -127,7 +129,16 @@ class range_streamer {
 
     void add_ranges(const sstring& keyspace_name, std::vector<range<token>> ranges);
 private:
+    using range_addresses_map = std::unordered_map<range<token>, std::unordered_set<inet_address>>;
+
     bool use_strict_sources_for_ranges(const sstring& keyspace_name);
+    // The replicas of each range of the ring, before and after the tokens are
+    // added to it, calculated once for the keyspaces replicated alike.
+    const range_addresses_map& get_range_addresses(const locator::abstract_replication_strategy& strat);
+    const range_addresses_map& get_pending_range_addresses(const locator::abstract_replication_strategy& strat);
+    // The ranges of the ring which contain the desired range.
+    std::vector<const range_addresses_map::value_type*> find_containing(const range_addresses_map& range_addresses,
+            const range<token>& desired_range);
     /**
      * Get a map of all ranges and their respective sources that are candidates for streaming the given ranges
      * to us. For each range, the list of sources is sorted by proximity relative to the given destAddress.
@@ -146,12 +157,14 @@ class range_streamer {
      * @param rangesWithSources The ranges we want to fetch (key) and their potential sources (value)
      * @param sourceFilters A (possibly empty) collection of source filters to apply. In addition to any filters given
      *                      here, we always exclude ourselves.
+     * @param ranges_per_source The ranges assigned to each source so far, which the ranges are spread to balance
      * @return
      */
     static std::unordered_multimap<inet_address, range<token>>
     get_range_fetch_map(const std::unordered_multimap<range<token>, inet_address>& ranges_with_sources,
                         const std::unordered_set<std::unique_ptr<i_source_filter>>& source_filters,
-                        const sstring& keyspace);
+                        const sstring& keyspace,
+                        std::unordered_map<inet_address, size_t>& ranges_per_source);
 
 #if 0
     public static Multimap<InetAddress, Range<Token>> getWorkMap(Multimap<Range<Token>, InetAddress> rangesWithSourceTarget, String keyspace)
@@ -166,7 +179,26 @@ class range_streamer {
     }
 #endif
 public:
+    // Fetches the ranges added, but for those of each table an earlier,
+    // failed attempt already received.
     future<streaming::stream_state> fetch_async();
+
+    // The ranges added to fetch from each source, of all keyspaces.
+    std::unordered_map<inet_address, std::vector<range<token>>> ranges_by_source() const;
+private:
+    // Records the ranges of each table received, for a new attempt to skip.
+    class stream_state_store : public streaming::stream_event_handler {
+        future<> _written = make_ready_future<>();
+    public:
+        virtual void handle_stream_event(streaming::table_received_event event) override;
+        // Resolves once the ranges received so far are recorded.
+        future<> flush() {
+            return std::exchange(_written, make_ready_future<>());
+        }
+    };
+
+    void request_ranges(const sstring& keyspace, inet_address source, const std::vector<range<token>>& ranges,
+            const std::unordered_map<sstring, std::vector<range<token>>>& available);
 private:
     distributed<database>& _db;
     token_metadata& _metadata;
@@ -176,6 +208,10 @@ class range_streamer {
     std::unordered_multimap<sstring, std::unordered_map<inet_address, std::vector<range<token>>>> _to_fetch;
     std::unordered_set<std::unique_ptr<i_source_filter>> _source_filters;
     stream_plan _stream_plan;
+    std::map<locator::replication_params, range_addresses_map> _range_addresses;
+    std::map<locator::replication_params, range_addresses_map> _pending_range_addresses;
+    // The ranges of all keyspaces to fetch from each source.
+    std::unordered_map<inet_address, size_t> _ranges_per_source;
 };
 
 } // dht
@@ -47,30 +47,50 @@ frozen_mutation::key(const schema& s) const {
     return partition_key_view_serializer::read(in);
 }
 
+dht::token
+frozen_mutation::token(const schema& s) const {
+    if (_token) {
+        return *_token;
+    }
+    return dht::global_partitioner().get_token(s, key(s));
+}
+
+dht::decorated_key
+frozen_mutation::decorated_key(const schema& s) const {
+    if (_token) {
+        return dht::decorated_key{*_token, partition_key(key(s))};
+    }
+    return dht::global_partitioner().decorate_key(s, key(s));
+}
+
 frozen_mutation::frozen_mutation(bytes&& b)
     : _bytes(std::move(b))
 { }
 
-frozen_mutation::frozen_mutation(const mutation& m) {
-    auto&& id = m.schema()->id();
-    partition_key_view key_view = m.key();
-
-    uuid_serializer id_ser(id);
-    partition_key_view_serializer key_ser(key_view);
-    mutation_partition_serializer part_ser(*m.schema(), m.partition());
+frozen_mutation::frozen_mutation(bytes&& b, dht::token t)
+    : _bytes(std::move(b))
+    , _token(std::move(t))
+{ }
 
-    bytes buf(bytes::initialized_later(), id_ser.size() + key_ser.size() + part_ser.size_without_framing());
-    data_output out(buf);
-    id_ser.write(out);
-    key_ser.write(out);
-    part_ser.write_without_framing(out);
+frozen_mutation::frozen_mutation(const mutation& m)
+    : _token(m.token())
+{
+    bytes_ostream out;
+    uuid_serializer(m.schema()->id()).write(out);
+    partition_key_view_serializer(m.key()).write(out);
+    mutation_partition_serializer(*m.schema(), m.partition()).write_without_framing(out);
 
+    bytes buf(bytes::initialized_later(), out.size());
+    auto dst = buf.begin();
+    for (bytes_view fragment : out.fragments()) {
+        dst = std::copy(fragment.begin(), fragment.end(), dst);
+    }
     _bytes = std::move(buf);
 }
 
 mutation
 frozen_mutation::unfreeze(schema_ptr schema) const {
-    mutation m(key(*schema), schema);
+    mutation m(decorated_key(*schema), schema);
     partition_builder b(*schema, m.partition());
     partition().accept(*schema, b);
     return m;
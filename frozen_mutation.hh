@@ -21,6 +21,8 @@
 
 #pragma once
 
+#include <experimental/optional>
+
 #include "atomic_cell.hh"
 #include "keys.hh"
 #include "mutation.hh"
@@ -37,12 +39,19 @@
 // the schema. Data can be wrapped in frozen_mutation without schema
 // information, the schema is only needed to access some of the fields.
 //
+// The token of the partition, once computed, travels with the mutation,
+// across shards and to the replicas, so that the key is hashed once per
+// write rather than on every hop. It isn't part of the representation,
+// which is what the commitlog stores.
+//
 class frozen_mutation final {
 private:
     bytes _bytes;
+    std::experimental::optional<dht::token> _token;
 public:
     frozen_mutation(const mutation& m);
     explicit frozen_mutation(bytes&& b);
+    frozen_mutation(bytes&& b, dht::token t);
     frozen_mutation(frozen_mutation&& m) = default;
     frozen_mutation(const frozen_mutation& m) = default;
     frozen_mutation& operator=(frozen_mutation&&) = default;
@@ -51,6 +60,11 @@ class frozen_mutation final {
     bytes_view representation() const { return _bytes; }
     utils::UUID column_family_id() const;
     partition_key_view key(const schema& s) const;
+    // The token carried with the mutation, if any.
+    const std::experimental::optional<dht::token>& carried_token() const { return _token; }
+    // The carried token, or the token of the key if none is.
+    dht::token token(const schema& s) const;
+    dht::decorated_key decorated_key(const schema& s) const;
     mutation_partition_view partition() const;
     mutation unfreeze(schema_ptr s) const;
 };
@@ -56,10 +56,10 @@ enum class application_state
     NET_VERSION,
     HOST_ID,
     TOKENS,
+    SUPPORTED_FEATURES,
+    SHARD_COUNT,
+    SHARD_AWARE_STORAGE_PORT,
     // pad to allow adding new states to existing cluster
-    X1,
-    X2,
-    X3,
     X4,
     X5,
     X6,
@@ -51,6 +51,20 @@ std::experimental::optional<versioned_value> endpoint_state::get_application_sta
     }
 }
 
+const std::unordered_set<dht::token>& endpoint_state::get_tokens() const {
+    static thread_local const std::unordered_set<dht::token> no_tokens;
+    auto it = _application_state.find(application_state::TOKENS);
+    if (it == _application_state.end()) {
+        return no_tokens;
+    }
+    auto generation = _heart_beat_state.get_generation();
+    auto& value = it->second;
+    if (!_tokens || _tokens->generation != generation || _tokens->version != value.version) {
+        _tokens = parsed_tokens{generation, value.version, versioned_value::tokens_of(value.value)};
+    }
+    return _tokens->tokens;
+}
+
 std::ostream& operator<<(std::ostream& os, const endpoint_state& x) {
     os << "EndpointState: HeartBeatState = " << x._heart_beat_state << ", AppStateMap = ";
     for (auto&entry : x._application_state) {
@@ -61,6 +61,13 @@ class endpoint_state {
     /* fields below do not get serialized */
     clk::time_point _update_timestamp;
     bool _is_alive;
+    // The tokens of the TOKENS state, parsed once per version of it.
+    struct parsed_tokens {
+        int32_t generation;
+        int version;
+        std::unordered_set<dht::token> tokens;
+    };
+    mutable std::experimental::optional<parsed_tokens> _tokens;
 public:
     bool operator==(const endpoint_state& other) const {
         return _heart_beat_state  == other._heart_beat_state &&
@@ -104,6 +111,9 @@ class endpoint_state {
         _application_state[key] = value;
     }
 
+    // The tokens of the TOKENS state, none without one.
+    const std::unordered_set<dht::token>& get_tokens() const;
+
     /* getters and setters */
     /**
      * @return System.nanoTime() when state was updated last time.
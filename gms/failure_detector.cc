@@ -52,6 +52,9 @@ extern logging::logger logger;
 
 using clk = arrival_window::clk;
 
+constexpr double failure_detector::MIN_PHI_CONVICT_THRESHOLD;
+constexpr double failure_detector::MAX_PHI_CONVICT_THRESHOLD;
+
 static clk::duration get_initial_value() {
 #if 0
     String newvalue = System.getProperty("cassandra.fd_initial_value_ms");
@@ -90,7 +93,7 @@ void arrival_window::add(clk::time_point value) {
     if (_tlast > clk::time_point::min()) {
         auto inter_arrival_time = value - _tlast;
         if (inter_arrival_time <= get_max_interval()) {
-            _arrival_intervals.add(inter_arrival_time.count());
+            _arrival_intervals.add(std::max(inter_arrival_time, _min_interval).count());
         } else  {
             logger.debug("failure_detector: Ignoring interval time of {}", inter_arrival_time.count());
         }
@@ -107,13 +110,24 @@ double arrival_window::mean() {
     return _arrival_intervals.mean();
 }
 
+double arrival_window::std_deviation() {
+    return std::max(std::sqrt(_arrival_intervals.variance()), double(_min_interval.count()));
+}
+
 double arrival_window::phi(clk::time_point tnow) {
     assert(_arrival_intervals.size() > 0 && _tlast > clk::time_point::min()); // should not be called before any samples arrive
     auto t = (tnow - _tlast).count();
     auto m = mean();
-    double phi = t / m;
-    logger.debug("failure_detector: now={}, tlast={}, t={}, mean={}, phi={}",
-        tnow.time_since_epoch().count(), _tlast.time_since_epoch().count(), t, m, phi);
+    auto sd = std_deviation();
+    // The logistic approximation of the cumulative distribution function of
+    // the normal distribution, whose error is below 0.01%, evaluated on the
+    // side which does not cancel out, so that phi stays accurate far from
+    // the mean.
+    double y = (t - m) / sd;
+    double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+    double phi = t > m ? -std::log10(e / (1.0 + e)) : -std::log10(1.0 - 1.0 / (1.0 + e));
+    logger.debug("failure_detector: now={}, tlast={}, t={}, mean={}, sd={}, phi={}",
+        tnow.time_since_epoch().count(), _tlast.time_since_epoch().count(), t, m, sd, phi);
     return phi;
 }
 
@@ -198,15 +212,17 @@ void failure_detector::append_endpoint_state(std::stringstream& ss, endpoint_sta
 }
 
 void failure_detector::set_phi_convict_threshold(double phi) {
-    // FIXME
-    // DatabaseDescriptor.setPhiConvictThreshold(phi);
+    if (phi < MIN_PHI_CONVICT_THRESHOLD || phi > MAX_PHI_CONVICT_THRESHOLD) {
+        auto clamped = std::min(std::max(phi, MIN_PHI_CONVICT_THRESHOLD), MAX_PHI_CONVICT_THRESHOLD);
+        logger.warn("failure_detector: phi_convict_threshold must be between {} and {}, using {} instead of {}",
+            MIN_PHI_CONVICT_THRESHOLD, MAX_PHI_CONVICT_THRESHOLD, clamped, phi);
+        phi = clamped;
+    }
+    _phi_convict_threshold = phi;
 }
 
 double failure_detector::get_phi_convict_threshold() {
-    // FIXME: phi_convict_threshold must be between 5 and 16"
-    // return DatabaseDescriptor.getPhiConvictThreshold();
-    warn(unimplemented::cause::GOSSIP);
-    return 8;
+    return _phi_convict_threshold;
 }
 
 bool failure_detector::is_alive(inet_address ep) {
@@ -219,7 +235,7 @@ void failure_detector::report(inet_address ep) {
     auto it = _arrival_samples.find(ep);
     if (it == _arrival_samples.end()) {
         // avoid adding an empty ArrivalWindow to the Map
-        auto heartbeat_window = arrival_window(SAMPLE_SIZE);
+        auto heartbeat_window = arrival_window(SAMPLE_SIZE, _min_interval);
         heartbeat_window.add(now);
         _arrival_samples.emplace(ep, heartbeat_window);
     } else {
@@ -238,9 +254,9 @@ void failure_detector::interpret(inet_address ep) {
     double phi = hb_wnd.phi(now);
     logger.trace("failure_detector: PHI for {} : {}", ep, phi);
 
-    if (PHI_FACTOR * phi > get_phi_convict_threshold()) {
+    if (phi > get_phi_convict_threshold()) {
         logger.trace("failure_detector: notifying listeners that {} is down", ep);
-        logger.trace("failure_detector: intervals: {} mean: {}", hb_wnd, hb_wnd.mean());
+        logger.trace("failure_detector: intervals: {} mean: {} sd: {}", hb_wnd, hb_wnd.mean(), hb_wnd.std_deviation());
         for (auto& listener : _fd_evnt_listeners) {
             logger.debug("failure_detector: convict ep={} phi={}", ep, phi);
             listener->convict(ep, phi);
@@ -54,22 +54,27 @@ class inet_address;
 class i_failure_detection_event_listener;
 class endpoint_state;
 
+// Estimates how likely it is that the next heartbeat of an endpoint is still
+// to come, as in the phi accrual failure detector of Hayashibara et al. The
+// intervals between heartbeats are taken to be normally distributed, with the
+// mean and the variance of the last intervals, which the window keeps running
+// sums of, so that both adding a heartbeat and computing phi are O(1).
 class arrival_window {
 public:
     using clk = std::chrono::steady_clock;
 private:
     clk::time_point _tlast{clk::time_point::min()};
     utils::bounded_stats_deque _arrival_intervals;
-
-    // this is useless except to provide backwards compatibility in phi_convict_threshold,
-    // because everyone seems pretty accustomed to the default of 8, and users who have
-    // already tuned their phi_convict_threshold for their own environments won't need to
-    // change.
-    static constexpr double PHI_FACTOR{1.0 / std::log(10.0)};
+    // Intervals and the standard deviation are taken to be no shorter than
+    // this, so that a peer which heartbeats very regularly, or whose
+    // heartbeats are reported several times in a row, is not convicted by
+    // the first pause of a few hundred milliseconds.
+    clk::duration _min_interval;
 
 public:
-    arrival_window(int size)
-        : _arrival_intervals(size) {
+    arrival_window(int size, clk::duration min_interval)
+        : _arrival_intervals(size)
+        , _min_interval(min_interval) {
     }
 
     // in the event of a long partition, never record an interval longer than the rpc timeout,
@@ -82,7 +87,9 @@ class arrival_window {
 
     double mean();
 
-    // see CASSANDRA-2597 for an explanation of the math at work here.
+    double std_deviation();
+
+    // -log10 of the probability that a heartbeat comes later than tnow.
     double phi(clk::time_point tnow);
 
     friend std::ostream& operator<<(std::ostream& os, const arrival_window& w);
@@ -90,24 +97,21 @@ class arrival_window {
 };
 
 
-/**
- * This FailureDetector is an implementation of the paper titled
- * "The Phi Accrual Failure Detector" by Hayashibara.
- * Check the paper and the <i>IFailureDetector</i> interface for details.
- */
 class failure_detector : public i_failure_detector, public seastar::async_sharded_service<failure_detector> {
 private:
     static constexpr int SAMPLE_SIZE = 1000;
-    // this is useless except to provide backwards compatibility in phi_convict_threshold,
-    // because everyone seems pretty accustomed to the default of 8, and users who have
-    // already tuned their phi_convict_threshold for their own environments won't need to
-    // change.
-    static constexpr double PHI_FACTOR{1.0 / std::log(10.0)}; // 0.434...
+    static constexpr double MIN_PHI_CONVICT_THRESHOLD = 5;
+    static constexpr double MAX_PHI_CONVICT_THRESHOLD = 16;
+    double _phi_convict_threshold;
+    arrival_window::clk::duration _min_interval;
     std::map<inet_address, arrival_window> _arrival_samples;
     std::list<i_failure_detection_event_listener*> _fd_evnt_listeners;
 
 public:
-    failure_detector() {
+    failure_detector(double phi_convict_threshold = 8,
+            std::chrono::milliseconds min_interval = std::chrono::milliseconds(1000))
+        : _min_interval(min_interval) {
+        set_phi_convict_threshold(phi_convict_threshold);
     }
 
     future<> stop() {
@@ -125,41 +125,36 @@ void gossiper::set_last_processed_message_at(clk::time_point tp) {
 }
 
 /*
- * First construct a map whose key is the endpoint in the GossipDigest and the value is the
- * GossipDigest itself. Then build a list of version differences i.e difference between the
- * version in the GossipDigest and the version in the local state for a given InetAddress.
- * Sort this list. Now loop through the sorted list and retrieve the GossipDigest corresponding
- * to the endpoint from the map that was initially constructed.
+ * Build a list of version differences i.e difference between the version in the
+ * GossipDigest and the version in the local state for a given InetAddress, each
+ * along with the GossipDigest it was computed from. Sort this list and take the
+ * GossipDigests back out of it in that order.
 */
 void gossiper::do_sort(std::vector<gossip_digest>& g_digest_list) {
-    /* Construct a map of endpoint to GossipDigest. */
-    std::map<inet_address, gossip_digest> ep_to_digest_map;
-    for (auto g_digest : g_digest_list) {
-        ep_to_digest_map.emplace(g_digest.get_endpoint(), g_digest);
-    }
-
     /*
-     * These digests have their maxVersion set to the difference of the version
+     * The first digests have their maxVersion set to the difference of the version
      * of the local EndpointState and the version found in the GossipDigest.
     */
-    std::vector<gossip_digest> diff_digests;
-    for (auto g_digest : g_digest_list) {
+    std::vector<std::pair<gossip_digest, gossip_digest>> diff_digests;
+    diff_digests.reserve(g_digest_list.size());
+    for (auto& g_digest : g_digest_list) {
         auto ep = g_digest.get_endpoint();
         auto ep_state = this->get_endpoint_state_for_endpoint(ep);
         int version = ep_state ? this->get_max_endpoint_state_version(*ep_state) : 0;
         int diff_version = ::abs(version - g_digest.get_max_version());
-        diff_digests.emplace_back(gossip_digest(ep, g_digest.get_generation(), diff_version));
+        diff_digests.emplace_back(gossip_digest(ep, g_digest.get_generation(), diff_version), std::move(g_digest));
     }
 
-    g_digest_list.clear();
-    std::sort(diff_digests.begin(), diff_digests.end());
-    int size = diff_digests.size();
     /*
      * Report the digests in descending order. This takes care of the endpoints
      * that are far behind w.r.t this local endpoint
     */
-    for (int i = size - 1; i >= 0; --i) {
-        g_digest_list.emplace_back(ep_to_digest_map[diff_digests[i].get_endpoint()]);
+    std::sort(diff_digests.begin(), diff_digests.end(), [] (const auto& x, const auto& y) {
+        return y.first < x.first;
+    });
+    g_digest_list.clear();
+    for (auto& d : diff_digests) {
+        g_digest_list.emplace_back(std::move(d.second));
     }
 }
 
@@ -318,7 +313,7 @@ future<bool> gossiper::send_gossip(gossip_digest_syn message, std::set<inet_addr
 }
 
 
-void gossiper::notify_failure_detector(inet_address endpoint, endpoint_state remote_endpoint_state) {
+void gossiper::notify_failure_detector(inet_address endpoint, endpoint_state& remote_endpoint_state) {
     /*
      * If the local endpoint state exists then report to the FD only
      * if the versions workout.
@@ -669,7 +664,7 @@ std::set<inet_address> gossiper::get_unreachable_members() {
     return ret;
 }
 
-int gossiper::get_max_endpoint_state_version(endpoint_state state) {
+int gossiper::get_max_endpoint_state_version(endpoint_state& state) {
     int max_version = state.get_heart_beat_state().get_heart_beat_version();
     for (auto& entry : state.get_application_state_map()) {
         auto& value = entry.second;
@@ -708,24 +703,14 @@ void gossiper::replaced_endpoint(inet_address endpoint) {
 }
 
 void gossiper::make_random_gossip_digest(std::vector<gossip_digest>& g_digests) {
-    int generation = 0;
-    int max_version = 0;
-
     // local epstate will be part of endpoint_state_map
-    std::vector<inet_address> endpoints;
+    g_digests.reserve(g_digests.size() + endpoint_state_map.size());
     for (auto&& x : endpoint_state_map) {
-        endpoints.push_back(x.first);
-    }
-    std::random_shuffle(endpoints.begin(), endpoints.end());
-    for (auto& endpoint : endpoints) {
-        auto it = endpoint_state_map.find(endpoint);
-        if (it != endpoint_state_map.end()) {
-            auto& eps = it->second;
-            generation = eps.get_heart_beat_state().get_generation();
-            max_version = get_max_endpoint_state_version(eps);
-        }
-        g_digests.push_back(gossip_digest(endpoint, generation, max_version));
+        auto& eps = x.second;
+        g_digests.push_back(gossip_digest(x.first, eps.get_heart_beat_state().get_generation(),
+                get_max_endpoint_state_version(eps)));
     }
+    std::random_shuffle(g_digests.begin(), g_digests.end());
 #if 0
     if (logger.isTraceEnabled()) {
         StringBuilder sb = new StringBuilder();
@@ -938,6 +923,25 @@ std::unordered_map<inet_address, endpoint_state>& gms::gossiper::get_endpoint_st
     return endpoint_state_map;
 }
 
+bool gossiper::cluster_supports_feature(const sstring& feature) {
+    if (endpoint_state_map.empty()) {
+        // gossip hasn't started, we know nothing of the cluster yet
+        return false;
+    }
+    for (auto&& entry : endpoint_state_map) {
+        auto features = entry.second.get_application_state(application_state::SUPPORTED_FEATURES);
+        if (!features) {
+            return false;
+        }
+        std::vector<sstring> names;
+        boost::split(names, features->value, boost::is_any_of(versioned_value::DELIMITER_STR));
+        if (std::find(names.begin(), names.end(), feature) == names.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool gossiper::uses_host_id(inet_address endpoint) {
     if (net::get_local_messaging_service().knows_version(endpoint)) {
         return true;
@@ -959,6 +963,24 @@ utils::UUID gossiper::get_host_id(inet_address endpoint) {
     return utils::UUID(uuid);
 }
 
+static unsigned get_unsigned_application_state(std::unordered_map<inet_address, endpoint_state>& map, inet_address endpoint, application_state state) {
+    auto it = map.find(endpoint);
+    if (it == map.end()) {
+        return 0;
+    }
+    auto& states = it->second.get_application_state_map();
+    auto v = states.find(state);
+    return v == states.end() ? 0 : std::stoul(v->second.value);
+}
+
+unsigned gossiper::get_shard_count(inet_address endpoint) {
+    return get_unsigned_application_state(endpoint_state_map, endpoint, application_state::SHARD_COUNT);
+}
+
+uint16_t gossiper::get_shard_aware_storage_port(inet_address endpoint) {
+    return get_unsigned_application_state(endpoint_state_map, endpoint, application_state::SHARD_AWARE_STORAGE_PORT);
+}
+
 std::experimental::optional<endpoint_state> gossiper::get_state_for_version_bigger_than(inet_address for_endpoint, int version) {
     std::experimental::optional<endpoint_state> reqd_endpoint_state;
     auto it = endpoint_state_map.find(for_endpoint);
@@ -1001,7 +1023,7 @@ int gossiper::compare_endpoint_startup(inet_address addr1, inet_address addr2) {
     return ep1->get_heart_beat_state().get_generation() - ep2->get_heart_beat_state().get_generation();
 }
 
-void gossiper::notify_failure_detector(std::map<inet_address, endpoint_state> remoteEpStateMap) {
+void gossiper::notify_failure_detector(std::map<inet_address, endpoint_state>& remoteEpStateMap) {
     for (auto& entry : remoteEpStateMap) {
         notify_failure_detector(entry.first, entry.second);
     }
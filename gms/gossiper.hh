@@ -214,7 +214,7 @@ class gossiper : public i_failure_detection_event_listener, public seastar::asyn
      * @param ep_state
      * @return
      */
-    int get_max_endpoint_state_version(endpoint_state state);
+    int get_max_endpoint_state_version(endpoint_state& state);
 
 
 private:
@@ -341,10 +341,21 @@ class gossiper : public i_failure_detection_event_listener, public seastar::asyn
 
     bool uses_host_id(inet_address endpoint);
 
+    // Whether every node known to gossip advertises the feature in its
+    // SUPPORTED_FEATURES application state.
+    bool cluster_supports_feature(const sstring& feature);
+
     bool uses_vnodes(inet_address endpoint);
 
     utils::UUID get_host_id(inet_address endpoint);
 
+    // The number of shards of the node, or 0 if it does not advertise it.
+    unsigned get_shard_count(inet_address endpoint);
+
+    // The port from which the shards of the node listen each for the
+    // messages addressed to it, or 0 if it does not.
+    uint16_t get_shard_aware_storage_port(inet_address endpoint);
+
     std::experimental::optional<endpoint_state> get_state_for_version_bigger_than(inet_address for_endpoint, int version);
 
     /**
@@ -352,10 +363,10 @@ class gossiper : public i_failure_detection_event_listener, public seastar::asyn
      */
     int compare_endpoint_startup(inet_address addr1, inet_address addr2);
 
-    void notify_failure_detector(std::map<inet_address, endpoint_state> remoteEpStateMap);
+    void notify_failure_detector(std::map<inet_address, endpoint_state>& remoteEpStateMap);
 
 
-    void notify_failure_detector(inet_address endpoint, endpoint_state remote_endpoint_state);
+    void notify_failure_detector(inet_address endpoint, endpoint_state& remote_endpoint_state);
 
 private:
     void mark_alive(inet_address addr, endpoint_state& local_state);
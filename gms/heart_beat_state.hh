@@ -66,7 +66,7 @@ class heart_beat_state {
         , _version(ver) {
     }
 
-    int32_t get_generation() {
+    int32_t get_generation() const {
         return _generation;
     }
 
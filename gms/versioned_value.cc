@@ -36,6 +36,8 @@
  * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "gms/versioned_value.hh"
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
 
 namespace gms {
 
@@ -50,5 +52,37 @@ constexpr const char* versioned_value::REMOVING_TOKEN;
 constexpr const char* versioned_value::REMOVED_TOKEN;
 constexpr const char* versioned_value::HIBERNATE;
 constexpr const char* versioned_value::REMOVAL_COORDINATOR;
+constexpr const char* versioned_value::BINARY_TOKENS;
+constexpr char versioned_value::BINARY_TOKENS_MARKER;
+constexpr size_t versioned_value::binary_token_size;
+
+static bool is_binary_tokens(const sstring& value) {
+    return !value.empty() && value[0] == versioned_value::BINARY_TOKENS_MARKER;
+}
+
+std::ostream& operator<<(std::ostream& os, const versioned_value& x) {
+    if (is_binary_tokens(x.value)) {
+        auto packed = bytes_view(reinterpret_cast<const int8_t*>(x.value.data()) + 1, x.value.size() - 1);
+        return os << "Value(binary:" << to_hex(packed) << "," << x.version <<  ")";
+    }
+    return os << "Value(" << x.value << "," << x.version <<  ")";
+}
+
+std::unordered_set<dht::token> versioned_value::tokens_of(const sstring& value) {
+    std::unordered_set<dht::token> ret;
+    if (is_binary_tokens(value)) {
+        auto p = reinterpret_cast<const int8_t*>(value.data());
+        for (size_t i = 1; i + binary_token_size <= value.size(); i += binary_token_size) {
+            ret.emplace(dht::token::kind::key, bytes(p + i, binary_token_size));
+        }
+        return ret;
+    }
+    std::vector<sstring> tokens;
+    boost::split(tokens, value, boost::is_any_of(";"));
+    for (auto&& str : tokens) {
+        ret.emplace(dht::token::kind::key, from_hex(sstring_view(str)));
+    }
+    return ret;
+}
 
 }
@@ -47,6 +47,7 @@
 #include "dht/i_partitioner.hh"
 #include "to_string.hh"
 #include <unordered_set>
+#include <set>
 #include <vector>
 #include "message/messaging_service.hh"
 #include "version.hh"
@@ -88,6 +89,23 @@ class versioned_value //implements Comparable<VersionedValue>
     // values for ApplicationState.REMOVAL_COORDINATOR
     static constexpr const char* REMOVAL_COORDINATOR = "REMOVER";
 
+    // values for ApplicationState.SUPPORTED_FEATURES
+    static constexpr const char* MURMUR3_DIGEST = "MURMUR3_DIGEST";
+    static constexpr const char* COLUMNAR_RESULTS = "COLUMNAR_RESULTS";
+    static constexpr const char* BINARY_TOKENS = "BINARY_TOKENS";
+    static constexpr const char* MUTATION_TOKENS = "MUTATION_TOKENS";
+    static constexpr const char* BATCHED_MUTATIONS = "BATCHED_MUTATIONS";
+    static constexpr const char* AGGREGATE = "AGGREGATE";
+    static constexpr const char* STREAM_MUTATIONS = "STREAM_MUTATIONS";
+    static constexpr const char* STREAM_SSTABLE_FILES = "STREAM_SSTABLE_FILES";
+    static constexpr const char* REPAIR_MERKLE_TREE = "REPAIR_MERKLE_TREE";
+
+    // Starts a TOKENS value of tokens packed in binary_token_size bytes
+    // each, rather than of tokens in hex separated by ';', none of whose
+    // characters is a '\0'.
+    static constexpr char BINARY_TOKENS_MARKER = '\0';
+    static constexpr size_t binary_token_size = 8;
+
     int version;
     sstring value;
 public:
@@ -125,9 +143,10 @@ class versioned_value //implements Comparable<VersionedValue>
         return version - value.version;
     }
 
-    friend inline std::ostream& operator<<(std::ostream& os, const versioned_value& x) {
-        return os << "Value(" << x.value << "," << x.version <<  ")";
-    }
+    friend std::ostream& operator<<(std::ostream& os, const versioned_value& x);
+
+    // The tokens of a TOKENS value, of either encoding.
+    static std::unordered_set<dht::token> tokens_of(const sstring& value);
 
     static sstring version_string(const std::initializer_list<sstring>& args) {
         return ::join(sstring(versioned_value::DELIMITER_STR), args);
@@ -198,7 +217,23 @@ class versioned_value //implements Comparable<VersionedValue>
             return versioned_value(hostId.to_sstring());
         }
 
-        versioned_value tokens(const std::unordered_set<token> tokens) {
+        // With binary, which all the nodes must support, tokens of
+        // binary_token_size bytes, as those of Murmur3Partitioner are, are
+        // packed in binary. That takes less than half the size of their hex,
+        // and no parsing.
+        versioned_value tokens(const std::unordered_set<token> tokens, bool binary = false) {
+            binary = binary && std::all_of(tokens.begin(), tokens.end(), [] (const token& t) {
+                return t._data.size() == binary_token_size;
+            });
+            if (binary) {
+                sstring packed(sstring::initialized_later(), 1 + tokens.size() * binary_token_size);
+                auto out = packed.begin();
+                *out++ = BINARY_TOKENS_MARKER;
+                for (auto&& t : tokens) {
+                    out = std::copy(t._data.begin(), t._data.end(), out);
+                }
+                return versioned_value(std::move(packed));
+            }
             sstring tokens_string;
             for (auto it = tokens.cbegin(); it != tokens.cend(); ) {
                 tokens_string += to_hex(it->_data);
@@ -263,6 +298,21 @@ class versioned_value //implements Comparable<VersionedValue>
             return versioned_value(version::release());
         }
 
+        versioned_value supported_features(const std::set<sstring>& features)
+        {
+            return versioned_value(::join(sstring(versioned_value::DELIMITER_STR), features));
+        }
+
+        versioned_value shard_count(unsigned count)
+        {
+            return versioned_value(sprint("%d", count));
+        }
+
+        versioned_value shard_aware_storage_port(uint16_t port)
+        {
+            return versioned_value(sprint("%d", port));
+        }
+
         versioned_value network_version()
         {
             return versioned_value(sprint("%s",net::messaging_service::current_version));
@@ -37,15 +37,17 @@ future<> init_storage_service(distributed<database>& db) {
     });
 }
 
-future<> init_ms_fd_gossiper(sstring listen_address, db::seed_provider_type seed_provider, sstring cluster_name) {
+future<> init_ms_fd_gossiper(sstring listen_address, db::seed_provider_type seed_provider, sstring cluster_name,
+        double phi, std::chrono::milliseconds phi_min_interval, net::messaging_service::connections_config connections,
+        net::messaging_service::compression_config compression) {
     const gms::inet_address listen(listen_address);
     // Init messaging_service
-    return net::get_messaging_service().start(listen).then([]{
+    return net::get_messaging_service().start(listen, connections, compression).then([]{
         // #293 - do not stop anything
         //engine().at_exit([] { return net::get_messaging_service().stop(); });
-    }).then([] {
+    }).then([phi, phi_min_interval] {
         // Init failure_detector
-        return gms::get_failure_detector().start().then([] {
+        return gms::get_failure_detector().start(phi, phi_min_interval).then([] {
             // #293 - do not stop anything
             //engine().at_exit([]{ return gms::get_failure_detector().stop(); });
         });
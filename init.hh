@@ -25,6 +25,10 @@
 #include <seastar/core/distributed.hh>
 #include "db/config.hh"
 #include "database.hh"
+#include "message/messaging_service.hh"
 
 future<> init_storage_service(distributed<database>& db);
-future<> init_ms_fd_gossiper(sstring listen_address, db::seed_provider_type seed_provider, sstring cluster_name = "Test Cluster");
+future<> init_ms_fd_gossiper(sstring listen_address, db::seed_provider_type seed_provider, sstring cluster_name = "Test Cluster",
+        double phi = 8, std::chrono::milliseconds phi_min_interval = std::chrono::milliseconds(1000),
+        net::messaging_service::connections_config connections = {},
+        net::messaging_service::compression_config compression = {});
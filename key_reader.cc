@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "key_reader.hh"
+#include "core/future-util.hh"
+
+// Keeps the next key of each reader, and hands out the smallest. There are
+// as many readers as sstables and memtables, few enough for a linear scan
+// to beat a heap.
+class combined_key_reader final : public key_reader::impl {
+    struct input {
+        key_reader reader;
+        partition_key_entry_opt next;
+        bool exhausted = false;
+    };
+    schema_ptr _schema;
+    std::vector<input> _inputs;
+private:
+    future<> fill() {
+        return parallel_for_each(_inputs, [] (input& in) {
+            if (in.next || in.exhausted) {
+                return make_ready_future<>();
+            }
+            return in.reader().then([&in] (partition_key_entry_opt e) {
+                in.exhausted = !e;
+                in.next = std::move(e);
+            });
+        });
+    }
+public:
+    combined_key_reader(schema_ptr s, std::vector<key_reader> readers)
+            : _schema(std::move(s)) {
+        _inputs.reserve(readers.size());
+        for (auto&& r : readers) {
+            _inputs.push_back(input{std::move(r), {}});
+        }
+    }
+    virtual future<partition_key_entry_opt> operator()() override {
+        return fill().then([this] {
+            input* first = nullptr;
+            for (auto&& in : _inputs) {
+                if (in.next && (!first || in.next->key.less_compare(*_schema, first->next->key))) {
+                    first = &in;
+                }
+            }
+            if (!first) {
+                return partition_key_entry_opt();
+            }
+            auto result = std::move(first->next);
+            first->next = {};
+            for (auto&& in : _inputs) {
+                if (in.next && in.next->key.equal(*_schema, result->key)) {
+                    result->maybe_dead |= in.next->maybe_dead;
+                    in.next = {};
+                }
+            }
+            return result;
+        });
+    }
+};
+
+key_reader make_combined_key_reader(schema_ptr s, std::vector<key_reader> readers) {
+    return make_key_reader<combined_key_reader>(std::move(s), std::move(readers));
+}
+
+class mutation_key_reader final : public key_reader::impl {
+    mutation_reader _reader;
+public:
+    mutation_key_reader(mutation_reader reader) : _reader(std::move(reader)) {}
+    virtual future<partition_key_entry_opt> operator()() override {
+        return _reader().then([] (mutation_opt m) {
+            if (!m) {
+                return partition_key_entry_opt();
+            }
+            return partition_key_entry_opt(partition_key_entry{m->decorated_key(), true});
+        });
+    }
+};
+
+key_reader make_key_reader_from_mutations(mutation_reader reader) {
+    return make_key_reader<mutation_key_reader>(std::move(reader));
+}
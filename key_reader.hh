@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <experimental/optional>
+
+#include "dht/i_partitioner.hh"
+#include "mutation_reader.hh"
+#include "core/future.hh"
+
+// The key of a partition handed out by a key_reader. The partition is
+// known to be live, unless maybe_dead is set: it may then hold nothing but
+// tombstones and expired cells, or have its data shadowed by those of
+// another source, which only reading it tells.
+struct partition_key_entry {
+    dht::decorated_key key;
+    bool maybe_dead;
+};
+
+using partition_key_entry_opt = std::experimental::optional<partition_key_entry>;
+
+// A key_reader hands out the keys of the partitions of a source, in ring
+// order, without their data, with an unset optional marking the end of
+// iteration. Like with mutation_reader, the caller must keep the reader
+// alive until the returned future is fulfilled.
+class key_reader final {
+public:
+    class impl {
+    public:
+        virtual ~impl() {}
+        virtual future<partition_key_entry_opt> operator()() = 0;
+    };
+private:
+    std::unique_ptr<impl> _impl;
+public:
+    key_reader(std::unique_ptr<impl> impl) noexcept : _impl(std::move(impl)) {}
+    key_reader(key_reader&&) = default;
+    key_reader(const key_reader&) = delete;
+    key_reader& operator=(key_reader&&) = default;
+    key_reader& operator=(const key_reader&) = delete;
+    future<partition_key_entry_opt> operator()() { return _impl->operator()(); }
+};
+
+template <typename Impl, typename... Args>
+inline
+key_reader
+make_key_reader(Args&&... args) {
+    return key_reader(std::make_unique<Impl>(std::forward<Args>(args)...));
+}
+
+// Merges the keys of the readers. A key handed out by several of them is
+// handed out once, maybe dead if it is so in any of them.
+key_reader make_combined_key_reader(schema_ptr s, std::vector<key_reader> readers);
+
+// The keys of the partitions of a mutation_reader, all maybe dead, as
+// readers of sources held in memory don't tell them apart for less than
+// reading them.
+key_reader make_key_reader_from_mutations(mutation_reader reader);
@@ -512,9 +512,15 @@ class clustering_key_view : public compound_view_wrapper<clustering_key_view> {
         : compound_view_wrapper<clustering_key_view>(v)
     { }
 public:
+    using compound = lw_shared_ptr<compound_type<allow_prefixes::no>>;
+
     static clustering_key_view from_bytes(bytes_view v) {
         return { v };
     }
+
+    static const compound& get_compound_type(const schema& s) {
+        return s.clustering_key_type();
+    }
 };
 
 class clustering_key : public prefixable_full_compound<clustering_key, clustering_key_view, clustering_key_prefix> {
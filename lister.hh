@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/file.hh"
+#include "core/reactor.hh"
+#include "core/sstring.hh"
+
+// Walks the entries of the given type in a directory, skipping hidden ones.
+class lister {
+    file _f;
+    std::function<future<> (directory_entry de)> _walker;
+    directory_entry_type _expected_type;
+    subscription<directory_entry> _listing;
+    sstring _dirname;
+
+public:
+    lister(file f, directory_entry_type type, std::function<future<> (directory_entry)> walker, sstring dirname)
+            : _f(std::move(f))
+            , _walker(std::move(walker))
+            , _expected_type(type)
+            , _listing(_f.list_directory([this] (directory_entry de) { return _visit(de); }))
+            , _dirname(dirname) {
+    }
+
+    static future<> scan_dir(sstring name, directory_entry_type type, std::function<future<> (directory_entry)> walker);
+protected:
+    future<> _visit(directory_entry de) {
+
+        return guarantee_type(std::move(de)).then([this] (directory_entry de) {
+            // Hide all synthetic directories and hidden files.
+            if ((de.type != _expected_type) || (de.name[0] == '.')) {
+                return make_ready_future<>();
+            }
+            return _walker(de);
+        });
+
+    }
+    future<> done() { return _listing.done(); }
+private:
+    future<directory_entry> guarantee_type(directory_entry de) {
+        if (de.type) {
+            return make_ready_future<directory_entry>(std::move(de));
+        } else {
+            auto f = engine().file_type(_dirname + "/" + de.name);
+            return f.then([de = std::move(de)] (std::experimental::optional<directory_entry_type> t) mutable {
+                de.type = t;
+                return make_ready_future<directory_entry>(std::move(de));
+            });
+        }
+    }
+};
@@ -70,19 +70,16 @@ void abstract_replication_strategy::validate_replication_strategy(const sstring&
 }
 
 std::vector<inet_address> abstract_replication_strategy::get_natural_endpoints(const token& search_token) {
-    const token& key_token = _token_metadata.first_token(search_token);
     auto& cached_endpoints = get_cached_endpoints();
-    auto res = cached_endpoints.find(key_token);
+    auto& res = cached_endpoints[_token_metadata.first_token_index(search_token)];
 
-    if (res == cached_endpoints.end()) {
-        auto endpoints = calculate_natural_endpoints(search_token, _token_metadata);
-        cached_endpoints.emplace(key_token, endpoints);
-
-        return std::move(endpoints);
+    if (!res) {
+        res = calculate_natural_endpoints(search_token, _token_metadata);
+        return *res;
     }
 
     ++_cache_hits_count;
-    return res->second;
+    return *res;
 }
 
 void abstract_replication_strategy::validate_replication_factor(sstring rf) const
@@ -98,10 +95,12 @@ void abstract_replication_strategy::validate_replication_factor(sstring rf) cons
     }
 }
 
-inline std::unordered_map<token, std::vector<inet_address>>&
+inline std::vector<std::experimental::optional<std::vector<inet_address>>>&
 abstract_replication_strategy::get_cached_endpoints() {
-    if (_last_invalidated_ring_version != _token_metadata.get_ring_version()) {
+    if (_last_invalidated_ring_version != _token_metadata.get_ring_version()
+            || _cached_endpoints.size() != _token_metadata.sorted_tokens().size()) {
         _cached_endpoints.clear();
+        _cached_endpoints.resize(_token_metadata.sorted_tokens().size());
         _last_invalidated_ring_version = _token_metadata.get_ring_version();
     }
 
@@ -178,9 +177,12 @@ abstract_replication_strategy::get_pending_address_ranges(token_metadata& tm, st
     std::vector<range<token>> ret;
     auto temp = tm.clone_only_token_map();
     temp.update_normal_tokens(pending_tokens, pending_address);
-    for (auto& x : get_address_ranges(temp)) {
-        if (x.first == pending_address) {
-            ret.push_back(x.second);
+    // Only the ranges of pending_address are wanted, so don't gather the
+    // replicas of the whole ring.
+    for (auto& t : temp.sorted_tokens()) {
+        auto eps = calculate_natural_endpoints(t, temp);
+        if (std::find(eps.begin(), eps.end(), pending_address) != eps.end()) {
+            ret.push_back(temp.get_primary_range_for(t));
         }
     }
     return ret;
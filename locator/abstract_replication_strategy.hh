@@ -43,15 +43,24 @@ enum class replication_strategy_type {
     network_topology,
 };
 
+// What the replicas of a token depend on besides the ring, so that keyspaces
+// with equal parameters have the same replicas.
+using replication_params = std::pair<replication_strategy_type, std::map<sstring, sstring>>;
+
 class abstract_replication_strategy {
 private:
     long _last_invalidated_ring_version = 0;
-    std::unordered_map<token, std::vector<inet_address>> _cached_endpoints;
+    // The replicas of each vnode, at the index of its token in
+    // token_metadata::sorted_tokens(), so that a lookup is a binary search
+    // rather than the hashing of a token. An entry is calculated the first
+    // time a token of the vnode is looked up, and all are dropped when the
+    // ring changes.
+    std::vector<std::experimental::optional<std::vector<inet_address>>> _cached_endpoints;
     uint64_t _cache_hits_count = 0;
 
     static logging::logger logger;
 
-    std::unordered_map<token, std::vector<inet_address>>&
+    std::vector<std::experimental::optional<std::vector<inet_address>>>&
     get_cached_endpoints();
 protected:
     sstring _ks_name;
@@ -100,6 +109,7 @@ class abstract_replication_strategy {
     virtual size_t get_replication_factor() const = 0;
     uint64_t get_cache_hits_count() const { return _cache_hits_count; }
     replication_strategy_type get_type() const { return _my_type; }
+    replication_params get_replication_params() const { return { _my_type, _config_options }; }
 
     // get_ranges() returns the list of ranges held by the given endpoint.
     // It the analogue of Origin's getAddressRanges().get(endpoint).
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+#include "locator/dynamic_snitch.hh"
+#include "gms/gossiper.hh"
+
+namespace locator {
+
+void dynamic_snitch::on_read_response(gms::inet_address endpoint, clock::duration latency) {
+    if (!_cfg.enabled) {
+        return;
+    }
+    double us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    auto i = _latencies.find(endpoint);
+    if (i == _latencies.end()) {
+        _latencies.emplace(endpoint, us);
+    } else {
+        i->second += alpha * (us - i->second);
+    }
+}
+
+void dynamic_snitch::maybe_reset(clock::time_point now) {
+    if (now - _last_reset >= _cfg.reset_interval) {
+        _latencies.clear();
+        _last_reset = now;
+    }
+}
+
+void dynamic_snitch::update_severities(clock::time_point now) {
+    if (now - _last_update < _cfg.update_interval) {
+        return;
+    }
+    _last_update = now;
+    _severities.clear();
+    // The gossiper replicates endpoint states to all shards.
+    for (auto&& e : gms::get_local_gossiper().endpoint_state_map) {
+        auto v = e.second.get_application_state(gms::application_state::SEVERITY);
+        if (!v) {
+            continue;
+        }
+        try {
+            _severities.emplace(e.first, boost::lexical_cast<double>(v->value));
+        } catch (boost::bad_lexical_cast&) {
+            // Not something we can go by.
+        }
+    }
+}
+
+double dynamic_snitch::score(gms::inet_address endpoint, double max_latency) const {
+    double s = 0;
+    auto i = _latencies.find(endpoint);
+    if (i != _latencies.end() && max_latency > 0) {
+        s = i->second / max_latency;
+    }
+    auto j = _severities.find(endpoint);
+    if (j != _severities.end()) {
+        s += j->second;
+    }
+    return s;
+}
+
+void dynamic_snitch::sort_by_proximity(std::vector<gms::inet_address>& addresses) {
+    if (!_cfg.enabled || addresses.size() < 2) {
+        return;
+    }
+    auto now = clock::now();
+    maybe_reset(now);
+    update_severities(now);
+    if (_latencies.empty() && _severities.empty()) {
+        return;
+    }
+
+    double max_latency = 0;
+    for (auto&& a : addresses) {
+        auto i = _latencies.find(a);
+        if (i != _latencies.end()) {
+            max_latency = std::max(max_latency, i->second);
+        }
+    }
+
+    std::vector<std::pair<double, gms::inet_address>> scored;
+    scored.reserve(addresses.size());
+    for (auto&& a : addresses) {
+        scored.emplace_back(score(a, max_latency), a);
+    }
+    auto by_score = scored;
+    std::stable_sort(by_score.begin(), by_score.end(), [] (auto&& x, auto&& y) {
+        return x.first < y.first;
+    });
+
+    bool too_bad = false;
+    for (size_t i = 0; i < scored.size(); ++i) {
+        if (scored[i].first > by_score[i].first * (1 + _cfg.badness_threshold)) {
+            too_bad = true;
+            break;
+        }
+    }
+    if (too_bad) {
+        std::transform(by_score.begin(), by_score.end(), addresses.begin(), [] (auto&& s) {
+            return s.second;
+        });
+    }
+}
+
+void dynamic_snitch::reset() {
+    _latencies.clear();
+    _last_reset = clock::now();
+}
+
+}
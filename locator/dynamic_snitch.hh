@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+#include "gms/inet_address.hh"
+
+namespace locator {
+
+//
+// Latency-aware ordering of replicas, laid over the order the configured
+// snitch gives them in, like Origin's DynamicEndpointSnitch.
+//
+// Keeps an exponentially weighted moving average of how long each endpoint
+// took to answer reads coordinated by this shard. An endpoint's score is
+// its latency relative to the slowest one among the replicas being sorted,
+// plus the severity it gossips, so lower is better. Replicas are reordered
+// by score only when the snitch's order puts one in a place where another
+// scores better by more than the badness threshold. That way reads stick
+// to the same replicas, whose caches stay warm, for as long as they
+// perform well enough.
+//
+// Latencies are forgotten every reset interval, so that endpoints which
+// were slow get a chance to show they recovered.
+//
+class dynamic_snitch {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct config {
+        bool enabled = true;
+        double badness_threshold = 0.1;
+        clock::duration reset_interval = std::chrono::minutes(10);
+        // How often gossiped severities are looked at again.
+        clock::duration update_interval = std::chrono::milliseconds(100);
+    };
+private:
+    // Weight of a new sample in the moving average.
+    static constexpr double alpha = 0.2;
+
+    config _cfg;
+    // Moving average of reply latencies, in microseconds.
+    std::unordered_map<gms::inet_address, double> _latencies;
+    std::unordered_map<gms::inet_address, double> _severities;
+    clock::time_point _last_reset = clock::now();
+    clock::time_point _last_update;
+private:
+    void maybe_reset(clock::time_point now);
+    void update_severities(clock::time_point now);
+    double score(gms::inet_address endpoint, double max_latency) const;
+public:
+    dynamic_snitch() = default;
+    explicit dynamic_snitch(config cfg) : _cfg(std::move(cfg)) { }
+
+    // Records how long endpoint took to answer a read.
+    void on_read_response(gms::inet_address endpoint, clock::duration latency);
+
+    // Reorders addresses, which the snitch has sorted by proximity, by the
+    // scores of the endpoints when the snitch's choice is too bad.
+    void sort_by_proximity(std::vector<gms::inet_address>& addresses);
+
+    void reset();
+};
+
+}
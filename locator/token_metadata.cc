@@ -23,6 +23,8 @@
 #include "token_metadata.hh"
 #include <experimental/optional>
 #include "locator/snitch_base.hh"
+#include <boost/range/algorithm/count_if.hpp>
+#include <boost/algorithm/cxx11/all_of.hpp>
 
 namespace locator {
 
@@ -37,29 +39,35 @@ static void remove_by_value(C& container, V value) {
     }
 }
 
-token_metadata::token_metadata(std::map<token, inet_address> token_to_endpoint_map, std::unordered_map<inet_address, utils::UUID> endpoints_map, topology topology) :
-    _token_to_endpoint_map(token_to_endpoint_map), _endpoint_to_host_id_map(endpoints_map), _topology(topology) {
-    _sorted_tokens = sort_tokens();
+token_metadata::token_metadata(std::shared_ptr<ring> ring, std::unordered_map<inet_address, utils::UUID> endpoints_map, topology topology) :
+    _ring(std::move(ring)), _endpoint_to_host_id_map(endpoints_map), _topology(topology) {
 }
 
-std::vector<token> token_metadata::sort_tokens() {
-    std::vector<token> sorted;
-    sorted.reserve(_token_to_endpoint_map.size());
-
-    for (auto&& i : _token_to_endpoint_map) {
-        sorted.push_back(i.first);
+token_metadata::ring& token_metadata::mutable_ring() {
+    // No other copy can take a reference when this is the only one.
+    if (_ring.use_count() != 1) {
+        _ring = std::make_shared<ring>(*_ring);
     }
+    return *_ring;
+}
 
-    return sorted;
+void token_metadata::sort_tokens() {
+    auto& r = mutable_ring();
+    r.sorted_tokens.clear();
+    r.sorted_tokens.reserve(r.token_to_endpoint_map.size());
+
+    for (auto&& i : r.token_to_endpoint_map) {
+        r.sorted_tokens.push_back(i.first);
+    }
 }
 
 const std::vector<token>& token_metadata::sorted_tokens() const {
-    return _sorted_tokens;
+    return _ring->sorted_tokens;
 }
 
 std::vector<token> token_metadata::get_tokens(const inet_address& addr) const {
     std::vector<token> res;
-    for (auto&& i : _token_to_endpoint_map) {
+    for (auto&& i : token_to_endpoint_map()) {
         if (i.second == addr) {
             res.push_back(i.first);
         }
@@ -99,21 +107,34 @@ void token_metadata::update_normal_tokens(std::unordered_map<inet_address, std::
 
         assert(!tokens.empty());
 
-        for(auto it = _token_to_endpoint_map.begin(), ite = _token_to_endpoint_map.end(); it != ite;) {
+        _topology.add_endpoint(endpoint);
+        remove_by_value(_bootstrap_tokens, endpoint);
+        _leaving_endpoints.erase(endpoint);
+        remove_from_moving(endpoint); // also removing this endpoint from moving
+
+        // Gossip repeats the tokens of endpoints; the ring, shared with the
+        // other shards, is only copied when they change.
+        auto owned = boost::count_if(token_to_endpoint_map(), [endpoint] (auto&& x) { return x.second == endpoint; });
+        auto unchanged = size_t(owned) == tokens.size() && boost::algorithm::all_of(tokens, [this, endpoint] (const token& t) {
+            auto it = token_to_endpoint_map().find(t);
+            return it != token_to_endpoint_map().end() && it->second == endpoint;
+        });
+        if (unchanged) {
+            continue;
+        }
+
+        auto& token_to_endpoint_map = mutable_ring().token_to_endpoint_map;
+        for(auto it = token_to_endpoint_map.begin(), ite = token_to_endpoint_map.end(); it != ite;) {
             if(it->second == endpoint) {
-                it = _token_to_endpoint_map.erase(it);
+                it = token_to_endpoint_map.erase(it);
             } else {
                 ++it;
             }
         }
 
-        _topology.add_endpoint(endpoint);
-        remove_by_value(_bootstrap_tokens, endpoint);
-        _leaving_endpoints.erase(endpoint);
-        remove_from_moving(endpoint); // also removing this endpoint from moving
         for (const token& t : tokens)
         {
-            auto prev = _token_to_endpoint_map.insert(std::pair<token, inet_address>(t, endpoint));
+            auto prev = token_to_endpoint_map.insert(std::pair<token, inet_address>(t, endpoint));
             should_sort_tokens |= prev.second; // new token inserted -> sort
             if (prev.first->second != endpoint) {
                 // logger.warn("Token {} changing ownership from {} to {}", t, prev.first->second, endpoint);
@@ -123,27 +144,28 @@ void token_metadata::update_normal_tokens(std::unordered_map<inet_address, std::
     }
 
     if (should_sort_tokens) {
-        _sorted_tokens = sort_tokens();
+        sort_tokens();
     }
 }
 
 size_t token_metadata::first_token_index(const token& start) const {
-    assert(_sorted_tokens.size() > 0);
-    auto it = std::lower_bound(_sorted_tokens.begin(), _sorted_tokens.end(), start);
-    if (it == _sorted_tokens.end()) {
+    auto& sorted_tokens = _ring->sorted_tokens;
+    assert(sorted_tokens.size() > 0);
+    auto it = std::lower_bound(sorted_tokens.begin(), sorted_tokens.end(), start);
+    if (it == sorted_tokens.end()) {
         return 0;
     } else {
-        return std::distance(_sorted_tokens.begin(), it);
+        return std::distance(sorted_tokens.begin(), it);
     }
 }
 
 const token& token_metadata::first_token(const token& start) const {
-    return _sorted_tokens[first_token_index(start)];
+    return _ring->sorted_tokens[first_token_index(start)];
 }
 
 std::experimental::optional<inet_address> token_metadata::get_endpoint(const token& token) const {
-    auto it = _token_to_endpoint_map.find(token);
-    if (it == _token_to_endpoint_map.end()) {
+    auto it = token_to_endpoint_map().find(token);
+    if (it == token_to_endpoint_map().end()) {
         return std::experimental::nullopt;
     } else {
         return it->second;
@@ -154,7 +176,7 @@ void token_metadata::debug_show() {
     auto reporter = std::make_shared<timer<lowres_clock>>();
     reporter->set_callback ([reporter, this] {
         print("Endpoint -> Token\n");
-        for (auto x : _token_to_endpoint_map) {
+        for (auto x : token_to_endpoint_map()) {
             print("inet_address=%s, token=%s\n", x.second, x.first);
         }
         print("Endpoint -> UUID\n");
@@ -162,7 +184,7 @@ void token_metadata::debug_show() {
             print("inet_address=%s, uuid=%s\n", x.first, x.second);
         }
         print("Sorted Token\n");
-        for (auto x : _sorted_tokens) {
+        for (auto x : _ring->sorted_tokens) {
             print("token=%s\n", x);
         }
     });
@@ -214,8 +236,8 @@ const std::unordered_map<inet_address, utils::UUID>& token_metadata::get_endpoin
 }
 
 bool token_metadata::is_member(inet_address endpoint) {
-    auto beg = _token_to_endpoint_map.cbegin();
-    auto end = _token_to_endpoint_map.cend();
+    auto beg = token_to_endpoint_map().cbegin();
+    auto end = token_to_endpoint_map().cend();
     return end != std::find_if(beg, end, [endpoint] (const auto& x) {
         return x.second == endpoint;
     });
@@ -255,8 +277,8 @@ void token_metadata::add_bootstrap_tokens(std::unordered_set<token> tokens, inet
             throw std::runtime_error(msg);
         }
 
-        auto old_endpoint2 = _token_to_endpoint_map.find(t);
-        if (old_endpoint2 != _token_to_endpoint_map.end() && (*old_endpoint2).second != endpoint) {
+        auto old_endpoint2 = token_to_endpoint_map().find(t);
+        if (old_endpoint2 != token_to_endpoint_map().end() && (*old_endpoint2).second != endpoint) {
             auto msg = sprint("Bootstrap Token collision between %s and %s (token %s", (*old_endpoint2).second, endpoint, t);
             throw std::runtime_error(msg);
         }
@@ -289,11 +311,13 @@ bool token_metadata::is_leaving(inet_address endpoint) {
 
 void token_metadata::remove_endpoint(inet_address endpoint) {
     remove_by_value(_bootstrap_tokens, endpoint);
-    remove_by_value(_token_to_endpoint_map, endpoint);
+    if (is_member(endpoint)) {
+        remove_by_value(mutable_ring().token_to_endpoint_map, endpoint);
+        sort_tokens();
+    }
     _topology.remove_endpoint(endpoint);
     _leaving_endpoints.erase(endpoint);
     _endpoint_to_host_id_map.erase(endpoint);
-    _sorted_tokens = sort_tokens();
     invalidate_cached_rings();
 }
 
@@ -39,6 +39,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <unordered_set>
 #include <unordered_map>
 #include "gms/inet_address.hh"
@@ -126,7 +127,24 @@ class token_metadata final {
      * multiple tokens.  Hence, the BiMultiValMap collection.
      */
     // FIXME: have to be BiMultiValMap
-    std::map<token, inet_address> _token_to_endpoint_map;
+    //
+    // Along with the tokens in order. Shared, read-only, by the copies of
+    // the token_metadata on all shards and by clones, and copied by the
+    // first of them to change it, so that replicating the token_metadata
+    // or cloning it for a pending ranges calculation doesn't copy the ring.
+    // Its reference count is atomic, so the last copy can drop it from any
+    // shard.
+    struct ring {
+        std::map<token, inet_address> token_to_endpoint_map;
+        std::vector<token> sorted_tokens;
+    };
+    std::shared_ptr<ring> _ring = std::make_shared<ring>();
+
+    const std::map<token, inet_address>& token_to_endpoint_map() const {
+        return _ring->token_to_endpoint_map;
+    }
+    // The ring of this token_metadata alone, for changing it.
+    ring& mutable_ring();
 
     /** Maintains endpoint to host ID map of every node in the cluster */
     std::unordered_map<inet_address, utils::UUID> _endpoint_to_host_id_map;
@@ -137,13 +155,11 @@ class token_metadata final {
 
     std::unordered_map<sstring, std::unordered_multimap<range<token>, inet_address>> _pending_ranges;
 
-    std::vector<token> _sorted_tokens;
-
     topology _topology;
 
     long _ring_version = 0;
 
-    std::vector<token> sort_tokens();
+    void sort_tokens();
 
     class tokens_iterator :
             public std::iterator<std::input_iterator_tag, token> {
@@ -211,7 +227,7 @@ class token_metadata final {
         friend class token_metadata;
     };
 
-    token_metadata(std::map<token, inet_address> token_to_endpoint_map, std::unordered_map<inet_address, utils::UUID> endpoints_map, topology topology);
+    token_metadata(std::shared_ptr<ring> ring, std::unordered_map<inet_address, utils::UUID> endpoints_map, topology topology);
 public:
     token_metadata() {};
     const std::vector<token>& sorted_tokens() const;
@@ -223,7 +239,7 @@ class token_metadata final {
     std::experimental::optional<inet_address> get_endpoint(const token& token) const;
     std::vector<token> get_tokens(const inet_address& addr) const;
     const std::map<token, inet_address>& get_token_to_endpoint() const {
-        return _token_to_endpoint_map;
+        return token_to_endpoint_map();
     }
 
     const std::unordered_set<inet_address>& get_leaving_endpoints() const {
@@ -553,7 +569,7 @@ class token_metadata final {
      * bootstrap tokens and leaving endpoints are not included in the copy.
      */
     token_metadata clone_only_token_map() {
-        return token_metadata(this->_token_to_endpoint_map, this->_endpoint_to_host_id_map, this->_topology);
+        return token_metadata(this->_ring, this->_endpoint_to_host_id_map, this->_topology);
     }
 #if 0
 
@@ -26,7 +26,12 @@
 #include <boost/range/adaptor/map.hpp>
 #include <map>
 #include <syslog.h>
+#include <thread>
+#include <condition_variable>
+#include <cstdlib>
+#include <boost/lockfree/spsc_queue.hpp>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/print.hh>
 
 namespace logging {
 
@@ -68,6 +73,177 @@ namespace logging {
 
 std::atomic<bool> logger::_stdout = { true };
 std::atomic<bool> logger::_syslog = { false };
+std::atomic<size_t> logger::_buffer_size = { 0 };
+std::atomic<uint32_t> logger::_rate_limit = { 0 };
+
+namespace {
+
+// Precedes each message in the buffers, and in the messages as formatted.
+struct message_header {
+    uint32_t size;
+    log_level level;
+};
+
+// Keeps the messages of the writer thread and the errors of the threads
+// logging them from interleaving.
+std::mutex write_mutex;
+
+void write_out(log_level level, const char* msg, size_t size) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (logger::stdout_enabled()) {
+        std::cout.write(msg, size);
+        if (level == log_level::error) {
+            std::cout.flush();
+        }
+    }
+    if (logger::syslog_enabled()) {
+        static array_map<int, 20> level_map = {
+                { int(log_level::debug), LOG_DEBUG },
+                { int(log_level::info), LOG_INFO },
+                { int(log_level::trace), LOG_DEBUG },  // no LOG_TRACE
+                { int(log_level::warn), LOG_WARNING },
+                { int(log_level::error), LOG_ERR },
+        };
+        // syslog() interprets % characters, so send msg as a parameter,
+        // without the level it has its own notion of.
+        syslog(level_map[int(level)], "%.*s", int(size - 5), msg + 5);
+    }
+}
+
+// Drains the buffers of the threads which log, each written by its thread
+// alone, and writes their messages out. syslog() and a slow stdout block
+// this thread instead of a reactor.
+class log_writer {
+    using buffer = boost::lockfree::spsc_queue<char>;
+    static constexpr auto drain_period = std::chrono::milliseconds(10);
+
+    // Guards all but the buffers themselves and the drop count.
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::unique_ptr<buffer>> _buffers;
+    std::thread _thread;
+    bool _started = false;
+    bool _stop = false;
+    std::atomic<bool> _stopped = { false };
+    std::atomic<uint64_t> _dropped = { 0 };
+    // Of the draining thread.
+    uint64_t _dropped_reported = 0;
+    std::vector<char> _message;
+private:
+    std::vector<buffer*> buffers() {
+        std::vector<buffer*> ret;
+        for (auto&& b : _buffers) {
+            ret.push_back(b.get());
+        }
+        return ret;
+    }
+
+    void drain(const std::vector<buffer*>& buffers) {
+        for (auto b : buffers) {
+            message_header h;
+            // A message is pushed whole, so its header is never available
+            // without it.
+            while (b->read_available() >= sizeof(h)) {
+                b->pop(reinterpret_cast<char*>(&h), sizeof(h));
+                _message.resize(h.size);
+                b->pop(_message.data(), h.size);
+                write_out(h.level, _message.data(), h.size);
+            }
+        }
+        auto dropped = _dropped.load(std::memory_order_relaxed);
+        if (dropped != _dropped_reported) {
+            auto msg = sprint("WARN  [log] %d log messages dropped, as the log buffer was full\n", dropped - _dropped_reported);
+            write_out(log_level::warn, msg.data(), msg.size());
+            _dropped_reported = dropped;
+        }
+        if (logger::stdout_enabled()) {
+            std::cout.flush();
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stop) {
+            _cv.wait_for(lock, drain_period);
+            auto bs = buffers();
+            lock.unlock();
+            drain(bs);
+            lock.lock();
+        }
+    }
+public:
+    // The buffer of a thread logging for the first time, or null once
+    // stopped.
+    buffer* add_buffer(size_t size) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stop) {
+            return nullptr;
+        }
+        _buffers.push_back(std::make_unique<buffer>(size));
+        if (!_started) {
+            _started = true;
+            _thread = std::thread([this] { run(); });
+            std::atexit([] { logger::flush_and_stop(); });
+        }
+        return _buffers.back().get();
+    }
+
+    bool stopped() const {
+        return _stopped.load(std::memory_order_relaxed);
+    }
+
+    uint64_t dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+    // Fails, counting the message as dropped, when the buffer is full.
+    bool push(buffer& b, const std::string& msg) {
+        if (b.write_available() < msg.size()) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        b.push(msg.data(), msg.size());
+        return true;
+    }
+
+    void wake() {
+        _cv.notify_one();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stop) {
+                return;
+            }
+            _stop = true;
+        }
+        _stopped.store(true, std::memory_order_relaxed);
+        _cv.notify_one();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        drain(buffers());
+    }
+
+    static buffer* local_buffer();
+};
+
+// Never destroyed, as threads may log until the process exits.
+log_writer& the_log_writer() {
+    static log_writer* writer = new log_writer;
+    return *writer;
+}
+
+log_writer::buffer* log_writer::local_buffer() {
+    static thread_local buffer* local = nullptr;
+    if (!local) {
+        local = the_log_writer().add_buffer(logger::buffer_size());
+    }
+    return local;
+}
+
+}
 
 logger::logger(sstring name) : _name(std::move(name)) {
     logger_registry().register_logger(this);
@@ -81,8 +257,32 @@ logger::~logger() {
     logger_registry().unregister_logger(this);
 }
 
+bool
+logger::rate_limit(log_level level, uint64_t& suppressed) {
+    auto limit = _rate_limit.load(std::memory_order_relaxed);
+    if (limit && level != log_level::error) {
+        // Approximate under contention, which is good enough for a limit.
+        auto now = std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto window = _window.load(std::memory_order_relaxed);
+        if (window != now && _window.compare_exchange_strong(window, now, std::memory_order_relaxed)) {
+            _window_messages.store(0, std::memory_order_relaxed);
+        }
+        if (_window_messages.fetch_add(1, std::memory_order_relaxed) >= limit) {
+            _suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    suppressed = _suppressed.load(std::memory_order_relaxed) ? _suppressed.exchange(0, std::memory_order_relaxed) : 0;
+    return true;
+}
+
 void
 logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n) {
+    uint64_t suppressed;
+    if (!rate_limit(level, suppressed)) {
+        return;
+    }
     std::ostringstream out;
     static array_map<sstring, 20> level_map = {
             { int(log_level::debug), "DEBUG" },
@@ -91,8 +291,21 @@ logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n)
             { int(log_level::warn),  "WARN "  },
             { int(log_level::error), "ERROR" },
     };
-    out << level_map[int(level)];
-    out << " [shard " << engine().cpu_id() << "] " << _name << " - ";
+    auto prefix = [&] {
+        // Room for the header, filled in once the message is formatted.
+        message_header h{};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out << level_map[int(level)];
+        out << " [shard " << engine().cpu_id() << "] " << _name << " - ";
+    };
+    std::string notice;
+    if (suppressed) {
+        prefix();
+        out << suppressed << " messages suppressed by the rate limit\n";
+        notice = out.str();
+        out.str({});
+    }
+    prefix();
     const char* p = fmt;
     while (*p != '\0') {
         if (*p == '{' && *(p+1) == '}') {
@@ -109,24 +322,27 @@ logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n)
     }
     out << "\n";
     auto msg = out.str();
-    if (_stdout.load(std::memory_order_relaxed)) {
-        std::cout << msg;
+
+    auto& writer = the_log_writer();
+    // An error may be the last thing logged before a crash, and is never
+    // dropped for a full buffer.
+    auto buffered = level != log_level::error && _buffer_size.load(std::memory_order_relaxed) && !writer.stopped();
+    auto buffer = buffered ? log_writer::local_buffer() : nullptr;
+    for (auto m : { &notice, &msg }) {
+        if (m->empty()) {
+            continue;
+        }
+        message_header h{uint32_t(m->size() - sizeof(message_header)), level};
+        if (buffer) {
+            std::copy_n(reinterpret_cast<const char*>(&h), sizeof(h), m->begin());
+            writer.push(*buffer, *m);
+        } else {
+            write_out(level, m->data() + sizeof(h), h.size);
+        }
     }
-    if (_syslog.load(std::memory_order_relaxed)) {
-        static array_map<int, 20> level_map = {
-                { int(log_level::debug), LOG_DEBUG },
-                { int(log_level::info), LOG_INFO },
-                { int(log_level::trace), LOG_DEBUG },  // no LOG_TRACE
-                { int(log_level::warn), LOG_WARNING },
-                { int(log_level::error), LOG_ERR },
-        };
-        // NOTE: syslog() can block, which will stall the reactor thread.
-        //       this should be rare (will have to fill the pipe buffer
-        //       before syslogd can clear it) but can happen.  If it does,
-        //       we'll have to implement some internal buffering (which
-        //       still means the problem can happen, just less frequently).
-        // syslog() interprets % characters, so send msg as a parameter
-        syslog(level_map[int(level)], "%s", msg.c_str() + 5);
+    // What was buffered before an error is written out right after it.
+    if (level <= log_level::warn) {
+        writer.wake();
     }
 }
 
@@ -140,6 +356,26 @@ logger::set_syslog_enabled(bool enabled) {
     _syslog.store(enabled, std::memory_order_relaxed);
 }
 
+void
+logger::set_buffer_size(size_t bytes) {
+    _buffer_size.store(bytes, std::memory_order_relaxed);
+}
+
+uint64_t
+logger::dropped_messages() {
+    return the_log_writer().dropped();
+}
+
+void
+logger::set_rate_limit(uint32_t messages_per_second) {
+    _rate_limit.store(messages_per_second, std::memory_order_relaxed);
+}
+
+void
+logger::flush_and_stop() {
+    the_log_writer().stop();
+}
+
 void
 registry::set_all_loggers_level(log_level level) {
     std::lock_guard<std::mutex> g(_mutex);
@@ -60,11 +60,26 @@ namespace logging {
 class logger;
 class registry;
 
+// Messages are formatted by the thread logging them. By default they are
+// then written out by it too; with set_buffer_size(), they are instead
+// copied to a buffer of the thread's own, and written to stdout and syslog
+// by a thread dedicated to it, so that a slow terminal or syslogd doesn't
+// stall the reactor. A message which doesn't fit in the buffer is dropped
+// and counted, and the count is logged once the buffer drains. Errors are
+// always written out by the thread logging them, so that none is dropped or
+// lost to a crash following it.
 class logger {
     sstring _name;
     std::atomic<log_level> _level = { log_level::warn };
+    // Of the rate limit: the second of the current window, the messages
+    // logged in it, and those suppressed since one was last logged.
+    std::atomic<int64_t> _window = { 0 };
+    std::atomic<uint32_t> _window_messages = { 0 };
+    std::atomic<uint64_t> _suppressed = { 0 };
     static std::atomic<bool> _stdout;
     static std::atomic<bool> _syslog;
+    static std::atomic<size_t> _buffer_size;
+    static std::atomic<uint32_t> _rate_limit;
 private:
     struct stringer {
         // no need for virtual dtor, since not dynamically destroyed
@@ -84,6 +99,9 @@ class logger {
     void do_log_step(log_level level, const char* fmt, stringer** s, size_t n, size_t idx, Arg&& arg, Args&&... args);
     void do_log_step(log_level level, const char* fmt, stringer** s, size_t n, size_t idx);
     void really_do_log(log_level level, const char* fmt, stringer** stringers, size_t n);
+    // Whether the message is within the rate limit, and if so, how many
+    // were suppressed before it.
+    bool rate_limit(log_level level, uint64_t& suppressed);
 public:
     explicit logger(sstring name);
     logger(logger&& x);
@@ -128,6 +146,27 @@ class logger {
     }
     static void set_stdout_enabled(bool enabled);
     static void set_syslog_enabled(bool enabled);
+    static bool stdout_enabled() {
+        return _stdout.load(std::memory_order_relaxed);
+    }
+    static bool syslog_enabled() {
+        return _syslog.load(std::memory_order_relaxed);
+    }
+    static size_t buffer_size() {
+        return _buffer_size.load(std::memory_order_relaxed);
+    }
+    // Size of the buffer of each thread, 0 to write messages out as they
+    // are logged. A thread keeps the size of its buffer as of its first
+    // message.
+    static void set_buffer_size(size_t bytes);
+    // The messages dropped so far, as their buffer was full.
+    static uint64_t dropped_messages();
+    // Of each logger, the messages logged per second, 0 for no limit.
+    // Errors are never suppressed.
+    static void set_rate_limit(uint32_t messages_per_second);
+    // Writes out the buffered messages, and stops the thread writing them.
+    // Messages logged later are written out as they are logged.
+    static void flush_and_stop();
 };
 
 class registry {
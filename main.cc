@@ -31,8 +31,15 @@
 #include "service/storage_service.hh"
 #include "service/migration_manager.hh"
 #include "streaming/stream_session.hh"
+#include "repair/repair.hh"
 #include "db/system_keyspace.hh"
 #include "db/batchlog_manager.hh"
+#include "db/size_estimates_recorder.hh"
+#include "db/saved_caches_manager.hh"
+#include "db/index_summary_manager.hh"
+#include "tracing/tracing.hh"
+#include "cql3/result_cache.hh"
+#include "utils/stall_detector.hh"
 #include "db/commitlog/commitlog.hh"
 #include "db/commitlog/commitlog_replayer.hh"
 #include "utils/runtime.hh"
@@ -95,7 +102,7 @@ static future<> disk_sanity(sstring path) {
 };
 
 static void apply_logger_settings(sstring default_level, db::config::string_map levels,
-        bool log_to_stdout, bool log_to_syslog) {
+        bool log_to_stdout, bool log_to_syslog, uint32_t log_buffer_size_in_kb, uint32_t log_rate_limit) {
     logging::logger_registry().set_all_loggers_level(to_loglevel(default_level));
     for (auto&& kv: levels) {
         auto&& k = kv.first;
@@ -108,6 +115,8 @@ static void apply_logger_settings(sstring default_level, db::config::string_map
     }
     logging::logger::set_stdout_enabled(log_to_stdout);
     logging::logger::set_syslog_enabled(log_to_syslog);
+    logging::logger::set_buffer_size(size_t(log_buffer_size_in_kb) * 1024);
+    logging::logger::set_rate_limit(log_rate_limit);
 }
 
 class directories {
@@ -186,25 +195,53 @@ int main(int ac, char** av) {
         // Do this first once set log applied from command line so for example config
         // parse can get right log level.
         apply_logger_settings(cfg->default_log_level(), cfg->logger_log_level(),
-                cfg->log_to_stdout(), cfg->log_to_syslog());
+                cfg->log_to_stdout(), cfg->log_to_syslog(), cfg->log_buffer_size_in_kb(), cfg->log_rate_limit());
 
         return read_config(opts, *cfg).then([&cfg, &db, &qp, &proxy, &mm, &ctx, &opts, &dirs]() {
             apply_logger_settings(cfg->default_log_level(), cfg->logger_log_level(),
-                    cfg->log_to_stdout(), cfg->log_to_syslog());
+                    cfg->log_to_stdout(), cfg->log_to_syslog(), cfg->log_buffer_size_in_kb(), cfg->log_rate_limit());
             dht::set_global_partitioner(cfg->partitioner());
             auto start_thrift = cfg->start_rpc();
             uint16_t thrift_port = cfg->rpc_port();
             uint16_t cql_port = cfg->native_transport_port();
+            uint16_t shard_aware_cql_port = cfg->native_shard_aware_transport_port();
+            uint32_t cql_max_requests = cfg->native_transport_max_requests_per_connection();
+            size_t cql_max_request_memory = size_t(cfg->native_transport_max_request_memory_per_connection_in_mb()) << 20;
+            uint32_t cql_max_concurrent_requests = cfg->native_transport_max_concurrent_requests_per_shard();
+            std::unordered_map<sstring, service::service_level_options> service_levels;
+            for (auto&& e : cfg->service_levels()) {
+                try {
+                    service_levels.emplace(e.first, service::service_level_options::parse(e.second));
+                } catch (const std::invalid_argument& ex) {
+                    throw std::runtime_error(sprint("Invalid service level %s: %s", e.first, ex.what()));
+                }
+            }
             uint16_t api_port = cfg->api_port();
             ctx.api_dir = cfg->api_ui_dir();
             ctx.api_doc = cfg->api_doc_dir();
             sstring cluster_name = cfg->cluster_name();
+            double phi = cfg->phi_convict_threshold();
+            auto phi_min_interval = std::chrono::milliseconds(cfg->phi_min_interval_in_ms());
+            net::messaging_service::connections_config connections;
+            connections.gossip = cfg->internode_gossip_connections();
+            connections.request_response = cfg->internode_request_response_connections();
+            connections.streaming = cfg->internode_streaming_connections();
+            connections.repair = cfg->internode_repair_connections();
+            connections.shard_aware_port = cfg->shard_aware_storage_port();
+            net::messaging_service::compression_config compression;
+            compression.mode = cfg->internode_compression();
+            compression.threshold = cfg->internode_compression_threshold_in_bytes();
             sstring listen_address = cfg->listen_address();
             sstring rpc_address = cfg->rpc_address();
             sstring api_address = cfg->api_address() != "" ? cfg->api_address() : rpc_address;
             auto seed_provider= cfg->seed_provider();
+            auto stall_threshold = std::chrono::milliseconds(cfg->reactor_stall_threshold_in_ms());
             using namespace locator;
-            return i_endpoint_snitch::create_snitch(cfg->endpoint_snitch()).then([] {
+            return utils::get_stall_detector().start(stall_threshold).then([&cfg] {
+                // #293 - do not stop anything
+                // engine().at_exit([] { return utils::get_stall_detector().stop(); });
+                return i_endpoint_snitch::create_snitch(cfg->endpoint_snitch());
+            }).then([] {
                 // #293 - do not stop anything
                 // engine().at_exit([] { return i_endpoint_snitch::stop_snitch(); });
             }).then([&db] {
@@ -223,10 +260,18 @@ int main(int ac, char** av) {
                         });
                     });
                 });
-            }).then([listen_address, seed_provider, cluster_name] {
-                return init_ms_fd_gossiper(listen_address, seed_provider, cluster_name);
+            }).then([listen_address, seed_provider, cluster_name, phi, phi_min_interval, connections, compression] {
+                return init_ms_fd_gossiper(listen_address, seed_provider, cluster_name, phi, phi_min_interval, connections, compression);
             }).then([&db] {
                 return streaming::stream_session::init_streaming_service(db);
+            }).then([&db] {
+                return repair_init_messaging_service_handler(db);
+            }).then([&db] {
+                return db::get_saved_caches_manager().start(std::ref(db)).then([] {
+                    // #293 - do not stop anything
+                    // engine().at_exit([] { return db::get_saved_caches_manager().stop(); });
+                    return db::get_saved_caches_manager().invoke_on_all(&db::saved_caches_manager::init_messaging_service_handler);
+                });
             }).then([&proxy, &db] {
                 return proxy.start(std::ref(db)).then([&proxy] {
                     // #293 - do not stop anything
@@ -242,20 +287,39 @@ int main(int ac, char** av) {
                     // #293 - do not stop anything
                     // engine().at_exit([&qp] { return qp.stop(); });
                 });
+            }).then([&db] {
+                size_t size = size_t(db.local().get_config().query_result_cache_size_in_mb()) * 1024 * 1024 / smp::count;
+                return db.invoke_on_all([size] (database&) {
+                    cql3::global_result_cache().set_max_memory(size);
+                });
             }).then([&qp] {
                 return db::get_batchlog_manager().start(std::ref(qp)).then([] {
                     // #293 - do not stop anything
                     // engine().at_exit([] { return db::get_batchlog_manager().stop(); });
                 });
+            }).then([&db] {
+                auto threshold = std::chrono::milliseconds(db.local().get_config().slow_query_log_threshold_in_ms());
+                return tracing::get_tracing().start().then([threshold] {
+                    // #293 - do not stop anything
+                    // engine().at_exit([] { return tracing::get_tracing().stop(); });
+                    return tracing::get_tracing().invoke_on_all([threshold] (tracing::tracing& t) {
+                        t.set_slow_query_threshold(threshold);
+                    });
+                });
             }).then([&db, &dirs] {
                 return dirs.touch_and_lock(db.local().get_config().data_file_directories());
             }).then([&db, &dirs] {
                 return dirs.touch_and_lock(db.local().get_config().commitlog_directory());
+            }).then([&db, &dirs] {
+                return dirs.touch_and_lock(db.local().get_config().hints_directory());
+            }).then([&db, &dirs] {
+                return dirs.touch_and_lock(db.local().get_config().saved_caches_directory());
             }).then([&db] {
                 std::unordered_set<sstring> directories;
                 directories.insert(db.local().get_config().data_file_directories().cbegin(),
                         db.local().get_config().data_file_directories().cend());
                 directories.insert(db.local().get_config().commitlog_directory());
+                directories.insert(db.local().get_config().hints_directory());
                 return do_with(std::move(directories), [] (auto& directories) {
                     return parallel_for_each(directories, [] (sstring pathname) {
                         return disk_sanity(pathname);
@@ -307,19 +371,47 @@ int main(int ac, char** av) {
                 return db::get_batchlog_manager().invoke_on_all([] (db::batchlog_manager& b) {
                     return b.start();
                 });
+            }).then([&db] {
+                return db::get_size_estimates_recorder().start(std::ref(db)).then([] {
+                    // #293 - do not stop anything
+                    // engine().at_exit([] { return db::get_size_estimates_recorder().stop(); });
+                    return db::get_size_estimates_recorder().invoke_on_all(&db::size_estimates_recorder::start);
+                });
+            }).then([] {
+                return db::get_saved_caches_manager().invoke_on_all(&db::saved_caches_manager::start);
+            }).then([&db] {
+                return db::get_index_summary_manager().start(std::ref(db)).then([] {
+                    // #293 - do not stop anything
+                    // engine().at_exit([] { return db::get_index_summary_manager().stop(); });
+                    return db::get_index_summary_manager().invoke_on_all(&db::index_summary_manager::start);
+                });
+            }).then([&proxy] {
+                return proxy.invoke_on_all([] (service::storage_proxy& p) {
+                    return p.start_hints_manager();
+                });
             }).then([rpc_address] {
                 return dns::gethostbyname(rpc_address);
-            }).then([&db, &proxy, &qp, rpc_address, cql_port, thrift_port, start_thrift] (dns::hostent e) {
+            }).then([&db, &proxy, &qp, rpc_address, cql_port, shard_aware_cql_port, cql_max_requests, cql_max_request_memory,
+                    cql_max_concurrent_requests, service_levels, thrift_port, start_thrift] (dns::hostent e) {
                 auto ip = e.addresses[0].in.s_addr;
                 auto cserver = new distributed<transport::cql_server>;
-                cserver->start(std::ref(proxy), std::ref(qp)).then([server = std::move(cserver), cql_port, rpc_address, ip] () mutable {
+                cserver->start(std::ref(proxy), std::ref(qp), cql_max_requests, cql_max_request_memory,
+                        cql_max_concurrent_requests, service_levels).then([server = std::move(cserver), cql_port, shard_aware_cql_port, rpc_address, ip] () mutable {
                     // #293 - do not stop anything
                     //engine().at_exit([server] {
                     //    return server->stop();
                     //});
-                    server->invoke_on_all(&transport::cql_server::listen, ipv4_addr{ip, cql_port});
-                }).then([rpc_address, cql_port] {
+                    return server->invoke_on_all(&transport::cql_server::listen, ipv4_addr{ip, cql_port}).then([server, shard_aware_cql_port, ip] {
+                        if (!shard_aware_cql_port) {
+                            return make_ready_future<>();
+                        }
+                        return server->invoke_on_all(&transport::cql_server::listen_shard_aware, ipv4_addr{ip, shard_aware_cql_port});
+                    });
+                }).then([rpc_address, cql_port, shard_aware_cql_port] {
                     print("Starting listening for CQL clients on %s:%s...\n", rpc_address, cql_port);
+                    if (shard_aware_cql_port) {
+                        print("Shard-aware CQL ports start at %s:%s\n", rpc_address, shard_aware_cql_port);
+                    }
                 });
                 if (start_thrift) {
                     auto tserver = new distributed<thrift_server>;
@@ -22,6 +22,7 @@
 #include "memtable.hh"
 #include "frozen_mutation.hh"
 #include "sstable_mutation_readers.hh"
+#include "mutation_partition_visitor.hh"
 
 namespace stdx = std::experimental;
 
@@ -37,34 +38,97 @@ memtable::~memtable() {
     });
 }
 
-mutation_partition&
-memtable::find_or_create_partition_slow(partition_key_view key) {
-    assert(!_region.reclaiming_enabled());
+namespace {
 
-    // FIXME: Perform lookup using std::pair<token, partition_key_view>
-    // to avoid unconditional copy of the partition key.
-    // We can't do it right now because std::map<> which holds
-    // partitions doesn't support heterogeneous lookup.
-    // We could switch to boost::intrusive_map<> similar to what we have for row keys.
-    auto& outer = current_allocator();
-    return with_allocator(standard_allocator(), [&, this] () -> mutation_partition& {
-        auto dk = dht::global_partitioner().decorate_key(*_schema, key);
-        return with_allocator(outer, [&dk, this] () -> mutation_partition& {
-            return find_or_create_partition(dk);
+// Finds the smallest timestamp of the data of mutations.
+class min_timestamp_visitor final : public mutation_partition_visitor {
+    const schema& _s;
+    api::timestamp_type _min = api::max_timestamp;
+private:
+    void add(api::timestamp_type ts) {
+        _min = std::min(_min, ts);
+    }
+    void add(tombstone t) {
+        if (t) {
+            add(t.timestamp);
+        }
+    }
+    void add(const column_definition& def, collection_mutation::view c) {
+        auto ctype = static_pointer_cast<const collection_type_impl>(def.type);
+        auto mv = ctype->deserialize_mutation_form(c);
+        add(mv.tomb);
+        for (auto&& e : mv.cells) {
+            add(e.second.timestamp());
+        }
+    }
+    void add(const row& r, column_kind kind) {
+        r.for_each_cell([this, kind] (column_id id, const atomic_cell_or_collection& c) {
+            auto& def = _s.column_at(kind, id);
+            if (def.is_atomic()) {
+                add(c.as_atomic_cell().timestamp());
+            } else {
+                add(def, c.as_collection_mutation());
+            }
         });
-    });
+    }
+public:
+    explicit min_timestamp_visitor(const schema& s) : _s(s) {}
+    api::timestamp_type get() const {
+        return _min;
+    }
+    void accept(const mutation_partition& p) {
+        add(p.partition_tombstone());
+        add(p.static_row(), column_kind::static_column);
+        for (auto&& rt : p.row_tombstones()) {
+            add(rt.t());
+        }
+        for (auto&& e : p.clustered_rows()) {
+            accept_row(e.key(), e.row().deleted_at(), e.row().marker());
+            add(e.row().cells(), column_kind::regular_column);
+        }
+    }
+    virtual void accept_partition_tombstone(tombstone t) override {
+        add(t);
+    }
+    virtual void accept_static_cell(column_id, atomic_cell_view c) override {
+        add(c.timestamp());
+    }
+    virtual void accept_static_cell(column_id id, collection_mutation::view c) override {
+        add(_s.static_column_at(id), c);
+    }
+    virtual void accept_row_tombstone(clustering_key_prefix_view, tombstone t) override {
+        add(t);
+    }
+    virtual void accept_row(clustering_key_view, tombstone deleted_at, const row_marker& rm) override {
+        add(deleted_at);
+        if (!rm.is_missing()) {
+            add(rm.timestamp());
+        }
+    }
+    virtual void accept_row_cell(column_id, atomic_cell_view c) override {
+        add(c.timestamp());
+    }
+    virtual void accept_row_cell(column_id id, collection_mutation::view c) override {
+        add(_s.regular_column_at(id), c);
+    }
+};
+
 }
 
 mutation_partition&
 memtable::find_or_create_partition(const dht::decorated_key& key) {
     assert(!_region.reclaiming_enabled());
 
-    // call lower_bound so we have a hint for the insert, just in case.
     auto i = partitions.lower_bound(key, partition_entry::compare(_schema));
     if (i == partitions.end() || !key.equal(*_schema, i->key())) {
         partition_entry* entry = current_allocator().construct<partition_entry>(
             dht::decorated_key(key), mutation_partition(_schema));
-        i = partitions.insert(i, *entry);
+        try {
+            i = partitions.insert_before(i, *entry);
+        } catch (...) {
+            current_allocator().destroy(entry);
+            throw;
+        }
     }
     return i->partition();
 }
@@ -194,6 +258,86 @@ memtable::make_reader(const query::partition_range& range) const {
     }
 }
 
+// Hands out the partitions of a memtable being flushed in pieces of at most
+// about max_piece_size bytes of cells, so that a wide partition is never
+// copied out of the memtable whole.
+//
+// The memtable is no longer written to, but its region may be compacted
+// between calls, so each call looks the partition and the last row up again.
+class flush_reader final : public sstables::partition_source {
+    lw_shared_ptr<const memtable> _memtable;
+    size_t _max_piece_size;
+    stdx::optional<dht::decorated_key> _key;
+    stdx::optional<clustering_key> _last_row;
+    bool _more_rows = false;
+private:
+    // Copies the rows of p following _last_row into m, until the piece
+    // size is reached.
+    void copy_rows(const mutation_partition& p, mutation& m) {
+        const schema& s = *_memtable->_schema;
+        auto& rows = p.clustered_rows();
+        auto i = _last_row ? rows.upper_bound(*_last_row, rows_entry::compare(s)) : rows.begin();
+        size_t size = 0;
+        while (i != rows.end() && size < _max_piece_size) {
+            auto& r = m.partition().clustered_row(i->key());
+            r.apply(i->row().deleted_at());
+            r.apply(i->row().marker());
+            r.cells() = row(i->row().cells());
+            size += i->key().representation().size();
+            i->row().cells().for_each_cell([&size] (column_id, const atomic_cell_or_collection& c) {
+                size += c.serialize().size();
+            });
+            _last_row = i->key();
+            ++i;
+        }
+        _more_rows = i != rows.end();
+    }
+public:
+    flush_reader(lw_shared_ptr<const memtable> m, size_t max_piece_size)
+        : _memtable(std::move(m))
+        , _max_piece_size(std::max(max_piece_size, size_t(1)))
+    { }
+
+    virtual future<mutation_opt> next_partition() override {
+        logalloc::reclaim_lock _(_memtable->_region);
+        auto& partitions = _memtable->partitions;
+        auto cmp = partition_entry::compare(_memtable->_schema);
+        auto i = _key ? partitions.upper_bound(*_key, cmp) : partitions.cbegin();
+        if (i == partitions.cend()) {
+            return make_ready_future<mutation_opt>(stdx::nullopt);
+        }
+        const schema& s = *_memtable->_schema;
+        const mutation_partition& p = i->partition();
+        _key = i->key();
+        _last_row = {};
+        mutation m(i->key(), _memtable->_schema);
+        m.partition().apply(p.partition_tombstone());
+        m.partition().static_row() = row(p.static_row());
+        for (auto& rt : p.row_tombstones()) {
+            m.partition().apply_row_tombstone(s, rt.prefix(), rt.t());
+        }
+        copy_rows(p, m);
+        return make_ready_future<mutation_opt>(std::move(m));
+    }
+
+    virtual future<mutation_opt> next_rows() override {
+        if (!_more_rows) {
+            return make_ready_future<mutation_opt>(stdx::nullopt);
+        }
+        logalloc::reclaim_lock _(_memtable->_region);
+        auto i = _memtable->partitions.find(*_key, partition_entry::compare(_memtable->_schema));
+        assert(i != _memtable->partitions.end());
+        mutation m(*_key, _memtable->_schema);
+        copy_rows(i->partition(), m);
+        return make_ready_future<mutation_opt>(std::move(m));
+    }
+};
+
+std::unique_ptr<sstables::partition_source>
+memtable::make_flush_reader(size_t max_piece_size) const {
+    return std::make_unique<flush_reader>(shared_from_this(), max_piece_size);
+}
+
 void
 memtable::update(const db::replay_position& rp) {
     if (_replay_position < rp) {
@@ -208,16 +352,44 @@ memtable::apply(const mutation& m, const db::replay_position& rp) {
         mutation_partition& p = find_or_create_partition(m.decorated_key());
         p.apply(*_schema, m.partition());
     });
+    min_timestamp_visitor v(*_schema);
+    v.accept(m.partition());
+    _min_timestamp = std::min(_min_timestamp, v.get());
     update(rp);
 }
 
 void
 memtable::apply(const frozen_mutation& m, const db::replay_position& rp) {
-    with_allocator(_region.allocator(), [this, &m] {
+    auto dk = m.decorated_key(*_schema);
+    with_allocator(_region.allocator(), [this, &m, &dk] {
         logalloc::reclaim_lock _(_region);
-        mutation_partition& p = find_or_create_partition_slow(m.key(*_schema));
+        mutation_partition& p = find_or_create_partition(dk);
         p.apply(*_schema, m.partition());
     });
+    min_timestamp_visitor v(*_schema);
+    m.partition().accept(*_schema, v);
+    _min_timestamp = std::min(_min_timestamp, v.get());
+    update(rp);
+}
+
+void
+memtable::apply(const std::vector<partition_update>& updates, const db::replay_position& rp) {
+    with_allocator(_region.allocator(), [this, &updates] {
+        logalloc::reclaim_lock _(_region);
+        for (auto&& u : updates) {
+            mutation_partition& p = find_or_create_partition(u.key);
+            for (auto&& m : u.frozen) {
+                p.apply(*_schema, m->partition());
+            }
+        }
+    });
+    min_timestamp_visitor v(*_schema);
+    for (auto&& u : updates) {
+        for (auto&& m : u.frozen) {
+            m->partition().accept(*_schema, v);
+        }
+    }
+    _min_timestamp = std::min(_min_timestamp, v.get());
     update(rp);
 }
 
@@ -225,25 +397,39 @@ logalloc::occupancy_stats memtable::occupancy() const {
     return _region.occupancy();
 }
 
+size_t memtable::compact(size_t max_segments) {
+    auto before = _region.occupancy().total_space();
+    _region.compact_sparse(0.5, max_segments);
+    return before - _region.occupancy().total_space();
+}
+
 mutation_source memtable::as_data_source() {
     return [mt = shared_from_this()] (const query::partition_range& range) {
         return mt->make_reader(range);
     };
 }
 
+uint32_t memtable::max_shadowed_rows(const dht::decorated_key& key) const {
+    auto i = partitions.find(key, partition_entry::compare(_schema));
+    if (i == partitions.end()) {
+        return 0;
+    }
+    auto& p = i->partition();
+    if (p.partition_tombstone() || !p.row_tombstones().empty()) {
+        return query::max_rows;
+    }
+    return std::min(p.clustered_rows().size(), size_t(query::max_rows));
+}
+
 size_t memtable::partition_count() const {
     return partitions.size();
 }
 
 partition_entry::partition_entry(partition_entry&& o) noexcept
-    : _link()
+    : _link(std::move(o._link))
     , _key(std::move(o._key))
     , _p(std::move(o._p))
-{
-    using container_type = memtable::partitions_type;
-    container_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
-    container_type::node_algorithms::init(o._link.this_ptr());
-}
+{ }
 
 void memtable::mark_flushed(lw_shared_ptr<sstables::sstable> sst) {
     _sstable = std::move(sst);
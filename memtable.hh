@@ -29,15 +29,13 @@
 #include "mutation_reader.hh"
 #include "db/commitlog/replay_position.hh"
 #include "utils/logalloc.hh"
+#include "utils/intrusive_btree.hh"
 #include "sstables/sstables.hh"
 
 class frozen_mutation;
 
-
-namespace bi = boost::intrusive;
-
 class partition_entry {
-    bi::set_member_hook<> _link;
+    intrusive_btree_hook _link;
     dht::decorated_key _key;
     mutation_partition _p;
 public:
@@ -82,38 +80,63 @@ class partition_entry {
             return _c(k1, k2._key);
         }
     };
+
+    struct key_prefix : dht::token_prefix_of {
+        using dht::token_prefix_of::operator();
+
+        uint64_t operator()(const partition_entry& e) const {
+            return (*this)(e._key);
+        }
+    };
 };
 
 // Managed by lw_shared_ptr<>.
 class memtable final : public enable_lw_shared_from_this<memtable> {
 public:
-    using partitions_type = bi::set<partition_entry,
-        bi::member_hook<partition_entry, bi::set_member_hook<>, &partition_entry::_link>,
-        bi::compare<partition_entry::compare>>;
+    // Ordered by token first, so that lookups mostly compare token prefixes
+    // kept in the nodes instead of the keys of entries.
+    using partitions_type = intrusive_btree<partition_entry, &partition_entry::_link,
+        partition_entry::compare, partition_entry::key_prefix>;
 private:
     schema_ptr _schema;
     mutable logalloc::region _region;
     partitions_type partitions;
     db::replay_position _replay_position;
+    api::timestamp_type _min_timestamp = api::max_timestamp;
     lw_shared_ptr<sstables::sstable> _sstable;
     void update(const db::replay_position&);
     friend class row_cache;
 private:
     boost::iterator_range<partitions_type::const_iterator> slice(const query::partition_range& r) const;
     mutation_partition& find_or_create_partition(const dht::decorated_key& key);
-    mutation_partition& find_or_create_partition_slow(partition_key_view key);
 public:
     explicit memtable(schema_ptr schema, logalloc::region_group* dirty_memory_region_group = nullptr);
     ~memtable();
     schema_ptr schema() const { return _schema; }
     void apply(const mutation& m, const db::replay_position& = db::replay_position());
     void apply(const frozen_mutation& m, const db::replay_position& = db::replay_position());
+
+    // The update of a partition in a batch of writes: the frozen mutations
+    // of the partition, applied in the order the writes came.
+    struct partition_update {
+        dht::decorated_key key;
+        std::vector<const frozen_mutation*> frozen;
+    };
+    // Applies the updates of a batch of writes, of distinct partitions in
+    // ring order, locking the region once.
+    void apply(const std::vector<partition_update>& updates, const db::replay_position& rp);
     const logalloc::region& region() const {
         return _region;
     }
 public:
     size_t partition_count() const;
     logalloc::occupancy_stats occupancy() const;
+    // Returns the space taken by the values overwritten or deleted since
+    // they were written, as rows keep being updated, by compacting the
+    // segments of the memtable which are mostly free, at most max_segments
+    // of them. Returns the space freed, in bytes.
+    // Invalidates references into the memtable.
+    size_t compact(size_t max_segments = std::numeric_limits<size_t>::max());
 
     // Creates a reader of data in this memtable for given partition range.
     //
@@ -123,8 +146,19 @@ class memtable final : public enable_lw_shared_from_this<memtable> {
     // The 'range' parameter must be live as long as the reader is being used
     mutation_reader make_reader(const query::partition_range& range = query::full_partition_range) const;
 
+    // Creates a source of all the data in this memtable for writing it to
+    // an sstable, copying out at most about max_piece_size bytes of a
+    // partition at a time. Shares ownership of the memtable, like readers.
+    std::unique_ptr<sstables::partition_source> make_flush_reader(size_t max_piece_size) const;
+
     mutation_source as_data_source();
 
+    // Returns how many rows of the given partition, as found in other data
+    // sources, the data in this memtable can at most hide from a query: one
+    // per row it holds, or query::max_rows if it deletes ranges of rows or
+    // the whole partition.
+    uint32_t max_shadowed_rows(const dht::decorated_key& key) const;
+
     bool empty() const { return partitions.empty(); }
     void mark_flushed(lw_shared_ptr<sstables::sstable> sst);
     bool is_flushed() const;
@@ -133,5 +167,12 @@ class memtable final : public enable_lw_shared_from_this<memtable> {
         return _replay_position;
     }
 
+    // The smallest timestamp of the cells, row markers and tombstones
+    // written to it, api::max_timestamp if none was.
+    api::timestamp_type min_timestamp() const {
+        return _min_timestamp;
+    }
+
     friend class scanning_reader;
+    friend class flush_reader;
 };
@@ -21,6 +21,7 @@
 
 #include "message/messaging_service.hh"
 #include "core/distributed.hh"
+#include "util/defer.hh"
 #include "gms/failure_detector.hh"
 #include "gms/gossiper.hh"
 #include "service/storage_service.hh"
@@ -31,8 +32,15 @@
 #include "gms/gossip_digest_ack2.hh"
 #include "query-request.hh"
 #include "query-result.hh"
+#include "service/paxos/proposal.hh"
+#include "repair/merkle_tree.hh"
+#include "repair/row_level.hh"
+#include "db/saved_caches_manager.hh"
 #include "rpc/rpc.hh"
 #include "db/config.hh"
+#include "sstables/compress.hh"
+#include "locator/snitch_base.hh"
+#include "utils/fb_utilities.hh"
 
 namespace net {
 
@@ -130,6 +138,24 @@ query::result_digest net::serializer::read(Input& in, rpc::type<query::result_di
     return read_gms<query::result_digest>(in);
 }
 
+template <typename Output>
+void net::serializer::write(Output& out, const query::aggregate& v) const {
+    return write_gms(out, v);
+}
+template <typename Input>
+query::aggregate net::serializer::read(Input& in, rpc::type<query::aggregate>) const {
+    return read_gms<query::aggregate>(in);
+}
+
+template <typename Output>
+void net::serializer::write(Output& out, const query::partial_aggregates& v) const {
+    return write_gms(out, v);
+}
+template <typename Input>
+query::partial_aggregates net::serializer::read(Input& in, rpc::type<query::partial_aggregates>) const {
+    return read_gms<query::partial_aggregates>(in);
+}
+
 template <typename Output>
 void net::serializer::write(Output& out, const utils::UUID& v) const {
     return write_gms(out, v);
@@ -139,6 +165,69 @@ utils::UUID net::serializer::read(Input& in, rpc::type<utils::UUID>) const {
     return read_gms<utils::UUID>(in);
 }
 
+template <typename Output>
+void net::serializer::write(Output& out, const service::paxos::proposal& v) const {
+    return write_gms(out, v);
+}
+template <typename Input>
+service::paxos::proposal net::serializer::read(Input& in, rpc::type<service::paxos::proposal>) const {
+    return read_gms<service::paxos::proposal>(in);
+}
+
+template <typename Output>
+void net::serializer::write(Output& out, const service::paxos::prepare_response& v) const {
+    return write_gms(out, v);
+}
+template <typename Input>
+service::paxos::prepare_response net::serializer::read(Input& in, rpc::type<service::paxos::prepare_response>) const {
+    return read_gms<service::paxos::prepare_response>(in);
+}
+
+template <typename Output>
+void net::serializer::write(Output& out, const merkle_tree& v) const {
+    return write_gms(out, v);
+}
+template <typename Input>
+merkle_tree net::serializer::read(Input& in, rpc::type<merkle_tree>) const {
+    return read_gms<merkle_tree>(in);
+}
+
+template <typename Output>
+void net::serializer::write(Output& out, const repair_row_key& v) const {
+    return write_gms(out, v);
+}
+template <typename Input>
+repair_row_key net::serializer::read(Input& in, rpc::type<repair_row_key>) const {
+    return read_gms<repair_row_key>(in);
+}
+
+template <typename Output>
+void net::serializer::write(Output& out, const repair_row_window& v) const {
+    return write_gms(out, v);
+}
+template <typename Input>
+repair_row_window net::serializer::read(Input& in, rpc::type<repair_row_window>) const {
+    return read_gms<repair_row_window>(in);
+}
+
+template <typename Output>
+void net::serializer::write(Output& out, const repair_row_hashes& v) const {
+    return write_gms(out, v);
+}
+template <typename Input>
+repair_row_hashes net::serializer::read(Input& in, rpc::type<repair_row_hashes>) const {
+    return read_gms<repair_row_hashes>(in);
+}
+
+template <typename Output>
+void net::serializer::write(Output& out, const db::cache_hot_keys& v) const {
+    return write_gms(out, v);
+}
+template <typename Input>
+db::cache_hot_keys net::serializer::read(Input& in, rpc::type<db::cache_hot_keys>) const {
+    return read_gms<db::cache_hot_keys>(in);
+}
+
 // for query::range<T>
 template <typename Output, typename T>
 void net::serializer::write(Output& out, const query::range<T>& v) const {
@@ -190,17 +279,19 @@ constexpr int32_t messaging_service::current_version;
 
 distributed<messaging_service> _the_messaging_service;
 
+constexpr uint32_t shard_id::any_cpu;
+
 bool operator==(const shard_id& x, const shard_id& y) {
-    // Ignore cpu id for now since we do not really support shard to shard connections
-    return x.addr == y.addr;
+    return x.addr == y.addr && x.cpu_id == y.cpu_id;
 }
 
 bool operator<(const shard_id& x, const shard_id& y) {
-    // Ignore cpu id for now since we do not really support shard to shard connections
     if (x.addr < y.addr) {
         return true;
-    } else {
+    } else if (y.addr < x.addr) {
         return false;
+    } else {
+        return x.cpu_id < y.cpu_id;
     }
 }
 
@@ -209,8 +300,7 @@ std::ostream& operator<<(std::ostream& os, const shard_id& x) {
 }
 
 size_t shard_id::hash::operator()(const shard_id& id) const {
-    // Ignore cpu id for now since we do not really support // shard to shard connections
-    return std::hash<uint32_t>()(id.addr.raw_addr());
+    return std::hash<uint32_t>()(id.addr.raw_addr()) ^ std::hash<uint32_t>()(id.cpu_id);
 }
 
 messaging_service::shard_info::shard_info(shared_ptr<rpc_protocol_client_wrapper>&& client)
@@ -221,8 +311,51 @@ rpc::stats messaging_service::shard_info::get_stats() const {
     return rpc_client->get_stats();
 }
 
+thread_local const payload_compression* current_payload_compression = nullptr;
+thread_local bool payload_tokens = false;
+
+std::experimental::optional<bytes> compress_payload(bytes_view payload) {
+    bytes compressed(bytes::initialized_later(), compress_max_size_lz4(payload.size()));
+    auto len = compress_lz4(reinterpret_cast<const char*>(payload.begin()), payload.size(),
+            reinterpret_cast<char*>(compressed.begin()), compressed.size());
+    if (len >= payload.size()) {
+        return {};
+    }
+    compressed.resize(len);
+    return std::move(compressed);
+}
+
+bytes uncompress_payload(bytes_view compressed, size_t size) {
+    bytes payload(bytes::initialized_later(), size);
+    auto len = uncompress_lz4(reinterpret_cast<const char*>(compressed.begin()), compressed.size(),
+            reinterpret_cast<char*>(payload.begin()), payload.size());
+    if (len != size) {
+        throw std::runtime_error("compressed payload size mismatch");
+    }
+    return payload;
+}
+
+unsigned messaging_service::connections_config::count(connection_class c) const {
+    switch (c) {
+    case connection_class::gossip: return gossip;
+    case connection_class::request_response: return request_response;
+    case connection_class::streaming: return streaming;
+    case connection_class::repair: return repair;
+    default: abort();
+    }
+}
+
 void messaging_service::foreach_client(std::function<void(const shard_id& id, const shard_info& info)> f) const {
-    for (unsigned idx = 0; idx < 2; idx ++) {
+    for (unsigned idx = 0; idx < _clients.size(); idx ++) {
+        for (auto i = _clients[idx].cbegin(); i != _clients[idx].cend(); i++) {
+            f(i->first, i->second);
+        }
+    }
+}
+
+void messaging_service::foreach_client(connection_class c, std::function<void(const shard_id& id, const shard_info& info)> f) const {
+    auto cls = static_cast<unsigned>(c);
+    for (unsigned idx = _first_client[cls]; idx < _first_client[cls + 1]; idx ++) {
         for (auto i = _clients[idx].cbegin(); i != _clients[idx].cend(); i++) {
             f(i->first, i->second);
         }
@@ -251,11 +384,27 @@ bool messaging_service::knows_version(const gms::inet_address& endpoint) const {
     return true;
 }
 
-messaging_service::messaging_service(gms::inet_address ip)
+messaging_service::messaging_service(gms::inet_address ip, connections_config connections, compression_config compression)
     : _listen_address(ip)
     , _port(_default_port)
     , _rpc(new rpc_protocol_wrapper(serializer{}))
-    , _server(new rpc_protocol_server_wrapper(*_rpc, ipv4_addr{_listen_address.raw_addr(), _port})) {
+    , _server(new rpc_protocol_server_wrapper(*_rpc, ipv4_addr{_listen_address.raw_addr(), _port}))
+    , _shard_aware_port(connections.shard_aware_port)
+    , _compression(std::move(compression)) {
+    if (_shard_aware_port) {
+        _shard_aware_server.reset(new rpc_protocol_server_wrapper(*_rpc,
+                ipv4_addr{_listen_address.raw_addr(), uint16_t(_shard_aware_port + engine().cpu_id())}));
+    }
+    if (_compression.mode != "none" && _compression.mode != "dc" && _compression.mode != "all") {
+        throw std::invalid_argument(sprint("Invalid internode_compression: %s", _compression.mode));
+    }
+    unsigned nr_clients = 0;
+    for (unsigned c = 0; c < static_cast<unsigned>(connection_class::LAST); ++c) {
+        _first_client[c] = nr_clients;
+        nr_clients += std::max(connections.count(static_cast<connection_class>(c)), 1u);
+    }
+    _first_client[static_cast<unsigned>(connection_class::LAST)] = nr_clients;
+    _clients.resize(nr_clients);
 }
 
 messaging_service::~messaging_service() = default;
@@ -270,11 +419,11 @@ gms::inet_address messaging_service::listen_address() {
 
 future<> messaging_service::stop() {
     return when_all(_server->stop(),
-        parallel_for_each(_clients[0], [](std::pair<const shard_id, shard_info>& c) {
-            return c.second.rpc_client->stop();
-        }),
-        parallel_for_each(_clients[1], [](std::pair<const shard_id, shard_info>& c) {
-            return c.second.rpc_client->stop();
+        _shard_aware_server ? _shard_aware_server->stop() : make_ready_future<>(),
+        parallel_for_each(_clients, [](std::unordered_map<shard_id, shard_info, shard_id::hash>& clients) {
+            return parallel_for_each(clients, [](std::pair<const shard_id, shard_info>& c) {
+                return c.second.rpc_client->stop();
+            });
         })
     ).discard_result();
 }
@@ -283,20 +432,111 @@ rpc::no_wait_type messaging_service::no_wait() {
     return rpc::no_wait;
 }
 
-static unsigned get_rpc_client_idx(messaging_verb verb) {
-    unsigned idx = 0;
-    if (verb == messaging_verb::GOSSIP_DIGEST_SYN ||
-        verb == messaging_verb::GOSSIP_DIGEST_ACK ||
-        verb == messaging_verb::GOSSIP_DIGEST_ACK2 ||
-        verb == messaging_verb::GOSSIP_SHUTDOWN ||
-        verb == messaging_verb::ECHO) {
-        idx = 1;
+connection_class get_connection_class(messaging_verb verb) {
+    switch (verb) {
+    case messaging_verb::GOSSIP_DIGEST_SYN:
+    case messaging_verb::GOSSIP_DIGEST_ACK:
+    case messaging_verb::GOSSIP_DIGEST_ACK2:
+    case messaging_verb::GOSSIP_SHUTDOWN:
+    case messaging_verb::ECHO:
+        return connection_class::gossip;
+    case messaging_verb::STREAM_INIT_MESSAGE:
+    case messaging_verb::PREPARE_MESSAGE:
+    case messaging_verb::PREPARE_DONE_MESSAGE:
+    case messaging_verb::STREAM_MUTATION:
+    case messaging_verb::STREAM_MUTATION_DONE:
+    case messaging_verb::INCOMING_FILE_MESSAGE:
+    case messaging_verb::OUTGOING_FILE_MESSAGE:
+    case messaging_verb::RECEIVED_MESSAGE:
+    case messaging_verb::RETRY_MESSAGE:
+    case messaging_verb::COMPLETE_MESSAGE:
+    case messaging_verb::SESSION_FAILED_MESSAGE:
+    case messaging_verb::STREAM_MUTATIONS:
+    case messaging_verb::CACHE_HOT_KEYS:
+        return connection_class::streaming;
+    case messaging_verb::REPAIR_MESSAGE:
+    case messaging_verb::REPAIR_MERKLE_TREE:
+    case messaging_verb::REPAIR_ROW_HASHES:
+    case messaging_verb::REPAIR_GET_ROWS:
+    case messaging_verb::REPAIR_PUT_ROWS:
+        return connection_class::repair;
+    default:
+        return connection_class::request_response;
     }
-    return idx;
 }
 
-shared_ptr<messaging_service::rpc_protocol_client_wrapper> messaging_service::get_rpc_client(messaging_verb verb, shard_id id) {
-    auto idx = get_rpc_client_idx(verb);
+bool is_shard_routed(messaging_verb verb) {
+    switch (verb) {
+    case messaging_verb::MUTATION:
+    case messaging_verb::MUTATIONS:
+    case messaging_verb::MUTATION_DONE:
+    case messaging_verb::COUNTER_MUTATION:
+    case messaging_verb::READ_DATA:
+    case messaging_verb::READ_MUTATION_DATA:
+    case messaging_verb::READ_DIGEST:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, connection_class c) {
+    switch (c) {
+    case connection_class::gossip: return os << "gossip";
+    case connection_class::request_response: return os << "request_response";
+    case connection_class::streaming: return os << "streaming";
+    case connection_class::repair: return os << "repair";
+    default: return os << "unknown";
+    }
+}
+
+bool messaging_service::should_compress(gms::inet_address peer) const {
+    if (_compression.mode == "all") {
+        return true;
+    }
+    if (_compression.mode == "dc") {
+        auto& snitch = locator::i_endpoint_snitch::get_local_snitch_ptr();
+        return snitch->get_datacenter(peer) != snitch->get_datacenter(utils::fb_utilities::get_broadcast_address());
+    }
+    return false;
+}
+
+void messaging_service::refresh_payload_tokens() {
+    if (payload_tokens) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - _payload_tokens_checked > std::chrono::seconds(1)) {
+        _payload_tokens_checked = now;
+        payload_tokens = gms::get_local_gossiper().cluster_supports_feature(gms::versioned_value::MUTATION_TOKENS);
+    }
+}
+
+template <typename Func>
+auto messaging_service::with_payload_compression(gms::inet_address peer, Func&& func) {
+    if (!should_compress(peer)) {
+        return func();
+    }
+    payload_compression c{_compression.threshold, &_compression_stats[peer]};
+    current_payload_compression = &c;
+    auto reset = defer([] { current_payload_compression = nullptr; });
+    return func();
+}
+
+shard_id messaging_service::connection_id(messaging_verb verb, shard_id id) const {
+    if (is_shard_routed(verb) && gms::get_local_gossiper().get_shard_aware_storage_port(id.addr)) {
+        return id;
+    }
+    return shard_id{id.addr, shard_id::any_cpu};
+}
+
+unsigned messaging_service::get_rpc_client_idx(messaging_verb verb) {
+    auto c = static_cast<unsigned>(get_connection_class(verb));
+    auto nr = _first_client[c + 1] - _first_client[c];
+    return _first_client[c] + _next_client[c]++ % nr;
+}
+
+shared_ptr<messaging_service::rpc_protocol_client_wrapper> messaging_service::get_rpc_client(unsigned idx, shard_id id) {
     auto it = _clients[idx].find(id);
 
     if (it != _clients[idx].end()) {
@@ -304,17 +544,20 @@ shared_ptr<messaging_service::rpc_protocol_client_wrapper> messaging_service::ge
         if (!c->error()) {
             return c;
         }
-        remove_rpc_client(verb, id);
+        remove_rpc_client(idx, id);
     }
 
-    auto remote_addr = ipv4_addr(id.addr.raw_addr(), _port);
+    auto port = _port;
+    if (id.cpu_id != shard_id::any_cpu) {
+        port = gms::get_local_gossiper().get_shard_aware_storage_port(id.addr) + id.cpu_id;
+    }
+    auto remote_addr = ipv4_addr(id.addr.raw_addr(), port);
     auto client = make_shared<rpc_protocol_client_wrapper>(*_rpc, remote_addr, ipv4_addr{_listen_address.raw_addr(), 0});
     it = _clients[idx].emplace(id, shard_info(std::move(client))).first;
     return it->second.rpc_client;
 }
 
-void messaging_service::remove_rpc_client(messaging_verb verb, shard_id id) {
-    auto idx = get_rpc_client_idx(verb);
+void messaging_service::remove_rpc_client(unsigned idx, shard_id id) {
     _clients[idx].erase(id);
 }
 
@@ -331,10 +574,16 @@ void register_handler(messaging_service* ms, messaging_verb verb, Func&& func) {
 // Send a message for verb
 template <typename MsgIn, typename... MsgOut>
 auto send_message(messaging_service* ms, messaging_verb verb, shard_id id, MsgOut&&... msg) {
-    auto rpc_client_ptr = ms->get_rpc_client(verb, id);
+    auto idx = ms->get_rpc_client_idx(verb);
+    auto cid = ms->connection_id(verb, id);
+    auto rpc_client_ptr = ms->get_rpc_client(idx, cid);
     auto rpc_handler = ms->rpc()->make_client<MsgIn(MsgOut...)>(verb);
     auto& rpc_client = *rpc_client_ptr;
-    return rpc_handler(rpc_client, std::forward<MsgOut>(msg)...).then_wrapped([ms = ms->shared_from_this(), id, verb, rpc_client_ptr = std::move(rpc_client_ptr)] (auto&& f) {
+    ms->refresh_payload_tokens();
+    auto sent = ms->with_payload_compression(id.addr, [&] {
+        return rpc_handler(rpc_client, std::forward<MsgOut>(msg)...);
+    });
+    return sent.then_wrapped([ms = ms->shared_from_this(), idx, cid, verb, rpc_client_ptr = std::move(rpc_client_ptr)] (auto&& f) {
         try {
             if (f.failed()) {
                 ms->increment_dropped_messages(verb);
@@ -344,7 +593,7 @@ auto send_message(messaging_service* ms, messaging_verb verb, shard_id id, MsgOu
             return std::move(f);
         } catch (rpc::closed_error) {
             // This is a transport error
-            ms->remove_rpc_client(verb, id);
+            ms->remove_rpc_client(idx, cid);
             throw;
         } catch (...) {
             // This is expected to be a rpc server error, e.g., the rpc handler throws a std::runtime_error.
@@ -356,10 +605,16 @@ auto send_message(messaging_service* ms, messaging_verb verb, shard_id id, MsgOu
 // TODO: Remove duplicated code in send_message
 template <typename MsgIn, typename... MsgOut>
 auto send_message_timeout(messaging_service* ms, messaging_verb verb, shard_id id, std::chrono::milliseconds timeout, MsgOut&&... msg) {
-    auto rpc_client_ptr = ms->get_rpc_client(verb, id);
+    auto idx = ms->get_rpc_client_idx(verb);
+    auto cid = ms->connection_id(verb, id);
+    auto rpc_client_ptr = ms->get_rpc_client(idx, cid);
     auto rpc_handler = ms->rpc()->make_client<MsgIn(MsgOut...)>(verb);
     auto& rpc_client = *rpc_client_ptr;
-    return rpc_handler(rpc_client, timeout, std::forward<MsgOut>(msg)...).then_wrapped([ms = ms->shared_from_this(), id, verb, rpc_client_ptr = std::move(rpc_client_ptr)] (auto&& f) {
+    ms->refresh_payload_tokens();
+    auto sent = ms->with_payload_compression(id.addr, [&] {
+        return rpc_handler(rpc_client, timeout, std::forward<MsgOut>(msg)...);
+    });
+    return sent.then_wrapped([ms = ms->shared_from_this(), idx, cid, verb, rpc_client_ptr = std::move(rpc_client_ptr)] (auto&& f) {
         try {
             if (f.failed()) {
                 ms->increment_dropped_messages(verb);
@@ -369,7 +624,7 @@ auto send_message_timeout(messaging_service* ms, messaging_verb verb, shard_id i
             return std::move(f);
         } catch (rpc::closed_error) {
             // This is a transport error
-            ms->remove_rpc_client(verb, id);
+            ms->remove_rpc_client(idx, cid);
             throw;
         } catch (...) {
             // This is expected to be a rpc server error, e.g., the rpc handler throws a std::runtime_error.
@@ -417,6 +672,13 @@ future<> messaging_service::send_stream_mutation(shard_id id, UUID plan_id, froz
     return send_message<void>(this, messaging_verb::STREAM_MUTATION, std::move(id), std::move(plan_id), std::move(fm), std::move(dst_cpu_id));
 }
 
+void messaging_service::register_stream_mutations(std::function<future<> (UUID plan_id, inet_address from, std::vector<frozen_mutation> fms, unsigned dst_cpu_id)>&& func) {
+    register_handler(this, messaging_verb::STREAM_MUTATIONS, std::move(func));
+}
+future<> messaging_service::send_stream_mutations(shard_id id, UUID plan_id, inet_address from, const std::vector<lw_shared_ptr<const frozen_mutation>>& fms, unsigned dst_cpu_id) {
+    return send_message<void>(this, messaging_verb::STREAM_MUTATIONS, std::move(id), std::move(plan_id), std::move(from), fms, std::move(dst_cpu_id));
+}
+
 void messaging_service::register_stream_mutation_done(std::function<future<> (UUID plan_id, UUID cf_id, inet_address from, inet_address connecting, unsigned dst_cpu_id)>&& func) {
     register_handler(this, messaging_verb::STREAM_MUTATION_DONE, std::move(func));
 }
@@ -424,6 +686,16 @@ future<> messaging_service::send_stream_mutation_done(shard_id id, UUID plan_id,
     return send_message<void>(this, messaging_verb::STREAM_MUTATION_DONE, std::move(id), std::move(plan_id), std::move(cf_id), std::move(from), std::move(connecting), std::move(dst_cpu_id));
 }
 
+void messaging_service::register_incoming_file_message(std::function<future<> (UUID plan_id, UUID cf_id, inet_address from, sstring name,
+        temporary_buffer<char> data, bool last, unsigned dst_cpu_id)>&& func) {
+    register_handler(this, messaging_verb::INCOMING_FILE_MESSAGE, std::move(func));
+}
+future<> messaging_service::send_incoming_file_message(shard_id id, UUID plan_id, UUID cf_id, inet_address from, sstring name,
+        temporary_buffer<char> data, bool last, unsigned dst_cpu_id) {
+    return send_message<void>(this, messaging_verb::INCOMING_FILE_MESSAGE, std::move(id), std::move(plan_id), std::move(cf_id),
+            std::move(from), std::move(name), std::move(data), std::move(last), std::move(dst_cpu_id));
+}
+
 void messaging_service::register_complete_message(std::function<rpc::no_wait_type (UUID plan_id, inet_address from, inet_address connecting, unsigned dst_cpu_id)>&& func) {
     register_handler(this, messaging_verb::COMPLETE_MESSAGE, std::move(func));
 }
@@ -491,6 +763,16 @@ future<std::vector<frozen_mutation>> messaging_service::send_migration_request(s
     return send_message<std::vector<frozen_mutation>>(this, messaging_verb::MIGRATION_REQUEST, std::move(id), std::move(reply_to), std::move(shard));
 }
 
+void messaging_service::register_keyspace_migration_request(std::function<future<std::vector<frozen_mutation>> (std::vector<sstring> keyspaces, std::vector<utils::UUID> digests)>&& func) {
+    register_handler(this, net::messaging_verb::KEYSPACE_MIGRATION_REQUEST, std::move(func));
+}
+void messaging_service::unregister_keyspace_migration_request() {
+    _rpc->unregister_handler(net::messaging_verb::KEYSPACE_MIGRATION_REQUEST);
+}
+future<std::vector<frozen_mutation>> messaging_service::send_keyspace_migration_request(shard_id id, std::vector<sstring> keyspaces, std::vector<utils::UUID> digests) {
+    return send_message<std::vector<frozen_mutation>>(this, messaging_verb::KEYSPACE_MIGRATION_REQUEST, std::move(id), std::move(keyspaces), std::move(digests));
+}
+
 void messaging_service::register_mutation(std::function<rpc::no_wait_type (frozen_mutation fm, std::vector<inet_address> forward,
     inet_address reply_to, unsigned shard, response_id_type response_id)>&& func) {
     register_handler(this, net::messaging_verb::MUTATION, std::move(func));
@@ -504,6 +786,59 @@ future<> messaging_service::send_mutation(shard_id id, const frozen_mutation& fm
         std::move(reply_to), std::move(shard), std::move(response_id));
 }
 
+void messaging_service::register_mutations(std::function<rpc::no_wait_type (std::vector<frozen_mutation> fms, std::vector<std::vector<inet_address>> forward,
+    inet_address reply_to, unsigned shard, std::vector<response_id_type> response_ids)>&& func) {
+    register_handler(this, net::messaging_verb::MUTATIONS, std::move(func));
+}
+void messaging_service::unregister_mutations() {
+    _rpc->unregister_handler(net::messaging_verb::MUTATIONS);
+}
+future<> messaging_service::send_mutations(shard_id id, const std::vector<lw_shared_ptr<const frozen_mutation>>& fms, std::vector<std::vector<inet_address>> forward,
+    inet_address reply_to, unsigned shard, std::vector<response_id_type> response_ids) {
+    return send_message_oneway(this, messaging_verb::MUTATIONS, std::move(id), fms, std::move(forward),
+        std::move(reply_to), std::move(shard), std::move(response_ids));
+}
+
+void messaging_service::register_counter_mutation(std::function<future<> (frozen_mutation fm, int32_t cl)>&& func) {
+    register_handler(this, net::messaging_verb::COUNTER_MUTATION, std::move(func));
+}
+void messaging_service::unregister_counter_mutation() {
+    _rpc->unregister_handler(net::messaging_verb::COUNTER_MUTATION);
+}
+future<> messaging_service::send_counter_mutation(shard_id id, const frozen_mutation& fm, int32_t cl) {
+    return send_message<void>(this, messaging_verb::COUNTER_MUTATION, std::move(id), fm, std::move(cl));
+}
+
+void messaging_service::register_paxos_prepare(std::function<future<service::paxos::prepare_response> (query::read_command cmd, query::partition_range pr, utils::UUID ballot)>&& func) {
+    register_handler(this, net::messaging_verb::PAXOS_PREPARE, std::move(func));
+}
+void messaging_service::unregister_paxos_prepare() {
+    _rpc->unregister_handler(net::messaging_verb::PAXOS_PREPARE);
+}
+future<service::paxos::prepare_response> messaging_service::send_paxos_prepare(shard_id id, query::read_command& cmd, query::partition_range& pr, utils::UUID ballot) {
+    return send_message<service::paxos::prepare_response>(this, messaging_verb::PAXOS_PREPARE, std::move(id), cmd, pr, std::move(ballot));
+}
+
+void messaging_service::register_paxos_propose(std::function<future<bool> (service::paxos::proposal p)>&& func) {
+    register_handler(this, net::messaging_verb::PAXOS_PROPOSE, std::move(func));
+}
+void messaging_service::unregister_paxos_propose() {
+    _rpc->unregister_handler(net::messaging_verb::PAXOS_PROPOSE);
+}
+future<bool> messaging_service::send_paxos_propose(shard_id id, const service::paxos::proposal& p) {
+    return send_message<bool>(this, messaging_verb::PAXOS_PROPOSE, std::move(id), p);
+}
+
+void messaging_service::register_paxos_commit(std::function<future<> (service::paxos::proposal p)>&& func) {
+    register_handler(this, net::messaging_verb::PAXOS_COMMIT, std::move(func));
+}
+void messaging_service::unregister_paxos_commit() {
+    _rpc->unregister_handler(net::messaging_verb::PAXOS_COMMIT);
+}
+future<> messaging_service::send_paxos_commit(shard_id id, const service::paxos::proposal& p) {
+    return send_message<void>(this, messaging_verb::PAXOS_COMMIT, std::move(id), p);
+}
+
 void messaging_service::register_mutation_done(std::function<rpc::no_wait_type (const rpc::client_info& cinfo, unsigned shard, response_id_type response_id)>&& func) {
     register_handler(this, net::messaging_verb::MUTATION_DONE, std::move(func));
 }
@@ -544,6 +879,84 @@ future<query::result_digest> messaging_service::send_read_digest(shard_id id, qu
     return send_message<query::result_digest>(this, net::messaging_verb::READ_DIGEST, std::move(id), cmd, pr);
 }
 
+// Wrapper for AGGREGATE
+void messaging_service::register_aggregate(std::function<future<query::partial_aggregates> (query::read_command cmd, std::vector<query::partition_range> ranges,
+        std::vector<query::aggregate> aggregates, int32_t cl)>&& func) {
+    register_handler(this, net::messaging_verb::AGGREGATE, std::move(func));
+}
+void messaging_service::unregister_aggregate() {
+    _rpc->unregister_handler(net::messaging_verb::AGGREGATE);
+}
+future<query::partial_aggregates> messaging_service::send_aggregate(shard_id id, query::read_command& cmd, std::vector<query::partition_range>& ranges,
+        std::vector<query::aggregate>& aggregates, int32_t cl) {
+    return send_message<query::partial_aggregates>(this, net::messaging_verb::AGGREGATE, std::move(id), cmd, ranges, aggregates, std::move(cl));
+}
+
+// Wrapper for REPAIR_MERKLE_TREE
+void messaging_service::register_repair_merkle_tree(std::function<future<merkle_tree> (sstring keyspace, sstring cf,
+        query::range<dht::token> range, uint32_t depth)>&& func) {
+    register_handler(this, net::messaging_verb::REPAIR_MERKLE_TREE, std::move(func));
+}
+void messaging_service::unregister_repair_merkle_tree() {
+    _rpc->unregister_handler(net::messaging_verb::REPAIR_MERKLE_TREE);
+}
+future<merkle_tree> messaging_service::send_repair_merkle_tree(shard_id id, sstring keyspace, sstring cf,
+        query::range<dht::token> range, uint32_t depth) {
+    return send_message<merkle_tree>(this, net::messaging_verb::REPAIR_MERKLE_TREE, std::move(id),
+        std::move(keyspace), std::move(cf), std::move(range), std::move(depth));
+}
+
+// Wrapper for REPAIR_ROW_HASHES
+void messaging_service::register_repair_row_hashes(std::function<future<repair_row_hashes> (sstring keyspace, sstring cf,
+        query::range<dht::token> range, repair_row_window window, uint32_t limit, bool with_rows)>&& func) {
+    register_handler(this, net::messaging_verb::REPAIR_ROW_HASHES, std::move(func));
+}
+void messaging_service::unregister_repair_row_hashes() {
+    _rpc->unregister_handler(net::messaging_verb::REPAIR_ROW_HASHES);
+}
+future<repair_row_hashes> messaging_service::send_repair_row_hashes(shard_id id, sstring keyspace, sstring cf,
+        query::range<dht::token> range, repair_row_window window, uint32_t limit, bool with_rows) {
+    return send_message<repair_row_hashes>(this, net::messaging_verb::REPAIR_ROW_HASHES, std::move(id),
+        std::move(keyspace), std::move(cf), std::move(range), std::move(window), std::move(limit), std::move(with_rows));
+}
+
+// Wrapper for REPAIR_GET_ROWS
+void messaging_service::register_repair_get_rows(std::function<future<std::vector<frozen_mutation>> (const rpc::client_info& cinfo, sstring keyspace, sstring cf,
+        query::range<dht::token> range, repair_row_window window, std::vector<repair_row_key> keys)>&& func) {
+    register_handler(this, net::messaging_verb::REPAIR_GET_ROWS, std::move(func));
+}
+void messaging_service::unregister_repair_get_rows() {
+    _rpc->unregister_handler(net::messaging_verb::REPAIR_GET_ROWS);
+}
+future<std::vector<frozen_mutation>> messaging_service::send_repair_get_rows(shard_id id, sstring keyspace, sstring cf,
+        query::range<dht::token> range, repair_row_window window, std::vector<repair_row_key> keys) {
+    return send_message<std::vector<frozen_mutation>>(this, net::messaging_verb::REPAIR_GET_ROWS, std::move(id),
+        std::move(keyspace), std::move(cf), std::move(range), std::move(window), std::move(keys));
+}
+
+// Wrapper for REPAIR_PUT_ROWS
+void messaging_service::register_repair_put_rows(std::function<future<> (std::vector<frozen_mutation> rows)>&& func) {
+    register_handler(this, net::messaging_verb::REPAIR_PUT_ROWS, std::move(func));
+}
+void messaging_service::unregister_repair_put_rows() {
+    _rpc->unregister_handler(net::messaging_verb::REPAIR_PUT_ROWS);
+}
+future<> messaging_service::send_repair_put_rows(shard_id id, const std::vector<frozen_mutation>& rows) {
+    return send_message<void>(this, net::messaging_verb::REPAIR_PUT_ROWS, std::move(id), rows);
+}
+
+// Wrapper for CACHE_HOT_KEYS
+void messaging_service::register_cache_hot_keys(std::function<future<db::cache_hot_keys> (std::vector<query::range<dht::token>> ranges,
+        uint32_t limit)>&& func) {
+    register_handler(this, net::messaging_verb::CACHE_HOT_KEYS, std::move(func));
+}
+void messaging_service::unregister_cache_hot_keys() {
+    _rpc->unregister_handler(net::messaging_verb::CACHE_HOT_KEYS);
+}
+future<db::cache_hot_keys> messaging_service::send_cache_hot_keys(shard_id id, std::vector<query::range<dht::token>> ranges, uint32_t limit) {
+    return send_message<db::cache_hot_keys>(this, net::messaging_verb::CACHE_HOT_KEYS, std::move(id), std::move(ranges), std::move(limit));
+}
+
 // Wrapper for TRUNCATE
 void messaging_service::register_truncate(std::function<future<> (sstring, sstring)>&& func) {
     register_handler(this, net::messaging_verb::TRUNCATE, std::move(func));
@@ -32,6 +32,7 @@
 #include "gms/inet_address.hh"
 #include "rpc/rpc_types.hh"
 #include <unordered_map>
+#include <limits>
 #include "frozen_mutation.hh"
 #include "query-request.hh"
 #include "db/serializer.hh"
@@ -43,6 +44,11 @@ namespace streaming { namespace messages {
     class prepare_message;
 }}
 
+namespace service { namespace paxos {
+    class proposal;
+    class prepare_response;
+}}
+
 namespace gms {
     class gossip_digest_syn;
     class gossip_digest_ack;
@@ -50,6 +56,10 @@ namespace gms {
 }
 
 class frozen_mutation;
+class merkle_tree;
+class repair_row_key;
+class repair_row_window;
+class repair_row_hashes;
 
 namespace utils {
     class UUID;
@@ -57,6 +67,7 @@ namespace utils {
 
 namespace db {
 class seed_provider_type;
+class cache_hot_keys;
 }
 
 namespace net {
@@ -119,9 +130,38 @@ enum class messaging_verb : int32_t {
     RETRY_MESSAGE,
     COMPLETE_MESSAGE,
     SESSION_FAILED_MESSAGE,
+    MUTATIONS, // scylla-only, several MUTATIONs for the same replica
+    AGGREGATE, // scylla-only, partial aggregates over token ranges
+    REPAIR_MERKLE_TREE, // scylla-only, hash tree of a table over a token range
+    REPAIR_ROW_HASHES, // scylla-only, hashes of a window of rows of a table
+    REPAIR_GET_ROWS, // scylla-only, rows of a window, for row-level repair
+    REPAIR_PUT_ROWS, // scylla-only, rows to apply, for row-level repair
+    STREAM_MUTATIONS, // scylla-only, several STREAM_MUTATIONs in one message
+    KEYSPACE_MIGRATION_REQUEST, // scylla-only, MIGRATION_REQUEST for the keyspaces whose schema differs
+    CACHE_HOT_KEYS, // scylla-only, keys of the hottest cached partitions, for a joining node to warm up its cache
+    LAST,
+};
+
+// Verbs of different classes are sent over different connections, so that
+// large streaming or repair messages do not delay gossip or the reads and
+// writes of clients queued behind them.
+enum class connection_class : unsigned {
+    gossip,
+    request_response,
+    streaming,
+    repair,
     LAST,
 };
 
+connection_class get_connection_class(messaging_verb verb);
+
+// Whether a message of the verb is sent to the very shard of the peer which
+// its shard_id names, when the peer listens on shard-aware ports, so that the
+// handler runs on the shard owning the data instead of hopping to it.
+bool is_shard_routed(messaging_verb verb);
+
+std::ostream& operator<<(std::ostream& os, connection_class c);
+
 } // namespace net
 
 namespace std {
@@ -136,6 +176,38 @@ class hash<net::messaging_verb> {
 
 namespace net {
 
+struct payload_compression_stats {
+    uint64_t uncompressed_bytes = 0;
+    uint64_t compressed_bytes = 0;
+};
+
+// The compression of the large payloads of the message being serialized,
+// set by send_message() while it serializes the arguments of a message to a
+// peer whose traffic internode_compression says to compress. Replies are
+// serialized by the rpc layer later on, so only requests are compressed.
+// Compressed payloads are flagged on the wire, so receiving them needs no
+// setting: either end of a connection decides what it sends.
+struct payload_compression {
+    size_t threshold;
+    payload_compression_stats* stats;
+};
+
+extern thread_local const payload_compression* current_payload_compression;
+
+constexpr uint32_t compressed_payload_flag = 0x80000000;
+
+// Whether frozen_mutations are sent with the tokens they carry, which is
+// the case once every node of the cluster advertises MUTATION_TOKENS, see
+// messaging_service::refresh_payload_tokens(). A token sent is flagged in
+// the size of the payload, and trusted by the receiver.
+extern thread_local bool payload_tokens;
+
+constexpr uint32_t token_payload_flag = 0x40000000;
+
+// Returns the payload compressed with LZ4, or nothing if it does not shrink.
+std::experimental::optional<bytes> compress_payload(bytes_view payload);
+bytes uncompress_payload(bytes_view compressed, size_t size);
+
 // NOTE: operator(input_stream<char>&, T&) takes a reference to uninitialized
 //       T object and should use placement new in case T is non POD
 struct serializer {
@@ -256,14 +328,86 @@ struct serializer {
         return v;
     }
 
+    // For temporary_buffer<char>, the chunks of sstable files streaming sends
+    template <typename Output>
+    void write(Output& out, const temporary_buffer<char>& v) const {
+        write(out, uint32_t(v.size()));
+        out.write(v.get(), v.size());
+    }
+    template <typename Input>
+    temporary_buffer<char> read(Input& in, rpc::type<temporary_buffer<char>>) const {
+        auto sz = read(in, rpc::type<uint32_t>());
+        temporary_buffer<char> v(sz);
+        in.read(v.get_write(), sz);
+        return v;
+    }
+
     // For frozen_mutation
+    // Same format as write_serializable() produces, but the representation is
+    // copied only once, directly between the rpc stream and the frozen_mutation,
+    // instead of going through intermediate buffers. On the replica it is then
+    // appended to the commitlog and applied to the memtable as is.
+    // When compressed, the size carries compressed_payload_flag and covers the
+    // size of the representation and the compressed representation.
+    // When it carries token_payload_flag, the token follows the size of the
+    // representation, as the size of its data and the data; it is not
+    // covered by the size.
     template <typename Output>
     void write(Output& out, const frozen_mutation& v) const{
-        return write_serializable(out, v);
+        bytes_view repr = v.representation();
+        auto& token = v.carried_token();
+        uint32_t flags = payload_tokens && token ? token_payload_flag : 0;
+        auto write_token = [&] {
+            if (flags & token_payload_flag) {
+                write(out, uint16_t(token->_data.size()));
+                out.write(reinterpret_cast<const char*>(token->_data.begin()), token->_data.size());
+            }
+        };
+        auto c = current_payload_compression;
+        if (c && repr.size() >= c->threshold) {
+            auto compressed = compress_payload(repr);
+            c->stats->uncompressed_bytes += repr.size();
+            c->stats->compressed_bytes += compressed ? compressed->size() : repr.size();
+            if (compressed) {
+                write(out, uint32_t(flags | compressed_payload_flag | (sizeof(uint32_t) + compressed->size())));
+                write(out, uint32_t(repr.size()));
+                write_token();
+                out.write(reinterpret_cast<const char*>(compressed->begin()), compressed->size());
+                return;
+            }
+        }
+        write(out, uint32_t(flags | data_output::serialized_size(repr)));
+        write(out, uint32_t(repr.size()));
+        write_token();
+        out.write(reinterpret_cast<const char*>(repr.begin()), repr.size());
     }
     template <typename Input>
     frozen_mutation read(Input& in, rpc::type<frozen_mutation>) const {
-        return read_serializable<frozen_mutation>(in);
+        auto sz = read(in, rpc::type<uint32_t>());
+        auto repr_size = read(in, rpc::type<uint32_t>());
+        std::experimental::optional<dht::token> token;
+        if (sz & token_payload_flag) {
+            auto token_size = read(in, rpc::type<uint16_t>());
+            bytes data(bytes::initialized_later(), token_size);
+            in.read(reinterpret_cast<char*>(data.begin()), token_size);
+            token = dht::token(dht::token::kind::key, std::move(data));
+            sz &= ~token_payload_flag;
+        }
+        auto make = [&token] (bytes repr) {
+            return token ? frozen_mutation(std::move(repr), std::move(*token)) : frozen_mutation(std::move(repr));
+        };
+        if (sz & compressed_payload_flag) {
+            auto compressed_size = (sz & ~compressed_payload_flag) - sizeof(uint32_t);
+            bytes compressed(bytes::initialized_later(), compressed_size);
+            in.read(reinterpret_cast<char*>(compressed.begin()), compressed_size);
+            return make(uncompress_payload(compressed, repr_size));
+        }
+        if (sz != sizeof(uint32_t) + repr_size) {
+            throw std::runtime_error("frozen_mutation size mismatch");
+        }
+        bytes repr(bytes::initialized_later(), repr_size);
+        in.read(reinterpret_cast<char*>(repr.begin()), repr_size);
+        return make(std::move(repr));
     }
 
     // For reconcilable_result
@@ -340,11 +484,56 @@ struct serializer {
     template <typename Input>
     query::result_digest read(Input& in, rpc::type<query::result_digest>) const;
 
+    template <typename Output>
+    void write(Output& out, const query::aggregate& v) const;
+    template <typename Input>
+    query::aggregate read(Input& in, rpc::type<query::aggregate>) const;
+
+    template <typename Output>
+    void write(Output& out, const query::partial_aggregates& v) const;
+    template <typename Input>
+    query::partial_aggregates read(Input& in, rpc::type<query::partial_aggregates>) const;
+
     template <typename Output>
     void write(Output& out, const utils::UUID& v) const;
     template <typename Input>
     utils::UUID read(Input& in, rpc::type<utils::UUID>) const;
 
+    template <typename Output>
+    void write(Output& out, const service::paxos::proposal& v) const;
+    template <typename Input>
+    service::paxos::proposal read(Input& in, rpc::type<service::paxos::proposal>) const;
+
+    template <typename Output>
+    void write(Output& out, const service::paxos::prepare_response& v) const;
+    template <typename Input>
+    service::paxos::prepare_response read(Input& in, rpc::type<service::paxos::prepare_response>) const;
+
+    template <typename Output>
+    void write(Output& out, const merkle_tree& v) const;
+    template <typename Input>
+    merkle_tree read(Input& in, rpc::type<merkle_tree>) const;
+
+    template <typename Output>
+    void write(Output& out, const repair_row_key& v) const;
+    template <typename Input>
+    repair_row_key read(Input& in, rpc::type<repair_row_key>) const;
+
+    template <typename Output>
+    void write(Output& out, const repair_row_window& v) const;
+    template <typename Input>
+    repair_row_window read(Input& in, rpc::type<repair_row_window>) const;
+
+    template <typename Output>
+    void write(Output& out, const repair_row_hashes& v) const;
+    template <typename Input>
+    repair_row_hashes read(Input& in, rpc::type<repair_row_hashes>) const;
+
+    template <typename Output>
+    void write(Output& out, const db::cache_hot_keys& v) const;
+    template <typename Input>
+    db::cache_hot_keys read(Input& in, rpc::type<db::cache_hot_keys>) const;
+
     // for query::range<T>
     template <typename Output, typename T>
     void write(Output& out, const query::range<T>& v) const;
@@ -386,6 +575,8 @@ read(serializer s, Input& in, rpc::type<T> type) {
 }
 
 struct shard_id {
+    // The cpu_id of a connection to whichever shard of the peer accepts it.
+    static constexpr uint32_t any_cpu = std::numeric_limits<uint32_t>::max();
     gms::inet_address addr;
     uint32_t cpu_id;
     friend bool operator==(const shard_id& x, const shard_id& y);
@@ -415,8 +606,35 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
         rpc::stats get_stats() const;
     };
 
+    // The number of connections to each peer shard of each connection class.
+    // The messages of a class are spread over its connections in turn.
+    struct connections_config {
+        unsigned gossip = 1;
+        unsigned request_response = 1;
+        unsigned streaming = 1;
+        unsigned repair = 1;
+        // Shard n also listens on this port + n for the messages addressed to
+        // it, unless 0.
+        uint16_t shard_aware_port = 0;
+
+        unsigned count(connection_class c) const;
+    };
+
     void foreach_client(std::function<void(const shard_id& id, const shard_info& info)> f) const;
 
+    void foreach_client(connection_class c, std::function<void(const shard_id& id, const shard_info& info)> f) const;
+
+    // What internode_compression says of the traffic to compress, and the
+    // size from which a payload is compressed.
+    struct compression_config {
+        sstring mode = "none";
+        size_t threshold = 512;
+    };
+
+    const std::unordered_map<gms::inet_address, payload_compression_stats>& get_compression_stats() const {
+        return _compression_stats;
+    }
+
     void increment_dropped_messages(messaging_verb verb);
 
     uint64_t get_dropped_messages(messaging_verb verb) const;
@@ -433,13 +651,24 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
     uint16_t _port;
     std::unique_ptr<rpc_protocol_wrapper> _rpc;
     std::unique_ptr<rpc_protocol_server_wrapper> _server;
-    std::unordered_map<shard_id, shard_info, shard_id::hash> _clients[2];
+    uint16_t _shard_aware_port;
+    std::unique_ptr<rpc_protocol_server_wrapper> _shard_aware_server;
+    // The connections of class c are _clients[_first_client[c]] up to but
+    // excluding _clients[_first_client[c + 1]].
+    std::vector<std::unordered_map<shard_id, shard_info, shard_id::hash>> _clients;
+    unsigned _first_client[static_cast<unsigned>(connection_class::LAST) + 1];
+    unsigned _next_client[static_cast<unsigned>(connection_class::LAST)] = {};
     uint64_t _dropped_messages[static_cast<int32_t>(messaging_verb::LAST)] = {};
+    compression_config _compression;
+    std::unordered_map<gms::inet_address, payload_compression_stats> _compression_stats;
+    std::chrono::steady_clock::time_point _payload_tokens_checked;
 public:
-    messaging_service(gms::inet_address ip = gms::inet_address("0.0.0.0"));
+    messaging_service(gms::inet_address ip = gms::inet_address("0.0.0.0"), connections_config connections = {},
+            compression_config compression = {});
     ~messaging_service();
 public:
     uint16_t port();
+    uint16_t shard_aware_port() const { return _shard_aware_port; }
     gms::inet_address listen_address();
     future<> stop();
     static rpc::no_wait_type no_wait();
@@ -462,9 +691,21 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
     void register_stream_mutation(std::function<future<> (UUID plan_id, frozen_mutation fm, unsigned dst_cpu_id)>&& func);
     future<> send_stream_mutation(shard_id id, UUID plan_id, frozen_mutation fm, unsigned dst_cpu_id);
 
+    // Wrapper for STREAM_MUTATIONS verb
+    void register_stream_mutations(std::function<future<> (UUID plan_id, inet_address from, std::vector<frozen_mutation> fms, unsigned dst_cpu_id)>&& func);
+    future<> send_stream_mutations(shard_id id, UUID plan_id, inet_address from, const std::vector<lw_shared_ptr<const frozen_mutation>>& fms, unsigned dst_cpu_id);
+
     void register_stream_mutation_done(std::function<future<> (UUID plan_id, UUID cf_id, inet_address from, inet_address connecting, unsigned dst_cpu_id)>&& func);
     future<> send_stream_mutation_done(shard_id id, UUID plan_id, UUID cf_id, inet_address from, inet_address connecting, unsigned dst_cpu_id);
 
+    // Wrapper for INCOMING_FILE_MESSAGE verb, which carries the next chunk of
+    // an sstable component file, by its name on the sending node. last marks
+    // the end of the file.
+    void register_incoming_file_message(std::function<future<> (UUID plan_id, UUID cf_id, inet_address from, sstring name,
+            temporary_buffer<char> data, bool last, unsigned dst_cpu_id)>&& func);
+    future<> send_incoming_file_message(shard_id id, UUID plan_id, UUID cf_id, inet_address from, sstring name,
+            temporary_buffer<char> data, bool last, unsigned dst_cpu_id);
+
     void register_complete_message(std::function<rpc::no_wait_type (UUID plan_id, inet_address from, inet_address connecting, unsigned dst_cpu_id)>&& func);
     future<> send_complete_message(shard_id id, UUID plan_id, inet_address from, inet_address connecting, unsigned dst_cpu_id);
 
@@ -498,6 +739,12 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
     void unregister_migration_request();
     future<std::vector<frozen_mutation>> send_migration_request(shard_id id, gms::inet_address reply_to, unsigned shard);
 
+    // Wrapper for KEYSPACE_MIGRATION_REQUEST, carrying the digests of the
+    // schema of the keyspaces of the requester
+    void register_keyspace_migration_request(std::function<future<std::vector<frozen_mutation>> (std::vector<sstring> keyspaces, std::vector<utils::UUID> digests)>&& func);
+    void unregister_keyspace_migration_request();
+    future<std::vector<frozen_mutation>> send_keyspace_migration_request(shard_id id, std::vector<sstring> keyspaces, std::vector<utils::UUID> digests);
+
     // FIXME: response_id_type is an alias in service::storage_proxy::response_id_type
     using response_id_type = uint64_t;
     // Wrapper for MUTATION
@@ -507,6 +754,35 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
     future<> send_mutation(shard_id id, const frozen_mutation& fm, std::vector<inet_address> forward,
         inet_address reply_to, unsigned shard, response_id_type response_id);
 
+    // Wrapper for MUTATIONS, each mutation is acknowledged by its own MUTATION_DONE
+    void register_mutations(std::function<rpc::no_wait_type (std::vector<frozen_mutation> fms, std::vector<std::vector<inet_address>> forward,
+        inet_address reply_to, unsigned shard, std::vector<response_id_type> response_ids)>&& func);
+    void unregister_mutations();
+    future<> send_mutations(shard_id id, const std::vector<lw_shared_ptr<const frozen_mutation>>& fms, std::vector<std::vector<inet_address>> forward,
+        inet_address reply_to, unsigned shard, std::vector<response_id_type> response_ids);
+
+    // Wrapper for COUNTER_MUTATION, sent to the replica leading a counter
+    // update, which resolves once the update was written at cl.
+    void register_counter_mutation(std::function<future<> (frozen_mutation fm, int32_t cl)>&& func);
+    void unregister_counter_mutation();
+    future<> send_counter_mutation(shard_id id, const frozen_mutation& fm, int32_t cl);
+
+    // Wrapper for PAXOS_PREPARE, which also runs the read of the
+    // conditional update on the replicas promising the ballot.
+    void register_paxos_prepare(std::function<future<service::paxos::prepare_response> (query::read_command cmd, query::partition_range pr, utils::UUID ballot)>&& func);
+    void unregister_paxos_prepare();
+    future<service::paxos::prepare_response> send_paxos_prepare(shard_id id, query::read_command& cmd, query::partition_range& pr, utils::UUID ballot);
+
+    // Wrapper for PAXOS_PROPOSE
+    void register_paxos_propose(std::function<future<bool> (service::paxos::proposal p)>&& func);
+    void unregister_paxos_propose();
+    future<bool> send_paxos_propose(shard_id id, const service::paxos::proposal& p);
+
+    // Wrapper for PAXOS_COMMIT
+    void register_paxos_commit(std::function<future<> (service::paxos::proposal p)>&& func);
+    void unregister_paxos_commit();
+    future<> send_paxos_commit(shard_id id, const service::paxos::proposal& p);
+
     // Wrapper for MUTATION_DONE
     void register_mutation_done(std::function<rpc::no_wait_type (const rpc::client_info& cinfo, unsigned shard, response_id_type response_id)>&& func);
     void unregister_mutation_done();
@@ -528,15 +804,68 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
     void unregister_read_digest();
     future<query::result_digest> send_read_digest(shard_id id, query::read_command& cmd, query::partition_range& pr);
 
+    // Wrapper for AGGREGATE
+    void register_aggregate(std::function<future<query::partial_aggregates> (query::read_command cmd, std::vector<query::partition_range> ranges,
+        std::vector<query::aggregate> aggregates, int32_t cl)>&& func);
+    void unregister_aggregate();
+    future<query::partial_aggregates> send_aggregate(shard_id id, query::read_command& cmd, std::vector<query::partition_range>& ranges,
+        std::vector<query::aggregate>& aggregates, int32_t cl);
+
+    // Wrapper for REPAIR_MERKLE_TREE, which builds the hash tree of the data
+    // of a table the replica holds in a token range.
+    void register_repair_merkle_tree(std::function<future<merkle_tree> (sstring keyspace, sstring cf,
+        query::range<dht::token> range, uint32_t depth)>&& func);
+    void unregister_repair_merkle_tree();
+    future<merkle_tree> send_repair_merkle_tree(shard_id id, sstring keyspace, sstring cf,
+        query::range<dht::token> range, uint32_t depth);
+
+    // Wrapper for REPAIR_ROW_HASHES, which reads up to limit rows of the
+    // window, with their hashes when with_rows is set.
+    void register_repair_row_hashes(std::function<future<repair_row_hashes> (sstring keyspace, sstring cf,
+        query::range<dht::token> range, repair_row_window window, uint32_t limit, bool with_rows)>&& func);
+    void unregister_repair_row_hashes();
+    future<repair_row_hashes> send_repair_row_hashes(shard_id id, sstring keyspace, sstring cf,
+        query::range<dht::token> range, repair_row_window window, uint32_t limit, bool with_rows);
+
+    // Wrapper for REPAIR_GET_ROWS
+    void register_repair_get_rows(std::function<future<std::vector<frozen_mutation>> (const rpc::client_info& cinfo, sstring keyspace, sstring cf,
+        query::range<dht::token> range, repair_row_window window, std::vector<repair_row_key> keys)>&& func);
+    void unregister_repair_get_rows();
+    future<std::vector<frozen_mutation>> send_repair_get_rows(shard_id id, sstring keyspace, sstring cf,
+        query::range<dht::token> range, repair_row_window window, std::vector<repair_row_key> keys);
+
+    // Wrapper for REPAIR_PUT_ROWS
+    void register_repair_put_rows(std::function<future<> (std::vector<frozen_mutation> rows)>&& func);
+    void unregister_repair_put_rows();
+    future<> send_repair_put_rows(shard_id id, const std::vector<frozen_mutation>& rows);
+
+    // Wrapper for CACHE_HOT_KEYS
+    void register_cache_hot_keys(std::function<future<db::cache_hot_keys> (std::vector<query::range<dht::token>> ranges, uint32_t limit)>&& func);
+    void unregister_cache_hot_keys();
+    future<db::cache_hot_keys> send_cache_hot_keys(shard_id id, std::vector<query::range<dht::token>> ranges, uint32_t limit);
+
     // Wrapper for TRUNCATE
     void register_truncate(std::function<future<>(sstring, sstring)>&& func);
     void unregister_truncate();
     future<> send_truncate(shard_id, std::chrono::milliseconds, sstring, sstring);
 
 public:
+    bool should_compress(gms::inet_address peer) const;
+    // Sets payload_tokens once the cluster supports them, checking gossip
+    // at most once a second.
+    void refresh_payload_tokens();
+    // The shard_id of the connection a message of the verb to id goes over.
+    shard_id connection_id(messaging_verb verb, shard_id id) const;
+    // Calls func, which serializes a message to the peer, with the
+    // compression of its payloads set up as internode_compression says.
+    template <typename Func>
+    auto with_payload_compression(gms::inet_address peer, Func&& func);
+    // Return the index of the connection the next message of the verb goes
+    // over.
+    unsigned get_rpc_client_idx(messaging_verb verb);
     // Return rpc::protocol::client for a shard which is a ip + cpuid pair.
-    shared_ptr<rpc_protocol_client_wrapper> get_rpc_client(messaging_verb verb, shard_id id);
-    void remove_rpc_client(messaging_verb verb, shard_id id);
+    shared_ptr<rpc_protocol_client_wrapper> get_rpc_client(unsigned idx, shard_id id);
+    void remove_rpc_client(unsigned idx, shard_id id);
     std::unique_ptr<rpc_protocol_wrapper>& rpc();
 };
 
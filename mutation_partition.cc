@@ -20,8 +20,22 @@
  */
 
 #include <boost/range/adaptor/reversed.hpp>
+#include <boost/algorithm/cxx11/all_of.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
 #include "mutation_partition.hh"
 #include "mutation_partition_applier.hh"
+#include "counters.hh"
+
+// Links e, which was just allocated, before i, freeing it if that fails.
+template <typename Tree, typename Entry>
+static typename Tree::iterator insert_new(Tree& t, typename Tree::const_iterator i, Entry* e) {
+    try {
+        return t.insert_before(i, *e);
+    } catch (...) {
+        current_allocator().destroy(e);
+        throw;
+    }
+}
 
 mutation_partition::mutation_partition(const mutation_partition& x)
         : _tombstone(x._tombstone)
@@ -63,10 +77,9 @@ mutation_partition::apply(const schema& schema, const mutation_partition& p) {
     _static_row.merge(schema, column_kind::static_column, p._static_row);
 
     for (auto&& entry : p._rows) {
-        auto i = _rows.find(entry);
-        if (i == _rows.end()) {
-            auto e = current_allocator().construct<rows_entry>(entry);
-            _rows.insert(i, *e);
+        auto i = _rows.lower_bound(entry);
+        if (i == _rows.end() || _rows.value_comp()(entry, *i)) {
+            insert_new(_rows, i, current_allocator().construct<rows_entry>(entry));
         } else {
             i->row().apply(entry.row().deleted_at());
             i->row().apply(entry.row().marker());
@@ -79,9 +92,18 @@ void
 mutation_partition::apply(const schema& s, mutation_partition&& p) {
     _tombstone.apply(p._tombstone);
 
-    p._row_tombstones.clear_and_dispose([this, &s] (row_tombstones_entry* e) {
-        apply_row_tombstone(s, e);
-    });
+    auto t_i = p._row_tombstones.begin();
+    while (t_i != p._row_tombstones.end()) {
+        auto i = _row_tombstones.lower_bound(*t_i);
+        if (i == _row_tombstones.end() || !t_i->prefix().equal(s, i->prefix())) {
+            auto next = std::next(t_i);
+            _row_tombstones.splice(i, p._row_tombstones, t_i);
+            t_i = next;
+        } else {
+            i->apply(t_i->t());
+            t_i = p._row_tombstones.erase_and_dispose(t_i, current_deleter<row_tombstones_entry>());
+        }
+    }
 
     _static_row.merge(s, column_kind::static_column, std::move(p._static_row));
 
@@ -89,10 +111,11 @@ mutation_partition::apply(const schema& s, mutation_partition&& p) {
     auto p_end = p._rows.end();
     while (p_i != p_end) {
         rows_entry& entry = *p_i;
-        auto i = _rows.find(entry);
-        if (i == _rows.end()) {
-            p_i = p._rows.erase(p_i);
-            _rows.insert(i, entry);
+        auto i = _rows.lower_bound(entry);
+        if (i == _rows.end() || _rows.value_comp()(entry, *i)) {
+            auto next = std::next(p_i);
+            _rows.splice(i, p._rows, p_i);
+            p_i = next;
         } else {
             i->row().apply(entry.row().deleted_at());
             i->row().apply(entry.row().marker());
@@ -149,29 +172,56 @@ mutation_partition::tombstone_for_row(const schema& schema, const rows_entry& e)
     return t;
 }
 
+mutation_partition::range_tombstone_cursor::range_tombstone_cursor(const schema& s, const mutation_partition& p)
+    : _s(s)
+    , _partition_tombstone(p._tombstone)
+    , _next(p._row_tombstones.begin())
+    , _end(p._row_tombstones.end())
+{ }
+
+tombstone
+mutation_partition::range_tombstone_cursor::range_tombstone_for_row(const clustering_key& key) {
+    tombstone t = _partition_tombstone;
+    if (_next == _end && _active.empty()) {
+        return t;
+    }
+
+    // The prefixes of the key sort before it.
+    clustering_key::less_compare_with_prefix less(_s);
+    while (_next != _end && less(_next->prefix(), key)) {
+        _active.push_back(&*_next);
+        ++_next;
+    }
+    // A prefix sorting before the key which isn't one of its own sorts
+    // before all the keys of its rows, so it isn't a prefix of any key to
+    // come either.
+    _active.erase(std::remove_if(_active.begin(), _active.end(), [&] (const row_tombstones_entry* e) {
+        return !key.is_prefixed_by(_s, e->prefix());
+    }), _active.end());
+    for (auto e : _active) {
+        t.apply(e->t());
+    }
+    return t;
+}
+
+tombstone
+mutation_partition::range_tombstone_cursor::tombstone_for_row(const rows_entry& e) {
+    tombstone t = range_tombstone_for_row(e.key());
+    t.apply(e.row().deleted_at());
+    return t;
+}
+
 void
 mutation_partition::apply_row_tombstone(const schema& schema, clustering_key_prefix prefix, tombstone t) {
     assert(!prefix.is_full(schema));
     auto i = _row_tombstones.lower_bound(prefix, row_tombstones_entry::compare(schema));
     if (i == _row_tombstones.end() || !prefix.equal(schema, i->prefix())) {
-        auto e = current_allocator().construct<row_tombstones_entry>(std::move(prefix), t);
-        _row_tombstones.insert(i, *e);
+        insert_new(_row_tombstones, i, current_allocator().construct<row_tombstones_entry>(std::move(prefix), t));
     } else {
         i->apply(t);
     }
 }
 
-void
-mutation_partition::apply_row_tombstone(const schema& s, row_tombstones_entry* e) noexcept {
-    auto i = _row_tombstones.lower_bound(*e);
-    if (i == _row_tombstones.end() || !e->prefix().equal(s, i->prefix())) {
-        _row_tombstones.insert(i, *e);
-    } else {
-        i->apply(e->t());
-        current_allocator().destroy(e);
-    }
-}
-
 void
 mutation_partition::apply_delete(const schema& schema, const exploded_clustering_prefix& prefix, tombstone t) {
     if (!prefix) {
@@ -209,7 +259,7 @@ mutation_partition::find_entry(const schema& schema, const clustering_key_prefix
 
 const row*
 mutation_partition::find_row(const clustering_key& key) const {
-    auto i = _rows.find(key);
+    auto i = _rows.find(key, _rows.value_comp());
     if (i == _rows.end()) {
         return nullptr;
     }
@@ -218,33 +268,33 @@ mutation_partition::find_row(const clustering_key& key) const {
 
 deletable_row&
 mutation_partition::clustered_row(clustering_key&& key) {
-    auto i = _rows.find(key);
-    if (i == _rows.end()) {
-        auto e = current_allocator().construct<rows_entry>(std::move(key));
-        _rows.insert(i, *e);
-        return e->row();
+    auto& cmp = _rows.value_comp();
+    auto k = cmp.make_lookup_key(key);
+    auto i = _rows.lower_bound(k, cmp);
+    if (i == _rows.end() || cmp(k, *i)) {
+        i = insert_new(_rows, i, current_allocator().construct<rows_entry>(std::move(key), k.comparable_key));
     }
     return i->row();
 }
 
 deletable_row&
 mutation_partition::clustered_row(const clustering_key& key) {
-    auto i = _rows.find(key);
-    if (i == _rows.end()) {
-        auto e = current_allocator().construct<rows_entry>(key);
-        _rows.insert(i, *e);
-        return e->row();
+    auto& cmp = _rows.value_comp();
+    auto k = cmp.make_lookup_key(key);
+    auto i = _rows.lower_bound(k, cmp);
+    if (i == _rows.end() || cmp(k, *i)) {
+        i = insert_new(_rows, i, current_allocator().construct<rows_entry>(key, k.comparable_key));
     }
     return i->row();
 }
 
 deletable_row&
 mutation_partition::clustered_row(const schema& s, const clustering_key_view& key) {
-    auto i = _rows.find(key, rows_entry::compare(s));
-    if (i == _rows.end()) {
-        auto e = current_allocator().construct<rows_entry>(key);
-        _rows.insert(i, *e);
-        return e->row();
+    rows_entry::compare cmp(s);
+    auto k = cmp.make_lookup_key(key);
+    auto i = _rows.lower_bound(k, cmp);
+    if (i == _rows.end() || cmp(k, *i)) {
+        i = insert_new(_rows, i, current_allocator().construct<rows_entry>(key, k.comparable_key));
     }
     return i->row();
 }
@@ -299,8 +349,10 @@ static void get_row_slice(const schema& s,
                 auto c = cell->as_atomic_cell();
                 if (!c.is_live(tomb, now)) {
                     writer.add_empty();
+                } else if (def.type->is_counter()) {
+                    writer.add(c, counter_total_value(c));
                 } else {
-                    writer.add(cell->as_atomic_cell());
+                    writer.add(c);
                 }
             } else {
                 auto&& mut = cell->as_collection_mutation();
@@ -341,18 +393,59 @@ bool has_any_live_data(const schema& s, column_kind kind, const row& cells, tomb
     return any_live;
 }
 
+// Whether the cells of a row, covered by the tombstone, match a filter.
+static bool matches(const schema& s, const row& cells, const query::column_filter& f, tombstone t, gc_clock::time_point now) {
+    auto c = cells.find_cell(f.column);
+    if (!c) {
+        return false;
+    }
+    auto& def = s.regular_column_at(f.column);
+    if (!def.is_atomic()) {
+        return false;
+    }
+    auto cell = c->as_atomic_cell();
+    if (!cell.is_live(t, now)) {
+        return false;
+    }
+    bytes counter_value;
+    auto value = cell.value();
+    if (def.type->is_counter()) {
+        counter_value = counter_total_value(cell);
+        value = counter_value;
+    }
+    auto compare = [&] (const bytes& v) {
+        return def.type->compare(value, v);
+    };
+    switch (f.oper) {
+    case query::column_filter::op::EQ: return compare(f.values.front()) == 0;
+    case query::column_filter::op::LT: return compare(f.values.front()) < 0;
+    case query::column_filter::op::LTE: return compare(f.values.front()) <= 0;
+    case query::column_filter::op::GT: return compare(f.values.front()) > 0;
+    case query::column_filter::op::GTE: return compare(f.values.front()) >= 0;
+    case query::column_filter::op::IN:
+        return boost::algorithm::any_of(f.values, [&] (const bytes& v) { return compare(v) == 0; });
+    }
+    abort();
+}
+
 void
 mutation_partition::query(query::result::partition_writer& pw,
     const schema& s,
     gc_clock::time_point now,
-    uint32_t limit) const
+    uint32_t limit,
+    const clustering_key* resume_after) const
 {
     const query::partition_slice& slice = pw.slice();
 
     // To avoid retraction of the partition entry in case of limit == 0.
     assert(limit > 0);
 
-    bool any_live = has_any_live_data(s, column_kind::static_column, static_row(), _tombstone, now);
+    // The static row was returned along with the rows of the previous page.
+    // Partitions of filtering queries are returned only for the rows which
+    // match.
+    bool any_live = !resume_after && slice.filters.empty()
+            && has_any_live_data(s, column_kind::static_column, static_row(), _tombstone, now);
+    pw.add_tombstones(_row_tombstones.size());
 
     if (!slice.static_columns.empty()) {
         auto row_builder = pw.add_static_row();
@@ -361,8 +454,18 @@ mutation_partition::query(query::result::partition_writer& pw,
     }
 
     auto is_reversed = slice.options.contains(query::partition_slice::option::reversed);
+    rows_entry::compare less(s);
+    auto already_returned = [&] (const rows_entry& e) {
+        return resume_after && (is_reversed ? !less(e, *resume_after) : !less(*resume_after, e));
+    };
+    // Rows of a single range are walked in order, unless reversed.
+    std::experimental::optional<range_tombstone_cursor> tombstones;
+    if (!is_reversed && slice.row_ranges.size() == 1) {
+        tombstones.emplace(s, *this);
+    }
+    bool full = false;
     for (auto&& row_range : slice.row_ranges) {
-        if (limit == 0) {
+        if (limit == 0 || full) {
             break;
         }
 
@@ -370,17 +473,30 @@ mutation_partition::query(query::result::partition_writer& pw,
         // does two lookups to form a range, even for singular range. We need
         // only one lookup for a full-tuple singular range though.
         for_each_row(s, row_range, is_reversed, [&] (const rows_entry& e) {
+            if (already_returned(e)) {
+                return stop_iteration::no;
+            }
             auto& row = e.row();
-            auto row_tombstone = tombstone_for_row(s, e);
+            auto row_tombstone = tombstones ? tombstones->tombstone_for_row(e) : tombstone_for_row(s, e);
 
             if (row.is_live(s, row_tombstone, now)) {
+                auto match = [&] (const query::column_filter& f) {
+                    return matches(s, row.cells(), f, row_tombstone, now);
+                };
+                if (!boost::algorithm::all_of(slice.filters, match)) {
+                    pw.filter_row();
+                    return stop_iteration::no;
+                }
                 any_live = true;
                 auto row_builder = pw.add_row(e.key());
                 get_row_slice(s, column_kind::regular_column, row.cells(), slice.regular_columns, row_tombstone, now, row_builder);
                 row_builder.finish();
-                if (--limit == 0) {
+                full = pw.is_full();
+                if (--limit == 0 || full) {
                     return stop_iteration::yes;
                 }
+            } else {
+                pw.add_tombstones(1);
             }
             return stop_iteration::no;
         });
@@ -402,8 +518,8 @@ std::ostream&
 operator<<(std::ostream& os, const row& r) {
     sstring cells;
     switch (r._type) {
-    case row::storage_type::set:
-        cells = ::join(", ", r.get_range_set());
+    case row::storage_type::sparse:
+        cells = ::join(", ", r.get_range_sparse());
         break;
     case row::storage_type::vector:
         cells = ::join(", ", r.get_range_vector());
@@ -492,7 +608,9 @@ void
 merge_column(const column_definition& def,
              atomic_cell_or_collection& old,
              atomic_cell_or_collection&& neww) {
-    if (def.is_atomic()) {
+    if (def.type->is_counter()) {
+        old = merge_counter_cells(old.as_atomic_cell(), neww.as_atomic_cell());
+    } else if (def.is_atomic()) {
         if (compare_atomic_cell_for_merge(old.as_atomic_cell(), neww.as_atomic_cell()) < 0) {
             old = std::move(neww);
         }
@@ -502,11 +620,34 @@ merge_column(const column_definition& def,
     }
 }
 
+// Unlike the overload taking an rvalue, overwrites the old atomic cell in
+// place when the new one wins and has the same size, so that rows which keep
+// being updated with values of the same size, as in a memtable, don't leave
+// a dead copy of the old value behind for each update.
+void
+merge_column(const column_definition& def,
+             atomic_cell_or_collection& old,
+             const atomic_cell_or_collection& neww) {
+    if (def.is_atomic() && !def.type->is_counter()) {
+        if (compare_atomic_cell_for_merge(old.as_atomic_cell(), neww.as_atomic_cell()) < 0) {
+            if (!old.overwrite(neww.serialize())) {
+                old = neww;
+            }
+        }
+    } else {
+        merge_column(def, old, atomic_cell_or_collection(neww));
+    }
+}
+
 void
 row::apply(const column_definition& column, const atomic_cell_or_collection& value) {
-    // FIXME: Optimize
-    atomic_cell_or_collection tmp(value);
-    apply(column, std::move(tmp));
+    auto old = find_mutable_cell(column.id);
+    if (old) {
+        merge_column(column, *old, value);
+    } else {
+        atomic_cell_or_collection tmp(value);
+        apply(column, std::move(tmp));
+    }
 }
 
 void
@@ -526,12 +667,12 @@ row::apply(const column_definition& column, atomic_cell_or_collection&& value) {
         }
     } else {
         if (_type == storage_type::vector) {
-            vector_to_set();
+            vector_to_sparse();
         }
-        auto i = _storage.set.lower_bound(id, cell_entry::compare());
-        if (i == _storage.set.end() || i->id() != id) {
-            auto e = current_allocator().construct<cell_entry>(id, std::move(value));
-            _storage.set.insert(i, *e);
+        auto& cells = _storage.sparse;
+        auto i = std::lower_bound(cells.begin(), cells.end(), id, cell_entry::compare());
+        if (i == cells.end() || i->id() != id) {
+            cells.insert(i, cell_entry(id, std::move(value)));
             _size++;
         } else {
             merge_column(column, i->cell(), std::move(value));
@@ -539,6 +680,22 @@ row::apply(const column_definition& column, atomic_cell_or_collection&& value) {
     }
 }
 
+void
+row::apply(const column_definition& column, atomic_cell_view value) {
+    if (!column.type->is_counter()) {
+        auto old = find_mutable_cell(column.id);
+        if (old) {
+            if (compare_atomic_cell_for_merge(old->as_atomic_cell(), value) >= 0) {
+                return;
+            }
+            if (old->overwrite(value.serialize())) {
+                return;
+            }
+        }
+    }
+    apply(column, atomic_cell_or_collection(value));
+}
+
 void
 row::append_cell(column_id id, atomic_cell_or_collection value) {
     if (_type == storage_type::vector && id < max_vector_size) {
@@ -546,24 +703,29 @@ row::append_cell(column_id id, atomic_cell_or_collection value) {
         _storage.vector.emplace_back(std::move(value));
     } else {
         if (_type == storage_type::vector) {
-            vector_to_set();
+            vector_to_sparse();
         }
-        auto e = current_allocator().construct<cell_entry>(id, std::move(value));
-        _storage.set.insert(_storage.set.end(), *e);
+        _storage.sparse.emplace_back(id, std::move(value));
     }
     _size++;
 }
 
 const atomic_cell_or_collection*
 row::find_cell(column_id id) const {
+    return const_cast<row*>(this)->find_mutable_cell(id);
+}
+
+atomic_cell_or_collection*
+row::find_mutable_cell(column_id id) {
     if (_type == storage_type::vector) {
         if (id >= _storage.vector.size() || !bool(_storage.vector[id])) {
             return nullptr;
         }
         return &_storage.vector[id];
     } else {
-        auto i = _storage.set.find(id, cell_entry::compare());
-        if (i == _storage.set.end()) {
+        auto& cells = _storage.sparse;
+        auto i = std::lower_bound(cells.begin(), cells.end(), id, cell_entry::compare());
+        if (i == cells.end() || i->id() != id) {
             return nullptr;
         }
         return &i->cell();
@@ -571,18 +733,18 @@ row::find_cell(column_id id) const {
 }
 
 uint32_t mutation_partition::do_compact(const schema& s, gc_clock::time_point query_time,
-    const std::vector<query::clustering_range>& row_ranges, uint32_t row_limit, api::timestamp_type max_purgeable)
+    const std::vector<query::clustering_range>& row_ranges, uint32_t row_limit, api::timestamp_type max_purgeable,
+    gc_clock::time_point gc_before)
 {
     assert(row_limit > 0);
     bool stop = false;
 
-    auto gc_before = query_time - s.gc_grace_seconds();
-
     bool static_row_live = _static_row.compact_and_expire(s, column_kind::static_column, _tombstone,
         query_time, max_purgeable, gc_before);
 
     uint32_t row_count = 0;
 
+    range_tombstone_cursor tombstones(s, *this);
     auto last = _rows.begin();
     for (auto&& row_range : row_ranges) {
         if (stop) {
@@ -596,7 +758,7 @@ uint32_t mutation_partition::do_compact(const schema& s, gc_clock::time_point qu
             rows_entry& e = *last;
             deletable_row& row = e.row();
 
-            tombstone tomb = tombstone_for_row(s, e);
+            tombstone tomb = tombstones.tombstone_for_row(e);
 
             bool is_live = row.cells().compact_and_expire(s, column_kind::regular_column, tomb, query_time, max_purgeable, gc_before);
             is_live |= row.marker().compact_and_expire(tomb, query_time, max_purgeable, gc_before);
@@ -650,17 +812,55 @@ mutation_partition::compact_for_query(
     const std::vector<query::clustering_range>& row_ranges,
     uint32_t row_limit)
 {
-    return do_compact(s, query_time, row_ranges, row_limit, api::max_timestamp);
+    return do_compact(s, query_time, row_ranges, row_limit, api::max_timestamp, query_time - s.gc_grace_seconds());
 }
 
 void mutation_partition::compact_for_compaction(const schema& s,
-    api::timestamp_type max_purgeable, gc_clock::time_point compaction_time)
+    api::timestamp_type max_purgeable, gc_clock::time_point compaction_time, gc_clock::time_point gc_before)
 {
     static const std::vector<query::clustering_range> all_rows = {
         query::clustering_range::make_open_ended_both_sides()
     };
 
-    do_compact(s, compaction_time, all_rows, query::max_rows, max_purgeable);
+    do_compact(s, compaction_time, all_rows, query::max_rows, max_purgeable, gc_before);
+}
+
+void mutation_partition::drop_shadowed(const schema& s)
+{
+    // Nothing expires, and no tombstone can be purged.
+    auto drop = [&s] (row& r, column_kind kind, tombstone tomb) {
+        r.compact_and_expire(s, kind, tomb, gc_clock::time_point::min(), api::min_timestamp, gc_clock::time_point::min());
+    };
+    if (_tombstone) {
+        drop(_static_row, column_kind::static_column, _tombstone);
+        auto it = _row_tombstones.begin();
+        while (it != _row_tombstones.end()) {
+            if (it->t() <= _tombstone) {
+                it = _row_tombstones.erase_and_dispose(it, current_deleter<row_tombstones_entry>());
+            } else {
+                ++it;
+            }
+        }
+    }
+    range_tombstone_cursor tombstones(s, *this);
+    auto i = _rows.begin();
+    while (i != _rows.end()) {
+        deletable_row& row = i->row();
+        auto range_tomb = tombstones.range_tombstone_for_row(i->key());
+        auto tomb = range_tomb;
+        tomb.apply(row.deleted_at());
+        if (!tomb) {
+            ++i;
+            continue;
+        }
+        drop(row.cells(), column_kind::regular_column, tomb);
+        row.marker().compact_and_expire(tomb, gc_clock::time_point::min(), api::min_timestamp, gc_clock::time_point::min());
+        if (!row.cells().size() && row.marker().is_missing() && row.deleted_at() <= range_tomb) {
+            i = _rows.erase_and_dispose(i, current_deleter<rows_entry>());
+        } else {
+            ++i;
+        }
+    }
 }
 
 // Returns true if there is no live data or tombstones.
@@ -672,6 +872,52 @@ bool mutation_partition::empty() const
     return !_static_row.size() && _rows.empty() && _row_tombstones.empty();
 }
 
+mutation_partition mutation_partition::difference(schema_ptr s, const mutation_partition& other) const
+{
+    mutation_partition mp(s);
+    if (_tombstone > other._tombstone) {
+        mp.apply(_tombstone);
+    }
+    mp._static_row = _static_row.difference(*s, column_kind::static_column, other._static_row);
+
+    for (auto&& e : _row_tombstones) {
+        auto i = other._row_tombstones.find(e);
+        if (i == other._row_tombstones.end() || e.t() > i->t()) {
+            mp.apply_row_tombstone(*s, e.prefix(), e.t());
+        }
+    }
+
+    // Both row sets are sorted the same way, so they're walked together.
+    auto& cmp = _rows.value_comp();
+    auto i = other._rows.begin();
+    for (auto&& e : _rows) {
+        while (i != other._rows.end() && cmp(*i, e)) {
+            ++i;
+        }
+        if (i == other._rows.end() || cmp(e, *i)) {
+            insert_new(mp._rows, mp._rows.end(), current_allocator().construct<rows_entry>(e));
+            continue;
+        }
+        const deletable_row& mine = e.row();
+        const deletable_row& theirs = i->row();
+        auto cells = mine.cells().difference(*s, column_kind::regular_column, theirs.cells());
+        bool newer_tombstone = mine.deleted_at() > theirs.deleted_at();
+        // Markers merge by timestamp, the later one winning ties.
+        bool newer_marker = mine.marker() != theirs.marker() && mine.marker().timestamp() >= theirs.marker().timestamp();
+        if (cells.size() || newer_tombstone || newer_marker) {
+            auto& r = mp.clustered_row(*s, e.key());
+            if (newer_tombstone) {
+                r.apply(mine.deleted_at());
+            }
+            if (newer_marker) {
+                r.apply(mine.marker());
+            }
+            r.cells() = std::move(cells);
+        }
+    }
+    return mp;
+}
+
 bool
 deletable_row::is_live(const schema& s, tombstone base_tombstone, gc_clock::time_point query_time = gc_clock::time_point::min()) const {
     // _created_at corresponds to the row marker cell, present for rows
@@ -692,8 +938,9 @@ size_t
 mutation_partition::live_row_count(const schema& s, gc_clock::time_point query_time) const {
     size_t count = 0;
 
+    range_tombstone_cursor tombstones(s, *this);
     for (const rows_entry& e : _rows) {
-        tombstone base_tombstone = range_tombstone_for_row(s, e.key());
+        tombstone base_tombstone = tombstones.range_tombstone_for_row(e.key());
         if (e.row().is_live(s, base_tombstone, query_time)) {
             ++count;
         }
@@ -709,22 +956,15 @@ mutation_partition::live_row_count(const schema& s, gc_clock::time_point query_t
 rows_entry::rows_entry(rows_entry&& o) noexcept
     : _link(std::move(o._link))
     , _key(std::move(o._key))
+    , _comparable_key(std::move(o._comparable_key))
     , _row(std::move(o._row))
-{
-    using container_type = mutation_partition::rows_type;
-    container_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
-    container_type::node_algorithms::init(o._link.this_ptr());
-}
+{ }
 
 row_tombstones_entry::row_tombstones_entry(row_tombstones_entry&& o) noexcept
-    : _link()
+    : _link(std::move(o._link))
     , _prefix(std::move(o._prefix))
     , _t(std::move(o._t))
-{
-    using container_type = mutation_partition::row_tombstones_type;
-    container_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
-    container_type::node_algorithms::init(o._link.this_ptr());
-}
+{ }
 
 row::row(const row& o)
     : _type(o._type)
@@ -733,16 +973,7 @@ row::row(const row& o)
     if (_type == storage_type::vector) {
         new (&_storage.vector) vector_type(o._storage.vector);
     } else {
-        auto cloner = [] (const auto& x) {
-            return current_allocator().construct<std::remove_const_t<std::remove_reference_t<decltype(x)>>>(x);
-        };
-        new (&_storage.set) map_type;
-        try {
-            _storage.set.clone_from(o._storage.set, cloner, current_deleter<cell_entry>());
-        } catch (...) {
-            _storage.set.~map_type();
-            throw;
-        }
+        new (&_storage.sparse) sparse_type(o._storage.sparse);
     }
 }
 
@@ -750,26 +981,10 @@ row::~row() {
     if (_type == storage_type::vector) {
         _storage.vector.~vector_type();
     } else {
-        _storage.set.clear_and_dispose(current_deleter<cell_entry>());
-        _storage.set.~map_type();
+        _storage.sparse.~sparse_type();
     }
 }
 
-row::cell_entry::cell_entry(const cell_entry& o) noexcept
-    : _id(o._id)
-    , _cell(o._cell)
-{ }
-
-row::cell_entry::cell_entry(cell_entry&& o) noexcept
-    : _link()
-    , _id(o._id)
-    , _cell(std::move(o._cell))
-{
-    using container_type = row::map_type;
-    container_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
-    container_type::node_algorithms::init(o._link.this_ptr());
-}
-
 const atomic_cell_or_collection& row::cell_at(column_id id) const {
     auto&& cell = find_cell(id);
     if (!cell) {
@@ -778,28 +993,28 @@ const atomic_cell_or_collection& row::cell_at(column_id id) const {
     return *cell;
 }
 
-void row::vector_to_set()
+void row::vector_to_sparse()
 {
     assert(_type == storage_type::vector);
-    map_type set;
+    sparse_type cells;
+    cells.reserve(_size);
     for (unsigned i = 0; i < _storage.vector.size(); i++) {
         auto& c = _storage.vector[i];
         if (!bool(c)) {
             continue;
         }
-        auto e = current_allocator().construct<cell_entry>(i, std::move(c));
-        set.insert(set.end(), *e);
+        cells.emplace_back(i, std::move(c));
     }
     _storage.vector.~vector_type();
-    new (&_storage.set) map_type(std::move(set));
-    _type = storage_type::set;
+    new (&_storage.sparse) sparse_type(std::move(cells));
+    _type = storage_type::sparse;
 }
 
 void row::reserve(column_id last_column)
 {
     if (_type == storage_type::vector && last_column >= internal_count) {
         if (last_column >= max_vector_size) {
-            vector_to_set();
+            vector_to_sparse();
         } else {
             _storage.vector.reserve(last_column);
         }
@@ -818,13 +1033,13 @@ bool row::operator==(const row& other) const {
         if (other._type == storage_type::vector) {
             return boost::equal(get_range_vector(), other.get_range_vector(), cells_equal);
         } else {
-            return boost::equal(get_range_vector(), other.get_range_set(), cells_equal);
+            return boost::equal(get_range_vector(), other.get_range_sparse(), cells_equal);
         }
     } else {
         if (other._type == storage_type::vector) {
-            return boost::equal(get_range_set(), other.get_range_vector(), cells_equal);
+            return boost::equal(get_range_sparse(), other.get_range_vector(), cells_equal);
         } else {
-            return boost::equal(get_range_set(), other.get_range_set(), cells_equal);
+            return boost::equal(get_range_sparse(), other.get_range_sparse(), cells_equal);
         }
     }
 }
@@ -838,7 +1053,7 @@ row::row(row&& other)
     if (_type == storage_type::vector) {
         new (&_storage.vector) vector_type(std::move(other._storage.vector));
     } else {
-        new (&_storage.set) map_type(std::move(other._storage.set));
+        new (&_storage.sparse) sparse_type(std::move(other._storage.sparse));
     }
 }
 
@@ -850,28 +1065,122 @@ row& row::operator=(row&& other) {
     return *this;
 }
 
+row::size_type row::count_missing(const row& other) const {
+    size_type missing = 0;
+    auto i = _storage.sparse.begin();
+    auto end = _storage.sparse.end();
+    other.for_each_cell([&] (column_id id, const atomic_cell_or_collection&) {
+        while (i != end && i->id() < id) {
+            ++i;
+        }
+        if (i == end || i->id() != id) {
+            ++missing;
+        }
+    });
+    return missing;
+}
+
+void row::insert_missing(sparse_type&& cells) noexcept {
+    auto& v = _storage.sparse;
+    auto old_size = v.size();
+    for (size_type k = 0; k < cells.size(); ++k) {
+        v.emplace_back();
+    }
+    auto dst = v.end();
+    auto src = v.begin() + old_size;
+    auto in = cells.end();
+    while (in != cells.begin()) {
+        if (src != v.begin() && std::prev(src)->id() > std::prev(in)->id()) {
+            *--dst = std::move(*--src);
+        } else {
+            *--dst = std::move(*--in);
+        }
+    }
+    _size += cells.size();
+}
+
+// Sparse rows are merged with a linear merge. Cells present in both rows
+// are merged in place first, then the rest is inserted in one pass from
+// the back, after all allocations, so that an exception leaves the rows in
+// states which still commute.
 void row::merge(const schema& s, column_kind kind, const row& other) {
+    if (!other.size()) {
+        return;
+    }
     if (other._type == storage_type::vector) {
         reserve(other._storage.vector.size() - 1);
     } else {
-        reserve(other._storage.set.rbegin()->id());
+        reserve(other._storage.sparse.back().id());
+    }
+    if (_type == storage_type::vector) {
+        other.for_each_cell([&] (column_id id, const atomic_cell_or_collection& cell) {
+            apply(s.column_at(kind, id), cell);
+        });
+        return;
     }
+    auto missing_count = count_missing(other);
+    _storage.sparse.reserve(_storage.sparse.size() + missing_count);
+    sparse_type missing;
+    missing.reserve(missing_count);
+    auto i = _storage.sparse.begin();
+    auto end = _storage.sparse.end();
     other.for_each_cell([&] (column_id id, const atomic_cell_or_collection& cell) {
-        apply(s.column_at(kind, id), cell);
+        while (i != end && i->id() < id) {
+            ++i;
+        }
+        if (i != end && i->id() == id) {
+            merge_column(s.column_at(kind, id), i->cell(), cell);
+        } else {
+            missing.emplace_back(id, cell);
+        }
     });
+    insert_missing(std::move(missing));
 }
 
 void row::merge(const schema& s, column_kind kind, row&& other) {
+    if (!other.size()) {
+        return;
+    }
     if (other._type == storage_type::vector) {
         reserve(other._storage.vector.size() - 1);
     } else {
-        reserve(other._storage.set.rbegin()->id());
+        reserve(other._storage.sparse.back().id());
     }
-    // FIXME: Optimize when 'other' is a set. We could move whole entries, not only cells.
+    if (_type == storage_type::vector) {
+        other.for_each_cell_until([&] (column_id id, atomic_cell_or_collection& cell) {
+            apply(s.column_at(kind, id), std::move(cell));
+            return stop_iteration::no;
+        });
+        return;
+    }
+    auto missing_count = count_missing(other);
+    _storage.sparse.reserve(_storage.sparse.size() + missing_count);
+    sparse_type missing;
+    missing.reserve(missing_count);
+    auto begin = _storage.sparse.begin();
+    auto end = _storage.sparse.end();
+    auto i = begin;
     other.for_each_cell_until([&] (column_id id, atomic_cell_or_collection& cell) {
-        apply(s.column_at(kind, id), std::move(cell));
+        while (i != end && i->id() < id) {
+            ++i;
+        }
+        if (i != end && i->id() == id) {
+            merge_column(s.column_at(kind, id), i->cell(), std::move(cell));
+        }
+        return stop_iteration::no;
+    });
+    // Moving cells out can't fail, so it's safe only now.
+    i = begin;
+    other.for_each_cell_until([&] (column_id id, atomic_cell_or_collection& cell) {
+        while (i != end && i->id() < id) {
+            ++i;
+        }
+        if (i == end || i->id() != id) {
+            missing.emplace_back(id, std::move(cell));
+        }
         return stop_iteration::no;
     });
+    insert_missing(std::move(missing));
 }
 
 bool row::compact_and_expire(const schema& s, column_kind kind, tombstone tomb, gc_clock::time_point query_time,
@@ -886,7 +1195,12 @@ bool row::compact_and_expire(const schema& s, column_kind kind, tombstone tomb,
             if (cell.is_covered_by(tomb)) {
                 erase = true;
             } else if (cell.has_expired(query_time)) {
-                c = atomic_cell::make_dead(cell.timestamp(), cell.deletion_time());
+                // Deleted when written, as far as gc_grace_seconds is
+                // concerned, so it may go right away.
+                erase = cell.timestamp() < max_purgeable && cell.deletion_time() < gc_before;
+                if (!erase) {
+                    c = atomic_cell::make_dead(cell.timestamp(), cell.deletion_time());
+                }
             } else if (!cell.is_live()) {
                 erase = cell.timestamp() < max_purgeable && cell.deletion_time() < gc_before;
             } else {
@@ -908,3 +1222,33 @@ bool row::compact_and_expire(const schema& s, column_kind kind, tombstone tomb,
     });
     return any_live;
 }
+
+row row::difference(const schema& s, column_kind kind, const row& other) const
+{
+    row r;
+    for_each_cell([&] (column_id id, const atomic_cell_or_collection& c) {
+        auto other_cell = other.find_cell(id);
+        if (!other_cell) {
+            r.append_cell(id, c);
+            return;
+        }
+        const column_definition& def = s.column_at(kind, id);
+        if (def.type->is_counter()) {
+            // Counter cells merge shard by shard, so resending is harmless.
+            if (!(c == *other_cell)) {
+                r.append_cell(id, c);
+            }
+        } else if (def.is_atomic()) {
+            if (compare_atomic_cell_for_merge(c.as_atomic_cell(), other_cell->as_atomic_cell()) > 0) {
+                r.append_cell(id, c);
+            }
+        } else {
+            auto ctype = static_pointer_cast<const collection_type_impl>(def.type);
+            auto diff = ctype->difference(c.as_collection_mutation(), other_cell->as_collection_mutation());
+            if (diff) {
+                r.append_cell(id, std::move(*diff));
+            }
+        }
+    });
+    return r;
+}
@@ -23,7 +23,6 @@
 
 #include <iostream>
 #include <map>
-#include <boost/intrusive/set.hpp>
 #include <boost/range/iterator_range.hpp>
 #include <boost/range/adaptor/indexed.hpp>
 #include <boost/range/adaptor/filtered.hpp>
@@ -34,6 +33,7 @@
 #include "query-result-writer.hh"
 #include "mutation_partition_view.hh"
 #include "utils/managed_vector.hh"
+#include "utils/intrusive_btree.hh"
 
 //
 // Container for cells of a row. Cells are identified by column_id.
@@ -42,21 +42,27 @@
 // for space-efficiency reasons. Whenever a method accepts a column_kind,
 // the caller must always supply the same column_kind.
 //
+// Rows whose cells all have small column ids keep them in an array indexed
+// by column id. Other rows keep them in an array of (id, cell) entries
+// sorted by id. Either way the cells are held in a single allocation, which
+// the row itself holds for a few cells.
+//
 // Can be used as a range of row::cell_entry.
 //
 class row {
     class cell_entry {
-        boost::intrusive::set_member_hook<> _link;
-        column_id _id;
+        column_id _id = 0;
         atomic_cell_or_collection _cell;
         friend class row;
     public:
+        cell_entry() = default;
         cell_entry(column_id id, atomic_cell_or_collection cell)
             : _id(id)
             , _cell(std::move(cell))
         { }
-        cell_entry(cell_entry&&) noexcept;
-        cell_entry(const cell_entry&) noexcept;
+        cell_entry(cell_entry&&) = default;
+        cell_entry(const cell_entry&) = default;
+        cell_entry& operator=(cell_entry&&) = default;
 
         column_id id() const { return _id; }
         const atomic_cell_or_collection& cell() const { return _cell; }
@@ -79,24 +85,23 @@ class row {
 
     enum class storage_type {
         vector,
-        set,
+        sparse,
     };
     storage_type _type = storage_type::vector;
     size_type _size = 0;
 
-    using map_type = boost::intrusive::set<cell_entry,
-        boost::intrusive::member_hook<cell_entry, boost::intrusive::set_member_hook<>, &cell_entry::_link>,
-        boost::intrusive::compare<cell_entry::compare>, boost::intrusive::constant_time_size<false>>;
+    using sparse_type = managed_vector<cell_entry, 0, size_type>;
 public:
     static constexpr size_t max_vector_size = 32;
-    static constexpr size_t internal_count = (sizeof(map_type) + sizeof(cell_entry)) / sizeof(atomic_cell_or_collection);
+    // Cells the column-indexed array holds without allocating.
+    static constexpr size_t internal_count = 4;
 private:
     using vector_type = managed_vector<atomic_cell_or_collection, internal_count, size_type>;
 
     union storage {
         storage() { }
         ~storage() { }
-        map_type set;
+        sparse_type sparse;
         vector_type vector;
     } _storage;
 public:
@@ -114,6 +119,7 @@ class row {
     // Returns a pointer to cell's value or nullptr if column is not set.
     const atomic_cell_or_collection* find_cell(column_id id) const;
 private:
+    atomic_cell_or_collection* find_mutable_cell(column_id id);
     template<typename Func>
     void remove_if(Func&& func) {
         if (_type == storage_type::vector) {
@@ -128,16 +134,21 @@ class row {
                 }
             }
         } else {
-            for (auto it = _storage.set.begin(); it != _storage.set.end();) {
-                if (func(it->id(), it->cell())) {
-                    auto& entry = *it;
-                    it = _storage.set.erase(it);
-                    current_allocator().destroy(&entry);
+            auto& cells = _storage.sparse;
+            auto out = cells.begin();
+            for (auto& e : cells) {
+                if (func(e.id(), e.cell())) {
                     _size--;
                 } else {
-                    ++it;
+                    if (&e != out) {
+                        *out = std::move(e);
+                    }
+                    ++out;
                 }
             }
+            while (cells.end() != out) {
+                cells.pop_back();
+            }
         }
     }
 
@@ -150,14 +161,19 @@ class row {
             return std::pair<column_id, const atomic_cell_or_collection&>(id, std::cref(c));
         });
     }
-    auto get_range_set() const {
-        auto range = boost::make_iterator_range(_storage.set.begin(), _storage.set.end());
+    auto get_range_sparse() const {
+        auto range = boost::make_iterator_range(_storage.sparse.begin(), _storage.sparse.end());
         return range | boost::adaptors::transformed([] (const cell_entry& c) {
             return std::pair<column_id, const atomic_cell_or_collection&>(c.id(), c.cell());
         });
     }
 
-    void vector_to_set();
+    void vector_to_sparse();
+    // Number of cells of other which this sparse row doesn't have.
+    size_type count_missing(const row& other) const;
+    // Merges in cells, sorted by id, none of which this sparse row has, in
+    // a single pass from the back. Must have enough capacity reserved.
+    void insert_missing(sparse_type&& cells) noexcept;
 public:
     template<typename Func>
     void for_each_cell(Func&& func) const {
@@ -180,7 +196,7 @@ class row {
                 }
             }
         } else {
-            for (auto& cell : _storage.set) {
+            for (auto& cell : _storage.sparse) {
                 const auto& c = cell.cell();
                 if (c && func(cell.id(), c) == stop_iteration::yes) {
                     break;
@@ -202,7 +218,7 @@ class row {
                 }
             }
         } else {
-            for (auto& cell : _storage.set) {
+            for (auto& cell : _storage.sparse) {
                 auto& c = cell.cell();
                 if (c && func(cell.id(), c) == stop_iteration::yes) {
                     break;
@@ -223,6 +239,10 @@ class row {
     //
     void apply(const column_definition& column, atomic_cell_or_collection&& cell);
 
+    // Merges an atomic cell's value into the row, copying it only if it
+    // isn't shadowed by the cell already there.
+    void apply(const column_definition& column, atomic_cell_view cell);
+
     // Adds cell to the row. The column must not be already set.
     void append_cell(column_id id, atomic_cell_or_collection cell);
 
@@ -239,6 +259,10 @@ class row {
     bool compact_and_expire(const schema& s, column_kind kind, tombstone tomb, gc_clock::time_point query_time,
         api::timestamp_type max_purgeable, gc_clock::time_point gc_before);
 
+    // The cells of this row which other lacks, or which win over other's
+    // when merged. Of collections, only such elements are kept.
+    row difference(const schema&, column_kind, const row& other) const;
+
     bool operator==(const row&) const;
 
     friend std::ostream& operator<<(std::ostream& os, const row& r);
@@ -370,7 +394,7 @@ class deletable_row final {
 };
 
 class row_tombstones_entry {
-    boost::intrusive::set_member_hook<> _link;
+    intrusive_btree_hook _link;
     clustering_key_prefix _prefix;
     tombstone _t;
     friend class mutation_partition;
@@ -432,20 +456,27 @@ class row_tombstones_entry {
 };
 
 class rows_entry {
-    boost::intrusive::set_member_hook<> _link;
+    intrusive_btree_hook _link;
     clustering_key _key;
+    // The key encoded so that entries compare with memcmp(), see
+    // compound_type::to_comparable_bytes(). Empty when the clustering key
+    // types have no such encoding.
+    managed_bytes _comparable_key;
     deletable_row _row;
     friend class mutation_partition;
 public:
-    rows_entry(clustering_key&& key)
+    rows_entry(clustering_key&& key, const bytes_opt& comparable_key = {})
         : _key(std::move(key))
+        , _comparable_key(comparable_key ? managed_bytes(*comparable_key) : managed_bytes())
     { }
-    rows_entry(const clustering_key& key)
+    rows_entry(const clustering_key& key, const bytes_opt& comparable_key = {})
         : _key(key)
+        , _comparable_key(comparable_key ? managed_bytes(*comparable_key) : managed_bytes())
     { }
     rows_entry(rows_entry&& o) noexcept;
     rows_entry(const rows_entry& e)
         : _key(e._key)
+        , _comparable_key(e._comparable_key)
         , _row(e._row)
     { }
     clustering_key& key() {
@@ -463,12 +494,36 @@ class rows_entry {
     void apply(tombstone t) {
         _row.apply(t);
     }
+    // A key to look entries up with, encoded once for all the comparisons
+    // of the lookup.
+    struct lookup_key {
+        clustering_key_view key;
+        bytes_opt comparable_key;
+    };
     struct compare {
         clustering_key::less_compare _c;
         compare(const schema& s) : _c(s) {}
+        lookup_key make_lookup_key(const clustering_key_view& key) const {
+            return { key, _c._t->to_comparable_bytes(key.representation()) };
+        }
         bool operator()(const rows_entry& e1, const rows_entry& e2) const {
+            if (!e1._comparable_key.empty() && !e2._comparable_key.empty()) {
+                return compare_unsigned(e1._comparable_key, e2._comparable_key) < 0;
+            }
             return _c(e1._key, e2._key);
         }
+        bool operator()(const lookup_key& key, const rows_entry& e) const {
+            if (key.comparable_key && !e._comparable_key.empty()) {
+                return compare_unsigned(*key.comparable_key, e._comparable_key) < 0;
+            }
+            return _c(key.key, e._key);
+        }
+        bool operator()(const rows_entry& e, const lookup_key& key) const {
+            if (key.comparable_key && !e._comparable_key.empty()) {
+                return compare_unsigned(e._comparable_key, *key.comparable_key) < 0;
+            }
+            return _c(e._key, key.key);
+        }
         bool operator()(const clustering_key& key, const rows_entry& e) const {
             return _c(key, e._key);
         }
@@ -510,13 +565,10 @@ class serializer;
 
 
 class mutation_partition final {
-    // FIXME: using boost::intrusive because gcc's std::set<> does not support heterogeneous lookup yet
-    using rows_type = boost::intrusive::set<rows_entry,
-        boost::intrusive::member_hook<rows_entry, boost::intrusive::set_member_hook<>, &rows_entry::_link>,
-        boost::intrusive::compare<rows_entry::compare>>;
-    using row_tombstones_type = boost::intrusive::set<row_tombstones_entry,
-        boost::intrusive::member_hook<row_tombstones_entry, boost::intrusive::set_member_hook<>, &row_tombstones_entry::_link>,
-        boost::intrusive::compare<row_tombstones_entry::compare>>;
+    // B+-trees rather than std::set<> or red-black trees, since partitions
+    // can have millions of rows and lookups are dominated by cache misses.
+    using rows_type = intrusive_btree<rows_entry, &rows_entry::_link, rows_entry::compare>;
+    using row_tombstones_type = intrusive_btree<row_tombstones_entry, &row_tombstones_entry::_link, row_tombstones_entry::compare>;
     friend rows_entry;
     friend row_tombstones_entry;
     friend class size_calculator;
@@ -526,7 +578,6 @@ class mutation_partition final {
     rows_type _rows;
     // Contains only strict prefixes so that we don't have to lookup full keys
     // in both _row_tombstones and _rows.
-    // FIXME: using boost::intrusive because gcc's std::set<> does not support heterogeneous lookup yet
     row_tombstones_type _row_tombstones;
 
     template<typename T>
@@ -553,7 +604,6 @@ class mutation_partition final {
     void apply_insert(const schema& s, clustering_key_view, api::timestamp_type created_at);
     // prefix must not be full
     void apply_row_tombstone(const schema& schema, clustering_key_prefix prefix, tombstone t);
-    void apply_row_tombstone(const schema&, row_tombstones_entry*) noexcept;
     //
     // Applies p to current object.
     //
@@ -577,7 +627,7 @@ class mutation_partition final {
 private:
     uint32_t do_compact(const schema& s, gc_clock::time_point now,
         const std::vector<query::clustering_range>& row_ranges, uint32_t row_limit,
-        api::timestamp_type max_purgeable);
+        api::timestamp_type max_purgeable, gc_clock::time_point gc_before);
 public:
     // Performs the following:
     //   - throws out data which doesn't belong to row_ranges
@@ -602,11 +652,22 @@ class mutation_partition final {
     //   - expires cells based on compaction_time
     //   - drops cells covered by higher-level tombstones
     //   - drops expired tombstones which timestamp is before max_purgeable
+    //     and deletion time before gc_before
     void compact_for_compaction(const schema& s, api::timestamp_type max_purgeable,
-        gc_clock::time_point compaction_time);
+        gc_clock::time_point compaction_time, gc_clock::time_point gc_before);
+
+    // Drops the cells and rows covered by the partition's tombstones, and
+    // the row tombstones covered by its partition tombstone, keeping the
+    // others. Merging the result with other data gives what merging the
+    // partition as it was would.
+    void drop_shadowed(const schema& s);
 
     // Returns true if there is no live data or tombstones.
     bool empty() const;
+
+    // Returns what this partition has which other doesn't, i.e. the least
+    // which, applied to other, makes it include this partition.
+    mutation_partition difference(schema_ptr s, const mutation_partition& other) const;
 public:
     deletable_row& clustered_row(const clustering_key& key);
     deletable_row& clustered_row(clustering_key&& key);
@@ -617,15 +678,41 @@ class mutation_partition final {
     const row& static_row() const { return _static_row; }
     // return a set of rows_entry where each entry represents a CQL row sharing the same clustering key.
     const rows_type& clustered_rows() const { return _rows; }
+    rows_type& clustered_rows() { return _rows; }
     const row_tombstones_type& row_tombstones() const { return _row_tombstones; }
     const row* find_row(const clustering_key& key) const;
     const rows_entry* find_entry(const schema& schema, const clustering_key_prefix& key) const;
     tombstone range_tombstone_for_row(const schema& schema, const clustering_key& key) const;
     tombstone tombstone_for_row(const schema& schema, const clustering_key& key) const;
     tombstone tombstone_for_row(const schema& schema, const rows_entry& e) const;
+
+    // Gives the tombstones of rows passed in clustering order, walking the
+    // row tombstones along with them rather than looking up each prefix of
+    // each row, as range_tombstone_for_row() does. The row tombstones which
+    // apply to a row are those of its prefixes, so of those passed, only a
+    // chain of nested prefixes, no longer than the clustering key, may apply
+    // to the rows to come. Walking all rows and row tombstones so takes
+    // linear time. The partition must not change while the cursor is used.
+    class range_tombstone_cursor {
+        const schema& _s;
+        tombstone _partition_tombstone;
+        row_tombstones_type::const_iterator _next;
+        row_tombstones_type::const_iterator _end;
+        // Passed, and prefixes of the last row.
+        std::vector<const row_tombstones_entry*> _active;
+    public:
+        range_tombstone_cursor(const schema& s, const mutation_partition& p);
+        // The key must not sort before that of the previous call.
+        tombstone range_tombstone_for_row(const clustering_key& key);
+        tombstone tombstone_for_row(const rows_entry& e);
+    };
     boost::iterator_range<rows_type::const_iterator> range(const schema& schema, const query::range<clustering_key_prefix>& r) const;
     // Returns at most "limit" rows. The limit must be greater than 0.
-    void query(query::result::partition_writer& pw, const schema& s, gc_clock::time_point now, uint32_t limit = query::max_rows) const;
+    // Stops after the row which fills the result up to its size limit.
+    // Given resume_after, only the rows which follow it in the query order
+    // are returned, the static row not counting as a row on its own then.
+    void query(query::result::partition_writer& pw, const schema& s, gc_clock::time_point now, uint32_t limit = query::max_rows,
+            const clustering_key* resume_after = nullptr) const;
 
     // Returns the number of live CQL rows in this partition.
     //
@@ -52,7 +52,7 @@
 using namespace db;
 
 mutation_partition_serializer::mutation_partition_serializer(const schema& schema, const mutation_partition& p)
-    : _schema(schema), _p(p), _size(size(schema, p))
+    : _schema(schema), _p(p)
 { }
 
 size_t
@@ -102,7 +102,7 @@ mutation_partition_serializer::size(const schema& schema, const mutation_partiti
 
 void
 mutation_partition_serializer::write(data_output& out) const {
-    out.write<size_type>(_size);
+    out.write<size_type>(size_without_framing());
     write_without_framing(out);
 }
 
@@ -155,12 +155,62 @@ mutation_partition_serializer::write_without_framing(data_output& out) const {
     }
 }
 
+static void write_tombstone(bytes_ostream& out, tombstone t) {
+    out.write(t.timestamp);
+    out.write(t.deletion_time.time_since_epoch().count());
+}
+
+static void write_key(bytes_ostream& out, bytes_view key) {
+    out.write<uint16_t>(key.size());
+    out.write(key);
+}
+
+// Atomic cells and collections are both written as their serialized form,
+// so cells are copied whole, without looking their columns up.
+static void write_cells(bytes_ostream& out, const row& cells) {
+    auto n_cells = cells.size();
+    assert(n_cells == (mutation_partition_serializer::count_type)n_cells);
+    out.write<mutation_partition_serializer::count_type>(n_cells);
+    cells.for_each_cell([&] (column_id id, const atomic_cell_or_collection& c) {
+        out.write(id);
+        out.write_blob(c.serialize());
+    });
+}
+
 void
 mutation_partition_serializer::write(bytes_ostream& out) const {
-    out.write<size_type>(_size);
-    auto buf = out.write_place_holder(_size);
-    data_output data_out((char*)buf, _size);
-    write_without_framing(data_out);
+    auto size = out.write_place_holder<size_type>();
+    auto start = out.pos();
+    write_without_framing(out);
+    out.set(size, out.written_since(start));
+}
+
+void
+mutation_partition_serializer::write_without_framing(bytes_ostream& out) const {
+    write_tombstone(out, _p.partition_tombstone());
+    write_cells(out, _p.static_row());
+
+    auto n_tombstones = _p.row_tombstones().size();
+    assert(n_tombstones == (count_type)n_tombstones);
+    out.write<count_type>(n_tombstones);
+    for (const row_tombstones_entry& e : _p.row_tombstones()) {
+        write_key(out, e.prefix().representation());
+        write_tombstone(out, e.t());
+    }
+
+    for (const rows_entry& e : _p.clustered_rows()) {
+        write_key(out, e.key().representation());
+        const auto& rm = e.row().marker();
+        out.write(rm.timestamp());
+        if (!rm.is_missing()) {
+            out.write(rm.ttl().count());
+            if (rm.ttl().count()) {
+                out.write(rm.expiry().time_since_epoch().count());
+            }
+        }
+        write_tombstone(out, e.row().deleted_at());
+        write_cells(out, e.row().cells());
+    }
 }
 
 mutation_partition_view
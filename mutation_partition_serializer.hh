@@ -34,16 +34,18 @@ class mutation_partition_serializer {
 private:
     const schema& _schema;
     const mutation_partition& _p;
-    size_type _size;
 public:
     using count_type = uint32_t;
     mutation_partition_serializer(const schema&, const mutation_partition&);
 public:
-    size_t size() const { return _size + sizeof(size_type); }
-    size_t size_without_framing() const { return _size ; }
+    // Walks the partition; only writing into a data_output needs it.
+    size_t size() const { return size_without_framing() + sizeof(size_type); }
+    size_t size_without_framing() const { return size(_schema, _p); }
     void write(data_output&) const;
     void write_without_framing(data_output&) const;
+    // Writes in a single pass, the framing being filled in afterwards.
     void write(bytes_ostream&) const;
+    void write_without_framing(bytes_ostream&) const;
 public:
     static mutation_partition_view read_as_view(data_input&);
     static mutation_partition read(data_input&, schema_ptr);
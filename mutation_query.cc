@@ -112,13 +112,15 @@ mutation_query(const mutation_source& source,
     const query::partition_range& range,
     const query::partition_slice& slice,
     uint32_t row_limit,
-    gc_clock::time_point query_time)
+    gc_clock::time_point query_time,
+    const query::row_position* resume_after)
 {
     struct query_state {
         const query::partition_range& range;
         const query::partition_slice& slice;
         uint32_t requested_limit;
         gc_clock::time_point query_time;
+        const query::row_position* resume_after;
         uint32_t limit;
         mutation_reader reader;
         std::vector<partition> result;
@@ -127,12 +129,14 @@ mutation_query(const mutation_source& source,
             const query::partition_range& range,
             const query::partition_slice& slice,
             uint32_t requested_limit,
-            gc_clock::time_point query_time
+            gc_clock::time_point query_time,
+            const query::row_position* resume_after
         )
             : range(range)
             , slice(slice)
             , requested_limit(requested_limit)
             , query_time(query_time)
+            , resume_after(resume_after)
             , limit(requested_limit)
         { }
     };
@@ -141,13 +145,28 @@ mutation_query(const mutation_source& source,
         return make_ready_future<reconcilable_result>(reconcilable_result());
     }
 
-    return do_with(query_state(range, slice, row_limit, query_time), [&source] (query_state& state) -> future<reconcilable_result> {
+    return do_with(query_state(range, slice, row_limit, query_time, resume_after), [&source] (query_state& state) -> future<reconcilable_result> {
         state.reader = source(state.range);
         return consume(state.reader, [&state] (mutation&& m) {
             // FIXME: Make data sources respect row_ranges so that we don't have to filter them out here.
             auto is_distinct = state.slice.options.contains(query::partition_slice::option::distinct);
+            auto resumed = !is_distinct && state.resume_after && m.key().equal(*m.schema(), state.resume_after->key);
+            if (resumed) {
+                auto& rows = m.partition().clustered_rows();
+                rows_entry::compare less(*m.schema());
+                auto&& after = state.resume_after->row;
+                if (state.slice.options.contains(query::partition_slice::option::reversed)) {
+                    rows.erase_and_dispose(rows.lower_bound(after, less), rows.end(), current_deleter<rows_entry>());
+                } else {
+                    rows.erase_and_dispose(rows.begin(), rows.upper_bound(after, less), current_deleter<rows_entry>());
+                }
+            }
             auto limit = !is_distinct ? state.limit : 1;
             auto rows_left = m.partition().compact_for_query(*m.schema(), state.query_time, state.slice.row_ranges, limit);
+            // The static row went with the rows of the previous page.
+            if (resumed && m.partition().clustered_rows().empty() && m.partition().row_tombstones().empty()) {
+                return stop_iteration::no;
+            }
             state.limit -= rows_left;
 
             // NOTE: We must return all columns, regardless of what's in
@@ -104,10 +104,15 @@ extern template class serializer<reconcilable_result>;
 // compact, meaning that any cell which is covered by higher-level tombstone
 // is absent in the results.
 //
+// Given resume_after, the rows of its partition up to its row, in the
+// query order, are left out, as the previous page of a paged query
+// returned them already.
+//
 // 'source' doesn't have to survive deferring.
 future<reconcilable_result> mutation_query(
     const mutation_source& source,
     const query::partition_range& range,
     const query::partition_slice& slice,
     uint32_t row_limit,
-    gc_clock::time_point query_time);
+    gc_clock::time_point query_time,
+    const query::row_position* resume_after = nullptr);
@@ -37,6 +37,12 @@ move_and_disengage(std::experimental::optional<T>& opt) {
 }
 
 // Combines multiple mutation_readers into one.
+//
+// The readers are kept in a heap by their next partition. A reader whose
+// next partition still comes first is not pushed back into the heap, so
+// runs of partitions coming from the same reader, like those of sstables
+// covering disjoint ranges, cost a comparison each instead of a heap update.
+// Once a single reader is left, it is read from directly.
 class combined_reader final : public mutation_reader::impl {
     std::vector<mutation_reader> _readers;
     struct mutation_and_reader {
@@ -51,8 +57,22 @@ class combined_reader final : public mutation_reader::impl {
         return b.m.decorated_key().less_compare(*s, a.m.decorated_key());
     }
     mutation_opt _current;
+    // The versions merged into _current.
+    unsigned _versions = 0;
     bool _inited = false;
+    // The only reader left, once the others are exhausted.
+    mutation_reader* _single = nullptr;
 private:
+    // What a version has which the tombstones of another cover is dropped
+    // here, rather than carried along until the query or the compaction
+    // drops it.
+    mutation_opt take_current() {
+        if (_versions > 1) {
+            _current->partition().drop_shadowed(*_current->schema());
+        }
+        _versions = 0;
+        return move_and_disengage(_current);
+    }
     // Produces next mutation or disengaged optional if there are no more.
     //
     // Entry conditions:
@@ -60,7 +80,7 @@ class combined_reader final : public mutation_reader::impl {
     //  - the _ptables heap is in invalid state (if not empty), waiting for pop_back or push_heap.
     future<mutation_opt> next() {
         if (_ptables.empty()) {
-            return make_ready_future<mutation_opt>(move_and_disengage(_current));
+            return make_ready_future<mutation_opt>(take_current());
         };
 
 
@@ -69,10 +89,19 @@ class combined_reader final : public mutation_reader::impl {
 
         if (_current && !_current->decorated_key().equal(*m.schema(), m.decorated_key())) {
             // key has changed, so emit accumulated mutation
-            return make_ready_future<mutation_opt>(move_and_disengage(_current));
+            return make_ready_future<mutation_opt>(take_current());
+        }
+
+        if (!_current && _ptables.size() == 1) {
+            // Nothing left to merge with.
+            _single = candidate.read;
+            auto last = std::move(m);
+            _ptables.clear();
+            return make_ready_future<mutation_opt>(std::move(last));
         }
 
         apply(_current, std::move(m));
+        ++_versions;
 
         return (*candidate.read)().then([this] (mutation_opt&& more) {
             // Restore heap to valid state
@@ -80,6 +109,10 @@ class combined_reader final : public mutation_reader::impl {
                 _ptables.pop_back();
             } else {
                 _ptables.back().m = std::move(*more);
+                if (_ptables.size() == 1 || !heap_compare(_ptables.back(), _ptables.front())) {
+                    // Still not after the next partition of any other reader.
+                    return next();
+                }
                 boost::range::push_heap(_ptables, &heap_compare);
             }
 
@@ -93,6 +126,9 @@ class combined_reader final : public mutation_reader::impl {
     { }
 
     virtual future<mutation_opt> operator()() override {
+        if (_single) {
+            return (*_single)();
+        }
         if (!_inited) {
             return parallel_for_each(_readers, [this] (mutation_reader& reader) {
                 return reader().then([this, &reader](mutation_opt&& m) {
@@ -51,5 +51,11 @@ class partition_slice_builder {
     partition_slice_builder& with_no_regular_columns();
     partition_slice_builder& with_range(query::clustering_range range);
 
+    template <query::partition_slice::option OPTION>
+    partition_slice_builder& with_option() {
+        _options.set<OPTION>();
+        return *this;
+    }
+
     query::partition_slice build();
 };
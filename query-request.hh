@@ -23,6 +23,7 @@
 #pragma once
 
 #include <experimental/optional>
+#include <chrono>
 #include "keys.hh"
 #include "dht/i_partitioner.hh"
 #include "enum_set.hh"
@@ -52,22 +53,49 @@ bool is_single_partition(const query::partition_range& range) {
     return range.is_singular() && range.start()->value().has_key();
 }
 
+// A restriction of a filtering query on a regular column, which replicas
+// check the rows against as they build the result, returning only those
+// which match. A row without a live value for the column never matches.
+struct column_filter {
+    enum class op : uint8_t { EQ, LT, LTE, GT, GTE, IN };
+    column_id column;
+    op oper;
+    // A single value for all but IN.
+    std::vector<bytes> values;
+
+    friend std::ostream& operator<<(std::ostream& out, const column_filter& f);
+};
+
 // Specifies subset of rows, columns and cell attributes to be returned in a query.
 // Can be accessed across cores.
 class partition_slice {
 public:
-    enum class option { send_clustering_key, send_partition_key, send_timestamp_and_expiry, reversed, distinct };
+    // bypass_cache makes the query read through the row cache without
+    // populating it or promoting what it hits, for bulk scans which would
+    // otherwise evict the working set.
+    // murmur3_digest makes digests of the result be computed with murmur3
+    // rather than MD5, and is set only once the whole cluster supports it.
+    // columnar makes the result be encoded column by column, for scans
+    // whose consumers go over values of a column at a time. The
+    // coordinator drops it unless the whole cluster supports it.
+    enum class option { send_clustering_key, send_partition_key, send_timestamp_and_expiry, reversed, distinct, bypass_cache, murmur3_digest,
+        columnar };
     using option_set = enum_set<super_enum<option,
         option::send_clustering_key,
         option::send_partition_key,
         option::send_timestamp_and_expiry,
         option::reversed,
-        option::distinct>>;
+        option::distinct,
+        option::bypass_cache,
+        option::murmur3_digest,
+        option::columnar>>;
 public:
     std::vector<clustering_range> row_ranges;
     std::vector<column_id> static_columns; // TODO: consider using bitmap
     std::vector<column_id> regular_columns;  // TODO: consider using bitmap
     option_set options;
+    // All of which the rows returned must match.
+    std::vector<column_filter> filters;
 public:
     partition_slice(std::vector<clustering_range> row_ranges, std::vector<column_id> static_columns,
         std::vector<column_id> regular_columns, option_set options)
@@ -80,6 +108,21 @@ class partition_slice {
 };
 
 constexpr auto max_rows = std::numeric_limits<uint32_t>::max();
+constexpr auto no_result_size_limit = std::numeric_limits<uint32_t>::max();
+
+// A row a page of a paged query ended with, for the next page to go on
+// from the row of its partition which follows it.
+struct row_position {
+    partition_key key;
+    clustering_key row;
+};
+
+// Restricts a query to the rows in which a column has the given value,
+// which replicas look up in their secondary index of the column.
+struct index_restriction {
+    bytes column;
+    bytes value;
+};
 
 // Full specification of a query to the database.
 // Intended for passing across replicas.
@@ -90,6 +133,27 @@ class read_command {
     partition_slice slice;
     uint32_t row_limit;
     gc_clock::time_point timestamp;
+    // Set for the pages of a paged query. Replicas keep the reader a page
+    // stopped at under the query uuid, so that the next page continues it
+    // rather than reads its partitions again.
+    utils::UUID query_uuid;
+    bool is_first_page = true;
+    // Set when the previous page stopped within a partition, which the
+    // ranges then start with.
+    std::experimental::optional<row_position> resume_after;
+    // In bytes, for the result of each replica as for the whole page. A
+    // result reaching it may have stopped short of row_limit rows, and is
+    // to be continued by the next page. Only paged queries can be limited.
+    uint32_t max_result_size = no_result_size_limit;
+    // Set for queries restricting an indexed column, which are not paged.
+    std::experimental::optional<index_restriction> index;
+    // Set when the coordinator traces the query, for the replicas to record
+    // what they do for it under the same session.
+    std::experimental::optional<utils::UUID> trace_session;
+    // When the coordinator gives up on the query, by this node's clock, for
+    // replicas to abandon reads nobody waits for any more. Sent as the time
+    // left, so that it holds whether or not the clocks of the nodes agree.
+    std::experimental::optional<std::chrono::steady_clock::time_point> deadline;
 public:
     read_command(const utils::UUID& cf_id, partition_slice slice, uint32_t row_limit = max_rows, gc_clock::time_point now = gc_clock::now())
         : cf_id(cf_id)
@@ -98,6 +162,20 @@ class read_command {
         , timestamp(now)
     { }
 
+    bool is_paged() const {
+        return query_uuid != utils::UUID();
+    }
+
+    bool is_expired() const {
+        return deadline && *deadline <= std::chrono::steady_clock::now();
+    }
+
+    // Whether a result of this size may have stopped short of the rows
+    // asked for.
+    bool is_size_limited(size_t result_size) const {
+        return max_result_size != no_result_size_limit && result_size >= max_result_size;
+    }
+
     size_t serialized_size() const;
     void serialize(bytes::iterator& out) const;
     static read_command deserialize(bytes_view& v);
@@ -105,6 +183,29 @@ class read_command {
     friend std::ostream& operator<<(std::ostream& out, const read_command& r);
 };
 
+// An aggregate of the rows a read_command selects, which replicas compute
+// partial results of for the coordinator to merge. Names a native
+// aggregate function and the column it takes as argument, if any.
+struct aggregate {
+    sstring function;
+    // Empty for the functions of the rows themselves, like countRows.
+    bytes column;
+
+    size_t serialized_size() const;
+    void serialize(bytes::iterator& out) const;
+    static aggregate deserialize(bytes_view& v);
+};
+
+// The results of aggregates over part of the rows a query selects, in the
+// order of the aggregates. Can be accessed across cores.
+struct partial_aggregates {
+    std::vector<bytes_opt> values;
+
+    size_t serialized_size() const;
+    void serialize(bytes::iterator& out) const;
+    static partial_aggregates deserialize(bytes_view& v);
+};
+
 }
 
 // Allow using query::range<T> in a hash table. The hash function 31 * left +
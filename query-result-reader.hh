@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <deque>
 #include "query-request.hh"
 #include "query-result.hh"
 #include "utils/data_input.hh"
@@ -50,23 +51,142 @@ class result_atomic_cell_view {
     }
 };
 
+// The cells of a column of a columnar result block.
+class columnar_column_view {
+    const int8_t* _present = nullptr;
+    const int8_t* _offsets = nullptr;
+    const int8_t* _values = nullptr;
+    const int8_t* _timestamps = nullptr;
+    const int8_t* _expiries = nullptr;
+    uint32_t _size = 0;
+private:
+    template <typename T>
+    static T read_at(const int8_t* p, size_t i) {
+        return net::ntoh(*reinterpret_cast<const net::packed<T>*>(p + i * sizeof(T)));
+    }
+public:
+    columnar_column_view() = default;
+    // Reads the column of the given number of cells off in.
+    columnar_column_view(data_input& in, uint32_t size, const partition_slice& slice);
+
+    uint32_t size() const {
+        return _size;
+    }
+
+    bool is_present(uint32_t i) const {
+        return _present[i / 8] & (1 << (i % 8));
+    }
+
+    bytes_view value(uint32_t i) const {
+        auto begin = read_at<uint32_t>(_offsets, i);
+        return bytes_view(_values + begin, read_at<uint32_t>(_offsets, i + 1) - begin);
+    }
+
+    // api::missing_timestamp unless the slice asked for timestamps.
+    api::timestamp_type timestamp(uint32_t i) const {
+        return _timestamps ? read_at<api::timestamp_type>(_timestamps, i) : api::missing_timestamp;
+    }
+
+    expiry_opt expiry(uint32_t i) const {
+        if (!_expiries) {
+            return {};
+        }
+        auto rep = read_at<gc_clock::rep>(_expiries, i);
+        if (rep == std::numeric_limits<gc_clock::rep>::max()) {
+            return {};
+        }
+        return gc_clock::time_point(gc_clock::duration(rep));
+    }
+};
+
+// A block of a columnar result, see query-result.hh.
+//
+// The clustering keys are decoded when the block is read; the rest are
+// views into the result.
+class columnar_block_view {
+    uint32_t _partition_count = 0;
+    uint32_t _row_count = 0;
+    const int8_t* _row_offsets = nullptr;
+    std::vector<bytes_view> _partition_keys;
+    bytes _clustering_keys;
+    std::vector<uint32_t> _clustering_key_offsets;
+    std::vector<columnar_column_view> _static_columns;
+    std::vector<columnar_column_view> _regular_columns;
+public:
+    // Reads the block off in.
+    columnar_block_view(data_input& in, const partition_slice& slice);
+
+    uint32_t partition_count() const {
+        return _partition_count;
+    }
+
+    uint32_t row_count() const {
+        return _row_count;
+    }
+
+    // The index of the first row of the partition; that of partition_count()
+    // is row_count().
+    uint32_t first_row(uint32_t partition) const {
+        return net::ntoh(*reinterpret_cast<const net::packed<uint32_t>*>(_row_offsets + partition * sizeof(uint32_t)));
+    }
+
+    // Valid only if the slice has send_partition_key.
+    partition_key_view partition_key(uint32_t partition) const {
+        return partition_key_view::from_bytes(_partition_keys[partition]);
+    }
+
+    // Valid only if the slice has send_clustering_key.
+    clustering_key_view clustering_key(uint32_t row) const {
+        auto begin = _clustering_key_offsets[row];
+        return clustering_key_view::from_bytes(bytes_view(_clustering_keys.begin() + begin, _clustering_key_offsets[row + 1] - begin));
+    }
+
+    // Indexed by partition, in the order of the slice's static columns.
+    const std::vector<columnar_column_view>& static_columns() const {
+        return _static_columns;
+    }
+
+    // Indexed by row, in the order of the slice's regular columns.
+    const std::vector<columnar_column_view>& regular_columns() const {
+        return _regular_columns;
+    }
+};
+
 // Contains cells in the same order as requested by partition_slice.
 // Contains only live cells.
 class result_row_view {
     bytes_view _v;
     const partition_slice& _slice;
+    // The columns of a columnar result and the index of the row's cells.
+    const std::vector<columnar_column_view>* _columns = nullptr;
+    uint32_t _index = 0;
 public:
     result_row_view(bytes_view v, const partition_slice& slice) : _v(v), _slice(slice) {}
+    result_row_view(const std::vector<columnar_column_view>& columns, uint32_t index, const partition_slice& slice)
+        : _slice(slice), _columns(&columns), _index(index) {}
 
     class iterator_type {
         data_input _in;
         const partition_slice& _slice;
+        const std::vector<columnar_column_view>* _columns;
+        uint32_t _index;
+        size_t _column = 0;
     public:
-        iterator_type(bytes_view v, const partition_slice& slice)
+        iterator_type(bytes_view v, const partition_slice& slice,
+                const std::vector<columnar_column_view>* columns = nullptr, uint32_t index = 0)
             : _in(v)
             , _slice(slice)
+            , _columns(columns)
+            , _index(index)
         { }
         std::experimental::optional<result_atomic_cell_view> next_atomic_cell() {
+            if (_columns) {
+                auto& c = (*_columns)[_column++];
+                if (!c.is_present(_index)) {
+                    return {};
+                }
+                return {result_atomic_cell_view(c.timestamp(_index), c.expiry(_index), c.value(_index))};
+            }
             auto present = _in.read<int8_t>();
             if (!present) {
                 return {};
@@ -84,6 +204,13 @@ class result_row_view {
             return {result_atomic_cell_view(timestamp, expiry_, value)};
         }
         std::experimental::optional<collection_mutation::view> next_collection_cell() {
+            if (_columns) {
+                auto& c = (*_columns)[_column++];
+                if (!c.is_present(_index)) {
+                    return {};
+                }
+                return collection_mutation::view{c.value(_index)};
+            }
             auto present = _in.read<int8_t>();
             if (!present) {
                 return {};
@@ -100,11 +227,11 @@ class result_row_view {
     };
 
     iterator_type iterator() const {
-        return iterator_type(_v, _slice);
+        return iterator_type(_v, _slice, _columns, _index);
     }
 
     bool empty() const {
-        return _v.empty();
+        return _columns ? _columns->empty() : _v.empty();
     }
 };
 
@@ -122,15 +249,14 @@ class result_row_view {
 //   -> accept_partition_end()
 //   ...
 //
+// The keys are views into the result, valid until consume() returns.
 struct result_visitor {
-    void accept_new_partition(
-        const partition_key& key, // FIXME: use view for the key
-        uint32_t row_count) {}
+    void accept_new_partition(const partition_key_view& key, uint32_t row_count) {}
 
     void accept_new_partition(uint32_t row_count) {}
 
     void accept_new_row(
-        const clustering_key& key, // FIXME: use view for the key
+        const clustering_key_view& key,
         const result_row_view& static_row,
         const result_row_view& row) {}
 
@@ -146,11 +272,33 @@ class result_view {
 
     template <typename ResultVisitor>
     void consume(const partition_slice& slice, ResultVisitor&& visitor) {
+        std::deque<columnar_block_view> blocks;
+        consume(slice, visitor, blocks);
+    }
+
+    // Consumes a result, a merged one part by part, without copying the
+    // parts together.
+    template <typename ResultVisitor>
+    static void consume(const result& r, const partition_slice& slice, ResultVisitor&& visitor) {
+        std::deque<columnar_block_view> blocks;
+        r.for_each_view([&] (bytes_view v) {
+            result_view(v).consume(slice, visitor, blocks);
+        });
+    }
+private:
+    // Columnar blocks are kept in blocks, for the keys decoded to stay valid
+    // until consume() returns.
+    template <typename ResultVisitor>
+    void consume(const partition_slice& slice, ResultVisitor& visitor, std::deque<columnar_block_view>& blocks) {
+        if (slice.options.contains<partition_slice::option::columnar>()) {
+            consume_columnar(slice, visitor, blocks);
+            return;
+        }
         data_input in(_v);
         while (in.has_next()) {
             auto row_count = in.read<uint32_t>();
             if (slice.options.contains<partition_slice::option::send_partition_key>()) {
-                auto key = partition_key::from_bytes(to_bytes(in.read_view_to_blob<uint32_t>()));
+                auto key = partition_key_view::from_bytes(in.read_view_to_blob<uint32_t>());
                 visitor.accept_new_partition(key, row_count);
             } else {
                 visitor.accept_new_partition(row_count);
@@ -164,7 +312,7 @@ class result_view {
 
             while (row_count--) {
                 if (slice.options.contains<partition_slice::option::send_clustering_key>()) {
-                    auto key = clustering_key::from_bytes(to_bytes(in.read_view_to_blob<uint32_t>()));
+                    auto key = clustering_key_view::from_bytes(in.read_view_to_blob<uint32_t>());
                     result_row_view row(in.read_view_to_blob<uint32_t>(), slice);
                     visitor.accept_new_row(key, static_row, row);
                 } else {
@@ -176,6 +324,40 @@ class result_view {
             visitor.accept_partition_end(static_row);
         }
     }
+
+    // Visits the rows of a columnar result, for the consumers of row-wise
+    // ones to read either.
+    template <typename ResultVisitor>
+    void consume_columnar(const partition_slice& slice, ResultVisitor& visitor, std::deque<columnar_block_view>& blocks) {
+        data_input in(_v);
+        while (in.has_next()) {
+            blocks.emplace_back(in, slice);
+            auto& block = blocks.back();
+            for (uint32_t p = 0; p < block.partition_count(); ++p) {
+                auto first = block.first_row(p);
+                auto end = block.first_row(p + 1);
+                if (slice.options.contains<partition_slice::option::send_partition_key>()) {
+                    visitor.accept_new_partition(block.partition_key(p), end - first);
+                } else {
+                    visitor.accept_new_partition(end - first);
+                }
+
+                auto static_row = slice.static_columns.empty() ? result_row_view(bytes_view(), slice)
+                        : result_row_view(block.static_columns(), p, slice);
+
+                for (auto r = first; r < end; ++r) {
+                    result_row_view row(block.regular_columns(), r, slice);
+                    if (slice.options.contains<partition_slice::option::send_clustering_key>()) {
+                        visitor.accept_new_row(block.clustering_key(r), static_row, row);
+                    } else {
+                        visitor.accept_new_row(static_row, row);
+                    }
+                }
+
+                visitor.accept_partition_end(static_row);
+            }
+        }
+    }
 };
 
 }
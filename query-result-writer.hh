@@ -30,6 +30,13 @@
 
 namespace query {
 
+// The present byte of collections in rows to be encoded as columns.
+static constexpr int8_t columnar_collection_cell = 2;
+
+// Encodes rows serialized as with row_writer, collections marked with
+// columnar_collection_cell, into a columnar block.
+bytes_ostream encode_columnar(const partition_slice& slice, bytes_view rows);
+
 class result::row_writer {
     bytes_ostream& _w;
     const partition_slice& _slice;
@@ -52,6 +59,11 @@ class result::row_writer {
     }
 
     void add(::atomic_cell_view c) {
+        add(c, c.value());
+    }
+
+    // Adds a cell with a value other than the one it holds, like counters.
+    void add(::atomic_cell_view c, bytes_view value) {
         // FIXME: store this in a bitmap
         _w.write<int8_t>(true);
         assert(c.is_live());
@@ -63,12 +75,14 @@ class result::row_writer {
                 _w.write<gc_clock::rep>(std::numeric_limits<gc_clock::rep>::max());
             }
         }
-        _w.write_blob(c.value());
+        _w.write_blob(value);
     }
 
     void add(collection_mutation::view v) {
         // FIXME: store this in a bitmap
-        _w.write<int8_t>(true);
+        // Columnar results are encoded from the rows, which have to tell
+        // collections from atomic cells for that.
+        _w.write<int8_t>(_slice.options.contains<partition_slice::option::columnar>() ? columnar_collection_cell : true);
         _w.write_blob(v.data);
     }
 
@@ -85,18 +99,24 @@ class result::partition_writer {
     const partition_slice& _slice;
     bytes_ostream::place_holder<uint32_t> _count_ph;
     bytes_ostream::position _pos;
+    size_t _max_size;
     uint32_t _row_count = 0;
+    uint32_t _filtered_row_count = 0;
+    uint32_t _tombstone_count = 0;
     bool _static_row_added = false;
+    const clustering_key* _last_row = nullptr;
 public:
     partition_writer(
         const partition_slice& slice,
         bytes_ostream::place_holder<uint32_t> count_ph,
         bytes_ostream::position pos,
-        bytes_ostream& w)
+        bytes_ostream& w,
+        size_t max_size)
         : _w(w)
         , _slice(slice)
         , _count_ph(count_ph)
         , _pos(pos)
+        , _max_size(max_size)
     { }
 
     row_writer add_row(const clustering_key& key) {
@@ -104,6 +124,7 @@ class result::partition_writer {
             _w.write_blob(key);
         }
         ++_row_count;
+        _last_row = &key;
         auto size_placeholder = _w.write_place_holder<uint32_t>();
         return row_writer(_slice, _w, size_placeholder);
     }
@@ -121,6 +142,37 @@ class result::partition_writer {
         return _row_count;
     }
 
+    // Counts a live row left out as it didn't match the filters of the slice.
+    void filter_row() {
+        ++_filtered_row_count;
+    }
+
+    uint32_t filtered_row_count() const {
+        return _filtered_row_count;
+    }
+
+    // Counts dead rows and range tombstones read on the way to the rows
+    // returned.
+    void add_tombstones(uint32_t n) {
+        _tombstone_count += n;
+    }
+
+    uint32_t tombstone_count() const {
+        return _tombstone_count;
+    }
+
+    // Whether the result reached its size limit, so that no more rows
+    // should be added to it.
+    bool is_full() const {
+        return _w.size() >= _max_size;
+    }
+
+    // The key of the last row added, valid as long as the key passed to
+    // add_row() is. Null when no rows were added.
+    const clustering_key* last_row() const {
+        return _last_row;
+    }
+
     void finish() {
         _w.set(_count_ph, _row_count);
 
@@ -132,6 +184,7 @@ class result::partition_writer {
 
     void retract() {
         _row_count = 0;
+        _last_row = nullptr;
         _w.retract(_pos);
     }
 
@@ -140,11 +193,18 @@ class result::partition_writer {
     }
 };
 
+// The size limit bounds the result to what it reached with the row which
+// took it over the limit. A result that large may thus have stopped short of
+// the rows which were asked for.
 class result::builder {
     bytes_ostream _w;
     const partition_slice& _slice;
+    size_t _max_size;
 public:
-    builder(const partition_slice& slice) : _slice(slice) { }
+    builder(const partition_slice& slice, size_t max_size = std::numeric_limits<size_t>::max())
+        : _slice(slice)
+        , _max_size(max_size)
+    { }
 
     // Starts new partition and returns a builder for its contents.
     // Invalidates all previously obtained builders
@@ -154,10 +214,20 @@ class result::builder {
         if (_slice.options.contains<partition_slice::option::send_partition_key>()) {
             _w.write_blob(key);
         }
-        return partition_writer(_slice, count_place_holder, pos, _w);
+        return partition_writer(_slice, count_place_holder, pos, _w, _max_size);
     }
 
+    bool is_full() const {
+        return _w.size() >= _max_size;
+    }
+
+    // Columnar results are written row by row, like the others, and
+    // encoded at the end, so that partitions can be retracted and sizes
+    // limited alike.
     result build() {
+        if (_slice.options.contains<partition_slice::option::columnar>()) {
+            return result(encode_columnar(_slice, _w.linearize()));
+        }
         return result(std::move(_w));
     };
 
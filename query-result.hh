@@ -23,8 +23,12 @@
 
 #define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
 #include <cryptopp/md5.h>
+#include <deque>
+#include "core/distributed.hh"
 #include "bytes_ostream.hh"
 #include "query-request.hh"
+#include "utils/murmur_hash.hh"
+#include "net/byteorder.hh"
 
 namespace query {
 
@@ -116,8 +120,57 @@ class result_digest {
 // <row-count>       ::= <uint32_t>
 // <blob-length>     ::= <uint32_t>
 //
+// With partition_slice::option::columnar, they are serialized instead as
+// blocks, each holding the values of a column contiguously. Concatenating
+// results concatenates their blocks.
+//
+// <result>          ::= <block>*
+// <block>           ::= <block-length> <partition-count> <total-row-count> <row-offsets>
+//                       [ <partition-key>* ] [ <clustering-key>* ] <static-column>* <regular-column>*
+// <row-offsets>     ::= <uint32_t>*
+// <clustering-key>  ::= <shared-length> <blob>
+// <column>          ::= <present-bitmap> <value-offsets> <uint8_t>* [ <timestamp>* <expiry>* ]
+// <present-bitmap>  ::= <uint8_t>*
+// <value-offsets>   ::= <uint32_t>*
+// <block-length>    ::= <uint32_t>
+// <partition-count> ::= <uint32_t>
+// <total-row-count> ::= <uint32_t>
+// <shared-length>   ::= <uint16_t>
+//
+// <block-length> is the size of the rest of the block.
+// There are <partition-count> + 1 <row-offsets>, the index of the first row
+// of each partition and the total row count. A <clustering-key> is the
+// length of the prefix its representation shares with the previous key of
+// the block, followed by the rest of it. Static columns have a cell per
+// partition, regular columns one per row. Cell i is present if bit i % 8
+// of byte i / 8 of <present-bitmap> is set. There is one more
+// <value-offsets> than cells, the values of cell i being those between
+// offsets i and i + 1. Atomic cells and collections are both stored as
+// their value.
+//
 class result {
-    bytes_ostream _w;
+    // A result merged from others holds them, rather than copies of their
+    // buffers, until something needs a single buffer.
+    mutable bytes_ostream _w;
+    mutable std::vector<foreign_ptr<lw_shared_ptr<result>>> _parts;
+private:
+    void flatten() const {
+        for (auto&& p : _parts) {
+            _w.append(p->buf());
+        }
+        _parts.clear();
+    }
+    void collect_views(std::vector<bytes_view>& views, std::deque<bytes_ostream>& copies) const {
+        if (_w.is_linearized()) {
+            views.push_back(_w.view());
+        } else {
+            copies.emplace_back(_w);
+            views.push_back(copies.back().linearize());
+        }
+        for (auto&& p : _parts) {
+            p->collect_views(views, copies);
+        }
+    }
 public:
     class builder;
     class partition_writer;
@@ -126,23 +179,64 @@ class result {
 
     result() {}
     result(bytes_ostream&& w) : _w(std::move(w)) {}
+    // The concatenation of the parts, which are kept as they are.
+    explicit result(std::vector<foreign_ptr<lw_shared_ptr<result>>> parts) : _parts(std::move(parts)) {}
 
+    // Copies the parts of a merged result into one buffer, the first time.
     const bytes_ostream& buf() const {
+        flatten();
         return _w;
     }
 
-    result_digest digest() {
+    // Calls func with views covering the result, in order, without copying
+    // the parts of a merged result together. The views are valid until
+    // for_each_view() returns.
+    template <typename Func>
+    void for_each_view(Func&& func) const {
+        std::vector<bytes_view> views;
+        std::deque<bytes_ostream> copies;
+        collect_views(views, copies);
+        for (auto&& v : views) {
+            func(v);
+        }
+    }
+
+    // All the replicas of a read must be given the same slice, so that they
+    // agree on the digest algorithm.
+    result_digest digest(const partition_slice& slice) {
+        flatten();
+        bytes_view v = _w.linearize();
+        if (slice.options.contains(partition_slice::option::murmur3_digest)) {
+            std::array<uint64_t, 2> hash;
+            utils::murmur_hash::hash3_x64_128(v, 0, hash);
+            bytes b(bytes::initialized_later(), sizeof(hash));
+            auto out = b.begin();
+            for (auto h : hash) {
+                h = net::hton(h);
+                out = std::copy_n(reinterpret_cast<const int8_t*>(&h), sizeof(h), out);
+            }
+            return result_digest(std::move(b));
+        }
         CryptoPP::Weak::MD5 hash;
         bytes b(bytes::initialized_later(), CryptoPP::Weak::MD5::DIGESTSIZE);
-        bytes_view v = _w.linearize();
         hash.CalculateDigest(reinterpret_cast<unsigned char*>(b.begin()), reinterpret_cast<const unsigned char*>(v.begin()), v.size());
         return result_digest(std::move(b));
     }
     sstring pretty_print(schema_ptr, const query::partition_slice&) const;
-    size_t serialized_size() const { return _w.size(); }
+    size_t serialized_size() const {
+        size_t size = _w.size();
+        for (auto&& p : _parts) {
+            size += p->serialized_size();
+        }
+        return size;
+    }
     void serialize(bytes::iterator& out) {
-        auto v = _w.linearize();
-        out = std::copy(v.begin(), v.end(), out);
+        for (bytes_view f : _w.fragments()) {
+            out = std::copy(f.begin(), f.end(), out);
+        }
+        for (auto&& p : _parts) {
+            p->serialize(out);
+        }
     }
     static result deserialize(bytes_view& in) {
         bytes_ostream w;
@@ -22,6 +22,8 @@
 #include "db/serializer.hh"
 #include "query-request.hh"
 #include "query-result.hh"
+#include "query-result-reader.hh"
+#include "query-result-writer.hh"
 #include "query-result-set.hh"
 #include "to_string.hh"
 #include "bytes.hh"
@@ -32,12 +34,22 @@ namespace query {
 
 const partition_range full_partition_range = partition_range::make_open_ended_both_sides();
 
+std::ostream& operator<<(std::ostream& out, const column_filter& f) {
+    static const char* ops[] = { "=", "<", "<=", ">", ">=", "IN" };
+    out << "{column=" << f.column << " " << ops[unsigned(f.oper)] << " [";
+    for (auto&& v : f.values) {
+        out << (&v == &f.values.front() ? "" : ", ") << to_hex(v);
+    }
+    return out << "]}";
+}
+
 std::ostream& operator<<(std::ostream& out, const partition_slice& ps) {
     return out << "{"
         << "regular_cols=[" << join(", ", ps.regular_columns) << "]"
         << ", static_cols=[" << join(", ", ps.static_columns) << "]"
         << ", rows=[" << join(", ", ps.row_ranges) << "]"
         << ", options=" << sprint("%x", ps.options.mask()) // FIXME: pretty print options
+        << ", filters=[" << join(", ", ps.filters) << "]"
         << "}";
 }
 
@@ -46,7 +58,11 @@ std::ostream& operator<<(std::ostream& out, const read_command& r) {
         << "cf_id=" << r.cf_id
         << ", slice=" << r.slice << ""
         << ", limit=" << r.row_limit
-        << ", timestamp=" << r.timestamp.time_since_epoch().count() << "}";
+        << ", timestamp=" << r.timestamp.time_since_epoch().count()
+        << ", query_uuid=" << r.query_uuid
+        << ", is_first_page=" << r.is_first_page
+        << ", max_result_size=" << r.max_result_size
+        << ", index=" << (r.index ? to_hex(r.index->column) + "=" + to_hex(r.index->value) : sstring("none")) << "}";
 }
 
 size_t read_command::serialized_size() const {
@@ -54,13 +70,32 @@ size_t read_command::serialized_size() const {
     for (auto&& i : slice.row_ranges) {
         row_range_size += i.serialized_size();
     }
+    size_t filters_size = serialize_int32_size;
+    for (auto&& f : slice.filters) {
+        filters_size += serialize_int32_size + serialize_int8_size + serialize_int32_size;
+        for (auto&& v : f.values) {
+            filters_size += serialize_int32_size + v.size();
+        }
+    }
     return 2 * serialize_int64_size // cf_id
             + serialize_int32_size // row_limit
             + serialize_int32_size // timestamp
             + serialize_int64_size // slice.options
             + (slice.static_columns.size() + 1) * serialize_int32_size
             + (slice.regular_columns.size() + 1) * serialize_int32_size
-            + row_range_size;
+            + row_range_size
+            + 2 * serialize_int64_size // query_uuid
+            + serialize_bool_size // is_first_page
+            + serialize_bool_size // resume_after
+            + (resume_after ? 2 * serialize_int32_size + resume_after->key.representation().size() + resume_after->row.representation().size() : 0)
+            + serialize_int32_size // max_result_size
+            + serialize_bool_size // index
+            + (index ? 2 * serialize_int32_size + index->column.size() + index->value.size() : 0)
+            + filters_size
+            + serialize_bool_size // trace_session
+            + (trace_session ? 2 * serialize_int64_size : 0)
+            + serialize_bool_size // deadline
+            + (deadline ? serialize_int64_size : 0);
 }
 
 void read_command::serialize(bytes::iterator& out) const {
@@ -81,6 +116,46 @@ void read_command::serialize(bytes::iterator& out) const {
     for (auto&& i : slice.row_ranges) {
         i.serialize(out);
     }
+    serialize_int64(out, query_uuid.get_most_significant_bits());
+    serialize_int64(out, query_uuid.get_least_significant_bits());
+    serialize_bool(out, is_first_page);
+    serialize_bool(out, bool(resume_after));
+    if (resume_after) {
+        auto&& key = resume_after->key.representation();
+        serialize_int32(out, key.size());
+        out = std::copy(key.begin(), key.end(), out);
+        auto&& row = resume_after->row.representation();
+        serialize_int32(out, row.size());
+        out = std::copy(row.begin(), row.end(), out);
+    }
+    serialize_int32(out, max_result_size);
+    serialize_bool(out, bool(index));
+    if (index) {
+        serialize_int32(out, index->column.size());
+        out = std::copy(index->column.begin(), index->column.end(), out);
+        serialize_int32(out, index->value.size());
+        out = std::copy(index->value.begin(), index->value.end(), out);
+    }
+    serialize_int32(out, slice.filters.size());
+    for (auto&& f : slice.filters) {
+        serialize_int32(out, f.column);
+        serialize_int8(out, uint8_t(f.oper));
+        serialize_int32(out, f.values.size());
+        for (auto&& v : f.values) {
+            serialize_int32(out, v.size());
+            out = std::copy(v.begin(), v.end(), out);
+        }
+    }
+    serialize_bool(out, bool(trace_session));
+    if (trace_session) {
+        serialize_int64(out, trace_session->get_most_significant_bits());
+        serialize_int64(out, trace_session->get_least_significant_bits());
+    }
+    serialize_bool(out, bool(deadline));
+    if (deadline) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now());
+        serialize_int64(out, left.count());
+    }
 }
 
 read_command read_command::deserialize(bytes_view& v) {
@@ -112,7 +187,102 @@ read_command read_command::deserialize(bytes_view& v) {
         row_ranges.emplace_back(clustering_range::deserialize(v));
     };
 
-    return read_command(std::move(uuid), partition_slice(std::move(row_ranges), std::move(static_columns), std::move(regular_columns), options), row_limit, timestamp);
+    read_command cmd(std::move(uuid), partition_slice(std::move(row_ranges), std::move(static_columns), std::move(regular_columns), options), row_limit, timestamp);
+    // Nodes which don't page natively send nothing more.
+    if (!v.empty()) {
+        auto query_msb = read_simple<int64_t>(v);
+        auto query_lsb = read_simple<int64_t>(v);
+        cmd.query_uuid = utils::UUID(query_msb, query_lsb);
+        cmd.is_first_page = read_simple<int8_t>(v);
+        if (read_simple<int8_t>(v)) {
+            auto key = partition_key::from_bytes(to_bytes(read_simple_bytes(v, read_simple<uint32_t>(v))));
+            auto row = clustering_key::from_bytes(to_bytes(read_simple_bytes(v, read_simple<uint32_t>(v))));
+            cmd.resume_after = row_position{std::move(key), std::move(row)};
+        }
+        cmd.max_result_size = read_simple<uint32_t>(v);
+        if (read_simple<int8_t>(v)) {
+            auto column = to_bytes(read_simple_bytes(v, read_simple<uint32_t>(v)));
+            auto value = to_bytes(read_simple_bytes(v, read_simple<uint32_t>(v)));
+            cmd.index = index_restriction{std::move(column), std::move(value)};
+        }
+        size = read_simple<uint32_t>(v);
+        cmd.slice.filters.reserve(size);
+        while (size--) {
+            column_filter f;
+            f.column = read_simple<uint32_t>(v);
+            f.oper = column_filter::op(read_simple<uint8_t>(v));
+            auto count = read_simple<uint32_t>(v);
+            f.values.reserve(count);
+            while (count--) {
+                f.values.emplace_back(to_bytes(read_simple_bytes(v, read_simple<uint32_t>(v))));
+            }
+            cmd.slice.filters.emplace_back(std::move(f));
+        }
+        // Nor do nodes which don't trace.
+        if (!v.empty() && read_simple<int8_t>(v)) {
+            auto msb = read_simple<int64_t>(v);
+            auto lsb = read_simple<int64_t>(v);
+            cmd.trace_session = utils::UUID(msb, lsb);
+        }
+        // Nor those which don't send deadlines.
+        if (!v.empty() && read_simple<int8_t>(v)) {
+            auto left = std::chrono::milliseconds(read_simple<int64_t>(v));
+            cmd.deadline = std::chrono::steady_clock::now() + left;
+        }
+    }
+    return cmd;
+}
+
+size_t aggregate::serialized_size() const {
+    return serialize_string_size(function) + serialize_int32_size + column.size();
+}
+
+void aggregate::serialize(bytes::iterator& out) const {
+    serialize_string(out, function);
+    serialize_int32(out, column.size());
+    out = std::copy(column.begin(), column.end(), out);
+}
+
+aggregate aggregate::deserialize(bytes_view& v) {
+    auto function = read_simple_short_string(v);
+    auto size = read_simple<uint32_t>(v);
+    auto column = to_bytes(read_simple_bytes(v, size));
+    return aggregate{std::move(function), std::move(column)};
+}
+
+size_t partial_aggregates::serialized_size() const {
+    size_t size = serialize_int32_size;
+    for (auto&& v : values) {
+        size += serialize_int32_size + (v ? v->size() : 0);
+    }
+    return size;
+}
+
+void partial_aggregates::serialize(bytes::iterator& out) const {
+    serialize_int32(out, values.size());
+    for (auto&& v : values) {
+        if (!v) {
+            serialize_int32(out, uint32_t(-1));
+            continue;
+        }
+        serialize_int32(out, v->size());
+        out = std::copy(v->begin(), v->end(), out);
+    }
+}
+
+partial_aggregates partial_aggregates::deserialize(bytes_view& v) {
+    auto count = read_simple<uint32_t>(v);
+    partial_aggregates result;
+    result.values.reserve(count);
+    while (count--) {
+        auto size = read_simple<int32_t>(v);
+        if (size < 0) {
+            result.values.emplace_back();
+        } else {
+            result.values.emplace_back(to_bytes(read_simple_bytes(v, size)));
+        }
+    }
+    return result;
 }
 
 
@@ -128,7 +298,7 @@ to_partition_range(query::range<dht::token> r) {
 
     auto end = r.end()
                ? bound_opt(dht::ring_position(r.end()->value(),
-            r.start()->is_inclusive()
+            r.end()->is_inclusive()
             ? dht::ring_position::token_bound::end
             : dht::ring_position::token_bound::start))
                : bound_opt();
@@ -136,6 +306,193 @@ to_partition_range(query::range<dht::token> r) {
     return { std::move(start), std::move(end) };
 }
 
+namespace {
+
+// A column of a columnar result block being encoded.
+class column_encoder {
+    bool _with_timestamps;
+    uint32_t _size = 0;
+    std::vector<uint8_t> _present;
+    std::vector<uint32_t> _offsets = { 0 };
+    bytes_ostream _values;
+    std::vector<api::timestamp_type> _timestamps;
+    std::vector<gc_clock::rep> _expiries;
+private:
+    void add(bool present, bytes_view value, api::timestamp_type timestamp, gc_clock::rep expiry) {
+        if (_size % 8 == 0) {
+            _present.push_back(0);
+        }
+        if (present) {
+            _present.back() |= 1 << (_size % 8);
+        }
+        ++_size;
+        _values.write(value);
+        _offsets.push_back(_values.size());
+        if (_with_timestamps) {
+            _timestamps.push_back(timestamp);
+            _expiries.push_back(expiry);
+        }
+    }
+public:
+    explicit column_encoder(bool with_timestamps) : _with_timestamps(with_timestamps) { }
+
+    // Reads a cell as written by result::row_writer.
+    void add_cell(data_input& in) {
+        auto present = in.read<int8_t>();
+        auto timestamp = api::missing_timestamp;
+        auto expiry = std::numeric_limits<gc_clock::rep>::max();
+        if (!present) {
+            add(false, bytes_view(), timestamp, expiry);
+            return;
+        }
+        if (present != columnar_collection_cell && _with_timestamps) {
+            timestamp = in.read<api::timestamp_type>();
+            expiry = in.read<gc_clock::rep>();
+        }
+        add(true, in.read_view_to_blob<uint32_t>(), timestamp, expiry);
+    }
+
+    void write(bytes_ostream& out) const {
+        for (auto b : _present) {
+            out.write(b);
+        }
+        for (auto offset : _offsets) {
+            out.write(offset);
+        }
+        out.append(_values);
+        for (auto timestamp : _timestamps) {
+            out.write(timestamp);
+        }
+        for (auto expiry : _expiries) {
+            out.write(expiry);
+        }
+    }
+};
+
+}
+
+bytes_ostream encode_columnar(const partition_slice& slice, bytes_view rows) {
+    bytes_ostream out;
+    if (rows.empty()) {
+        return out;
+    }
+    auto with_timestamps = slice.options.contains<partition_slice::option::send_timestamp_and_expiry>();
+    std::vector<column_encoder> static_columns(slice.static_columns.size(), column_encoder(with_timestamps));
+    std::vector<column_encoder> regular_columns(slice.regular_columns.size(), column_encoder(with_timestamps));
+    auto add_row = [] (bytes_view row, std::vector<column_encoder>& columns) {
+        data_input in(row);
+        for (auto&& c : columns) {
+            c.add_cell(in);
+        }
+    };
+
+    std::vector<uint32_t> row_offsets;
+    std::vector<bytes_view> partition_keys;
+    bytes_ostream clustering_keys;
+    bytes_view last_key;
+    uint32_t row_count = 0;
+    data_input in(rows);
+    while (in.has_next()) {
+        row_offsets.push_back(row_count);
+        auto partition_rows = in.read<uint32_t>();
+        if (slice.options.contains<partition_slice::option::send_partition_key>()) {
+            partition_keys.push_back(in.read_view_to_blob<uint32_t>());
+        }
+        if (!slice.static_columns.empty()) {
+            add_row(in.read_view_to_blob<uint32_t>(), static_columns);
+        }
+        for (; partition_rows; --partition_rows) {
+            if (slice.options.contains<partition_slice::option::send_clustering_key>()) {
+                auto key = in.read_view_to_blob<uint32_t>();
+                size_t shared = std::mismatch(key.begin(), key.end(), last_key.begin(), last_key.end()).first - key.begin();
+                shared = std::min<size_t>(shared, std::numeric_limits<uint16_t>::max());
+                clustering_keys.write<uint16_t>(shared);
+                clustering_keys.write_blob(key.substr(shared));
+                last_key = key;
+            }
+            add_row(in.read_view_to_blob<uint32_t>(), regular_columns);
+            ++row_count;
+        }
+    }
+    row_offsets.push_back(row_count);
+
+    auto length = out.write_place_holder<uint32_t>();
+    auto start = out.pos();
+    out.write<uint32_t>(row_offsets.size() - 1);
+    out.write<uint32_t>(row_count);
+    for (auto offset : row_offsets) {
+        out.write(offset);
+    }
+    for (auto key : partition_keys) {
+        out.write_blob(key);
+    }
+    out.append(clustering_keys);
+    for (auto&& c : static_columns) {
+        c.write(out);
+    }
+    for (auto&& c : regular_columns) {
+        c.write(out);
+    }
+    out.set(length, uint32_t(out.written_since(start)));
+    return out;
+}
+
+columnar_column_view::columnar_column_view(data_input& in, uint32_t size, const partition_slice& slice)
+    : _size(size)
+{
+    _present = in.read_view((size + 7) / 8).begin();
+    _offsets = in.read_view((size + 1) * sizeof(uint32_t)).begin();
+    _values = in.read_view(read_at<uint32_t>(_offsets, size)).begin();
+    if (slice.options.contains<partition_slice::option::send_timestamp_and_expiry>()) {
+        _timestamps = in.read_view(size * sizeof(api::timestamp_type)).begin();
+        _expiries = in.read_view(size * sizeof(gc_clock::rep)).begin();
+    }
+}
+
+columnar_block_view::columnar_block_view(data_input& in, const partition_slice& slice) {
+    data_input block(in.read_view(in.read<uint32_t>()));
+    _partition_count = block.read<uint32_t>();
+    _row_count = block.read<uint32_t>();
+    _row_offsets = block.read_view((_partition_count + 1) * sizeof(uint32_t)).begin();
+    if (slice.options.contains<partition_slice::option::send_partition_key>()) {
+        _partition_keys.reserve(_partition_count);
+        for (uint32_t p = 0; p < _partition_count; ++p) {
+            _partition_keys.push_back(block.read_view_to_blob<uint32_t>());
+        }
+    }
+    if (slice.options.contains<partition_slice::option::send_clustering_key>()) {
+        // Sized first, so that keys can be copied from the previous one.
+        data_input sizes(block);
+        size_t size = 0;
+        for (uint32_t r = 0; r < _row_count; ++r) {
+            size += sizes.read<uint16_t>();
+            size += sizes.read_view_to_blob<uint32_t>().size();
+        }
+        _clustering_keys = bytes(bytes::initialized_later(), size);
+        _clustering_key_offsets.reserve(_row_count + 1);
+        _clustering_key_offsets.push_back(0);
+        auto out = _clustering_keys.begin();
+        auto last = out;
+        for (uint32_t r = 0; r < _row_count; ++r) {
+            auto shared = block.read<uint16_t>();
+            auto rest = block.read_view_to_blob<uint32_t>();
+            auto key = out;
+            out = std::copy_n(last, shared, out);
+            out = std::copy(rest.begin(), rest.end(), out);
+            last = key;
+            _clustering_key_offsets.push_back(out - _clustering_keys.begin());
+        }
+    }
+    _static_columns.reserve(slice.static_columns.size());
+    for (size_t i = 0; i < slice.static_columns.size(); ++i) {
+        _static_columns.emplace_back(block, _partition_count, slice);
+    }
+    _regular_columns.reserve(slice.regular_columns.size());
+    for (size_t i = 0; i < slice.regular_columns.size(); ++i) {
+        _regular_columns.emplace_back(block, _row_count, slice);
+    }
+}
+
 sstring
 result::pretty_print(schema_ptr s, const query::partition_slice& slice) const {
     std::ostringstream out;
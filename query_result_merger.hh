@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <limits>
 #include "core/distributed.hh"
 #include "query-result.hh"
 
@@ -28,36 +29,41 @@ namespace query {
 
 // Merges non-overlapping results into one
 // Implements @Reducer concept from distributed.hh
+//
+// Given a size limit, the results following the one which reaches it are
+// dropped, as that one may have stopped short of the rows asked for.
 class result_merger {
     std::vector<foreign_ptr<lw_shared_ptr<query::result>>> _partial;
+    size_t _max_size;
+    size_t _size = 0;
 public:
+    explicit result_merger(size_t max_size = std::numeric_limits<size_t>::max())
+        : _max_size(max_size)
+    { }
+
     void reserve(size_t size) {
         _partial.reserve(size);
     }
 
     void operator()(foreign_ptr<lw_shared_ptr<query::result>> r) {
+        if (_size >= _max_size) {
+            return;
+        }
+        _size += r->serialized_size();
         _partial.emplace_back(std::move(r));
     }
 
-    // FIXME: Eventually we should return a composite_query_result here
-    // which holds the vector of query results and which can be quickly turned
-    // into packet fragments by the transport layer without copying the data.
-    foreign_ptr<lw_shared_ptr<query::result>> get() {
-        auto merged = make_lw_shared<query::result>();
-
-        size_t total_size = 0;
-        for (auto&& r : _partial) {
-            total_size += r->_w.size();
-        }
-
-        bytes_ostream w;
-        w.reserve(total_size);
+    bool is_full() const {
+        return _size >= _max_size;
+    }
 
-        for (auto&& r : _partial) {
-            w.append(r->_w);
+    // The merged result holds the partial ones, so that their buffers are
+    // consumed where they are rather than copied together.
+    foreign_ptr<lw_shared_ptr<query::result>> get() {
+        if (_partial.size() == 1) {
+            return std::move(_partial.front());
         }
-
-        return make_foreign(make_lw_shared<query::result>(std::move(w)));
+        return make_foreign(make_lw_shared<query::result>(std::move(_partial)));
     }
 };
 
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "merkle_tree.hh"
+#include "types.hh"
+#include "utils/serialization.hh"
+
+constexpr unsigned merkle_tree::max_depth;
+
+// Orders the tokens of a range starting after start as they come on the
+// ring, wrapping around its end.
+static bool ring_less(const dht::token& start, const dht::token& a, const dht::token& b) {
+    bool a_wraps = a <= start;
+    bool b_wraps = b <= start;
+    if (a_wraps != b_wraps) {
+        return b_wraps;
+    }
+    return a < b;
+}
+
+// Bisects the range depth times, or as many times as its midpoints fall
+// strictly inside the sub-ranges they cut.
+static std::vector<dht::token> split(const query::range<dht::token>& range, unsigned& depth) {
+    auto splittable = [] (const std::experimental::optional<query::range<dht::token>::bound>& b) {
+        return b && !b->value().is_minimum() && !b->value().is_maximum();
+    };
+    if (!splittable(range.start()) || !splittable(range.end())
+            || range.start()->is_inclusive() || !range.end()->is_inclusive()) {
+        depth = 0;
+        return {};
+    }
+    auto& start = range.start()->value();
+    auto& partitioner = dht::global_partitioner();
+    std::vector<dht::token> points{start, range.end()->value()};
+    for (unsigned level = 0; level < depth; ++level) {
+        std::vector<dht::token> next;
+        next.reserve(points.size() * 2 - 1);
+        for (size_t i = 0; i + 1 < points.size(); ++i) {
+            auto mid = partitioner.midpoint(points[i], points[i + 1]);
+            if ((i != 0 && !ring_less(start, points[i], mid)) || (i == 0 && mid == start)
+                    || !ring_less(start, mid, points[i + 1])) {
+                depth = level;
+                return std::vector<dht::token>(points.begin() + 1, points.end() - 1);
+            }
+            next.push_back(points[i]);
+            next.push_back(std::move(mid));
+        }
+        next.push_back(points.back());
+        points = std::move(next);
+    }
+    return std::vector<dht::token>(points.begin() + 1, points.end() - 1);
+}
+
+merkle_tree::merkle_tree(query::range<dht::token> range, unsigned depth)
+    : _range(std::move(range))
+    , _depth(std::min(depth, max_depth))
+    , _splits(split(_range, _depth))
+    , _leaves(size_t(1) << _depth)
+{ }
+
+merkle_tree::hash_type merkle_tree::root() const {
+    hash_type h = 0;
+    for (auto&& leaf : _leaves) {
+        h ^= leaf;
+    }
+    return h;
+}
+
+void merkle_tree::add(const dht::token& t, hash_type h) {
+    auto& start = _range.start() ? _range.start()->value() : t;
+    auto i = std::lower_bound(_splits.begin(), _splits.end(), t, [&start] (const dht::token& a, const dht::token& b) {
+        return ring_less(start, a, b);
+    }) - _splits.begin();
+    _leaves[i] ^= h;
+    ++_partitions;
+}
+
+void merkle_tree::merge(const merkle_tree& other) {
+    assert(_leaves.size() == other._leaves.size());
+    for (size_t i = 0; i < _leaves.size(); ++i) {
+        _leaves[i] ^= other._leaves[i];
+    }
+    _partitions += other._partitions;
+}
+
+merkle_tree merkle_tree::shrink(unsigned depth) const {
+    merkle_tree t(_range, std::min(depth, _depth));
+    auto shift = _depth - t._depth;
+    for (size_t i = 0; i < _leaves.size(); ++i) {
+        t._leaves[i >> shift] ^= _leaves[i];
+    }
+    t._partitions = _partitions;
+    return t;
+}
+
+query::range<dht::token> merkle_tree::leaf_range(size_t i) const {
+    using bound_opt = std::experimental::optional<query::range<dht::token>::bound>;
+    auto start = i == 0 ? _range.start() : bound_opt(query::range<dht::token>::bound(_splits[i - 1], false));
+    auto end = i == _splits.size() ? _range.end() : bound_opt(query::range<dht::token>::bound(_splits[i], true));
+    return query::range<dht::token>(std::move(start), std::move(end));
+}
+
+std::vector<query::range<dht::token>> merkle_tree::difference(const merkle_tree& other) const {
+    assert(_depth == other._depth);
+    // levels[l] holds the 2^l nodes at depth l of the XOR of both trees, which
+    // are zero where the trees agree.
+    std::vector<std::vector<hash_type>> levels(_depth + 1);
+    levels[_depth].resize(_leaves.size());
+    for (size_t i = 0; i < _leaves.size(); ++i) {
+        levels[_depth][i] = _leaves[i] ^ other._leaves[i];
+    }
+    for (unsigned l = _depth; l > 0; --l) {
+        levels[l - 1].resize(levels[l].size() / 2);
+        for (size_t i = 0; i < levels[l - 1].size(); ++i) {
+            levels[l - 1][i] = levels[l][2 * i] ^ levels[l][2 * i + 1];
+        }
+    }
+
+    // Descend from the root into the subtrees which differ only, left first,
+    // so that differing leaves come out in ring order.
+    std::vector<size_t> differing;
+    std::vector<std::pair<unsigned, size_t>> pending{{0, 0}};
+    while (!pending.empty()) {
+        auto l = pending.back().first;
+        auto i = pending.back().second;
+        pending.pop_back();
+        if (!levels[l][i]) {
+            continue;
+        }
+        if (l == _depth) {
+            differing.push_back(i);
+        } else {
+            pending.emplace_back(l + 1, 2 * i + 1);
+            pending.emplace_back(l + 1, 2 * i);
+        }
+    }
+
+    std::vector<query::range<dht::token>> ranges;
+    for (size_t i = 0; i < differing.size();) {
+        auto j = i;
+        while (j + 1 < differing.size() && differing[j + 1] == differing[j] + 1) {
+            ++j;
+        }
+        ranges.emplace_back(leaf_range(differing[i]).start(), leaf_range(differing[j]).end());
+        i = j + 1;
+    }
+    return ranges;
+}
+
+size_t merkle_tree::serialized_size() const {
+    return _range.serialized_size() + serialize_int32_size + serialize_int64_size
+            + _leaves.size() * serialize_int64_size;
+}
+
+void merkle_tree::serialize(bytes::iterator& out) const {
+    _range.serialize(out);
+    serialize_int32(out, _depth);
+    serialize_int64(out, _partitions);
+    for (auto&& leaf : _leaves) {
+        serialize_int64(out, leaf);
+    }
+}
+
+merkle_tree merkle_tree::deserialize(bytes_view& v) {
+    auto range = query::range<dht::token>::deserialize(v);
+    auto depth = read_simple<uint32_t>(v);
+    merkle_tree t(std::move(range), depth);
+    t._partitions = read_simple<uint64_t>(v);
+    for (auto&& leaf : t._leaves) {
+        leaf = read_simple<uint64_t>(v);
+    }
+    return t;
+}
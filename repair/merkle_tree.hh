@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "bytes.hh"
+#include "query-request.hh"
+#include "dht/i_partitioner.hh"
+
+// A hash tree over the data a replica holds of a table in a token range,
+// which replicas compare to find the sub-ranges they disagree on without
+// exchanging the data itself.
+//
+// The range is cut into 2^depth leaves by bisecting it with the partitioner's
+// midpoint, so replicas building a tree of the same range and depth cut it
+// the same way. A leaf is the XOR of the hashes of the partitions in it, and
+// an inner node the XOR of its children. The hash of a node therefore does
+// not depend on the order partitions are added in, so each shard builds a
+// tree of its own partitions, and the trees of the shards merge into that of
+// the node.
+class merkle_tree {
+public:
+    using hash_type = uint64_t;
+    // 4096 leaves, 32KB of hashes.
+    static constexpr unsigned max_depth = 12;
+private:
+    query::range<dht::token> _range;
+    unsigned _depth;
+    // The tokens ending each leaf but the last, in ring order from the start
+    // of the range.
+    std::vector<dht::token> _splits;
+    std::vector<hash_type> _leaves;
+    uint64_t _partitions = 0;
+public:
+    // The depth is lower than asked for when the range cannot be cut that
+    // many times, e.g. when it has no bounds to take midpoints of.
+    merkle_tree(query::range<dht::token> range, unsigned depth);
+
+    const query::range<dht::token>& range() const {
+        return _range;
+    }
+    unsigned depth() const {
+        return _depth;
+    }
+    uint64_t partitions() const {
+        return _partitions;
+    }
+    hash_type root() const;
+
+    void add(const dht::token& t, hash_type h);
+    void merge(const merkle_tree& other);
+    // The tree of the same data with 2^depth leaves, whose leaves are the
+    // inner nodes of this one at that depth.
+    merkle_tree shrink(unsigned depth) const;
+
+    // The sub-ranges whose leaves differ between the trees, adjacent ones
+    // joined. Both trees must be of the same range and depth.
+    std::vector<query::range<dht::token>> difference(const merkle_tree& other) const;
+
+    size_t serialized_size() const;
+    void serialize(bytes::iterator& out) const;
+    static merkle_tree deserialize(bytes_view& v);
+private:
+    query::range<dht::token> leaf_range(size_t i) const;
+};
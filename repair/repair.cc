@@ -20,14 +20,27 @@
  */
 
 #include "repair.hh"
+#include "merkle_tree.hh"
+#include "row_level.hh"
 
 #include "streaming/stream_plan.hh"
 #include "streaming/stream_state.hh"
 #include "gms/inet_address.hh"
+#include "gms/gossiper.hh"
+#include "message/messaging_service.hh"
+#include "sstables/compaction.hh"
+#include "frozen_mutation.hh"
+#include "mutation_reader.hh"
+#include "utils/murmur_hash.hh"
+#include "utils/cpu_scheduler.hh"
+#include "core/sleep.hh"
+#include "core/semaphore.hh"
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
+#include <boost/range/irange.hpp>
+#include <boost/lexical_cast.hpp>
 
 static logging::logger logger("repair");
 
@@ -137,6 +150,88 @@ static std::vector<gms::inet_address> get_neighbors(database& db,
 }
 
 
+// The hash of a partition, which is the same on replicas agreeing on its
+// data once compacted.
+static merkle_tree::hash_type hash_partition(const mutation& m) {
+    auto fm = freeze(m);
+    std::array<uint64_t, 2> hash;
+    murmur_hash::hash3_x64_128(fm.representation(), 0, hash);
+    return hash[0];
+}
+
+// Validation compaction: builds the hash tree of the partitions of the table
+// this shard holds in the range.
+static future<merkle_tree> build_local_merkle_tree(column_family& cf,
+        query::range<dht::token> range, unsigned depth) {
+    auto tree = make_lw_shared<merkle_tree>(range, depth);
+    std::vector<query::partition_range> prs;
+    if (range.is_wrap_around(dht::token_comparator())) {
+        auto unwrapped = range.unwrap();
+        prs.push_back(query::to_partition_range(std::move(unwrapped.first)));
+        prs.push_back(query::to_partition_range(std::move(unwrapped.second)));
+    } else {
+        prs.push_back(query::to_partition_range(std::move(range)));
+    }
+    auto s = cf.schema();
+    auto now = gc_clock::now();
+    auto gc_before = sstables::get_gc_before(*s, now);
+    return do_with(std::move(prs), [&cf, tree, s, now, gc_before] (const std::vector<query::partition_range>& prs) {
+        return do_for_each(prs, [&cf, tree, s, now, gc_before] (const query::partition_range& pr) {
+            return do_with(cf.make_reader(pr), cpu_timeslice(maintenance_group()),
+                    [tree, s, now, gc_before] (mutation_reader& reader, cpu_timeslice& timeslice) {
+                return consume(reader, [tree, s, now, gc_before, &timeslice] (mutation m) {
+                    timeslice.run([&] {
+                        // However the data is spread over memtables and sstables:
+                        // expired cells turn into tombstones, shadowed data goes,
+                        // and so do tombstones past gc_grace, which replicas
+                        // purge at different times.
+                        m.partition().compact_for_compaction(*s, api::max_timestamp, now, gc_before);
+                        if (!m.partition().empty()) {
+                            tree->add(m.token(), hash_partition(m));
+                        }
+                    });
+                    return timeslice.maybe_yield().then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            });
+        });
+    }).then([tree] {
+        return std::move(*tree);
+    });
+}
+
+// Builds the hash tree of the table over the range on all shards in
+// parallel, and merges their trees into that of this node.
+static future<merkle_tree> build_merkle_tree(seastar::sharded<database>& db,
+        sstring keyspace, sstring cf, query::range<dht::token> range, unsigned depth) {
+    return db.map_reduce0([keyspace, cf, range, depth] (database& local_db) {
+        return build_local_merkle_tree(local_db.find_column_family(keyspace, cf), range, depth);
+    }, merkle_tree(range, depth), [] (merkle_tree tree, merkle_tree shard_tree) {
+        tree.merge(shard_tree);
+        return tree;
+    });
+}
+
+future<> repair_init_messaging_service_handler(seastar::sharded<database>& db) {
+    return net::get_messaging_service().invoke_on_all([&db] (net::messaging_service& ms) {
+        ms.register_repair_merkle_tree([&db] (sstring keyspace, sstring cf, query::range<dht::token> range, uint32_t depth) {
+            return build_merkle_tree(db, std::move(keyspace), std::move(cf), std::move(range), depth);
+        });
+        init_row_level_repair_messaging_service_handler();
+    });
+}
+
+// The depth of the trees replicas exchange, for leaves of about one
+// partition each on this node, within merkle_tree::max_depth.
+static unsigned tree_depth(uint64_t partitions) {
+    unsigned depth = 0;
+    while (depth < merkle_tree::max_depth && (uint64_t(1) << depth) < partitions) {
+        ++depth;
+    }
+    return depth;
+}
+
 // The repair_tracker tracks ongoing repair operations and their progress.
 // A repair which has already finished successfully is dropped from this
 // table, but a failed repair will remain in the table forever so it can
@@ -152,9 +247,21 @@ static class {
     // Successfully-finished repairs are those with id < _next_repair_command
     // but aren't listed as running or failed the status map.
     std::unordered_map<int, repair_status> _status;
+    // Unlike statuses, progress is kept for successful repairs too.
+    std::unordered_map<int, repair_progress> _progress;
 public:
-    void start(int id) {
+    void start(int id, size_t ranges) {
         _status[id] = repair_status::RUNNING;
+        _progress[id].ranges = ranges;
+    }
+    void range_done(int id, const row_sync_stats& stats) {
+        auto& p = _progress[id];
+        ++p.ranges_done;
+        p.rows_sent += stats.rows_sent;
+        p.rows_received += stats.rows_received;
+    }
+    void range_failed(int id) {
+        ++_progress[id].ranges_failed;
     }
     void done(int id, bool succeeded) {
         if (succeeded) {
@@ -174,6 +281,12 @@ static class {
             return it->second;
         }
     }
+    repair_progress get_progress(int id) {
+        if (id >= _next_repair_command) {
+            throw std::runtime_error(sprint("unknown repair id %d", id));
+        }
+        return _progress[id];
+    }
     int next_repair_command() {
         return _next_repair_command++;
     }
@@ -185,39 +298,158 @@ static class {
 // repairs). It is fine to always do this on one CPU, because the function
 // itself does very little (mainly tell other nodes and CPUs what to do).
 
+// Syncs the rows of the ranges with the peer. The ranges are spread over
+// the shards, each syncing its ranges one after the other, which bounds the
+// rows in memory to a window per shard.
+static future<row_sync_stats> sync_rows_on_all_shards(gms::inet_address peer, sstring keyspace, sstring cf,
+        std::vector<query::range<dht::token>> ranges) {
+    std::vector<std::vector<query::range<dht::token>>> shard_ranges(smp::count);
+    size_t next = 0;
+    auto add = [&] (query::range<dht::token> r) {
+        shard_ranges[next++ % smp::count].push_back(std::move(r));
+    };
+    for (auto&& r : ranges) {
+        if (r.is_wrap_around(dht::token_comparator())) {
+            auto unwrapped = r.unwrap();
+            add(std::move(unwrapped.first));
+            add(std::move(unwrapped.second));
+        } else {
+            add(std::move(r));
+        }
+    }
+    auto total = make_lw_shared<row_sync_stats>();
+    return do_with(std::move(shard_ranges), [peer, keyspace, cf, total] (auto& shard_ranges) {
+        return parallel_for_each(boost::irange<unsigned>(0, smp::count), [&shard_ranges, peer, keyspace, cf, total] (unsigned shard) {
+            return smp::submit_to(shard, [peer, keyspace, cf, ranges = shard_ranges[shard]] () mutable {
+                auto stats = make_lw_shared<row_sync_stats>();
+                return do_with(std::move(ranges), [peer, keyspace, cf, stats] (auto& ranges) {
+                    return do_for_each(ranges, [peer, keyspace, cf, stats] (const query::range<dht::token>& r) {
+                        return sync_rows(peer, keyspace, cf, r).then([stats] (row_sync_stats s) {
+                            *stats += s;
+                        });
+                    });
+                }).then([stats] {
+                    return *stats;
+                });
+            }).then([total] (row_sync_stats s) {
+                *total += s;
+            });
+        });
+    }).then([total] {
+        return *total;
+    });
+}
+
 // Repair a single range. Comparable to RepairSession in Origin
 // In Origin, this is composed of several "repair jobs", each with one cf,
 // but our streaming already works for several cfs.
-static future<> repair_range(seastar::sharded<database>& db, sstring keyspace,
-        query::range<dht::token> range, std::vector<sstring> cfs) {
+//
+// Each cf is validated on this node and on the neighbors. The sub-ranges
+// whose hash trees differ are then streamed, in both directions, or with
+// row_level, synced row by row. Until every node knows REPAIR_MERKLE_TREE,
+// the whole range is streamed, as nodes not upgraded yet can't validate.
+static future<row_sync_stats> repair_range(seastar::sharded<database>& db, sstring keyspace,
+        query::range<dht::token> range, std::vector<sstring> cfs, bool row_level) {
     auto sp = make_lw_shared<streaming::stream_plan>("repair");
     auto id = utils::UUID_gen::get_time_UUID();
+    auto stats = make_lw_shared<row_sync_stats>();
 
     auto neighbors = get_neighbors(db.local(), keyspace, range);
     logger.info("[repair #{}] new session: will sync {} on range {} for {}.{}", id, neighbors, range, keyspace, cfs);
-    for (auto peer : neighbors) {
-        // FIXME: obviously, we'll need Merkel trees or another alternative
-        // method to decide which parts of the data we need to stream instead
-        // of streaming everything like we do now. So this logging is kind of
-        // silly, and we never log the corresponding "... is consistent with"
-        // message: see SyncTask.run() in Origin for the original messages.
+    // Streams the ranges of the cf both ways.
+    auto stream = [sp, keyspace] (gms::inet_address peer, const sstring& cf, std::vector<query::range<dht::token>> ranges) {
+        sp->transfer_ranges(peer, peer, keyspace, ranges, {cf});
+        sp->request_ranges(peer, peer, keyspace, std::move(ranges), {cf});
+    };
+    auto synced = make_ready_future<>();
+    if (!gms::get_local_gossiper().cluster_supports_feature(gms::versioned_value::REPAIR_MERKLE_TREE)) {
         auto me = utils::fb_utilities::get_broadcast_address();
-        for (auto &&cf : cfs) {
-            logger.info("[repair #{}] Endpoints {} and {} have {} range(s) out of sync for {}", id, me, peer, 1, cf);
+        for (auto peer : neighbors) {
+            for (auto&& cf : cfs) {
+                logger.info("[repair #{}] Endpoints {} and {} have {} range(s) out of sync for {}", id, me, peer, 1, cf);
+                stream(peer, cf, {range});
+            }
         }
-
-        // FIXME: think: if we have several neighbors, perhaps we need to
-        // request ranges from all of them and only later transfer ranges to
-        // all of them? Otherwise, we won't necessarily fully repair the
-        // other ndoes, just this one? What does Cassandra do here?
-        sp->transfer_ranges(peer, peer, keyspace, {range}, cfs);
-        sp->request_ranges(peer, peer, keyspace, {range}, cfs);
+    } else {
+        synced = do_with(std::move(cfs), std::move(neighbors), [&db, sp, stats, id, keyspace, range, row_level, stream] (auto& cfs, auto& neighbors) {
+            return parallel_for_each(cfs, [&db, &neighbors, sp, stats, id, keyspace, range, row_level, stream] (const sstring& cf) {
+                return build_merkle_tree(db, keyspace, cf, range, merkle_tree::max_depth).then([&neighbors, sp, stats, id, keyspace, cf, range, row_level, stream] (merkle_tree local) {
+                    auto tree = make_lw_shared<merkle_tree>(local.shrink(tree_depth(local.partitions())));
+                    return parallel_for_each(neighbors, [tree, sp, stats, id, keyspace, cf, range, row_level, stream] (gms::inet_address peer) {
+                        using diff_type = std::experimental::optional<std::vector<query::range<dht::token>>>;
+                        auto& ms = net::get_local_messaging_service();
+                        return ms.send_repair_merkle_tree(net::messaging_service::shard_id{peer, 0}, keyspace, cf, range, tree->depth()).then([tree, range] (merkle_tree remote) {
+                            // Trees of the same range and depth are cut the
+                            // same way, unless the nodes disagree on the
+                            // partitioner.
+                            return diff_type(remote.depth() == tree->depth()
+                                    ? tree->difference(remote) : std::vector<query::range<dht::token>>{range});
+                        }).handle_exception([id, peer, cf] (auto ep) {
+                            logger.warn("[repair #{}] Validating {} with {} failed ({}), streaming the whole range", id, cf, peer, ep);
+                            return diff_type();
+                        }).then([sp, stats, id, keyspace, cf, range, row_level, stream, peer] (diff_type diff) {
+                            auto me = utils::fb_utilities::get_broadcast_address();
+                            if (!diff) {
+                                stream(peer, cf, {range});
+                                return make_ready_future<>();
+                            }
+                            if (diff->empty()) {
+                                logger.info("[repair #{}] Endpoints {} and {} are consistent for {}", id, me, peer, cf);
+                                return make_ready_future<>();
+                            }
+                            logger.info("[repair #{}] Endpoints {} and {} have {} range(s) out of sync for {}", id, me, peer, diff->size(), cf);
+                            if (!row_level) {
+                                stream(peer, cf, std::move(*diff));
+                                return make_ready_future<>();
+                            }
+                            return sync_rows_on_all_shards(peer, keyspace, cf, std::move(*diff)).then([stats, id, me, peer, cf] (row_sync_stats s) {
+                                logger.info("[repair #{}] Endpoints {} and {} synced {} row(s) out, {} row(s) in for {}", id, me, peer, s.rows_sent, s.rows_received, cf);
+                                *stats += s;
+                            });
+                        });
+                    });
+                });
+            });
+        });
     }
-    return sp->execute().discard_result().then([sp, id] {
+    return synced.then([sp] {
+        if (sp->is_empty()) {
+            return make_ready_future<>();
+        }
+        return sp->execute().discard_result();
+    }).then([sp, stats, id] {
         logger.info("repair session #{} successful", id);
+        return *stats;
     }).handle_exception([id] (auto ep) {
-        logger.error("repair session #{} stream failed: {}", id, ep);
-        return make_exception_future(std::runtime_error("repair_range failed"));
+        logger.error("repair session #{} failed: {}", id, ep);
+        return make_exception_future<row_sync_stats>(std::runtime_error("repair_range failed"));
+    });
+}
+
+// How many times a range is tried before the repair gives up on it, and how
+// long to wait between tries.
+static constexpr unsigned repair_range_attempts = 3;
+static constexpr auto repair_range_retry_delay = std::chrono::seconds(5);
+
+// Repairs the range on the shard owning its end token, so that the ranges of
+// a repair spread over the shards like the data does, and tries it again
+// when it fails, so that a failure only costs its range.
+static future<row_sync_stats> repair_range_with_retry(seastar::sharded<database>& db, sstring keyspace,
+        query::range<dht::token> range, std::vector<sstring> cfs, bool row_level, unsigned attempt = 1) {
+    unsigned shard = 0;
+    if (range.end() && !range.end()->value().is_minimum() && !range.end()->value().is_maximum()) {
+        shard = dht::shard_of(range.end()->value());
+    }
+    return smp::submit_to(shard, [&db, keyspace, range, cfs, row_level] {
+        return repair_range(db, keyspace, range, cfs, row_level);
+    }).handle_exception([&db, keyspace, range, cfs, row_level, attempt] (std::exception_ptr ep) {
+        if (attempt >= repair_range_attempts) {
+            return make_exception_future<row_sync_stats>(ep);
+        }
+        logger.warn("repair of range {} failed (attempt {} of {}), retrying: {}", range, attempt, repair_range_attempts, ep);
+        return sleep(repair_range_retry_delay).then([&db, keyspace, range, cfs, row_level, attempt] {
+            return repair_range_with_retry(db, keyspace, range, cfs, row_level, attempt + 1);
+        });
     });
 }
 
@@ -251,6 +483,13 @@ struct repair_options {
     // held by the node. primary_range=true is useful if the user plans to
     // repair all nodes.
     bool primary_range = false;
+    // If row_level is true, the parts of the ranges which differ between
+    // replicas are synced row by row, instead of streamed whole.
+    bool row_level = false;
+    // The number of ranges repaired at once. Unlike Origin's jobThreads, which
+    // parallelizes the column families of a range, this bounds the ranges in
+    // flight, spread over the shards owning them.
+    unsigned job_threads = smp::count;
     // If ranges is not empty, it overrides the repair's default heuristics
     // for determining the list of ranges to repair. In particular, "ranges"
     // overrides the setting of "primary_range".
@@ -258,6 +497,11 @@ struct repair_options {
 
     repair_options(std::unordered_map<sstring, sstring> options) {
         bool_opt(primary_range, options, PRIMARY_RANGE_KEY);
+        bool_opt(row_level, options, ROW_LEVEL_KEY);
+        int_opt(job_threads, options, JOB_THREADS_KEY);
+        if (!job_threads) {
+            throw std::runtime_error("jobThreads must be positive");
+        }
         ranges_opt(ranges, options, RANGES_KEY);
         // The parsing code above removed from the map options we have parsed.
         // If anything is left there in the end, it's an unsupported option.
@@ -269,12 +513,13 @@ struct repair_options {
     static constexpr const char* PRIMARY_RANGE_KEY = "primaryRange";
     static constexpr const char* PARALLELISM_KEY = "parallelism"; // TODO
     static constexpr const char* INCREMENTAL_KEY = "incremental"; // TODO
-    static constexpr const char* JOB_THREADS_KEY = "jobThreads"; // TODO
+    static constexpr const char* JOB_THREADS_KEY = "jobThreads";
     static constexpr const char* RANGES_KEY = "ranges";
     static constexpr const char* COLUMNFAMILIES_KEY = "columnFamilies"; // TODO
     static constexpr const char* DATACENTERS_KEY = "dataCenters"; // TODO
     static constexpr const char* HOSTS_KEY = "hosts"; // TODO
     static constexpr const char* TRACE_KEY = "trace"; // TODO
+    static constexpr const char* ROW_LEVEL_KEY = "rowLevel"; // scylla-only
 
 private:
     static void bool_opt(bool& var,
@@ -292,6 +537,20 @@ struct repair_options {
         }
     }
 
+    static void int_opt(unsigned& var,
+            std::unordered_map<sstring, sstring>& options,
+            const sstring& key) {
+        auto it = options.find(key);
+        if (it != options.end()) {
+            try {
+                var = boost::lexical_cast<unsigned>(it->second);
+            } catch (boost::bad_lexical_cast&) {
+                throw std::runtime_error(sprint("option %s must be a number, got '%s'", key, it->second));
+            }
+            options.erase(it);
+        }
+    }
+
     // A range is expressed as start_token:end token and multiple ranges can
     // be given as comma separated ranges(e.g. aaa:bbb,ccc:ddd).
     static void ranges_opt(std::vector<query::range<dht::token>> var,
@@ -328,8 +587,6 @@ static int do_repair_start(seastar::sharded<database>& db, sstring keyspace,
     int id = repair_tracker.next_repair_command();
     logger.info("starting user-requested repair for keyspace {}, repair id {}", keyspace, id);
 
-    repair_tracker.start(id);
-
     // If the "ranges" option is not explicitly specified, we repair all the
     // local ranges (the token ranges for which this node holds a replica of).
     // Each of these ranges may have a different set of replicas, so the
@@ -363,18 +620,32 @@ static int do_repair_start(seastar::sharded<database>& db, sstring keyspace,
     // FIXME: let the cfs be overriden by an option
     std::vector<sstring> cfs = list_column_families(db.local(), keyspace);
 
-    do_with(std::move(ranges), [&db, keyspace, cfs, id] (auto& ranges) {
-#if 1
-        // repair all the ranges in parallel
-        return parallel_for_each(ranges.begin(), ranges.end(), [&db, keyspace, cfs, id] (auto&& range) {
-#else
-        // repair all the ranges in sequence
-        return do_for_each(ranges.begin(), ranges.end(), [&db, keyspace, cfs, id] (auto&& range) {
-#endif
-            return repair_range(db, keyspace, range, cfs);
+    repair_tracker.start(id, ranges.size());
+
+    // Repair up to job_threads ranges at once. A range which still fails
+    // after its retries fails the repair, but not the other ranges.
+    auto jobs = make_lw_shared<semaphore>(options.job_threads);
+    do_with(std::move(ranges), [&db, keyspace, cfs, id, jobs, row_level = options.row_level] (auto& ranges) {
+        return parallel_for_each(ranges.begin(), ranges.end(), [&db, keyspace, cfs, id, jobs, row_level] (auto&& range) {
+            return jobs->wait().then([&db, keyspace, cfs, id, row_level, &range] {
+                return repair_range_with_retry(db, keyspace, range, cfs, row_level).then([id] (row_sync_stats stats) {
+                    repair_tracker.range_done(id, stats);
+                }).handle_exception([id, &range] (std::exception_ptr eptr) {
+                    logger.error("repair {} failed on range {}: {}", id, range, eptr);
+                    repair_tracker.range_failed(id);
+                });
+            }).finally([jobs] {
+                jobs->signal();
+            });
         }).then([id] {
-            logger.info("repair {} completed sucessfully", id);
-            repair_tracker.done(id, true);
+            auto failed = repair_tracker.get_progress(id).ranges_failed;
+            if (failed) {
+                logger.info("repair {} failed on {} range(s)", id, failed);
+                repair_tracker.done(id, false);
+            } else {
+                logger.info("repair {} completed sucessfully", id);
+                repair_tracker.done(id, true);
+            }
         }).handle_exception([id] (std::exception_ptr eptr) {
             logger.info("repair {} failed", id);
             repair_tracker.done(id, false);
@@ -396,3 +667,9 @@ future<repair_status> repair_get_status(seastar::sharded<database>& db, int id)
         return repair_tracker.get(id);
     });
 }
+
+future<repair_progress> repair_get_progress(seastar::sharded<database>& db, int id) {
+    return db.invoke_on(0, [id] (database& localdb) {
+        return repair_tracker.get_progress(id);
+    });
+}
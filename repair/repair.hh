@@ -57,3 +57,21 @@ enum class repair_status { RUNNING, SUCCESSFUL, FAILED };
 // repair_get_status() returns a future because it needs to run code on a
 // different CPU (cpu 0) and that might be a deferring operation.
 future<repair_status> repair_get_status(seastar::sharded<database>& db, int id);
+
+struct repair_progress {
+    // The ranges the repair covers, and those repaired so far.
+    size_t ranges = 0;
+    size_t ranges_done = 0;
+    // The ranges given up on after failing all their tries.
+    size_t ranges_failed = 0;
+    // The rows sent to and received from neighbors by row-level repair.
+    uint64_t rows_sent = 0;
+    uint64_t rows_received = 0;
+};
+
+// repair_get_progress() tells how far a repair got, running or finished.
+future<repair_progress> repair_get_progress(seastar::sharded<database>& db, int id);
+
+// Registers on all shards the handler of the verb neighbors use to fetch the
+// hash trees of this node during repair.
+future<> repair_init_messaging_service_handler(seastar::sharded<database>& db);
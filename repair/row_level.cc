@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "row_level.hh"
+
+#include "service/storage_proxy.hh"
+#include "streaming/stream_manager.hh"
+#include "message/messaging_service.hh"
+#include "sstables/compaction.hh"
+#include "frozen_mutation.hh"
+#include "mutation_reader.hh"
+#include "types.hh"
+#include "utils/murmur_hash.hh"
+#include "utils/serialization.hh"
+
+// The most rows the coordinator reads into a window. A peer reads at most
+// twice that, so that a window still covers some rows the coordinator lacks.
+static constexpr uint32_t window_rows = 1024;
+
+int repair_row_key::tri_compare(const schema& s, const repair_row_key& other) const {
+    auto r = dk.tri_compare(s, other.dk);
+    if (r) {
+        return r;
+    }
+    if (!ck || !other.ck) {
+        return int(bool(ck)) - int(bool(other.ck));
+    }
+    clustering_key::less_compare less(s);
+    return less(*ck, *other.ck) ? -1 : less(*other.ck, *ck);
+}
+
+static size_t serialized_size(bytes_view v) {
+    return serialize_int32_size + v.size();
+}
+
+static void serialize(bytes::iterator& out, bytes_view v) {
+    serialize_int32(out, v.size());
+    out = std::copy(v.begin(), v.end(), out);
+}
+
+static bytes deserialize_bytes(bytes_view& v) {
+    auto size = read_simple<uint32_t>(v);
+    return to_bytes(read_simple_bytes(v, size));
+}
+
+size_t repair_row_key::serialized_size() const {
+    return dk._token.serialized_size() + ::serialized_size(dk._key.representation())
+            + serialize_bool_size + (ck ? ::serialized_size(ck->representation()) : 0);
+}
+
+void repair_row_key::serialize(bytes::iterator& out) const {
+    dk._token.serialize(out);
+    ::serialize(out, dk._key.representation());
+    serialize_bool(out, bool(ck));
+    if (ck) {
+        ::serialize(out, ck->representation());
+    }
+}
+
+repair_row_key repair_row_key::deserialize(bytes_view& v) {
+    auto token = dht::token::deserialize(v);
+    auto key = partition_key::from_bytes(deserialize_bytes(v));
+    std::experimental::optional<clustering_key> ck;
+    if (read_simple<int8_t>(v)) {
+        ck = clustering_key::from_bytes(deserialize_bytes(v));
+    }
+    return repair_row_key(dht::decorated_key{std::move(token), std::move(key)}, std::move(ck));
+}
+
+static size_t serialized_size(const std::experimental::optional<repair_row_key>& k) {
+    return serialize_bool_size + (k ? k->serialized_size() : 0);
+}
+
+static void serialize(bytes::iterator& out, const std::experimental::optional<repair_row_key>& k) {
+    serialize_bool(out, bool(k));
+    if (k) {
+        k->serialize(out);
+    }
+}
+
+static std::experimental::optional<repair_row_key> deserialize_row_key(bytes_view& v) {
+    if (!read_simple<int8_t>(v)) {
+        return {};
+    }
+    return repair_row_key::deserialize(v);
+}
+
+size_t repair_row_window::serialized_size() const {
+    return ::serialized_size(after) + ::serialized_size(last);
+}
+
+void repair_row_window::serialize(bytes::iterator& out) const {
+    ::serialize(out, after);
+    ::serialize(out, last);
+}
+
+repair_row_window repair_row_window::deserialize(bytes_view& v) {
+    repair_row_window w;
+    w.after = deserialize_row_key(v);
+    w.last = deserialize_row_key(v);
+    return w;
+}
+
+size_t repair_row_hashes::serialized_size() const {
+    size_t size = 2 * serialize_int64_size + ::serialized_size(last) + serialize_int32_size;
+    for (auto&& r : rows) {
+        size += r.first.serialized_size() + serialize_int64_size;
+    }
+    return size;
+}
+
+void repair_row_hashes::serialize(bytes::iterator& out) const {
+    serialize_int64(out, combined);
+    serialize_int64(out, count);
+    ::serialize(out, last);
+    serialize_int32(out, rows.size());
+    for (auto&& r : rows) {
+        r.first.serialize(out);
+        serialize_int64(out, r.second);
+    }
+}
+
+repair_row_hashes repair_row_hashes::deserialize(bytes_view& v) {
+    repair_row_hashes h;
+    h.combined = read_simple<uint64_t>(v);
+    h.count = read_simple<uint64_t>(v);
+    h.last = deserialize_row_key(v);
+    auto size = read_simple<uint32_t>(v);
+    h.rows.reserve(size);
+    while (size--) {
+        auto key = repair_row_key::deserialize(v);
+        auto hash = read_simple<uint64_t>(v);
+        h.rows.emplace_back(std::move(key), hash);
+    }
+    return h;
+}
+
+// Splits a partition into its rows, each a mutation of its own.
+template <typename Func>
+static void for_each_row(const schema_ptr& s, const mutation& m, Func&& func) {
+    auto& p = m.partition();
+    if (p.partition_tombstone() || p.static_row().size() || !p.row_tombstones().empty()) {
+        mutation row(m.decorated_key(), s);
+        row.partition().apply(p.partition_tombstone());
+        row.partition().static_row().merge(*s, column_kind::static_column, p.static_row());
+        for (auto&& rt : p.row_tombstones()) {
+            row.partition().apply_row_tombstone(*s, rt.prefix(), rt.t());
+        }
+        func(repair_row_key(m.decorated_key(), {}), std::move(row));
+    }
+    for (auto&& e : p.clustered_rows()) {
+        mutation row(m.decorated_key(), s);
+        auto& r = row.partition().clustered_row(e.key());
+        r.apply(e.row().deleted_at());
+        r.apply(e.row().marker());
+        r.cells().merge(*s, column_kind::regular_column, e.row().cells());
+        func(repair_row_key(m.decorated_key(), e.key()), std::move(row));
+    }
+}
+
+// Calls func for each row of the table in the window of the range, in ring
+// order, until it returns stop_iteration::yes. Like for validation, the data
+// is compacted first, so that replicas agreeing on it hash it the same
+// however it is spread over memtables and sstables.
+template <typename Func>
+static future<> consume_rows(schema_ptr s, const query::range<dht::token>& range,
+        const repair_row_window& window, Func func) {
+    auto pr = query::to_partition_range(range);
+    if (window.after) {
+        pr = query::partition_range(query::partition_range::bound(dht::ring_position(window.after->dk), true), pr.end());
+    }
+    auto now = gc_clock::now();
+    auto gc_before = sstables::get_gc_before(*s, now);
+    auto reader = service::get_local_storage_proxy().make_local_reader(s->id(), pr);
+    return do_with(std::move(reader), std::move(func), [s, &window, now, gc_before] (mutation_reader& reader, Func& func) {
+        return consume(reader, [s, &window, &func, now, gc_before] (mutation m) {
+            m.partition().compact_for_compaction(*s, api::max_timestamp, now, gc_before);
+            auto stop = stop_iteration::no;
+            for_each_row(s, m, [&] (repair_row_key key, mutation row) {
+                if (stop || (window.after && key.tri_compare(*s, *window.after) <= 0)) {
+                    return;
+                }
+                if (window.last && key.tri_compare(*s, *window.last) > 0) {
+                    stop = stop_iteration::yes;
+                    return;
+                }
+                stop = func(std::move(key), std::move(row));
+            });
+            return stop;
+        });
+    });
+}
+
+static uint64_t hash_row(const mutation& row) {
+    auto fm = freeze(row);
+    std::array<uint64_t, 2> hash;
+    murmur_hash::hash3_x64_128(fm.representation(), 0, hash);
+    return hash[0];
+}
+
+// Reads the rows of the window, up to limit of them.
+static future<repair_row_hashes> get_row_hashes(schema_ptr s, query::range<dht::token> range,
+        repair_row_window window, uint32_t limit, bool with_rows) {
+    auto result = make_lw_shared<repair_row_hashes>();
+    return do_with(std::move(range), std::move(window), [s, result, limit, with_rows] (auto& range, auto& window) {
+        return consume_rows(s, range, window, [result, limit, with_rows] (repair_row_key key, mutation row) {
+            auto h = hash_row(row);
+            result->combined ^= h;
+            if (with_rows) {
+                result->rows.emplace_back(key, h);
+            }
+            if (++result->count == limit) {
+                result->last = std::move(key);
+                return stop_iteration::yes;
+            }
+            return stop_iteration::no;
+        });
+    }).then([result] {
+        return std::move(*result);
+    });
+}
+
+// Reads the rows of the window with the given keys, which are in ring order.
+static future<std::vector<frozen_mutation>> get_rows(schema_ptr s, query::range<dht::token> range,
+        repair_row_window window, std::vector<repair_row_key> keys) {
+    auto result = make_lw_shared<std::vector<frozen_mutation>>();
+    return do_with(std::move(range), std::move(window), std::move(keys), [s, result] (auto& range, auto& window, auto& keys) {
+        return consume_rows(s, range, window, [s, result, &keys, next = keys.begin()] (repair_row_key key, mutation row) mutable {
+            while (next != keys.end() && next->tri_compare(*s, key) < 0) {
+                ++next;
+            }
+            if (next == keys.end()) {
+                return stop_iteration::yes;
+            }
+            if (next->tri_compare(*s, key) == 0) {
+                result->emplace_back(freeze(row));
+            }
+            return stop_iteration::no;
+        });
+    }).then([result] {
+        return std::move(*result);
+    });
+}
+
+static future<> apply_rows(std::vector<frozen_mutation> rows) {
+    return do_with(std::move(rows), [] (const std::vector<frozen_mutation>& rows) {
+        return parallel_for_each(rows.begin(), rows.end(), [] (const frozen_mutation& row) {
+            return service::get_local_storage_proxy().mutate_locally(row);
+        });
+    });
+}
+
+void repair_row_hashes::trim(const schema& s, const repair_row_key& last) {
+    while (!rows.empty() && rows.back().first.tri_compare(s, last) > 0) {
+        combined ^= rows.back().second;
+        --count;
+        rows.pop_back();
+    }
+}
+
+repair_row_diff diff_rows(const schema& s, const repair_row_hashes& local, const repair_row_hashes& remote) {
+    repair_row_diff diff;
+    auto l = local.rows.begin();
+    auto r = remote.rows.begin();
+    while (l != local.rows.end() || r != remote.rows.end()) {
+        auto c = l == local.rows.end() ? 1 : r == remote.rows.end() ? -1 : l->first.tri_compare(s, r->first);
+        if (c < 0) {
+            diff.to_send.push_back((l++)->first);
+        } else if (c > 0) {
+            diff.to_fetch.push_back((r++)->first);
+        } else {
+            if (l->second != r->second) {
+                diff.to_send.push_back(l->first);
+                diff.to_fetch.push_back(r->first);
+            }
+            ++l;
+            ++r;
+        }
+    }
+    return diff;
+}
+
+static size_t rows_size(const std::vector<frozen_mutation>& rows) {
+    size_t bytes = 0;
+    for (auto&& fm : rows) {
+        bytes += fm.representation().size();
+    }
+    return bytes;
+}
+
+// Rows sent to a peer count against the outbound throughputs of streaming,
+// and those received against the inbound one.
+static future<> throttle(gms::inet_address peer, const std::vector<frozen_mutation>& rows) {
+    return streaming::get_local_stream_manager().throttle(peer, rows_size(rows));
+}
+
+static future<> throttle_inbound(const std::vector<frozen_mutation>& rows) {
+    return streaming::get_local_stream_manager().throttle_inbound(rows_size(rows));
+}
+
+void init_row_level_repair_messaging_service_handler() {
+    auto& ms = net::get_local_messaging_service();
+    ms.register_repair_row_hashes([] (sstring keyspace, sstring cf, query::range<dht::token> range,
+            repair_row_window window, uint32_t limit, bool with_rows) {
+        auto s = service::get_local_storage_proxy().get_db().local().find_schema(keyspace, cf);
+        return get_row_hashes(std::move(s), std::move(range), std::move(window), limit, with_rows);
+    });
+    ms.register_repair_get_rows([] (const rpc::client_info& cinfo, sstring keyspace, sstring cf, query::range<dht::token> range,
+            repair_row_window window, std::vector<repair_row_key> keys) {
+        gms::inet_address peer(net::ntoh(cinfo.addr.as_posix_sockaddr_in().sin_addr.s_addr));
+        auto s = service::get_local_storage_proxy().get_db().local().find_schema(keyspace, cf);
+        return get_rows(std::move(s), std::move(range), std::move(window), std::move(keys)).then([peer] (std::vector<frozen_mutation> rows) {
+            auto f = throttle(peer, rows);
+            return f.then([rows = std::move(rows)] () mutable {
+                return std::move(rows);
+            });
+        });
+    });
+    ms.register_repair_put_rows([] (std::vector<frozen_mutation> rows) {
+        auto f = throttle_inbound(rows);
+        return f.then([rows = std::move(rows)] () mutable {
+            return apply_rows(std::move(rows));
+        });
+    });
+}
+
+namespace {
+
+class row_sync {
+    gms::inet_address _peer;
+    sstring _keyspace;
+    sstring _cf;
+    schema_ptr _schema;
+    query::range<dht::token> _range;
+    std::experimental::optional<repair_row_key> _after;
+    row_sync_stats _stats;
+public:
+    row_sync(gms::inet_address peer, sstring keyspace, sstring cf, query::range<dht::token> range)
+        : _peer(peer)
+        , _keyspace(std::move(keyspace))
+        , _cf(std::move(cf))
+        , _schema(service::get_local_storage_proxy().get_db().local().find_schema(_keyspace, _cf))
+        , _range(std::move(range))
+    { }
+
+    const row_sync_stats& stats() const {
+        return _stats;
+    }
+
+    // Syncs the next window, and tells whether it was the last.
+    future<stop_iteration> sync_window() {
+        repair_row_window window;
+        window.after = _after;
+        return get_row_hashes(_schema, _range, window, window_rows, true).then([this, window] (repair_row_hashes local) mutable {
+            window.last = local.last;
+            return get_peer_hashes(window, false).then([this, window, local = std::move(local)] (repair_row_hashes remote) mutable {
+                narrow(window, local, remote);
+                if (remote.combined == local.combined && remote.count == local.count) {
+                    return make_ready_future<repair_row_window>(std::move(window));
+                }
+                return get_peer_hashes(window, true).then([this, window, local = std::move(local)] (repair_row_hashes rows) mutable {
+                    narrow(window, local, rows);
+                    return reconcile(window, local, rows).then([window] () mutable {
+                        return std::move(window);
+                    });
+                });
+            });
+        }).then([this] (repair_row_window window) {
+            if (!window.last) {
+                return stop_iteration::yes;
+            }
+            _after = std::move(window.last);
+            return stop_iteration::no;
+        });
+    }
+private:
+    future<repair_row_hashes> get_peer_hashes(const repair_row_window& window, bool with_rows) {
+        auto& ms = net::get_local_messaging_service();
+        return ms.send_repair_row_hashes(net::messaging_service::shard_id{_peer, 0}, _keyspace, _cf, _range,
+            window, 2 * window_rows, with_rows);
+    }
+
+    // When the peer stopped short of the end of the window, the window ends
+    // where it stopped.
+    void narrow(repair_row_window& window, repair_row_hashes& local, const repair_row_hashes& remote) {
+        if (remote.last) {
+            window.last = remote.last;
+            local.trim(*_schema, *remote.last);
+        }
+    }
+
+    future<> reconcile(const repair_row_window& window, const repair_row_hashes& local, const repair_row_hashes& remote) {
+        auto diff = diff_rows(*_schema, local, remote);
+        auto& to_send = diff.to_send;
+        auto& to_fetch = diff.to_fetch;
+        _stats.rows_sent += to_send.size();
+        _stats.rows_received += to_fetch.size();
+
+        auto& ms = net::get_local_messaging_service();
+        auto id = net::messaging_service::shard_id{_peer, 0};
+        auto send = to_send.empty() ? make_ready_future<>()
+                : get_rows(_schema, _range, window, std::move(to_send)).then([&ms, id] (std::vector<frozen_mutation> rows) {
+            return do_with(std::move(rows), [&ms, id] (const std::vector<frozen_mutation>& rows) {
+                return throttle(id.addr, rows).then([&ms, id, &rows] {
+                    return ms.send_repair_put_rows(id, rows);
+                });
+            });
+        });
+        auto fetch = to_fetch.empty() ? make_ready_future<>()
+                : ms.send_repair_get_rows(id, _keyspace, _cf, _range, window, std::move(to_fetch)).then([] (std::vector<frozen_mutation> rows) {
+            auto f = throttle_inbound(rows);
+            return f.then([rows = std::move(rows)] () mutable {
+                return apply_rows(std::move(rows));
+            });
+        });
+        return when_all(std::move(send), std::move(fetch)).then([] (std::tuple<future<>, future<>> done) {
+            std::get<0>(done).get();
+            std::get<1>(done).get();
+        });
+    }
+};
+
+}
+
+future<row_sync_stats> sync_rows(gms::inet_address peer, sstring keyspace, sstring cf,
+        query::range<dht::token> range) {
+    auto sync = make_lw_shared<row_sync>(peer, std::move(keyspace), std::move(cf), std::move(range));
+    return repeat([sync] {
+        return sync->sync_window();
+    }).then([sync] {
+        return sync->stats();
+    });
+}
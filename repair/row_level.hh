@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+#include <vector>
+
+#include <seastar/core/future.hh>
+
+#include "bytes.hh"
+#include "keys.hh"
+#include "schema.hh"
+#include "query-request.hh"
+#include "dht/i_partitioner.hh"
+#include "gms/inet_address.hh"
+
+// Row-level repair syncs the rows of a table in a token range with a peer,
+// so that a differing cell of a wide partition costs the transfer of its row
+// rather than of the partition. The replicas walk the range in windows of a
+// bounded number of rows. For each window they compare the XOR of the hashes
+// of its rows, and only when it differs the hashes of the rows themselves.
+// Then they exchange the rows which differ, as frozen mutations.
+//
+// The partition-level data of a partition, i.e. its tombstone, static row
+// and range tombstones, counts as a row of its own, ordered before the
+// clustering rows of the partition.
+
+// The position of a row: its partition and, but for the partition-level
+// row, its clustering key.
+class repair_row_key {
+public:
+    dht::decorated_key dk;
+    std::experimental::optional<clustering_key> ck;
+public:
+    repair_row_key(dht::decorated_key dk, std::experimental::optional<clustering_key> ck)
+        : dk(std::move(dk))
+        , ck(std::move(ck))
+    { }
+
+    int tri_compare(const schema& s, const repair_row_key& other) const;
+
+    size_t serialized_size() const;
+    void serialize(bytes::iterator& out) const;
+    static repair_row_key deserialize(bytes_view& v);
+};
+
+// The rows of a window: those after `after`, or from the start of the
+// range, up to and including `last`, or up to the end of the range.
+class repair_row_window {
+public:
+    std::experimental::optional<repair_row_key> after;
+    std::experimental::optional<repair_row_key> last;
+public:
+    size_t serialized_size() const;
+    void serialize(bytes::iterator& out) const;
+    static repair_row_window deserialize(bytes_view& v);
+};
+
+// What a replica has in a window.
+class repair_row_hashes {
+public:
+    // The XOR of the hashes of the rows.
+    uint64_t combined = 0;
+    uint64_t count = 0;
+    // The last row read, when the replica stopped at the limit of rows it
+    // was asked for.
+    std::experimental::optional<repair_row_key> last;
+    // The rows and their hashes, in ring order, when asked for.
+    std::vector<std::pair<repair_row_key, uint64_t>> rows;
+public:
+    // Drops the rows after last, when the peer stopped reading there.
+    void trim(const schema& s, const repair_row_key& last);
+
+    size_t serialized_size() const;
+    void serialize(bytes::iterator& out) const;
+    static repair_row_hashes deserialize(bytes_view& v);
+};
+
+// The rows of a window to send to the peer and to fetch from it, given the
+// hashes of both replicas: those either one lacks, and those whose hashes
+// differ.
+struct repair_row_diff {
+    std::vector<repair_row_key> to_send;
+    std::vector<repair_row_key> to_fetch;
+};
+
+repair_row_diff diff_rows(const schema& s, const repair_row_hashes& local, const repair_row_hashes& remote);
+
+struct row_sync_stats {
+    uint64_t rows_sent = 0;
+    uint64_t rows_received = 0;
+
+    row_sync_stats& operator+=(const row_sync_stats& o) {
+        rows_sent += o.rows_sent;
+        rows_received += o.rows_received;
+        return *this;
+    }
+};
+
+// Syncs the rows of the table in the range, which must not wrap around, with
+// the peer. Runs on the calling shard, reading the data of all shards.
+future<row_sync_stats> sync_rows(gms::inet_address peer, sstring keyspace, sstring cf,
+        query::range<dht::token> range);
+
+// Registers the handlers of the verbs of row-level repair on this shard.
+void init_row_level_repair_messaging_service_handler();
@@ -26,14 +26,112 @@
 #include <seastar/core/scollectd.hh>
 #include <seastar/util/defer.hh>
 #include "memtable.hh"
+#include "utils/cpu_scheduler.hh"
 #include <chrono>
+#include <lz4.h>
 
 using namespace std::chrono_literals;
+namespace stdx = std::experimental;
 
 static logging::logger logger("cache");
 
-thread_local seastar::thread_scheduling_group row_cache::_update_thread_scheduling_group(1ms, 0.2);
+// Links e, which was just allocated, before i, freeing it if that fails.
+static void insert_new(row_cache::partitions_type& t, row_cache::partitions_type::const_iterator i, cache_entry* e) {
+    try {
+        t.insert_before(i, *e);
+    } catch (...) {
+        current_allocator().destroy(e);
+        throw;
+    }
+}
+
+// The values of large cells of tables whose caching options ask so are
+// kept compressed with LZ4, if that saves at least an eighth of them, and
+// decompressed into the mutations the cache returns. The value of a
+// compressed cell is its uncompressed size followed by the LZ4 block.
+
+static thread_local bytes compression_buffer;
+
+// Returns the compressed value, in compression_buffer, unless compressing
+// doesn't save enough.
+static stdx::optional<bytes_view> compress_value(bytes_view v) {
+    auto bound = sizeof(uint32_t) + LZ4_COMPRESSBOUND(v.size());
+    if (compression_buffer.size() < bound) {
+        compression_buffer = bytes(bytes::initialized_later(), bound);
+    }
+    auto out = compression_buffer.begin();
+    auto len = LZ4_compress(reinterpret_cast<const char*>(v.begin()), reinterpret_cast<char*>(out + sizeof(uint32_t)), v.size());
+    auto size = sizeof(uint32_t) + len;
+    if (len <= 0 || size > v.size() - v.size() / 8) {
+        return {};
+    }
+    auto n = net::hton(uint32_t(v.size()));
+    std::copy_n(reinterpret_cast<const int8_t*>(&n), sizeof(n), out);
+    return bytes_view(out, size);
+}
+
+static bytes decompress_value(bytes_view v) {
+    auto size = read_simple<uint32_t>(v);
+    bytes out(bytes::initialized_later(), size);
+    auto len = LZ4_decompress_safe(reinterpret_cast<const char*>(v.begin()), reinterpret_cast<char*>(out.begin()), v.size(), size);
+    if (len < 0 || uint32_t(len) != size) {
+        throw std::runtime_error("LZ4 decompression of a cached value failed");
+    }
+    return out;
+}
 
+static size_t compression_saving(bytes_view compressed) {
+    return read_simple<uint32_t>(compressed) - compressed.size();
+}
+
+// Compresses the values of the atomic cells of the row of at least
+// threshold bytes.
+static void compress_cells(const schema& s, column_kind kind, row& r, size_t threshold,
+        cache_tracker& tracker, cache_entry& entry) {
+    r.for_each_cell_until([&] (column_id id, atomic_cell_or_collection& c) {
+        if (s.column_at(kind, id).is_atomic()) {
+            auto cell = c.as_atomic_cell();
+            if (cell.is_live() && !cell.is_compressed() && cell.value().size() >= threshold) {
+                auto v = compress_value(cell.value());
+                if (v) {
+                    auto saving = cell.value().size() - v->size();
+                    c = atomic_cell::with_value(cell, *v, true);
+                    tracker.on_compressed(entry, saving);
+                }
+            }
+        }
+        return stop_iteration::no;
+    });
+}
+
+// Decompresses the values of the atomic cells of the row, or only of those
+// of the columns other has cells of, if given. Returns the number of values
+// decompressed and the memory saved by their compression.
+static std::pair<uint64_t, size_t> decompress_cells(const schema& s, column_kind kind, row& r, const row* other) {
+    uint64_t values = 0;
+    size_t saving = 0;
+    r.for_each_cell_until([&] (column_id id, atomic_cell_or_collection& c) {
+        if (s.column_at(kind, id).is_atomic() && (!other || other->find_cell(id))) {
+            auto cell = c.as_atomic_cell();
+            if (cell.is_compressed()) {
+                ++values;
+                saving += compression_saving(cell.value());
+                c = atomic_cell::with_value(cell, decompress_value(cell.value()), false);
+            }
+        }
+        return stop_iteration::no;
+    });
+    return { values, saving };
+}
+
+// Decompresses the values of a copy of a cached partition.
+static uint64_t decompress_partition(const schema& s, mutation_partition& p) {
+    auto values = decompress_cells(s, column_kind::static_column, p.static_row(), nullptr).first;
+    for (auto&& e : p.clustered_rows()) {
+        values += decompress_cells(s, column_kind::regular_column, e.row().cells(), nullptr).first;
+    }
+    return values;
+}
 
 cache_tracker& global_cache_tracker() {
     static thread_local cache_tracker instance;
@@ -45,16 +143,44 @@ cache_tracker::cache_tracker() {
 
     _region.make_evictable([this] {
         return with_allocator(_region.allocator(), [this] {
-            if (_lru.empty()) {
+            if (_probationary_lru.empty() && _protected_lru.empty()) {
                 return memory::reclaiming_result::reclaimed_nothing;
             }
-            _lru.pop_back_and_dispose(current_deleter<cache_entry>());
-            --_partitions;
+            evict_one();
             return memory::reclaiming_result::reclaimed_something;
         });
     });
 }
 
+constexpr size_t cache_tracker::rows_evicted_at_once;
+constexpr double cache_tracker::protected_ratio;
+
+// Trims rows from the end of the least recently used partition, which
+// stays at the back of its segment, so that reads of the head of a wide
+// partition keep hitting while its tail is evicted. Must be called with
+// the region's allocator.
+void cache_tracker::evict_one() {
+    auto& lru = _probationary_lru.empty() ? _protected_lru : _probationary_lru;
+    cache_entry& e = lru.back();
+    auto& rows = e.partition().clustered_rows();
+    if (rows.size() <= rows_evicted_at_once) {
+        on_erase(e);
+        if (e._protected) {
+            ++_protected_evictions;
+        } else {
+            ++_probationary_evictions;
+        }
+        lru.pop_back_and_dispose(current_deleter<cache_entry>());
+        return;
+    }
+    on_rows_dropped(e, rows_evicted_at_once);
+    for (size_t n = 0; n < rows_evicted_at_once; ++n) {
+        rows.erase_and_dispose(std::prev(rows.end()), current_deleter<rows_entry>());
+    }
+    e._complete = false;
+    _evicted_rows += rows_evicted_at_once;
+}
+
 cache_tracker::~cache_tracker() {
     clear();
 }
@@ -82,6 +208,11 @@ cache_tracker::setup_collectd() {
                 , "total_operations", "misses")
                 , scollectd::make_typed(scollectd::data_type::DERIVE, _misses)
         ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "negative_hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _negative_hits)
+        ),
         scollectd::add_polled_metric(scollectd::type_instance_id("cache"
                 , scollectd::per_cpu_plugin_instance
                 , "total_operations", "insertions")
@@ -92,34 +223,153 @@ cache_tracker::setup_collectd() {
                 , "total_operations", "merges")
                 , scollectd::make_typed(scollectd::data_type::DERIVE, _merges)
         ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "row_evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _evicted_rows)
+        ),
         scollectd::add_polled_metric(scollectd::type_instance_id("cache"
                 , scollectd::per_cpu_plugin_instance
                 , "objects", "partitions")
                 , scollectd::make_typed(scollectd::data_type::GAUGE, _partitions)
         ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "protected_partitions")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _protected_partitions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "probationary_partitions")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _partitions - _protected_partitions; })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "promotions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _promotions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "demotions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _demotions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "probationary_evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _probationary_evictions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "protected_evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _protected_evictions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_time_in_ms", "update")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, [this] { return _update_time_ns / 1000000; })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "update_slices")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _update_slices)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "latency", "max_update_slice")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _max_update_slice_ns / 1000; })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "compression_saving")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _compression_saving)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "compressed_values")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _compressed_values)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "decompressed_values")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _decompressed_values)
+        ),
     }));
 }
 
 void cache_tracker::clear() {
     with_allocator(_region.allocator(), [this] {
-        _lru.clear_and_dispose(current_deleter<cache_entry>());
+        _probationary_lru.clear_and_dispose(current_deleter<cache_entry>());
+        _protected_lru.clear_and_dispose(current_deleter<cache_entry>());
     });
     _partitions = 0;
+    _protected_partitions = 0;
+    _compression_saving = 0;
+}
+
+void cache_tracker::demote_excess() {
+    while (_protected_partitions > _partitions * protected_ratio) {
+        cache_entry& e = _protected_lru.back();
+        _protected_lru.pop_back();
+        e._protected = false;
+        _probationary_lru.push_front(e);
+        --_protected_partitions;
+        ++_demotions;
+    }
 }
 
 void cache_tracker::touch(cache_entry& e) {
-    _lru.erase(_lru.iterator_to(e));
-    _lru.push_front(e);
+    if (e._protected) {
+        _protected_lru.erase(_protected_lru.iterator_to(e));
+    } else {
+        _probationary_lru.erase(_probationary_lru.iterator_to(e));
+        e._protected = true;
+        ++_protected_partitions;
+        ++_promotions;
+    }
+    _protected_lru.push_front(e);
+    demote_excess();
 }
 
 void cache_tracker::insert(cache_entry& entry) {
     ++_insertions;
     ++_partitions;
-    _lru.push_front(entry);
+    _probationary_lru.push_front(entry);
 }
 
-void cache_tracker::on_erase() {
+void cache_tracker::on_erase(const cache_entry& e) {
     --_partitions;
+    if (e._protected) {
+        --_protected_partitions;
+    }
+    _compression_saving -= e._compression_saving;
+}
+
+void cache_tracker::on_compressed(cache_entry& e, size_t saving) {
+    e._compressed = true;
+    e._compression_saving += saving;
+    _compression_saving += saving;
+    ++_compressed_values;
+}
+
+void cache_tracker::on_decompressed(cache_entry& e, uint64_t values, size_t saving) {
+    // The entry's saving may have been underestimated.
+    saving = std::min(saving, e._compression_saving);
+    e._compression_saving -= saving;
+    _compression_saving -= saving;
+    _decompressed_values += values;
+}
+
+void cache_tracker::on_rows_dropped(cache_entry& e, size_t rows) {
+    // Assumes the rows saved their share.
+    auto saving = e._compression_saving * rows / e.partition().clustered_rows().size();
+    e._compression_saving -= saving;
+    _compression_saving -= saving;
+}
+
+void cache_tracker::on_uncompressed(cache_entry& e) {
+    _compression_saving -= e._compression_saving;
+    e._compression_saving = 0;
+    e._compressed = false;
 }
 
 void cache_tracker::on_merge() {
@@ -134,6 +384,17 @@ void cache_tracker::on_miss() {
     ++_misses;
 }
 
+void cache_tracker::on_negative_hit() {
+    ++_negative_hits;
+}
+
+void cache_tracker::on_update_slice(std::chrono::steady_clock::duration d) {
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    _update_time_ns += ns;
+    ++_update_slices;
+    _max_update_slice_ns = std::max(_max_update_slice_ns, ns);
+}
+
 allocation_strategy& cache_tracker::allocator() {
     return _region.allocator();
 }
@@ -147,25 +408,121 @@ const logalloc::region& cache_tracker::region() const {
 }
 
 // Reader which populates the cache using data from the delegate.
+//
+// When reading a single partition, given by key, its absence from the
+// delegate is recorded in cache too.
 class populating_reader final : public mutation_reader::impl {
     row_cache& _cache;
     mutation_reader _delegate;
+    uint64_t _phase;
+    stdx::optional<dht::decorated_key> _key;
 public:
-    populating_reader(row_cache& cache, mutation_reader delegate)
+    populating_reader(row_cache& cache, mutation_reader delegate, stdx::optional<dht::decorated_key> key = {})
         : _cache(cache)
         , _delegate(std::move(delegate))
+        , _phase(cache._populate_phase)
+        , _key(std::move(key))
     { }
 
     virtual future<mutation_opt> operator()() override {
         return _delegate().then([this] (mutation_opt&& mo) {
+            bool can_populate = _phase == _cache._populate_phase;
             if (mo) {
-                _cache.populate(*mo);
+                if (can_populate) {
+                    _cache.populate(*mo);
+                }
+            } else if (_key && can_populate) {
+                _cache.populate_absent(*_key);
             }
+            _key = {};
             return std::move(mo);
         });
     }
 };
 
+// Reader which populates the cache with as much of the partitions read
+// from the delegate as is needed to answer a query of the slice.
+class slice_populating_reader final : public mutation_reader::impl {
+    row_cache& _cache;
+    mutation_reader _delegate;
+    const query::partition_slice& _slice;
+    uint32_t _row_limit;
+    gc_clock::time_point _now;
+    uint64_t _phase;
+    stdx::optional<dht::decorated_key> _key;
+public:
+    slice_populating_reader(row_cache& cache, mutation_reader delegate, const query::partition_slice& slice,
+            uint32_t row_limit, gc_clock::time_point now, const dht::decorated_key& key)
+        : _cache(cache)
+        , _delegate(std::move(delegate))
+        , _slice(slice)
+        , _row_limit(row_limit)
+        , _now(now)
+        , _phase(cache._populate_phase)
+        , _key(key)
+    { }
+
+    virtual future<mutation_opt> operator()() override {
+        return _delegate().then([this] (mutation_opt&& mo) {
+            bool can_populate = _phase == _cache._populate_phase;
+            if (mo) {
+                if (can_populate) {
+                    _cache.populate(*mo, _slice, _row_limit, _now);
+                }
+            } else if (_key && can_populate) {
+                _cache.populate_absent(*_key);
+            }
+            _key = {};
+            return std::move(mo);
+        });
+    }
+};
+
+// Walks the rows of p which a query of the slice, returning at most
+// row_limit rows, would look at, setting last to the last one of them.
+// Returns whether the query could also look at rows sorted after the last
+// row of p.
+static bool needs_rows_past_end(const schema& s, const mutation_partition& p, const query::partition_slice& slice,
+        uint32_t row_limit, gc_clock::time_point now, mutation_partition::rows_type::const_iterator& last) {
+    auto& rows = p.clustered_rows();
+    last = rows.end();
+    if (rows.empty()) {
+        return true;
+    }
+    if (slice.options.contains(query::partition_slice::option::reversed)) {
+        last = std::prev(rows.end());
+        return true;
+    }
+    auto cmp = rows_entry::key_comparator(clustering_key::prefix_equality_less_compare(s));
+    const rows_entry& last_row = *rows.rbegin();
+    for (auto&& row_range : slice.row_ranges) {
+        auto r = p.range(s, row_range);
+        for (auto i = r.begin(); i != r.end(); ++i) {
+            last = i;
+            if (i->row().is_live(s, p.tombstone_for_row(s, *i), now) && --row_limit == 0) {
+                return false;
+            }
+        }
+        if (!row_range.end()) {
+            return true;
+        }
+        auto& end = row_range.end()->value();
+        if (row_range.end()->is_inclusive() ? !cmp(end, last_row) : cmp(last_row, end)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cache_entry::covers(const schema& s, const query::partition_slice& slice, uint32_t row_limit,
+        gc_clock::time_point now) const {
+    if (_complete) {
+        return true;
+    }
+    mutation_partition::rows_type::const_iterator last;
+    return !needs_rows_past_end(s, _p, slice, row_limit, now, last);
+}
+
 void row_cache::on_hit() {
     ++_stats.hits;
     _tracker.on_hit();
@@ -194,14 +551,14 @@ row_cache::make_reader(const query::partition_range& range) {
         return _read_section(_tracker.region(), [&] {
             const dht::decorated_key& dk = pos.as_decorated_key();
             auto i = _partitions.find(dk, cache_entry::compare(_schema));
-            if (i != _partitions.end()) {
+            if (i != _partitions.end() && i->complete()) {
                 cache_entry& e = *i;
                 _tracker.touch(e);
                 on_hit();
-                return make_reader_returning(mutation(_schema, dk, e.partition()));
+                return make_entry_reader(e);
             } else {
                 on_miss();
-                return make_mutation_reader<populating_reader>(*this, _underlying(range));
+                return make_mutation_reader<populating_reader>(*this, _underlying(range), dk);
             }
         });
     }
@@ -209,55 +566,235 @@ row_cache::make_reader(const query::partition_range& range) {
     return make_scanning_reader(range);
 }
 
+mutation_reader
+row_cache::make_reader(const query::partition_range& range, const query::partition_slice& slice, uint32_t row_limit,
+        gc_clock::time_point now) {
+    auto bypass = slice.options.contains(query::partition_slice::option::bypass_cache);
+    if (!query::is_single_partition(range)) {
+        if (bypass) {
+            return _underlying(range);
+        }
+        return make_scanning_reader(range);
+    }
+
+    return _read_section(_tracker.region(), [&] {
+        const dht::decorated_key& dk = range.start()->value().as_decorated_key();
+        auto i = _partitions.find(dk, cache_entry::compare(_schema));
+        if (i != _partitions.end() && i->covers(*_schema, slice, row_limit, now)) {
+            cache_entry& e = *i;
+            if (!bypass) {
+                _tracker.touch(e);
+            }
+            on_hit();
+            return make_entry_reader(e);
+        } else {
+            on_miss();
+            if (bypass) {
+                return _underlying(range);
+            }
+            return make_mutation_reader<slice_populating_reader>(*this, _underlying(range), slice, row_limit, now, dk);
+        }
+    });
+}
+
+mutation_reader row_cache::make_entry_reader(const cache_entry& e) {
+    if (e.absent()) {
+        _tracker.on_negative_hit();
+        return make_empty_reader();
+    }
+    mutation m(_schema, e.key(), e.partition());
+    if (e._compressed) {
+        _tracker.on_decompressed_for_read(decompress_partition(*_schema, m.partition()));
+    }
+    return make_reader_returning(std::move(m));
+}
+
 row_cache::~row_cache() {
     clear();
 }
 
+// Returns the end of the first max_rows rows.
+static mutation_partition::rows_type::const_iterator
+first_rows_end(const mutation_partition::rows_type& rows, uint64_t max_rows) {
+    return rows.size() > max_rows ? std::next(rows.begin(), max_rows) : rows.end();
+}
+
 void row_cache::populate(const mutation& m) {
-    with_allocator(_tracker.allocator(), [this, &m] {
+    populate_prefix(m, first_rows_end(m.partition().clustered_rows(), _schema->caching_options().rows_per_partition()));
+}
+
+void row_cache::populate(const mutation& m, const query::partition_slice& slice, uint32_t row_limit,
+        gc_clock::time_point now) {
+    auto& p = m.partition();
+    auto& rows = p.clustered_rows();
+    auto end = first_rows_end(rows, _schema->caching_options().rows_per_partition());
+    mutation_partition::rows_type::const_iterator last;
+    if (rows.size() > _tracker.partial_partition_threshold() && !needs_rows_past_end(*_schema, p, slice, row_limit, now, last)) {
+        auto needed_end = last == rows.end() ? std::next(rows.begin()) : std::next(last);
+        if (end == rows.end() || (needed_end != rows.end() && rows_entry::compare(*_schema)(*needed_end, *end))) {
+            end = needed_end;
+        }
+    }
+    populate_prefix(m, end);
+}
+
+void row_cache::populate_prefix(const mutation& m, mutation_partition::rows_type::const_iterator end) {
+    if (!_schema->caching_options().row_cache_enabled()) {
+        return;
+    }
+    auto& p = m.partition();
+    if (end == p.clustered_rows().end()) {
+        do_populate(m, p, true);
+        return;
+    }
+    mutation_partition prefix(_schema);
+    prefix.apply(p.partition_tombstone());
+    prefix.static_row() = row(p.static_row());
+    for (auto&& rt : p.row_tombstones()) {
+        prefix.apply_row_tombstone(*_schema, rt.prefix(), rt.t());
+    }
+    for (auto i = p.clustered_rows().begin(); i != end; ++i) {
+        auto& r = prefix.clustered_row(i->key());
+        r.apply(i->row().deleted_at());
+        r.apply(i->row().marker());
+        r.cells() = row(i->row().cells());
+    }
+    do_populate(m, prefix, false);
+}
+
+void row_cache::trim(cache_entry& entry) {
+    auto& rows = entry.partition().clustered_rows();
+    auto max_rows = _schema->caching_options().rows_per_partition();
+    if (rows.size() > max_rows) {
+        _tracker.on_rows_dropped(entry, rows.size() - max_rows);
+        rows.erase_and_dispose(std::next(rows.begin(), max_rows), rows.end(), current_deleter<rows_entry>());
+        entry._complete = false;
+    }
+}
+
+void row_cache::compress(cache_entry& entry, const schema& s) {
+    auto threshold = _schema->caching_options().cell_compression_threshold();
+    // Counter cells are merged by value.
+    if (!threshold || s.is_counter()) {
+        return;
+    }
+    compress_cells(s, column_kind::static_column, entry.partition().static_row(), threshold, _tracker, entry);
+    for (auto&& e : entry.partition().clustered_rows()) {
+        compress_cells(s, column_kind::regular_column, e.row().cells(), threshold, _tracker, entry);
+    }
+}
+
+// Decompresses the values of the cells of the entry p has cells of too,
+// which apply() compares by value.
+static void decompress_for_merge(const schema& s, cache_tracker& tracker, cache_entry& entry, const mutation_partition& p) {
+    auto& cached = entry.partition();
+    auto r = decompress_cells(s, column_kind::static_column, cached.static_row(), &p.static_row());
+    for (auto&& e : p.clustered_rows()) {
+        auto i = cached.clustered_rows().find(e, rows_entry::compare(s));
+        if (i != cached.clustered_rows().end()) {
+            auto ri = decompress_cells(s, column_kind::regular_column, i->row().cells(), &e.row().cells());
+            r.first += ri.first;
+            r.second += ri.second;
+        }
+    }
+    tracker.on_decompressed(entry, r.first, r.second);
+}
+
+void row_cache::do_populate(const mutation& m, const mutation_partition& p, bool complete) {
+    with_allocator(_tracker.allocator(), [this, &m, &p, complete] {
         _populate_section(_tracker.region(), [&] {
         auto i = _partitions.lower_bound(m.decorated_key(), cache_entry::compare(_schema));
         if (i == _partitions.end() || !i->key().equal(*_schema, m.decorated_key())) {
-            cache_entry* entry = current_allocator().construct<cache_entry>(m.decorated_key(), m.partition());
+            cache_entry* entry = current_allocator().construct<cache_entry>(m.decorated_key(), p);
+            entry->_complete = complete;
+            insert_new(_partitions, i, entry);
             _tracker.insert(*entry);
-            _partitions.insert(i, *entry);
+            compress(*entry, *_schema);
         } else {
-            _tracker.touch(*i);
-            // We cache whole partitions right now, so if cache already has this partition,
-            // it must be complete, so do nothing.
+            cache_entry& entry = *i;
+            // Not a hit, so the entry is not promoted: a scan over cached
+            // partitions mustn't protect them all.
+            //
+            // Whatever is cached is consistent with the underlying data
+            // sources, so a partial entry only needs to be replaced by
+            // a longer prefix.
+            if (entry._absent || (!entry._complete
+                    && (complete || p.clustered_rows().size() > entry.partition().clustered_rows().size()))) {
+                entry.partition() = p;
+                entry._complete = complete;
+                entry._absent = false;
+                _tracker.on_uncompressed(entry);
+                compress(entry, *_schema);
+            }
         }
         });
     });
 }
 
+void row_cache::populate_absent(const dht::decorated_key& dk) {
+    if (!_schema->caching_options().row_cache_enabled()) {
+        return;
+    }
+    with_allocator(_tracker.allocator(), [this, &dk] {
+        _populate_section(_tracker.region(), [&] {
+            auto i = _partitions.lower_bound(dk, cache_entry::compare(_schema));
+            if (i == _partitions.end() || !i->key().equal(*_schema, dk)) {
+                cache_entry* entry = current_allocator().construct<cache_entry>(dk, mutation_partition(_schema));
+                entry->_absent = true;
+                insert_new(_partitions, i, entry);
+                _tracker.insert(*entry);
+            }
+        });
+    });
+}
+
 void row_cache::clear() {
     with_allocator(_tracker.allocator(), [this] {
         _partitions.clear_and_dispose([this, deleter = current_deleter<cache_entry>()] (auto&& p) mutable {
-            _tracker.on_erase();
+            _tracker.on_erase(*p);
             deleter(p);
         });
     });
 }
 
+// Rows sorted after the last row of a partial entry are not cached, so
+// those the memtable brings there are dropped rather than merged. Must be
+// called with the cache's allocator.
+static void merge_partial(const schema& s, cache_entry& entry, mutation_partition&& p) {
+    auto& last = *entry.partition().clustered_rows().rbegin();
+    auto& new_rows = p.clustered_rows();
+    new_rows.erase_and_dispose(new_rows.upper_bound(last, rows_entry::compare(s)), new_rows.end(),
+            current_deleter<rows_entry>());
+    entry.partition().apply(s, std::move(p));
+}
+
 future<> row_cache::update(memtable& m, partition_presence_checker presence_checker) {
     _tracker.region().merge(m._region); // Now all data in memtable belongs to cache
-    auto attr = seastar::thread_attributes();
-    attr.scheduling_group = &_update_thread_scheduling_group;
-    auto t = seastar::thread(attr, [this, &m, presence_checker = std::move(presence_checker)] {
+    ++_populate_phase;
+    auto t = seastar::thread([this, &m, presence_checker = std::move(presence_checker)] {
       auto cleanup = defer([&] {
           with_allocator(_tracker.allocator(), [&m, this] () {
             m.partitions.clear_and_dispose(current_deleter<partition_entry>());
           });
       });
+      auto update_start = std::chrono::steady_clock::now();
+      unsigned slices = 0;
+      cpu_timeslice timeslice(memtable_flush_group());
       while (!m.partitions.empty()) {
-        with_allocator(_tracker.allocator(), [this, &m, &presence_checker] () {
-            unsigned quota = 30;
+        auto slice_start = std::chrono::steady_clock::now();
+        ++slices;
+        with_allocator(_tracker.allocator(), [this, &m, &presence_checker, slice_start] () {
             auto cmp = cache_entry::compare(_schema);
             try {
                 _update_section(_tracker.region(), [&] {
                     auto i = m.partitions.begin();
                     const schema& s = *m.schema();
-                    while (i != m.partitions.end() && quota) {
+                    bool enabled = _schema->caching_options().row_cache_enabled();
+                    // Always make progress, even if we got here late.
+                    bool first = true;
+                    while (i != m.partitions.end() && (first || !(seastar::thread::should_yield()
+                            || std::chrono::steady_clock::now() - slice_start >= cpu_scheduler::timeslice))) {
+                        first = false;
                         partition_entry& mem_e = *i;
                         // FIXME: Optimize knowing we lookup in-order.
                         auto cache_i = _partitions.lower_bound(mem_e.key(), cmp);
@@ -266,24 +803,48 @@ future<> row_cache::update(memtable& m, partition_presence_checker presence_chec
                         //        search it.
                         if (cache_i != _partitions.end() && cache_i->key().equal(s, mem_e.key())) {
                             cache_entry& entry = *cache_i;
-                            entry.partition().apply(s, std::move(mem_e.partition()));
-                            _tracker.touch(entry);
-                            _tracker.on_merge();
-                        } else if (presence_checker(mem_e.key().key()) ==
+                            if (!enabled) {
+                                // Caching was turned off after the entry was populated.
+                                _tracker.on_erase(entry);
+                                _partitions.erase_and_dispose(cache_i, current_deleter<cache_entry>());
+                            } else {
+                                if (entry._compressed) {
+                                    decompress_for_merge(s, _tracker, entry, mem_e.partition());
+                                }
+                                if (entry.complete()) {
+                                    // An absent entry is complete, the partition
+                                    // being just what the memtable brings.
+                                    entry.partition().apply(s, std::move(mem_e.partition()));
+                                    entry._absent = false;
+                                } else {
+                                    merge_partial(s, entry, std::move(mem_e.partition()));
+                                }
+                                trim(entry);
+                                compress(entry, s);
+                                _tracker.touch(entry);
+                                _tracker.on_merge();
+                            }
+                        } else if (enabled && presence_checker(mem_e.key().key()) ==
                                    partition_presence_checker_result::definitely_doesnt_exist) {
                             cache_entry* entry = current_allocator().construct<cache_entry>(
                                 std::move(mem_e.key()), std::move(mem_e.partition()));
+                            try {
+                                _partitions.insert_before(cache_i, *entry);
+                            } catch (...) {
+                                // Give the data back, so that the retry finds it.
+                                mem_e.key() = std::move(entry->_key);
+                                mem_e.partition() = std::move(entry->_p);
+                                current_allocator().destroy(entry);
+                                throw;
+                            }
+                            trim(*entry);
                             _tracker.insert(*entry);
-                            _partitions.insert(cache_i, *entry);
+                            compress(*entry, s);
                         }
                         i = m.partitions.erase(i);
                         current_allocator().destroy(&mem_e);
-                        --quota;
                     }
                 });
-                if (quota == 0 && seastar::thread::should_yield()) {
-                    return;
-                }
             } catch (const std::bad_alloc&) {
                 // Cache entry may be in an incomplete state if
                 // _update_section fails due to weak exception guarantees of
@@ -291,14 +852,21 @@ future<> row_cache::update(memtable& m, partition_presence_checker presence_chec
                 auto i = m.partitions.begin();
                 auto cache_i = _partitions.find(i->key(), cmp);
                 if (cache_i != _partitions.end()) {
+                    _tracker.on_erase(*cache_i);
                     _partitions.erase_and_dispose(cache_i, current_deleter<cache_entry>());
-                    _tracker.on_erase();
                 }
                 throw;
             }
         });
-        seastar::thread::yield();
+        auto slice_time = std::chrono::steady_clock::now() - slice_start;
+        _tracker.on_update_slice(slice_time);
+        timeslice.charge(slice_time);
+        timeslice.yield().get();
       }
+      logger.debug("Merged memtable into cache of {}.{} in {} us, {} slices",
+          _schema->ks_name(), _schema->cf_name(),
+          std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - update_start).count(),
+          slices);
     });
     return do_with(std::move(t), [] (seastar::thread& t) {
         return t.join();
@@ -312,6 +880,17 @@ void row_cache::touch(const dht::decorated_key& dk) {
     }
 }
 
+std::vector<partition_key> row_cache::keys(bool protected_entries) const {
+    std::vector<partition_key> keys;
+    logalloc::reclaim_lock _(_tracker.region());
+    for (auto&& e : _partitions) {
+        if (!e.absent() && e.is_protected() == protected_entries) {
+            keys.push_back(e.key().key());
+        }
+    }
+    return keys;
+}
+
 row_cache::row_cache(schema_ptr s, mutation_source fallback_factory, cache_tracker& tracker)
     : _tracker(tracker)
     , _schema(std::move(s))
@@ -322,18 +901,17 @@ row_cache::row_cache(schema_ptr s, mutation_source fallback_factory, cache_track
 cache_entry::cache_entry(cache_entry&& o) noexcept
     : _key(std::move(o._key))
     , _p(std::move(o._p))
+    , _complete(o._complete)
+    , _protected(o._protected)
+    , _absent(o._absent)
+    , _compressed(o._compressed)
+    , _compression_saving(o._compression_saving)
     , _lru_link()
-    , _cache_link()
+    , _cache_link(std::move(o._cache_link))
 {
     {
         auto prev = o._lru_link.prev_;
         o._lru_link.unlink();
         cache_tracker::lru_type::node_algorithms::link_after(prev, _lru_link.this_ptr());
     }
-
-    {
-        using container_type = row_cache::partitions_type;
-        container_type::node_algorithms::replace_node(o._cache_link.this_ptr(), _cache_link.this_ptr());
-        container_type::node_algorithms::init(o._cache_link.this_ptr());
-    }
 }
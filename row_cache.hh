@@ -22,7 +22,7 @@
 #pragma once
 
 #include <boost/intrusive/list.hpp>
-#include <boost/intrusive/set.hpp>
+#include <chrono>
 
 #include "core/memory.hh"
 #include <seastar/core/thread.hh>
@@ -30,6 +30,7 @@
 #include "mutation_reader.hh"
 #include "mutation_partition.hh"
 #include "utils/logalloc.hh"
+#include "utils/intrusive_btree.hh"
 
 namespace scollectd {
 
@@ -41,19 +42,39 @@ namespace bi = boost::intrusive;
 
 // Intrusive set entry which holds partition data.
 //
+// An entry may hold only a prefix of the partition's rows, either because
+// it was populated from a read needing only those, or because rows were
+// evicted from its end. The static row and the tombstones are always
+// complete, and so are the rows up to and including the last one cached;
+// nothing is known about the rows following it.
+//
+// An entry may also record that the partition is absent from the
+// underlying data sources, so that repeated lookups of a missing key don't
+// have to go to them. Such an entry is complete and has an empty partition.
+//
 // TODO: Make memtables use this format too.
 class cache_entry {
-    // We need auto_unlink<> option on the _cache_link because when entry is
-    // evicted from cache via LRU we don't have a reference to the container
-    // and don't want to store it with each entry. As for the _lru_link, we
-    // have a global LRU, so technically we could not use auto_unlink<> on
-    // _lru_link, but it's convenient to do so too. We may also want to have
-    // multiple eviction spaces in the future and thus multiple LRUs.
+    // When entry is evicted from cache via LRU we don't have a reference to
+    // the container and don't want to store it with each entry, so it
+    // relies on _cache_link unlinking itself on destruction. As for the
+    // _lru_link, we have a global LRU, so technically we could not use
+    // auto_unlink<> on _lru_link, but it's convenient to do so too. We may
+    // also want to have multiple eviction spaces in the future and thus
+    // multiple LRUs.
     using lru_link_type = bi::list_member_hook<bi::link_mode<bi::auto_unlink>>;
-    using cache_link_type = bi::set_member_hook<bi::link_mode<bi::auto_unlink>>;
+    using cache_link_type = intrusive_btree_hook;
 
     dht::decorated_key _key;
     mutation_partition _p;
+    bool _complete = true;
+    // Whether the entry is in the protected segment of the LRU.
+    bool _protected = false;
+    bool _absent = false;
+    // Whether the values of some cells are compressed, see
+    // caching_options::cell_compression_threshold(), and the memory that
+    // saves, estimated once rows were evicted.
+    bool _compressed = false;
+    size_t _compression_saving = 0;
     lru_link_type _lru_link;
     cache_link_type _cache_link;
     friend class size_calculator;
@@ -71,11 +92,24 @@ class cache_entry {
         , _p(std::move(p))
     { }
 
+    cache_entry(dht::decorated_key&& key, mutation_partition&& p, bool complete) noexcept
+        : _key(std::move(key))
+        , _p(std::move(p))
+        , _complete(complete)
+    { }
+
     cache_entry(cache_entry&&) noexcept;
 
     const dht::decorated_key& key() const { return _key; }
     const mutation_partition& partition() const { return _p; }
     mutation_partition& partition() { return _p; }
+    bool complete() const { return _complete; }
+    bool is_protected() const { return _protected; }
+    bool absent() const { return _absent; }
+
+    // Whether the cached rows are enough to answer a query of the given
+    // slice returning at most row_limit rows.
+    bool covers(const schema&, const query::partition_slice&, uint32_t row_limit, gc_clock::time_point now) const;
 
     struct compare {
         dht::decorated_key::less_comparator _c;
@@ -96,35 +130,104 @@ class cache_entry {
             return _c(k1._key, k2);
         }
     };
+
+    struct key_prefix : dht::token_prefix_of {
+        using dht::token_prefix_of::operator();
+
+        uint64_t operator()(const cache_entry& e) const {
+            return (*this)(e._key);
+        }
+    };
 };
 
 // Tracks accesses and performs eviction of cache entries.
+//
+// Eviction follows a segmented LRU, so that a scan doesn't flush the cache.
+// Entries are inserted into the probationary segment and move to the
+// protected one when hit. The protected segment holds at most
+// protected_ratio of the entries, demoting its least recently used ones to
+// the front of the probationary segment, which is evicted first.
 class cache_tracker final {
 public:
     using lru_type = bi::list<cache_entry,
         bi::member_hook<cache_entry, cache_entry::lru_link_type, &cache_entry::_lru_link>,
         bi::constant_time_size<false>>; // we need this to have bi::auto_unlink on hooks.
+
+    static constexpr double protected_ratio = 0.8;
 private:
     uint64_t _hits = 0;
     uint64_t _misses = 0;
+    uint64_t _negative_hits = 0;
     uint64_t _insertions = 0;
     uint64_t _merges = 0;
     uint64_t _partitions = 0;
+    uint64_t _protected_partitions = 0;
+    uint64_t _promotions = 0;
+    uint64_t _demotions = 0;
+    uint64_t _probationary_evictions = 0;
+    uint64_t _protected_evictions = 0;
+    uint64_t _evicted_rows = 0;
+    // Time spent merging flushed memtables into cache, and in how many
+    // slices, i.e. stretches without yielding, it was done.
+    uint64_t _update_time_ns = 0;
+    uint64_t _update_slices = 0;
+    uint64_t _max_update_slice_ns = 0;
+    // Of the entries' _compression_saving.
+    uint64_t _compression_saving = 0;
+    uint64_t _compressed_values = 0;
+    uint64_t _decompressed_values = 0;
+    // Partitions with more rows than this are cached only as far as the
+    // read populating them needs.
+    size_t _partial_partition_threshold = 1000;
     std::unique_ptr<scollectd::registrations> _collectd_registrations;
     logalloc::region _region;
-    lru_type _lru;
+    lru_type _probationary_lru;
+    lru_type _protected_lru;
 private:
     void setup_collectd();
+    void evict_one();
+    void demote_excess();
 public:
+    // Rows are evicted from the end of a partition this many at a time,
+    // and the partition is evicted whole once it has no more than that.
+    static constexpr size_t rows_evicted_at_once = 64;
+
     cache_tracker();
     ~cache_tracker();
     void clear();
+    // Marks the entry as hit, moving it to the front of the protected segment.
     void touch(cache_entry&);
     void insert(cache_entry&);
-    void on_erase();
+    // Must be called before an entry is destroyed by its owner.
+    void on_erase(const cache_entry&);
     void on_merge();
     void on_hit();
     void on_miss();
+    // Called, in addition to on_hit(), for hits of absent partitions.
+    void on_negative_hit();
+    uint64_t negative_hits() const { return _negative_hits; }
+    void on_update_slice(std::chrono::steady_clock::duration);
+    uint64_t update_time_ns() const { return _update_time_ns; }
+    uint64_t update_slices() const { return _update_slices; }
+    uint64_t max_update_slice_ns() const { return _max_update_slice_ns; }
+    void set_partial_partition_threshold(size_t rows) { _partial_partition_threshold = rows; }
+    size_t partial_partition_threshold() const { return _partial_partition_threshold; }
+    uint64_t evicted_rows() const { return _evicted_rows; }
+    // A value of a cell of the entry was compressed, saving that much
+    // memory, or values were decompressed, losing it.
+    void on_compressed(cache_entry&, size_t saving);
+    void on_decompressed(cache_entry&, uint64_t values, size_t saving);
+    // The cells of the entry were replaced by uncompressed ones.
+    void on_uncompressed(cache_entry&);
+    // That many of the rows of the entry are about to be dropped.
+    void on_rows_dropped(cache_entry&, size_t rows);
+    // Values were decompressed for a read, leaving the entry as is.
+    void on_decompressed_for_read(uint64_t values) { _decompressed_values += values; }
+    // The memory saved by keeping values compressed, the capacity the
+    // cache gains at the cost of compressing and decompressing them.
+    uint64_t compression_saving() const { return _compression_saving; }
+    uint64_t partitions() const { return _partitions; }
+    uint64_t protected_partitions() const { return _protected_partitions; }
     allocation_strategy& allocator();
     logalloc::region& region();
     const logalloc::region& region() const;
@@ -146,11 +249,11 @@ cache_tracker& global_cache_tracker();
 //
 class row_cache final {
 public:
-    using partitions_type = bi::set<cache_entry,
-        bi::member_hook<cache_entry, cache_entry::cache_link_type, &cache_entry::_cache_link>,
-        bi::constant_time_size<false>, // we need this to have bi::auto_unlink on hooks
-        bi::compare<cache_entry::compare>>;
+    // Ordered by token first, like memtable::partitions_type.
+    using partitions_type = intrusive_btree<cache_entry, &cache_entry::_cache_link,
+        cache_entry::compare, cache_entry::key_prefix>;
     friend class populating_reader;
+    friend class slice_populating_reader;
 public:
     struct stats {
         uint64_t hits;
@@ -160,15 +263,30 @@ class row_cache final {
     cache_tracker& _tracker;
     stats _stats{};
     schema_ptr _schema;
-    partitions_type _partitions; // Cached partitions are complete.
+    partitions_type _partitions; // Cached partitions are complete, or hold a prefix of their rows.
     mutation_source _underlying;
     logalloc::allocating_section _update_section;
     logalloc::allocating_section _populate_section;
     logalloc::allocating_section _read_section;
+    // Bumped by each update(). Readers started in an earlier phase may
+    // have missed data the update moved from the memtable into
+    // sstables, so they must not populate the cache.
+    uint64_t _populate_phase = 0;
     mutation_reader make_scanning_reader(const query::partition_range&);
+    // Caches the rows of m preceding end, and all if end is the end.
+    void populate_prefix(const mutation& m, mutation_partition::rows_type::const_iterator end);
+    void do_populate(const mutation& m, const mutation_partition& p, bool complete);
+    // Records that the partition is absent from the underlying data sources.
+    void populate_absent(const dht::decorated_key&);
+    mutation_reader make_entry_reader(const cache_entry&);
+    // Drops the rows past the first rows_per_partition of the entry. Must
+    // be called with the cache's allocator.
+    void trim(cache_entry&);
+    // Compresses the values of the large cells of the entry, if its table's
+    // caching options ask so. Must be called with the cache's allocator.
+    void compress(cache_entry&, const schema&);
     void on_hit();
     void on_miss();
-    static thread_local seastar::thread_scheduling_group _update_thread_scheduling_group;
 public:
     ~row_cache();
     row_cache(schema_ptr, mutation_source underlying, cache_tracker&);
@@ -177,12 +295,25 @@ class row_cache final {
     row_cache& operator=(row_cache&&) = default;
 public:
     mutation_reader make_reader(const query::partition_range&);
+    // Like make_reader(), but for a read which needs only what is selected
+    // by the slice, up to row_limit rows. A partially cached partition is
+    // good enough for such a read if it covers it, and a wide partition
+    // missing from cache is populated only as far as the read needs. With
+    // the bypass_cache option, nothing is populated or promoted.
+    mutation_reader make_reader(const query::partition_range&, const query::partition_slice&, uint32_t row_limit,
+            gc_clock::time_point now);
     const stats& stats() const { return _stats; }
 public:
     // Populate cache from given mutation. The mutation must contain all
     // information there is for its partition in the underlying data sources.
+    // Only as many of its rows as the schema's rows_per_partition caching
+    // option allows are cached, and none if it is NONE.
     void populate(const mutation& m);
 
+    // Like populate(), but caches only as many rows as are needed to answer
+    // a query of the slice, if the partition is wide.
+    void populate(const mutation& m, const query::partition_slice&, uint32_t row_limit, gc_clock::time_point now);
+
     // Clears the cache.
     void clear();
 
@@ -190,11 +321,20 @@ class row_cache final {
     // has just been flushed to the underlying data source.
     // The memtable can be queried during the process, but must not be written.
     // After the update is complete, memtable is empty.
+    //
+    // The merge yields between partitions whenever the reactor needs the
+    // CPU back, so it doesn't stall other work for long, and runs in the
+    // memtable_flush_group() scheduling group.
     future<> update(memtable&, partition_presence_checker underlying_negative);
 
     // Moves given partition to the front of LRU if present in cache.
     void touch(const dht::decorated_key&);
 
+    // The keys of the cached partitions which are present in the underlying
+    // data sources: of those in the protected segment of the LRU if
+    // protected_entries, or else of the others.
+    std::vector<partition_key> keys(bool protected_entries) const;
+
     auto num_entries() const {
         return _partitions.size();
     }
@@ -25,6 +25,7 @@
 #include "schema_builder.hh"
 #include <boost/algorithm/cxx11/any_of.hpp>
 #include <boost/range/adaptor/transformed.hpp>
+#include <boost/range/algorithm/equal.hpp>
 #include "version.hh"
 
 constexpr int32_t schema::NAME_LENGTH;
@@ -74,15 +75,16 @@ void schema::rebuild() {
     _clustering_key_prefix_type = make_lw_shared(_clustering_key_type->as_prefix());
 
     _columns_by_name.clear();
-    _regular_columns_by_name.clear();
-
     for (const column_definition& def : all_columns_in_select_order()) {
-        _columns_by_name[def.name()] = &def;
+        _columns_by_name.push_back(&def);
     }
+    std::sort(_columns_by_name.begin(), _columns_by_name.end(), [] (const column_definition* a, const column_definition* b) {
+        return bytes_view(a->name()) < bytes_view(b->name());
+    });
 
-    for (const column_definition& def : regular_columns()) {
-        _regular_columns_by_name[def.name()] = &def;
-    }
+    _is_counter = std::any_of(_raw._columns.begin(), _raw._columns.end(), [] (const column_definition& def) {
+        return !def.is_primary_key() && def.type->is_counter();
+    });
 }
 
 schema::raw_schema::raw_schema(utils::UUID id)
@@ -105,7 +107,6 @@ schema::schema(const raw_schema& raw)
         }
         return std::array<size_t, 4> { count[0], count[0] + count[1], count[0] + count[1] + count[2], count[0] + count[1] + count[2] + count[3] };
     }())
-    , _regular_columns_by_name(serialized_compare(_raw._regular_column_name_type))
 {
     struct name_compare {
         data_type type;
@@ -204,7 +205,6 @@ schema::schema(std::experimental::optional<utils::UUID> id,
 schema::schema(const schema& o)
     : _raw(o._raw)
     , _offsets(o._offsets)
-    , _regular_columns_by_name(serialized_compare(_raw._regular_column_name_type))
 {
     rebuild();
 }
@@ -236,7 +236,28 @@ bool operator==(const schema& x, const schema& y)
         && x._raw._comment == y._raw._comment
         && x._raw._default_time_to_live == y._raw._default_time_to_live
         && x._raw._regular_column_name_type->equals(y._raw._regular_column_name_type)
-        && x._raw._bloom_filter_fp_chance == y._raw._bloom_filter_fp_chance;
+        && x._raw._bloom_filter_fp_chance == y._raw._bloom_filter_fp_chance
+        && x._raw._bloom_filter_format == y._raw._bloom_filter_format
+        && x._raw._view_info == y._raw._view_info
+        && x._raw._cdc_options == y._raw._cdc_options;
+}
+
+bool equal_except_indexes(const schema& x, const schema& y)
+{
+    auto same_column = [] (const column_definition& a, const column_definition& b) {
+        return a.name() == b.name() && a.type->equals(b.type) && a.id == b.id && a.kind == b.kind;
+    };
+    return x._raw._id == y._raw._id
+        && x._raw._ks_name == y._raw._ks_name
+        && x._raw._cf_name == y._raw._cf_name
+        && boost::equal(x._raw._columns, y._raw._columns, same_column)
+        && x._raw._comment == y._raw._comment
+        && x._raw._default_time_to_live == y._raw._default_time_to_live
+        && x._raw._regular_column_name_type->equals(y._raw._regular_column_name_type)
+        && x._raw._bloom_filter_fp_chance == y._raw._bloom_filter_fp_chance
+        && x._raw._bloom_filter_format == y._raw._bloom_filter_format
+        && x._raw._view_info == y._raw._view_info
+        && x._raw._cdc_options == y._raw._cdc_options;
 }
 
 index_info::index_info(::index_type idx_type,
@@ -262,12 +283,14 @@ std::ostream& operator<<(std::ostream& os, const column_definition& cd) {
 }
 
 const column_definition*
-schema::get_column_definition(const bytes& name) const {
-    auto i = _columns_by_name.find(name);
-    if (i == _columns_by_name.end()) {
+schema::get_column_definition(bytes_view name) const {
+    auto i = std::lower_bound(_columns_by_name.begin(), _columns_by_name.end(), name, [] (const column_definition* def, bytes_view name) {
+        return bytes_view(def->name()) < name;
+    });
+    if (i == _columns_by_name.end() || bytes_view((*i)->name()) != name) {
         return nullptr;
     }
-    return i->second;
+    return *i;
 }
 
 const column_definition&
@@ -319,12 +342,19 @@ std::ostream& operator<<(std::ostream& os, const schema& s) {
     }
     os << "}";
     os << ",bloomFilterFpChance=" << s._raw._bloom_filter_fp_chance;
+    os << ",bloomFilterFormat=" << utils::to_sstring(s._raw._bloom_filter_format);
     os << ",memtableFlushPeriod=" << s._raw._memtable_flush_period;
     os << ",caching=" << s._raw._caching_options.to_sstring();
     os << ",defaultTimeToLive=" << s._raw._default_time_to_live.count();
     os << ",minIndexInterval=" << s._raw._min_index_interval;
     os << ",maxIndexInterval=" << s._raw._max_index_interval;
     os << ",speculativeRetry=" << s._raw._speculative_retry.to_sstring();
+    if (s._raw._view_info) {
+        os << ",baseTableId=" << s._raw._view_info->base_id;
+        os << ",baseTableName=" << s._raw._view_info->base_name;
+        os << ",includeAllColumns=" << s._raw._view_info->include_all_columns;
+    }
+    os << ",cdc=" << s._raw._cdc_options.to_sstring();
     os << ",droppedColumns={}";
     os << ",triggers=[]";
     os << ",isDense=" << std::boolalpha << s._raw._is_dense;
@@ -351,7 +381,8 @@ bool operator==(const column_definition& x, const column_definition& y)
     return x._name == y._name
         && x.type->equals(y.type)
         && x.id == y.id
-        && x.kind == y.kind;
+        && x.kind == y.kind
+        && x.idx_info == y.idx_info;
 }
 
 // Based on org.apache.cassandra.config.CFMetaData#generateLegacyCfId
@@ -419,8 +450,8 @@ void schema_builder::add_default_index_names(database& db) {
 
     auto existing_names = db.existing_index_names();
     for (auto& sc : _raw._columns) {
-        if (sc.idx_info.index_type != index_type::none && sc.idx_info.index_name) {
-            sstring base_name = cf_name() + "_" + *sc.idx_info.index_name + "_idx";
+        if (sc.idx_info.index_type != index_type::none && !sc.idx_info.index_name) {
+            sstring base_name = cf_name() + "_" + sc.name_as_text() + "_idx";
             auto i = std::remove_if(base_name.begin(), base_name.end(), [](char c) {
                return ::isspace(c);
             });
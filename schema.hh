@@ -37,6 +37,8 @@
 #include "compress.hh"
 #include "compaction_strategy.hh"
 #include "caching_options.hh"
+#include "cdc_options.hh"
+#include "utils/i_filter.hh"
 
 // Column ID, unique within column_kind
 using column_id = uint32_t;
@@ -159,6 +161,10 @@ struct index_info {
     enum index_type index_type = ::index_type::none;
     std::experimental::optional<sstring> index_name;
     std::experimental::optional<index_options_map> index_options;
+
+    bool operator==(const index_info& o) const {
+        return index_type == o.index_type && index_name == o.index_name && index_options == o.index_options;
+    }
 };
 
 class column_definition final {
@@ -241,6 +247,24 @@ class thrift_schema {
 
 bool operator==(const column_definition&, const column_definition&);
 
+// What makes a table a materialized view: the table it is a view of. The
+// view's primary key holds all the columns of the base table's primary key,
+// and at most one other column of it.
+struct view_info {
+    utils::UUID base_id;
+    sstring base_name;
+    // Whether the view was created with SELECT *, so that it gains the
+    // columns added to the base table.
+    bool include_all_columns = false;
+
+    bool operator==(const view_info& o) const {
+        return base_id == o.base_id && base_name == o.base_name && include_all_columns == o.include_all_columns;
+    }
+    bool operator!=(const view_info& o) const {
+        return !(*this == o);
+    }
+};
+
 static constexpr int DEFAULT_MIN_COMPACTION_THRESHOLD = 4;
 static constexpr int DEFAULT_MAX_COMPACTION_THRESHOLD = 32;
 
@@ -265,6 +289,7 @@ class schema final {
         data_type _default_validator = bytes_type;
         data_type _regular_column_name_type;
         double _bloom_filter_fp_chance = 0.01;
+        utils::filter_format _bloom_filter_format = utils::filter_format::murmur3;
         compression_parameters _compressor_params;
         bool _is_dense = false;
         bool _is_compound = true;
@@ -283,6 +308,8 @@ class schema final {
         sstables::compaction_strategy_type _compaction_strategy = sstables::compaction_strategy_type::size_tiered;
         std::map<sstring, sstring> _compaction_strategy_options;
         caching_options _caching_options;
+        std::experimental::optional<::view_info> _view_info;
+        ::cdc_options _cdc_options;
     };
     raw_schema _raw;
     thrift_schema _thrift;
@@ -293,11 +320,14 @@ class schema final {
         return k == column_kind::partition_key ? 0 : _offsets[size_t(k) - 1];
     }
 
-    std::unordered_map<bytes, const column_definition*> _columns_by_name;
-    std::map<bytes, const column_definition*, serialized_compare> _regular_columns_by_name;
+    // Sorted by name in byte order, for looking columns up without hashing
+    // or copying the name, as the sstable reader does for every cell.
+    std::vector<const column_definition*> _columns_by_name;
     lw_shared_ptr<compound_type<allow_prefixes::no>> _partition_key_type;
     lw_shared_ptr<compound_type<allow_prefixes::no>> _clustering_key_type;
     lw_shared_ptr<compound_type<allow_prefixes::yes>> _clustering_key_prefix_type;
+    // Set when the columns outside of the key are counters.
+    bool _is_counter = false;
 
     friend class schema_builder;
 public:
@@ -334,6 +364,9 @@ class schema final {
     double bloom_filter_fp_chance() const {
         return _raw._bloom_filter_fp_chance;
     }
+    utils::filter_format bloom_filter_format() const {
+        return _raw._bloom_filter_format;
+    }
     sstring thrift_key_validator() const;
     const compression_parameters& get_compressor_params() const {
         return _raw._compressor_params;
@@ -359,7 +392,17 @@ class schema final {
         return _raw._comment;
     }
     bool is_counter() const {
-        return false;
+        return _is_counter;
+    }
+    bool is_view() const {
+        return bool(_raw._view_info);
+    }
+    // Only for views.
+    const ::view_info& get_view_info() const {
+        return *_raw._view_info;
+    }
+    const ::cdc_options& cdc_options() const {
+        return _raw._cdc_options;
     }
 
     const cf_type type() const {
@@ -419,7 +462,7 @@ class schema final {
         return _raw._caching_options;
     }
 
-    const column_definition* get_column_definition(const bytes& name) const;
+    const column_definition* get_column_definition(bytes_view name) const;
     const column_definition& column_at(column_kind, column_id) const;
     const_iterator regular_begin() const {
         return regular_columns().begin();
@@ -427,23 +470,18 @@ class schema final {
     const_iterator regular_end() const {
         return regular_columns().end();
     }
-    const_iterator regular_lower_bound(const bytes& name) const {
-        // TODO: use regular_columns and a version of std::lower_bound() with heterogeneous comparator
-        auto i = _regular_columns_by_name.lower_bound(name);
-        if (i == _regular_columns_by_name.end()) {
-            return regular_end();
-        } else {
-            return regular_begin() + i->second->id;
-        }
+    // The regular columns are sorted by name, as regular_column_name_type() orders them.
+    const_iterator regular_lower_bound(bytes_view name) const {
+        auto&& type = regular_column_name_type();
+        return std::lower_bound(regular_begin(), regular_end(), name, [&type] (const column_definition& def, bytes_view name) {
+            return type->less(def.name(), name);
+        });
     }
-    const_iterator regular_upper_bound(const bytes& name) const {
-        // TODO: use regular_columns and a version of std::upper_bound() with heterogeneous comparator
-        auto i = _regular_columns_by_name.upper_bound(name);
-        if (i == _regular_columns_by_name.end()) {
-            return regular_end();
-        } else {
-            return regular_begin() + i->second->id;
-        }
+    const_iterator regular_upper_bound(bytes_view name) const {
+        auto&& type = regular_column_name_type();
+        return std::upper_bound(regular_begin(), regular_end(), name, [&type] (bytes_view name, const column_definition& def) {
+            return type->less(name, def.name());
+        });
     }
     data_type column_name_type(const column_definition& def) const {
         return def.kind == column_kind::regular_column ? _raw._regular_column_name_type : utf8_type;
@@ -551,10 +589,14 @@ class schema final {
     }
     friend std::ostream& operator<<(std::ostream& os, const schema& s);
     friend bool operator==(const schema&, const schema&);
+    friend bool equal_except_indexes(const schema&, const schema&);
 };
 
 bool operator==(const schema&, const schema&);
 
+// Like operator==, but ignoring the secondary indexes of the columns.
+bool equal_except_indexes(const schema&, const schema&);
+
 using schema_ptr = lw_shared_ptr<const schema>;
 
 utils::UUID generate_legacy_id(const sstring& ks_name, const sstring& cf_name);
@@ -147,6 +147,24 @@ struct schema_builder {
     double get_bloom_filter_fp_chance() const {
         return _raw._bloom_filter_fp_chance;
     }
+    void set_bloom_filter_format(utils::filter_format format) {
+        _raw._bloom_filter_format = format;
+    }
+    utils::filter_format get_bloom_filter_format() const {
+        return _raw._bloom_filter_format;
+    }
+    void set_view_info(::view_info info) {
+        _raw._view_info = std::move(info);
+    }
+    const std::experimental::optional<::view_info>& get_view_info() const {
+        return _raw._view_info;
+    }
+    void set_cdc_options(::cdc_options opts) {
+        _raw._cdc_options = std::move(opts);
+    }
+    const ::cdc_options& get_cdc_options() const {
+        return _raw._cdc_options;
+    }
     void set_compressor_params(const compression_parameters& cp) {
         _raw._compressor_params = cp;
     }
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "admission_queue.hh"
+#include "exceptions/exceptions.hh"
+
+namespace service {
+
+admission_queue::admission_queue(sstring name, std::function<bool ()> has_room, size_t max_queued, std::chrono::milliseconds timeout)
+    : _name(std::move(name))
+    , _has_room(std::move(has_room))
+    , _max_queued(max_queued)
+    , _timeout(timeout)
+    , _expiry(std::bind(&admission_queue::expire, this))
+{}
+
+admission_queue::~admission_queue() {
+    for (auto& w : _queue) {
+        w.pr.set_exception(exceptions::overloaded_exception(sprint("Shutting down, %s not admitted", _name)));
+    }
+}
+
+future<> admission_queue::admit() {
+    if (_queue.empty() && _has_room()) {
+        ++_stats.admitted;
+        return make_ready_future<>();
+    }
+    if (_timeout == clock_type::duration::zero() || _queue.size() >= _max_queued) {
+        ++_stats.rejected;
+        return make_exception_future<>(exceptions::overloaded_exception(sprint("Too many %s in flight", _name)));
+    }
+    ++_stats.queued;
+    _queue.emplace_back(waiter{promise<>(), clock_type::now() + _timeout});
+    auto f = _queue.back().pr.get_future();
+    if (_queue.size() == 1) {
+        arm();
+    }
+    return f;
+}
+
+void admission_queue::notify() {
+    if (!_queue.empty() && _has_room()) {
+        ++_stats.admitted;
+        _queue.front().pr.set_value();
+        _queue.pop_front();
+        arm();
+    }
+}
+
+void admission_queue::arm() {
+    _expiry.cancel();
+    if (!_queue.empty()) {
+        _expiry.arm(_queue.front().deadline);
+    }
+}
+
+// All waiters have the same timeout, so the oldest ones expire first.
+void admission_queue::expire() {
+    auto now = clock_type::now();
+    while (!_queue.empty() && _queue.front().deadline <= now) {
+        ++_stats.shed;
+        _queue.front().pr.set_exception(exceptions::overloaded_exception(sprint("Timed out waiting for %s in flight to complete", _name)));
+        _queue.pop_front();
+    }
+    arm();
+}
+
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <seastar/core/future.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/sstring.hh>
+
+namespace service {
+
+/**
+ * Admission control for the requests a coordinator shard takes in.
+ *
+ * The owner tells whether there is room for one more request through
+ * has_room, based on whatever it has in flight. Requests arriving while
+ * there is none wait, in FIFO order, for a notify() to let them in, but
+ * for at most the queue timeout. They fail with an overloaded_exception
+ * once they waited for longer, or right away if the queue is full or
+ * the timeout is 0.
+ */
+class admission_queue {
+public:
+    using clock_type = lowres_clock;
+
+    struct stats {
+        uint64_t admitted = 0;
+        uint64_t queued = 0;
+        // Failed on arrival.
+        uint64_t rejected = 0;
+        // Failed after waiting for the queue timeout.
+        uint64_t shed = 0;
+    };
+private:
+    struct waiter {
+        promise<> pr;
+        clock_type::time_point deadline;
+    };
+
+    sstring _name;
+    std::function<bool ()> _has_room;
+    size_t _max_queued;
+    clock_type::duration _timeout;
+    std::deque<waiter> _queue;
+    timer<clock_type> _expiry;
+    stats _stats;
+private:
+    void expire();
+    void arm();
+public:
+    admission_queue(sstring name, std::function<bool ()> has_room, size_t max_queued, std::chrono::milliseconds timeout);
+    ~admission_queue();
+
+    future<> admit();
+
+    // Lets the oldest waiter in, if there is room for it. To be called
+    // whenever a request the owner has in flight completes.
+    void notify();
+
+    size_t queued() const {
+        return _queue.size();
+    }
+
+    const stats& get_stats() const {
+        return _stats;
+    }
+};
+
+}
@@ -55,6 +55,7 @@ namespace service {
 class client_state {
 private:
     sstring _keyspace;
+    sstring _service_level = "default";
 #if 0
     private static final Logger logger = LoggerFactory.getLogger(ClientState.class);
     public static final SemanticVersion DEFAULT_CQL_VERSION = org.apache.cassandra.cql3.QueryProcessor.CQL_VERSION;
@@ -154,6 +155,15 @@ class client_state {
     }
 #endif
 
+    // The service level the requests of the client run under.
+    const sstring& get_service_level() const {
+        return _service_level;
+    }
+
+    void set_service_level(sstring service_level) {
+        _service_level = std::move(service_level);
+    }
+
     const sstring& get_raw_keyspace() const {
         return _keyspace;
     }
@@ -42,6 +42,7 @@
 #include "service/migration_manager.hh"
 
 #include "service/migration_listener.hh"
+#include "db/cdc/log.hh"
 #include "message/messaging_service.hh"
 #include "service/storage_service.hh"
 #include "service/migration_task.hh"
@@ -288,7 +289,17 @@ future<> migration_manager::announce_new_column_family(schema_ptr cfm, bool anno
             throw exceptions::already_exists_exception(cfm->ks_name(), cfm->cf_name());
         }
         logger.info("Create new ColumnFamily: {}", cfm);
-        auto mutations = db::schema_tables::make_create_table_mutations(keyspace.metadata(), cfm, db_clock::now_in_usecs());
+        auto ts = db_clock::now_in_usecs();
+        auto mutations = db::schema_tables::make_create_table_mutations(keyspace.metadata(), cfm, ts);
+        if (cfm->cdc_options().enabled()) {
+            auto log = db::cdc::make_log_schema(*cfm);
+            if (db.has_schema(log->ks_name(), log->cf_name())) {
+                throw exceptions::already_exists_exception(log->ks_name(), log->cf_name());
+            }
+            logger.info("Create change data capture log: {}", log);
+            auto log_mutations = db::schema_tables::make_create_table_mutations(keyspace.metadata(), log, ts);
+            std::move(log_mutations.begin(), log_mutations.end(), std::back_inserter(mutations));
+        }
         return announce(std::move(mutations), announce_locally);
     } catch (const no_such_keyspace& e) {
         throw exceptions::configuration_exception(sprint("Cannot add table '%s' to non existing keyspace '%s'.", cfm->cf_name(), cfm->ks_name()));
@@ -296,8 +307,24 @@ future<> migration_manager::announce_new_column_family(schema_ptr cfm, bool anno
 }
 
 future<> migration_manager::announce_column_family_update(schema_ptr cfm, bool from_thrift, bool announce_locally) {
-    warn(unimplemented::cause::MIGRATIONS);
-    return make_ready_future<>();
+#if 0
+    cfm.validate();
+#endif
+    try {
+        auto& db = get_local_storage_proxy().get_db().local();
+        auto&& old_schema = db.find_column_family(cfm->ks_name(), cfm->cf_name()).schema();
+        auto&& keyspace = db.find_keyspace(cfm->ks_name());
+        // Only secondary indexes can be added or dropped yet.
+        if (!equal_except_indexes(*old_schema, *cfm)) {
+            throw exceptions::configuration_exception(sprint("Cannot update table '%s' in keyspace '%s': only changes to its secondary indexes are supported.",
+                    cfm->cf_name(), cfm->ks_name()));
+        }
+        logger.info("Update table '{}.{}' From {} To {}", cfm->ks_name(), cfm->cf_name(), *old_schema, *cfm);
+        auto mutations = db::schema_tables::make_update_table_mutations(keyspace.metadata(), old_schema, cfm, db_clock::now_in_usecs());
+        return announce(std::move(mutations), announce_locally);
+    } catch (const no_such_column_family& e) {
+        throw exceptions::configuration_exception(sprint("Cannot update non existing table '%s' in keyspace '%s'.", cfm->cf_name(), cfm->ks_name()));
+    }
 #if 0
     cfm.validate();
 
@@ -401,7 +428,13 @@ future<> migration_manager::announce_column_family_drop(const sstring& ks_name,
         auto&& old_cfm = db.find_schema(ks_name, cf_name);
         auto&& keyspace = db.find_keyspace(ks_name);
         logger.info("Drop table '{}/{}'", old_cfm->ks_name(), old_cfm->cf_name());
-        auto mutations = db::schema_tables::make_drop_table_mutations(keyspace.metadata(), old_cfm, db_clock::now_in_usecs());
+        auto ts = db_clock::now_in_usecs();
+        auto mutations = db::schema_tables::make_drop_table_mutations(keyspace.metadata(), old_cfm, ts);
+        auto log_name = db::cdc::log_name(cf_name);
+        if (old_cfm->cdc_options().enabled() && db.has_schema(ks_name, log_name)) {
+            auto log_mutations = db::schema_tables::make_drop_table_mutations(keyspace.metadata(), db.find_schema(ks_name, log_name), ts);
+            std::move(log_mutations.begin(), log_mutations.end(), std::back_inserter(mutations));
+        }
         return announce(std::move(mutations), announce_locally);
     } catch (const no_such_column_family& e) {
         throw exceptions::configuration_exception(sprint("Cannot drop non existing table '%s' in keyspace '%s'.", cf_name, ks_name));
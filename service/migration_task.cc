@@ -57,8 +57,22 @@ future<> migration_task::run_may_throw(distributed<service::storage_proxy>& prox
         return make_ready_future<>();
     }
     net::messaging_service::shard_id id{endpoint, 0};
-    auto& ms = net::get_local_messaging_service();
-    return ms.send_migration_request(std::move(id), endpoint, engine().cpu_id()).then([&proxy](const std::vector<frozen_mutation>& mutations) {
+    // Only the keyspaces whose schema differs from ours are pulled. A node
+    // which doesn't know KEYSPACE_MIGRATION_REQUEST sends all of its schema.
+    return db::schema_tables::calculate_keyspace_schema_digests(proxy).then([id, endpoint] (std::map<sstring, utils::UUID> digests) {
+        std::vector<sstring> keyspaces;
+        std::vector<utils::UUID> uuids;
+        for (auto&& e : digests) {
+            keyspaces.push_back(e.first);
+            uuids.push_back(e.second);
+        }
+        auto& ms = net::get_local_messaging_service();
+        return ms.send_keyspace_migration_request(id, std::move(keyspaces), std::move(uuids)).handle_exception([id, endpoint] (auto ep) {
+            logger.debug("Pulling the schema of differing keyspaces from {} failed ({}), pulling all of it", endpoint, ep);
+            auto& ms = net::get_local_messaging_service();
+            return ms.send_migration_request(id, endpoint, engine().cpu_id());
+        });
+    }).then([&proxy](const std::vector<frozen_mutation>& mutations) {
         try {
             std::vector<mutation> schema;
             for (auto& m : mutations) {
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "admission_queue.hh"
+#include "paging_state.hh"
+#include "types.hh"
+#include "utils/serialization.hh"
+#include "exceptions/exceptions.hh"
+
+namespace service {
+
+namespace pager {
+
+paging_state::paging_state(partition_key pk, std::experimental::optional<clustering_key> ck, uint32_t remaining, utils::UUID query_uuid)
+    : _partition_key(std::move(pk))
+    , _clustering_key(std::move(ck))
+    , _remaining(remaining)
+    , _query_uuid(query_uuid)
+{ }
+
+// [short pk length][pk][bool has ck]([short ck length][ck])[int remaining][uuid]
+::shared_ptr<paging_state> paging_state::deserialize(bytes_opt bytes) {
+    if (!bytes) {
+        return nullptr;
+    }
+    try {
+        bytes_view v = *bytes;
+        auto pk = partition_key::from_bytes(to_bytes(read_simple_bytes(v, read_simple<uint16_t>(v))));
+        std::experimental::optional<clustering_key> ck;
+        if (read_simple<int8_t>(v)) {
+            ck = clustering_key::from_bytes(to_bytes(read_simple_bytes(v, read_simple<uint16_t>(v))));
+        }
+        auto remaining = read_simple<uint32_t>(v);
+        auto msb = read_simple<int64_t>(v);
+        auto lsb = read_simple<int64_t>(v);
+        return ::make_shared<paging_state>(std::move(pk), std::move(ck), remaining, utils::UUID(msb, lsb));
+    } catch (const marshal_exception&) {
+        throw exceptions::protocol_exception("Invalid value for the paging state");
+    }
+}
+
+bytes_opt paging_state::serialize() const {
+    auto&& pk = _partition_key.representation();
+    size_t size = serialize_int16_size + pk.size() + serialize_bool_size
+        + serialize_int32_size + 2 * serialize_int64_size;
+    if (_clustering_key) {
+        size += serialize_int16_size + _clustering_key->representation().size();
+    }
+    bytes b(bytes::initialized_later(), size);
+    auto out = b.begin();
+    serialize_int16(out, uint16_t(pk.size()));
+    out = std::copy(pk.begin(), pk.end(), out);
+    serialize_bool(out, bool(_clustering_key));
+    if (_clustering_key) {
+        auto&& ck = _clustering_key->representation();
+        serialize_int16(out, uint16_t(ck.size()));
+        out = std::copy(ck.begin(), ck.end(), out);
+    }
+    serialize_int32(out, _remaining);
+    serialize_int64(out, _query_uuid.get_most_significant_bits());
+    serialize_int64(out, _query_uuid.get_least_significant_bits());
+    return b;
+}
+
+}
+
+}
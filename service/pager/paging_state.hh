@@ -41,80 +41,54 @@
 
 #pragma once
 
+#include <experimental/optional>
+#include <seastar/core/shared_ptr.hh>
 #include "unimplemented.hh"
 #include "bytes.hh"
+#include "keys.hh"
+#include "utils/UUID.hh"
 
 namespace service {
 
 namespace pager {
 
+/**
+ * Where a paged query stopped, handed to the client along with a page and
+ * back with the request for the next one.
+ *
+ * The clustering key is that of the last row of the page, when the page
+ * stopped within a partition. The query uuid names the query across its
+ * pages, for the replicas to find the reader they kept from the previous
+ * page.
+ */
 class paging_state final {
-#if 0
-    public final ByteBuffer partitionKey;
-    public final ByteBuffer cellName;
-    public final int remaining;
+    partition_key _partition_key;
+    std::experimental::optional<clustering_key> _clustering_key;
+    uint32_t _remaining;
+    utils::UUID _query_uuid;
+public:
+    paging_state(partition_key pk, std::experimental::optional<clustering_key> ck, uint32_t remaining, utils::UUID query_uuid);
 
-    public PagingState(ByteBuffer partitionKey, ByteBuffer cellName, int remaining)
-    {
-        this.partitionKey = partitionKey == null ? ByteBufferUtil.EMPTY_BYTE_BUFFER : partitionKey;
-        this.cellName = cellName == null ? ByteBufferUtil.EMPTY_BYTE_BUFFER : cellName;
-        this.remaining = remaining;
+    const partition_key& get_partition_key() const {
+        return _partition_key;
     }
 
-    public static PagingState deserialize(ByteBuffer bytes)
-    {
-        if (bytes == null)
-            return null;
-
-        try
-        {
-            DataInputStream in = new DataInputStream(ByteBufferUtil.inputStream(bytes));
-            ByteBuffer pk = ByteBufferUtil.readWithShortLength(in);
-            ByteBuffer cn = ByteBufferUtil.readWithShortLength(in);
-            int remaining = in.readInt();
-            return new PagingState(pk, cn, remaining);
-        }
-        catch (IOException e)
-        {
-            throw new ProtocolException("Invalid value for the paging state");
-        }
+    const std::experimental::optional<clustering_key>& get_clustering_key() const {
+        return _clustering_key;
     }
-#endif
 
-public:
-
-    bytes_opt serialize() {
-        fail(unimplemented::cause::PAGING);
-#if 0
-        try
-        {
-            DataOutputBuffer out = new DataOutputBuffer(serializedSize());
-            ByteBufferUtil.writeWithShortLength(partitionKey, out);
-            ByteBufferUtil.writeWithShortLength(cellName, out);
-            out.writeInt(remaining);
-            return out.asByteBuffer();
-        }
-        catch (IOException e)
-        {
-            throw new RuntimeException(e);
-        }
-#endif
+    // The rows of the query limit left for the next pages.
+    uint32_t get_remaining() const {
+        return _remaining;
     }
 
-#if 0
-    private int serializedSize()
-    {
-        return 2 + partitionKey.remaining()
-             + 2 + cellName.remaining()
-             + 4;
+    const utils::UUID& get_query_uuid() const {
+        return _query_uuid;
     }
 
-    @Override
-    public String toString()
-    {
-        return String.format("PagingState(key=%s, cellname=%s, remaining=%d", ByteBufferUtil.bytesToHex(partitionKey), ByteBufferUtil.bytesToHex(cellName), remaining);
-    }
-#endif
+    // Throws protocol_exception for something which is not a paging state.
+    static ::shared_ptr<paging_state> deserialize(bytes_opt bytes);
+    bytes_opt serialize() const;
 };
 
 }
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "paxos_state.hh"
+#include "db/system_keyspace.hh"
+#include "utils/UUID_gen.hh"
+
+namespace service {
+
+namespace paxos {
+
+namespace {
+
+struct state {
+    std::experimental::optional<utils::UUID> promised;
+    std::experimental::optional<proposal> accepted;
+    std::experimental::optional<proposal> most_recent_commit;
+};
+
+// The state of a partition of a table is under the legacy form of the
+// partition key, which has the same token, and the id of the table.
+class state_key {
+    schema_ptr _paxos;
+    partition_key _key;
+    clustering_key _ckey;
+    // Paxos state is kept for at least 3 hours.
+    gc_clock::duration _ttl;
+public:
+    state_key(const schema& s, const partition_key& key)
+        : _paxos(db::system_keyspace::paxos())
+        , _key(make_key(*_paxos, s, key))
+        , _ckey(clustering_key::from_single_value(*_paxos, s.id().to_bytes()))
+        , _ttl(std::max<gc_clock::duration>(std::chrono::hours(3), s.gc_grace_seconds()))
+    { }
+
+    column_family& find_column_family(database& db) const {
+        return db.find_column_family(_paxos);
+    }
+
+    const partition_key& key() const {
+        return _key;
+    }
+
+    future<state> load(database& db) const {
+        auto dk = dht::global_partitioner().decorate_key(*_paxos, _key);
+        return find_column_family(db).find_row(dk, _ckey).then([paxos = _paxos] (column_family::const_row_ptr r) {
+            state st;
+            if (!r) {
+                return st;
+            }
+            auto now = gc_clock::now();
+            auto get = [&] (const char* name) -> bytes_opt {
+                auto cell = r->find_cell(paxos->get_column_definition(to_bytes(name))->id);
+                if (!cell) {
+                    return {};
+                }
+                auto c = cell->as_atomic_cell();
+                if (!c.is_live(tombstone(), now)) {
+                    return {};
+                }
+                return to_bytes(c.value());
+            };
+            auto get_proposal = [&] (const char* ballot_name, const char* update_name) -> std::experimental::optional<proposal> {
+                auto ballot = get(ballot_name);
+                auto update = get(update_name);
+                if (!ballot || !update) {
+                    return {};
+                }
+                return proposal(utils::UUID_gen::get_UUID(std::move(*ballot)), frozen_mutation(std::move(*update)));
+            };
+            if (auto ballot = get("in_progress_ballot")) {
+                st.promised = utils::UUID_gen::get_UUID(std::move(*ballot));
+            }
+            st.accepted = get_proposal("proposal_ballot", "proposal");
+            st.most_recent_commit = get_proposal("most_recent_commit_at", "most_recent_commit");
+            return st;
+        });
+    }
+
+    mutation make_mutation() const {
+        return mutation(_key, _paxos);
+    }
+
+    void set_cell(mutation& m, const char* name, const utils::UUID& ballot, bytes_opt value) const {
+        auto& def = *_paxos->get_column_definition(to_bytes(name));
+        auto ts = utils::UUID_gen::micros_timestamp(ballot);
+        if (value) {
+            m.set_clustered_cell(_ckey, def, atomic_cell::make_live(ts, *value, gc_clock::now() + _ttl, _ttl));
+        } else {
+            m.set_clustered_cell(_ckey, def, atomic_cell::make_dead(ts, gc_clock::now()));
+        }
+    }
+private:
+    static partition_key make_key(const schema& paxos, const schema& s, const partition_key& key) {
+        auto&& legacy = key.legacy_form(s);
+        bytes b(bytes::initialized_later(), legacy.size());
+        std::copy(legacy.begin(), legacy.end(), b.begin());
+        return partition_key::from_single_value(paxos, std::move(b));
+    }
+};
+
+static future<> apply(database& db, mutation m) {
+    return do_with(std::move(m), [&db] (const mutation& m) {
+        return db.apply(m);
+    });
+}
+
+template <typename Func>
+static auto with_state(database& db, const schema& s, const partition_key& key, Func&& func) {
+    auto sk = make_lw_shared<state_key>(s, key);
+    return sk->find_column_family(db).with_partition_lock(sk->key(), [&db, sk, func = std::forward<Func>(func)] () mutable {
+        return sk->load(db).then([&db, sk, func = std::move(func)] (state st) mutable {
+            return func(*sk, std::move(st));
+        });
+    });
+}
+
+}
+
+future<prepare_response>
+paxos_state::prepare(database& db, const query::read_command& cmd, const query::partition_range& pr, utils::UUID ballot) {
+    auto s = db.find_schema(cmd.cf_id);
+    auto& key = pr.start()->value().key();
+    auto response = make_lw_shared<prepare_response>();
+    return with_state(db, *s, *key, [&db, &cmd, &pr, response, ballot] (const state_key& sk, state st) {
+        response->accepted = std::move(st.accepted);
+        response->most_recent_commit = std::move(st.most_recent_commit);
+        if (st.promised && !ballot_less(*st.promised, ballot)) {
+            response->promised = false;
+            response->promised_ballot = *st.promised;
+            return make_ready_future<>();
+        }
+        response->promised = true;
+        response->promised_ballot = ballot;
+        auto m = sk.make_mutation();
+        sk.set_cell(m, "in_progress_ballot", ballot, ballot.to_bytes());
+        // Read under the lock, so that the data is that of the most recent
+        // commit we answer with.
+        return apply(db, std::move(m)).then([&db, &cmd, &pr, response] {
+            return db.query(cmd, pr).then([response] (lw_shared_ptr<query::result> result) {
+                bytes data(bytes::initialized_later(), result->serialized_size());
+                auto out = data.begin();
+                result->serialize(out);
+                response->data = std::move(data);
+            });
+        });
+    }).then([response] {
+        return std::move(*response);
+    });
+}
+
+future<bool>
+paxos_state::accept(database& db, proposal p) {
+    auto s = db.find_schema(p.update.column_family_id());
+    auto accepted = make_lw_shared<bool>(false);
+    partition_key key = p.update.key(*s);
+    return with_state(db, *s, key, [&db, p = std::move(p), accepted] (const state_key& sk, state st) {
+        if (st.promised && ballot_less(p.ballot, *st.promised)) {
+            return make_ready_future<>();
+        }
+        *accepted = true;
+        auto m = sk.make_mutation();
+        sk.set_cell(m, "proposal_ballot", p.ballot, p.ballot.to_bytes());
+        sk.set_cell(m, "proposal", p.ballot, to_bytes(p.update.representation()));
+        return apply(db, std::move(m));
+    }).then([accepted] {
+        return *accepted;
+    });
+}
+
+future<>
+paxos_state::learn(database& db, proposal p) {
+    auto s = db.find_schema(p.update.column_family_id());
+    return do_with(std::move(p), [&db, s] (const proposal& p) {
+        return db.apply(p.update).then([&db, s, &p] {
+            return with_state(db, *s, p.update.key(*s), [&db, &p] (const state_key& sk, state) {
+                // The proposal is forgotten with the timestamp of the commit,
+                // so that a later one stays.
+                auto m = sk.make_mutation();
+                sk.set_cell(m, "proposal_ballot", p.ballot, {});
+                sk.set_cell(m, "proposal", p.ballot, {});
+                sk.set_cell(m, "most_recent_commit_at", p.ballot, p.ballot.to_bytes());
+                sk.set_cell(m, "most_recent_commit", p.ballot, to_bytes(p.update.representation()));
+                return apply(db, std::move(m));
+            });
+        });
+    });
+}
+
+}
+
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "database.hh"
+#include "query-request.hh"
+#include "proposal.hh"
+
+namespace service {
+
+namespace paxos {
+
+// The replica side of Paxos. The state of a partition is kept in
+// system.paxos, under a key with the token of the partition, so that it
+// lives on the shard owning the partition, where these run. Changes of the
+// state of a partition go one at a time.
+class paxos_state {
+public:
+    // Promises not to accept proposals of ballots before this one, unless
+    // a later one was promised already. When promised, runs the read of the
+    // conditional update, which then needs no round of its own.
+    static future<prepare_response> prepare(database& db, const query::read_command& cmd,
+            const query::partition_range& pr, utils::UUID ballot);
+    // Accepts the proposal unless a later ballot was promised.
+    static future<bool> accept(database& db, proposal p);
+    // Applies the update of a proposal chosen by a quorum, and forgets the
+    // proposal.
+    static future<> learn(database& db, proposal p);
+};
+
+}
+
+}
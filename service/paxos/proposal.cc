@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "proposal.hh"
+#include "types.hh"
+#include "utils/serialization.hh"
+
+namespace service {
+
+namespace paxos {
+
+bool ballot_less(const utils::UUID& a, const utils::UUID& b) {
+    auto ta = a.timestamp();
+    auto tb = b.timestamp();
+    if (ta != tb) {
+        return ta < tb;
+    }
+    return a < b;
+}
+
+size_t proposal::serialized_size() const {
+    return ballot.serialized_size() + serialize_int32_size + update.representation().size();
+}
+
+void proposal::serialize(bytes::iterator& out) const {
+    ballot.serialize(out);
+    auto repr = update.representation();
+    serialize_int32(out, repr.size());
+    out = std::copy(repr.begin(), repr.end(), out);
+}
+
+proposal proposal::deserialize(bytes_view& v) {
+    auto ballot = utils::UUID::deserialize(v);
+    auto size = read_simple<uint32_t>(v);
+    auto repr = to_bytes(read_simple_bytes(v, size));
+    return proposal(std::move(ballot), frozen_mutation(std::move(repr)));
+}
+
+prepare_summary::prepare_summary(const std::vector<std::pair<gms::inet_address, prepare_response>>& responses) {
+    for (auto&& r : responses) {
+        if (!r.second.promised) {
+            refused_for = r.second.promised_ballot;
+            return;
+        }
+    }
+    auto newer = [] (const std::experimental::optional<proposal>& a, const std::experimental::optional<proposal>& b) {
+        return a && (!b || ballot_less(b->ballot, a->ballot));
+    };
+    for (auto&& r : responses) {
+        if (newer(r.second.most_recent_commit, most_recent_commit)) {
+            most_recent_commit = r.second.most_recent_commit;
+        }
+    }
+    // An accepted proposal no later than the most recent commit was
+    // learned already.
+    for (auto&& r : responses) {
+        if (newer(r.second.accepted, in_progress) && newer(r.second.accepted, most_recent_commit)) {
+            in_progress = r.second.accepted;
+        }
+    }
+    for (auto&& r : responses) {
+        if (most_recent_commit && (!r.second.most_recent_commit || r.second.most_recent_commit->ballot != most_recent_commit->ballot)) {
+            missing_commit.push_back(r.first);
+        }
+    }
+    if (responses.empty() || !missing_commit.empty()) {
+        return;
+    }
+    auto& first = responses.front().second.data;
+    for (auto&& r : responses) {
+        if (!r.second.data || !first || *r.second.data != *first) {
+            return;
+        }
+    }
+    data = first;
+}
+
+std::ostream& operator<<(std::ostream& out, const proposal& p) {
+    return out << "{proposal: " << p.ballot << "}";
+}
+
+static size_t serialized_size(const std::experimental::optional<proposal>& p) {
+    return serialize_bool_size + (p ? p->serialized_size() : 0);
+}
+
+static void serialize(bytes::iterator& out, const std::experimental::optional<proposal>& p) {
+    serialize_bool(out, bool(p));
+    if (p) {
+        p->serialize(out);
+    }
+}
+
+static std::experimental::optional<proposal> deserialize_proposal(bytes_view& v) {
+    if (!read_simple<int8_t>(v)) {
+        return {};
+    }
+    return proposal::deserialize(v);
+}
+
+size_t prepare_response::serialized_size() const {
+    return serialize_bool_size + promised_ballot.serialized_size()
+            + paxos::serialized_size(accepted) + paxos::serialized_size(most_recent_commit)
+            + serialize_int32_size + (data ? data->size() : 0);
+}
+
+void prepare_response::serialize(bytes::iterator& out) const {
+    serialize_bool(out, promised);
+    promised_ballot.serialize(out);
+    paxos::serialize(out, accepted);
+    paxos::serialize(out, most_recent_commit);
+    if (!data) {
+        serialize_int32(out, uint32_t(-1));
+        return;
+    }
+    serialize_int32(out, data->size());
+    out = std::copy(data->begin(), data->end(), out);
+}
+
+prepare_response prepare_response::deserialize(bytes_view& v) {
+    prepare_response r;
+    r.promised = read_simple<int8_t>(v);
+    r.promised_ballot = utils::UUID::deserialize(v);
+    r.accepted = deserialize_proposal(v);
+    r.most_recent_commit = deserialize_proposal(v);
+    auto size = read_simple<int32_t>(v);
+    if (size >= 0) {
+        r.data = to_bytes(read_simple_bytes(v, size));
+    }
+    return r;
+}
+
+}
+
+}
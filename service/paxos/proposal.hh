@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <experimental/optional>
+#include <vector>
+#include "bytes.hh"
+#include "frozen_mutation.hh"
+#include "gms/inet_address.hh"
+#include "utils/UUID.hh"
+
+namespace service {
+
+namespace paxos {
+
+// Ballots are time UUIDs, ordered by their time and then by the rest,
+// which tells apart the coordinators picking the same time.
+bool ballot_less(const utils::UUID& a, const utils::UUID& b);
+
+// An update of a single partition, proposed or committed in the round of
+// Paxos of the ballot.
+class proposal {
+public:
+    utils::UUID ballot;
+    frozen_mutation update;
+public:
+    proposal(utils::UUID ballot, frozen_mutation update)
+        : ballot(std::move(ballot))
+        , update(std::move(update))
+    { }
+
+    size_t serialized_size() const;
+    void serialize(bytes::iterator& out) const;
+    static proposal deserialize(bytes_view& v);
+
+    friend std::ostream& operator<<(std::ostream& out, const proposal& p);
+};
+
+// What a replica answers a prepare with. When it promised the ballot, the
+// result of the read of the conditional update comes along, so that the
+// coordinator needs no separate round for it.
+class prepare_response {
+public:
+    bool promised;
+    // The ballot the replica promised instead, when it did not promise ours.
+    utils::UUID promised_ballot;
+    // The last proposal the replica accepted, if not committed since.
+    std::experimental::optional<proposal> accepted;
+    std::experimental::optional<proposal> most_recent_commit;
+    // The serialized query::result of the read, when promised.
+    bytes_opt data;
+public:
+    size_t serialized_size() const;
+    void serialize(bytes::iterator& out) const;
+    static prepare_response deserialize(bytes_view& v);
+};
+
+// What the coordinator makes of the answers of the replicas to a prepare.
+class prepare_summary {
+public:
+    // The ballot some replica promised instead of ours, if any.
+    std::experimental::optional<utils::UUID> refused_for;
+    std::experimental::optional<proposal> most_recent_commit;
+    // The latest proposal accepted after the most recent commit, which may
+    // have been chosen, so that its round is to be finished first.
+    std::experimental::optional<proposal> in_progress;
+    // The replicas which missed the most recent commit.
+    std::vector<gms::inet_address> missing_commit;
+    // What the replicas read, when they all read the same and none missed
+    // the most recent commit. Otherwise it takes a read of its own.
+    bytes_opt data;
+public:
+    explicit prepare_summary(const std::vector<std::pair<gms::inet_address, prepare_response>>& responses);
+};
+
+}
+
+}
@@ -24,12 +24,14 @@
 #define SERVICE_QUERY_STATE_HH
 
 #include "service/client_state.hh"
+#include "tracing/tracing.hh"
 
 namespace service {
 
 class query_state final {
 private:
     client_state& _client_state;
+    tracing::trace_state_ptr _trace_state;
 public:
     query_state(client_state& client_state_) : _client_state(client_state_) {}
     client_state& get_client_state() {
@@ -38,6 +40,13 @@ class query_state final {
     api::timestamp_type get_timestamp() {
         return _client_state.get_timestamp();
     }
+    // That of the client request being processed, if any.
+    const tracing::trace_state_ptr& get_trace_state() const {
+        return _trace_state;
+    }
+    void set_trace_state(tracing::trace_state_ptr trace_state) {
+        _trace_state = std::move(trace_state);
+    }
 };
 
 }
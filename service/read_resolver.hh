@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <experimental/optional>
+#include <boost/algorithm/cxx11/any_of.hpp>
+#include "core/future.hh"
+#include "core/sharded.hh"
+#include "core/timer.hh"
+#include "db/consistency_level_type.hh"
+#include "exceptions/exceptions.hh"
+#include "gms/inet_address.hh"
+#include "mutation_query.hh"
+#include "query-request.hh"
+
+namespace service {
+
+// Collect the responses of the replicas to a read, completing once all of
+// them answered or failing with read_timeout_exception at the deadline.
+class abstract_read_resolver {
+protected:
+    db::consistency_level _cl;
+    size_t _targets_count;
+    promise<> _done_promise; // all target responded
+    bool _timedout = false; // will be true if request timeouts
+    timer<> _timeout;
+    size_t _responses = 0;
+
+    virtual void on_timeout() {}
+    virtual size_t response_count() const = 0;
+public:
+    abstract_read_resolver(db::consistency_level cl, size_t target_count, std::chrono::high_resolution_clock::time_point timeout)
+        : _cl(cl)
+        , _targets_count(target_count)
+    {
+        _timeout.set_callback([this] {
+            _timedout = true;
+            _done_promise.set_exception(exceptions::read_timeout_exception(_cl, response_count(), _targets_count, _responses != 0));
+            on_timeout();
+        });
+        _timeout.arm(timeout);
+    }
+    virtual ~abstract_read_resolver() {};
+    future<> done() {
+        return _done_promise.get_future();
+    }
+    virtual void error(gms::inet_address ep, std::exception_ptr eptr);
+};
+
+// Reconciles the mutation data read from several replicas, as read repair
+// and reads at consistency levels above ONE do.
+class data_read_resolver : public abstract_read_resolver {
+    struct reply {
+        gms::inet_address from;
+        foreign_ptr<lw_shared_ptr<reconcilable_result>> result;
+        // The replica returned as many rows as it was asked for, and may
+        // have more past the last one.
+        bool reached_limit;
+        reply(gms::inet_address from_, foreign_ptr<lw_shared_ptr<reconcilable_result>> result_, bool reached_limit_)
+            : from(std::move(from_)), result(std::move(result_)), reached_limit(reached_limit_) {}
+    };
+    struct version {
+        gms::inet_address from;
+        // Null if the replica has nothing of the partition.
+        const partition* par;
+        version(gms::inet_address from_, const partition* par_) : from(std::move(from_)), par(par_) {}
+    };
+public:
+    // Where the result of a replica which reached its limit stopped.
+    struct position {
+        partition_key key;
+        // The last row of the partition the replica returned, disengaged
+        // if it returned none, the partition then being whole.
+        std::experimental::optional<clustering_key> row;
+    };
+private:
+    std::vector<reply> _data_results;
+    // What each replica is missing of the reconciled partitions.
+    std::unordered_map<gms::inet_address, std::vector<mutation>> _diffs;
+    // Where the first replicas to stop stopped, and which they are; what
+    // lies beyond is only known of the others.
+    std::experimental::optional<position> _horizon;
+    std::vector<gms::inet_address> _short_replicas;
+private:
+    virtual void on_timeout() override {
+        // we will not need them any more
+        _data_results.clear();
+    }
+    virtual size_t response_count() const override {
+        return _data_results.size();
+    }
+    static std::experimental::optional<position> stop_position(schema_ptr schema, const query::partition_slice& slice, const reply& r);
+    // Whether a stops before b.
+    static bool before(const schema& s, const position& a, const position& b);
+    // Finds the replicas which reached their limit first. Only forward
+    // queries are tracked, the rows of reversed ones being limited in
+    // the reverse of the order they are returned in.
+    void find_horizon(schema_ptr schema, const query::partition_slice& slice);
+public:
+    data_read_resolver(db::consistency_level cl, size_t targets_count, std::chrono::high_resolution_clock::time_point timeout) : abstract_read_resolver(cl, targets_count, timeout) {
+        _data_results.reserve(targets_count);
+    }
+    void add_mutate_data(gms::inet_address from, foreign_ptr<lw_shared_ptr<reconcilable_result>> result, uint32_t row_limit) {
+        if (!_timedout) {
+            bool reached_limit = result->row_count() >= row_limit;
+            _data_results.emplace_back(std::move(from), std::move(result), reached_limit);
+            if (_data_results.size() == _targets_count) {
+                _timeout.cancel();
+                _done_promise.set_value();
+            }
+        }
+    }
+    // Appends what the replicas returned to continuation reads, which went
+    // on from where their previous results stopped.
+    void add_continuations(schema_ptr schema, data_read_resolver& continuations);
+    bool any_reached_limit() const {
+        return boost::algorithm::any_of(_data_results, [] (const reply& r) { return r.reached_limit; });
+    }
+    // Reconciles the replicas' results, up to where the first of those
+    // which reached their limit stopped, beyond which its data is unknown
+    // and could shadow the others'.
+    reconcilable_result resolve(schema_ptr schema, const query::partition_slice& slice);
+    // What the replicas miss of the partitions resolve() reconciled.
+    std::unordered_map<gms::inet_address, std::vector<mutation>> take_diffs() {
+        return std::move(_diffs);
+    }
+    // Where resolve() stopped, if some replica may have more data, and
+    // the replicas which stopped there, to be read on from.
+    const std::experimental::optional<position>& horizon() const {
+        return _horizon;
+    }
+    const std::vector<gms::inet_address>& short_replicas() const {
+        return _short_replicas;
+    }
+};
+
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "service_level_controller.hh"
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/lexical_cast.hpp>
+#include <seastar/core/reactor.hh>
+
+namespace service {
+
+const sstring service_level_controller::default_service_level = "default";
+
+service_level_options service_level_options::parse(const sstring& spec) {
+    service_level_options options;
+    std::vector<sstring> entries;
+    boost::split(entries, spec, boost::is_any_of(","), boost::token_compress_on);
+    for (auto&& e : entries) {
+        if (e.empty()) {
+            continue;
+        }
+        auto eq = e.find('=');
+        if (eq == sstring::npos) {
+            throw std::invalid_argument(sprint("Invalid service level option '%s', expected name=value", e));
+        }
+        auto name = e.substr(0, eq);
+        auto value = e.substr(eq + 1);
+        try {
+            if (name == "shares") {
+                options.shares = boost::lexical_cast<uint32_t>(value);
+            } else if (name == "requests_per_second") {
+                options.requests_per_second = boost::lexical_cast<uint64_t>(value);
+            } else if (name == "bytes_per_second") {
+                options.bytes_per_second = boost::lexical_cast<uint64_t>(value);
+            } else {
+                throw std::invalid_argument(sprint("Unknown service level option '%s'", name));
+            }
+        } catch (const boost::bad_lexical_cast&) {
+            throw std::invalid_argument(sprint("Invalid value '%s' of service level option '%s'", value, name));
+        }
+    }
+    if (!options.shares) {
+        throw std::invalid_argument("Service level shares must be positive");
+    }
+    return options;
+}
+
+service_level_controller::service_level_controller(unsigned max_concurrent)
+    : _max_concurrent(std::max(max_concurrent, 1u))
+{
+    set_service_level(default_service_level, service_level_options());
+}
+
+void service_level_controller::set_service_level(const sstring& name, service_level_options options) {
+    auto& sl = _levels[name];
+    if (!sl) {
+        sl = std::make_unique<service_level>();
+    }
+    // This shard's part of the node-wide rates, but never none at all.
+    auto per_shard = [] (uint64_t rate) -> size_t {
+        return rate ? std::max<uint64_t>(rate / smp::count, 1) : 0;
+    };
+    sl->request_limiter = make_lw_shared<utils::rate_limiter>(per_shard(options.requests_per_second));
+    sl->byte_limiter = make_lw_shared<utils::rate_limiter>(per_shard(options.bytes_per_second));
+    sl->options = options;
+}
+
+std::vector<sstring> service_level_controller::service_levels() const {
+    std::vector<sstring> names;
+    for (auto&& e : _levels) {
+        names.push_back(e.first);
+    }
+    return names;
+}
+
+service_level_controller::service_level& service_level_controller::find(const sstring& name) {
+    auto i = _levels.find(name);
+    if (i == _levels.end()) {
+        i = _levels.find(default_service_level);
+    }
+    return *i->second;
+}
+
+future<> service_level_controller::limit(service_level& sl, size_t bytes) {
+    if (!sl.options.requests_per_second && !sl.options.bytes_per_second) {
+        return make_ready_future<>();
+    }
+    // The limiters are replaced along with the options, so hold on to the
+    // ones the request waits for.
+    auto f = sl.request_limiter->reserve(1).then([byte_limiter = sl.byte_limiter, bytes] {
+        return byte_limiter->reserve(bytes);
+    }).finally([request_limiter = sl.request_limiter] {});
+    if (!f.available()) {
+        ++sl.st.throttled;
+    }
+    return f;
+}
+
+future<> service_level_controller::admit(service_level& sl) {
+    if (sl.waiters.empty()) {
+        sl.accumulated = std::max(sl.accumulated, _virtual_time);
+    }
+    sl.waiters.emplace_back();
+    ++sl.st.queued;
+    auto f = sl.waiters.back().get_future();
+    dispatch();
+    return f;
+}
+
+void service_level_controller::release() {
+    --_running;
+    dispatch();
+}
+
+void service_level_controller::dispatch() {
+    while (_running < _max_concurrent) {
+        service_level* next = nullptr;
+        for (auto&& e : _levels) {
+            auto& sl = *e.second;
+            if (!sl.waiters.empty() && (!next || sl.accumulated < next->accumulated)) {
+                next = &sl;
+            }
+        }
+        if (!next) {
+            return;
+        }
+        _virtual_time = next->accumulated;
+        next->accumulated += 1.0 / next->options.shares;
+        --next->st.queued;
+        ++_running;
+        auto pr = std::move(next->waiters.front());
+        next->waiters.pop_front();
+        pr.set_value();
+    }
+}
+
+}
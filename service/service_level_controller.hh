@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <seastar/core/future.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/sstring.hh>
+#include "utils/histogram.hh"
+#include "utils/rate_limiter.hh"
+
+namespace service {
+
+/**
+ * What a service level grants the requests of its clients, parsed from a
+ * specification like "shares=200,requests_per_second=1000,bytes_per_second=1048576".
+ * Omitted options keep their defaults. Rates are node-wide, 0 meaning
+ * unlimited; each shard enforces its part of them.
+ */
+struct service_level_options {
+    uint32_t shares = 1000;
+    uint64_t requests_per_second = 0;
+    uint64_t bytes_per_second = 0;
+
+    // Throws std::invalid_argument on a malformed specification.
+    static service_level_options parse(const sstring& spec);
+};
+
+/**
+ * Runs the requests of each shard's CQL clients under their service
+ * levels, so that workloads sharing a cluster don't crowd each other out.
+ *
+ * A request first waits for the request and byte rate limits of its level,
+ * and is then admitted among at most max_concurrent requests in progress
+ * on the shard. Requests waiting to be admitted are let in by start-time
+ * fair queueing on the shares of their levels, so that when the shard is
+ * saturated each level gets through requests in proportion to its shares.
+ * Clients choose their level when they connect; those which don't run
+ * under default_service_level.
+ */
+class service_level_controller {
+public:
+    static const sstring default_service_level;
+
+    struct stats {
+        uint64_t requests = 0;
+        // Delayed by the rate limits of the level.
+        uint64_t throttled = 0;
+        // Waiting to be admitted.
+        uint64_t queued = 0;
+        // Of all the requests, including the time they waited, in microseconds.
+        utils::decaying_histogram latencies;
+    };
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct service_level {
+        service_level_options options;
+        lw_shared_ptr<utils::rate_limiter> request_limiter;
+        lw_shared_ptr<utils::rate_limiter> byte_limiter;
+        double accumulated = 0;
+        std::deque<promise<>> waiters;
+        stats st;
+    };
+    // Levels are never removed, so requests can hold on to them.
+    std::map<sstring, std::unique_ptr<service_level>> _levels;
+    unsigned _max_concurrent;
+    unsigned _running = 0;
+    // Accumulated shares-weighted count of the level last admitted from.
+    double _virtual_time = 0;
+private:
+    service_level& find(const sstring& name);
+    future<> limit(service_level& sl, size_t bytes);
+    future<> admit(service_level& sl);
+    void release();
+    void dispatch();
+public:
+    explicit service_level_controller(unsigned max_concurrent);
+
+    // Adds a level, or replaces the options of an existing one.
+    void set_service_level(const sstring& name, service_level_options options);
+
+    bool has_service_level(const sstring& name) const {
+        return _levels.count(name);
+    }
+
+    // Runs func, a request of about bytes bytes, under the named level,
+    // or the default one if there is no such level.
+    template <typename Func>
+    futurize_t<std::result_of_t<Func()>> run(const sstring& name, size_t bytes, Func&& func) {
+        using futurator = futurize<std::result_of_t<Func()>>;
+        auto& sl = find(name);
+        ++sl.st.requests;
+        auto start = clock::now();
+        return limit(sl, bytes).then([this, &sl] {
+            return admit(sl);
+        }).then([this, func = std::forward<Func>(func)] () mutable {
+            return futurator::apply(func).finally([this] {
+                release();
+            });
+        }).finally([&sl, start] {
+            sl.st.latencies.mark(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count());
+        });
+    }
+
+    std::vector<sstring> service_levels() const;
+
+    const service_level_options& get_options(const sstring& name) const {
+        return _levels.at(name)->options;
+    }
+
+    const stats& get_stats(const sstring& name) const {
+        return _levels.at(name)->st;
+    }
+
+    unsigned running() const {
+        return _running;
+    }
+};
+
+}
@@ -43,9 +43,11 @@
 #include "db/commitlog/commitlog.hh"
 #include "db/serializer.hh"
 #include "storage_proxy.hh"
+#include "read_resolver.hh"
 #include "unimplemented.hh"
 #include "frozen_mutation.hh"
 #include "query_result_merger.hh"
+#include "query-result-reader.hh"
 #include "core/do_with.hh"
 #include "message/messaging_service.hh"
 #include "gms/failure_detector.hh"
@@ -53,11 +55,23 @@
 #include "db/serializer.hh"
 #include "storage_service.hh"
 #include "core/future-util.hh"
+#include "core/memory.hh"
 #include "db/read_repair_decision.hh"
 #include "db/config.hh"
 #include "db/batchlog_manager.hh"
+#include "db/system_keyspace.hh"
+#include "db/hints/manager.hh"
+#include "db/cdc/log.hh"
+#include "service/paxos/paxos_state.hh"
+#include "utils/UUID_gen.hh"
+#include "core/sleep.hh"
 #include "exceptions/exceptions.hh"
+#include "cql3/functions/functions.hh"
+#include "cql3/result_cache.hh"
 #include <boost/range/algorithm_ext/push_back.hpp>
+#include <boost/algorithm/cxx11/none_of.hpp>
+#include <boost/algorithm/cxx11/any_of.hpp>
+#include <boost/range/join.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/iterator/counting_iterator.hpp>
 #include <boost/range/adaptor/filtered.hpp>
@@ -68,6 +82,7 @@
 #include <boost/range/algorithm/heap_algorithm.hpp>
 #include <boost/range/numeric.hpp>
 #include <boost/range/algorithm/sort.hpp>
+#include <boost/range/irange.hpp>
 #include "utils/latency.hh"
 #include "schema.hh"
 
@@ -83,6 +98,25 @@ static inline bool is_me(gms::inet_address from) {
     return from == utils::fb_utilities::get_broadcast_address();
 }
 
+// The shard of the replica owning the token, as far as gossip tells, so that
+// the messages about it are handled there without crossing to it.
+static net::messaging_service::shard_id replica_shard(gms::inet_address ep, const dht::token& t) {
+    auto shard_count = gms::get_local_gossiper().get_shard_count(ep);
+    return {ep, shard_count ? dht::global_partitioner().shard_of(t, shard_count) : 0};
+}
+
+static net::messaging_service::shard_id replica_shard(gms::inet_address ep, const query::partition_range& pr) {
+    if (!pr.is_singular()) {
+        return {ep, 0};
+    }
+    return replica_shard(ep, pr.start()->value().token());
+}
+
+static dht::token token_of(database& db, const frozen_mutation& m) {
+    auto s = db.find_schema(m.column_family_id());
+    return dht::global_partitioner().get_token(*s, m.key(*s));
+}
+
 static inline
 const dht::token& start_token(const query::partition_range& r) {
     static const dht::token min_token = dht::minimum_token();
@@ -109,6 +143,9 @@ class abstract_write_response_handler {
     // it should not be a huge burden. (flw)
     std::vector<gms::inet_address> _dead_endpoints;
     size_t _cl_acks = 0;
+    // That of the client request, which gets the replicas' response times.
+    tracing::trace_state_ptr _trace_state;
+    std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
     virtual size_t total_block_for() {
         // original comment from cassandra:
         // during bootstrap, include pending endpoints in the count
@@ -136,6 +173,9 @@ class abstract_write_response_handler {
     // return true on last ack
     bool response(gms::inet_address from) {
         signal(from);
+        if (_trace_state) {
+            _trace_state->add_replica_time(from, std::chrono::steady_clock::now() - _start);
+        }
         auto it = _targets.find(from);
         assert(it != _targets.end());
         _targets.erase(it);
@@ -222,11 +262,19 @@ storage_proxy::response_id_type storage_proxy::register_response_handler(std::un
         }
     }));
     assert(e.second);
+    ++_stats.writes_in_flight;
+    _stats.write_bytes_in_flight += e.first->second.handler->get_mutation()->representation().size();
     return id;
 }
 
 void storage_proxy::remove_response_handler(storage_proxy::response_id_type id) {
-    _response_handlers.erase(id);
+    auto it = _response_handlers.find(id);
+    if (it != _response_handlers.end()) {
+        --_stats.writes_in_flight;
+        _stats.write_bytes_in_flight -= it->second.handler->get_mutation()->representation().size();
+        _response_handlers.erase(it);
+        _write_admission.notify();
+    }
 }
 
 void storage_proxy::got_response(storage_proxy::response_id_type id, gms::inet_address from) {
@@ -271,8 +319,37 @@ storage_proxy::response_id_type storage_proxy::create_write_response_handler(key
 }
 
 storage_proxy::~storage_proxy() {}
-storage_proxy::storage_proxy(distributed<database>& db) : _db(db) {
+static locator::dynamic_snitch::config dynamic_snitch_config(const db::config& cfg) {
+    locator::dynamic_snitch::config c;
+    c.enabled = cfg.dynamic_snitch();
+    c.badness_threshold = cfg.dynamic_snitch_badness_threshold();
+    c.reset_interval = std::chrono::milliseconds(cfg.dynamic_snitch_reset_interval_in_ms());
+    c.update_interval = std::chrono::milliseconds(cfg.dynamic_snitch_update_interval_in_ms());
+    return c;
+}
+
+storage_proxy::storage_proxy(distributed<database>& db)
+        : _db(db)
+        , _dynamic_snitch(dynamic_snitch_config(db.local().get_config()))
+        , _hints_manager(std::make_unique<db::hints::manager>(*this, db::hints::manager::config(db.local().get_config())))
+        , _max_writes_in_flight(db.local().get_config().max_coordinator_writes_in_flight())
+        , _max_write_bytes_in_flight(db.local().get_config().max_coordinator_write_memory_in_mb()
+                ? uint64_t(db.local().get_config().max_coordinator_write_memory_in_mb()) << 20
+                : memory::stats().total_memory() / 10)
+        , _max_reads_in_flight(db.local().get_config().max_coordinator_reads_in_flight())
+        , _write_admission("writes", [this] {
+                return (!_max_writes_in_flight || _stats.writes_in_flight < _max_writes_in_flight)
+                        && _stats.write_bytes_in_flight < _max_write_bytes_in_flight;
+            }, std::max<uint64_t>(_max_writes_in_flight, 1), std::chrono::milliseconds(db.local().get_config().coordinator_queue_timeout_in_ms()))
+        , _read_admission("reads", [this] {
+                return !_max_reads_in_flight || _stats.reads_in_flight < _max_reads_in_flight;
+            }, std::max<uint64_t>(_max_reads_in_flight, 1), std::chrono::milliseconds(db.local().get_config().coordinator_queue_timeout_in_ms()))
+        , _max_view_update_backlog(std::max<size_t>(size_t(db.local().get_config().max_view_update_backlog_in_mb()) << 20, 1))
+        , _view_update_backlog(_max_view_update_backlog) {
     init_messaging_service();
+    db.local().set_view_update_sender([this] (schema_ptr base, dht::token base_token, std::vector<mutation> updates) {
+        return send_view_updates(std::move(base), std::move(base_token), std::move(updates));
+    });
 }
 
 storage_proxy::rh_entry::rh_entry(std::unique_ptr<abstract_write_response_handler>&& h, shared_ptr<storage_proxy> p, std::function<void()>&& cb) : handler(std::move(h)), proxy(p), expire_timer(std::move(cb)) {}
@@ -311,358 +388,15 @@ storage_proxy::rh_entry::rh_entry(std::unique_ptr<abstract_write_response_handle
             }
         };
     }
-
-    /**
-     * Apply @param updates if and only if the current values in the row for @param key
-     * match the provided @param conditions.  The algorithm is "raw" Paxos: that is, Paxos
-     * minus leader election -- any node in the cluster may propose changes for any row,
-     * which (that is, the row) is the unit of values being proposed, not single columns.
-     *
-     * The Paxos cohort is only the replicas for the given key, not the entire cluster.
-     * So we expect performance to be reasonable, but CAS is still intended to be used
-     * "when you really need it," not for all your updates.
-     *
-     * There are three phases to Paxos:
-     *  1. Prepare: the coordinator generates a ballot (timeUUID in our case) and asks replicas to (a) promise
-     *     not to accept updates from older ballots and (b) tell us about the most recent update it has already
-     *     accepted.
-     *  2. Accept: if a majority of replicas reply, the coordinator asks replicas to accept the value of the
-     *     highest proposal ballot it heard about, or a new value if no in-progress proposals were reported.
-     *  3. Commit (Learn): if a majority of replicas acknowledge the accept request, we can commit the new
-     *     value.
-     *
-     *  Commit procedure is not covered in "Paxos Made Simple," and only briefly mentioned in "Paxos Made Live,"
-     *  so here is our approach:
-     *   3a. The coordinator sends a commit message to all replicas with the ballot and value.
-     *   3b. Because of 1-2, this will be the highest-seen commit ballot.  The replicas will note that,
-     *       and send it with subsequent promise replies.  This allows us to discard acceptance records
-     *       for successfully committed replicas, without allowing incomplete proposals to commit erroneously
-     *       later on.
-     *
-     *  Note that since we are performing a CAS rather than a simple update, we perform a read (of committed
-     *  values) between the prepare and accept phases.  This gives us a slightly longer window for another
-     *  coordinator to come along and trump our own promise with a newer one but is otherwise safe.
-     *
-     * @param keyspaceName the keyspace for the CAS
-     * @param cfName the column family for the CAS
-     * @param key the row key for the row to CAS
-     * @param request the conditions for the CAS to apply as well as the update to perform if the conditions hold.
-     * @param consistencyForPaxos the consistency for the paxos prepare and propose round. This can only be either SERIAL or LOCAL_SERIAL.
-     * @param consistencyForCommit the consistency for write done during the commit phase. This can be anything, except SERIAL or LOCAL_SERIAL.
-     *
-     * @return null if the operation succeeds in updating the row, or the current values corresponding to conditions.
-     * (since, if the CAS doesn't succeed, it means the current value do not match the conditions).
-     */
-    public static ColumnFamily cas(String keyspaceName,
-                                   String cfName,
-                                   ByteBuffer key,
-                                   CASRequest request,
-                                   ConsistencyLevel consistencyForPaxos,
-                                   ConsistencyLevel consistencyForCommit,
-                                   ClientState state)
-    throws UnavailableException, IsBootstrappingException, ReadTimeoutException, WriteTimeoutException, InvalidRequestException
-    {
-        final long start = System.nanoTime();
-        int contentions = 0;
-        try
-        {
-            consistencyForPaxos.validateForCas();
-            consistencyForCommit.validateForCasCommit(keyspaceName);
-
-            CFMetaData metadata = Schema.instance.getCFMetaData(keyspaceName, cfName);
-
-            long timeout = TimeUnit.MILLISECONDS.toNanos(DatabaseDescriptor.getCasContentionTimeout());
-            while (System.nanoTime() - start < timeout)
-            {
-                // for simplicity, we'll do a single liveness check at the start of each attempt
-                Pair<List<InetAddress>, Integer> p = getPaxosParticipants(keyspaceName, key, consistencyForPaxos);
-                List<InetAddress> liveEndpoints = p.left;
-                int requiredParticipants = p.right;
-
-                final Pair<UUID, Integer> pair = beginAndRepairPaxos(start, key, metadata, liveEndpoints, requiredParticipants, consistencyForPaxos, consistencyForCommit, true, state);
-                final UUID ballot = pair.left;
-                contentions += pair.right;
-                // read the current values and check they validate the conditions
-                Tracing.trace("Reading existing values for CAS precondition");
-                long timestamp = System.currentTimeMillis();
-                ReadCommand readCommand = ReadCommand.create(keyspaceName, key, cfName, timestamp, request.readFilter());
-                List<Row> rows = read(Arrays.asList(readCommand), consistencyForPaxos == ConsistencyLevel.LOCAL_SERIAL ? ConsistencyLevel.LOCAL_QUORUM : ConsistencyLevel.QUORUM);
-                ColumnFamily current = rows.get(0).cf;
-                if (!request.appliesTo(current))
-                {
-                    Tracing.trace("CAS precondition does not match current values {}", current);
-                    // We should not return null as this means success
-                    casWriteMetrics.conditionNotMet.inc();
-                    return current == null ? ArrayBackedSortedColumns.factory.create(metadata) : current;
-                }
-
-                // finish the paxos round w/ the desired updates
-                // TODO turn null updates into delete?
-                ColumnFamily updates = request.makeUpdates(current);
-
-                // Apply triggers to cas updates. A consideration here is that
-                // triggers emit Mutations, and so a given trigger implementation
-                // may generate mutations for partitions other than the one this
-                // paxos round is scoped for. In this case, TriggerExecutor will
-                // validate that the generated mutations are targetted at the same
-                // partition as the initial updates and reject (via an
-                // InvalidRequestException) any which aren't.
-                updates = TriggerExecutor.instance.execute(key, updates);
-
-                Commit proposal = Commit.newProposal(key, ballot, updates);
-                Tracing.trace("CAS precondition is met; proposing client-requested updates for {}", ballot);
-                if (proposePaxos(proposal, liveEndpoints, requiredParticipants, true, consistencyForPaxos))
-                {
-                    commitPaxos(proposal, consistencyForCommit);
-                    Tracing.trace("CAS successful");
-                    return null;
-                }
-
-                Tracing.trace("Paxos proposal not accepted (pre-empted by a higher ballot)");
-                contentions++;
-                Uninterruptibles.sleepUninterruptibly(ThreadLocalRandom.current().nextInt(100), TimeUnit.MILLISECONDS);
-                // continue to retry
-            }
-
-            throw new WriteTimeoutException(WriteType.CAS, consistencyForPaxos, 0, consistencyForPaxos.blockFor(Keyspace.open(keyspaceName)));
-        }
-        catch (WriteTimeoutException|ReadTimeoutException e)
-        {
-            casWriteMetrics.timeouts.mark();
-            throw e;
-        }
-        catch(UnavailableException e)
-        {
-            casWriteMetrics.unavailables.mark();
-            throw e;
-        }
-        finally
-        {
-            if(contentions > 0)
-                casWriteMetrics.contention.update(contentions);
-            casWriteMetrics.addNano(System.nanoTime() - start);
-        }
-    }
-
-    private static Predicate<InetAddress> sameDCPredicateFor(final String dc)
-    {
-        final IEndpointSnitch snitch = DatabaseDescriptor.getEndpointSnitch();
-        return new Predicate<InetAddress>()
-        {
-            public boolean apply(InetAddress host)
-            {
-                return dc.equals(snitch.getDatacenter(host));
-            }
-        };
-    }
-
-    private static Pair<List<InetAddress>, Integer> getPaxosParticipants(String keyspaceName, ByteBuffer key, ConsistencyLevel consistencyForPaxos) throws UnavailableException
-    {
-        Token tk = StorageService.getPartitioner().getToken(key);
-        List<InetAddress> naturalEndpoints = StorageService.instance.getNaturalEndpoints(keyspaceName, tk);
-        Collection<InetAddress> pendingEndpoints = StorageService.instance.getTokenMetadata().pendingEndpointsFor(tk, keyspaceName);
-
-        if (consistencyForPaxos == ConsistencyLevel.LOCAL_SERIAL)
-        {
-            // Restrict naturalEndpoints and pendingEndpoints to node in the local DC only
-            String localDc = DatabaseDescriptor.getEndpointSnitch().getDatacenter(FBUtilities.getBroadcastAddress());
-            Predicate<InetAddress> isLocalDc = sameDCPredicateFor(localDc);
-            naturalEndpoints = ImmutableList.copyOf(Iterables.filter(naturalEndpoints, isLocalDc));
-            pendingEndpoints = ImmutableList.copyOf(Iterables.filter(pendingEndpoints, isLocalDc));
-        }
-        int participants = pendingEndpoints.size() + naturalEndpoints.size();
-        int requiredParticipants = participants + 1  / 2; // See CASSANDRA-833
-        List<InetAddress> liveEndpoints = ImmutableList.copyOf(Iterables.filter(Iterables.concat(naturalEndpoints, pendingEndpoints), IAsyncCallback.isAlive));
-        if (liveEndpoints.size() < requiredParticipants)
-            throw new UnavailableException(consistencyForPaxos, requiredParticipants, liveEndpoints.size());
-
-        // We cannot allow CAS operations with 2 or more pending endpoints, see #8346.
-        // Note that we fake an impossible number of required nodes in the unavailable exception
-        // to nail home the point that it's an impossible operation no matter how many nodes are live.
-        if (pendingEndpoints.size() > 1)
-            throw new UnavailableException(String.format("Cannot perform LWT operation as there is more than one (%d) pending range movement", pendingEndpoints.size()),
-                                           consistencyForPaxos,
-                                           participants + 1,
-                                           liveEndpoints.size());
-
-        return Pair.create(liveEndpoints, requiredParticipants);
-    }
-
-    /**
-     * begin a Paxos session by sending a prepare request and completing any in-progress requests seen in the replies
-     *
-     * @return the Paxos ballot promised by the replicas if no in-progress requests were seen and a quorum of
-     * nodes have seen the mostRecentCommit.  Otherwise, return null.
-     */
-    private static Pair<UUID, Integer> beginAndRepairPaxos(long start,
-                                                           ByteBuffer key,
-                                                           CFMetaData metadata,
-                                                           List<InetAddress> liveEndpoints,
-                                                           int requiredParticipants,
-                                                           ConsistencyLevel consistencyForPaxos,
-                                                           ConsistencyLevel consistencyForCommit,
-                                                           final boolean isWrite,
-                                                           ClientState state)
-    throws WriteTimeoutException
-    {
-        long timeout = TimeUnit.MILLISECONDS.toNanos(DatabaseDescriptor.getCasContentionTimeout());
-
-        PrepareCallback summary = null;
-        int contentions = 0;
-        while (System.nanoTime() - start < timeout)
-        {
-            // We don't want to use a timestamp that is older than the last one assigned by the ClientState or operations
-            // may appear out-of-order (#7801). But note that state.getTimestamp() is in microseconds while the ballot
-            // timestamp is only in milliseconds
-            long currentTime = (state.getTimestamp() / 1000) + 1;
-            long ballotMillis = summary == null
-                              ? currentTime
-                              : Math.max(currentTime, 1 + UUIDGen.unixTimestamp(summary.mostRecentInProgressCommit.ballot));
-            UUID ballot = UUIDGen.getTimeUUID(ballotMillis);
-
-            // prepare
-            Tracing.trace("Preparing {}", ballot);
-            Commit toPrepare = Commit.newPrepare(key, metadata, ballot);
-            summary = preparePaxos(toPrepare, liveEndpoints, requiredParticipants, consistencyForPaxos);
-            if (!summary.promised)
-            {
-                Tracing.trace("Some replicas have already promised a higher ballot than ours; aborting");
-                contentions++;
-                // sleep a random amount to give the other proposer a chance to finish
-                Uninterruptibles.sleepUninterruptibly(ThreadLocalRandom.current().nextInt(100), TimeUnit.MILLISECONDS);
-                continue;
-            }
-
-            Commit inProgress = summary.mostRecentInProgressCommitWithUpdate;
-            Commit mostRecent = summary.mostRecentCommit;
-
-            // If we have an in-progress ballot greater than the MRC we know, then it's an in-progress round that
-            // needs to be completed, so do it.
-            if (!inProgress.update.isEmpty() && inProgress.isAfter(mostRecent))
-            {
-                Tracing.trace("Finishing incomplete paxos round {}", inProgress);
-                if(isWrite)
-                    casWriteMetrics.unfinishedCommit.inc();
-                else
-                    casReadMetrics.unfinishedCommit.inc();
-                Commit refreshedInProgress = Commit.newProposal(inProgress.key, ballot, inProgress.update);
-                if (proposePaxos(refreshedInProgress, liveEndpoints, requiredParticipants, false, consistencyForPaxos))
-                {
-                    commitPaxos(refreshedInProgress, consistencyForCommit);
-                }
-                else
-                {
-                    Tracing.trace("Some replicas have already promised a higher ballot than ours; aborting");
-                    // sleep a random amount to give the other proposer a chance to finish
-                    contentions++;
-                    Uninterruptibles.sleepUninterruptibly(ThreadLocalRandom.current().nextInt(100), TimeUnit.MILLISECONDS);
-                }
-                continue;
-            }
-
-            // To be able to propose our value on a new round, we need a quorum of replica to have learn the previous one. Why is explained at:
-            // https://issues.apache.org/jira/browse/CASSANDRA-5062?focusedCommentId=13619810&page=com.atlassian.jira.plugin.system.issuetabpanels:comment-tabpanel#comment-13619810)
-            // Since we waited for quorum nodes, if some of them haven't seen the last commit (which may just be a timing issue, but may also
-            // mean we lost messages), we pro-actively "repair" those nodes, and retry.
-            Iterable<InetAddress> missingMRC = summary.replicasMissingMostRecentCommit();
-            if (Iterables.size(missingMRC) > 0)
-            {
-                Tracing.trace("Repairing replicas that missed the most recent commit");
-                sendCommit(mostRecent, missingMRC);
-                // TODO: provided commits don't invalid the prepare we just did above (which they don't), we could just wait
-                // for all the missingMRC to acknowledge this commit and then move on with proposing our value. But that means
-                // adding the ability to have commitPaxos block, which is exactly CASSANDRA-5442 will do. So once we have that
-                // latter ticket, we can pass CL.ALL to the commit above and remove the 'continue'.
-                continue;
-            }
-
-            // We might commit this ballot and we want to ensure operations starting after this CAS succeed will be assigned
-            // a timestamp greater that the one of this ballot, so operation order is preserved (#7801)
-            state.updateLastTimestamp(ballotMillis * 1000);
-
-            return Pair.create(ballot, contentions);
-        }
-
-        throw new WriteTimeoutException(WriteType.CAS, consistencyForPaxos, 0, consistencyForPaxos.blockFor(Keyspace.open(metadata.ksName)));
-    }
-
-    /**
-     * Unlike commitPaxos, this does not wait for replies
-     */
-    private static void sendCommit(Commit commit, Iterable<InetAddress> replicas)
-    {
-        MessageOut<Commit> message = new MessageOut<Commit>(MessagingService.Verb.PAXOS_COMMIT, commit, Commit.serializer);
-        for (InetAddress target : replicas)
-            MessagingService.instance().sendOneWay(message, target);
-    }
-
-    private static PrepareCallback preparePaxos(Commit toPrepare, List<InetAddress> endpoints, int requiredParticipants, ConsistencyLevel consistencyForPaxos)
-    throws WriteTimeoutException
-    {
-        PrepareCallback callback = new PrepareCallback(toPrepare.key, toPrepare.update.metadata(), requiredParticipants, consistencyForPaxos);
-        MessageOut<Commit> message = new MessageOut<Commit>(MessagingService.Verb.PAXOS_PREPARE, toPrepare, Commit.serializer);
-        for (InetAddress target : endpoints)
-            MessagingService.instance().sendRR(message, target, callback);
-        callback.await();
-        return callback;
-    }
-
-    private static boolean proposePaxos(Commit proposal, List<InetAddress> endpoints, int requiredParticipants, boolean timeoutIfPartial, ConsistencyLevel consistencyLevel)
-    throws WriteTimeoutException
-    {
-        ProposeCallback callback = new ProposeCallback(endpoints.size(), requiredParticipants, !timeoutIfPartial, consistencyLevel);
-        MessageOut<Commit> message = new MessageOut<Commit>(MessagingService.Verb.PAXOS_PROPOSE, proposal, Commit.serializer);
-        for (InetAddress target : endpoints)
-            MessagingService.instance().sendRR(message, target, callback);
-
-        callback.await();
-
-        if (callback.isSuccessful())
-            return true;
-
-        if (timeoutIfPartial && !callback.isFullyRefused())
-            throw new WriteTimeoutException(WriteType.CAS, consistencyLevel, callback.getAcceptCount(), requiredParticipants);
-
-        return false;
-    }
-
-    private static void commitPaxos(Commit proposal, ConsistencyLevel consistencyLevel) throws WriteTimeoutException
-    {
-        boolean shouldBlock = consistencyLevel != ConsistencyLevel.ANY;
-        Keyspace keyspace = Keyspace.open(proposal.update.metadata().ksName);
-
-        Token tk = StorageService.getPartitioner().getToken(proposal.key);
-        List<InetAddress> naturalEndpoints = StorageService.instance.getNaturalEndpoints(keyspace.getName(), tk);
-        Collection<InetAddress> pendingEndpoints = StorageService.instance.getTokenMetadata().pendingEndpointsFor(tk, keyspace.getName());
-
-        AbstractWriteResponseHandler responseHandler = null;
-        if (shouldBlock)
-        {
-            AbstractReplicationStrategy rs = keyspace.getReplicationStrategy();
-            responseHandler = rs.getWriteResponseHandler(naturalEndpoints, pendingEndpoints, consistencyLevel, null, WriteType.SIMPLE);
-        }
-
-        MessageOut<Commit> message = new MessageOut<Commit>(MessagingService.Verb.PAXOS_COMMIT, proposal, Commit.serializer);
-        for (InetAddress destination : Iterables.concat(naturalEndpoints, pendingEndpoints))
-        {
-            if (FailureDetector.instance.isAlive(destination))
-            {
-                if (shouldBlock)
-                    MessagingService.instance().sendRR(message, destination, responseHandler);
-                else
-                    MessagingService.instance().sendOneWay(message, destination);
-            }
-        }
-
-        if (shouldBlock)
-            responseHandler.get();
-    }
 #endif
 
 
 future<>
 storage_proxy::mutate_locally(const mutation& m) {
     auto shard = _db.local().shard_of(m);
+    if (shard == engine().cpu_id()) {
+        return _db.local().apply(m);
+    }
     return _db.invoke_on(shard, [m = freeze(m)] (database& db) -> future<> {
         return db.apply(m);
     });
@@ -758,7 +492,7 @@ future<std::vector<storage_proxy::response_id_type>> storage_proxy::mutate_prepa
 }
 
 future<> storage_proxy::mutate_begin(std::vector<storage_proxy::response_id_type> ids, db::consistency_level cl, const sstring& local_dc) {
-    return parallel_for_each(ids, [this, cl, &local_dc] (storage_proxy::response_id_type response_id) {
+    auto f = parallel_for_each(ids, [this, cl] (storage_proxy::response_id_type response_id) {
         // it is better to send first and hint afterwards to reduce latency
         // but request may complete before hint_to_dead_endpoints() is called and
         // response_id handler will be removed, so we will have to do hint with separate
@@ -766,13 +500,15 @@ future<> storage_proxy::mutate_begin(std::vector<storage_proxy::response_id_type
         hint_to_dead_endpoints(response_id, cl);
 
         // call before send_to_live_endpoints() for the same reason as above
-        auto f = response_wait(response_id);
-        send_to_live_endpoints(response_id, local_dc);
-        return f.handle_exception([this, response_id] (std::exception_ptr exp) {
+        return response_wait(response_id).handle_exception([this, response_id] (std::exception_ptr exp) {
             remove_response_handler(response_id); // cancel expire_timer, so no hint will happen
             return make_exception_future<>(exp);
         });
     });
+    // All mutations are sent at once, so that the ones going to the same
+    // replica can share a message.
+    send_to_live_endpoints(std::move(ids), local_dc);
+    return f;
 }
 
 // this function should be called with a future that holds result of mutation attempt (usually
@@ -780,6 +516,7 @@ future<> storage_proxy::mutate_begin(std::vector<storage_proxy::response_id_type
 future<> storage_proxy::mutate_end(future<> mutate_result, utils::latency_counter lc) {
     assert(mutate_result.available());
     _stats.write.mark(lc.stop().latency_in_nano());
+    _stats.write_latencies.mark(lc.latency_in_micro());
     try {
         mutate_result.get();
         return make_ready_future<>();
@@ -802,6 +539,31 @@ future<> storage_proxy::mutate_end(future<> mutate_result, utils::latency_counte
     }
 }
 
+// The partitions written, of tables whose reads have their results cached.
+static void add_cached_partition(std::vector<uint64_t>& partitions, const schema& s, const dht::token& t) {
+    if (s.caching_options().result_cache_ttl().count()) {
+        partitions.push_back(cql3::result_cache::partition_hash(s.id(), t));
+    }
+}
+
+static std::vector<uint64_t> cached_partitions(const std::vector<mutation>& mutations) {
+    std::vector<uint64_t> partitions;
+    for (auto&& m : mutations) {
+        add_cached_partition(partitions, *m.schema(), m.token());
+    }
+    return partitions;
+}
+
+// A write coordinated here drops the results of reads of its partitions
+// cached here, as this node needn't be a replica of them. Even a failed
+// write may have been applied.
+static future<> invalidate_cached_results(future<> f, std::vector<uint64_t> partitions) {
+    return cql3::result_cache::invalidate_on_all_shards(std::move(partitions)).then_wrapped([f = std::move(f)] (future<> inv) mutable {
+        inv.ignore_ready_future();
+        return std::move(f);
+    });
+}
+
 /**
  * Use this method to have these Mutations applied
  * across all replicas. This method will take care
@@ -812,25 +574,493 @@ future<> storage_proxy::mutate_end(future<> mutate_result, utils::latency_counte
  * @param consistency_level the consistency level for the operation
  */
 future<>
-storage_proxy::mutate(std::vector<mutation> mutations, db::consistency_level cl) {
+storage_proxy::mutate(std::vector<mutation> mutations, db::consistency_level cl, tracing::trace_state_ptr trace_state) {
+    auto is_counter = [] (const mutation& m) { return m.schema()->is_counter(); };
+    if (boost::algorithm::none_of(mutations, is_counter)) {
+        // A session begun here rather than by the client request ends here.
+        auto began = !trace_state;
+        if (!mutations.empty()) {
+            trace_state = maybe_begin_trace(*mutations.front().schema(), "Execute write", cl, std::move(trace_state));
+        }
+        return do_mutate(std::move(mutations), cl, trace_state).finally([trace_state, began] {
+            if (began && trace_state) {
+                trace_state->end();
+            }
+        });
+    }
+    return do_with(std::move(mutations), [this, cl, is_counter] (std::vector<mutation>& mutations) {
+        return parallel_for_each(mutations, [this, cl, is_counter] (mutation& m) {
+            if (!is_counter(m)) {
+                std::vector<mutation> mutations;
+                mutations.push_back(std::move(m));
+                return do_mutate(std::move(mutations), cl, nullptr);
+            }
+            return mutate_counter(std::move(m), cl);
+        });
+    });
+}
+
+future<>
+storage_proxy::mutate_counter(mutation m, db::consistency_level cl) {
+    auto& ks = _db.local().find_keyspace(m.schema()->ks_name());
+    auto natural = ks.get_replication_strategy().get_natural_endpoints(m.token());
+    if (boost::range::find_if(natural, is_me) != natural.end()) {
+        return apply_counter_update_on_leader(freeze(m), cl);
+    }
+    auto live = get_live_sorted_endpoints(ks, m.token());
+    if (live.empty()) {
+        return make_exception_future<>(exceptions::unavailable_exception(cl, 1, 0));
+    }
+    auto leader = live.front();
+    std::vector<uint64_t> partitions;
+    add_cached_partition(partitions, *m.schema(), m.token());
+    return do_with(freeze(m), [leader, cl, fm_token = m.token()] (const frozen_mutation& fm) {
+        auto& ms = net::get_local_messaging_service();
+        return ms.send_counter_mutation(replica_shard(leader, fm_token), fm, int32_t(cl));
+    }).then_wrapped([partitions = std::move(partitions)] (future<> f) mutable {
+        return invalidate_cached_results(std::move(f), std::move(partitions));
+    });
+}
+
+// Shards belong to nodes rather than to their CPUs, as a partition is only
+// ever written by the one CPU owning it, which serializes its updates.
+future<>
+storage_proxy::apply_counter_update_on_leader(frozen_mutation fm, db::consistency_level cl) {
+    auto shard = _db.local().shard_of(fm);
+    return get_counter_id().then([this, shard, fm = std::move(fm)] (utils::UUID counter_id) mutable {
+        return do_with(std::move(fm), [this, shard, counter_id] (const frozen_mutation& fm) {
+            return _db.invoke_on(shard, [&fm, counter_id] (database& db) {
+                return db.apply_counter_update(fm, counter_id).then([] (mutation m) {
+                    return make_foreign(std::make_unique<const frozen_mutation>(freeze(m)));
+                });
+            });
+        });
+    }).then([this, cl] (foreign_ptr<std::unique_ptr<const frozen_mutation>> fm) {
+        // The leader applies the shards again, which changes nothing.
+        std::vector<mutation> mutations;
+        mutations.emplace_back(fm->unfreeze(_db.local().find_schema(fm->column_family_id())));
+        return do_mutate(std::move(mutations), cl, nullptr);
+    });
+}
+
+future<utils::UUID>
+storage_proxy::get_counter_id() {
+    if (_counter_id) {
+        return make_ready_future<utils::UUID>(*_counter_id);
+    }
+    return db::system_keyspace::get_local_host_id().then([this] (utils::UUID id) {
+        _counter_id = id;
+        return id;
+    });
+}
+
+namespace {
+
+// Collects the answers of the participants to a round of Paxos, until
+// there are enough of them for the round to go on, all of them are in, or
+// the round timed out.
+template <typename Response>
+class paxos_round {
+public:
+    using responses_type = std::vector<std::pair<gms::inet_address, Response>>;
+    using enough_type = std::function<bool (const responses_type&)>;
+private:
+    responses_type _responses;
+    size_t _pending;
+    enough_type _enough;
+    promise<responses_type> _done;
+    timer<> _expire;
+    bool _completed = false;
+public:
+    paxos_round(size_t participants, enough_type enough, std::chrono::milliseconds timeout)
+        : _pending(participants)
+        , _enough(std::move(enough)) {
+        _expire.set_callback([this] { complete(); });
+        _expire.arm(timeout);
+        if (!_pending) {
+            complete();
+        }
+    }
+    future<responses_type> get_future() {
+        return _done.get_future();
+    }
+    void add(gms::inet_address from, Response r) {
+        _pending--;
+        if (!_completed) {
+            _responses.emplace_back(from, std::move(r));
+        }
+        check();
+    }
+    void failed() {
+        _pending--;
+        check();
+    }
+private:
+    void check() {
+        if (!_pending || _enough(_responses)) {
+            complete();
+        }
+    }
+    void complete() {
+        if (!_completed) {
+            _completed = true;
+            _expire.cancel();
+            _done.set_value(std::move(_responses));
+        }
+    }
+};
+
+template <typename Response, typename Send>
+static future<typename paxos_round<Response>::responses_type>
+run_paxos_round(const std::vector<gms::inet_address>& endpoints, typename paxos_round<Response>::enough_type enough, Send&& send) {
+    auto timeout = std::chrono::milliseconds(get_local_storage_proxy().get_db().local().get_config().write_request_timeout_in_ms());
+    auto round = make_lw_shared<paxos_round<Response>>(endpoints.size(), std::move(enough), timeout);
+    for (auto&& ep : endpoints) {
+        send(ep).then_wrapped([round, ep] (future<Response> f) {
+            try {
+                round->add(ep, std::get<0>(f.get()));
+            } catch (...) {
+                logger.debug("Paxos round with {} failed: {}", ep, std::current_exception());
+                round->failed();
+            }
+        });
+    }
+    return round->get_future().finally([round] {});
+}
+
+// A round with no answer but an acknowledgment.
+struct paxos_ack {};
+
+}
+
+storage_proxy::paxos_participants
+storage_proxy::get_paxos_participants(const schema& s, const dht::token& token, db::consistency_level cl_for_paxos) {
+    keyspace& ks = _db.local().find_keyspace(s.ks_name());
+    std::vector<gms::inet_address> natural = ks.get_replication_strategy().get_natural_endpoints(token);
+    std::vector<gms::inet_address> pending = get_local_storage_service().get_token_metadata().pending_endpoints_for(token, ks);
+    if (cl_for_paxos == db::consistency_level::LOCAL_SERIAL) {
+        auto not_local = [] (gms::inet_address ep) { return !db::is_local(ep); };
+        natural.erase(boost::range::remove_if(natural, not_local), natural.end());
+        pending.erase(boost::range::remove_if(pending, not_local), pending.end());
+    }
+    // Pending endpoints count towards the quorum, so that the replica
+    // taking over the range has seen the quorum's state.
+    size_t participants = natural.size() + pending.size();
+    size_t required = participants / 2 + 1;
+    paxos_participants p;
+    auto is_alive = std::bind1st(std::mem_fn(&gms::failure_detector::is_alive), &gms::get_local_failure_detector());
+    boost::push_back(p.endpoints, boost::range::join(natural, pending) | boost::adaptors::filtered(is_alive));
+    p.required = required;
+    if (p.endpoints.size() < required) {
+        throw exceptions::unavailable_exception(cl_for_paxos, required, p.endpoints.size());
+    }
+    // Two pending endpoints could each miss what the other saw.
+    if (pending.size() > 1) {
+        throw exceptions::unavailable_exception(cl_for_paxos, participants + 1, p.endpoints.size());
+    }
+    return p;
+}
+
+future<paxos::prepare_response>
+storage_proxy::prepare_paxos_locally(lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr, utils::UUID ballot) {
+    unsigned shard = _db.local().shard_of(pr.start()->value().token());
+    return _db.invoke_on(shard, [cmd, &pr, ballot] (database& db) {
+        return paxos::paxos_state::prepare(db, *cmd, pr, ballot).then([] (paxos::prepare_response r) {
+            return make_foreign(std::make_unique<paxos::prepare_response>(std::move(r)));
+        });
+    }).then([] (foreign_ptr<std::unique_ptr<paxos::prepare_response>> r) {
+        return paxos::prepare_response(*r);
+    });
+}
+
+future<bool>
+storage_proxy::accept_paxos_locally(const paxos::proposal& p) {
+    return _db.invoke_on(_db.local().shard_of(p.update), [&p] (database& db) {
+        return paxos::paxos_state::accept(db, p);
+    });
+}
+
+future<>
+storage_proxy::learn_paxos_locally(const paxos::proposal& p) {
+    return _db.invoke_on(_db.local().shard_of(p.update), [&p] (database& db) {
+        return paxos::paxos_state::learn(db, p);
+    });
+}
+
+future<std::vector<std::pair<gms::inet_address, paxos::prepare_response>>>
+storage_proxy::prepare_paxos(const paxos_participants& participants, lw_shared_ptr<query::read_command> cmd,
+        const query::partition_range& pr, utils::UUID ballot) {
+    // A single refusal is enough for us to start over with a later ballot.
+    auto enough = [required = participants.required] (const paxos_round<paxos::prepare_response>::responses_type& responses) {
+        return responses.size() >= required || boost::algorithm::any_of(responses, [] (auto&& r) { return !r.second.promised; });
+    };
+    // The sends may outlive the round, so they own what they send.
+    auto range = make_lw_shared<query::partition_range>(pr);
+    return run_paxos_round<paxos::prepare_response>(participants.endpoints, enough, [this, cmd, range, ballot] (gms::inet_address ep) {
+        if (is_me(ep)) {
+            return prepare_paxos_locally(cmd, *range, ballot).finally([cmd, range] {});
+        }
+        auto& ms = net::get_local_messaging_service();
+        return ms.send_paxos_prepare(net::messaging_service::shard_id{ep, 0}, *cmd, *range, ballot).finally([cmd, range] {});
+    });
+}
+
+// Whether a quorum of the participants accepted the proposal. Fails with a
+// timeout when too few of them answered to tell.
+future<bool>
+storage_proxy::propose_paxos(const paxos_participants& participants, const paxos::proposal& p, db::consistency_level cl_for_paxos) {
+    auto required = participants.required;
+    auto refusals_enough = participants.endpoints.size() - required + 1;
+    auto count = [] (const paxos_round<bool>::responses_type& responses, bool accepted) {
+        return size_t(boost::range::count_if(responses, [accepted] (auto&& r) { return r.second == accepted; }));
+    };
+    auto enough = [required, refusals_enough, count] (const paxos_round<bool>::responses_type& responses) {
+        return count(responses, true) >= required || count(responses, false) >= refusals_enough;
+    };
+    auto pp = make_lw_shared<paxos::proposal>(p);
+    return run_paxos_round<bool>(participants.endpoints, enough, [this, pp] (gms::inet_address ep) {
+        if (is_me(ep)) {
+            return accept_paxos_locally(*pp).finally([pp] {});
+        }
+        auto& ms = net::get_local_messaging_service();
+        return ms.send_paxos_propose(net::messaging_service::shard_id{ep, 0}, *pp).finally([pp] {});
+    }).then([required, cl_for_paxos, count] (paxos_round<bool>::responses_type responses) {
+        auto accepted = count(responses, true);
+        if (accepted >= required) {
+            return true;
+        }
+        if (!count(responses, false)) {
+            throw exceptions::mutation_write_timeout_exception(cl_for_paxos, accepted, required, db::write_type::CAS);
+        }
+        return false;
+    });
+}
+
+future<>
+storage_proxy::send_paxos_commit(const std::vector<gms::inet_address>& endpoints, const paxos::proposal& p, size_t block_for, db::consistency_level cl) {
+    auto local_only = cl == db::consistency_level::LOCAL_ONE || cl == db::consistency_level::LOCAL_QUORUM;
+    auto acks = [local_only] (const paxos_round<paxos_ack>::responses_type& responses) {
+        return size_t(boost::range::count_if(responses, [local_only] (auto&& r) { return !local_only || db::is_local(r.first); }));
+    };
+    auto pp = make_lw_shared<paxos::proposal>(p);
+    auto f = run_paxos_round<paxos_ack>(endpoints, [block_for, acks] (auto&& responses) { return acks(responses) >= block_for; },
+            [this, pp] (gms::inet_address ep) {
+        auto f = is_me(ep) ? learn_paxos_locally(*pp)
+                : net::get_local_messaging_service().send_paxos_commit(net::messaging_service::shard_id{ep, 0}, *pp);
+        return f.then([] { return paxos_ack(); }).finally([pp] {});
+    });
+    if (!block_for) {
+        // The commits go on in the background.
+        return make_ready_future<>();
+    }
+    return f.then([block_for, cl, acks] (paxos_round<paxos_ack>::responses_type responses) {
+        auto acked = acks(responses);
+        if (acked < block_for) {
+            throw exceptions::mutation_write_timeout_exception(cl, acked, block_for, db::write_type::SIMPLE);
+        }
+    });
+}
+
+// Commits to all live replicas, waiting for as many of them as the
+// consistency level needs, which is none for ANY.
+future<>
+storage_proxy::commit_paxos(const schema& s, const dht::token& token, const paxos::proposal& p, db::consistency_level cl_for_commit) {
+    keyspace& ks = _db.local().find_keyspace(s.ks_name());
+    std::vector<gms::inet_address> natural = ks.get_replication_strategy().get_natural_endpoints(token);
+    std::vector<gms::inet_address> pending = get_local_storage_service().get_token_metadata().pending_endpoints_for(token, ks);
+    std::vector<gms::inet_address> live;
+    auto is_alive = std::bind1st(std::mem_fn(&gms::failure_detector::is_alive), &gms::get_local_failure_detector());
+    boost::push_back(live, boost::range::join(natural, pending) | boost::adaptors::filtered(is_alive));
+    size_t block_for = 0;
+    if (cl_for_commit != db::consistency_level::ANY) {
+        block_for = db::block_for(ks, cl_for_commit) + pending.size();
+        db::assure_sufficient_live_nodes(cl_for_commit, ks, live);
+    }
+    std::vector<uint64_t> partitions;
+    add_cached_partition(partitions, s, token);
+    return send_paxos_commit(live, p, block_for, cl_for_commit).then_wrapped([partitions = std::move(partitions)] (future<> f) mutable {
+        return invalidate_cached_results(std::move(f), std::move(partitions));
+    });
+}
+
+// One attempt at a conditional update, which resolves to nothing when it
+// has to be retried with a later ballot.
+future<std::experimental::optional<bool>>
+storage_proxy::cas_attempt(schema_ptr s, shared_ptr<cas_request> request, lw_shared_ptr<query::read_command> cmd,
+        const query::partition_range& pr, db::consistency_level cl_for_paxos, db::consistency_level cl_for_commit, api::timestamp_type& last_ballot) {
+    using result_type = std::experimental::optional<bool>;
+    auto& token = pr.start()->value().token();
+    auto participants = make_lw_shared<paxos_participants>(get_paxos_participants(*s, token, cl_for_paxos));
+    api::timestamp_type now = db_clock::now().time_since_epoch().count() * 1000;
+    last_ballot = std::max(now, last_ballot + 1);
+    auto ballot = utils::UUID_gen::get_time_UUID_from_micros(last_ballot);
+    auto retry = [this] {
+        // Gives the coordinator which got in our way a chance to finish.
+        auto delay = std::uniform_int_distribution<>(0, 100)(_urandom);
+        return sleep(std::chrono::milliseconds(delay)).then([] {
+            return result_type();
+        });
+    };
+
+    return prepare_paxos(*participants, cmd, pr, ballot).then([this, s, request, cmd, &pr, &token, cl_for_paxos, cl_for_commit, &last_ballot, participants, ballot, retry]
+            (std::vector<std::pair<gms::inet_address, paxos::prepare_response>> responses) {
+        auto required = participants->required;
+        paxos::prepare_summary summary(responses);
+        if (summary.refused_for) {
+            logger.debug("CAS: a replica promised a ballot later than ours");
+            last_ballot = std::max(last_ballot, utils::UUID_gen::micros_timestamp(*summary.refused_for));
+            return retry();
+        }
+        if (responses.size() < required) {
+            throw exceptions::mutation_write_timeout_exception(cl_for_paxos, responses.size(), required, db::write_type::CAS);
+        }
+
+        // A proposal accepted after the most recent commit may have been
+        // chosen, so we finish its round with our ballot before ours.
+        if (summary.in_progress) {
+            logger.debug("CAS: finishing incomplete paxos round {}", *summary.in_progress);
+            auto refreshed = make_lw_shared<paxos::proposal>(ballot, std::move(summary.in_progress->update));
+            return propose_paxos(*participants, *refreshed, cl_for_paxos).then([this, s, &token, refreshed, cl_for_commit, retry] (bool accepted) {
+                if (!accepted) {
+                    return retry();
+                }
+                return commit_paxos(*s, token, *refreshed, cl_for_commit).then([] {
+                    return result_type();
+                });
+            }).finally([participants] {});
+        }
+
+        // A quorum of replicas must have learned the most recent commit
+        // before we propose. We commit it to those which missed it, and wait
+        // for them rather than prepare again.
+        auto repaired = make_ready_future<>();
+        if (!summary.missing_commit.empty()) {
+            logger.debug("CAS: repairing replicas that missed the most recent commit");
+            auto mrc = make_lw_shared<paxos::proposal>(std::move(*summary.most_recent_commit));
+            repaired = do_with(std::move(summary.missing_commit), [this, mrc, cl_for_paxos] (const std::vector<gms::inet_address>& missing) {
+                return send_paxos_commit(missing, *mrc, missing.size(), cl_for_paxos);
+            }).finally([mrc] {});
+        }
+
+        // The replicas read the partition as they promised our ballot. Unless
+        // they disagree, or some of them were behind, that is the current
+        // contents, and we need no read round.
+        auto current = [&] () -> future<foreign_ptr<lw_shared_ptr<query::result>>> {
+            if (summary.data) {
+                bytes_ostream buf;
+                buf.write(*summary.data);
+                return make_ready_future<foreign_ptr<lw_shared_ptr<query::result>>>(make_foreign(make_lw_shared<query::result>(std::move(buf))));
+            }
+            auto cl = cl_for_paxos == db::consistency_level::LOCAL_SERIAL ? db::consistency_level::LOCAL_QUORUM : db::consistency_level::QUORUM;
+            return repaired.then([this, s, cmd, &pr, cl] {
+                return query(s, cmd, {pr}, cl);
+            });
+        }();
+
+        return current.then([this, s, request, cmd, &token, cl_for_paxos, cl_for_commit, participants, ballot, retry]
+                (foreign_ptr<lw_shared_ptr<query::result>> current) {
+            auto update = request->apply(*current, cmd->slice, utils::UUID_gen::micros_timestamp(ballot));
+            if (!update) {
+                return make_ready_future<result_type>(false);
+            }
+            auto p = make_lw_shared<paxos::proposal>(ballot, freeze(*update));
+            return propose_paxos(*participants, *p, cl_for_paxos).then([this, s, &token, p, cl_for_commit, retry] (bool accepted) {
+                if (!accepted) {
+                    return retry();
+                }
+                return commit_paxos(*s, token, *p, cl_for_commit).then([] {
+                    return result_type(true);
+                });
+            }).finally([participants] {});
+        });
+    });
+}
+
+future<bool>
+storage_proxy::cas(schema_ptr s, shared_ptr<cas_request> request, lw_shared_ptr<query::read_command> cmd,
+        query::partition_range pr, db::consistency_level cl_for_paxos, db::consistency_level cl_for_commit) {
+    try {
+        db::validate_for_cas(cl_for_paxos);
+        db::validate_for_cas_commit(s->ks_name(), cl_for_commit);
+    } catch (...) {
+        return make_exception_future<bool>(std::current_exception());
+    }
+    auto timeout = std::chrono::milliseconds(_db.local().get_config().cas_contention_timeout_in_ms());
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    return do_with(std::move(pr), api::timestamp_type(api::min_timestamp), std::experimental::optional<bool>(),
+            [this, s, request, cmd, cl_for_paxos, cl_for_commit, deadline]
+            (const query::partition_range& pr, api::timestamp_type& last_ballot, std::experimental::optional<bool>& applied) {
+        return repeat([this, s, request, cmd, &pr, cl_for_paxos, cl_for_commit, deadline, &last_ballot, &applied] {
+            if (std::chrono::steady_clock::now() > deadline) {
+                auto& ks = _db.local().find_keyspace(s->ks_name());
+                throw exceptions::mutation_write_timeout_exception(cl_for_paxos, 0, db::block_for(ks, cl_for_paxos), db::write_type::CAS);
+            }
+            return cas_attempt(s, request, cmd, pr, cl_for_paxos, cl_for_commit, last_ballot).then([&applied] (std::experimental::optional<bool> result) {
+                applied = result;
+                return applied ? stop_iteration::yes : stop_iteration::no;
+            });
+        }).then([&applied] {
+            return *applied;
+        });
+    });
+}
+
+future<>
+storage_proxy::do_mutate(std::vector<mutation> mutations, db::consistency_level cl, tracing::trace_state_ptr trace_state) {
     auto type = mutations.size() == 1 ? db::write_type::SIMPLE : db::write_type::UNLOGGED_BATCH;
     utils::latency_counter lc;
     lc.start();
-
-    return mutate_prepare(mutations, cl, type).then([this, cl] (std::vector<storage_proxy::response_id_type> ids) {
+    auto start = std::chrono::steady_clock::now();
+    auto partitions = cached_partitions(mutations);
+
+    return _write_admission.admit().then([this, mutations = std::move(mutations), cl, type, trace_state] () mutable {
+        tracing::trace(trace_state, "Admitted %d mutations", mutations.size());
+        return mutate_prepare(mutations, cl, type);
+    }).then([this, cl, trace_state] (std::vector<storage_proxy::response_id_type> ids) {
+        if (trace_state) {
+            for (auto id : ids) {
+                auto& h = get_write_response_handler(id);
+                h._trace_state = trace_state;
+                tracing::trace(trace_state, "Sending mutation to %s, hinting %d dead replicas", ::join(", ", h.get_targets()),
+                        h.get_dead_endpoints().size());
+            }
+        }
         auto local_addr = utils::fb_utilities::get_broadcast_address();
         auto& snitch_ptr = locator::i_endpoint_snitch::get_local_snitch_ptr();
         sstring local_dc = snitch_ptr->get_datacenter(local_addr);
         return mutate_begin(std::move(ids), cl, local_dc);
-    }).then_wrapped([p = shared_from_this(), lc] (future<> f) {
+    }).then_wrapped([p = shared_from_this(), lc, start, trace_state] (future<> f) {
+        tracing::trace(trace_state, f.failed() ? "Write failed" : "Write acknowledged by enough replicas");
+        if (trace_state) {
+            trace_state->add_stage_time(tracing::stage::coordinator, std::chrono::steady_clock::now() - start);
+        }
         return p->mutate_end(std::move(f), lc);
+    }).then_wrapped([partitions = std::move(partitions)] (future<> f) mutable {
+        return invalidate_cached_results(std::move(f), std::move(partitions));
     });
 }
 
+tracing::trace_state_ptr storage_proxy::maybe_begin_trace(const schema& s, const char* request, db::consistency_level cl,
+        tracing::trace_state_ptr trace_state) {
+    if (!trace_state) {
+        if (s.ks_name() == tracing::trace_keyspace_name) {
+            return nullptr;
+        }
+        trace_state = tracing::maybe_begin_session(request);
+    }
+    if (trace_state) {
+        trace_state->add_param("consistency_level", sprint("%s", cl));
+        trace_state->add_param("table", s.ks_name() + "." + s.cf_name());
+    }
+    return trace_state;
+}
+
 future<>
 storage_proxy::mutate_with_triggers(std::vector<mutation> mutations, db::consistency_level cl,
-        bool should_mutate_atomically) {
+        bool should_mutate_atomically, tracing::trace_state_ptr trace_state) {
     warn(unimplemented::cause::TRIGGERS);
+    auto log_mutations = db::cdc::make_log_mutations(_db.local(), mutations);
+    std::move(log_mutations.begin(), log_mutations.end(), std::back_inserter(mutations));
 #if 0
         Collection<Mutation> augmented = TriggerExecutor.instance.execute(mutations);
         if (augmented != null) {
@@ -840,7 +1070,7 @@ storage_proxy::mutate_with_triggers(std::vector<mutation> mutations, db::consist
     if (should_mutate_atomically) {
         return mutate_atomically(std::move(mutations), cl);
     }
-    return mutate(std::move(mutations), cl);
+    return mutate(std::move(mutations), cl, std::move(trace_state));
 #if 0
     }
 #endif
@@ -904,8 +1134,15 @@ storage_proxy::mutate_atomically(std::vector<mutation> mutations, db::consistenc
                 return _p.mutate_begin(std::move(ids), _cl, _local_dc);
             });
         }
-        future<> sync_write_to_batchlog() {
-            auto m = db::get_batchlog_manager().local().get_batch_log_mutation_for(_mutations, _batch_uuid, net::messaging_service::current_version);
+        // The mutations were frozen for their replicas already, the batchlog
+        // entry is made of the same frozen mutations.
+        future<> sync_write_to_batchlog(const std::vector<response_id_type>& ids) {
+            std::vector<lw_shared_ptr<const frozen_mutation>> mutations;
+            mutations.reserve(ids.size());
+            for (auto id : ids) {
+                mutations.emplace_back(_p.get_write_response_handler(id).get_mutation());
+            }
+            auto m = db::get_batchlog_manager().local().get_batch_log_mutation_for(mutations, _batch_uuid, net::messaging_service::current_version);
             return send_batchlog_mutation(std::move(m));
         };
         void async_remove_from_batchlog() {
@@ -921,7 +1158,8 @@ storage_proxy::mutate_atomically(std::vector<mutation> mutations, db::consistenc
 
         future<> run() {
             return _p.mutate_prepare(_mutations, _cl, db::write_type::BATCH).then([this] (std::vector<response_id_type> ids) {
-                return sync_write_to_batchlog().then_wrapped([this, ids = std::move(ids)] (future<> f) {
+                auto batchlog_written = sync_write_to_batchlog(ids);
+                return batchlog_written.then_wrapped([this, ids = std::move(ids)] (future<> f) {
                     try {
                         f.get();
                         return _p.mutate_begin(std::move(ids), _cl, _local_dc);
@@ -943,10 +1181,15 @@ storage_proxy::mutate_atomically(std::vector<mutation> mutations, db::consistenc
       }
     };
 
-    return mk_ctxt(std::move(mutations), cl).then([this] (lw_shared_ptr<context> ctxt) {
+    auto partitions = cached_partitions(mutations);
+    return _write_admission.admit().then([mk_ctxt, mutations = std::move(mutations), cl] () mutable {
+        return mk_ctxt(std::move(mutations), cl);
+    }).then([this] (lw_shared_ptr<context> ctxt) {
         return ctxt->run().finally([ctxt]{});
     }).then_wrapped([p = shared_from_this(), lc] (future<> f) mutable {
         return p->mutate_end(std::move(f), lc);
+    }).then_wrapped([partitions = std::move(partitions)] (future<> f) mutable {
+        return invalidate_cached_results(std::move(f), std::move(partitions));
     });
 }
 
@@ -970,48 +1213,88 @@ bool storage_proxy::cannot_hint(gms::inet_address target) {
  * @throws OverloadedException if the hints cannot be written/enqueued
  */
  // returned future is ready when sent is complete, not when mutation is executed on all (or any) targets!
-future<> storage_proxy::send_to_live_endpoints(storage_proxy::response_id_type response_id, sstring local_dc)
+future<> storage_proxy::send_to_live_endpoints(std::vector<storage_proxy::response_id_type> ids, sstring local_dc)
 {
-    // extra-datacenter replicas, grouped by dc
-    std::unordered_map<sstring, std::vector<gms::inet_address>> dc_groups;
-    std::vector<std::pair<const sstring, std::vector<gms::inet_address>>> local;
-    local.reserve(3);
+    // Mutations bound for the same shard of a coordinator replica are coalesced
+    // into a single MUTATIONS message, once every node knows that verb. The
+    // replica still answers each of them with its own MUTATION_DONE, so
+    // consistency is accounted for per mutation.
+    struct endpoint_mutations {
+        std::vector<lw_shared_ptr<const frozen_mutation>> mutations;
+        std::vector<std::vector<gms::inet_address>> forward;
+        std::vector<response_id_type> response_ids;
+    };
+    std::unordered_map<net::messaging_service::shard_id, endpoint_mutations, net::messaging_service::shard_id::hash> by_coordinator;
     auto& snitch_ptr = locator::i_endpoint_snitch::get_local_snitch_ptr();
 
-    for(auto dest: get_write_response_handler(response_id).get_targets()) {
-        sstring dc = snitch_ptr->get_datacenter(dest);
-        if (dc == local_dc) {
-            local.emplace_back("", std::vector<gms::inet_address>({dest}));
-        } else {
-            dc_groups[dc].push_back(dest);
+    for (auto response_id : ids) {
+        auto& h = get_write_response_handler(response_id);
+        // extra-datacenter replicas, grouped by dc
+        std::unordered_map<sstring, std::vector<gms::inet_address>> dc_groups;
+        std::vector<std::vector<gms::inet_address>> local;
+
+        for (auto dest : h.get_targets()) {
+            sstring dc = snitch_ptr->get_datacenter(dest);
+            if (dc == local_dc) {
+                local.emplace_back(std::vector<gms::inet_address>({dest}));
+            } else {
+                dc_groups[dc].push_back(dest);
+            }
         }
-    }
 
-    auto mptr = get_write_response_handler(response_id).get_mutation();
-    auto& m = *mptr;
-    auto all = boost::range::join(local, dc_groups);
+        auto add = [&] (std::vector<gms::inet_address>& forward) {
+            // last one in forward list is a coordinator
+            auto coordinator = forward.back();
+            forward.pop_back();
+            auto& em = by_coordinator[replica_shard(coordinator, token_of(_db.local(), *h.get_mutation()))];
+            em.mutations.push_back(h.get_mutation());
+            em.forward.push_back(std::move(forward));
+            em.response_ids.push_back(response_id);
+        };
+        for (auto& forward : local) {
+            add(forward);
+        }
+        for (auto& dc_targets : dc_groups) {
+            // A remote datacenter gets the mutation once over the WAN, through
+            // one of its replicas which forwards it to the others there. Pick
+            // it at random, so that the forwarding load spreads over them.
+            auto& targets = dc_targets.second;
+            auto i = std::uniform_int_distribution<size_t>(0, targets.size() - 1)(_urandom);
+            std::swap(targets[i], targets.back());
+            add(targets);
+        }
+    }
 
     // OK, now send and/or apply locally
-    return parallel_for_each(all.begin(), all.end(), [response_id, &m, this] (typename decltype(dc_groups)::value_type& dc_targets) {
-        auto my_address = utils::fb_utilities::get_broadcast_address();
-        auto& forward = dc_targets.second;
-
-        // last one in forward list is a coordinator
-        auto coordinator = forward.back();
-        forward.pop_back();
+    return do_with(std::move(by_coordinator), [this] (auto& by_coordinator) {
+        return parallel_for_each(by_coordinator.begin(), by_coordinator.end(), [this] (auto& dest) {
+            auto my_address = utils::fb_utilities::get_broadcast_address();
+            auto coordinator = dest.first;
+            auto& em = dest.second;
+
+            if (coordinator.addr == my_address) {
+                return parallel_for_each(boost::irange<size_t>(0, em.mutations.size()), [this, &em, my_address] (size_t i) {
+                    auto response_id = em.response_ids[i];
+                    return mutate_locally(*em.mutations[i]).then([response_id, this, my_address] {
+                        got_response(response_id, my_address);
+                    });
+                });
+            }
 
-        if (coordinator == my_address) {
-            return mutate_locally(m).then([response_id, this, my_address] {
-                got_response(response_id, my_address);
-            });
-        } else {
             auto& ms = net::get_local_messaging_service();
-            return ms.send_mutation(net::messaging_service::shard_id{coordinator, 0}, m,
-                std::move(forward), my_address, engine().cpu_id(), response_id);
-        }
-    }).handle_exception([mptr] (std::exception_ptr eptr) {
-        // make mutation alive until it is sent or processed locally, otherwise it
-        // may disappear if write timeouts before this future is ready
+            if (em.mutations.size() == 1 || !cluster_supports(_batched_mutations)) {
+                return parallel_for_each(boost::irange<size_t>(0, em.mutations.size()), [&ms, &em, coordinator, my_address] (size_t i) {
+                    return ms.send_mutation(coordinator, *em.mutations[i],
+                        std::move(em.forward[i]), my_address, engine().cpu_id(), em.response_ids[i]);
+                });
+            }
+            return ms.send_mutations(coordinator, em.mutations,
+                std::move(em.forward), my_address, engine().cpu_id(), std::move(em.response_ids));
+        });
+    }).handle_exception([] (std::exception_ptr eptr) {
+        // the mutations are kept alive by by_coordinator until they are sent or
+        // processed locally, otherwise they may disappear if write timeouts before
+        // this future is ready
         try {
             std::rethrow_exception(eptr);
         } catch(rpc::closed_error&) {
@@ -1047,32 +1330,109 @@ size_t storage_proxy::get_hints_in_progress_for(gms::inet_address target) {
 
 bool storage_proxy::submit_hint(lw_shared_ptr<const frozen_mutation> m, gms::inet_address target)
 {
-    warn(unimplemented::cause::HINT);
     // local write that time out should be handled by LocalMutationRunnable
-    assert(is_me(target));
-    return false;
-#if 0
-    HintRunnable runnable = new HintRunnable(target)
-    {
-        public void runMayThrow()
-        {
-            int ttl = HintedHandOffManager.calculateHintTTL(mutation);
-            if (ttl > 0)
-            {
-                logger.debug("Adding hint for {}", target);
-                writeHintForMutation(mutation, System.currentTimeMillis(), ttl, target);
-                // Notify the handler only for CL == ANY
-                if (responseHandler != null && responseHandler.consistencyLevel == ConsistencyLevel.ANY)
-                    responseHandler.response(null);
-            } else
-            {
-                logger.debug("Skipped writing hint for {} (ttl {})", target, ttl);
-            }
+    assert(!is_me(target));
+    logger.debug("Adding hint for {}", target);
+    ++_total_hints_in_progress;
+    ++_hints_in_progress[target];
+    _hints_manager->store_hint(target, std::move(m)).finally([p = shared_from_this(), target] {
+        --p->_total_hints_in_progress;
+        auto i = p->_hints_in_progress.find(target);
+        if (--i->second == 0) {
+            p->_hints_in_progress.erase(i);
         }
+    });
+    return true;
+}
+
+future<> storage_proxy::send_hint(frozen_mutation fm, gms::inet_address target) {
+    return send_to_endpoint(std::move(fm), target, db::write_type::SIMPLE);
+}
+
+future<> storage_proxy::send_to_endpoint(frozen_mutation fm, gms::inet_address target, db::write_type type) {
+    auto& ks = _db.local().find_keyspace(_db.local().find_schema(fm.column_family_id())->ks_name());
+    auto local_dc = locator::i_endpoint_snitch::get_local_snitch_ptr()->get_datacenter(utils::fb_utilities::get_broadcast_address());
+    auto id = create_write_response_handler(ks, db::consistency_level::ONE, type, std::move(fm), {target}, {}, {});
+    auto f = response_wait(id).handle_exception([this, id] (std::exception_ptr exp) {
+        remove_response_handler(id);
+        return make_exception_future<>(exp);
+    });
+    send_to_live_endpoints({id}, std::move(local_dc));
+    return f;
+}
+
+std::experimental::optional<gms::inet_address>
+storage_proxy::get_view_natural_endpoint(keyspace& ks, const dht::token& base_token, const dht::token& view_token) {
+    auto& snitch_ptr = locator::i_endpoint_snitch::get_local_snitch_ptr();
+    auto my_address = utils::fb_utilities::get_broadcast_address();
+    auto local_dc = snitch_ptr->get_datacenter(my_address);
+    auto local_endpoints = [&] (std::vector<gms::inet_address> endpoints) {
+        endpoints.erase(std::remove_if(endpoints.begin(), endpoints.end(), [&] (gms::inet_address ep) {
+            return snitch_ptr->get_datacenter(ep) != local_dc;
+        }), endpoints.end());
+        return endpoints;
     };
+    auto& rs = ks.get_replication_strategy();
+    auto base_endpoints = local_endpoints(rs.get_natural_endpoints(base_token));
+    auto view_endpoints = local_endpoints(rs.get_natural_endpoints(view_token));
+    auto i = boost::range::find(base_endpoints, my_address);
+    if (i == base_endpoints.end()) {
+        return {};
+    }
+    size_t pos = std::distance(base_endpoints.begin(), i);
+    if (pos >= view_endpoints.size()) {
+        return {};
+    }
+    return view_endpoints[pos];
+}
 
-    return submitHint(runnable);
-#endif
+future<> storage_proxy::send_view_updates(schema_ptr base, dht::token base_token, std::vector<mutation> updates) {
+    return do_with(std::move(updates), [this, base = std::move(base), base_token = std::move(base_token)] (std::vector<mutation>& updates) {
+        return parallel_for_each(updates, [this, &base, &base_token] (const mutation& update) {
+            auto& ks = _db.local().find_keyspace(base->ks_name());
+            auto target = get_view_natural_endpoint(ks, base_token, update.token());
+            if (!target) {
+                // Pending replicas of the base table leave the view to the
+                // natural ones, which get the same writes.
+                return make_ready_future<>();
+            }
+            auto fm = make_lw_shared<const frozen_mutation>(freeze(update));
+            auto size = std::min(fm->representation().size(), _max_view_update_backlog);
+            // The write waits only for room in the backlog, the update being
+            // sent in the background.
+            return _view_update_backlog.wait(size).then([this, fm, target = *target, size] {
+                ++_stats.view_updates;
+                _stats.view_update_backlog_bytes += size;
+                send_view_update(fm, target).finally([p = shared_from_this(), size] {
+                    p->_stats.view_update_backlog_bytes -= size;
+                    p->_view_update_backlog.signal(size);
+                });
+            });
+        });
+    });
+}
+
+future<> storage_proxy::send_view_update(lw_shared_ptr<const frozen_mutation> fm, gms::inet_address target) {
+    if (is_me(target)) {
+        return mutate_locally(*fm).finally([fm] {}).handle_exception([this] (std::exception_ptr ep) {
+            ++_stats.view_update_failures;
+            logger.warn("Failed to apply view update locally: {}", ep);
+        });
+    }
+    return send_to_endpoint(*fm, target, db::write_type::SIMPLE).handle_exception([this, fm, target] (std::exception_ptr ep) {
+        ++_stats.view_update_failures;
+        logger.debug("Failed to send view update to {}: {}", target, ep);
+        if (should_hint(target)) {
+            submit_hint(fm, target);
+        }
+    });
+}
+
+future<> storage_proxy::start_hints_manager() {
+    if (!_db.local().get_config().hinted_handoff_enabled()) {
+        return make_ready_future<>();
+    }
+    return _hints_manager->start();
 }
 
 #if 0
@@ -1232,51 +1592,24 @@ class digest_mismatch_exception : public std::runtime_error {
     digest_mismatch_exception() : std::runtime_error("Digest mismatch") {}
 };
 
-class abstract_read_resolver {
-protected:
-    db::consistency_level _cl;
-    size_t _targets_count;
-    promise<> _done_promise; // all target responded
-    bool _timedout = false; // will be true if request timeouts
-    timer<> _timeout;
-    size_t _responses = 0;
-
-    virtual void on_timeout() {}
-    virtual size_t response_count() const = 0;
-public:
-    abstract_read_resolver(db::consistency_level cl, size_t target_count, std::chrono::high_resolution_clock::time_point timeout)
-        : _cl(cl)
-        , _targets_count(target_count)
-    {
-        _timeout.set_callback([this] {
-            _timedout = true;
-            _done_promise.set_exception(read_timeout_exception(_cl, response_count(), _targets_count, _responses != 0));
-            on_timeout();
-        });
-        _timeout.arm(timeout);
-    }
-    virtual ~abstract_read_resolver() {};
-    future<> done() {
-        return _done_promise.get_future();
+void abstract_read_resolver::error(gms::inet_address ep, std::exception_ptr eptr) {
+    sstring why;
+    try {
+        std::rethrow_exception(eptr);
+    } catch (rpc::closed_error&) {
+        return; // do not report connection closed exception, gossiper does that
+    } catch(std::exception& e) {
+        why = e.what();
+    } catch(...) {
+        why = "Unknown exception";
     }
-    virtual void error(gms::inet_address ep, std::exception_ptr eptr) {
-        sstring why;
-        try {
-            std::rethrow_exception(eptr);
-        } catch (rpc::closed_error&) {
-            return; // do not report connection closed exception, gossiper does that
-        } catch(std::exception& e) {
-            why = e.what();
-        } catch(...) {
-            why = "Unknown exception";
-        }
 
-        // do nothing other than log for now, request will timeout eventually
-        logger.error("Exception when communicating with {}: {}", ep, why);
-    }
-};
+    // do nothing other than log for now, request will timeout eventually
+    logger.error("Exception when communicating with {}: {}", ep, why);
+}
 
 class digest_read_resolver : public abstract_read_resolver {
+    lw_shared_ptr<query::read_command> _cmd;
     size_t _block_for;
     size_t _cl_responses = 0;
     promise<> _cl_promise; // cl is reached
@@ -1304,11 +1637,12 @@ class digest_read_resolver : public abstract_read_resolver {
         return std::find_if(_digest_results.begin() + 1, _digest_results.end(), [&first] (query::result_digest digest) { return digest != first; }) == _digest_results.end();
     }
 public:
-    digest_read_resolver(db::consistency_level cl, size_t block_for, std::chrono::high_resolution_clock::time_point timeout) : abstract_read_resolver(cl, 0, timeout), _block_for(block_for) {}
+    digest_read_resolver(lw_shared_ptr<query::read_command> cmd, db::consistency_level cl, size_t block_for, std::chrono::high_resolution_clock::time_point timeout)
+        : abstract_read_resolver(cl, 0, timeout), _cmd(std::move(cmd)), _block_for(block_for) {}
     void add_data(gms::inet_address from, foreign_ptr<lw_shared_ptr<query::result>> result) {
         if (!_timedout) {
             // if only one target was queried digest_check() will be skipped so we can also skip digest calculation
-            _digest_results.emplace_back(_targets_count == 1 ? query::result_digest(bytes()) : result->digest());
+            _digest_results.emplace_back(_targets_count == 1 ? query::result_digest(bytes()) : result->digest(_cmd->slice));
             _data_results.emplace_back(std::move(result));
             got_response(from);
         }
@@ -1358,107 +1692,139 @@ class digest_read_resolver : public abstract_read_resolver {
     }
 };
 
-class data_read_resolver : public abstract_read_resolver {
-    struct reply {
-        gms::inet_address from;
-        foreign_ptr<lw_shared_ptr<reconcilable_result>> result;
-        reply(gms::inet_address from_, foreign_ptr<lw_shared_ptr<reconcilable_result>> result_) : from(std::move(from_)), result(std::move(result_)) {}
-    };
-    struct version {
-        gms::inet_address from;
-        partition par;
-        version(gms::inet_address from_, partition par_) : from(std::move(from_)), par(std::move(par_)) {}
-    };
+std::experimental::optional<data_read_resolver::position> data_read_resolver::stop_position(schema_ptr schema, const query::partition_slice& slice, const reply& r) {
+    auto&& partitions = r.result->partitions();
+    if (!r.reached_limit || partitions.empty()) {
+        return {};
+    }
+    auto m = partitions.back().mut().unfreeze(schema);
+    auto&& rows = m.partition().clustered_rows();
+    if (rows.empty() || slice.options.contains(query::partition_slice::option::distinct)) {
+        return position{m.key(), {}};
+    }
+    return position{m.key(), rows.rbegin()->key()};
+}
 
-    uint32_t _max_live_count = 0;
-    std::vector<reply> _data_results;
-private:
-    virtual void on_timeout() override {
-        // we will not need them any more
-        _data_results.clear();
+bool data_read_resolver::before(const schema& s, const position& a, const position& b) {
+    auto c = a.key.ring_order_tri_compare(s, b.key);
+    if (c != 0) {
+        return c < 0;
     }
-    virtual size_t response_count() const override {
-        return _data_results.size();
+    if (!a.row || !b.row) {
+        return a.row && !b.row;
     }
+    return clustering_key::less_compare(s)(*a.row, *b.row);
+}
 
-public:
-    data_read_resolver(db::consistency_level cl, size_t targets_count, std::chrono::high_resolution_clock::time_point timeout) : abstract_read_resolver(cl, targets_count, timeout) {
-        _data_results.reserve(targets_count);
+void data_read_resolver::find_horizon(schema_ptr schema, const query::partition_slice& slice) {
+    _horizon = {};
+    _short_replicas.clear();
+    if (slice.options.contains(query::partition_slice::option::reversed)) {
+        return;
     }
-    void add_mutate_data(gms::inet_address from, foreign_ptr<lw_shared_ptr<reconcilable_result>> result) {
-        if (!_timedout) {
-            _max_live_count = std::max(result->row_count(), _max_live_count);
-            _data_results.emplace_back(std::move(from), std::move(result));
-            if (_data_results.size() == _targets_count) {
-                _timeout.cancel();
-                _done_promise.set_value();
-            }
+    const auto& s = *schema;
+    for (const reply& r : _data_results) {
+        auto pos = stop_position(schema, slice, r);
+        if (!pos) {
+            continue;
+        }
+        if (!_horizon || before(s, *pos, *_horizon)) {
+            _horizon = std::move(pos);
+            _short_replicas.clear();
+            _short_replicas.push_back(r.from);
+        } else if (!before(s, *_horizon, *pos)) {
+            _short_replicas.push_back(r.from);
         }
     }
-    uint32_t max_live_count() const {
-        return _max_live_count;
+}
+
+void data_read_resolver::add_continuations(schema_ptr schema, data_read_resolver& continuations) {
+    const auto& s = *schema;
+    for (reply& c : continuations._data_results) {
+        auto r = boost::find_if(_data_results, [&c] (const reply& r) { return r.from == c.from; });
+        assert(r != _data_results.end());
+        auto& partitions = r->result->partitions();
+        auto& more = c.result->partitions();
+        auto i = more.begin();
+        // The partition the replica stopped within is merged with the
+        // rest of its rows.
+        if (!partitions.empty() && i != more.end() && partitions.back().mut().key(s).equal(s, i->mut().key(s))) {
+            auto m = partitions.back().mut().unfreeze(schema);
+            m.partition().apply(s, i->mut().partition());
+            auto row_count = partitions.back().row_count() + i->row_count();
+            partitions.pop_back();
+            partitions.emplace_back(row_count, freeze(m));
+            ++i;
+        }
+        std::move(i, more.end(), std::back_inserter(partitions));
+        r->reached_limit = c.reached_limit;
     }
-    reconcilable_result resolve(schema_ptr schema) {
-        assert(_data_results.size());
-        const auto& s = *schema;
-
-        // return true if lh > rh
-        auto cmp = [&s](reply& lh, reply& rh) {
-            if (lh.result->partitions().size() == 0) {
-                return false; // reply with empty partition array goes to the end of the sorted array
-            } else if (rh.result->partitions().size() == 0) {
-                return true;
+}
+
+reconcilable_result data_read_resolver::resolve(schema_ptr schema, const query::partition_slice& slice) {
+    assert(_data_results.size());
+    const auto& s = *schema;
+    find_horizon(schema, slice);
+    _diffs.clear();
+
+    std::vector<partition> reconciliated_partitions;
+    uint32_t row_count = 0;
+    // The results are in ring order, and merged walking them together.
+    std::vector<size_t> next(_data_results.size(), 0);
+    std::vector<version> v;
+    v.reserve(_data_results.size());
+    for (;;) {
+        const partition* first = nullptr;
+        for (size_t i = 0; i < _data_results.size(); ++i) {
+            auto&& partitions = _data_results[i].result->partitions();
+            if (next[i] < partitions.size()
+                    && (!first || partitions[next[i]].mut().key(s).ring_order_tri_compare(s, first->mut().key(s)) < 0)) {
+                first = &partitions[next[i]];
+            }
+        }
+        if (!first) {
+            break;
+        }
+        auto key = first->mut().key(s);
+        if (_horizon && key.ring_order_tri_compare(s, _horizon->key) > 0) {
+            break;
+        }
+        v.clear();
+        for (size_t i = 0; i < _data_results.size(); ++i) {
+            auto&& partitions = _data_results[i].result->partitions();
+            if (next[i] < partitions.size() && partitions[next[i]].mut().key(s).equal(s, key)) {
+                v.emplace_back(_data_results[i].from, &partitions[next[i]++]);
             } else {
-                auto lhk = lh.result->partitions().back().mut().key(s);
-                auto rhk = rh.result->partitions().back().mut().key(s);
-                return lhk.ring_order_tri_compare(s, rhk) > 0;
+                v.emplace_back(_data_results[i].from, nullptr);
             }
-        };
-
-        // this array will have an entry for each partition which will hold all available versions
-        std::vector<std::vector<version>> versions;
-        versions.reserve(_data_results.front().result->partitions().size());
-
-        do {
-            // after this sort reply with largest key is at the beginning
-            boost::sort(_data_results, cmp);
-            if (_data_results.front().result->partitions().empty()) {
-                break; // if top of the heap is empty all others are empty too
+        }
+        mutation m(key, schema);
+        for (const version& ver : v) {
+            if (ver.par) {
+                m.partition().apply(s, ver.par->mut().partition());
             }
-            const auto& max_key = _data_results.front().result->partitions().back().mut().key(s);
-            versions.emplace_back();
-            std::vector<version>& v = versions.back();
-            v.reserve(_targets_count);
-            for (reply& r : _data_results) {
-                auto pit = r.result->partitions().rbegin();
-                if (pit != r.result->partitions().rend() && pit->mut().key(s).legacy_equal(s, max_key)) {
-                    v.emplace_back(r.from, std::move(*pit));
-                    r.result->partitions().pop_back();
-                } else {
-                    // put empty partition for destination without result
-                    v.emplace_back(r.from, partition(0, freeze(mutation(max_key, schema))));
-                }
+        }
+        if (_horizon && _horizon->row && key.equal(s, _horizon->key)) {
+            auto& rows = m.partition().clustered_rows();
+            rows_entry::compare less(s);
+            rows.erase_and_dispose(rows.upper_bound(*_horizon->row, less), rows.end(), current_deleter<rows_entry>());
+        }
+        // Each replica gets only the rows and cells it lacks, rather
+        // than the whole partition.
+        for (const version& ver : v) {
+            auto diff = ver.par ? m.partition().difference(schema, ver.par->mut().unfreeze(schema).partition())
+                                : mutation_partition(m.partition());
+            if (!diff.empty()) {
+                _diffs[ver.from].emplace_back(schema, m.decorated_key(), std::move(diff));
             }
-        } while(true);
-
-        std::vector<partition> reconciliated_partitions;
-        reconciliated_partitions.reserve(versions.size());
-        uint32_t row_count = 0;
-
-        // traverse backwards since large keys are at the start
-        boost::range::transform(boost::make_iterator_range(versions.rbegin(), versions.rend()), std::back_inserter(reconciliated_partitions), [this, &row_count, schema] (std::vector<version>& v) {
-            mutation m = std::accumulate(std::begin(v), std::end(v), mutation(v.front().par.mut().key(*schema), schema), [this, schema = std::move(schema)] (mutation& m, const version& ver) {
-                m.partition().apply(*schema, ver.par.mut().partition());
-                return std::move(m);
-            });
-            auto count = m.live_row_count();
-            row_count += count;
-            return partition(count, freeze(m));
-        });
-
-        return reconcilable_result(row_count, std::move(reconciliated_partitions));
+        }
+        auto count = m.live_row_count();
+        row_count += count;
+        reconciliated_partitions.emplace_back(count, freeze(m));
     }
-};
+
+    return reconcilable_result(row_count, std::move(reconciliated_partitions));
+}
 
 class abstract_read_executor : public enable_shared_from_this<abstract_read_executor> {
 protected:
@@ -1470,10 +1836,14 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
     lw_shared_ptr<query::read_command> _cmd;
     lw_shared_ptr<query::read_command> _retry_cmd;
     query::partition_range _partition_range;
+    // Where continuations of a short read start.
+    query::partition_range _continuation_range;
     db::consistency_level _cl;
     size_t _block_for;
     std::vector<gms::inet_address> _targets;
     promise<foreign_ptr<lw_shared_ptr<query::result>>> _result_promise;
+    std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+    tracing::trace_state_ptr _trace_state;
 
 public:
     abstract_read_executor(shared_ptr<storage_proxy> proxy, lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl, size_t block_for,
@@ -1481,13 +1851,27 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
                            _proxy(std::move(proxy)), _cmd(std::move(cmd)), _partition_range(std::move(pr)), _cl(cl), _block_for(block_for), _targets(std::move(targets)) {}
     virtual ~abstract_read_executor() {};
 
+    void set_trace_state(tracing::trace_state_ptr trace_state) {
+        _trace_state = std::move(trace_state);
+    }
+
 protected:
-    future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> make_mutation_data_request(lw_shared_ptr<query::read_command> cmd, gms::inet_address ep) {
+    // This node's own response time is that of reading its storage.
+    static void add_replica_time(const tracing::trace_state_ptr& trace_state, gms::inet_address ep, std::chrono::steady_clock::time_point start) {
+        if (trace_state) {
+            auto d = std::chrono::steady_clock::now() - start;
+            trace_state->add_replica_time(ep, d);
+            if (is_me(ep)) {
+                trace_state->add_stage_time(tracing::stage::storage, d);
+            }
+        }
+    }
+    future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> make_mutation_data_request(lw_shared_ptr<query::read_command> cmd, gms::inet_address ep, const query::partition_range& pr) {
         if (is_me(ep)) {
-            return _proxy->query_mutations_locally(cmd, _partition_range);
+            return _proxy->query_mutations_locally(cmd, pr);
         } else {
             auto& ms = net::get_local_messaging_service();
-            return ms.send_read_mutation_data(net::messaging_service::shard_id{ep, 0}, *cmd, _partition_range).then([this](reconcilable_result&& result) {
+            return ms.send_read_mutation_data(replica_shard(ep, pr), *cmd, pr).then([this](reconcilable_result&& result) {
                     return make_foreign(::make_lw_shared<reconcilable_result>(std::move(result)));
             });
         }
@@ -1497,7 +1881,7 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
             return _proxy->query_singular_local(_cmd, _partition_range);
         } else {
             auto& ms = net::get_local_messaging_service();
-            return ms.send_read_data(net::messaging_service::shard_id{ep, 0}, *_cmd, _partition_range).then([this](query::result&& result) {
+            return ms.send_read_data(replica_shard(ep, _partition_range), *_cmd, _partition_range).then([this](query::result&& result) {
                 return make_foreign(::make_lw_shared<query::result>(std::move(result)));
             });
         }
@@ -1507,23 +1891,37 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
             return _proxy->query_singular_local_digest(_cmd, _partition_range);
         } else {
             auto& ms = net::get_local_messaging_service();
-            return ms.send_read_digest(net::messaging_service::shard_id{ep, 0}, *_cmd, _partition_range);
+            return ms.send_read_digest(replica_shard(ep, _partition_range), *_cmd, _partition_range);
         }
     }
-    future<> make_mutation_data_requests(lw_shared_ptr<query::read_command> cmd, data_resolver_ptr resolver, targets_iterator begin, targets_iterator end) {
-        return parallel_for_each(begin, end, [this, &cmd, resolver = std::move(resolver)] (gms::inet_address ep) {
-            return make_mutation_data_request(cmd, ep).then_wrapped([resolver, ep] (future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> f) {
+    future<> make_mutation_data_requests(lw_shared_ptr<query::read_command> cmd, data_resolver_ptr resolver, targets_iterator begin, targets_iterator end,
+            const query::partition_range& pr) {
+        return parallel_for_each(begin, end, [this, &cmd, &pr, resolver = std::move(resolver)] (gms::inet_address ep) {
+            auto start = std::chrono::steady_clock::now();
+            tracing::trace(_trace_state, "Sending a mutation data request to %s", ep);
+            return make_mutation_data_request(cmd, ep, pr).then_wrapped([resolver, ep, start, row_limit = cmd->row_limit, trace_state = _trace_state] (future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> f) {
+                tracing::trace(trace_state, "Mutation data response from %s", ep);
+                add_replica_time(trace_state, ep, start);
                 try {
-                    resolver->add_mutate_data(ep, f.get0());
+                    resolver->add_mutate_data(ep, f.get0(), row_limit);
                 } catch(...) {
                     resolver->error(ep, std::current_exception());
                 }
             });
         });
     }
+    future<> make_mutation_data_requests(lw_shared_ptr<query::read_command> cmd, data_resolver_ptr resolver, targets_iterator begin, targets_iterator end) {
+        return make_mutation_data_requests(std::move(cmd), std::move(resolver), begin, end, _partition_range);
+    }
     future<> make_data_requests(digest_resolver_ptr resolver, targets_iterator begin, targets_iterator end) {
         return parallel_for_each(begin, end, [this, resolver = std::move(resolver)] (gms::inet_address ep) {
-            return make_data_request(ep).then_wrapped([resolver, ep] (future<foreign_ptr<lw_shared_ptr<query::result>>> f) {
+            auto start = std::chrono::steady_clock::now();
+            tracing::trace(_trace_state, "Sending a data request to %s", ep);
+            return make_data_request(ep).then_wrapped([proxy = _proxy, resolver, ep, start, trace_state = _trace_state] (future<foreign_ptr<lw_shared_ptr<query::result>>> f) {
+                tracing::trace(trace_state, "Data response from %s", ep);
+                add_replica_time(trace_state, ep, start);
+                // Failures count too, a timed out endpoint is a slow one.
+                proxy->on_read_response(ep, start);
                 try {
                     resolver->add_data(ep, f.get0());
                 } catch(...) {
@@ -1534,7 +1932,12 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
     }
     future<> make_digest_requests(digest_resolver_ptr resolver, targets_iterator begin, targets_iterator end) {
         return parallel_for_each(begin, end, [this, resolver = std::move(resolver)] (gms::inet_address ep) {
-            return make_digest_request(ep).then_wrapped([resolver, ep] (future<query::result_digest> f) {
+            auto start = std::chrono::steady_clock::now();
+            tracing::trace(_trace_state, "Sending a digest request to %s", ep);
+            return make_digest_request(ep).then_wrapped([proxy = _proxy, resolver, ep, start, trace_state = _trace_state] (future<query::result_digest> f) {
+                tracing::trace(trace_state, "Digest response from %s", ep);
+                add_replica_time(trace_state, ep, start);
+                proxy->on_read_response(ep, start);
                 try {
                     resolver->add_digest(ep, f.get0());
                 } catch(...) {
@@ -1549,9 +1952,63 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
                         make_digest_requests(resolver, _targets.begin() + 1, _targets.end())).discard_result();
     }
     virtual void got_cl() {}
+    // Feeds the table's latency percentiles, which speculative retry goes by.
+    void record_latency() {
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start);
+        try {
+            _proxy->get_db().local().find_column_family(_cmd->cf_id).on_coordinator_read(latency);
+        } catch (no_such_column_family&) {
+            // Dropped while being read.
+        }
+    }
     uint32_t original_row_limit() const {
         return _cmd->row_limit;
     }
+    // Sends each replica what it missed of the partitions the resolver
+    // reconciled. Failures are only logged, the replica being repaired
+    // again by a later read, or by repair.
+    future<> send_read_repairs(std::unordered_map<gms::inet_address, std::vector<mutation>> diffs) {
+        return do_with(std::move(diffs), [this] (auto& diffs) {
+            return parallel_for_each(diffs, [this] (auto& ep_diffs) {
+                auto ep = ep_diffs.first;
+                return parallel_for_each(ep_diffs.second, [this, ep] (const mutation& m) {
+                    auto fm = freeze(m);
+                    auto& stats = _proxy->_stats;
+                    stats.read_repair_mutations++;
+                    stats.read_repair_bytes += fm.representation().size();
+                    tracing::trace(_trace_state, "Sending read repair of %d bytes to %s", fm.representation().size(), ep);
+                    return _proxy->send_to_endpoint(std::move(fm), ep, db::write_type::SIMPLE).handle_exception([ep] (std::exception_ptr ep_ex) {
+                        logger.debug("Read repair of {} failed: {}", ep, ep_ex);
+                    });
+                });
+            });
+        });
+    }
+    // Reconciles the replicas' data in the background, after a mismatch
+    // found once the read completed, and repairs them.
+    void repair_in_background() {
+        if (!_proxy->_background_read_repairs.try_wait()) {
+            _proxy->_stats.read_repair_dropped++;
+            return;
+        }
+        _proxy->_stats.read_repair_repaired_background++;
+        auto timeout = std::chrono::high_resolution_clock::now() +
+                std::chrono::milliseconds(_proxy->_db.local().get_config().read_request_timeout_in_ms());
+        data_resolver_ptr data_resolver = ::make_shared<data_read_resolver>(db::consistency_level::ALL, _targets.size(), timeout);
+        auto exec = shared_from_this();
+
+        make_mutation_data_requests(_cmd, data_resolver, _targets.begin(), _targets.end()).finally([exec]{});
+
+        data_resolver->done().then([this, exec, data_resolver] {
+            schema_ptr s = _proxy->_db.local().find_schema(_cmd->cf_id);
+            data_resolver->resolve(s, _cmd->slice);
+            return send_read_repairs(data_resolver->take_diffs());
+        }).handle_exception([] (std::exception_ptr ex) {
+            logger.debug("Background read repair failed: {}", ex);
+        }).finally([exec] {
+            exec->_proxy->_background_read_repairs.signal();
+        });
+    }
     void reconciliate(db::consistency_level cl, std::chrono::high_resolution_clock::time_point timeout, lw_shared_ptr<query::read_command> cmd) {
         data_resolver_ptr data_resolver = ::make_shared<data_read_resolver>(cl, _targets.size(), timeout);
         auto exec = shared_from_this();
@@ -1561,24 +2018,85 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
         data_resolver->done().then_wrapped([this, exec, data_resolver, cmd = std::move(cmd), cl, timeout] (future<> f) {
             try {
                 f.get();
-                schema_ptr s = _proxy->_db.local().find_schema(_cmd->cf_id);
-                auto rr = data_resolver->resolve(s); // reconciliation happens here
-
-                // We generate a retry if at least one node reply with count live columns but after merge we have less
-                // than the total number of column we are interested in (which may be < count on a retry).
-                // So in particular, if no host returned count live columns, we know it's not a short read.
-                if (data_resolver->max_live_count() < cmd->row_limit || rr.row_count() >= original_row_limit()) {
-                    auto result = ::make_foreign(::make_lw_shared(to_data_query_result(std::move(rr), std::move(s), _cmd->slice)));
-                    _result_promise.set_value(std::move(result));
-                } else {
-                    _retry_cmd = make_lw_shared<query::read_command>(*cmd);
-                    // We asked t (= _cmd->row_limit) live columns and got l (=rr.row_count) ones.
-                    // From that, we can estimate that on this row, for x requested
-                    // columns, only l/t end up live after reconciliation. So for next
-                    // round we want to ask x column so that x * (l/t) == t, i.e. x = t^2/l.
-                    _retry_cmd->row_limit = rr.row_count() == 0 ? cmd->row_limit + 1 : ((cmd->row_limit * cmd->row_limit) / rr.row_count()) + 1;
-                    reconciliate(cl, timeout, _retry_cmd);
+                resolve_data(data_resolver, cl, timeout, cmd);
+            } catch(read_timeout_exception& ex) {
+                _result_promise.set_exception(ex);
+            }
+        });
+    }
+    void resolve_data(data_resolver_ptr data_resolver, db::consistency_level cl, std::chrono::high_resolution_clock::time_point timeout, lw_shared_ptr<query::read_command> cmd) {
+        schema_ptr s = _proxy->_db.local().find_schema(_cmd->cf_id);
+        auto rr = data_resolver->resolve(s, cmd->slice); // reconciliation happens here
+        auto& horizon = data_resolver->horizon();
+
+        // The read is short if at least one replica returned as many rows as it was asked for, but reconciliation
+        // left fewer than were asked for (which may be < the replicas' limit on a retry). So in particular, if no
+        // replica returned that many, we know it's not a short read; nor if one returned the whole of a single
+        // partition.
+        if (!data_resolver->any_reached_limit() || rr.row_count() >= original_row_limit()
+                || (horizon && !horizon->row && _partition_range.is_singular())) {
+            auto result = ::make_foreign(::make_lw_shared(to_data_query_result(std::move(rr), std::move(s), _cmd->slice)));
+            // The replicas are repaired before the result is
+            // returned, so that a later read can't see older data.
+            auto diffs = data_resolver->take_diffs();
+            if (diffs.empty()) {
+                _result_promise.set_value(std::move(result));
+                return;
+            }
+            _proxy->_stats.read_repair_repaired_blocking++;
+            send_read_repairs(std::move(diffs)).then_wrapped([this, exec = shared_from_this(), result = std::move(result)] (future<> f) mutable {
+                try {
+                    f.get();
+                } catch (...) {
+                    logger.debug("Read repair failed: {}", std::current_exception());
                 }
+                _result_promise.set_value(std::move(result));
+            });
+        } else if (horizon) {
+            read_on(data_resolver, cl, timeout, cmd, original_row_limit() - rr.row_count());
+        } else {
+            tracing::trace(_trace_state, "Short read after reconciliation, retrying");
+            _retry_cmd = make_lw_shared<query::read_command>(*cmd);
+            // We asked t (= _cmd->row_limit) live columns and got l (=rr.row_count) ones.
+            // From that, we can estimate that on this row, for x requested
+            // columns, only l/t end up live after reconciliation. So for next
+            // round we want to ask x column so that x * (l/t) == t, i.e. x = t^2/l.
+            _retry_cmd->row_limit = rr.row_count() == 0 ? cmd->row_limit + 1 : ((cmd->row_limit * cmd->row_limit) / rr.row_count()) + 1;
+            reconciliate(cl, timeout, _retry_cmd);
+        }
+    }
+    // Continues a short read from where the replicas which stopped first
+    // stopped, asking only them for the rows still missing, rather than
+    // all replicas for all rows again.
+    void read_on(data_resolver_ptr data_resolver, db::consistency_level cl, std::chrono::high_resolution_clock::time_point timeout,
+            lw_shared_ptr<query::read_command> cmd, uint32_t missing_rows) {
+        schema_ptr s = _proxy->_db.local().find_schema(_cmd->cf_id);
+        auto& horizon = *data_resolver->horizon();
+        auto continuation = make_lw_shared<query::read_command>(*cmd);
+        continuation->row_limit = missing_rows;
+        continuation->resume_after = {};
+        if (horizon.row) {
+            continuation->resume_after = query::row_position{horizon.key, *horizon.row};
+        }
+        _continuation_range = _partition_range;
+        if (!_partition_range.is_singular()) {
+            // The partition the replicas stopped within is read again,
+            // from its row which follows the last one they returned.
+            auto dk = dht::global_partitioner().decorate_key(*s, horizon.key);
+            _continuation_range = query::partition_range(query::partition_range::bound(dht::ring_position(dk), bool(horizon.row)), _partition_range.end());
+        }
+        auto targets = data_resolver->short_replicas();
+        tracing::trace(_trace_state, "Short read after reconciliation, reading %d more rows from %d replicas", missing_rows, targets.size());
+        auto continuations = ::make_shared<data_read_resolver>(cl, targets.size(), timeout);
+        auto exec = shared_from_this();
+
+        make_mutation_data_requests(continuation, continuations, targets.begin(), targets.end(), _continuation_range).finally([exec]{});
+
+        continuations->done().then_wrapped([this, exec, data_resolver, continuations, cmd = std::move(cmd), s = std::move(s), cl, timeout] (future<> f) {
+            try {
+                f.get();
+                data_resolver->add_continuations(s, *continuations);
+                resolve_data(data_resolver, cl, timeout, cmd);
             } catch(read_timeout_exception& ex) {
                 _result_promise.set_exception(ex);
             }
@@ -1590,7 +2108,7 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
 
 public:
     virtual future<foreign_ptr<lw_shared_ptr<query::result>>> execute(std::chrono::high_resolution_clock::time_point timeout) {
-        digest_resolver_ptr digest_resolver = ::make_shared<digest_read_resolver>(_cl, _block_for, timeout);
+        digest_resolver_ptr digest_resolver = ::make_shared<digest_read_resolver>(_cmd, _cl, _block_for, timeout);
         auto exec = shared_from_this();
 
         make_requests(digest_resolver).finally([exec]() {
@@ -1601,6 +2119,7 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
             try {
                 got_cl();
                 f.get();
+                record_latency();
                 exec->_result_promise.set_value(digest_resolver->resolve()); // can throw digest missmatch exception
                 auto done = digest_resolver->done();
                 if (exec->_block_for < exec->_targets.size()) { // if there are more targets then needed for cl, check digest in background
@@ -1609,7 +2128,7 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
                             f.get();
                             digest_resolver->resolve();
                         } catch(digest_mismatch_exception& ex) {
-                            // FIXME: do read repair here
+                            exec->repair_in_background();
                         } catch(...) {
                             // ignore all exception besides digest mismatch during background check
                         }
@@ -1618,6 +2137,7 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
                     done.discard_result(); // no need for background check, discard done future explicitly
                 }
             } catch (digest_mismatch_exception& ex) {
+                tracing::trace(_trace_state, "Digest mismatch, reconciling the data of all replicas");
                 exec->reconciliate(_cl, timeout);
             } catch (read_timeout_exception& ex) {
                 exec->_result_promise.set_exception(ex);
@@ -1647,11 +2167,15 @@ class always_speculating_read_executor : public abstract_read_executor {
 // this executor sends request to an additional replica after some time below timeout
 class speculating_read_executor : public abstract_read_executor {
     timer<> _speculate_timer;
+    std::chrono::microseconds _delay;
 public:
-    using abstract_read_executor::abstract_read_executor;
+    speculating_read_executor(shared_ptr<storage_proxy> proxy, lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl, size_t block_for,
+            std::vector<gms::inet_address> targets, std::chrono::microseconds delay) :
+                           abstract_read_executor(std::move(proxy), std::move(cmd), std::move(pr), cl, block_for, std::move(targets)), _delay(delay) {}
     virtual future<> make_requests(digest_resolver_ptr resolver) {
         _speculate_timer.set_callback([this, resolver] {
             if (!resolver->is_completed()) { // at the time the callback runs request may be completed already
+                tracing::trace(_trace_state, "Speculating a read after %d us", _delay.count());
                 resolver->add_wait_targets(1); // we send one more request so wait for it too
                 future<> f = resolver->has_data() ?
                         make_digest_requests(resolver, _targets.end() - 1, _targets.end()) :
@@ -1659,9 +2183,7 @@ class speculating_read_executor : public abstract_read_executor {
                 f.finally([exec = shared_from_this()]{});
             }
         });
-        // FIXME: the timeout should come from previous latency statistics for a partition
-        auto timeout = std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(_proxy->get_db().local().get_config().read_request_timeout_in_ms()/2);
-        _speculate_timer.arm(timeout);
+        _speculate_timer.arm(std::chrono::high_resolution_clock::now() + _delay);
 
         // if CL + RR result in covering all replicas, getReadExecutor forces AlwaysSpeculating.  So we know
         // that the last replica in our list is "extra."
@@ -1707,7 +2229,14 @@ db::read_repair_decision storage_proxy::new_read_repair_decision(const schema& s
     return db::read_repair_decision::NONE;
 }
 
-::shared_ptr<abstract_read_executor> storage_proxy::get_read_executor(lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl) {
+::shared_ptr<abstract_read_executor> storage_proxy::get_read_executor(lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl,
+        tracing::trace_state_ptr trace_state) {
+    auto exec = make_read_executor(std::move(cmd), std::move(pr), cl);
+    exec->set_trace_state(std::move(trace_state));
+    return exec;
+}
+
+::shared_ptr<abstract_read_executor> storage_proxy::make_read_executor(lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl) {
     const dht::token& token = pr.start()->value().token();
     schema_ptr schema = _db.local().find_schema(cmd->cf_id);
     keyspace& ks = _db.local().find_keyspace(schema->ks_name());
@@ -1719,10 +2248,9 @@ ::shared_ptr<abstract_read_executor> storage_proxy::get_read_executor(lw_shared_
     // Throw UAE early if we don't have enough replicas.
     db::assure_sufficient_live_nodes(cl, ks, target_replicas);
 
-#if 0
-    if (repair_decision != read_repair_decision::NONE)
-        ReadRepairMetrics.attempted.mark();
-#endif
+    if (repair_decision != db::read_repair_decision::NONE) {
+        _stats.read_repair_attempted++;
+    }
 
 #if 0
     ColumnFamilyStore cfs = keyspace.getColumnFamilyStore(command.cfName);
@@ -1758,63 +2286,139 @@ ::shared_ptr<abstract_read_executor> storage_proxy::get_read_executor(lw_shared_
     if (retry_type == speculative_retry::type::ALWAYS) {
         return ::make_shared<always_speculating_read_executor>(/*cfs,*/p, cmd, std::move(pr), cl, block_for, std::move(target_replicas));
     } else {// PERCENTILE or CUSTOM.
-        return ::make_shared<speculating_read_executor>(/*cfs,*/p, cmd, std::move(pr), cl, block_for, std::move(target_replicas));
+        auto delay = _db.local().find_column_family(schema).speculative_retry_delay();
+        if (!delay) {
+            // Not enough reads to go by yet.
+            delay = std::chrono::milliseconds(_db.local().get_config().read_request_timeout_in_ms() / 2);
+        }
+        return ::make_shared<speculating_read_executor>(/*cfs,*/p, cmd, std::move(pr), cl, block_for, std::move(target_replicas), *delay);
     }
 }
 
 future<query::result_digest>
 storage_proxy::query_singular_local_digest(lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr) {
-    return query_singular_local(cmd, pr).then([] (foreign_ptr<lw_shared_ptr<query::result>> result) {
-        return result->digest();
+    return query_singular_local(cmd, pr).then([cmd] (foreign_ptr<lw_shared_ptr<query::result>> result) {
+        return result->digest(cmd->slice);
     });
 }
 
 future<foreign_ptr<lw_shared_ptr<query::result>>>
 storage_proxy::query_singular_local(lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr) {
     unsigned shard = _db.local().shard_of(pr.start()->value().token());
-    return _db.invoke_on(shard, [prv = std::vector<query::partition_range>({pr}) /* FIXME: pr is copied */, cmd] (database& db) {
-        return db.query(*cmd, prv).then([](auto&& f) {
+    // The caller keeps pr alive until the result is ready, so the owning shard
+    // reads it in place.
+    return _db.invoke_on(shard, [&pr, cmd] (database& db) {
+        return db.query(*cmd, pr).then([](auto&& f) {
             return make_foreign(std::move(f));
         });
     });
 }
 
-future<foreign_ptr<lw_shared_ptr<query::result>>>
-storage_proxy::query_singular(lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges, db::consistency_level cl) {
+// Counts the rows of a query result, for the coordinator to tell whether a
+// multi-partition query has already satisfied its limit.
+static uint32_t count_rows(const query::partition_slice& slice, const query::result& r) {
+    struct row_counter : public query::result_visitor {
+        uint32_t rows = 0;
+        void accept_new_partition(const partition_key_view& key, uint32_t row_count) {
+            rows += row_count;
+        }
+        void accept_new_partition(uint32_t row_count) {
+            rows += row_count;
+        }
+    } counter;
+    query::result_view::consume(r, slice, counter);
+    return counter.rows;
+}
+
+// Whether the results gathered so far fill the page up to its size limit.
+static bool is_size_limited(const query::read_command& cmd, const std::vector<foreign_ptr<lw_shared_ptr<query::result>>>& results) {
+    size_t size = 0;
+    for (auto&& r : results) {
+        size += r->serialized_size();
+    }
+    return cmd.is_size_limited(size);
+}
+
+future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>
+storage_proxy::query_singular_concurrent(std::chrono::high_resolution_clock::time_point timeout, std::vector<foreign_ptr<lw_shared_ptr<query::result>>>&& results,
+        lw_shared_ptr<query::read_command> cmd, db::consistency_level cl, std::vector<query::partition_range>::iterator&& i,
+        std::vector<query::partition_range>&& ranges, uint32_t rows, tracing::trace_state_ptr trace_state) {
+    // Every partition is expected to contribute at least a row, so there is
+    // no point in reading more partitions than there are rows still missing.
+    size_t concurrency = std::max<uint32_t>(1, std::min(_db.local().get_config().max_concurrent_partition_reads(), cmd->row_limit - rows));
     std::vector<::shared_ptr<abstract_read_executor>> exec;
-    exec.reserve(partition_ranges.size());
+    exec.reserve(std::min<size_t>(concurrency, std::distance(i, ranges.end())));
+
+    while (i != ranges.end() && exec.size() < concurrency) {
+        exec.push_back(get_read_executor(cmd, std::move(*i), cl, trace_state));
+        ++i;
+    }
+
+    query::result_merger merger(cmd->max_result_size);
+    merger.reserve(exec.size());
+
+    auto f = ::map_reduce(exec.begin(), exec.end(), [timeout] (::shared_ptr<abstract_read_executor>& rex) {
+        return rex->execute(timeout);
+    }, std::move(merger));
+
+    return f.then([p = shared_from_this(), exec = std::move(exec), results = std::move(results), i = std::move(i), ranges = std::move(ranges), cl, cmd, rows, timeout,
+                   trace_state = std::move(trace_state)] (foreign_ptr<lw_shared_ptr<query::result>>&& result) mutable {
+        if (cmd->row_limit != query::max_rows) {
+            rows += count_rows(cmd->slice, *result);
+        }
+        results.emplace_back(std::move(result));
+        // The partitions are merged in the order of the query, so once a
+        // limit is reached the remaining ones can't contribute to the result.
+        if (i == ranges.end() || rows >= cmd->row_limit || is_size_limited(*cmd, results)) {
+            return make_ready_future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>(std::move(results));
+        } else {
+            return p->query_singular_concurrent(timeout, std::move(results), cmd, cl, std::move(i), std::move(ranges), rows, std::move(trace_state));
+        }
+    });
+}
+
+future<foreign_ptr<lw_shared_ptr<query::result>>>
+storage_proxy::query_singular(lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges, db::consistency_level cl,
+        tracing::trace_state_ptr trace_state) {
     auto timeout = std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(_db.local().get_config().read_request_timeout_in_ms());
+    cmd->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_db.local().get_config().read_request_timeout_in_ms());
 
     for (auto&& pr: partition_ranges) {
         if (!pr.is_singular()) {
             throw std::runtime_error("mixed singular and non singular range are not supported");
         }
-        exec.push_back(get_read_executor(cmd, std::move(pr), cl));
     }
 
-    query::result_merger merger;
-    merger.reserve(exec.size());
+    std::vector<foreign_ptr<lw_shared_ptr<query::result>>> results;
 
-    auto f = ::map_reduce(exec.begin(), exec.end(), [timeout] (::shared_ptr<abstract_read_executor>& rex) {
-        return rex->execute(timeout);
-    }, std::move(merger));
+    return query_singular_concurrent(timeout, std::move(results), cmd, cl, partition_ranges.begin(), std::move(partition_ranges), 0, std::move(trace_state))
+            .then([cmd](std::vector<foreign_ptr<lw_shared_ptr<query::result>>> results) {
+        if (results.size() == 1) {
+            return std::move(results.front());
+        }
+
+        query::result_merger merger(cmd->max_result_size);
+        merger.reserve(results.size());
+
+        for (auto&& r: results) {
+            merger(std::move(r));
+        }
 
-    return f.finally([exec = std::move(exec)] {
-        // hold onto exec until read is complete
+        return merger.get();
     });
 }
 
 future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>
 storage_proxy::query_partition_key_range_concurrent(std::chrono::high_resolution_clock::time_point timeout, std::vector<foreign_ptr<lw_shared_ptr<query::result>>>&& results,
         lw_shared_ptr<query::read_command> cmd, db::consistency_level cl, std::vector<query::partition_range>::iterator&& i,
-        std::vector<query::partition_range>&& ranges, int concurrency_factor) {
+        std::vector<query::partition_range>&& ranges, int concurrency_factor, uint32_t rows, tracing::trace_state_ptr trace_state) {
     schema_ptr schema = _db.local().find_schema(cmd->cf_id);
     keyspace& ks = _db.local().find_keyspace(schema->ks_name());
     std::vector<::shared_ptr<abstract_read_executor>> exec;
     auto concurrent_fetch_starting_index = i;
     auto p = shared_from_this();
 
-    while (i != ranges.end() && std::distance(i, concurrent_fetch_starting_index) < concurrency_factor) {
+    while (i != ranges.end() && std::distance(concurrent_fetch_starting_index, i) < concurrency_factor) {
         query::partition_range& range = *i;
         std::vector<gms::inet_address> live_endpoints = get_live_sorted_endpoints(ks, end_token(range));
         std::vector<gms::inet_address> filtered_endpoints = filter_for_query(cl, ks, live_endpoints);
@@ -1862,32 +2466,54 @@ storage_proxy::query_partition_key_range_concurrent(std::chrono::high_resolution
         }
         db::assure_sufficient_live_nodes(cl, ks, filtered_endpoints);
         exec.push_back(::make_shared<range_slice_read_executor>(p, cmd, std::move(range), cl, std::move(filtered_endpoints)));
+        exec.back()->set_trace_state(trace_state);
     }
 
-    query::result_merger merger;
+    query::result_merger merger(cmd->max_result_size);
     merger.reserve(exec.size());
 
     auto f = ::map_reduce(exec.begin(), exec.end(), [timeout] (::shared_ptr<abstract_read_executor>& rex) {
         return rex->execute(timeout);
     }, std::move(merger));
 
-    return f.then([p, exec = std::move(exec), results = std::move(results), i = std::move(i), ranges = std::move(ranges), cl, cmd, concurrency_factor, timeout]
-                   (foreign_ptr<lw_shared_ptr<query::result>>&& result) mutable {
+    tracing::trace(trace_state, "Reading %d sub-ranges", exec.size());
+
+    return f.then([p, exec = std::move(exec), results = std::move(results), i = std::move(i), ranges = std::move(ranges), cl, cmd, concurrency_factor, rows, timeout,
+                   trace_state = std::move(trace_state)] (foreign_ptr<lw_shared_ptr<query::result>>&& result) mutable {
+        if (cmd->row_limit != query::max_rows) {
+            rows += count_rows(cmd->slice, *result);
+        }
         results.emplace_back(std::move(result));
-        if (i == ranges.end()) {
+        if (i == ranges.end() || rows >= cmd->row_limit || is_size_limited(*cmd, results)) {
             return make_ready_future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>(std::move(results));
+        }
+
+        // Adapt the concurrency to the rows per range actually seen so far. If
+        // nothing has been found yet the table is sparse, so ask for all the
+        // remaining ranges at once.
+        auto ranges_queried = std::distance(ranges.begin(), i);
+        auto ranges_left = std::distance(i, ranges.end());
+        if (rows == 0) {
+            concurrency_factor = ranges_left;
         } else {
-            return p->query_partition_key_range_concurrent(timeout, std::move(results), cmd, cl, std::move(i), std::move(ranges), concurrency_factor);
+            float rows_per_range = float(rows) / ranges_queried;
+            uint32_t rows_left = cmd->row_limit - rows;
+            concurrency_factor = std::max(1, int(std::min(double(ranges_left), std::round(rows_left / rows_per_range))));
         }
+        logger.trace("range scan: {} rows from {} ranges so far, next concurrency factor is {}", rows, ranges_queried, concurrency_factor);
+        return p->query_partition_key_range_concurrent(timeout, std::move(results), cmd, cl, std::move(i), std::move(ranges), concurrency_factor, rows,
+                std::move(trace_state));
     });
 }
 
 future<foreign_ptr<lw_shared_ptr<query::result>>>
-storage_proxy::query_partition_key_range(lw_shared_ptr<query::read_command> cmd, query::partition_range&& range, db::consistency_level cl) {
+storage_proxy::query_partition_key_range(lw_shared_ptr<query::read_command> cmd, query::partition_range&& range, db::consistency_level cl,
+        tracing::trace_state_ptr trace_state) {
     schema_ptr schema = _db.local().find_schema(cmd->cf_id);
     keyspace& ks = _db.local().find_keyspace(schema->ks_name());
     std::vector<query::partition_range> ranges;
     auto timeout = std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(_db.local().get_config().read_request_timeout_in_ms());
+    cmd->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_db.local().get_config().read_request_timeout_in_ms());
 
     // when dealing with LocalStrategy keyspaces, we can skip the range splitting and merging (which can be
     // expensive in clusters with vnodes)
@@ -1902,14 +2528,15 @@ storage_proxy::query_partition_key_range(lw_shared_ptr<query::read_command> cmd,
     // underestimate how many rows we will get per-range in order to increase the likelihood that we'll
     // fetch enough rows in the first round
     result_rows_per_range -= result_rows_per_range * CONCURRENT_SUBREQUESTS_MARGIN;
-    int concurrency_factor = result_rows_per_range == 0.0 ? 1 : std::max(1, std::min(int(ranges.size()), int(std::ceil(cmd->row_limit / result_rows_per_range))));
+    int concurrency_factor = result_rows_per_range == 0.0 ? 1 : std::max(1, int(std::min(double(ranges.size()), std::ceil(cmd->row_limit / result_rows_per_range))));
 
     std::vector<foreign_ptr<lw_shared_ptr<query::result>>> results;
     results.reserve(ranges.size()/concurrency_factor + 1);
 
-    return query_partition_key_range_concurrent(timeout, std::move(results), cmd, cl, ranges.begin(), std::move(ranges), concurrency_factor)
-            .then([](std::vector<foreign_ptr<lw_shared_ptr<query::result>>> results) {
-        query::result_merger merger;
+    return query_partition_key_range_concurrent(timeout, std::move(results), cmd, cl, ranges.begin(), std::move(ranges), concurrency_factor, 0,
+            std::move(trace_state))
+            .then([cmd](std::vector<foreign_ptr<lw_shared_ptr<query::result>>> results) {
+        query::result_merger merger(cmd->max_result_size);
         merger.reserve(results.size());
 
         for (auto&& r: results) {
@@ -1920,31 +2547,366 @@ storage_proxy::query_partition_key_range(lw_shared_ptr<query::read_command> cmd,
     });
 }
 
+static std::vector<data_type> aggregate_arg_types(const schema& s, const query::aggregate& a) {
+    if (a.column.empty()) {
+        return {};
+    }
+    auto def = s.get_column_definition(a.column);
+    if (!def) {
+        throw std::runtime_error(sprint("Unknown argument column of aggregate %s", a.function));
+    }
+    return { def->type };
+}
+
+static shared_ptr<cql3::functions::aggregate_function>
+find_aggregate_function(const sstring& name, const std::vector<data_type>& arg_types) {
+    auto f = cql3::functions::functions::find(cql3::functions::function_name::native_function(name), arg_types);
+    auto af = dynamic_pointer_cast<cql3::functions::aggregate_function>(f);
+    if (!af) {
+        throw std::runtime_error(sprint("Unknown aggregate function %s", name));
+    }
+    return af;
+}
+
+// Computes aggregates over the rows of query results. The rows are those
+// the selection is given: a partition without rows counts as a row with
+// the partition key and static columns only.
+class partial_aggregates_builder {
+    struct argument {
+        // Null for the functions of the rows themselves.
+        const column_definition* def = nullptr;
+        // Position of static and regular columns in the slice.
+        size_t index = 0;
+    };
+    using aggregate_ptr = std::unique_ptr<cql3::functions::aggregate_function::aggregate>;
+    using cell_value = std::experimental::optional<bytes_view>;
+
+    schema_ptr _schema;
+    const query::partition_slice& _slice;
+    std::vector<aggregate_ptr> _aggregates;
+    std::vector<argument> _arguments;
+    // Point into the results being visited.
+    std::vector<bytes_view> _partition_key;
+    std::vector<bytes_view> _clustering_key;
+    std::vector<cell_value> _static_values;
+    std::vector<cell_value> _regular_values;
+    std::vector<bytes_opt> _input;
+    uint32_t _row_count = 0;
+private:
+    static size_t position(const std::vector<column_id>& ids, const column_definition& def) {
+        auto i = boost::find(ids, def.id);
+        if (i == ids.end()) {
+            throw std::runtime_error(sprint("Argument %s of an aggregate is not selected", def.name_as_text()));
+        }
+        return i - ids.begin();
+    }
+
+    void read_cells(const query::result_row_view& row, const std::vector<column_id>& ids, column_kind kind, std::vector<cell_value>& values) {
+        auto i = row.iterator();
+        for (size_t n = 0; n < ids.size(); ++n) {
+            auto&& def = kind == column_kind::static_column ? _schema->static_column_at(ids[n]) : _schema->regular_column_at(ids[n]);
+            if (def.is_atomic()) {
+                auto cell = i.next_atomic_cell();
+                values[n] = cell ? cell_value(cell->value()) : cell_value();
+            } else {
+                i.skip(def);
+                values[n] = {};
+            }
+        }
+    }
+
+    static bytes_opt to_value(const cell_value& v) {
+        return v ? bytes_opt(bytes(v->begin(), v->end())) : bytes_opt();
+    }
+
+    bytes_opt argument_value(const column_definition& def, size_t index, bool has_row) const {
+        switch (def.kind) {
+        case column_kind::partition_key:
+            return to_value(_partition_key[def.component_index()]);
+        case column_kind::clustering_key:
+            return has_row ? to_value(_clustering_key[def.component_index()]) : bytes_opt();
+        case column_kind::static_column:
+            return to_value(_static_values[index]);
+        default:
+            return has_row ? to_value(_regular_values[index]) : bytes_opt();
+        }
+    }
+
+    void add_row(bool has_row) {
+        for (size_t n = 0; n < _aggregates.size(); ++n) {
+            _input.clear();
+            if (_arguments[n].def) {
+                _input.emplace_back(argument_value(*_arguments[n].def, _arguments[n].index, has_row));
+            }
+            _aggregates[n]->add_input(serialization_format::internal(), _input);
+        }
+    }
+public:
+    partial_aggregates_builder(schema_ptr s, const query::partition_slice& slice, const std::vector<query::aggregate>& aggregates)
+        : _schema(std::move(s))
+        , _slice(slice)
+        , _static_values(slice.static_columns.size())
+        , _regular_values(slice.regular_columns.size())
+    {
+        for (auto&& a : aggregates) {
+            auto types = aggregate_arg_types(*_schema, a);
+            argument arg;
+            if (!types.empty()) {
+                arg.def = _schema->get_column_definition(a.column);
+                if (arg.def->is_static()) {
+                    arg.index = position(slice.static_columns, *arg.def);
+                } else if (!arg.def->is_primary_key()) {
+                    arg.index = position(slice.regular_columns, *arg.def);
+                }
+            }
+            _aggregates.emplace_back(find_aggregate_function(a.function, types)->new_aggregate());
+            _aggregates.back()->reset();
+            _arguments.emplace_back(arg);
+        }
+    }
+
+    void consume(const query::result& r) {
+        query::result_view::consume(r, _slice, *this);
+    }
+
+    query::partial_aggregates get() {
+        query::partial_aggregates result;
+        for (auto&& a : _aggregates) {
+            result.values.emplace_back(a->compute(serialization_format::internal()));
+        }
+        return result;
+    }
+
+    void accept_new_partition(const partition_key_view& key, uint32_t row_count) {
+        _partition_key.assign(key.begin(*_schema), key.end(*_schema));
+        _row_count = row_count;
+    }
+
+    void accept_new_partition(uint32_t row_count) {
+        _row_count = row_count;
+    }
+
+    void accept_new_row(const clustering_key_view& key, const query::result_row_view& static_row,
+            const query::result_row_view& row) {
+        _clustering_key.assign(key.begin(*_schema), key.end(*_schema));
+        accept_new_row(static_row, row);
+    }
+
+    void accept_new_row(const query::result_row_view& static_row, const query::result_row_view& row) {
+        read_cells(static_row, _slice.static_columns, column_kind::static_column, _static_values);
+        read_cells(row, _slice.regular_columns, column_kind::regular_column, _regular_values);
+        add_row(true);
+    }
+
+    void accept_partition_end(const query::result_row_view& static_row) {
+        if (_row_count == 0) {
+            read_cells(static_row, _slice.static_columns, column_kind::static_column, _static_values);
+            add_row(false);
+        }
+    }
+};
+
+// Merges the partial results of aggregates over disjoint sets of rows.
+// Counts add up, the other functions apply to their own partial results.
+class partial_aggregates_merger {
+    std::vector<std::unique_ptr<cql3::functions::aggregate_function::aggregate>> _aggregates;
+public:
+    partial_aggregates_merger(const schema& s, const std::vector<query::aggregate>& aggregates) {
+        for (auto&& a : aggregates) {
+            auto f = a.function == "count" || a.function == "countRows"
+                    ? find_aggregate_function("sum", { long_type })
+                    : find_aggregate_function(a.function, aggregate_arg_types(s, a));
+            _aggregates.emplace_back(f->new_aggregate());
+            _aggregates.back()->reset();
+        }
+    }
+
+    void operator()(query::partial_aggregates partial) {
+        if (partial.values.size() != _aggregates.size()) {
+            throw std::runtime_error(sprint("Got %d partial aggregates, expected %d", partial.values.size(), _aggregates.size()));
+        }
+        for (size_t n = 0; n < _aggregates.size(); ++n) {
+            _aggregates[n]->add_input(serialization_format::internal(), { std::move(partial.values[n]) });
+        }
+    }
+
+    query::partial_aggregates get() {
+        query::partial_aggregates result;
+        for (auto&& a : _aggregates) {
+            result.values.emplace_back(a->compute(serialization_format::internal()));
+        }
+        return result;
+    }
+};
+
+future<query::partial_aggregates>
+storage_proxy::query_partial_aggregates(lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range> ranges,
+        std::vector<query::aggregate> aggregates, db::consistency_level cl) {
+    schema_ptr s = _db.local().find_schema(cmd->cf_id);
+    if (cl == db::consistency_level::ONE || cl == db::consistency_level::LOCAL_ONE) {
+        // We are the replica picked for the ranges: each shard aggregates
+        // the part of them it owns, one range at a time.
+        return _db.map_reduce(partial_aggregates_merger(*s, aggregates), [cmd, ranges = std::move(ranges), aggregates] (database& db) {
+            return do_with(partial_aggregates_builder(db.find_schema(cmd->cf_id), cmd->slice, aggregates), std::vector<query::partition_range>(ranges),
+                    [&db, cmd] (partial_aggregates_builder& builder, const std::vector<query::partition_range>& ranges) {
+                return do_for_each(ranges, [&db, cmd, &builder] (const query::partition_range& range) {
+                    return db.query(*cmd, range).then([&builder] (lw_shared_ptr<query::result> r) {
+                        builder.consume(*r);
+                    });
+                }).then([&builder] {
+                    return builder.get();
+                });
+            });
+        });
+    }
+    // Reads the ranges at cl as any coordinator would, keeping only the
+    // results of one range at a time.
+    auto p = shared_from_this();
+    return do_with(std::move(ranges), partial_aggregates_builder(s, cmd->slice, aggregates), [p, s, cmd, cl] (auto& ranges, auto& builder) {
+        return do_for_each(ranges, [p, s, cmd, cl, &builder] (const query::partition_range& range) {
+            return p->query(s, cmd, { range }, cl).then([&builder] (foreign_ptr<lw_shared_ptr<query::result>> r) {
+                builder.consume(*r);
+            });
+        }).then([&builder] {
+            return builder.get();
+        });
+    });
+}
+
+future<std::vector<bytes_opt>>
+storage_proxy::query_aggregates(schema_ptr s,
+    lw_shared_ptr<query::read_command> cmd,
+    std::vector<query::partition_range>&& partition_ranges,
+    std::vector<query::aggregate> aggregates,
+    db::consistency_level cl)
+{
+    // Partitions are read by a single replica set anyway, so there is
+    // nothing to spread: aggregate the result here. So do we until every
+    // node knows the AGGREGATE verb.
+    if (partition_ranges.size() != 1 || partition_ranges[0].is_singular() || !cluster_supports(_aggregate)) {
+        return query(s, cmd, std::move(partition_ranges), cl).then([s, cmd, aggregates = std::move(aggregates)] (foreign_ptr<lw_shared_ptr<query::result>> r) {
+            partial_aggregates_builder builder(s, cmd->slice, aggregates);
+            builder.consume(*r);
+            return std::move(builder.get().values);
+        });
+    }
+
+    keyspace& ks = _db.local().find_keyspace(s->ks_name());
+    std::vector<query::partition_range> ranges;
+    if (ks.get_replication_strategy().get_type() == locator::replication_strategy_type::local) {
+        ranges.emplace_back(std::move(partition_ranges[0]));
+    } else {
+        ranges = get_restricted_ranges(ks, *s, std::move(partition_ranges[0]));
+    }
+
+    // Each range is aggregated by its closest replica, which reads it at cl
+    // like a coordinator would, so that only the partial results travel.
+    // The ranges sharing that replica go in a single request.
+    std::unordered_map<gms::inet_address, std::vector<query::partition_range>> ranges_by_endpoint;
+    for (auto&& range : ranges) {
+        std::vector<gms::inet_address> live_endpoints = get_live_sorted_endpoints(ks, end_token(range));
+        std::vector<gms::inet_address> filtered_endpoints = filter_for_query(cl, ks, live_endpoints);
+        db::assure_sufficient_live_nodes(cl, ks, filtered_endpoints);
+        ranges_by_endpoint[filtered_endpoints[0]].emplace_back(std::move(range));
+    }
+
+    return _read_admission.admit().then([this, s = std::move(s), cmd = std::move(cmd), ranges_by_endpoint = std::move(ranges_by_endpoint),
+            aggregates = std::move(aggregates), cl] () mutable {
+        ++_stats.reads_in_flight;
+        utils::latency_counter lc;
+        lc.start();
+        auto p = shared_from_this();
+        return do_with(std::move(ranges_by_endpoint), std::move(aggregates), [p, s, cmd, cl] (auto& ranges_by_endpoint, auto& aggregates) {
+            return map_reduce(ranges_by_endpoint.begin(), ranges_by_endpoint.end(), [p, cmd, cl, &aggregates] (auto& e) {
+                if (is_me(e.first)) {
+                    return p->query_partial_aggregates(cmd, std::move(e.second), aggregates, cl);
+                }
+                auto& ms = net::get_local_messaging_service();
+                return ms.send_aggregate(net::messaging_service::shard_id{e.first, 0}, *cmd, e.second, aggregates, int32_t(cl));
+            }, partial_aggregates_merger(*s, aggregates));
+        }).then([] (query::partial_aggregates result) {
+            return std::move(result.values);
+        }).finally([lc, p] () mutable {
+            p->_stats.read.mark(lc.stop().latency_in_nano());
+            p->_stats.read_latencies.mark(lc.latency_in_micro());
+            --p->_stats.reads_in_flight;
+            p->_read_admission.notify();
+        });
+    });
+}
+
 future<foreign_ptr<lw_shared_ptr<query::result>>>
 storage_proxy::query(schema_ptr s,
     lw_shared_ptr<query::read_command> cmd,
     std::vector<query::partition_range>&& partition_ranges,
-    db::consistency_level cl)
+    db::consistency_level cl,
+    tracing::trace_state_ptr trace_state)
+{
+    // A session begun here rather than by the client request ends here.
+    auto began = !trace_state;
+    trace_state = maybe_begin_trace(*s, "Execute read", cl, std::move(trace_state));
+    // The command of a query's next page may be that of a traced one.
+    cmd->trace_session = std::experimental::optional<utils::UUID>();
+    if (trace_state && trace_state->traced()) {
+        cmd->trace_session = trace_state->session_id();
+    }
+    auto start = std::chrono::steady_clock::now();
+    return _read_admission.admit().then([this, s = std::move(s), cmd = std::move(cmd), partition_ranges = std::move(partition_ranges), cl,
+            trace_state] () mutable {
+        ++_stats.reads_in_flight;
+        tracing::trace(trace_state, "Admitted, reading %d partition ranges", partition_ranges.size());
+        return do_query_traced(std::move(s), std::move(cmd), std::move(partition_ranges), cl, std::move(trace_state)).finally([p = shared_from_this()] {
+            --p->_stats.reads_in_flight;
+            p->_read_admission.notify();
+        });
+    }).finally([trace_state, began, start] {
+        if (trace_state) {
+            trace_state->add_stage_time(tracing::stage::coordinator, std::chrono::steady_clock::now() - start);
+            if (began) {
+                trace_state->end();
+            }
+        }
+    });
+}
+
+future<foreign_ptr<lw_shared_ptr<query::result>>>
+storage_proxy::do_query_traced(schema_ptr s,
+    lw_shared_ptr<query::read_command> cmd,
+    std::vector<query::partition_range>&& partition_ranges,
+    db::consistency_level cl,
+    tracing::trace_state_ptr trace_state)
 {
     if (logger.is_enabled(logging::log_level::trace)) {
         static thread_local int next_id = 0;
         auto query_id = next_id++;
 
         logger.trace("query {}.{} cmd={}, ranges={}, id={}", s->ks_name(), s->cf_name(), *cmd, ::join(", ", partition_ranges), query_id);
-        return do_query(s, cmd, std::move(partition_ranges), cl).then([query_id, cmd, s] (foreign_ptr<lw_shared_ptr<query::result>>&& res) {
+        return do_query(s, cmd, std::move(partition_ranges), cl, std::move(trace_state)).then([query_id, cmd, s] (foreign_ptr<lw_shared_ptr<query::result>>&& res) {
             logger.trace("query_result id={}, {}", query_id, res->pretty_print(s, cmd->slice));
             return std::move(res);
         });
     }
 
-    return do_query(s, cmd, std::move(partition_ranges), cl);
+    return do_query(s, cmd, std::move(partition_ranges), cl, std::move(trace_state));
+}
+
+bool storage_proxy::cluster_supports(cluster_feature& f) {
+    if (!f.enabled) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - f.checked > std::chrono::seconds(1)) {
+            f.checked = now;
+            f.enabled = gms::get_local_gossiper().cluster_supports_feature(f.name);
+        }
+    }
+    return f.enabled;
 }
 
 future<foreign_ptr<lw_shared_ptr<query::result>>>
 storage_proxy::do_query(schema_ptr s,
     lw_shared_ptr<query::read_command> cmd,
     std::vector<query::partition_range>&& partition_ranges,
-    db::consistency_level cl)
+    db::consistency_level cl,
+    tracing::trace_state_ptr trace_state)
 {
     static auto make_empty = [] {
         return make_ready_future<foreign_ptr<lw_shared_ptr<query::result>>>(make_foreign(make_lw_shared<query::result>()));
@@ -1957,13 +2919,25 @@ storage_proxy::do_query(schema_ptr s,
     lc.start();
     auto p = shared_from_this();
 
+    // Replicas compute digests with whatever the command asks for, so a mixed
+    // cluster keeps using MD5 until every node can do murmur3.
+    if (cluster_supports(_murmur3_digest)) {
+        cmd->slice.options.set(query::partition_slice::option::murmur3_digest);
+    }
+    // Nodes which don't know the columnar format would send rows instead.
+    if (cmd->slice.options.contains(query::partition_slice::option::columnar) && !cluster_supports(_columnar_results)) {
+        cmd->slice.options.remove(query::partition_slice::option::columnar);
+    }
+
     if (partition_ranges[0].is_singular() && partition_ranges[0].start()->value().has_key()) { // do not support mixed partitions (yet?)
         try {
-            return query_singular(cmd, std::move(partition_ranges), cl).finally([lc, p] () mutable {
+            return query_singular(cmd, std::move(partition_ranges), cl, std::move(trace_state)).finally([lc, p] () mutable {
                     p->_stats.read.mark(lc.stop().latency_in_nano());
+                    p->_stats.read_latencies.mark(lc.latency_in_micro());
             });
         } catch (const no_such_column_family&) {
             _stats.read.mark(lc.stop().latency_in_nano());
+            _stats.read_latencies.mark(lc.latency_in_micro());
             return make_empty();
         }
     }
@@ -1974,8 +2948,9 @@ storage_proxy::do_query(schema_ptr s,
         _stats.read.mark(lc.stop().latency_in_nano());
     }
 
-    return query_partition_key_range(cmd, std::move(partition_ranges[0]), cl).finally([lc, p] () mutable {
+    return query_partition_key_range(cmd, std::move(partition_ranges[0]), cl, std::move(trace_state)).finally([lc, p] () mutable {
         p->_stats.read.mark(lc.stop().latency_in_nano());
+        p->_stats.range_latencies.mark(lc.latency_in_micro());
     });
 }
 
@@ -2051,6 +3026,7 @@ std::vector<gms::inet_address> storage_proxy::get_live_sorted_endpoints(keyspace
     auto itend = boost::range::remove_if(eps, std::not1(std::bind1st(std::mem_fn(&gms::failure_detector::is_alive), &gms::get_local_failure_detector())));
     eps.erase(itend, eps.end());
     locator::i_endpoint_snitch::get_local_snitch_ptr()->sort_by_proximity(utils::fb_utilities::get_broadcast_address(), eps);
+    _dynamic_snitch.sort_by_proximity(eps);
     return eps;
 }
 
@@ -2198,32 +3174,7 @@ bool storage_proxy::should_hint(gms::inet_address ep) {
         return false;
     }
 
-    return false;
-#if 0
-    if (DatabaseDescriptor.shouldHintByDC())
-    {
-        final String dc = DatabaseDescriptor.getEndpointSnitch().getDatacenter(ep);
-        //Disable DC specific hints
-        if(!DatabaseDescriptor.hintedHandoffEnabled(dc))
-        {
-            HintedHandOffManager.instance.metrics.incrPastWindow(ep);
-            return false;
-        }
-    }
-    else if (!DatabaseDescriptor.hintedHandoffEnabled())
-    {
-        HintedHandOffManager.instance.metrics.incrPastWindow(ep);
-        return false;
-    }
-
-    boolean hintWindowExpired = Gossiper.instance.getEndpointDowntime(ep) > DatabaseDescriptor.getMaxHintWindow();
-    if (hintWindowExpired)
-    {
-        HintedHandOffManager.instance.metrics.incrPastWindow(ep);
-        Tracing.trace("Not hinting {} which has been down {}ms", ep, Gossiper.instance.getEndpointDowntime(ep));
-    }
-    return !hintWindowExpired;
-#endif
+    return _db.local().get_config().hinted_handoff_enabled() && _hints_manager->can_hint(ep);
 }
 
 future<> storage_proxy::truncate_blocking(sstring keyspace, sstring cfname) {
@@ -2437,6 +3388,41 @@ future<> storage_proxy::truncate_blocking(sstring keyspace, sstring cfname) {
     }
 #endif
 
+// Applies a mutation received from a coordinator, forwards it to the other
+// replicas of this datacenter and acknowledges it to the coordinator.
+static void handle_mutation(frozen_mutation in, std::vector<gms::inet_address> forward, gms::inet_address reply_to, unsigned shard, storage_proxy::response_id_type response_id) {
+    do_with(std::move(in), get_local_shared_storage_proxy(), [forward = std::move(forward), reply_to, shard, response_id] (const frozen_mutation& m, shared_ptr<storage_proxy>& p) {
+        return make_ready_future<>().then([&p, &m, reply_to, shard, response_id, forward = std::move(forward)] () mutable {
+            return when_all(
+                p->mutate_locally(m).then([reply_to, shard, response_id] () mutable {
+                    auto& ms = net::get_local_messaging_service();
+                    ms.send_mutation_done(net::messaging_service::shard_id{reply_to, shard}, shard, response_id).then_wrapped([] (future<> f) {
+                        f.ignore_ready_future();
+                    });
+                    // return void, no need to wait for send to complete
+                }),
+                parallel_for_each(forward.begin(), forward.end(), [reply_to, shard, response_id, &m, &p] (gms::inet_address forward) {
+                    auto& ms = net::get_local_messaging_service();
+                    return ms.send_mutation(replica_shard(forward, token_of(p->get_db().local(), m)), m, {}, reply_to, shard, response_id).then_wrapped([] (future<> f) {
+                        f.ignore_ready_future();
+                    });
+                })
+            );
+        }).then_wrapped([] (auto&& f) {
+                try {
+                    f.get();
+                } catch (std::exception& e){
+                    logger.warn("MUTATION verb handler: {}", e.what());
+                } catch(...) {
+                    logger.warn("MUTATION verb handler: unknown exception is thrown");
+                }
+
+                // don't propagate the exception further
+                return make_ready_future<>();
+        });
+    }).discard_result();
+}
+
 void storage_proxy::init_messaging_service() {
     auto& ms = net::get_local_messaging_service();
     ms.register_definitions_update( [] (std::vector<frozen_mutation> m) {
@@ -2455,40 +3441,47 @@ void storage_proxy::init_messaging_service() {
             // keep local proxy alive
         });
     });
+    ms.register_keyspace_migration_request([] (std::vector<sstring> keyspaces, std::vector<utils::UUID> digests) {
+        std::map<sstring, utils::UUID> their_digests;
+        for (size_t i = 0; i < keyspaces.size() && i < digests.size(); ++i) {
+            their_digests.emplace(std::move(keyspaces[i]), digests[i]);
+        }
+        return db::schema_tables::convert_schema_to_mutations(get_storage_proxy(), std::move(their_digests)).finally([p = get_local_shared_storage_proxy()] {
+            // keep local proxy alive
+        });
+    });
     ms.register_mutation([] (frozen_mutation in, std::vector<gms::inet_address> forward, gms::inet_address reply_to, unsigned shard, storage_proxy::response_id_type response_id) {
-        do_with(std::move(in), get_local_shared_storage_proxy(), [forward = std::move(forward), reply_to, shard, response_id] (const frozen_mutation& m, shared_ptr<storage_proxy>& p) {
-            return make_ready_future<>().then([&p, &m, reply_to, shard, response_id, forward = std::move(forward)] () mutable {
-                return when_all(
-                    p->mutate_locally(m).then([reply_to, shard, response_id] () mutable {
-                        auto& ms = net::get_local_messaging_service();
-                        ms.send_mutation_done(net::messaging_service::shard_id{reply_to, shard}, shard, response_id).then_wrapped([] (future<> f) {
-                            f.ignore_ready_future();
-                        });
-                        // return void, no need to wait for send to complete
-                    }),
-                    parallel_for_each(forward.begin(), forward.end(), [reply_to, shard, response_id, &m] (gms::inet_address forward) {
-                        auto& ms = net::get_local_messaging_service();
-                        return ms.send_mutation(net::messaging_service::shard_id{forward, 0}, m, {}, reply_to, shard, response_id).then_wrapped([] (future<> f) {
-                            f.ignore_ready_future();
-                        });
-                    })
-                );
-            }).then_wrapped([] (auto&& f) {
-                    try {
-                        f.get();
-                    } catch (std::exception& e){
-                        logger.warn("MUTATION verb handler: {}", e.what());
-                    } catch(...) {
-                        logger.warn("MUTATION verb handler: unknown exception is thrown");
-                    }
-
-                    // don't propagate the exception further
-                    return make_ready_future<>();
-            });
-        }).discard_result();
-
+        handle_mutation(std::move(in), std::move(forward), reply_to, shard, response_id);
+        return net::messaging_service::no_wait();
+    });
+    ms.register_mutations([] (std::vector<frozen_mutation> in, std::vector<std::vector<gms::inet_address>> forward, gms::inet_address reply_to, unsigned shard,
+            std::vector<storage_proxy::response_id_type> response_ids) {
+        for (size_t i = 0; i < in.size(); ++i) {
+            handle_mutation(std::move(in[i]), std::move(forward[i]), reply_to, shard, response_ids[i]);
+        }
         return net::messaging_service::no_wait();
     });
+    ms.register_counter_mutation([] (frozen_mutation fm, int32_t cl) {
+        auto p = get_local_shared_storage_proxy();
+        return p->apply_counter_update_on_leader(std::move(fm), db::consistency_level(cl)).finally([p] {
+            // keep local proxy alive
+        });
+    });
+    ms.register_paxos_prepare([] (query::read_command cmd, query::partition_range pr, utils::UUID ballot) {
+        return do_with(std::move(pr), get_local_shared_storage_proxy(), [cmd = make_lw_shared<query::read_command>(std::move(cmd)), ballot] (const query::partition_range& pr, shared_ptr<storage_proxy>& p) {
+            return p->prepare_paxos_locally(cmd, pr, ballot);
+        });
+    });
+    ms.register_paxos_propose([] (paxos::proposal proposal) {
+        return do_with(std::move(proposal), get_local_shared_storage_proxy(), [] (const paxos::proposal& proposal, shared_ptr<storage_proxy>& p) {
+            return p->accept_paxos_locally(proposal);
+        });
+    });
+    ms.register_paxos_commit([] (paxos::proposal proposal) {
+        return do_with(std::move(proposal), get_local_shared_storage_proxy(), [] (const paxos::proposal& proposal, shared_ptr<storage_proxy>& p) {
+            return p->learn_paxos_locally(proposal);
+        });
+    });
     ms.register_mutation_done([] (rpc::client_info cinfo, unsigned shard, storage_proxy::response_id_type response_id) {
         gms::inet_address from(net::ntoh(cinfo.addr.as_posix_sockaddr_in().sin_addr.s_addr));
         get_storage_proxy().invoke_on(shard, [from, response_id] (storage_proxy& sp) {
@@ -2511,6 +3504,13 @@ void storage_proxy::init_messaging_service() {
             return p->query_singular_local_digest(cmd, pr);
         });
     });
+    ms.register_aggregate([] (query::read_command cmd, std::vector<query::partition_range> ranges, std::vector<query::aggregate> aggregates, int32_t cl) {
+        auto p = get_local_shared_storage_proxy();
+        return p->query_partial_aggregates(make_lw_shared<query::read_command>(std::move(cmd)), std::move(ranges), std::move(aggregates),
+                db::consistency_level(cl)).finally([p] {
+            // keep local proxy alive
+        });
+    });
     ms.register_truncate([](sstring ksname, sstring cfname) {
         const auto truncated_at = db_clock::now();
         return get_storage_proxy().invoke_on_all([truncated_at, ksname, cfname](storage_proxy& sp) {
@@ -2523,11 +3523,18 @@ void storage_proxy::uninit_messaging_service() {
     auto& ms = net::get_local_messaging_service();
     ms.unregister_definitions_update();
     ms.unregister_migration_request();
+    ms.unregister_keyspace_migration_request();
     ms.unregister_mutation();
+    ms.unregister_mutations();
+    ms.unregister_counter_mutation();
+    ms.unregister_paxos_prepare();
+    ms.unregister_paxos_propose();
+    ms.unregister_paxos_commit();
     ms.unregister_mutation_done();
     ms.unregister_read_data();
     ms.unregister_read_mutation_data();
     ms.unregister_read_digest();
+    ms.unregister_aggregate();
     ms.unregister_truncate();
 }
 
@@ -2642,8 +3649,9 @@ storage_proxy::query_mutations_locally(lw_shared_ptr<query::read_command> cmd, c
 
 future<>
 storage_proxy::stop() {
+    _db.local().set_view_update_sender({});
     uninit_messaging_service();
-    return make_ready_future<>();
+    return _hints_manager->stop();
 }
 
 class shard_reader final : public mutation_reader::impl {
@@ -49,12 +49,35 @@
 #include "db/consistency_level.hh"
 #include "db/write_type.hh"
 #include "utils/histogram.hh"
+#include "locator/dynamic_snitch.hh"
+#include "gms/versioned_value.hh"
+#include "service/admission_queue.hh"
+#include "service/paxos/proposal.hh"
+
+namespace db {
+namespace hints {
+
+class manager;
+
+}
+}
 
 namespace service {
 
 class abstract_write_response_handler;
 class abstract_read_executor;
 
+// A conditional update of a single partition, for storage_proxy::cas().
+class cas_request {
+public:
+    virtual ~cas_request() {}
+    // Given the current contents of the partition, as read by the read
+    // command of the update, returns the update to make with timestamp ts,
+    // or nothing when its conditions do not hold.
+    virtual std::experimental::optional<mutation> apply(const query::result& current,
+            const query::partition_slice& slice, api::timestamp_type ts) = 0;
+};
+
 class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*implements StorageProxyMBean*/ {
     struct rh_entry {
         std::unique_ptr<abstract_write_response_handler> handler;
@@ -74,6 +97,32 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
         utils::ihistogram read;
         utils::ihistogram write;
         utils::ihistogram range;
+        // Latencies, in microseconds, of every coordinated operation, for
+        // percentiles; mergeable across shards.
+        utils::decaying_histogram read_latencies;
+        utils::decaying_histogram write_latencies;
+        utils::decaying_histogram range_latencies;
+        // Write handlers, including the ones past their consistency level
+        // which still wait for some replicas, and their mutations' size.
+        uint64_t writes_in_flight = 0;
+        uint64_t write_bytes_in_flight = 0;
+        uint64_t reads_in_flight = 0;
+        // Reads which contacted extra replicas for read repair, and the
+        // repairs made of mismatches found while the read waited for them,
+        // or after it completed. Background repairs beyond the limit on
+        // those in flight are dropped.
+        uint64_t read_repair_attempted = 0;
+        uint64_t read_repair_repaired_blocking = 0;
+        uint64_t read_repair_repaired_background = 0;
+        uint64_t read_repair_dropped = 0;
+        // Rows and cells sent to replicas which missed them.
+        uint64_t read_repair_mutations = 0;
+        uint64_t read_repair_bytes = 0;
+        // Updates of materialized views sent to view replicas, those which
+        // failed, and the size of those not acknowledged yet.
+        uint64_t view_updates = 0;
+        uint64_t view_update_failures = 0;
+        uint64_t view_update_backlog_bytes = 0;
     };
     using response_id_type = uint64_t;
 private:
@@ -81,6 +130,11 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     response_id_type _next_response_id = 0;
     std::unordered_map<response_id_type, rh_entry> _response_handlers;
     constexpr static size_t _max_hints_in_progress = 128; // origin multiplies by FBUtilities.getAvailableProcessors() but we already sharded
+    // Repairs of mismatches found after a read completed run in the
+    // background, at most this many at a time, so that they can't pile up
+    // and compete with the reads.
+    constexpr static size_t _max_background_read_repairs = 32;
+    semaphore _background_read_repairs{_max_background_read_repairs};
     size_t _total_hints_in_progress = 0;
     std::unordered_map<gms::inet_address, size_t> _hints_in_progress;
     stats _stats;
@@ -88,10 +142,37 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     // for read repair chance calculation
     std::default_random_engine _urandom;
     std::uniform_real_distribution<> _read_repair_chance = std::uniform_real_distribution<>(0,1);
+    locator::dynamic_snitch _dynamic_snitch;
+    // A feature the cluster supports once every node does, checked at most
+    // once a second until then.
+    struct cluster_feature {
+        const char* name;
+        bool enabled = false;
+        std::chrono::steady_clock::time_point checked = {};
+    };
+    cluster_feature _murmur3_digest{gms::versioned_value::MURMUR3_DIGEST};
+    cluster_feature _columnar_results{gms::versioned_value::COLUMNAR_RESULTS};
+    cluster_feature _batched_mutations{gms::versioned_value::BATCHED_MUTATIONS};
+    cluster_feature _aggregate{gms::versioned_value::AGGREGATE};
+    std::unique_ptr<db::hints::manager> _hints_manager;
+    // Limits on what the shard coordinates at once. 0 means no limit.
+    uint64_t _max_writes_in_flight;
+    uint64_t _max_write_bytes_in_flight;
+    uint64_t _max_reads_in_flight;
+    admission_queue _write_admission;
+    admission_queue _read_admission;
+    // Room for the view updates sent and not acknowledged yet, in bytes.
+    // Writes to base tables wait for it once the view replicas fall behind.
+    size_t _max_view_update_backlog;
+    semaphore _view_update_backlog;
+    // The host id of this node, which names its counter shards.
+    std::experimental::optional<utils::UUID> _counter_id;
 private:
     void init_messaging_service();
+    bool cluster_supports(cluster_feature& f);
     void uninit_messaging_service();
-    future<foreign_ptr<lw_shared_ptr<query::result>>> query_singular(lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges, db::consistency_level cl);
+    future<foreign_ptr<lw_shared_ptr<query::result>>> query_singular(lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges, db::consistency_level cl,
+            tracing::trace_state_ptr trace_state);
     response_id_type register_response_handler(std::unique_ptr<abstract_write_response_handler>&& h);
     void remove_response_handler(response_id_type id);
     void got_response(response_id_type id, gms::inet_address from);
@@ -100,7 +181,17 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     response_id_type create_write_response_handler(keyspace& ks, db::consistency_level cl, db::write_type type, frozen_mutation&& mutation, std::unordered_set<gms::inet_address> targets,
             const std::vector<gms::inet_address>& pending_endpoints, std::vector<gms::inet_address>);
     response_id_type create_write_response_handler(const mutation&, db::consistency_level cl, db::write_type type);
-    future<> send_to_live_endpoints(response_id_type response_id,  sstring local_data_center);
+    future<> send_to_live_endpoints(std::vector<response_id_type> ids, sstring local_data_center);
+    // Sends a mutation to target only, resolving once it acknowledged it.
+    future<> send_to_endpoint(frozen_mutation fm, gms::inet_address target, db::write_type type);
+    // The replica of the view partition with view_token which is paired with
+    // this node as a replica of the base partition with base_token: the one
+    // at the same position among the replicas of the local data center. None
+    // if this node is not a replica of the base partition there.
+    std::experimental::optional<gms::inet_address> get_view_natural_endpoint(keyspace& ks,
+            const dht::token& base_token, const dht::token& view_token);
+    future<> send_view_updates(schema_ptr base, dht::token base_token, std::vector<mutation> updates);
+    future<> send_view_update(lw_shared_ptr<const frozen_mutation> fm, gms::inet_address target);
     template<typename Range>
     size_t hint_to_dead_endpoints(lw_shared_ptr<const frozen_mutation> m, const Range& targets);
     void hint_to_dead_endpoints(response_id_type, db::consistency_level);
@@ -109,27 +200,72 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     bool should_hint(gms::inet_address ep);
     bool submit_hint(lw_shared_ptr<const frozen_mutation> m, gms::inet_address target);
     std::vector<gms::inet_address> get_live_sorted_endpoints(keyspace& ks, const dht::token& token);
+    void on_read_response(gms::inet_address ep, std::chrono::steady_clock::time_point start) {
+        _dynamic_snitch.on_read_response(ep, std::chrono::steady_clock::now() - start);
+    }
     db::read_repair_decision new_read_repair_decision(const schema& s);
-    ::shared_ptr<abstract_read_executor> get_read_executor(lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl);
+    ::shared_ptr<abstract_read_executor> get_read_executor(lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl,
+            tracing::trace_state_ptr trace_state);
+    ::shared_ptr<abstract_read_executor> make_read_executor(lw_shared_ptr<query::read_command> cmd, query::partition_range pr, db::consistency_level cl);
     future<foreign_ptr<lw_shared_ptr<query::result>>> query_singular_local(lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr);
     future<query::result_digest> query_singular_local_digest(lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr);
-    future<foreign_ptr<lw_shared_ptr<query::result>>> query_partition_key_range(lw_shared_ptr<query::read_command> cmd, query::partition_range&& range, db::consistency_level cl);
+    future<foreign_ptr<lw_shared_ptr<query::result>>> query_partition_key_range(lw_shared_ptr<query::read_command> cmd, query::partition_range&& range, db::consistency_level cl,
+            tracing::trace_state_ptr trace_state);
     std::vector<query::partition_range> get_restricted_ranges(keyspace& ks, const schema& s, query::partition_range range);
     float estimate_result_rows_per_range(lw_shared_ptr<query::read_command> cmd, keyspace& ks);
     static std::vector<gms::inet_address> intersection(const std::vector<gms::inet_address>& l1, const std::vector<gms::inet_address>& l2);
+    future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>> query_singular_concurrent(std::chrono::high_resolution_clock::time_point timeout,
+            std::vector<foreign_ptr<lw_shared_ptr<query::result>>>&& results, lw_shared_ptr<query::read_command> cmd, db::consistency_level cl,
+            std::vector<query::partition_range>::iterator&& i, std::vector<query::partition_range>&& ranges, uint32_t rows,
+            tracing::trace_state_ptr trace_state);
     future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>> query_partition_key_range_concurrent(std::chrono::high_resolution_clock::time_point timeout,
             std::vector<foreign_ptr<lw_shared_ptr<query::result>>>&& results, lw_shared_ptr<query::read_command> cmd, db::consistency_level cl, std::vector<query::partition_range>::iterator&& i,
-            std::vector<query::partition_range>&& ranges, int concurrency_factor);
+            std::vector<query::partition_range>&& ranges, int concurrency_factor, uint32_t rows, tracing::trace_state_ptr trace_state);
+
+    future<query::partial_aggregates> query_partial_aggregates(lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range> ranges,
+            std::vector<query::aggregate> aggregates, db::consistency_level cl);
 
+    future<foreign_ptr<lw_shared_ptr<query::result>>> do_query_traced(schema_ptr,
+        lw_shared_ptr<query::read_command> cmd,
+        std::vector<query::partition_range>&& partition_ranges,
+        db::consistency_level cl,
+        tracing::trace_state_ptr trace_state);
     future<foreign_ptr<lw_shared_ptr<query::result>>> do_query(schema_ptr,
         lw_shared_ptr<query::read_command> cmd,
         std::vector<query::partition_range>&& partition_ranges,
-        db::consistency_level cl);
+        db::consistency_level cl,
+        tracing::trace_state_ptr trace_state);
+    // The state of the client request the caller passes, or else a new
+    // session for a request on a table, if it's sampled. Writing out traces
+    // is never traced.
+    static tracing::trace_state_ptr maybe_begin_trace(const schema& s, const char* request, db::consistency_level cl,
+            tracing::trace_state_ptr trace_state);
     template<typename Range, typename CreateWriteHandler>
     future<std::vector<storage_proxy::response_id_type>> mutate_prepare(const Range& mutations, db::consistency_level cl, db::write_type type, CreateWriteHandler handler);
     future<std::vector<storage_proxy::response_id_type>> mutate_prepare(std::vector<mutation>& mutations, db::consistency_level cl, db::write_type type);
     future<> mutate_begin(const std::vector<storage_proxy::response_id_type> ids, db::consistency_level cl, const sstring& local_dc);
     future<> mutate_end(future<> mutate_result, utils::latency_counter);
+    future<> do_mutate(std::vector<mutation> mutations, db::consistency_level cl, tracing::trace_state_ptr trace_state);
+    // Counter updates are sent to a live replica, preferably this node,
+    // which turns them into its own shards before writing them to all.
+    future<> mutate_counter(mutation m, db::consistency_level cl);
+    future<> apply_counter_update_on_leader(frozen_mutation fm, db::consistency_level cl);
+    future<utils::UUID> get_counter_id();
+    struct paxos_participants {
+        std::vector<gms::inet_address> endpoints;
+        size_t required;
+    };
+    paxos_participants get_paxos_participants(const schema& s, const dht::token& token, db::consistency_level cl_for_paxos);
+    future<paxos::prepare_response> prepare_paxos_locally(lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr, utils::UUID ballot);
+    future<bool> accept_paxos_locally(const paxos::proposal& p);
+    future<> learn_paxos_locally(const paxos::proposal& p);
+    future<std::vector<std::pair<gms::inet_address, paxos::prepare_response>>> prepare_paxos(const paxos_participants& participants,
+            lw_shared_ptr<query::read_command> cmd, const query::partition_range& pr, utils::UUID ballot);
+    future<bool> propose_paxos(const paxos_participants& participants, const paxos::proposal& p, db::consistency_level cl_for_paxos);
+    future<> commit_paxos(const schema& s, const dht::token& token, const paxos::proposal& p, db::consistency_level cl_for_commit);
+    future<> send_paxos_commit(const std::vector<gms::inet_address>& endpoints, const paxos::proposal& p, size_t block_for, db::consistency_level cl);
+    future<std::experimental::optional<bool>> cas_attempt(schema_ptr s, shared_ptr<cas_request> request, lw_shared_ptr<query::read_command> cmd,
+            const query::partition_range& pr, db::consistency_level cl_for_paxos, db::consistency_level cl_for_commit, api::timestamp_type& last_ballot);
 
 public:
     storage_proxy(distributed<database>& db);
@@ -138,6 +274,17 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
         return _db;
     }
 
+    db::hints::manager& get_hints_manager() {
+        return *_hints_manager;
+    }
+
+    // Starts storing and delivering hints, if hinted handoff is enabled.
+    future<> start_hints_manager();
+
+    // Delivers a hint to its target, and only to it. Resolves once the
+    // target acknowledged it.
+    future<> send_hint(frozen_mutation fm, gms::inet_address target);
+
     future<> mutate_locally(const mutation& m);
     future<> mutate_locally(const frozen_mutation& m);
     future<> mutate_locally(std::vector<mutation> mutations);
@@ -150,11 +297,12 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     *
     * @param mutations the mutations to be applied across the replicas
     * @param consistency_level the consistency level for the operation
+    * @param trace_state that of the client request, if any
     */
-    future<> mutate(std::vector<mutation> mutations, db::consistency_level cl);
+    future<> mutate(std::vector<mutation> mutations, db::consistency_level cl, tracing::trace_state_ptr trace_state = nullptr);
 
     future<> mutate_with_triggers(std::vector<mutation> mutations, db::consistency_level cl,
-        bool should_mutate_atomically);
+        bool should_mutate_atomically, tracing::trace_state_ptr trace_state = nullptr);
 
     /**
     * See mutate. Adds additional steps before and after writing a batch.
@@ -167,6 +315,25 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     */
     future<> mutate_atomically(std::vector<mutation> mutations, db::consistency_level cl);
 
+    /**
+     * Applies the update of the request if and only if its conditions hold
+     * on the current contents of the partition of pr, as read by cmd. The
+     * replicas of the partition agree on the update with Paxos, in which
+     * the coordinator proposes the update of a ballot promised by a quorum
+     * of them, and commits it once a quorum of them accepted it.
+     *
+     * The replicas read the partition as they promise the ballot, so that a
+     * conditional update takes a round to prepare, to propose and to commit
+     * when it applies, and the first one alone when it does not.
+     *
+     * @param cl_for_paxos SERIAL or LOCAL_SERIAL, for the prepare and propose rounds
+     * @param cl_for_commit any but SERIAL and LOCAL_SERIAL, for the commit
+     *
+     * @return whether the update was applied
+     */
+    future<bool> cas(schema_ptr s, shared_ptr<cas_request> request, lw_shared_ptr<query::read_command> cmd,
+            query::partition_range pr, db::consistency_level cl_for_paxos, db::consistency_level cl_for_commit);
+
     /**
      * Performs the truncate operatoin, which effectively deletes all data from
      * the column family cfname
@@ -180,10 +347,25 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
      *
      * Partitions for each range will be ordered according to decorated_key ordering. Results for
      * each range from "partition_ranges" may appear in any order.
+     *
+     * The trace state of the client request, if any, gets the time spent
+     * coordinating the query and that of each replica to respond.
      */
     future<foreign_ptr<lw_shared_ptr<query::result>>> query(schema_ptr,
         lw_shared_ptr<query::read_command> cmd,
         std::vector<query::partition_range>&& partition_ranges,
+        db::consistency_level cl,
+        tracing::trace_state_ptr trace_state = nullptr);
+
+    /*
+     * Computes aggregates of the rows a data query selects, in the order of
+     * "aggregates". A scan has the replicas of each of its token ranges
+     * aggregate the range, and merges their partial results.
+     */
+    future<std::vector<bytes_opt>> query_aggregates(schema_ptr,
+        lw_shared_ptr<query::read_command> cmd,
+        std::vector<query::partition_range>&& partition_ranges,
+        std::vector<query::aggregate> aggregates,
         db::consistency_level cl);
 
     future<foreign_ptr<lw_shared_ptr<query::result>>> query_local(lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges);
@@ -204,6 +386,14 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     const stats& get_stats() const {
         return _stats;
     }
+
+    const admission_queue::stats& get_write_admission_stats() const {
+        return _write_admission.get_stats();
+    }
+
+    const admission_queue::stats& get_read_admission_stats() const {
+        return _read_admission.get_stats();
+    }
 };
 
 extern distributed<storage_proxy> _the_storage_proxy;
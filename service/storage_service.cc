@@ -53,6 +53,8 @@
 #include "locator/local_strategy.hh"
 #include "version.hh"
 #include "unimplemented.hh"
+#include "tracing/tracing.hh"
+#include "exceptions/exceptions.hh"
 
 using token = dht::token;
 using UUID = utils::UUID;
@@ -168,6 +170,22 @@ future<> storage_service::prepare_to_join() {
         app_states.emplace(gms::application_state::HOST_ID, value_factory.host_id(local_host_id));
         app_states.emplace(gms::application_state::RPC_ADDRESS, value_factory.rpcaddress(broadcast_rpc_address));
         app_states.emplace(gms::application_state::RELEASE_VERSION, value_factory.release_version());
+        app_states.emplace(gms::application_state::SUPPORTED_FEATURES, value_factory.supported_features({
+            gms::versioned_value::MURMUR3_DIGEST,
+            gms::versioned_value::COLUMNAR_RESULTS,
+            gms::versioned_value::BINARY_TOKENS,
+            gms::versioned_value::MUTATION_TOKENS,
+            gms::versioned_value::BATCHED_MUTATIONS,
+            gms::versioned_value::AGGREGATE,
+            gms::versioned_value::STREAM_MUTATIONS,
+            gms::versioned_value::STREAM_SSTABLE_FILES,
+            gms::versioned_value::REPAIR_MERKLE_TREE,
+        }));
+        app_states.emplace(gms::application_state::SHARD_COUNT, value_factory.shard_count(smp::count));
+        auto shard_aware_port = net::get_local_messaging_service().shard_aware_port();
+        if (shard_aware_port) {
+            app_states.emplace(gms::application_state::SHARD_AWARE_STORAGE_PORT, value_factory.shard_aware_storage_port(shard_aware_port));
+        }
         logger.info("Starting up server gossip");
 
         auto& gossiper = gms::get_local_gossiper();
@@ -324,11 +342,26 @@ void storage_service::join_token_ring(int delay) {
             }
         }
     }
-#if 0
     // if we don't have system_traces keyspace at this point, then create it manually
-    if (Schema.instance.getKSMetaData(TraceKeyspace.NAME) == null)
-        MigrationManager.announceNewKeyspace(TraceKeyspace.definition(), 0, false);
-#endif
+    if (!_db.local().has_keyspace(tracing::trace_keyspace_name)) {
+        try {
+            // At timestamp 0, so that the definitions of all nodes agree.
+            service::get_local_migration_manager().announce_new_keyspace(tracing::trace_keyspace_definition(), 0, false).get();
+        } catch (exceptions::already_exists_exception&) {
+            // Created by another node meanwhile.
+        }
+    } else {
+        // The keyspace may predate some of its tables.
+        for (auto&& cf : tracing::trace_keyspace_definition()->cf_meta_data()) {
+            if (!_db.local().has_schema(cf.second->ks_name(), cf.second->cf_name())) {
+                try {
+                    service::get_local_migration_manager().announce_new_column_family(cf.second, false).get();
+                } catch (exceptions::already_exists_exception&) {
+                    // Created by another node meanwhile.
+                }
+            }
+        }
+    }
 
     if (!_is_survey_mode) {
         // start participating in the ring.
@@ -373,7 +406,7 @@ void storage_service::bootstrap(std::unordered_set<token> tokens) {
     auto& gossiper = gms::get_local_gossiper();
     if (!is_replacing()) {
         // if not an existing token then bootstrap
-        gossiper.add_local_application_state(gms::application_state::TOKENS, value_factory.tokens(tokens));
+        gossiper.add_local_application_state(gms::application_state::TOKENS, value_factory.tokens(tokens, binary_tokens()));
         gossiper.add_local_application_state(gms::application_state::STATUS, value_factory.bootstrapping(tokens));
         set_mode(mode::JOINING, sprint("sleeping %s ms for pending range setup", RING_DELAY), true);
         sleep(std::chrono::milliseconds(RING_DELAY)).get();
@@ -810,19 +843,18 @@ sstring storage_service::get_application_state_value(inet_address endpoint, appl
     return v->value;
 }
 
+bool storage_service::binary_tokens() {
+    return gms::get_local_gossiper().cluster_supports_feature(gms::versioned_value::BINARY_TOKENS);
+}
+
 std::unordered_set<locator::token> storage_service::get_tokens_for(inet_address endpoint) {
-    auto tokens_string = get_application_state_value(endpoint, application_state::TOKENS);
-    logger.debug("endpoint={}, tokens_string={}", endpoint, tokens_string);
-    std::vector<sstring> tokens;
-    std::unordered_set<token> ret;
-    boost::split(tokens, tokens_string, boost::is_any_of(";"));
-    for (auto str : tokens) {
-        logger.debug("token={}", str);
-        sstring_view sv(str);
-        bytes b = from_hex(sv);
-        ret.emplace(token::kind::key, b);
+    auto eps = gms::get_local_gossiper().get_endpoint_state_for_endpoint(endpoint);
+    if (!eps) {
+        return {};
     }
-    return ret;
+    auto& tokens = eps->get_tokens();
+    logger.debug("endpoint={}, tokens={}", endpoint, tokens);
+    return tokens;
 }
 
 // Runs inside seastar::async context
@@ -833,7 +865,7 @@ void storage_service::set_tokens(std::unordered_set<token> tokens) {
     // Collection<Token> localTokens = getLocalTokens();
     auto local_tokens = _bootstrap_tokens;
     auto& gossiper = gms::get_local_gossiper();
-    gossiper.add_local_application_state(gms::application_state::TOKENS, value_factory.tokens(local_tokens));
+    gossiper.add_local_application_state(gms::application_state::TOKENS, value_factory.tokens(local_tokens, binary_tokens()));
     gossiper.add_local_application_state(gms::application_state::STATUS, value_factory.normal(local_tokens));
     set_mode(mode::NORMAL, false);
     replicate_to_all_cores().get();
@@ -973,7 +1005,7 @@ future<> storage_service::init_server(int delay) {
             if (!tokens.empty()) {
                 _token_metadata.update_normal_tokens(tokens, get_broadcast_address());
                 // order is important here, the gossiper can fire in between adding these two states.  It's ok to send TOKENS without STATUS, but *not* vice versa.
-                gossiper.add_local_application_state(gms::application_state::TOKENS, value_factory.tokens(tokens));
+                gossiper.add_local_application_state(gms::application_state::TOKENS, value_factory.tokens(tokens, binary_tokens()));
                 gossiper.add_local_application_state(gms::application_state::STATUS, value_factory.hibernate(true));
             }
             logger.info("Not joining ring as requested. Use JMX (StorageService->joinRing()) to initiate ring joining");
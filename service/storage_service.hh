@@ -701,6 +701,9 @@ class storage_service : public gms::i_endpoint_state_change_subscriber, public s
     void do_update_system_peers_table(gms::inet_address endpoint, const application_state& state, const versioned_value& value);
     sstring get_application_state_value(inet_address endpoint, application_state appstate);
     std::unordered_set<token> get_tokens_for(inet_address endpoint);
+    // Whether the TOKENS state may be gossiped packed in binary, which all
+    // the nodes must then understand.
+    bool binary_tokens();
     future<> replicate_to_all_cores();
     semaphore _replicate_task{1};
 private:
@@ -53,10 +53,13 @@
 #include "compaction.hh"
 #include "database.hh"
 #include "compaction_strategy.hh"
+#include "utils/cpu_scheduler.hh"
 #include "mutation_reader.hh"
 #include "schema.hh"
 #include "cql3/statements/property_definitions.hh"
 #include "leveled_manifest.hh"
+#include "hyperloglog.hh"
+#include "utils/bloom_calculations.hh"
 
 namespace sstables {
 
@@ -71,17 +74,208 @@ struct compaction_stats {
     std::vector<shared_sstable> new_sstables;
 };
 
-class sstable_reader final : public ::mutation_reader::impl {
+// Reads the partitions of an sstable in pieces of about the size memtable
+// partitions are flushed in.
+//
+// Of an sstable shared with other shards, as after the shard count changed,
+// only the partitions of this shard are read, so that the compaction writes
+// sstables of this shard alone; the other shards compact theirs.
+//
+// Given several ranges, the sstable reads them one after the other, looking
+// the start of each up in the summary and index, so that the partitions
+// between them are skipped rather than read.
+class sstable_reader final : public partition_source {
     shared_sstable _sst;
-    mutation_reader _reader;
+    schema_ptr _schema;
+    std::unique_ptr<partition_source> _source;
+    lw_shared_ptr<std::vector<query::partition_range>> _ranges;
+    size_t _next_range = 0;
+    // The bytes read by the sources of the ranges done with.
+    uint64_t _bytes_read_before = 0;
+private:
+    future<> skip_rows() {
+        return repeat([this] {
+            return _source->next_rows().then([] (mutation_opt m) {
+                return m ? stop_iteration::no : stop_iteration::yes;
+            });
+        });
+    }
+    std::unique_ptr<partition_source> read_range(const query::partition_range& range) {
+        return _sst->read_range_rows_in_pieces(_schema, range, default_write_options().flush_buffer_size,
+                compaction_priority());
+    }
+    // The next partition of the current range, or else of the next ones.
+    future<mutation_opt> next_partition_in_ranges() {
+        return _source->next_partition().then([this] (mutation_opt m) {
+            if (m || !_ranges || _next_range == _ranges->size()) {
+                return make_ready_future<mutation_opt>(std::move(m));
+            }
+            _bytes_read_before += _source->bytes_read();
+            _source = read_range((*_ranges)[_next_range++]);
+            return next_partition_in_ranges();
+        });
+    }
 public:
     sstable_reader(shared_sstable sst, schema_ptr schema)
-            : _sst(std::move(sst)), _reader(_sst->read_rows(schema)) {}
-    virtual future<mutation_opt> operator()() override {
-        return _reader.read();
+            : _sst(std::move(sst))
+            , _schema(std::move(schema))
+            , _source(_sst->read_rows_in_pieces(_schema, default_write_options().flush_buffer_size, compaction_priority())) {}
+    sstable_reader(shared_sstable sst, schema_ptr schema, const query::partition_range& range)
+            : _sst(std::move(sst))
+            , _schema(std::move(schema))
+            , _source(read_range(range)) {}
+    // The ranges must be sorted and disjoint.
+    sstable_reader(shared_sstable sst, schema_ptr schema, lw_shared_ptr<std::vector<query::partition_range>> ranges)
+            : _sst(std::move(sst))
+            , _schema(std::move(schema))
+            , _source(read_range(ranges->front()))
+            , _ranges(std::move(ranges))
+            , _next_range(1) {}
+    virtual future<mutation_opt> next_partition() override {
+        if (!_sst->is_shared()) {
+            return next_partition_in_ranges();
+        }
+        auto result = make_lw_shared<mutation_opt>();
+        return repeat([this, result] {
+            return next_partition_in_ranges().then([this, result] (mutation_opt m) {
+                if (!m || dht::shard_of(m->token()) == engine().cpu_id()) {
+                    *result = std::move(m);
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return skip_rows().then([] {
+                    return stop_iteration::no;
+                });
+            });
+        }).then([result] {
+            return std::move(*result);
+        });
+    }
+    virtual future<mutation_opt> next_rows() override {
+        return _source->next_rows();
     }
+    virtual uint64_t bytes_read() const override {
+        return _bytes_read_before + _source->bytes_read();
+    }
+};
+
+// A piece of a partition, as passed between the fibers of a compaction.
+struct compacted_piece {
+    mutation m;
+    // Whether it is the first piece of its partition.
+    bool first;
 };
 
+using piece_pipe_reader = seastar::pipe_reader<compacted_piece>;
+using piece_pipe_writer = seastar::pipe_writer<compacted_piece>;
+
+// Feeds the pieces of the partitions of a source into a pipe, waiting for
+// on_partition before feeding the first piece of each.
+static future<> feed_pieces(partition_source& src, lw_shared_ptr<piece_pipe_writer> out,
+        std::function<future<> (const mutation&)> on_partition) {
+    auto in_partition = make_lw_shared<bool>(false);
+    return repeat([&src, out, in_partition, on_partition = std::move(on_partition)] {
+        if (*in_partition) {
+            return src.next_rows().then([out, in_partition] (mutation_opt m) {
+                if (!m) {
+                    *in_partition = false;
+                    return make_ready_future<stop_iteration>(stop_iteration::no);
+                }
+                return out->write(compacted_piece{std::move(*m), false}).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        }
+        return src.next_partition().then([out, in_partition, on_partition] (mutation_opt m) {
+            if (!m) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            *in_partition = true;
+            auto f = on_partition(*m);
+            return f.then([out, m = std::move(*m)] () mutable {
+                return out->write(compacted_piece{std::move(m), true});
+            }).then([] {
+                return stop_iteration::no;
+            });
+        });
+    });
+}
+
+// Hands out the pieces fed into a pipe. An error which stopped the feeding
+// is raised once the pieces fed before it are out.
+class queue_source final : public partition_source {
+    lw_shared_ptr<piece_pipe_reader> _pr;
+    lw_shared_ptr<std::exception_ptr> _error;
+    // The source fed into the pipe, if any.
+    lw_shared_ptr<std::unique_ptr<partition_source>> _fed;
+private:
+    future<std::experimental::optional<compacted_piece>> read() {
+        return _pr->read().then([this] (std::experimental::optional<compacted_piece> piece) {
+            if (!piece && *_error) {
+                std::rethrow_exception(*_error);
+            }
+            return piece;
+        });
+    }
+public:
+    queue_source(lw_shared_ptr<piece_pipe_reader> pr, lw_shared_ptr<std::exception_ptr> error = make_lw_shared<std::exception_ptr>(),
+            lw_shared_ptr<std::unique_ptr<partition_source>> fed = {})
+        : _pr(std::move(pr))
+        , _error(std::move(error))
+        , _fed(std::move(fed))
+    { }
+    virtual future<mutation_opt> next_partition() override {
+        return read().then([this] (auto piece) {
+            if (!piece) {
+                return make_ready_future<mutation_opt>();
+            }
+            if (!piece->first) {
+                // The rest of a partition which was not read through.
+                return next_partition();
+            }
+            return make_ready_future<mutation_opt>(std::move(piece->m));
+        });
+    }
+    virtual future<mutation_opt> next_rows() override {
+        return read().then([this] (auto piece) {
+            if (!piece) {
+                return make_ready_future<mutation_opt>();
+            }
+            if (piece->first) {
+                // The start of the next partition, which may go into
+                // another sstable.
+                _pr->unread(std::move(*piece));
+                return make_ready_future<mutation_opt>();
+            }
+            return make_ready_future<mutation_opt>(std::move(piece->m));
+        });
+    }
+    // Includes what was read ahead into the pipe.
+    virtual uint64_t bytes_read() const override {
+        return _fed ? (*_fed)->bytes_read() : 0;
+    }
+};
+
+// The pieces each input sstable is read ahead by.
+static constexpr size_t prefetch_depth = 4;
+
+// Reads a source ahead of its consumer, in a fiber of its own, so that the
+// reading and parsing of each input sstable overlaps with the merging.
+static std::unique_ptr<partition_source> make_prefetching_source(std::unique_ptr<partition_source> src, size_t depth) {
+    seastar::pipe<compacted_piece> p{depth};
+    auto reader = make_lw_shared<piece_pipe_reader>(std::move(p.reader));
+    auto writer = make_lw_shared<piece_pipe_writer>(std::move(p.writer));
+    auto error = make_lw_shared<std::exception_ptr>();
+    auto source = make_lw_shared<std::unique_ptr<partition_source>>(std::move(src));
+    // Runs in the background. Once the consumer is gone, writing to the
+    // pipe fails, which ends it.
+    feed_pieces(**source, writer, [] (const mutation&) {
+        return make_ready_future<>();
+    }).handle_exception([error] (std::exception_ptr ep) {
+        *error = ep;
+    }).finally([source, writer] {});
+    return std::make_unique<queue_source>(std::move(reader), std::move(error), std::move(source));
+}
+
 static api::timestamp_type get_max_purgeable_timestamp(schema_ptr schema,
     const std::vector<shared_sstable>& not_compacted_sstables, const dht::decorated_key& dk)
 {
@@ -94,12 +288,192 @@ static api::timestamp_type get_max_purgeable_timestamp(schema_ptr schema,
     return timestamp;
 }
 
+// Estimates the number of distinct partitions in the given sstables by
+// merging their cardinality estimators which, unlike adding up their key
+// counts, doesn't count a key present in several of them more than once.
+// Returns a disengaged optional if any of them lacks usable cardinality
+// data, e.g. because it was written by Origin.
+static std::experimental::optional<uint64_t>
+estimate_partitions_from_cardinality(const std::vector<shared_sstable>& sstables) {
+    std::experimental::optional<hll::HyperLogLog> merged;
+    try {
+        for (auto&& sst : sstables) {
+            auto& cardinality = sst->get_compaction_metadata().cardinality.elements;
+            temporary_buffer<uint8_t> buf(cardinality.size());
+            std::copy(cardinality.begin(), cardinality.end(), buf.get_write());
+            auto hll = hll::HyperLogLog::from_bytes(buf);
+            if (merged) {
+                merged->merge(hll);
+            } else {
+                merged = std::move(hll);
+            }
+        }
+    } catch (std::exception& e) {
+        logger.debug("Cardinality estimates not usable for compaction: {}", e.what());
+        return {};
+    }
+    // Leave room for three standard errors, so that filters are seldom
+    // sized for fewer keys than they get.
+    auto error = 3 * 1.04 / sqrt(merged->registerSize());
+    return uint64_t(ceil(merged->estimate() * (1 + error)));
+}
+
+// Below this many lookups, the false positive rate observed on the filters
+// of the sstables being compacted is too noisy to act on.
+static constexpr uint64_t min_filter_lookups = 1000;
+// The most the false positive chance of new filters is lowered relative to
+// the table's bloom_filter_fp_chance.
+static constexpr double max_fp_chance_reduction = 10;
+
+// Returns the false positive chance for which to size the filters of the
+// sstables replacing the given ones. If their filters let through more
+// absent keys than the table's bloom_filter_fp_chance allows, the target
+// is lowered in proportion to bring the observed rate back in line.
+static double filter_fp_chance_for(const schema& s, const std::vector<shared_sstable>& sstables) {
+    auto target = s.bloom_filter_fp_chance();
+    uint64_t false_positives = 0;
+    uint64_t true_negatives = 0;
+    for (auto&& sst : sstables) {
+        false_positives += sst->filter_get_false_positive();
+        true_negatives += sst->filter_get_true_negative();
+    }
+    auto lookups = false_positives + true_negatives;
+    if (target >= 1.0 || lookups < min_filter_lookups) {
+        return target;
+    }
+    auto observed = double(false_positives) / lookups;
+    if (observed <= target) {
+        return target;
+    }
+    auto& probs = utils::bloom_calculations::probs;
+    auto fp_chance = std::max({target * target / observed, target / max_fp_chance_reduction, probs.back().back()});
+    logger.info("Observed bloom filter false positive rate {} of {}.{} exceeds {}, sizing new filters for {}",
+            observed, s.ks_name(), s.cf_name(), target, fp_chance);
+    return fp_chance;
+}
+
+// Hands the sealed output sstables of a compaction of the full token range
+// over to a compaction_replacer, with the input sstables they replace.
+class incremental_release {
+    schema_ptr _schema;
+    compaction_replacer _replace;
+    // Inputs not released yet.
+    std::vector<shared_sstable> _inputs;
+    // Outputs not handed over yet.
+    std::vector<shared_sstable> _sealed;
+private:
+    bool overlaps(const shared_sstable& a, const shared_sstable& b) const {
+        auto& s = *_schema;
+        return a->get_first_decorated_key(s)._token <= b->get_last_decorated_key(s)._token
+            && b->get_first_decorated_key(s)._token <= a->get_last_decorated_key(s)._token;
+    }
+    // Whether the tombstones purged from a can't have shadowed data of b.
+    static bool newer(const shared_sstable& b, const shared_sstable& a) {
+        return b->get_stats_metadata().min_timestamp > a->get_stats_metadata().max_timestamp;
+    }
+public:
+    incremental_release(schema_ptr schema, compaction_replacer replace, std::vector<shared_sstable> inputs)
+        : _schema(std::move(schema))
+        , _replace(std::move(replace))
+        , _inputs(std::move(inputs))
+    { }
+
+    void sealed(shared_sstable sst) {
+        _sealed.push_back(std::move(sst));
+    }
+
+    // Called once the compaction goes on past the outputs sealed so far,
+    // which proves their last partition complete.
+    void resume() {
+        if (_sealed.empty()) {
+            return;
+        }
+        auto& s = *_schema;
+        auto last = _sealed.back()->get_last_decorated_key(s);
+
+        std::vector<shared_sstable> released;
+        std::vector<shared_sstable> kept;
+        for (auto& input : _inputs) {
+            if (input->get_last_decorated_key(s).tri_compare(s, last) <= 0) {
+                released.push_back(input);
+            } else {
+                kept.push_back(input);
+            }
+        }
+        // An input which can't be released yet may keep others from being so.
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto it = released.begin(); it != released.end();) {
+                auto conflicts = std::any_of(kept.begin(), kept.end(), [&] (const shared_sstable& other) {
+                    return overlaps(*it, other) && !newer(other, *it);
+                });
+                if (conflicts) {
+                    kept.push_back(std::move(*it));
+                    it = released.erase(it);
+                    changed = true;
+                } else {
+                    ++it;
+                }
+            }
+        }
+        if (released.empty()) {
+            return;
+        }
+        logger.debug("Releasing {} compacted sstables replaced by {} new ones", released.size(), _sealed.size());
+        _inputs = std::move(kept);
+        _replace(std::exchange(_sealed, {}), std::move(released));
+    }
+};
+
 // compact_sstables compacts the given list of sstables creating one
 // (currently) or more (in the future) new sstables. The new sstables
 // are created using the "sstable_creator" object passed by the caller.
 future<> compact_sstables(std::vector<shared_sstable> sstables,
         column_family& cf, std::function<shared_sstable()> creator, uint64_t max_sstable_size, uint32_t sstable_level) {
-    std::vector<::mutation_reader> readers;
+    return compact_sstables(std::move(sstables), cf, std::move(creator), max_sstable_size, sstable_level, query::full_partition_range);
+}
+
+// Reads an input sstable of a compaction.
+using compaction_reader_factory = std::function<std::unique_ptr<partition_source> (shared_sstable)>;
+
+static future<> compact_sstables(std::vector<shared_sstable> sstables,
+        column_family& cf, std::function<shared_sstable()> creator, uint64_t max_sstable_size, uint32_t sstable_level,
+        compaction_reader_factory make_reader, bool full_range, compaction_replacer replacer);
+
+future<> compact_sstables(std::vector<shared_sstable> sstables,
+        column_family& cf, std::function<shared_sstable()> creator, uint64_t max_sstable_size, uint32_t sstable_level,
+        const query::partition_range& range, compaction_replacer replacer) {
+    auto schema = cf.schema();
+    bool full_range = !range.start() && !range.end();
+    auto make_reader = [schema, &range, full_range] (shared_sstable sst) -> std::unique_ptr<partition_source> {
+        // A full scan doesn't need the index, so it's cheaper than a range read.
+        if (full_range) {
+            return std::make_unique<sstable_reader>(std::move(sst), schema);
+        }
+        return std::make_unique<sstable_reader>(std::move(sst), schema, range);
+    };
+    return compact_sstables(std::move(sstables), cf, std::move(creator), max_sstable_size, sstable_level,
+            std::move(make_reader), full_range, std::move(replacer));
+}
+
+future<> cleanup_sstable(shared_sstable sst, column_family& cf, std::function<shared_sstable()> creator,
+        std::vector<query::partition_range> owned_ranges) {
+    assert(!owned_ranges.empty());
+    auto schema = cf.schema();
+    auto ranges = make_lw_shared<std::vector<query::partition_range>>(std::move(owned_ranges));
+    auto make_reader = [schema, ranges] (shared_sstable sst) -> std::unique_ptr<partition_source> {
+        return std::make_unique<sstable_reader>(std::move(sst), schema, ranges);
+    };
+    auto level = sst->get_sstable_level();
+    return compact_sstables({ std::move(sst) }, cf, std::move(creator), std::numeric_limits<uint64_t>::max(), level,
+            std::move(make_reader), false, {});
+}
+
+static future<> compact_sstables(std::vector<shared_sstable> sstables,
+        column_family& cf, std::function<shared_sstable()> creator, uint64_t max_sstable_size, uint32_t sstable_level,
+        compaction_reader_factory make_reader, bool full_range, compaction_replacer replacer) {
+    std::vector<std::unique_ptr<partition_source>> readers;
     uint64_t estimated_partitions = 0;
     auto ancestors = make_lw_shared<std::vector<unsigned long>>();
     auto stats = make_lw_shared<compaction_stats>();
@@ -121,11 +495,9 @@ future<> compact_sstables(std::vector<shared_sstable> sstables,
 
     auto schema = cf.schema();
     for (auto sst : sstables) {
-        // We also capture the sstable, so we keep it alive while the read isn't done
-        readers.emplace_back(make_mutation_reader<sstable_reader>(sst, schema));
-        // FIXME: If the sstables have cardinality estimation bitmaps, use that
-        // for a better estimate for the number of partitions in the merged
-        // sstable than just adding up the lengths of individual sstables.
+        // We also capture the sstable, so we keep it alive while the read isn't done.
+        readers.emplace_back(make_prefetching_source(make_reader(sst), prefetch_depth));
+        // When compacting a sub-range, this overestimates the partition count.
         estimated_partitions += sst->get_estimated_key_count();
         stats->total_partitions += sst->get_estimated_key_count();
         // Compacted sstable keeps track of its ancestors.
@@ -142,6 +514,28 @@ future<> compact_sstables(std::vector<shared_sstable> sstables,
         rp = std::max(rp, sst->get_stats_metadata().position);
     }
 
+    // The sum of key counts above counts keys present in several sstables
+    // more than once, which over-sizes the filters of the new sstables.
+    auto cardinality = estimate_partitions_from_cardinality(sstables);
+    if (cardinality) {
+        estimated_partitions = std::min(estimated_partitions, *cardinality);
+    }
+    auto filter_fp_chance = filter_fp_chance_for(*schema, sstables);
+
+    lw_shared_ptr<incremental_release> release;
+    if (replacer && full_range) {
+        release = make_lw_shared<incremental_release>(schema, std::move(replacer), sstables);
+    }
+
+    // Zstd dictionaries are trained on what compactions write, and used
+    // for the sstables written afterwards.
+    lw_shared_ptr<zstd_dictionary_trainer> trainer;
+    const auto& cp = schema->get_compressor_params();
+    if (cp.get_compressor() == compressor::zstd && cp.dictionary_size()) {
+        trainer = make_lw_shared<zstd_dictionary_trainer>(cp.dictionary_size());
+    }
+    auto dictionary = make_lw_shared<bytes>(cf.get_compression_dictionary());
+
     uint64_t estimated_sstables = std::max(1UL, uint64_t(ceil(double(stats->start_size) / max_sstable_size)));
     uint64_t partitions_per_sstable = ceil(double(estimated_partitions) / estimated_sstables);
 
@@ -149,40 +543,122 @@ future<> compact_sstables(std::vector<shared_sstable> sstables,
     stats->sstables = sstables.size();
     logger.info("Compacting {}", sstable_logger_msg);
 
-    class compacting_reader final : public ::mutation_reader::impl {
+    // Compacts the merged partitions piece by piece, leaving out those with
+    // nothing left.
+    class compacting_reader final : public partition_source {
     private:
         schema_ptr _schema;
-        ::mutation_reader _reader;
+        std::unique_ptr<partition_source> _source;
         std::vector<shared_sstable> _not_compacted_sstables;
         gc_clock::time_point _now;
+        gc_clock::time_point _gc_before;
+        api::timestamp_type _max_purgeable;
+        // The tombstones of the current partition read so far, which shadow
+        // the rows of its following pieces.
+        mutation_opt _tombstones;
+        cpu_timeslice _timeslice{compaction_group()};
+    private:
+        // Compacts a piece following the first one of its partition, keeping
+        // only its rows and the range tombstones it came with.
+        void compact_rows(mutation& piece) {
+            std::vector<clustering_key_prefix> own;
+            for (auto&& rt : piece.partition().row_tombstones()) {
+                own.push_back(rt.prefix());
+                _tombstones->partition().apply_row_tombstone(*_schema, rt.prefix(), rt.t());
+            }
+            piece.partition().apply(*_schema, _tombstones->partition());
+            piece.partition().compact_for_compaction(*_schema, _max_purgeable, _now, _gc_before);
+            mutation rows(piece.decorated_key(), _schema);
+            rows.partition().clustered_rows().swap(piece.partition().clustered_rows());
+            for (auto&& rt : piece.partition().row_tombstones()) {
+                auto is_own = std::any_of(own.begin(), own.end(), [&] (const clustering_key_prefix& p) {
+                    return p.equal(*_schema, rt.prefix());
+                });
+                if (is_own) {
+                    rows.partition().apply_row_tombstone(*_schema, rt.prefix(), rt.t());
+                }
+            }
+            piece = std::move(rows);
+        }
+
+        static bool has_data(const mutation& m) {
+            return !m.partition().clustered_rows().empty() || !m.partition().row_tombstones().empty();
+        }
+
+        // Returns the next piece of the current partition with something
+        // left after compaction.
+        future<mutation_opt> next_compacted_rows() {
+            return _source->next_rows().then([this] (mutation_opt m) {
+                if (!m) {
+                    return make_ready_future<mutation_opt>();
+                }
+                _timeslice.run([&] {
+                    compact_rows(*m);
+                });
+                if (has_data(*m)) {
+                    return make_ready_future<mutation_opt>(std::move(m));
+                }
+                return next_compacted_rows();
+            });
+        }
     public:
-        compacting_reader(schema_ptr schema, std::vector<::mutation_reader> readers, std::vector<shared_sstable> not_compacted_sstables)
-            : _schema(std::move(schema))
-            , _reader(make_combined_reader(std::move(readers)))
+        compacting_reader(schema_ptr schema, std::vector<std::unique_ptr<partition_source>> readers, std::vector<shared_sstable> not_compacted_sstables)
+            : _schema(schema)
+            , _source(make_combined_partition_source(std::move(schema), std::move(readers)))
             , _not_compacted_sstables(std::move(not_compacted_sstables))
             , _now(gc_clock::now())
+            , _gc_before(get_gc_before(*_schema, _now))
         { }
 
-        virtual future<mutation_opt> operator()() override {
-            return _reader().then([this] (mutation_opt m) {
+        virtual future<mutation_opt> next_partition() override {
+            return _source->next_partition().then([this] (mutation_opt m) {
                 if (!bool(m)) {
                     return make_ready_future<mutation_opt>(std::move(m));
                 }
-                auto max_purgeable = get_max_purgeable_timestamp(_schema, _not_compacted_sstables, m->decorated_key());
-                m->partition().compact_for_compaction(*_schema, max_purgeable, _now);
+                _timeslice.run([&] {
+                    _max_purgeable = get_max_purgeable_timestamp(_schema, _not_compacted_sstables, m->decorated_key());
+                    _tombstones = mutation(m->decorated_key(), _schema);
+                    _tombstones->partition().apply(m->partition().partition_tombstone());
+                    for (auto&& rt : m->partition().row_tombstones()) {
+                        _tombstones->partition().apply_row_tombstone(*_schema, rt.prefix(), rt.t());
+                    }
+                    m->partition().compact_for_compaction(*_schema, _max_purgeable, _now, _gc_before);
+                });
                 if (!m->partition().empty()) {
                     return make_ready_future<mutation_opt>(std::move(m));
                 }
-                return operator()();
+                // The partition goes on if any of its following pieces has
+                // something left.
+                return next_compacted_rows().then([this] (mutation_opt rows) {
+                    if (rows) {
+                        return make_ready_future<mutation_opt>(std::move(rows));
+                    }
+                    return next_partition();
+                });
             });
         }
+
+        virtual future<mutation_opt> next_rows() override {
+            return next_compacted_rows();
+        }
+
+        virtual uint64_t bytes_read() const override {
+            return _source->bytes_read();
+        }
+
+        // Times the compacting, so that the compaction yields the CPU to
+        // statements in proportion to its shares.
+        cpu_timeslice& timeslice() {
+            return _timeslice;
+        }
     };
-    auto reader = make_mutation_reader<compacting_reader>(schema, std::move(readers), std::move(not_compacted_sstables));
+    auto reader = make_lw_shared<compacting_reader>(schema, std::move(readers), std::move(not_compacted_sstables));
 
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    // We use a fixed-sized pipe between the producer fiber (which reads the
-    // individual sstables and merges them) and the consumer fiber (which
+    // We use a fixed-sized pipe between the producer fiber (which merges
+    // what the fibers prefetching the individual sstables have read, see
+    // make_prefetching_source()) and the consumer fiber (which
     // only writes to the sstable). Things would have worked without this
     // pipe (the writing fiber would have also performed the reads), but we
     // prefer to do less work in the writer (which is a seastar::thread),
@@ -190,56 +666,62 @@ future<> compact_sstables(std::vector<shared_sstable> sstables,
     // to that seastar::thread.
     // TODO: better tuning for the size of the pipe. Perhaps should take into
     // account the size of the individual mutations?
-    seastar::pipe<mutation> output{16};
-    auto output_reader = make_lw_shared<seastar::pipe_reader<mutation>>(std::move(output.reader));
-    auto output_writer = make_lw_shared<seastar::pipe_writer<mutation>>(std::move(output.writer));
+    seastar::pipe<compacted_piece> output{16};
+    auto output_reader = make_lw_shared<seastar::pipe_reader<compacted_piece>>(std::move(output.reader));
+    auto output_writer = make_lw_shared<seastar::pipe_writer<compacted_piece>>(std::move(output.writer));
+
+    // Each partition is throttled by the input read since the previous one,
+    // read ahead included. Throttling the reader also throttles the writer,
+    // through the pipe.
+    auto throttle = &cf.get_compaction_throttle();
+    auto bytes_throttled = make_lw_shared<uint64_t>(0);
 
     auto done = make_lw_shared<bool>(false);
-    future<> read_done = do_until([done] { return *done; }, [done, output_writer, reader = std::move(reader), stats] () mutable {
-        return reader().then([done, output_writer, stats] (auto mopt) {
-            if (mopt) {
-                stats->total_keys_written++;
-                return output_writer->write(std::move(*mopt));
-            } else {
-                *done = true;
-                return make_ready_future<>();
-            }
+    future<> read_done = feed_pieces(*reader, output_writer, [stats, throttle, bytes_throttled, reader] (const mutation&) {
+        stats->total_keys_written++;
+        auto bytes_read = reader->bytes_read();
+        auto bytes = bytes_read - *bytes_throttled;
+        *bytes_throttled = bytes_read;
+        return throttle->throttle(bytes).then([reader] {
+            return reader->timeslice().maybe_yield();
         });
-    }).then([output_writer, done] {});
-
-    struct queue_reader final : public ::mutation_reader::impl {
-        lw_shared_ptr<seastar::pipe_reader<mutation>> pr;
-        queue_reader(lw_shared_ptr<seastar::pipe_reader<mutation>> pr) : pr(std::move(pr)) {}
-        virtual future<mutation_opt> operator()() override {
-            return pr->read();
-        }
-    };
+    }).then([done] {
+        *done = true;
+    }).finally([reader, output_writer] {});
 
     // If there is a maximum size for a sstable, it's possible that more than
     // one sstable will be generated for all partitions to be written.
-    future<> write_done = repeat([creator, ancestors, rp, max_sstable_size, sstable_level, output_reader, stats, partitions_per_sstable, schema] {
+    future<> write_done = repeat([creator, ancestors, rp, max_sstable_size, sstable_level, output_reader, stats, partitions_per_sstable, schema, filter_fp_chance, trainer, dictionary, release] {
         return output_reader->read().then(
-                [creator, ancestors, rp, max_sstable_size, sstable_level, output_reader, stats, partitions_per_sstable, schema] (auto mut) {
+                [creator, ancestors, rp, max_sstable_size, sstable_level, output_reader, stats, partitions_per_sstable, schema, filter_fp_chance, trainer, dictionary, release] (auto mut) {
             // Check if mutation is available from the pipe for a new sstable to be written. If not, just stop writing.
             if (!mut) {
                 return make_ready_future<stop_iteration>(stop_iteration::yes);
             }
             // If a mutation is available, we must unread it for write_components to read it afterwards.
             output_reader->unread(std::move(*mut));
+            if (release) {
+                release->resume();
+            }
 
             auto newtab = creator();
             newtab->get_metadata_collector().set_replay_position(rp);
             newtab->get_metadata_collector().sstable_level(sstable_level);
+            newtab->set_filter_fp_chance(filter_fp_chance);
+            newtab->set_compression_dictionary(*dictionary);
+            newtab->set_dictionary_trainer(trainer);
             for (auto ancestor : *ancestors) {
                 newtab->add_ancestor(ancestor);
             }
 
-            ::mutation_reader mutation_queue_reader = make_mutation_reader<queue_reader>(output_reader);
-
-            return newtab->write_components(std::move(mutation_queue_reader), partitions_per_sstable, schema, max_sstable_size).then([newtab, stats] {
-                return newtab->open_data().then([newtab, stats] {
+            return newtab->write_components(std::make_unique<queue_source>(output_reader), partitions_per_sstable, schema, max_sstable_size,
+                    compaction_priority()).then([newtab, stats, release] {
+                return newtab->open_data().then([newtab, stats, release] {
                     stats->new_sstables.push_back(newtab);
                     stats->end_size += newtab->data_size();
+                    if (release) {
+                        release->sealed(newtab);
+                    }
                     return make_ready_future<stop_iteration>(stop_iteration::no);
                 });
             });
@@ -271,7 +753,7 @@ future<> compact_sstables(std::vector<shared_sstable> sstables,
     });
 
     // Wait for both read_done and write_done fibers to finish.
-    return when_all(std::move(read_done), std::move(write_done)).then([] (std::tuple<future<>, future<>> t) {
+    return when_all(std::move(read_done), std::move(write_done)).then([&cf, trainer, schema] (std::tuple<future<>, future<>> t) {
         sstring ex;
         try {
             std::get<0>(t).get();
@@ -288,6 +770,15 @@ future<> compact_sstables(std::vector<shared_sstable> sstables,
         if (ex.size()) {
             throw std::runtime_error(ex);
         }
+
+        if (trainer) {
+            auto dictionary = trainer->train();
+            if (!dictionary.empty()) {
+                logger.debug("Trained a {} bytes compression dictionary for {}.{} on {} samples",
+                        dictionary.size(), schema->ks_name(), schema->cf_name(), trainer->samples());
+                cf.set_compression_dictionary(std::move(dictionary));
+            }
+        }
     });
 }
 
@@ -334,6 +825,97 @@ class major_compaction_strategy : public compaction_strategy_impl {
     }
 };
 
+static std::experimental::optional<sstring> get_value(const std::map<sstring, sstring>& options, const sstring& name) {
+    auto it = options.find(name);
+    if (it == options.end()) {
+        return std::experimental::nullopt;
+    }
+    return it->second;
+}
+
+// Size-tiered and leveled compaction compact an sstable alone, when they
+// have nothing else to do, if enough of its cells are tombstones they
+// could purge.
+class tombstone_compaction_options {
+    static constexpr double DEFAULT_TOMBSTONE_THRESHOLD = 0.2;
+    static constexpr long DEFAULT_TOMBSTONE_COMPACTION_INTERVAL = 86400;
+    const sstring TOMBSTONE_THRESHOLD_KEY = "tombstone_threshold";
+    const sstring TOMBSTONE_COMPACTION_INTERVAL_KEY = "tombstone_compaction_interval";
+    const sstring UNCHECKED_TOMBSTONE_COMPACTION_KEY = "unchecked_tombstone_compaction";
+
+    double _tombstone_threshold;
+    gc_clock::duration _tombstone_compaction_interval;
+    bool _unchecked_tombstone_compaction;
+private:
+    // Whether compacting sst alone at now would purge more than
+    // tombstone_threshold of its cells.
+    bool worth_dropping_tombstones(const schema& s, const shared_sstable& sst, const sstable_list& sstables,
+            gc_clock::time_point now, gc_clock::time_point gc_before) const {
+        // An sstable just written, maybe by a tombstone compaction, keeps
+        // the tombstones that were too young then for a while.
+        if (sst->data_file_write_time() + _tombstone_compaction_interval > now) {
+            return false;
+        }
+        if (sst->estimate_droppable_tombstone_ratio(gc_before) <= _tombstone_threshold) {
+            return false;
+        }
+        if (_unchecked_tombstone_compaction) {
+            return true;
+        }
+        // Compaction only purges a tombstone when no sstable left out of it
+        // may hold older data of its partition, which an sstable overlapping
+        // this one with data as old as its tombstones may, so don't bother.
+        auto max_timestamp = sst->get_stats_metadata().max_timestamp;
+        auto first = sst->get_first_decorated_key(s);
+        auto last = sst->get_last_decorated_key(s);
+        for (auto& other : sstables | boost::adaptors::map_values) {
+            if (other == sst || other->get_stats_metadata().min_timestamp > max_timestamp) {
+                continue;
+            }
+            if (other->get_last_decorated_key(s).tri_compare(s, first) < 0
+                    || last.tri_compare(s, other->get_first_decorated_key(s)) < 0) {
+                continue;
+            }
+            return false;
+        }
+        return true;
+    }
+public:
+    tombstone_compaction_options(const std::map<sstring, sstring>& options) {
+        using namespace cql3::statements;
+
+        auto tmp_value = get_value(options, TOMBSTONE_THRESHOLD_KEY);
+        _tombstone_threshold = property_definitions::to_double(TOMBSTONE_THRESHOLD_KEY, tmp_value, DEFAULT_TOMBSTONE_THRESHOLD);
+
+        tmp_value = get_value(options, TOMBSTONE_COMPACTION_INTERVAL_KEY);
+        auto interval = property_definitions::to_long(TOMBSTONE_COMPACTION_INTERVAL_KEY, tmp_value, DEFAULT_TOMBSTONE_COMPACTION_INTERVAL);
+        _tombstone_compaction_interval = gc_clock::duration(std::max(interval, 0L));
+
+        tmp_value = get_value(options, UNCHECKED_TOMBSTONE_COMPACTION_KEY);
+        _unchecked_tombstone_compaction = tmp_value && *tmp_value == "true";
+    }
+
+    // Of the candidates, the one with the most droppable tombstones among
+    // those worth compacting alone, if any.
+    template <typename Range>
+    shared_sstable pick(const schema& s, const Range& candidates, const sstable_list& sstables, gc_clock::time_point now) const {
+        auto gc_before = get_gc_before(s, now);
+        shared_sstable best;
+        double best_ratio = 0;
+        for (auto& sst : candidates) {
+            if (!worth_dropping_tombstones(s, sst, sstables, now, gc_before)) {
+                continue;
+            }
+            auto ratio = sst->estimate_droppable_tombstone_ratio(gc_before);
+            if (!best || ratio > best_ratio) {
+                best = sst;
+                best_ratio = ratio;
+            }
+        }
+        return best;
+    }
+};
+
 class size_tiered_compaction_strategy_options {
     static constexpr uint64_t DEFAULT_MIN_SSTABLE_SIZE = 50L * 1024L * 1024L;
     static constexpr double DEFAULT_BUCKET_LOW = 0.5;
@@ -348,14 +930,6 @@ class size_tiered_compaction_strategy_options {
     double bucket_low = DEFAULT_BUCKET_LOW;
     double bucket_high = DEFAULT_BUCKET_HIGH;
     double cold_reads_to_omit =  DEFAULT_COLD_READS_TO_OMIT;
-
-    static std::experimental::optional<sstring> get_value(const std::map<sstring, sstring>& options, const sstring& name) {
-        auto it = options.find(name);
-        if (it == options.end()) {
-            return std::experimental::nullopt;
-        }
-        return it->second;
-    }
 public:
     size_tiered_compaction_strategy_options(const std::map<sstring, sstring>& options) {
         using namespace cql3::statements;
@@ -426,6 +1000,7 @@ class size_tiered_compaction_strategy_options {
 
 class size_tiered_compaction_strategy : public compaction_strategy_impl {
     size_tiered_compaction_strategy_options _options;
+    tombstone_compaction_options _tombstone_options;
 
     // Return a list of pair of shared_sstable and its respective size.
     std::vector<std::pair<sstables::shared_sstable, uint64_t>> create_sstable_and_length_pairs(const sstable_list& sstables);
@@ -450,9 +1025,10 @@ class size_tiered_compaction_strategy : public compaction_strategy_impl {
         return n / sstables.size();
     }
 public:
-    size_tiered_compaction_strategy() = default;
+    size_tiered_compaction_strategy()
+        : _tombstone_options(std::map<sstring, sstring>()) {}
     size_tiered_compaction_strategy(const std::map<sstring, sstring>& options) :
-        _options(options) {}
+        _options(options), _tombstone_options(options) {}
 
     virtual future<> compact(column_family& cfs) override;
 
@@ -587,8 +1163,14 @@ future<> size_tiered_compaction_strategy::compact(column_family& cfs) {
     printf("size-tiered: Compacting %ld out of %ld sstables\n", most_interesting.size(), candidates->size());
 #endif
     if (most_interesting.empty()) {
-        // nothing to do
-        return make_ready_future<>();
+        auto& s = *cfs.schema();
+        auto sst = _tombstone_options.pick(s, *candidates | boost::adaptors::map_values, *candidates, gc_clock::now());
+        if (!sst) {
+            // nothing to do
+            return make_ready_future<>();
+        }
+        logger.debug("size-tiered: Compacting sstable {} alone to purge its tombstones", sst->get_filename());
+        most_interesting.push_back(std::move(sst));
     }
 
     return cfs.compact_sstables(sstables::compaction_descriptor(std::move(most_interesting)));
@@ -606,9 +1188,23 @@ std::vector<sstables::shared_sstable> size_tiered_most_interesting_bucket(lw_sha
 }
 
 class leveled_compaction_strategy : public compaction_strategy_impl {
-    // FIXME: User may choose to change this value; add support.
-    static constexpr uint32_t max_sstable_size_in_mb = 160;
+    static constexpr uint32_t DEFAULT_MAX_SSTABLE_SIZE_IN_MB = 160;
+    const sstring SSTABLE_SIZE_KEY = "sstable_size_in_mb";
+    // Maximum number of compactions, of disjoint sets of sstables, run at once.
+    static constexpr unsigned max_parallel_compactions = 4;
+
+    uint32_t _max_sstable_size_in_mb;
+    tombstone_compaction_options _tombstone_options;
 public:
+    leveled_compaction_strategy(const std::map<sstring, sstring>& options)
+        : _tombstone_options(options) {
+        using namespace cql3::statements;
+
+        auto tmp_value = get_value(options, SSTABLE_SIZE_KEY);
+        auto size = property_definitions::to_int(SSTABLE_SIZE_KEY, tmp_value, DEFAULT_MAX_SSTABLE_SIZE_IN_MB);
+        _max_sstable_size_in_mb = std::max(size, 1);
+    }
+
     virtual future<> compact(column_family& cfs) override;
 
     virtual compaction_strategy_type type() const {
@@ -622,16 +1218,280 @@ future<> leveled_compaction_strategy::compact(column_family& cfs) {
     // lists managed by the manifest may become outdated. For example, one
     // sstable in it may be marked for deletion after compacted.
     // Currently, we create a new manifest whenever it's time for compaction.
-    leveled_manifest manifest = leveled_manifest::create(cfs, max_sstable_size_in_mb);
-    auto candidate = manifest.get_compaction_candidates();
+    leveled_manifest manifest = leveled_manifest::create(cfs, _max_sstable_size_in_mb);
+    // Compactions of different levels, or of disjoint ranges of the same
+    // level, don't conflict, so we run as many of them as we can pick, for
+    // L0 not to fall behind while higher levels are being compacted.
+    auto candidates = manifest.get_parallel_compaction_candidates(max_parallel_compactions);
+
+    if (candidates.empty()) {
+        // The sstable compacted alone stays in its level, which it can't
+        // outgrow by losing data.
+        auto sstables = cfs.get_sstables();
+        auto sst = _tombstone_options.pick(*cfs.schema(), *sstables | boost::adaptors::map_values, *sstables, gc_clock::now());
+        if (!sst) {
+            return make_ready_future<>();
+        }
+        auto level = sst->get_sstable_level();
+        candidates.emplace_back(std::vector<sstables::shared_sstable>{std::move(sst)}, level,
+            uint64_t(_max_sstable_size_in_mb) * 1024 * 1024);
+    }
+
+    return do_with(std::move(candidates), [&cfs] (std::vector<sstables::compaction_descriptor>& candidates) {
+        return parallel_for_each(candidates, [&cfs] (sstables::compaction_descriptor& candidate) {
+            logger.debug("leveled: Compacting {} out of {} sstables into L{}", candidate.sstables.size(),
+                cfs.get_sstables()->size(), candidate.level);
+            return cfs.compact_sstables(std::move(candidate));
+        });
+    });
+}
+
+class date_tiered_compaction_strategy_options {
+    static constexpr double DEFAULT_MAX_SSTABLE_AGE_DAYS = 365;
+    static constexpr int64_t DEFAULT_BASE_TIME_SECONDS = 60;
+    const sstring TIMESTAMP_RESOLUTION_KEY = "timestamp_resolution";
+    const sstring MAX_SSTABLE_AGE_KEY = "max_sstable_age_days";
+    const sstring BASE_TIME_KEY = "base_time_seconds";
+
+    // Both values below are expressed in the timestamp resolution of the table.
+    int64_t max_sstable_age;
+    int64_t base_time;
+
+    static int64_t timestamp_units_per_second(const sstring& resolution) {
+        if (resolution == "MICROSECONDS") {
+            return 1000000;
+        } else if (resolution == "MILLISECONDS") {
+            return 1000;
+        } else if (resolution == "SECONDS") {
+            return 1;
+        }
+        throw exceptions::configuration_exception(sprint("Invalid timestamp resolution %s", resolution));
+    }
+public:
+    date_tiered_compaction_strategy_options(const std::map<sstring, sstring>& options) {
+        using namespace cql3::statements;
+
+        auto tmp_value = get_value(options, TIMESTAMP_RESOLUTION_KEY);
+        auto units = timestamp_units_per_second(tmp_value ? *tmp_value : sstring("MICROSECONDS"));
+
+        tmp_value = get_value(options, MAX_SSTABLE_AGE_KEY);
+        auto max_sstable_age_days = property_definitions::to_double(MAX_SSTABLE_AGE_KEY, tmp_value, DEFAULT_MAX_SSTABLE_AGE_DAYS);
+        if (max_sstable_age_days < 0) {
+            throw exceptions::configuration_exception(sprint("%s must be non negative: %f", MAX_SSTABLE_AGE_KEY, max_sstable_age_days));
+        }
+        max_sstable_age = int64_t(max_sstable_age_days * 24 * 60 * 60 * units);
+
+        tmp_value = get_value(options, BASE_TIME_KEY);
+        auto base_time_seconds = property_definitions::to_long(BASE_TIME_KEY, tmp_value, DEFAULT_BASE_TIME_SECONDS);
+        if (base_time_seconds <= 0) {
+            throw exceptions::configuration_exception(sprint("%s must be greater than 0, but was %d", BASE_TIME_KEY, base_time_seconds));
+        }
+        base_time = base_time_seconds * units;
+    }
+
+    date_tiered_compaction_strategy_options() {
+        max_sstable_age = int64_t(DEFAULT_MAX_SSTABLE_AGE_DAYS * 24 * 60 * 60 * 1000000);
+        base_time = DEFAULT_BASE_TIME_SECONDS * 1000000;
+    }
+
+    friend class date_tiered_compaction_strategy;
+};
+
+//
+// Date-tiered compaction strategy groups sstables by the age of their newest
+// data into time windows. Windows grow by a factor of min_threshold as they
+// get older, and sstables whose newest data is older than max_sstable_age_days
+// are never picked again, so closed windows are not re-compacted.
+//
+// NOTE: Origin buckets by minimum timestamp. We use the maximum timestamp
+// instead, so that a single late write can't pull an sstable into a newer
+// window than the bulk of its data.
+//
+class date_tiered_compaction_strategy : public compaction_strategy_impl {
+    date_tiered_compaction_strategy_options _options;
+
+    // A window in the time line: all timestamps ts such that ts / size == div_position.
+    struct target {
+        int64_t size;
+        int64_t div_position;
+
+        int compare_to_timestamp(int64_t timestamp) const {
+            auto div = timestamp / size;
+            return div_position < div ? -1 : (div_position > div ? 1 : 0);
+        }
+        bool on_target(int64_t timestamp) const {
+            return compare_to_timestamp(timestamp) == 0;
+        }
+        target next_target(int base) const {
+            if (div_position % base > 0) {
+                return target{size, div_position - 1};
+            }
+            return target{size * base, div_position / base - 1};
+        }
+    };
+
+    static target get_initial_target(int64_t now, int64_t time_unit) {
+        return target{time_unit, now / time_unit};
+    }
 
-    if (candidate.sstables.empty()) {
+    // Group sstables into windows, newest window first.
+    std::vector<std::vector<sstables::shared_sstable>>
+    get_buckets(std::vector<sstables::shared_sstable> sstables, int64_t now, int base) const;
+
+    std::vector<sstables::shared_sstable>
+    newest_bucket(std::vector<std::vector<sstables::shared_sstable>> buckets, unsigned min_threshold, unsigned max_threshold, int64_t now) const;
+public:
+    date_tiered_compaction_strategy() = default;
+    date_tiered_compaction_strategy(const std::map<sstring, sstring>& options) :
+        _options(options) {}
+
+    virtual future<> compact(column_family& cfs) override;
+
+    // Return the sstables to be compacted next out of candidates, ignoring fully expired ones.
+    std::vector<sstables::shared_sstable>
+    get_next_sstables(const sstable_list& candidates, unsigned min_threshold, unsigned max_threshold) const;
+
+    virtual compaction_strategy_type type() const {
+        return compaction_strategy_type::date_tiered;
+    }
+};
+
+std::vector<std::vector<sstables::shared_sstable>>
+date_tiered_compaction_strategy::get_buckets(std::vector<sstables::shared_sstable> sstables, int64_t now, int base) const {
+    std::sort(sstables.begin(), sstables.end(), [] (auto& i, auto& j) {
+        return i->get_stats_metadata().max_timestamp > j->get_stats_metadata().max_timestamp;
+    });
+
+    std::vector<std::vector<sstables::shared_sstable>> buckets;
+    auto t = get_initial_target(now, _options.base_time);
+    auto it = sstables.begin();
+
+    while (it != sstables.end()) {
+        auto timestamp = (*it)->get_stats_metadata().max_timestamp;
+        if (t.compare_to_timestamp(timestamp) < 0) {
+            // The sstable is too new for the current target; skip it.
+            ++it;
+            continue;
+        }
+        if (!t.on_target(timestamp)) {
+            // The sstable is too old for the current target; move to an older window.
+            t = t.next_target(base);
+            continue;
+        }
+        std::vector<sstables::shared_sstable> bucket;
+        while (it != sstables.end() && t.on_target((*it)->get_stats_metadata().max_timestamp)) {
+            bucket.push_back(*it++);
+        }
+        buckets.push_back(std::move(bucket));
+    }
+    return buckets;
+}
+
+std::vector<sstables::shared_sstable>
+date_tiered_compaction_strategy::newest_bucket(std::vector<std::vector<sstables::shared_sstable>> buckets,
+        unsigned min_threshold, unsigned max_threshold, int64_t now) const {
+    // If the incoming window has at least min_threshold sstables, choose it.
+    // For any other window, two sstables are enough.
+    auto incoming_window = get_initial_target(now, _options.base_time);
+    for (auto& bucket : buckets) {
+        auto in_incoming_window = incoming_window.on_target(bucket.front()->get_stats_metadata().max_timestamp);
+        if (bucket.size() >= min_threshold || (bucket.size() >= 2 && !in_incoming_window)) {
+            // Trim to max_threshold, preferring the smallest sstables.
+            std::sort(bucket.begin(), bucket.end(), [] (auto& i, auto& j) {
+                return i->data_size() < j->data_size();
+            });
+            if (bucket.size() > max_threshold) {
+                bucket.resize(max_threshold);
+            }
+            return std::move(bucket);
+        }
+    }
+    return {};
+}
+
+std::vector<sstables::shared_sstable>
+date_tiered_compaction_strategy::get_next_sstables(const sstable_list& candidates, unsigned min_threshold, unsigned max_threshold) const {
+    if (candidates.empty()) {
+        return {};
+    }
+
+    auto now = std::numeric_limits<int64_t>::min();
+    for (auto& sst : candidates | boost::adaptors::map_values) {
+        now = std::max(now, sst->get_stats_metadata().max_timestamp);
+    }
+
+    // Sstables whose newest data is older than max_sstable_age belong to closed windows.
+    std::vector<sstables::shared_sstable> recent;
+    for (auto& sst : candidates | boost::adaptors::map_values) {
+        if (!_options.max_sstable_age || sst->get_stats_metadata().max_timestamp >= now - _options.max_sstable_age) {
+            recent.push_back(sst);
+        }
+    }
+
+    auto buckets = get_buckets(std::move(recent), now, min_threshold);
+    return newest_bucket(std::move(buckets), min_threshold, max_threshold, now);
+}
+
+future<> date_tiered_compaction_strategy::compact(column_family& cfs) {
+    int min_threshold = cfs.schema()->min_compaction_threshold();
+    int max_threshold = cfs.schema()->max_compaction_threshold();
+
+    auto candidates = cfs.get_sstables();
+    auto most_interesting = get_next_sstables(*candidates, min_threshold, max_threshold);
+    if (most_interesting.empty()) {
         return make_ready_future<>();
     }
+    logger.debug("date-tiered: Compacting {} out of {} sstables", most_interesting.size(), candidates->size());
+    return cfs.compact_sstables(sstables::compaction_descriptor(std::move(most_interesting)));
+}
 
-    logger.debug("leveled: Compacting {} out of {} sstables", candidate.sstables.size(), cfs.get_sstables()->size());
+std::vector<sstables::shared_sstable>
+get_fully_expired_sstables(const sstable_list& sstables, gc_clock::time_point gc_before,
+        api::timestamp_type min_memtable_timestamp) {
+    auto gc_before_seconds = gc_before.time_since_epoch().count();
+    std::vector<sstables::shared_sstable> candidates;
+    auto min_timestamp = min_memtable_timestamp;
+
+    for (auto& sst : sstables | boost::adaptors::map_values) {
+        auto& stats = sst->get_stats_metadata();
+        if (int64_t(stats.max_local_deletion_time) < gc_before_seconds) {
+            candidates.push_back(sst);
+        } else {
+            min_timestamp = std::min(min_timestamp, stats.min_timestamp);
+        }
+    }
+
+    // A candidate can only be dropped if it doesn't hold tombstones which
+    // shadow older data still present in some other sstable.
+    std::vector<sstables::shared_sstable> expired;
+    for (auto& sst : candidates) {
+        if (sst->get_stats_metadata().max_timestamp < min_timestamp) {
+            expired.push_back(sst);
+        }
+    }
+    return expired;
+}
+
+gc_clock::time_point get_gc_before(const schema& s, gc_clock::time_point now) {
+    auto only_ttl_deletes = get_value(s.compaction_strategy_options(), "only_ttl_deletes");
+    if (only_ttl_deletes && *only_ttl_deletes == "true") {
+        return now;
+    }
+    return now - s.gc_grace_seconds();
+}
 
-    return cfs.compact_sstables(std::move(candidate));
+sstables::shared_sstable get_tombstone_compaction_candidate(const schema& s, const sstable_list& sstables,
+        const std::map<sstring, sstring>& options, gc_clock::time_point now) {
+    tombstone_compaction_options opts(options);
+
+    return opts.pick(s, sstables | boost::adaptors::map_values, sstables, now);
+}
+
+std::vector<sstables::shared_sstable> date_tiered_most_interesting_bucket(lw_shared_ptr<sstable_list> candidates,
+        const std::map<sstring, sstring>& options) {
+    date_tiered_compaction_strategy cs(options);
+
+    return cs.get_next_sstables(*candidates, DEFAULT_MIN_COMPACTION_THRESHOLD, DEFAULT_MAX_COMPACTION_THRESHOLD);
 }
 
 compaction_strategy::compaction_strategy(::shared_ptr<compaction_strategy_impl> impl)
@@ -645,8 +1505,22 @@ compaction_strategy& compaction_strategy::operator=(compaction_strategy&&) = def
 compaction_strategy_type compaction_strategy::type() const {
     return _compaction_strategy_impl->type();
 }
+// Sstables whose whole content expired are dropped without being read,
+// whatever the strategy, before it picks what to compact.
 future<> compaction_strategy::compact(column_family& cfs) {
-    return _compaction_strategy_impl->compact(cfs);
+    auto f = make_ready_future<>();
+    if (type() != compaction_strategy_type::null) {
+        auto candidates = cfs.get_sstables();
+        auto expired = get_fully_expired_sstables(*candidates, get_gc_before(*cfs.schema(), gc_clock::now()),
+                cfs.min_memtable_timestamp());
+        if (!expired.empty()) {
+            logger.debug("Dropping {} fully expired sstables out of {}", expired.size(), candidates->size());
+            f = cfs.drop_sstables(std::move(expired));
+        }
+    }
+    return f.then([impl = _compaction_strategy_impl, &cfs] {
+        return impl->compact(cfs);
+    });
 }
 
 compaction_strategy make_compaction_strategy(compaction_strategy_type strategy, const std::map<sstring, sstring>& options) {
@@ -663,7 +1537,10 @@ compaction_strategy make_compaction_strategy(compaction_strategy_type strategy,
         impl = make_shared<size_tiered_compaction_strategy>(size_tiered_compaction_strategy(options));
         break;
     case compaction_strategy_type::leveled:
-        impl = make_shared<leveled_compaction_strategy>(leveled_compaction_strategy());
+        impl = make_shared<leveled_compaction_strategy>(leveled_compaction_strategy(options));
+        break;
+    case compaction_strategy_type::date_tiered:
+        impl = make_shared<date_tiered_compaction_strategy>(date_tiered_compaction_strategy(options));
         break;
     default:
         throw std::runtime_error("strategy not supported");
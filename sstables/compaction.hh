@@ -37,7 +37,7 @@ namespace sstables {
 
         compaction_descriptor() = default;
 
-        compaction_descriptor(std::vector<sstables::shared_sstable> sstables, int level, long max_sstable_bytes)
+        compaction_descriptor(std::vector<sstables::shared_sstable> sstables, int level, uint64_t max_sstable_bytes)
             : sstables(std::move(sstables))
             , level(level)
             , max_sstable_bytes(max_sstable_bytes) {}
@@ -56,8 +56,66 @@ namespace sstables {
             column_family& cf, std::function<shared_sstable()> creator,
             uint64_t max_sstable_size, uint32_t sstable_level);
 
+    // Called by a compaction with the new sstables sealed so far, and the
+    // input sstables they make redundant, for the caller to replace the
+    // latter with the former before the compaction completes.
+    using compaction_replacer = std::function<void (std::vector<shared_sstable> sealed, std::vector<shared_sstable> released)>;
+
+    // Like above, but only partitions which fall into range are read from the
+    // input sstables and written to the new ones. Compacting disjoint ranges
+    // of the same sstables yields sstables which don't overlap each other.
+    // The input sstables are left untouched, it's up to the caller to replace
+    // them once all ranges are compacted.
+    //
+    // When the full range is compacted into several new sstables, the input
+    // sstables may instead be released as the new ones come to cover them,
+    // through replacer, so that the compaction needs less free disk space.
+    // An input is released once the new sstables sealed so far cover its
+    // last key, and the inputs still being read overlapping it only hold
+    // newer data, which tombstones purged from it can't have shadowed.
+    future<> compact_sstables(std::vector<shared_sstable> sstables,
+            column_family& cf, std::function<shared_sstable()> creator,
+            uint64_t max_sstable_size, uint32_t sstable_level, const query::partition_range& range,
+            compaction_replacer replacer = {});
+
+    // Rewrites sst, alone, without the partitions outside of owned_ranges,
+    // which must be sorted and disjoint, as after new nodes took ranges of
+    // this one over. The partitions between the owned ranges are skipped
+    // through the summary and index rather than read. The new sstables stay
+    // in the level of sst. It's up to the caller to replace sst with them.
+    future<> cleanup_sstable(shared_sstable sst, column_family& cf, std::function<shared_sstable()> creator,
+            std::vector<query::partition_range> owned_ranges);
+
     // Return the most interesting bucket applying the size-tiered strategy.
     // NOTE: currently used for purposes of testing. May also be used by leveled compaction strategy.
     std::vector<sstables::shared_sstable>
     size_tiered_most_interesting_bucket(lw_shared_ptr<sstable_list> candidates);
+
+    // Return the most interesting bucket applying the date-tiered strategy with the given options.
+    // NOTE: currently used for purposes of testing.
+    std::vector<sstables::shared_sstable>
+    date_tiered_most_interesting_bucket(lw_shared_ptr<sstable_list> candidates, const std::map<sstring, sstring>& options);
+
+    // Return the sstables whose whole content is made of tombstones and expired
+    // cells which can be purged given gc_before, and which can't shadow data
+    // in any other sstable, or in the memtables, whose smallest timestamp is
+    // min_memtable_timestamp. Such sstables can be dropped without compaction.
+    std::vector<sstables::shared_sstable>
+    get_fully_expired_sstables(const sstable_list& sstables, gc_clock::time_point gc_before,
+            api::timestamp_type min_memtable_timestamp);
+
+    // Return the time before which tombstones and expired cells of the table
+    // may be purged by a compaction running at now. Tables which set the
+    // only_ttl_deletes compaction option have no tombstones but those of
+    // expired cells, which every replica expires on its own, so they keep
+    // none past now.
+    gc_clock::time_point get_gc_before(const schema& s, gc_clock::time_point now);
+
+    // Return the sstable which size-tiered and leveled compaction would
+    // compact alone to purge its tombstones, given the tombstone_threshold,
+    // tombstone_compaction_interval and unchecked_tombstone_compaction
+    // options, or a null pointer if none is worth it.
+    sstables::shared_sstable
+    get_tombstone_compaction_candidate(const schema& s, const sstable_list& sstables,
+            const std::map<sstring, sstring>& options, gc_clock::time_point now);
 }
@@ -21,28 +21,53 @@
 
 #include <stdexcept>
 #include <cstdlib>
+#include <random>
 
 #include "core/align.hh"
 #include "core/unaligned.hh"
+#include "core/print.hh"
 
 #include "compress.hh"
+#include "exceptions.hh"
 
 #include <lz4.h>
 #include <zlib.h>
 #include <snappy-c.h>
+#include <zstd.h>
+#include <zdict.h>
 
 #include "unimplemented.hh"
 
 namespace sstables {
 
 void compression::update(uint64_t compressed_file_length) {
-    // FIXME: also process _compression.options (just for crc-check frequency)
+     _crc_check_chance = 1.0;
+     bytes_view dictionary;
+     for (auto&& o : options.elements) {
+         if (o.key.value == ZSTD_DICTIONARY) {
+             dictionary = o.value.value;
+         } else if (o.key.value == "crc_check_chance") {
+             auto value = std::string(reinterpret_cast<const char*>(o.value.value.data()), o.value.value.size());
+             try {
+                 _crc_check_chance = std::stod(value);
+             } catch (...) {
+                 throw malformed_sstable_exception("invalid crc_check_chance " + value);
+             }
+         }
+     }
+
      if (name.value == "LZ4Compressor") {
          _uncompress = uncompress_lz4;
      } else if (name.value == "SnappyCompressor") {
          _uncompress = uncompress_snappy;
      } else if (name.value == "DeflateCompressor") {
          _uncompress = uncompress_deflate;
+     } else if (name.value == "ZstdCompressor") {
+         _uncompress = uncompress_zstd;
+         // The level doesn't matter for uncompressing.
+         if (!dictionary.empty()) {
+             _zstd = make_lw_shared<zstd_dictionary>(bytes(dictionary), compression_parameters::DEFAULT_COMPRESSION_LEVEL);
+         }
      } else {
          throw std::runtime_error("unsupported compression type");
      }
@@ -63,11 +88,78 @@ void compression::set_compressor(compressor c) {
          _compress = compress_deflate;
          _compress_max_size = compress_max_size_deflate;
          name.value = "DeflateCompressor";
+     } else if (c == compressor::zstd) {
+         _compress = compress_zstd;
+         _compress_max_size = compress_max_size_zstd;
+         name.value = "ZstdCompressor";
      } else {
          throw std::runtime_error("unsupported compressor type");
      }
 }
 
+void compression::set_zstd_parameters(int level, bytes dictionary) {
+     if (!dictionary.empty()) {
+         options.elements.push_back({{to_bytes(ZSTD_DICTIONARY)}, {dictionary}});
+     }
+     if (level != compression_parameters::DEFAULT_COMPRESSION_LEVEL || !dictionary.empty()) {
+         _zstd = make_lw_shared<zstd_dictionary>(std::move(dictionary), level);
+     } else {
+         _zstd = {};
+     }
+}
+
+constexpr size_t zstd_dictionary_trainer::sample_size;
+constexpr size_t zstd_dictionary_trainer::samples_per_dictionary_size;
+
+zstd_dictionary_trainer::zstd_dictionary_trainer(size_t dictionary_size)
+    : _dictionary_size(dictionary_size)
+    , _max_samples(std::max<size_t>(1, dictionary_size * samples_per_dictionary_size / sample_size))
+    , _random_engine(std::random_device{}())
+{ }
+
+void zstd_dictionary_trainer::add_chunk(const char* chunk, size_t len) {
+    // One sample per chunk, from a random position within it, reservoir
+    // sampled so that the samples are spread over all that was written.
+    auto sample_len = std::min(len, sample_size);
+    if (!sample_len) {
+        return;
+    }
+    auto pos = std::uniform_int_distribution<size_t>(0, len - sample_len)(_random_engine);
+    auto sample = [&] {
+        return bytes(reinterpret_cast<const int8_t*>(chunk + pos), sample_len);
+    };
+    ++_seen;
+    if (_samples.size() < _max_samples) {
+        _samples.push_back(sample());
+        return;
+    }
+    auto i = std::uniform_int_distribution<uint64_t>(0, _seen - 1)(_random_engine);
+    if (i < _max_samples) {
+        _samples[i] = sample();
+    }
+}
+
+bytes zstd_dictionary_trainer::train() const {
+    size_t total = 0;
+    std::vector<size_t> sizes;
+    for (auto&& s : _samples) {
+        total += s.size();
+        sizes.push_back(s.size());
+    }
+    bytes buffer(bytes::initialized_later(), total);
+    auto out = buffer.begin();
+    for (auto&& s : _samples) {
+        out = std::copy(s.begin(), s.end(), out);
+    }
+    bytes dictionary(bytes::initialized_later(), _dictionary_size);
+    auto ret = ZDICT_trainFromBuffer(dictionary.begin(), dictionary.size(),
+            buffer.begin(), sizes.data(), sizes.size());
+    if (ZDICT_isError(ret)) {
+        return bytes();
+    }
+    return bytes(dictionary.begin(), ret);
+}
+
 compression::chunk_and_offset
 compression::locate(uint64_t position) const {
     auto ucl = uncompressed_chunk_length();
@@ -216,47 +308,150 @@ size_t compress_max_size_snappy(size_t input_len) {
     return snappy_max_compressed_length(input_len);
 }
 
+// Contexts are expensive to create, so each shard keeps one of each.
+static ZSTD_CCtx* zstd_compression_context() {
+    static thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> ctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    return ctx.get();
+}
+
+static ZSTD_DCtx* zstd_decompression_context() {
+    static thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    return ctx.get();
+}
+
+size_t uncompress_zstd(const char* input, size_t input_len,
+        char* output, size_t output_len) {
+    auto ret = ZSTD_decompressDCtx(zstd_decompression_context(), output, output_len, input, input_len);
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd uncompression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+size_t compress_zstd(const char* input, size_t input_len,
+        char* output, size_t output_len) {
+    auto ret = ZSTD_compressCCtx(zstd_compression_context(), output, output_len, input, input_len,
+            compression_parameters::DEFAULT_COMPRESSION_LEVEL);
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd compression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+size_t compress_max_size_zstd(size_t input_len) {
+    return ZSTD_compressBound(input_len);
+}
+
+namespace sstables {
+
+zstd_dictionary::zstd_dictionary(bytes raw, int level)
+    : _raw(std::move(raw))
+    , _level(level)
+{
+    if (!_raw.empty()) {
+        _cdict = ZSTD_createCDict(_raw.begin(), _raw.size(), _level);
+        _ddict = ZSTD_createDDict(_raw.begin(), _raw.size());
+        if (!_cdict || !_ddict) {
+            ZSTD_freeCDict(_cdict);
+            ZSTD_freeDDict(_ddict);
+            throw std::runtime_error("invalid zstd dictionary");
+        }
+    }
+}
+
+zstd_dictionary::~zstd_dictionary() {
+    ZSTD_freeCDict(_cdict);
+    ZSTD_freeDDict(_ddict);
+}
+
+size_t zstd_dictionary::compress(const char* input, size_t input_len, char* output, size_t output_len) const {
+    auto ret = _cdict
+            ? ZSTD_compress_usingCDict(zstd_compression_context(), output, output_len, input, input_len, _cdict)
+            : ZSTD_compressCCtx(zstd_compression_context(), output, output_len, input, input_len, _level);
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd compression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+size_t zstd_dictionary::uncompress(const char* input, size_t input_len, char* output, size_t output_len) const {
+    auto ret = _ddict
+            ? ZSTD_decompress_usingDDict(zstd_decompression_context(), output, output_len, input, input_len, _ddict)
+            : ZSTD_decompressDCtx(zstd_decompression_context(), output, output_len, input, input_len);
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd uncompression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+}
+
+static thread_local std::default_random_engine crc_check_random_engine{std::random_device{}()};
+
+// Verifies, with the probability set by crc_check_chance, and uncompresses
+// a chunk located by addr.
+static temporary_buffer<char> uncompress_chunk(temporary_buffer<char> buf,
+        sstables::compression::chunk_and_offset addr,
+        const sstables::compression::chunk_uncompressor& u) {
+    // The last 4 bytes of the chunk are the adler32 checksum
+    // of the rest of the (compressed) chunk.
+    auto compressed_len = addr.chunk_len - 4;
+    if (u.crc_check_chance >= 1.0
+            || std::uniform_real_distribution<double>()(crc_check_random_engine) < u.crc_check_chance) {
+        uint32_t checksum = ntohl(*unaligned_cast<const uint32_t *>(
+                buf.get() + compressed_len));
+        if (checksum != checksum_adler32(buf.get(), compressed_len)) {
+            throw std::runtime_error("compressed chunk failed checksum");
+        }
+    }
+
+    if (!u.uncompress) {
+        throw std::runtime_error("uncompress is not supported");
+    }
+    // We know that the uncompressed data will take exactly
+    // chunk_length bytes (or less, if reading the last chunk).
+    temporary_buffer<char> out(u.chunk_length);
+    // The compressed data is the whole chunk, minus the last 4
+    // bytes (which contain the checksum verified above).
+    auto len = u.zstd
+            ? u.zstd->uncompress(buf.get(), compressed_len, out.get_write(), out.size())
+            : u.uncompress(buf.get(), compressed_len, out.get_write(), out.size());
+    out.trim(len);
+    out.trim_front(addr.offset);
+    return out;
+}
+
 class compressed_file_data_source_impl : public data_source_impl {
     file _file;
     sstables::compression* _compression_metadata;
-    uint64_t _pos = 0;
+    // Uncompressed position of the next chunk to read, and where to stop.
+    uint64_t _read_pos;
+    uint64_t _end;
+    io_priority_class _pc;
+    io_queue* _queue;
+    sstables::read_ahead_window _window;
 public:
     compressed_file_data_source_impl(file f,
-            sstables::compression* cm, uint64_t pos)
+            sstables::compression* cm, uint64_t pos, uint64_t end, unsigned read_ahead_depth,
+            const io_priority_class& pc, io_queue& queue)
             : _file(std::move(f)), _compression_metadata(cm),
-              _pos(pos)
+              _read_pos(pos), _end(std::min(end, cm->data_len)),
+              _pc(pc), _queue(&queue), _window(read_ahead_depth)
             {}
     virtual future<temporary_buffer<char>> get() override {
-        if (_pos >= _compression_metadata->data_len) {
-            return make_ready_future<temporary_buffer<char>>();
-        }
-        auto addr = _compression_metadata->locate(_pos);
-        return _file.dma_read_exactly<char>(addr.chunk_start, addr.chunk_len).
-            then([this, addr](temporary_buffer<char> buf) {
-                // The last 4 bytes of the chunk are the adler32 checksum
-                // of the rest of the (compressed) chunk.
-                auto compressed_len = addr.chunk_len - 4;
-                // FIXME: Do not always calculate checksum - Cassandra has a
-                // probability (defaulting to 1.0, but still...)
-                uint32_t checksum = ntohl(*unaligned_cast<const uint32_t *>(
-                        buf.get() + compressed_len));
-                if (checksum != checksum_adler32(buf.get(), compressed_len)) {
-                    throw std::runtime_error("compressed chunk failed checksum");
-                }
-
-                // We know that the uncompressed data will take exactly
-                // chunk_length bytes (or less, if reading the last chunk).
-                temporary_buffer<char> out(
-                        _compression_metadata->uncompressed_chunk_length());
-                // The compressed data is the whole chunk, minus the last 4
-                // bytes (which contain the checksum verified above).
-                auto len = _compression_metadata->uncompress(
-                        buf.get(), compressed_len,
-                        out.get_write(), out.size());
-                out.trim(len);
-                out.trim_front(addr.offset);
-                _pos += out.size();
-                return out;
+        return _window.next([this] () -> std::experimental::optional<future<temporary_buffer<char>>> {
+            if (_read_pos >= _end) {
+                return {};
+            }
+            auto addr = _compression_metadata->locate(_read_pos);
+            _read_pos += _compression_metadata->uncompressed_chunk_length() - addr.offset;
+            // Uncompress as soon as the chunk arrives, rather than when it is
+            // consumed, so that chunks read ahead are also uncompressed ahead.
+            return _queue->queue_request(_pc, addr.chunk_len, [file = _file, addr] () mutable {
+                return file.dma_read_exactly<char>(addr.chunk_start, addr.chunk_len);
+            }).then([addr, u = _compression_metadata->get_chunk_uncompressor()] (temporary_buffer<char> buf) {
+                return uncompress_chunk(std::move(buf), addr, u);
+            });
         });
     }
 };
@@ -264,15 +459,24 @@ class compressed_file_data_source_impl : public data_source_impl {
 class compressed_file_data_source : public data_source {
 public:
     compressed_file_data_source(file f,
-            sstables::compression* cm, uint64_t offset)
+            sstables::compression* cm, uint64_t offset, uint64_t end, unsigned read_ahead_depth,
+            const io_priority_class& pc, io_queue& queue)
         : data_source(std::make_unique<compressed_file_data_source_impl>(
-                std::move(f), cm, offset))
+                std::move(f), cm, offset, end, read_ahead_depth, pc, queue))
         {}
 };
 
 input_stream<char> make_compressed_file_input_stream(
-        file f, sstables::compression* cm, uint64_t offset)
+        file f, sstables::compression* cm, uint64_t offset, const io_priority_class& pc, io_queue& queue)
+{
+    return input_stream<char>(compressed_file_data_source(
+            std::move(f), cm, offset, cm->data_len, 1, pc, queue));
+}
+
+input_stream<char> make_compressed_file_input_stream(
+        file f, sstables::compression* cm, uint64_t offset, uint64_t end,
+        const sstables::read_ahead_options& options, const io_priority_class& pc, io_queue& queue)
 {
     return input_stream<char>(compressed_file_data_source(
-            std::move(f), cm, offset));
+            std::move(f), cm, offset, end, options.max_depth, pc, queue));
 }
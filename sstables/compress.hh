@@ -36,11 +36,16 @@
 // Cassandra supports three different compression algorithms for the chunks,
 // LZ4, Snappy, and Deflate - the default (and therefore most important) is
 // LZ4. Each compressor is an implementation of the "compressor" class.
+// We additionally support Zstd, optionally with a dictionary trained on
+// samples of the table's data and stored in the Compression Info options,
+// which recovers much of the ratio lost by compressing each small chunk
+// on its own.
 //
 // Each compressed chunk is followed by a 4-byte checksum of the compressed
 // data, using the Adler32 algorithm. In Cassandra, there is a parameter
 // "crc_check_chance" (defaulting to 1.0) which determines the probability
-// of us verifying the checksum of each chunk we read.
+// of us verifying the checksum of each chunk we read. It is stored in the
+// options of the Compression Info file, and honoured when reading.
 //
 // This implementation does not cache the compressed disk blocks (which
 // are read using O_DIRECT), nor uncompressed data. We intend to cache high-
@@ -48,12 +53,14 @@
 
 #include <vector>
 #include <cstdint>
+#include <random>
 #include <zlib.h>
 
 #include "core/file.hh"
 #include "core/reactor.hh"
 #include "core/shared_ptr.hh"
 #include "types.hh"
+#include "read_ahead.hh"
 #include "../compress.hh"
 
 // An "uncompress_func" is a function which uncompresses the given compressed
@@ -68,6 +75,7 @@ typedef size_t uncompress_func(const char* input, size_t input_len,
 uncompress_func uncompress_lz4;
 uncompress_func uncompress_snappy;
 uncompress_func uncompress_deflate;
+uncompress_func uncompress_zstd;
 
 typedef size_t compress_func(const char* input, size_t input_len,
         char* output, size_t output_len);
@@ -75,12 +83,17 @@ typedef size_t compress_func(const char* input, size_t input_len,
 compress_func compress_lz4;
 compress_func compress_snappy;
 compress_func compress_deflate;
+compress_func compress_zstd;
 
 typedef size_t compress_max_size_func(size_t input_len);
 
 compress_max_size_func compress_max_size_lz4;
 compress_max_size_func compress_max_size_snappy;
 compress_max_size_func compress_max_size_deflate;
+compress_max_size_func compress_max_size_zstd;
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
 
 inline uint32_t init_checksum_adler32() {
     return adler32(0, Z_NULL, 0);
@@ -104,6 +117,57 @@ inline uint32_t checksum_adler32_combine(uint32_t adler1, uint32_t adler2, size_
 
 namespace sstables {
 
+// Zstd parameters beyond what compress_zstd() and uncompress_zstd() use:
+// a compression level and an optional dictionary, digested once so that
+// each chunk doesn't pay for loading it.
+class zstd_dictionary {
+    bytes _raw;
+    int _level;
+    ZSTD_CDict_s* _cdict = nullptr;
+    ZSTD_DDict_s* _ddict = nullptr;
+public:
+    zstd_dictionary(bytes raw, int level);
+    zstd_dictionary(const zstd_dictionary&) = delete;
+    zstd_dictionary& operator=(const zstd_dictionary&) = delete;
+    ~zstd_dictionary();
+
+    const bytes& raw() const {
+        return _raw;
+    }
+
+    size_t compress(const char* input, size_t input_len, char* output, size_t output_len) const;
+    size_t uncompress(const char* input, size_t input_len, char* output, size_t output_len) const;
+};
+
+// Collects a bounded, uniformly chosen, set of samples of the chunks
+// written to one or more sstables, and trains a Zstd dictionary on them.
+class zstd_dictionary_trainer {
+public:
+    // Zstd recommends training on about a hundred times the dictionary
+    // size, in samples around the size of what will be compressed.
+    static constexpr size_t sample_size = 4096;
+    static constexpr size_t samples_per_dictionary_size = 100;
+private:
+    size_t _dictionary_size;
+    size_t _max_samples;
+    uint64_t _seen = 0;
+    std::vector<bytes> _samples;
+    std::default_random_engine _random_engine;
+public:
+    explicit zstd_dictionary_trainer(size_t dictionary_size);
+
+    // Considers a sample of an uncompressed chunk.
+    void add_chunk(const char* chunk, size_t len);
+
+    size_t samples() const {
+        return _samples.size();
+    }
+
+    // Returns an empty dictionary if zstd couldn't train one, e.g. for
+    // lack of samples.
+    bytes train() const;
+};
+
 struct compression {
     disk_string<uint16_t> name;
     disk_array<uint32_t, option> options;
@@ -123,9 +187,42 @@ struct compression {
     // Variables *not* found in the "Compression Info" file (added by update()):
     uint64_t _compressed_file_length;
     uint32_t _full_checksum;
+    // Parsed from options by update().
+    double _crc_check_chance = 1.0;
+    // Zstd level and dictionary, when other than the defaults.
+    lw_shared_ptr<zstd_dictionary> _zstd;
+    // Fed with the chunks written, if set.
+    lw_shared_ptr<zstd_dictionary_trainer> _trainer;
 public:
+    static constexpr auto ZSTD_DICTIONARY = "zstd_dictionary";
+
+    // What it takes to verify and uncompress the chunks of a file, by value,
+    // so that chunks read ahead can be uncompressed as soon as they arrive,
+    // without referring to the compression metadata.
+    struct chunk_uncompressor {
+        uncompress_func* uncompress;
+        unsigned chunk_length;
+        double crc_check_chance;
+        lw_shared_ptr<zstd_dictionary> zstd;
+    };
+
     // Set the compressor algorithm, please check the definition of enum compressor.
     void set_compressor(compressor c);
+    // Zstd only: compress with the given level and dictionary (which may
+    // be empty), which is also stored in options for the readers.
+    void set_zstd_parameters(int level, bytes dictionary);
+    void set_dictionary_trainer(lw_shared_ptr<zstd_dictionary_trainer> trainer) {
+        _trainer = std::move(trainer);
+    }
+    void add_chunk_sample(const char* chunk, size_t len) {
+        if (_trainer) {
+            _trainer->add_chunk(chunk, len);
+        }
+    }
+    // The dictionary the chunks are compressed with, empty if none.
+    bytes_view dictionary() const {
+        return _zstd ? bytes_view(_zstd->raw()) : bytes_view();
+    }
     // After changing _compression, update() must be called to update
     // additional variables depending on it.
     void update(uint64_t compressed_file_length);
@@ -150,6 +247,12 @@ struct compression {
     unsigned uncompressed_chunk_length() const noexcept {
         return chunk_len;
     }
+    double crc_check_chance() const {
+        return _crc_check_chance;
+    }
+    chunk_uncompressor get_chunk_uncompressor() const {
+        return { _uncompress, chunk_len, _crc_check_chance, _zstd };
+    }
     uint64_t uncompressed_file_length() const {
         return data_len;
     }
@@ -177,6 +280,9 @@ struct compression {
         if (!_uncompress) {
             throw std::runtime_error("uncompress is not supported");
         }
+        if (_zstd) {
+            return _zstd->uncompress(input, input_len, output, output_len);
+        }
         return _uncompress(input, input_len, output, output_len);
     }
     size_t compress(
@@ -185,6 +291,9 @@ struct compression {
         if (!_compress) {
             throw std::runtime_error("compress is not supported");
         }
+        if (_zstd) {
+            return _zstd->compress(input, input_len, output, output_len);
+        }
         return _compress(input, input_len, output, output_len);
     }
     size_t compress_max_size(size_t input_len) const {
@@ -202,4 +311,16 @@ struct compression {
 // as long as we have *sstables* work in progress, we need to keep the whole
 // sstable alive, and the compression metadata is only a part of it.
 input_stream<char> make_compressed_file_input_stream(
-        file f, sstables::compression *cm, uint64_t offset = 0);
+        file f, sstables::compression *cm, uint64_t offset = 0,
+        const io_priority_class& pc = query_priority(),
+        io_queue& queue = local_io_queue());
+
+// Like the above, but stops at the uncompressed position end and keeps
+// reads of the compressed chunks in flight ahead of the consumer. Chunks
+// are verified and uncompressed as soon as they are read, so that their
+// decompression overlaps with the consumption of the preceding ones.
+input_stream<char> make_compressed_file_input_stream(
+        file f, sstables::compression *cm, uint64_t offset, uint64_t end,
+        const sstables::read_ahead_options& options,
+        const io_priority_class& pc = query_priority(),
+        io_queue& queue = local_io_queue());
@@ -220,6 +220,12 @@ class continuous_data_consumer {
     continuous_data_consumer(input_stream<char>&& input, uint64_t maxlen)
             : _input(std::move(input)), _remain(maxlen) {}
 
+    // Length of input left to read, or negative when reading until the end
+    // of file.
+    int64_t remaining() const {
+        return _remain;
+    }
+
     template<typename Consumer>
     future<> consume_input(Consumer& c) {
         return _input.consume(c);
@@ -28,17 +28,40 @@
 #include "types.hh"
 #include "sstables.hh"
 #include "utils/bloom_filter.hh"
+#include "utils/blocked_bloom_filter.hh"
 
 namespace sstables {
 
+// Blocked filters are tagged by this bit in the hash count of Filter.db.
+// Origin doesn't know about them, so sstables of tables using the blocked
+// format can only be read by Scylla.
+static constexpr uint32_t blocked_filter_flag = 1u << 31;
+
 future<> sstable::read_filter() {
     if (!has_component(sstable::component_type::Filter)) {
         _filter = std::make_unique<utils::filter::always_present_filter>();
         return make_ready_future<>();
     }
+    if (default_load_options().map_filter) {
+        return map_filter();
+    }
+    return load_filter();
+}
 
+future<> sstable::load_filter() {
     return do_with(sstables::filter(), [this] (auto& filter) {
         return this->read_simple<sstable::component_type::Filter>(filter).then([this, &filter] {
+            if (filter.hashes & blocked_filter_flag) {
+                auto& words = filter.buckets.elements;
+                auto f = std::make_unique<utils::filter::blocked_bloom_filter>(filter.hashes & ~blocked_filter_flag,
+                        words.size() / utils::filter::blocked_bloom_filter::words_per_block);
+                if (f->nr_words() != words.size()) {
+                    throw malformed_sstable_exception(sprint("blocked bloom filter of %d words is not a multiple of the block size", words.size()));
+                }
+                f->load(words.begin(), words.end());
+                _filter = std::move(f);
+                return;
+            }
             large_bitset bs(filter.buckets.elements.size() * 64);
             bs.load(filter.buckets.elements.begin(), filter.buckets.elements.end());
             _filter = utils::filter::create_filter(filter.hashes, std::move(bs));
@@ -50,18 +73,54 @@ future<> sstable::read_filter() {
     });
 }
 
-void sstable::write_filter() {
+// Filter.db is the hash count and the number of words, then the words of
+// the bitset, all big-endian, so the words are tested in place.
+future<> sstable::map_filter() {
+    return make_ready_future<>().then([this] {
+        auto m = map_component(sstable::component_type::Filter);
+        uint32_t header[2];
+        if (m->size() < sizeof(header)) {
+            throw malformed_sstable_exception(sprint("%s: truncated bloom filter", filename(sstable::component_type::Filter)));
+        }
+        std::copy_n(m->data(), sizeof(header), reinterpret_cast<char*>(header));
+        auto hashes = net::ntoh(header[0]);
+        auto nr_words = net::ntoh(header[1]);
+        if (hashes & blocked_filter_flag) {
+            return false;
+        }
+        if (m->size() < sizeof(header) + nr_words * sizeof(uint64_t)) {
+            throw malformed_sstable_exception(sprint("%s: truncated bloom filter of %d words", filename(sstable::component_type::Filter), nr_words));
+        }
+        auto words = reinterpret_cast<const uint64_t*>(m->data() + sizeof(header));
+        _filter_file_size = m->size();
+        _filter = std::make_unique<utils::filter::mapped_murmur3_bloom_filter>(hashes, std::move(m), words, nr_words);
+        return true;
+    }).then([this] (bool mapped) {
+        // Blocked filters are loaded.
+        return mapped ? make_ready_future<>() : this->load_filter();
+    });
+}
+
+void sstable::write_filter(const io_priority_class& pc) {
     if (!has_component(sstable::component_type::Filter)) {
         return;
     }
 
+    if (auto bf = dynamic_cast<utils::filter::blocked_bloom_filter*>(_filter.get())) {
+        std::deque<uint64_t> v(bf->nr_words());
+        bf->save(v.begin());
+        auto filter = sstables::filter(bf->num_hashes() | blocked_filter_flag, std::move(v));
+        write_simple<sstable::component_type::Filter>(filter, pc);
+        return;
+    }
+
     auto f = static_cast<utils::filter::murmur3_bloom_filter *>(_filter.get());
 
     auto&& bs = f->bits();
     std::deque<uint64_t> v(align_up(bs.size(), size_t(64)) / 64);
     bs.save(v.begin());
     auto filter = sstables::filter(f->num_hashes(), std::move(v));
-    write_simple<sstable::component_type::Filter>(filter);
+    write_simple<sstable::component_type::Filter>(filter, pc);
 }
 
 }
@@ -29,6 +29,9 @@ class sstable;
 class filter_tracker {
     uint64_t false_positive = 0;
     uint64_t true_positive = 0;
+    // Lookups the filter rejected. Together with false_positive, gives the
+    // false positive rate the filter was sized for.
+    uint64_t true_negative = 0;
 
     uint64_t last_false_positive = 0;
     uint64_t last_true_positive = 0;
@@ -41,5 +44,9 @@ class filter_tracker {
         true_positive++;
     }
 
+    void add_true_negative() {
+        true_negative++;
+    }
+
     friend class sstables::sstable;
 };
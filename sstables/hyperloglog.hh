@@ -84,6 +84,21 @@ static inline size_t size_unsigned_var_int(unsigned int value) {
     return size;
 }
 
+static inline unsigned int read_unsigned_var_int(const uint8_t* from, size_t size, size_t& offset) {
+    unsigned int value = 0;
+    for (unsigned shift = 0; shift < 32; shift += 7) {
+        if (offset >= size) {
+            throw std::invalid_argument("truncated variable length integer");
+        }
+        auto b = from[offset++];
+        value |= unsigned(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return value;
+        }
+    }
+    throw std::invalid_argument("variable length integer is too long");
+}
+
 static inline size_t write_unsigned_var_int(unsigned int value, uint8_t* to) {
     size_t size = 0;
     while ((value & 0xFFFFFF80) != 0L) {
@@ -136,11 +151,40 @@ class HyperLogLog {
         alphaMM_ = alpha * m_ * m_;
     }
 
-    static HyperLogLog from_bytes(temporary_buffer<uint8_t> bytes) {
-        // FIXME: implement class that creates a HyperLogLog from an array of bytes.
-        // This will useful if we need to work with the cardinality data from the
-        // compaction metadata.
-        abort();
+    /**
+     * Restores an estimator from the output of get_bytes().
+     *
+     * Only the NORMAL format with one byte per register, as written by
+     * get_bytes(), is understood. Origin packs registers differently, so
+     * its cardinality data is rejected.
+     *
+     * @exception std::invalid_argument the data is not in that format.
+     */
+    static HyperLogLog from_bytes(const temporary_buffer<uint8_t>& bytes) {
+        static constexpr int version = 2;
+
+        if (bytes.size() < sizeof(int)) {
+            throw std::invalid_argument("truncated cardinality data");
+        }
+        size_t offset = 0;
+        uint32_t raw_version;
+        memcpy(&raw_version, bytes.get(), sizeof(raw_version));
+        if (int(ntohl(raw_version)) != -version) {
+            throw std::invalid_argument("unsupported cardinality data version");
+        }
+        offset += sizeof(int);
+
+        auto b = read_unsigned_var_int(bytes.get(), bytes.size(), offset);
+        read_unsigned_var_int(bytes.get(), bytes.size(), offset); // sp
+        auto type = read_unsigned_var_int(bytes.get(), bytes.size(), offset);
+        auto size = read_unsigned_var_int(bytes.get(), bytes.size(), offset);
+        if (type != 0 || b < 4 || b > 16 || size != (1u << b) || bytes.size() - offset < size) {
+            throw std::invalid_argument("unsupported cardinality data format");
+        }
+
+        HyperLogLog hll(b);
+        std::copy_n(bytes.get() + offset, size, hll.M_.begin());
+        return hll;
     }
 
     /**
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "index_page_cache.hh"
+#include "types.hh"
+#include "core/memory.hh"
+#include <seastar/core/scollectd.hh>
+
+namespace sstables {
+
+index_page_cache& global_index_page_cache() {
+    static thread_local index_page_cache instance;
+    return instance;
+}
+
+bytes index_page_view::serialize(const std::vector<index_entry>& entries) {
+    size_t keys_size = 0;
+    for (auto&& e : entries) {
+        keys_size += e.get_key_bytes().size() + e.get_promoted_index_bytes().size();
+    }
+    uint32_t count = entries.size();
+    size_t headers_size = sizeof(count) + count * sizeof(entry_header);
+    bytes data(bytes::initialized_later(), headers_size + keys_size);
+
+    auto out = data.begin();
+    memcpy(out, &count, sizeof(count));
+    out += sizeof(count);
+    uint32_t key_offset = headers_size;
+    for (auto&& e : entries) {
+        auto key = e.get_key_bytes();
+        auto promoted_index = e.get_promoted_index_bytes();
+        entry_header h{e.position(), key_offset, uint32_t(key.size()), uint32_t(promoted_index.size())};
+        memcpy(out, &h, sizeof(h));
+        out += sizeof(h);
+        auto p = std::copy(key.begin(), key.end(), data.begin() + key_offset);
+        std::copy(promoted_index.begin(), promoted_index.end(), p);
+        key_offset += key.size() + promoted_index.size();
+    }
+    return data;
+}
+
+cached_index_page::cached_index_page(cached_index_page&& o) noexcept
+    : _sstable_id(o._sstable_id)
+    , _summary_idx(o._summary_idx)
+    , _data(std::move(o._data))
+    , _lru_link()
+    , _cache_link()
+{
+    {
+        auto prev = o._lru_link.prev_;
+        o._lru_link.unlink();
+        index_page_cache::lru_type::node_algorithms::link_after(prev, _lru_link.this_ptr());
+    }
+
+    {
+        using container_type = index_page_cache::pages_type;
+        container_type::node_algorithms::replace_node(o._cache_link.this_ptr(), _cache_link.this_ptr());
+        container_type::node_algorithms::init(o._cache_link.this_ptr());
+    }
+}
+
+index_page_cache::index_page_cache() {
+    setup_collectd();
+
+    _region.make_evictable([this] {
+        return with_allocator(_region.allocator(), [this] {
+            if (_lru.empty()) {
+                return memory::reclaiming_result::reclaimed_nothing;
+            }
+            evict_one();
+            return memory::reclaiming_result::reclaimed_something;
+        });
+    });
+}
+
+index_page_cache::~index_page_cache() {
+    clear();
+}
+
+void
+index_page_cache::setup_collectd() {
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "used")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _region.occupancy().used_space(); })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.hits)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "misses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.misses)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "insertions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.insertions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.evictions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_time_in_ms", "parse")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, [this] { return _stats.parse_time_ns / 1000000; })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "pages")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.pages)
+        ),
+    }));
+}
+
+// Must be called with the region's allocator.
+void index_page_cache::evict_one() {
+    _lru.pop_back_and_dispose(current_deleter<cached_index_page>());
+    --_stats.pages;
+    ++_stats.evictions;
+}
+
+void index_page_cache::insert(uint64_t sstable_id, uint64_t summary_idx, bytes_view page) {
+    if (!_capacity) {
+        return;
+    }
+    with_allocator(_region.allocator(), [&] {
+        _insert_section(_region, [&] {
+            cached_index_page::compare::key_type k(sstable_id, summary_idx);
+            auto i = _pages.lower_bound(k, cached_index_page::compare());
+            if (i != _pages.end() && !cached_index_page::compare()(k, *i)) {
+                return;
+            }
+            auto p = current_allocator().construct<cached_index_page>(sstable_id, summary_idx, page);
+            _pages.insert(i, *p);
+            _lru.push_front(*p);
+            ++_stats.pages;
+            ++_stats.insertions;
+        });
+        while (_region.occupancy().used_space() > _capacity && !_lru.empty()) {
+            evict_one();
+        }
+    });
+}
+
+void index_page_cache::invalidate(uint64_t sstable_id) {
+    with_allocator(_region.allocator(), [&] {
+        auto range = _pages.equal_range(sstable_id, cached_index_page::compare());
+        _pages.erase_and_dispose(range.first, range.second, [this, deleter = current_deleter<cached_index_page>()] (auto&& p) mutable {
+            --_stats.pages;
+            deleter(p);
+        });
+    });
+}
+
+void index_page_cache::clear() {
+    with_allocator(_region.allocator(), [this] {
+        _lru.clear_and_dispose(current_deleter<cached_index_page>());
+    });
+    _stats.pages = 0;
+}
+
+void index_page_cache::set_capacity(size_t capacity) {
+    _capacity = capacity;
+    with_allocator(_region.allocator(), [this] {
+        while (_region.occupancy().used_space() > _capacity && !_lru.empty()) {
+            evict_one();
+        }
+    });
+}
+
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/set.hpp>
+#include <experimental/optional>
+#include <type_traits>
+#include <chrono>
+
+#include "bytes.hh"
+#include "key.hh"
+#include "utils/managed_bytes.hh"
+#include "utils/logalloc.hh"
+
+namespace scollectd {
+
+struct registrations;
+
+}
+
+namespace sstables {
+
+class index_entry;
+
+// Read-only view of a parsed Index.db page, i.e. of the index entries of
+// one summary interval, laid out flat as
+//
+//   [count][count x (position, key offset, key size, promoted index size)]
+//   [count x (key, promoted index)]
+//
+// so that it can be stored as a single LSA blob and binary searched in
+// place. Provides the size()/operator[]/get_key() interface expected by
+// sstable::binary_search().
+class index_page_view {
+    struct entry_header {
+        uint64_t position;
+        uint32_t key_offset;
+        uint32_t key_size;
+        // The promoted index follows the key.
+        uint32_t promoted_index_size;
+    } __attribute__((packed));
+
+    bytes_view _data;
+public:
+    class entry {
+        key_view _key;
+        uint64_t _position;
+        bytes_view _promoted_index;
+    public:
+        entry(key_view key, uint64_t position, bytes_view promoted_index)
+            : _key(key), _position(position), _promoted_index(promoted_index) {}
+        key_view get_key() const { return _key; }
+        uint64_t position() const { return _position; }
+        // Empty for partitions which fit in a single block.
+        bytes_view promoted_index() const { return _promoted_index; }
+    };
+
+    explicit index_page_view(bytes_view data) : _data(data) {}
+
+    size_t size() const {
+        uint32_t count;
+        memcpy(&count, _data.data(), sizeof(count));
+        return count;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    entry operator[](size_t i) const {
+        entry_header h;
+        memcpy(&h, _data.data() + sizeof(uint32_t) + i * sizeof(entry_header), sizeof(h));
+        auto key = _data.data() + h.key_offset;
+        return entry(key_view(bytes_view(key, h.key_size)), h.position,
+                bytes_view(key + h.key_size, h.promoted_index_size));
+    }
+
+    entry front() const {
+        return (*this)[0];
+    }
+
+    // Builds the flat representation of a parsed index page.
+    static bytes serialize(const std::vector<index_entry>& entries);
+};
+
+class cached_index_page {
+    using lru_link_type = boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
+    using cache_link_type = boost::intrusive::set_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
+
+    uint64_t _sstable_id;
+    uint64_t _summary_idx;
+    managed_bytes _data;
+    lru_link_type _lru_link;
+    cache_link_type _cache_link;
+public:
+    friend class index_page_cache;
+
+    cached_index_page(uint64_t sstable_id, uint64_t summary_idx, bytes_view data)
+        : _sstable_id(sstable_id)
+        , _summary_idx(summary_idx)
+        , _data(data)
+    { }
+
+    cached_index_page(cached_index_page&&) noexcept;
+
+    // Only valid while the region is not compacted.
+    index_page_view view() const {
+        return index_page_view(_data);
+    }
+
+    struct compare {
+        using key_type = std::pair<uint64_t, uint64_t>;
+
+        static key_type key(const cached_index_page& p) {
+            return { p._sstable_id, p._summary_idx };
+        }
+
+        bool operator()(const cached_index_page& p1, const cached_index_page& p2) const {
+            return key(p1) < key(p2);
+        }
+
+        bool operator()(const key_type& k, const cached_index_page& p) const {
+            return k < key(p);
+        }
+
+        bool operator()(const cached_index_page& p, const key_type& k) const {
+            return key(p) < k;
+        }
+
+        bool operator()(uint64_t sstable_id, const cached_index_page& p) const {
+            return sstable_id < p._sstable_id;
+        }
+
+        bool operator()(const cached_index_page& p, uint64_t sstable_id) const {
+            return p._sstable_id < sstable_id;
+        }
+    };
+};
+
+// Shard-wide cache of parsed index pages, shared by all sstables of the
+// shard, living in its own evictable LSA region and bounded by a capacity.
+class index_page_cache final {
+public:
+    using lru_type = boost::intrusive::list<cached_index_page,
+        boost::intrusive::member_hook<cached_index_page, cached_index_page::lru_link_type, &cached_index_page::_lru_link>,
+        boost::intrusive::constant_time_size<false>>; // we need this to have bi::auto_unlink on hooks.
+    using pages_type = boost::intrusive::set<cached_index_page,
+        boost::intrusive::member_hook<cached_index_page, cached_index_page::cache_link_type, &cached_index_page::_cache_link>,
+        boost::intrusive::constant_time_size<false>, // we need this to have bi::auto_unlink on hooks
+        boost::intrusive::compare<cached_index_page::compare>>;
+
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        uint64_t pages = 0;
+        // Time spent reading and parsing pages which were not cached.
+        uint64_t parse_time_ns = 0;
+    };
+private:
+    stats _stats;
+    // In bytes of LSA memory. 0 disables the cache.
+    size_t _capacity = 100 << 20;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+    logalloc::region _region;
+    logalloc::allocating_section _insert_section;
+    lru_type _lru;
+    pages_type _pages;
+private:
+    void setup_collectd();
+    void evict_one();
+public:
+    index_page_cache();
+    ~index_page_cache();
+
+    // If the page is cached, invokes func with a view of it and returns
+    // the result. The view is valid only until func returns.
+    template <typename Func>
+    std::experimental::optional<std::result_of_t<Func(const index_page_view&)>>
+    with_page(uint64_t sstable_id, uint64_t summary_idx, Func&& func) {
+        if (!_capacity) {
+            return {};
+        }
+        logalloc::reclaim_lock _(_region);
+        auto i = _pages.find(cached_index_page::compare::key_type(sstable_id, summary_idx), cached_index_page::compare());
+        if (i == _pages.end()) {
+            ++_stats.misses;
+            return {};
+        }
+        ++_stats.hits;
+        _lru.erase(_lru.iterator_to(*i));
+        _lru.push_front(*i);
+        return func(i->view());
+    }
+
+    void insert(uint64_t sstable_id, uint64_t summary_idx, bytes_view page);
+
+    void on_parse(std::chrono::steady_clock::duration d) {
+        _stats.parse_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+    // Drops all the pages of the given sstable.
+    void invalidate(uint64_t sstable_id);
+
+    void clear();
+
+    void set_capacity(size_t capacity);
+
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    const stats& get_stats() const {
+        return _stats;
+    }
+
+    const logalloc::region& region() const {
+        return _region;
+    }
+};
+
+// Returns a reference to shard-wide index_page_cache.
+index_page_cache& global_index_page_cache();
+
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "key_cache.hh"
+#include "core/memory.hh"
+#include <seastar/core/scollectd.hh>
+
+namespace sstables {
+
+key_cache& global_key_cache() {
+    static thread_local key_cache instance;
+    return instance;
+}
+
+key_cache_entry::key_cache_entry(key_cache_entry&& o) noexcept
+    : _sstable_id(o._sstable_id)
+    , _key(std::move(o._key))
+    , _position(o._position)
+    , _lru_link()
+    , _cache_link()
+{
+    {
+        auto prev = o._lru_link.prev_;
+        o._lru_link.unlink();
+        key_cache::lru_type::node_algorithms::link_after(prev, _lru_link.this_ptr());
+    }
+
+    {
+        using container_type = key_cache::entries_type;
+        container_type::node_algorithms::replace_node(o._cache_link.this_ptr(), _cache_link.this_ptr());
+        container_type::node_algorithms::init(o._cache_link.this_ptr());
+    }
+}
+
+key_cache::key_cache() {
+    setup_collectd();
+
+    _region.make_evictable([this] {
+        return with_allocator(_region.allocator(), [this] {
+            if (_lru.empty()) {
+                return memory::reclaiming_result::reclaimed_nothing;
+            }
+            evict_one();
+            return memory::reclaiming_result::reclaimed_something;
+        });
+    });
+}
+
+key_cache::~key_cache() {
+    clear();
+}
+
+void
+key_cache::setup_collectd() {
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("key_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "used")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _region.occupancy().used_space(); })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("key_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.hits)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("key_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "misses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.misses)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("key_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "insertions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.insertions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("key_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.evictions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("key_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "entries")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.entries)
+        ),
+    }));
+}
+
+// Must be called with the region's allocator.
+void key_cache::evict_one() {
+    _lru.pop_back_and_dispose(current_deleter<key_cache_entry>());
+    --_stats.entries;
+    ++_stats.evictions;
+}
+
+std::experimental::optional<partition_position>
+key_cache::find(uint64_t sstable_id, bytes_view key) {
+    if (!_capacity) {
+        return {};
+    }
+    auto i = _entries.find(key_cache_entry::compare::lookup{sstable_id, key}, key_cache_entry::compare());
+    if (i == _entries.end()) {
+        ++_stats.misses;
+        return {};
+    }
+    ++_stats.hits;
+    _lru.erase(_lru.iterator_to(*i));
+    _lru.push_front(*i);
+    return i->position();
+}
+
+void key_cache::insert(uint64_t sstable_id, bytes_view key, partition_position position) {
+    if (!_capacity) {
+        return;
+    }
+    with_allocator(_region.allocator(), [&] {
+        _insert_section(_region, [&] {
+            key_cache_entry::compare::lookup l{sstable_id, key};
+            auto i = _entries.lower_bound(l, key_cache_entry::compare());
+            if (i != _entries.end() && !key_cache_entry::compare()(l, *i)) {
+                return;
+            }
+            auto entry = current_allocator().construct<key_cache_entry>(sstable_id, key, position);
+            _entries.insert(i, *entry);
+            _lru.push_front(*entry);
+            ++_stats.entries;
+            ++_stats.insertions;
+        });
+        while (_region.occupancy().used_space() > _capacity && !_lru.empty()) {
+            evict_one();
+        }
+    });
+}
+
+void key_cache::invalidate(uint64_t sstable_id) {
+    with_allocator(_region.allocator(), [&] {
+        auto range = _entries.equal_range(sstable_id, key_cache_entry::compare());
+        _entries.erase_and_dispose(range.first, range.second, [this, deleter = current_deleter<key_cache_entry>()] (auto&& e) mutable {
+            --_stats.entries;
+            deleter(e);
+        });
+    });
+}
+
+std::vector<std::pair<uint64_t, bytes>> key_cache::keys(size_t max) {
+    std::vector<std::pair<uint64_t, bytes>> keys;
+    logalloc::reclaim_lock _(_region);
+    for (auto&& e : _lru) {
+        if (max && keys.size() == max) {
+            break;
+        }
+        auto key = e.key();
+        keys.emplace_back(e.sstable_id(), bytes(key.begin(), key.end()));
+    }
+    return keys;
+}
+
+void key_cache::clear() {
+    with_allocator(_region.allocator(), [this] {
+        _lru.clear_and_dispose(current_deleter<key_cache_entry>());
+    });
+    _stats.entries = 0;
+}
+
+void key_cache::set_capacity(size_t capacity) {
+    _capacity = capacity;
+    with_allocator(_region.allocator(), [this] {
+        while (_region.occupancy().used_space() > _capacity && !_lru.empty()) {
+            evict_one();
+        }
+    });
+}
+
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/set.hpp>
+#include <experimental/optional>
+#include <vector>
+
+#include "bytes.hh"
+#include "utils/managed_bytes.hh"
+#include "utils/logalloc.hh"
+
+namespace scollectd {
+
+struct registrations;
+
+}
+
+namespace sstables {
+
+namespace bi = boost::intrusive;
+
+// Byte range of a partition in the data file.
+struct partition_position {
+    uint64_t start;
+    uint64_t end;
+    // Whether the index entry of the partition has a promoted index, which
+    // a read of a slice of it goes to Index.db for.
+    bool has_promoted_index = false;
+};
+
+// Maps a partition key of a given sstable to the position of the partition
+// in its data file, so that a read of a cached key doesn't need to go
+// through Index.db.
+//
+// Sstables are identified by an id unique within the shard rather than by
+// their generation number, since generations are only unique within a
+// column family.
+class key_cache_entry {
+    using lru_link_type = bi::list_member_hook<bi::link_mode<bi::auto_unlink>>;
+    using cache_link_type = bi::set_member_hook<bi::link_mode<bi::auto_unlink>>;
+
+    uint64_t _sstable_id;
+    managed_bytes _key;
+    partition_position _position;
+    lru_link_type _lru_link;
+    cache_link_type _cache_link;
+public:
+    friend class key_cache;
+
+    key_cache_entry(uint64_t sstable_id, bytes_view key, partition_position position)
+        : _sstable_id(sstable_id)
+        , _key(key)
+        , _position(position)
+    { }
+
+    key_cache_entry(key_cache_entry&&) noexcept;
+
+    uint64_t sstable_id() const { return _sstable_id; }
+    bytes_view key() const { return _key; }
+    const partition_position& position() const { return _position; }
+
+    // Orders by sstable first, so that all the entries of an sstable can be
+    // dropped at once.
+    struct compare {
+        struct lookup {
+            uint64_t sstable_id;
+            bytes_view key;
+        };
+
+        static int tri_compare(uint64_t id1, bytes_view k1, uint64_t id2, bytes_view k2) {
+            if (id1 != id2) {
+                return id1 < id2 ? -1 : 1;
+            }
+            return k1.compare(k2);
+        }
+
+        bool operator()(const key_cache_entry& e1, const key_cache_entry& e2) const {
+            return tri_compare(e1._sstable_id, e1._key, e2._sstable_id, e2._key) < 0;
+        }
+
+        bool operator()(const lookup& l, const key_cache_entry& e) const {
+            return tri_compare(l.sstable_id, l.key, e._sstable_id, e._key) < 0;
+        }
+
+        bool operator()(const key_cache_entry& e, const lookup& l) const {
+            return tri_compare(e._sstable_id, e._key, l.sstable_id, l.key) < 0;
+        }
+
+        bool operator()(uint64_t sstable_id, const key_cache_entry& e) const {
+            return sstable_id < e._sstable_id;
+        }
+
+        bool operator()(const key_cache_entry& e, uint64_t sstable_id) const {
+            return e._sstable_id < sstable_id;
+        }
+    };
+};
+
+// Shard-wide cache of partition positions, living in its own evictable
+// LSA region and bounded by a capacity. Entries are also evicted, in LRU
+// order, under memory pressure.
+class key_cache final {
+public:
+    using lru_type = bi::list<key_cache_entry,
+        bi::member_hook<key_cache_entry, key_cache_entry::lru_link_type, &key_cache_entry::_lru_link>,
+        bi::constant_time_size<false>>; // we need this to have bi::auto_unlink on hooks.
+    using entries_type = bi::set<key_cache_entry,
+        bi::member_hook<key_cache_entry, key_cache_entry::cache_link_type, &key_cache_entry::_cache_link>,
+        bi::constant_time_size<false>, // we need this to have bi::auto_unlink on hooks
+        bi::compare<key_cache_entry::compare>>;
+
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        uint64_t entries = 0;
+    };
+private:
+    stats _stats;
+    // In bytes of LSA memory. 0 disables the cache.
+    size_t _capacity = 100 << 20;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+    logalloc::region _region;
+    logalloc::allocating_section _insert_section;
+    lru_type _lru;
+    entries_type _entries;
+private:
+    void setup_collectd();
+    void evict_one();
+public:
+    key_cache();
+    ~key_cache();
+
+    // Returns the position of the given partition, if cached, and marks
+    // it as recently used.
+    std::experimental::optional<partition_position> find(uint64_t sstable_id, bytes_view key);
+
+    void insert(uint64_t sstable_id, bytes_view key, partition_position position);
+
+    // Drops all the entries of the given sstable.
+    void invalidate(uint64_t sstable_id);
+
+    // The sstable ids and keys of up to max entries, 0 for all, most
+    // recently used first.
+    std::vector<std::pair<uint64_t, bytes>> keys(size_t max);
+
+    void clear();
+
+    void set_capacity(size_t capacity);
+
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    const stats& get_stats() const {
+        return _stats;
+    }
+
+    const logalloc::region& region() const {
+        return _region;
+    }
+};
+
+// Returns a reference to shard-wide key_cache.
+key_cache& global_key_cache();
+
+}
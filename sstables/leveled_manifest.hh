@@ -45,6 +45,7 @@
 #include "compaction.hh"
 #include "range.hh"
 #include "log.hh"
+#include <unordered_set>
 
 class leveled_manifest {
     logging::logger logger;
@@ -68,6 +69,11 @@ class leveled_manifest {
     private final RowPosition[] lastCompactedKeys;
 #endif
     uint64_t _max_sstable_size_in_bytes;
+    // SSTables picked for a compaction which hasn't completed yet. They are
+    // left out when picking further compactions, so that compactions picked
+    // together never share an sstable, nor write overlapping sstables into
+    // the same level.
+    std::unordered_set<sstables::shared_sstable> _compacting;
 #if 0
     private final SizeTieredCompactionStrategyOptions options;
     private final int [] compactionCounter;
@@ -358,28 +364,21 @@ class leveled_manifest {
             if (sstables.empty()) {
                 continue; // mostly this just avoids polluting the debug log with zero scores
             }
-#if 0
             // we want to calculate score excluding compacting ones
-            Set<SSTableReader> sstablesInLevel = Sets.newHashSet(sstables);
-            Set<SSTableReader> remaining = Sets.difference(sstablesInLevel, cfs.getDataTracker().getCompacting());
-#endif
-            double score = (double) get_total_bytes(sstables) / (double) max_bytes_for_level(i);
+            auto remaining = uncompacting(sstables);
+            double score = (double) get_total_bytes(remaining) / (double) max_bytes_for_level(i);
 
             logger.debug("Compaction score for level {} is {}", i, score);
 
             if (score > 1.001) {
-#if 0
                 // before proceeding with a higher level, let's see if L0 is far enough behind to warrant STCS
-                if (!DatabaseDescriptor.getDisableSTCSInL0() && getLevel(0).size() > MAX_COMPACTING_L0)
-                {
-                    List<SSTableReader> mostInteresting = getSSTablesForSTCS(getLevel(0));
-                    if (!mostInteresting.isEmpty())
-                    {
+                if (get_level(0).size() > MAX_COMPACTING_L0) {
+                    auto most_interesting = get_sstables_for_stcs(get_level(0));
+                    if (!most_interesting.empty()) {
                         logger.debug("L0 is too far behind, performing size-tiering there first");
-                        return new CompactionCandidate(mostInteresting, 0, Long.MAX_VALUE);
+                        return sstables::compaction_descriptor(std::move(most_interesting));
                     }
                 }
-#endif
                 // L0 is fine, proceed with this level
                 auto candidates = get_candidates_for(i);
                 if (!candidates.empty()) {
@@ -409,18 +408,66 @@ class leveled_manifest {
         return sstables::compaction_descriptor(std::move(candidates), next_level, _max_sstable_size_in_bytes);
     }
 
-#if 0
-    private List<SSTableReader> getSSTablesForSTCS(Collection<SSTableReader> sstables)
-    {
-        Iterable<SSTableReader> candidates = cfs.getDataTracker().getUncompactingSSTables(sstables);
-        List<Pair<SSTableReader,Long>> pairs = SizeTieredCompactionStrategy.createSSTableAndLengthPairs(AbstractCompactionStrategy.filterSuspectSSTables(candidates));
-        List<List<SSTableReader>> buckets = SizeTieredCompactionStrategy.getBuckets(pairs,
-                                                                                    options.bucketHigh,
-                                                                                    options.bucketLow,
-                                                                                    options.minSSTableSize);
-        return SizeTieredCompactionStrategy.mostInterestingBucket(buckets, 4, 32);
+    /**
+     * @return up to the MAX_COMPACTING_L0 most interesting uncompacting sstables of @param sstables,
+     * bucketed the size-tiered way. The result of compacting them stays in the same level.
+     */
+    std::vector<sstables::shared_sstable> get_sstables_for_stcs(const std::list<sstables::shared_sstable>& sstables) {
+        auto candidates = make_lw_shared<sstables::sstable_list>();
+        for (auto& sstable : sstables) {
+            if (!_compacting.count(sstable)) {
+                candidates->emplace(sstable->generation(), sstable);
+            }
+        }
+        return sstables::size_tiered_most_interesting_bucket(std::move(candidates));
+    }
+
+    /**
+     * @return compactions to run at the same time, at most @param max_jobs of them.
+     * Each one is picked the way get_compaction_candidates() does, ignoring the sstables
+     * of the ones picked before, so that they share no sstable and write sstables which
+     * don't overlap those written by the others into the same level.
+     */
+    std::vector<sstables::compaction_descriptor> get_parallel_compaction_candidates(unsigned max_jobs) {
+        std::vector<sstables::compaction_descriptor> jobs;
+        while (jobs.size() < max_jobs) {
+            auto candidate = get_compaction_candidates();
+            if (candidate.sstables.empty()) {
+                break;
+            }
+            mark_compacting(candidate.sstables);
+            jobs.push_back(std::move(candidate));
+        }
+        return jobs;
+    }
+
+    void mark_compacting(const std::vector<sstables::shared_sstable>& sstables) {
+        _compacting.insert(sstables.begin(), sstables.end());
+    }
+
+    void unmark_compacting(const std::vector<sstables::shared_sstable>& sstables) {
+        for (auto& sstable : sstables) {
+            _compacting.erase(sstable);
+        }
+    }
+
+    template <typename T>
+    std::vector<sstables::shared_sstable> uncompacting(const T& sstables) const {
+        std::vector<sstables::shared_sstable> remaining;
+        for (auto& sstable : sstables) {
+            if (!_compacting.count(sstable)) {
+                remaining.push_back(sstable);
+            }
+        }
+        return remaining;
+    }
+
+    template <typename T>
+    bool any_compacting(const T& sstables) const {
+        return std::any_of(sstables.begin(), sstables.end(), [this] (const sstables::shared_sstable& sstable) {
+            return _compacting.count(sstable) > 0;
+        });
     }
-#endif
 
     /**
      * If we do something that makes many levels contain too little data (cleanup, change sstable size) we will "never"
@@ -567,6 +614,13 @@ class leveled_manifest {
         return overlapping(sstable->get_first_decorated_key(s)._token, sstable->get_last_decorated_key(s)._token, others);
     }
 
+    bool overlaps(const dht::token& start, const dht::token& end, const sstables::shared_sstable& sstable) {
+        const schema& s = *_schema;
+        auto range = ::range<dht::token>::make(start, end);
+        auto sstable_range = ::range<dht::token>::make(sstable->get_first_decorated_key(s)._token, sstable->get_last_decorated_key(s)._token);
+        return range.overlap(sstable_range, dht::token_comparator());
+    }
+
     /**
      * @return sstables from @param sstables that contain keys between @param start and @param end, inclusive.
      */
@@ -611,19 +665,21 @@ class leveled_manifest {
         final Set<SSTableReader> compacting = cfs.getDataTracker().getCompacting();
 #endif
         if (level == 0) {
-#if 0
-            Set<SSTableReader> compactingL0 = ImmutableSet.copyOf(Iterables.filter(getLevel(0), Predicates.in(compacting)));
-
-            RowPosition lastCompactingKey = null;
-            RowPosition firstCompactingKey = null;
-            for (SSTableReader candidate : compactingL0)
-            {
-                if (firstCompactingKey == null || candidate.first.compareTo(firstCompactingKey) < 0)
-                    firstCompactingKey = candidate.first;
-                if (lastCompactingKey == null || candidate.last.compareTo(lastCompactingKey) > 0)
-                    lastCompactingKey = candidate.last;
+            std::experimental::optional<dht::token> first_compacting_token;
+            std::experimental::optional<dht::token> last_compacting_token;
+            for (auto& candidate : get_level(0)) {
+                if (!_compacting.count(candidate)) {
+                    continue;
+                }
+                auto first = candidate->get_first_decorated_key(s)._token;
+                auto last = candidate->get_last_decorated_key(s)._token;
+                if (!first_compacting_token || first < *first_compacting_token) {
+                    first_compacting_token = std::move(first);
+                }
+                if (!last_compacting_token || last > *last_compacting_token) {
+                    last_compacting_token = std::move(last);
+                }
             }
-#endif
 
             // L0 is the dumping ground for new sstables which thus may overlap each other.
             //
@@ -655,18 +711,14 @@ class leveled_manifest {
                     overlappedL0.push_back(sstable);
                 }
 
-#if 0
-                if (!Sets.intersection(overlappedL0, compactingL0).isEmpty())
+                if (any_compacting(overlappedL0)) {
                     continue;
-#endif
+                }
 
                 for (auto& new_candidate : overlappedL0) {
-#if 0
-                    if (firstCompactingKey == null || lastCompactingKey == null || overlapping(firstCompactingKey.getToken(), lastCompactingKey.getToken(), Arrays.asList(newCandidate)).size() == 0)
-                        candidates.add(newCandidate);
-#else
-                    candidates.push_back(new_candidate);
-#endif
+                    if (!first_compacting_token || !overlaps(*first_compacting_token, *last_compacting_token, new_candidate)) {
+                        candidates.push_back(new_candidate);
+                    }
                     remaining.remove(new_candidate);
                 }
 
@@ -686,6 +738,9 @@ class leveled_manifest {
                 // if the overlapping ones are already busy in a compaction, leave it out.
                 // TODO try to find a set of L0 sstables that only overlaps with non-busy L1 sstables
                 auto l1overlapping = overlapping(candidates, get_level(1));
+                if (any_compacting(l1overlapping)) {
+                    return {};
+                }
                 for (auto candidate : l1overlapping) {
                     auto it = std::find(candidates.begin(), candidates.end(), candidate);
                     if (it != candidates.end()) {
@@ -731,14 +786,11 @@ class leveled_manifest {
 #if 0
             if (Iterables.any(candidates, suspectP))
                 continue;
-            if (Sets.intersection(candidates, compacting).isEmpty())
-                return candidates;
 #endif
-            if (candidates.size() < 2) {
-                return {};
-            } else {
-                return candidates;
+            if (candidates.size() < 2 || any_compacting(candidates)) {
+                continue;
             }
+            return candidates;
         }
 
         // all the sstables were suspect or overlapped with something suspect
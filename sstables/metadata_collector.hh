@@ -42,6 +42,7 @@
 #pragma once
 
 #include "types.hh"
+#include "schema.hh"
 #include "utils/murmur_hash.hh"
 #include "hyperloglog.hh"
 #include "db/commitlog/replay_position.hh"
@@ -194,8 +195,8 @@ class metadata_collector {
     static constexpr double NO_COMPRESSION_RATIO = -1.0;
 
     static hll::HyperLogLog hyperloglog(int p, int sp) {
-        // FIXME: hll::HyperLogLog doesn't support sparse format, so ignoring parameters by the time being.
-        return hll::HyperLogLog();
+        // FIXME: hll::HyperLogLog doesn't support sparse format, so ignoring sp by the time being.
+        return hll::HyperLogLog(p);
     }
 private:
     // EH of 150 can track a max value of 1697806495183, i.e., > 1.5PB
@@ -213,6 +214,12 @@ class metadata_collector {
     int _sstable_level = 0;
     std::vector<bytes> _min_column_names;
     std::vector<bytes> _max_column_names;
+    // Set once a partition tombstone is written, which may shadow rows in
+    // any clustering range, so that no bounds are recorded.
+    bool _unbounded_column_names = false;
+    // A range tombstone covers any value of the components following its
+    // prefix, so only those before them are bounded.
+    size_t _bounded_column_names = std::numeric_limits<size_t>::max();
     bool _has_legacy_counter_shards = false;
 
     /**
@@ -298,6 +305,35 @@ class metadata_collector {
         }
     }
 
+    // Records the clustering components of a row or range tombstone in the
+    // bounds of each component, compared by its type, which reads of
+    // clustering slices check to skip the sstable.
+    template <typename Prefix>
+    void update_min_max_components(const schema& s, const Prefix& prefix) {
+        auto& types = s.clustering_key_prefix_type()->types();
+        size_t i = 0;
+        for (auto it = prefix.begin(s); it != prefix.end(s); ++it, ++i) {
+            bytes_view component = *it;
+            if (i == _min_column_names.size()) {
+                _min_column_names.emplace_back(component.begin(), component.end());
+                _max_column_names.emplace_back(component.begin(), component.end());
+                continue;
+            }
+            if (types[i]->compare(component, _min_column_names[i]) < 0) {
+                _min_column_names[i] = bytes(component.begin(), component.end());
+            } else if (types[i]->compare(component, _max_column_names[i]) > 0) {
+                _max_column_names[i] = bytes(component.begin(), component.end());
+            }
+        }
+        if (i < s.clustering_key_size()) {
+            _bounded_column_names = std::min(_bounded_column_names, i);
+        }
+    }
+
+    void set_unbounded_column_names() {
+        _unbounded_column_names = true;
+    }
+
     void update_has_legacy_counter_shards(bool has_legacy_counter_shards) {
         _has_legacy_counter_shards = _has_legacy_counter_shards || has_legacy_counter_shards;
     }
@@ -333,8 +369,14 @@ class metadata_collector {
         m.estimated_tombstone_drop_time = std::move(_estimated_tombstone_drop_time);
         m.sstable_level = _sstable_level;
         m.repaired_at = _repaired_at;
-        convert(m.min_column_names, std::move(_min_column_names));
-        convert(m.max_column_names, std::move(_max_column_names));
+        if (!_unbounded_column_names) {
+            if (_min_column_names.size() > _bounded_column_names) {
+                _min_column_names.resize(_bounded_column_names);
+                _max_column_names.resize(_bounded_column_names);
+            }
+            convert(m.min_column_names, std::move(_min_column_names));
+            convert(m.max_column_names, std::move(_max_column_names));
+        }
         m.has_legacy_counter_shards = _has_legacy_counter_shards;
     }
 };
@@ -18,6 +18,8 @@
  * You should have received a copy of the GNU General Public License
  * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <deque>
+
 #include "mutation.hh"
 #include "sstables.hh"
 #include "types.hh"
@@ -26,6 +28,7 @@
 #include "keys.hh"
 #include "core/do_with.hh"
 #include "unimplemented.hh"
+#include "key_cache.hh"
 
 #include "dht/i_partitioner.hh"
 
@@ -52,26 +55,40 @@ namespace sstables {
  * This code should work in all kinds of vectors in whose's elements is possible to aquire
  * a key view via get_key().
  */
+template <typename Entry>
+static int tri_compare_entry(const key& sk, const dht::token& token, uint64_t prefix, const Entry& e) {
+    // The token comparison should yield the right result most of the time.
+    // So we avoid expensive copying operations that happens at key
+    // creation by keeping only a key view, and then manually carrying out
+    // both parts of the comparison ourselves.
+    key_view e_key = e.get_key();
+    auto e_token = dht::global_partitioner().get_token(e_key);
+
+    if (token == e_token) {
+        return sk.tri_compare(e_key);
+    } else {
+        return token < e_token ? -1 : 1;
+    }
+}
+
+// Summary entries carry the prefixes of their tokens, so that most of them
+// are told apart without hashing their keys.
+static int tri_compare_entry(const key& sk, const dht::token& token, uint64_t prefix, const summary_entry& e) {
+    if (prefix != e.token_prefix) {
+        return prefix < e.token_prefix ? -1 : 1;
+    }
+    return tri_compare_entry<summary_entry>(sk, token, prefix, e);
+}
+
 template <typename T>
 int sstable::binary_search(const T& entries, const key& sk, const dht::token& token) {
     int low = 0, mid = entries.size(), high = mid - 1, result = -1;
 
-    auto& partitioner = dht::global_partitioner();
+    auto prefix = dht::token_prefix(token);
 
     while (low <= high) {
-        // The token comparison should yield the right result most of the time.
-        // So we avoid expensive copying operations that happens at key
-        // creation by keeping only a key view, and then manually carrying out
-        // both parts of the comparison ourselves.
         mid = low + ((high - low) >> 1);
-        key_view mid_key = entries[mid].get_key();
-        auto mid_token = partitioner.get_token(mid_key);
-
-        if (token == mid_token) {
-            result = sk.tri_compare(mid_key);
-        } else {
-            result = token < mid_token ? -1 : 1;
-        }
+        result = tri_compare_entry(sk, token, prefix, entries[mid]);
 
         if (result > 0) {
             low = mid + 1;
@@ -87,7 +104,7 @@ int sstable::binary_search(const T& entries, const key& sk, const dht::token& to
 
 // Force generation, so we make it available outside this compilation unit without moving that
 // much code to .hh
-template int sstable::binary_search<>(const std::vector<summary_entry>& entries, const key& sk);
+template int sstable::binary_search<>(const summary_entries& entries, const key& sk);
 template int sstable::binary_search<>(const std::vector<index_entry>& entries, const key& sk);
 
 static inline bytes pop_back(std::vector<bytes>& vec) {
@@ -100,6 +117,17 @@ class mp_row_consumer : public row_consumer {
     schema_ptr _schema;
     key_view _key;
     std::function<future<> (mutation&& m)> _mutation_to_subscription;
+    // When not 0, partitions are handed out in pieces of about that many
+    // bytes of cells, cut between clustered rows.
+    size_t _max_piece_size = 0;
+    size_t _piece_size = 0;
+    bool _piece_full = false;
+    // The partition tombstone, and the last range tombstone read with the
+    // prefix it deletes. Cells they cover which follow them are skipped
+    // rather than materialized, only to be dropped by the query.
+    tombstone _partition_tombstone;
+    tombstone _range_tombstone;
+    std::vector<bytes> _range_tombstone_prefix;
 
     struct column {
         bool is_static;
@@ -248,8 +276,38 @@ class mp_row_consumer : public row_consumer {
             _pending_collection = {};
         }
     }
+    bool is_shadowed(const column& col, api::timestamp_type timestamp) const {
+        if (timestamp <= _partition_tombstone.timestamp) {
+            return true;
+        }
+        return !col.is_static && timestamp <= _range_tombstone.timestamp
+                && col.clustering.size() >= _range_tombstone_prefix.size()
+                && std::equal(_range_tombstone_prefix.begin(), _range_tombstone_prefix.end(), col.clustering.begin());
+    }
+    // Called with each cell of a clustered row, before it goes into mut. If
+    // the piece is full and the cell starts another row, hands the piece out
+    // and goes on with a new one.
+    void maybe_start_piece(const exploded_clustering_prefix& clustering_prefix, size_t size) {
+        if (!_max_piece_size) {
+            return;
+        }
+        auto& rows = mut->partition().clustered_rows();
+        if (_piece_size >= _max_piece_size && !rows.empty() && clustering_prefix.is_full(*_schema)) {
+            auto ck = clustering_key::from_clustering_prefix(*_schema, clustering_prefix);
+            if (!ck.equal(*_schema, std::prev(rows.end())->key())) {
+                flush_pending_collection(*_schema, *mut);
+                full_piece = std::move(mut);
+                mut = mutation(full_piece->decorated_key(), _schema);
+                _piece_size = 0;
+                _piece_full = true;
+            }
+        }
+        _piece_size += size;
+    }
 public:
     mutation_opt mut;
+    // In pieces mode, the piece handed out before the end of its partition.
+    mutation_opt full_piece;
 
     mp_row_consumer(const key& key, const schema_ptr _schema)
             : _schema(_schema)
@@ -266,6 +324,11 @@ class mp_row_consumer : public row_consumer {
             , _mutation_to_subscription(sub_fn)
     { }
 
+    mp_row_consumer(const schema_ptr _schema, size_t max_piece_size)
+            : _schema(_schema)
+            , _max_piece_size(max_piece_size)
+    { }
+
     virtual void consume_row_start(sstables::key_view key, sstables::deletion_time deltime) override {
         if (_key.empty()) {
             mut = mutation(partition_key::from_exploded(*_schema, key.explode(*_schema)), _schema);
@@ -273,9 +336,14 @@ class mp_row_consumer : public row_consumer {
             throw malformed_sstable_exception(sprint("Key mismatch. Got %s while processing %s", to_hex(bytes_view(key)).c_str(), to_hex(bytes_view(_key)).c_str()));
         }
 
+        _partition_tombstone = tombstone();
+        _range_tombstone = tombstone();
+        _range_tombstone_prefix.clear();
         if (!deltime.live()) {
-            mut->partition().apply(tombstone(deltime));
+            _partition_tombstone = tombstone(deltime);
+            mut->partition().apply(_partition_tombstone);
         }
+        _piece_size = 0;
     }
 
     atomic_cell make_atomic_cell(uint64_t timestamp, bytes_view value, uint32_t ttl, uint32_t expiration) {
@@ -289,10 +357,17 @@ class mp_row_consumer : public row_consumer {
 
     virtual void consume_cell(bytes_view col_name, bytes_view value, int64_t timestamp, int32_t ttl, int32_t expiration) override {
         struct column col(*_schema, col_name);
+        if (is_shadowed(col, timestamp)) {
+            return;
+        }
 
         auto ac = make_atomic_cell(timestamp, value, ttl, expiration);
         auto clustering_prefix = exploded_clustering_prefix(std::move(col.clustering));
 
+        if (!col.is_static) {
+            maybe_start_piece(clustering_prefix, col_name.size() + value.size());
+        }
+
         if (col.collection_extra_data.size()) {
             update_pending_collection(clustering_prefix, col.cdef, std::move(col.collection_extra_data), std::move(ac));
             return;
@@ -322,9 +397,15 @@ class mp_row_consumer : public row_consumer {
     }
 
     void consume_deleted_cell(column &col, int64_t timestamp, gc_clock::time_point ttl) {
+        if (is_shadowed(col, timestamp)) {
+            return;
+        }
         auto ac = atomic_cell::make_dead(timestamp, ttl);
 
         auto clustering_prefix = exploded_clustering_prefix(std::move(col.clustering));
+        if (!col.is_static) {
+            maybe_start_piece(clustering_prefix, col.col_name.size());
+        }
         if (col.collection_extra_data.size()) {
             update_pending_collection(clustering_prefix, col.cdef, std::move(col.collection_extra_data), std::move(ac));
         } else if (col.is_static) {
@@ -338,6 +419,14 @@ class mp_row_consumer : public row_consumer {
             mut->set_cell(clustering_prefix, *(col.cdef), atomic_cell_or_collection(std::move(ac)));
         }
     }
+    virtual proceed consume_atom_end() override {
+        if (_piece_full) {
+            _piece_full = false;
+            return proceed::no;
+        }
+        return proceed::yes;
+    }
+
     virtual proceed consume_row_end() override {
         if (mut) {
             flush_pending_collection(*_schema, *mut);
@@ -378,7 +467,9 @@ class mp_row_consumer : public row_consumer {
         // Still, it is enough to check if we're dealing with a collection, since any other tombstone
         // won't have a full clustering prefix (otherwise it isn't a range)
         if (start.size() <= _schema->clustering_key_size()) {
-            mut->partition().apply_delete(*_schema, exploded_clustering_prefix(std::move(start)), tombstone(deltime));
+            _range_tombstone = tombstone(deltime);
+            _range_tombstone_prefix = start;
+            mut->partition().apply_delete(*_schema, exploded_clustering_prefix(std::move(start)), _range_tombstone);
         } else {
             auto&& column = pop_back(start);
 
@@ -398,12 +489,22 @@ static int adjust_binary_search_index(int idx) {
     return idx;
 }
 
-future<uint64_t> sstables::sstable::data_end_position(uint64_t summary_idx, uint64_t index_idx, const index_list& il) {
-    if (uint64_t(index_idx + 1) < il.size()) {
-        return make_ready_future<uint64_t>(il[index_idx + 1].position());
+template <typename Func>
+future<std::result_of_t<Func(const index_page_view&)>>
+sstables::sstable::with_index_page(uint64_t summary_idx, Func&& func) {
+    using result_type = std::result_of_t<Func(const index_page_view&)>;
+    auto cached = global_index_page_cache().with_page(_cache_id, summary_idx, func);
+    if (cached) {
+        return make_ready_future<result_type>(std::move(*cached));
     }
-
-    return data_end_position(summary_idx);
+    auto start = std::chrono::steady_clock::now();
+    return read_indexes(summary_idx).then([this, summary_idx, start, func = std::forward<Func>(func)] (index_list il) mutable {
+        auto page = index_page_view::serialize(il);
+        auto& cache = global_index_page_cache();
+        cache.on_parse(std::chrono::steady_clock::now() - start);
+        cache.insert(_cache_id, summary_idx, page);
+        return func(index_page_view(page));
+    });
 }
 
 future<uint64_t> sstables::sstable::data_end_position(uint64_t summary_idx) {
@@ -414,44 +515,220 @@ future<uint64_t> sstables::sstable::data_end_position(uint64_t summary_idx) {
         return make_ready_future<uint64_t>(data_size());
     }
 
-    return read_indexes(summary_idx + 1).then([] (auto next_il) {
-        return next_il.front().position();
+    return with_index_page(summary_idx + 1, [] (const index_page_view& next_page) {
+        return next_page.front().position();
+    });
+}
+
+static future<mutation_opt> read_partition_at(sstable& sst, schema_ptr schema, const sstables::key& key, partition_position pos) {
+    return do_with(mp_row_consumer(key, schema), [&sst, pos] (auto& c) {
+        return sst.data_consume_rows_at_once(c, pos.start, pos.end).then([&c] {
+            return make_ready_future<mutation_opt>(std::move(c.mut));
+        });
+    });
+}
+
+// A block of the promoted index of a partition, see promoted_index_builder.
+struct promoted_index_block {
+    bytes_view first_name;
+    bytes_view last_name;
+    // Relative to the start of the partition.
+    uint64_t offset;
+    uint64_t width;
+};
+
+static bytes_view read_block_name(bytes_view& v) {
+    auto len = read_simple<uint16_t>(v);
+    if (v.size() < len) {
+        throw malformed_sstable_exception("promoted index block name past the end of the promoted index");
+    }
+    auto name = bytes_view(v.data(), len);
+    v.remove_prefix(len);
+    return name;
+}
+
+static std::vector<promoted_index_block> parse_promoted_index(bytes_view v) {
+    // Skip the deletion time of the partition.
+    read_simple<int32_t>(v);
+    read_simple<int64_t>(v);
+    auto count = read_simple<uint32_t>(v);
+    std::vector<promoted_index_block> blocks;
+    blocks.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        promoted_index_block b;
+        b.first_name = read_block_name(v);
+        b.last_name = read_block_name(v);
+        b.offset = read_simple<uint64_t>(v);
+        b.width = read_simple<uint64_t>(v);
+        blocks.push_back(b);
+    }
+    return blocks;
+}
+
+// The clustering prefix of a column name of a promoted index block, leaving
+// out the name of the cell it may end with.
+static clustering_key_prefix block_name_prefix(const schema& s, bytes_view name) {
+    std::vector<bytes> components;
+    if (s.is_compound()) {
+        components = composite_view(name).explode();
+    } else {
+        components.emplace_back(to_bytes(name));
+    }
+    components.resize(std::min(components.size(), s.clustering_key_size()));
+    return clustering_key_prefix::from_exploded(s, components);
+}
+
+// Prefix equality ordering, under which a prefix is equal to the keys it
+// prefixes, so that blocks are kept whenever they may hold a row in range.
+static int prefix_tri_compare(const schema& s, const clustering_key_prefix& k1, const clustering_key_prefix& k2) {
+    auto& t = s.clustering_key_prefix_type();
+    return prefix_equality_tri_compare(t->types().begin(),
+        t->begin(k1), t->end(k1), t->begin(k2), t->end(k2), tri_compare);
+}
+
+static bool block_may_overlap(const schema& s, const clustering_key_prefix& first, const clustering_key_prefix& last,
+        const query::clustering_range& r) {
+    if (r.start() && prefix_tri_compare(s, last, r.start()->value()) < 0) {
+        return false;
+    }
+    if (r.end() && prefix_tri_compare(s, r.end()->value(), first) < 0) {
+        return false;
+    }
+    return true;
+}
+
+// The byte ranges of the data file to read for the rows of a partition in
+// the clustering ranges: those of the blocks which may hold some of them,
+// merged when adjacent. The first block, which the key and deletion time
+// of the partition precede and which holds its static row and the range
+// tombstones written ahead of its rows, is always read.
+static std::vector<std::pair<uint64_t, uint64_t>> blocks_to_read(const schema& s, uint64_t partition_start,
+        const std::vector<promoted_index_block>& blocks, const std::vector<query::clustering_range>& ranges) {
+    std::vector<std::pair<uint64_t, uint64_t>> pieces;
+    if (blocks.empty()) {
+        return pieces;
+    }
+    pieces.emplace_back(partition_start, partition_start + blocks[0].offset + blocks[0].width);
+    for (size_t i = 1; i < blocks.size(); ++i) {
+        auto& b = blocks[i];
+        auto first = block_name_prefix(s, b.first_name);
+        auto last = block_name_prefix(s, b.last_name);
+        auto needed = std::any_of(ranges.begin(), ranges.end(), [&] (const query::clustering_range& r) {
+            return block_may_overlap(s, first, last, r);
+        });
+        if (!needed) {
+            continue;
+        }
+        auto start = partition_start + b.offset;
+        auto end = start + b.width;
+        if (pieces.back().second == start) {
+            pieces.back().second = end;
+        } else {
+            pieces.emplace_back(start, end);
+        }
+    }
+    return pieces;
+}
+
+static future<mutation_opt> read_partition_blocks(sstable& sst, schema_ptr schema, const sstables::key& key,
+        partition_position pos, bytes_view promoted_index, const std::vector<query::clustering_range>& ranges) {
+    auto pieces = blocks_to_read(*schema, pos.start, parse_promoted_index(promoted_index), ranges);
+    if (pieces.empty()) {
+        return read_partition_at(sst, std::move(schema), key, pos);
+    }
+    return do_with(mp_row_consumer(key, schema), [&sst, pieces = std::move(pieces)] (auto& c) mutable {
+        return sst.data_consume_partition_pieces(c, std::move(pieces)).then([&c] {
+            return make_ready_future<mutation_opt>(std::move(c.mut));
+        });
     });
 }
 
 future<mutation_opt>
 sstables::sstable::read_row(schema_ptr schema, const sstables::key& key) {
+    static thread_local const std::vector<query::clustering_range> all_rows = {
+        query::clustering_range::make_open_ended_both_sides()
+    };
+    return read_row(std::move(schema), key, all_rows);
+}
+
+future<mutation_opt>
+sstables::sstable::read_row(schema_ptr schema, const sstables::key& key, const std::vector<query::clustering_range>& ranges) {
 
     assert(schema);
 
     if (!filter_has_key(key)) {
+        _filter_tracker.add_true_negative();
         return make_ready_future<mutation_opt>();
     }
 
-    auto& partitioner = dht::global_partitioner();
-    auto token = partitioner.get_token(key_view(key));
-
-    auto& summary = _summary;
-    auto summary_idx = adjust_binary_search_index(binary_search(summary.entries, key, token));
-    if (summary_idx < 0) {
-        _filter_tracker.add_false_positive();
-        return make_ready_future<mutation_opt>();
+    bool sliced = schema->clustering_key_size() > 0
+        && !(ranges.size() == 1 && !ranges[0].start() && !ranges[0].end());
+
+    bool use_key_cache = schema->caching_options().key_cache_enabled();
+    if (use_key_cache) {
+        auto pos = global_key_cache().find(_cache_id, bytes_view(key));
+        // A slice of a partition with a promoted index needs the promoted
+        // index from Index.db.
+        if (pos && !(sliced && pos->has_promoted_index)) {
+            _filter_tracker.add_true_positive();
+            return read_partition_at(*this, schema, key, *pos);
+        }
     }
 
-    return read_indexes(summary_idx).then([this, schema, &key, token, summary_idx] (auto index_list) {
-        auto index_idx = this->binary_search(index_list, key, token);
-        if (index_idx < 0) {
+    return with_summary([this, schema, &key, &ranges, use_key_cache, sliced] {
+        auto& partitioner = dht::global_partitioner();
+        auto token = partitioner.get_token(key_view(key));
+
+        auto& summary = _summary;
+        auto summary_idx = adjust_binary_search_index(binary_search(summary.entries, key, token));
+        if (summary_idx < 0) {
             _filter_tracker.add_false_positive();
             return make_ready_future<mutation_opt>();
         }
-        _filter_tracker.add_true_positive();
 
-        auto position = index_list[index_idx].position();
-        return this->data_end_position(summary_idx, index_idx, index_list).then([&key, schema, this, position] (uint64_t end) {
-            return do_with(mp_row_consumer(key, schema), [this, position, end] (auto& c) {
-                return this->data_consume_rows_at_once(c, position, end).then([&c] {
-                    return make_ready_future<mutation_opt>(std::move(c.mut));
-                });
+        struct index_lookup {
+            bool found = false;
+            uint64_t position = 0;
+            // Unknown if the partition is the last one of its index page.
+            std::experimental::optional<uint64_t> end;
+            bool has_promoted_index = false;
+            // Copied only for reads of a slice.
+            bytes promoted_index;
+        };
+        return with_index_page(summary_idx, [this, &key, token, sliced] (const index_page_view& page) {
+            index_lookup l;
+            auto index_idx = this->binary_search(page, key, token);
+            if (index_idx >= 0) {
+                l.found = true;
+                l.position = page[index_idx].position();
+                if (size_t(index_idx + 1) < page.size()) {
+                    l.end = page[index_idx + 1].position();
+                }
+                auto promoted_index = page[index_idx].promoted_index();
+                l.has_promoted_index = !promoted_index.empty();
+                if (sliced) {
+                    l.promoted_index = to_bytes(promoted_index);
+                }
+            }
+            return l;
+        }).then([this, schema, &key, &ranges, summary_idx, use_key_cache, sliced] (index_lookup l) {
+            if (!l.found) {
+                _filter_tracker.add_false_positive();
+                return make_ready_future<mutation_opt>();
+            }
+            _filter_tracker.add_true_positive();
+
+            auto position = l.position;
+            auto end = l.end ? make_ready_future<uint64_t>(*l.end) : this->data_end_position(summary_idx);
+            return end.then([&key, &ranges, schema, this, position, use_key_cache, sliced, l = std::move(l)] (uint64_t end) {
+                partition_position pos{position, end, l.has_promoted_index};
+                if (use_key_cache) {
+                    global_key_cache().insert(_cache_id, bytes_view(key), pos);
+                }
+                if (sliced && pos.has_promoted_index) {
+                    return read_partition_blocks(*this, schema, key, pos, l.promoted_index, ranges);
+                }
+                return read_partition_at(*this, schema, key, pos);
             });
         });
     });
@@ -527,6 +804,14 @@ class index_comparator {
 public:
     index_comparator(const schema& s) : _s(s) {}
 
+    int tri_cmp(const summary_entry& e, const dht::ring_position& pos) const {
+        auto prefix = dht::token_prefix(pos.token());
+        if (e.token_prefix != prefix) {
+            return e.token_prefix < prefix ? -1 : 1;
+        }
+        return tri_cmp(e.get_key(), pos);
+    }
+
     int tri_cmp(key_view k2, const dht::ring_position& pos) const {
         auto k2_token = dht::global_partitioner().get_token(k2);
 
@@ -542,7 +827,7 @@ class index_comparator {
     }
 
     bool operator()(const summary_entry& e, const dht::ring_position& rp) const {
-        return tri_cmp(e.get_key(), rp) < 0;
+        return tri_cmp(e, rp) < 0;
     }
 
     bool operator()(const index_entry& e, const dht::ring_position& rp) const {
@@ -550,49 +835,94 @@ class index_comparator {
     }
 
     bool operator()(const dht::ring_position& rp, const summary_entry& e) const {
-        return tri_cmp(e.get_key(), rp) > 0;
+        return tri_cmp(e, rp) > 0;
     }
 
     bool operator()(const dht::ring_position& rp, const index_entry& e) const {
         return tri_cmp(e.get_key(), rp) > 0;
     }
-};
 
-future<uint64_t> sstable::lower_bound(schema_ptr s, const dht::ring_position& pos) {
-    uint64_t summary_idx = std::distance(std::begin(_summary.entries),
-        std::lower_bound(_summary.entries.begin(), _summary.entries.end(), pos, index_comparator(*s)));
+    bool operator()(const index_page_view::entry& e, const dht::ring_position& rp) const {
+        return tri_cmp(e.get_key(), rp) < 0;
+    }
 
-    if (summary_idx == 0) {
-        return make_ready_future<uint64_t>(0);
+    bool operator()(const dht::ring_position& rp, const index_page_view::entry& e) const {
+        return tri_cmp(e.get_key(), rp) > 0;
     }
+};
 
-    --summary_idx;
+// Returns the index of the first of the entries, of a summary or an index
+// page, for which pred is false, assuming they are partitioned with respect
+// to pred.
+template <typename Entries, typename Pred>
+static size_t index_partition_point(const Entries& entries, Pred&& pred) {
+    size_t low = 0, high = entries.size();
+    while (low < high) {
+        auto mid = low + ((high - low) >> 1);
+        if (pred(entries[mid])) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
 
-    return read_indexes(summary_idx).then([this, s, pos, summary_idx] (index_list il) {
-        auto i = std::lower_bound(il.begin(), il.end(), pos, index_comparator(*s));
-        if (i == il.end()) {
-            return this->data_end_position(summary_idx);
+future<uint64_t> sstable::lower_bound(schema_ptr s, const dht::ring_position& pos) {
+    // Copied, as the lookup may wait for a resampling of the summary.
+    return with_summary([this, s, pos] {
+        index_comparator cmp(*s);
+        uint64_t summary_idx = index_partition_point(_summary.entries, [&] (const summary_entry& e) {
+            return cmp(e, pos);
+        });
+
+        if (summary_idx == 0) {
+            return make_ready_future<uint64_t>(0);
         }
-        return make_ready_future<uint64_t>(i->position());
+
+        --summary_idx;
+
+        return with_index_page(summary_idx, [s, pos] (const index_page_view& page) {
+            index_comparator cmp(*s);
+            auto i = index_partition_point(page, [&] (const index_page_view::entry& e) {
+                return cmp(e, pos);
+            });
+            return i == page.size() ? std::experimental::optional<uint64_t>() : std::experimental::optional<uint64_t>(page[i].position());
+        }).then([this, summary_idx] (std::experimental::optional<uint64_t> position) {
+            if (!position) {
+                return this->data_end_position(summary_idx);
+            }
+            return make_ready_future<uint64_t>(*position);
+        });
     });
 }
 
 future<uint64_t> sstable::upper_bound(schema_ptr s, const dht::ring_position& pos) {
-    uint64_t summary_idx = std::distance(std::begin(_summary.entries),
-        std::upper_bound(_summary.entries.begin(), _summary.entries.end(), pos, index_comparator(*s)));
+    // Copied, as the lookup may wait for a resampling of the summary.
+    return with_summary([this, s, pos] {
+        index_comparator cmp(*s);
+        uint64_t summary_idx = index_partition_point(_summary.entries, [&] (const summary_entry& e) {
+            return !cmp(pos, e);
+        });
 
-    if (summary_idx == 0) {
-        return make_ready_future<uint64_t>(0);
-    }
+        if (summary_idx == 0) {
+            return make_ready_future<uint64_t>(0);
+        }
 
-    --summary_idx;
+        --summary_idx;
 
-    return read_indexes(summary_idx).then([this, s, pos, summary_idx] (index_list il) {
-        auto i = std::upper_bound(il.begin(), il.end(), pos, index_comparator(*s));
-        if (i == il.end()) {
-            return this->data_end_position(summary_idx);
-        }
-        return make_ready_future<uint64_t>(i->position());
+        return with_index_page(summary_idx, [s, pos] (const index_page_view& page) {
+            index_comparator cmp(*s);
+            auto i = index_partition_point(page, [&] (const index_page_view::entry& e) {
+                return !cmp(pos, e);
+            });
+            return i == page.size() ? std::experimental::optional<uint64_t>() : std::experimental::optional<uint64_t>(page[i].position());
+        }).then([this, summary_idx] (std::experimental::optional<uint64_t> position) {
+            if (!position) {
+                return this->data_end_position(summary_idx);
+            }
+            return make_ready_future<uint64_t>(*position);
+        });
     });
 }
 
@@ -607,12 +937,8 @@ mutation_reader sstable::read_range_rows(schema_ptr schema,
             dht::ring_position::ending_at(max_token)));
 }
 
-mutation_reader
-sstable::read_range_rows(schema_ptr schema, const query::partition_range& range) {
-    if (query::is_wrap_around(range, *schema)) {
-        fail(unimplemented::cause::WRAP_AROUND);
-    }
-
+std::pair<future<uint64_t>, future<uint64_t>>
+sstable::data_positions(schema_ptr schema, const query::partition_range& range) {
     future<uint64_t> start = range.start()
         ? (range.start()->is_inclusive()
                  ? lower_bound(schema, range.start()->value())
@@ -625,8 +951,410 @@ sstable::read_range_rows(schema_ptr schema, const query::partition_range& range)
                  : lower_bound(schema, range.end()->value()))
         : make_ready_future<uint64_t>(data_size());
 
+    return std::make_pair(std::move(start), std::move(end));
+}
+
+mutation_reader
+sstable::read_range_rows(schema_ptr schema, const query::partition_range& range) {
+    if (query::is_wrap_around(range, *schema)) {
+        fail(unimplemented::cause::WRAP_AROUND);
+    }
+
+    auto positions = data_positions(schema, range);
     return std::make_unique<mutation_reader::impl>(
-        *this, std::move(schema), std::move(start), std::move(end));
+        *this, std::move(schema), std::move(positions.first), std::move(positions.second));
+}
+
+// Hands out the keys of the entries of the index file whose partitions
+// start within a byte range of the data file, a page of the index at a time.
+class sstable_key_reader final : public key_reader::impl {
+    sstable& _sst;
+    schema_ptr _schema;
+    query::partition_range _range;
+    bool _maybe_dead;
+    std::experimental::optional<future<uint64_t>> _start_future;
+    std::experimental::optional<future<uint64_t>> _end_future;
+    // Of the next entry to hand out, at least.
+    uint64_t _start = 0;
+    uint64_t _end = 0;
+    std::experimental::optional<dht::decorated_key> _last;
+    std::deque<dht::decorated_key> _keys;
+    bool _done = false;
+private:
+    future<> get_positions() {
+        if (!_start_future) {
+            return make_ready_future<>();
+        }
+        return _start_future->then([this] (uint64_t start) {
+            return _end_future->then([this, start] (uint64_t end) {
+                _start = start;
+                _end = end;
+                _start_future = {};
+                _end_future = {};
+            });
+        });
+    }
+
+    // Whether the page held the entries up to the end of the range.
+    bool read_page(const index_page_view& page) {
+        for (size_t i = 0; i < page.size(); ++i) {
+            auto e = page[i];
+            auto position = e.position();
+            if (position >= _end) {
+                return true;
+            }
+            if (position < _start) {
+                continue;
+            }
+            _start = position + 1;
+            auto key = e.get_key().to_partition_key(*_schema);
+            auto dk = dht::global_partitioner().decorate_key(*_schema, std::move(key));
+            if (_sst.is_shared() && dht::shard_of(dk.token()) != engine().cpu_id()) {
+                continue;
+            }
+            _keys.emplace_back(std::move(dk));
+        }
+        return false;
+    }
+
+    // Reads the page holding the entry following the last one handed out, or
+    // the page after it when that was the last of its page. Found anew each
+    // time, as the summary may be resampled in between.
+    future<> fill() {
+        return _sst.with_summary([this] {
+            index_comparator cmp(*_schema);
+            uint64_t summary_idx = 0;
+            if (_last) {
+                auto pos = dht::ring_position(*_last);
+                summary_idx = index_partition_point(_sst._summary.entries, [&] (const summary_entry& e) {
+                    return !cmp(pos, e);
+                });
+            } else if (_range.start()) {
+                auto& pos = _range.start()->value();
+                summary_idx = index_partition_point(_sst._summary.entries, [&] (const summary_entry& e) {
+                    return cmp(e, pos);
+                });
+            }
+            if (summary_idx) {
+                --summary_idx;
+            }
+            return do_with(summary_idx, [this] (uint64_t& summary_idx) {
+                return repeat([this, &summary_idx] {
+                    if (summary_idx >= _sst._summary.entries.size()) {
+                        _done = true;
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    return _sst.with_index_page(summary_idx, [this] (const index_page_view& page) {
+                        return read_page(page);
+                    }).then([this, &summary_idx] (bool at_end) {
+                        ++summary_idx;
+                        _done = at_end;
+                        return stop_iteration(_done || !_keys.empty());
+                    });
+                });
+            });
+        });
+    }
+public:
+    sstable_key_reader(sstable& sst, schema_ptr s, const query::partition_range& range)
+        : _sst(sst)
+        , _schema(std::move(s))
+        , _range(range)
+        , _maybe_dead(sst.may_hold_dead_data())
+    {
+        auto positions = _sst.data_positions(_schema, _range);
+        _start_future = std::move(positions.first);
+        _end_future = std::move(positions.second);
+    }
+
+    virtual future<partition_key_entry_opt> operator()() override {
+        return get_positions().then([this] {
+            if (!_keys.empty() || _done) {
+                return make_ready_future<>();
+            }
+            return fill();
+        }).then([this] {
+            if (_keys.empty()) {
+                return partition_key_entry_opt();
+            }
+            auto dk = std::move(_keys.front());
+            _keys.pop_front();
+            _last = dk;
+            return partition_key_entry_opt(partition_key_entry{std::move(dk), _maybe_dead});
+        });
+    }
+};
+
+key_reader sstable::read_range_keys(schema_ptr schema, const query::partition_range& range) {
+    if (query::is_wrap_around(range, *schema)) {
+        fail(unimplemented::cause::WRAP_AROUND);
+    }
+    return make_key_reader<sstable_key_reader>(*this, std::move(schema), range);
+}
+
+// Hands out the partitions of a byte range of the data file in pieces.
+class sstable_partition_source final : public partition_source {
+    mp_row_consumer _consumer;
+    std::experimental::optional<data_consume_context> _context;
+    std::experimental::optional<future<data_consume_context>> _context_future;
+    // Whether the last piece handed out leaves more of its partition.
+    bool _in_partition = false;
+private:
+    future<> get_context() {
+        if (_context) {
+            return make_ready_future<>();
+        }
+        return _context_future->then([this] (data_consume_context context) {
+            _context = std::move(context);
+            _context_future = {};
+        });
+    }
+
+    future<mutation_opt> read_piece() {
+        return get_context().then([this] {
+            return _context->read();
+        }).then([this] {
+            mutation_opt piece;
+            if (_consumer.full_piece) {
+                piece = std::move(_consumer.full_piece);
+                _consumer.full_piece = {};
+                _in_partition = true;
+            } else {
+                piece = std::move(_consumer.mut);
+                _consumer.mut = {};
+                _in_partition = false;
+            }
+            return piece;
+        });
+    }
+public:
+    sstable_partition_source(sstable& sst, schema_ptr schema, future<uint64_t> start, future<uint64_t> end,
+            size_t max_piece_size, const io_priority_class& pc)
+        : _consumer(std::move(schema), max_piece_size)
+        , _context_future(start.then([this, &sst, end = std::move(end), pc] (uint64_t start) mutable {
+              return end.then([this, &sst, start, pc] (uint64_t end) {
+                  return sst.data_consume_rows(_consumer, start, end, default_read_ahead_options(), pc);
+              });
+          }))
+    { }
+
+    // _consumer is referenced by the context.
+    sstable_partition_source(sstable_partition_source&&) = delete;
+
+    virtual future<mutation_opt> next_partition() override {
+        // Skips what the caller left of the current partition.
+        return do_until([this] { return !_in_partition; }, [this] {
+            return read_piece().discard_result();
+        }).then([this] {
+            return read_piece();
+        });
+    }
+
+    virtual future<mutation_opt> next_rows() override {
+        if (!_in_partition) {
+            return make_ready_future<mutation_opt>();
+        }
+        return read_piece();
+    }
+
+    virtual uint64_t bytes_read() const override {
+        return _context ? _context->bytes_consumed() : 0;
+    }
+};
+
+std::unique_ptr<partition_source> sstable::read_rows_in_pieces(schema_ptr schema, size_t max_piece_size,
+        const io_priority_class& pc) {
+    return std::make_unique<sstable_partition_source>(*this, std::move(schema),
+            make_ready_future<uint64_t>(0), make_ready_future<uint64_t>(data_size()), max_piece_size, pc);
+}
+
+std::unique_ptr<partition_source> sstable::read_range_rows_in_pieces(schema_ptr schema,
+        const query::partition_range& range, size_t max_piece_size, const io_priority_class& pc) {
+    if (query::is_wrap_around(range, *schema)) {
+        fail(unimplemented::cause::WRAP_AROUND);
+    }
+
+    auto positions = data_positions(schema, range);
+    return std::make_unique<sstable_partition_source>(*this, std::move(schema),
+            std::move(positions.first), std::move(positions.second), max_piece_size, pc);
+}
+
+class combined_partition_source final : public partition_source {
+    struct input {
+        std::unique_ptr<partition_source> source;
+        // The first piece of its next partition, when it isn't the current one.
+        mutation_opt next;
+        bool exhausted = false;
+        // Whether it has rows of the current partition left, either in piece
+        // or still to come from the source.
+        bool in_current = false;
+        bool rows_done = true;
+        mutation_opt piece;
+
+        explicit input(std::unique_ptr<partition_source> s) : source(std::move(s)) {}
+    };
+    schema_ptr _schema;
+    std::vector<input> _inputs;
+    std::experimental::optional<dht::decorated_key> _key;
+private:
+    bool has_rows(const input& in) const {
+        return in.piece && !in.piece->partition().clustered_rows().empty();
+    }
+
+    // Reads the following pieces of the inputs which have handed out all the
+    // rows they had read of the current partition.
+    future<> refill() {
+        return parallel_for_each(_inputs, [this] (input& in) {
+            if (!in.in_current || in.rows_done || has_rows(in)) {
+                return make_ready_future<>();
+            }
+            return repeat([this, &in] {
+                return in.source->next_rows().then([this, &in] (mutation_opt mo) {
+                    if (!mo) {
+                        in.rows_done = true;
+                        return stop_iteration::yes;
+                    }
+                    if (in.piece) {
+                        in.piece->partition().apply(*_schema, std::move(mo->partition()));
+                    } else {
+                        in.piece = std::move(mo);
+                    }
+                    return has_rows(in) ? stop_iteration::yes : stop_iteration::no;
+                });
+            });
+        });
+    }
+
+    // Moves into m the rows of the inputs up to the smallest last row read
+    // of those which have more to come, which no later piece can precede.
+    void take_rows(mutation& m) {
+        std::experimental::optional<clustering_key> bound;
+        clustering_key::less_compare less(*_schema);
+        for (auto& in : _inputs) {
+            if (in.in_current && !in.rows_done) {
+                auto& last = std::prev(in.piece->partition().clustered_rows().end())->key();
+                if (!bound || less(last, *bound)) {
+                    bound = last;
+                }
+            }
+        }
+        for (auto& in : _inputs) {
+            if (!in.in_current) {
+                continue;
+            }
+            if (in.piece) {
+                auto& rows = in.piece->partition().clustered_rows();
+                mutation_partition rest(_schema);
+                while (bound && !rows.empty() && less(*bound, std::prev(rows.end())->key())) {
+                    auto& rest_rows = rest.clustered_rows();
+                    rest_rows.splice(rest_rows.begin(), rows, std::prev(rows.end()));
+                }
+                m.partition().apply(*_schema, std::move(in.piece->partition()));
+                in.piece->partition() = std::move(rest);
+            }
+            if (in.rows_done && !has_rows(in)) {
+                in.piece = {};
+                in.in_current = false;
+            }
+        }
+    }
+
+    future<mutation_opt> emit(mutation m) {
+        return refill().then([this, m = std::move(m)] () mutable {
+            take_rows(m);
+            return mutation_opt(std::move(m));
+        });
+    }
+
+    // Skips what the caller left of the current partition.
+    future<> skip_current() {
+        return parallel_for_each(_inputs, [] (input& in) {
+            if (!in.in_current) {
+                return make_ready_future<>();
+            }
+            in.piece = {};
+            in.in_current = false;
+            if (in.rows_done) {
+                return make_ready_future<>();
+            }
+            return repeat([&in] {
+                return in.source->next_rows().then([&in] (mutation_opt mo) {
+                    in.rows_done = !mo;
+                    return in.rows_done ? stop_iteration::yes : stop_iteration::no;
+                });
+            });
+        });
+    }
+public:
+    combined_partition_source(schema_ptr s, std::vector<std::unique_ptr<partition_source>> sources)
+        : _schema(std::move(s))
+    {
+        _inputs.reserve(sources.size());
+        for (auto&& src : sources) {
+            _inputs.emplace_back(std::move(src));
+        }
+    }
+
+    virtual future<mutation_opt> next_partition() override {
+        return skip_current().then([this] {
+            return parallel_for_each(_inputs, [] (input& in) {
+                if (in.exhausted || in.next) {
+                    return make_ready_future<>();
+                }
+                return in.source->next_partition().then([&in] (mutation_opt mo) {
+                    in.exhausted = !mo;
+                    in.next = std::move(mo);
+                });
+            });
+        }).then([this] {
+            input* first = nullptr;
+            for (auto& in : _inputs) {
+                if (in.next && (!first || in.next->decorated_key().less_compare(*_schema, first->next->decorated_key()))) {
+                    first = &in;
+                }
+            }
+            if (!first) {
+                _key = {};
+                return make_ready_future<mutation_opt>();
+            }
+            _key = first->next->decorated_key();
+            for (auto& in : _inputs) {
+                if (in.next && in.next->decorated_key().equal(*_schema, *_key)) {
+                    in.piece = std::move(in.next);
+                    in.next = {};
+                    in.in_current = true;
+                    in.rows_done = false;
+                }
+            }
+            return emit(mutation(*_key, _schema));
+        });
+    }
+
+    virtual future<mutation_opt> next_rows() override {
+        if (std::none_of(_inputs.begin(), _inputs.end(), [] (const input& in) { return in.in_current; })) {
+            return make_ready_future<mutation_opt>();
+        }
+        return emit(mutation(*_key, _schema)).then([] (mutation_opt mo) {
+            auto& p = mo->partition();
+            if (p.clustered_rows().empty() && p.row_tombstones().empty()) {
+                return mutation_opt();
+            }
+            return mo;
+        });
+    }
+
+    virtual uint64_t bytes_read() const override {
+        uint64_t bytes = 0;
+        for (auto& in : _inputs) {
+            bytes += in.source->bytes_read();
+        }
+        return bytes;
+    }
+};
+
+std::unique_ptr<partition_source> make_combined_partition_source(schema_ptr s,
+        std::vector<std::unique_ptr<partition_source>> sources) {
+    return std::make_unique<combined_partition_source>(std::move(s), std::move(sources));
 }
 
 }
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "read_ahead.hh"
+#include "core/align.hh"
+
+namespace sstables {
+
+class read_ahead_file_data_source_impl : public data_source_impl {
+    file _file;
+    uint64_t _pos;
+    uint64_t _end;
+    size_t _buffer_size;
+    io_priority_class _pc;
+    io_queue* _queue;
+    read_ahead_window _window;
+public:
+    read_ahead_file_data_source_impl(file f, uint64_t pos, uint64_t end, const read_ahead_options& options,
+            const io_priority_class& pc, io_queue& queue)
+        : _file(std::move(f))
+        , _pos(pos)
+        , _end(end)
+        , _buffer_size(options.buffer_size)
+        , _pc(pc)
+        , _queue(&queue)
+        , _window(options.max_depth)
+    { }
+
+    virtual future<temporary_buffer<char>> get() override {
+        return _window.next([this] () -> std::experimental::optional<future<temporary_buffer<char>>> {
+            if (_pos >= _end) {
+                return {};
+            }
+            // Reads after the first are aligned to the buffer size.
+            auto len = std::min(align_down(_pos, uint64_t(_buffer_size)) + _buffer_size, _end) - _pos;
+            auto f = _queue->queue_request(_pc, len, [file = _file, pos = _pos, len] () mutable {
+                return file.dma_read_exactly<char>(pos, len);
+            });
+            _pos += len;
+            return std::move(f);
+        });
+    }
+};
+
+input_stream<char> make_read_ahead_file_input_stream(file f, uint64_t pos, uint64_t end,
+        const read_ahead_options& options, const io_priority_class& pc, io_queue& queue) {
+    return input_stream<char>(data_source(std::make_unique<read_ahead_file_data_source_impl>(
+            std::move(f), pos, end, options, pc, queue)));
+}
+
+read_ahead_options& default_read_ahead_options() {
+    static thread_local read_ahead_options options;
+    return options;
+}
+
+read_ahead_window::~read_ahead_window() {
+    for (auto&& f : _reads) {
+        f.then_wrapped([] (future<buffer_type> f) {
+            try {
+                f.get();
+            } catch (...) {
+                // Nobody wants this read anymore.
+            }
+        });
+    }
+}
+
+void read_ahead_window::adapt(bool was_ready, bool next_ready) {
+    if (!was_ready) {
+        _ready_streak = 0;
+        _depth = std::min(_depth * 2, _max_depth);
+    } else if (!next_ready) {
+        _ready_streak = 0;
+    } else if (++_ready_streak >= _depth && _depth > 1) {
+        _ready_streak = 0;
+        --_depth;
+    }
+}
+
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "core/future.hh"
+#include "core/temporary_buffer.hh"
+#include "core/file.hh"
+#include "core/iostream.hh"
+#include "utils/io_queue.hh"
+#include <experimental/optional>
+#include <deque>
+
+namespace sstables {
+
+struct read_ahead_options {
+    // Size of the reads issued on uncompressed data files. Compressed files
+    // are read a chunk at a time.
+    size_t buffer_size = 128 * 1024;
+    // Most reads kept in flight ahead of the consumer. 1 disables read-ahead.
+    unsigned max_depth = 4;
+};
+
+// Returns the read-ahead options used by sequential scans on this shard.
+read_ahead_options& default_read_ahead_options();
+
+// Window of reads issued ahead of a sequential consumer.
+//
+// The window starts at a single read, i.e. no read-ahead, so short reads
+// don't pay for data they will never look at. It doubles, up to the
+// maximum depth, whenever the consumer finds the next buffer still in
+// flight. When, for a whole window's worth of buffers, the consumer finds
+// not only the buffer it asks for but also the one after it ready, it
+// drains slower than the disk delivers and the window shrinks by one
+// read, so that a slow consumer doesn't pin more memory than it needs.
+class read_ahead_window {
+public:
+    using buffer_type = temporary_buffer<char>;
+private:
+    std::deque<future<buffer_type>> _reads;
+    unsigned _max_depth;
+    unsigned _depth = 1;
+    unsigned _ready_streak = 0;
+private:
+    void adapt(bool was_ready, bool next_ready);
+public:
+    explicit read_ahead_window(unsigned max_depth) : _max_depth(std::max(max_depth, 1u)) {}
+    read_ahead_window(read_ahead_window&&) = default;
+    // Reads still in flight are abandoned, their results discarded.
+    ~read_ahead_window();
+
+    unsigned depth() const {
+        return _depth;
+    }
+
+    // Returns the next buffer, first issuing reads until the window is
+    // full. issue() starts the next read, returning a disengaged optional
+    // at the end of the data; once the window has drained, an empty
+    // buffer is returned.
+    //
+    // Reads issued but not yet returned may outlive the window, so they
+    // must not refer to the window's owner.
+    template <typename Issue>
+    future<buffer_type> next(Issue&& issue) {
+        while (_reads.size() < _depth) {
+            std::experimental::optional<future<buffer_type>> f = issue();
+            if (!f) {
+                break;
+            }
+            _reads.emplace_back(std::move(*f));
+        }
+        if (_reads.empty()) {
+            return make_ready_future<buffer_type>();
+        }
+        auto f = std::move(_reads.front());
+        _reads.pop_front();
+        adapt(f.available(), !_reads.empty() && _reads.front().available());
+        return f;
+    }
+};
+
+// Returns a stream of the bytes [pos, end) of f, read with read-ahead, in
+// the given I/O priority class of the given queue.
+input_stream<char> make_read_ahead_file_input_stream(file f, uint64_t pos, uint64_t end,
+        const read_ahead_options& options = default_read_ahead_options(),
+        const io_priority_class& pc = query_priority(),
+        io_queue& queue = local_io_queue());
+
+}
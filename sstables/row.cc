@@ -21,6 +21,9 @@
 
 #include "sstables.hh"
 #include "consumer.hh"
+#include "core/future-util.hh"
+
+#include <boost/range/irange.hpp>
 
 namespace sstables {
 
@@ -253,6 +256,9 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
                 _key.release();
                 _val.release();
                 _state = state::ATOM_START;
+                if (_consumer.consume_atom_end() == row_consumer::proceed::no) {
+                    return row_consumer::proceed::no;
+                }
             } else {
                 _state = state::CELL_VALUE_BYTES_2;
             }
@@ -275,6 +281,9 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
             _key.release();
             _val.release();
             _state = state::ATOM_START;
+            if (_consumer.consume_atom_end() == row_consumer::proceed::no) {
+                return row_consumer::proceed::no;
+            }
             break;
         case state::RANGE_TOMBSTONE:
             if (read_16(data) != read_status::ready) {
@@ -307,6 +316,9 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
             _key.release();
             _val.release();
             _state = state::ATOM_START;
+            if (_consumer.consume_atom_end() == row_consumer::proceed::no) {
+                return row_consumer::proceed::no;
+            }
             break;
         }
         default:
@@ -337,13 +349,18 @@ class data_consume_rows_context : public data_consumer::continuous_data_consumer
 class data_consume_context::impl {
 private:
     std::unique_ptr<data_consume_rows_context> _ctx;
+    uint64_t _maxlen;
 public:
     impl(row_consumer& consumer,
             input_stream<char>&& input, uint64_t maxlen) :
-                _ctx(new data_consume_rows_context(consumer, std::move(input), maxlen)) { }
+                _ctx(new data_consume_rows_context(consumer, std::move(input), maxlen))
+                , _maxlen(maxlen) { }
     future<> read() {
         return _ctx->consume_input(*_ctx);
     }
+    uint64_t bytes_consumed() const {
+        return _maxlen - _ctx->remaining();
+    }
 };
 
 data_consume_context::~data_consume_context() = default;
@@ -353,21 +370,29 @@ data_consume_context::data_consume_context(std::unique_ptr<impl> p) : _pimpl(std
 future<> data_consume_context::read() {
     return _pimpl->read();
 }
+uint64_t data_consume_context::bytes_consumed() const {
+    return _pimpl->bytes_consumed();
+}
 
 data_consume_context sstable::data_consume_rows(
-        row_consumer& consumer, uint64_t start, uint64_t end) {
-    auto estimated_size = std::min(uint64_t(sstable_buffer_size), align_up(end - start, uint64_t(8 << 10)));
+        row_consumer& consumer, uint64_t start, uint64_t end, const read_ahead_options& options,
+        const io_priority_class& pc) {
+    // Don't read in large buffers when the range is small.
+    auto estimated_size = std::min(uint64_t(options.buffer_size), align_up(end - start, uint64_t(8 << 10)));
+    auto stream_options = options;
+    stream_options.buffer_size = std::max<size_t>(estimated_size, 8192);
     return std::make_unique<data_consume_context::impl>(
-            consumer, data_stream_at(start, std::max<size_t>(estimated_size, 8192)), end - start);
+            consumer, data_stream_at(start, end, stream_options, pc), end - start);
 }
 
-data_consume_context sstable::data_consume_rows(row_consumer& consumer) {
-    return data_consume_rows(consumer, 0, data_size());
+data_consume_context sstable::data_consume_rows(row_consumer& consumer, const read_ahead_options& options,
+        const io_priority_class& pc) {
+    return data_consume_rows(consumer, 0, data_size(), options, pc);
 }
 
 future<> sstable::data_consume_rows_at_once(row_consumer& consumer,
-        uint64_t start, uint64_t end) {
-    return data_read(start, end - start).then([&consumer]
+        uint64_t start, uint64_t end, const io_priority_class& pc) {
+    return data_read(start, end - start, pc).then([&consumer]
                                                (temporary_buffer<char> buf) {
         data_consume_rows_context ctx(consumer, input_stream<char>(), -1);
         ctx.process(buf);
@@ -375,4 +400,27 @@ future<> sstable::data_consume_rows_at_once(row_consumer& consumer,
     });
 }
 
+future<> sstable::data_consume_partition_pieces(row_consumer& consumer,
+        std::vector<std::pair<uint64_t, uint64_t>> pieces, const io_priority_class& pc) {
+    auto count = pieces.size();
+    return do_with(std::move(pieces), std::vector<temporary_buffer<char>>(count),
+            [this, &consumer, pc] (auto& pieces, auto& bufs) {
+        return parallel_for_each(boost::irange<size_t>(0, pieces.size()), [this, &pieces, &bufs, pc] (size_t i) {
+            return this->data_read(pieces[i].first, pieces[i].second - pieces[i].first, pc).then([&bufs, i] (temporary_buffer<char> buf) {
+                bufs[i] = std::move(buf);
+            });
+        }).then([&consumer, &bufs] {
+            data_consume_rows_context ctx(consumer, input_stream<char>(), -1);
+            for (auto&& buf : bufs) {
+                ctx.process(buf);
+            }
+            // The pieces end short of the end of partition marker.
+            temporary_buffer<char> end_of_partition(sizeof(int16_t));
+            std::fill_n(end_of_partition.get_write(), end_of_partition.size(), 0);
+            ctx.process(end_of_partition);
+            ctx.verify_end_state();
+        });
+    });
+}
+
 }
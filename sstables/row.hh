@@ -75,6 +75,13 @@ class row_consumer {
             bytes_view start_col, bytes_view end_col,
             sstables::deletion_time deltime) = 0;
 
+    // Called after each cell or range tombstone of the row. Returns whether
+    // to go on consuming, which lets a consumer hand out a large row in
+    // pieces.
+    virtual proceed consume_atom_end() {
+        return proceed::yes;
+    }
+
     // Called at the end of the row, after all cells.
     // Returns a flag saying whether the sstable consumer should stop now, or
     // proceed consuming more data.
@@ -39,9 +39,12 @@
 #include "index_reader.hh"
 #include "remove.hh"
 #include "memtable.hh"
+#include "key_cache.hh"
 #include <boost/filesystem/operations.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/range/adaptor/map.hpp>
+#include <boost/range/irange.hpp>
+#include <boost/iterator/counting_iterator.hpp>
 #include <regex>
 #include <core/align.hh>
 
@@ -446,7 +449,10 @@ future<> parse(random_access_reader& in, summary& s) {
             auto len = s.header.size * sizeof(pos_type);
             check_buf_size(buf, len);
 
-            s.entries.resize(s.header.size);
+            s.entries.clear();
+            // All of the entries but their positions in Index.db.
+            auto entries_size = s.header.size * (sizeof(pos_type) + sizeof(uint64_t));
+            s.entries.reserve_keys(s.header.memory_size > entries_size ? s.header.memory_size - entries_size : 0);
 
             auto *nr = reinterpret_cast<const pos_type *>(buf.get());
             s.positions = std::deque<pos_type>(nr, nr + s.header.size);
@@ -465,23 +471,23 @@ future<> parse(random_access_reader& in, summary& s) {
 
             in.seek(s.positions[0] + sizeof(summary::header));
 
-            assert(s.positions.size() == (s.entries.size() + 1));
+            assert(s.positions.size() == (s.header.size + 1));
 
-            auto idx = make_lw_shared<size_t>(0);
-            return do_for_each(s.entries.begin(), s.entries.end(), [idx, &in, &s] (auto& entry) {
-                auto pos = s.positions[(*idx)++];
-                auto next = s.positions[*idx];
+            return do_for_each(boost::irange<size_t>(0, s.header.size), [&in, &s] (size_t i) {
+                auto pos = s.positions[i];
+                auto next = s.positions[i + 1];
 
                 auto entrysize = next - pos;
 
-                return in.read_exactly(entrysize).then([&entry, entrysize] (auto buf) {
+                return in.read_exactly(entrysize).then([&s, entrysize] (auto buf) {
                     check_buf_size(buf, entrysize);
 
                     auto keysize = entrysize - 8;
-                    entry.key = bytes(reinterpret_cast<const int8_t*>(buf.get()), keysize);
+                    auto key = bytes_view(reinterpret_cast<const int8_t*>(buf.get()), keysize);
                     buf.trim_front(keysize);
                     // FIXME: This is a le read. We should make this explicit
-                    entry.position = *(reinterpret_cast<const net::packed<uint64_t> *>(buf.get()));
+                    auto position = *(reinterpret_cast<const net::packed<uint64_t> *>(buf.get()));
+                    s.entries.push_back(key, position);
 
                     return make_ready_future<>();
                 });
@@ -493,7 +499,7 @@ future<> parse(random_access_reader& in, summary& s) {
     });
 }
 
-inline void write(file_writer& out, summary_entry& entry) {
+inline void write(file_writer& out, const summary_entry& entry) {
     // FIXME: summary entry is supposedly written in memory order, but that
     // would prevent portability of summary file between machines of different
     // endianness. We can treat it as little endian to preserve portability.
@@ -512,17 +518,19 @@ inline void write(file_writer& out, summary& s) {
     for (auto&& e : s.positions) {
         out.write(reinterpret_cast<const char*>(&e), sizeof(e)).get();
     }
-    write(out, s.entries);
+    for (size_t i = 0; i < s.entries.size(); ++i) {
+        write(out, s.entries[i]);
+    }
     write(out, s.first_key, s.last_key);
 }
 
-future<summary_entry&> sstable::read_summary_entry(size_t i) {
+future<summary_entry> sstable::read_summary_entry(size_t i) {
     // The last one is the boundary marker
     if (i >= (_summary.entries.size())) {
         throw std::out_of_range(sprint("Invalid Summary index: %ld", i));
     }
 
-    return make_ready_future<summary_entry&>(_summary.entries[i]);
+    return make_ready_future<summary_entry>(_summary.entries[i]);
 }
 
 future<> parse(random_access_reader& in, deletion_time& d) {
@@ -716,14 +724,14 @@ void sstable::generate_toc(compressor c, double filter_fp_chance) {
     }
 }
 
-void sstable::write_toc() {
+void sstable::write_toc(const io_priority_class& pc) {
     auto file_path = filename(sstable::component_type::TemporaryTOC);
 
     sstlog.debug("Writing TOC file {} ", file_path);
 
     // Writing TOC content to temporary file.
     file f = engine().open_file_dma(file_path, open_flags::wo | open_flags::create | open_flags::truncate).get0();
-    auto out = file_writer(std::move(f), 4096);
+    auto out = file_writer(std::move(f), pc, 4096, 1, disk_queue());
     auto w = file_writer(std::move(out));
 
     for (auto&& key : _components) {
@@ -758,24 +766,24 @@ void sstable::seal_sstable() {
     sstlog.debug("SSTable with generation {} was sealed successfully.", _generation);
 }
 
-void write_crc(const sstring file_path, checksum& c) {
+void write_crc(const sstring file_path, checksum& c, const io_priority_class& pc) {
     sstlog.debug("Writing CRC file {} ", file_path);
 
     auto oflags = open_flags::wo | open_flags::create | open_flags::exclusive;
     file f = engine().open_file_dma(file_path, oflags).get0();
-    auto out = file_writer(std::move(f), 4096);
+    auto out = file_writer(std::move(f), pc, 4096, 1, local_io_queue(file_path));
     auto w = file_writer(std::move(out));
     write(w, c);
     w.close().get();
 }
 
 // Digest file stores the full checksum of data file converted into a string.
-void write_digest(const sstring file_path, uint32_t full_checksum) {
+void write_digest(const sstring file_path, uint32_t full_checksum, const io_priority_class& pc) {
     sstlog.debug("Writing Digest file {} ", file_path);
 
     auto oflags = open_flags::wo | open_flags::create | open_flags::exclusive;
     auto f = engine().open_file_dma(file_path, oflags).get0();
-    auto out = file_writer(std::move(f), 4096);
+    auto out = file_writer(std::move(f), pc, 4096, 1, local_io_queue(file_path));
     auto w = file_writer(std::move(out));
 
     auto digest = to_sstring<bytes>(full_checksum);
@@ -789,7 +797,8 @@ future<index_list> sstable::read_indexes(uint64_t summary_idx) {
     }
 
     uint64_t position = _summary.entries[summary_idx].position;
-    uint64_t quantity = _summary.header.sampling_level;
+    // The entries dropped by a resampling are read along.
+    uint64_t quantity = _summary.header.sampling_level * _summary_downsampling;
 
     uint64_t estimated_size;
     if (++summary_idx >= _summary.header.size) {
@@ -802,7 +811,11 @@ future<index_list> sstable::read_indexes(uint64_t summary_idx) {
     estimated_size = std::max<size_t>(estimated_size, 8192);
 
     return do_with(index_consumer(quantity), [this, position, estimated_size] (index_consumer& ic) {
-        auto stream = make_file_input_stream(this->_index_file, position, estimated_size);
+        read_ahead_options options;
+        options.buffer_size = estimated_size;
+        options.max_depth = 1;
+        auto stream = make_read_ahead_file_input_stream(this->_index_file, position, this->index_size(), options,
+                query_priority(), this->disk_queue());
         auto ctx = make_lw_shared<index_consume_entry_context>(ic, std::move(stream), this->index_size() - position);
         return ctx->consume_input(*ctx).then([ctx, &ic] {
             return make_ready_future<index_list>(std::move(ic.indexes));
@@ -833,11 +846,11 @@ future<> sstable::read_simple(T& component) {
 }
 
 template <sstable::component_type Type, typename T>
-void sstable::write_simple(T& component) {
+void sstable::write_simple(T& component, const io_priority_class& pc) {
     auto file_path = filename(Type);
     sstlog.debug(("Writing " + _component_map[Type] + " file {} ").c_str(), file_path);
     file f = engine().open_file_dma(file_path, open_flags::wo | open_flags::create | open_flags::truncate).get0();
-    auto out = file_writer(std::move(f), sstable_buffer_size);
+    auto out = file_writer(std::move(f), pc, sstable_buffer_size, default_write_options().write_behind, disk_queue());
     auto w = file_writer(std::move(out));
     write(w, component);
     w.flush().get();
@@ -845,7 +858,90 @@ void sstable::write_simple(T& component) {
 }
 
 template future<> sstable::read_simple<sstable::component_type::Filter>(sstables::filter& f);
-template void sstable::write_simple<sstable::component_type::Filter>(sstables::filter& f);
+template void sstable::write_simple<sstable::component_type::Filter>(sstables::filter& f, const io_priority_class& pc);
+
+load_options& default_load_options() {
+    static thread_local load_options options;
+    return options;
+}
+
+lw_shared_ptr<utils::mapped_file> sstable::map_component(component_type type) {
+    auto file_path = filename(type);
+    sstlog.debug(("Mapping " + _component_map[type] + " file {} ").c_str(), file_path);
+    try {
+        return make_lw_shared<utils::mapped_file>(file_path, MADV_RANDOM);
+    } catch (std::system_error& e) {
+        if (e.code() == std::error_code(ENOENT, std::system_category())) {
+            throw malformed_sstable_exception(file_path + ": file not found");
+        }
+        throw;
+    }
+}
+
+future<> sstable::read_summary() {
+    if (default_load_options().map_summary) {
+        return map_summary();
+    }
+    return read_simple<component_type::Summary>(_summary);
+}
+
+// Mirrors parse(random_access_reader&, summary&), but leaves the keys in the
+// mapping.
+future<> sstable::map_summary() {
+    return make_ready_future<>().then([this] {
+        using pos_type = typename decltype(summary::positions)::value_type;
+        auto m = map_component(component_type::Summary);
+        auto file_path = filename(component_type::Summary);
+        auto check = [&] (size_t end) {
+            if (end > m->size()) {
+                throw malformed_sstable_exception(sprint("%s: truncated at %d of %d bytes", file_path, m->size(), end));
+            }
+        };
+        auto read_be = [&] (auto& v, size_t pos) {
+            check(pos + sizeof(v));
+            std::copy_n(m->data() + pos, sizeof(v), reinterpret_cast<char*>(&v));
+            v = net::ntoh(v);
+        };
+        auto& s = _summary;
+        auto& h = s.header;
+        read_be(h.min_index_interval, 0);
+        read_be(h.size, 4);
+        read_be(h.memory_size, 8);
+        read_be(h.sampling_level, 16);
+        read_be(h.size_at_full_sampling, 20);
+        static_assert(sizeof(summary::header) == 24, "unexpected summary header layout");
+        auto base = sizeof(summary::header);
+
+        check(base + h.memory_size);
+        check(base + h.size * sizeof(pos_type));
+        auto nr = reinterpret_cast<const pos_type*>(m->data() + base);
+        s.positions = std::deque<pos_type>(nr, nr + h.size);
+
+        s.entries.clear();
+        for (size_t i = 0; i < h.size; ++i) {
+            size_t pos = s.positions[i];
+            size_t next = i + 1 < h.size ? size_t(s.positions[i + 1]) : size_t(h.memory_size);
+            if (next < pos + sizeof(uint64_t) || next > h.memory_size) {
+                throw malformed_sstable_exception(sprint("%s: bad position of summary entry %d", file_path, i));
+            }
+            auto key = bytes_view(reinterpret_cast<const int8_t*>(m->data() + base + pos), next - pos - sizeof(uint64_t));
+            // Like the parsed summary's, a native-endian read.
+            uint64_t position;
+            std::copy_n(m->data() + base + next - sizeof(uint64_t), sizeof(position), reinterpret_cast<char*>(&position));
+            s.entries.push_back_mapped(m, key, position);
+        }
+
+        auto read_key = [&] (disk_string<uint32_t>& k, size_t pos) {
+            uint32_t len;
+            read_be(len, pos);
+            check(pos + sizeof(len) + len);
+            auto p = reinterpret_cast<const int8_t*>(m->data() + pos + sizeof(len));
+            k.value = bytes(p, len);
+            return pos + sizeof(len) + len;
+        };
+        read_key(s.last_key, read_key(s.first_key, base + h.memory_size));
+    });
+}
 
 future<> sstable::read_compression() {
      // FIXME: If there is no compression, we should expect a CRC file to be present.
@@ -856,20 +952,20 @@ future<> sstable::read_compression() {
     return read_simple<component_type::CompressionInfo>(_compression);
 }
 
-void sstable::write_compression() {
+void sstable::write_compression(const io_priority_class& pc) {
     if (!has_component(sstable::component_type::CompressionInfo)) {
         return;
     }
 
-    write_simple<component_type::CompressionInfo>(_compression);
+    write_simple<component_type::CompressionInfo>(_compression, pc);
 }
 
 future<> sstable::read_statistics() {
     return read_simple<component_type::Statistics>(_statistics);
 }
 
-void sstable::write_statistics() {
-    write_simple<component_type::Statistics>(_statistics);
+void sstable::write_statistics(const io_priority_class& pc) {
+    write_simple<component_type::Statistics>(_statistics, pc);
 }
 
 future<> sstable::open_data() {
@@ -887,6 +983,10 @@ future<> sstable::open_data() {
             return _index_file.size().then([this] (auto size) {
               _index_file_size = size;
             });
+        }).then([this] {
+            return _data_file.stat().then([this] (struct stat st) {
+                _data_file_write_time = gc_clock::time_point(gc_clock::duration(st.st_mtime));
+            });
         });
 
     });
@@ -905,15 +1005,75 @@ future<> sstable::create_data() {
     });
 }
 
+uint64_t sstable::summary_memory() const {
+    return _summary.entries.memory_usage();
+}
+
+// Keeps one in every step of the entries of the summary.
+static void downsample(summary& s, unsigned step) {
+    summary_entries entries;
+    size_t keys_size = 0;
+    for (size_t i = 0; i < s.entries.size(); i += step) {
+        keys_size += s.entries[i].key.size();
+    }
+    entries.reserve_keys(keys_size);
+    for (size_t i = 0; i < s.entries.size(); i += step) {
+        entries.push_back(s.entries[i]);
+    }
+    s.entries = std::move(entries);
+    s.header.size = s.entries.size();
+    // Only of use to write the summary.
+    s.positions.clear();
+}
+
+future<> sstable::resample_summary(unsigned step) {
+    assert(step >= 1);
+    if (step == _summary_downsampling) {
+        return make_ready_future<>();
+    }
+    return with_semaphore(_summary_lock, summary_lock_units, [this, step] {
+        if (_summary_downsampling == 1) {
+            _full_summary_memory = summary_memory();
+        }
+        auto f = make_ready_future<>();
+        if (step % _summary_downsampling) {
+            // Some of the entries to keep were dropped.
+            f = do_with(summary(), [this] (summary& full) {
+                return read_simple<component_type::Summary>(full).then([this, &full] {
+                    _summary.entries = std::move(full.entries);
+                    _summary.header.size = full.header.size;
+                    _summary_downsampling = 1;
+                });
+            });
+        }
+        return f.then([this, step] {
+            if (step != _summary_downsampling) {
+                downsample(_summary, step / _summary_downsampling);
+                _summary_downsampling = step;
+            }
+            // The cached pages are of the intervals of the old summary.
+            global_index_page_cache().invalidate(_cache_id);
+        });
+    });
+}
+
 future<> sstable::load() {
+    return load_summary().then([this] {
+        return load_components();
+    });
+}
+
+future<> sstable::load_summary() {
     return read_toc().then([this] {
-        return read_statistics();
-    }).then([this] {
+        return read_summary();
+    });
+}
+
+future<> sstable::load_components() {
+    return read_statistics().then([this] {
         return read_compression();
     }).then([this] {
         return read_filter();
-    }).then([this] {;
-        return read_summary();
     }).then([this] {
         return open_data();
     });
@@ -922,11 +1082,6 @@ future<> sstable::load() {
 // @clustering_key: it's expected that clustering key is already in its composite form.
 // NOTE: empty clustering key means that there is no clustering key.
 void sstable::write_column_name(file_writer& out, const composite& clustering_key, const std::vector<bytes_view>& column_names, composite_marker m) {
-    // FIXME: min_components and max_components also keep track of clustering
-    // prefix, so we must merge clustering_key and column_names somehow and
-    // pass the result to the functions below.
-    column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, column_names);
-
     // was defined in the schema, for example.
     auto c= composite::from_exploded(column_names, m);
     auto ck_bview = bytes_view(clustering_key);
@@ -944,8 +1099,6 @@ void sstable::write_column_name(file_writer& out, const composite& clustering_ke
 }
 
 void sstable::write_column_name(file_writer& out, bytes_view column_names) {
-    column_name_helper::min_max_components(_c_stats.min_column_names, _c_stats.max_column_names, { column_names });
-
     uint16_t sz = column_names.size();
     write(out, sz, column_names);
 }
@@ -973,6 +1126,7 @@ void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
         uint32_t deletion_time = cell.deletion_time().time_since_epoch().count();
 
         _c_stats.tombstone_histogram.update(deletion_time);
+        _c_stats.update_max_local_deletion_time(deletion_time);
 
         write(out, mask, timestamp, deletion_time_size, deletion_time);
     } else if (cell.is_live_and_has_ttl()) {
@@ -983,6 +1137,11 @@ void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
         uint32_t expiration = cell.expiry().time_since_epoch().count();
         disk_string_view<uint32_t> cell_value { cell.value() };
 
+        // Counted as a tombstone to be, so that the histogram tells whether
+        // the sstable may hold dead data.
+        _c_stats.tombstone_histogram.update(expiration);
+        _c_stats.update_max_local_deletion_time(expiration);
+
         write(out, mask, ttl, expiration, timestamp, cell_value);
     } else {
         // regular cell
@@ -990,6 +1149,8 @@ void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
         column_mask mask = column_mask::none;
         disk_string_view<uint32_t> cell_value { cell.value() };
 
+        _c_stats.update_max_local_deletion_time(std::numeric_limits<int>::max());
+
         write(out, mask, timestamp, cell_value);
     }
 }
@@ -1013,15 +1174,19 @@ void sstable::write_row_marker(file_writer& out, const rows_entry& clustered_row
         uint32_t deletion_time = marker.deletion_time().time_since_epoch().count();
 
         _c_stats.tombstone_histogram.update(deletion_time);
+        _c_stats.update_max_local_deletion_time(deletion_time);
 
         write(out, mask, timestamp, deletion_time_size, deletion_time);
     } else if (marker.is_expiring()) {
         column_mask mask = column_mask::expiration;
         uint32_t ttl = marker.ttl().count();
         uint32_t expiration = marker.expiry().time_since_epoch().count();
+        _c_stats.tombstone_histogram.update(expiration);
+        _c_stats.update_max_local_deletion_time(expiration);
         write(out, mask, ttl, expiration, timestamp, value_length);
     } else {
         column_mask mask = column_mask::none;
+        _c_stats.update_max_local_deletion_time(std::numeric_limits<int>::max());
         write(out, mask, timestamp, value_length);
     }
 }
@@ -1040,6 +1205,7 @@ void sstable::write_range_tombstone(file_writer& out, const composite& clusterin
 
     update_cell_stats(_c_stats, timestamp);
     _c_stats.tombstone_histogram.update(deletion_time);
+    _c_stats.update_max_local_deletion_time(deletion_time);
 
     write(out, deletion_time, timestamp);
 }
@@ -1115,11 +1281,121 @@ void sstable::write_static_row(file_writer& out, const schema& schema, const row
     });
 }
 
-static void write_index_entry(file_writer& out, disk_string_view<uint16_t>& key, uint64_t pos) {
-    // FIXME: support promoted indexes.
-    uint32_t promoted_index_size = 0;
+write_options& default_write_options() {
+    static thread_local write_options options;
+    return options;
+}
+
+// Builds the promoted index of a partition while its rows are written: the
+// blocks of about column_index_size bytes its rows are split into, at row
+// boundaries, with the first and last column names of each block, so that
+// a read of a slice of a wide partition can skip to the right block.
+class promoted_index_builder {
+    struct block {
+        bytes first_name;
+        bytes last_name;
+        // Relative to the start of the partition.
+        uint64_t offset;
+        uint64_t width;
+    };
+    const schema& _schema;
+    uint64_t _partition_start;
+    size_t _block_size;
+    uint64_t _block_start;
+    bool _block_open = false;
+    bytes _first_name;
+    bytes _last_name;
+    std::vector<block> _blocks;
+private:
+    bytes column_name(const clustering_key& ck, composite_marker m) const {
+        if (!_schema.is_compound()) {
+            return to_bytes(bytes_view(ck));
+        }
+        auto name = to_bytes(bytes_view(composite::from_clustering_element(_schema, ck)));
+        if (!name.empty()) {
+            name[name.size() - 1] = bytes::value_type(m);
+        }
+        return name;
+    }
+    void close_block(uint64_t end) {
+        _blocks.push_back({ std::move(_first_name), std::move(_last_name), _block_start - _partition_start, end - _block_start });
+        _block_start = end;
+        _block_open = false;
+    }
+public:
+    // atoms_start is where the first atom of the partition, following its
+    // key and deletion time, is written.
+    promoted_index_builder(const schema& s, uint64_t partition_start, uint64_t atoms_start, size_t block_size)
+        : _schema(s)
+        , _partition_start(partition_start)
+        , _block_size(block_size)
+        , _block_start(atoms_start)
+    { }
+
+    void before_row(const clustering_key& ck) {
+        if (!_block_open) {
+            _first_name = column_name(ck, composite_marker::none);
+            _block_open = true;
+        }
+    }
+
+    // pos is the data file offset just past the row.
+    void after_row(const clustering_key& ck, uint64_t pos) {
+        if (_block_size && pos - _block_start >= _block_size) {
+            _last_name = column_name(ck, composite_marker::end_range);
+            close_block(pos);
+        }
+    }
+
+    // Called with the last row of each piece of the partition, which is
+    // gone by the time the last block is closed.
+    void end_piece(const clustering_key& ck) {
+        if (_block_open) {
+            _last_name = column_name(ck, composite_marker::end_range);
+        }
+    }
+
+    // pos is the data file offset just past the last atom.
+    void finish(uint64_t pos) {
+        if (_block_open) {
+            close_block(pos);
+        }
+    }
+
+    // A single block tells nothing the index entry doesn't.
+    bool empty() const {
+        return _blocks.size() < 2;
+    }
+
+    uint32_t serialized_size() const {
+        uint32_t size = sizeof(int32_t) + sizeof(int64_t) + sizeof(uint32_t);
+        for (auto& b : _blocks) {
+            size += 2 * sizeof(uint16_t) + b.first_name.size() + b.last_name.size() + 2 * sizeof(uint64_t);
+        }
+        return size;
+    }
+
+    void write_blocks(file_writer& out) const {
+        uint32_t count = _blocks.size();
+        write(out, count);
+        for (auto& b : _blocks) {
+            disk_string_view<uint16_t> first_name, last_name;
+            first_name.value = bytes_view(b.first_name);
+            last_name.value = bytes_view(b.last_name);
+            write(out, first_name, last_name, b.offset, b.width);
+        }
+    }
+};
+
+static void write_index_entry(file_writer& out, disk_string_view<uint16_t>& key, uint64_t pos,
+        deletion_time& d, const promoted_index_builder& promoted_index) {
+    uint32_t promoted_index_size = promoted_index.empty() ? 0 : promoted_index.serialized_size();
 
     write(out, key, pos, promoted_index_size);
+    if (promoted_index_size) {
+        write(out, d);
+        promoted_index.write_blocks(out);
+    }
 }
 
 static constexpr int BASE_SAMPLING_LEVEL = 128;
@@ -1149,7 +1425,8 @@ static void seal_summary(summary& s,
     s.header.size_at_full_sampling = s.header.size;
 
     s.header.memory_size = s.header.size * sizeof(uint32_t);
-    for (auto& e: s.entries) {
+    for (size_t i = 0; i < s.entries.size(); ++i) {
+        auto e = s.entries[i];
         s.positions.push_back(s.header.memory_size);
         s.header.memory_size += e.key.size() + sizeof(e.position);
     }
@@ -1164,22 +1441,27 @@ static void seal_summary(summary& s,
     }
 }
 
-static void prepare_compression(compression& c, const schema& schema) {
+static void prepare_compression(compression& c, const schema& schema, bytes dictionary,
+        lw_shared_ptr<zstd_dictionary_trainer> trainer) {
     const auto& cp = schema.get_compressor_params();
     c.set_compressor(cp.get_compressor());
     c.chunk_len = cp.chunk_length();
     c.data_len = 0;
-    // FIXME: crc_check_chance can be configured by the user.
     // probability to verify the checksum of a compressed chunk we read.
     // defaults to 1.0.
-    c.options.elements.push_back({"crc_check_chance", "1.0"});
+    auto crc_check_chance = to_bytes(std::to_string(cp.crc_check_chance()));
+    c.options.elements.push_back({{to_bytes(compression_parameters::CRC_CHECK_CHANCE)}, {std::move(crc_check_chance)}});
+    if (cp.get_compressor() == compressor::zstd) {
+        c.set_zstd_parameters(cp.compression_level(), cp.dictionary_size() ? std::move(dictionary) : bytes());
+        c.set_dictionary_trainer(std::move(trainer));
+    }
     c.init_full_checksum();
 }
 
 static void maybe_add_summary_entry(summary& s, bytes_view key, uint64_t offset) {
     // Maybe add summary entry into in-memory representation of summary file.
     if ((s.keys_written++ % s.header.min_index_interval) == 0) {
-        s.entries.push_back({ bytes(key.data(), key.size()), offset });
+        s.entries.push_back(key, offset);
     }
 }
 
@@ -1222,12 +1504,13 @@ static void seal_statistics(statistics& s, metadata_collector& collector,
 ///
 ///  @param out holds an output stream to data file.
 ///
-void sstable::do_write_components(::mutation_reader mr,
-        uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, file_writer& out) {
-    auto index = make_shared<file_writer>(_index_file, sstable_buffer_size);
+void sstable::do_write_components(partition_source& src,
+        uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, file_writer& out,
+        const io_priority_class& pc) {
+    auto index = make_shared<file_writer>(_index_file, pc, sstable_buffer_size, default_write_options().write_behind, disk_queue());
 
-    auto filter_fp_chance = schema->bloom_filter_fp_chance();
-    _filter = utils::i_filter::get_filter(estimated_partitions, filter_fp_chance);
+    auto filter_fp_chance = this->filter_fp_chance(*schema);
+    _filter = utils::i_filter::get_filter(estimated_partitions, filter_fp_chance, schema->bloom_filter_format());
 
     prepare_summary(_summary, estimated_partitions);
 
@@ -1236,10 +1519,13 @@ void sstable::do_write_components(::mutation_reader mr,
     // Remember first and last keys, which we need for the summary file.
     std::experimental::optional<key> first_key, last_key;
 
+    auto column_index_size = default_write_options().column_index_size;
+
     // Iterate through CQL partitions, then CQL rows, then CQL columns.
-    // Each mt.all_partitions() entry is a set of clustered rows sharing the same partition key.
+    // A partition may come in several pieces, each holding some of its
+    // clustered rows, so only one piece needs to be in memory at a time.
     while (out.offset() < max_sstable_size) {
-        mutation_opt mut = mr().get0();
+        mutation_opt mut = src.next_partition().get0();
         if (!mut) {
             break;
         }
@@ -1249,16 +1535,12 @@ void sstable::do_write_components(::mutation_reader mr,
 
         auto partition_key = key::from_partition_key(*schema, mut->key());
 
-        maybe_add_summary_entry(_summary, bytes_view(partition_key), index->offset());
         _filter->add(bytes_view(partition_key));
         _collector.add_key(bytes_view(partition_key));
 
         auto p_key = disk_string_view<uint16_t>();
         p_key.value = bytes_view(partition_key);
 
-        // Write index file entry from partition key into index file.
-        write_index_entry(*index, p_key, out.offset());
-
         // Write partition key into data file.
         write(out, p_key);
 
@@ -1273,6 +1555,7 @@ void sstable::do_write_components(::mutation_reader mr,
             _c_stats.update_max_local_deletion_time(d.local_deletion_time);
             _c_stats.update_min_timestamp(d.marked_for_delete_at);
             _c_stats.update_max_timestamp(d.marked_for_delete_at);
+            _collector.set_unbounded_column_names();
         } else {
             // Default values for live, undeleted rows.
             d.local_deletion_time = std::numeric_limits<int32_t>::max();
@@ -1280,22 +1563,49 @@ void sstable::do_write_components(::mutation_reader mr,
         }
         write(out, d);
 
-        auto& partition = mut->partition();
-        auto& static_row = partition.static_row();
+        promoted_index_builder promoted_index(*schema, _c_stats.start_offset, out.offset(), column_index_size);
 
-        write_static_row(out, *schema, static_row);
-        for (const auto& rt: partition.row_tombstones()) {
+        write_static_row(out, *schema, mut->partition().static_row());
+        for (const auto& rt: mut->partition().row_tombstones()) {
             auto prefix = composite::from_clustering_element(*schema, rt.prefix());
             write_range_tombstone(out, prefix, {}, rt.t());
+            _collector.update_min_max_components(*schema, rt.prefix());
         }
 
-        // Write all CQL rows from a given mutation partition.
-        for (auto& clustered_row: partition.clustered_rows()) {
-            write_clustered_row(out, *schema, clustered_row);
+        // Write all CQL rows from each piece of the partition. The pieces
+        // following the first may hold range tombstones which came between
+        // rows of an sstable they were read from.
+        bool first_piece = true;
+        while (mut) {
+            if (!first_piece) {
+                for (const auto& rt: mut->partition().row_tombstones()) {
+                    auto prefix = composite::from_clustering_element(*schema, rt.prefix());
+                    write_range_tombstone(out, prefix, {}, rt.t());
+                    _collector.update_min_max_components(*schema, rt.prefix());
+                }
+            }
+            first_piece = false;
+            auto& rows = mut->partition().clustered_rows();
+            for (auto& clustered_row: rows) {
+                promoted_index.before_row(clustered_row.key());
+                write_clustered_row(out, *schema, clustered_row);
+                _collector.update_min_max_components(*schema, clustered_row.key());
+                promoted_index.after_row(clustered_row.key(), out.offset());
+            }
+            if (!rows.empty()) {
+                promoted_index.end_piece(rows.rbegin()->key());
+            }
+            mut = src.next_rows().get0();
         }
+        promoted_index.finish(out.offset());
         int16_t end_of_row = 0;
         write(out, end_of_row);
 
+        // The index entry goes after the partition, once its promoted
+        // index is known.
+        maybe_add_summary_entry(_summary, bytes_view(partition_key), index->offset());
+        write_index_entry(*index, p_key, _c_stats.start_offset, d, promoted_index);
+
         // compute size of the current row.
         _c_stats.row_size = out.offset() - _c_stats.start_offset;
         // update is about merging column_stats with the data being stored by collector.
@@ -1323,49 +1633,83 @@ void sstable::do_write_components(::mutation_reader mr,
     seal_statistics(_statistics, _collector, dht::global_partitioner().name(), filter_fp_chance);
 }
 
-void sstable::prepare_write_components(::mutation_reader mr, uint64_t estimated_partitions, schema_ptr schema,
-        uint64_t max_sstable_size) {
+void sstable::prepare_write_components(partition_source& src, uint64_t estimated_partitions, schema_ptr schema,
+        uint64_t max_sstable_size, const io_priority_class& pc) {
     // CRC component must only be present when compression isn't enabled.
     bool checksum_file = has_component(sstable::component_type::CRC);
 
     if (checksum_file) {
-        auto w = make_shared<checksummed_file_writer>(_data_file, sstable_buffer_size, checksum_file);
-        this->do_write_components(std::move(mr), estimated_partitions, std::move(schema), max_sstable_size, *w);
+        auto w = make_shared<checksummed_file_writer>(_data_file, pc, sstable_buffer_size, checksum_file,
+                default_write_options().write_behind, disk_queue());
+        this->do_write_components(src, estimated_partitions, std::move(schema), max_sstable_size, *w, pc);
         w->close().get();
         _data_file = file(); // w->close() closed _data_file
 
-        write_digest(filename(sstable::component_type::Digest), w->full_checksum());
-        write_crc(filename(sstable::component_type::CRC), w->finalize_checksum());
+        write_digest(filename(sstable::component_type::Digest), w->full_checksum(), pc);
+        write_crc(filename(sstable::component_type::CRC), w->finalize_checksum(), pc);
     } else {
-        prepare_compression(_compression, *schema);
-        auto w = make_shared<file_writer>(make_compressed_file_output_stream(_data_file, &_compression));
-        this->do_write_components(std::move(mr), estimated_partitions, std::move(schema), max_sstable_size, *w);
+        prepare_compression(_compression, *schema, std::move(_compression_dictionary), std::move(_dictionary_trainer));
+        auto w = make_shared<file_writer>(make_compressed_file_output_stream(_data_file, &_compression, pc,
+                sstable_buffer_size, default_write_options().write_behind, disk_queue()));
+        this->do_write_components(src, estimated_partitions, std::move(schema), max_sstable_size, *w, pc);
         w->close().get();
         _data_file = file(); // w->close() closed _data_file
 
-        write_digest(filename(sstable::component_type::Digest), _compression.full_checksum());
+        write_digest(filename(sstable::component_type::Digest), _compression.full_checksum(), pc);
     }
 }
 
-future<> sstable::write_components(const memtable& mt) {
+// Hands out each partition of a mutation_reader whole.
+class mutation_reader_partition_source final : public partition_source {
+    ::mutation_reader _mr;
+public:
+    explicit mutation_reader_partition_source(::mutation_reader mr) : _mr(std::move(mr)) {}
+
+    virtual future<mutation_opt> next_partition() override {
+        return _mr();
+    }
+
+    virtual future<mutation_opt> next_rows() override {
+        return make_ready_future<mutation_opt>();
+    }
+};
+
+future<> sstable::write_components(const memtable& mt, const io_priority_class& pc) {
     _collector.set_replay_position(mt.replay_position());
-    return write_components(mt.make_reader(),
-            mt.partition_count(), mt.schema(), std::numeric_limits<uint64_t>::max());
+    return write_partitions(mt.make_flush_reader(default_write_options().flush_buffer_size),
+            mt.partition_count(), mt.schema(), std::numeric_limits<uint64_t>::max(), pc);
 }
 
 future<> sstable::write_components(::mutation_reader mr,
-        uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size) {
-    return seastar::async([this, mr = std::move(mr), estimated_partitions, schema = std::move(schema), max_sstable_size] () mutable {
+        uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, const io_priority_class& pc) {
+    return write_partitions(std::make_unique<mutation_reader_partition_source>(std::move(mr)),
+            estimated_partitions, std::move(schema), max_sstable_size, pc);
+}
+
+future<> sstable::write_components(std::unique_ptr<partition_source> src,
+        uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, const io_priority_class& pc) {
+    return write_partitions(std::move(src), estimated_partitions, std::move(schema), max_sstable_size, pc);
+}
+
+future<> sstable::write_partitions(std::unique_ptr<partition_source> src,
+        uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, const io_priority_class& pc) {
+    return seastar::async([this, src = std::move(src), estimated_partitions, schema = std::move(schema), max_sstable_size, pc] () mutable {
         // FIXME: write all components
-        generate_toc(schema->get_compressor_params().get_compressor(), schema->bloom_filter_fp_chance());
-        write_toc();
+        generate_toc(schema->get_compressor_params().get_compressor(), filter_fp_chance(*schema));
+        write_toc(pc);
         create_data().get();
-        prepare_write_components(std::move(mr), estimated_partitions, std::move(schema), max_sstable_size);
-        write_summary();
-        write_filter();
-        write_statistics();
-        // NOTE: write_compression means maybe_write_compression.
-        write_compression();
+        prepare_write_components(*src, estimated_partitions, std::move(schema), max_sstable_size, pc);
+        // The remaining components don't depend on each other.
+        std::vector<std::function<void ()>> writers = {
+            [this, &pc] { write_summary(pc); },
+            [this, &pc] { write_filter(pc); },
+            [this, &pc] { write_statistics(pc); },
+            // NOTE: write_compression means maybe_write_compression.
+            [this, &pc] { write_compression(pc); },
+        };
+        parallel_for_each(writers, [] (std::function<void ()>& w) {
+            return seastar::async(w);
+        }).get();
         seal_sstable();
     });
 }
@@ -1377,6 +1721,68 @@ uint64_t sstable::data_size() {
     return _data_file_size;
 }
 
+// Sstables written before the bounds of clustering components were recorded
+// hold there the names of the columns of their cells instead, which are
+// either empty or name a column outside of the primary key.
+static bool has_clustering_bounds(const schema& s, const stats_metadata& stats) {
+    auto& min = stats.min_column_names.elements;
+    auto& max = stats.max_column_names.elements;
+    if (min.empty() || min.size() != max.size() || min.size() > s.clustering_key_size()) {
+        return false;
+    }
+    auto names_column = [&s] (const bytes& name) {
+        auto def = s.get_column_definition(name);
+        return name.empty() || (def && !def->is_primary_key());
+    };
+    if (names_column(min[0].value) || names_column(max[0].value)) {
+        return false;
+    }
+    auto& types = s.clustering_key_prefix_type()->types();
+    try {
+        for (size_t i = 0; i < min.size(); ++i) {
+            types[i]->validate(min[i].value);
+            types[i]->validate(max[i].value);
+        }
+    } catch (const marshal_exception&) {
+        return false;
+    }
+    return true;
+}
+
+static std::vector<bytes_view> prefix_components(const schema& s, const clustering_key_prefix& prefix) {
+    return std::vector<bytes_view>(prefix.begin(s), prefix.end(s));
+}
+
+bool sstable::may_contain_rows(const schema& s, const std::vector<query::clustering_range>& ranges) const {
+    auto& stats = get_stats_metadata();
+    if (!has_clustering_bounds(s, stats)) {
+        return true;
+    }
+    auto& min = stats.min_column_names.elements;
+    auto& max = stats.max_column_names.elements;
+    auto& types = s.clustering_key_prefix_type()->types();
+    return std::any_of(ranges.begin(), ranges.end(), [&] (const query::clustering_range& r) {
+        auto start = r.start() ? prefix_components(s, r.start()->value()) : std::vector<bytes_view>();
+        auto end = r.end() ? prefix_components(s, r.end()->value()) : std::vector<bytes_view>();
+        // Rows within the range share the components which its bounds
+        // share, and have the first component they differ in between them.
+        for (size_t i = 0; i < min.size(); ++i) {
+            bool has_start = i < start.size();
+            bool has_end = i < end.size();
+            if (has_end && types[i]->compare(end[i], min[i].value) < 0) {
+                return false;
+            }
+            if (has_start && types[i]->compare(start[i], max[i].value) > 0) {
+                return false;
+            }
+            if (!has_start || !has_end || types[i]->compare(start[i], end[i]) != 0) {
+                break;
+            }
+        }
+        return true;
+    });
+}
+
 future<uint64_t> sstable::bytes_on_disk() {
     if (_bytes_on_disk) {
         return make_ready_future<uint64_t>(_bytes_on_disk);
@@ -1427,13 +1833,17 @@ const sstring sstable::filename(sstring dir, sstring ks, sstring cf, version_typ
     return dir + "/" + strmap[version](entry_descriptor(ks, cf, version, generation, format, component));
 }
 
-future<> sstable::create_links(sstring dir) const {
+future<> sstable::link_components(sstring dir) const {
     return parallel_for_each(component_filenames(), [this, dir](sstring f) {
         auto sdir = get_dir();
         auto name = f.substr(sdir.size());
         auto dst = dir + name;
         return ::link_file(f, dst);
-    }).then([dir] {
+    });
+}
+
+future<> sstable::create_links(sstring dir) const {
+    return link_components(dir).then([dir] {
         // sync dir
         return ::open_directory(dir).then([](file df) {
             auto f = df.flush();
@@ -1489,21 +1899,40 @@ sstable::component_type sstable::component_from_sstring(sstring &s) {
     return reverse_map(s, _component_map);
 }
 
-input_stream<char> sstable::data_stream_at(uint64_t pos, uint64_t buf_size) {
+input_stream<char> sstable::data_stream_at(uint64_t pos, uint64_t buf_size, const io_priority_class& pc) {
     if (_compression) {
         return make_compressed_file_input_stream(
-                _data_file, &_compression, pos);
+                _data_file, &_compression, pos, pc, disk_queue());
     } else {
-        return make_file_input_stream(_data_file, pos, buf_size);
+        // Without read-ahead, so that the reads go through the I/O queue
+        // as they would with make_file_input_stream().
+        read_ahead_options options;
+        options.buffer_size = buf_size;
+        options.max_depth = 1;
+        return make_read_ahead_file_input_stream(_data_file, pos, data_size(), options, pc, disk_queue());
     }
 }
 
-// FIXME: to read a specific byte range, we shouldn't use the input stream
-// interface - it may cause too much read when we intend to read a small
-// range, and too small reads, and repeated waits, when reading a large range
-// which we should have started at once.
-future<temporary_buffer<char>> sstable::data_read(uint64_t pos, size_t len) {
-    return do_with(data_stream_at(pos), [len] (auto& stream) {
+input_stream<char> sstable::data_stream_at(uint64_t pos, uint64_t end, const read_ahead_options& options,
+        const io_priority_class& pc) {
+    if (_compression) {
+        return make_compressed_file_input_stream(
+                _data_file, &_compression, pos, end, options, pc, disk_queue());
+    } else {
+        return make_read_ahead_file_input_stream(_data_file, pos, end, options, pc, disk_queue());
+    }
+}
+
+future<temporary_buffer<char>> sstable::data_read(uint64_t pos, size_t len, const io_priority_class& pc) {
+    if (!_compression) {
+        return disk_queue().queue_request(pc, len, [file = _data_file, pos, len] () mutable {
+            return file.dma_read_exactly<char>(pos, len);
+        });
+    }
+    // FIXME: to read a specific byte range of a compressed file, we shouldn't
+    // use the input stream interface - it may cause too much read when we
+    // intend to read a small range.
+    return do_with(data_stream_at(pos, 8192, pc), [len] (auto& stream) {
         return stream.read_exactly(len);
     });
 }
@@ -1536,17 +1965,80 @@ dht::decorated_key sstable::get_last_decorated_key(const schema& s) const {
     return dht::global_partitioner().decorate_key(s, std::move(pk));
 }
 
+uint64_t sstable::estimated_keys_for_range(const query::range<dht::token>& range) const {
+    auto& entries = _summary.entries;
+    if (entries.empty()) {
+        return 0;
+    }
+    auto cmp = dht::token_comparator();
+    // The entries are sorted by token, so those of a non-wrapping range
+    // are a run of them.
+    auto count_in = [&] (const query::range<dht::token>& r) -> uint64_t {
+        auto token_of = [] (const summary_entry& e) {
+            return dht::global_partitioner().get_token(e.get_key());
+        };
+        auto first = std::partition_point(boost::counting_iterator<size_t>(0), boost::counting_iterator<size_t>(entries.size()), [&] (size_t i) {
+            return r.before(token_of(entries[i]), cmp);
+        });
+        auto last = std::partition_point(first, boost::counting_iterator<size_t>(entries.size()), [&] (size_t i) {
+            return !r.after(token_of(entries[i]), cmp);
+        });
+        return std::distance(first, last);
+    };
+    uint64_t n;
+    if (range.is_wrap_around(cmp)) {
+        auto unwrapped = range.unwrap();
+        n = count_in(unwrapped.first) + count_in(unwrapped.second);
+    } else {
+        n = count_in(range);
+    }
+    if (!n) {
+        // Between two entries, it still may have some.
+        auto& p = dht::global_partitioner();
+        query::range<dht::token> spanned({p.get_token(key_view(_summary.first_key.value))},
+                {p.get_token(key_view(_summary.last_key.value))});
+        return range.overlap(spanned, cmp);
+    }
+    // Each entry stands for the partitions up to the next one.
+    return n * get_estimated_key_count() / entries.size();
+}
+
+uint64_t sstable::estimated_mean_partition_size() const {
+    auto& sizes = get_stats_metadata().estimated_row_size;
+    return sizes.count() ? sizes.mean() : 0;
+}
+
 int sstable::compare_by_first_key(const schema& s, const sstable& other) const {
     return get_first_decorated_key(s).tri_compare(s, other.get_first_decorated_key(s));
 }
 
+double sstable::estimate_droppable_tombstone_ratio(gc_clock::time_point gc_before) const {
+    auto& st = get_stats_metadata();
+    auto cells = st.estimated_column_count.count();
+    if (!cells) {
+        return 0;
+    }
+    double estimated_cells = double(st.estimated_column_count.mean()) * cells;
+    if (estimated_cells <= 0) {
+        return 0;
+    }
+    return st.estimated_tombstone_drop_time.sum(gc_before.time_since_epoch().count()) / estimated_cells;
+}
+
 int sstable::compare_by_max_timestamp(const sstable& other) const {
     auto ts1 = get_stats_metadata().max_timestamp;
     auto ts2 = other.get_stats_metadata().max_timestamp;
     return (ts1 > ts2 ? 1 : (ts1 == ts2 ? 0 : -1));
 }
 
+uint64_t sstable::next_cache_id() {
+    static thread_local uint64_t next_id = 0;
+    return next_id++;
+}
+
 sstable::~sstable() {
+    global_key_cache().invalidate(_cache_id);
+    global_index_page_cache().invalidate(_cache_id);
     if (_index_file) {
         _index_file.close().handle_exception([save = _index_file] (auto ep) {
             sstlog.warn("sstable close index_file failed: {}", ep);
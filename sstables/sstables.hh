@@ -29,6 +29,7 @@
 #include "core/enum.hh"
 #include "core/shared_ptr.hh"
 #include "core/distributed.hh"
+#include "core/semaphore.hh"
 #include <unordered_set>
 #include <unordered_map>
 #include "types.hh"
@@ -45,6 +46,11 @@
 #include "filter.hh"
 #include "exceptions.hh"
 #include "mutation_reader.hh"
+#include "key_reader.hh"
+#include "index_page_cache.hh"
+#include "read_ahead.hh"
+#include "utils/io_queue.hh"
+#include "utils/mapped_file.hh"
 
 namespace sstables {
 
@@ -71,6 +77,8 @@ class data_consume_context {
     friend class sstable;
 public:
     future<> read();
+    // The bytes of the data range read so far.
+    uint64_t bytes_consumed() const;
     // Define (as defaults) the destructor and move operations in the source
     // file, so here we don't need to know the incomplete impl type.
     ~data_consume_context();
@@ -105,6 +113,61 @@ class mutation_reader {
     mutation_reader& operator=(mutation_reader&&);
 };
 
+struct write_options {
+    // Size of the blocks of the data file the rows of a partition are
+    // indexed by, in the promoted index of its Index.db entry. Partitions
+    // which fit in a single block get no promoted index.
+    size_t column_index_size = 64 * 1024;
+    // Most memtable data, in bytes of cells, copied out at a time when
+    // flushing a partition.
+    size_t flush_buffer_size = 1024 * 1024;
+    // Most writes in flight to each of the Data, Index, Filter and Summary
+    // files of an sstable being written.
+    unsigned write_behind = 4;
+};
+
+// Returns the options used by sstable writes on this shard.
+write_options& default_write_options();
+
+struct load_options {
+    // Test the bloom filter in place in a read-only mapping of Filter.db,
+    // rather than loading it into memory. Blocked filters are still loaded.
+    bool map_filter = false;
+    // Read the keys of the summary in place in a read-only mapping of
+    // Summary.db. The prefixes of their tokens are still computed when it is
+    // loaded, as they aren't stored in the file.
+    bool map_summary = false;
+};
+
+// Returns the options used by sstable loads on this shard.
+load_options& default_load_options();
+
+// Source of the partitions written into an sstable, which may hand each
+// partition out in pieces.
+//
+// next_partition() returns the next partition, with its tombstone, static
+// row, row tombstones and possibly some of its clustered rows, or a
+// disengaged optional at the end. next_rows() then returns the following
+// clustered rows of that partition, in clustering order, or a disengaged
+// optional once there are no more. Only one piece is alive at a time.
+class partition_source {
+public:
+    virtual ~partition_source() {}
+    virtual future<mutation_opt> next_partition() = 0;
+    virtual future<mutation_opt> next_rows() = 0;
+    // The bytes of sstable data read so far, for sources reading sstables.
+    virtual uint64_t bytes_read() const {
+        return 0;
+    }
+};
+
+// Merges the partitions of sources sorted by key, which may hold pieces of
+// the same partitions, into pieces holding the rows of each source up to
+// the last row of some source's piece. So no more than about a piece of
+// each source is in memory at a time.
+std::unique_ptr<partition_source> make_combined_partition_source(schema_ptr s,
+        std::vector<std::unique_ptr<partition_source>> sources);
+
 class key;
 
 using index_list = std::vector<index_entry>;
@@ -148,7 +211,15 @@ class sstable {
     // The function returns a future which completes after all the data has
     // been fed into the consumer. The caller needs to ensure the "consumer"
     // object lives until then (e.g., using the do_with() idiom).
-    future<> data_consume_rows_at_once(row_consumer& consumer, uint64_t pos, uint64_t end);
+    future<> data_consume_rows_at_once(row_consumer& consumer, uint64_t pos, uint64_t end,
+            const io_priority_class& pc = query_priority());
+
+    // Like data_consume_rows_at_once(), for a single partition of which only
+    // the given byte ranges are read. The first one starts with the partition,
+    // and all of them end on atom boundaries, short of the end of partition
+    // marker.
+    future<> data_consume_partition_pieces(row_consumer& consumer, std::vector<std::pair<uint64_t, uint64_t>> pieces,
+            const io_priority_class& pc = query_priority());
 
 
     // data_consume_rows() iterates over rows in the data file from
@@ -167,10 +238,17 @@ class sstable {
     // The caller must ensure (e.g., using do_with()) that the context object,
     // as well as the sstable, remains alive as long as a read() is in
     // progress (i.e., returned a future which hasn't completed yet).
-    data_consume_context data_consume_rows(row_consumer& consumer, uint64_t start, uint64_t end);
+    //
+    // Data is read ahead of the consumer as configured by options; see
+    // read_ahead_window. The reads are queued in the I/O priority class pc.
+    data_consume_context data_consume_rows(row_consumer& consumer, uint64_t start, uint64_t end,
+            const read_ahead_options& options = default_read_ahead_options(),
+            const io_priority_class& pc = query_priority());
 
     // Like data_consume_rows() with bounds, but iterates over whole range
-    data_consume_context data_consume_rows(row_consumer& consumer);
+    data_consume_context data_consume_rows(row_consumer& consumer,
+            const read_ahead_options& options = default_read_ahead_options(),
+            const io_priority_class& pc = query_priority());
 
     static component_type component_from_sstring(sstring& s);
     static version_types version_from_sstring(sstring& s);
@@ -183,6 +261,11 @@ class sstable {
                                                  version_types v, format_types f);
 
     future<> load();
+    // load() in two steps: the TOC and summary, which tell the partitions
+    // the sstable covers, and then the other components, so that an sstable
+    // of no use to this shard is not read further.
+    future<> load_summary();
+    future<> load_components();
     future<> open_data();
 
     void set_generation(unsigned long generation) {
@@ -192,7 +275,15 @@ class sstable {
         return _generation;
     }
 
+    uint64_t cache_id() const {
+        return _cache_id;
+    }
+
     future<mutation_opt> read_row(schema_ptr schema, const key& k);
+    // Reads the partition, or of a partition with a promoted index, only
+    // the blocks of it which may hold rows in the given clustering ranges,
+    // along with its first block, which holds its static row.
+    future<mutation_opt> read_row(schema_ptr schema, const key& k, const std::vector<query::clustering_range>& ranges);
     /**
      * @param schema a schema_ptr object describing this table
      * @param min the minimum token we want to search for (inclusive)
@@ -206,6 +297,12 @@ class sstable {
     // Returns a mutation_reader for given range of partitions
     mutation_reader read_range_rows(schema_ptr schema, const query::partition_range& range);
 
+    // Returns a key_reader of the keys of the partitions of the range, read
+    // from the index file alone. They are maybe dead if the sstable holds
+    // any tombstone or expiring cell. The sstable must be kept alive as long
+    // as the reader is.
+    key_reader read_range_keys(schema_ptr schema, const query::partition_range& range);
+
     // read_rows() returns each of the rows in the sstable, in sequence,
     // converted to a "mutation" data structure.
     // This function is implemented efficiently - doing buffered, sequential
@@ -219,16 +316,40 @@ class sstable {
     // progress (i.e., returned a future which hasn't completed yet).
     mutation_reader read_rows(schema_ptr schema);
 
-    // Write sstable components from a memtable.
-    future<> write_components(const memtable& mt);
+    // Like read_rows() and read_range_rows(), but hands each partition out
+    // in pieces of about max_piece_size bytes of cells, cut between
+    // clustered rows, so that no more than a piece of a wide partition is
+    // in memory at a time. The sstable must be kept alive likewise. They
+    // serve compaction and streaming, which pass their I/O priority class.
+    std::unique_ptr<partition_source> read_rows_in_pieces(schema_ptr schema, size_t max_piece_size,
+            const io_priority_class& pc = query_priority());
+    std::unique_ptr<partition_source> read_range_rows_in_pieces(schema_ptr schema,
+            const query::partition_range& range, size_t max_piece_size,
+            const io_priority_class& pc = query_priority());
+
+    // Write sstable components from a memtable. The writes are queued in
+    // the given I/O priority class.
+    future<> write_components(const memtable& mt, const io_priority_class& pc = memtable_flush_priority());
     future<> write_components(::mutation_reader mr,
-            uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size);
+            uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size,
+            const io_priority_class& pc = memtable_flush_priority());
+    future<> write_components(std::unique_ptr<partition_source> src,
+            uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size,
+            const io_priority_class& pc = memtable_flush_priority());
 
     uint64_t get_estimated_key_count() const {
         return ((uint64_t)_summary.header.size_at_full_sampling + 1) *
                 _summary.header.min_index_interval;
     }
 
+    // The estimated number of partitions of the sstable in the range,
+    // from the summary entries falling in it.
+    uint64_t estimated_keys_for_range(const query::range<dht::token>& range) const;
+
+    // The mean size of the partitions of the sstable in bytes, from its
+    // histogram of partition sizes.
+    uint64_t estimated_mean_partition_size() const;
+
     // mark_for_deletion() specifies that the on-disk files for this sstable
     // should be deleted as soon as the in-memory object is destructed.
     void mark_for_deletion() {
@@ -243,8 +364,27 @@ class sstable {
         _collector.add_ancestor(generation);
     }
 
+    // Sizes the filter of the sstable about to be written for the given
+    // false positive chance rather than the schema's bloom_filter_fp_chance.
+    void set_filter_fp_chance(double fp_chance) {
+        _filter_fp_chance = fp_chance;
+    }
+
+    // For Zstd compressed tables: the dictionary to compress the sstable
+    // about to be written with, and a trainer to feed its chunks to.
+    void set_compression_dictionary(bytes dictionary) {
+        _compression_dictionary = std::move(dictionary);
+    }
+    void set_dictionary_trainer(lw_shared_ptr<zstd_dictionary_trainer> trainer) {
+        _dictionary_trainer = std::move(trainer);
+    }
+    // The dictionary this sstable's chunks are compressed with, if any.
+    bytes_view get_compression_dictionary() const {
+        return _compression.dictionary();
+    }
+
     // Returns true iff this sstable contains data which belongs to many shards.
-    bool is_shared() {
+    bool is_shared() const {
         return _shared;
     }
 
@@ -264,6 +404,26 @@ class sstable {
         return _filter->memory_size();
     }
 
+    // Memory used by the entries of the summary, as resampled.
+    uint64_t summary_memory() const;
+    // Memory the summary uses at the sampling it was written with.
+    uint64_t full_summary_memory() const {
+        return _summary_downsampling == 1 ? summary_memory() : _full_summary_memory;
+    }
+    // Of the entries of Summary.db, the summary keeps one in every
+    // summary_downsampling().
+    unsigned summary_downsampling() const {
+        return _summary_downsampling;
+    }
+    // Returns the lookups through the summary since the last call.
+    uint64_t take_index_reads() {
+        return std::exchange(_index_reads, 0);
+    }
+    // Keeps one in every step of the entries of Summary.db in the summary,
+    // reading them from Summary.db again if needed. Waits for the lookups
+    // under way, and lookups wait for it.
+    future<> resample_summary(unsigned step);
+
     // Returns the total bytes of all components.
     future<uint64_t> bytes_on_disk();
 
@@ -281,12 +441,27 @@ class sstable {
     // Return values are those of a trichotomic comparison.
     int compare_by_max_timestamp(const sstable& other) const;
 
+    // Estimates the share of the cells of the sstable which are tombstones,
+    // or expired cells, that a compaction at gc_before could purge.
+    double estimate_droppable_tombstone_ratio(gc_clock::time_point gc_before) const;
+
+    // When the data file was last written, as told by its modification time,
+    // or when this object was created if it wasn't opened from disk.
+    gc_clock::time_point data_file_write_time() const {
+        return _data_file_write_time;
+    }
+
     const sstring get_filename() const {
         return filename(component_type::Data);
     }
     const sstring& get_dir() const {
         return _dir;
     }
+    // The queue of the disk I/O of the sstable, that of its data directory
+    // if it has one of its own.
+    io_queue& disk_queue() const {
+        return local_io_queue(_dir);
+    }
     sstring toc_filename() const;
 
     metadata_collector& get_metadata_collector() {
@@ -294,6 +469,8 @@ class sstable {
     }
 
     future<> create_links(sstring dir) const;
+    // Links the components into dir, leaving it to the caller to sync it.
+    future<> link_components(sstring dir) const;
 
     /**
      * Note. This is using the Origin definition of
@@ -319,10 +496,13 @@ class sstable {
 
     size_t sstable_buffer_size = 128*1024;
 
-    void do_write_components(::mutation_reader mr,
-            uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, file_writer& out);
-    void prepare_write_components(::mutation_reader mr,
-            uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size);
+    future<> write_partitions(std::unique_ptr<partition_source> src,
+            uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, const io_priority_class& pc);
+    void do_write_components(partition_source& src,
+            uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, file_writer& out,
+            const io_priority_class& pc);
+    void prepare_write_components(partition_source& src,
+            uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, const io_priority_class& pc);
     static future<> shared_remove_by_toc_name(sstring toc_name, bool shared);
     static std::unordered_map<version_types, sstring, enum_hash<version_types>> _version_string;
     static std::unordered_map<format_types, sstring, enum_hash<format_types>> _format_string;
@@ -343,6 +523,7 @@ class sstable {
     file _index_file;
     file _data_file;
     uint64_t _data_file_size;
+    gc_clock::time_point _data_file_write_time = gc_clock::now();
     uint64_t _index_file_size;
     uint64_t _filter_file_size = 0;
     uint64_t _bytes_on_disk = 0;
@@ -355,48 +536,90 @@ class sstable {
     format_types _format;
 
     filter_tracker _filter_tracker;
+    // When set, used instead of the schema's bloom_filter_fp_chance for the
+    // filter of the sstable being written.
+    std::experimental::optional<double> _filter_fp_chance;
+    bytes _compression_dictionary;
+    lw_shared_ptr<zstd_dictionary_trainer> _dictionary_trainer;
 
     bool _marked_for_deletion = false;
 
     gc_clock::time_point _now;
 
+    // Identifies this sstable in the shard's key_cache and index_page_cache.
+    uint64_t _cache_id = next_cache_id();
+    static uint64_t next_cache_id();
+
+    static constexpr size_t summary_lock_units = std::numeric_limits<int32_t>::max();
+    // A lookup through the summary holds one unit, a resampling all.
+    semaphore _summary_lock{summary_lock_units};
+    unsigned _summary_downsampling = 1;
+    uint64_t _full_summary_memory = 0;
+    uint64_t _index_reads = 0;
+
     const bool has_component(component_type f) const;
 
+    double filter_fp_chance(const schema& s) const {
+        return _filter_fp_chance ? *_filter_fp_chance : s.bloom_filter_fp_chance();
+    }
+
     const sstring filename(component_type f) const;
 
     template <sstable::component_type Type, typename T>
     future<> read_simple(T& comp);
 
     template <sstable::component_type Type, typename T>
-    void write_simple(T& comp);
+    void write_simple(T& comp, const io_priority_class& pc);
 
     future<> read_toc();
     void generate_toc(compressor c, double filter_fp_chance);
-    void write_toc();
+    void write_toc(const io_priority_class& pc = memtable_flush_priority());
     void seal_sstable();
 
     future<> read_compression();
-    void write_compression();
+    void write_compression(const io_priority_class& pc = memtable_flush_priority());
 
     future<> read_filter();
+    future<> load_filter();
 
-    void write_filter();
+    void write_filter(const io_priority_class& pc = memtable_flush_priority());
 
-    future<> read_summary() {
-        return read_simple<component_type::Summary>(_summary);
-    }
-    void write_summary() {
-        write_simple<component_type::Summary>(_summary);
+    // A read-only mapping of the component.
+    lw_shared_ptr<utils::mapped_file> map_component(component_type);
+
+    future<> read_summary();
+    future<> map_filter();
+    future<> map_summary();
+    void write_summary(const io_priority_class& pc = memtable_flush_priority()) {
+        write_simple<component_type::Summary>(_summary, pc);
     }
 
     future<> read_statistics();
-    void write_statistics();
+    void write_statistics(const io_priority_class& pc = memtable_flush_priority());
 
     future<> create_data();
 
     future<index_list> read_indexes(uint64_t summary_idx);
 
-    input_stream<char> data_stream_at(uint64_t pos, uint64_t buf_size = 8192);
+    // Invokes func, synchronously, with a view of the parsed index page of
+    // the given summary interval, reading it into the index_page_cache
+    // first if needed. Returns a future of func's result.
+    template <typename Func>
+    future<std::result_of_t<Func(const index_page_view&)>> with_index_page(uint64_t summary_idx, Func&& func);
+
+    // Counts a lookup through the summary, and runs it with the summary
+    // locked against resampling.
+    template <typename Func>
+    futurize_t<std::result_of_t<Func()>> with_summary(Func&& func) {
+        ++_index_reads;
+        return with_semaphore(_summary_lock, 1, std::forward<Func>(func));
+    }
+
+    input_stream<char> data_stream_at(uint64_t pos, uint64_t buf_size = 8192,
+            const io_priority_class& pc = query_priority());
+    // Stream of the data file from pos to end, read ahead as configured.
+    input_stream<char> data_stream_at(uint64_t pos, uint64_t end, const read_ahead_options& options,
+            const io_priority_class& pc);
 
     // Read exactly the specific byte range from the data file (after
     // uncompression, if the file is compressed). This can be used to read
@@ -404,9 +627,7 @@ class sstable {
     // determined using the index file).
     // This function is intended (and optimized for) random access, not
     // for iteration through all the rows.
-    future<temporary_buffer<char>> data_read(uint64_t pos, size_t len);
-
-    future<uint64_t> data_end_position(uint64_t summary_idx, uint64_t index_idx, const index_list& il);
+    future<temporary_buffer<char>> data_read(uint64_t pos, size_t len, const io_priority_class& pc = query_priority());
 
     // Returns data file position for an entry right after all entries mapped by given summary page.
     future<uint64_t> data_end_position(uint64_t summary_idx);
@@ -433,10 +654,12 @@ class sstable {
     // The ring_position doesn't have to survive deferring.
     future<uint64_t> upper_bound(schema_ptr, const dht::ring_position&);
 
-    future<summary_entry&> read_summary_entry(size_t i);
+    // Returns the positions in the data file of the first partition of the
+    // range, and of the first one following it.
+    std::pair<future<uint64_t>, future<uint64_t>> data_positions(schema_ptr, const query::partition_range& range);
+
+    future<summary_entry> read_summary_entry(size_t i);
 
-    // FIXME: pending on Bloom filter implementation
-    bool filter_has_key(const key& key) { return _filter->is_present(bytes_view(key)); }
     bool filter_has_key(const schema& s, const dht::decorated_key& dk) { return filter_has_key(key::from_partition_key(s, dk._key)); }
 
     // NOTE: functions used to generate sstable components.
@@ -449,16 +672,20 @@ class sstable {
     void write_range_tombstone(file_writer& out, const composite& clustering_prefix, std::vector<bytes_view> suffix, const tombstone t);
     void write_collection(file_writer& out, const composite& clustering_key, const column_definition& cdef, collection_mutation::view collection);
 public:
+    bool filter_has_key(const key& key) { return _filter->is_present(bytes_view(key)); }
     bool filter_has_key(const schema& s, const partition_key& key) {
         return filter_has_key(key::from_partition_key(s, key));
     }
 
-    uint64_t filter_get_false_positive() {
+    uint64_t filter_get_false_positive() const {
         return _filter_tracker.false_positive;
     }
-    uint64_t filter_get_true_positive() {
+    uint64_t filter_get_true_positive() const {
         return _filter_tracker.true_positive;
     }
+    uint64_t filter_get_true_negative() const {
+        return _filter_tracker.true_negative;
+    }
     uint64_t filter_get_recent_false_positive() {
         auto t = _filter_tracker.false_positive - _filter_tracker.last_false_positive;
         _filter_tracker.last_false_positive = _filter_tracker.false_positive;
@@ -482,6 +709,19 @@ class sstable {
         const stats_metadata& s = *static_cast<stats_metadata *>(p.get());
         return s;
     }
+    // Whether the sstable may hold tombstones or expiring cells, as told by
+    // its tombstone histogram. Sstables written before expiring cells were
+    // counted in it tell of them only when they hold no cell that never
+    // expires.
+    bool may_hold_dead_data() const {
+        auto entry = _statistics.contents.find(metadata_type::Stats);
+        if (entry == _statistics.contents.end() || !entry->second) {
+            return true;
+        }
+        auto& stats = *static_cast<stats_metadata*>(entry->second.get());
+        return !stats.estimated_tombstone_drop_time.bin.map.empty()
+                || stats.max_local_deletion_time != uint32_t(std::numeric_limits<int32_t>::max());
+    }
     const compaction_metadata& get_compaction_metadata() const {
         auto entry = _statistics.contents.find(metadata_type::Compaction);
         if (entry == _statistics.contents.end()) {
@@ -499,10 +739,16 @@ class sstable {
         return get_stats_metadata().sstable_level;
     }
 
+    // Returns false when none of the rows and range tombstones of the
+    // sstable can fall in the clustering ranges, as told by the bounds of
+    // each clustering component recorded in its statistics.
+    bool may_contain_rows(const schema& s, const std::vector<query::clustering_range>& ranges) const;
+
     // Allow the test cases from sstable_test.cc to test private methods. We use
     // a placeholder to avoid cluttering this class too much. The sstable_test class
     // will then re-export as public every method it needs.
     friend class test;
+    friend class sstable_key_reader;
 };
 
 using shared_sstable = lw_shared_ptr<sstable>;
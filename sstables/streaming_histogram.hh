@@ -145,43 +145,46 @@ struct streaming_histogram {
     template <typename Describer>
     auto describe_type(Describer f) { return f(max_bin_size, bin); }
 
-    // FIXME: convert Java code below.
-#if 0
     /**
      * Calculates estimated number of points in interval [-inf,b].
      *
      * @param b upper bound of a interval to calculate sum
      * @return estimated number of points in a interval [-inf,b].
      */
-    public double sum(double b)
-    {
-        double sum = 0;
-        // find the points pi, pnext which satisfy pi <= b < pnext
-        Map.Entry<Double, Long> pnext = bin.higherEntry(b);
-        if (pnext == null)
-        {
+    double sum(double b) const {
+        // The bins aren't sorted, so find the points pi, pnext which
+        // satisfy pi <= b < pnext in one pass, adding up the values of the
+        // points below b on the way.
+        const std::pair<const double, uint64_t>* pi = nullptr;
+        const std::pair<const double, uint64_t>* pnext = nullptr;
+        double below = 0;
+        for (auto& e : bin.map) {
+            if (e.first <= b) {
+                below += e.second;
+                if (!pi || e.first > pi->first) {
+                    pi = &e;
+                }
+            } else if (!pnext || e.first < pnext->first) {
+                pnext = &e;
+            }
+        }
+        if (!pnext) {
             // if b is greater than any key in this histogram,
             // just count all appearance and return
-            for (Long value : bin.values())
-                sum += value;
+            return below;
         }
-        else
-        {
-            Map.Entry<Double, Long> pi = bin.floorEntry(b);
-            if (pi == null)
-                return 0;
-            // calculate estimated count mb for point b
-            double weight = (b - pi.getKey()) / (pnext.getKey() - pi.getKey());
-            double mb = pi.getValue() + (pnext.getValue() - pi.getValue()) * weight;
-            sum += (pi.getValue() + mb) * weight / 2;
-
-            sum += pi.getValue() / 2.0;
-            for (Long value : bin.headMap(pi.getKey(), false).values())
-                sum += value;
+        if (!pi) {
+            return 0;
         }
-        return sum;
+        // calculate estimated count mb for point b
+        double weight = (b - pi->first) / (pnext->first - pi->first);
+        double mb = pi->second + (double(pnext->second) - pi->second) * weight;
+        // below counts all of pi, of which only half is left of its point.
+        return below - pi->second / 2.0 + (pi->second + mb) * weight / 2;
     }
 
+    // FIXME: convert Java code below.
+#if 0
     public Map<Double, Long> getAsMap()
     {
         return Collections.unmodifiableMap(bin);
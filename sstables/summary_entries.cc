@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+
+#include "summary_entries.hh"
+#include "dht/i_partitioner.hh"
+
+namespace sstables {
+
+constexpr size_t summary_entries::min_chunk_size;
+constexpr size_t summary_entries::max_chunk_size;
+
+int8_t* summary_entries::allocate_key(size_t size, uint32_t& chunk, uint32_t& offset) {
+    if (_chunks.empty() || _chunks.back().size() - _last_chunk_used < size) {
+        // Each chunk is twice the size of the previous one, so that small
+        // summaries don't waste much and large ones take few chunks.
+        auto chunk_size = _chunks.empty() ? min_chunk_size : std::min(_chunks.back().size() * 2, max_chunk_size);
+        if (_keys_to_add) {
+            chunk_size = std::min(_keys_to_add, max_chunk_size);
+        }
+        _chunks.emplace_back(bytes::initialized_later(), std::max(chunk_size, size));
+        _last_chunk_used = 0;
+    }
+    chunk = _chunks.size() - 1;
+    offset = _last_chunk_used;
+    _last_chunk_used += size;
+    _keys_to_add -= std::min(_keys_to_add, size);
+    return _chunks.back().begin() + offset;
+}
+
+void summary_entries::push_back(bytes_view key, uint64_t position) {
+    auto token = dht::global_partitioner().get_token(key_view(key));
+    push_back(summary_entry{key, position, dht::token_prefix(token)});
+}
+
+void summary_entries::push_back(const summary_entry& e) {
+    entry_header h;
+    h.token_prefix = e.token_prefix;
+    h.position = e.position;
+    h.key_size = e.key.size();
+    auto key = allocate_key(e.key.size(), h.chunk, h.key_offset);
+    std::copy(e.key.begin(), e.key.end(), key);
+    _headers.push_back(h);
+}
+
+void summary_entries::push_back_mapped(lw_shared_ptr<utils::mapped_file> mapping, bytes_view key, uint64_t position) {
+    assert(!_mapping || _mapping == mapping);
+    _mapping = std::move(mapping);
+    entry_header h;
+    h.token_prefix = dht::token_prefix(dht::global_partitioner().get_token(key_view(key)));
+    h.position = position;
+    h.chunk = mapped_chunk;
+    h.key_offset = reinterpret_cast<const char*>(key.data()) - _mapping->data();
+    h.key_size = key.size();
+    _headers.push_back(h);
+}
+
+void summary_entries::clear() {
+    _headers.clear();
+    _chunks.clear();
+    _mapping = {};
+    _last_chunk_used = 0;
+    _keys_to_add = 0;
+}
+
+size_t summary_entries::memory_usage() const {
+    size_t size = _headers.size() * sizeof(entry_header);
+    for (auto&& c : _chunks) {
+        size += c.size();
+    }
+    return size;
+}
+
+bool summary_entries::operator==(const summary_entries& x) const {
+    if (size() != x.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < size(); ++i) {
+        if (!((*this)[i] == x[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
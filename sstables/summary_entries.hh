@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <deque>
+#include <limits>
+#include <vector>
+#include "bytes.hh"
+#include "key.hh"
+#include "core/shared_ptr.hh"
+#include "utils/mapped_file.hh"
+
+namespace sstables {
+
+// An entry of a summary, as a view into its summary_entries.
+struct summary_entry {
+    bytes_view key;
+    uint64_t position;
+    // dht::token_prefix() of the token of the key, so that entries can
+    // mostly be ordered without hashing their keys.
+    uint64_t token_prefix;
+
+    key_view get_key() const {
+        return { key };
+    }
+
+    bool operator==(const summary_entry& x) const {
+        return position == x.position && key == x.key;
+    }
+};
+
+// The entries of a summary, laid out so that they take a few allocations
+// rather than one for each key: the keys back to back in chunks of up to
+// max_chunk_size, and for each entry a fixed-size header with the prefix of
+// its token, its position in Index.db and where its key is. Provides the
+// size()/operator[]/get_key() interface expected by
+// sstable::binary_search().
+class summary_entries {
+    static constexpr size_t min_chunk_size = 1024;
+    static constexpr size_t max_chunk_size = 128 * 1024;
+    // Of the keys read in place in the mapping of Summary.db, at their
+    // offsets in it.
+    static constexpr uint32_t mapped_chunk = std::numeric_limits<uint32_t>::max();
+
+    struct entry_header {
+        uint64_t token_prefix;
+        uint64_t position;
+        uint32_t chunk;
+        uint32_t key_offset;
+        uint32_t key_size;
+    } __attribute__((packed));
+
+    // Can be large, so a deque instead of a vector.
+    std::deque<entry_header> _headers;
+    // A key never spans chunks. Only the last one has room left.
+    std::vector<bytes> _chunks;
+    size_t _last_chunk_used = 0;
+    // Of the keys to be added, when known.
+    size_t _keys_to_add = 0;
+    lw_shared_ptr<utils::mapped_file> _mapping;
+private:
+    int8_t* allocate_key(size_t size, uint32_t& chunk, uint32_t& offset);
+    const int8_t* key_data(const entry_header& h) const {
+        if (h.chunk == mapped_chunk) {
+            return reinterpret_cast<const int8_t*>(_mapping->data()) + h.key_offset;
+        }
+        return _chunks[h.chunk].begin() + h.key_offset;
+    }
+public:
+    size_t size() const {
+        return _headers.size();
+    }
+
+    bool empty() const {
+        return _headers.empty();
+    }
+
+    summary_entry operator[](size_t i) const {
+        auto& h = _headers[i];
+        return { bytes_view(key_data(h), h.key_size), h.position, h.token_prefix };
+    }
+
+    summary_entry front() const {
+        return (*this)[0];
+    }
+
+    summary_entry back() const {
+        return (*this)[size() - 1];
+    }
+
+    // Of the keys of the entries to be added, so that they are allocated
+    // with no room to spare.
+    void reserve_keys(size_t size) {
+        _keys_to_add = size;
+    }
+
+    // Computes the prefix of the token of the key.
+    void push_back(bytes_view key, uint64_t position);
+    // Of another summary_entries.
+    void push_back(const summary_entry& e);
+    // Of a key in the mapping, which isn't copied. All such entries are of
+    // the same mapping.
+    void push_back_mapped(lw_shared_ptr<utils::mapped_file> mapping, bytes_view key, uint64_t position);
+
+    void clear();
+
+    // Of the heap: mapped keys take none.
+    size_t memory_usage() const;
+
+    bool operator==(const summary_entries& x) const;
+};
+
+}
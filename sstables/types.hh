@@ -30,6 +30,7 @@
 #include "estimated_histogram.hh"
 #include "column_name_helper.hh"
 #include "sstables/key.hh"
+#include "sstables/summary_entries.hh"
 #include "db/commitlog/replay_position.hh"
 #include <vector>
 #include <unordered_map>
@@ -75,24 +76,15 @@ class index_entry {
         return _position;
     }
 
+    bytes_view get_promoted_index_bytes() const {
+        return bytes_view(reinterpret_cast<const bytes::value_type *>(_promoted_index.get()), _promoted_index.size());
+    }
+
     index_entry(temporary_buffer<char>&& key, uint64_t position, temporary_buffer<char>&& promoted_index)
         : _key(std::move(key)), _position(position), _promoted_index(std::move(promoted_index)) {}
 
 };
 
-struct summary_entry {
-    bytes key;
-    uint64_t position;
-
-    key_view get_key() const {
-        return { key };
-    }
-
-    bool operator==(const summary_entry& x) const {
-        return position ==  x.position && key == x.key;
-    }
-};
-
 // Note: Sampling level is present in versions ka and higher. We ATM only support ka,
 // so it's always there. But we need to make this conditional if we ever want to support
 // other formats.
@@ -118,7 +110,7 @@ struct summary_ka {
     // not the file. The memory stream effectively begins after the header,
     // so every position here has to be added of sizeof(header).
     std::deque<uint32_t> positions;   // can be large, so use a deque instead of a vector
-    std::deque<summary_entry> entries;
+    summary_entries entries;
 
     disk_string<uint32_t> first_key;
     disk_string<uint32_t> last_key;
@@ -23,17 +23,116 @@
 
 #include "core/iostream.hh"
 #include "core/fstream.hh"
+#include "core/semaphore.hh"
+#include "core/align.hh"
 #include "types.hh"
 #include "compress.hh"
+#include "utils/io_queue.hh"
 
 namespace sstables {
 
+// Writes a file through DMA with up to write_behind writes in flight, so
+// that writing a component isn't bound by the latency of each write. Only
+// the last buffer may fall short of the DMA alignment; it is padded, and
+// the file truncated back to its size on close. Writes are queued in the
+// given I/O priority class of the given queue.
+class write_behind_file_data_sink_impl : public data_sink_impl {
+    static constexpr size_t alignment = 4096;
+    file _file;
+    io_priority_class _pc;
+    io_queue* _queue;
+    uint64_t _pos = 0;
+    unsigned _write_behind;
+    semaphore _slots;
+    std::exception_ptr _error;
+private:
+    future<> write(uint64_t pos, temporary_buffer<char> buf) {
+        auto written = make_lw_shared<size_t>(0);
+        auto p = buf.get();
+        auto size = buf.size();
+        return repeat([this, pos, p, size, written] {
+            return _queue->queue_request(_pc, size - *written, [this, pos, p, size, written] {
+                return _file.dma_write(pos + *written, p + *written, size - *written);
+            }).then([size, written] (size_t bytes) {
+                // A short write ends on the alignment; the rest is retried.
+                *written = align_down(*written + bytes, alignment);
+                return *written >= size ? stop_iteration::yes : stop_iteration::no;
+            });
+        }).finally([buf = std::move(buf)] {});
+    }
+public:
+    write_behind_file_data_sink_impl(file f, unsigned write_behind, const io_priority_class& pc, io_queue& queue)
+        : _file(std::move(f))
+        , _pc(pc)
+        , _queue(&queue)
+        , _write_behind(std::max(write_behind, 1U))
+        , _slots(_write_behind)
+    { }
+
+    virtual temporary_buffer<char> allocate_buffer(size_t size) override {
+        return temporary_buffer<char>::aligned(alignment, align_up(size, alignment));
+    }
+
+    future<> put(net::packet data) { abort(); }
+    virtual future<> put(temporary_buffer<char> buf) override {
+        if (_error) {
+            return make_exception_future<>(_error);
+        }
+        if (_pos % alignment) {
+            return make_exception_future<>(std::runtime_error("write after the end of a write-behind file"));
+        }
+        auto pos = _pos;
+        _pos += buf.size();
+        if (reinterpret_cast<uintptr_t>(buf.get()) % alignment || buf.size() % alignment) {
+            auto aligned = temporary_buffer<char>::aligned(alignment, align_up(buf.size(), alignment));
+            std::fill(std::copy(buf.get(), buf.get() + buf.size(), aligned.get_write()), aligned.get_write() + aligned.size(), 0);
+            buf = std::move(aligned);
+        }
+        return _slots.wait().then([this, pos, buf = std::move(buf)] () mutable {
+            // The write goes on in the background, holding its slot.
+            write(pos, std::move(buf)).handle_exception([this] (std::exception_ptr ep) {
+                _error = ep;
+            }).finally([this] {
+                _slots.signal();
+            });
+        });
+    }
+
+    virtual future<> close() override {
+        return _slots.wait(_write_behind).then([this] {
+            if (_error) {
+                return make_exception_future<>(_error);
+            }
+            return _file.truncate(_pos);
+        }).then([this] {
+            return _file.flush();
+        }).finally([this] {
+            return _file.close();
+        });
+    }
+};
+
+class write_behind_file_data_sink : public data_sink {
+public:
+    write_behind_file_data_sink(file f, unsigned write_behind, const io_priority_class& pc, io_queue& queue)
+        : data_sink(std::make_unique<write_behind_file_data_sink_impl>(std::move(f), write_behind, pc, queue)) {}
+};
+
+inline
+output_stream<char> make_write_behind_file_output_stream(file f, size_t buffer_size, unsigned write_behind,
+        const io_priority_class& pc, io_queue& queue = local_io_queue()) {
+    // Each buffer but the last must fill whole DMA blocks.
+    buffer_size = align_up(buffer_size, size_t(4096));
+    return output_stream<char>(write_behind_file_data_sink(std::move(f), write_behind, pc, queue), buffer_size, true);
+}
+
 class file_writer {
     output_stream<char> _out;
     size_t _offset = 0;
 public:
-    file_writer(file f, size_t buffer_size = 8192)
-        : _out(make_file_output_stream(std::move(f), buffer_size)) {}
+    file_writer(file f, const io_priority_class& pc, size_t buffer_size = 8192, unsigned write_behind = 1,
+            io_queue& queue = local_io_queue())
+        : _out(make_write_behind_file_output_stream(std::move(f), buffer_size, write_behind, pc, queue)) {}
 
     file_writer(output_stream<char>&& out)
         : _out(std::move(out)) {}
@@ -60,14 +159,15 @@ class file_writer {
     }
 };
 
-output_stream<char> make_checksummed_file_output_stream(file f, size_t buffer_size, struct checksum& cinfo, uint32_t& full_file_checksum, bool checksum_file);
+output_stream<char> make_checksummed_file_output_stream(file f, size_t buffer_size, unsigned write_behind, struct checksum& cinfo, uint32_t& full_file_checksum, bool checksum_file, const io_priority_class& pc, io_queue& queue);
 
 class checksummed_file_writer : public file_writer {
     checksum _c;
     uint32_t _full_checksum;
 public:
-    checksummed_file_writer(file f, size_t buffer_size = 8192, bool checksum_file = false)
-            : file_writer(make_checksummed_file_output_stream(std::move(f), buffer_size, _c, _full_checksum, checksum_file))
+    checksummed_file_writer(file f, const io_priority_class& pc, size_t buffer_size = 8192, bool checksum_file = false, unsigned write_behind = 1,
+            io_queue& queue = local_io_queue())
+            : file_writer(make_checksummed_file_output_stream(std::move(f), buffer_size, write_behind, _c, _full_checksum, checksum_file, pc, queue))
             , _c({uint32_t(std::min(size_t(DEFAULT_CHUNK_SIZE), buffer_size))})
             , _full_checksum(init_checksum_adler32()) {}
 
@@ -91,8 +191,8 @@ class checksummed_file_data_sink_impl : public data_sink_impl {
     uint32_t& _full_checksum;
     bool _checksum_file;
 public:
-    checksummed_file_data_sink_impl(file f, size_t buffer_size, struct checksum& c, uint32_t& full_file_checksum, bool checksum_file)
-            : _out(make_file_output_stream(std::move(f), buffer_size))
+    checksummed_file_data_sink_impl(file f, size_t buffer_size, unsigned write_behind, struct checksum& c, uint32_t& full_file_checksum, bool checksum_file, const io_priority_class& pc, io_queue& queue)
+            : _out(make_write_behind_file_output_stream(std::move(f), buffer_size, write_behind, pc, queue))
             , _c(c)
             , _full_checksum(full_file_checksum)
             , _checksum_file(checksum_file)
@@ -127,13 +227,13 @@ class checksummed_file_data_sink_impl : public data_sink_impl {
 
 class checksummed_file_data_sink : public data_sink {
 public:
-    checksummed_file_data_sink(file f, size_t buffer_size, struct checksum& cinfo, uint32_t& full_file_checksum, bool checksum_file)
-        : data_sink(std::make_unique<checksummed_file_data_sink_impl>(std::move(f), buffer_size, cinfo, full_file_checksum, checksum_file)) {}
+    checksummed_file_data_sink(file f, size_t buffer_size, unsigned write_behind, struct checksum& cinfo, uint32_t& full_file_checksum, bool checksum_file, const io_priority_class& pc, io_queue& queue)
+        : data_sink(std::make_unique<checksummed_file_data_sink_impl>(std::move(f), buffer_size, write_behind, cinfo, full_file_checksum, checksum_file, pc, queue)) {}
 };
 
 inline
-output_stream<char> make_checksummed_file_output_stream(file f, size_t buffer_size, struct checksum& cinfo, uint32_t& full_file_checksum, bool checksum_file) {
-    return output_stream<char>(checksummed_file_data_sink(std::move(f), buffer_size, cinfo, full_file_checksum, checksum_file), buffer_size, true);
+output_stream<char> make_checksummed_file_output_stream(file f, size_t buffer_size, unsigned write_behind, struct checksum& cinfo, uint32_t& full_file_checksum, bool checksum_file, const io_priority_class& pc, io_queue& queue) {
+    return output_stream<char>(checksummed_file_data_sink(std::move(f), buffer_size, write_behind, cinfo, full_file_checksum, checksum_file, pc, queue), buffer_size, true);
 }
 
 // compressed_file_data_sink_impl works as a filter for a file output stream,
@@ -144,12 +244,14 @@ class compressed_file_data_sink_impl : public data_sink_impl {
     sstables::compression* _compression_metadata;
     size_t _pos = 0;
 public:
-    compressed_file_data_sink_impl(file f, sstables::compression* cm, file_output_stream_options options)
-            : _out(make_file_output_stream(std::move(f), options))
+    compressed_file_data_sink_impl(file f, sstables::compression* cm, size_t buffer_size, unsigned write_behind,
+            const io_priority_class& pc, io_queue& queue)
+            : _out(make_write_behind_file_output_stream(std::move(f), buffer_size, write_behind, pc, queue))
             , _compression_metadata(cm) {}
 
     future<> put(net::packet data) { abort(); }
     virtual future<> put(temporary_buffer<char> buf) override {
+        _compression_metadata->add_chunk_sample(buf.get(), buf.size());
         auto output_len = _compression_metadata->compress_max_size(buf.size());
         // account space for checksum that goes after compressed data.
         temporary_buffer<char> compressed(output_len + 4);
@@ -186,17 +288,20 @@ class compressed_file_data_sink_impl : public data_sink_impl {
 
 class compressed_file_data_sink : public data_sink {
 public:
-    compressed_file_data_sink(file f, sstables::compression* cm, file_output_stream_options options)
+    compressed_file_data_sink(file f, sstables::compression* cm, size_t buffer_size, unsigned write_behind,
+            const io_priority_class& pc, io_queue& queue)
         : data_sink(std::make_unique<compressed_file_data_sink_impl>(
-                std::move(f), cm, options)) {}
+                std::move(f), cm, buffer_size, write_behind, pc, queue)) {}
 };
 
-static inline output_stream<char> make_compressed_file_output_stream(file f, sstables::compression* cm) {
-    file_output_stream_options options;
+// Compressed chunks are written out in buffers of buffer_size.
+static inline output_stream<char> make_compressed_file_output_stream(file f, sstables::compression* cm,
+        const io_priority_class& pc, size_t buffer_size = 8192, unsigned write_behind = 1,
+        io_queue& queue = local_io_queue()) {
     // buffer of output stream is set to chunk length, because flush must
     // happen every time a chunk was filled up.
-    options.buffer_size = cm->uncompressed_chunk_length();
-    return output_stream<char>(compressed_file_data_sink(std::move(f), cm, options), options.buffer_size, true);
+    auto chunk_length = cm->uncompressed_chunk_length();
+    return output_stream<char>(compressed_file_data_sink(std::move(f), cm, buffer_size, write_behind, pc, queue), chunk_length, true);
 }
 
 }
@@ -61,6 +61,7 @@ class outgoing_file_message : public stream_message {
     file_message_header header;
     stream_detail detail;
 
+    // The batches of mutations sent, and those acknowledged.
     size_t mutations_nr{0};
     semaphore mutations_done{0};
 
@@ -54,6 +54,12 @@ void prepare_message::serialize(bytes::iterator& out) const {
     for (auto& x : summaries) {
         x.serialize(out);
     }
+
+    // The sstable_files flags of the requests come last, where nodes not
+    // knowing them ignore them.
+    for (auto& x : requests) {
+        serialize_bool(out, x.sstable_files);
+    }
 }
 
 prepare_message prepare_message::deserialize(bytes_view& v) {
@@ -71,6 +77,13 @@ prepare_message prepare_message::deserialize(bytes_view& v) {
         summaries_.push_back(std::move(s));
     }
 
+    // Absent from the messages of nodes not knowing them.
+    if (!v.empty()) {
+        for (auto& r : requests_) {
+            r.sstable_files = read_simple<bool>(v);
+        }
+    }
+
     return prepare_message(std::move(requests_), std::move(summaries_));
 }
 
@@ -84,6 +97,8 @@ size_t prepare_message::serialized_size() const {
     for (auto& x : summaries) {
         size += x.serialized_size();
     }
+
+    size += requests.size() * serialize_bool_size;
     return size;
 }
 
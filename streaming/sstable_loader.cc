@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "streaming/sstable_loader.hh"
+#include "streaming/stream_plan.hh"
+#include "streaming/stream_state.hh"
+#include "streaming/stream_transfer_task.hh"
+#include "service/storage_service.hh"
+#include "database.hh"
+#include "lister.hh"
+#include "log.hh"
+
+namespace streaming {
+
+extern logging::logger sslog;
+
+// The sstables in dir, as of the schema of the column family they are
+// loaded into. Unlike column_family::probe_file(), doesn't add them to it.
+static future<std::vector<sstables::shared_sstable>> load_sstables(schema_ptr s, sstring dir) {
+    auto sstables = make_lw_shared<std::vector<sstables::shared_sstable>>();
+    return lister::scan_dir(dir, directory_entry_type::regular, [s, dir, sstables] (directory_entry de) {
+        auto desc = sstables::entry_descriptor::make_descriptor(de.name);
+        if (desc.component != sstables::sstable::component_type::TOC) {
+            return make_ready_future<>();
+        }
+        auto sst = make_lw_shared<sstables::sstable>(s->ks_name(), s->cf_name(), dir, desc.generation, desc.version, desc.format);
+        return sst->load().then([sstables, sst] {
+            sstables->push_back(sst);
+        });
+    }).then([sstables] {
+        return std::move(*sstables);
+    });
+}
+
+future<> load_and_stream(distributed<database>& db, sstring ks_name, sstring cf_name, sstring dir) {
+    auto s = db.local().find_column_family(ks_name, cf_name).schema();
+    return load_sstables(s, dir).then([&db, s, dir] (std::vector<sstables::shared_sstable> sstables) {
+        if (sstables.empty()) {
+            sslog.info("Load and stream: no sstables in {}", dir);
+            return make_ready_future<>();
+        }
+        sslog.info("Load and stream: streaming {} sstable(s) of {} into {}.{}", sstables.size(), dir, s->ks_name(), s->cf_name());
+        auto& rs = db.local().find_keyspace(s->ks_name()).get_replication_strategy();
+        auto& tm = service::get_local_storage_service().get_token_metadata();
+        auto plan = make_lw_shared<stream_plan>("Load and stream");
+        for (auto&& ep : tm.get_all_endpoints()) {
+            auto ranges = rs.get_ranges(ep);
+            if (ranges.empty()) {
+                continue;
+            }
+            stream_detail detail(s->id(), make_sstables_reader(s, sstables, ranges), 0, 0);
+            detail.loaded = true;
+            detail.sstables = sstables;
+            std::vector<stream_detail> details;
+            details.push_back(std::move(detail));
+            plan->transfer_files(ep, std::move(details));
+        }
+        return plan->execute().then([plan, dir] (stream_state state) {
+            sslog.info("Load and stream: done streaming the sstables of {}", dir);
+        });
+    });
+}
+
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/distributed.hh"
+#include "core/future.hh"
+#include "core/sstring.hh"
+
+class database;
+
+namespace streaming {
+
+// Streams the data of the sstables in dir, written elsewhere for the column
+// family ks_name.cf_name, to the nodes which own it, each of which takes in
+// the ranges it owns as it does those of any stream: into sstables of its
+// own, added on all of its shards, rather than through the write path. The
+// files are left in dir.
+future<> load_and_stream(distributed<database>& db, sstring ks_name, sstring cf_name, sstring dir);
+
+}
@@ -40,6 +40,7 @@
 
 #include "query-request.hh"
 #include "mutation_reader.hh"
+#include "sstables/sstables.hh"
 #include "utils/UUID.hh"
 #include <vector>
 
@@ -51,6 +52,15 @@ struct stream_detail {
     lw_shared_ptr<mutation_reader> mr;
     int64_t estimated_keys;
     int64_t repaired_at;
+    // With sstable_files, the sstables lying entirely within the ranges are
+    // sent as files, and mr is only made once the transfer starts, of the
+    // data of the other sstables, which it keeps in sstables.
+    bool sstable_files = false;
+    std::vector<query::range<dht::token>> ranges;
+    std::vector<sstables::shared_sstable> sstables;
+    // Whether the data is of sstables loaded from elsewhere rather than of
+    // the column family, and is throttled as such.
+    bool loaded = false;
     stream_detail() = default;
     stream_detail(UUID cf_id_, mutation_reader mr_, long estimated_keys_, long repaired_at_)
         : cf_id(std::move(cf_id_))
@@ -58,6 +68,13 @@ struct stream_detail {
         , estimated_keys(estimated_keys_)
         , repaired_at(repaired_at_) {
     }
+    stream_detail(UUID cf_id_, std::vector<query::range<dht::token>> ranges_, long repaired_at_)
+        : cf_id(std::move(cf_id_))
+        , estimated_keys(0)
+        , repaired_at(repaired_at_)
+        , sstable_files(true)
+        , ranges(std::move(ranges_)) {
+    }
 };
 
 } // namespace streaming
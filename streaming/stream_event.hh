@@ -53,6 +53,7 @@ class stream_event {
         STREAM_PREPARED,
         STREAM_COMPLETE,
         FILE_PROGRESS,
+        TABLE_RECEIVED,
     };
 
     type event_type;
@@ -103,4 +104,22 @@ struct session_prepared_event : public stream_event {
     }
 };
 
+// All the ranges requested of a table from the peer were received.
+struct table_received_event : public stream_event {
+    using inet_address = gms::inet_address;
+    inet_address peer;
+    sstring keyspace;
+    sstring table;
+    std::vector<query::range<dht::token>> ranges;
+
+    table_received_event(UUID plan_id_, inet_address peer_, sstring keyspace_, sstring table_,
+            std::vector<query::range<dht::token>> ranges_)
+        : stream_event(stream_event::type::TABLE_RECEIVED, plan_id_)
+        , peer(peer_)
+        , keyspace(std::move(keyspace_))
+        , table(std::move(table_))
+        , ranges(std::move(ranges_)) {
+    }
+};
+
 } // namespace streaming
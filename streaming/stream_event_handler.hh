@@ -53,6 +53,7 @@ class stream_event_handler /* extends FutureCallback<StreamState> */ {
     virtual void handle_stream_event(session_complete_event event) {}
     virtual void handle_stream_event(progress_event event) {}
     virtual void handle_stream_event(session_prepared_event event) {}
+    virtual void handle_stream_event(table_received_event event) {}
 };
 
 } // namespace streaming
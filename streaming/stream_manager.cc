@@ -40,6 +40,8 @@
 #include "streaming/stream_manager.hh"
 #include "streaming/stream_result_future.hh"
 #include "log.hh"
+#include "locator/snitch_base.hh"
+#include "utils/fb_utilities.hh"
 
 namespace streaming {
 
@@ -108,4 +110,60 @@ void stream_manager::show_streams() {
     }
 }
 
+void stream_manager::throughput_limit::set(uint32_t mbits) {
+    _mbits = mbits;
+    size_t bytes_per_sec = size_t(mbits) * 1024 * 1024 / 8 / smp::count;
+    // A non-zero throughput too low to split keeps a byte per second per shard
+    // rather than disabling throttling.
+    if (mbits && !bytes_per_sec) {
+        bytes_per_sec = 1;
+    }
+    _limiter = make_lw_shared<utils::rate_limiter>(bytes_per_sec);
+}
+
+future<> stream_manager::throughput_limit::throttle(size_t bytes) {
+    auto limiter = _limiter;
+    return limiter->reserve(bytes).finally([limiter] {});
+}
+
+void stream_manager::set_peer_throughput_mbits_per_sec(uint32_t mbits) {
+    _peer_outbound_mbits = mbits;
+    for (auto&& limit : _peer_outbound) {
+        limit.second.set(mbits);
+    }
+}
+
+future<> stream_manager::throttle(inet_address peer, size_t bytes) {
+    return _outbound.throttle(bytes).then([this, peer, bytes] {
+        if (!_peer_outbound_mbits) {
+            return make_ready_future<>();
+        }
+        auto it = _peer_outbound.find(peer);
+        if (it == _peer_outbound.end()) {
+            it = _peer_outbound.emplace(peer, throughput_limit()).first;
+            it->second.set(_peer_outbound_mbits);
+        }
+        return it->second.throttle(bytes);
+    }).then([this, peer, bytes] {
+        if (!_inter_dc_outbound.get()) {
+            return make_ready_future<>();
+        }
+        auto& snitch = locator::i_endpoint_snitch::get_local_snitch_ptr();
+        if (snitch->get_datacenter(peer) == snitch->get_datacenter(utils::fb_utilities::get_broadcast_address())) {
+            return make_ready_future<>();
+        }
+        return _inter_dc_outbound.throttle(bytes);
+    });
+}
+
+future<> stream_manager::throttle_inbound(size_t bytes) {
+    return _inbound.throttle(bytes);
+}
+
+future<> stream_manager::throttle_load(inet_address peer, size_t bytes) {
+    return _load_outbound.throttle(bytes).then([this, peer, bytes] {
+        return throttle(peer, bytes);
+    });
+}
+
 } // namespace streaming
@@ -40,8 +40,11 @@
 #include "core/shared_ptr.hh"
 #include "core/distributed.hh"
 #include "utils/UUID.hh"
+#include "utils/rate_limiter.hh"
+#include "gms/inet_address.hh"
 #include <seastar/core/semaphore.hh>
 #include <map>
+#include <unordered_map>
 
 namespace streaming {
 
@@ -54,6 +57,7 @@ class stream_result_future;
  */
 class stream_manager {
     using UUID = utils::UUID;
+    using inet_address = gms::inet_address;
 #if 0
     /**
      * Gets streaming rate limiter.
@@ -118,9 +122,76 @@ class stream_manager {
 private:
     std::unordered_map<UUID, shared_ptr<stream_result_future>> _initiated_streams;
     std::unordered_map<UUID, shared_ptr<stream_result_future>> _receiving_streams;
+    // The window of STREAM_MUTATIONS batches in flight from this shard.
     semaphore _mutation_send_limiter{10};
+
+    // A throughput of the node, in megabits per second, of which each shard
+    // enforces an even share. 0 disables throttling.
+    class throughput_limit {
+        uint32_t _mbits = 0;
+        // Replaced when the throughput changes; those waiting on the old
+        // one keep it alive.
+        lw_shared_ptr<utils::rate_limiter> _limiter = make_lw_shared<utils::rate_limiter>(0);
+    public:
+        void set(uint32_t mbits);
+        uint32_t get() const {
+            return _mbits;
+        }
+        future<> throttle(size_t bytes);
+    };
+    throughput_limit _outbound;
+    throughput_limit _inter_dc_outbound;
+    throughput_limit _inbound;
+    throughput_limit _load_outbound;
+    // The outbound throughput to each peer, created as data is first sent
+    // to it.
+    uint32_t _peer_outbound_mbits = 0;
+    std::unordered_map<inet_address, throughput_limit> _peer_outbound;
 public:
     semaphore& mutation_send_limiter() { return _mutation_send_limiter; }
+
+    // The throughputs of streaming and repair of the node, in megabits per
+    // second: the outbound one, that to each peer, that to peers in other
+    // data centers, and the inbound one.
+    void set_throughput_mbits_per_sec(uint32_t mbits) {
+        _outbound.set(mbits);
+    }
+    uint32_t throughput_mbits_per_sec() const {
+        return _outbound.get();
+    }
+    void set_peer_throughput_mbits_per_sec(uint32_t mbits);
+    uint32_t peer_throughput_mbits_per_sec() const {
+        return _peer_outbound_mbits;
+    }
+    void set_inter_dc_throughput_mbits_per_sec(uint32_t mbits) {
+        _inter_dc_outbound.set(mbits);
+    }
+    uint32_t inter_dc_throughput_mbits_per_sec() const {
+        return _inter_dc_outbound.get();
+    }
+    void set_inbound_throughput_mbits_per_sec(uint32_t mbits) {
+        _inbound.set(mbits);
+    }
+    uint32_t inbound_throughput_mbits_per_sec() const {
+        return _inbound.get();
+    }
+    // The outbound throughput of the streaming of loaded sstables, in
+    // megabits per second.
+    void set_load_throughput_mbits_per_sec(uint32_t mbits) {
+        _load_outbound.set(mbits);
+    }
+    uint32_t load_throughput_mbits_per_sec() const {
+        return _load_outbound.get();
+    }
+    // Resolves once bytes may be sent to the peer within the outbound
+    // throughputs.
+    future<> throttle(inet_address peer, size_t bytes);
+    // Resolves once bytes received may be taken in within the inbound
+    // throughput. Holding back the reply to a peer holds back its sending.
+    future<> throttle_inbound(size_t bytes);
+    // Resolves once bytes of loaded sstables may be sent to the peer within
+    // the outbound throughputs and the load throughput.
+    future<> throttle_load(inet_address peer, size_t bytes);
 #if  0
     public Set<CompositeData> getCurrentStreams()
     {
@@ -48,7 +48,7 @@ stream_plan& stream_plan::request_ranges(inet_address from, inet_address connect
 
 stream_plan& stream_plan::request_ranges(inet_address from, inet_address connecting, sstring keyspace, std::vector<query::range<token>> ranges, std::vector<sstring> column_families) {
     auto session = _coordinator->get_or_create_next_session(from, connecting);
-    session->add_stream_request(keyspace, ranges, std::move(column_families), _repaired_at);
+    session->add_stream_request(keyspace, ranges, std::move(column_families), _repaired_at, _sstable_files);
     return *this;
 }
 
@@ -62,7 +62,7 @@ stream_plan& stream_plan::transfer_ranges(inet_address to, inet_address connecti
 
 stream_plan& stream_plan::transfer_ranges(inet_address to, inet_address connecting, sstring keyspace, std::vector<query::range<token>> ranges, std::vector<sstring> column_families) {
     auto session = _coordinator->get_or_create_next_session(to, connecting);
-    session->add_transfer_ranges(keyspace, std::move(ranges), std::move(column_families), _flush_before_transfer, _repaired_at);
+    session->add_transfer_ranges(keyspace, std::move(ranges), std::move(column_families), _flush_before_transfer, _repaired_at, _sstable_files);
     return *this;
 }
 
@@ -80,6 +80,11 @@ stream_plan& stream_plan::flush_before_transfer(bool flush_before_transfer_) {
     return *this;
 }
 
+stream_plan& stream_plan::sstable_files(bool sstable_files_) {
+    _sstable_files = sstable_files_;
+    return *this;
+}
+
 stream_plan& stream_plan::listeners(std::vector<stream_event_handler*> handlers) {
     std::copy(handlers.begin(), handlers.end(), std::back_inserter(_handlers));
     return *this;
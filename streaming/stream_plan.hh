@@ -70,6 +70,7 @@ class stream_plan {
     shared_ptr<stream_coordinator> _coordinator;
 
     bool _flush_before_transfer = true;
+    bool _sstable_files = false;
     // FIXME: ActiveRepairService.UNREPAIRED_SSTABLE
     long UNREPAIRED_SSTABLE = 0;
 public:
@@ -193,6 +194,13 @@ class stream_plan {
      * @return this object for chaining
      */
     stream_plan& flush_before_transfer(bool flush_before_transfer_);
+
+    /**
+     * Send the sstables lying entirely within the ranges as files, instead
+     * of mutation by mutation, which is much cheaper for bulk transfers such
+     * as bootstrap. Data in other sstables is still sent as mutations.
+     */
+    stream_plan& sstable_files(bool sstable_files_);
 };
 
 } // namespace streaming
@@ -38,9 +38,43 @@
 
 #include "streaming/stream_session.hh"
 #include "streaming/stream_receive_task.hh"
+#include "database.hh"
+#include "log.hh"
+#include <core/fstream.hh>
 
 namespace streaming {
 
+extern logging::logger sslog;
+
+// The size the memtable of streamed mutations grows to before it is written
+// into an sstable.
+static constexpr size_t streamed_memtable_size = 64 << 20;
+
+// Moves the sstable, received in the staging directory, into the directory
+// of the column family under a generation of this node, and adds it there
+// on all shards.
+static future<> add_received_sstable(utils::UUID cf_id, sstring staging, std::vector<sstring> components) {
+    auto& cf = stream_session::get_local_db().find_column_family(cf_id);
+    auto s = cf.schema();
+    auto dir = cf.dir();
+    auto generation = cf.calculate_generation_for_new_table();
+    auto toc = sstables::entry_descriptor::make_descriptor(components.back());
+    // The TOC is moved last, so that the sstable is complete once it has one.
+    return do_with(std::move(components), [s, dir, staging, generation] (const std::vector<sstring>& components) {
+        return do_for_each(components, [s, dir, staging, generation] (const sstring& name) {
+            auto desc = sstables::entry_descriptor::make_descriptor(name);
+            auto to = sstables::sstable::filename(dir, s->ks_name(), s->cf_name(), desc.version, generation, desc.format, desc.component);
+            return engine().rename_file(staging + "/" + name, to);
+        });
+    }).then([dir] {
+        return sync_directory(dir);
+    }).then([cf_id, generation, toc] {
+        return stream_session::get_db().invoke_on_all([cf_id, generation, toc] (database& db) {
+            return db.find_column_family(cf_id).add_streamed_sstable(generation, toc.version, toc.format);
+        });
+    });
+}
+
 stream_receive_task::stream_receive_task(shared_ptr<stream_session> _session, UUID _cf_id, int _total_files, long _total_size)
         : stream_task(_session, _cf_id)
         , total_files(_total_files)
@@ -50,4 +84,111 @@ stream_receive_task::stream_receive_task(shared_ptr<stream_session> _session, UU
 stream_receive_task::~stream_receive_task() {
 }
 
+future<> stream_receive_task::receive_file(sstring name, temporary_buffer<char> data, bool last) {
+    auto& cf = stream_session::get_local_db().find_column_family(cf_id);
+    auto staging = sprint("%s/streaming-%s-%s", cf.dir(), session->plan_id(), session->peer);
+    auto it = _files.find(name);
+    auto opened = it != _files.end() ? make_ready_future<lw_shared_ptr<output_stream<char>>>(it->second)
+            : touch_directory(staging).then([staging, name] {
+        return engine().open_file_dma(staging + "/" + name, open_flags::wo | open_flags::create | open_flags::truncate);
+    }).then([this, name] (file f) {
+        auto out = make_lw_shared(make_file_output_stream(std::move(f)));
+        _files.emplace(name, out);
+        return out;
+    });
+    return opened.then([this, name, staging, last, data = std::move(data)] (lw_shared_ptr<output_stream<char>> out) {
+        return out->write(data.get(), data.size()).then([this, name, staging, last, out] {
+            if (!last) {
+                return make_ready_future<>();
+            }
+            _files.erase(name);
+            return out->close().then([this, name, staging] {
+                auto desc = sstables::entry_descriptor::make_descriptor(name);
+                auto& components = _components[desc.generation];
+                components.push_back(name);
+                if (desc.component != sstables::sstable::component_type::TOC) {
+                    return make_ready_future<>();
+                }
+                auto received = std::move(components);
+                _components.erase(desc.generation);
+                return add_received_sstable(cf_id, staging, std::move(received)).then([this, staging] {
+                    // The sender sends one file at a time, so the staging
+                    // directory is empty until the next sstable comes.
+                    return _files.empty() && _components.empty() ? remove_file(staging) : make_ready_future<>();
+                });
+            });
+        });
+    });
+}
+
+sstring stream_receive_task::mutations_staging_directory() const {
+    auto& cf = stream_session::get_local_db().find_column_family(cf_id);
+    return sprint("%s/streaming-%s-%s-mutations", cf.dir(), session->plan_id(), session->peer);
+}
+
+future<> stream_receive_task::receive_mutations(std::vector<frozen_mutation> fms) {
+    if (!_memtable) {
+        _memtable = make_lw_shared<memtable>(stream_session::get_local_db().find_column_family(cf_id).schema());
+    }
+    for (auto&& fm : fms) {
+        _memtable->apply(fm);
+    }
+    if (_memtable->occupancy().total_space() < streamed_memtable_size) {
+        return make_ready_future<>();
+    }
+    return write_memtable();
+}
+
+future<> stream_receive_task::write_memtable() {
+    // Mutations coming while it is written go to a new memtable.
+    auto mt = std::move(_memtable);
+    if (!mt || !mt->partition_count()) {
+        return make_ready_future<>();
+    }
+    return _write_sem.wait().then([this, mt] {
+        auto& cf = stream_session::get_local_db().find_column_family(cf_id);
+        auto s = cf.schema();
+        auto staging = mutations_staging_directory();
+        auto sst = make_lw_shared<sstables::sstable>(s->ks_name(), s->cf_name(), staging, ++_generation,
+                sstables::sstable::version_types::ka, sstables::sstable::format_types::big);
+        sst->set_compression_dictionary(cf.get_compression_dictionary());
+        sslog.debug("stream_receive_task: Writing streamed mutations to {}", sst->get_filename());
+        return touch_directory(staging).then([sst, mt] {
+            return sst->write_components(*mt, streaming_priority());
+        }).then([this, sst, staging] {
+            std::vector<sstring> components;
+            auto toc = sst->toc_filename();
+            for (auto&& f : sst->component_filenames()) {
+                if (f != toc) {
+                    components.push_back(f.substr(staging.size() + 1));
+                }
+            }
+            components.push_back(toc.substr(staging.size() + 1));
+            _written.push_back(std::move(components));
+        });
+    }).finally([this] {
+        _write_sem.signal();
+    });
+}
+
+future<> stream_receive_task::finish() {
+    // The sender waits for all its batches to be applied before it tells
+    // the column family is done, so no other write is left.
+    return write_memtable().then([this] {
+        auto staging = mutations_staging_directory();
+        auto written = std::move(_written);
+        _written.clear();
+        if (written.empty()) {
+            return make_ready_future<>();
+        }
+        return do_with(std::move(written), [this, staging] (std::vector<std::vector<sstring>>& written) {
+            return do_for_each(written, [this, staging] (std::vector<sstring>& components) {
+                return add_received_sstable(cf_id, staging, std::move(components));
+            });
+        }).then([staging] {
+            return remove_file(staging);
+        });
+    });
+}
+
 } // namespace streaming
@@ -41,7 +41,12 @@
 #include "utils/UUID.hh"
 #include "streaming/stream_task.hh"
 #include "streaming/messages/incoming_file_message.hh"
+#include "core/iostream.hh"
+#include "core/semaphore.hh"
+#include "frozen_mutation.hh"
+#include "memtable.hh"
 #include <memory>
+#include <unordered_map>
 
 namespace streaming {
 
@@ -62,6 +67,28 @@ class stream_receive_task : public stream_task {
 
     // holds references to SSTables received
     // protected Collection<SSTableWriter> sstables;
+
+    // The sstable files being received, by their name on the sending node,
+    // open in the staging directory.
+    std::unordered_map<sstring, lw_shared_ptr<output_stream<char>>> _files;
+    // The files received so far of each sstable, by its generation on the
+    // sending node.
+    std::unordered_map<unsigned long, std::vector<sstring>> _components;
+
+    // The streamed mutations, collected into a memtable of this task rather
+    // than applied to that of the column family, so that they are written
+    // once, into sstables of their own, and don't compete with writes for
+    // memory.
+    lw_shared_ptr<memtable> _memtable;
+    // Serializes writing the memtables into sstables.
+    semaphore _write_sem{1};
+    // The generation of the last sstable written in the staging directory.
+    unsigned long _generation = 0;
+    // The files of each sstable written, the TOC last.
+    std::vector<std::vector<sstring>> _written;
+private:
+    sstring mutations_staging_directory() const;
+    future<> write_memtable();
 public:
     stream_receive_task(shared_ptr<stream_session> _session, UUID _cf_id, int _total_files, long _total_size);
     ~stream_receive_task();
@@ -88,6 +115,18 @@ class stream_receive_task : public stream_task {
 #endif
     }
 
+    // Writes the next chunk of an sstable file. Once the TOC, which comes
+    // last, is complete, adds the sstable to the column family.
+    future<> receive_file(sstring name, temporary_buffer<char> data, bool last);
+
+    // Applies a batch of streamed mutations to the memtable of the task,
+    // writing it into an sstable once it is large enough.
+    future<> receive_mutations(std::vector<frozen_mutation> fms);
+
+    // Writes the rest of the streamed mutations, and adds the sstables they
+    // were written into to the column family, once all have come.
+    future<> finish();
+
     virtual int get_total_number_of_files() override {
         return total_files;
     }
@@ -52,12 +52,16 @@ class stream_request {
     std::vector<query::range<token>> ranges;
     std::vector<sstring> column_families;
     long repaired_at;
+    // Whether the sstables entirely within the ranges are to be sent as files.
+    // Not serialized with the request, see prepare_message.
+    bool sstable_files = false;
     stream_request() = default;
-    stream_request(sstring _keyspace, std::vector<query::range<token>> _ranges, std::vector<sstring> _column_families, long _repaired_at)
+    stream_request(sstring _keyspace, std::vector<query::range<token>> _ranges, std::vector<sstring> _column_families, long _repaired_at, bool _sstable_files = false)
         : keyspace(std::move(_keyspace))
         , ranges(std::move(_ranges))
         , column_families(std::move(_column_families))
-        , repaired_at(_repaired_at) {
+        , repaired_at(_repaired_at)
+        , sstable_files(_sstable_files) {
     }
     friend std::ostream& operator<<(std::ostream& os, const stream_request& r);
 public:
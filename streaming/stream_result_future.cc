@@ -133,6 +133,10 @@ void stream_result_future::handle_progress(progress_info progress) {
     fire_stream_event(progress_event(plan_id, std::move(progress)));
 }
 
+void stream_result_future::handle_table_received(inet_address peer, sstring keyspace, sstring table, std::vector<query::range<dht::token>> ranges) {
+    fire_stream_event(table_received_event(plan_id, peer, std::move(keyspace), std::move(table), std::move(ranges)));
+}
+
 shared_ptr<stream_result_future> stream_result_future::create_and_register(UUID plan_id_, sstring description_, shared_ptr<stream_coordinator> coordinator_) {
     auto future = make_shared<stream_result_future>(plan_id_, description_, coordinator_);
     auto& sm = get_local_stream_manager();
@@ -143,6 +143,8 @@ class stream_result_future {
 
     void handle_progress(progress_info progress);
 
+    void handle_table_received(inet_address peer, sstring keyspace, sstring table, std::vector<query::range<dht::token>> ranges);
+
     template <typename Event>
     void fire_stream_event(Event event);
 
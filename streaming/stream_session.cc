@@ -51,6 +51,7 @@
 #include "mutation_reader.hh"
 #include "dht/i_partitioner.hh"
 #include "database.hh"
+#include "db/config.hh"
 #include "utils/fb_utilities.hh"
 #include "streaming/stream_plan.hh"
 #include "core/sleep.hh"
@@ -60,6 +61,7 @@
 #include "streaming/stream_state.hh"
 #include "streaming/stream_exception.hh"
 #include "service/storage_proxy.hh"
+#include "gms/gossiper.hh"
 
 namespace streaming {
 
@@ -129,7 +131,36 @@ void stream_session::init_messaging_service_handler() {
                 auto cf_id = fm.column_family_id();
                 sslog.debug("GOT STREAM_MUTATION: plan_id={}, cf_id={}", plan_id, cf_id);
             }
-            return service::get_storage_proxy().local().mutate_locally(fm);
+            auto f = get_local_stream_manager().throttle_inbound(fm.representation().size());
+            return f.then([fm = std::move(fm)] () mutable {
+                return do_with(std::move(fm), [] (const frozen_mutation& fm) {
+                    return service::get_storage_proxy().local().mutate_locally(fm);
+                });
+            });
+        });
+    });
+    ms().register_stream_mutations([] (UUID plan_id, inet_address from, std::vector<frozen_mutation> fms, unsigned dst_cpu_id) {
+        return smp::submit_to(dst_cpu_id, [plan_id, from, fms = std::move(fms)] () mutable {
+            sslog.debug("GOT STREAM_MUTATIONS: plan_id={}, from={}, mutations={}", plan_id, from, fms.size());
+            size_t bytes = 0;
+            for (auto&& fm : fms) {
+                bytes += fm.representation().size();
+            }
+            auto throttled = get_local_stream_manager().throttle_inbound(bytes);
+            return throttled.then([plan_id, from, fms = std::move(fms)] () mutable {
+                auto f = get_stream_result_future(plan_id);
+                if (f) {
+                    auto coordinator = f->get_coordinator();
+                    assert(coordinator);
+                    auto session = coordinator->get_or_create_next_session(from, from);
+                    assert(session);
+                    return session->receive_mutations(std::move(fms));
+                } else {
+                    auto err = sprint("STREAM_MUTATIONS: Can not find stream_manager for plan_id=%s", plan_id);
+                    sslog.warn(err.c_str());
+                    throw std::runtime_error(err);
+                }
+            });
         });
     });
     ms().register_stream_mutation_done([] (UUID plan_id, UUID cf_id, inet_address from, inet_address connecting, unsigned dst_cpu_id) {
@@ -141,8 +172,7 @@ void stream_session::init_messaging_service_handler() {
                 assert(coordinator);
                 auto session = coordinator->get_or_create_next_session(from, from);
                 assert(session);
-                session->receive_task_completed(cf_id);
-                return make_ready_future<>();
+                return session->receive_task_completed(cf_id);
             } else {
                 auto err = sprint("STREAM_MUTATION_DONE: Can not find stream_manager for plan_id=%s", plan_id);
                 sslog.warn(err.c_str());
@@ -150,6 +180,27 @@ void stream_session::init_messaging_service_handler() {
             }
         });
     });
+    ms().register_incoming_file_message([] (UUID plan_id, UUID cf_id, inet_address from, sstring name,
+            temporary_buffer<char> data, bool last, unsigned dst_cpu_id) {
+        return smp::submit_to(dst_cpu_id, [plan_id, cf_id, from, name = std::move(name), data = std::move(data), last] () mutable {
+            sslog.debug("GOT INCOMING_FILE_MESSAGE: plan_id={}, cf_id={}, from={}, name={}, last={}", plan_id, cf_id, from, name, last);
+            auto throttled = get_local_stream_manager().throttle_inbound(data.size());
+            return throttled.then([plan_id, cf_id, from, name = std::move(name), data = std::move(data), last] () mutable {
+                auto f = get_stream_result_future(plan_id);
+                if (f) {
+                    auto coordinator = f->get_coordinator();
+                    assert(coordinator);
+                    auto session = coordinator->get_or_create_next_session(from, from);
+                    assert(session);
+                    return session->receive_file(cf_id, std::move(name), std::move(data), last);
+                } else {
+                    auto err = sprint("INCOMING_FILE_MESSAGE: Can not find stream_manager for plan_id=%s", plan_id);
+                    sslog.warn(err.c_str());
+                    throw std::runtime_error(err);
+                }
+            });
+        });
+    });
 #if 0
     ms().register_handler(messaging_verb::RETRY_MESSAGE, [] (messages::retry_message msg, unsigned dst_cpu_id) {
         return smp::submit_to(dst_cpu_id, [msg = std::move(msg)] () mutable {
@@ -214,7 +265,21 @@ future<> stream_session::init_streaming_service(distributed<database>& db) {
             return get_stream_manager().stop();
         });
     });
-    return get_stream_manager().start().then([] {
+    return get_stream_manager().start().then([&db] {
+        auto& cfg = db.local().get_config();
+        auto mbits = cfg.stream_throughput_outbound_megabits_per_sec();
+        auto peer_mbits = cfg.stream_throughput_outbound_megabits_per_sec_per_peer();
+        auto inter_dc_mbits = cfg.inter_dc_stream_throughput_outbound_megabits_per_sec();
+        auto inbound_mbits = cfg.stream_throughput_inbound_megabits_per_sec();
+        auto load_mbits = cfg.load_and_stream_throughput_megabits_per_sec();
+        return get_stream_manager().invoke_on_all([mbits, peer_mbits, inter_dc_mbits, inbound_mbits, load_mbits] (stream_manager& sm) {
+            sm.set_throughput_mbits_per_sec(mbits);
+            sm.set_peer_throughput_mbits_per_sec(peer_mbits);
+            sm.set_inter_dc_throughput_mbits_per_sec(inter_dc_mbits);
+            sm.set_inbound_throughput_mbits_per_sec(inbound_mbits);
+            sm.set_load_throughput_mbits_per_sec(load_mbits);
+        });
+    }).then([] {
         return _handlers.start().then([] {
             return _handlers.invoke_on_all([] (handler& h) {
                 init_messaging_service_handler();
@@ -366,7 +431,7 @@ future<messages::prepare_message> stream_session::prepare(std::vector<stream_req
                 throw std::runtime_error(err);
             }
         }
-        add_transfer_ranges(request.keyspace, request.ranges, request.column_families, true, request.repaired_at);
+        add_transfer_ranges(request.keyspace, request.ranges, request.column_families, true, request.repaired_at, request.sstable_files);
     }
     for (auto& summary : summaries) {
         sslog.debug("stream_session::prepare stream_summary={}", summary);
@@ -428,6 +493,34 @@ void stream_session::receive(messages::incoming_file_message message) {
     it->second.received(std::move(message));
 }
 
+future<> stream_session::receive_file(UUID cf_id, sstring name, temporary_buffer<char> data, bool last) {
+    auto it = _receivers.find(cf_id);
+    if (it == _receivers.end()) {
+        throw std::runtime_error(sprint("receive_file: cf_id=%s is not being received", cf_id));
+    }
+    return it->second.receive_file(std::move(name), std::move(data), last);
+}
+
+future<> stream_session::receive_mutations(std::vector<frozen_mutation> fms) {
+    if (fms.empty()) {
+        return make_ready_future<>();
+    }
+    auto cf_id = fms.front().column_family_id();
+    auto it = _receivers.find(cf_id);
+    // The rows of secondary indexes and the updates of views are made along
+    // with the writes to the column family, so such column families take
+    // the write path.
+    auto& cf = get_local_db().find_column_family(cf_id);
+    if (it == _receivers.end() || !cf.index_manager().empty() || !cf.views().empty()) {
+        return do_with(std::move(fms), [] (const std::vector<frozen_mutation>& fms) {
+            return parallel_for_each(fms.begin(), fms.end(), [] (const frozen_mutation& fm) {
+                return service::get_storage_proxy().local().mutate_locally(fm);
+            });
+        });
+    }
+    return it->second.receive_mutations(std::move(fms));
+}
+
 void stream_session::progress(/* Descriptor desc */ progress_info::direction dir, long bytes, long total) {
     auto progress = progress_info(peer, _index, "", dir, bytes, total);
     _stream_result->handle_progress(std::move(progress));
@@ -477,10 +570,26 @@ session_info stream_session::get_session_info() {
     return session_info(peer, _index, connecting, std::move(receiving_summaries), std::move(transfer_summaries), _state);
 }
 
-void stream_session::receive_task_completed(UUID cf_id) {
-    _receivers.erase(cf_id);
-    sslog.debug("receive  task_completed: cf_id={} done, receivers.size={} transfers.size={}", cf_id, _receivers.size(), _transfers.size());
-    maybe_completed();
+future<> stream_session::receive_task_completed(UUID cf_id) {
+    auto it = _receivers.find(cf_id);
+    auto finished = it != _receivers.end() ? it->second.finish() : make_ready_future<>();
+    return finished.then([this, cf_id] {
+        // The ranges of the column family this node requested of the peer.
+        auto s = get_local_db().find_schema(cf_id);
+        std::vector<query::range<token>> ranges;
+        for (auto&& request : _requests) {
+            if (request.keyspace == s->ks_name() && (request.column_families.empty()
+                    || std::count(request.column_families.begin(), request.column_families.end(), s->cf_name()))) {
+                ranges.insert(ranges.end(), request.ranges.begin(), request.ranges.end());
+            }
+        }
+        if (!ranges.empty()) {
+            _stream_result->handle_table_received(peer, s->ks_name(), s->cf_name(), std::move(ranges));
+        }
+        _receivers.erase(cf_id);
+        sslog.debug("receive  task_completed: cf_id={} done, receivers.size={} transfers.size={}", cf_id, _receivers.size(), _transfers.size());
+        maybe_completed();
+    });
 }
 
 void stream_session::transfer_task_completed(UUID cf_id) {
@@ -586,7 +695,7 @@ std::vector<column_family*> stream_session::get_column_family_stores(const sstri
     return stores;
 }
 
-void stream_session::add_transfer_ranges(sstring keyspace, std::vector<query::range<token>> ranges, std::vector<sstring> column_families, bool flush_tables, long repaired_at) {
+void stream_session::add_transfer_ranges(sstring keyspace, std::vector<query::range<token>> ranges, std::vector<sstring> column_families, bool flush_tables, long repaired_at, bool sstable_files) {
     std::vector<stream_detail> stream_details;
     auto cfs = get_column_family_stores(keyspace, column_families);
     if (flush_tables) {
@@ -595,6 +704,16 @@ void stream_session::add_transfer_ranges(sstring keyspace, std::vector<query::ra
     for (auto& cf : cfs) {
         std::vector<mutation_reader> readers;
         auto cf_id = cf->schema()->id();
+        // Files would bypass the write path, which indexes and views are
+        // maintained on.
+        // Nodes not upgraded yet don't know INCOMING_FILE_MESSAGE.
+        if (sstable_files && cf->index_manager().empty() && cf->views().empty()
+                && gms::get_local_gossiper().cluster_supports_feature(gms::versioned_value::STREAM_SSTABLE_FILES)) {
+            // The transfer task flushes the column family and picks its
+            // sstables when it starts.
+            stream_details.emplace_back(std::move(cf_id), ranges, repaired_at);
+            continue;
+        }
         for (auto& range : ranges) {
             auto pr = query::to_partition_range(range);
             auto mr = service::get_storage_proxy().local().make_local_reader(cf_id, pr);
@@ -152,6 +152,7 @@ class stream_session : public gms::i_endpoint_state_change_subscriber, public en
         return net::get_local_messaging_service();
     }
     static database& get_local_db() { return _db->local(); }
+    static distributed<database>& get_db() { return *_db; }
     static future<> init_streaming_service(distributed<database>& db);
     static future<> test(distributed<cql3::query_processor>& qp);
 public:
@@ -234,8 +235,8 @@ class stream_session : public gms::i_endpoint_state_change_subscriber, public en
      * @param ranges Ranges to retrieve data
      * @param columnFamilies ColumnFamily names. Can be empty if requesting all CF under the keyspace.
      */
-    void add_stream_request(sstring keyspace, std::vector<query::range<token>> ranges, std::vector<sstring> column_families, long repaired_at) {
-        _requests.emplace_back(std::move(keyspace), std::move(ranges), std::move(column_families), repaired_at);
+    void add_stream_request(sstring keyspace, std::vector<query::range<token>> ranges, std::vector<sstring> column_families, long repaired_at, bool sstable_files = false) {
+        _requests.emplace_back(std::move(keyspace), std::move(ranges), std::move(column_families), repaired_at, sstable_files);
     }
 
     /**
@@ -248,8 +249,9 @@ class stream_session : public gms::i_endpoint_state_change_subscriber, public en
      * @param columnFamilies Transfer ColumnFamilies
      * @param flushTables flush tables?
      * @param repairedAt the time the repair started.
+     * @param sstable_files send the sstables entirely within the ranges as files
      */
-    void add_transfer_ranges(sstring keyspace, std::vector<query::range<token>> ranges, std::vector<sstring> column_families, bool flush_tables, long repaired_at);
+    void add_transfer_ranges(sstring keyspace, std::vector<query::range<token>> ranges, std::vector<sstring> column_families, bool flush_tables, long repaired_at, bool sstable_files = false);
 
     std::vector<column_family*> get_column_family_stores(const sstring& keyspace, const std::vector<sstring>& column_families);
 
@@ -353,6 +355,12 @@ class stream_session : public gms::i_endpoint_state_change_subscriber, public en
      */
     void receive(messages::incoming_file_message message);
 
+    // Writes a chunk of an sstable file the peer sends of the column family.
+    future<> receive_file(UUID cf_id, sstring name, temporary_buffer<char> data, bool last);
+
+    // Writes a batch of mutations the peer streams of a column family.
+    future<> receive_mutations(std::vector<frozen_mutation> fms);
+
     void progress(/* Descriptor desc */ progress_info::direction dir, long bytes, long total);
 
     void received(UUID cf_id, int sequence_number);
@@ -393,7 +401,9 @@ class stream_session : public gms::i_endpoint_state_change_subscriber, public en
      */
     session_info get_session_info();
 
-    void receive_task_completed(UUID cf_id);
+    // Adds what was received of the column family, then completes the
+    // session if nothing else is left.
+    future<> receive_task_completed(UUID cf_id);
     void transfer_task_completed(UUID cf_id);
 
 public:
@@ -46,11 +46,121 @@
 #include "frozen_mutation.hh"
 #include "mutation.hh"
 #include "message/messaging_service.hh"
+#include "database.hh"
+#include "lister.hh"
+#include "utils/fb_utilities.hh"
+#include "utils/cpu_scheduler.hh"
+#include "gms/gossiper.hh"
+#include <core/fstream.hh>
+#include <boost/range/adaptor/map.hpp>
 
 namespace streaming {
 
 extern logging::logger sslog;
 
+// The size of the chunks sstable files are sent in.
+static constexpr size_t file_chunk_size = 128 * 1024;
+
+// The size at which a batch of mutations is sent.
+static constexpr size_t mutation_batch_size = 1024 * 1024;
+
+// An sstable linked into the staging directory of a transfer.
+struct staged_sstable {
+    // The names of its component files, the TOC last.
+    std::vector<sstring> components;
+    dht::token first;
+    dht::token last;
+};
+
+// Links the sstables of the column family this shard holds the first
+// partition of into the staging directory, so that they can be sent while
+// compaction replaces them. A shared sstable is thus linked by one shard.
+static future<std::vector<staged_sstable>> stage_sstables(column_family& cf, sstring staging) {
+    auto s = cf.schema();
+    auto sstables = cf.get_sstables();
+    auto staged = make_lw_shared<std::vector<staged_sstable>>();
+    return touch_directory(staging).then([s, sstables, staging, staged] {
+        return parallel_for_each(*sstables | boost::adaptors::map_values, [s, staging, staged] (sstables::shared_sstable sst) {
+            auto first = sst->get_first_decorated_key(*s).token();
+            if (dht::shard_of(first) != engine().cpu_id()) {
+                return make_ready_future<>();
+            }
+            staged_sstable st{{}, std::move(first), sst->get_last_decorated_key(*s).token()};
+            auto toc = sst->toc_filename();
+            for (auto&& f : sst->component_filenames()) {
+                if (f != toc) {
+                    st.components.push_back(f.substr(sst->get_dir().size() + 1));
+                }
+            }
+            st.components.push_back(toc.substr(sst->get_dir().size() + 1));
+            return sst->create_links(staging).then([staged, st = std::move(st)] () mutable {
+                staged->push_back(std::move(st));
+            });
+        });
+    }).then([staged] {
+        return std::move(*staged);
+    });
+}
+
+// The ranges as the fewest non-wrapping ranges covering the same tokens,
+// sorted. Streamed ranges, such as the vnode ranges of a rebuild, are often
+// adjacent, and an sstable spanning several of them lies within their
+// union, so it can be sent as files, but within none of them on its own.
+std::vector<query::range<dht::token>> merge_token_ranges(const std::vector<query::range<dht::token>>& ranges) {
+    using range_type = query::range<dht::token>;
+    dht::token_comparator cmp;
+    std::vector<range_type> unwrapped;
+    for (auto&& r : ranges) {
+        if (r.is_wrap_around(cmp)) {
+            auto p = r.unwrap();
+            unwrapped.push_back(std::move(p.first));
+            unwrapped.push_back(std::move(p.second));
+        } else {
+            unwrapped.push_back(r);
+        }
+    }
+    // An open start first, then an inclusive start before an exclusive one
+    // of the same token.
+    std::sort(unwrapped.begin(), unwrapped.end(), [&cmp] (const range_type& a, const range_type& b) {
+        if (!a.start() || !b.start()) {
+            return !a.start() && b.start();
+        }
+        auto c = cmp(a.start()->value(), b.start()->value());
+        return c < 0 || (c == 0 && a.start()->is_inclusive() && !b.start()->is_inclusive());
+    });
+    std::vector<range_type> merged;
+    for (auto&& r : unwrapped) {
+        if (!merged.empty()) {
+            auto& last = merged.back();
+            // Overlapping or adjacent, as (a, b] and (b, c] are.
+            auto touches = !last.end() || !r.start() || [&] {
+                auto c = cmp(last.end()->value(), r.start()->value());
+                return c > 0 || (c == 0 && (last.end()->is_inclusive() || r.start()->is_inclusive()));
+            }();
+            if (touches) {
+                auto extends = last.end() && (!r.end() || [&] {
+                    auto c = cmp(r.end()->value(), last.end()->value());
+                    return c > 0 || (c == 0 && r.end()->is_inclusive());
+                }());
+                if (extends) {
+                    last = range_type(last.start(), r.end());
+                }
+                continue;
+            }
+        }
+        merged.push_back(r);
+    }
+    return merged;
+}
+
+static future<> remove_staging_directory(sstring staging) {
+    return lister::scan_dir(staging, directory_entry_type::regular, [staging] (directory_entry de) {
+        return remove_file(staging + "/" + de.name);
+    }).then([staging] {
+        return remove_file(staging);
+    });
+}
+
 stream_transfer_task::stream_transfer_task(shared_ptr<stream_session> session, UUID cf_id)
     : stream_task(session, cf_id) {
 }
@@ -66,6 +176,171 @@ void stream_transfer_task::add_transfer_file(stream_detail detail) {
     total_size += size;
 }
 
+sstring stream_transfer_task::staging_directory(int32_t seq) {
+    auto& cf = stream_session::get_local_db().find_column_family(cf_id);
+    return sprint("%s/streaming-%s-%d", cf.dir(), session->plan_id(), seq);
+}
+
+future<> stream_transfer_task::send_file(sstring staging, sstring name) {
+    using shard_id = net::messaging_service::shard_id;
+    auto id = shard_id{session->peer, session->dst_cpu_id};
+    auto from = utils::fb_utilities::get_broadcast_address();
+    return engine().open_file_dma(staging + "/" + name, open_flags::ro).then([this, id, from, name] (file f) {
+        auto in = make_lw_shared(make_file_input_stream(std::move(f), 0, file_chunk_size));
+        return repeat([this, id, from, name, in] {
+            return in->read().then([this, id, from, name] (temporary_buffer<char> buf) {
+                // The end of the file is sent as an empty chunk.
+                bool last = buf.empty();
+                auto f = get_local_stream_manager().throttle(session->peer, buf.size());
+                return f.then([this, id, from, name, last, buf = std::move(buf)] () mutable {
+                    return session->ms().send_incoming_file_message(id, session->plan_id(), cf_id, from, name,
+                            std::move(buf), last, session->dst_cpu_id);
+                }).then([last] {
+                    return last ? stop_iteration::yes : stop_iteration::no;
+                });
+            });
+        }).finally([in] {
+            return in->close();
+        });
+    });
+}
+
+future<> stream_transfer_task::send_mutations(messages::outgoing_file_message& msg, mutation_batch batch, bool batched) {
+    using shard_id = net::messaging_service::shard_id;
+    auto id = shard_id{session->peer, session->dst_cpu_id};
+    msg.mutations_nr++;
+    auto b = make_lw_shared<mutation_batch>(std::move(batch));
+    auto& sm = get_local_stream_manager();
+    auto throttled = msg.detail.loaded ? sm.throttle_load(session->peer, b->size) : sm.throttle(session->peer, b->size);
+    return throttled.then([] {
+        return get_local_stream_manager().mutation_send_limiter().wait();
+    }).then([&msg, this, id, b, batched] {
+        auto verb = batched ? "STREAM_MUTATIONS" : "STREAM_MUTATION";
+        sslog.debug("SEND {} to {}, cf_id={}, mutations={}", verb, id, cf_id, b->mutations.size());
+        auto from = utils::fb_utilities::get_broadcast_address();
+        auto sent = batched ? session->ms().send_stream_mutations(id, session->plan_id(), from, b->mutations, session->dst_cpu_id)
+                : session->ms().send_stream_mutation(id, session->plan_id(), *b->mutations.front(), session->dst_cpu_id);
+        sent.then_wrapped([&msg, id, b, verb] (auto&& f) {
+            try {
+                f.get();
+                sslog.debug("GOT {} Reply", verb);
+                msg.mutations_done.signal();
+            } catch (...) {
+                sslog.error("stream_transfer_task: Fail to send {} to {}: {}", verb, id, std::current_exception());
+                msg.mutations_done.broken();
+            }
+        }).finally([] {
+            get_local_stream_manager().mutation_send_limiter().signal();
+        });
+    });
+}
+
+// Hands out each piece of the partitions of a source as a mutation of its
+// own, so that no more than a piece of a wide partition is held at a time.
+// The receiver applies the pieces of a partition one after another.
+class partition_pieces_reader final : public mutation_reader::impl {
+    std::unique_ptr<sstables::partition_source> _source;
+    bool _in_partition = false;
+public:
+    partition_pieces_reader(std::unique_ptr<sstables::partition_source> source)
+        : _source(std::move(source))
+    { }
+    virtual future<mutation_opt> operator()() override {
+        if (!_in_partition) {
+            return _source->next_partition().then([this] (mutation_opt m) {
+                _in_partition = bool(m);
+                return std::move(m);
+            });
+        }
+        return _source->next_rows().then([this] (mutation_opt m) {
+            if (!m) {
+                _in_partition = false;
+                return operator()();
+            }
+            return make_ready_future<mutation_opt>(std::move(m));
+        });
+    }
+};
+
+mutation_reader make_sstables_reader(schema_ptr s, const std::vector<sstables::shared_sstable>& sstables,
+        const std::vector<query::range<dht::token>>& ranges) {
+    std::vector<std::unique_ptr<sstables::partition_source>> sources;
+    for (auto&& range : ranges) {
+        std::vector<query::range<dht::token>> unwrapped;
+        if (range.is_wrap_around(dht::token_comparator())) {
+            auto p = range.unwrap();
+            unwrapped.push_back(std::move(p.first));
+            unwrapped.push_back(std::move(p.second));
+        } else {
+            unwrapped.push_back(range);
+        }
+        for (auto&& r : unwrapped) {
+            auto pr = query::to_partition_range(r);
+            for (auto&& sst : sstables) {
+                sources.push_back(sst->read_range_rows_in_pieces(s, pr, mutation_batch_size, streaming_priority()));
+            }
+        }
+    }
+    return make_mutation_reader<partition_pieces_reader>(sstables::make_combined_partition_source(s, std::move(sources)));
+}
+
+future<> stream_transfer_task::send_sstable_files(sstring staging, stream_detail& detail) {
+    auto& db = stream_session::get_db();
+    auto cf_id = detail.cf_id;
+    return db.invoke_on_all([cf_id] (database& db) {
+        return db.find_column_family(cf_id).flush();
+    }).then([&db, cf_id, staging] {
+        return db.map_reduce0([cf_id, staging] (database& db) {
+            return stage_sstables(db.find_column_family(cf_id), staging);
+        }, std::vector<staged_sstable>(), [] (std::vector<staged_sstable> all, std::vector<staged_sstable> shard) {
+            std::move(shard.begin(), shard.end(), std::back_inserter(all));
+            return all;
+        });
+    }).then([this, &detail, staging] (std::vector<staged_sstable> staged) {
+        auto ranges = merge_token_ranges(detail.ranges);
+        std::vector<staged_sstable> whole;
+        std::vector<staged_sstable> partial;
+        for (auto&& st : staged) {
+            query::range<dht::token> r(query::range<dht::token>::bound(st.first, true),
+                    query::range<dht::token>::bound(st.last, true));
+            auto within = [&r] (const query::range<dht::token>& range) {
+                return range.contains(r, dht::token_comparator());
+            };
+            auto overlapping = [&r] (const query::range<dht::token>& range) {
+                return range.overlap(r, dht::token_comparator());
+            };
+            if (std::any_of(ranges.begin(), ranges.end(), within)) {
+                whole.push_back(std::move(st));
+            } else if (std::any_of(ranges.begin(), ranges.end(), overlapping)) {
+                partial.push_back(std::move(st));
+            }
+        }
+        sslog.info("[Stream #{}] Sending {} sstable(s) of cf_id={} as files and the ranges of {} other(s) as mutations",
+                session->plan_id(), whole.size(), cf_id, partial.size());
+        return do_with(std::move(whole), [this, staging] (const std::vector<staged_sstable>& whole) {
+            return do_for_each(whole, [this, staging] (const staged_sstable& st) {
+                return do_for_each(st.components, [this, staging] (const sstring& name) {
+                    return send_file(staging, name);
+                });
+            });
+        }).then([this, &detail, staging, partial = std::move(partial)] {
+            // Reads the data of the sstables partly within the ranges, the
+            // only data of the column family left since the flush.
+            auto s = stream_session::get_local_db().find_column_family(cf_id).schema();
+            return parallel_for_each(partial, [&detail, s, staging] (const staged_sstable& st) {
+                auto desc = sstables::entry_descriptor::make_descriptor(st.components.back());
+                auto sst = make_lw_shared<sstables::sstable>(s->ks_name(), s->cf_name(), staging,
+                        desc.generation, desc.version, desc.format);
+                return sst->load().then([&detail, sst] {
+                    detail.sstables.push_back(sst);
+                });
+            }).then([&detail, s] {
+                detail.mr = make_lw_shared(make_sstables_reader(s, detail.sstables, detail.ranges));
+            });
+        });
+    });
+}
+
 void stream_transfer_task::start() {
     using shard_id = net::messaging_service::shard_id;
     using net::messaging_verb;
@@ -76,27 +351,45 @@ void stream_transfer_task::start() {
         auto id = shard_id{session->peer, session->dst_cpu_id};
         sslog.debug("stream_transfer_task: Sending outgoing_file_message seq={} msg.detail.cf_id={}", seq, msg.detail.cf_id);
         it++;
-        consume(*msg.detail.mr, [&msg, this, seq, id] (mutation&& m) {
-            msg.mutations_nr++;
-            auto fm = make_lw_shared<const frozen_mutation>(m);
-            return get_local_stream_manager().mutation_send_limiter().wait().then([&msg, this, fm, seq, id] {
-                sslog.debug("SEND STREAM_MUTATION to {}, cf_id={}", id, fm->column_family_id());
-                session->ms().send_stream_mutation(id, session->plan_id(), *fm, session->dst_cpu_id).then_wrapped([&msg, this, id, fm] (auto&& f) {
-                    try {
-                        f.get();
-                        sslog.debug("GOT STREAM_MUTATION Reply");
-                        msg.mutations_done.signal();
-                    } catch (...) {
-                        sslog.error("stream_transfer_task: Fail to send STREAM_MUTATION to {}: {}", id, std::current_exception());
-                        msg.mutations_done.broken();
-                    }
-                }).finally([] {
-                    get_local_stream_manager().mutation_send_limiter().signal();
+        auto staging = msg.detail.sstable_files ? staging_directory(seq) : sstring();
+        auto prepared = msg.detail.sstable_files ? send_sstable_files(staging, msg.detail) : make_ready_future<>();
+        prepared.then([&msg, this] {
+            // Nodes not upgraded yet only know STREAM_MUTATION, one mutation
+            // per message.
+            auto batched = gms::get_local_gossiper().cluster_supports_feature(gms::versioned_value::STREAM_MUTATIONS);
+            auto batch = make_lw_shared<mutation_batch>();
+            auto timeslice = make_lw_shared<cpu_timeslice>(streaming_group());
+            return consume(*msg.detail.mr, [&msg, this, batch, timeslice, batched] (mutation&& m) {
+                auto fm = timeslice->run([&] {
+                    return make_lw_shared<const frozen_mutation>(m);
                 });
-                return stop_iteration::no;
+                batch->size += fm->representation().size();
+                batch->mutations.push_back(std::move(fm));
+                if (batched && batch->size < mutation_batch_size) {
+                    return timeslice->maybe_yield().then([] {
+                        return stop_iteration::no;
+                    });
+                }
+                auto full = std::move(*batch);
+                *batch = mutation_batch();
+                return send_mutations(msg, std::move(full), batched).then([] {
+                    return stop_iteration::no;
+                });
+            }).then([&msg, this, batch, batched] {
+                if (batch->mutations.empty()) {
+                    return make_ready_future<>();
+                }
+                return send_mutations(msg, std::move(*batch), batched);
             });
         }).then([&msg] {
             return msg.mutations_done.wait(msg.mutations_nr);
+        }).finally([staging] {
+            if (staging.empty()) {
+                return make_ready_future<>();
+            }
+            return remove_staging_directory(staging).handle_exception([staging] (auto ep) {
+                sslog.warn("stream_transfer_task: Fail to remove {}: {}", staging, ep);
+            });
         }).then_wrapped([this, seq, id] (auto&& f){
             // TODO: Add retry and timeout logic
             try {
@@ -43,12 +43,22 @@
 #include "streaming/messages/outgoing_file_message.hh"
 #include "streaming/stream_detail.hh"
 #include "sstables/sstables.hh"
+#include "frozen_mutation.hh"
 #include <map>
 
 namespace streaming {
 
 class stream_session;
 
+// Reads the data of the sstables within the ranges, handing out the pieces
+// of a partition as mutations of their own.
+mutation_reader make_sstables_reader(schema_ptr s, const std::vector<sstables::shared_sstable>& sstables,
+        const std::vector<query::range<dht::token>>& ranges);
+
+// The ranges as the fewest non-wrapping ranges covering the same tokens,
+// sorted.
+std::vector<query::range<dht::token>> merge_token_ranges(const std::vector<query::range<dht::token>>& ranges);
+
 /**
  * StreamTransferTask sends sections of SSTable files in certain ColumnFamily.
  */
@@ -151,6 +161,24 @@ class stream_transfer_task : public stream_task {
     }
 #endif
     void start();
+private:
+    // Mutations sent together in one STREAM_MUTATIONS message.
+    struct mutation_batch {
+        std::vector<lw_shared_ptr<const frozen_mutation>> mutations;
+        size_t size = 0;
+    };
+    // Sends the batch once the throughput and the window of batches in
+    // flight allow, without waiting for the reply, which signals
+    // msg.mutations_done. Unless batched, the batch is of a single mutation,
+    // sent in a STREAM_MUTATION message, which all nodes know.
+    future<> send_mutations(messages::outgoing_file_message& msg, mutation_batch batch, bool batched);
+    // The directory the sstables of the message are linked into while sent.
+    sstring staging_directory(int32_t sequence_number);
+    future<> send_file(sstring staging, sstring name);
+    // Flushes the column family, sends its sstables entirely within the
+    // ranges of the detail as files, and sets the reader of the detail to
+    // the data in the ranges of the others.
+    future<> send_sstable_files(sstring staging, stream_detail& detail);
 };
 
 } // namespace streaming
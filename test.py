@@ -46,6 +46,7 @@ boost_tests = [
     'UUID_test',
     'compound_test',
     'murmur_hash_test',
+    'bloom_filter_test',
     'partitioner_test',
     'frozen_mutation_test',
     'gossiping_property_file_snitch_test',
@@ -54,8 +55,22 @@ boost_tests = [
     'query_processor_test',
     'batchlog_manager_test',
     'logalloc_test',
+    'intrusive_btree_test',
+    'histogram_test',
     'crc_test',
     'flush_queue_test',
+    'merkle_tree_test',
+    'failure_detector_test',
+    'stall_detector_test',
+    'tracing_test',
+    'hints_manager_test',
+    'log_test',
+    'space_saving_test',
+    'stream_transfer_task_test',
+    'thrift_test',
+    'api_test',
+    'paxos_test',
+    'cql_compression_test',
 ]
 
 other_tests = [
@@ -29,3 +29,17 @@ BOOST_AUTO_TEST_CASE(test_generation_of_name_based_UUID) {
     auto uuid = utils::UUID_gen::get_name_UUID("systembatchlog");
     BOOST_REQUIRE_EQUAL(uuid.to_sstring(), "0290003c-977e-397c-ac3e-fdfdc01d626b");
 }
+
+BOOST_AUTO_TEST_CASE(test_time_UUIDs_are_unique_and_increasing) {
+    auto before = utils::UUID_gen::get_time_UUID();
+    auto uuids = utils::UUID_gen::get_time_UUIDs(1000);
+    auto after = utils::UUID_gen::get_time_UUID();
+    BOOST_REQUIRE_EQUAL(uuids.size(), 1000);
+    auto previous = before;
+    for (auto&& uuid : uuids) {
+        BOOST_REQUIRE_EQUAL(uuid.version(), 1);
+        BOOST_REQUIRE(uuid.timestamp() > previous.timestamp());
+        previous = uuid;
+    }
+    BOOST_REQUIRE(after.timestamp() > previous.timestamp());
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+
+#include <sstream>
+#include <set>
+#include <boost/test/unit_test.hpp>
+#include <json/json.h>
+
+#include "tests/test-utils.hh"
+#include "tests/cql_test_env.hh"
+#include "core/thread.hh"
+#include "core/scollectd.hh"
+#include "api/api.hh"
+#include "api/collectd.hh"
+#include "api/lsa.hh"
+
+// Serves a GET of path through the routes, as the API server does.
+static sstring get(httpd::routes& r, sstring path) {
+    auto req = std::make_unique<httpd::request>();
+    req->_method = "GET";
+    req->_url = path;
+    return r.handle(path, std::move(req), std::make_unique<httpd::reply>()).get0()->_content;
+}
+
+SEASTAR_TEST_CASE(test_collectd_metrics_scrape) {
+    return do_with_cql_env([] (cql_test_env& e) {
+        return seastar::async([&e] {
+            api::http_context ctx(e.db(), service::get_storage_proxy());
+            httpd::routes r;
+            api::set_collectd(ctx, r);
+
+            double value = 42;
+            auto reg = scollectd::add_polled_metric(scollectd::type_instance_id("api_test",
+                    scollectd::per_cpu_plugin_instance, "gauge", "answer"),
+                    scollectd::make_typed(scollectd::data_type::GAUGE, [&value] { return value; }));
+
+            // A line per value, the shard, the plugin instance and the type
+            // instance as labels.
+            auto find_answer = [] (const sstring& metrics) {
+                std::istringstream lines(metrics);
+                std::string line;
+                std::vector<std::string> found;
+                while (std::getline(lines, line)) {
+                    if (line.find("scylla_api_test_gauge{") == 0) {
+                        found.push_back(line);
+                    }
+                }
+                BOOST_REQUIRE_EQUAL(found.size(), 1);
+                BOOST_REQUIRE(found[0].find(sprint("shard=\"%d\"", engine().cpu_id())) != std::string::npos);
+                BOOST_REQUIRE(found[0].find("type_instance=\"answer\"} ") != std::string::npos);
+                return found[0].substr(found[0].rfind(' ') + 1);
+            };
+            auto metrics = get(r, "/collectd/metrics");
+            BOOST_REQUIRE_EQUAL(find_answer(metrics), "42");
+
+            // The metrics of every shard are in.
+            for (unsigned cpu = 0; cpu < smp::count; ++cpu) {
+                auto dirty = sprint("scylla_memory_bytes{shard=\"%d\"", cpu);
+                BOOST_REQUIRE(metrics.find(dirty) != sstring::npos);
+            }
+
+            // Read anew on each scrape.
+            value = 43;
+            BOOST_REQUIRE_EQUAL(find_answer(get(r, "/collectd/metrics")), "43");
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_lsa_memory_usage) {
+    return do_with_cql_env([] (cql_test_env& e) {
+        return seastar::async([&e] {
+            api::http_context ctx(e.db(), service::get_storage_proxy());
+            httpd::routes r;
+            api::set_lsa(ctx, r);
+
+            // The memory of each shard, once.
+            auto usage = [&r] {
+                Json::Value root;
+                Json::Reader reader;
+                BOOST_REQUIRE(reader.parse(std::string(get(r, "/lsa/memory")), root));
+                BOOST_REQUIRE(root.isArray());
+                BOOST_REQUIRE_EQUAL(root.size(), smp::count);
+                std::set<unsigned> shards;
+                for (auto&& m : root) {
+                    BOOST_REQUIRE(shards.insert(m["shard"].asUInt()).second);
+                    BOOST_REQUIRE(m["total"].asUInt64() > 0);
+                    BOOST_REQUIRE(m["free"].asUInt64() <= m["total"].asUInt64());
+                }
+                return root;
+            };
+            auto sum = [] (const Json::Value& root, const char* field) {
+                uint64_t total = 0;
+                for (auto&& m : root) {
+                    total += m[field].asUInt64();
+                }
+                return total;
+            };
+
+            auto before = usage();
+            e.execute_cql("create table cf (p int primary key, v text);").get();
+            for (int i = 0; i < 100; ++i) {
+                e.execute_cql(sprint("insert into cf (p, v) values (%d, '%s');", i, sstring(1000, 'x'))).get();
+            }
+            // The writes are in memtables.
+            auto after = usage();
+            BOOST_REQUIRE(sum(after, "memtables") > sum(before, "memtables"));
+            BOOST_REQUIRE(sum(after, "memtables") >= 100 * 1000);
+        });
+    });
+}
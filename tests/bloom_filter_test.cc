@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+#include <deque>
+
+#include "utils/bloom_filter.hh"
+#include "utils/blocked_bloom_filter.hh"
+#include "core/print.hh"
+
+using namespace utils;
+
+static bytes key(int i) {
+    auto s = sprint("key%d", i);
+    return bytes(reinterpret_cast<const int8_t*>(s.data()), s.size());
+}
+
+static void check_no_false_negatives(filter_format format) {
+    const int n = 10000;
+    auto f = i_filter::get_filter(n, 0.01, format);
+    for (int i = 0; i < n; ++i) {
+        f->add(key(i));
+    }
+    for (int i = 0; i < n; ++i) {
+        BOOST_REQUIRE(f->is_present(key(i)));
+    }
+}
+
+static double false_positive_rate(filter_format format, double fp_chance) {
+    const int n = 10000;
+    auto f = i_filter::get_filter(n, fp_chance, format);
+    for (int i = 0; i < n; ++i) {
+        f->add(key(i));
+    }
+    int false_positives = 0;
+    for (int i = n; i < 2 * n; ++i) {
+        false_positives += f->is_present(key(i));
+    }
+    return double(false_positives) / n;
+}
+
+BOOST_AUTO_TEST_CASE(test_no_false_negatives) {
+    check_no_false_negatives(filter_format::murmur3);
+    check_no_false_negatives(filter_format::blocked);
+}
+
+BOOST_AUTO_TEST_CASE(test_blocked_filter_false_positive_rate) {
+    for (auto fp_chance : { 0.1, 0.01, 0.001 }) {
+        auto rate = false_positive_rate(filter_format::blocked, fp_chance);
+        BOOST_REQUIRE_MESSAGE(rate <= fp_chance * 2, sprint("false positive rate %f for fp_chance %f", rate, fp_chance));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_blocked_filter_save_load) {
+    const int n = 1000;
+    filter::blocked_bloom_filter f1(7, 100);
+    for (int i = 0; i < n; ++i) {
+        f1.add(key(i));
+    }
+    std::deque<uint64_t> words(f1.nr_words());
+    f1.save(words.begin());
+
+    filter::blocked_bloom_filter f2(f1.num_hashes(), f1.nr_blocks());
+    f2.load(words.begin(), words.end());
+    for (int i = 0; i < 2 * n; ++i) {
+        BOOST_REQUIRE_EQUAL(f1.is_present(key(i)), f2.is_present(key(i)));
+    }
+
+    f2.clear();
+    for (int i = 0; i < n; ++i) {
+        BOOST_REQUIRE(!f2.is_present(key(i)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_filter_format_names) {
+    for (auto format : { filter_format::murmur3, filter_format::blocked }) {
+        BOOST_REQUIRE(filter_format_from_sstring(to_sstring(format)) == format);
+    }
+    BOOST_REQUIRE_THROW(filter_format_from_sstring("bogus"), std::invalid_argument);
+}
@@ -275,3 +275,16 @@ BOOST_AUTO_TEST_CASE(test_append_big_and_small_chunks) {
     buf.append(big);
     buf.append(small);
 }
+
+BOOST_AUTO_TEST_CASE(test_large_buffer_has_few_fragments) {
+    int count = 1024*1024;
+
+    bytes_ostream buf;
+    append_sequence(buf, count);
+
+    // Chunks grow as the buffer does, rather than staying small.
+    auto fragments = std::distance(buf.fragments().begin(), buf.fragments().end());
+    BOOST_REQUIRE(fragments < 64);
+
+    assert_sequence(buf, count);
+}
@@ -28,10 +28,12 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <set>
+#include <boost/range/irange.hpp>
 
 #include "tests/test-utils.hh"
 #include "core/future-util.hh"
 #include "core/do_with.hh"
+#include "core/sleep.hh"
 #include "core/scollectd_api.hh"
 #include "core/file.hh"
 #include "core/reactor.hh"
@@ -175,6 +177,34 @@ SEASTAR_TEST_CASE(test_commitlog_written_to_disk_batch){
         });
 }
 
+SEASTAR_TEST_CASE(test_commitlog_batch_group_commit){
+    commitlog::config cfg;
+    cfg.mode = commitlog::sync_mode::BATCH;
+    cfg.commitlog_sync_batch_window_in_ms = 100;
+    return make_commitlog(cfg).then([](tmplog_ptr log) {
+            auto uuid = utils::UUID_gen::get_time_UUID();
+            return parallel_for_each(boost::irange(0, 10), [log, uuid](int) {
+                        sstring tmp = "hej bubba cow";
+                        return log->second.add_mutation(uuid, tmp.size(), [tmp](db::commitlog::output& dst) {
+                                    dst.write(tmp.begin(), tmp.end());
+                                }).then([](replay_position rp) {
+                                    BOOST_CHECK_NE(rp, db::replay_position());
+                                });
+                    }).then([log] {
+                        // All ten writes were acknowledged by the same sync.
+                        auto& sizes = log->second.get_batch_size_histogram();
+                        BOOST_REQUIRE_EQUAL(sizes.count, 1);
+                        BOOST_REQUIRE_EQUAL(sizes.max, 10);
+                        BOOST_REQUIRE_EQUAL(log->second.get_batch_sync_latency_histogram().count, 1);
+                        return count_files_with_size(log->first.path).then([log](size_t n) {
+                                    BOOST_REQUIRE(n > 0);
+                                });
+                    }).finally([log]() {
+                        return log->second.clear().then([log] {});
+                    });
+        });
+}
+
 SEASTAR_TEST_CASE(test_commitlog_written_to_disk_periodic){
     return make_commitlog().then([](tmplog_ptr log) {
             auto state = make_lw_shared(false);
@@ -277,6 +307,85 @@ SEASTAR_TEST_CASE(test_commitlog_discard_completed_segments){
         });
 }
 
+SEASTAR_TEST_CASE(test_commitlog_recycle_segments){
+    commitlog::config cfg;
+    cfg.commitlog_segment_size_in_mb = 1;
+    return make_commitlog(cfg).then([](tmplog_ptr log) {
+            auto ids = make_lw_shared<std::set<segment_id_type>>();
+            auto uuid = utils::UUID_gen::get_time_UUID();
+            auto write = [log, ids, uuid] {
+                sstring tmp = "hej bubba cow";
+                return log->second.add_mutation(uuid, tmp.size(), [tmp](db::commitlog::output& dst) {
+                            dst.write(tmp.begin(), tmp.end());
+                        }).then([ids](replay_position rp) {
+                            ids->insert(rp.id);
+                        });
+            };
+            return do_until([ids]() { return ids->size() > 1; }, write).then([log, ids, uuid] {
+                return log->second.sync_all_segments().then([log, ids, uuid] {
+                    log->second.discard_completed_segments(uuid, replay_position(*ids->rbegin(), 0));
+                    BOOST_REQUIRE_EQUAL(log->second.get_num_segments_destroyed(), 1);
+                    return do_until([log] { return log->second.get_num_segments_recycled() > 0; }, [] {
+                        return sleep(std::chrono::milliseconds(1));
+                    });
+                });
+            }).then([log] {
+                // The recycled file replaced the discarded one.
+                return count_files(log->first.path).then([log](size_t n) {
+                    BOOST_REQUIRE_EQUAL(n, 2);
+                });
+            }).finally([log]() {
+                return log->second.clear().then([log] {});
+            });
+        });
+}
+
+SEASTAR_TEST_CASE(test_commitlog_buffer_pool){
+    return make_commitlog().then([](tmplog_ptr log) {
+            auto uuid = utils::UUID_gen::get_time_UUID();
+            // Each large write cycles the buffer of its segment.
+            auto size = 64 * 1024;
+            return do_for_each(boost::irange(0, 10), [log, uuid, size](int) {
+                        return log->second.add_mutation(uuid, size, [size](db::commitlog::output& dst) {
+                                    dst.write(char(1), size);
+                                }).then([log](replay_position) {
+                                    return log->second.sync_all_segments();
+                                });
+                    }).then([log] {
+                        BOOST_REQUIRE_GT(log->second.get_buffer_pool_hits(), 0);
+                        BOOST_REQUIRE_LT(log->second.get_buffer_pool_misses(), 10);
+                    }).finally([log]() {
+                        return log->second.clear().then([log] {});
+                    });
+        });
+}
+
+SEASTAR_TEST_CASE(test_commitlog_pending_write_limit){
+    commitlog::config cfg;
+    cfg.max_pending_writes_in_kb = 1;
+    return make_commitlog(cfg).then([](tmplog_ptr log) {
+            auto uuid = utils::UUID_gen::get_time_UUID();
+            auto size = 64 * 1024;
+            return log->second.add_mutation(uuid, size, [size](db::commitlog::output& dst) {
+                        dst.write(char(1), size);
+                    }).then([log, uuid, size](replay_position) {
+                        // Each write cycles the buffer of the previous one, so
+                        // all but the first ones have to wait for the disk.
+                        return parallel_for_each(boost::irange(0, 10), [log, uuid, size](int) {
+                            return log->second.add_mutation(uuid, size, [size](db::commitlog::output& dst) {
+                                        dst.write(char(1), size);
+                                    }).then([](replay_position rp) {
+                                        BOOST_CHECK_NE(rp, db::replay_position());
+                                    });
+                        });
+                    }).then([log] {
+                        BOOST_REQUIRE_GT(log->second.get_pending_write_stalls(), 0);
+                    }).finally([log]() {
+                        return log->second.clear().then([log] {});
+                    });
+        });
+}
+
 SEASTAR_TEST_CASE(test_equal_record_limit){
     return make_commitlog().then([](tmplog_ptr log) {
             auto size = log->second.max_record_size();
@@ -397,6 +506,55 @@ SEASTAR_TEST_CASE(test_commitlog_reader){
         });
 }
 
+SEASTAR_TEST_CASE(test_commitlog_compressed_reader){
+    commitlog::config cfg;
+    cfg.commitlog_segment_size_in_mb = 1;
+    cfg.compression = true;
+    return make_commitlog(cfg).then([](tmplog_ptr log) {
+            auto set = make_lw_shared<std::set<segment_id_type>>();
+            auto written = make_lw_shared<std::vector<db::replay_position>>();
+            auto read = make_lw_shared<std::vector<db::replay_position>>();
+            auto uuid = utils::UUID_gen::get_time_UUID();
+            return do_until([set]() {return set->size() > 1;},
+                    [log, uuid, set, written]() {
+                        sstring tmp = "hej bubba cow";
+                        return log->second.add_mutation(uuid, tmp.size(), [tmp](db::commitlog::output& dst) {
+                                    dst.write(tmp.begin(), tmp.end());
+                                }).then([set, written](replay_position rp) {
+                                    set->insert(rp.id);
+                                    if (set->size() == 1) {
+                                        written->emplace_back(rp);
+                                    }
+                                });
+                    }).then([log] {
+                        BOOST_REQUIRE_LT(log->second.get_compression_bytes_out(), log->second.get_compression_bytes_in());
+                    }).then([log, set, read] {
+                        auto findme = sstring("CommitLog-1-") + std::to_string(*set->begin()) + ".log";
+                        return list_files(log->first.path).then([log, findme, read](auto l) {
+                                    for (auto & de : l->contents()) {
+                                        if (de.name == findme) {
+                                            auto path = log->first.path + "/" + de.name;
+                                            return db::commitlog::read_log_file(path, [read](temporary_buffer<char> buf, db::replay_position rp) {
+                                                        sstring str(buf.get(), buf.size());
+                                                        BOOST_CHECK_EQUAL(str, "hej bubba cow");
+                                                        read->emplace_back(rp);
+                                                        return make_ready_future<>();
+                                                    }).then([log](auto s) {
+                                                        auto ss = make_lw_shared(std::move(s));
+                                                        return ss->done().then([ss] {});
+                                                    });
+                                        }
+                                    }
+                                    throw std::runtime_error("Did not find expected log file");
+                               });
+                    }).then([written, read] {
+                        BOOST_REQUIRE(*written == *read);
+                    }).finally([log]() {
+                        return log->second.clear().then([log] {});
+                    });
+        });
+}
+
 SEASTAR_TEST_CASE(test_commitlog_counters) {
     auto count_cl_counters = []() -> size_t {
         auto ids = scollectd::get_collectd_ids();
@@ -450,3 +608,41 @@ SEASTAR_TEST_CASE(test_allocation_failure){
 }
 
 #endif
+
+// Several commitlogs can live on the same shard, as long as only one
+// registers the metrics, and the entries of one which was shut down can
+// be read back from its segments.
+SEASTAR_TEST_CASE(test_commitlog_without_metrics){
+    return make_commitlog().then([](tmplog_ptr main_log) {
+        commitlog::config cfg;
+        cfg.max_reserve_segments = 0;
+        cfg.register_metrics = false;
+        return make_commitlog(cfg).then([main_log](tmplog_ptr log) {
+            auto uuid = utils::UUID_gen::get_time_UUID();
+            sstring tmp = "hej bubba cow";
+            return log->second.add_mutation(uuid, tmp.size(), [tmp](db::commitlog::output& dst) {
+                dst.write(tmp.begin(), tmp.end());
+            }).then([log](replay_position) {
+                return log->second.shutdown();
+            }).then([log] {
+                return log->second.list_existing_segments();
+            }).then([log](std::vector<sstring> paths) {
+                BOOST_REQUIRE_EQUAL(paths.size(), 1);
+                auto count = make_lw_shared<size_t>(0);
+                return db::commitlog::read_log_file(paths.front(), [count](temporary_buffer<char> buf, db::replay_position rp) {
+                    sstring str(buf.get(), buf.size());
+                    BOOST_CHECK_EQUAL(str, "hej bubba cow");
+                    ++(*count);
+                    return make_ready_future<>();
+                }).then([](auto s) {
+                    auto ss = make_lw_shared(std::move(s));
+                    return ss->done().then([ss] {});
+                }).then([count] {
+                    BOOST_CHECK_EQUAL(*count, 1);
+                });
+            }).finally([log, main_log] {
+                return main_log->second.clear().then([main_log] {});
+            });
+        });
+    });
+}
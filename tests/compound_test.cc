@@ -229,3 +229,36 @@ BOOST_AUTO_TEST_CASE(test_legacy_ordering_of_composites) {
     BOOST_REQUIRE(cmp(make("", "A"), make("A", "A")) < 0);
     BOOST_REQUIRE(cmp(make("A", ""), make("A", "A")) < 0);
 }
+
+BOOST_AUTO_TEST_CASE(test_comparable_bytes_order_like_compound) {
+    compound_type<allow_prefixes::yes> t({int32_type, reversed_type_impl::get_instance(utf8_type), bytes_type});
+    BOOST_REQUIRE(t.has_comparable_bytes());
+
+    auto i = [] (int32_t v) { return int32_type->decompose(v); };
+    std::vector<bytes> values = {
+        t.serialize_value(std::vector<bytes>{}),
+        t.serialize_value({i(-1)}),
+        t.serialize_value({i(1)}),
+        t.serialize_value({i(1), to_bytes("a")}),
+        t.serialize_value({i(1), to_bytes("ab")}),
+        t.serialize_value({i(1), to_bytes("")}),
+        t.serialize_value({i(1), to_bytes("a"), to_bytes("")}),
+        t.serialize_value({i(1), to_bytes("a"), bytes(1, int8_t(0))}),
+        t.serialize_value({i(1), to_bytes("a"), bytes(2, int8_t(0))}),
+        t.serialize_value({i(1), to_bytes("a"), bytes(1, int8_t(-1))}),
+        t.serialize_value({bytes(), to_bytes("a")}),
+    };
+    auto sign = [] (int c) { return c < 0 ? -1 : c > 0 ? 1 : 0; };
+    for (auto&& v1 : values) {
+        for (auto&& v2 : values) {
+            auto c1 = t.to_comparable_bytes(v1);
+            auto c2 = t.to_comparable_bytes(v2);
+            BOOST_REQUIRE(c1 && c2);
+            BOOST_REQUIRE_EQUAL(sign(compare_unsigned(*c1, *c2)), sign(t.compare(v1, v2)));
+        }
+    }
+
+    compound_type<allow_prefixes::yes> generic({int32_type, double_type});
+    BOOST_REQUIRE(!generic.has_comparable_bytes());
+    BOOST_REQUIRE(!generic.to_comparable_bytes(generic.serialize_value({i(1)})));
+}
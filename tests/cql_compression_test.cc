@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+#include <lz4.h>
+#include <snappy-c.h>
+#include <arpa/inet.h>
+
+#include "transport/server.hh"
+#include "exceptions/exceptions.hh"
+
+using namespace transport;
+
+// A body which compresses well, like most result sets do.
+static bytes make_body(size_t size) {
+    bytes b(bytes::initialized_later(), size);
+    for (size_t i = 0; i < size; ++i) {
+        b[i] = "abcd"[i / 16 % 4];
+    }
+    return b;
+}
+
+static temporary_buffer<char> to_buffer(const char* data, size_t size) {
+    return temporary_buffer<char>(data, size);
+}
+
+static bytes to_bytes(const temporary_buffer<char>& buf) {
+    return bytes(reinterpret_cast<const int8_t*>(buf.get()), buf.size());
+}
+
+static void check_round_trip(cql_compression compression) {
+    for (size_t size : {1u, 100u, 4096u, 1u << 20}) {
+        auto body = make_body(size);
+        std::vector<char> buf;
+        auto len = compress_frame_body(compression, body, buf);
+        if (size > 100) {
+            BOOST_REQUIRE(len > 0);
+            BOOST_REQUIRE(len < size);
+        }
+        if (len) {
+            auto out = decompress_frame_body(compression, to_buffer(buf.data(), len));
+            BOOST_REQUIRE(to_bytes(out) == body);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_lz4_round_trip) {
+    check_round_trip(cql_compression::lz4);
+}
+
+BOOST_AUTO_TEST_CASE(test_snappy_round_trip) {
+    check_round_trip(cql_compression::snappy);
+}
+
+BOOST_AUTO_TEST_CASE(test_body_not_compressed_unless_smaller) {
+    std::vector<char> buf;
+    BOOST_REQUIRE_EQUAL(compress_frame_body(cql_compression::lz4, bytes(), buf), 0);
+    BOOST_REQUIRE_EQUAL(compress_frame_body(cql_compression::snappy, bytes(), buf), 0);
+    BOOST_REQUIRE_EQUAL(compress_frame_body(cql_compression::none, make_body(4096), buf), 0);
+
+    // Random bytes only grow by the framing of the algorithm.
+    bytes noise(bytes::initialized_later(), 64);
+    for (size_t i = 0; i < noise.size(); ++i) {
+        noise[i] = (i * 2654435761u) >> 13;
+    }
+    BOOST_REQUIRE_EQUAL(compress_frame_body(cql_compression::lz4, noise, buf), 0);
+}
+
+// Frames built the way the drivers do, with the libraries directly.
+BOOST_AUTO_TEST_CASE(test_client_lz4_frame_is_decompressed) {
+    auto body = make_body(10000);
+    std::vector<char> frame(4 + LZ4_compressBound(body.size()));
+    auto n = htonl(body.size());
+    std::copy_n(reinterpret_cast<const char*>(&n), 4, frame.data());
+    auto len = LZ4_compress(reinterpret_cast<const char*>(body.data()), frame.data() + 4, body.size());
+    BOOST_REQUIRE(len > 0);
+
+    auto out = decompress_frame_body(cql_compression::lz4, to_buffer(frame.data(), 4 + len));
+    BOOST_REQUIRE(to_bytes(out) == body);
+
+    // An empty body is just its length.
+    char empty[4] = {};
+    BOOST_REQUIRE_EQUAL(decompress_frame_body(cql_compression::lz4, to_buffer(empty, 4)).size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_client_snappy_frame_is_decompressed) {
+    auto body = make_body(10000);
+    size_t len = snappy_max_compressed_length(body.size());
+    std::vector<char> frame(len);
+    BOOST_REQUIRE(snappy_compress(reinterpret_cast<const char*>(body.data()), body.size(), frame.data(), &len) == SNAPPY_OK);
+
+    auto out = decompress_frame_body(cql_compression::snappy, to_buffer(frame.data(), len));
+    BOOST_REQUIRE(to_bytes(out) == body);
+}
+
+BOOST_AUTO_TEST_CASE(test_corrupted_frames_are_rejected) {
+    auto body = make_body(10000);
+    std::vector<char> buf;
+    auto len = compress_frame_body(cql_compression::lz4, body, buf);
+    BOOST_REQUIRE(len > 0);
+
+    // Shorter than the length.
+    BOOST_REQUIRE_THROW(decompress_frame_body(cql_compression::lz4, to_buffer(buf.data(), 3)),
+            exceptions::protocol_exception);
+    // A length which does not match the body.
+    auto wrong = buf;
+    wrong[3] ^= 1;
+    BOOST_REQUIRE_THROW(decompress_frame_body(cql_compression::lz4, to_buffer(wrong.data(), len)),
+            exceptions::protocol_exception);
+    // Lengths no frame can have.
+    for (uint32_t l : {0xffffffffu, 512u << 20}) {
+        auto n = htonl(l);
+        std::copy_n(reinterpret_cast<const char*>(&n), 4, wrong.data());
+        BOOST_REQUIRE_THROW(decompress_frame_body(cql_compression::lz4, to_buffer(wrong.data(), len)),
+                exceptions::protocol_exception);
+    }
+    // A truncated body.
+    BOOST_REQUIRE_THROW(decompress_frame_body(cql_compression::lz4, to_buffer(buf.data(), len / 2)),
+            exceptions::protocol_exception);
+
+    len = compress_frame_body(cql_compression::snappy, body, buf);
+    BOOST_REQUIRE(len > 0);
+    BOOST_REQUIRE_THROW(decompress_frame_body(cql_compression::snappy, to_buffer(buf.data(), len / 2)),
+            exceptions::protocol_exception);
+    char garbage[] = "\xff\xff\xff\xff\xff\xff";
+    BOOST_REQUIRE_THROW(decompress_frame_body(cql_compression::snappy, to_buffer(garbage, sizeof(garbage))),
+            exceptions::protocol_exception);
+}
@@ -33,7 +33,11 @@
 
 #include "core/future-util.hh"
 #include "core/sleep.hh"
+#include "core/thread.hh"
 #include "transport/messages/result_message.hh"
+#include "cql3/query_options.hh"
+#include "cql3/result_cache.hh"
+#include "service/pager/paging_state.hh"
 #include "utils/big_decimal.hh"
 
 using namespace std::literals::chrono_literals;
@@ -72,6 +76,20 @@ SEASTAR_TEST_CASE(test_insert_statement) {
     });
 }
 
+SEASTAR_TEST_CASE(test_insert_statement_without_durable_writes) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create keyspace ks4 with replication = { 'class' : 'SimpleStrategy', 'replication_factor' : 1 } and durable_writes = false;").discard_result().then([&e] {
+            return e.execute_cql("create table ks4.cf (p1 varchar, c1 int, r1 int, PRIMARY KEY (p1, c1));").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into ks4.cf (p1, c1, r1) values ('key1', 1, 100);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select r1 from ks4.cf where p1 = 'key1' and c1 = 1;").then([] (auto msg) {
+                assert_that(msg).is_rows().with_rows({{int32_type->decompose(100)}});
+            });
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_select_statement) {
    return do_with_cql_env([] (auto& e) {
         return e.create_table([](auto ks_name) {
@@ -1751,6 +1769,91 @@ SEASTAR_TEST_CASE(test_select_distinct) {
     });
 }
 
+SEASTAR_TEST_CASE(test_multi_column_in_restrictions) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tmci (p1 int, c1 int, c2 int, r1 int, PRIMARY KEY (p1, c1, c2)) with clustering order by (c1 asc, c2 desc);").discard_result().then([&e] {
+            return parallel_for_each(boost::irange(0, 9), [&e] (int i) {
+                return e.execute_cql(sprint("insert into tmci (p1, c1, c2, r1) values (0, %d, %d, %d);", i / 3, i % 3, i)).discard_result();
+            });
+        }).then([&e] {
+            return e.execute_cql("select c1, c2 from tmci where p1 = 0 and c1 in (2, 0, 2) and c2 in (0, 2, 0);");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({
+                {int32_type->decompose(0), int32_type->decompose(2)},
+                {int32_type->decompose(0), int32_type->decompose(0)},
+                {int32_type->decompose(2), int32_type->decompose(2)},
+                {int32_type->decompose(2), int32_type->decompose(0)},
+            });
+            return e.execute_cql("select c1, c2 from tmci where p1 = 0 and c1 in (1, 0) and c2 > 0;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({
+                {int32_type->decompose(0), int32_type->decompose(2)},
+                {int32_type->decompose(0), int32_type->decompose(1)},
+                {int32_type->decompose(1), int32_type->decompose(2)},
+                {int32_type->decompose(1), int32_type->decompose(1)},
+            });
+        });
+    });
+}
+
+// Partitions in sstables are listed from their index files, and those of
+// sstables holding tombstones are checked to be live.
+SEASTAR_TEST_CASE(test_select_distinct_from_sstables) {
+    return do_with_cql_env([] (auto& e) {
+        auto flush = [&e] {
+            return e.db().invoke_on_all([] (database& db) {
+                return db.find_column_family("ks", "tsdf").flush();
+            });
+        };
+        return e.execute_cql("create table tsdf (p1 int, c1 int, r1 int, PRIMARY KEY (p1, c1));").discard_result().then([&e] {
+            return parallel_for_each(boost::irange(0, 4), [&e] (int p) {
+                return e.execute_cql(sprint("insert into tsdf (p1, c1, r1) values (%d, 0, 0);", p)).discard_result();
+            });
+        }).then(flush).then([&e] {
+            return e.execute_cql("select distinct p1 from tsdf;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_size(4)
+                .with_row({int32_type->decompose(0)})
+                .with_row({int32_type->decompose(1)})
+                .with_row({int32_type->decompose(2)})
+                .with_row({int32_type->decompose(3)});
+            return e.execute_cql("delete from tsdf where p1 = 1;").discard_result();
+        }).then([&e] {
+            return e.execute_cql("delete from tsdf where p1 = 2 and c1 = 0;").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into tsdf (p1, c1, r1) values (4, 0, 0);").discard_result();
+        }).then(flush).then([&e] {
+            return e.execute_cql("select distinct p1 from tsdf;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_size(3)
+                .with_row({int32_type->decompose(0)})
+                .with_row({int32_type->decompose(3)})
+                .with_row({int32_type->decompose(4)});
+            return e.execute_cql("select distinct p1 from tsdf limit 2;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_size(2);
+        });
+    });
+}
+
+// Values bound by name are reordered as views of the request.
+SEASTAR_TEST_CASE(test_query_options_named_values) {
+    bytes request = int32_type->decompose(1) + int32_type->decompose(2);
+    bytes_view a(request.data(), 4);
+    bytes_view b(request.data() + 4, 4);
+    cql3::query_options options(db::consistency_level::ONE, std::vector<sstring_view>{"b", "a"},
+            std::vector<bytes_view_opt>{b, a}, false, cql3::query_options::specific_options::DEFAULT,
+            3, serialization_format::use_32_bit());
+    auto spec = [] (sstring name) {
+        return ::make_shared<cql3::column_specification>("ks", "cf", ::make_shared<cql3::column_identifier>(name, true), int32_type);
+    };
+    options.prepare({spec("a"), spec("b")});
+    BOOST_REQUIRE_EQUAL(options.get_values_count(), 2);
+    BOOST_REQUIRE(options.get_value_at(0)->data() == a.data());
+    BOOST_REQUIRE(options.get_value_at(1)->data() == b.data());
+    return make_ready_future<>();
+}
+
 SEASTAR_TEST_CASE(test_batch_insert_statement) {
     return do_with_cql_env([] (auto& e) {
         return e.execute_cql("create table cf (p1 varchar, c1 int, r1 int, PRIMARY KEY (p1, c1));").discard_result().then([&e] {
@@ -1774,6 +1877,63 @@ APPLY BATCH;)"
     });
 }
 
+SEASTAR_TEST_CASE(test_batch_same_partition) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table cf (p1 varchar, c1 int, r1 int, PRIMARY KEY (p1, c1));").discard_result().then([&e] {
+            return e.execute_cql("create table cf2 (p1 varchar, c1 int, r1 int, PRIMARY KEY (p1, c1));").discard_result();
+        }).then([&e] {
+            return e.execute_cql(R"(BEGIN BATCH
+insert into cf (p1, c1, r1) values ('key1', 1, 100);
+insert into cf2 (p1, c1, r1) values ('key1', 1, 101);
+insert into cf (p1, c1, r1) values ('key2', 1, 200);
+insert into cf (p1, c1, r1) values ('key1', 2, 300);
+update cf set r1 = 66 where p1 = 'key1' and c1 = 3;
+APPLY BATCH;)"
+            ).discard_result();
+        }).then([&e] {
+            return e.require_column_has_value("cf", {sstring("key1")}, {1}, "r1", 100);
+        }).then([&e] {
+            return e.require_column_has_value("cf", {sstring("key1")}, {3}, "r1", 66);
+        }).then([&e] {
+            return e.require_column_has_value("cf", {sstring("key1")}, {2}, "r1", 300);
+        }).then([&e] {
+            return e.require_column_has_value("cf", {sstring("key2")}, {1}, "r1", 200);
+        }).then([&e] {
+            return e.require_column_has_value("cf2", {sstring("key1")}, {1}, "r1", 101);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_batch_list_operations) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table cf (p1 varchar, c1 int, l list<int>, PRIMARY KEY (p1, c1));").discard_result().then([&e] {
+            return e.execute_cql(R"(BEGIN BATCH
+insert into cf (p1, c1, l) values ('key1', 1, [1, 2, 3]);
+insert into cf (p1, c1, l) values ('key1', 2, [1, 2, 3]);
+insert into cf (p1, c1, l) values ('key2', 1, [1, 2, 3]);
+APPLY BATCH;)"
+            ).discard_result();
+        }).then([&e] {
+            return e.execute_cql(R"(BEGIN BATCH
+update cf set l[0] = 10 where p1 = 'key1' and c1 = 1;
+update cf set l = l - [2] where p1 = 'key1' and c1 = 2;
+update cf set l[2] = 30 where p1 = 'key2' and c1 = 1;
+delete l[1] from cf where p1 = 'key1' and c1 = 1;
+APPLY BATCH;)"
+            ).discard_result();
+        }).then([&e] {
+            return e.require_column_has_value("cf", {sstring("key1")}, {1},
+                    "l", list_type_impl::native_type({10, 3}));
+        }).then([&e] {
+            return e.require_column_has_value("cf", {sstring("key1")}, {2},
+                    "l", list_type_impl::native_type({1, 3}));
+        }).then([&e] {
+            return e.require_column_has_value("cf", {sstring("key2")}, {1},
+                    "l", list_type_impl::native_type({1, 2, 30}));
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_in_restriction) {
     return do_with_cql_env([] (auto& e) {
         return e.execute_cql("create table tir (p1 int, c1 int, r1 int, PRIMARY KEY (p1, c1));").discard_result().then([&e] {
@@ -1887,3 +2047,416 @@ SEASTAR_TEST_CASE(test_compact_storage) {
         });
     });
 }
+
+static std::unique_ptr<cql3::query_options> paged_query_options(int32_t page_size, ::shared_ptr<service::pager::paging_state> state) {
+    return std::make_unique<cql3::query_options>(db::consistency_level::ONE, std::experimental::nullopt,
+            std::vector<bytes_view_opt>(), false,
+            cql3::query_options::specific_options{page_size, std::move(state), db::consistency_level::SERIAL, api::missing_timestamp},
+            3, serialization_format::use_32_bit());
+}
+
+// The paging state of a page, as a client would send it back.
+static ::shared_ptr<service::pager::paging_state> next_page(shared_ptr<transport::messages::result_message> msg) {
+    auto rows = dynamic_pointer_cast<transport::messages::result_message::rows>(msg);
+    auto state = rows->rs().get_metadata().paging_state();
+    return state ? service::pager::paging_state::deserialize(state->serialize()) : state;
+}
+
+SEASTAR_TEST_CASE(test_paging) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tp (p int, c int, v int, PRIMARY KEY (p, c));").discard_result().then([&e] {
+            return parallel_for_each(boost::irange(0, 5), [&e] (int c) {
+                return e.execute_cql(sprint("insert into tp (p, c, v) values (1, %d, %d);", c, c)).discard_result();
+            });
+        }).then([&e] {
+            return e.execute_cql("select c from tp where p = 1;", paged_query_options(2, {}));
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(0)}, {int32_type->decompose(1)}});
+            return e.execute_cql("select c from tp where p = 1;", paged_query_options(2, next_page(msg)));
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(2)}, {int32_type->decompose(3)}});
+            return e.execute_cql("select c from tp where p = 1;", paged_query_options(2, next_page(msg)));
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(4)}});
+            BOOST_REQUIRE(!next_page(msg));
+            return e.execute_cql("select c from tp where p = 1 order by c desc limit 3;", paged_query_options(2, {}));
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(4)}, {int32_type->decompose(3)}});
+            return e.execute_cql("select c from tp where p = 1 order by c desc limit 3;", paged_query_options(2, next_page(msg)));
+        }).then([] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(2)}});
+            BOOST_REQUIRE(!next_page(msg));
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_secondary_index) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tsi (p int, c int, v int, PRIMARY KEY (p, c));").discard_result().then([&e] {
+            return e.execute_cql("insert into tsi (p, c, v) values (1, 1, 10);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("create index on tsi (v);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into tsi (p, c, v) values (2, 1, 20);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select p, c from tsi where v = 10;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(1), int32_type->decompose(1)}});
+            return e.execute_cql("select p, c from tsi where v = 20;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(2), int32_type->decompose(1)}});
+            // Leaves a stale entry for 20, which must not select the row.
+            return e.execute_cql("update tsi set v = 30 where p = 2 and c = 1;").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select p, c from tsi where v = 20;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().is_empty();
+            return e.execute_cql("select p, c from tsi where v = 30;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(2), int32_type->decompose(1)}});
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_filtering) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tf (p int, c int, v int, PRIMARY KEY (p, c));").discard_result().then([&e] {
+            return parallel_for_each(boost::irange(0, 5), [&e] (int c) {
+                return e.execute_cql(sprint("insert into tf (p, c, v) values (1, %d, %d);", c, c * 10)).discard_result();
+            });
+        }).then([&e] {
+            return e.execute_cql("select c from tf where p = 1 and v > 10 and v <= 30 allow filtering;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(2)}, {int32_type->decompose(3)}});
+            return e.execute_cql("select c from tf where p = 1 and v in (0, 40) allow filtering;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(0)}, {int32_type->decompose(4)}});
+            return e.execute_cql("select c from tf where v = 20 allow filtering;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(2)}});
+            return e.execute_cql("select c from tf where p = 1 and v = 25 allow filtering;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().is_empty();
+            return e.execute_cql("select c from tf where p = 1 and v = 20;");
+        }).then_wrapped([] (auto f) {
+            assert_that_failed(f);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_aggregates_over_batches) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table ta (p int, c int, d double, PRIMARY KEY (p, c));").discard_result().then([&e] {
+            // More rows than fit in a batch of the coordinator's selectors.
+            return parallel_for_each(boost::irange(0, 1499), [&e] (int c) {
+                return e.execute_cql(sprint("insert into ta (p, c, d) values (1, %d, %f);", c, c * 0.5)).discard_result();
+            });
+        }).then([&e] {
+            return e.execute_cql("insert into ta (p, c) values (1, 1499);").discard_result();
+        }).then([&e] {
+            // With a limit, the aggregates are computed by the coordinator.
+            return e.execute_cql("select count(*), count(d), sum(c), min(c), max(c), sum(d), avg(d), max(d) from ta where p = 1 limit 10000;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{
+                long_type->decompose(int64_t(1500)),
+                long_type->decompose(int64_t(1499)),
+                int32_type->decompose(1124250),
+                int32_type->decompose(0),
+                int32_type->decompose(1499),
+                double_type->decompose(561375.5),
+                double_type->decompose(374.5),
+                double_type->decompose(749.0),
+            }});
+        });
+    });
+}
+
+static std::vector<std::vector<bytes_opt>> rows_of(shared_ptr<transport::messages::result_message> msg) {
+    auto rows = dynamic_pointer_cast<transport::messages::result_message::rows>(msg);
+    BOOST_REQUIRE(rows);
+    std::vector<std::vector<bytes_opt>> result;
+    for (auto&& row : rows->rs().rows()) {
+        result.emplace_back(row.begin(), row.end());
+    }
+    return result;
+}
+
+// The aggregates of a scan are computed by the replicas of its ranges, but
+// by the coordinator with a limit. Both must agree.
+static void require_aggregates_agree(cql_test_env& e, sstring select, std::vector<bytes_opt> expected) {
+    auto on_replicas = rows_of(e.execute_cql(select + ";").get0());
+    auto on_coordinator = rows_of(e.execute_cql(select + " limit 1000000;").get0());
+    BOOST_REQUIRE_EQUAL(on_replicas.size(), 1);
+    BOOST_REQUIRE(on_replicas == on_coordinator);
+    BOOST_REQUIRE(on_replicas[0] == expected);
+}
+
+SEASTAR_TEST_CASE(test_aggregates_over_ranges) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tagg (p int, c int, s int static, v int, PRIMARY KEY (p, c));").get();
+            auto select = sstring("select count(*), count(v), sum(v), min(v), max(v) from tagg");
+
+            // An empty table.
+            require_aggregates_agree(e, select, {
+                long_type->decompose(int64_t(0)),
+                long_type->decompose(int64_t(0)),
+                int32_type->decompose(0),
+                bytes_opt(),
+                bytes_opt(),
+            });
+
+            // Partitions all over the ring, so that the scan spans many
+            // ranges, with a null cell each.
+            for (int p = 0; p < 50; ++p) {
+                for (int c = 0; c < 3; ++c) {
+                    e.execute_cql(sprint("insert into tagg (p, c, v) values (%d, %d, %d);", p, c, p * 3 + c)).get();
+                }
+                e.execute_cql(sprint("insert into tagg (p, c) values (%d, 3);", p)).get();
+            }
+            // Partitions of a static row only, which count as a row.
+            for (int p = 50; p < 55; ++p) {
+                e.execute_cql(sprint("insert into tagg (p, s) values (%d, %d);", p, p)).get();
+            }
+            // The sum of 0..149.
+            require_aggregates_agree(e, select, {
+                long_type->decompose(int64_t(50 * 4 + 5)),
+                long_type->decompose(int64_t(150)),
+                int32_type->decompose(11175),
+                int32_type->decompose(0),
+                int32_type->decompose(149),
+            });
+            require_aggregates_agree(e, "select count(s), sum(s), min(s), max(s) from tagg", {
+                long_type->decompose(int64_t(5)),
+                int32_type->decompose(50 + 51 + 52 + 53 + 54),
+                int32_type->decompose(50),
+                int32_type->decompose(54),
+            });
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_partial_aggregates_serialization) {
+    query::partial_aggregates pa;
+    pa.values.emplace_back(long_type->decompose(int64_t(42)));
+    pa.values.emplace_back();
+    pa.values.emplace_back(bytes());
+    bytes buf(bytes::initialized_later(), pa.serialized_size());
+    auto out = buf.begin();
+    pa.serialize(out);
+    BOOST_REQUIRE(out == buf.end());
+    bytes_view v(buf);
+    auto read = query::partial_aggregates::deserialize(v);
+    BOOST_REQUIRE(v.empty());
+    BOOST_REQUIRE(read.values == pa.values);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_result_cache) {
+    return do_with_cql_env([] (auto& e) {
+        cql3::global_result_cache().set_max_memory(1 << 20);
+        return e.execute_cql("create table trc (p int, c int, v int, PRIMARY KEY (p, c)) "
+                "with caching = {'keys': 'ALL', 'rows_per_partition': 'ALL', 'result_cache_ttl_in_ms': '600000'};").discard_result().then([&e] {
+            return e.execute_cql("insert into trc (p, c, v) values (1, 1, 1);").discard_result();
+        }).then([&e] {
+            return e.prepare("select c, v from trc where p = ?;");
+        }).then([&e] (bytes id) {
+            auto read = [&e, id] {
+                return e.execute_prepared(id, {int32_type->decompose(1)});
+            };
+            auto& stats = cql3::global_result_cache().get_stats();
+            auto hits = stats.hits;
+            auto misses = stats.misses;
+            return read().then([read, &stats, misses] (auto msg) {
+                assert_that(msg).is_rows().with_rows({{int32_type->decompose(1), int32_type->decompose(1)}});
+                BOOST_REQUIRE_EQUAL(stats.misses, misses + 1);
+                return read();
+            }).then([&e, &stats, hits] (auto msg) {
+                assert_that(msg).is_rows().with_rows({{int32_type->decompose(1), int32_type->decompose(1)}});
+                BOOST_REQUIRE_EQUAL(stats.hits, hits + 1);
+                // A write of the partition drops the results of its reads.
+                return e.execute_cql("update trc set v = 2 where p = 1 and c = 1;").discard_result();
+            }).then([read] {
+                return read();
+            }).then([&stats, hits, misses] (auto msg) {
+                assert_that(msg).is_rows().with_rows({{int32_type->decompose(1), int32_type->decompose(2)}});
+                BOOST_REQUIRE_EQUAL(stats.hits, hits + 1);
+                BOOST_REQUIRE_EQUAL(stats.misses, misses + 2);
+                BOOST_REQUIRE(stats.invalidations > 0);
+            });
+        }).finally([] {
+            cql3::global_result_cache().clear();
+            cql3::global_result_cache().set_max_memory(0);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_result_cache_generation_is_per_partition) {
+    return seastar::async([] {
+        auto& cache = cql3::global_result_cache();
+        cache.clear();
+        cache.set_max_memory(1 << 20);
+        uint64_t p1 = 1;
+        uint64_t p2 = 2;
+        int statement;
+        auto ttl = std::chrono::milliseconds(600000);
+        auto make_result = [] {
+            bytes_ostream buf;
+            buf.write(bytes("result"));
+            return query::result(std::move(buf));
+        };
+
+        // A write of another partition doesn't keep a read from its cache.
+        auto g = cache.generation({p1});
+        cache.invalidate(p2);
+        cache.insert({&statement, bytes("a")}, make_result(), {p1}, ttl, g);
+        BOOST_REQUIRE_EQUAL(cache.size(), 1);
+
+        // A write of the partition read does.
+        g = cache.generation({p1});
+        cache.invalidate(p1);
+        cache.insert({&statement, bytes("b")}, make_result(), {p1}, ttl, g);
+        BOOST_REQUIRE_EQUAL(cache.size(), 0);
+
+        // As does a clear.
+        g = cache.generation({p2});
+        cache.clear();
+        cache.insert({&statement, bytes("c")}, make_result(), {p2}, ttl, g);
+        BOOST_REQUIRE_EQUAL(cache.size(), 0);
+        cache.set_max_memory(0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_counters) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tc (p int, c int, cnt counter, PRIMARY KEY (p, c));").discard_result().then([&e] {
+            return e.execute_cql("update tc set cnt = cnt + 5 where p = 1 and c = 1;").discard_result();
+        }).then([&e] {
+            return e.execute_cql("update tc set cnt = cnt - 2 where p = 1 and c = 1;").discard_result();
+        }).then([&e] {
+            return e.execute_cql("update tc set cnt = cnt + 7 where p = 1 and c = 2;").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select c, cnt from tc where p = 1;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({
+                {int32_type->decompose(1), long_type->decompose(int64_t(3))},
+                {int32_type->decompose(2), long_type->decompose(int64_t(7))},
+            });
+            return e.execute_cql("update tc set cnt = 3 where p = 1 and c = 1;").discard_result();
+        }).then_wrapped([&e] (auto f) {
+            assert_that_failed(f);
+            return e.execute_cql("create table tcm (p int PRIMARY KEY, cnt counter, v int);").discard_result();
+        }).then_wrapped([] (auto f) {
+            assert_that_failed(f);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_conditional_updates) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tlwt (p int, c int, v int, PRIMARY KEY (p, c));").discard_result().then([&e] {
+            return e.execute_cql("insert into tlwt (p, c, v) values (1, 1, 10) if not exists;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{boolean_type->decompose(true)}});
+            return e.execute_cql("insert into tlwt (p, c, v) values (1, 1, 20) if not exists;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{boolean_type->decompose(false),
+                int32_type->decompose(1), int32_type->decompose(1), int32_type->decompose(10)}});
+            return e.execute_cql("update tlwt set v = 30 where p = 1 and c = 1 if v = 20;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{boolean_type->decompose(false), int32_type->decompose(10)}});
+            return e.execute_cql("update tlwt set v = 30 where p = 1 and c = 1 if v = 10;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{boolean_type->decompose(true)}});
+            return e.execute_cql("select v from tlwt where p = 1 and c = 1;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{int32_type->decompose(30)}});
+            return e.execute_cql("delete from tlwt where p = 1 and c = 2 if exists;");
+        }).then([&e] (auto msg) {
+            assert_that(msg).is_rows().with_rows({{boolean_type->decompose(false)}});
+            return e.execute_cql("update tlwt set v = 40 where p = 1 and c = 1 using timestamp 1 if v = 30;");
+        }).then_wrapped([] (auto f) {
+            assert_that_failed(f);
+        });
+    });
+}
+
+// Views are updated in the background of the writes to their base tables.
+static future<> eventually(std::function<future<> ()> f, unsigned attempts = 100) {
+    return f().handle_exception([f, attempts] (auto ep) {
+        if (attempts <= 1) {
+            return make_exception_future<>(ep);
+        }
+        return sleep(std::chrono::milliseconds(10)).then([f, attempts] {
+            return eventually(f, attempts - 1);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_materialized_view) {
+    return do_with_cql_env([] (auto& e) {
+        // Whether the view has the view row of base row (1, 1) under v.
+        auto view_has = [&e] (int32_t v, bool present) {
+            return eventually([&e, v, present] {
+                return e.execute_cql(sprint("select p, c from tmv_by_v where v = %d;", v)).then([present] (auto msg) {
+                    if (present) {
+                        assert_that(msg).is_rows().with_rows({{int32_type->decompose(1), int32_type->decompose(1)}});
+                    } else {
+                        assert_that(msg).is_rows().is_empty();
+                    }
+                });
+            });
+        };
+        return e.execute_cql("create table tmv (p int, c int, v int, PRIMARY KEY (p, c));").discard_result().then([&e] {
+            return e.execute_cql("create materialized view tmv_by_v as select * from tmv "
+                    "where v is not null and p is not null and c is not null primary key (v, p, c);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("insert into tmv (p, c, v) values (1, 1, 10);").discard_result();
+        }).then([view_has] {
+            return view_has(10, true);
+        }).then([&e] {
+            return e.execute_cql("update tmv set v = 20 where p = 1 and c = 1;").discard_result();
+        }).then([view_has] {
+            return view_has(20, true);
+        }).then([view_has] {
+            return view_has(10, false);
+        }).then([&e] {
+            return e.execute_cql("delete from tmv where p = 1 and c = 1;").discard_result();
+        }).then([view_has] {
+            return view_has(20, false);
+        }).then([&e] {
+            return e.execute_cql("insert into tmv_by_v (v, p, c) values (30, 1, 1);").discard_result();
+        }).then_wrapped([&e] (auto f) {
+            assert_that_failed(f);
+            return e.execute_cql("drop table tmv;").discard_result();
+        }).then_wrapped([&e] (auto f) {
+            assert_that_failed(f);
+            return e.execute_cql("create materialized view tmv_by_c as select * from tmv "
+                    "where c is not null and p is not null primary key (c);").discard_result();
+        }).then_wrapped([] (auto f) {
+            assert_that_failed(f);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_cdc_log) {
+    return do_with_cql_env([] (auto& e) {
+        return e.execute_cql("create table tcdc (p int, c int, v int, PRIMARY KEY (p, c)) with cdc = {'enabled': 'true', 'ttl': '3600'};").discard_result().then([&e] {
+            return e.execute_cql("insert into tcdc (p, c, v) values (1, 1, 10);").discard_result();
+        }).then([&e] {
+            return e.execute_cql("delete from tcdc where p = 1 and c = 1;").discard_result();
+        }).then([&e] {
+            return e.execute_cql("select key from tcdc_scylla_cdc_log;");
+        }).then([&e] (auto msg) {
+            auto key = partition_key::from_single_value(*e.local_db().find_schema("ks", "tcdc"), int32_type->decompose(1));
+            auto k = bytes(key.representation());
+            assert_that(msg).is_rows().with_rows({{k}, {k}});
+            return e.execute_cql("drop table tcdc;").discard_result();
+        }).then([&e] {
+            BOOST_REQUIRE(!e.local_db().has_schema("ks", "tcdc_scylla_cdc_log"));
+            return e.execute_cql("create table tcdc2 (p int PRIMARY KEY, v int) with cdc = {'enabled': 'yes'};").discard_result();
+        }).then_wrapped([] (auto f) {
+            assert_that_failed(f);
+        });
+    });
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+
+#include "gms/failure_detector.hh"
+
+using clk = gms::arrival_window::clk;
+using namespace std::chrono_literals;
+
+static gms::arrival_window make_window(clk::time_point start, clk::duration interval, clk::duration min_interval, int heartbeats) {
+    gms::arrival_window w(1000, min_interval);
+    for (int i = 0; i <= heartbeats; ++i) {
+        w.add(start + i * interval);
+    }
+    return w;
+}
+
+BOOST_AUTO_TEST_CASE(test_phi_grows_with_the_time_since_the_last_heartbeat) {
+    auto start = clk::now();
+    auto w = make_window(start, 1s, 100ms, 100);
+    auto last = start + 100 * 1s;
+
+    BOOST_REQUIRE_LT(w.phi(last + 1s), 1);
+    double previous = 0;
+    for (auto t = 1s; t <= 10s; t += 1s) {
+        auto phi = w.phi(last + t);
+        BOOST_REQUIRE_GE(phi, previous);
+        previous = phi;
+    }
+    BOOST_REQUIRE_GT(previous, 16);
+}
+
+BOOST_AUTO_TEST_CASE(test_min_interval_tolerates_pauses_of_regular_peers) {
+    auto start = clk::now();
+    auto strict = make_window(start, 1s, 1ms, 100);
+    auto tolerant = make_window(start, 1s, 1s, 100);
+    auto last = start + 100 * 1s;
+
+    // The intervals are all the same, so that without a floor on the
+    // standard deviation a short pause convicts the peer.
+    BOOST_REQUIRE_GT(strict.phi(last + 2s), 8);
+    BOOST_REQUIRE_LT(tolerant.phi(last + 2s), 1);
+    BOOST_REQUIRE_GT(tolerant.phi(last + 10s), 8);
+}
+
+BOOST_AUTO_TEST_CASE(test_min_interval_clamps_short_intervals) {
+    auto start = clk::now();
+    auto w = make_window(start, 10ms, 1s, 100);
+
+    // The first interval is the initial value, the others are clamped.
+    BOOST_REQUIRE_GE(w.mean(), std::chrono::duration_cast<clk::duration>(1s).count());
+}
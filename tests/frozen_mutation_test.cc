@@ -138,3 +138,29 @@ BOOST_AUTO_TEST_CASE(test_application_of_partition_view_has_the_same_effect_as_a
     assert_that(m_unfrozen).is_equal_to(m_refrozen);
     assert_that(m_unfrozen).is_equal_to(m_frozen);
 }
+
+BOOST_AUTO_TEST_CASE(test_frozen_mutation_carries_token) {
+    schema_ptr s = new_table()
+        .with_column("pk_col", bytes_type, column_kind::partition_key)
+        .with_column("reg_1", bytes_type)
+        .build();
+
+    mutation m(partition_key::from_single_value(*s, bytes("key")), s);
+    m.set_clustered_cell(clustering_key::make_empty(*s), "reg_1", bytes("val"), new_timestamp());
+
+    auto fm = freeze(m);
+    BOOST_REQUIRE(fm.carried_token());
+    BOOST_REQUIRE(*fm.carried_token() == m.token());
+    BOOST_REQUIRE(fm.decorated_key(*s).equal(*s, m.decorated_key()));
+
+    // As read from the commitlog: the token is computed from the key.
+    frozen_mutation from_repr(bytes(fm.representation().begin(), fm.representation().end()));
+    BOOST_REQUIRE(!from_repr.carried_token());
+    BOOST_REQUIRE(from_repr.token(*s) == m.token());
+    assert_that(from_repr.unfreeze(s)).is_equal_to(m);
+
+    // As received from a peer which sent the token along.
+    frozen_mutation with_token(bytes(fm.representation().begin(), fm.representation().end()), m.token());
+    BOOST_REQUIRE(*with_token.carried_token() == m.token());
+    assert_that(with_token.unfreeze(s)).is_equal_to(m);
+}
@@ -28,6 +28,7 @@
 #include "message/messaging_service.hh"
 #include "gms/failure_detector.hh"
 #include "gms/gossiper.hh"
+#include "gms/endpoint_state.hh"
 #include "core/reactor.hh"
 
 SEASTAR_TEST_CASE(test_boot_shutdown){
@@ -45,3 +46,76 @@ SEASTAR_TEST_CASE(test_boot_shutdown){
         });
     });
 }
+
+static std::unordered_set<dht::token> make_tokens(size_t n, size_t size = gms::versioned_value::binary_token_size) {
+    std::unordered_set<dht::token> tokens;
+    for (size_t i = 0; i < n; ++i) {
+        bytes b(bytes::initialized_later(), size);
+        for (size_t j = 0; j < size; ++j) {
+            // Includes bytes of '\0' and ';', which must not confuse parsing.
+            b[j] = (i * 7 + j * 59) % 256;
+        }
+        tokens.emplace(dht::token::kind::key, std::move(b));
+    }
+    return tokens;
+}
+
+static gms::versioned_value serialize_deserialize(const gms::versioned_value& v) {
+    bytes buf(bytes::initialized_later(), v.serialized_size());
+    auto out = buf.begin();
+    v.serialize(out);
+    bytes_view in(buf);
+    auto ret = gms::versioned_value::deserialize(in);
+    BOOST_REQUIRE(in.empty());
+    return ret;
+}
+
+SEASTAR_TEST_CASE(test_binary_tokens_round_trip) {
+    gms::versioned_value::versioned_value_factory factory;
+    for (size_t n : {1, 2, 256}) {
+        auto tokens = make_tokens(n);
+        auto binary = factory.tokens(tokens, true);
+        auto hex = factory.tokens(tokens, false);
+        BOOST_REQUIRE_EQUAL(binary.value[0], gms::versioned_value::BINARY_TOKENS_MARKER);
+        BOOST_REQUIRE_EQUAL(binary.value.size(), 1 + n * gms::versioned_value::binary_token_size);
+        BOOST_REQUIRE(binary.value.size() < hex.value.size());
+        BOOST_REQUIRE(gms::versioned_value::tokens_of(binary.value) == tokens);
+        BOOST_REQUIRE(gms::versioned_value::tokens_of(hex.value) == tokens);
+        // As sent in gossip messages.
+        BOOST_REQUIRE(gms::versioned_value::tokens_of(serialize_deserialize(binary).value) == tokens);
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_legacy_tokens_are_decoded) {
+    // As gossiped by nodes which do not know BINARY_TOKENS.
+    auto tokens = gms::versioned_value::tokens_of("0102030405060708;8000000000000000");
+    BOOST_REQUIRE_EQUAL(tokens.size(), 2);
+    BOOST_REQUIRE(tokens.count(dht::token(dht::token::kind::key, from_hex("0102030405060708"))));
+    BOOST_REQUIRE(tokens.count(dht::token(dht::token::kind::key, from_hex("8000000000000000"))));
+
+    // Tokens not of binary_token_size bytes stay in hex, even with binary.
+    gms::versioned_value::versioned_value_factory factory;
+    auto odd = make_tokens(3, 16);
+    auto v = factory.tokens(odd, true);
+    BOOST_REQUIRE(v.value[0] != gms::versioned_value::BINARY_TOKENS_MARKER);
+    BOOST_REQUIRE(gms::versioned_value::tokens_of(v.value) == odd);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_endpoint_state_tokens_follow_versions) {
+    gms::versioned_value::versioned_value_factory factory;
+    gms::endpoint_state state(gms::heart_beat_state(1));
+    BOOST_REQUIRE(state.get_tokens().empty());
+
+    auto first = make_tokens(4);
+    state.add_application_state(gms::application_state::TOKENS, factory.tokens(first, true));
+    BOOST_REQUIRE(state.get_tokens() == first);
+    BOOST_REQUIRE(state.get_tokens() == first);
+
+    // A newer version of the state, in the other encoding.
+    auto second = make_tokens(2);
+    state.add_application_state(gms::application_state::TOKENS, factory.tokens(second, false));
+    BOOST_REQUIRE(state.get_tokens() == second);
+    return make_ready_future<>();
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test-utils.hh"
+#include "tests/cql_test_env.hh"
+#include "tests/cql_assertions.hh"
+#include "tests/tmpdir.hh"
+
+#include "core/sleep.hh"
+#include "core/thread.hh"
+#include "db/hints/manager.hh"
+#include "service/storage_proxy.hh"
+#include "utils/fb_utilities.hh"
+#include "lister.hh"
+
+using namespace std::chrono_literals;
+
+// The hints of these tests are for the local node, which takes them like
+// any other replica. Pausing delivery stands for it being down.
+static gms::inet_address local_node() {
+    return utils::fb_utilities::get_broadcast_address();
+}
+
+static db::hints::manager::config make_config(const tmpdir& dir) {
+    db::hints::manager::config cfg;
+    cfg.hints_directory = dir.path;
+    cfg.segment_size_in_mb = 1;
+    cfg.throttle_in_kb = 0;
+    return cfg;
+}
+
+static lw_shared_ptr<const frozen_mutation> make_hint(cql_test_env& e, int32_t p, int32_t v) {
+    auto s = e.local_db().find_schema("ks", "cf");
+    mutation m(partition_key::from_single_value(*s, int32_type->decompose(p)), s);
+    m.set_clustered_cell(clustering_key::make_empty(*s), "v", v, api::new_timestamp());
+    return make_lw_shared<const frozen_mutation>(freeze(m));
+}
+
+static void wait_until(std::function<bool ()> done) {
+    for (int i = 0; !done(); ++i) {
+        BOOST_REQUIRE(i < 1000);
+        sleep(10ms).get();
+    }
+}
+
+static size_t count_files(sstring dir) {
+    size_t n = 0;
+    lister::scan_dir(dir, directory_entry_type::regular, [&n] (directory_entry) {
+        ++n;
+        return make_ready_future<>();
+    }).get();
+    return n;
+}
+
+SEASTAR_TEST_CASE(test_hints_are_delivered_once_the_endpoint_is_back) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table cf (p int primary key, v int);").get();
+            tmpdir dir;
+            db::hints::manager mgr(service::get_local_storage_proxy(), make_config(dir));
+            mgr.start().get();
+            mgr.pause_delivery(true);
+
+            mgr.store_hint(local_node(), make_hint(e, 1, 10)).get();
+            mgr.store_hint(local_node(), make_hint(e, 2, 20)).get();
+            BOOST_REQUIRE_EQUAL(mgr.written_hints(local_node()), 2);
+            BOOST_REQUIRE_EQUAL(mgr.endpoints_pending_hints().size(), 1);
+            assert_that(e.execute_cql("select * from cf;").get0()).is_rows().is_empty();
+
+            mgr.pause_delivery(false);
+            mgr.schedule_delivery(local_node());
+            wait_until([&mgr] { return mgr.get_stats().sent == 2 && mgr.endpoints_pending_hints().empty(); });
+            assert_that(e.execute_cql("select * from cf;").get0()).is_rows().with_size(2);
+            BOOST_REQUIRE_EQUAL(mgr.get_stats().expired, 0);
+
+            mgr.stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_hints_expire) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table cf (p int primary key, v int) with gc_grace_seconds = 0;").get();
+            tmpdir dir;
+            auto cfg = make_config(dir);
+            cfg.max_hint_window = 1ms;
+            db::hints::manager mgr(service::get_local_storage_proxy(), cfg);
+            mgr.start().get();
+
+            // Not hinted any more once down for longer than the window.
+            auto down = gms::inet_address("127.0.0.2");
+            BOOST_REQUIRE(mgr.can_hint(down));
+            mgr.store_hint(down, make_hint(e, 1, 10)).get();
+            sleep(50ms).get();
+            BOOST_REQUIRE(!mgr.can_hint(down));
+            BOOST_REQUIRE(mgr.can_hint(gms::inet_address("127.0.0.3")));
+
+            // Dropped rather than delivered once past the gc grace period.
+            mgr.pause_delivery(true);
+            mgr.store_hint(local_node(), make_hint(e, 2, 20)).get();
+            sleep(10ms).get();
+            mgr.pause_delivery(false);
+            mgr.schedule_delivery(local_node());
+            // Only the hint of the down endpoint is left.
+            wait_until([&mgr] { return mgr.get_stats().expired == 1 && mgr.endpoints_pending_hints().size() == 1; });
+            BOOST_REQUIRE_EQUAL(mgr.get_stats().sent, 0);
+            assert_that(e.execute_cql("select * from cf;").get0()).is_rows().is_empty();
+
+            mgr.stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_truncate_drops_hints) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table cf (p int primary key, v int);").get();
+            tmpdir dir;
+            db::hints::manager mgr(service::get_local_storage_proxy(), make_config(dir));
+            mgr.start().get();
+            mgr.pause_delivery(true);
+
+            mgr.store_hint(local_node(), make_hint(e, 1, 10)).get();
+            mgr.store_hint(local_node(), make_hint(e, 2, 20)).get();
+            mgr.truncate(local_node()).get();
+            BOOST_REQUIRE(mgr.endpoints_pending_hints().empty());
+            BOOST_REQUIRE_EQUAL(mgr.size_on_disk(), 0);
+            auto ep_dir = sprint("%s/%d/%s", dir.path, engine().cpu_id(), local_node());
+            BOOST_REQUIRE_EQUAL(count_files(ep_dir), 0);
+
+            mgr.pause_delivery(false);
+            mgr.schedule_delivery(local_node());
+            sleep(50ms).get();
+            BOOST_REQUIRE_EQUAL(mgr.get_stats().sent, 0);
+            assert_that(e.execute_cql("select * from cf;").get0()).is_rows().is_empty();
+
+            mgr.stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_hints_size_cap) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table cf (p int primary key, v int);").get();
+            tmpdir dir;
+            auto cfg = make_config(dir);
+            cfg.max_size_per_endpoint = 1;
+            db::hints::manager mgr(service::get_local_storage_proxy(), cfg);
+            mgr.start().get();
+            mgr.pause_delivery(true);
+
+            BOOST_REQUIRE(mgr.can_hint(local_node()));
+            mgr.store_hint(local_node(), make_hint(e, 1, 10)).get();
+            BOOST_REQUIRE(mgr.size_on_disk() > 0);
+            BOOST_REQUIRE(!mgr.can_hint(local_node()));
+            // The cap is per endpoint.
+            BOOST_REQUIRE(mgr.can_hint(gms::inet_address("127.0.0.2")));
+
+            mgr.stop().get();
+        });
+    });
+}
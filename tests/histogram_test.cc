@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+
+#include "utils/histogram.hh"
+
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_CASE(test_percentiles_of_decaying_histogram) {
+    utils::decaying_histogram h;
+    BOOST_REQUIRE_EQUAL(h.percentile(0.99), 0);
+
+    auto now = utils::decaying_histogram::clock::now();
+    for (uint64_t v = 1; v <= 1000; ++v) {
+        h.mark(v, now);
+    }
+    BOOST_REQUIRE_EQUAL(h.count(), 1000);
+
+    for (auto p : { 0.01, 0.5, 0.9, 0.99, 1.0 }) {
+        uint64_t exact = p * 1000;
+        auto estimate = h.percentile(p);
+        BOOST_REQUIRE_GE(estimate, exact);
+        BOOST_REQUIRE_LE(estimate, exact * 1.0625);
+    }
+
+    // Small values get exact buckets.
+    utils::decaying_histogram small;
+    small.mark(0, now);
+    small.mark(3, now);
+    BOOST_REQUIRE_EQUAL(small.percentile(0.5), 0);
+    BOOST_REQUIRE_EQUAL(small.percentile(1), 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_decaying_histogram_follows_recent_values) {
+    utils::decaying_histogram h(1s);
+    auto now = utils::decaying_histogram::clock::now();
+    for (int i = 0; i < 1000; ++i) {
+        h.mark(100000, now);
+    }
+    BOOST_REQUIRE_GE(h.percentile(0.5), 100000);
+
+    // After a period, old values weigh half of what they did.
+    now += 1s;
+    for (int i = 0; i < 1000; ++i) {
+        h.mark(100, now);
+    }
+    BOOST_REQUIRE_EQUAL(h.count(), 1500);
+    BOOST_REQUIRE_LE(h.percentile(0.5), 125);
+    BOOST_REQUIRE_GE(h.percentile(0.9), 100000);
+
+    // After ten more, they are gone.
+    now += 10s;
+    h.mark(100, now);
+    BOOST_REQUIRE_EQUAL(h.count(), 1);
+    BOOST_REQUIRE_LE(h.percentile(1), 125);
+}
+
+BOOST_AUTO_TEST_CASE(test_merged_decaying_histograms) {
+    auto now = utils::decaying_histogram::clock::now();
+    utils::decaying_histogram all;
+    utils::decaying_histogram shard0;
+    utils::decaying_histogram shard1;
+    for (uint64_t v = 1; v <= 100000; ++v) {
+        all.mark(v * 10, now);
+        (v % 2 ? shard0 : shard1).mark(v * 10, now);
+    }
+
+    shard0.merge(shard1, now);
+    BOOST_REQUIRE_EQUAL(shard0.count(), all.count());
+    for (auto p : { 0.5, 0.75, 0.95, 0.98, 0.99, 0.999 }) {
+        BOOST_REQUIRE_EQUAL(shard0.percentile(p), all.percentile(p));
+    }
+
+    // Values too large for the buckets are kept, in the last one.
+    utils::decaying_histogram huge;
+    huge.mark(uint64_t(1) << 50, now);
+    BOOST_REQUIRE_EQUAL(huge.count(), 1);
+    BOOST_REQUIRE_GE(huge.percentile(1), uint64_t(1) << 39);
+}
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+#include <boost/range/adaptor/reversed.hpp>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "utils/intrusive_btree.hh"
+#include "utils/logalloc.hh"
+
+struct element {
+    intrusive_btree_hook _link;
+    int _value;
+
+    element(int v) : _value(v) { }
+    element(element&& o) noexcept
+        : _link(std::move(o._link))
+        , _value(o._value)
+    { }
+
+    struct compare {
+        bool operator()(const element& e1, const element& e2) const {
+            return e1._value < e2._value;
+        }
+        bool operator()(int v, const element& e) const {
+            return v < e._value;
+        }
+        bool operator()(const element& e, int v) const {
+            return e._value < v;
+        }
+    };
+};
+
+// Maps many values to the same prefix, so that lookups have to break ties.
+struct coarse_prefix {
+    uint64_t operator()(const element& e) const {
+        return (*this)(e._value);
+    }
+    uint64_t operator()(int v) const {
+        return uint64_t(v + 1000) / 16;
+    }
+};
+
+using tree_type = intrusive_btree<element, &element::_link, element::compare>;
+using prefixed_tree_type = intrusive_btree<element, &element::_link, element::compare, coarse_prefix>;
+
+template <typename Tree>
+static void insert(Tree& t, int v) {
+    auto e = current_allocator().construct<element>(v);
+    try {
+        BOOST_REQUIRE(t.insert(*e).second);
+    } catch (...) {
+        current_allocator().destroy(e);
+        throw;
+    }
+}
+
+template <typename Tree>
+static void verify(const Tree& t, const std::set<int>& model) {
+    BOOST_REQUIRE_EQUAL(t.size(), model.size());
+    BOOST_REQUIRE_EQUAL(t.empty(), model.empty());
+
+    auto i = model.begin();
+    for (auto&& e : t) {
+        BOOST_REQUIRE(i != model.end());
+        BOOST_REQUIRE_EQUAL(e._value, *i);
+        ++i;
+    }
+    BOOST_REQUIRE(i == model.end());
+
+    auto ri = model.rbegin();
+    for (auto&& e : t | boost::adaptors::reversed) {
+        BOOST_REQUIRE_EQUAL(e._value, *ri);
+        ++ri;
+    }
+    BOOST_REQUIRE(ri == model.rend());
+}
+
+template <typename Tree>
+static void verify_bounds(const Tree& t, const std::set<int>& model, int v) {
+    auto lb = t.lower_bound(v, element::compare());
+    auto mlb = model.lower_bound(v);
+    BOOST_REQUIRE_EQUAL(lb == t.end(), mlb == model.end());
+    if (mlb != model.end()) {
+        BOOST_REQUIRE_EQUAL(lb->_value, *mlb);
+    }
+
+    auto ub = t.upper_bound(v, element::compare());
+    auto mub = model.upper_bound(v);
+    BOOST_REQUIRE_EQUAL(ub == t.end(), mub == model.end());
+    if (mub != model.end()) {
+        BOOST_REQUIRE_EQUAL(ub->_value, *mub);
+    }
+
+    auto f = t.find(v, element::compare());
+    BOOST_REQUIRE_EQUAL(f != t.end(), model.count(v) != 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_append_and_iterate) {
+    tree_type t{element::compare()};
+    std::set<int> model;
+    for (int i = 0; i < 10000; ++i) {
+        auto e = current_allocator().construct<element>(i);
+        t.insert_before(t.end(), *e);
+        model.insert(i);
+    }
+    verify(t, model);
+    for (int i = -1; i <= 10000; i += 7) {
+        verify_bounds(t, model, i);
+    }
+    t.clear_and_dispose(current_deleter<element>());
+    verify(t, {});
+}
+
+BOOST_AUTO_TEST_CASE(test_random_insert_and_erase) {
+    std::default_random_engine gen;
+    std::uniform_int_distribution<int> dist(0, 5000);
+
+    tree_type t{element::compare()};
+    std::set<int> model;
+    for (int i = 0; i < 20000; ++i) {
+        auto v = dist(gen);
+        if (!model.count(v)) {
+            insert(t, v);
+            model.insert(v);
+        }
+    }
+    verify(t, model);
+
+    // Erase most of the elements, so that nodes get merged.
+    for (int i = 0; i < 20000; ++i) {
+        auto v = dist(gen);
+        auto it = t.find(v, element::compare());
+        BOOST_REQUIRE_EQUAL(it != t.end(), model.count(v) != 0);
+        if (it != t.end()) {
+            t.erase_and_dispose(it, current_deleter<element>());
+            model.erase(v);
+        }
+        if (i % 1000 == 0) {
+            verify(t, model);
+            verify_bounds(t, model, v);
+        }
+    }
+    verify(t, model);
+
+    while (!t.empty()) {
+        t.erase_and_dispose(std::prev(t.end()), current_deleter<element>());
+        model.erase(std::prev(model.end()));
+    }
+    verify(t, model);
+}
+
+BOOST_AUTO_TEST_CASE(test_iterators_stay_valid) {
+    tree_type t{element::compare()};
+    std::set<int> model;
+    for (int i = 0; i < 1000; ++i) {
+        insert(t, i * 2);
+        model.insert(i * 2);
+    }
+    auto& e = *t.find(500, element::compare());
+    auto it = t.iterator_to(e);
+
+    // Erase everything around the element.
+    t.erase_and_dispose(t.begin(), it, current_deleter<element>());
+    t.erase_and_dispose(std::next(it), t.end(), current_deleter<element>());
+    BOOST_REQUIRE_EQUAL(t.size(), 1);
+    BOOST_REQUIRE_EQUAL(it->_value, 500);
+    BOOST_REQUIRE(t.begin() == it);
+
+    for (int i = 0; i < 1000; ++i) {
+        if (i != 250) {
+            insert(t, i * 2);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(it->_value, 500);
+    BOOST_REQUIRE_EQUAL(std::prev(it)->_value, 498);
+    BOOST_REQUIRE_EQUAL(std::next(it)->_value, 502);
+    verify(t, model);
+
+    t.clear_and_dispose(current_deleter<element>());
+}
+
+BOOST_AUTO_TEST_CASE(test_clone_and_splice) {
+    tree_type t1{element::compare()};
+    std::set<int> model1;
+    for (int i = 0; i < 3000; i += 3) {
+        insert(t1, i);
+        model1.insert(i);
+    }
+
+    tree_type t2{element::compare()};
+    t2.clone_from(t1, [] (const element& e) {
+        return current_allocator().construct<element>(e._value);
+    }, current_deleter<element>());
+    verify(t2, model1);
+
+    tree_type t3{element::compare()};
+    std::set<int> model3;
+    for (int i = 0; i < 3000; i += 2) {
+        insert(t3, i);
+        model3.insert(i);
+    }
+
+    // Moves the elements of t3 missing in t1 over.
+    auto i = t3.begin();
+    while (i != t3.end()) {
+        auto next = std::next(i);
+        auto pos = t1.lower_bound(*i);
+        if (pos == t1.end() || pos->_value != i->_value) {
+            model3.erase(i->_value);
+            model1.insert(i->_value);
+            t1.splice(pos, t3, i);
+        }
+        i = next;
+    }
+    verify(t1, model1);
+    verify(t3, model3);
+
+    tree_type t4(std::move(t1));
+    verify(t4, model1);
+    verify(t1, {});
+
+    t1 = std::move(t4);
+    verify(t1, model1);
+
+    t1.clear_and_dispose(current_deleter<element>());
+    t2.clear_and_dispose(current_deleter<element>());
+    t3.clear_and_dispose(current_deleter<element>());
+}
+
+BOOST_AUTO_TEST_CASE(test_compaction) {
+    logalloc::region reg;
+    with_allocator(reg.allocator(), [&] {
+        std::default_random_engine gen;
+        std::uniform_int_distribution<int> dist(0, 100000);
+
+        tree_type t{element::compare()};
+        std::set<int> model;
+        for (int i = 0; i < 10000; ++i) {
+            auto v = dist(gen);
+            if (!model.count(v)) {
+                insert(t, v);
+                model.insert(v);
+            }
+        }
+        // Leave holes behind, so that compaction moves things.
+        for (int i = 0; i < 10000; ++i) {
+            auto it = t.find(dist(gen), element::compare());
+            if (it != t.end()) {
+                model.erase(it->_value);
+                t.erase_and_dispose(it, current_deleter<element>());
+            }
+        }
+
+        reg.full_compaction();
+
+        verify(t, model);
+        for (int i = 0; i < 100; ++i) {
+            verify_bounds(t, model, dist(gen));
+        }
+        t.clear_and_dispose(current_deleter<element>());
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_prefixed_lookups) {
+    std::default_random_engine gen;
+    std::uniform_int_distribution<int> dist(0, 5000);
+
+    prefixed_tree_type t{element::compare()};
+    std::set<int> model;
+    for (int i = 0; i < 20000; ++i) {
+        auto v = dist(gen);
+        if (!model.count(v)) {
+            insert(t, v);
+            model.insert(v);
+        }
+    }
+    verify(t, model);
+    for (int i = -1; i <= 5001; ++i) {
+        verify_bounds(t, model, i);
+    }
+
+    for (int i = 0; i < 20000; ++i) {
+        auto it = t.find(dist(gen), element::compare());
+        if (it != t.end()) {
+            model.erase(it->_value);
+            t.erase_and_dispose(it, current_deleter<element>());
+        }
+    }
+    verify(t, model);
+    for (int i = -1; i <= 5001; i += 3) {
+        verify_bounds(t, model, i);
+    }
+    t.clear_and_dispose(current_deleter<element>());
+}
+
+BOOST_AUTO_TEST_CASE(test_destroying_element_unlinks_it) {
+    prefixed_tree_type t{element::compare()};
+    std::set<int> model;
+    for (int i = 0; i < 1000; ++i) {
+        insert(t, i);
+        model.insert(i);
+    }
+    for (int i = 0; i < 1000; i += 3) {
+        current_allocator().destroy(&*t.find(i, element::compare()));
+        model.erase(i);
+    }
+    verify(t, model);
+    t.clear_and_dispose(current_deleter<element>());
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include "tests/test-utils.hh"
+#include "core/thread.hh"
+#include "log.hh"
+
+// The writer thread is stopped by the test, so there is only one.
+SEASTAR_TEST_CASE(test_full_buffer_drops_messages_but_not_errors) {
+    return seastar::async([] {
+        std::ostringstream out;
+        auto old = std::cout.rdbuf(out.rdbuf());
+        logging::logger log("log_test");
+        log.set_level(logging::log_level::info);
+        logging::logger::set_stdout_enabled(true);
+        // Room for a few messages only, filled faster than it drains.
+        logging::logger::set_buffer_size(1024);
+        auto dropped_before = logging::logger::dropped_messages();
+
+        const uint64_t total = 1000;
+        for (uint64_t i = 0; i < total; ++i) {
+            log.info("message {}", i);
+        }
+        log.error("the error");
+        logging::logger::flush_and_stop();
+        std::cout.rdbuf(old);
+        logging::logger::set_buffer_size(0);
+
+        auto dropped = logging::logger::dropped_messages() - dropped_before;
+        BOOST_REQUIRE(dropped > 0);
+
+        std::istringstream lines(out.str());
+        std::string line;
+        uint64_t written = 0;
+        uint64_t reported = 0;
+        bool error_written = false;
+        while (std::getline(lines, line)) {
+            if (line.find("log_test - message ") != std::string::npos) {
+                ++written;
+            } else if (line.find("log_test - the error") != std::string::npos) {
+                error_written = true;
+            } else if (boost::starts_with(line, "WARN  [log] ")) {
+                std::istringstream notice(line.substr(12));
+                uint64_t n;
+                notice >> n;
+                reported += n;
+            }
+        }
+        BOOST_REQUIRE_EQUAL(written + dropped, total);
+        BOOST_REQUIRE_EQUAL(reported, dropped);
+        BOOST_REQUIRE(error_written);
+    });
+}
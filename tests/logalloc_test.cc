@@ -293,6 +293,36 @@ SEASTAR_TEST_CASE(test_merging) {
     });
 }
 
+SEASTAR_TEST_CASE(test_large_objects_are_accounted) {
+    return seastar::async([] {
+        region_group group;
+        region reg1(group);
+        region reg2;
+        constexpr size_t blob_size = 100 * 1024;
+        std::deque<managed_bytes> refs;
+
+        with_allocator(reg1.allocator(), [&] {
+            for (int i = 0; i < 100; ++i) {
+                refs.push_back(managed_bytes(managed_bytes::initialized_later(), blob_size));
+            }
+        });
+
+        BOOST_REQUIRE(reg1.large_objects_space() >= 100 * blob_size);
+        BOOST_REQUIRE(reg1.occupancy().used_space() >= 100 * blob_size);
+        BOOST_REQUIRE(group.memory_used() >= 100 * blob_size);
+        BOOST_REQUIRE(shard_tracker().large_objects() >= 100);
+
+        // Merging moves the accounting along with the objects.
+        reg2.merge(reg1);
+        BOOST_REQUIRE(reg2.large_objects_space() >= 100 * blob_size);
+
+        with_allocator(reg2.allocator(), [&] {
+            refs.clear();
+        });
+        BOOST_REQUIRE_EQUAL(reg2.large_objects_space(), 0);
+    });
+}
+
 #ifndef DEFAULT_ALLOCATOR
 SEASTAR_TEST_CASE(test_region_lock) {
     return seastar::async([] {
@@ -349,4 +379,66 @@ SEASTAR_TEST_CASE(test_region_lock) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_background_reclaim) {
+    return seastar::async([] {
+        region reg;
+        with_allocator(reg.allocator(), [&] {
+            std::deque<managed_bytes> refs;
+
+            for (int i = 0; i < 1024 * 10; ++i) {
+                refs.push_back(managed_bytes(managed_bytes::initialized_later(), 1024));
+            }
+
+            reg.make_evictable([&refs] {
+                if (refs.empty()) {
+                    return memory::reclaiming_result::reclaimed_nothing;
+                }
+                refs.pop_back();
+                return memory::reclaiming_result::reclaimed_something;
+            });
+
+            // Nothing to do while enough memory is free.
+            auto steps = shard_tracker().background_reclaim_histogram().count;
+            BOOST_REQUIRE_EQUAL(shard_tracker().reclaim_in_background(0, std::chrono::microseconds(1000)), 0);
+            BOOST_REQUIRE_EQUAL(shard_tracker().background_reclaim_histogram().count, steps);
+
+            // With a reserve which can't be met, the step is bounded by the budget.
+            BOOST_REQUIRE(shard_tracker().reclaim_in_background(std::numeric_limits<size_t>::max(),
+                    std::chrono::microseconds(1)) > 0);
+            BOOST_REQUIRE(!refs.empty());
+            BOOST_REQUIRE_EQUAL(shard_tracker().background_reclaim_histogram().count, steps + 1);
+        });
+    });
+}
+SEASTAR_TEST_CASE(test_eviction_of_large_objects) {
+    return seastar::async([] {
+        region reg;
+        constexpr size_t blob_size = 100 * 1024;
+        std::deque<managed_bytes> refs;
+
+        with_allocator(reg.allocator(), [&] {
+            for (int i = 0; i < 100; ++i) {
+                refs.push_back(managed_bytes(managed_bytes::initialized_later(), blob_size));
+            }
+
+            reg.make_evictable([&refs] {
+                if (refs.empty()) {
+                    return memory::reclaiming_result::reclaimed_nothing;
+                }
+                refs.pop_back();
+                return memory::reclaiming_result::reclaimed_something;
+            });
+
+            // Evicting large objects counts towards the goal, so only
+            // about as many as needed are evicted.
+            BOOST_REQUIRE(shard_tracker().reclaim(1024 * 1024) >= 1024 * 1024);
+            BOOST_REQUIRE(refs.size() < 100);
+            BOOST_REQUIRE(refs.size() > 80);
+
+            refs.clear();
+        });
+    });
+}
+
 #endif
@@ -27,6 +27,10 @@
 #include "core/thread.hh"
 #include "memtable.hh"
 #include "mutation_source_test.hh"
+#include "utils/flush_scheduler.hh"
+#include "frozen_mutation.hh"
+#include "schema_builder.hh"
+#include "mutation_reader_assertions.hh"
 
 SEASTAR_TEST_CASE(test_memtable_conforms_to_mutation_source) {
     return seastar::async([] {
@@ -43,3 +47,179 @@ SEASTAR_TEST_CASE(test_memtable_conforms_to_mutation_source) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_batch_of_partition_updates) {
+    return seastar::async([] {
+        auto s = schema_builder("ks", "cf")
+            .with_column("pk", bytes_type, column_kind::partition_key)
+            .with_column("ck", int32_type, column_kind::clustering_key)
+            .with_column("v", int32_type)
+            .build();
+        auto make = [s] (bytes key, int32_t ck, int32_t v, api::timestamp_type ts) {
+            mutation m(partition_key::from_single_value(*s, key), s);
+            m.set_clustered_cell(clustering_key::from_single_value(*s, int32_type->decompose(ck)), "v", v, ts);
+            return m;
+        };
+        auto hot1 = make("hot", 1, 1, 1);
+        auto hot2 = make("hot", 1, 2, 2);
+        auto hot3 = make("hot", 2, 3, 1);
+        auto cold = make("cold", 1, 4, 1);
+        auto frozen_cold = freeze(cold);
+        std::vector<frozen_mutation> frozen_hot = { freeze(hot2), freeze(hot1), freeze(hot3) };
+
+        memtable::partition_update hot{hot1.decorated_key()};
+        for (auto&& fm : frozen_hot) {
+            hot.frozen.push_back(&fm);
+        }
+        std::vector<memtable::partition_update> updates;
+        dht::decorated_key::less_comparator less(s);
+        auto cold_first = less(cold.decorated_key(), hot1.decorated_key());
+        if (cold_first) {
+            updates.push_back(memtable::partition_update{cold.decorated_key(), {&frozen_cold}});
+        }
+        updates.push_back(std::move(hot));
+        if (!cold_first) {
+            updates.push_back(memtable::partition_update{cold.decorated_key(), {&frozen_cold}});
+        }
+
+        auto mt = make_lw_shared<memtable>(s);
+        mt->apply(updates, db::replay_position());
+
+        auto expected_hot = hot1;
+        expected_hot.partition().apply(*s, hot2.partition());
+        expected_hot.partition().apply(*s, hot3.partition());
+        auto expected = cold_first ? std::vector<mutation>{cold, expected_hot} : std::vector<mutation>{expected_hot, cold};
+        BOOST_REQUIRE_EQUAL(mt->partition_count(), 2);
+        assert_that(mt->make_reader())
+            .produces(expected)
+            .produces_end_of_stream();
+    });
+}
+
+SEASTAR_TEST_CASE(test_min_timestamp_of_memtable) {
+    return seastar::async([] {
+        auto set_type = set_type_impl::get_instance(int32_type, true);
+        auto s = schema_builder("ks", "cf")
+            .with_column("pk", bytes_type, column_kind::partition_key)
+            .with_column("ck", int32_type, column_kind::clustering_key)
+            .with_column("v", int32_type)
+            .with_column("s", set_type)
+            .build();
+        auto key = partition_key::from_single_value(*s, to_bytes("key"));
+        auto ck = clustering_key::from_single_value(*s, int32_type->decompose(1));
+        auto mt = make_lw_shared<memtable>(s);
+        BOOST_REQUIRE_EQUAL(mt->min_timestamp(), api::max_timestamp);
+
+        mutation m1(key, s);
+        m1.set_clustered_cell(ck, "v", int32_t(1), 10);
+        mt->apply(m1);
+        BOOST_REQUIRE_EQUAL(mt->min_timestamp(), 10);
+
+        // Tombstones count, frozen or not.
+        mutation m2(key, s);
+        m2.partition().apply_delete(*s, clustering_key(ck), tombstone(7, gc_clock::now()));
+        mt->apply(freeze(m2));
+        BOOST_REQUIRE_EQUAL(mt->min_timestamp(), 7);
+
+        // And so do the cells of collections.
+        mutation m3(key, s);
+        set_type_impl::mutation cm{{}, {{int32_type->decompose(1), atomic_cell::make_live(3, bytes())}}};
+        m3.set_clustered_cell(ck, *s->get_column_definition("s"), set_type->serialize_mutation_form(cm));
+        mt->apply(freeze(m3));
+        BOOST_REQUIRE_EQUAL(mt->min_timestamp(), 3);
+    });
+}
+
+SEASTAR_TEST_CASE(test_overwritten_rows_take_no_space) {
+    return seastar::async([] {
+        auto s = schema_builder("ks", "cf")
+            .with_column("pk", bytes_type, column_kind::partition_key)
+            .with_column("ck", int32_type, column_kind::clustering_key)
+            .with_column("v", bytes_type)
+            .build();
+        auto make = [s] (size_t size, api::timestamp_type ts) {
+            mutation m(partition_key::from_single_value(*s, "key"), s);
+            m.set_clustered_cell(clustering_key::from_single_value(*s, int32_type->decompose(1)), "v",
+                bytes(size, int8_t(ts)), ts);
+            return m;
+        };
+
+        auto mt = make_lw_shared<memtable>(s);
+        auto last = make(200, 0);
+        mt->apply(freeze(last));
+        auto used = mt->occupancy().used_space();
+        auto total = mt->occupancy().total_space();
+        for (int i = 1; i < 10000; ++i) {
+            last = make(200, i);
+            mt->apply(freeze(last));
+        }
+        // Values of the same size are overwritten in place.
+        BOOST_REQUIRE_EQUAL(mt->occupancy().used_space(), used);
+        BOOST_REQUIRE_EQUAL(mt->occupancy().total_space(), total);
+        assert_that(mt->make_reader())
+            .produces(last)
+            .produces_end_of_stream();
+
+        for (int i = 10000; i < 20000; ++i) {
+            mt->apply(freeze(make(200 + i % 2, i)));
+        }
+        auto before = mt->occupancy();
+        BOOST_REQUIRE(before.used_space() < before.total_space() / 2);
+        mt->compact();
+        BOOST_REQUIRE(mt->occupancy().total_space() < before.total_space() / 2);
+        BOOST_REQUIRE_EQUAL(mt->occupancy().used_space(), before.used_space());
+        assert_that(mt->make_reader())
+            .produces(make(201, 19999))
+            .produces_end_of_stream();
+    });
+}
+
+SEASTAR_TEST_CASE(test_flush_scheduler_ordering) {
+    return seastar::async([] {
+        flush_scheduler scheduler(1);
+        bool under_pressure = false;
+        scheduler.set_pressure_source([&under_pressure] { return under_pressure; });
+
+        std::vector<int> order;
+        promise<> first_done;
+        auto flush = [&order] (int id) {
+            return [&order, id] {
+                order.push_back(id);
+                return make_ready_future<>();
+            };
+        };
+
+        auto f1 = scheduler.schedule(10, db::replay_position(1), [&order, &first_done] {
+            order.push_back(1);
+            return first_done.get_future();
+        });
+        // Pins the newest segment, but frees the most memory.
+        auto f2 = scheduler.schedule(1000, db::replay_position(3), flush(2));
+        auto f3 = scheduler.schedule(10, db::replay_position(2), flush(3));
+        BOOST_REQUIRE_EQUAL(scheduler.get_stats().queued, 2);
+        BOOST_REQUIRE_EQUAL(scheduler.get_stats().running, 1);
+
+        first_done.set_value();
+        f1.get();
+        f2.get();
+        f3.get();
+        BOOST_REQUIRE(order == std::vector<int>({1, 3, 2}));
+
+        order.clear();
+        under_pressure = true;
+        first_done = promise<>();
+        f1 = scheduler.schedule(10, db::replay_position(4), [&order, &first_done] {
+            order.push_back(1);
+            return first_done.get_future();
+        });
+        f2 = scheduler.schedule(1000, db::replay_position(6), flush(2));
+        f3 = scheduler.schedule(10, db::replay_position(5), flush(3));
+        first_done.set_value();
+        f1.get();
+        f2.get();
+        f3.get();
+        BOOST_REQUIRE(order == std::vector<int>({1, 2, 3}));
+        BOOST_REQUIRE_EQUAL(scheduler.get_stats().completed, 6);
+        BOOST_REQUIRE_EQUAL(scheduler.get_stats().bytes_flushed, 2040);
+    });
+}
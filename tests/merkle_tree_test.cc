@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+
+#include "repair/merkle_tree.hh"
+#include "repair/row_level.hh"
+#include "dht/murmur3_partitioner.hh"
+#include "schema_builder.hh"
+
+static dht::token token_from_long(uint64_t value) {
+    auto t = net::hton(value);
+    bytes b(bytes::initialized_later(), 8);
+    std::copy_n(reinterpret_cast<int8_t*>(&t), 8, b.begin());
+    return { dht::token::kind::key, std::move(b) };
+}
+
+static query::range<dht::token> make_range(uint64_t start, uint64_t end) {
+    return query::range<dht::token>(
+        query::range<dht::token>::bound(token_from_long(start), false),
+        query::range<dht::token>::bound(token_from_long(end), true));
+}
+
+static bool contains(const std::vector<query::range<dht::token>>& ranges, uint64_t t) {
+    return std::any_of(ranges.begin(), ranges.end(), [t] (const query::range<dht::token>& r) {
+        return r.contains(token_from_long(t), dht::token_comparator());
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_trees_of_the_same_partitions_agree) {
+    auto range = make_range(0, 1 << 20);
+    merkle_tree t1(range, 8);
+    merkle_tree shard0(range, 8);
+    merkle_tree shard1(range, 8);
+    BOOST_REQUIRE_EQUAL(t1.depth(), 8);
+
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        t1.add(token_from_long(i * 1000), i);
+        (i % 2 ? shard0 : shard1).add(token_from_long((1001 - i) * 1000), 1001 - i);
+    }
+    shard0.merge(shard1);
+
+    BOOST_REQUIRE_EQUAL(t1.partitions(), shard0.partitions());
+    BOOST_REQUIRE_EQUAL(t1.root(), shard0.root());
+    BOOST_REQUIRE(t1.difference(shard0).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_difference_covers_differing_partitions_only) {
+    auto range = make_range(0, 1 << 20);
+    merkle_tree t1(range, 8);
+    merkle_tree t2(range, 8);
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        t1.add(token_from_long(i * 1000), i);
+        t2.add(token_from_long(i * 1000), i == 500 ? 0 : i);
+    }
+
+    auto diff = t1.difference(t2);
+    BOOST_REQUIRE_EQUAL(diff.size(), 1);
+    BOOST_REQUIRE(contains(diff, 500 * 1000));
+    BOOST_REQUIRE(!contains(diff, 499 * 1000));
+    BOOST_REQUIRE(!contains(diff, 501 * 1000));
+
+    // The difference at a lower depth is that of the same data.
+    auto shallow = t1.shrink(2).difference(t2.shrink(2));
+    BOOST_REQUIRE_EQUAL(shallow.size(), 1);
+    BOOST_REQUIRE(shallow[0].contains(diff[0], dht::token_comparator()));
+}
+
+BOOST_AUTO_TEST_CASE(test_wrapping_range) {
+    auto range = make_range(1 << 20, 1 << 10);
+    merkle_tree t1(range, 4);
+    merkle_tree t2(range, 4);
+    BOOST_REQUIRE_EQUAL(t1.depth(), 4);
+
+    t1.add(token_from_long(1 << 5), 1);
+    t1.add(token_from_long(1 << 30), 2);
+    t2.add(token_from_long(1 << 30), 2);
+
+    auto diff = t1.difference(t2);
+    BOOST_REQUIRE_EQUAL(diff.size(), 1);
+    BOOST_REQUIRE(contains(diff, 1 << 5));
+    BOOST_REQUIRE(!contains(diff, 1 << 30));
+}
+
+BOOST_AUTO_TEST_CASE(test_unbounded_range_is_a_single_leaf) {
+    merkle_tree t(query::range<dht::token>::make_open_ended_both_sides(), 8);
+    BOOST_REQUIRE_EQUAL(t.depth(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_serialization) {
+    merkle_tree t(make_range(0, 1 << 20), 6);
+    t.add(token_from_long(12345), 42);
+
+    bytes b(bytes::initialized_later(), t.serialized_size());
+    auto out = b.begin();
+    t.serialize(out);
+    bytes_view v(b);
+    auto t2 = merkle_tree::deserialize(v);
+
+    BOOST_REQUIRE_EQUAL(t2.depth(), t.depth());
+    BOOST_REQUIRE_EQUAL(t2.partitions(), 1);
+    BOOST_REQUIRE(t.difference(t2).empty());
+}
+
+static schema_ptr make_row_schema() {
+    return schema_builder("ks", "cf")
+        .with_column("pk", int32_type, column_kind::partition_key)
+        .with_column("ck", int32_type, column_kind::clustering_key)
+        .with_column("v", int32_type)
+        .build();
+}
+
+// The row of the clustering key ck of partition p, or its partition-level row.
+static repair_row_key make_row_key(const schema& s, int32_t p, std::experimental::optional<int32_t> ck = {}) {
+    auto dk = dht::global_partitioner().decorate_key(s, partition_key::from_single_value(s, int32_type->decompose(p)));
+    std::experimental::optional<clustering_key> key;
+    if (ck) {
+        key = clustering_key::from_single_value(s, int32_type->decompose(*ck));
+    }
+    return repair_row_key(std::move(dk), std::move(key));
+}
+
+template <typename T>
+static T serialize_deserialize(const T& v) {
+    bytes buf(bytes::initialized_later(), v.serialized_size());
+    auto out = buf.begin();
+    v.serialize(out);
+    bytes_view in(buf);
+    auto ret = T::deserialize(in);
+    BOOST_REQUIRE(in.empty());
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(test_repair_row_key_order) {
+    auto s = make_row_schema();
+    auto p1 = make_row_key(*s, 1);
+    auto p2 = make_row_key(*s, 2);
+    auto partition_order = p1.dk.tri_compare(*s, p2.dk);
+    BOOST_REQUIRE(partition_order != 0);
+
+    // The partition-level row comes before the clustering rows.
+    BOOST_REQUIRE_EQUAL(p1.tri_compare(*s, p1), 0);
+    BOOST_REQUIRE(p1.tri_compare(*s, make_row_key(*s, 1, 0)) < 0);
+    BOOST_REQUIRE(make_row_key(*s, 1, 0).tri_compare(*s, p1) > 0);
+    BOOST_REQUIRE(make_row_key(*s, 1, 0).tri_compare(*s, make_row_key(*s, 1, 1)) < 0);
+    BOOST_REQUIRE_EQUAL(make_row_key(*s, 1, 1).tri_compare(*s, make_row_key(*s, 1, 1)), 0);
+
+    // Rows of different partitions are in the order of their partitions.
+    BOOST_REQUIRE_EQUAL(make_row_key(*s, 1, 5).tri_compare(*s, p2) < 0, partition_order < 0);
+    BOOST_REQUIRE_EQUAL(p1.tri_compare(*s, make_row_key(*s, 2, 0)) < 0, partition_order < 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_repair_row_serialization) {
+    auto s = make_row_schema();
+
+    repair_row_window window;
+    auto w = serialize_deserialize(window);
+    BOOST_REQUIRE(!w.after);
+    BOOST_REQUIRE(!w.last);
+    window.after = make_row_key(*s, 1);
+    window.last = make_row_key(*s, 2, 7);
+    w = serialize_deserialize(window);
+    BOOST_REQUIRE(w.after && !w.after->ck);
+    BOOST_REQUIRE_EQUAL(w.after->tri_compare(*s, *window.after), 0);
+    BOOST_REQUIRE(w.last && w.last->ck);
+    BOOST_REQUIRE_EQUAL(w.last->tri_compare(*s, *window.last), 0);
+
+    repair_row_hashes hashes;
+    hashes.combined = 0x123456789abcdefULL;
+    hashes.count = 3;
+    hashes.last = make_row_key(*s, 3, 1);
+    hashes.rows.emplace_back(make_row_key(*s, 3), 1);
+    hashes.rows.emplace_back(make_row_key(*s, 3, 1), 2);
+    auto h = serialize_deserialize(hashes);
+    BOOST_REQUIRE_EQUAL(h.combined, hashes.combined);
+    BOOST_REQUIRE_EQUAL(h.count, hashes.count);
+    BOOST_REQUIRE(h.last);
+    BOOST_REQUIRE_EQUAL(h.last->tri_compare(*s, *hashes.last), 0);
+    BOOST_REQUIRE_EQUAL(h.rows.size(), 2);
+    for (size_t i = 0; i < h.rows.size(); ++i) {
+        BOOST_REQUIRE_EQUAL(h.rows[i].first.tri_compare(*s, hashes.rows[i].first), 0);
+        BOOST_REQUIRE_EQUAL(h.rows[i].second, hashes.rows[i].second);
+    }
+}
+
+// The hashes of a window of rows of partition 1, in ring order.
+static repair_row_hashes make_hashes(const schema& s, std::vector<std::pair<int32_t, uint64_t>> rows) {
+    repair_row_hashes h;
+    for (auto&& r : rows) {
+        h.rows.emplace_back(make_row_key(s, 1, r.first), r.second);
+        h.combined ^= r.second;
+        ++h.count;
+    }
+    return h;
+}
+
+static std::vector<int32_t> clustering_values(const schema& s, const std::vector<repair_row_key>& keys) {
+    std::vector<int32_t> values;
+    for (auto&& k : keys) {
+        values.push_back(boost::any_cast<int32_t>(int32_type->deserialize(k.ck->get_component(s, 0))));
+    }
+    return values;
+}
+
+BOOST_AUTO_TEST_CASE(test_repair_row_diff) {
+    auto s = make_row_schema();
+    auto local = make_hashes(*s, {{1, 10}, {2, 20}, {3, 30}, {5, 50}});
+    auto remote = make_hashes(*s, {{2, 20}, {3, 31}, {4, 40}, {5, 50}, {6, 60}});
+
+    // Rows either replica lacks go one way, those which differ both ways.
+    auto diff = diff_rows(*s, local, remote);
+    BOOST_REQUIRE(clustering_values(*s, diff.to_send) == std::vector<int32_t>({1, 3}));
+    BOOST_REQUIRE(clustering_values(*s, diff.to_fetch) == std::vector<int32_t>({3, 4, 6}));
+
+    BOOST_REQUIRE(diff_rows(*s, local, local).to_send.empty());
+    BOOST_REQUIRE(diff_rows(*s, local, local).to_fetch.empty());
+    BOOST_REQUIRE(clustering_values(*s, diff_rows(*s, local, repair_row_hashes()).to_send) == std::vector<int32_t>({1, 2, 3, 5}));
+}
+
+BOOST_AUTO_TEST_CASE(test_repair_row_hashes_trim) {
+    auto s = make_row_schema();
+    auto h = make_hashes(*s, {{1, 10}, {2, 20}, {3, 30}, {5, 50}});
+
+    // The window ends at the last row the peer read, which we may lack.
+    h.trim(*s, make_row_key(*s, 1, 4));
+    BOOST_REQUIRE_EQUAL(h.count, 3);
+    BOOST_REQUIRE_EQUAL(h.combined, uint64_t(10 ^ 20 ^ 30));
+    BOOST_REQUIRE(clustering_values(*s, {h.rows[2].first}) == std::vector<int32_t>({3}));
+
+    h.trim(*s, make_row_key(*s, 1, 3));
+    BOOST_REQUIRE_EQUAL(h.count, 3);
+
+    // Only the partition-level row is before the first clustering row.
+    h.trim(*s, make_row_key(*s, 1));
+    BOOST_REQUIRE_EQUAL(h.count, 0);
+    BOOST_REQUIRE_EQUAL(h.combined, 0);
+    BOOST_REQUIRE(h.rows.empty());
+}
@@ -123,3 +123,28 @@ BOOST_AUTO_TEST_CASE(test_hash_output) {
         }
     }
 }
+
+BOOST_AUTO_TEST_CASE(test_hash_of_many_keys) {
+    // Runs of keys of the same length, hashed together where the CPU allows
+    // it, between keys of other lengths.
+    std::vector<size_t> sizes;
+    for (size_t size : { 0, 4, 16, 17, 32, 48 }) {
+        for (int i = 0; i < 9; ++i) {
+            sizes.push_back(size);
+        }
+        sizes.push_back(size + 1);
+    }
+    std::vector<bytes_view> keys;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        keys.emplace_back(full_sequence.begin() + i % 8, sizes[i]);
+    }
+
+    std::vector<std::array<uint64_t, 2>> dst;
+    utils::murmur_hash::hash3_x64_128(keys, seed, dst);
+    BOOST_REQUIRE_EQUAL(dst.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        std::array<uint64_t, 2> expected;
+        utils::murmur_hash::hash3_x64_128(keys[i], seed, expected);
+        BOOST_REQUIRE(dst[i] == expected);
+    }
+}
@@ -37,6 +37,7 @@
 #include "core/thread.hh"
 #include "schema_builder.hh"
 #include "partition_slice_builder.hh"
+#include "query_result_merger.hh"
 
 using namespace std::literals::chrono_literals;
 
@@ -191,3 +192,54 @@ SEASTAR_TEST_CASE(test_query_when_partition_tombstone_covers_live_cells) {
             .is_empty();
     });
 }
+
+SEASTAR_TEST_CASE(test_columnar_results) {
+    return seastar::async([] {
+        auto s = make_schema();
+        auto now = gc_clock::now();
+
+        mutation m1(partition_key::from_single_value(*s, "key1"), s);
+        m1.set_static_cell("s1", bytes("s1:v"), 1);
+        m1.set_clustered_cell(clustering_key::from_single_value(*s, bytes("prefix-A")), "v1", bytes("A:v1"), 1);
+        m1.set_clustered_cell(clustering_key::from_single_value(*s, bytes("prefix-A")), "v2", bytes("A:v2"), 1);
+        m1.set_clustered_cell(clustering_key::from_single_value(*s, bytes("prefix-AB")), "v2", bytes(""), 1);
+        m1.set_clustered_cell(clustering_key::from_single_value(*s, bytes("prefix-B")), "v1", bytes("B:v1"), 1);
+
+        mutation m2(partition_key::from_single_value(*s, "key2"), s);
+        m2.set_static_cell("s2", bytes("s2:v"), 1);
+
+        mutation m3(partition_key::from_single_value(*s, "key3"), s);
+        m3.set_clustered_cell(clustering_key::from_single_value(*s, bytes("prefix-A")), "v1", bytes("A:v1"), 1);
+
+        std::vector<mutation> mutations = { m1, m2, m3 };
+        std::sort(mutations.begin(), mutations.end(), mutation_less_cmp());
+        auto src = make_source(mutations);
+
+        auto check = [&] (query::partition_slice slice) {
+            auto columnar = slice;
+            columnar.options.set<query::partition_slice::option::columnar>();
+            reconcilable_result result = mutation_query(src,
+                query::full_partition_range, slice, query::max_rows, now).get0();
+            auto rows = to_result_set(result, s, slice);
+            BOOST_REQUIRE_EQUAL(rows.rows().size(), 5);
+            BOOST_REQUIRE(to_result_set(result, s, columnar) == rows);
+
+            // Results of several shards are concatenated.
+            query::result_merger merger;
+            merger(make_foreign(make_lw_shared(to_data_query_result(result, s, columnar))));
+            merger(make_foreign(make_lw_shared(to_data_query_result(result, s, columnar))));
+            auto merged_result = merger.get();
+            auto merged = query::result_set::from_raw_result(s, columnar, *merged_result);
+            BOOST_REQUIRE_EQUAL(merged.rows().size(), 10);
+
+            // The parts of a merged result are copied together only when needed.
+            auto size = merged_result->serialized_size();
+            BOOST_REQUIRE_EQUAL(merged_result->buf().size(), size);
+            BOOST_REQUIRE(query::result_set::from_raw_result(s, columnar, *merged_result) == merged);
+        };
+        auto slice = make_full_slice(*s);
+        check(slice);
+        slice.options.remove<query::partition_slice::option::send_timestamp_and_expiry>();
+        check(slice);
+    });
+}
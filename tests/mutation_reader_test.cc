@@ -28,8 +28,10 @@
 #include "tests/mutation_reader_assertions.hh"
 
 #include "mutation_reader.hh"
+#include "utils/reader_concurrency_semaphore.hh"
 #include "core/do_with.hh"
 #include "core/thread.hh"
+#include "core/sleep.hh"
 #include "schema_builder.hh"
 
 static schema_ptr make_schema() {
@@ -123,6 +125,35 @@ static mutation make_mutation_with_key(schema_ptr s, sstring key) {
     return m;
 }
 
+SEASTAR_TEST_CASE(test_combining_readers_with_runs_of_partitions) {
+    return seastar::async([] {
+        auto s = make_schema();
+
+        std::vector<mutation> ms;
+        for (int i = 0; i < 6; ++i) {
+            ms.push_back(make_mutation_with_key(s, sprint("key%d", i)));
+        }
+        std::sort(ms.begin(), ms.end(), [] (const mutation& a, const mutation& b) {
+            return a.decorated_key().less_compare(*a.schema(), b.decorated_key());
+        });
+        mutation newer(ms[2].key(), s);
+        newer.set_clustered_cell(clustering_key::make_empty(*s), "v", bytes("v2"), 2);
+
+        std::vector<mutation_reader> v;
+        v.push_back(make_reader_returning_many({ms[0], ms[1], ms[2]}));
+        v.push_back(make_reader_returning_many({newer, ms[3], ms[4]}));
+        v.push_back(make_reader_returning(ms[5]));
+        assert_that(make_combined_reader(std::move(v)))
+            .produces(ms[0])
+            .produces(ms[1])
+            .produces(newer)
+            .produces(ms[3])
+            .produces(ms[4])
+            .produces(ms[5])
+            .produces_end_of_stream();
+    });
+}
+
 SEASTAR_TEST_CASE(test_filtering) {
     return seastar::async([] {
         auto s = make_schema();
@@ -239,3 +270,69 @@ SEASTAR_TEST_CASE(test_joining_reader) {
             .produces_end_of_stream();
     });
 }
+
+SEASTAR_TEST_CASE(test_reader_concurrency_semaphore_admission) {
+    return seastar::async([] {
+        reader_concurrency_semaphore sem(2, 100, 1, std::chrono::hours(1));
+
+        auto f1 = sem.wait_admission(60);
+        BOOST_REQUIRE(f1.available());
+        // Over the memory limit.
+        auto f2 = sem.wait_admission(60);
+        BOOST_REQUIRE(!f2.available());
+        // Over the queue length limit.
+        auto f3 = sem.wait_admission(10);
+        BOOST_REQUIRE_THROW(f3.get(), read_admission_exception);
+        BOOST_REQUIRE_EQUAL(sem.get_stats().rejected, 1);
+
+        sem.signal(60);
+        f2.get();
+        BOOST_REQUIRE_EQUAL(sem.get_stats().active, 1);
+        BOOST_REQUIRE_EQUAL(sem.get_stats().memory, 60);
+        sem.signal(60);
+
+        // A read larger than the limit runs alone.
+        auto f4 = sem.wait_admission(1000);
+        BOOST_REQUIRE(f4.available());
+        auto f5 = sem.wait_admission(1);
+        BOOST_REQUIRE(!f5.available());
+        sem.signal(1000);
+        f5.get();
+        sem.signal(1);
+        BOOST_REQUIRE_EQUAL(sem.get_stats().active, 0);
+        BOOST_REQUIRE_EQUAL(sem.get_stats().memory, 0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_reader_concurrency_semaphore_timeout) {
+    return seastar::async([] {
+        reader_concurrency_semaphore sem(1, 100, 10, std::chrono::milliseconds(1));
+
+        auto f1 = sem.wait_admission(1);
+        auto f2 = sem.wait_admission(1);
+        sleep(std::chrono::milliseconds(50)).get();
+        BOOST_REQUIRE_THROW(f2.get(), read_admission_exception);
+        BOOST_REQUIRE_EQUAL(sem.get_stats().timed_out, 1);
+        BOOST_REQUIRE_EQUAL(sem.get_stats().queued, 0);
+        f1.get();
+        sem.signal(1);
+    });
+}
+
+SEASTAR_TEST_CASE(test_reader_concurrency_semaphore_deadline) {
+    return seastar::async([] {
+        reader_concurrency_semaphore sem(1, 100, 10, std::chrono::hours(1));
+
+        auto f1 = sem.wait_admission(1);
+        auto f2 = sem.wait_admission(1);
+        // Queued behind f2, but expires first.
+        auto f3 = sem.wait_admission(1, std::chrono::steady_clock::now() + std::chrono::milliseconds(1));
+        sleep(std::chrono::milliseconds(50)).get();
+        BOOST_REQUIRE_THROW(f3.get(), read_admission_exception);
+        BOOST_REQUIRE(!f2.available());
+        sem.signal(1);
+        f2.get();
+        sem.signal(1);
+        f1.get();
+    });
+}
@@ -36,8 +36,10 @@
 #include "schema_builder.hh"
 #include "query-result-set.hh"
 #include "query-result-reader.hh"
+#include "query-result-writer.hh"
 #include "partition_slice_builder.hh"
 #include "tmpdir.hh"
+#include "counters.hh"
 
 #include "tests/test-utils.hh"
 #include "tests/mutation_assertions.hh"
@@ -157,6 +159,37 @@ SEASTAR_TEST_CASE(test_row_tombstone_updates) {
     return make_ready_future<>();
 }
 
+SEASTAR_TEST_CASE(test_range_tombstone_cursor) {
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}},
+        {{"c1", int32_type}, {"c2", int32_type}, {"c3", int32_type}},
+        {{"r1", int32_type}}, {}, utf8_type));
+
+    auto ttl = gc_clock::now() + std::chrono::seconds(1);
+
+    mutation m(partition_key::from_exploded(*s, {to_bytes("key1")}), s);
+    m.partition().apply(tombstone(1, ttl));
+    // Nested and disjoint prefixes, with tombstones older and newer than
+    // those of the prefixes they extend.
+    std::vector<std::pair<std::vector<boost::any>, api::timestamp_type>> tombstones = {
+        {{1}, 5}, {{1, 2}, 3}, {{1, 3}, 7}, {{2, 1}, 4}, {{3}, 2}, {{3, 3}, 9}, {{5, 5}, 6},
+    };
+    for (auto&& t : tombstones) {
+        m.partition().apply_row_tombstone(*s, clustering_key_prefix::from_deeply_exploded(*s, t.first), tombstone(t.second, ttl));
+    }
+
+    mutation_partition::range_tombstone_cursor cursor(*s, m.partition());
+    for (int32_t c1 = 0; c1 < 6; c1++) {
+        for (int32_t c2 = 0; c2 < 6; c2 += 2) {
+            for (int32_t c3 = 0; c3 < 2; c3++) {
+                auto key = clustering_key::from_deeply_exploded(*s, {c1, c2 + c1 % 2, c3});
+                BOOST_REQUIRE_EQUAL(cursor.range_tombstone_for_row(key), m.partition().range_tombstone_for_row(*s, key));
+            }
+        }
+    }
+    return make_ready_future<>();
+}
+
 SEASTAR_TEST_CASE(test_map_mutations) {
     return seastar::async([] {
         auto my_map_type = map_type_impl::get_instance(int32_type, utf8_type, true);
@@ -386,6 +419,145 @@ SEASTAR_TEST_CASE(test_flush_in_the_middle_of_a_scan) {
     }).then([dir] {});
 }
 
+SEASTAR_TEST_CASE(test_sstables_per_read_are_counted) {
+    auto s = schema_builder("ks", "cf")
+        .with_column("pk", bytes_type, column_kind::partition_key)
+        .with_column("v", bytes_type)
+        .build();
+
+    auto dir = make_lw_shared<tmpdir>();
+
+    column_family::config cfg;
+    cfg.datadir = { dir->path };
+    cfg.enable_disk_reads = true;
+    cfg.enable_disk_writes = true;
+    cfg.enable_cache = false;
+    cfg.enable_incremental_backups = false;
+
+    return with_column_family(s, cfg, [s](column_family& cf) {
+        return seastar::async([s, &cf] {
+            auto key = dht::global_partitioner().decorate_key(*s, partition_key::from_single_value(*s, to_bytes("key")));
+            for (int i = 0; i < 3; ++i) {
+                mutation m(key, s);
+                m.set_clustered_cell(clustering_key::make_empty(*s), "v", to_bytes(sprint("value%d", i)), i);
+                cf.apply(m);
+                cf.flush().get();
+            }
+
+            auto& histogram = cf.get_stats().estimated_sstable_per_read;
+            BOOST_REQUIRE_EQUAL(histogram.count(), 0);
+
+            auto pr = query::partition_range::make_singular(key);
+            auto reader = cf.make_reader(pr);
+            BOOST_REQUIRE(reader().get0());
+            BOOST_REQUIRE_EQUAL(histogram.count(), 1);
+            BOOST_REQUIRE_EQUAL(histogram.mean(), 3);
+        });
+    }).then([dir] {});
+}
+
+static column_family::config uncached_disk_config(const tmpdir& dir) {
+    column_family::config cfg;
+    cfg.datadir = { dir.path };
+    cfg.enable_disk_reads = true;
+    cfg.enable_disk_writes = true;
+    cfg.enable_cache = false;
+    cfg.enable_incremental_backups = false;
+    return cfg;
+}
+
+SEASTAR_TEST_CASE(test_single_row_read_keeps_older_row_marker) {
+    auto s = schema_builder("ks", "cf")
+        .with_column("pk", bytes_type, column_kind::partition_key)
+        .with_column("ck", bytes_type, column_kind::clustering_key)
+        .with_column("v", bytes_type)
+        .build();
+
+    auto dir = make_lw_shared<tmpdir>();
+    return with_column_family(s, uncached_disk_config(*dir), [s](column_family& cf) {
+        return seastar::async([s, &cf] {
+            auto key = dht::global_partitioner().decorate_key(*s, partition_key::from_single_value(*s, to_bytes("key")));
+            auto ck = clustering_key::from_single_value(*s, to_bytes("ck"));
+            auto& v = *s->get_column_definition("v");
+
+            mutation older(key, s);
+            older.partition().apply_insert(*s, ck, 1);
+            older.set_clustered_cell(ck, v, atomic_cell::make_live(1, to_bytes("value")));
+            cf.apply(older);
+            cf.flush().get();
+
+            // Only the cell is newer: the older marker still keeps the row.
+            mutation newer(key, s);
+            newer.set_clustered_cell(ck, v, atomic_cell::make_dead(2, gc_clock::now()));
+            cf.apply(newer);
+            cf.flush().get();
+
+            auto pr = query::partition_range::make_singular(key);
+            auto slice = partition_slice_builder(*s)
+                .with_range(query::clustering_range::make_singular(ck))
+                .with_regular_column("v")
+                .build();
+            auto reader = cf.make_reader(pr, slice, query::max_rows, gc_clock::now());
+            auto m = reader().get0();
+            BOOST_REQUIRE(m);
+            auto e = m->partition().find_entry(*s, ck);
+            BOOST_REQUIRE(e);
+            BOOST_REQUIRE(e->row().marker().is_live(tombstone(), gc_clock::now()));
+            BOOST_REQUIRE_EQUAL(e->row().marker().timestamp(), 1);
+
+            auto& histogram = cf.get_stats().estimated_sstable_per_read;
+            BOOST_REQUIRE_EQUAL(histogram.count(), 1);
+            BOOST_REQUIRE_EQUAL(histogram.mean(), 2);
+        });
+    }).then([dir] {});
+}
+
+SEASTAR_TEST_CASE(test_single_row_read_merges_counter_shards) {
+    auto s = schema_builder("ks", "cf")
+        .with_column("pk", bytes_type, column_kind::partition_key)
+        .with_column("ck", bytes_type, column_kind::clustering_key)
+        .with_column("c", counter_type)
+        .build();
+
+    auto dir = make_lw_shared<tmpdir>();
+    return with_column_family(s, uncached_disk_config(*dir), [s](column_family& cf) {
+        return seastar::async([s, &cf] {
+            auto key = dht::global_partitioner().decorate_key(*s, partition_key::from_single_value(*s, to_bytes("key")));
+            auto ck = clustering_key::from_single_value(*s, to_bytes("ck"));
+            auto& c = *s->get_column_definition("c");
+            auto id1 = utils::make_random_uuid();
+            auto id2 = utils::make_random_uuid();
+
+            mutation older(key, s);
+            older.set_clustered_cell(ck, c, atomic_cell::make_live(1, serialize_counter_shards(std::vector<counter_shard>{{id1, 5, 1}})));
+            cf.apply(older);
+            cf.flush().get();
+
+            // Newer in every respect, yet it holds only the shard of id2.
+            mutation newer(key, s);
+            newer.partition().apply_insert(*s, ck, 2);
+            newer.set_clustered_cell(ck, c, atomic_cell::make_live(2, serialize_counter_shards(std::vector<counter_shard>{{id2, 3, 1}})));
+            cf.apply(newer);
+            cf.flush().get();
+
+            auto pr = query::partition_range::make_singular(key);
+            auto slice = partition_slice_builder(*s)
+                .with_range(query::clustering_range::make_singular(ck))
+                .with_regular_column("c")
+                .build();
+            auto reader = cf.make_reader(pr, slice, query::max_rows, gc_clock::now());
+            auto m = reader().get0();
+            BOOST_REQUIRE(m);
+            auto row = m->partition().find_row(ck);
+            BOOST_REQUIRE(row);
+            auto cell = row->find_cell(c.id);
+            BOOST_REQUIRE(cell);
+            auto total = boost::any_cast<int64_t>(long_type->deserialize(counter_total_value(cell->as_atomic_cell())));
+            BOOST_REQUIRE_EQUAL(total, 8);
+        });
+    }).then([dir] {});
+}
+
 SEASTAR_TEST_CASE(test_multiple_memtables_multiple_partitions) {
     auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
             {{"p1", int32_type}}, {{"c1", int32_type}}, {{"r1", int32_type}}, {}, utf8_type));
@@ -680,3 +852,368 @@ SEASTAR_TEST_CASE(test_row_counting) {
         BOOST_REQUIRE_EQUAL(2, m.live_row_count());
     });
 }
+
+SEASTAR_TEST_CASE(test_query_stops_at_result_size_limit) {
+    return seastar::async([] {
+        auto s = schema_builder("ks", "cf")
+            .with_column("pk", bytes_type, column_kind::partition_key)
+            .with_column("ck", bytes_type, column_kind::clustering_key)
+            .with_column("v", bytes_type, column_kind::regular_column)
+            .build();
+
+        mutation m(partition_key::from_single_value(*s, "key1"), s);
+        for (auto&& ck : {"A", "B", "C"}) {
+            m.set_clustered_cell(clustering_key::from_single_value(*s, bytes_type->decompose(bytes(ck))),
+                *s->get_column_definition("v"), atomic_cell::make_live(1, bytes_type->decompose(bytes("v:value"))));
+        }
+
+        auto slice = make_full_slice(*s);
+        auto query = [&] (size_t max_size) {
+            query::result::builder builder(slice, max_size);
+            auto pb = builder.add_partition(m.key());
+            m.partition().query(pb, *s, gc_clock::now(), query::max_rows);
+            return std::make_pair(builder.is_full(), builder.build());
+        };
+
+        auto unlimited = query(std::numeric_limits<size_t>::max());
+        BOOST_REQUIRE(!unlimited.first);
+        assert_that(query::result_set::from_raw_result(s, slice, unlimited.second)).has_size(3);
+
+        // Even the smallest limit lets a row in.
+        auto limited = query(1);
+        BOOST_REQUIRE(limited.first);
+        assert_that(query::result_set::from_raw_result(s, slice, limited.second))
+            .has_only(a_row()
+                .with_column("pk", bytes("key1"))
+                .with_column("ck", bytes("A"))
+                .with_column("v", bytes("v:value")));
+    });
+}
+
+SEASTAR_TEST_CASE(test_merging_sparse_rows) {
+    return seastar::async([] {
+        schema_builder builder(some_keyspace, some_column_family);
+        builder.with_column("pk", bytes_type, column_kind::partition_key);
+        auto column_count = row::max_vector_size * 2;
+        for (unsigned i = 0; i < column_count; ++i) {
+            builder.with_column(to_bytes(sprint("v%d", i)), bytes_type);
+        }
+        auto s = builder.build();
+
+        auto cell = [] (api::timestamp_type ts, unsigned id) {
+            return atomic_cell_or_collection(atomic_cell::make_live(ts, bytes_type->decompose(bytes(to_bytes(sprint("%d:%d", ts, id))))));
+        };
+
+        // Every third column in r1 and every second one in r2, set out of order.
+        row r1;
+        row r2;
+        for (unsigned i = column_count; i-- > 0;) {
+            if (i % 3 == 0) {
+                r1.apply(s->regular_column_at(i), cell(1, i));
+            }
+            if (i % 2 == 0) {
+                r2.apply(s->regular_column_at(i), cell(2, i));
+            }
+        }
+        auto r2_copy = r2;
+
+        auto check = [&] (const row& r) {
+            size_t expected = 0;
+            for (unsigned i = 0; i < column_count; ++i) {
+                auto c = r.find_cell(i);
+                if (i % 2 == 0) {
+                    BOOST_REQUIRE(c && *c == cell(2, i));
+                    ++expected;
+                } else if (i % 3 == 0) {
+                    BOOST_REQUIRE(c && *c == cell(1, i));
+                    ++expected;
+                } else {
+                    BOOST_REQUIRE(!c);
+                }
+            }
+            BOOST_REQUIRE_EQUAL(r.size(), expected);
+        };
+
+        row merged1(r1);
+        merged1.merge(*s, column_kind::regular_column, r2);
+        check(merged1);
+
+        row merged2(r1);
+        merged2.merge(*s, column_kind::regular_column, std::move(r2_copy));
+        check(merged2);
+        BOOST_REQUIRE(merged1 == merged2);
+
+        // Merging the other way gives the same.
+        r2.merge(*s, column_kind::regular_column, std::move(r1));
+        check(r2);
+        BOOST_REQUIRE(r2 == merged1);
+    });
+}
+
+SEASTAR_TEST_CASE(test_partition_difference) {
+    return seastar::async([] {
+        auto my_map_type = map_type_impl::get_instance(int32_type, utf8_type, true);
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", int32_type}}, {{"r1", int32_type}, {"r2", int32_type}}, {{"s1", my_map_type}}, utf8_type));
+        auto& r1_col = *s->get_column_definition("r1");
+        auto& r2_col = *s->get_column_definition("r2");
+        auto& s1_col = *s->get_column_definition("s1");
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        auto ckey = [&] (int32_t c) {
+            return clustering_key::from_exploded(*s, {int32_type->decompose(c)});
+        };
+        auto cell = [] (api::timestamp_type ts, int32_t v) {
+            return atomic_cell::make_live(ts, int32_type->decompose(v));
+        };
+        auto map_entry = [&] (int32_t k, sstring v) {
+            map_type_impl::mutation mm{{}, {{int32_type->decompose(k), atomic_cell::make_live(1, utf8_type->decompose(v))}}};
+            return my_map_type->serialize_mutation_form(mm);
+        };
+
+        // What a replica has.
+        mutation theirs(key, s);
+        theirs.set_clustered_cell(ckey(1), r1_col, cell(1, 1));
+        theirs.set_clustered_cell(ckey(2), r1_col, cell(1, 2));
+        theirs.set_clustered_cell(ckey(2), r2_col, cell(1, 2));
+        theirs.set_static_cell(s1_col, map_entry(101, "a"));
+
+        // What the others have besides: a newer cell, a new row, a new map
+        // element and a deleted row.
+        mutation mine(theirs);
+        mine.set_clustered_cell(ckey(1), r1_col, cell(2, 10));
+        mine.set_clustered_cell(ckey(3), r1_col, cell(1, 3));
+        mine.set_static_cell(s1_col, map_entry(102, "b"));
+        mine.partition().apply_delete(*s, ckey(4), tombstone(1, gc_clock::now()));
+
+        auto diff = mine.partition().difference(s, theirs.partition());
+        BOOST_REQUIRE_EQUAL(diff.clustered_rows().size(), 3);
+        BOOST_REQUIRE(!diff.find_row(ckey(2)));
+        auto r1 = diff.find_row(ckey(1));
+        BOOST_REQUIRE(r1 && r1->size() == 1 && r1->find_cell(r1_col.id));
+        auto map = my_map_type->deserialize_mutation_form(diff.static_row().find_cell(s1_col.id)->as_collection_mutation());
+        BOOST_REQUIRE_EQUAL(map.cells.size(), 1);
+
+        // Applying the difference makes the replica's partition whole.
+        theirs.partition().apply(*s, diff);
+        BOOST_REQUIRE(theirs.partition().equal(*s, mine.partition()));
+        BOOST_REQUIRE(mine.partition().difference(s, theirs.partition()).empty());
+    });
+}
+
+SEASTAR_TEST_CASE(test_drop_shadowed) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", int32_type}, {"c2", int32_type}}, {{"r1", int32_type}}, {}, utf8_type));
+        auto& r1_col = *s->get_column_definition("r1");
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        auto ckey = [&] (int32_t c1, int32_t c2) {
+            return clustering_key::from_exploded(*s, {int32_type->decompose(c1), int32_type->decompose(c2)});
+        };
+        auto cell = [] (api::timestamp_type ts, int32_t v) {
+            return atomic_cell::make_live(ts, int32_type->decompose(v));
+        };
+
+        mutation m(key, s);
+        m.partition().apply(tombstone(2, gc_clock::now()));
+        m.partition().apply_row_tombstone(*s, clustering_key_prefix::from_deeply_exploded(*s, {1}),
+            tombstone(4, gc_clock::now()));
+        m.partition().apply_row_tombstone(*s, clustering_key_prefix::from_deeply_exploded(*s, {2}),
+            tombstone(1, gc_clock::now()));
+        m.set_clustered_cell(ckey(0, 0), r1_col, cell(1, 0));
+        m.set_clustered_cell(ckey(0, 1), r1_col, cell(3, 1));
+        m.set_clustered_cell(ckey(1, 0), r1_col, cell(3, 2));
+        m.set_clustered_cell(ckey(1, 1), r1_col, cell(5, 3));
+        m.partition().apply_delete(*s, ckey(3, 0), tombstone(3, gc_clock::now()));
+
+        mutation newer(key, s);
+        newer.set_clustered_cell(ckey(0, 0), r1_col, cell(6, 4));
+
+        mutation expected(m);
+        expected.partition().apply(*s, newer.partition());
+        m.partition().drop_shadowed(*s);
+
+        // Rows under a newer tombstone are gone, the tombstones aren't.
+        BOOST_REQUIRE(!m.partition().find_row(ckey(0, 0)));
+        BOOST_REQUIRE(m.partition().find_row(ckey(0, 1)));
+        BOOST_REQUIRE(!m.partition().find_row(ckey(1, 0)));
+        BOOST_REQUIRE(m.partition().find_row(ckey(1, 1)));
+        BOOST_REQUIRE(m.partition().find_row(ckey(3, 0)));
+        BOOST_REQUIRE_EQUAL(m.partition().row_tombstones().size(), 1);
+
+        // Merging gives what merging the partition as it was did.
+        m.partition().apply(*s, newer.partition());
+        auto now = gc_clock::now();
+        m.partition().compact_for_query(*s, now, {query::full_clustering_range}, query::max_rows);
+        expected.partition().compact_for_query(*s, now, {query::full_clustering_range}, query::max_rows);
+        BOOST_REQUIRE(m.partition().equal(*s, expected.partition()));
+    });
+}
+
+SEASTAR_TEST_CASE(test_counter_cells_merge) {
+    return seastar::async([] {
+        auto id1 = utils::make_random_uuid();
+        auto id2 = utils::make_random_uuid();
+        if (id2 < id1) {
+            std::swap(id1, id2);
+        }
+        auto counter = [] (std::vector<counter_shard> shards) {
+            return atomic_cell::make_live(1, serialize_counter_shards(shards));
+        };
+        auto total = [] (const atomic_cell& c) {
+            return boost::any_cast<int64_t>(long_type->deserialize(counter_total_value(c)));
+        };
+
+        auto a = counter({{id1, 5, 2}, {id2, 1, 1}});
+        auto b = counter({{id1, 3, 1}, {id2, 4, 3}});
+        auto merged = merge_counter_cells(a, b);
+        BOOST_REQUIRE_EQUAL(total(merged), 9);
+        BOOST_REQUIRE(merge_counter_cells(b, a).value() == merged.value());
+        BOOST_REQUIRE(merge_counter_cells(merged, a).value() == merged.value());
+
+        auto c = counter({{id2, 2, 1}});
+        BOOST_REQUIRE_EQUAL(total(merge_counter_cells(c, counter({{id1, 1, 1}}))), 3);
+
+        auto u = merge_counter_cells(atomic_cell::make_live_counter_update(1, 3), atomic_cell::make_live_counter_update(2, -5));
+        BOOST_REQUIRE(u.is_counter_update());
+        BOOST_REQUIRE_EQUAL(u.counter_update_delta(), -2);
+
+        auto dead = atomic_cell::make_dead(2, gc_clock::now());
+        BOOST_REQUIRE(!merge_counter_cells(merged, dead).is_live());
+    });
+}
+
+SEASTAR_TEST_CASE(test_collection_merge) {
+    return seastar::async([] {
+        auto my_set_type = set_type_impl::get_instance(int32_type, true);
+        auto make = [&] (std::experimental::optional<tombstone> tomb, std::vector<std::pair<int32_t, api::timestamp_type>> cells) {
+            set_type_impl::mutation m;
+            m.tomb = tomb;
+            for (auto&& c : cells) {
+                m.cells.emplace_back(int32_type->decompose(c.first), atomic_cell::make_live(c.second, bytes()));
+            }
+            return my_set_type->serialize_mutation_form(m);
+        };
+        auto check = [&] (collection_mutation::view cm, std::experimental::optional<tombstone> tomb,
+                std::vector<std::pair<int32_t, api::timestamp_type>> cells) {
+            auto m = my_set_type->deserialize_mutation_form(cm);
+            BOOST_REQUIRE(m.tomb == tomb);
+            BOOST_REQUIRE_EQUAL(m.cells.size(), cells.size());
+            for (size_t i = 0; i < cells.size(); ++i) {
+                BOOST_REQUIRE_EQUAL(boost::any_cast<int32_t>(int32_type->deserialize(m.cells[i].first)), cells[i].first);
+                BOOST_REQUIRE_EQUAL(m.cells[i].second.timestamp(), cells[i].second);
+            }
+        };
+
+        auto a = make({}, {{1, 1}, {2, 1}, {3, 1}, {4, 1}, {5, 1}});
+        check(my_set_type->merge(a, make({}, {})), {}, {{1, 1}, {2, 1}, {3, 1}, {4, 1}, {5, 1}});
+        check(my_set_type->merge(a, make({}, {{0, 1}, {3, 2}, {7, 1}})), {},
+                {{0, 1}, {1, 1}, {2, 1}, {3, 2}, {4, 1}, {5, 1}, {7, 1}});
+        check(my_set_type->merge(make({}, {{0, 1}, {3, 2}, {7, 1}}), a), {},
+                {{0, 1}, {1, 1}, {2, 1}, {3, 2}, {4, 1}, {5, 1}, {7, 1}});
+
+        auto t1 = tombstone(1, gc_clock::now());
+        check(my_set_type->merge(a, make(t1, {{3, 2}, {7, 1}})), t1, {{3, 2}, {7, 1}});
+        check(my_set_type->merge(make(t1, {{3, 2}}), make({}, {{2, 1}, {4, 3}})), t1, {{3, 2}, {4, 3}});
+
+        auto t0 = tombstone(0, gc_clock::now());
+        auto b = make({}, {{1, 0}, {2, 1}, {4, 0}});
+        check(my_set_type->merge(b, make(t0, {{3, 1}})), t0, {{2, 1}, {3, 1}});
+    });
+}
+
+SEASTAR_TEST_CASE(test_expired_cells_are_purged_by_compaction) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", int32_type}}, {{"r1", int32_type}, {"r2", int32_type}}, {}, utf8_type));
+        auto& r1_col = *s->get_column_definition("r1");
+        auto& r2_col = *s->get_column_definition("r2");
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        auto c_key = clustering_key::from_exploded(*s, {int32_type->decompose(1)});
+
+        auto now = gc_clock::now();
+        auto gc_before = now - std::chrono::hours(1);
+        mutation m(key, s);
+        // Written two hours ago, expired an hour later.
+        m.set_clustered_cell(c_key, r1_col, atomic_cell::make_live(1, int32_type->decompose(1),
+            now - std::chrono::hours(1), std::chrono::hours(1)));
+        // Written ten minutes ago, expired a minute later.
+        m.set_clustered_cell(c_key, r2_col, atomic_cell::make_live(1, int32_type->decompose(2),
+            now - std::chrono::minutes(9), std::chrono::minutes(1)));
+
+        m.partition().compact_for_compaction(*s, api::max_timestamp, now, gc_before);
+        auto& cells = m.partition().clustered_row(c_key).cells();
+        BOOST_REQUIRE(!cells.find_cell(r1_col.id));
+        auto r2 = cells.find_cell(r2_col.id);
+        BOOST_REQUIRE(r2);
+        BOOST_REQUIRE(!r2->as_atomic_cell().is_live());
+
+        // Kept while it may shadow data of sstables not being compacted.
+        mutation m2(key, s);
+        m2.set_clustered_cell(c_key, r1_col, atomic_cell::make_live(1, int32_type->decompose(1),
+            now - std::chrono::hours(1), std::chrono::hours(1)));
+        m2.partition().compact_for_compaction(*s, 1, now, gc_before);
+        BOOST_REQUIRE(m2.partition().clustered_row(c_key).cells().find_cell(r1_col.id));
+
+        // Nothing is kept for tables with only TTL deletes.
+        m.partition().compact_for_compaction(*s, api::max_timestamp, now, now);
+        BOOST_REQUIRE(!m.partition().clustered_row(c_key).cells().find_cell(r2_col.id));
+    });
+}
+
+SEASTAR_TEST_CASE(test_column_lookup_by_name) {
+    auto s = schema_builder("ks", "cf")
+        .with_column("pk", utf8_type, column_kind::partition_key)
+        .with_column("ck", utf8_type, column_kind::clustering_key)
+        .with_column("s", utf8_type, column_kind::static_column)
+        .with_column("b", utf8_type)
+        .with_column("ab", utf8_type)
+        .with_column("a", utf8_type)
+        .build();
+
+    for (auto&& name : {"pk", "ck", "s", "a", "ab", "b"}) {
+        auto def = s->get_column_definition(to_bytes(name));
+        BOOST_REQUIRE(def);
+        BOOST_REQUIRE_EQUAL(def->name_as_text(), name);
+    }
+    BOOST_REQUIRE(s->get_column_definition(to_bytes("s"))->kind == column_kind::static_column);
+    for (auto&& name : {"", "aa", "abc", "c"}) {
+        BOOST_REQUIRE(!s->get_column_definition(to_bytes(name)));
+    }
+    BOOST_REQUIRE(!s->get_column_definition(to_bytes(std::string("ck\0", 3))));
+
+    // Copies look their own columns up.
+    auto copy = make_lw_shared<schema>(*s);
+    auto def = copy->get_column_definition(to_bytes("ab"));
+    BOOST_REQUIRE(def);
+    BOOST_REQUIRE(def == &copy->regular_column_at(def->id));
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_regular_column_bounds_follow_name_type) {
+    // Sorted as int32 rather than in byte order, as for thrift tables.
+    auto name = [] (int32_t v) {
+        return int32_type->decompose(v);
+    };
+    auto s = schema_builder("ks", "cf", {}, int32_type)
+        .with_column("pk", utf8_type, column_kind::partition_key)
+        .with_column(name(10), utf8_type)
+        .with_column(name(-5), utf8_type)
+        .with_column(name(3), utf8_type)
+        .build();
+
+    auto id_of = [&] (schema::const_iterator i) {
+        return i == s->regular_end() ? -1 : int(i - s->regular_begin());
+    };
+    BOOST_REQUIRE_EQUAL(s->regular_begin()->name(), name(-5));
+    BOOST_REQUIRE_EQUAL(id_of(s->regular_lower_bound(name(-5))), 0);
+    BOOST_REQUIRE_EQUAL(id_of(s->regular_upper_bound(name(-5))), 1);
+    BOOST_REQUIRE_EQUAL(id_of(s->regular_lower_bound(name(0))), 1);
+    BOOST_REQUIRE_EQUAL(id_of(s->regular_upper_bound(name(3))), 2);
+    BOOST_REQUIRE_EQUAL(id_of(s->regular_lower_bound(name(-100))), 0);
+    BOOST_REQUIRE_EQUAL(id_of(s->regular_lower_bound(name(11))), -1);
+    BOOST_REQUIRE_EQUAL(id_of(s->regular_upper_bound(name(10))), -1);
+
+    BOOST_REQUIRE(s->get_column_definition(name(3)));
+    BOOST_REQUIRE(!s->get_column_definition(name(4)));
+    return make_ready_future<>();
+}
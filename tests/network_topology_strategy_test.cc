@@ -292,3 +292,38 @@ SEASTAR_TEST_CASE(NetworkTopologyStrategy_simple) {
 SEASTAR_TEST_CASE(NetworkTopologyStrategy_heavy) {
     return heavy_origin_test();
 }
+
+// Copies share the ring until one of them changes it.
+SEASTAR_TEST_CASE(token_metadata_copies_share_ring) {
+    return i_endpoint_snitch::create_snitch("RackInferringSnitch").then([] {
+        auto token_at = [] (double point) {
+            return dht::token{dht::token::kind::key, {(int8_t*)d2t(point).data(), 8}};
+        };
+        inet_address a("192.100.10.1");
+        inet_address b("192.100.20.1");
+        token_metadata tm;
+        tm.update_normal_token(token_at(0.1), a);
+        tm.update_normal_token(token_at(0.2), b);
+
+        auto copy = tm;
+        auto clone = tm.clone_only_token_map();
+        BOOST_REQUIRE(&copy.sorted_tokens() == &tm.sorted_tokens());
+        BOOST_REQUIRE(&clone.sorted_tokens() == &tm.sorted_tokens());
+
+        // Repeating the tokens of an endpoint changes nothing.
+        tm.update_normal_token(token_at(0.1), a);
+        BOOST_REQUIRE(&copy.sorted_tokens() == &tm.sorted_tokens());
+
+        clone.remove_endpoint(b);
+        BOOST_REQUIRE_EQUAL(clone.sorted_tokens().size(), 1);
+        BOOST_REQUIRE_EQUAL(tm.sorted_tokens().size(), 2);
+        BOOST_REQUIRE_EQUAL(copy.sorted_tokens().size(), 2);
+
+        tm.update_normal_token(token_at(0.3), b);
+        BOOST_REQUIRE(*tm.get_endpoint(token_at(0.3)) == b);
+        BOOST_REQUIRE(!copy.get_endpoint(token_at(0.3)));
+        BOOST_REQUIRE(*copy.get_endpoint(token_at(0.2)) == b);
+
+        return i_endpoint_snitch::stop_snitch();
+    });
+}
@@ -101,3 +101,19 @@ BOOST_AUTO_TEST_CASE(test_ring_position_is_comparable_with_decorated_key) {
     BOOST_REQUIRE(k2.tri_compare(*s, dht::ring_position::ending_at(k1._token)) > 0);
     BOOST_REQUIRE(k2.tri_compare(*s, dht::ring_position(k1)) > 0);
 }
+
+BOOST_AUTO_TEST_CASE(test_token_prefix_preserves_order) {
+    std::vector<dht::token> tokens = {
+        dht::minimum_token(),
+        token_from_long(0x8000'0000'0000'0000),
+        token_from_long(0xffff'ffff'ffff'fffe),
+        token_from_long(0),
+        token_from_long(1),
+        token_from_long(0x7fff'ffff'ffff'ffff),
+        dht::maximum_token(),
+    };
+    std::sort(tokens.begin(), tokens.end());
+    for (unsigned i = 1; i < tokens.size(); ++i) {
+        BOOST_REQUIRE_LT(dht::token_prefix(tokens[i - 1]), dht::token_prefix(tokens[i]));
+    }
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test-utils.hh"
+#include "tests/cql_test_env.hh"
+#include "tests/cql_assertions.hh"
+
+#include "core/thread.hh"
+#include "service/paxos/paxos_state.hh"
+#include "partition_slice_builder.hh"
+#include "utils/UUID_gen.hh"
+
+using namespace service::paxos;
+
+using responses = std::vector<std::pair<gms::inet_address, prepare_response>>;
+
+// The replicas of the coordinator, all of which are the local node here, so
+// that their answers are told apart by the address only.
+static const gms::inet_address replica1("127.0.0.1");
+static const gms::inet_address replica2("127.0.0.2");
+
+static utils::UUID make_ballot(api::timestamp_type micros) {
+    return utils::UUID_gen::get_time_UUID_from_micros(micros);
+}
+
+// The paxos state of a partition of ks.cf, driven on the shard owning it.
+class partition_paxos {
+    cql_test_env& _e;
+    schema_ptr _s;
+    partition_key _key;
+    dht::decorated_key _dk;
+    lw_shared_ptr<query::read_command> _cmd;
+    query::partition_range _pr;
+    unsigned _shard;
+public:
+    partition_paxos(cql_test_env& e, int32_t p)
+        : _e(e)
+        , _s(e.local_db().find_schema("ks", "cf"))
+        , _key(partition_key::from_single_value(*_s, int32_type->decompose(p)))
+        , _dk(dht::global_partitioner().decorate_key(*_s, _key))
+        , _cmd(make_lw_shared<query::read_command>(_s->id(), partition_slice_builder(*_s).build()))
+        , _pr(query::partition_range::make_singular(_dk))
+        , _shard(e.local_db().shard_of(_dk.token()))
+    { }
+
+    proposal make_proposal(utils::UUID ballot, int32_t v) const {
+        mutation m(_key, _s);
+        m.set_clustered_cell(clustering_key::make_empty(*_s), "v", v, utils::UUID_gen::micros_timestamp(ballot));
+        return proposal(ballot, freeze(m));
+    }
+
+    prepare_response prepare(utils::UUID ballot) {
+        return _e.db().invoke_on(_shard, [cmd = _cmd, &pr = _pr, ballot] (database& db) {
+            return paxos_state::prepare(db, *cmd, pr, ballot).then([] (prepare_response r) {
+                return make_foreign(std::make_unique<prepare_response>(std::move(r)));
+            });
+        }).then([] (foreign_ptr<std::unique_ptr<prepare_response>> r) {
+            return prepare_response(*r);
+        }).get0();
+    }
+
+    bool accept(const proposal& p) {
+        return _e.db().invoke_on(_shard, [&p] (database& db) {
+            return paxos_state::accept(db, p);
+        }).get0();
+    }
+
+    void learn(const proposal& p) {
+        _e.db().invoke_on(_shard, [&p] (database& db) {
+            return paxos_state::learn(db, p);
+        }).get();
+    }
+};
+
+static future<> with_paxos_env(std::function<void (cql_test_env&)> func) {
+    return do_with_cql_env([func = std::move(func)] (cql_test_env& e) {
+        return seastar::async([&e, func = std::move(func)] {
+            e.execute_cql("create table cf (p int primary key, v int);").get();
+            func(e);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_prepare_refused_for_later_ballot) {
+    return with_paxos_env([] (cql_test_env& e) {
+        partition_paxos px(e, 1);
+        auto b1 = make_ballot(1000);
+        auto b2 = make_ballot(2000);
+
+        auto r2 = px.prepare(b2);
+        BOOST_REQUIRE(r2.promised);
+        BOOST_REQUIRE(r2.data);
+
+        auto r1 = px.prepare(b1);
+        BOOST_REQUIRE(!r1.promised);
+        BOOST_REQUIRE(r1.promised_ballot == b2);
+        BOOST_REQUIRE(!r1.data);
+        // A proposal of the refused ballot is not accepted either.
+        BOOST_REQUIRE(!px.accept(px.make_proposal(b1, 10)));
+        BOOST_REQUIRE(px.accept(px.make_proposal(b2, 20)));
+
+        // A single refusal is enough for the coordinator to retry, with a
+        // ballot after the one promised.
+        prepare_summary summary(responses{{replica1, r2}, {replica2, r1}});
+        BOOST_REQUIRE(summary.refused_for);
+        BOOST_REQUIRE(*summary.refused_for == b2);
+        BOOST_REQUIRE(!summary.in_progress);
+        BOOST_REQUIRE(!summary.data);
+    });
+}
+
+SEASTAR_TEST_CASE(test_in_progress_proposal_is_reproposed) {
+    return with_paxos_env([] (cql_test_env& e) {
+        partition_paxos px(e, 1);
+        auto b1 = make_ballot(1000);
+        auto b2 = make_ballot(2000);
+        auto b3 = make_ballot(3000);
+
+        // The coordinator of b1 goes away after its proposal is accepted.
+        auto p1 = px.make_proposal(b1, 10);
+        BOOST_REQUIRE(px.prepare(b1).promised);
+        BOOST_REQUIRE(px.accept(p1));
+        assert_that(e.execute_cql("select * from cf;").get0()).is_rows().is_empty();
+
+        // The next one finds it, and has to finish its round first.
+        auto r2 = px.prepare(b2);
+        BOOST_REQUIRE(r2.promised);
+        BOOST_REQUIRE(r2.accepted);
+        BOOST_REQUIRE(r2.accepted->ballot == b1);
+        BOOST_REQUIRE(!r2.most_recent_commit);
+        prepare_summary summary(responses{{replica1, r2}, {replica2, r2}});
+        BOOST_REQUIRE(!summary.refused_for);
+        BOOST_REQUIRE(summary.in_progress);
+        BOOST_REQUIRE(summary.in_progress->ballot == b1);
+
+        // Proposed again under the new ballot, and then committed.
+        auto refreshed = proposal(b2, summary.in_progress->update);
+        BOOST_REQUIRE(px.accept(refreshed));
+        px.learn(refreshed);
+        assert_that(e.execute_cql("select v from cf where p = 1;").get0())
+            .is_rows().with_rows({{int32_type->decompose(10)}});
+
+        // Once committed, it is not in progress any more.
+        auto r3 = px.prepare(b3);
+        BOOST_REQUIRE(r3.promised);
+        BOOST_REQUIRE(!r3.accepted);
+        BOOST_REQUIRE(r3.most_recent_commit);
+        BOOST_REQUIRE(r3.most_recent_commit->ballot == b2);
+        prepare_summary after(responses{{replica1, r3}, {replica2, r3}});
+        BOOST_REQUIRE(!after.in_progress);
+        BOOST_REQUIRE(after.most_recent_commit);
+        BOOST_REQUIRE(after.missing_commit.empty());
+    });
+}
+
+SEASTAR_TEST_CASE(test_replica_missing_commit_is_repaired) {
+    return with_paxos_env([] (cql_test_env& e) {
+        partition_paxos px(e, 1);
+        auto b1 = make_ballot(1000);
+        auto b2 = make_ballot(2000);
+        auto b3 = make_ballot(3000);
+
+        // The answer of a replica which missed the commit of b1.
+        auto behind = px.prepare(b1);
+        auto p1 = px.make_proposal(b1, 10);
+        BOOST_REQUIRE(px.accept(p1));
+        px.learn(p1);
+        auto ahead = px.prepare(b2);
+        BOOST_REQUIRE(ahead.most_recent_commit);
+        BOOST_REQUIRE(!behind.most_recent_commit);
+
+        prepare_summary summary(responses{{replica1, ahead}, {replica2, behind}});
+        BOOST_REQUIRE(!summary.in_progress);
+        BOOST_REQUIRE(summary.most_recent_commit);
+        BOOST_REQUIRE(summary.most_recent_commit->ballot == b1);
+        BOOST_REQUIRE_EQUAL(summary.missing_commit.size(), 1);
+        BOOST_REQUIRE(summary.missing_commit[0] == replica2);
+        // What the replica behind read is stale, so it takes a read.
+        BOOST_REQUIRE(!summary.data);
+
+        // Repaired by committing the most recent commit to it again, which
+        // is harmless for a replica which has it.
+        px.learn(*summary.most_recent_commit);
+        auto repaired = px.prepare(b3);
+        BOOST_REQUIRE(repaired.most_recent_commit);
+        BOOST_REQUIRE(repaired.most_recent_commit->ballot == b1);
+        prepare_summary after(responses{{replica1, repaired}, {replica2, repaired}});
+        BOOST_REQUIRE(after.missing_commit.empty());
+        BOOST_REQUIRE(after.data);
+        assert_that(e.execute_cql("select v from cf where p = 1;").get0())
+            .is_rows().with_rows({{int32_type->decompose(10)}});
+    });
+}
+
+SEASTAR_TEST_CASE(test_read_falls_back_when_replicas_disagree) {
+    return with_paxos_env([] (cql_test_env& e) {
+        partition_paxos px(e, 1);
+        auto b1 = make_ballot(1000);
+        auto b2 = make_ballot(2000);
+
+        auto before = px.prepare(b1);
+        e.execute_cql("insert into cf (p, v) values (1, 10);").get();
+        auto after = px.prepare(b2);
+        BOOST_REQUIRE(before.data);
+        BOOST_REQUIRE(after.data);
+        BOOST_REQUIRE(*before.data != *after.data);
+
+        // Replicas which read alike spare the coordinator its read.
+        prepare_summary agree(responses{{replica1, after}, {replica2, after}});
+        BOOST_REQUIRE(agree.missing_commit.empty());
+        BOOST_REQUIRE(agree.data);
+        BOOST_REQUIRE(*agree.data == *after.data);
+
+        prepare_summary disagree(responses{{replica1, after}, {replica2, before}});
+        BOOST_REQUIRE(!disagree.refused_for);
+        BOOST_REQUIRE(disagree.missing_commit.empty());
+        BOOST_REQUIRE(!disagree.data);
+
+        // As does a replica with no data in its answer.
+        auto empty = after;
+        empty.data = {};
+        prepare_summary missing_data(responses{{replica1, after}, {replica2, empty}});
+        BOOST_REQUIRE(!missing_data.data);
+    });
+}
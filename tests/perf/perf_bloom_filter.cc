@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "utils/bloom_filter.hh"
+#include "utils/blocked_bloom_filter.hh"
+#include "tests/perf/perf.hh"
+
+#include <vector>
+
+using namespace utils;
+
+volatile uint64_t black_hole;
+
+static std::vector<bytes> make_keys(int n, int offset) {
+    std::vector<bytes> keys;
+    keys.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        auto s = sprint("key-%020d", offset + i);
+        keys.emplace_back(reinterpret_cast<const int8_t*>(s.data()), s.size());
+    }
+    return keys;
+}
+
+// Filters are sized well above the last level cache, so that lookups are
+// dominated by cache misses, as they are on a node with many sstables.
+int main(int argc, char* argv[]) {
+    const int nr_keys = 10 * 1000 * 1000;
+    const int nr_probes = 1 << 16;
+    auto present = make_keys(nr_keys, 0);
+    auto absent = make_keys(nr_probes, nr_keys);
+
+    for (auto format : { filter_format::murmur3, filter_format::blocked }) {
+        auto f = i_filter::get_filter(nr_keys, 0.01, format);
+        for (auto&& k : present) {
+            f->add(k);
+        }
+
+        int false_positives = 0;
+        for (auto&& k : absent) {
+            false_positives += f->is_present(k);
+        }
+        std::cout << sprint("%s: %d bytes, false positive rate %.4f\n", to_sstring(format),
+                f->memory_size(), double(false_positives) / nr_probes);
+
+        uint64_t sink = 0;
+        size_t i = 0;
+
+        std::cout << "Timing lookups of absent keys...\n";
+        time_it([&] {
+            sink += f->is_present(absent[i++ % nr_probes]);
+        });
+
+        std::cout << "Timing lookups of present keys...\n";
+        time_it([&] {
+            sink += f->is_present(present[(i++ * 7919) % nr_keys]);
+        });
+
+        black_hole = sink;
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <zlib.h>
+
+#include "utils/crc.hh"
+#include "tests/perf/perf.hh"
+
+volatile uint32_t black_hole;
+
+// Times the checksums of the write paths on buffers of the sizes they are
+// computed on: commitlog entries and chunks, and sstable chunks.
+int main(int argc, char* argv[]) {
+    uint32_t sink = 0;
+
+    for (size_t size : { 128, 4096, 65536 }) {
+        std::vector<uint8_t> buf(size);
+        for (size_t i = 0; i < size; ++i) {
+            buf[i] = i * 31;
+        }
+
+        std::cout << "Timing crc32 of " << size << " bytes...\n";
+
+        time_it([&] {
+            crc32 c;
+            c.process(buf.data(), buf.size());
+            sink += c.get();
+        }, 5, 100);
+
+        std::cout << "Timing adler32 of " << size << " bytes...\n";
+
+        time_it([&] {
+            sink += adler32(adler32(0, Z_NULL, 0), buf.data(), buf.size());
+        }, 5, 100);
+    }
+
+    black_hole = sink;
+}
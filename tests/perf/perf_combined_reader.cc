@@ -0,0 +1,94 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <core/app-template.hh>
+#include <core/thread.hh>
+
+#include "mutation_reader.hh"
+#include "schema_builder.hh"
+#include "tests/perf/perf.hh"
+
+// Measures how fast the combined reader merges readers of varying fan-in,
+// whether their partitions interleave, as those of overlapping sstables,
+// or come in runs, as those of sstables covering disjoint ranges.
+
+static std::vector<mutation> make_mutations(schema_ptr s, unsigned count) {
+    std::vector<mutation> ms;
+    for (unsigned i = 0; i < count; ++i) {
+        mutation m(partition_key::from_single_value(*s, to_bytes(sprint("key%d", i))), s);
+        m.set_clustered_cell(clustering_key::make_empty(*s), "v", bytes("v"), 1);
+        ms.push_back(std::move(m));
+    }
+    std::sort(ms.begin(), ms.end(), [] (const mutation& a, const mutation& b) {
+        return a.decorated_key().less_compare(*a.schema(), b.decorated_key());
+    });
+    return ms;
+}
+
+// Deals the partitions out to the readers round-robin when interleaved,
+// or in consecutive runs otherwise.
+static std::vector<std::vector<mutation>> distribute(const std::vector<mutation>& ms, unsigned fan_in, bool interleaved) {
+    std::vector<std::vector<mutation>> parts(fan_in);
+    auto per_reader = (ms.size() + fan_in - 1) / fan_in;
+    for (size_t i = 0; i < ms.size(); ++i) {
+        parts[interleaved ? i % fan_in : i / per_reader].push_back(ms[i]);
+    }
+    return parts;
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("partitions", bpo::value<unsigned>()->default_value(100000), "number of partitions read");
+
+    return app.run(argc, argv, [&app] {
+        return seastar::async([&] {
+            auto s = schema_builder("ks", "cf")
+                .with_column("pk", bytes_type, column_kind::partition_key)
+                .with_column("v", bytes_type, column_kind::regular_column)
+                .build();
+
+            auto ms = make_mutations(s, app.configuration()["partitions"].as<unsigned>());
+
+            for (bool interleaved : { true, false }) {
+                for (unsigned fan_in : { 1, 2, 4, 8, 16, 32, 64 }) {
+                    auto parts = distribute(ms, fan_in, interleaved);
+                    std::vector<mutation_reader> readers;
+                    for (auto&& p : parts) {
+                        readers.push_back(make_reader_returning_many(std::move(p)));
+                    }
+                    auto reader = make_combined_reader(std::move(readers));
+
+                    using clk = std::chrono::high_resolution_clock;
+                    auto start = clk::now();
+                    uint64_t count = 0;
+                    while (reader().get0()) {
+                        ++count;
+                    }
+                    auto duration = std::chrono::duration<double>(clk::now() - start).count();
+                    std::cout << sprint("%s, fan-in %d: %.2f partitions/s\n",
+                            interleaved ? "interleaved" : "runs", fan_in, count / duration);
+                }
+            }
+        });
+    });
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/range/irange.hpp>
+
+#include "core/app-template.hh"
+#include "core/distributed.hh"
+#include "core/future-util.hh"
+#include "core/thread.hh"
+#include "db/commitlog/commitlog.hh"
+#include "utils/UUID_gen.hh"
+#include "utils/histogram.hh"
+#include "tests/tmpdir.hh"
+
+// Measures the commitlog in each sync mode, writing from all shards.
+//
+// Each shard keeps a number of writes of a given size in flight to its own
+// commitlog, as the database does, for a while. Segments are discarded as
+// soon as the commitlog asks for them to be flushed, as if memtables were
+// flushed instantly.
+//
+// The latency of a write is from add_mutation() to its future resolving: in
+// BATCH mode, that's until the write is on disk; in PERIODIC mode, until it
+// is in a segment buffer, on disk by the next sync period at the latest.
+
+using clk = std::chrono::steady_clock;
+
+struct bench_config {
+    db::commitlog::config log;
+    size_t mutation_size;
+    unsigned concurrency;
+    clk::duration duration;
+};
+
+struct run_result {
+    uint64_t writes = 0;
+    uint64_t flushes = 0;
+    uint64_t bytes_written = 0;
+    // BATCH mode: writes acknowledged by flushes, and the flushes.
+    uint64_t batched_writes = 0;
+    uint64_t batches = 0;
+    utils::decaying_histogram latencies{std::chrono::hours(24)};
+
+    run_result& operator+=(const run_result& o) {
+        writes += o.writes;
+        flushes += o.flushes;
+        bytes_written += o.bytes_written;
+        batched_writes += o.batched_writes;
+        batches += o.batches;
+        latencies.merge(o.latencies);
+        return *this;
+    }
+};
+
+class log_writer {
+    bench_config _cfg;
+    std::unique_ptr<db::commitlog> _log;
+    db::cf_id_type _id = utils::UUID_gen::get_time_UUID();
+    sstring _payload;
+public:
+    log_writer(bench_config cfg)
+        : _cfg(std::move(cfg))
+        , _payload(_cfg.mutation_size, 'x')
+    { }
+
+    future<> init() {
+        return db::commitlog::create_commitlog(_cfg.log).then([this] (db::commitlog&& log) {
+            _log = std::make_unique<db::commitlog>(std::move(log));
+            _log->add_flush_handler([this] (db::cf_id_type id, db::replay_position pos) {
+                _log->discard_completed_segments(id, pos);
+            }).release();
+        });
+    }
+
+    future<run_result> run() {
+        auto res = make_lw_shared<run_result>();
+        auto flushes = _log->get_flush_count();
+        auto bytes_written = _log->get_bytes_written();
+        auto& batch_sizes = _log->get_batch_size_histogram();
+        auto batched_writes = batch_sizes.sum;
+        auto batches = batch_sizes.count;
+        auto end = clk::now() + _cfg.duration;
+        return parallel_for_each(boost::irange(0u, _cfg.concurrency), [this, res, end] (unsigned) {
+            return do_until([end] { return clk::now() >= end; }, [this, res] {
+                auto start = clk::now();
+                return _log->add_mutation(_id, _payload.size(), [this] (db::commitlog::output& out) {
+                    out.write(_payload.begin(), _payload.end());
+                }).then([res, start] (db::replay_position) {
+                    res->latencies.mark(std::chrono::duration_cast<std::chrono::microseconds>(clk::now() - start).count());
+                    ++res->writes;
+                });
+            });
+        }).then([this, res, flushes, bytes_written, batched_writes, batches] {
+            auto& batch_sizes = _log->get_batch_size_histogram();
+            res->flushes = _log->get_flush_count() - flushes;
+            res->bytes_written = _log->get_bytes_written() - bytes_written;
+            res->batched_writes = batch_sizes.sum - batched_writes;
+            res->batches = batch_sizes.count - batches;
+            return std::move(*res);
+        });
+    }
+
+    future<> stop() {
+        if (!_log) {
+            return make_ready_future<>();
+        }
+        return _log->shutdown();
+    }
+};
+
+static void run_benchmark(bench_config cfg) {
+    auto writers = ::make_shared<distributed<log_writer>>();
+    writers->start(cfg).get();
+    try {
+        writers->invoke_on_all(&log_writer::init).get();
+        auto start = clk::now();
+        auto res = writers->map_reduce0([] (log_writer& w) {
+            return w.run();
+        }, run_result(), [] (run_result a, const run_result& b) {
+            a += b;
+            return a;
+        }).get0();
+        auto seconds = std::chrono::duration<double>(clk::now() - start).count();
+        auto mb = [] (uint64_t bytes) { return bytes / double(1 << 20); };
+        std::cout << sprint("  %.0f writes/s, %.1f MB/s of mutations, %.1f MB/s written to segments\n",
+                res.writes / seconds, mb(res.writes * cfg.mutation_size) / seconds, mb(res.bytes_written) / seconds);
+        std::cout << sprint("  %d flushes, %.0f/s, %.1f writes per flush\n",
+                res.flushes, res.flushes / seconds, res.flushes ? double(res.writes) / res.flushes : 0.0);
+        if (cfg.log.mode == db::commitlog::sync_mode::BATCH) {
+            std::cout << sprint("  %d batches of %.1f writes on average\n",
+                    res.batches, res.batches ? double(res.batched_writes) / res.batches : 0.0);
+        }
+        auto& h = res.latencies;
+        std::cout << sprint("  latency us: p50 %d, p90 %d, p99 %d, p999 %d, max %d\n",
+                h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.percentile(0.999), h.percentile(1));
+    } catch (...) {
+        writers->stop().get();
+        throw;
+    }
+    writers->stop().get();
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("mode", bpo::value<std::string>()->default_value("both"), "sync mode: periodic, batch or both")
+        ("mutation-size", bpo::value<size_t>()->default_value(512), "bytes per write")
+        ("concurrency", bpo::value<unsigned>()->default_value(100), "writes in flight per shard")
+        ("duration", bpo::value<unsigned>()->default_value(10), "seconds to run each mode for")
+        ("segment-size-in-mb", bpo::value<uint64_t>()->default_value(32), "commitlog segment size")
+        ("total-space-in-mb", bpo::value<uint64_t>()->default_value(1024),
+                "commitlog space, per shard, beyond which segments are discarded")
+        ("sync-period-in-ms", bpo::value<uint64_t>()->default_value(10000), "PERIODIC mode sync period")
+        ("batch-window-in-ms", bpo::value<uint64_t>()->default_value(2), "BATCH mode batch window")
+        ("batch-max-size-in-kb", bpo::value<uint64_t>()->default_value(1024), "BATCH mode batch size cap")
+        ("compression", "compress commitlog segments");
+
+    return app.run(argc, argv, [&app] {
+        return seastar::async([&app] {
+            auto&& config = app.configuration();
+            bench_config cfg;
+            cfg.log.commitlog_segment_size_in_mb = config["segment-size-in-mb"].as<uint64_t>();
+            cfg.log.commitlog_total_space_in_mb = config["total-space-in-mb"].as<uint64_t>();
+            cfg.log.commitlog_sync_period_in_ms = config["sync-period-in-ms"].as<uint64_t>();
+            cfg.log.commitlog_sync_batch_window_in_ms = config["batch-window-in-ms"].as<uint64_t>();
+            cfg.log.commitlog_sync_batch_max_size_in_kb = config["batch-max-size-in-kb"].as<uint64_t>();
+            cfg.log.compression = config.count("compression");
+            cfg.log.register_metrics = false;
+            cfg.mutation_size = config["mutation-size"].as<size_t>();
+            cfg.concurrency = config["concurrency"].as<unsigned>();
+            cfg.duration = std::chrono::seconds(config["duration"].as<unsigned>());
+
+            auto mode = config["mode"].as<std::string>();
+            std::vector<db::commitlog::sync_mode> modes;
+            if (mode == "periodic" || mode == "both") {
+                modes.push_back(db::commitlog::sync_mode::PERIODIC);
+            }
+            if (mode == "batch" || mode == "both") {
+                modes.push_back(db::commitlog::sync_mode::BATCH);
+            }
+            if (modes.empty()) {
+                throw std::invalid_argument(sprint("unknown mode %s", mode));
+            }
+            std::cout << sprint("%d shards, %d writes of %d bytes in flight per shard\n",
+                    smp::count, cfg.concurrency, cfg.mutation_size);
+            for (auto m : modes) {
+                std::cout << (m == db::commitlog::sync_mode::BATCH ? "BATCH" : "PERIODIC") << ":\n";
+                tmpdir dir;
+                cfg.log.commit_log_location = dir.path;
+                cfg.log.mode = m;
+                run_benchmark(cfg);
+            }
+        });
+    });
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <random>
+#include <sys/resource.h>
+#include <boost/range/adaptor/map.hpp>
+
+#include <core/app-template.hh>
+#include <core/thread.hh>
+#include <core/timer.hh>
+
+#include "database.hh"
+#include "schema_builder.hh"
+#include "utils/compaction_manager.hh"
+#include "tests/tmpdir.hh"
+
+// Measures flushes and compactions end to end, through a column family.
+//
+// Memtables are flushed into --sstables sstables, whose partitions overlap
+// as much as --overlap says, and whose rows are partly tombstones and cells
+// with a TTL. The compaction strategy is then run until it finds nothing
+// more to compact, as the compaction manager would, and how much was read
+// and written, how fast, and at what cost in CPU and memory, is printed.
+//
+// It runs on one shard; run it with -c1. The sstables are written into a
+// temporary directory under the current one.
+
+using clk = std::chrono::steady_clock;
+
+struct bench_config {
+    unsigned sstables;
+    unsigned partitions;
+    unsigned rows;
+    unsigned value_size;
+    // The fraction of each sstable's partitions which are also in the others.
+    double overlap;
+    // The fraction of rows written which are deleted rather than written.
+    double tombstone_ratio;
+    // The fraction of cells written with a TTL, and the TTL.
+    double ttl_ratio;
+    gc_clock::duration ttl;
+    std::map<sstring, sstring> strategy_options;
+};
+
+// CPU time this thread used, user and system.
+static std::chrono::microseconds cpu_time() {
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    auto tv = [] (const timeval& t) {
+        return std::chrono::seconds(t.tv_sec) + std::chrono::microseconds(t.tv_usec);
+    };
+    return tv(ru.ru_utime) + tv(ru.ru_stime);
+}
+
+static uint64_t memory_used() {
+    auto stats = memory::stats();
+    return stats.total_memory() - stats.free_memory();
+}
+
+// Tracks the peak of the memory used, sampled while it is running.
+class memory_peak {
+    uint64_t _peak = memory_used();
+    timer<> _sampler;
+public:
+    memory_peak() : _sampler([this] { _peak = std::max(_peak, memory_used()); }) {
+        _sampler.arm_periodic(std::chrono::milliseconds(1));
+    }
+    uint64_t peak() const {
+        return std::max(_peak, memory_used());
+    }
+};
+
+static uint64_t data_size(const sstable_list& sstables) {
+    uint64_t size = 0;
+    for (auto&& sst : sstables | boost::adaptors::map_values) {
+        size += sst->data_size();
+    }
+    return size;
+}
+
+static double mb(uint64_t bytes) {
+    return bytes / double(1 << 20);
+}
+
+static void populate(column_family& cf, schema_ptr s, const bench_config& cfg) {
+    std::default_random_engine random;
+    std::uniform_real_distribution<double> fraction;
+    auto& v = *s->get_column_definition("v");
+    bytes value(bytes::initialized_later(), cfg.value_size);
+    std::fill(value.begin(), value.end(), 'v');
+
+    uint64_t bytes_flushed = 0;
+    auto flush_time = clk::duration::zero();
+    for (unsigned i = 0; i < cfg.sstables; ++i) {
+        api::timestamp_type ts = i + 1;
+        for (unsigned p = 0; p < cfg.partitions; ++p) {
+            // Overlapping partitions are those all sstables have; the
+            // others are the sstable's own.
+            uint64_t n = fraction(random) < cfg.overlap ? p : uint64_t(i + 1) * cfg.partitions + p;
+            mutation m(partition_key::from_single_value(*s, to_bytes(sprint("key%d", n))), s);
+            for (unsigned r = 0; r < cfg.rows; ++r) {
+                auto ck = clustering_key::from_single_value(*s, int32_type->decompose(int32_t(r)));
+                if (fraction(random) < cfg.tombstone_ratio) {
+                    m.partition().apply_delete(*s, std::move(ck), tombstone(ts, gc_clock::now()));
+                } else if (fraction(random) < cfg.ttl_ratio) {
+                    m.set_clustered_cell(ck, v, atomic_cell::make_live(ts, value, gc_clock::now() + cfg.ttl, cfg.ttl));
+                } else {
+                    m.set_clustered_cell(ck, v, atomic_cell::make_live(ts, value));
+                }
+            }
+            cf.apply(std::move(m));
+        }
+        auto before = data_size(*cf.get_sstables());
+        auto start = clk::now();
+        cf.flush().get();
+        flush_time += clk::now() - start;
+        bytes_flushed += data_size(*cf.get_sstables()) - before;
+    }
+    auto seconds = std::chrono::duration<double>(flush_time).count();
+    std::cout << sprint("  flush: %d sstables, %.1f MB in %.2f s, %.1f MB/s\n",
+            cfg.sstables, mb(bytes_flushed), seconds, mb(bytes_flushed) / seconds);
+}
+
+static void run_compactions(column_family& cf) {
+    auto initial = *cf.get_sstables();
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    unsigned rounds = 0;
+    memory_peak memory;
+    auto memory_before = memory_used();
+    auto cpu_start = cpu_time();
+    auto start = clk::now();
+    for (;;) {
+        auto before = *cf.get_sstables();
+        cf.run_compaction().get();
+        auto after = *cf.get_sstables();
+        bool changed = false;
+        for (auto&& e : before) {
+            if (!after.count(e.first)) {
+                bytes_read += e.second->data_size();
+                changed = true;
+            }
+        }
+        for (auto&& e : after) {
+            if (!before.count(e.first)) {
+                bytes_written += e.second->data_size();
+                changed = true;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+        ++rounds;
+    }
+    auto seconds = std::chrono::duration<double>(clk::now() - start).count();
+    auto cpu = std::chrono::duration<double>(cpu_time() - cpu_start).count();
+    auto input = data_size(initial);
+    auto output = data_size(*cf.get_sstables());
+    std::cout << sprint("  compaction: %d rounds, %d sstables of %.1f MB into %d of %.1f MB in %.2f s\n",
+            rounds, initial.size(), mb(input), cf.get_sstables()->size(), mb(output), seconds);
+    std::cout << sprint("    read %.1f MB/s, written %.1f MB/s, write amplification %.2f\n",
+            mb(bytes_read) / seconds, mb(bytes_written) / seconds, input ? double(bytes_written) / input : 0.0);
+    std::cout << sprint("    cpu %.2f s, %.1f ns per byte read, peak memory %.1f MB over %.1f MB\n",
+            cpu, bytes_read ? cpu * 1e9 / bytes_read : 0.0, mb(memory.peak() - memory_before), mb(memory_before));
+}
+
+static void run_benchmark(sstables::compaction_strategy_type strategy, const bench_config& cfg) {
+    std::cout << sstables::compaction_strategy::name(strategy) << ":\n";
+    schema_builder builder("ks", "cf");
+    builder.with_column("pk", utf8_type, column_kind::partition_key)
+        .with_column("ck", int32_type, column_kind::clustering_key)
+        .with_column("v", bytes_type);
+    // For tombstones and expired cells to be purged.
+    builder.set_gc_grace_seconds(0);
+    builder.set_compaction_strategy(strategy);
+    builder.set_compaction_strategy_options(cfg.strategy_options);
+    auto s = builder.build();
+
+    tmpdir dir;
+    column_family::config cf_cfg;
+    cf_cfg.datadir = dir.path;
+    cf_cfg.enable_disk_reads = true;
+    cf_cfg.enable_disk_writes = true;
+    cf_cfg.enable_cache = false;
+    cf_cfg.enable_commitlog = false;
+    cf_cfg.enable_incremental_backups = false;
+    // One sstable per flush, as many as asked for.
+    cf_cfg.max_memtable_size = std::numeric_limits<size_t>::max();
+    // Not started, so that compactions are only run by the benchmark.
+    compaction_manager cm;
+    column_family cf(s, cf_cfg, column_family::no_commitlog(), cm);
+    cf.start_compaction();
+
+    populate(cf, s, cfg);
+    run_compactions(cf);
+    cf.stop().get();
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("strategy", bpo::value<std::vector<std::string>>()->composing(),
+                "compaction strategy to run, SizeTieredCompactionStrategy and LeveledCompactionStrategy if none given")
+        ("strategy-option", bpo::value<std::vector<std::string>>()->composing(),
+                "compaction strategy option, as name=value, e.g. sstable_size_in_mb=16")
+        ("sstables", bpo::value<unsigned>()->default_value(16), "number of sstables flushed")
+        ("partitions", bpo::value<unsigned>()->default_value(10000), "partitions per sstable")
+        ("rows", bpo::value<unsigned>()->default_value(10), "rows per partition")
+        ("value-size", bpo::value<unsigned>()->default_value(100), "bytes per value")
+        ("overlap", bpo::value<double>()->default_value(0.5), "fraction of partitions which all sstables have")
+        ("tombstone-ratio", bpo::value<double>()->default_value(0.1), "fraction of rows deleted")
+        ("ttl-ratio", bpo::value<double>()->default_value(0), "fraction of cells written with a TTL")
+        ("ttl", bpo::value<unsigned>()->default_value(1), "TTL of those cells, in seconds");
+
+    return app.run(argc, argv, [&app] {
+        return seastar::async([&app] {
+            auto&& config = app.configuration();
+            bench_config cfg;
+            cfg.sstables = config["sstables"].as<unsigned>();
+            cfg.partitions = config["partitions"].as<unsigned>();
+            cfg.rows = config["rows"].as<unsigned>();
+            cfg.value_size = config["value-size"].as<unsigned>();
+            cfg.overlap = config["overlap"].as<double>();
+            cfg.tombstone_ratio = config["tombstone-ratio"].as<double>();
+            cfg.ttl_ratio = config["ttl-ratio"].as<double>();
+            cfg.ttl = std::chrono::seconds(config["ttl"].as<unsigned>());
+            if (config.count("strategy-option")) {
+                for (auto&& o : config["strategy-option"].as<std::vector<std::string>>()) {
+                    auto eq = o.find('=');
+                    if (eq == std::string::npos) {
+                        throw std::invalid_argument(sprint("strategy option %s isn't name=value", o));
+                    }
+                    cfg.strategy_options.emplace(o.substr(0, eq), o.substr(eq + 1));
+                }
+            }
+            std::vector<std::string> strategies = { "SizeTieredCompactionStrategy", "LeveledCompactionStrategy" };
+            if (config.count("strategy")) {
+                strategies = config["strategy"].as<std::vector<std::string>>();
+            }
+            std::cout << sprint("%d sstables of %d partitions of %d rows of %d bytes, overlap %.2f, "
+                    "tombstone ratio %.2f, TTL ratio %.2f\n", cfg.sstables, cfg.partitions, cfg.rows,
+                    cfg.value_size, cfg.overlap, cfg.tombstone_ratio, cfg.ttl_ratio);
+            for (auto&& name : strategies) {
+                run_benchmark(sstables::compaction_strategy::type(sstring(name.c_str())), cfg);
+            }
+        });
+    });
+}
@@ -0,0 +1,630 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <random>
+#include <unordered_map>
+#include <boost/range/irange.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "core/app-template.hh"
+#include "core/distributed.hh"
+#include "core/reactor.hh"
+#include "core/semaphore.hh"
+#include "gms/inet_address.hh"
+#include "service/storage_proxy.hh"
+#include "transport/server.hh"
+#include "utils/histogram.hh"
+#include "tests/cql_test_env.hh"
+
+// Load generator driving a CQL server through the binary protocol, over
+// loopback, so that what it measures includes the protocol and the
+// connection handling which perf_simple_query bypasses.
+//
+// By default it starts a node in-process and its CQL server, which then
+// shares the cores with the clients. Given --host, it loads that node
+// instead, e.g. one set up like a production node.
+//
+// Each core runs a client with one connection, on which --concurrency
+// requests are in flight at a time. Several concurrencies may be given, to
+// sweep through them. After each run, the throughput and the latency
+// percentiles of reads and writes are printed.
+
+using clk = std::chrono::steady_clock;
+
+// The data models loaded.
+enum class profile {
+    // One value per partition.
+    key_value,
+    // Partitions of --rows rows, of which reads take a slice of --slice rows.
+    wide,
+    // One map per partition, which each write adds an entry to.
+    collection,
+};
+
+std::istream& operator>>(std::istream& is, profile& p) {
+    std::string s;
+    is >> s;
+    if (s == "key_value") {
+        p = profile::key_value;
+    } else if (s == "wide") {
+        p = profile::wide;
+    } else if (s == "collection") {
+        p = profile::collection;
+    } else {
+        is.setstate(std::ios::failbit);
+    }
+    return is;
+}
+
+std::ostream& operator<<(std::ostream& os, const profile& p) {
+    switch (p) {
+        case profile::key_value: return os << "key_value";
+        case profile::wide: return os << "wide";
+        case profile::collection: return os << "collection";
+    }
+    assert(0);
+}
+
+struct load_config {
+    profile prof;
+    sstring keyspace;
+    unsigned partitions;
+    unsigned rows;
+    unsigned slice;
+    unsigned value_size;
+    // The fraction of requests which are reads.
+    double read_ratio;
+    bool prepared;
+    ipv4_addr server;
+    // Connect to the shard-aware port of the same shard, if not 0.
+    uint16_t shard_aware_port;
+};
+
+// Encoding of the values of the protocol, in network byte order.
+static void put_short(std::string& out, uint16_t v) {
+    out.push_back(char(v >> 8));
+    out.push_back(char(v));
+}
+
+static void put_int(std::string& out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(char(v >> shift));
+    }
+}
+
+static void put_string(std::string& out, const sstring& s) {
+    put_short(out, s.size());
+    out.append(s.begin(), s.end());
+}
+
+static void put_long_string(std::string& out, const sstring& s) {
+    put_int(out, s.size());
+    out.append(s.begin(), s.end());
+}
+
+static void put_bytes(std::string& out, const std::string& b) {
+    put_int(out, b.size());
+    out.append(b);
+}
+
+static uint16_t get_short(const char* p) {
+    return (uint16_t(uint8_t(p[0])) << 8) | uint8_t(p[1]);
+}
+
+static uint32_t get_int(const char* p) {
+    return (uint32_t(get_short(p)) << 16) | get_short(p + 2);
+}
+
+static std::string int_value(uint32_t v) {
+    std::string res;
+    put_int(res, v);
+    return res;
+}
+
+static std::string key_value(uint64_t v) {
+    std::string res = int_value(v >> 32);
+    res += int_value(v);
+    return res;
+}
+
+// A connection speaking just enough of version 3 of the CQL binary protocol
+// to run statements and prepare and execute them. Requests in flight are
+// told apart by their stream id.
+class cql_connection {
+public:
+    struct response {
+        uint8_t opcode;
+        temporary_buffer<char> body;
+    };
+    static constexpr uint8_t version = 3;
+    static constexpr uint8_t opcode_error = 0x00;
+    static constexpr uint8_t opcode_startup = 0x01;
+    static constexpr uint8_t opcode_ready = 0x02;
+    static constexpr uint8_t opcode_query = 0x07;
+    static constexpr uint8_t opcode_prepare = 0x09;
+    static constexpr uint8_t opcode_execute = 0x0a;
+    static constexpr uint16_t consistency_one = 0x0001;
+    static constexpr size_t max_streams = 32768;
+private:
+    connected_socket _socket;
+    input_stream<char> _in;
+    output_stream<char> _out;
+    semaphore _write_sem{1};
+    std::vector<int16_t> _free_streams;
+    std::unordered_map<int16_t, promise<response>> _pending;
+    future<> _reader = make_ready_future<>();
+private:
+    void fail_pending(std::exception_ptr ex) {
+        for (auto&& p : _pending) {
+            p.second.set_exception(ex);
+        }
+        _pending.clear();
+    }
+
+    future<> read_responses() {
+        return repeat([this] {
+            return _in.read_exactly(9).then([this] (temporary_buffer<char> header) {
+                if (header.size() < 9) {
+                    fail_pending(std::make_exception_ptr(std::runtime_error("connection closed")));
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                auto stream = int16_t(get_short(header.get() + 2));
+                auto opcode = uint8_t(header[4]);
+                auto length = get_int(header.get() + 5);
+                return _in.read_exactly(length).then([this, stream, opcode] (temporary_buffer<char> body) {
+                    auto i = _pending.find(stream);
+                    if (i != _pending.end()) {
+                        i->second.set_value(response{opcode, std::move(body)});
+                        _pending.erase(i);
+                        _free_streams.push_back(stream);
+                    }
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }
+
+    static void check(const response& r) {
+        if (r.opcode == opcode_error) {
+            auto code = get_int(r.body.get());
+            auto length = get_short(r.body.get() + 4);
+            throw std::runtime_error(sprint("error 0x%x: %s", code, sstring(r.body.get() + 6, length)));
+        }
+    }
+
+    static void put_values(std::string& out, const std::vector<std::string>& values) {
+        put_short(out, consistency_one);
+        if (values.empty()) {
+            out.push_back(0);
+            return;
+        }
+        out.push_back(0x01); // values follow
+        put_short(out, values.size());
+        for (auto&& v : values) {
+            put_bytes(out, v);
+        }
+    }
+public:
+    cql_connection(connected_socket socket)
+        : _socket(std::move(socket))
+        , _in(_socket.input())
+        , _out(_socket.output())
+    {
+        for (size_t i = 0; i < max_streams; ++i) {
+            _free_streams.push_back(max_streams - 1 - i);
+        }
+        _reader = read_responses();
+    }
+
+    static future<std::unique_ptr<cql_connection>> connect(ipv4_addr addr) {
+        return engine().net().connect(make_ipv4_address(addr)).then([] (connected_socket socket) {
+            auto c = std::make_unique<cql_connection>(std::move(socket));
+            std::string body;
+            put_short(body, 1);
+            put_string(body, "CQL_VERSION");
+            put_string(body, "3.0.0");
+            auto f = c->request(opcode_startup, std::move(body));
+            return f.then([c = std::move(c)] (response r) mutable {
+                check(r);
+                if (r.opcode != opcode_ready) {
+                    throw std::runtime_error(sprint("unexpected response 0x%x to STARTUP", r.opcode));
+                }
+                return std::move(c);
+            });
+        });
+    }
+
+    future<response> request(uint8_t opcode, std::string body) {
+        if (_free_streams.empty()) {
+            return make_exception_future<response>(std::runtime_error("too many requests in flight"));
+        }
+        auto stream = _free_streams.back();
+        _free_streams.pop_back();
+        auto f = _pending[stream].get_future();
+        std::string frame;
+        frame.push_back(char(version));
+        frame.push_back(0); // flags
+        put_short(frame, stream);
+        frame.push_back(char(opcode));
+        put_int(frame, body.size());
+        frame += body;
+        return with_semaphore(_write_sem, 1, [this, frame = std::move(frame)] {
+            return _out.write(frame.data(), frame.size()).then([this] {
+                return _out.flush();
+            });
+        }).then([f = std::move(f)] () mutable {
+            return std::move(f);
+        });
+    }
+
+    future<> query(const sstring& text, const std::vector<std::string>& values = {}) {
+        std::string body;
+        put_long_string(body, text);
+        put_values(body, values);
+        return request(opcode_query, std::move(body)).then([] (response r) {
+            check(r);
+        });
+    }
+
+    // Returns the id of the prepared statement.
+    future<std::string> prepare(const sstring& text) {
+        std::string body;
+        put_long_string(body, text);
+        return request(opcode_prepare, std::move(body)).then([] (response r) {
+            check(r);
+            // A Prepared result: its kind, then the id as [short bytes].
+            auto length = get_short(r.body.get() + 4);
+            return std::string(r.body.get() + 6, length);
+        });
+    }
+
+    future<> execute(const std::string& id, const std::vector<std::string>& values) {
+        std::string body;
+        put_short(body, id.size());
+        body += id;
+        put_values(body, values);
+        return request(opcode_execute, std::move(body)).then([] (response r) {
+            check(r);
+        });
+    }
+
+    future<> close() {
+        return _out.close().then([this] {
+            _socket.shutdown_input();
+            return std::move(_reader);
+        });
+    }
+};
+
+struct run_result {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t errors = 0;
+    // In microseconds. Not to decay within a run.
+    utils::decaying_histogram read_latencies{std::chrono::hours(24)};
+    utils::decaying_histogram write_latencies{std::chrono::hours(24)};
+
+    run_result& operator+=(const run_result& o) {
+        reads += o.reads;
+        writes += o.writes;
+        errors += o.errors;
+        read_latencies.merge(o.read_latencies);
+        write_latencies.merge(o.write_latencies);
+        return *this;
+    }
+};
+
+// The client of a core.
+class load_client {
+    struct statement {
+        sstring text;
+        std::string id;
+    };
+    load_config _cfg;
+    std::unique_ptr<cql_connection> _conn;
+    statement _read;
+    statement _write;
+    std::default_random_engine _random;
+    std::string _value;
+private:
+    uint64_t random_partition() {
+        return std::uniform_int_distribution<uint64_t>(0, _cfg.partitions - 1)(_random);
+    }
+    unsigned random_row() {
+        return std::uniform_int_distribution<unsigned>(0, _cfg.rows - 1)(_random);
+    }
+
+    future<> send(const statement& st, std::vector<std::string> values) {
+        if (_cfg.prepared) {
+            return _conn->execute(st.id, values);
+        }
+        return _conn->query(st.text, values);
+    }
+
+    future<> write(uint64_t partition, unsigned row) {
+        switch (_cfg.prof) {
+        case profile::key_value:
+            return send(_write, { key_value(partition), _value });
+        case profile::wide:
+            return send(_write, { key_value(partition), int_value(row), _value });
+        case profile::collection: {
+            // A map of one entry: its size, then its key and value.
+            std::string entry = int_value(1);
+            put_bytes(entry, int_value(row));
+            put_bytes(entry, _value);
+            return send(_write, { std::move(entry), key_value(partition) });
+        }
+        }
+        assert(0);
+    }
+
+    future<> read(uint64_t partition) {
+        if (_cfg.prof == profile::wide) {
+            auto start = random_row();
+            return send(_read, { key_value(partition), int_value(start), int_value(start + _cfg.slice) });
+        }
+        return send(_read, { key_value(partition) });
+    }
+public:
+    load_client(load_config cfg)
+        : _cfg(std::move(cfg))
+        , _random(engine().cpu_id())
+        , _value(_cfg.value_size, 'x')
+    {
+        auto table = _cfg.keyspace + ".cf";
+        switch (_cfg.prof) {
+        case profile::key_value:
+            _read.text = sprint("SELECT v FROM %s WHERE pk = ?", table);
+            _write.text = sprint("INSERT INTO %s (pk, v) VALUES (?, ?)", table);
+            break;
+        case profile::wide:
+            _read.text = sprint("SELECT ck, v FROM %s WHERE pk = ? AND ck >= ? AND ck < ?", table);
+            _write.text = sprint("INSERT INTO %s (pk, ck, v) VALUES (?, ?, ?)", table);
+            break;
+        case profile::collection:
+            _read.text = sprint("SELECT m FROM %s WHERE pk = ?", table);
+            _write.text = sprint("UPDATE %s SET m = m + ? WHERE pk = ?", table);
+            break;
+        }
+    }
+
+    future<> connect() {
+        auto addr = _cfg.server;
+        if (_cfg.shard_aware_port) {
+            addr.port = _cfg.shard_aware_port + engine().cpu_id();
+        }
+        return cql_connection::connect(addr).then([this] (std::unique_ptr<cql_connection> conn) {
+            _conn = std::move(conn);
+            if (!_cfg.prepared) {
+                return make_ready_future<>();
+            }
+            return _conn->prepare(_read.text).then([this] (std::string id) {
+                _read.id = std::move(id);
+                return _conn->prepare(_write.text);
+            }).then([this] (std::string id) {
+                _write.id = std::move(id);
+            });
+        });
+    }
+
+    // Writes this core's share of the data, with concurrency requests in
+    // flight.
+    future<> populate(unsigned concurrency) {
+        uint64_t per_partition = _cfg.prof == profile::wide ? _cfg.rows : 1;
+        uint64_t total = _cfg.partitions * per_partition;
+        auto next = make_lw_shared<uint64_t>(total * engine().cpu_id() / smp::count);
+        auto end = total * (engine().cpu_id() + 1) / smp::count;
+        auto workers = boost::irange(0u, concurrency);
+        return parallel_for_each(workers.begin(), workers.end(), [this, next, end, per_partition] (unsigned) {
+            return repeat([this, next, end, per_partition] {
+                if (*next >= end) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                auto i = (*next)++;
+                return write(i / per_partition, i % per_partition).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }
+
+    future<run_result> run(unsigned concurrency, clk::duration duration) {
+        auto res = make_lw_shared<run_result>();
+        auto end_at = clk::now() + duration;
+        auto workers = boost::irange(0u, concurrency);
+        return parallel_for_each(workers.begin(), workers.end(), [this, res, end_at] (unsigned) {
+            return do_until([end_at] { return clk::now() >= end_at; }, [this, res] {
+                bool is_read = std::uniform_real_distribution<double>()(_random) < _cfg.read_ratio;
+                auto start = clk::now();
+                auto f = is_read ? read(random_partition()) : write(random_partition(), random_row());
+                return f.then_wrapped([res, is_read, start] (future<> f) {
+                    try {
+                        f.get();
+                    } catch (...) {
+                        ++res->errors;
+                        return;
+                    }
+                    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(clk::now() - start).count();
+                    if (is_read) {
+                        ++res->reads;
+                        res->read_latencies.mark(latency);
+                    } else {
+                        ++res->writes;
+                        res->write_latencies.mark(latency);
+                    }
+                });
+            });
+        }).then([res] {
+            return std::move(*res);
+        });
+    }
+
+    future<> stop() {
+        if (!_conn) {
+            return make_ready_future<>();
+        }
+        return _conn->close();
+    }
+};
+
+static sstring schema_of(const load_config& cfg) {
+    auto table = cfg.keyspace + ".cf";
+    switch (cfg.prof) {
+    case profile::key_value:
+        return sprint("CREATE TABLE %s (pk blob PRIMARY KEY, v blob)", table);
+    case profile::wide:
+        return sprint("CREATE TABLE %s (pk blob, ck int, v blob, PRIMARY KEY (pk, ck))", table);
+    case profile::collection:
+        return sprint("CREATE TABLE %s (pk blob PRIMARY KEY, m map<int, blob>)", table);
+    }
+    assert(0);
+}
+
+static void print_latencies(const char* name, uint64_t count, const utils::decaying_histogram& h, double seconds) {
+    std::cout << sprint("  %-6s %10.0f ops/s, latency us: p50 %d, p95 %d, p99 %d, p999 %d, max %d\n",
+            name, count / seconds, h.percentile(0.5), h.percentile(0.95), h.percentile(0.99),
+            h.percentile(0.999), h.percentile(1));
+}
+
+static future<> run_load(load_config cfg, std::vector<unsigned> concurrencies, clk::duration duration, bool populate) {
+    return seastar::async([cfg, concurrencies, duration, populate] {
+        auto clients = ::make_shared<distributed<load_client>>();
+        clients->start(cfg).get();
+        try {
+            auto conn = cql_connection::connect(cfg.server).get0();
+            conn->query(sprint("CREATE KEYSPACE IF NOT EXISTS %s WITH replication = "
+                    "{ 'class' : 'SimpleStrategy', 'replication_factor' : 1 }", cfg.keyspace)).get();
+            conn->query(sprint("DROP TABLE IF EXISTS %s.cf", cfg.keyspace)).get();
+            conn->query(schema_of(cfg)).get();
+            conn->close().get();
+            clients->invoke_on_all(&load_client::connect).get();
+            if (populate) {
+                std::cout << "Populating " << cfg.partitions << " partitions..." << std::endl;
+                clients->invoke_on_all([] (load_client& c) {
+                    return c.populate(100);
+                }).get();
+            }
+            for (auto concurrency : concurrencies) {
+                auto start = clk::now();
+                auto res = clients->map_reduce0([concurrency, duration] (load_client& c) {
+                    return c.run(concurrency, duration);
+                }, run_result(), [] (run_result a, const run_result& b) {
+                    a += b;
+                    return a;
+                }).get0();
+                auto seconds = std::chrono::duration<double>(clk::now() - start).count();
+                std::cout << sprint("concurrency %d per core: %.0f ops/s, %d errors\n", concurrency,
+                        (res.reads + res.writes) / seconds, res.errors);
+                print_latencies("reads", res.reads, res.read_latencies, seconds);
+                print_latencies("writes", res.writes, res.write_latencies, seconds);
+            }
+        } catch (...) {
+            clients->stop().get();
+            throw;
+        }
+        clients->stop().get();
+    });
+}
+
+static std::vector<unsigned> parse_concurrencies(const std::string& s) {
+    std::vector<std::string> parts;
+    boost::split(parts, s, boost::is_any_of(","));
+    std::vector<unsigned> res;
+    for (auto&& p : parts) {
+        auto c = boost::lexical_cast<unsigned>(p);
+        if (c == 0 || c > cql_connection::max_streams) {
+            throw std::invalid_argument(sprint("invalid concurrency %s", p));
+        }
+        res.push_back(c);
+    }
+    return res;
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("profile", bpo::value<profile>()->default_value(profile::key_value),
+                "data model: key_value, wide (partitions of --rows rows), or collection (a map per partition)")
+        ("partitions", bpo::value<unsigned>()->default_value(10000), "number of partitions")
+        ("rows", bpo::value<unsigned>()->default_value(100), "rows per partition of the wide profile, map entries of the collection profile")
+        ("slice", bpo::value<unsigned>()->default_value(10), "rows read at a time with the wide profile")
+        ("value-size", bpo::value<unsigned>()->default_value(64), "bytes per value; large values make for a blob store")
+        ("read-ratio", bpo::value<double>()->default_value(0.5), "fraction of requests which are reads")
+        ("unprepared", "send statements as queries rather than prepare them")
+        ("concurrency", bpo::value<std::string>()->default_value("1,10,100"), "requests in flight per core, a comma separated list to sweep through")
+        ("duration", bpo::value<unsigned>()->default_value(10), "seconds each concurrency is run for")
+        ("no-populate", "skip writing the data before running")
+        ("host", bpo::value<std::string>(), "IPv4 address of the node to load, rather than one started in-process")
+        ("port", bpo::value<uint16_t>()->default_value(9142), "CQL port")
+        ("shard-aware-port", bpo::value<uint16_t>()->default_value(0), "connect each core to this port plus its id, if not 0")
+        ("keyspace", bpo::value<std::string>()->default_value("perf"), "keyspace of the table loaded");
+
+    return app.run_deprecated(argc, argv, [&app] {
+        auto&& config = app.configuration();
+        load_config cfg;
+        cfg.prof = config["profile"].as<profile>();
+        cfg.keyspace = config["keyspace"].as<std::string>();
+        cfg.partitions = std::max(config["partitions"].as<unsigned>(), 1u);
+        cfg.rows = std::max(config["rows"].as<unsigned>(), 1u);
+        cfg.slice = config["slice"].as<unsigned>();
+        cfg.value_size = config["value-size"].as<unsigned>();
+        cfg.read_ratio = config["read-ratio"].as<double>();
+        cfg.prepared = !config.count("unprepared");
+        cfg.shard_aware_port = config["shard-aware-port"].as<uint16_t>();
+        auto port = config["port"].as<uint16_t>();
+        auto concurrencies = parse_concurrencies(config["concurrency"].as<std::string>());
+        auto duration = std::chrono::seconds(config["duration"].as<unsigned>());
+        bool populate = !config.count("no-populate");
+
+        std::cout << "Running " << cfg.prof << " profile, read ratio " << cfg.read_ratio
+                  << (cfg.prepared ? ", prepared" : ", unprepared") << " statements" << std::endl;
+
+        if (config.count("host")) {
+            cfg.server = ipv4_addr(gms::inet_address(config["host"].as<std::string>()).raw_addr(), port);
+            return run_load(cfg, concurrencies, duration, populate).then([] {
+                return engine().exit(0);
+            }).or_terminate();
+        }
+        cfg.server = ipv4_addr(gms::inet_address("127.0.0.1").raw_addr(), port);
+        return make_env_for_test().then([cfg, concurrencies, duration, populate] (auto env) mutable {
+            // Not stopped, as its connections aren't, like main() does.
+            auto server = new distributed<transport::cql_server>;
+            return server->start(std::ref(service::get_storage_proxy()), std::ref(env->qp()), 1024, 64 << 20).then([server, cfg] {
+                return server->invoke_on_all(&transport::cql_server::listen, cfg.server);
+            }).then([server, cfg] {
+                if (!cfg.shard_aware_port) {
+                    return make_ready_future<>();
+                }
+                return server->invoke_on_all(&transport::cql_server::listen_shard_aware, ipv4_addr(cfg.server.ip, cfg.shard_aware_port));
+            }).then([cfg, concurrencies, duration, populate] {
+                return run_load(cfg, concurrencies, duration, populate);
+            }).finally([env, server] {
+                return server->invoke_on_all(&transport::cql_server::stop).then([env] {
+                    return env->stop();
+                }).finally([env] {});
+            });
+        }).then([] {
+            return engine().exit(0);
+        }).or_terminate();
+    });
+}
@@ -19,6 +19,9 @@
  * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
+#include <cryptopp/md5.h>
+
 #include "utils/murmur_hash.hh"
 #include "tests/perf/perf.hh"
 
@@ -48,5 +51,62 @@ int main(int argc, char* argv[]) {
         sink += dst[1];
     });
 
+    // Hashing the keys of a batch or of an IN, of an int and of a uuid.
+    for (size_t size : { 4, 16 }) {
+        std::vector<bytes> keys;
+        for (size_t i = 0; i < 1000; ++i) {
+            bytes key(bytes::initialized_later(), size);
+            for (size_t j = 0; j < size; ++j) {
+                key[j] = i * 31 + j;
+            }
+            keys.push_back(std::move(key));
+        }
+        std::vector<bytes_view> views(keys.begin(), keys.end());
+        std::vector<std::array<uint64_t, 2>> dst;
+
+        std::cout << "Timing " << keys.size() << " keys of " << size << " bytes, one by one...\n";
+
+        time_it([&] {
+            dst.resize(views.size());
+            for (size_t i = 0; i < views.size(); ++i) {
+                utils::murmur_hash::hash3_x64_128(views[i], seed, dst[i]);
+            }
+            sink += dst[0][0];
+        }, 5, 100);
+
+        std::cout << "Timing " << keys.size() << " keys of " << size << " bytes, together...\n";
+
+        time_it([&] {
+            utils::murmur_hash::hash3_x64_128(views, seed, dst);
+            sink += dst[0][0];
+        }, 5, 100);
+    }
+
+    // Compares the two algorithms query::result::digest() can use, on
+    // results of typical sizes.
+    for (size_t size : { 256, 4096, 65536 }) {
+        bytes result(bytes::initialized_later(), size);
+        for (size_t i = 0; i < size; ++i) {
+            result[i] = i * 31;
+        }
+
+        std::cout << "Timing MD5 digest of " << size << " bytes...\n";
+
+        time_it([&] {
+            CryptoPP::Weak::MD5 hash;
+            unsigned char dst[CryptoPP::Weak::MD5::DIGESTSIZE];
+            hash.CalculateDigest(dst, reinterpret_cast<const unsigned char*>(result.begin()), result.size());
+            sink += dst[0];
+        }, 5, 100);
+
+        std::cout << "Timing murmur3 digest of " << size << " bytes...\n";
+
+        time_it([&] {
+            std::array<uint64_t,2> dst;
+            utils::murmur_hash::hash3_x64_128(result, seed, dst);
+            sink += dst[0];
+        }, 5, 100);
+    }
+
     black_hole = sink;
 }
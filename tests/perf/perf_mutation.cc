@@ -21,8 +21,10 @@
  */
 
 #include "database.hh"
+#include "frozen_mutation.hh"
 #include "perf.hh"
 #include <seastar/core/app-template.hh>
+#include <random>
 
 static atomic_cell make_atomic_cell(bytes value) {
     return atomic_cell::make_live(0, value);
@@ -47,6 +49,52 @@ int main(int argc, char* argv[]) {
             m.set_clustered_cell(c_key, col, make_atomic_cell(value));
             mt.apply(std::move(m));
         });
+
+        // Keys are drawn from a bounded range, so that the partition stops
+        // growing once most of them are in.
+        static constexpr int32_t max_rows = 1000000;
+        std::default_random_engine gen;
+        std::uniform_int_distribution<int32_t> dist(0, max_rows);
+        auto random_key = [&] {
+            return clustering_key::from_exploded(*s, {int32_type->decompose(dist(gen))});
+        };
+
+        std::cout << "Timing insertion of rows into a wide partition...\n";
+        mutation_partition wide(s);
+        time_it([&] {
+            wide.clustered_row(random_key());
+        });
+
+        std::cout << "Timing lookups of rows in a partition of " << wide.clustered_rows().size() << " rows...\n";
+        time_it([&] {
+            wide.find_row(random_key());
+        });
+
+        std::cout << "Timing copying of a partition of " << wide.clustered_rows().size() << " rows...\n";
+        time_it([&] {
+            mutation_partition copy(wide);
+        }, 5, 1);
+
+        // What each write pays to be sent to replicas and to the commitlog.
+        const column_definition& col = *s->get_column_definition("r1");
+        mutation single(key, s);
+        single.set_clustered_cell(c_key, col, make_atomic_cell(value));
+        std::cout << "Timing freezing of a mutation of a single cell, "
+                << freeze(single).representation().size() << " bytes...\n";
+        time_it([&] {
+            freeze(single);
+        });
+
+        mutation batch(key, s);
+        for (int32_t i = 0; i < 100; ++i) {
+            batch.set_clustered_cell(clustering_key::from_exploded(*s, {int32_type->decompose(i)}), col,
+                    make_atomic_cell(value));
+        }
+        std::cout << "Timing freezing of a mutation of 100 rows, "
+                << freeze(batch).representation().size() << " bytes...\n";
+        time_it([&] {
+            freeze(batch);
+        }, 5, 100);
         engine().exit(0);
     });
 }
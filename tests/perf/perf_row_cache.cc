@@ -0,0 +1,240 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <random>
+
+#include <core/app-template.hh>
+#include <core/future-util.hh>
+#include <core/thread.hh>
+
+#include "memtable.hh"
+#include "row_cache.hh"
+#include "schema_builder.hh"
+#include "utils/histogram.hh"
+#include "utils/logalloc.hh"
+
+// Measures how densely the row cache keeps data, and what keeping it under
+// memory pressure costs.
+//
+// The cache is populated with partitions of the given shape until it has to
+// evict, which tells how many bytes of LSA memory a cell takes. Reads of a
+// key space larger than what fits, and updates from memtables, are then
+// mixed for a while, with the cache evicting as it goes. The hit ratio, the
+// time LSA spent reclaiming memory, and the latencies of reads and updates
+// are printed.
+//
+// It runs on one shard; run it with -c1, and with -m to choose how much the
+// cache gets.
+
+using clk = std::chrono::steady_clock;
+
+struct bench_config {
+    unsigned rows;
+    unsigned columns;
+    unsigned value_size;
+    // The key space read and updated, relative to the partitions which fit.
+    double working_set;
+    double read_ratio;
+    // Partitions per memtable merged into the cache, and rows per partition.
+    unsigned update_partitions;
+    unsigned update_rows;
+    clk::duration duration;
+};
+
+class partition_generator {
+    schema_ptr _s;
+    const bench_config& _cfg;
+    bytes _value;
+public:
+    partition_generator(schema_ptr s, const bench_config& cfg)
+        : _s(std::move(s))
+        , _cfg(cfg)
+        , _value(bytes::initialized_later(), cfg.value_size)
+    {
+        std::fill(_value.begin(), _value.end(), 'v');
+    }
+
+    partition_key key(uint64_t n) const {
+        return partition_key::from_single_value(*_s, to_bytes(sprint("key%d", n)));
+    }
+
+    // The inverse of key().
+    uint64_t number(const partition_key& key) const {
+        auto b = key.explode(*_s)[0];
+        return std::stoull(std::string(reinterpret_cast<const char*>(b.data()) + 3, b.size() - 3));
+    }
+
+    mutation make(uint64_t n, unsigned rows, api::timestamp_type ts) const {
+        mutation m(key(n), _s);
+        for (unsigned r = 0; r < rows; ++r) {
+            auto ck = clustering_key::from_single_value(*_s, int32_type->decompose(int32_t(r)));
+            for (unsigned c = 0; c < _cfg.columns; ++c) {
+                m.set_clustered_cell(ck, *_s->get_column_definition(to_bytes(sprint("v%d", c))),
+                        atomic_cell::make_live(ts, _value));
+            }
+        }
+        return m;
+    }
+
+    // Every partition of the key space as it was first written, so that
+    // the underlying source takes no memory away from the cache.
+    mutation_source as_mutation_source() const {
+        return [this] (const query::partition_range& range) {
+            if (!range.is_singular() || !range.start()->value().has_key()) {
+                return make_empty_reader();
+            }
+            return make_reader_returning(make(number(*range.start()->value().key()), _cfg.rows, 1));
+        };
+    }
+};
+
+static void print_latencies(const char* name, const utils::decaying_histogram& h) {
+    std::cout << sprint("    %s latency [us]: p50 %d, p90 %d, p99 %d, p999 %d\n", name,
+            h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.percentile(0.999));
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("rows", bpo::value<unsigned>()->default_value(10), "rows per partition")
+        ("columns", bpo::value<unsigned>()->default_value(4), "cells per row")
+        ("value-size", bpo::value<unsigned>()->default_value(32), "bytes per cell value")
+        ("working-set", bpo::value<double>()->default_value(2),
+                "partitions read and updated, as a multiple of the partitions which fit in the cache")
+        ("read-ratio", bpo::value<double>()->default_value(0.9), "fraction of operations which are reads")
+        ("update-partitions", bpo::value<unsigned>()->default_value(100), "partitions per memtable merged into the cache")
+        ("update-rows", bpo::value<unsigned>()->default_value(1), "rows written per updated partition")
+        ("duration", bpo::value<unsigned>()->default_value(10), "seconds of mixed reads and updates");
+
+    return app.run(argc, argv, [&app] {
+        return seastar::async([&app] {
+            auto&& config = app.configuration();
+            bench_config cfg;
+            cfg.rows = config["rows"].as<unsigned>();
+            cfg.columns = config["columns"].as<unsigned>();
+            cfg.value_size = config["value-size"].as<unsigned>();
+            cfg.working_set = config["working-set"].as<double>();
+            cfg.read_ratio = config["read-ratio"].as<double>();
+            cfg.update_partitions = config["update-partitions"].as<unsigned>();
+            cfg.update_rows = std::min(config["update-rows"].as<unsigned>(), cfg.rows);
+            cfg.duration = std::chrono::seconds(config["duration"].as<unsigned>());
+
+            schema_builder builder("ks", "cf");
+            builder.with_column("pk", bytes_type, column_kind::partition_key)
+                .with_column("ck", int32_type, column_kind::clustering_key);
+            for (unsigned c = 0; c < cfg.columns; ++c) {
+                builder.with_column(to_bytes(sprint("v%d", c)), bytes_type);
+            }
+            auto s = builder.build();
+
+            partition_generator gen(s, cfg);
+            cache_tracker tracker;
+            row_cache cache(s, gen.as_mutation_source(), tracker);
+            auto cells_per_partition = uint64_t(cfg.rows) * cfg.columns;
+
+            std::cout << sprint("Partitions of %d rows of %d cells of %d bytes\n", cfg.rows, cfg.columns, cfg.value_size);
+
+            // Fill the cache up to the point it starts evicting.
+            uint64_t fitting = 0;
+            size_t used = 0;
+            for (;;) {
+                cache.populate(gen.make(fitting, cfg.rows, 1));
+                if (cache.num_entries() <= fitting || tracker.evicted_rows()) {
+                    break;
+                }
+                used = tracker.region().occupancy().used_space();
+                ++fitting;
+            }
+            auto cells = fitting * cells_per_partition;
+            if (!cells) {
+                throw std::runtime_error("not even one partition fits in the cache");
+            }
+            std::cout << sprint("  fill: %d partitions, %d cells in %d bytes of LSA memory before evicting\n",
+                    fitting, cells, used);
+            std::cout << sprint("    %.1f bytes per cell, %.1f of them overhead\n",
+                    double(used) / cells, double(used) / cells - cfg.value_size);
+
+            // Read and update a key space larger than what fits.
+            uint64_t key_space = std::max<uint64_t>(1, fitting * cfg.working_set);
+            for (uint64_t n = fitting + 1; n < key_space; ++n) {
+                cache.populate(gen.make(n, cfg.rows, 1));
+            }
+
+            std::default_random_engine random;
+            std::uniform_int_distribution<uint64_t> keys(0, key_space - 1);
+            std::uniform_real_distribution<double> fraction;
+            utils::decaying_histogram read_latencies{std::chrono::hours(24)};
+            utils::decaying_histogram update_latencies{std::chrono::hours(24)};
+            auto checker = make_default_partition_presence_checker();
+            auto stats_before = cache.stats();
+            auto& reclaims = logalloc::shard_tracker().reclaim_histogram();
+            auto reclaims_before = reclaims.count;
+            auto reclaim_ns_before = reclaims.sum;
+            auto evicted_rows_before = tracker.evicted_rows();
+            api::timestamp_type ts = 1;
+            uint64_t reads = 0;
+            uint64_t updates = 0;
+            auto start = clk::now();
+            auto end = start + cfg.duration;
+            while (clk::now() < end) {
+                auto op_start = clk::now();
+                if (fraction(random) < cfg.read_ratio) {
+                    auto dk = dht::global_partitioner().decorate_key(*s, gen.key(keys(random)));
+                    auto reader = cache.make_reader(query::partition_range::make_singular(dk));
+                    reader().get0();
+                    read_latencies.mark(std::chrono::duration_cast<std::chrono::microseconds>(clk::now() - op_start).count());
+                    ++reads;
+                } else {
+                    auto mt = make_lw_shared<memtable>(s);
+                    ++ts;
+                    for (unsigned i = 0; i < cfg.update_partitions; ++i) {
+                        mt->apply(gen.make(keys(random), cfg.update_rows, ts));
+                    }
+                    op_start = clk::now();
+                    cache.update(*mt, checker).get();
+                    update_latencies.mark(std::chrono::duration_cast<std::chrono::microseconds>(clk::now() - op_start).count());
+                    ++updates;
+                }
+                if ((reads + updates) % 1000 == 0) {
+                    later().get();
+                }
+            }
+            auto seconds = std::chrono::duration<double>(clk::now() - start).count();
+
+            auto hits = cache.stats().hits - stats_before.hits;
+            auto misses = cache.stats().misses - stats_before.misses;
+            auto reclaim_count = reclaims.count - reclaims_before;
+            auto reclaim_ns = reclaims.sum - reclaim_ns_before;
+            std::cout << sprint("  mixed: %d reads and %d updates of %d partitions over a key space of %d in %.2f s\n",
+                    reads, updates, cfg.update_partitions, key_space, seconds);
+            std::cout << sprint("    hit ratio %.3f, %d rows evicted, %d partitions cached\n",
+                    hits + misses ? double(hits) / (hits + misses) : 0.0,
+                    tracker.evicted_rows() - evicted_rows_before, cache.num_entries());
+            std::cout << sprint("    LSA reclaimed %d times in %.2f ms, %.1f us on average, %.1f us at most\n",
+                    reclaim_count, reclaim_ns / 1e6, reclaim_count ? reclaim_ns / 1e3 / reclaim_count : 0.0,
+                    reclaims.max / 1e3);
+            std::cout << "    cache occupancy: " << tracker.region().occupancy() << "\n";
+            print_latencies("read", read_latencies);
+            print_latencies("update", update_latencies);
+        });
+    });
+}
@@ -45,13 +45,43 @@ static auto execute_update_for_key(cql_test_env& env, const bytes& key) {
 
 struct test_config {
     enum class run_mode { read, write };
+    // Which partitions each core reads: those of any shard, those it owns, or
+    // those other shards own, to measure the cost of the hop to the owner.
+    enum class shard_mode { any, local, remote };
 
     run_mode mode;
+    shard_mode shards;
     unsigned partitions;
     unsigned concurrency;
     bool query_single_key;
+    // The partitions by owning shard.
+    std::vector<std::vector<unsigned>> partitions_by_shard;
 };
 
+std::istream& operator>>(std::istream& is, test_config::shard_mode& m) {
+    std::string s;
+    is >> s;
+    if (s == "any") {
+        m = test_config::shard_mode::any;
+    } else if (s == "local") {
+        m = test_config::shard_mode::local;
+    } else if (s == "remote") {
+        m = test_config::shard_mode::remote;
+    } else {
+        is.setstate(std::ios::failbit);
+    }
+    return is;
+}
+
+std::ostream& operator<<(std::ostream& os, const test_config::shard_mode& m) {
+    switch (m) {
+        case test_config::shard_mode::any: return os << "any";
+        case test_config::shard_mode::local: return os << "local";
+        case test_config::shard_mode::remote: return os << "remote";
+    }
+    assert(0);
+}
+
 std::ostream& operator<<(std::ostream& os, const test_config::run_mode& m) {
     switch (m) {
         case test_config::run_mode::write: return os << "write";
@@ -64,20 +94,53 @@ std::ostream& operator<<(std::ostream& os, const test_config& cfg) {
     return os << "{partitions=" << cfg.partitions
            << ", concurrency=" << cfg.concurrency
            << ", mode=" << cfg.mode
+           << ", shards=" << cfg.shards
            << ", query_single_key=" << (cfg.query_single_key ? "yes" : "no")
            << "}";
 }
 
+static void group_partitions_by_shard(cql_test_env& env, test_config& cfg) {
+    auto s = env.local_db().find_schema("ks", table_name);
+    cfg.partitions_by_shard.assign(smp::count, {});
+    for (unsigned sequence = 0; sequence < cfg.partitions; ++sequence) {
+        auto key = partition_key::from_single_value(*s, make_key(sequence));
+        auto shard = dht::shard_of(dht::global_partitioner().get_token(*s, key));
+        cfg.partitions_by_shard[shard].push_back(sequence);
+    }
+}
+
+// A partition the current core reads, as cfg.shards tells.
+static unsigned pick_partition(const test_config& cfg) {
+    if (cfg.query_single_key) {
+        return 0;
+    }
+    auto shard = engine().cpu_id();
+    switch (cfg.shards) {
+    case test_config::shard_mode::any:
+        return std::rand() % cfg.partitions;
+    case test_config::shard_mode::local:
+        break;
+    case test_config::shard_mode::remote:
+        if (smp::count > 1) {
+            shard = (shard + 1 + std::rand() % (smp::count - 1)) % smp::count;
+        }
+        break;
+    }
+    auto& partitions = cfg.partitions_by_shard[shard];
+    return partitions.empty() ? 0 : partitions[std::rand() % partitions.size()];
+}
+
 future<> test_read(cql_test_env& env, test_config& cfg) {
     std::cout << "Creating " << cfg.partitions << " partitions..." << std::endl;
     auto partitions = boost::irange(0, (int)cfg.partitions);
     return do_for_each(partitions.begin(), partitions.end(), [&env](int sequence) {
         return execute_update_for_key(env, make_key(sequence));
-    }).then([&env] {
+    }).then([&env, &cfg] {
+        group_partitions_by_shard(env, cfg);
         return env.prepare("select \"C0\", \"C1\", \"C2\", \"C3\", \"C4\" from cf where \"KEY\" = ?");
     }).then([&env, &cfg](auto id) {
         return time_parallel([&env, &cfg, id] {
-            bytes key = make_key(cfg.query_single_key ? 0 : std::rand() % cfg.partitions);
+            bytes key = make_key(pick_partition(cfg));
             return env.execute_prepared(id, {{std::move(key)}}).discard_result();
         }, cfg.concurrency);
     });
@@ -126,6 +189,8 @@ int main(int argc, char** argv) {
         ("partitions", bpo::value<unsigned>()->default_value(10000), "number of partitions")
         ("write", "test write path instead of read path")
         ("query-single-key", "test write path instead of read path")
+        ("shards", bpo::value<test_config::shard_mode>()->default_value(test_config::shard_mode::any),
+                "which partitions each core reads: those of any shard, those it owns (local), or those other shards own (remote)")
         ("concurrency", bpo::value<unsigned>()->default_value(100), "workers per core");
 
     return app.run_deprecated(argc, argv, [&app] {
@@ -135,6 +200,7 @@ int main(int argc, char** argv) {
             cfg->concurrency = app.configuration()["concurrency"].as<unsigned>();
             cfg->mode = app.configuration().count("write") ? test_config::run_mode::write : test_config::run_mode::read;
             cfg->query_single_key = app.configuration().count("query-single-key");
+            cfg->shards = app.configuration()["shards"].as<test_config::shard_mode>();
             return do_test(*env, *cfg).finally([env, cfg] {
                 return env->stop().finally([env] {});
             });
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Some thrift headers include other files from within namespaces,
+// which is totally broken.  Include those files here to avoid
+// breakage:
+#include <sys/param.h>
+// end thrift workaround
+#include "Cassandra.h"
+#include "thrift/handler.hh"
+#include "tests/cql_test_env.hh"
+#include "tests/perf/perf.hh"
+#include "core/app-template.hh"
+#include "timestamp.hh"
+
+using namespace org::apache::cassandra;
+
+using mutation_map = std::map<std::string, std::map<std::string, std::vector<Mutation>>>;
+
+struct test_config {
+    unsigned partitions;
+    unsigned concurrency;
+    unsigned keys_per_batch;
+};
+
+std::ostream& operator<<(std::ostream& os, const test_config& cfg) {
+    return os << "{partitions=" << cfg.partitions
+           << ", concurrency=" << cfg.concurrency
+           << ", keys_per_batch=" << cfg.keys_per_batch
+           << "}";
+}
+
+// A handler per core, like the thrift server has one per connection.
+static thread_local std::unique_ptr<CassandraCobSvIfFactory> handler_factory;
+static thread_local CassandraCobSvIf* handler;
+
+// Adapts the continuation objects of a handler call to a future.
+template <typename Call>
+static future<> call_handler(Call call) {
+    auto pr = make_lw_shared<promise<>>();
+    auto f = pr->get_future();
+    call([pr] { pr->set_value(); }, [pr] (::apache::thrift::TDelayedException* ex) {
+        try {
+            ex->throw_it();
+        } catch (...) {
+            pr->set_exception(std::current_exception());
+        }
+    });
+    return f;
+}
+
+static std::string make_key(uint64_t sequence) {
+    return std::string(reinterpret_cast<const char*>(&sequence), sizeof(sequence));
+}
+
+static lw_shared_ptr<mutation_map> make_batch(const test_config& cfg) {
+    static const std::string value = "\x8f\x75\xda\x6b\x3d\xce\xc9\x0c\x8a\x40\x4f\xb9\xa5\xf6\xb0\x62";
+    auto batch = make_lw_shared<mutation_map>();
+    for (unsigned i = 0; i < cfg.keys_per_batch; ++i) {
+        auto& mutations = (*batch)[make_key(std::rand() % cfg.partitions)]["cf"];
+        for (auto&& name : { "C0", "C1", "C2", "C3", "C4" }) {
+            Column col;
+            col.__set_name(name);
+            col.__set_value(value);
+            col.__set_timestamp(api::new_timestamp());
+            ColumnOrSuperColumn cosc;
+            cosc.__set_column(col);
+            Mutation m;
+            m.__set_column_or_supercolumn(cosc);
+            mutations.emplace_back(std::move(m));
+        }
+    }
+    return batch;
+}
+
+future<> do_test(cql_test_env& env, test_config& cfg) {
+    std::cout << "Running test with config: " << cfg << std::endl;
+    return env.create_table([] (auto ks_name) {
+        return schema({}, ks_name, "cf",
+                {{"KEY", bytes_type}},
+                {},
+                {{"C0", bytes_type}, {"C1", bytes_type}, {"C2", bytes_type}, {"C3", bytes_type}, {"C4", bytes_type}},
+                {},
+                utf8_type);
+    }).then([&env] {
+        return env.db().invoke_on_all([&env] (database&) {
+            handler_factory = create_handler_factory(env.db());
+            handler = handler_factory->getHandler(::apache::thrift::TConnectionInfo());
+            return call_handler([] (auto cob, auto exn_cob) {
+                handler->set_keyspace(cob, exn_cob, "ks");
+            });
+        });
+    }).then([&cfg] {
+        return time_parallel([&cfg] {
+            auto batch = make_batch(cfg);
+            return call_handler([batch] (auto cob, auto exn_cob) {
+                handler->batch_mutate(cob, exn_cob, *batch, ConsistencyLevel::ONE);
+            }).finally([batch] {});
+        }, cfg.concurrency);
+    }).finally([&env] {
+        return env.db().invoke_on_all([] (database&) {
+            if (handler) {
+                handler_factory->releaseHandler(handler);
+                handler = nullptr;
+            }
+            handler_factory.reset();
+        });
+    });
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("partitions", bpo::value<unsigned>()->default_value(10000), "number of partitions")
+        ("keys-per-batch", bpo::value<unsigned>()->default_value(10), "partitions written by each batch_mutate")
+        ("concurrency", bpo::value<unsigned>()->default_value(100), "workers per core");
+
+    return app.run_deprecated(argc, argv, [&app] {
+        make_env_for_test().then([&app] (auto env) {
+            auto cfg = make_lw_shared<test_config>();
+            cfg->partitions = app.configuration()["partitions"].as<unsigned>();
+            cfg->concurrency = app.configuration()["concurrency"].as<unsigned>();
+            cfg->keys_per_batch = app.configuration()["keys-per-batch"].as<unsigned>();
+            return do_test(*env, *cfg).finally([env, cfg] {
+                return env->stop().finally([env] {});
+            });
+        }).then([] {
+            return engine().exit(0);
+        }).or_terminate();
+    });
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <vector>
+#include <boost/locale/encoding_utf.hpp>
+
+#include "utils/utf8.hh"
+#include "tests/perf/perf.hh"
+
+volatile bool black_hole;
+
+static bool validate_bytewise(const std::vector<uint8_t>& buf) {
+    auto p = reinterpret_cast<const char*>(buf.data());
+    try {
+        boost::locale::conv::utf_to_utf<char>(p, p + buf.size(), boost::locale::conv::stop);
+        return true;
+    } catch (const boost::locale::conv::conversion_error&) {
+        return false;
+    }
+}
+
+// Times the validation of text cells of the sizes of short strings and of
+// log lines, all ASCII and with a multi-byte character every few bytes,
+// against the byte-at-a-time validation it replaced.
+int main(int argc, char* argv[]) {
+    bool sink = true;
+
+    for (size_t size : { 16, 256, 4096, 65536 }) {
+        std::vector<uint8_t> ascii(size);
+        for (size_t i = 0; i < size; ++i) {
+            ascii[i] = 'a' + i % 26;
+        }
+        // "é", two bytes, after every six ASCII ones.
+        std::vector<uint8_t> mixed;
+        while (mixed.size() + 2 <= size) {
+            if (mixed.size() % 8 < 6) {
+                mixed.push_back('a' + mixed.size() % 26);
+            } else {
+                mixed.push_back(0xc3);
+                mixed.push_back(0xa9);
+            }
+        }
+
+        for (auto&& buf : { std::make_pair("ASCII", &ascii), std::make_pair("mixed", &mixed) }) {
+            auto& v = *buf.second;
+            std::cout << "Timing validation of " << v.size() << " bytes of " << buf.first << " text...\n";
+            time_it([&] {
+                sink &= utils::utf8::validate(v.data(), v.size());
+            }, 5, 100);
+
+            std::cout << "Timing bytewise validation of " << v.size() << " bytes of " << buf.first << " text...\n";
+            time_it([&] {
+                sink &= validate_bytewise(v);
+            }, 5, 100);
+        }
+
+        std::cout << "Timing ASCII validation of " << size << " bytes...\n";
+        time_it([&] {
+            sink &= utils::ascii::validate(ascii.data(), ascii.size());
+        }, 5, 100);
+    }
+
+    black_hole = sink;
+}
@@ -98,6 +98,14 @@ int main(int argc, char** argv) {
                     cache.update(*mt, checker).get();
                 }
             }, 5, 1);
+
+            if (update_cache) {
+                auto& t = cache.get_cache_tracker();
+                auto slices = std::max<uint64_t>(t.update_slices(), 1);
+                std::cout << sprint("update: %.3f ms total, %d slices, %.3f us avg slice, %.3f us max slice",
+                    t.update_time_ns() / 1e6, t.update_slices(),
+                    t.update_time_ns() / 1e3 / slices, t.max_update_slice_ns() / 1e3) << "\n";
+            }
         });
     });
 }
@@ -32,8 +32,11 @@
 #include "tests/cql_assertions.hh"
 
 #include "core/future-util.hh"
+#include "core/thread.hh"
 #include "transport/messages/result_message.hh"
 #include "cql3/query_processor.hh"
+#include "cql3/prepared_statements_cache.hh"
+#include "service/service_level_controller.hh"
 
 SEASTAR_TEST_CASE(test_execute_internal_insert) {
     return do_with_cql_env([] (auto& e) {
@@ -112,3 +115,138 @@ SEASTAR_TEST_CASE(test_execute_internal_update) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_service_level_options) {
+    auto options = service::service_level_options::parse("shares=200,requests_per_second=1000");
+    BOOST_REQUIRE_EQUAL(options.shares, 200);
+    BOOST_REQUIRE_EQUAL(options.requests_per_second, 1000);
+    BOOST_REQUIRE_EQUAL(options.bytes_per_second, 0);
+    BOOST_REQUIRE_EQUAL(service::service_level_options::parse("").shares, 1000);
+    BOOST_REQUIRE_THROW(service::service_level_options::parse("shares"), std::invalid_argument);
+    BOOST_REQUIRE_THROW(service::service_level_options::parse("shares=0"), std::invalid_argument);
+    BOOST_REQUIRE_THROW(service::service_level_options::parse("shares=x"), std::invalid_argument);
+    BOOST_REQUIRE_THROW(service::service_level_options::parse("priority=1"), std::invalid_argument);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_service_level_shares) {
+    return seastar::async([] {
+        service::service_level_controller controller(1);
+        service::service_level_options oltp;
+        oltp.shares = 300;
+        controller.set_service_level("oltp", oltp);
+        service::service_level_options batch;
+        batch.shares = 100;
+        controller.set_service_level("batch", batch);
+
+        // Holds the only slot while both levels queue up.
+        promise<> unblock;
+        auto blocker = controller.run("batch", 0, [&unblock] {
+            return unblock.get_future();
+        });
+        std::vector<sstring> order;
+        std::vector<future<>> done;
+        for (int i = 0; i < 4; i++) {
+            for (auto name : { "batch", "oltp" }) {
+                done.push_back(controller.run(name, 0, [&order, name] {
+                    order.push_back(name);
+                    return make_ready_future<>();
+                }));
+            }
+        }
+        BOOST_REQUIRE_EQUAL(controller.running(), 1);
+        BOOST_REQUIRE_EQUAL(controller.get_stats("oltp").queued, 4);
+
+        unblock.set_value();
+        blocker.get();
+        when_all(done.begin(), done.end()).get();
+        BOOST_REQUIRE_EQUAL(order.size(), 8);
+        // Three times the shares, about three times the requests let in.
+        BOOST_REQUIRE(std::count(order.begin(), order.begin() + 4, sstring("oltp")) >= 3);
+        BOOST_REQUIRE_EQUAL(controller.running(), 0);
+        BOOST_REQUIRE_EQUAL(controller.get_stats("batch").requests, 5);
+        BOOST_REQUIRE_EQUAL(controller.get_stats("batch").latencies.count(), 5);
+
+        // Unknown levels fall back to the default one.
+        controller.run("reporting", 0, [] {
+            return make_ready_future<>();
+        }).get();
+        BOOST_REQUIRE_EQUAL(controller.get_stats(service::service_level_controller::default_service_level).requests, 1);
+    });
+}
+
+SEASTAR_TEST_CASE(test_unprepared_statements_are_cached) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            auto& cache = e.local_qp().unprepared_statements();
+            e.execute_cql("create table cf (p int primary key, v int);").get();
+
+            auto hits = cache.get_stats().hits;
+            auto misses = cache.get_stats().misses;
+            e.execute_cql("insert into cf (p, v) values (1, 2);").get();
+            BOOST_REQUIRE_EQUAL(cache.get_stats().misses, misses + 1);
+            e.execute_cql("insert into cf (p, v) values (1, 2);").get();
+            BOOST_REQUIRE_EQUAL(cache.get_stats().hits, hits + 1);
+            BOOST_REQUIRE_EQUAL(cache.get_stats().misses, misses + 1);
+            // Another text is another statement.
+            e.execute_cql("insert into cf (p, v) values (2, 3);").get();
+            BOOST_REQUIRE_EQUAL(cache.get_stats().misses, misses + 2);
+
+            assert_that(e.execute_cql("select * from cf where p = 1;").get0())
+                .is_rows().with_rows({{int32_type->decompose(1), int32_type->decompose(2)}});
+            BOOST_REQUIRE_EQUAL(cache.get_stats().misses, misses + 3);
+
+            // The statements go with their table, so that one re-created
+            // under the same name is not queried through them.
+            e.execute_cql("drop table cf;").get();
+            e.execute_cql("create table cf (p int primary key, w text);").get();
+            e.execute_cql("insert into cf (p, w) values (1, 'x');").get();
+            misses = cache.get_stats().misses;
+            assert_that(e.execute_cql("select * from cf where p = 1;").get0())
+                .is_rows().with_rows({{int32_type->decompose(1), utf8_type->decompose(sstring("x"))}});
+            BOOST_REQUIRE_EQUAL(cache.get_stats().misses, misses + 1);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_prepared_statements_cache_evicts_least_recently_used) {
+    using cache_type = cql3::prepared_statements_cache<int>;
+    auto make_prepared = [] {
+        return ::make_shared<cql3::statements::parsed_statement::prepared>(::shared_ptr<cql3::cql_statement>());
+    };
+    cache_type cache(300);
+    auto p1 = make_prepared();
+    auto p2 = make_prepared();
+    auto p3 = make_prepared();
+    cache.insert(1, p1, 100);
+    cache.insert(2, p2, 100);
+    cache.insert(3, p3, 100);
+    BOOST_REQUIRE_EQUAL(cache.count(), 3);
+    BOOST_REQUIRE_EQUAL(cache.size(), 300);
+
+    // Used last, so it outlives the one inserted after it.
+    BOOST_REQUIRE(cache.get(1) == p1);
+    cache.insert(4, make_prepared(), 100);
+    BOOST_REQUIRE_EQUAL(cache.count(), 3);
+    BOOST_REQUIRE_EQUAL(cache.size(), 300);
+    BOOST_REQUIRE_EQUAL(cache.get_stats().evictions, 1);
+    BOOST_REQUIRE(!cache.get(2));
+    BOOST_REQUIRE(cache.get(1) == p1);
+    BOOST_REQUIRE(cache.get(3) == p3);
+    BOOST_REQUIRE_EQUAL(cache.get_stats().hits, 3);
+    BOOST_REQUIRE_EQUAL(cache.get_stats().misses, 1);
+
+    // A large statement makes room for itself, but is never evicted by itself.
+    cache.insert(5, make_prepared(), 250);
+    BOOST_REQUIRE_EQUAL(cache.count(), 1);
+    BOOST_REQUIRE_EQUAL(cache.size(), 250);
+    cache.insert(6, make_prepared(), 400);
+    BOOST_REQUIRE_EQUAL(cache.count(), 1);
+    BOOST_REQUIRE(cache.find(6));
+    BOOST_REQUIRE_EQUAL(cache.get_stats().evictions, 5);
+
+    cache.erase(6);
+    BOOST_REQUIRE_EQUAL(cache.count(), 0);
+    BOOST_REQUIRE_EQUAL(cache.size(), 0);
+    return make_ready_future<>();
+}
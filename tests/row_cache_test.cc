@@ -29,9 +29,11 @@
 #include "tests/mutation_source_test.hh"
 
 #include "schema_builder.hh"
+#include "partition_slice_builder.hh"
 #include "row_cache.hh"
 #include "core/thread.hh"
 #include "memtable.hh"
+#include "db/saved_caches_manager.hh"
 
 static schema_ptr make_schema() {
     return schema_builder("ks", "cf")
@@ -355,3 +357,367 @@ SEASTAR_TEST_CASE(test_update) {
         }
     });
 }
+
+static schema_ptr make_wide_schema() {
+    return schema_builder("ks", "wide")
+        .with_column("pk", bytes_type, column_kind::partition_key)
+        .with_column("ck", int32_type, column_kind::clustering_key)
+        .with_column("v", bytes_type, column_kind::regular_column)
+        .build();
+}
+
+SEASTAR_TEST_CASE(test_partial_partition_caching) {
+    return seastar::async([] {
+        auto s = make_wide_schema();
+        mutation m(new_key(s), s);
+        for (int i = 0; i < 4000; i++) {
+            auto ck = clustering_key::from_single_value(*s, int32_type->decompose(i));
+            m.set_clustered_cell(ck, "v", bytes(512, 'v'), 1);
+        }
+        auto mt = make_lw_shared<memtable>(s);
+        mt->apply(m);
+
+        cache_tracker tracker;
+        tracker.set_partial_partition_threshold(100);
+        row_cache cache(s, mt->as_data_source(), tracker);
+
+        auto range = query::partition_range::make_singular(m.decorated_key());
+        auto slice = partition_slice_builder(*s).build();
+        auto now = gc_clock::now();
+        auto read_head = [&] {
+            auto mo = cache.make_reader(range, slice, 10, now)().get0();
+            BOOST_REQUIRE(bool(mo));
+            return std::move(*mo);
+        };
+
+        // The first read goes to the underlying source and caches only the
+        // rows it needs.
+        BOOST_REQUIRE(read_head().partition().clustered_rows().size() == 4000);
+        BOOST_REQUIRE(cache.stats().misses == 1);
+        BOOST_REQUIRE(read_head().partition().clustered_rows().size() == 10);
+        BOOST_REQUIRE(cache.stats().hits == 1);
+
+        // A read of the whole partition doesn't hit, and caches all of it.
+        assert_that(cache.make_reader(range))
+            .produces(m)
+            .produces_end_of_stream();
+        BOOST_REQUIRE(cache.stats().misses == 2);
+        assert_that(cache.make_reader(range))
+            .produces(m)
+            .produces_end_of_stream();
+        BOOST_REQUIRE(cache.stats().hits == 2);
+
+        // Eviction trims the partition from its end, so its head still hits.
+        while (!tracker.evicted_rows()) {
+            logalloc::shard_tracker().reclaim(1);
+        }
+        BOOST_REQUIRE(cache.num_entries() == 1);
+        BOOST_REQUIRE(read_head().partition().clustered_rows().size() < 4000);
+        BOOST_REQUIRE(cache.stats().hits == 3);
+        assert_that(cache.make_reader(range))
+            .produces(m)
+            .produces_end_of_stream();
+        BOOST_REQUIRE(cache.stats().misses == 3);
+    });
+}
+
+SEASTAR_TEST_CASE(test_rows_per_partition_caching_option) {
+    return seastar::async([] {
+        auto make_schema_caching = [] (sstring rows_per_partition) {
+            schema_builder builder(make_wide_schema());
+            builder.set_caching_options(caching_options::from_sstring(
+                    "{\"keys\":\"ALL\",\"rows_per_partition\":\"" + rows_per_partition + "\"}"));
+            return builder.build();
+        };
+        auto make_mutation = [] (schema_ptr s) {
+            mutation m(new_key(s), s);
+            for (int i = 0; i < 20; i++) {
+                auto ck = clustering_key::from_single_value(*s, int32_type->decompose(i));
+                m.set_clustered_cell(ck, "v", to_bytes(sprint("v%d", i)), 1);
+            }
+            return m;
+        };
+
+        cache_tracker tracker;
+
+        {
+            auto s = make_schema_caching("5");
+            auto m = make_mutation(s);
+            row_cache cache(s, [m] (const query::partition_range&) {
+                return make_reader_returning(m);
+            }, tracker);
+
+            cache.populate(m);
+            BOOST_REQUIRE(cache.num_entries() == 1);
+
+            // Reads needing only the first rows hit, others don't.
+            auto range = query::partition_range::make_singular(m.decorated_key());
+            auto slice = partition_slice_builder(*s).build();
+            auto mo = cache.make_reader(range, slice, 5, gc_clock::now())().get0();
+            BOOST_REQUIRE(bool(mo));
+            BOOST_REQUIRE(mo->partition().clustered_rows().size() == 5);
+            BOOST_REQUIRE(cache.stats().hits == 1);
+
+            assert_that(cache.make_reader(range))
+                .produces(m)
+                .produces_end_of_stream();
+            BOOST_REQUIRE(cache.stats().misses == 1);
+            BOOST_REQUIRE(cache.make_reader(range, slice, 5, gc_clock::now())().get0()->partition().clustered_rows().size() == 5);
+            BOOST_REQUIRE(cache.stats().hits == 2);
+        }
+
+        {
+            auto s = make_schema_caching("NONE");
+            auto m = make_mutation(s);
+            row_cache cache(s, [m] (const query::partition_range&) {
+                return make_reader_returning(m);
+            }, tracker);
+
+            cache.populate(m);
+            BOOST_REQUIRE(cache.num_entries() == 0);
+            assert_that(cache.make_reader(query::partition_range::make_singular(m.decorated_key())))
+                .produces(m)
+                .produces_end_of_stream();
+            BOOST_REQUIRE(cache.num_entries() == 0);
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_cell_compression_caching_option) {
+    return seastar::async([] {
+        schema_builder builder(make_wide_schema());
+        builder.set_caching_options(caching_options::from_sstring(
+                "{\"keys\":\"ALL\",\"rows_per_partition\":\"ALL\",\"cell_compression_threshold_in_kb\":\"1\"}"));
+        auto s = builder.build();
+        BOOST_REQUIRE(s->caching_options().cell_compression_threshold() == 1024);
+        BOOST_REQUIRE(caching_options::from_sstring(s->caching_options().to_sstring()).cell_compression_threshold() == 1024);
+
+        // All values but the first are large enough to be compressed.
+        mutation m(new_key(s), s);
+        for (int i = 0; i < 4; i++) {
+            auto ck = clustering_key::from_single_value(*s, int32_type->decompose(i));
+            m.set_clustered_cell(ck, "v", bytes(i ? 8192 : 512, 'a' + i), 1);
+        }
+
+        cache_tracker tracker;
+        row_cache cache(s, [m] (const query::partition_range&) {
+            return make_reader_returning(m);
+        }, tracker);
+
+        cache.populate(m);
+        BOOST_REQUIRE(tracker.compression_saving() > 0);
+        auto range = query::partition_range::make_singular(m.decorated_key());
+        assert_that(cache.make_reader(range))
+            .produces(m)
+            .produces_end_of_stream();
+        BOOST_REQUIRE(cache.stats().hits == 1);
+
+        // Merged writes are compared with the uncompressed values.
+        auto mt = make_lw_shared<memtable>(s);
+        mutation m2(m.key(), s);
+        auto ck = clustering_key::from_single_value(*s, int32_type->decompose(1));
+        m2.set_clustered_cell(ck, "v", bytes(8192, 'z'), 1);
+        mt->apply(m2);
+        cache.update(*mt, [] (auto&& key) {
+            return partition_presence_checker_result::maybe_exists;
+        }).get();
+        m.apply(m2);
+        assert_that(cache.make_reader(range))
+            .produces(m)
+            .produces_end_of_stream();
+        BOOST_REQUIRE(cache.stats().hits == 2);
+
+        cache.clear();
+        BOOST_REQUIRE(tracker.compression_saving() == 0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_scan_resistant_eviction) {
+    return seastar::async([] {
+        auto s = make_schema();
+        auto mt = make_lw_shared<memtable>(s);
+
+        cache_tracker tracker;
+        row_cache cache(s, mt->as_data_source(), tracker);
+
+        // Hits move the hot partitions to the protected segment.
+        std::vector<mutation> hot;
+        for (int i = 0; i < 10; i++) {
+            hot.push_back(make_new_mutation(s));
+            cache.populate(hot.back());
+            verify_has(cache, hot.back());
+        }
+        BOOST_REQUIRE(tracker.protected_partitions() == 8);
+
+        // A scan populates the cache without promoting anything, nor does
+        // a read bypassing the cache.
+        std::vector<mutation> scanned;
+        for (int i = 0; i < 100; i++) {
+            mutation m(new_key(s), s);
+            m.set_clustered_cell(clustering_key::make_empty(*s), "v", bytes(16 * 1024, 'v'), 1);
+            cache.populate(m);
+            scanned.push_back(std::move(m));
+        }
+        for (auto&& m : hot) {
+            verify_has(cache, m);
+        }
+        BOOST_REQUIRE(tracker.protected_partitions() == 10);
+        BOOST_REQUIRE(tracker.partitions() == 110);
+
+        auto slice = partition_slice_builder(*s)
+            .with_option<query::partition_slice::option::bypass_cache>()
+            .build();
+        auto bypassed = make_new_mutation(s);
+        mt->apply(bypassed);
+        auto range = query::partition_range::make_singular(bypassed.decorated_key());
+        assert_that(cache.make_reader(range, slice, query::max_rows, gc_clock::now()))
+            .produces(bypassed)
+            .produces_end_of_stream();
+        BOOST_REQUIRE(tracker.partitions() == 110);
+        auto scanned_range = query::partition_range::make_singular(scanned.front().decorated_key());
+        assert_that(cache.make_reader(scanned_range, slice, query::max_rows, gc_clock::now()))
+            .produces(scanned.front())
+            .produces_end_of_stream();
+        BOOST_REQUIRE(tracker.protected_partitions() == 10);
+
+        // Eviction takes the scanned partitions first.
+        logalloc::shard_tracker().reclaim(1);
+        BOOST_REQUIRE(tracker.partitions() < 110);
+        BOOST_REQUIRE(tracker.protected_partitions() == 10);
+    });
+}
+
+SEASTAR_TEST_CASE(test_update_invalidates_concurrent_population) {
+    return seastar::async([] {
+        auto s = make_schema();
+        auto m1 = make_new_mutation(s);
+        auto m2 = make_new_mutation(s);
+
+        cache_tracker tracker;
+        row_cache cache(s, [m1] (const query::partition_range&) {
+            return make_reader_returning(m1);
+        }, tracker);
+
+        // The reader misses, and looks at the underlying source as it was
+        // before the memtable got flushed.
+        auto rd = cache.make_reader(query::partition_range::make_singular(m1.decorated_key()));
+
+        auto mt = make_lw_shared<memtable>(s);
+        mt->apply(m2);
+        cache.update(*mt, [] (auto&& key) {
+            return partition_presence_checker_result::definitely_doesnt_exist;
+        }).get();
+        BOOST_REQUIRE(tracker.update_slices() > 0);
+        BOOST_REQUIRE_EQUAL(cache.num_entries(), 1);
+
+        assert_that(std::move(rd))
+            .produces(m1)
+            .produces_end_of_stream();
+        BOOST_REQUIRE_EQUAL(cache.num_entries(), 1);
+
+        verify_has(cache, m1);
+        BOOST_REQUIRE_EQUAL(cache.num_entries(), 2);
+    });
+}
+
+SEASTAR_TEST_CASE(test_absent_partitions_are_cached) {
+    return seastar::async([] {
+        auto s = make_schema();
+        auto m = make_new_mutation(s);
+        auto range = query::partition_range::make_singular(m.decorated_key());
+
+        int underlying_reads = 0;
+        cache_tracker tracker;
+        row_cache cache(s, [&underlying_reads] (const query::partition_range&) {
+            ++underlying_reads;
+            return make_empty_reader();
+        }, tracker);
+
+        assert_that(cache.make_reader(range)).produces_end_of_stream();
+        BOOST_REQUIRE_EQUAL(underlying_reads, 1);
+        BOOST_REQUIRE_EQUAL(cache.num_entries(), 1);
+
+        assert_that(cache.make_reader(range)).produces_end_of_stream();
+        BOOST_REQUIRE_EQUAL(underlying_reads, 1);
+        BOOST_REQUIRE_EQUAL(tracker.negative_hits(), 1);
+
+        // The partition shows up when a memtable holding it gets flushed.
+        auto mt = make_lw_shared<memtable>(s);
+        mt->apply(m);
+        cache.update(*mt, [] (auto&& key) {
+            return partition_presence_checker_result::maybe_exists;
+        }).get();
+
+        assert_that(cache.make_reader(range))
+            .produces(m)
+            .produces_end_of_stream();
+        BOOST_REQUIRE_EQUAL(underlying_reads, 1);
+        BOOST_REQUIRE_EQUAL(tracker.negative_hits(), 1);
+    });
+}
+
+SEASTAR_TEST_CASE(test_keys_of_cached_partitions) {
+    return seastar::async([] {
+        auto s = make_schema();
+        auto hot = make_new_mutation(s);
+        auto cold = make_new_mutation(s);
+        auto missing = make_new_mutation(s);
+
+        auto mt = make_lw_shared<memtable>(s);
+        mt->apply(hot);
+        mt->apply(cold);
+
+        cache_tracker tracker;
+        row_cache cache(s, mt->as_data_source(), tracker);
+        for (auto&& m : { hot, cold }) {
+            auto range = query::partition_range::make_singular(m.decorated_key());
+            assert_that(cache.make_reader(range))
+                .produces(m)
+                .produces_end_of_stream();
+        }
+        auto missing_range = query::partition_range::make_singular(missing.decorated_key());
+        assert_that(cache.make_reader(missing_range)).produces_end_of_stream();
+        BOOST_REQUIRE_EQUAL(cache.num_entries(), 3);
+        cache.touch(hot.decorated_key());
+
+        auto protected_keys = cache.keys(true);
+        BOOST_REQUIRE_EQUAL(protected_keys.size(), 1);
+        BOOST_REQUIRE(protected_keys[0].equal(*s, hot.key()));
+
+        // Absent partitions aren't worth saving.
+        auto other_keys = cache.keys(false);
+        BOOST_REQUIRE_EQUAL(other_keys.size(), 1);
+        BOOST_REQUIRE(other_keys[0].equal(*s, cold.key()));
+    });
+}
+
+SEASTAR_TEST_CASE(test_saved_cache_keys_round_trip) {
+    return seastar::async([] {
+        using saved_key = db::saved_caches_manager::saved_key;
+        std::vector<saved_key> keys = {
+            { utils::make_random_uuid(), to_bytes(sstring("key1")) },
+            { utils::make_random_uuid(), bytes() },
+        };
+        auto data = db::saved_caches_manager::serialize(keys);
+        auto loaded = db::saved_caches_manager::deserialize(data);
+        BOOST_REQUIRE_EQUAL(loaded.size(), keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            BOOST_REQUIRE(loaded[i].cf_id == keys[i].cf_id);
+            BOOST_REQUIRE(loaded[i].key == keys[i].key);
+        }
+
+        db::cache_hot_keys hot{keys};
+        bytes buf(bytes::initialized_later(), hot.serialized_size());
+        auto out = buf.begin();
+        hot.serialize(out);
+        BOOST_REQUIRE(out == buf.end());
+        bytes_view in(buf);
+        BOOST_REQUIRE_EQUAL(db::cache_hot_keys::deserialize(in).keys.size(), keys.size());
+        BOOST_REQUIRE(in.empty());
+
+        // A truncated file still yields the keys before the truncation.
+        data.resize(data.size() - 1);
+        BOOST_REQUIRE_EQUAL(db::saved_caches_manager::deserialize(data).size(), 1);
+        BOOST_REQUIRE(db::saved_caches_manager::deserialize(bytes()).empty());
+    });
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+#include <string>
+
+#include "utils/space_saving.hh"
+
+BOOST_AUTO_TEST_CASE(test_space_saving_counts_exactly_within_capacity) {
+    utils::space_saving<int> ss(10);
+    for (int i = 0; i < 10; ++i) {
+        for (int j = 0; j <= i; ++j) {
+            ss.add(i);
+        }
+    }
+    auto top = ss.top(3);
+    BOOST_REQUIRE_EQUAL(top.size(), 3);
+    for (int i = 0; i < 3; ++i) {
+        BOOST_REQUIRE_EQUAL(top[i].key, 9 - i);
+        BOOST_REQUIRE_EQUAL(top[i].count, 10 - i);
+        BOOST_REQUIRE_EQUAL(top[i].error, 0);
+    }
+    BOOST_REQUIRE_EQUAL(ss.top(100).size(), 10);
+}
+
+BOOST_AUTO_TEST_CASE(test_space_saving_finds_hot_keys) {
+    utils::space_saving<std::string> ss(20);
+    std::default_random_engine random;
+    std::uniform_int_distribution<int> cold(0, 100000);
+    for (int i = 0; i < 100000; ++i) {
+        if (i % 5 == 0) {
+            ss.add("hot");
+        } else if (i % 11 == 0) {
+            ss.add("warm");
+        } else {
+            ss.add(std::to_string(cold(random)));
+        }
+    }
+    auto top = ss.top(2);
+    BOOST_REQUIRE_EQUAL(top[0].key, "hot");
+    BOOST_REQUIRE_EQUAL(top[1].key, "warm");
+    // Counts are never underestimated, and overestimated by error at most.
+    BOOST_REQUIRE_GE(top[0].count, 20000);
+    BOOST_REQUIRE_LE(top[0].count - top[0].error, 20000);
+}
@@ -32,10 +32,17 @@
 #include "database.hh"
 #include "sstables/leveled_manifest.hh"
 #include <memory>
+#include <boost/range/adaptor/map.hpp>
 #include "sstable_test.hh"
 #include "core/seastar.hh"
 #include "core/do_with.hh"
 #include "utils/compaction_manager.hh"
+#include "utils/compaction_throttle.hh"
+#include "utils/io_queue.hh"
+#include "utils/cpu_scheduler.hh"
+#include "db/index_summary_manager.hh"
+#include "db/data_directories.hh"
+#include "sstables/key_cache.hh"
 #include "tmpdir.hh"
 #include "dht/i_partitioner.hh"
 #include "range.hh"
@@ -907,6 +914,10 @@ SEASTAR_TEST_CASE(datafile_generation_15) {
     return sstable_compression_test(compressor::deflate, 15);
 }
 
+SEASTAR_TEST_CASE(datafile_zstd_compression) {
+    return sstable_compression_test(compressor::zstd, 15);
+}
+
 SEASTAR_TEST_CASE(datafile_generation_16) {
     return test_setup::do_with_test_directory([] {
         auto s = uncompressed_schema();
@@ -1568,6 +1579,239 @@ SEASTAR_TEST_CASE(datafile_generation_47) {
     });
 }
 
+SEASTAR_TEST_CASE(datafile_generation_48) {
+    // A wide partition is flushed in pieces and gets a promoted index.
+    return test_setup::do_with_test_directory([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        auto mt = make_lw_shared<memtable>(s);
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        mutation m(key, s);
+        for (int i = 0; i < 1000; i++) {
+            auto c_key = clustering_key::from_exploded(*s, {to_bytes(sprint("c%04d", i))});
+            m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(i)));
+        }
+        mt->apply(std::move(m));
+
+        auto old_options = default_write_options();
+        default_write_options().column_index_size = 1024;
+        default_write_options().flush_buffer_size = 4096;
+
+        auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 48, la, big);
+        return sst->write_components(*mt).finally([old_options] {
+            default_write_options() = old_options;
+        }).then([s] {
+            return reusable_sst("tests/sstables/tests-temporary", 48).then([s] (auto sstp) {
+                return sstables::test(sstp).read_indexes(0).then([sstp, s] (index_list indexes) {
+                    BOOST_REQUIRE(indexes.size() == 1);
+                    BOOST_REQUIRE(indexes[0].get_promoted_index_bytes().size() > 0);
+                    return do_with(sstables::key("key1"), [sstp, s] (auto& key) {
+                        return sstp->read_row(s, key).then([sstp, s] (auto mutation) {
+                            auto& mp = mutation->partition();
+                            BOOST_REQUIRE(mp.clustered_rows().size() == 1000);
+                            for (int i : { 0, 499, 999 }) {
+                                auto c_key = clustering_key::from_exploded(*s, {to_bytes(sprint("c%04d", i))});
+                                match_live_cell(mp.clustered_row(c_key).cells(), *s, "r1", boost::any(i));
+                            }
+                        });
+                    });
+                });
+            });
+        }).then([sst, mt] {});
+    });
+}
+
+SEASTAR_TEST_CASE(datafile_generation_49) {
+    // A slice of a wide partition is read from the blocks of its promoted
+    // index which may hold it, and from its first block.
+    return test_setup::do_with_test_directory([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        auto mt = make_lw_shared<memtable>(s);
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        mutation m(key, s);
+        for (int i = 0; i < 1000; i++) {
+            auto c_key = clustering_key::from_exploded(*s, {to_bytes(sprint("c%04d", i))});
+            m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(i)));
+        }
+        mt->apply(std::move(m));
+
+        auto old_options = default_write_options();
+        default_write_options().column_index_size = 1024;
+
+        auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 49, la, big);
+        return sst->write_components(*mt).finally([old_options] {
+            default_write_options() = old_options;
+        }).then([s] {
+            return reusable_sst("tests/sstables/tests-temporary", 49).then([s] (auto sstp) {
+                auto ck = [s] (int i) {
+                    return clustering_key::from_exploded(*s, {to_bytes(sprint("c%04d", i))});
+                };
+                auto prefix = [s] (int i) {
+                    return clustering_key_prefix::from_exploded(*s, {to_bytes(sprint("c%04d", i))});
+                };
+                std::vector<query::clustering_range> ranges = {
+                    query::clustering_range::make(prefix(500), prefix(509)),
+                    query::clustering_range::make_starting_with(prefix(990)),
+                };
+                return do_with(sstables::key("key1"), std::move(ranges), [sstp, s, ck] (auto& key, auto& ranges) {
+                    return sstp->read_row(s, key, ranges).then([sstp, s, ck] (auto mutation) {
+                        auto& mp = mutation->partition();
+                        BOOST_REQUIRE(mp.clustered_rows().size() < 1000);
+                        for (int i : { 0, 500, 505, 509, 990, 999 }) {
+                            match_live_cell(mp.clustered_row(ck(i)).cells(), *s, "r1", boost::any(i));
+                        }
+                        BOOST_REQUIRE(!mp.find_row(ck(750)));
+                    });
+                });
+            });
+        }).then([sst, mt] {});
+    });
+}
+
+SEASTAR_TEST_CASE(datafile_generation_50) {
+    // A wide partition split over two sstables is read back in pieces of
+    // bounded size, its rows merged in order.
+    return test_setup::do_with_test_directory([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        auto mt1 = make_lw_shared<memtable>(s);
+        auto mt2 = make_lw_shared<memtable>(s);
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        mutation m1(key, s);
+        mutation m2(key, s);
+        for (int i = 0; i < 1000; i++) {
+            auto c_key = clustering_key::from_exploded(*s, {to_bytes(sprint("c%04d", i))});
+            (i % 2 ? m2 : m1).set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(i)));
+        }
+        mt1->apply(std::move(m1));
+        mt2->apply(std::move(m2));
+        mutation m3(partition_key::from_exploded(*s, {to_bytes("key2")}), s);
+        m3.set_clustered_cell(clustering_key::from_exploded(*s, {to_bytes("c0000")}), r1_col, make_atomic_cell(int32_type->decompose(0)));
+        mt2->apply(std::move(m3));
+
+        auto sst1 = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 50, la, big);
+        auto sst2 = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 51, la, big);
+        return sst1->write_components(*mt1).then([sst2, mt2] {
+            return sst2->write_components(*mt2);
+        }).then([s] {
+            return reusable_sst("tests/sstables/tests-temporary", 50).then([s] (auto sstp1) {
+                return reusable_sst("tests/sstables/tests-temporary", 51).then([s, sstp1] (auto sstp2) {
+                    std::vector<std::unique_ptr<partition_source>> sources;
+                    sources.push_back(sstp1->read_rows_in_pieces(s, 1024));
+                    sources.push_back(sstp2->read_rows_in_pieces(s, 1024));
+                    struct state {
+                        std::unique_ptr<partition_source> source;
+                        bool in_partition = false;
+                        std::experimental::optional<clustering_key> last;
+                        size_t partitions = 0;
+                        size_t pieces = 0;
+                        size_t rows = 0;
+                    };
+                    auto st = make_lw_shared<state>();
+                    st->source = make_combined_partition_source(s, std::move(sources));
+                    auto add_piece = [s, st] (const mutation& m) {
+                        st->pieces++;
+                        for (auto&& e : m.partition().clustered_rows()) {
+                            if (st->last) {
+                                BOOST_REQUIRE(clustering_key::less_compare(*s)(*st->last, e.key()));
+                            }
+                            st->last = e.key();
+                            st->rows++;
+                        }
+                    };
+                    return repeat([st, add_piece] {
+                        if (st->in_partition) {
+                            return st->source->next_rows().then([st, add_piece] (mutation_opt m) {
+                                if (m) {
+                                    add_piece(*m);
+                                } else {
+                                    st->in_partition = false;
+                                }
+                                return stop_iteration::no;
+                            });
+                        }
+                        return st->source->next_partition().then([st, add_piece] (mutation_opt m) {
+                            if (!m) {
+                                return stop_iteration::yes;
+                            }
+                            st->partitions++;
+                            st->in_partition = true;
+                            st->last = {};
+                            add_piece(*m);
+                            return stop_iteration::no;
+                        });
+                    }).then([st, sstp1, sstp2] {
+                        BOOST_REQUIRE_EQUAL(st->partitions, 2);
+                        BOOST_REQUIRE_EQUAL(st->rows, 1001);
+                        BOOST_REQUIRE(st->pieces > 2);
+                    });
+                });
+            });
+        }).then([sst1, sst2, mt1, mt2] {});
+    });
+}
+
+SEASTAR_TEST_CASE(datafile_generation_52) {
+    // The bounds of the clustering components of an sstable tell the
+    // clustering slices it holds no rows of.
+    return test_setup::do_with_test_directory([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}, {"c2", int32_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        auto mt = make_lw_shared<memtable>(s);
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+
+        auto key = partition_key::from_exploded(*s, {to_bytes("key1")});
+        mutation m(key, s);
+        for (int i = 100; i < 200; i++) {
+            auto c_key = clustering_key::from_exploded(*s, {to_bytes(sprint("c%04d", i)), int32_type->decompose(-i)});
+            m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(i)));
+        }
+        mt->apply(std::move(m));
+
+        auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 52, la, big);
+        return sst->write_components(*mt).then([s] {
+            return reusable_sst("tests/sstables/tests-temporary", 52).then([s] (auto sstp) {
+                auto prefix = [s] (int i) {
+                    return clustering_key_prefix::from_exploded(*s, {to_bytes(sprint("c%04d", i))});
+                };
+                auto full = [s] (int i, int j) {
+                    return clustering_key_prefix::from_exploded(*s, {to_bytes(sprint("c%04d", i)), int32_type->decompose(j)});
+                };
+                using range = query::clustering_range;
+                auto may_contain = [s, sstp] (range r) {
+                    return sstp->may_contain_rows(*s, { std::move(r) });
+                };
+                BOOST_REQUIRE(may_contain(range::make_open_ended_both_sides()));
+                BOOST_REQUIRE(may_contain(range::make(prefix(150), prefix(160))));
+                BOOST_REQUIRE(may_contain(range::make(prefix(50), prefix(100))));
+                BOOST_REQUIRE(!may_contain(range::make(prefix(50), prefix(99))));
+                BOOST_REQUIRE(!may_contain(range::make_starting_with(prefix(200))));
+                BOOST_REQUIRE(!may_contain(range::make_ending_with(prefix(99))));
+                // The second component is compared by its type, -199 to -100.
+                BOOST_REQUIRE(may_contain(range::make_singular(full(150, -150))));
+                BOOST_REQUIRE(!may_contain(range::make_singular(full(150, 5))));
+                BOOST_REQUIRE(!may_contain(range::make_singular(full(150, -200))));
+                BOOST_REQUIRE(sstp->may_contain_rows(*s, { range::make(prefix(50), prefix(60)), range::make_singular(prefix(120)) }));
+            });
+        }).then([sst, mt] {});
+    });
+}
+
 // Leveled compaction strategy tests
 
 static dht::token create_token_from_key(sstring key) {
@@ -1887,3 +2131,912 @@ SEASTAR_TEST_CASE(leveled_05) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(leveled_parallel_compactions) {
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
+
+    column_family::config cfg;
+    compaction_manager cm;
+    cfg.enable_disk_writes = false;
+    cfg.enable_commitlog = false;
+    auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+
+    auto key_and_token_pair = token_generation_for_current_shard(50);
+    auto min_key = key_and_token_pair[0].first;
+    auto max_key = key_and_token_pair[key_and_token_pair.size()-1].first;
+
+    auto max_sstable_size_in_mb = 1;
+    auto max_sstable_size_in_bytes = max_sstable_size_in_mb*1024*1024;
+    auto max_bytes_for_l1 = leveled_manifest::max_bytes_for_level(1, max_sstable_size_in_bytes);
+
+    // Two overlapping sstables of level 0, too small to be promoted.
+    add_sstable_for_leveled_test(cf, /*gen*/1, /*data_size*/0, /*level*/0, min_key, key_and_token_pair[10].first);
+    add_sstable_for_leveled_test(cf, /*gen*/2, /*data_size*/0, /*level*/0, min_key, key_and_token_pair[20].first);
+    // Level 1 is three times over its size, each of its sstables overlapping one of level 2.
+    add_sstable_for_leveled_test(cf, /*gen*/3, /*data_size*/max_bytes_for_l1, /*level*/1, key_and_token_pair[30].first, key_and_token_pair[35].first);
+    add_sstable_for_leveled_test(cf, /*gen*/4, /*data_size*/2*max_bytes_for_l1, /*level*/1, key_and_token_pair[40].first, max_key);
+    add_sstable_for_leveled_test(cf, /*gen*/5, /*data_size*/max_sstable_size_in_bytes, /*level*/2, key_and_token_pair[30].first, key_and_token_pair[35].first);
+    add_sstable_for_leveled_test(cf, /*gen*/6, /*data_size*/max_sstable_size_in_bytes, /*level*/2, key_and_token_pair[40].first, max_key);
+
+    BOOST_REQUIRE(sstable_overlaps(cf, 1, 2) == true);
+    BOOST_REQUIRE(sstable_overlaps(cf, 2, 3) == false);
+    BOOST_REQUIRE(sstable_overlaps(cf, 3, 5) == true);
+    BOOST_REQUIRE(sstable_overlaps(cf, 3, 6) == false);
+    BOOST_REQUIRE(sstable_overlaps(cf, 4, 5) == false);
+    BOOST_REQUIRE(sstable_overlaps(cf, 4, 6) == true);
+
+    {
+        leveled_manifest manifest = leveled_manifest::create(*cf, max_sstable_size_in_mb);
+        auto jobs = manifest.get_parallel_compaction_candidates(1);
+        BOOST_REQUIRE(jobs.size() == 1);
+        BOOST_REQUIRE(jobs[0].level == 2);
+    }
+
+    leveled_manifest manifest = leveled_manifest::create(*cf, max_sstable_size_in_mb);
+    auto jobs = manifest.get_parallel_compaction_candidates(4);
+    BOOST_REQUIRE(jobs.size() == 3);
+
+    auto generations = [] (const sstables::compaction_descriptor& job) {
+        std::set<unsigned long> gens;
+        for (auto& sst : job.sstables) {
+            gens.insert(sst->generation());
+        }
+        return gens;
+    };
+    BOOST_REQUIRE(generations(jobs[0]) == std::set<unsigned long>({ 3, 5 }));
+    BOOST_REQUIRE(jobs[0].level == 2);
+    BOOST_REQUIRE(generations(jobs[1]) == std::set<unsigned long>({ 4, 6 }));
+    BOOST_REQUIRE(jobs[1].level == 2);
+    BOOST_REQUIRE(generations(jobs[2]) == std::set<unsigned long>({ 1, 2 }));
+    BOOST_REQUIRE(jobs[2].level == 0);
+
+    // Once a compaction is done, its sstables may be picked again.
+    manifest.unmark_compacting(jobs[2].sstables);
+    auto candidate = manifest.get_compaction_candidates();
+    BOOST_REQUIRE(generations(candidate) == std::set<unsigned long>({ 1, 2 }));
+
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(leveled_stcs_in_l0) {
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
+
+    column_family::config cfg;
+    compaction_manager cm;
+    cfg.enable_disk_writes = false;
+    cfg.enable_commitlog = false;
+    auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+
+    auto key_and_token_pair = token_generation_for_current_shard(50);
+    auto min_key = key_and_token_pair[0].first;
+    auto max_key = key_and_token_pair[key_and_token_pair.size()-1].first;
+
+    auto max_sstable_size_in_mb = 1;
+    auto max_sstable_size_in_bytes = max_sstable_size_in_mb*1024*1024;
+    auto max_bytes_for_l1 = leveled_manifest::max_bytes_for_level(1, max_sstable_size_in_bytes);
+
+    // More sstables in level 0 than can be compacted at once into level 1,
+    // while level 1 is over its size.
+    for (auto gen = 1; gen <= 33; gen++) {
+        add_sstable_for_leveled_test(cf, gen, /*data_size*/max_sstable_size_in_bytes, /*level*/0, min_key, max_key);
+    }
+    add_sstable_for_leveled_test(cf, /*gen*/34, /*data_size*/2*max_bytes_for_l1, /*level*/1, min_key, max_key);
+
+    // Level 0 is size-tiered first, into level 0.
+    leveled_manifest manifest = leveled_manifest::create(*cf, max_sstable_size_in_mb);
+    auto candidate = manifest.get_compaction_candidates();
+    BOOST_REQUIRE(candidate.sstables.size() == 32);
+    BOOST_REQUIRE(candidate.level == 0);
+    for (auto& sst : candidate.sstables) {
+        BOOST_REQUIRE(sst->get_sstable_level() == 0);
+    }
+
+    return make_ready_future<>();
+}
+
+static shared_sstable make_sstable_for_date_tiered_test(unsigned long gen, int64_t min_timestamp, int64_t max_timestamp,
+                                                        uint32_t max_local_deletion_time = std::numeric_limits<int32_t>::max()) {
+    auto sst = make_lw_shared<sstable>("ks", "cf", "", gen, la, big);
+    sstables::test(sst).set_values_for_date_tiered_strategy(/*data_size*/1, min_timestamp, max_timestamp, max_local_deletion_time);
+    return sst;
+}
+
+SEASTAR_TEST_CASE(date_tiered_strategy_buckets) {
+    // One minute in microseconds, the default base time of the strategy.
+    const int64_t minute = 60 * 1000000L;
+    const int64_t now = 1000 * minute + minute / 2;
+
+    // Four sstables in the incoming window are enough to be compacted together.
+    {
+        std::vector<shared_sstable> ssts;
+        for (auto gen = 1; gen <= 4; gen++) {
+            ssts.push_back(make_sstable_for_date_tiered_test(gen, now - gen, now - gen + 1));
+        }
+        auto candidates = create_sstable_list(ssts);
+        auto bucket = date_tiered_most_interesting_bucket(candidates, {});
+        BOOST_REQUIRE(bucket.size() == 4);
+    }
+
+    // Two sstables in the incoming window aren't, but two in an older window are.
+    {
+        std::vector<shared_sstable> ssts;
+        ssts.push_back(make_sstable_for_date_tiered_test(1, now - 1, now));
+        ssts.push_back(make_sstable_for_date_tiered_test(2, now - 2, now - 1));
+        ssts.push_back(make_sstable_for_date_tiered_test(3, now - 2 * minute, now - 2 * minute + 1));
+        ssts.push_back(make_sstable_for_date_tiered_test(4, now - 2 * minute, now - 2 * minute + 2));
+        auto candidates = create_sstable_list(ssts);
+        auto bucket = date_tiered_most_interesting_bucket(candidates, {});
+        BOOST_REQUIRE(bucket.size() == 2);
+        std::set<unsigned long> generations = { 3, 4 };
+        for (auto& sst : bucket) {
+            BOOST_REQUIRE(generations.erase(sst->generation()) == 1);
+        }
+    }
+
+    // Sstables older than max_sstable_age_days are never compacted again.
+    {
+        const int64_t day = 24 * 60 * minute;
+        std::vector<shared_sstable> ssts;
+        ssts.push_back(make_sstable_for_date_tiered_test(1, now + 10 * day, now + 10 * day));
+        ssts.push_back(make_sstable_for_date_tiered_test(2, now - 2, now - 1));
+        ssts.push_back(make_sstable_for_date_tiered_test(3, now - 2, now));
+        auto candidates = create_sstable_list(ssts);
+        auto bucket = date_tiered_most_interesting_bucket(candidates, {{ "max_sstable_age_days", "1" }});
+        BOOST_REQUIRE(bucket.empty());
+        bucket = date_tiered_most_interesting_bucket(candidates, {});
+        BOOST_REQUIRE(bucket.size() == 2);
+    }
+
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(fully_expired_sstables) {
+    auto gc_before = gc_clock::time_point(gc_clock::duration(1000));
+
+    std::vector<shared_sstable> ssts;
+    // expired, and newer than any live data which could be shadowed by it.
+    ssts.push_back(make_sstable_for_date_tiered_test(1, 200, 300, 500));
+    // expired, but may shadow data of sstable 4.
+    ssts.push_back(make_sstable_for_date_tiered_test(2, 450, 550, 500));
+    // not yet purgeable.
+    ssts.push_back(make_sstable_for_date_tiered_test(3, 600, 700, 2000));
+    // live data.
+    ssts.push_back(make_sstable_for_date_tiered_test(4, 500, 800));
+
+    auto expired = get_fully_expired_sstables(*create_sstable_list(ssts), gc_before, api::max_timestamp);
+    BOOST_REQUIRE(expired.size() == 1);
+    BOOST_REQUIRE(expired.front()->generation() == 1);
+
+    // Data as old in a memtable may be shadowed by it as well.
+    expired = get_fully_expired_sstables(*create_sstable_list(ssts), gc_before, 250);
+    BOOST_REQUIRE(expired.empty());
+
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(gc_before_of_tables_with_only_ttl_deletes) {
+    auto now = gc_clock::now();
+    auto s = schema_builder(some_keyspace, some_column_family)
+        .with_column("p1", utf8_type, column_kind::partition_key)
+        .with_column("r1", int32_type)
+        .build();
+    BOOST_REQUIRE(get_gc_before(*s, now) == now - s->gc_grace_seconds());
+
+    schema_builder builder(s);
+    builder.set_compaction_strategy_options({{"only_ttl_deletes", "true"}});
+    BOOST_REQUIRE(get_gc_before(*builder.build(), now) == now);
+
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(tombstone_compaction_candidates) {
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {}, {}, {}, utf8_type));
+    auto now = gc_clock::now();
+    auto day = std::chrono::duration_cast<gc_clock::duration>(std::chrono::hours(24));
+    uint32_t deleted = (now - s->gc_grace_seconds() - day).time_since_epoch().count();
+    auto written = now - 2 * day;
+    auto keys = token_generation_for_current_shard(10);
+
+    auto make_sst = [&] (unsigned long gen, unsigned first, unsigned last, int64_t min_timestamp, int64_t max_timestamp,
+            uint64_t tombstones, uint32_t deletion_time, gc_clock::time_point write_time) {
+        auto sst = make_lw_shared<sstable>("ks", "cf", "", gen, la, big);
+        sstables::test(sst).set_values_for_tombstone_compaction(keys[first].first, keys[last].first,
+            min_timestamp, max_timestamp, 100, tombstones, deletion_time, write_time);
+        return sst;
+    };
+
+    // Mostly droppable tombstones, and no other sstable.
+    {
+        std::vector<shared_sstable> ssts;
+        ssts.push_back(make_sst(1, 0, 9, 100, 200, 90, deleted, written));
+        BOOST_REQUIRE(ssts[0]->estimate_droppable_tombstone_ratio(get_gc_before(*s, now)) > 0.5);
+        auto candidate = get_tombstone_compaction_candidate(*s, *create_sstable_list(ssts), {}, now);
+        BOOST_REQUIRE(candidate && candidate->generation() == 1);
+        // Unless the threshold is above the ratio.
+        candidate = get_tombstone_compaction_candidate(*s, *create_sstable_list(ssts), {{"tombstone_threshold", "0.95"}}, now);
+        BOOST_REQUIRE(!candidate);
+    }
+
+    // Too few tombstones, tombstones not yet droppable, or written too recently.
+    {
+        std::vector<shared_sstable> ssts;
+        ssts.push_back(make_sst(1, 0, 1, 100, 200, 10, deleted, written));
+        ssts.push_back(make_sst(2, 2, 3, 100, 200, 90, now.time_since_epoch().count(), written));
+        ssts.push_back(make_sst(3, 4, 5, 100, 200, 90, deleted, now));
+        BOOST_REQUIRE(!get_tombstone_compaction_candidate(*s, *create_sstable_list(ssts), {}, now));
+        BOOST_REQUIRE(get_tombstone_compaction_candidate(*s, *create_sstable_list(ssts),
+            {{"tombstone_compaction_interval", "0"}}, now)->generation() == 3);
+    }
+
+    // Older data overlapping the tombstones keeps them from being purged,
+    // unless the check is disabled. Older data elsewhere and newer data don't.
+    {
+        std::vector<shared_sstable> ssts;
+        ssts.push_back(make_sst(1, 0, 5, 100, 200, 90, deleted, written));
+        ssts.push_back(make_sst(2, 4, 9, 50, 60, 0, deleted, written));
+        BOOST_REQUIRE(!get_tombstone_compaction_candidate(*s, *create_sstable_list(ssts), {}, now));
+        BOOST_REQUIRE(get_tombstone_compaction_candidate(*s, *create_sstable_list(ssts),
+            {{"unchecked_tombstone_compaction", "true"}}, now)->generation() == 1);
+
+        ssts.push_back(make_sst(3, 6, 9, 10, 20, 0, deleted, written));
+        ssts[1] = make_sst(2, 4, 9, 300, 400, 0, deleted, written);
+        BOOST_REQUIRE(get_tombstone_compaction_candidate(*s, *create_sstable_list(ssts), {}, now)->generation() == 1);
+    }
+
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(parallel_major_compaction) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        compaction_manager cm;
+        cm.set_major_compaction_parallelism(4);
+        auto tmp = make_lw_shared<tmpdir>();
+        column_family::config cfg;
+        cfg.datadir = tmp->path;
+        cfg.enable_commitlog = false;
+        auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto c_key = clustering_key::from_exploded(*s, {to_bytes("abc")});
+        auto keys = token_generation_for_current_shard(64);
+
+        // Every sstable spans the whole token range of the keys.
+        for (unsigned long generation = 1; generation <= 4; generation++) {
+            auto mt = make_lw_shared<memtable>(s);
+            for (auto i = generation - 1; i < keys.size(); i += 4) {
+                mutation m(partition_key::from_exploded(*s, {to_bytes(keys[i].first)}), s);
+                m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(int32_t(i))));
+                mt->apply(std::move(m));
+            }
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            column_family_test(cf).add_sstable(std::move(*sst));
+        }
+
+        cf->compact_all_sstables().get();
+
+        auto sstables = cf->get_sstables();
+        BOOST_REQUIRE(sstables->size() > 1);
+        BOOST_REQUIRE(sstables->size() <= 4);
+
+        // Output sstables of disjoint sub-ranges must not overlap.
+        for (auto& a : *sstables) {
+            for (auto& b : *sstables) {
+                if (a.first < b.first) {
+                    BOOST_REQUIRE(!sstable_overlaps(cf, a.first, b.first));
+                }
+            }
+        }
+
+        unsigned partitions = 0;
+        for (auto& entry : *sstables) {
+            auto reader = sstable_reader(entry.second, s);
+            while (reader().get0()) {
+                partitions++;
+            }
+        }
+        BOOST_REQUIRE(partitions == keys.size());
+    });
+}
+
+SEASTAR_TEST_CASE(incremental_compaction_releases_inputs) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        compaction_manager cm;
+        auto tmp = make_lw_shared<tmpdir>();
+        column_family::config cfg;
+        cfg.datadir = tmp->path;
+        cfg.enable_commitlog = false;
+        auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto c_key = clustering_key::from_exploded(*s, {to_bytes("abc")});
+        auto keys = token_generation_for_current_shard(64);
+
+        // Writes the keys of [first, last), stepping by step, at the given timestamp.
+        auto make_input = [&] (unsigned long generation, size_t first, size_t last, size_t step, api::timestamp_type ts) {
+            auto mt = make_lw_shared<memtable>(s);
+            for (auto i = first; i < last; i += step) {
+                mutation m(partition_key::from_exploded(*s, {to_bytes(keys[i].first)}), s);
+                m.set_clustered_cell(c_key, r1_col, atomic_cell::make_live(ts, int32_type->decompose(int32_t(i))));
+                mt->apply(std::move(m));
+            }
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            return sst;
+        };
+
+        // Compacts into an sstable per partition, returning the generations of
+        // the inputs released before the compaction completed.
+        unsigned long next_generation = 100;
+        auto compact = [&] (std::vector<shared_sstable> inputs) {
+            std::set<unsigned long> released;
+            auto new_sstable = [&] {
+                return make_lw_shared<sstable>("ks", "cf", tmp->path, next_generation++, la, big);
+            };
+            auto replacer = [&] (std::vector<shared_sstable> sealed, std::vector<shared_sstable> ssts) {
+                BOOST_REQUIRE(!sealed.empty());
+                for (auto& sst : ssts) {
+                    BOOST_REQUIRE(released.insert(sst->generation()).second);
+                }
+            };
+            sstables::compact_sstables(std::move(inputs), *cf, new_sstable, 1, 0, query::full_partition_range, replacer).get();
+            return released;
+        };
+
+        // Inputs of disjoint ranges are released as soon as they are covered,
+        // but for the last one, which is replaced once the compaction completes.
+        std::vector<shared_sstable> inputs;
+        for (unsigned long generation = 1; generation <= 4; generation++) {
+            inputs.push_back(make_input(generation, (generation - 1) * 16, generation * 16, 1, generation));
+        }
+        BOOST_REQUIRE(compact(inputs) == std::set<unsigned long>({ 1, 2, 3 }));
+
+        // An input spanning all the others, holding older data, must stay
+        // until the end, for it may hold data shadowed by tombstones purged
+        // from them. Newer, it doesn't hold them back.
+        inputs.push_back(make_input(5, 0, keys.size(), 3, 0));
+        BOOST_REQUIRE(compact(inputs).empty());
+        inputs.back() = make_input(6, 0, keys.size(), 3, 10);
+        BOOST_REQUIRE(compact(inputs) == std::set<unsigned long>({ 1, 2, 3 }));
+    });
+}
+
+SEASTAR_TEST_CASE(compaction_merges_partitions_read_in_pieces) {
+    // The inputs are read ahead in fibers of their own, piece by piece,
+    // and the pieces of the same partition merged as they come.
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        compaction_manager cm;
+        auto tmp = make_lw_shared<tmpdir>();
+        column_family::config cfg;
+        cfg.datadir = tmp->path;
+        cfg.enable_commitlog = false;
+        auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto ck = [s] (int i) {
+            return clustering_key::from_exploded(*s, {to_bytes(sprint("c%04d", i))});
+        };
+        auto keys = token_generation_for_current_shard(16);
+        auto wide_key = partition_key::from_exploded(*s, {to_bytes(keys[0].first)});
+        const int rows = 600;
+
+        // Each input holds a third of the rows of the wide partition, its
+        // own version of its first row, and a third of the other partitions.
+        std::vector<shared_sstable> inputs;
+        for (unsigned long generation = 1; generation <= 3; generation++) {
+            auto ts = api::timestamp_type(generation);
+            auto mt = make_lw_shared<memtable>(s);
+            mutation wide(wide_key, s);
+            wide.set_clustered_cell(ck(0), r1_col, atomic_cell::make_live(ts, int32_type->decompose(int32_t(generation))));
+            for (int i = generation; i < rows; i += 3) {
+                wide.set_clustered_cell(ck(i), r1_col, atomic_cell::make_live(ts, int32_type->decompose(int32_t(i))));
+            }
+            mt->apply(std::move(wide));
+            for (auto i = generation; i < keys.size(); i += 3) {
+                mutation m(partition_key::from_exploded(*s, {to_bytes(keys[i].first)}), s);
+                m.set_clustered_cell(ck(0), r1_col, atomic_cell::make_live(ts, int32_type->decompose(int32_t(i))));
+                mt->apply(std::move(m));
+            }
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            inputs.push_back(sst);
+        }
+
+        // Small pieces, so that the wide partition takes many of them.
+        auto old_options = default_write_options();
+        default_write_options().flush_buffer_size = 1024;
+        auto output = make_lw_shared<sstable>("ks", "cf", tmp->path, 10, la, big);
+        auto compacted = sstables::compact_sstables(inputs, *cf, [output] { return output; },
+                std::numeric_limits<uint64_t>::max(), 0);
+        compacted.finally([old_options] {
+            default_write_options() = old_options;
+        }).get();
+
+        auto reader = sstable_reader(output, s);
+        unsigned partitions = 0;
+        while (auto m = reader().get0()) {
+            partitions++;
+            if (!m->key().equal(*s, wide_key)) {
+                continue;
+            }
+            auto& mp = m->partition();
+            BOOST_REQUIRE_EQUAL(mp.clustered_rows().size(), rows);
+            // The newest version of the first row wins.
+            match_live_cell(mp.clustered_row(ck(0)).cells(), *s, "r1", boost::any(int32_t(3)));
+            int expected = 0;
+            for (auto& row : mp.clustered_rows()) {
+                BOOST_REQUIRE(row.key().equal(*s, ck(expected++)));
+            }
+            for (int i : { 1, 2, 3, 299, 599 }) {
+                match_live_cell(mp.clustered_row(ck(i)).cells(), *s, "r1", boost::any(int32_t(i)));
+            }
+        }
+        BOOST_REQUIRE_EQUAL(partitions, keys.size());
+    });
+}
+
+SEASTAR_TEST_CASE(compaction_throttle_limits_rate) {
+    return seastar::async([] {
+        compaction_throttle throttle;
+        throttle.set_bytes_per_second(1 << 20);
+        auto start = compaction_throttle::clock::now();
+        // The first chunk goes through right away, each of the following
+        // three waits for the previous one, ~98ms each at 1MB/s.
+        for (int i = 0; i < 4; i++) {
+            throttle.throttle(100 << 10).get();
+        }
+        auto elapsed = compaction_throttle::clock::now() - start;
+        BOOST_REQUIRE(elapsed >= std::chrono::milliseconds(280));
+
+        // Unthrottled.
+        throttle.set_bytes_per_second(0);
+        start = compaction_throttle::clock::now();
+        for (int i = 0; i < 4; i++) {
+            throttle.throttle(100 << 10).get();
+        }
+        BOOST_REQUIRE(compaction_throttle::clock::now() - start < std::chrono::milliseconds(50));
+    });
+}
+
+SEASTAR_TEST_CASE(compaction_throttle_stop_ends_sleeps) {
+    return seastar::async([] {
+        compaction_throttle throttle;
+        throttle.set_bytes_per_second(1 << 10);
+        auto start = compaction_throttle::clock::now();
+        // The second call owes a whole second, the third two more.
+        throttle.throttle(1 << 10).get();
+        auto second = throttle.throttle(1 << 10);
+        auto third = throttle.throttle(2 << 10);
+        BOOST_REQUIRE(!second.available());
+        throttle.stop();
+        second.get();
+        third.get();
+        throttle.throttle(1 << 20).get();
+        BOOST_REQUIRE(compaction_throttle::clock::now() - start < std::chrono::milliseconds(500));
+    });
+}
+
+SEASTAR_TEST_CASE(io_queue_shares) {
+    return seastar::async([] {
+        io_queue queue(1);
+        auto low = queue.register_priority_class("low", 100);
+        auto high = queue.register_priority_class("high", 300);
+
+        // Holds the only slot while both classes queue up.
+        promise<> unblock;
+        auto blocker = queue.queue_request(low, 0, [&unblock] {
+            return unblock.get_future();
+        });
+        std::vector<unsigned> order;
+        std::vector<future<>> done;
+        for (int i = 0; i < 4; i++) {
+            for (auto pc : { low, high }) {
+                done.push_back(queue.queue_request(pc, 0, [&order, pc] {
+                    order.push_back(pc.id());
+                    return make_ready_future<>();
+                }));
+            }
+        }
+        BOOST_REQUIRE_EQUAL(queue.outstanding(), 1);
+        BOOST_REQUIRE_EQUAL(queue.get_stats(low).queued, 4);
+        BOOST_REQUIRE_EQUAL(queue.get_stats(high).queued, 4);
+
+        unblock.set_value();
+        blocker.get();
+        when_all(done.begin(), done.end()).get();
+        BOOST_REQUIRE_EQUAL(order.size(), 8);
+        // Three times the shares, about three times the requests.
+        BOOST_REQUIRE(std::count(order.begin(), order.begin() + 4, high.id()) >= 3);
+        BOOST_REQUIRE_EQUAL(queue.outstanding(), 0);
+        BOOST_REQUIRE_EQUAL(queue.get_stats(low).requests, 5);
+        BOOST_REQUIRE_EQUAL(queue.get_stats(high).requests, 4);
+    });
+}
+
+SEASTAR_TEST_CASE(cpu_scheduler_shares) {
+    return seastar::async([] {
+        cpu_scheduler scheduler;
+        auto background = scheduler.register_group("background", 100);
+        auto ran = std::chrono::milliseconds(1);
+
+        // With nothing in the foreground, background work runs freely.
+        scheduler.yield(background, ran).get();
+        BOOST_REQUIRE_EQUAL(scheduler.get_stats(background).slices, 1);
+        BOOST_REQUIRE_EQUAL(scheduler.get_stats(background).deferred_ns, 0);
+
+        // Statements have ten times the shares, so a millisecond of
+        // background work is paid for with ten of sleep while they run.
+        {
+            auto fg = scheduler.start_foreground();
+            BOOST_REQUIRE(scheduler.foreground_busy());
+            scheduler.yield(background, ran).get();
+        }
+        BOOST_REQUIRE(!scheduler.foreground_busy());
+        BOOST_REQUIRE(scheduler.get_stats(background).deferred_ns >= 10000000);
+
+        // The sleep ends as soon as the foreground goes idle.
+        auto fg = std::make_unique<cpu_scheduler::foreground_request>(scheduler.start_foreground());
+        auto f = scheduler.yield(background, std::chrono::seconds(10));
+        sleep(std::chrono::milliseconds(5)).get();
+        fg.reset();
+        auto start = cpu_scheduler::clock::now();
+        f.get();
+        BOOST_REQUIRE(cpu_scheduler::clock::now() - start < std::chrono::seconds(1));
+        BOOST_REQUIRE_EQUAL(scheduler.get_stats(background).runtime_ns, 10002000000ull);
+    });
+}
+
+SEASTAR_TEST_CASE(compaction_throttle_adaptive) {
+    compaction_throttle::foreground_load load;
+    compaction_throttle throttle;
+    throttle.set_bytes_per_second(1 << 20);
+    throttle.set_read_latency_target(std::chrono::milliseconds(10));
+    throttle.set_pending_reads_target(8);
+    throttle.set_load_source([&load] { return load; });
+    throttle.set_adaptive(true);
+
+    auto add_reads = [&load] (int64_t reads, std::chrono::milliseconds latency) {
+        load.sampled_reads += reads;
+        load.read_latency_sum += reads * std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+    };
+
+    // Slow reads halve the rate.
+    add_reads(10, std::chrono::milliseconds(20));
+    throttle.adjust();
+    BOOST_REQUIRE(throttle.factor() == 0.5);
+    BOOST_REQUIRE(throttle.effective_bytes_per_second() == (1 << 19));
+
+    // So do queued reads, even if those which completed were fast.
+    add_reads(10, std::chrono::milliseconds(1));
+    load.pending_reads = 9;
+    throttle.adjust();
+    BOOST_REQUIRE(throttle.factor() == 0.25);
+
+    // Recovery is additive.
+    load.pending_reads = 0;
+    add_reads(10, std::chrono::milliseconds(1));
+    throttle.adjust();
+    BOOST_REQUIRE(throttle.factor() == 0.25 + compaction_throttle::factor_increase);
+
+    // An idle interval counts as healthy.
+    throttle.adjust();
+    BOOST_REQUIRE(throttle.factor() == 0.25 + 2 * compaction_throttle::factor_increase);
+
+    // Backing off is bounded.
+    for (int i = 0; i < 10; i++) {
+        add_reads(10, std::chrono::milliseconds(100));
+        throttle.adjust();
+    }
+    BOOST_REQUIRE(throttle.factor() == compaction_throttle::min_factor);
+
+    for (int i = 0; i < 20; i++) {
+        throttle.adjust();
+    }
+    BOOST_REQUIRE(throttle.factor() == 1.0);
+
+    // Leaving adaptive mode restores the configured rate.
+    add_reads(10, std::chrono::milliseconds(100));
+    throttle.adjust();
+    BOOST_REQUIRE(throttle.factor() == 0.5);
+    throttle.set_adaptive(false);
+    BOOST_REQUIRE(throttle.effective_bytes_per_second() == (1 << 20));
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(resampled_summary_finds_all_partitions) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", int32_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto c_key = clustering_key::from_exploded(*s, {to_bytes("abc")});
+        // Five summary entries, at the min index interval of 128.
+        std::vector<partition_key> keys;
+        auto mt = make_lw_shared<memtable>(s);
+        for (int32_t i = 0; i < 600; i++) {
+            keys.push_back(partition_key::from_exploded(*s, {int32_type->decompose(i)}));
+            mutation m(keys.back(), s);
+            m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(i)));
+            mt->apply(std::move(m));
+        }
+        auto tmp = make_lw_shared<tmpdir>();
+        auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        sst->write_components(*mt).get();
+        sst->load().get();
+
+        auto full_memory = sst->summary_memory();
+        auto verify = [&] (unsigned step, size_t entries) {
+            sst->resample_summary(step).get();
+            BOOST_REQUIRE(sst->summary_downsampling() == step);
+            BOOST_REQUIRE(sstables::test(sst).get_summary().entries.size() == entries);
+            BOOST_REQUIRE(sst->full_summary_memory() == full_memory);
+            BOOST_REQUIRE(step == 1 || sst->summary_memory() < full_memory);
+            // Looked up through the summary, not the key cache.
+            global_key_cache().invalidate(sst->cache_id());
+            sst->take_index_reads();
+            for (auto&& key : keys) {
+                auto m = sst->read_row(s, sstables::key::from_partition_key(*s, key)).get0();
+                BOOST_REQUIRE(m);
+                BOOST_REQUIRE(m->key().equal(*s, key));
+            }
+            BOOST_REQUIRE(sst->take_index_reads() == keys.size());
+        };
+        verify(1, 5);
+        verify(2, 3);
+        // Further downsampled in memory.
+        verify(4, 2);
+        // Read from Summary.db again.
+        verify(3, 2);
+        verify(1, 5);
+    });
+}
+
+SEASTAR_TEST_CASE(index_summaries_redistributed_by_reads) {
+    using sstable_summary = db::index_summary_manager::sstable_summary;
+    auto redistribute = [] (std::vector<sstable_summary> summaries, uint64_t capacity) {
+        db::index_summary_manager::redistribute(summaries, capacity);
+        std::vector<unsigned> steps;
+        for (auto&& s : summaries) {
+            steps.push_back(s.downsampling);
+        }
+        return steps;
+    };
+    // All fit.
+    BOOST_REQUIRE(redistribute({{1000, 0, 16}, {1000, 100, 16}}, 2000) == std::vector<unsigned>({ 1, 1 }));
+    // The hot one keeps its summary, the cold one gives way.
+    BOOST_REQUIRE(redistribute({{1000, 0, 16}, {1000, 1000, 16}}, 1100) == std::vector<unsigned>({ 16, 1 }));
+    // Evenly read, evenly downsampled.
+    BOOST_REQUIRE(redistribute({{1000, 10, 16}, {1000, 10, 16}}, 1000) == std::vector<unsigned>({ 2, 2 }));
+    // No further than the table allows.
+    BOOST_REQUIRE(redistribute({{1000, 0, 4}, {1000, 0, 4}}, 10) == std::vector<unsigned>({ 4, 4 }));
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(sstables_spread_across_data_directories) {
+    return seastar::async([] {
+        tmpdir disk1, disk2;
+        db::data_directories dirs;
+        dirs.add(disk1.path);
+        dirs.add(disk2.path);
+        BOOST_REQUIRE_EQUAL(dirs.size(), 2);
+        auto& queue = local_io_queue(disk2.path + "/ks/cf");
+        BOOST_REQUIRE(&queue != &local_io_queue());
+        BOOST_REQUIRE(&queue != &local_io_queue(disk1.path + "/ks/cf"));
+        BOOST_REQUIRE(&local_io_queue(disk2.path + "_other") == &local_io_queue());
+
+        // On the same file system, the directories have the same free space,
+        // so writes alternate between them.
+        std::vector<sstring> table_dirs = { disk1.path + "/ks/cf", disk2.path + "/ks/cf" };
+        auto& first = dirs.pick(table_dirs);
+        dirs.write_started(first);
+        auto& second = dirs.pick(table_dirs);
+        BOOST_REQUIRE(first != second);
+        dirs.write_started(second);
+        dirs.write_finished(first);
+        BOOST_REQUIRE(dirs.pick(table_dirs) == first);
+        dirs.write_finished(second);
+        BOOST_REQUIRE_EQUAL(dirs.get_stats(0).pending_writes + dirs.get_stats(1).pending_writes, 0);
+        BOOST_REQUIRE_EQUAL(dirs.get_stats(0).sstables_written + dirs.get_stats(1).sstables_written, 2);
+
+        // The I/O of an sstable goes through the queue of its directory.
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+        auto mt = make_lw_shared<memtable>(s);
+        mutation m(partition_key::from_exploded(*s, {to_bytes("key1")}), s);
+        m.set_clustered_cell(clustering_key::from_exploded(*s, {to_bytes("c1")}), *s->get_column_definition("r1"),
+                make_atomic_cell(int32_type->decompose(1)));
+        mt->apply(std::move(m));
+        auto requests = [] (io_queue& q) {
+            uint64_t n = 0;
+            for (auto pc : q.priority_classes()) {
+                n += q.get_stats(pc).requests;
+            }
+            return n;
+        };
+        auto before = requests(queue);
+        auto before_local = requests(local_io_queue());
+        auto sst = make_lw_shared<sstable>("ks", "cf", disk2.path, 1, la, big);
+        sst->write_components(*mt).get();
+        BOOST_REQUIRE(requests(queue) > before);
+        BOOST_REQUIRE_EQUAL(requests(local_io_queue()), before_local);
+    });
+}
+
+SEASTAR_TEST_CASE(mapped_filter_and_summary_match_loaded) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", int32_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto c_key = clustering_key::from_exploded(*s, {to_bytes("abc")});
+        std::vector<partition_key> keys;
+        auto mt = make_lw_shared<memtable>(s);
+        for (int32_t i = 0; i < 600; i++) {
+            keys.push_back(partition_key::from_exploded(*s, {int32_type->decompose(i)}));
+            mutation m(keys.back(), s);
+            m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(i)));
+            mt->apply(std::move(m));
+        }
+        auto tmp = make_lw_shared<tmpdir>();
+        auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        sst->write_components(*mt).get();
+
+        auto loaded = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        loaded->load().get();
+        auto& options = default_load_options();
+        options.map_filter = options.map_summary = true;
+        auto mapped = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        mapped->load().get();
+        options.map_filter = options.map_summary = false;
+
+        auto& ls = sstables::test(loaded).get_summary();
+        auto& ms = sstables::test(mapped).get_summary();
+        BOOST_REQUIRE(ms.entries.size() == 5);
+        BOOST_REQUIRE(ms.entries == ls.entries);
+        for (size_t i = 0; i < ms.entries.size(); i++) {
+            BOOST_REQUIRE(ms.entries[i].token_prefix == ls.entries[i].token_prefix);
+        }
+        BOOST_REQUIRE(ms.positions == ls.positions);
+        BOOST_REQUIRE(ms.header.memory_size == ls.header.memory_size);
+        BOOST_REQUIRE(ms.first_key.value == ls.first_key.value);
+        BOOST_REQUIRE(ms.last_key.value == ls.last_key.value);
+        // The mapped keys and bitset aren't on the heap.
+        BOOST_REQUIRE(mapped->summary_memory() < loaded->summary_memory());
+        BOOST_REQUIRE(mapped->filter_memory_size() < loaded->filter_memory_size());
+        BOOST_REQUIRE(mapped->filter_size() == loaded->filter_size());
+
+        for (int32_t i = 0; i < 1200; i++) {
+            auto key = partition_key::from_exploded(*s, {int32_type->decompose(i)});
+            BOOST_REQUIRE(mapped->filter_has_key(*s, key) == loaded->filter_has_key(*s, key));
+            BOOST_REQUIRE(i >= 600 || mapped->filter_has_key(*s, key));
+        }
+        for (auto&& key : keys) {
+            auto m = mapped->read_row(s, sstables::key::from_partition_key(*s, key)).get0();
+            BOOST_REQUIRE(m);
+            BOOST_REQUIRE(m->key().equal(*s, key));
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(shared_sstables_resharded) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        compaction_manager cm;
+        auto tmp = make_lw_shared<tmpdir>();
+        column_family::config cfg;
+        cfg.datadir = tmp->path;
+        cfg.enable_commitlog = false;
+        cfg.enable_incremental_backups = false;
+        auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+        cf->set_compaction_strategy(sstables::compaction_strategy_type::size_tiered);
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto c_key = clustering_key::from_exploded(*s, {to_bytes("abc")});
+        std::vector<partition_key> keys;
+        auto mt = make_lw_shared<memtable>(s);
+        for (int i = 0; i < 20; i++) {
+            keys.push_back(partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))}));
+            mutation m(keys.back(), s);
+            m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(i)));
+            mt->apply(std::move(m));
+        }
+        // Loaded sstables are taken to be shared with other shards until
+        // found otherwise.
+        auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        sst->write_components(*mt).get();
+        sst->load().get();
+        BOOST_REQUIRE(sst->is_shared());
+        column_family_test(cf).add_sstable(std::move(*sst));
+        BOOST_REQUIRE(cf->shared_sstables().first == 1);
+        BOOST_REQUIRE(cf->shared_sstables().second > 0);
+
+        cf->reshard_sstables().get();
+        BOOST_REQUIRE(cf->shared_sstables().first == 0);
+        BOOST_REQUIRE(cf->get_stats().resharded_sstables == 1);
+        BOOST_REQUIRE(cf->get_stats().resharded_bytes > 0);
+        BOOST_REQUIRE(cf->sstables_count() == 1);
+        for (auto&& sst : *cf->get_sstables() | boost::adaptors::map_values) {
+            BOOST_REQUIRE(!sst->is_shared());
+            BOOST_REQUIRE(sst->generation() != 1);
+        }
+        // All partitions are of the only shard, so all are kept.
+        for (auto&& key : keys) {
+            BOOST_REQUIRE(cf->find_partition_slow(key).get0());
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(cleanup_drops_partitions_of_lost_ranges) {
+    return seastar::async([] {
+        auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+            {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+        compaction_manager cm;
+        auto tmp = make_lw_shared<tmpdir>();
+        column_family::config cfg;
+        cfg.datadir = tmp->path;
+        cfg.enable_commitlog = false;
+        cfg.enable_incremental_backups = false;
+        auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+        cf->set_compaction_strategy(sstables::compaction_strategy_type::size_tiered);
+
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto c_key = clustering_key::from_exploded(*s, {to_bytes("abc")});
+        std::vector<dht::decorated_key> keys;
+        for (int i = 0; i < 20; i++) {
+            auto key = partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))});
+            keys.push_back(dht::global_partitioner().decorate_key(*s, std::move(key)));
+        }
+        std::sort(keys.begin(), keys.end(), [&] (const dht::decorated_key& a, const dht::decorated_key& b) {
+            return a.less_compare(*s, b);
+        });
+        auto add_sstable = [&] (unsigned long gen, unsigned first, unsigned last) {
+            auto mt = make_lw_shared<memtable>(s);
+            for (auto i = first; i <= last; i++) {
+                mutation m(keys[i].key(), s);
+                m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(int32_t(i))));
+                mt->apply(std::move(m));
+            }
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, gen, la, big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            sst->set_unshared();
+            column_family_test(cf).add_sstable(std::move(*sst));
+        };
+        add_sstable(1, 0, 19);
+        // Inside the owned ranges, and outside of them.
+        add_sstable(2, 1, 5);
+        add_sstable(3, 11, 13);
+
+        // The node keeps (keys[14], keys[9]], which wraps around the ring.
+        using bound = query::range<dht::token>::bound;
+        query::range<dht::token> owned(bound(keys[14].token(), false), bound(keys[9].token(), true));
+        cf->cleanup_sstables({ owned }).get();
+
+        auto generations = boost::copy_range<std::set<unsigned long>>(*cf->get_sstables() | boost::adaptors::map_keys);
+        BOOST_REQUIRE(generations.size() == 2);
+        BOOST_REQUIRE(generations.count(2));
+        BOOST_REQUIRE(!generations.count(1) && !generations.count(3));
+        for (unsigned i = 0; i < keys.size(); i++) {
+            bool kept = i <= 9 || i >= 15;
+            BOOST_REQUIRE(bool(cf->find_partition_slow(keys[i].key()).get0()) == kept);
+        }
+    });
+}
@@ -25,6 +25,8 @@
 #include "tests/test-utils.hh"
 #include "sstable_test.hh"
 #include "sstables/key.hh"
+#include "sstables/key_cache.hh"
+#include "sstables/index_page_cache.hh"
 #include "core/do_with.hh"
 #include "core/thread.hh"
 #include "database.hh"
@@ -474,3 +476,105 @@ SEASTAR_TEST_CASE(broken_ranges_collection) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(read_row_populates_key_cache) {
+    return seastar::async([] {
+        auto sstp = reusable_sst("tests/sstables/uncompressed", 1).get0();
+        auto s = uncompressed_schema();
+        auto key = sstables::key(to_bytes("vinna"));
+        auto& kc = sstables::global_key_cache();
+
+        auto hits = kc.get_stats().hits;
+        auto insertions = kc.get_stats().insertions;
+        auto m1 = sstp->read_row(s, key).get0();
+        BOOST_REQUIRE(m1);
+        BOOST_REQUIRE(kc.get_stats().insertions == insertions + 1);
+
+        auto m2 = sstp->read_row(s, key).get0();
+        BOOST_REQUIRE(m2);
+        BOOST_REQUIRE(kc.get_stats().hits == hits + 1);
+        BOOST_REQUIRE(*m1 == *m2);
+
+        // Keys which are not in the sstable are not cached.
+        auto absent = sstables::key(to_bytes("invalid_key"));
+        BOOST_REQUIRE(!sstp->read_row(s, absent).get0());
+        BOOST_REQUIRE(kc.get_stats().insertions == insertions + 1);
+    });
+}
+
+SEASTAR_TEST_CASE(key_cache_invalidation) {
+    sstables::key_cache kc;
+    auto k1 = to_bytes("k1");
+    auto k2 = to_bytes("k2");
+    kc.insert(1, k1, { 0, 10 });
+    kc.insert(1, k2, { 10, 20 });
+    kc.insert(2, k1, { 0, 30 });
+    BOOST_REQUIRE(kc.get_stats().entries == 3);
+
+    auto pos = kc.find(1, k2);
+    BOOST_REQUIRE(pos && pos->start == 10 && pos->end == 20);
+    pos = kc.find(2, k1);
+    BOOST_REQUIRE(pos && pos->end == 30);
+    BOOST_REQUIRE(!kc.find(3, k1));
+
+    kc.invalidate(1);
+    BOOST_REQUIRE(kc.get_stats().entries == 1);
+    BOOST_REQUIRE(!kc.find(1, k1));
+    BOOST_REQUIRE(!kc.find(1, k2));
+    BOOST_REQUIRE(kc.find(2, k1));
+
+    // A disabled cache holds nothing.
+    kc.set_capacity(0);
+    BOOST_REQUIRE(kc.get_stats().entries == 0);
+    kc.insert(1, k1, { 0, 10 });
+    BOOST_REQUIRE(!kc.find(1, k1));
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(index_pages_are_cached) {
+    return seastar::async([] {
+        auto sstp = reusable_sst("tests/sstables/uncompressed", 1).get0();
+        auto s = uncompressed_schema();
+        auto& ipc = sstables::global_index_page_cache();
+
+        // The sstable is small enough for all its keys to be in one page.
+        BOOST_REQUIRE(sstp->read_row(s, sstables::key(to_bytes("vinna"))).get0());
+        auto hits = ipc.get_stats().hits;
+        auto insertions = ipc.get_stats().insertions;
+
+        // Not in the key cache, so this one goes to the index page.
+        auto m = sstp->read_row(s, sstables::key(to_bytes("gustaf"))).get0();
+        BOOST_REQUIRE(m);
+        BOOST_REQUIRE(ipc.get_stats().hits > hits);
+        BOOST_REQUIRE(ipc.get_stats().insertions == insertions);
+
+        // A cached lookup reads the same partition as an uncached one.
+        ipc.clear();
+        sstables::global_key_cache().clear();
+        auto uncached = sstp->read_row(s, sstables::key(to_bytes("gustaf"))).get0();
+        BOOST_REQUIRE(uncached);
+        BOOST_REQUIRE(*m == *uncached);
+    });
+}
+
+SEASTAR_TEST_CASE(index_page_view_search) {
+    std::vector<sstables::index_entry> entries;
+    for (auto k : { "a", "bb", "ccc" }) {
+        auto key = to_bytes(k);
+        temporary_buffer<char> buf(reinterpret_cast<const char*>(key.data()), key.size());
+        temporary_buffer<char> promoted(reinterpret_cast<const char*>(key.data()), entries.size());
+        entries.emplace_back(std::move(buf), entries.size() * 100, std::move(promoted));
+    }
+    auto data = sstables::index_page_view::serialize(entries);
+    sstables::index_page_view page(data);
+    BOOST_REQUIRE(page.size() == 3);
+    for (size_t i = 0; i < entries.size(); i++) {
+        BOOST_REQUIRE(page[i].position() == entries[i].position());
+        BOOST_REQUIRE(bytes_view(page[i].get_key()) == entries[i].get_key_bytes());
+        BOOST_REQUIRE(page[i].promoted_index() == entries[i].get_promoted_index_bytes());
+    }
+
+    auto empty = sstables::index_page_view::serialize({});
+    BOOST_REQUIRE(sstables::index_page_view(empty).empty());
+    return make_ready_future<>();
+}
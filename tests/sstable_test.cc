@@ -222,6 +222,15 @@ SEASTAR_TEST_CASE(check_compressed_info_func) {
     return check_component_integrity(sstable::component_type::CompressionInfo);
 }
 
+SEASTAR_TEST_CASE(estimated_keys_for_range) {
+    return reusable_sst("tests/sstables/uncompressed", 1).then([] (sstable_ptr ptr) {
+        auto all = query::range<dht::token>::make_open_ended_both_sides();
+        BOOST_REQUIRE(ptr->estimated_keys_for_range(all) == ptr->get_estimated_key_count());
+        auto none = query::range<dht::token>::make_ending_with({dht::minimum_token(), false});
+        BOOST_REQUIRE(ptr->estimated_keys_for_range(none) == 0);
+    });
+}
+
 SEASTAR_TEST_CASE(check_summary_func) {
     return do_write_sst("tests/sstables/compressed", 1).then([] (auto sst1) {
         auto sst2 = make_lw_shared<sstable>("ks", "cf", "tests/sstables/compressed", 2, la, big);
@@ -262,6 +271,35 @@ SEASTAR_TEST_CASE(check_statistics_func) {
     });
 }
 
+SEASTAR_TEST_CASE(cardinality_round_trip) {
+    auto hll = metadata_collector::hyperloglog(13, 25);
+    const uint64_t nr_keys = 100000;
+    for (uint64_t i = 0; i < nr_keys; ++i) {
+        // splitmix64 finalizer, for well distributed hashes.
+        uint64_t h = (i + 1) * 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        hll.offer_hashed(h ^ (h >> 31));
+    }
+    BOOST_REQUIRE(std::abs(hll.estimate() - nr_keys) < nr_keys * 0.05);
+
+    auto restored = hll::HyperLogLog::from_bytes(hll.get_bytes());
+    BOOST_REQUIRE_EQUAL(restored.estimate(), hll.estimate());
+    // Merging an estimator with itself must not change the estimate.
+    restored.merge(hll);
+    BOOST_REQUIRE_EQUAL(restored.estimate(), hll.estimate());
+
+    // Origin lays out registers differently; its data must be rejected
+    // rather than misread.
+    auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/compressed", 1, la, big);
+    return sst->load().then([sst] {
+        auto& cardinality = sst->get_compaction_metadata().cardinality.elements;
+        temporary_buffer<uint8_t> buf(cardinality.size());
+        std::copy(cardinality.begin(), cardinality.end(), buf.get_write());
+        BOOST_REQUIRE_THROW(hll::HyperLogLog::from_bytes(buf), std::invalid_argument);
+    });
+}
+
 SEASTAR_TEST_CASE(check_toc_func) {
     return do_write_sst("tests/sstables/compressed", 1).then([] (auto sst1) {
         auto sst2 = make_lw_shared<sstable>("ks", "cf", "tests/sstables/compressed", 2, la, big);
@@ -487,6 +525,120 @@ SEASTAR_TEST_CASE(compressed_rows_read_all) {
     });
 }
 
+SEASTAR_TEST_CASE(read_ahead_window_adapts) {
+    sstables::read_ahead_window window(4);
+    auto issue_pending = [] () -> std::experimental::optional<future<temporary_buffer<char>>> {
+        return later().then([] { return temporary_buffer<char>(1); });
+    };
+    auto issue_ready = [] () -> std::experimental::optional<future<temporary_buffer<char>>> {
+        return make_ready_future<temporary_buffer<char>>(temporary_buffer<char>(1));
+    };
+
+    // A consumer which waits for every read deepens the window...
+    BOOST_REQUIRE_EQUAL(window.depth(), 1);
+    window.next(issue_pending);
+    BOOST_REQUIRE_EQUAL(window.depth(), 2);
+    window.next(issue_pending);
+    BOOST_REQUIRE_EQUAL(window.depth(), 4);
+    window.next(issue_pending);
+    BOOST_REQUIRE_EQUAL(window.depth(), 4);
+
+    // ...and one which is always ahead of the disk shrinks it.
+    return do_with(std::move(window), [issue_ready] (auto& window) {
+        return later().then([&window, issue_ready] {
+            for (int i = 0; i < 16; ++i) {
+                window.next(issue_ready);
+            }
+            BOOST_REQUIRE_EQUAL(window.depth(), 1);
+
+            // End of data.
+            auto f = window.next([] () -> std::experimental::optional<future<temporary_buffer<char>>> { return {}; });
+            while (!f.get0().empty()) {
+                f = window.next([] () -> std::experimental::optional<future<temporary_buffer<char>>> { return {}; });
+            }
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(read_ahead_file_stream) {
+    return reusable_sst("tests/sstables/uncompressed", 1).then([] (auto sstp) {
+        auto size = sstp->data_size();
+        return sstables::test(sstp).data_read(0, size).then([sstp, size] (temporary_buffer<char> expected) {
+            return engine().open_file_dma(sstp->get_filename(), open_flags::ro).then([size, expected = std::move(expected)] (file f) mutable {
+                sstables::read_ahead_options options;
+                options.buffer_size = 64;
+                options.max_depth = 4;
+                auto in = make_lw_shared(sstables::make_read_ahead_file_input_stream(f, 0, size, options));
+                return in->read_exactly(size + 1).then([in, expected = std::move(expected)] (temporary_buffer<char> actual) {
+                    BOOST_REQUIRE_EQUAL(actual.size(), expected.size());
+                    BOOST_REQUIRE(std::equal(actual.get(), actual.get() + actual.size(), expected.get()));
+                });
+            });
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(compression_crc_check_chance) {
+    sstables::compression c;
+    c.name.value = to_bytes("LZ4Compressor");
+    c.update(0);
+    BOOST_REQUIRE_EQUAL(c.crc_check_chance(), 1.0);
+
+    c.options.elements.push_back({{to_bytes("crc_check_chance")}, {to_bytes("0.25")}});
+    c.update(0);
+    BOOST_REQUIRE_EQUAL(c.crc_check_chance(), 0.25);
+    BOOST_REQUIRE_EQUAL(c.get_chunk_uncompressor().crc_check_chance, 0.25);
+
+    c.options.elements.back().value.value = to_bytes("bogus");
+    BOOST_REQUIRE_THROW(c.update(0), malformed_sstable_exception);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(zstd_dictionary_round_trip) {
+    // Chunks sharing most of their content, as rows of a table do.
+    auto make_chunk = [] (unsigned i) {
+        sstring chunk;
+        for (unsigned j = 0; j < 64; j++) {
+            chunk += sprint("{\"user_id\": %d, \"name\": \"user%d\", \"country\": \"%s\"}", i * 64 + j, j, j % 2 ? "PL" : "IL");
+        }
+        return chunk;
+    };
+
+    zstd_dictionary_trainer trainer(4096);
+    for (unsigned i = 0; i < 1000; i++) {
+        auto chunk = make_chunk(i);
+        trainer.add_chunk(chunk.c_str(), chunk.size());
+    }
+    BOOST_REQUIRE_EQUAL(trainer.samples(), 4096 * zstd_dictionary_trainer::samples_per_dictionary_size / zstd_dictionary_trainer::sample_size);
+    auto dictionary = trainer.train();
+    BOOST_REQUIRE(!dictionary.empty());
+    BOOST_REQUIRE(dictionary.size() <= 4096);
+
+    sstables::compression w;
+    w.set_compressor(compressor::zstd);
+    w.set_zstd_parameters(compression_parameters::DEFAULT_COMPRESSION_LEVEL, dictionary);
+    BOOST_REQUIRE(w.dictionary() == bytes_view(dictionary));
+
+    auto chunk = make_chunk(1000);
+    std::vector<char> compressed(w.compress_max_size(chunk.size()));
+    auto len = w.compress(chunk.c_str(), chunk.size(), compressed.data(), compressed.size());
+    std::vector<char> plain(compress_max_size_zstd(chunk.size()));
+    BOOST_REQUIRE(len < compress_zstd(chunk.c_str(), chunk.size(), plain.data(), plain.size()));
+
+    // Readers find the dictionary in the options.
+    sstables::compression r;
+    r.name.value = w.name.value;
+    r.options = w.options;
+    r.update(0);
+    std::vector<char> uncompressed(chunk.size());
+    BOOST_REQUIRE_EQUAL(r.uncompress(compressed.data(), len, uncompressed.data(), uncompressed.size()), chunk.size());
+    BOOST_REQUIRE(std::equal(uncompressed.begin(), uncompressed.end(), chunk.begin()));
+
+    // Without the dictionary, the chunk can't be uncompressed.
+    BOOST_REQUIRE_THROW(uncompress_zstd(compressed.data(), len, uncompressed.data(), uncompressed.size()), std::runtime_error);
+    return make_ready_future<>();
+}
+
 // test reading all the rows one by one, using the feature of the
 // consume_row_end returning proceed::no message
 class pausable_count_row_consumer : public count_row_consumer {
@@ -785,3 +937,38 @@ SEASTAR_TEST_CASE(wrong_range) {
     });
 }
  
+
+SEASTAR_TEST_CASE(summary_entries_layout) {
+    summary_entries entries;
+    std::vector<bytes> keys;
+    // Enough to take a few chunks.
+    for (int i = 0; i < 10000; i++) {
+        keys.push_back(to_bytes(sprint("key-%040d", i)));
+        entries.push_back(keys.back(), i * 100);
+    }
+    BOOST_REQUIRE(entries.size() == keys.size());
+    size_t keys_size = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto e = entries[i];
+        BOOST_REQUIRE(e.key == bytes_view(keys[i]));
+        BOOST_REQUIRE(e.position == i * 100);
+        auto token = dht::global_partitioner().get_token(key_view(e.key));
+        BOOST_REQUIRE(e.token_prefix == dht::token_prefix(token));
+        keys_size += keys[i].size();
+    }
+    BOOST_REQUIRE(entries.memory_usage() < 2 * keys_size + entries.size() * 32);
+
+    // With the size of the keys known up front, they take no more than that.
+    summary_entries copy;
+    copy.reserve_keys(keys_size);
+    for (size_t i = 0; i < entries.size(); i++) {
+        copy.push_back(entries[i]);
+    }
+    BOOST_REQUIRE(copy == entries);
+    BOOST_REQUIRE(copy.memory_usage() <= keys_size + entries.size() * 32);
+
+    copy.clear();
+    BOOST_REQUIRE(copy.empty());
+    BOOST_REQUIRE(copy.memory_usage() == 0);
+    return make_ready_future<>();
+}
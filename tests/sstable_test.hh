@@ -75,7 +75,7 @@ class test {
         return _sst->read_summary();
     }
 
-    future<summary_entry&> read_summary_entry(size_t i) {
+    future<summary_entry> read_summary_entry(size_t i) {
         return _sst->read_summary_entry(i);
     }
 
@@ -126,6 +126,36 @@ class test {
         _sst->_summary.first_key.value = bytes(reinterpret_cast<const signed char*>(first_key.c_str()), first_key.size());
         _sst->_summary.last_key.value = bytes(reinterpret_cast<const signed char*>(last_key.c_str()), last_key.size());
     }
+
+    // Used to create synthetic sstables for testing date-tiered compaction strategy.
+    void set_values_for_date_tiered_strategy(uint64_t fake_data_size, int64_t min_timestamp, int64_t max_timestamp, uint32_t max_local_deletion_time) {
+        _sst->_data_file_size = fake_data_size;
+        stats_metadata stats = {};
+        stats.min_timestamp = min_timestamp;
+        stats.max_timestamp = max_timestamp;
+        stats.max_local_deletion_time = max_local_deletion_time;
+        _sst->_statistics.contents[metadata_type::Stats] = std::make_unique<stats_metadata>(std::move(stats));
+    }
+
+    // Used to create synthetic sstables for testing tombstone compaction: a
+    // partition of the given number of cells, of which tombstones were
+    // deleted at deletion_time.
+    void set_values_for_tombstone_compaction(sstring first_key, sstring last_key, int64_t min_timestamp, int64_t max_timestamp,
+            uint64_t cells, uint64_t tombstones, uint32_t deletion_time, gc_clock::time_point write_time) {
+        _sst->_data_file_size = 1;
+        _sst->_data_file_write_time = write_time;
+        stats_metadata stats = {};
+        stats.min_timestamp = min_timestamp;
+        stats.max_timestamp = max_timestamp;
+        stats.max_local_deletion_time = deletion_time;
+        stats.estimated_column_count = estimated_histogram(114);
+        stats.estimated_column_count.add(cells);
+        stats.estimated_tombstone_drop_time = streaming_histogram(TOMBSTONE_HISTOGRAM_BIN_SIZE);
+        stats.estimated_tombstone_drop_time.update(deletion_time, tombstones);
+        _sst->_statistics.contents[metadata_type::Stats] = std::make_unique<stats_metadata>(std::move(stats));
+        _sst->_summary.first_key.value = bytes(reinterpret_cast<const signed char*>(first_key.c_str()), first_key.size());
+        _sst->_summary.last_key.value = bytes(reinterpret_cast<const signed char*>(last_key.c_str()), last_key.size());
+    }
 };
 
 inline future<sstable_ptr> reusable_sst(sstring dir, unsigned long generation) {
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test-utils.hh"
+#include "core/sleep.hh"
+#include "core/thread.hh"
+#include "utils/stall_detector.hh"
+
+using namespace std::chrono_literals;
+
+// Keeps the reactor busy without yielding.
+static void spin(std::chrono::steady_clock::duration d) {
+    auto end = std::chrono::steady_clock::now() + d;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+SEASTAR_TEST_CASE(test_stall_is_detected) {
+    return seastar::async([] {
+        utils::get_stall_detector().start(20ms).get();
+        auto& sd = utils::get_stall_detector().local();
+
+        spin(5ms);
+        sleep(50ms).get();
+        BOOST_REQUIRE_EQUAL(sd.get_stats().stalls, 0);
+
+        spin(200ms);
+        sleep(50ms).get();
+        BOOST_REQUIRE_EQUAL(sd.get_stats().stalls, 1);
+        BOOST_REQUIRE_EQUAL(sd.sites().size(), 1);
+        auto& site = sd.sites().begin()->second;
+        BOOST_REQUIRE_EQUAL(site.count, 1);
+        BOOST_REQUIRE(site.max >= 150ms);
+
+        sd.reset();
+        BOOST_REQUIRE(sd.sites().empty());
+
+        sd.set_threshold(0ms);
+        spin(100ms);
+        sleep(50ms).get();
+        BOOST_REQUIRE_EQUAL(sd.get_stats().stalls, 0);
+
+        utils::get_stall_detector().stop().get();
+    });
+}
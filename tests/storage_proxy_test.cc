@@ -28,7 +28,9 @@
 #include "tests/mutation_source_test.hh"
 #include "tests/result_set_assertions.hh"
 #include "service/storage_proxy.hh"
+#include "service/read_resolver.hh"
 #include "partition_slice_builder.hh"
+#include "schema_builder.hh"
 
 static query::result to_data_query_result(mutation_reader& reader, const query::partition_slice& slice) {
     query::result::builder builder(slice);
@@ -76,3 +78,146 @@ SEASTAR_TEST_CASE(test_make_local_reader) {
         });
     });
 }
+
+static schema_ptr resolver_schema() {
+    return schema_builder("ks", "cf")
+        .with_column("p", int32_type, column_kind::partition_key)
+        .with_column("c1", int32_type, column_kind::clustering_key)
+        .with_column("c2", int32_type, column_kind::clustering_key)
+        .with_column("v", int32_type)
+        .build();
+}
+
+static clustering_key make_ck(const schema& s, int32_t c1, int32_t c2) {
+    return clustering_key::from_exploded(s, {int32_type->decompose(c1), int32_type->decompose(c2)});
+}
+
+// Rows (c1, c2) of partition 0.
+static mutation make_rows(schema_ptr s, std::vector<std::pair<int32_t, int32_t>> rows, api::timestamp_type ts = 1) {
+    mutation m(partition_key::from_single_value(*s, int32_type->decompose(0)), s);
+    for (auto&& r : rows) {
+        m.set_clustered_cell(make_ck(*s, r.first, r.second), "v", int32_t(0), ts);
+    }
+    return m;
+}
+
+static foreign_ptr<lw_shared_ptr<reconcilable_result>> make_result(const mutation& m) {
+    auto rows = m.live_row_count();
+    std::vector<partition> partitions;
+    partitions.emplace_back(rows, freeze(m));
+    return make_foreign(make_lw_shared<reconcilable_result>(rows, std::move(partitions)));
+}
+
+static ::shared_ptr<service::data_read_resolver> make_resolver(size_t targets) {
+    return ::make_shared<service::data_read_resolver>(db::consistency_level::ALL, targets, std::chrono::high_resolution_clock::now() + std::chrono::seconds(10));
+}
+
+static const gms::inet_address replica_a("127.0.0.1");
+static const gms::inet_address replica_b("127.0.0.2");
+
+SEASTAR_TEST_CASE(test_resolve_stops_where_the_first_replica_reached_its_limit) {
+    return seastar::async([] {
+        auto s = resolver_schema();
+        auto slice = partition_slice_builder(*s).build();
+        auto resolver = make_resolver(2);
+        resolver->add_mutate_data(replica_a, make_result(make_rows(s, {{0, 1}, {0, 2}, {0, 3}})), 3);
+        // Returns a row past the last one of replica_a, which is unknown to it.
+        resolver->add_mutate_data(replica_b, make_result(make_rows(s, {{0, 1}, {0, 5}})), 3);
+
+        auto result = resolver->resolve(s, slice);
+        BOOST_REQUIRE_EQUAL(result.row_count(), 3);
+        BOOST_REQUIRE(resolver->horizon());
+        BOOST_REQUIRE(resolver->horizon()->row->equal(*s, make_ck(*s, 0, 3)));
+        BOOST_REQUIRE(resolver->short_replicas() == std::vector<gms::inet_address>({replica_a}));
+
+        auto diffs = resolver->take_diffs();
+        BOOST_REQUIRE(!diffs.count(replica_a));
+        BOOST_REQUIRE_EQUAL(diffs[replica_b].size(), 1);
+        BOOST_REQUIRE_EQUAL(diffs[replica_b][0].live_row_count(), 2);
+    });
+}
+
+SEASTAR_TEST_CASE(test_resolve_with_row_tombstones_past_the_horizon) {
+    return seastar::async([] {
+        auto s = resolver_schema();
+        auto slice = partition_slice_builder(*s).build();
+        auto c1_prefix = [&s] (int32_t c1) {
+            return clustering_key_prefix::from_exploded(*s, {int32_type->decompose(c1)});
+        };
+        {
+            // Deletes rows beyond the horizon only, leaving those before it.
+            auto resolver = make_resolver(2);
+            resolver->add_mutate_data(replica_a, make_result(make_rows(s, {{0, 1}, {0, 2}, {0, 3}})), 3);
+            auto m = make_rows(s, {{0, 1}});
+            m.partition().apply_row_tombstone(*s, c1_prefix(1), tombstone(2, gc_clock::now()));
+            resolver->add_mutate_data(replica_b, make_result(m), 3);
+
+            auto result = resolver->resolve(s, slice);
+            BOOST_REQUIRE_EQUAL(result.row_count(), 3);
+            auto diffs = resolver->take_diffs();
+            BOOST_REQUIRE_EQUAL(diffs[replica_a].size(), 1);
+            BOOST_REQUIRE(!diffs[replica_a][0].partition().row_tombstones().empty());
+            BOOST_REQUIRE_EQUAL(diffs[replica_a][0].live_row_count(), 0);
+        }
+        {
+            // Deletes rows on both sides of it. What is left before the
+            // horizon is short of the limit, to be read on from there.
+            auto resolver = make_resolver(2);
+            resolver->add_mutate_data(replica_a, make_result(make_rows(s, {{0, 1}, {0, 2}, {0, 3}})), 3);
+            auto m = make_rows(s, {{0, 1}});
+            m.partition().apply_row_tombstone(*s, c1_prefix(0), tombstone(2, gc_clock::now()));
+            resolver->add_mutate_data(replica_b, make_result(m), 3);
+
+            auto result = resolver->resolve(s, slice);
+            BOOST_REQUIRE_EQUAL(result.row_count(), 0);
+            BOOST_REQUIRE(resolver->horizon());
+            BOOST_REQUIRE(resolver->short_replicas() == std::vector<gms::inet_address>({replica_a}));
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_resolve_continuations_within_a_partition) {
+    return seastar::async([] {
+        auto s = resolver_schema();
+        auto slice = partition_slice_builder(*s).build();
+        auto resolver = make_resolver(2);
+        resolver->add_mutate_data(replica_a, make_result(make_rows(s, {{0, 1}, {0, 2}})), 2);
+        resolver->add_mutate_data(replica_b, make_result(make_rows(s, {{0, 1}, {0, 2}})), 2);
+        BOOST_REQUIRE_EQUAL(resolver->resolve(s, slice).row_count(), 2);
+        BOOST_REQUIRE_EQUAL(resolver->short_replicas().size(), 2);
+
+        // Both go on from the middle of the partition.
+        auto continuations = make_resolver(2);
+        continuations->add_mutate_data(replica_a, make_result(make_rows(s, {{0, 3}, {0, 4}})), 2);
+        continuations->add_mutate_data(replica_b, make_result(make_rows(s, {{0, 3}})), 2);
+        resolver->add_continuations(s, *continuations);
+
+        auto result = resolver->resolve(s, slice);
+        BOOST_REQUIRE_EQUAL(result.row_count(), 4);
+        BOOST_REQUIRE_EQUAL(result.partitions().size(), 1);
+        BOOST_REQUIRE(resolver->horizon()->row->equal(*s, make_ck(*s, 0, 4)));
+        BOOST_REQUIRE(resolver->short_replicas() == std::vector<gms::inet_address>({replica_a}));
+        auto diffs = resolver->take_diffs();
+        BOOST_REQUIRE(!diffs.count(replica_a));
+        BOOST_REQUIRE_EQUAL(diffs[replica_b][0].live_row_count(), 1);
+    });
+}
+
+SEASTAR_TEST_CASE(test_resolve_reversed_queries_whole) {
+    return seastar::async([] {
+        auto s = resolver_schema();
+        auto slice = partition_slice_builder(*s)
+            .with_option<query::partition_slice::option::reversed>()
+            .build();
+        auto resolver = make_resolver(2);
+        resolver->add_mutate_data(replica_a, make_result(make_rows(s, {{0, 1}, {0, 2}, {0, 3}})), 3);
+        resolver->add_mutate_data(replica_b, make_result(make_rows(s, {{0, 1}, {0, 5}})), 3);
+
+        // No horizon: the executor retries the whole query instead.
+        auto result = resolver->resolve(s, slice);
+        BOOST_REQUIRE(!resolver->horizon());
+        BOOST_REQUIRE(resolver->short_replicas().empty());
+        BOOST_REQUIRE(resolver->any_reached_limit());
+        BOOST_REQUIRE_EQUAL(result.row_count(), 4);
+    });
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+
+#include "streaming/stream_transfer_task.hh"
+#include "dht/murmur3_partitioner.hh"
+
+using token_range = query::range<dht::token>;
+
+static dht::token token_from_long(uint64_t value) {
+    auto t = net::hton(value);
+    bytes b(bytes::initialized_later(), 8);
+    std::copy_n(reinterpret_cast<int8_t*>(&t), 8, b.begin());
+    return { dht::token::kind::key, std::move(b) };
+}
+
+static token_range::bound bound(uint64_t t, bool inclusive) {
+    return token_range::bound(token_from_long(t), inclusive);
+}
+
+// (start, end]
+static token_range make_range(uint64_t start, uint64_t end) {
+    return token_range(bound(start, false), bound(end, true));
+}
+
+BOOST_AUTO_TEST_CASE(test_adjacent_ranges_are_merged) {
+    auto merged = streaming::merge_token_ranges({ make_range(20, 30), make_range(10, 20), make_range(30, 40) });
+    BOOST_REQUIRE_EQUAL(merged.size(), 1);
+    BOOST_REQUIRE(merged[0] == make_range(10, 40));
+}
+
+BOOST_AUTO_TEST_CASE(test_ranges_with_a_gap_are_kept_apart) {
+    // (10, 20) leaves out 20, which (20, 30] doesn't cover either.
+    token_range open(bound(10, false), bound(20, false));
+    auto merged = streaming::merge_token_ranges({ make_range(20, 30), open });
+    BOOST_REQUIRE_EQUAL(merged.size(), 2);
+    BOOST_REQUIRE(merged[0] == open);
+    BOOST_REQUIRE(merged[1] == make_range(20, 30));
+
+    // [20, 30] covers it.
+    token_range closed(bound(20, true), bound(30, true));
+    merged = streaming::merge_token_ranges({ closed, open });
+    BOOST_REQUIRE_EQUAL(merged.size(), 1);
+    BOOST_REQUIRE(merged[0] == token_range(bound(10, false), bound(30, true)));
+}
+
+BOOST_AUTO_TEST_CASE(test_wrapping_ranges_are_unwrapped) {
+    // (90, 10] wraps around the ring.
+    auto merged = streaming::merge_token_ranges({ make_range(90, 10), make_range(40, 50) });
+    BOOST_REQUIRE_EQUAL(merged.size(), 3);
+    BOOST_REQUIRE(merged[0] == token_range({}, bound(10, true)));
+    BOOST_REQUIRE(merged[1] == make_range(40, 50));
+    BOOST_REQUIRE(merged[2] == token_range(bound(90, false), {}));
+    for (auto&& r : merged) {
+        BOOST_REQUIRE(!r.is_wrap_around(dht::token_comparator()));
+    }
+
+    // Joined with what is adjacent on either side.
+    merged = streaming::merge_token_ranges({ make_range(90, 10), make_range(10, 20), make_range(80, 90) });
+    BOOST_REQUIRE_EQUAL(merged.size(), 2);
+    BOOST_REQUIRE(merged[0] == token_range({}, bound(20, true)));
+    BOOST_REQUIRE(merged[1] == token_range(bound(80, false), {}));
+}
+
+BOOST_AUTO_TEST_CASE(test_nested_and_overlapping_ranges_are_merged) {
+    auto merged = streaming::merge_token_ranges({ make_range(10, 50), make_range(20, 30), make_range(10, 15) });
+    BOOST_REQUIRE_EQUAL(merged.size(), 1);
+    BOOST_REQUIRE(merged[0] == make_range(10, 50));
+
+    merged = streaming::merge_token_ranges({ make_range(10, 30), make_range(20, 40), make_range(60, 70) });
+    BOOST_REQUIRE_EQUAL(merged.size(), 2);
+    BOOST_REQUIRE(merged[0] == make_range(10, 40));
+    BOOST_REQUIRE(merged[1] == make_range(60, 70));
+
+    // Anything within a range open at both ends is covered by it.
+    token_range full;
+    merged = streaming::merge_token_ranges({ make_range(10, 30), full, make_range(60, 70) });
+    BOOST_REQUIRE_EQUAL(merged.size(), 1);
+    BOOST_REQUIRE(merged[0] == full);
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+
+// Some thrift headers include other files from within namespaces,
+// which is totally broken.  Include those files here to avoid
+// breakage:
+#include <sys/param.h>
+// end thrift workaround
+#include "Cassandra.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test-utils.hh"
+#include "tests/cql_test_env.hh"
+#include "core/thread.hh"
+#include "thrift/handler.hh"
+#include "timestamp.hh"
+
+using namespace org::apache::cassandra;
+
+// Calls a handler method from a seastar thread, returning what it passes
+// its continuation object, or throwing what it passes its error one.
+template <typename Result, typename Call>
+static Result call_handler(Call call) {
+    auto pr = make_lw_shared<promise<Result>>();
+    auto f = pr->get_future();
+    call([pr] (const Result& result) { pr->set_value(result); }, [pr] (::apache::thrift::TDelayedException* ex) {
+        try {
+            ex->throw_it();
+        } catch (...) {
+            pr->set_exception(std::current_exception());
+        }
+    });
+    return f.get0();
+}
+
+template <typename Call>
+static void call_handler(Call call) {
+    auto pr = make_lw_shared<promise<>>();
+    auto f = pr->get_future();
+    call([pr] { pr->set_value(); }, [pr] (::apache::thrift::TDelayedException* ex) {
+        try {
+            ex->throw_it();
+        } catch (...) {
+            pr->set_exception(std::current_exception());
+        }
+    });
+    f.get();
+}
+
+// A thrift column family, holding the keys k000 to k299: C0 in all of
+// them, C1 in those of even number.
+class thrift_env {
+    std::unique_ptr<CassandraCobSvIfFactory> _factory;
+    CassandraCobSvIf* _handler;
+public:
+    static constexpr int keys = 300;
+
+    explicit thrift_env(cql_test_env& e)
+        : _factory(create_handler_factory(e.db()))
+        , _handler(_factory->getHandler(::apache::thrift::TConnectionInfo()))
+    {
+        e.create_table([] (auto ks_name) {
+            return schema({}, ks_name, "cf",
+                    {{"KEY", bytes_type}},
+                    {},
+                    {{"C0", bytes_type}, {"C1", bytes_type}},
+                    {},
+                    utf8_type);
+        }).get();
+        call_handler([this] (auto cob, auto exn_cob) {
+            _handler->set_keyspace(cob, exn_cob, "ks");
+        });
+        std::map<std::string, std::map<std::string, std::vector<Mutation>>> batch;
+        for (int i = 0; i < keys; ++i) {
+            auto& mutations = batch[key(i)]["cf"];
+            for (auto&& name : { "C0", "C1" }) {
+                if (name == std::string("C1") && i % 2) {
+                    continue;
+                }
+                Column col;
+                col.__set_name(name);
+                col.__set_value(sprint("%s-%d", name, i));
+                col.__set_timestamp(api::new_timestamp());
+                ColumnOrSuperColumn cosc;
+                cosc.__set_column(col);
+                Mutation m;
+                m.__set_column_or_supercolumn(cosc);
+                mutations.emplace_back(std::move(m));
+            }
+        }
+        call_handler([this, &batch] (auto cob, auto exn_cob) {
+            _handler->batch_mutate(cob, exn_cob, batch, ConsistencyLevel::ONE);
+        });
+    }
+
+    ~thrift_env() {
+        _factory->releaseHandler(_handler);
+    }
+
+    static std::string key(int i) {
+        return sprint("k%03d", i);
+    }
+
+    CassandraCobSvIf& handler() {
+        return *_handler;
+    }
+};
+
+constexpr int thrift_env::keys;
+
+static ColumnParent column_parent() {
+    ColumnParent parent;
+    parent.__set_column_family("cf");
+    return parent;
+}
+
+static SlicePredicate all_columns() {
+    SliceRange range;
+    range.__set_start("");
+    range.__set_finish("");
+    range.__set_count(100);
+    SlicePredicate predicate;
+    predicate.__set_slice_range(range);
+    return predicate;
+}
+
+static KeyRange whole_ring(int32_t count) {
+    KeyRange range;
+    range.__set_start_token("0");
+    range.__set_end_token("0");
+    range.__set_count(count);
+    return range;
+}
+
+static std::vector<KeySlice> get_range_slices(thrift_env& t, const KeyRange& range) {
+    return call_handler<std::vector<KeySlice>>([&t, &range] (auto cob, auto exn_cob) {
+        t.handler().get_range_slices(cob, exn_cob, column_parent(), all_columns(), range, ConsistencyLevel::ONE);
+    });
+}
+
+SEASTAR_TEST_CASE(test_multiget) {
+    return do_with_cql_env([] (cql_test_env& e) {
+        return seastar::async([&e] {
+            thrift_env t(e);
+            // More keys than fit a page, and one which was never written.
+            std::vector<std::string> keys;
+            for (int i = 0; i < thrift_env::keys; ++i) {
+                keys.push_back(thrift_env::key(i));
+            }
+            keys.push_back("absent");
+
+            auto counts = call_handler<std::map<std::string, int32_t>>([&] (auto cob, auto exn_cob) {
+                t.handler().multiget_count(cob, exn_cob, keys, column_parent(), all_columns(), ConsistencyLevel::ONE);
+            });
+            BOOST_REQUIRE_EQUAL(counts.size(), keys.size());
+            for (int i = 0; i < thrift_env::keys; ++i) {
+                BOOST_REQUIRE_EQUAL(counts[thrift_env::key(i)], i % 2 ? 1 : 2);
+            }
+            BOOST_REQUIRE_EQUAL(counts["absent"], 0);
+
+            SlicePredicate c1;
+            c1.__set_column_names({ "C1" });
+            auto slices = call_handler<std::map<std::string, std::vector<ColumnOrSuperColumn>>>([&] (auto cob, auto exn_cob) {
+                t.handler().multiget_slice(cob, exn_cob, keys, column_parent(), c1, ConsistencyLevel::ONE);
+            });
+            BOOST_REQUIRE_EQUAL(slices.size(), keys.size());
+            for (int i = 0; i < thrift_env::keys; ++i) {
+                auto& columns = slices[thrift_env::key(i)];
+                if (i % 2) {
+                    BOOST_REQUIRE(columns.empty());
+                } else {
+                    BOOST_REQUIRE_EQUAL(columns.size(), 1);
+                    BOOST_REQUIRE_EQUAL(columns[0].column.name, "C1");
+                    BOOST_REQUIRE_EQUAL(columns[0].column.value, sprint("C1-%d", i));
+                }
+            }
+            BOOST_REQUIRE(slices["absent"].empty());
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_get_range_slices_pages) {
+    return do_with_cql_env([] (cql_test_env& e) {
+        return seastar::async([&e] {
+            thrift_env t(e);
+            auto s = e.local_db().find_schema("ks", "cf");
+            auto decorate = [s] (const std::string& key) {
+                return dht::global_partitioner().decorate_key(*s, partition_key::from_single_value(*s, to_bytes(key)));
+            };
+
+            // Read over several pages, each resuming after the last
+            // partition of the previous one, in ring order, each once.
+            auto all = get_range_slices(t, whole_ring(1000));
+            BOOST_REQUIRE_EQUAL(all.size(), thrift_env::keys);
+            std::set<std::string> seen;
+            for (size_t i = 0; i < all.size(); ++i) {
+                BOOST_REQUIRE(seen.insert(all[i].key).second);
+                if (i) {
+                    BOOST_REQUIRE(decorate(all[i - 1].key).less_compare(*s, decorate(all[i].key)));
+                }
+                auto n = std::stoi(all[i].key.substr(1));
+                BOOST_REQUIRE_EQUAL(all[i].columns.size(), n % 2 ? 1 : 2);
+            }
+
+            // The count ends the read within a page.
+            auto first = get_range_slices(t, whole_ring(200));
+            BOOST_REQUIRE_EQUAL(first.size(), 200);
+            for (size_t i = 0; i < first.size(); ++i) {
+                BOOST_REQUIRE_EQUAL(first[i].key, all[i].key);
+            }
+
+            // A range of keys, both ends included, spanning pages.
+            KeyRange keys;
+            keys.__set_start_key(all[50].key);
+            keys.__set_end_key(all[249].key);
+            keys.__set_count(1000);
+            auto part = get_range_slices(t, keys);
+            BOOST_REQUIRE_EQUAL(part.size(), 200);
+            for (size_t i = 0; i < part.size(); ++i) {
+                BOOST_REQUIRE_EQUAL(part[i].key, all[50 + i].key);
+            }
+        });
+    });
+}
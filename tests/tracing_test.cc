@@ -0,0 +1,125 @@
+/*
+ * Copyright 2015 Cloudius Systems
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test-utils.hh"
+#include "tests/cql_test_env.hh"
+
+#include "core/sleep.hh"
+#include "core/thread.hh"
+#include "tracing/tracing.hh"
+
+SEASTAR_TEST_CASE(test_sampled_requests_are_traced) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            tracing::get_tracing().start().get();
+            auto& t = tracing::get_tracing().local();
+            t.set_trace_probability(1);
+
+            e.execute_cql("create table cf (p1 varchar primary key, r1 int);").get();
+            auto sessions = t.get_stats().sessions;
+            e.execute_cql("insert into cf (p1, r1) values ('key1', 1);").get();
+            e.execute_cql("select * from cf where p1 = 'key1';").get();
+            BOOST_REQUIRE_EQUAL(t.get_stats().sessions, sessions + 2);
+            BOOST_REQUIRE(t.get_stats().events > 0);
+
+            t.set_trace_probability(0);
+            sessions = t.get_stats().sessions;
+            auto events = t.get_stats().events;
+            e.execute_cql("select * from cf where p1 = 'key1';").get();
+            BOOST_REQUIRE_EQUAL(t.get_stats().sessions, sessions);
+            BOOST_REQUIRE_EQUAL(t.get_stats().events, events);
+
+            tracing::get_tracing().stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_trace_probability) {
+    // Traces are written out through the storage proxy.
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([] {
+            tracing::get_tracing().start().get();
+            auto& t = tracing::get_tracing().local();
+
+            BOOST_REQUIRE_THROW(t.set_trace_probability(-0.1), std::invalid_argument);
+            BOOST_REQUIRE_THROW(t.set_trace_probability(1.1), std::invalid_argument);
+
+            t.set_trace_probability(0.1);
+            unsigned traced = 0;
+            for (int i = 0; i < 10000; ++i) {
+                traced += bool(t.maybe_begin_session("test"));
+            }
+            BOOST_REQUIRE(traced > 700 && traced < 1300);
+
+            tracing::get_tracing().stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_slow_query_log) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([] {
+            tracing::get_tracing().start().get();
+            auto& t = tracing::get_tracing().local();
+
+            // Client requests are only followed while the log is enabled.
+            BOOST_REQUIRE(!t.begin_request());
+
+            t.set_slow_query_threshold(std::chrono::hours(1));
+            auto fast = t.begin_request();
+            BOOST_REQUIRE(fast);
+            BOOST_REQUIRE(!fast->traced());
+            fast->end();
+            BOOST_REQUIRE(t.slow_queries().empty());
+
+            t.set_slow_query_threshold(std::chrono::microseconds(1));
+            auto slow = t.begin_request();
+            slow->set_request("select * from cf");
+            slow->add_stage_time(tracing::stage::parse, std::chrono::microseconds(10));
+            slow->add_stage_time(tracing::stage::coordinator, std::chrono::microseconds(20));
+            slow->add_stage_time(tracing::stage::coordinator, std::chrono::microseconds(30));
+            auto replica = gms::inet_address("127.0.0.2");
+            slow->add_replica_time(replica, std::chrono::microseconds(40));
+            slow->add_replica_time(replica, std::chrono::microseconds(5));
+            seastar::sleep(std::chrono::milliseconds(1)).get();
+            slow->end();
+            // Ending it again, as its destruction does, logs nothing more.
+            slow->end();
+
+            BOOST_REQUIRE_EQUAL(t.slow_queries().size(), 1);
+            auto& r = t.slow_queries().back();
+            BOOST_REQUIRE_EQUAL(r.request, "select * from cf");
+            BOOST_REQUIRE(r.duration >= 1000);
+            BOOST_REQUIRE_EQUAL(r.stage_times[size_t(tracing::stage::parse)], 10);
+            BOOST_REQUIRE_EQUAL(r.stage_times[size_t(tracing::stage::coordinator)], 50);
+            BOOST_REQUIRE_EQUAL(r.stage_times[size_t(tracing::stage::serialize)], 0);
+            BOOST_REQUIRE_EQUAL(r.replica_times.size(), 1);
+            BOOST_REQUIRE_EQUAL(r.replica_times.at(replica), 40);
+            BOOST_REQUIRE_EQUAL(t.get_stats().slow_queries, 1);
+
+            tracing::get_tracing().stop().get();
+        });
+    });
+}
@@ -407,6 +407,35 @@ BOOST_AUTO_TEST_CASE(test_utf8_type_validation) {
     test_validation_fails(utf8_type, bytes("test") + from_hex("fe"));
 }
 
+BOOST_AUTO_TEST_CASE(test_utf8_type_validation_of_long_strings) {
+    // Errors at every offset of the 16-byte blocks validated at once.
+    auto prefix = bytes("");
+    for (int i = 0; i < 40; i++) {
+        ascii_type->validate(prefix + bytes("x"));
+        test_validation_fails(ascii_type, prefix + from_hex("80"));
+        // The longest and the shortest of each length.
+        utf8_type->validate(prefix + from_hex("c280") + from_hex("dfbf") + prefix);
+        utf8_type->validate(prefix + from_hex("e0a080") + from_hex("efbfbf") + prefix);
+        utf8_type->validate(prefix + from_hex("f0908080") + from_hex("f48fbfbf") + prefix);
+        // Overlong.
+        test_validation_fails(utf8_type, prefix + from_hex("c1bf"));
+        test_validation_fails(utf8_type, prefix + from_hex("e09fbf"));
+        test_validation_fails(utf8_type, prefix + from_hex("f08fbfbf"));
+        // Surrogate.
+        test_validation_fails(utf8_type, prefix + from_hex("eda080") + prefix);
+        // Past U+10FFFF.
+        test_validation_fails(utf8_type, prefix + from_hex("f4908080") + prefix);
+        test_validation_fails(utf8_type, prefix + from_hex("f5808080"));
+        // Truncated, at the end and in the middle.
+        test_validation_fails(utf8_type, prefix + from_hex("e0a0"));
+        test_validation_fails(utf8_type, prefix + from_hex("f09080") + bytes("x"));
+        // A continuation with no lead.
+        test_validation_fails(utf8_type, prefix + from_hex("80") + prefix);
+        test_validation_fails(utf8_type, prefix + from_hex("c280bf"));
+        prefix += bytes("a");
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_int32_type_validation) {
     int32_type->validate(bytes());
     int32_type->validate(from_hex("deadbeef"));
@@ -575,3 +604,28 @@ BOOST_AUTO_TEST_CASE(test_reversed_type_value_compatibility) {
     BOOST_REQUIRE(rb->is_value_compatible_with(*rs));
     BOOST_REQUIRE(rb->is_value_compatible_with(*utf8_type));
 }
+
+BOOST_AUTO_TEST_CASE(test_type_comparator_agrees_with_types) {
+    auto sign = [] (int32_t c) { return c < 0 ? -1 : c > 0 ? 1 : 0; };
+    auto check = [&] (data_type t, std::vector<bytes> values) {
+        for (auto&& rt : { t, reversed_type_impl::get_instance(t) }) {
+            type_comparator c(*rt);
+            for (auto&& v1 : values) {
+                for (auto&& v2 : values) {
+                    BOOST_REQUIRE_EQUAL(sign(c.compare(v1, v2)), sign(rt->compare(v1, v2)));
+                }
+            }
+        }
+    };
+    check(int32_type, { bytes(), int32_type->decompose(-7), int32_type->decompose(0), int32_type->decompose(42) });
+    check(long_type, { bytes(), long_type->decompose(int64_t(-7)), long_type->decompose(int64_t(0)),
+            long_type->decompose(std::numeric_limits<int64_t>::max()) });
+    check(timestamp_type, { bytes(), timestamp_type->decompose(db_clock::time_point(db_clock::duration(-1))),
+            timestamp_type->decompose(db_clock::time_point(db_clock::duration(1))) });
+    check(timeuuid_type, { bytes(), timeuuid_type->decompose(utils::UUID_gen::get_time_UUID()),
+            timeuuid_type->decompose(utils::UUID_gen::get_time_UUID()),
+            timeuuid_type->decompose(utils::UUID("D2177dD0-EAa2-11de-a572-001B779C76e3")) });
+    check(utf8_type, { bytes(), utf8_type->decompose(sstring("a")), utf8_type->decompose(sstring("ab")),
+            utf8_type->decompose(sstring("b")) });
+    check(double_type, { bytes(), double_type->decompose(-1.5), double_type->decompose(2.0) });
+}
@@ -34,6 +34,8 @@
 #include <thrift/protocol/TBinaryProtocol.h>
 #include <boost/move/iterator.hpp>
 #include "service/migration_manager.hh"
+#include "service/storage_proxy.hh"
+#include "query-result-reader.hh"
 #include "utils/class_registrator.hh"
 
 using namespace ::apache::thrift;
@@ -140,6 +142,71 @@ std::string bytes_to_string(bytes_view v) {
     return { reinterpret_cast<const char*>(v.begin()), v.size() };
 }
 
+// The most keys a single query of a multiget or of a range slice reads, so
+// that a large set of keys or a large range is read a page at a time.
+static constexpr uint32_t query_page_size = 128;
+
+// Collects the live columns a predicate selects of each partition of a
+// query of a thrift column family, whose partitions have a single row.
+class key_slices_visitor : public query::result_visitor {
+    const schema& _s;
+    const query::partition_slice& _slice;
+    const SlicePredicate& _predicate;
+public:
+    std::vector<KeySlice> key_slices;
+public:
+    key_slices_visitor(const schema& s, const query::partition_slice& slice, const SlicePredicate& predicate)
+        : _s(s), _slice(slice), _predicate(predicate) { }
+
+    void accept_new_partition(const partition_key_view& key, uint32_t row_count) {
+        KeySlice ks;
+        ks.__set_key(bytes_to_string(key.explode(_s).front()));
+        key_slices.push_back(std::move(ks));
+    }
+
+    void accept_new_row(const clustering_key_view& key, const query::result_row_view& static_row, const query::result_row_view& row) {
+        accept_new_row(static_row, row);
+    }
+
+    void accept_new_row(const query::result_row_view& static_row, const query::result_row_view& row) {
+        auto& columns = key_slices.back().columns;
+        auto it = row.iterator();
+        for (auto id : _slice.regular_columns) {
+            auto& def = _s.regular_column_at(id);
+            if (!def.is_atomic()) {
+                it.skip(def);
+                continue;
+            }
+            auto cell = it.next_atomic_cell();
+            if (!cell) {
+                continue;
+            }
+            Column col;
+            col.__set_name(bytes_to_string(def.name()));
+            col.__set_value(bytes_to_string(cell->value()));
+            col.__set_timestamp(cell->timestamp());
+            // FIXME: set ttl
+            ColumnOrSuperColumn v;
+            v.__set_column(std::move(col));
+            columns.push_back(std::move(v));
+        }
+    }
+
+    void accept_partition_end(const query::result_row_view& static_row) {
+        if (!_predicate.__isset.slice_range) {
+            return;
+        }
+        auto& columns = key_slices.back().columns;
+        auto&& range = _predicate.slice_range;
+        if (range.reversed) {
+            std::reverse(columns.begin(), columns.end());
+        }
+        if (columns.size() > size_t(std::max(range.count, 0))) {
+            columns.resize(range.count);
+        }
+    }
+};
+
 class thrift_handler : public CassandraCobSvIf {
     distributed<database>& _db;
     sstring _ks_name;
@@ -239,21 +306,34 @@ class thrift_handler : public CassandraCobSvIf {
     }
 
     void multiget_slice(tcxx::function<void(std::map<std::string, std::vector<ColumnOrSuperColumn> >  const& _return)> cob, tcxx::function<void(::apache::thrift::TDelayedException* _throw)> exn_cob, const std::vector<std::string> & keys, const ColumnParent& column_parent, const SlicePredicate& predicate, const ConsistencyLevel::type consistency_level) {
-        std::map<std::string, std::vector<ColumnOrSuperColumn> >  _return;
-        // FIXME: implement
-        return pass_unimplemented(exn_cob);
+        with_cob(std::move(cob), std::move(exn_cob), [&] {
+            auto schema = lookup_schema(column_parent);
+            return multiget(schema, predicate, keys, cl_from_thrift(consistency_level));
+        });
     }
 
     void multiget_count(tcxx::function<void(std::map<std::string, int32_t>  const& _return)> cob, tcxx::function<void(::apache::thrift::TDelayedException* _throw)> exn_cob, const std::vector<std::string> & keys, const ColumnParent& column_parent, const SlicePredicate& predicate, const ConsistencyLevel::type consistency_level) {
-        std::map<std::string, int32_t>  _return;
-        // FIXME: implement
-        return pass_unimplemented(exn_cob);
+        with_cob(std::move(cob), std::move(exn_cob), [&] {
+            auto schema = lookup_schema(column_parent);
+            return multiget(schema, predicate, keys, cl_from_thrift(consistency_level)).then([] (auto columns) {
+                std::map<std::string, int32_t> counts;
+                for (auto&& key_columns : columns) {
+                    counts.emplace(key_columns.first, key_columns.second.size());
+                }
+                return counts;
+            });
+        });
     }
 
     void get_range_slices(tcxx::function<void(std::vector<KeySlice>  const& _return)> cob, tcxx::function<void(::apache::thrift::TDelayedException* _throw)> exn_cob, const ColumnParent& column_parent, const SlicePredicate& predicate, const KeyRange& range, const ConsistencyLevel::type consistency_level) {
-        std::vector<KeySlice>  _return;
-        // FIXME: implement
-        return pass_unimplemented(exn_cob);
+        with_cob(std::move(cob), std::move(exn_cob), [&] {
+            auto schema = lookup_schema(column_parent);
+            if (range.__isset.row_filter && !range.row_filter.empty()) {
+                throw unimplemented_exception();
+            }
+            return range_slices(schema, predicate, ranges_from_thrift(schema, range), range.count,
+                    cl_from_thrift(consistency_level));
+        });
     }
 
     void get_paged_slice(tcxx::function<void(std::vector<KeySlice>  const& _return)> cob, tcxx::function<void(::apache::thrift::TDelayedException* _throw)> exn_cob, const std::string& column_family, const KeyRange& range, const std::string& start_column, const ConsistencyLevel::type consistency_level) {
@@ -299,65 +379,24 @@ class thrift_handler : public CassandraCobSvIf {
             if (_ks_name.empty()) {
                 throw make_exception<InvalidRequestException>("keyspace not set");
             }
-            // Would like to use move_iterator below, but Mutation is filled with some const stuff.
-            return parallel_for_each(mutation_map.begin(), mutation_map.end(),
-                    [this] (std::pair<std::string, std::map<std::string, std::vector<Mutation>>> key_cf) {
+            // Mutations are built here, and applied by their owning shards,
+            // each of which gets all of its mutations at once.
+            std::unordered_map<unsigned, std::vector<frozen_mutation>> mutations_by_shard;
+            for (auto&& key_cf : mutation_map) {
                 bytes thrift_key = to_bytes(key_cf.first);
-                std::map<std::string, std::vector<Mutation>>& cf_mutations_map = key_cf.second;
-                return parallel_for_each(
-                        boost::make_move_iterator(cf_mutations_map.begin()),
-                        boost::make_move_iterator(cf_mutations_map.end()),
-                        [this, thrift_key] (std::pair<std::string, std::vector<Mutation>> cf_mutations) {
-                    sstring cf_name = cf_mutations.first;
-                    const std::vector<Mutation>& mutations = cf_mutations.second;
-                    auto& cf = lookup_column_family(_db.local(), _ks_name, cf_name);
-                    mutation m_to_apply(key_from_thrift(cf.schema(), thrift_key), cf.schema());
-                    auto empty_clustering_key = clustering_key::make_empty(*cf.schema());
-                    for (const Mutation& m : mutations) {
-                        if (m.__isset.column_or_supercolumn) {
-                            auto&& cosc = m.column_or_supercolumn;
-                            if (cosc.__isset.column) {
-                                auto&& col = cosc.column;
-                                bytes cname = to_bytes(col.name);
-                                auto def = cf.schema()->get_column_definition(cname);
-                                if (!def) {
-                                    throw make_exception<InvalidRequestException>("column %s not found", col.name);
-                                }
-                                if (def->kind != column_kind::regular_column) {
-                                    throw make_exception<InvalidRequestException>("Column %s is not settable", col.name);
-                                }
-                                gc_clock::duration ttl;
-                                if (col.__isset.ttl) {
-                                    ttl = std::chrono::duration_cast<gc_clock::duration>(std::chrono::seconds(col.ttl));
-                                }
-                                if (ttl.count() <= 0) {
-                                    ttl = cf.schema()->default_time_to_live();
-                                }
-                                ttl_opt maybe_ttl;
-                                if (ttl.count() > 0) {
-                                    maybe_ttl = ttl;
-                                }
-                                m_to_apply.set_clustered_cell(empty_clustering_key, *def,
-                                    atomic_cell::make_live(col.timestamp, to_bytes(col.value), maybe_ttl));
-                            } else if (cosc.__isset.super_column) {
-                                // FIXME: implement
-                            } else if (cosc.__isset.counter_column) {
-                                // FIXME: implement
-                            } else if (cosc.__isset.counter_super_column) {
-                                // FIXME: implement
-                            } else {
-                                throw make_exception<InvalidRequestException>("Empty ColumnOrSuperColumn");
-                            }
-                        } else if (m.__isset.deletion) {
-                            // FIXME: implement
-                            abort();
-                        } else {
-                            throw make_exception<InvalidRequestException>("Mutation must have either column or deletion");
-                        }
-                    }
+                for (auto&& cf_mutations : key_cf.second) {
+                    auto& cf = lookup_column_family(_db.local(), _ks_name, cf_mutations.first);
+                    auto m_to_apply = mutation_from_thrift(cf, thrift_key, cf_mutations.second);
                     auto shard = _db.local().shard_of(m_to_apply);
-                    return _db.invoke_on(shard, [this, cf_name, m = freeze(m_to_apply)] (database& db) {
-                        return db.apply(m);
+                    mutations_by_shard[shard].emplace_back(freeze(m_to_apply));
+                }
+            }
+            return do_with(std::move(mutations_by_shard), [this] (auto& mutations_by_shard) {
+                return parallel_for_each(mutations_by_shard, [this] (auto& shard_mutations) {
+                    return _db.invoke_on(shard_mutations.first, [&mutations = shard_mutations.second] (database& db) {
+                        return parallel_for_each(mutations, [&db] (const frozen_mutation& m) {
+                            return db.apply(m);
+                        });
                     });
                 });
             });
@@ -658,6 +697,191 @@ class thrift_handler : public CassandraCobSvIf {
         def.__set_durable_writes(meta->durable_writes());
         return std::move(def);
     }
+    schema_ptr lookup_schema(const ColumnParent& column_parent) {
+        if (_ks_name.empty()) {
+            throw make_exception<InvalidRequestException>("keyspace not set");
+        }
+        if (!column_parent.super_column.empty()) {
+            throw unimplemented_exception();
+        }
+        try {
+            return _db.local().find_schema(_ks_name, column_parent.column_family);
+        } catch (...) {
+            throw make_exception<InvalidRequestException>("column family %s not found", column_parent.column_family);
+        }
+    }
+    static db::consistency_level cl_from_thrift(ConsistencyLevel::type cl) {
+        switch (cl) {
+        case ConsistencyLevel::ONE: return db::consistency_level::ONE;
+        case ConsistencyLevel::QUORUM: return db::consistency_level::QUORUM;
+        case ConsistencyLevel::LOCAL_QUORUM: return db::consistency_level::LOCAL_QUORUM;
+        case ConsistencyLevel::EACH_QUORUM: return db::consistency_level::EACH_QUORUM;
+        case ConsistencyLevel::ALL: return db::consistency_level::ALL;
+        case ConsistencyLevel::ANY: return db::consistency_level::ANY;
+        case ConsistencyLevel::TWO: return db::consistency_level::TWO;
+        case ConsistencyLevel::THREE: return db::consistency_level::THREE;
+        case ConsistencyLevel::SERIAL: return db::consistency_level::SERIAL;
+        case ConsistencyLevel::LOCAL_SERIAL: return db::consistency_level::LOCAL_SERIAL;
+        case ConsistencyLevel::LOCAL_ONE: return db::consistency_level::LOCAL_ONE;
+        }
+        throw make_exception<InvalidRequestException>("invalid consistency level %d", int(cl));
+    }
+    // Selects the regular columns a predicate names, or those of its range
+    // of names. The count and order of a range are applied to the results.
+    static query::partition_slice slice_from_predicate(const schema& s, const SlicePredicate& predicate) {
+        std::vector<column_id> regular_columns;
+        if (predicate.__isset.column_names) {
+            for (auto&& name : predicate.column_names) {
+                auto def = s.get_column_definition(to_bytes(name));
+                if (def && def->is_regular()) {
+                    regular_columns.push_back(def->id);
+                }
+            }
+            std::sort(regular_columns.begin(), regular_columns.end());
+            regular_columns.erase(std::unique(regular_columns.begin(), regular_columns.end()), regular_columns.end());
+        } else if (predicate.__isset.slice_range) {
+            auto&& range = predicate.slice_range;
+            // A reversed range starts from its greatest name.
+            auto& first = range.reversed ? range.finish : range.start;
+            auto& last = range.reversed ? range.start : range.finish;
+            auto beg = first.empty() ? s.regular_begin() : s.regular_lower_bound(to_bytes(first));
+            auto end = last.empty() ? s.regular_end() : s.regular_upper_bound(to_bytes(last));
+            for (; beg < end; ++beg) {
+                regular_columns.push_back(beg->id);
+            }
+        } else {
+            throw make_exception<InvalidRequestException>("empty SlicePredicate");
+        }
+        query::partition_slice::option_set opts;
+        opts.set(query::partition_slice::option::send_partition_key);
+        opts.set(query::partition_slice::option::send_timestamp_and_expiry);
+        return query::partition_slice({ query::clustering_range::make_open_ended_both_sides() }, {}, std::move(regular_columns), opts);
+    }
+    static future<std::vector<KeySlice>> query_key_slices(schema_ptr schema, const query::partition_slice& slice,
+            const SlicePredicate& predicate, std::vector<query::partition_range> ranges, db::consistency_level cl,
+            uint32_t row_limit = query::max_rows) {
+        auto cmd = make_lw_shared<query::read_command>(schema->id(), slice, row_limit);
+        return service::get_local_storage_proxy().query(schema, cmd, std::move(ranges), cl).then([schema, cmd, predicate] (foreign_ptr<lw_shared_ptr<query::result>> result) {
+            key_slices_visitor visitor(*schema, cmd->slice, predicate);
+            query::result_view::consume(*result, cmd->slice, visitor);
+            return std::move(visitor.key_slices);
+        });
+    }
+    // Keys are queried in groups of those of the same shard, so that each
+    // query is answered by a single shard of each replica. The groups are
+    // queried in parallel, each a page of keys at a time.
+    future<std::map<std::string, std::vector<ColumnOrSuperColumn>>> multiget(schema_ptr schema, const SlicePredicate& predicate,
+            const std::vector<std::string>& keys, db::consistency_level cl) {
+        auto slice = slice_from_predicate(*schema, predicate);
+        // Keys with no live columns map to none.
+        auto result = make_lw_shared<std::map<std::string, std::vector<ColumnOrSuperColumn>>>();
+        std::unordered_map<unsigned, std::vector<query::partition_range>> ranges_by_shard;
+        for (auto&& key : keys) {
+            auto dk = dht::global_partitioner().decorate_key(*schema, key_from_thrift(schema, to_bytes(key)));
+            auto shard = _db.local().shard_of(dk._token);
+            ranges_by_shard[shard].push_back(query::partition_range::make_singular(std::move(dk)));
+            (*result)[key];
+        }
+        return do_with(std::move(ranges_by_shard), std::move(slice), SlicePredicate(predicate),
+                [schema, cl, result] (auto& ranges_by_shard, auto& slice, auto& predicate) {
+            return parallel_for_each(ranges_by_shard, [&slice, &predicate, schema, cl, result] (auto& shard_ranges) {
+                auto& ranges = shard_ranges.second;
+                return do_with(size_t(0), [&ranges, &slice, &predicate, schema, cl, result] (size_t& next) {
+                    return do_until([&ranges, &next] { return next == ranges.size(); }, [&ranges, &next, &slice, &predicate, schema, cl, result] {
+                        auto end = std::min(next + query_page_size, ranges.size());
+                        std::vector<query::partition_range> page(std::make_move_iterator(ranges.begin() + next),
+                                std::make_move_iterator(ranges.begin() + end));
+                        next = end;
+                        return query_key_slices(schema, slice, predicate, std::move(page), cl).then([result] (std::vector<KeySlice> key_slices) {
+                            for (auto&& ks : key_slices) {
+                                (*result)[ks.key] = std::move(ks.columns);
+                            }
+                        });
+                    });
+                });
+            });
+        }).then([result] {
+            return std::move(*result);
+        });
+    }
+    // The partition ranges of a range of keys, or of tokens, in ring order.
+    static std::vector<query::partition_range> ranges_from_thrift(schema_ptr s, const KeyRange& range) {
+        if (range.__isset.start_key || range.__isset.end_key) {
+            using bound_opt = std::experimental::optional<query::partition_range::bound>;
+            auto key_bound = [s] (const std::string& key) {
+                if (key.empty()) {
+                    return bound_opt();
+                }
+                auto dk = dht::global_partitioner().decorate_key(*s, key_from_thrift(s, to_bytes(key)));
+                return bound_opt(query::partition_range::bound(dht::ring_position(std::move(dk)), true));
+            };
+            auto start = key_bound(range.start_key);
+            auto end = key_bound(range.end_key);
+            if (start && end && dht::ring_position_comparator(*s)(start->value(), end->value()) > 0) {
+                throw make_exception<InvalidRequestException>("start key's token sorts after end key's token");
+            }
+            return { query::partition_range(std::move(start), std::move(end)) };
+        }
+        if (!range.__isset.start_token || !range.__isset.end_token) {
+            throw make_exception<InvalidRequestException>("exactly one of start key and start token must be set");
+        }
+        auto& partitioner = dht::global_partitioner();
+        auto start = partitioner.from_sstring(range.start_token);
+        auto end = partitioner.from_sstring(range.end_token);
+        if (start == end) {
+            return { query::partition_range::make_open_ended_both_sides() };
+        }
+        // From after the start token to the end token, around the ring.
+        query::range<dht::token> r(query::range<dht::token>::bound(std::move(start), false),
+                query::range<dht::token>::bound(std::move(end), true));
+        if (!r.is_wrap_around(dht::token_comparator())) {
+            return { query::to_partition_range(std::move(r)) };
+        }
+        auto p = r.unwrap();
+        return { query::to_partition_range(std::move(p.first)), query::to_partition_range(std::move(p.second)) };
+    }
+    // The ranges left to read after the partition a page ended with.
+    static std::vector<query::partition_range> ranges_after(const schema& s, std::vector<query::partition_range> ranges,
+            dht::ring_position pos) {
+        dht::ring_position_comparator cmp(s);
+        auto i = std::find_if(ranges.begin(), ranges.end(), [&] (const query::partition_range& r) {
+            return r.contains(pos, cmp);
+        });
+        ranges.erase(ranges.begin(), i);
+        if (!ranges.empty()) {
+            ranges.front() = query::partition_range(query::partition_range::bound(std::move(pos), false), ranges.front().end());
+        }
+        return ranges;
+    }
+    // Reads the ranges a page of partitions at a time, up to count of them.
+    static future<std::vector<KeySlice>> range_slices(schema_ptr schema, const SlicePredicate& predicate,
+            std::vector<query::partition_range> ranges, int32_t count, db::consistency_level cl) {
+        if (count <= 0) {
+            return make_ready_future<std::vector<KeySlice>>();
+        }
+        auto slice = slice_from_predicate(*schema, predicate);
+        return do_with(std::move(ranges), std::vector<KeySlice>(), std::move(slice), SlicePredicate(predicate),
+                [schema, count, cl] (auto& ranges, auto& result, auto& slice, auto& predicate) {
+            return repeat([&ranges, &result, &slice, &predicate, schema, count, cl] {
+                auto limit = std::min<uint32_t>(count - result.size(), query_page_size);
+                return query_key_slices(schema, slice, predicate, ranges, cl, limit).then([&ranges, &result, schema, count, limit] (std::vector<KeySlice> page) {
+                    auto done = page.size() < limit;
+                    if (!page.empty()) {
+                        auto last = dht::global_partitioner().decorate_key(*schema, key_from_thrift(schema, to_bytes(page.back().key)));
+                        ranges = ranges_after(*schema, std::move(ranges), dht::ring_position(std::move(last)));
+                    }
+                    std::move(page.begin(), page.end(), std::back_inserter(result));
+                    if (result.size() >= size_t(count)) {
+                        result.resize(count);
+                        done = true;
+                    }
+                    return done || ranges.empty() ? stop_iteration::yes : stop_iteration::no;
+                });
+            }).then([&result] {
+                return std::move(result);
+            });
+        });
+    }
     static column_family& lookup_column_family(database& db, const sstring& ks_name, const sstring& cf_name) {
         try {
             return db.find_column_family(ks_name, cf_name);
@@ -665,6 +889,53 @@ class thrift_handler : public CassandraCobSvIf {
             throw make_exception<InvalidRequestException>("column family %s not found", cf_name);
         }
     }
+    static mutation mutation_from_thrift(column_family& cf, const bytes& thrift_key, const std::vector<Mutation>& mutations) {
+        mutation m_to_apply(key_from_thrift(cf.schema(), thrift_key), cf.schema());
+        auto empty_clustering_key = clustering_key::make_empty(*cf.schema());
+        for (const Mutation& m : mutations) {
+            if (m.__isset.column_or_supercolumn) {
+                auto&& cosc = m.column_or_supercolumn;
+                if (cosc.__isset.column) {
+                    auto&& col = cosc.column;
+                    bytes cname = to_bytes(col.name);
+                    auto def = cf.schema()->get_column_definition(cname);
+                    if (!def) {
+                        throw make_exception<InvalidRequestException>("column %s not found", col.name);
+                    }
+                    if (def->kind != column_kind::regular_column) {
+                        throw make_exception<InvalidRequestException>("Column %s is not settable", col.name);
+                    }
+                    gc_clock::duration ttl;
+                    if (col.__isset.ttl) {
+                        ttl = std::chrono::duration_cast<gc_clock::duration>(std::chrono::seconds(col.ttl));
+                    }
+                    if (ttl.count() <= 0) {
+                        ttl = cf.schema()->default_time_to_live();
+                    }
+                    ttl_opt maybe_ttl;
+                    if (ttl.count() > 0) {
+                        maybe_ttl = ttl;
+                    }
+                    m_to_apply.set_clustered_cell(empty_clustering_key, *def,
+                        atomic_cell::make_live(col.timestamp, to_bytes(col.value), maybe_ttl));
+                } else if (cosc.__isset.super_column) {
+                    // FIXME: implement
+                } else if (cosc.__isset.counter_column) {
+                    // FIXME: implement
+                } else if (cosc.__isset.counter_super_column) {
+                    // FIXME: implement
+                } else {
+                    throw make_exception<InvalidRequestException>("Empty ColumnOrSuperColumn");
+                }
+            } else if (m.__isset.deletion) {
+                // FIXME: implement
+                abort();
+            } else {
+                throw make_exception<InvalidRequestException>("Mutation must have either column or deletion");
+            }
+        }
+        return m_to_apply;
+    }
     static partition_key key_from_thrift(schema_ptr s, bytes k) {
         if (s->partition_key_size() != 1) {
             fail(unimplemented::cause::THRIFT);
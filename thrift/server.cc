@@ -118,7 +118,11 @@ class thrift_server::connection {
     }
     future<> process_one_request() {
         _input->resetBuffer();
-        _output->resetBuffer();
+        // The previous response may still be referenced by the socket, which
+        // sends it without copying it out, so each response gets a buffer
+        // of its own.
+        _output = boost::make_shared<TMemoryBuffer>();
+        _out_proto = _server._protocol_factory->getProtocol(_output);
         return read().then([this] {
             ++_server._requests_served;
             auto ret = _processor_promise.get_future();
@@ -159,10 +163,11 @@ class thrift_server::connection {
         uint32_t len;
         _output->getBuffer(&data, &len);
         net::packed<uint32_t> plen = { net::hton(len) };
-        return _write_buf.write(reinterpret_cast<char*>(&plen), 4).then([this, data, len] {
-            // FIXME: zero-copy
-            return _write_buf.write(reinterpret_cast<char*>(data), len);
-        }).then([this] {
+        scattered_message<char> msg;
+        msg.append(sstring(reinterpret_cast<char*>(&plen), 4));
+        msg.append_static(reinterpret_cast<char*>(data), len);
+        msg.on_delete([output = _output] { });
+        return _write_buf.write(std::move(msg)).then([this] {
             return _write_buf.flush();
         });
     }
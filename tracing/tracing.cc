@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <seastar/core/future-util.hh>
+
+#include "tracing/tracing.hh"
+#include "database.hh"
+#include "schema_builder.hh"
+#include "service/storage_proxy.hh"
+#include "utils/UUID_gen.hh"
+#include "utils/fb_utilities.hh"
+#include "log.hh"
+
+namespace tracing {
+
+static logging::logger logger("tracing");
+
+const sstring trace_keyspace_name("system_traces");
+
+static const sstring SESSIONS("sessions");
+static const sstring EVENTS("events");
+static const sstring NODE_SLOW_LOG("node_slow_log");
+
+distributed<tracing> _the_tracing;
+
+static thread_local tracing* local_tracing = nullptr;
+
+tracing* get_local_tracing_ptr() {
+    return local_tracing;
+}
+
+constexpr std::chrono::seconds tracing::ttl;
+constexpr std::chrono::seconds tracing::flush_period;
+
+schema_ptr sessions() {
+    static thread_local auto sessions = [] {
+        schema_builder builder(make_lw_shared(schema(generate_legacy_id(trace_keyspace_name, SESSIONS), trace_keyspace_name, SESSIONS,
+        // partition key
+        {{"session_id", uuid_type}},
+        // clustering key
+        {},
+        // regular columns
+        {
+            {"coordinator", inet_addr_type},
+            {"duration", int32_type},
+            {"parameters", map_type_impl::get_instance(utf8_type, utf8_type, true)},
+            {"request", utf8_type},
+            {"started_at", timestamp_type},
+        },
+        // static columns
+        {},
+        // regular column name type
+        utf8_type,
+        // comment
+        "traced sessions"
+        )));
+        builder.set_gc_grace_seconds(0);
+        builder.set_default_time_to_live(tracing::ttl);
+        return builder.build(schema_builder::compact_storage::no);
+    }();
+    return sessions;
+}
+
+schema_ptr events() {
+    static thread_local auto events = [] {
+        schema_builder builder(make_lw_shared(schema(generate_legacy_id(trace_keyspace_name, EVENTS), trace_keyspace_name, EVENTS,
+        // partition key
+        {{"session_id", uuid_type}},
+        // clustering key
+        {{"event_id", timeuuid_type}},
+        // regular columns
+        {
+            {"activity", utf8_type},
+            {"source", inet_addr_type},
+            {"source_elapsed", int32_type},
+            {"thread", utf8_type},
+        },
+        // static columns
+        {},
+        // regular column name type
+        utf8_type,
+        // comment
+        "events of traced sessions"
+        )));
+        builder.set_gc_grace_seconds(0);
+        builder.set_default_time_to_live(tracing::ttl);
+        return builder.build(schema_builder::compact_storage::no);
+    }();
+    return events;
+}
+
+// Each node logs its slow queries in a partition of its own.
+schema_ptr node_slow_log() {
+    static thread_local auto node_slow_log = [] {
+        schema_builder builder(make_lw_shared(schema(generate_legacy_id(trace_keyspace_name, NODE_SLOW_LOG), trace_keyspace_name, NODE_SLOW_LOG,
+        // partition key
+        {{"node", inet_addr_type}},
+        // clustering key
+        {{"id", timeuuid_type}},
+        // regular columns
+        {
+            {"duration", int32_type},
+            {"parameters", map_type_impl::get_instance(utf8_type, utf8_type, true)},
+            {"replica_durations", map_type_impl::get_instance(inet_addr_type, int32_type, true)},
+            {"request", utf8_type},
+            {"session_id", uuid_type},
+            {"stage_durations", map_type_impl::get_instance(utf8_type, int32_type, true)},
+            {"started_at", timestamp_type},
+            {"thread", utf8_type},
+        },
+        // static columns
+        {},
+        // regular column name type
+        utf8_type,
+        // comment
+        "requests which took longer than the slow query threshold"
+        )));
+        builder.set_gc_grace_seconds(0);
+        builder.set_default_time_to_live(tracing::ttl);
+        return builder.build(schema_builder::compact_storage::no);
+    }();
+    return node_slow_log;
+}
+
+lw_shared_ptr<keyspace_metadata> trace_keyspace_definition() {
+    return make_lw_shared<keyspace_metadata>(trace_keyspace_name,
+            "org.apache.cassandra.locator.SimpleStrategy",
+            std::map<sstring, sstring>{{"replication_factor", "2"}},
+            true,
+            std::vector<schema_ptr>{sessions(), events(), node_slow_log()});
+}
+
+const char* stage_name(stage s) {
+    switch (s) {
+    case stage::parse: return "parse";
+    case stage::coordinator: return "coordinator";
+    case stage::storage: return "storage";
+    case stage::serialize: return "serialize";
+    }
+    abort();
+}
+
+static int32_t to_micros(std::chrono::steady_clock::duration d) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    return int32_t(std::min<int64_t>(us, std::numeric_limits<int32_t>::max()));
+}
+
+trace_state::~trace_state() {
+    end();
+}
+
+void trace_state::end() {
+    if (!_coordinator || _ended) {
+        return;
+    }
+    _ended = true;
+    if (auto t = get_local_tracing_ptr()) {
+        auto duration = std::chrono::steady_clock::now() - _start;
+        t->maybe_record_slow_query(*this, duration);
+        if (_traced) {
+            t->record_session(*this, duration);
+        }
+    }
+}
+
+void trace_state::trace(sstring activity) {
+    if (!_traced) {
+        return;
+    }
+    if (auto t = get_local_tracing_ptr()) {
+        t->record_event(_session_id, std::move(activity), std::chrono::steady_clock::now() - _start);
+    }
+}
+
+tracing::tracing()
+    : _random_engine(std::random_device()())
+    , _slow_queries(slow_query_log_size)
+    , _flush_timer([this] { flush(); })
+{
+    local_tracing = this;
+    _flush_timer.arm_periodic(flush_period);
+}
+
+tracing::~tracing() {
+    local_tracing = nullptr;
+}
+
+future<> tracing::stop() {
+    _flush_timer.cancel();
+    local_tracing = nullptr;
+    return flush().then([this] {
+        return _gate.close();
+    });
+}
+
+void tracing::draw_untraced_left() {
+    if (_trace_probability <= 0) {
+        _untraced_left = 0;
+        return;
+    }
+    _untraced_left = std::geometric_distribution<uint64_t>(_trace_probability)(_random_engine);
+}
+
+void tracing::set_slow_query_threshold(std::chrono::microseconds threshold) {
+    _slow_query_threshold = std::max(threshold, std::chrono::microseconds(0));
+}
+
+void tracing::set_trace_probability(double p) {
+    if (p < 0 || p > 1) {
+        throw std::invalid_argument(sprint("trace probability %f is not between 0 and 1", p));
+    }
+    _trace_probability = p;
+    draw_untraced_left();
+}
+
+bool tracing::sample() {
+    if (_trace_probability <= 0) {
+        return false;
+    }
+    if (_untraced_left) {
+        --_untraced_left;
+        return false;
+    }
+    draw_untraced_left();
+    return true;
+}
+
+trace_state_ptr tracing::maybe_begin_session(const char* request) {
+    return sample() ? begin_session(request) : nullptr;
+}
+
+trace_state_ptr tracing::begin_request() {
+    if (!_slow_query_threshold.count()) {
+        return nullptr;
+    }
+    if (sample()) {
+        return begin_session({});
+    }
+    return make_lw_shared<trace_state>(utils::UUID(), true, sstring(), false);
+}
+
+trace_state_ptr tracing::begin_session(sstring request) {
+    ++_stats.sessions;
+    return make_lw_shared<trace_state>(utils::UUID_gen::get_time_UUID(), true, std::move(request));
+}
+
+bool tracing::reserve_record() {
+    if (pending() >= max_pending) {
+        ++_stats.dropped;
+        return false;
+    }
+    if (pending() + 1 >= flush_threshold) {
+        flush();
+    }
+    return true;
+}
+
+void tracing::record_session(const trace_state& state, trace_state::duration duration) {
+    if (!reserve_record()) {
+        return;
+    }
+    _pending_sessions.push_back(session_record{state.session_id(), state.request(), state.params(), state.started_at(),
+            to_micros(duration)});
+}
+
+void tracing::record_event(const utils::UUID& session_id, sstring activity, std::chrono::steady_clock::duration elapsed) {
+    if (!reserve_record()) {
+        return;
+    }
+    ++_stats.events;
+    _pending_events.push_back(event_record{session_id, utils::UUID_gen::get_time_UUID(), std::move(activity),
+            to_micros(elapsed)});
+}
+
+void tracing::maybe_record_slow_query(const trace_state& state, trace_state::duration duration) {
+    if (!_slow_query_threshold.count() || duration < _slow_query_threshold) {
+        return;
+    }
+    ++_stats.slow_queries;
+    slow_query_record r;
+    r.id = utils::UUID_gen::get_time_UUID();
+    if (state.traced()) {
+        r.session_id = state.session_id();
+    }
+    r.request = state.request();
+    r.params = state.params();
+    r.started_at = state.started_at();
+    r.duration = to_micros(duration);
+    for (size_t i = 0; i < stage_count; ++i) {
+        r.stage_times[i] = to_micros(state.stage_times()[i]);
+    }
+    for (auto&& rt : state.replica_times()) {
+        auto& t = r.replica_times[rt.first];
+        t = std::max(t, to_micros(rt.second));
+    }
+    _slow_queries.push_back(r);
+    if (reserve_record()) {
+        _pending_slow_queries.push_back(std::move(r));
+    }
+}
+
+// The events of a session go into a single mutation, as they share the
+// partition.
+std::vector<mutation> tracing::make_mutations() {
+    auto ts = api::new_timestamp();
+    auto ttl = std::experimental::make_optional(gc_clock::duration(std::chrono::duration_cast<gc_clock::duration>(tracing::ttl)));
+    auto source = utils::fb_utilities::get_broadcast_address().addr();
+    auto thread = sprint("shard %d", engine().cpu_id());
+    std::vector<mutation> mutations;
+
+    auto ss = sessions();
+    auto& parameters = *ss->get_column_definition("parameters");
+    auto parameters_type = static_pointer_cast<const collection_type_impl>(parameters.type);
+    for (auto&& r : _pending_sessions) {
+        mutation m(partition_key::from_single_value(*ss, uuid_type->decompose(r.session_id)), ss);
+        exploded_clustering_prefix ckey;
+        m.set_cell(ckey, "coordinator", source, ts, ttl);
+        m.set_cell(ckey, "duration", r.duration, ts, ttl);
+        m.set_cell(ckey, "request", r.request, ts, ttl);
+        m.set_cell(ckey, "started_at", r.started_at, ts, ttl);
+        collection_type_impl::mutation params;
+        for (auto&& p : r.params) {
+            params.cells.emplace_back(utf8_type->decompose(p.first), atomic_cell::make_live(ts, utf8_type->decompose(p.second), ttl));
+        }
+        m.set_cell(ckey, parameters, atomic_cell_or_collection::from_collection_mutation(parameters_type->serialize_mutation_form(params)));
+        mutations.push_back(std::move(m));
+    }
+
+    auto es = events();
+    std::unordered_map<utils::UUID, mutation> by_session;
+    for (auto&& r : _pending_events) {
+        auto i = by_session.find(r.session_id);
+        if (i == by_session.end()) {
+            i = by_session.emplace(r.session_id, mutation(partition_key::from_single_value(*es, uuid_type->decompose(r.session_id)), es)).first;
+        }
+        auto ckey = clustering_key::from_single_value(*es, timeuuid_type->decompose(r.event_id));
+        auto& m = i->second;
+        m.set_clustered_cell(ckey, "activity", r.activity, ts, ttl);
+        m.set_clustered_cell(ckey, "source", source, ts, ttl);
+        m.set_clustered_cell(ckey, "source_elapsed", r.elapsed, ts, ttl);
+        m.set_clustered_cell(ckey, "thread", thread, ts, ttl);
+    }
+    for (auto&& e : by_session) {
+        mutations.push_back(std::move(e.second));
+    }
+
+    if (!_pending_slow_queries.empty()) {
+        auto ls = node_slow_log();
+        auto& parameters = *ls->get_column_definition("parameters");
+        auto& replica_durations = *ls->get_column_definition("replica_durations");
+        auto& stage_durations = *ls->get_column_definition("stage_durations");
+        auto to_map_cell = [&] (const column_definition& def, collection_type_impl::mutation cm) {
+            auto type = static_pointer_cast<const collection_type_impl>(def.type);
+            return atomic_cell_or_collection::from_collection_mutation(type->serialize_mutation_form(cm));
+        };
+        mutation m(partition_key::from_single_value(*ls, inet_addr_type->decompose(source)), ls);
+        for (auto&& r : _pending_slow_queries) {
+            auto ckey = clustering_key::from_single_value(*ls, timeuuid_type->decompose(r.id));
+            m.set_clustered_cell(ckey, "duration", r.duration, ts, ttl);
+            m.set_clustered_cell(ckey, "request", r.request, ts, ttl);
+            if (r.session_id) {
+                m.set_clustered_cell(ckey, "session_id", *r.session_id, ts, ttl);
+            }
+            m.set_clustered_cell(ckey, "started_at", r.started_at, ts, ttl);
+            m.set_clustered_cell(ckey, "thread", thread, ts, ttl);
+            collection_type_impl::mutation params;
+            for (auto&& p : r.params) {
+                params.cells.emplace_back(utf8_type->decompose(p.first), atomic_cell::make_live(ts, utf8_type->decompose(p.second), ttl));
+            }
+            m.set_clustered_cell(ckey, parameters, to_map_cell(parameters, std::move(params)));
+            collection_type_impl::mutation replicas;
+            for (auto&& rt : r.replica_times) {
+                replicas.cells.emplace_back(inet_addr_type->decompose(rt.first.addr()), atomic_cell::make_live(ts, int32_type->decompose(rt.second), ttl));
+            }
+            m.set_clustered_cell(ckey, replica_durations, to_map_cell(replica_durations, std::move(replicas)));
+            collection_type_impl::mutation stages;
+            for (size_t i = 0; i < stage_count; ++i) {
+                stages.cells.emplace_back(utf8_type->decompose(sstring(stage_name(stage(i)))), atomic_cell::make_live(ts, int32_type->decompose(r.stage_times[i]), ttl));
+            }
+            m.set_clustered_cell(ckey, stage_durations, to_map_cell(stage_durations, std::move(stages)));
+        }
+        mutations.push_back(std::move(m));
+    }
+
+    _pending_sessions.clear();
+    _pending_events.clear();
+    _pending_slow_queries.clear();
+    return mutations;
+}
+
+// A single write is in flight at a time; what is recorded meanwhile waits
+// for the next one, or is dropped if too much piles up.
+future<> tracing::flush() {
+    if (_flushing || !pending() || _gate.is_closed()) {
+        return make_ready_future<>();
+    }
+    _flushing = true;
+    return with_gate(_gate, [this] {
+        return futurize<void>::apply([this] {
+            return service::get_local_storage_proxy().mutate(make_mutations(), db::consistency_level::ANY);
+        }).handle_exception([this] (std::exception_ptr ep) {
+            ++_stats.write_errors;
+            logger.debug("Failed to write traces: {}", ep);
+        }).finally([this] {
+            _flushing = false;
+        });
+    });
+}
+
+}
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+#include <experimental/optional>
+#include <boost/circular_buffer.hpp>
+
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/sstring.hh>
+#include <seastar/core/timer.hh>
+
+#include "db_clock.hh"
+#include "gms/inet_address.hh"
+#include "schema.hh"
+#include "utils/UUID.hh"
+
+class keyspace_metadata;
+class mutation;
+
+// Request tracing, in the manner of Cassandra's.
+//
+// A sampled fraction of the requests a node coordinates are traced: the
+// coordinator and the replicas record what they do for the request as
+// events of its session, which end up in the system_traces keyspace. The
+// session id travels to the replicas with the read command.
+//
+// Events are buffered by the shard recording them, so recording takes no
+// lock, and are written out in batches in the background. An untraced
+// request costs a null check at each trace point and a decrement of the
+// sampling countdown.
+//
+// Requests taking longer than a threshold are also recorded, with where
+// their time went, in the slow query log, whether they are traced or not.
+namespace tracing {
+
+extern const sstring trace_keyspace_name;
+
+schema_ptr sessions();
+schema_ptr events();
+schema_ptr node_slow_log();
+lw_shared_ptr<keyspace_metadata> trace_keyspace_definition();
+
+// The stages the slow query log breaks the duration of a request into.
+enum class stage {
+    parse,       // parsing and preparing the statement
+    coordinator, // waiting for the replicas to respond
+    storage,     // reading memtables, cache and sstables on this node
+    serialize,   // serializing the response
+};
+
+constexpr size_t stage_count = 4;
+
+const char* stage_name(stage s);
+
+// What a node does for a request. The coordinator's state records the
+// request when it ends: as a session if it is traced, and in the slow query
+// log if it took too long. A state which isn't traced only keeps the times
+// of the request's stages.
+class trace_state {
+public:
+    using duration = std::chrono::steady_clock::duration;
+private:
+    utils::UUID _session_id;
+    bool _coordinator;
+    bool _traced;
+    bool _ended = false;
+    std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+    db_clock::time_point _started_at = db_clock::now();
+    sstring _request;
+    std::map<sstring, sstring> _params;
+    std::array<duration, stage_count> _stage_times{};
+    std::vector<std::pair<gms::inet_address, duration>> _replica_times;
+public:
+    trace_state(utils::UUID session_id, bool coordinator, sstring request = {}, bool traced = true)
+        : _session_id(session_id)
+        , _coordinator(coordinator)
+        , _traced(traced)
+        , _request(std::move(request))
+    { }
+    trace_state(const trace_state&) = delete;
+    ~trace_state();
+
+    const utils::UUID& session_id() const {
+        return _session_id;
+    }
+    bool traced() const {
+        return _traced;
+    }
+    const sstring& request() const {
+        return _request;
+    }
+    const std::map<sstring, sstring>& params() const {
+        return _params;
+    }
+    db_clock::time_point started_at() const {
+        return _started_at;
+    }
+    const std::array<duration, stage_count>& stage_times() const {
+        return _stage_times;
+    }
+    const std::vector<std::pair<gms::inet_address, duration>>& replica_times() const {
+        return _replica_times;
+    }
+
+    void set_request(sstring request) {
+        _request = std::move(request);
+    }
+
+    // Describes the request, e.g. its consistency level, in the session.
+    void add_param(sstring name, sstring value) {
+        _params.emplace(std::move(name), std::move(value));
+    }
+
+    // Stages may be gone through more than once, e.g. by the queries of a
+    // statement, their times adding up.
+    void add_stage_time(stage s, duration d) {
+        _stage_times[size_t(s)] += d;
+    }
+    void add_replica_time(gms::inet_address ep, duration d) {
+        _replica_times.emplace_back(ep, d);
+    }
+
+    void trace(sstring activity);
+
+    // Ends the request, for the coordinator. Whatever happens for it later,
+    // like replicas responding after the consistency level was reached,
+    // doesn't count into its duration.
+    void end();
+};
+
+using trace_state_ptr = lw_shared_ptr<trace_state>;
+
+template <typename... Args>
+inline void trace(const trace_state_ptr& state, const char* fmt, Args&&... args) {
+    if (state && state->traced()) {
+        state->trace(sprint(fmt, std::forward<Args>(args)...));
+    }
+}
+
+class tracing {
+public:
+    // Traces are kept for a day, like Cassandra's.
+    static constexpr std::chrono::seconds ttl = std::chrono::seconds(24 * 3600);
+    static constexpr std::chrono::seconds flush_period = std::chrono::seconds(2);
+    // Records pending to be written beyond which a write is started right
+    // away, and beyond which new ones are dropped.
+    static constexpr size_t flush_threshold = 1000;
+    static constexpr size_t max_pending = 10000;
+    // Slow queries kept in memory by each shard, the latest ones.
+    static constexpr size_t slow_query_log_size = 100;
+
+    struct stats {
+        uint64_t sessions = 0;
+        uint64_t events = 0;
+        uint64_t slow_queries = 0;
+        uint64_t dropped = 0;
+        uint64_t write_errors = 0;
+    };
+
+    struct slow_query_record {
+        utils::UUID id;
+        // That of the request's session, if it was traced.
+        std::experimental::optional<utils::UUID> session_id;
+        sstring request;
+        std::map<sstring, sstring> params;
+        db_clock::time_point started_at;
+        int32_t duration;
+        std::array<int32_t, stage_count> stage_times;
+        // The longest a replica took to respond, in microseconds.
+        std::map<gms::inet_address, int32_t> replica_times;
+    };
+private:
+    struct session_record {
+        utils::UUID session_id;
+        sstring request;
+        std::map<sstring, sstring> params;
+        db_clock::time_point started_at;
+        int32_t duration;
+    };
+    struct event_record {
+        utils::UUID session_id;
+        utils::UUID event_id;
+        sstring activity;
+        int32_t elapsed;
+    };
+    double _trace_probability = 0;
+    // Requests to go untraced before the next sampled one. Gaps between
+    // sampled requests follow a geometric distribution, so that sampling
+    // costs a decrement rather than a random number per request.
+    uint64_t _untraced_left = 0;
+    std::default_random_engine _random_engine;
+    std::vector<session_record> _pending_sessions;
+    std::vector<event_record> _pending_events;
+    std::vector<slow_query_record> _pending_slow_queries;
+    // Zero when the slow query log is disabled.
+    std::chrono::microseconds _slow_query_threshold{0};
+    boost::circular_buffer<slow_query_record> _slow_queries;
+    bool _flushing = false;
+    timer<lowres_clock> _flush_timer;
+    seastar::gate _gate;
+    stats _stats;
+private:
+    size_t pending() const {
+        return _pending_sessions.size() + _pending_events.size() + _pending_slow_queries.size();
+    }
+    bool sample();
+    void draw_untraced_left();
+    bool reserve_record();
+    std::vector<mutation> make_mutations();
+public:
+    tracing();
+    ~tracing();
+    future<> stop();
+
+    // The probability, between 0 and 1, of a request to be traced.
+    void set_trace_probability(double p);
+    double get_trace_probability() const {
+        return _trace_probability;
+    }
+    // Requests taking at least this long are logged as slow; zero disables
+    // the slow query log.
+    void set_slow_query_threshold(std::chrono::microseconds threshold);
+    std::chrono::microseconds get_slow_query_threshold() const {
+        return _slow_query_threshold;
+    }
+    // The latest slow queries of this shard, oldest first.
+    const boost::circular_buffer<slow_query_record>& slow_queries() const {
+        return _slow_queries;
+    }
+    const stats& get_stats() const {
+        return _stats;
+    }
+
+    // A new session for the coordinator of a request, or null if the
+    // request isn't sampled.
+    trace_state_ptr maybe_begin_session(const char* request);
+    trace_state_ptr begin_session(sstring request);
+    // A state for a client request as a whole, which its coordinator then
+    // adds to. Null unless the slow query log is enabled, in which case the
+    // request is sampled for tracing here rather than by the coordinator.
+    trace_state_ptr begin_request();
+
+    void record_session(const trace_state& state, trace_state::duration duration);
+    void record_event(const utils::UUID& session_id, sstring activity, std::chrono::steady_clock::duration elapsed);
+    void maybe_record_slow_query(const trace_state& state, trace_state::duration duration);
+
+    // Writes out the records pending.
+    future<> flush();
+};
+
+extern distributed<tracing> _the_tracing;
+
+inline distributed<tracing>& get_tracing() {
+    return _the_tracing;
+}
+
+// This shard's instance, or null when the service isn't running, as in
+// tests, in which case nothing is traced.
+tracing* get_local_tracing_ptr();
+
+// A state for the events of a replica working on a request whose
+// coordinator traces it under the given session.
+inline trace_state_ptr make_replica_trace_state(const std::experimental::optional<utils::UUID>& session_id) {
+    if (!session_id || !get_local_tracing_ptr()) {
+        return nullptr;
+    }
+    return make_lw_shared<trace_state>(*session_id, false);
+}
+
+// A new session for a request on this shard, if it's sampled.
+inline trace_state_ptr maybe_begin_session(const char* request) {
+    auto t = get_local_tracing_ptr();
+    return t ? t->maybe_begin_session(request) : nullptr;
+}
+
+inline trace_state_ptr begin_request() {
+    auto t = get_local_tracing_ptr();
+    return t ? t->begin_request() : nullptr;
+}
+
+}
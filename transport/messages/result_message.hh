@@ -119,14 +119,26 @@ class result_message::schema_change : public result_message {
 
 class result_message::rows : public result_message {
 private:
-    std::unique_ptr<cql3::result_set> _rs;
+    mutable std::unique_ptr<cql3::result_set> _rs;
+    std::unique_ptr<cql3::result_generator> _generator;
 public:
     rows(std::unique_ptr<cql3::result_set> rs) : _rs(std::move(rs)) {}
+    rows(std::unique_ptr<cql3::result_generator> generator) : _generator(std::move(generator)) {}
 
+    // Builds the result set of a generated result the first time it is
+    // asked for.
     const cql3::result_set& rs() const {
+        if (!_rs) {
+            _rs = _generator->build();
+        }
         return *_rs;
     }
 
+    // Set when the rows can be written without building the result set.
+    const cql3::result_generator* generator() const {
+        return _generator.get();
+    }
+
     virtual void accept(result_message::visitor& v) override {
         v.visit(*this);
     }
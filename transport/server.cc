@@ -27,6 +27,7 @@
 #include <boost/assign.hpp>
 #include <boost/locale/encoding_utf.hpp>
 #include <boost/range/adaptor/sliced.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
 
 #include "cql3/statements/batch_statement.hh"
 #include "service/migration_manager.hh"
@@ -37,6 +38,7 @@
 #include "core/reactor.hh"
 #include "utils/UUID.hh"
 #include "database.hh"
+#include "dht/i_partitioner.hh"
 #include "net/byteorder.hh"
 #include <seastar/core/scollectd.hh>
 
@@ -44,14 +46,24 @@
 #include "service/query_state.hh"
 #include "service/client_state.hh"
 #include "exceptions/exceptions.hh"
+#include "bytes_ostream.hh"
 
 #include <cassert>
 #include <string>
+#include <lz4.h>
+#include <snappy-c.h>
 
 namespace transport {
 
 static logging::logger logger("cql_server");
 
+// Flag of the frames whose body is compressed.
+static constexpr uint8_t cql_frame_compressed = 0x01;
+
+// Protects against decompressing a corrupted or malicious frame into more
+// memory than any frame the protocol allows.
+static constexpr size_t max_uncompressed_frame_size = 256 << 20;
+
 struct cql_frame_error : std::exception {
     const char* what() const throw () override {
         return "bad cql binary frame";
@@ -167,13 +179,21 @@ event::event_type parse_event_type(const sstring& value)
 class cql_server::response {
     int16_t           _stream;
     cql_binary_opcode _opcode;
-    std::vector<char> _body;
+    bytes_ostream _body;
 public:
     response(int16_t stream, cql_binary_opcode opcode)
         : _stream{stream}
         , _opcode{opcode}
     { }
+    // The message points into the body, so the response has to be kept
+    // alive until it is sent.
     scattered_message<char> make_message(uint8_t version);
+    size_t size() const {
+        return _body.size();
+    }
+    // Compresses the body into buf, and returns the size it compressed to,
+    // or 0 if it did not get any smaller.
+    size_t compress(cql_compression compression, std::vector<char>& buf);
     void serialize(const event::schema_change& event, uint8_t version);
     void write_byte(uint8_t b);
     void write_int(int32_t n);
@@ -193,16 +213,31 @@ class cql_server::response {
     void write_string_multimap(std::multimap<sstring, sstring> string_map);
     void write_value(bytes_opt value);
     void write(const cql3::metadata& m);
-    future<> output(output_stream<char>& out, uint8_t version);
+    void write_rows(const cql3::result_generator& g);
+    // Writes the frame with the body compressed into buf by compress().
+    future<> output(output_stream<char>& out, uint8_t version, const std::vector<char>& buf, size_t compressed_size);
 private:
-    sstring make_frame(uint8_t version, size_t length);
+    void write(const char* s, size_t n) {
+        _body.write(bytes_view(reinterpret_cast<const int8_t*>(s), n));
+    }
+    sstring make_frame(uint8_t version, uint8_t flags, size_t length);
 };
 
-cql_server::cql_server(distributed<service::storage_proxy>& proxy, distributed<cql3::query_processor>& qp)
+cql_server::cql_server(distributed<service::storage_proxy>& proxy, distributed<cql3::query_processor>& qp,
+        uint32_t max_requests_per_connection, size_t max_request_memory_per_connection,
+        uint32_t max_concurrent_requests,
+        std::unordered_map<sstring, service::service_level_options> service_levels)
     : _proxy(proxy)
     , _query_processor(qp)
+    , _max_requests_per_connection(std::max<uint32_t>(max_requests_per_connection, 1))
+    , _max_request_memory_per_connection(std::max<size_t>(max_request_memory_per_connection, 1))
     , _collectd_registrations(std::make_unique<scollectd::registrations>(setup_collectd()))
+    , _service_levels(max_concurrent_requests)
 {
+    for (auto&& e : service_levels) {
+        _service_levels.set_service_level(e.first, e.second);
+    }
+    _service_level_registrations = std::make_unique<scollectd::registrations>(setup_service_level_collectd());
 }
 
 scollectd::registrations
@@ -224,9 +259,62 @@ cql_server::setup_collectd() {
             scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
                     "queue_length", "requests_serving"),
             scollectd::make_typed(scollectd::data_type::GAUGE, _requests_serving)),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "compressed_bytes_received"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, _compressed_bytes_received)),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "uncompressed_bytes_received"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, _uncompressed_bytes_received)),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "compressed_bytes_sent"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, _compressed_bytes_sent)),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "uncompressed_bytes_sent"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, _uncompressed_bytes_sent)),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
+                    "total_requests", "requests_blocked"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, _requests_blocked)),
     };
 }
 
+scollectd::registrations
+cql_server::setup_service_level_collectd() {
+    scollectd::registrations regs;
+    for (auto&& name : _service_levels.service_levels()) {
+        auto add = [this, &regs, name] (sstring type, sstring metric, scollectd::data_type dt,
+                std::function<int64_t (const service::service_level_controller::stats&)> f) {
+            regs.push_back(
+                scollectd::add_polled_metric(
+                    scollectd::type_instance_id("service_level", scollectd::per_cpu_plugin_instance,
+                            type, name + "." + metric),
+                    scollectd::make_typed(dt, [this, name, f = std::move(f)] {
+                        return f(_service_levels.get_stats(name));
+                    })));
+        };
+        add("total_requests", "requests", scollectd::data_type::DERIVE, [] (const service::service_level_controller::stats& s) {
+            return s.requests;
+        });
+        add("total_requests", "throttled", scollectd::data_type::DERIVE, [] (const service::service_level_controller::stats& s) {
+            return s.throttled;
+        });
+        add("queue_length", "queued", scollectd::data_type::GAUGE, [] (const service::service_level_controller::stats& s) {
+            return s.queued;
+        });
+        add("latency", "p50_us", scollectd::data_type::GAUGE, [] (const service::service_level_controller::stats& s) {
+            return s.latencies.percentile(0.5);
+        });
+        add("latency", "p99_us", scollectd::data_type::GAUGE, [] (const service::service_level_controller::stats& s) {
+            return s.latencies.percentile(0.99);
+        });
+    }
+    return regs;
+}
+
 future<> cql_server::stop() {
     service::get_local_storage_service().unregister_subscriber(_notifier.get());
     service::get_local_migration_manager().unregister_listener(_notifier.get());
@@ -245,6 +333,17 @@ cql_server::listen(ipv4_addr addr) {
     return make_ready_future<>();
 }
 
+future<>
+cql_server::listen_shard_aware(ipv4_addr addr) {
+    _shard_aware_port = addr.port;
+    listen_options lo;
+    lo.reuse_address = true;
+    auto port = uint16_t(addr.port + engine().cpu_id());
+    _listeners.push_back(engine().listen(make_ipv4_address(ipv4_addr{addr.ip, port}), lo));
+    do_accepts(_listeners.size() - 1);
+    return make_ready_future<>();
+}
+
 void
 cql_server::do_accepts(int which) {
     _listeners[which].accept().then([this, which] (connected_socket fd, socket_address addr) mutable {
@@ -345,6 +444,25 @@ cql_server::connection::read_frame() {
     }
 }
 
+// The state of a client request, kept when the slow query log needs the
+// times of its stages, in which case the request is described.
+template <typename Describe>
+static tracing::trace_state_ptr begin_request(service::query_state& qs, Describe&& describe) {
+    auto trace_state = tracing::begin_request();
+    if (trace_state) {
+        trace_state->set_request(describe());
+    }
+    qs.set_trace_state(trace_state);
+    return trace_state;
+}
+
+static void end_request(service::query_state& qs) {
+    if (qs.get_trace_state()) {
+        qs.get_trace_state()->end();
+        qs.set_trace_state(nullptr);
+    }
+}
+
 future<> cql_server::connection::process_request_one(temporary_buffer<char> buf,
                                                      uint8_t op,
                                                      uint16_t stream) {
@@ -362,6 +480,10 @@ future<> cql_server::connection::process_request_one(temporary_buffer<char> buf,
         }
     }).then_wrapped([stream, this] (future<> f) {
         --_server._requests_serving;
+        auto i = _query_states.find(stream);
+        if (i != _query_states.end()) {
+            end_request(i->second.query_state);
+        }
         try {
             f.get();
             return make_ready_future<>();
@@ -390,12 +512,18 @@ cql_server::connection::connection(cql_server& server, connected_socket&& fd, so
     , _fd(std::move(fd))
     , _read_buf(_fd.input())
     , _write_buf(_fd.output())
+    , _requests_limit(server._max_requests_per_connection)
+    , _memory_limit(server._max_request_memory_per_connection)
     , _client_state(service::client_state::for_external_calls())
 { }
 
 cql_server::connection::~connection()
 {
     _server._notifier->unregister_connection(this);
+    if (_uncompressed_bytes_received || _uncompressed_bytes_sent) {
+        logger.debug("connection compressed {} bytes received into {} and {} bytes sent into {}",
+                _uncompressed_bytes_received, _compressed_bytes_received, _uncompressed_bytes_sent, _compressed_bytes_sent);
+    }
 }
 
 future<> cql_server::connection::process()
@@ -436,37 +564,146 @@ future<> cql_server::connection::process_request() {
 
         auto& f = *maybe_frame;
 
-        // FIXME: compression
-        if (f.flags & 0x01) {
-            throw std::runtime_error("CQL frame compression is not supported");
+        if ((f.flags & cql_frame_compressed) && _compression == cql_compression::none) {
+            throw exceptions::protocol_exception("Received a compressed frame, but no compression was negotiated in STARTUP");
         }
 
         auto op = f.opcode;
         auto stream = f.stream;
+        auto compressed = f.flags & cql_frame_compressed;
+        // A frame larger than the limit is let in alone.
+        auto mem = std::min<size_t>(f.length, _server._max_request_memory_per_connection);
 
-        return _read_buf.read_exactly(f.length).then([this, op, stream] (temporary_buffer<char> buf) {
-
-            ++_server._requests_served;
-            ++_server._requests_serving;
-
-            with_gate(
-                _pending_requests_gate,
-                [this, op, stream, buf = std::move(buf)] () mutable {
-                    return process_request_one(std::move(buf), op, stream);
-                }
-            ).handle_exception([] (std::exception_ptr ex) {
-                logger.error("request processing failed: {}", ex);
+        if (!_requests_limit.current() || _memory_limit.current() < mem) {
+            ++_server._requests_blocked;
+        }
+        return _requests_limit.wait(1).then([this, mem] {
+            return _memory_limit.wait(mem).handle_exception([this] (std::exception_ptr ep) {
+                _requests_limit.signal(1);
+                return make_exception_future<>(ep);
             });
+        }).then([this, op, stream, compressed, length = f.length, mem] {
+            return _read_buf.read_exactly(length).then_wrapped([this, op, stream, compressed, mem] (future<temporary_buffer<char>> f) {
+                temporary_buffer<char> buf;
+                try {
+                    buf = std::get<0>(f.get());
+                    if (compressed) {
+                        buf = decompress(std::move(buf));
+                    }
+                } catch (...) {
+                    _requests_limit.signal(1);
+                    _memory_limit.signal(mem);
+                    throw;
+                }
 
-            return make_ready_future<>();
+                ++_server._requests_served;
+                ++_server._requests_serving;
+
+                with_gate(
+                    _pending_requests_gate,
+                    [this, op, stream, buf = std::move(buf)] () mutable {
+                        auto size = buf.size();
+                        return _server._service_levels.run(_client_state.get_service_level(), size,
+                                [this, op, stream, buf = std::move(buf)] () mutable {
+                            return process_request_one(std::move(buf), op, stream);
+                        });
+                    }
+                ).handle_exception([] (std::exception_ptr ex) {
+                    logger.error("request processing failed: {}", ex);
+                }).finally([this, mem] {
+                    _requests_limit.signal(1);
+                    _memory_limit.signal(mem);
+                });
+
+                return make_ready_future<>();
+            });
         });
     });
 }
 
+temporary_buffer<char> decompress_frame_body(cql_compression compression, temporary_buffer<char> buf)
+{
+    temporary_buffer<char> out;
+    switch (compression) {
+    case cql_compression::lz4: {
+        // The body starts with its uncompressed length, in big endian.
+        if (buf.size() < 4) {
+            throw exceptions::protocol_exception("Truncated LZ4 compressed frame");
+        }
+        auto p = reinterpret_cast<const uint8_t*>(buf.get());
+        int32_t len = (static_cast<uint32_t>(p[0]) << 24)
+                    | (static_cast<uint32_t>(p[1]) << 16)
+                    | (static_cast<uint32_t>(p[2]) << 8)
+                    | (static_cast<uint32_t>(p[3]));
+        buf.trim_front(4);
+        if (len < 0 || size_t(len) > max_uncompressed_frame_size) {
+            throw exceptions::protocol_exception(sprint("Invalid uncompressed length of LZ4 compressed frame: %d", len));
+        }
+        if (len) {
+            out = temporary_buffer<char>(len);
+            if (LZ4_decompress_safe(buf.get(), out.get_write(), buf.size(), len) != len) {
+                throw exceptions::protocol_exception("Corrupted LZ4 compressed frame");
+            }
+        }
+        break;
+    }
+    case cql_compression::snappy: {
+        size_t len;
+        if (snappy_uncompressed_length(buf.get(), buf.size(), &len) != SNAPPY_OK || len > max_uncompressed_frame_size) {
+            throw exceptions::protocol_exception("Corrupted Snappy compressed frame");
+        }
+        if (len) {
+            out = temporary_buffer<char>(len);
+            if (snappy_uncompress(buf.get(), buf.size(), out.get_write(), &len) != SNAPPY_OK) {
+                throw exceptions::protocol_exception("Corrupted Snappy compressed frame");
+            }
+            out.trim(len);
+        }
+        break;
+    }
+    case cql_compression::none:
+        assert(0);
+    }
+    return out;
+}
+
+temporary_buffer<char> cql_server::connection::decompress(temporary_buffer<char> buf)
+{
+    auto compressed_size = buf.size();
+    auto out = decompress_frame_body(_compression, std::move(buf));
+    _compressed_bytes_received += compressed_size;
+    _uncompressed_bytes_received += out.size();
+    _server._compressed_bytes_received += compressed_size;
+    _server._uncompressed_bytes_received += out.size();
+    return out;
+}
+
 future<> cql_server::connection::process_startup(uint16_t stream, temporary_buffer<char> buf)
 {
-    /*auto string_map =*/ read_string_map(buf);
-    return write_ready(stream);
+    auto string_map = read_string_map(buf);
+    auto compression = cql_compression::none;
+    auto i = string_map.find("COMPRESSION");
+    if (i != string_map.end()) {
+        auto algorithm = boost::algorithm::to_lower_copy(i->second);
+        if (algorithm == "lz4") {
+            compression = cql_compression::lz4;
+        } else if (algorithm == "snappy") {
+            compression = cql_compression::snappy;
+        } else {
+            throw exceptions::protocol_exception(sprint("Unknown compression algorithm: %s", i->second));
+        }
+    }
+    i = string_map.find("SERVICE_LEVEL");
+    if (i != string_map.end()) {
+        if (!_server._service_levels.has_service_level(i->second)) {
+            throw exceptions::protocol_exception(sprint("Unknown service level: %s", i->second));
+        }
+        _client_state.set_service_level(i->second);
+    }
+    // The response to STARTUP itself is never compressed.
+    auto f = write_ready(stream);
+    _compression = compression;
+    return f;
 }
 
 future<> cql_server::connection::process_auth_response(uint16_t stream, temporary_buffer<char> buf)
@@ -502,9 +739,10 @@ future<> cql_server::connection::process_query(uint16_t stream, temporary_buffer
 {
     auto query = read_long_string_view(buf);
     auto& q_state = get_query_state(stream);
+    auto trace_state = begin_request(q_state.query_state, [&] { return query.to_string(); });
     q_state.options = read_options(buf);
-    return _server._query_processor.local().process(query, q_state.query_state, *q_state.options).then([this, stream, buf = std::move(buf)] (auto msg) {
-         return this->write_result(stream, msg);
+    return _server._query_processor.local().process(query, q_state.query_state, *q_state.options).then([this, stream, trace_state, buf = std::move(buf)] (auto msg) {
+         return this->write_result(stream, msg, trace_state);
     });
 }
 
@@ -547,8 +785,9 @@ future<> cql_server::connection::process_execute(uint16_t stream, temporary_buff
     if (stmt->get_bound_terms() != options.get_values_count()) {
         throw exceptions::invalid_request_exception("Invalid amount of bind variables");
     }
-    return _server._query_processor.local().process_statement(stmt, query_state, options).then([this, stream, buf = std::move(buf)] (auto msg) {
-         return this->write_result(stream, msg);
+    auto trace_state = begin_request(query_state, [&] { return sprint("Execute prepared statement %s", to_hex(id)); });
+    return _server._query_processor.local().process_statement(stmt, query_state, options).then([this, stream, trace_state, buf = std::move(buf)] (auto msg) {
+         return this->write_result(stream, msg, trace_state);
     });
 }
 
@@ -560,6 +799,7 @@ future<> cql_server::connection::process_batch(uint16_t stream, temporary_buffer
 
     const auto type = read_byte(buf);
     const unsigned n = read_unsigned_short(buf);
+    auto parse_start = std::chrono::steady_clock::now();
 
     std::vector<shared_ptr<cql3::statements::modification_statement>> modifications;
     std::vector<std::vector<bytes_view_opt>> values;
@@ -615,9 +855,13 @@ future<> cql_server::connection::process_batch(uint16_t stream, temporary_buffer
     q_state.options = std::make_unique<cql3::query_options>(std::move(*read_options(buf)), std::move(values));
     auto& options = *q_state.options;
 
+    auto trace_state = begin_request(query_state, [&] { return sprint("Execute batch of %d statements", n); });
+    if (trace_state) {
+        trace_state->add_stage_time(tracing::stage::parse, std::chrono::steady_clock::now() - parse_start);
+    }
     auto batch = ::make_shared<cql3::statements::batch_statement>(-1, cql3::statements::batch_statement::type(type), std::move(modifications), cql3::attributes::none());
-    return _server._query_processor.local().process_batch(batch, query_state, options).then([this, stream, batch] (auto msg) {
-        return this->write_result(stream, msg);
+    return _server._query_processor.local().process_batch(batch, query_state, options).then([this, stream, batch, trace_state] (auto msg) {
+        return this->write_result(stream, msg, trace_state);
     });
 }
 
@@ -704,7 +948,19 @@ future<> cql_server::connection::write_supported(int16_t stream)
 {
     std::multimap<sstring, sstring> opts;
     opts.insert({"CQL_VERSION", cql3::query_processor::CQL_VERSION});
+    opts.insert({"COMPRESSION", "lz4"});
     opts.insert({"COMPRESSION", "snappy"});
+    // Lets drivers compute the shard owning a token and, when shard-aware
+    // ports are enabled, connect to it directly instead of having every
+    // request bounced to the owning shard by storage_proxy.
+    auto& partitioner = dht::global_partitioner();
+    opts.insert({"SCYLLA_SHARD", to_sstring(engine().cpu_id())});
+    opts.insert({"SCYLLA_NR_SHARDS", to_sstring(smp::count)});
+    opts.insert({"SCYLLA_PARTITIONER", partitioner.name()});
+    opts.insert({"SCYLLA_SHARDING_ALGORITHM", partitioner.sharding_algorithm()});
+    if (_server._shard_aware_port) {
+        opts.insert({"SCYLLA_SHARD_AWARE_PORT", to_sstring(_server._shard_aware_port)});
+    }
     auto response = make_shared<cql_server::response>(stream, cql_binary_opcode::SUPPORTED);
     response->write_string_multimap(opts);
     return write_response(response);
@@ -760,6 +1016,11 @@ class cql_server::fmt_visitor : public messages::result_message::visitor {
 
     virtual void visit(const messages::result_message::rows& m) override {
         _response->write_int(0x0002);
+        if (auto generator = m.generator()) {
+            _response->write(generator->get_metadata());
+            _response->write_rows(*generator);
+            return;
+        }
         auto& rs = m.rs();
         _response->write(rs.get_metadata());
         _response->write_int(rs.size());
@@ -771,11 +1032,16 @@ class cql_server::fmt_visitor : public messages::result_message::visitor {
     }
 };
 
-future<> cql_server::connection::write_result(int16_t stream, shared_ptr<messages::result_message> msg)
+future<> cql_server::connection::write_result(int16_t stream, shared_ptr<messages::result_message> msg,
+        const tracing::trace_state_ptr& trace_state)
 {
+    auto start = std::chrono::steady_clock::now();
     auto response = make_shared<cql_server::response>(stream, cql_binary_opcode::RESULT);
     fmt_visitor fmt{_version, response};
     msg->accept(fmt);
+    if (trace_state) {
+        trace_state->add_stage_time(tracing::stage::serialize, std::chrono::steady_clock::now() - start);
+    }
     return write_response(response);
 }
 
@@ -807,12 +1073,38 @@ future<> cql_server::connection::write_schema_change_event(const event::schema_c
 
 future<> cql_server::connection::write_response(shared_ptr<cql_server::response> response)
 {
-    _ready_to_respond = _ready_to_respond.then([this, response = std::move(response)] () mutable {
-        return response->output(_write_buf, _version).then([this, response] {
+    // Compression is decided when the response is queued, so that
+    // a STARTUP response is not compressed with what it just negotiated.
+    auto compression = _compression;
+    auto written = make_lw_shared<promise<>>();
+    auto done = written->get_future();
+    _ready_to_respond = _ready_to_respond.then([this, compression, response = std::move(response)] () mutable {
+        size_t compressed_size = 0;
+        if (compression != cql_compression::none) {
+            compressed_size = response->compress(compression, _compression_buffer);
+        }
+        auto f = make_ready_future<>();
+        if (compressed_size) {
+            _compressed_bytes_sent += compressed_size;
+            _uncompressed_bytes_sent += response->size();
+            _server._compressed_bytes_sent += compressed_size;
+            _server._uncompressed_bytes_sent += response->size();
+            f = response->output(_write_buf, _version, _compression_buffer, compressed_size);
+        } else {
+            auto msg = response->make_message(_version);
+            msg.on_delete([response] { });
+            f = _write_buf.write(std::move(msg));
+        }
+        return f.then([this, response] {
             return _write_buf.flush();
         });
+    }).finally([written] {
+        // Write failures are the connection's, not the request's.
+        written->set_value();
     });
-    return make_ready_future<>();
+    // Resolves once the response is written, so that requests keep holding
+    // their share of the connection's limits until then.
+    return done;
 }
 
 void cql_server::connection::check_room(temporary_buffer<char>& buf, size_t n)
@@ -994,10 +1286,7 @@ std::unique_ptr<cql3::query_options> cql_server::connection::read_options(tempor
         ::shared_ptr<service::pager::paging_state> paging_state;
         int32_t page_size = flags.contains<options_flag::PAGE_SIZE>() ? read_int(buf) : -1;
         if (flags.contains<options_flag::PAGING_STATE>()) {
-            fail(unimplemented::cause::PAGING);
-#if 0
-            paging_state = PagingState.deserialize(CBUtil.readValue(body))
-#endif
+            paging_state = service::pager::paging_state::deserialize(read_value(buf));
         }
 
         db::consistency_level serial_consistency = db::consistency_level::SERIAL;
@@ -1079,24 +1368,64 @@ bytes_view_opt cql_server::connection::read_value_view(temporary_buffer<char>& b
 
 scattered_message<char> cql_server::response::make_message(uint8_t version) {
     scattered_message<char> msg;
-    sstring body{_body.data(), _body.size()};
-    sstring frame = make_frame(version, body.size());
-    msg.append(std::move(frame));
-    msg.append(std::move(body));
+    msg.append(make_frame(version, 0, _body.size()));
+    for (bytes_view fragment : _body.fragments()) {
+        msg.append_static(reinterpret_cast<const char*>(fragment.data()), fragment.size());
+    }
     return msg;
 }
 
 future<>
-cql_server::response::output(output_stream<char>& out, uint8_t version) {
-    auto frame = make_frame(version, _body.size());
+cql_server::response::output(output_stream<char>& out, uint8_t version, const std::vector<char>& buf, size_t compressed_size) {
+    // The buffer is reused for the next response, so it has to be copied
+    // out, unlike an uncompressed body.
+    auto frame = make_frame(version, cql_frame_compressed, compressed_size);
     auto tmp = temporary_buffer<char>(frame.size());
     std::copy_n(frame.begin(), frame.size(), tmp.get_write());
     auto f = out.write(tmp.get(), tmp.size());
-    return f.then([this, &out, tmp = std::move(tmp)] {
-        return out.write(_body.data(), _body.size());
+    return f.then([&out, &buf, compressed_size, tmp = std::move(tmp)] {
+        return out.write(buf.data(), compressed_size);
     });
 }
 
+size_t cql_server::response::compress(cql_compression compression, std::vector<char>& buf)
+{
+    return compress_frame_body(compression, _body.linearize(), buf);
+}
+
+size_t compress_frame_body(cql_compression compression, bytes_view body, std::vector<char>& buf)
+{
+    if (body.empty()) {
+        return 0;
+    }
+    auto data = reinterpret_cast<const char*>(body.data());
+    size_t len = 0;
+    switch (compression) {
+    case cql_compression::lz4: {
+        // The body starts with its uncompressed length, in big endian.
+        buf.resize(4 + LZ4_COMPRESSBOUND(body.size()));
+        auto n = htonl(body.size());
+        std::copy_n(reinterpret_cast<const char*>(&n), 4, buf.data());
+        auto ret = LZ4_compress(data, buf.data() + 4, body.size());
+        if (ret == 0) {
+            throw std::runtime_error("LZ4 compression failure: LZ4_compress() failed");
+        }
+        len = ret + 4;
+        break;
+    }
+    case cql_compression::snappy:
+        len = snappy_max_compressed_length(body.size());
+        buf.resize(len);
+        if (snappy_compress(data, body.size(), buf.data(), &len) != SNAPPY_OK) {
+            throw std::runtime_error("snappy compression failure: snappy_compress() failed");
+        }
+        break;
+    case cql_compression::none:
+        return 0;
+    }
+    return len < body.size() ? len : 0;
+}
+
 void cql_server::response::serialize(const event::schema_change& event, uint8_t version)
 {
     if (version >= 3) {
@@ -1125,7 +1454,7 @@ void cql_server::response::serialize(const event::schema_change& event, uint8_t
     }
 }
 
-sstring cql_server::response::make_frame(uint8_t version, size_t length)
+sstring cql_server::response::make_frame(uint8_t version, uint8_t flags, size_t length)
 {
     switch (version) {
     case 0x01:
@@ -1133,7 +1462,7 @@ sstring cql_server::response::make_frame(uint8_t version, size_t length)
         sstring frame_buf(sstring::initialized_later(), sizeof(cql_binary_frame_v1));
         auto* frame = reinterpret_cast<cql_binary_frame_v1*>(frame_buf.begin());
         frame->version = version | 0x80;
-        frame->flags   = 0x00;
+        frame->flags   = flags;
         frame->stream  = _stream;
         frame->opcode  = static_cast<uint8_t>(_opcode);
         frame->length  = htonl(length);
@@ -1144,7 +1473,7 @@ sstring cql_server::response::make_frame(uint8_t version, size_t length)
         sstring frame_buf(sstring::initialized_later(), sizeof(cql_binary_frame_v3));
         auto* frame = reinterpret_cast<cql_binary_frame_v3*>(frame_buf.begin());
         frame->version = version | 0x80;
-        frame->flags   = 0x00;
+        frame->flags   = flags;
         frame->stream  = htons(_stream);
         frame->opcode  = static_cast<uint8_t>(_opcode);
         frame->length  = htonl(length);
@@ -1157,42 +1486,36 @@ sstring cql_server::response::make_frame(uint8_t version, size_t length)
 
 void cql_server::response::write_byte(uint8_t b)
 {
-    _body.insert(_body.end(), b);
+    _body.write<uint8_t>(b);
 }
 
 void cql_server::response::write_int(int32_t n)
 {
-    auto u = htonl(n);
-    auto *s = reinterpret_cast<const char*>(&u);
-    _body.insert(_body.end(), s, s+sizeof(u));
+    _body.write<int32_t>(n);
 }
 
 void cql_server::response::write_long(int64_t n)
 {
-    auto u = htonq(n);
-    auto *s = reinterpret_cast<const char*>(&u);
-    _body.insert(_body.end(), s, s+sizeof(u));
+    _body.write<int64_t>(n);
 }
 
 void cql_server::response::write_short(int16_t n)
 {
-    auto u = htons(n);
-    auto *s = reinterpret_cast<const char*>(&u);
-    _body.insert(_body.end(), s, s+sizeof(u));
+    _body.write<int16_t>(n);
 }
 
 void cql_server::response::write_string(const sstring& s)
 {
     assert(s.size() < std::numeric_limits<int16_t>::max());
     write_short(s.size());
-    _body.insert(_body.end(), s.begin(), s.end());
+    write(s.begin(), s.size());
 }
 
 void cql_server::response::write_long_string(const sstring& s)
 {
     assert(s.size() < std::numeric_limits<int32_t>::max());
     write_int(s.size());
-    _body.insert(_body.end(), s.begin(), s.end());
+    write(s.begin(), s.size());
 }
 
 void cql_server::response::write_uuid(utils::UUID uuid)
@@ -1214,14 +1537,14 @@ void cql_server::response::write_bytes(bytes b)
 {
     assert(b.size() < std::numeric_limits<int32_t>::max());
     write_int(b.size());
-    _body.insert(_body.end(), b.begin(), b.end());
+    _body.write(b);
 }
 
 void cql_server::response::write_short_bytes(bytes b)
 {
     assert(b.size() < std::numeric_limits<int16_t>::max());
     write_short(b.size());
-    _body.insert(_body.end(), b.begin(), b.end());
+    _body.write(b);
 }
 
 void cql_server::response::write_option(std::pair<int16_t, boost::any> opt)
@@ -1288,7 +1611,7 @@ void cql_server::response::write_value(bytes_opt value)
     }
 
     write_int(value->size());
-    _body.insert(_body.end(), value->begin(), value->end());
+    _body.write(*value);
 }
 
 class type_codec {
@@ -1392,6 +1715,12 @@ thread_local const type_codec::type_id_to_type_type type_codec::type_id_to_type
     (type_id::TIMEUUID  , timeuuid_type)
     (type_id::INET      , inet_addr_type);
 
+void cql_server::response::write_rows(const cql3::result_generator& g)
+{
+    auto count = _body.write_place_holder<int32_t>();
+    _body.set(count, int32_t(g.write_rows(_body)));
+}
+
 void cql_server::response::write(const cql3::metadata& m) {
     bool no_metadata = m.flags().contains<cql3::metadata::flag::NO_METADATA>();
     bool global_tables_spec = m.flags().contains<cql3::metadata::flag::GLOBAL_TABLES_SPEC>();
@@ -25,8 +25,10 @@
 #include "service/endpoint_lifecycle_subscriber.hh"
 #include "service/migration_listener.hh"
 #include "service/storage_proxy.hh"
+#include "service/service_level_controller.hh"
 #include "cql3/query_processor.hh"
 #include "core/distributed.hh"
+#include "core/semaphore.hh"
 #include <memory>
 
 namespace scollectd {
@@ -65,6 +67,20 @@ struct [[gnu::packed]] cql_binary_frame_v3 {
     }
 };
 
+enum class cql_compression {
+    none,
+    lz4,
+    snappy,
+};
+
+// Compresses a frame body with the algorithm negotiated in STARTUP into buf,
+// and returns the size it compressed to, or 0 if it did not get any smaller.
+size_t compress_frame_body(cql_compression compression, bytes_view body, std::vector<char>& buf);
+
+// Decompresses a frame body compressed by a client or by compress_frame_body().
+// Throws exceptions::protocol_exception if it is corrupted.
+temporary_buffer<char> decompress_frame_body(cql_compression compression, temporary_buffer<char> buf);
+
 class cql_server {
     class event_notifier;
 
@@ -81,9 +97,31 @@ class cql_server {
     uint64_t _connections = 0;
     uint64_t _requests_served = 0;
     uint64_t _requests_serving = 0;
+    // Sizes of the compressed frames, before and after compression.
+    uint64_t _compressed_bytes_received = 0;
+    uint64_t _uncompressed_bytes_received = 0;
+    uint64_t _compressed_bytes_sent = 0;
+    uint64_t _uncompressed_bytes_sent = 0;
+    // Frames not read because their connection had too many requests, or
+    // too much request memory, in flight.
+    uint64_t _requests_blocked = 0;
+    // Base of the shard-aware ports, shard i listens on base + i. 0 if disabled.
+    uint16_t _shard_aware_port = 0;
+    uint32_t _max_requests_per_connection;
+    size_t _max_request_memory_per_connection;
+    service::service_level_controller _service_levels;
+    std::unique_ptr<scollectd::registrations> _service_level_registrations;
+private:
+    scollectd::registrations setup_service_level_collectd();
 public:
-    cql_server(distributed<service::storage_proxy>& proxy, distributed<cql3::query_processor>& qp);
+    cql_server(distributed<service::storage_proxy>& proxy, distributed<cql3::query_processor>& qp,
+            uint32_t max_requests_per_connection, size_t max_request_memory_per_connection,
+            uint32_t max_concurrent_requests = 256,
+            std::unordered_map<sstring, service::service_level_options> service_levels = {});
     future<> listen(ipv4_addr addr);
+    // Listens on addr.port + this shard's id, so that connections made to that
+    // port are always served by this shard. Must be called after listen().
+    future<> listen_shard_aware(ipv4_addr addr);
     void do_accepts(int which);
     future<> stop();
 private:
@@ -145,11 +183,26 @@ class cql_server::connection {
     input_stream<char> _read_buf;
     output_stream<char> _write_buf;
     seastar::gate _pending_requests_gate;
+    // Requests are processed concurrently, and their responses written as
+    // they complete, in no particular order. No more frames are read while
+    // the requests in flight, until their responses are written, exceed
+    // either limit.
+    semaphore _requests_limit;
+    semaphore _memory_limit;
     future<> _ready_to_respond = make_ready_future<>();
     uint8_t _version = 0;
     serialization_format _serialization_format = serialization_format::use_16_bit();
     service::client_state _client_state;
     std::unordered_map<uint16_t, cql_query_state> _query_states;
+    // Negotiated in STARTUP.
+    cql_compression _compression = cql_compression::none;
+    // Responses are written one at a time, so they can all be compressed
+    // into the same buffer.
+    std::vector<char> _compression_buffer;
+    uint64_t _compressed_bytes_received = 0;
+    uint64_t _uncompressed_bytes_received = 0;
+    uint64_t _compressed_bytes_sent = 0;
+    uint64_t _uncompressed_bytes_sent = 0;
 public:
     connection(cql_server& server, connected_socket&& fd, socket_address addr);
     ~connection();
@@ -163,6 +216,7 @@ class cql_server::connection {
     unsigned frame_size() const;
     cql_binary_frame_v3 parse_frame(temporary_buffer<char> buf);
     future<std::experimental::optional<cql_binary_frame_v3>> read_frame();
+    temporary_buffer<char> decompress(temporary_buffer<char> buf);
     future<> process_startup(uint16_t stream, temporary_buffer<char> buf);
     future<> process_auth_response(uint16_t stream, temporary_buffer<char> buf);
     future<> process_options(uint16_t stream, temporary_buffer<char> buf);
@@ -180,7 +234,8 @@ class cql_server::connection {
     future<> write_error(int16_t stream, exceptions::exception_code err, sstring msg);
     future<> write_ready(int16_t stream);
     future<> write_supported(int16_t stream);
-    future<> write_result(int16_t stream, shared_ptr<transport::messages::result_message> msg);
+    future<> write_result(int16_t stream, shared_ptr<transport::messages::result_message> msg,
+            const tracing::trace_state_ptr& trace_state = nullptr);
     future<> write_topology_change_event(const transport::event::topology_change& event);
     future<> write_status_change_event(const transport::event::status_change& event);
     future<> write_schema_change_event(const transport::event::schema_change& event);
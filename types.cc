@@ -36,9 +36,9 @@
 #include <boost/range/numeric.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/date_time/c_local_time_adjustor.hpp>
-#include <boost/locale/encoding_utf.hpp>
 #include <boost/multiprecision/cpp_int.hpp>
 #include "utils/big_decimal.hh"
+#include "utils/utf8.hh"
 
 static const char* int32_type_name     = "org.apache.cassandra.db.marshal.Int32Type";
 static const char* long_type_name      = "org.apache.cassandra.db.marshal.LongType";
@@ -220,14 +220,12 @@ struct string_type_impl : public abstract_type {
     }
     virtual void validate(bytes_view v) const override {
         if (as_cql3_type() == cql3::cql3_type::ascii) {
-            if (std::any_of(v.begin(), v.end(), [] (int8_t b) { return b < 0; })) {
+            if (!utils::ascii::validate(v)) {
                 throw marshal_exception();
             }
         } else {
-            try {
-                boost::locale::conv::utf_to_utf<char>(v.data(), v.end(), boost::locale::conv::stop);
-            } catch (const boost::locale::conv::conversion_error& ex) {
-                throw marshal_exception(ex.what());
+            if (!utils::utf8::validate(v)) {
+                throw marshal_exception("Invalid UTF-8 string");
             }
         }
     }
@@ -438,19 +436,11 @@ struct timeuuid_type_impl : public abstract_type {
         }
         return boost::any(utils::UUID(msb, lsb));
     }
+    virtual int32_t compare(bytes_view b1, bytes_view b2) const override {
+        return timeuuid_compare(b1, b2);
+    }
     virtual bool less(bytes_view b1, bytes_view b2) const override {
-        if (b1.empty()) {
-            return b2.empty() ? false : true;
-        }
-        if (b2.empty()) {
-            return false;
-        }
-        auto r = compare_bytes(b1, b2);
-        if (r != 0) {
-            return r < 0;
-        } else {
-            return std::lexicographical_compare(b1.begin(), b1.end(), b2.begin(), b2.end());
-        }
+        return compare(b1, b2) < 0;
     }
     virtual bool is_byte_order_equal() const override {
         return true;
@@ -1112,33 +1102,12 @@ class decimal_type_impl : public abstract_type {
     }
 };
 
-class counter_type_impl : public abstract_type {
-public:
-    counter_type_impl() : abstract_type{counter_type_name} { }
-    virtual void serialize(const boost::any& value, bytes::iterator& out) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual size_t serialized_size(const boost::any& value) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual int32_t compare(bytes_view v1, bytes_view v2) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual bool less(bytes_view v1, bytes_view v2) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual size_t hash(bytes_view v) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual boost::any deserialize(bytes_view v) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual sstring to_string(const bytes& b) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
-    virtual bytes from_string(sstring_view text) const override {
-        fail(unimplemented::cause::COUNTERS);
-    }
+// Values of counters, as the database gives them out, are bigints. The
+// shards counter cells hold are not values of this type, see counters.hh.
+struct counter_type_impl : integer_type_impl<int64_t> {
+    counter_type_impl() : integer_type_impl{counter_type_name}
+    { }
+
     virtual bool is_counter() const override {
         return true;
     }
@@ -1616,8 +1585,10 @@ bool collection_type_impl::mutation::compact_and_expire(tombstone base_tomb, gc_
             continue;
         }
         if (cell.has_expired(query_time)) {
-            survivors.emplace_back(std::make_pair(
-                std::move(name_and_cell.first), atomic_cell::make_dead(cell.timestamp(), cell.deletion_time())));
+            if (cell.timestamp() >= max_purgeable || cell.deletion_time() >= gc_before) {
+                survivors.emplace_back(std::make_pair(
+                    std::move(name_and_cell.first), atomic_cell::make_dead(cell.timestamp(), cell.deletion_time())));
+            }
         } else if (!cell.is_live()) {
             if (cell.timestamp() >= max_purgeable || cell.deletion_time() >= gc_before) {
                 survivors.emplace_back(std::move(name_and_cell));
@@ -1651,43 +1622,178 @@ collection_type_impl::serialize_mutation_form_only_live(mutation_view mut, gc_cl
     }));
 }
 
+namespace {
+
+// A collection in mutation form, whose cells are read one by one in place.
+struct serialized_collection {
+    std::experimental::optional<tombstone> tomb;
+    uint32_t size;
+    bytes_view cells;
+
+    explicit serialized_collection(collection_mutation::view cm) {
+        auto in = cm.data;
+        if (read_simple<bool>(in)) {
+            auto ts = read_simple<api::timestamp_type>(in);
+            auto ttl = read_simple<gc_clock::duration::rep>(in);
+            tomb = tombstone{ts, gc_clock::time_point(gc_clock::duration(ttl))};
+        }
+        size = read_simple<uint32_t>(in);
+        cells = in;
+    }
+};
+
+struct serialized_collection_cell {
+    bytes_view key;
+    atomic_cell_view value;
+    // The key and the value with their sizes, as the mutation form has them.
+    bytes_view serialized;
+};
+
+serialized_collection_cell read_collection_cell(bytes_view& in) {
+    auto begin = in.begin();
+    auto ksize = read_simple<uint32_t>(in);
+    auto key = read_simple_bytes(in, ksize);
+    auto vsize = read_simple<uint32_t>(in);
+    auto value = atomic_cell_view::from_bytes(read_simple_bytes(in, vsize));
+    return { key, value, bytes_view(begin, in.begin() - begin) };
+}
+
+}
+
+// The cells of the result are the same as those of the inputs, with the same
+// serialized form, so they are copied as they are, those of a in runs: merging
+// a small write into a large collection costs a scan over the cells of the
+// collection and a copy of it, not its deserialization into a vector of cells
+// and the serialization of the result.
 collection_mutation::one
 collection_type_impl::merge(collection_mutation::view a, collection_mutation::view b) const {
-    auto aa = deserialize_mutation_form(a);
-    auto bb = deserialize_mutation_form(b);
-    mutation_view merged;
-    merged.cells.reserve(aa.cells.size() + bb.cells.size());
-    using element_type = std::pair<bytes_view, atomic_cell_view>;
+    serialized_collection aa(a);
+    serialized_collection bb(b);
     auto key_type = name_comparator();
-    auto compare = [key_type] (const element_type& e1, const element_type& e2) {
-        return key_type->less(e1.first, e2.first);
+    // tombstone wins if timestamps equal here, unlike row tombstones
+    // FIXME: should we consider TTLs too?
+    auto killed_by = [] (const std::experimental::optional<tombstone>& t, const serialized_collection_cell& c) {
+        return t && t->timestamp >= c.value.timestamp();
     };
-    auto merge = [this] (const element_type& e1, const element_type& e2) {
-        // FIXME: use std::max()?
-        return std::make_pair(e1.first, compare_atomic_cell_for_merge(e1.second, e2.second) > 0 ? e1.second : e2.second);
+
+    std::vector<serialized_collection_cell> b_cells;
+    b_cells.reserve(bb.size);
+    for (uint32_t i = 0; i != bb.size; ++i) {
+        auto c = read_collection_cell(bb.cells);
+        if (!killed_by(aa.tomb, c)) {
+            b_cells.push_back(c);
+        }
+    }
+    auto tomb = std::max(aa.tomb, bb.tomb);
+    if (b_cells.empty() && tomb == aa.tomb) {
+        return collection_mutation::one(a);
+    }
+
+    std::vector<bytes_view> pieces;
+    uint32_t nr = 0;
+    auto run_begin = aa.cells.begin();
+    auto run_end = run_begin;
+    auto close_run = [&] {
+        if (run_begin != run_end) {
+            pieces.emplace_back(run_begin, run_end - run_begin);
+        }
     };
-    // applied to a tombstone, returns a predicate checking whether a cell is killed by
-    // the tombstone
-    auto cell_killed = [] (const std::experimental::optional<tombstone>& t) {
-        return [&t] (const element_type& e) {
-            if (!t) {
-                return false;
+    auto bi = b_cells.begin();
+    auto in = aa.cells;
+    for (uint32_t i = 0; i != aa.size; ++i) {
+        if (bi == b_cells.end() && !bb.tomb) {
+            // Nothing left to merge: the rest of a is taken as it is.
+            if (run_end != in.begin()) {
+                close_run();
+                run_begin = in.begin();
             }
-            // tombstone wins if timestamps equal here, unlike row tombstones
-            if (t->timestamp < e.second.timestamp()) {
-                return false;
+            run_end = in.end();
+            nr += aa.size - i;
+            break;
+        }
+        auto c = read_collection_cell(in);
+        while (bi != b_cells.end() && key_type->less(bi->key, c.key)) {
+            close_run();
+            pieces.push_back(bi->serialized);
+            ++nr;
+            ++bi;
+            run_begin = run_end = c.serialized.begin();
+        }
+        bool a_wins = !killed_by(bb.tomb, c);
+        if (bi != b_cells.end() && !key_type->less(c.key, bi->key)) {
+            if (!a_wins || compare_atomic_cell_for_merge(c.value, bi->value) <= 0) {
+                a_wins = false;
+                pieces.push_back(bi->serialized);
+                ++nr;
             }
-            return true;
-            // FIXME: should we consider TTLs too?
-        };
-    };
-    combine(aa.cells.begin(), std::remove_if(aa.cells.begin(), aa.cells.end(), cell_killed(bb.tomb)),
-            bb.cells.begin(), std::remove_if(bb.cells.begin(), bb.cells.end(), cell_killed(aa.tomb)),
-            std::back_inserter(merged.cells),
-            compare,
-            merge);
-    merged.tomb = std::max(aa.tomb, bb.tomb);
-    return serialize_mutation_form(merged);
+            ++bi;
+        }
+        if (a_wins) {
+            if (run_end != c.serialized.begin()) {
+                close_run();
+                run_begin = c.serialized.begin();
+            }
+            run_end = c.serialized.end();
+            ++nr;
+        } else {
+            close_run();
+            run_begin = run_end = c.serialized.end();
+        }
+    }
+    close_run();
+    for (; bi != b_cells.end(); ++bi) {
+        pieces.push_back(bi->serialized);
+        ++nr;
+    }
+
+    size_t size = 1 + sizeof(nr);
+    if (tomb) {
+        size += sizeof(tomb->timestamp) + sizeof(tomb->deletion_time);
+    }
+    for (auto&& p : pieces) {
+        size += p.size();
+    }
+    managed_bytes ret(managed_bytes::initialized_later(), size);
+    auto out = ret.begin();
+    *out++ = bool(tomb);
+    if (tomb) {
+        write(out, tomb->timestamp);
+        write(out, tomb->deletion_time.time_since_epoch().count());
+    }
+    serialize_int32(out, nr);
+    for (auto&& p : pieces) {
+        out = std::copy_n(p.begin(), p.size(), out);
+    }
+    return collection_mutation::one(std::move(ret));
+}
+
+std::experimental::optional<collection_mutation::one>
+collection_type_impl::difference(collection_mutation::view a, collection_mutation::view b) const {
+    auto aa = deserialize_mutation_form(a);
+    auto bb = deserialize_mutation_form(b);
+    mutation_view diff;
+    auto key_type = name_comparator();
+    auto it = bb.cells.begin();
+    for (auto&& c : aa.cells) {
+        // Cells b's tombstone covers would lose to it anyway.
+        if (c.second.timestamp() <= bb.tomb.timestamp) {
+            continue;
+        }
+        while (it != bb.cells.end() && key_type->less(it->first, c.first)) {
+            ++it;
+        }
+        if (it == bb.cells.end() || key_type->less(c.first, it->first)
+                || compare_atomic_cell_for_merge(c.second, it->second) > 0) {
+            diff.cells.emplace_back(c);
+        }
+    }
+    if (aa.tomb > bb.tomb) {
+        diff.tomb = aa.tomb;
+    }
+    if (diff.cells.empty() && !diff.tomb) {
+        return {};
+    }
+    return serialize_mutation_form(diff);
 }
 
 bytes_opt
@@ -2292,3 +2398,94 @@ data_type abstract_type::parse_type(const sstring& name)
     }
     return it->second;
 }
+
+type_comparator::type_comparator(const abstract_type& t)
+    : _type(&t)
+{
+    auto underlying = t.underlying_type();
+    auto u = underlying.get();
+    if (u == int32_type.get()) {
+        _kind = kind::int32;
+    } else if (u == long_type.get() || u == timestamp_type.get()) {
+        _kind = kind::int64;
+    } else if (u == timeuuid_type.get()) {
+        _kind = kind::timeuuid;
+    } else if (u->is_byte_order_comparable()) {
+        _kind = kind::byte_order;
+    } else {
+        return;
+    }
+    _reversed = t.is_reversed();
+}
+
+std::experimental::optional<size_t> type_comparator::encoded_size(bytes_view v) const {
+    switch (_kind) {
+    case kind::byte_order:
+        return v.size() + std::count(v.begin(), v.end(), 0) + 2;
+    case kind::int32:
+    case kind::int64:
+        if (!v.empty() && v.size() != (_kind == kind::int32 ? sizeof(int32_t) : sizeof(int64_t))) {
+            return {};
+        }
+        return 1 + v.size();
+    case kind::timeuuid:
+        if (v.empty()) {
+            return 1;
+        }
+        if (v.size() != 16) {
+            return {};
+        }
+        return 1 + sizeof(timeuuid_timestamp_bytes) / sizeof(timeuuid_timestamp_bytes[0]) + v.size();
+    default:
+        return {};
+    }
+}
+
+void type_comparator::encode(bytes_view v, bytes::iterator& out) const {
+    auto start = out;
+    switch (_kind) {
+    case kind::byte_order:
+        // Zero bytes are escaped, and the value terminated by two zero
+        // bytes, which sort before any escaped byte.
+        for (auto b : v) {
+            *out++ = b;
+            if (b == 0) {
+                *out++ = int8_t(0xff);
+            }
+        }
+        *out++ = 0;
+        *out++ = 0;
+        break;
+    case kind::int32:
+    case kind::int64:
+        // Empty values sort first. The sign bit is flipped for negative
+        // values to sort before the positive ones.
+        if (v.empty()) {
+            *out++ = 0;
+            break;
+        }
+        *out++ = 1;
+        *out++ = v[0] ^ 0x80;
+        out = std::copy(v.begin() + 1, v.end(), out);
+        break;
+    case kind::timeuuid:
+        if (v.empty()) {
+            *out++ = 0;
+            break;
+        }
+        *out++ = 1;
+        for (auto&& b : timeuuid_timestamp_bytes) {
+            *out++ = v[b.first] & b.second;
+        }
+        // Ties are broken by the signed bytes.
+        for (auto b : v) {
+            *out++ = b ^ 0x80;
+        }
+        break;
+    default:
+        abort();
+    }
+    if (_reversed) {
+        std::transform(start, out, start, [] (int8_t b) { return ~b; });
+    }
+}
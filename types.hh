@@ -447,6 +447,9 @@ class collection_type_impl : public abstract_type {
     collection_mutation::one serialize_mutation_form(mutation_view mut) const;
     collection_mutation::one serialize_mutation_form_only_live(mutation_view mut, gc_clock::time_point now) const;
     collection_mutation::one merge(collection_mutation::view a, collection_mutation::view b) const;
+    // The cells and tombstone of a which b lacks, or which win over b's,
+    // or nothing if there are none.
+    std::experimental::optional<collection_mutation::one> difference(collection_mutation::view a, collection_mutation::view b) const;
     virtual void serialize(const boost::any& value, bytes::iterator& out, serialization_format sf) const = 0;
     virtual boost::any deserialize(bytes_view v, serialization_format sf) const = 0;
     data_value deserialize_value(bytes_view v, serialization_format sf) const {
@@ -766,6 +769,18 @@ shared_ptr<const abstract_type> data_type_for<int64_t>() {
     return long_type;
 }
 
+template <>
+inline
+shared_ptr<const abstract_type> data_type_for<float>() {
+    return float_type;
+}
+
+template <>
+inline
+shared_ptr<const abstract_type> data_type_for<double>() {
+    return double_type;
+}
+
 template <>
 inline
 shared_ptr<const abstract_type> data_type_for<sstring>() {
@@ -932,6 +947,96 @@ T read_simple_exactly(bytes_view v) {
     return net::ntoh(*reinterpret_cast<const net::packed<T>*>(p));
 }
 
+// The positions of the bytes of the timestamp of a version 1 UUID, most
+// significant first, with the mask of their timestamp bits. The timestamp
+// is stored as time_low, time_mid, then time_hi and the version, so that
+// its most significant bits come last.
+static constexpr std::pair<unsigned, int> timeuuid_timestamp_bytes[] = {
+    { 6, 0xf }, { 7, 0xff }, { 4, 0xff }, { 5, 0xff }, { 0, 0xff }, { 1, 0xff }, { 2, 0xff }, { 3, 0xff },
+};
+
+// Orders version 1 UUIDs by their timestamp first, then by their bytes.
+inline int32_t timeuuid_compare(bytes_view v1, bytes_view v2) {
+    if (v1.empty()) {
+        return v2.empty() ? 0 : -1;
+    }
+    if (v2.empty()) {
+        return 1;
+    }
+    for (auto&& b : timeuuid_timestamp_bytes) {
+        int d = (v1[b.first] & b.second) - (v2[b.first] & b.second);
+        if (d) {
+            return d;
+        }
+    }
+    return lexicographical_tri_compare(v1.begin(), v1.end(), v2.begin(), v2.end(), [] (int8_t a, int8_t b) {
+        return int(a) - int(b);
+    });
+}
+
+// Compares values of a type as its compare() does. The types keys are
+// commonly made of are recognized once, when the comparator is made, and
+// compared inline rather than through a virtual call per value.
+class type_comparator {
+    enum class kind : uint8_t { generic, byte_order, int32, int64, timeuuid };
+    const abstract_type* _type;
+    kind _kind = kind::generic;
+    // Set for reversed types of the kinds compared inline.
+    bool _reversed = false;
+private:
+    template <typename T>
+    static int32_t compare_integers(bytes_view v1, bytes_view v2) {
+        auto a = read_simple_exactly<T>(v1);
+        auto b = read_simple_exactly<T>(v2);
+        return a == b ? 0 : a < b ? -1 : 1;
+    }
+public:
+    explicit type_comparator(const abstract_type& t);
+
+    // Whether values of the type have an encoding, see encode().
+    bool has_byte_comparable_encoding() const {
+        return _kind != kind::generic;
+    }
+
+    // The size of the encoding of v, or disengaged when the type has no
+    // such encoding or v is not a valid value of it.
+    std::experimental::optional<size_t> encoded_size(bytes_view v) const;
+
+    // Writes the encoding of v, which compares with compare_unsigned() as v
+    // compares with compare(). No encoding of a value is a prefix of
+    // another's, so that the encodings of the components of a compound can
+    // be concatenated. v must have an encoded_size().
+    void encode(bytes_view v, bytes::iterator& out) const;
+
+    int32_t compare(bytes_view v1, bytes_view v2) const {
+        int32_t r;
+        switch (_kind) {
+        case kind::byte_order:
+            r = compare_unsigned(v1, v2);
+            break;
+        case kind::int32:
+            // Empty values sort first, as the type itself takes care of.
+            if (v1.size() != sizeof(int32_t) || v2.size() != sizeof(int32_t)) {
+                return _type->compare(v1, v2);
+            }
+            r = compare_integers<int32_t>(v1, v2);
+            break;
+        case kind::int64:
+            if (v1.size() != sizeof(int64_t) || v2.size() != sizeof(int64_t)) {
+                return _type->compare(v1, v2);
+            }
+            r = compare_integers<int64_t>(v1, v2);
+            break;
+        case kind::timeuuid:
+            r = timeuuid_compare(v1, v2);
+            break;
+        default:
+            return _type->compare(v1, v2);
+        }
+        return _reversed ? -r : r;
+    }
+};
+
 inline
 bytes_view
 read_simple_bytes(bytes_view& v, size_t n) {
@@ -42,6 +42,7 @@
 
 #include <memory>
 #include <chrono>
+#include <vector>
 
 #include "UUID.hh"
 #include "db_clock.hh"
@@ -91,7 +92,24 @@ class UUID_gen
      */
     static UUID get_time_UUID()
     {
-        return UUID(instance->create_time_safe(), clock_seq_and_node);
+        return UUID(create_time(instance->create_time_safe()), clock_seq_and_node);
+    }
+
+    /**
+     * Creates n type 1 UUIDs, in increasing order, whose timestamps are
+     * reserved at once.
+     *
+     * @return the UUIDs
+     */
+    static std::vector<UUID> get_time_UUIDs(size_t n)
+    {
+        std::vector<UUID> uuids;
+        uuids.reserve(n);
+        auto first = instance->create_time_safe(n);
+        for (size_t i = 0; i < n; ++i) {
+            uuids.emplace_back(create_time(first + i), clock_seq_and_node);
+        }
+        return uuids;
     }
 
     /**
@@ -109,6 +127,16 @@ class UUID_gen
         return UUID(create_time(from_unix_timestamp(when)), clock_seq_and_node);
     }
 
+    /**
+     * Creates a type 1 UUID (time-based UUID) with the timestamp of @param when_in_micros, in microseconds.
+     *
+     * @return a UUID instance
+     */
+    static UUID get_time_UUID_from_micros(int64_t when_in_micros)
+    {
+        return UUID(create_time((when_in_micros - START_EPOCH * 1000) * 10), clock_seq_and_node);
+    }
+
     /** creates uuid from raw bytes. */
     static UUID get_UUID(bytes raw) {
         assert(raw.size() == 16);
@@ -151,7 +179,7 @@ class UUID_gen
      */
     static std::array<int8_t, 16> get_time_UUID_bytes()
     {
-        return create_time_UUID_bytes(instance->create_time_safe());
+        return create_time_UUID_bytes(create_time(instance->create_time_safe()));
     }
 
     /**
@@ -265,21 +293,23 @@ class UUID_gen
 private:
 
     // needs to return two different values for the same when.
-    // we can generate at most 10k UUIDs per ms.
+    // Reserves n consecutive 100ns ticks, returning the first one. The clock
+    // is read in microseconds, so that the ticks run ahead of it only past
+    // 10 UUIDs per microsecond, rather than 10k per millisecond.
     // NOTE: In the original Java code this function was "synchronized". This isn't
-    // needed if we assume our code will run on just one CPU.
-    int64_t create_time_safe()
+    // needed, since each core has its own instance, and its own node in
+    // clock_seq_and_node, so that cores never make the same UUID.
+    int64_t create_time_safe(size_t n = 1)
     {
         using namespace std::chrono;
-        int64_t millis = duration_cast<milliseconds>(
+        int64_t micros = duration_cast<microseconds>(
                 system_clock::now().time_since_epoch()).count();
-        int64_t nanos_since = (millis - START_EPOCH) * 10000;
-        if (nanos_since > last_nanos)
-            last_nanos = nanos_since;
-        else
-            nanos_since = ++last_nanos;
+        int64_t nanos_since = (micros - START_EPOCH * 1000) * 10;
+        if (nanos_since <= last_nanos)
+            nanos_since = last_nanos + 1;
+        last_nanos = nanos_since + n - 1;
 
-        return create_time(nanos_since);
+        return nanos_since;
     }
 
     int64_t create_time_unsafe(int64_t when, int nanos)
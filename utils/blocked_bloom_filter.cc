@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "blocked_bloom_filter.hh"
+#include "bloom_calculations.hh"
+#include "utils/murmur_hash.hh"
+#include <seastar/core/align.hh>
+#include <array>
+#include <cstring>
+#include <new>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace utils {
+namespace filter {
+
+constexpr size_t blocked_bloom_filter::block_bits;
+constexpr size_t blocked_bloom_filter::words_per_block;
+constexpr size_t blocked_bloom_filter::fragment_size;
+constexpr size_t blocked_bloom_filter::blocks_per_fragment;
+
+blocked_bloom_filter::blocked_bloom_filter(int hashes, size_t nr_blocks)
+    : _nr_blocks(std::max<size_t>(nr_blocks, 1))
+    , _hash_count(hashes)
+{
+    auto nr_fragments = align_up(_nr_blocks, blocks_per_fragment) / blocks_per_fragment;
+    _storage.reserve(nr_fragments);
+    for (size_t f = 0; f < nr_fragments; ++f) {
+        auto size = fragment_blocks(f) * sizeof(block);
+        void* p;
+        if (::posix_memalign(&p, alignof(block), size)) {
+            throw std::bad_alloc();
+        }
+        std::memset(p, 0, size);
+        _storage.emplace_back(static_cast<block*>(p));
+    }
+}
+
+// The block index is taken from the first half of the 128-bit hash and the
+// bit positions from the second, so that the two are independent.
+void blocked_bloom_filter::make_mask(uint64_t h, block& mask) const {
+    std::fill(std::begin(mask.words), std::end(mask.words), 0);
+    uint32_t pos = h;
+    uint32_t inc = (h >> 32) | 1;
+    for (int i = 0; i < _hash_count; ++i) {
+        auto bit = pos >> (32 - 9); // log2(block_bits)
+        mask.words[bit / 64] |= uint64_t(1) << (bit % 64);
+        pos += inc;
+    }
+}
+
+bool blocked_bloom_filter::contains(const block& b, const block& mask) {
+#ifdef __AVX2__
+    auto bp = reinterpret_cast<const __m256i*>(b.words);
+    auto mp = reinterpret_cast<const __m256i*>(mask.words);
+    return _mm256_testc_si256(_mm256_load_si256(bp), _mm256_load_si256(mp))
+        & _mm256_testc_si256(_mm256_load_si256(bp + 1), _mm256_load_si256(mp + 1));
+#else
+    // Branch-free so that the compiler can vectorize it.
+    uint64_t missing = 0;
+    for (size_t i = 0; i < words_per_block; ++i) {
+        missing |= mask.words[i] & ~b.words[i];
+    }
+    return !missing;
+#endif
+}
+
+void blocked_bloom_filter::add(const bytes_view& key) {
+    std::array<uint64_t, 2> h;
+    utils::murmur_hash::hash3_x64_128(key, 0, h);
+    block mask;
+    make_mask(h[1], mask);
+    auto& b = get_block(block_index(h[0]));
+    for (size_t i = 0; i < words_per_block; ++i) {
+        b.words[i] |= mask.words[i];
+    }
+}
+
+bool blocked_bloom_filter::is_present(const bytes_view& key) {
+    std::array<uint64_t, 2> h;
+    utils::murmur_hash::hash3_x64_128(key, 0, h);
+    auto& b = get_block(block_index(h[0]));
+    __builtin_prefetch(&b);
+    block mask;
+    make_mask(h[1], mask);
+    return contains(b, mask);
+}
+
+void blocked_bloom_filter::clear() {
+    for (size_t f = 0; f < _storage.size(); ++f) {
+        std::memset(_storage[f].get(), 0, fragment_blocks(f) * sizeof(block));
+    }
+}
+
+filter_ptr create_blocked_filter(int hash, long num_elements, int buckets_per) {
+    long num_bits = (num_elements * (buckets_per + 1)) + bloom_calculations::EXCESS;
+    auto nr_blocks = align_up<long>(num_bits, blocked_bloom_filter::block_bits) / blocked_bloom_filter::block_bits;
+    return std::make_unique<blocked_bloom_filter>(hash, nr_blocks);
+}
+
+}
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "i_filter.hh"
+
+#include <memory>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <cstdlib>
+
+namespace utils {
+namespace filter {
+
+// Bloom filter which confines all the bits of a key to a single 512-bit,
+// cache-line aligned block, so that a lookup touches one cache line no
+// matter how many hash functions are used. A single murmur3 hash of the key
+// selects the block and, by double hashing, the bits within it; the bits
+// are then set or tested a whole block at a time.
+//
+// Keys are not spread across blocks as evenly as bits are across a flat
+// bitmap, so for the same size the false positive rate is slightly higher
+// than murmur3_bloom_filter's. create_blocked_filter() compensates by
+// sizing the filter with an extra bucket per element.
+//
+// Like large_bitset, the bitmap is stored in fragments in order not to
+// stress the memory allocator.
+class blocked_bloom_filter : public i_filter {
+public:
+    static constexpr size_t block_bits = 512;
+    static constexpr size_t words_per_block = block_bits / 64;
+private:
+    struct alignas(64) block {
+        uint64_t words[words_per_block];
+    };
+    static constexpr size_t fragment_size = 128 * 1024;
+    static constexpr size_t blocks_per_fragment = fragment_size / sizeof(block);
+
+    struct free_deleter {
+        void operator()(block* p) const { ::free(p); }
+    };
+    using fragment = std::unique_ptr<block[], free_deleter>;
+
+    std::vector<fragment> _storage;
+    size_t _nr_blocks;
+    int _hash_count;
+private:
+    block& get_block(size_t idx) {
+        return _storage[idx / blocks_per_fragment][idx % blocks_per_fragment];
+    }
+    const block& get_block(size_t idx) const {
+        return _storage[idx / blocks_per_fragment][idx % blocks_per_fragment];
+    }
+    size_t fragment_blocks(size_t fragment_idx) const {
+        return std::min(blocks_per_fragment, _nr_blocks - fragment_idx * blocks_per_fragment);
+    }
+    // Maps a hash uniformly onto [0, _nr_blocks) without a division.
+    size_t block_index(uint64_t h) const {
+        return (static_cast<unsigned __int128>(h) * _nr_blocks) >> 64;
+    }
+    void make_mask(uint64_t h, block& mask) const;
+    static bool contains(const block& b, const block& mask);
+public:
+    blocked_bloom_filter(int hashes, size_t nr_blocks);
+
+    int num_hashes() const { return _hash_count; }
+    size_t nr_blocks() const { return _nr_blocks; }
+    size_t nr_words() const { return _nr_blocks * words_per_block; }
+
+    // Loads a bitmap, in host byte order, as written by save(). The number
+    // of words must match nr_words().
+    template <typename IntegerIterator>
+    void load(IntegerIterator start, IntegerIterator finish);
+    template <typename IntegerIterator>
+    IntegerIterator save(IntegerIterator out) const;
+
+    virtual void add(const bytes_view& key) override;
+    virtual bool is_present(const bytes_view& key) override;
+    virtual void clear() override;
+    virtual void close() override { }
+
+    virtual size_t memory_size() override {
+        return sizeof(_hash_count) + _storage.size() * fragment_size;
+    }
+};
+
+template <typename IntegerIterator>
+void
+blocked_bloom_filter::load(IntegerIterator start, IntegerIterator finish) {
+    for (size_t f = 0; f < _storage.size() && start != finish; ++f) {
+        auto words = &_storage[f][0].words[0];
+        auto now = std::min<size_t>(fragment_blocks(f) * words_per_block, std::distance(start, finish));
+        std::copy_n(start, now, words);
+        start += now;
+    }
+}
+
+template <typename IntegerIterator>
+IntegerIterator
+blocked_bloom_filter::save(IntegerIterator out) const {
+    for (size_t f = 0; f < _storage.size(); ++f) {
+        auto words = &_storage[f][0].words[0];
+        out = std::copy_n(words, fragment_blocks(f) * words_per_block, out);
+    }
+    return out;
+}
+
+filter_ptr create_blocked_filter(int hash, long num_elements, int buckets_per);
+
+}
+}
@@ -83,6 +83,22 @@ std::vector<long> bloom_filter::indexes(const bytes_view& key) {
     return idx;
 }
 
+bool mapped_murmur3_bloom_filter::is_present(const bytes_view& key) {
+    auto& idx = reusable_indexes;
+    std::array<uint64_t, 2> h;
+    utils::murmur_hash::hash3_x64_128(key, 0, h);
+
+    idx.resize(_hash_count);
+    bloom_filter::set_indexes(h[0], h[1], _hash_count, _nr_bits, idx);
+    for (int i = 0; i < _hash_count; i++) {
+        auto word = net::ntoh(_words[idx[i] / 64]);
+        if (!((word >> (idx[i] % 64)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 filter_ptr create_filter(int hash, large_bitset&& bitset) {
     return std::make_unique<murmur3_bloom_filter>(hash, std::move(bitset));
 }
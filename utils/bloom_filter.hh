@@ -45,7 +45,11 @@
 #include "i_filter.hh"
 #include "utils/murmur_hash.hh"
 #include "utils/large_bitset.hh"
+#include "utils/mapped_file.hh"
+#include "core/shared_ptr.hh"
+#include "net/byteorder.hh"
 
+#include <stdexcept>
 #include <vector>
 
 namespace utils {
@@ -59,11 +63,13 @@ class bloom_filter: public i_filter {
     bitmap _bitset;
     int _hash_count;
 
-    void set_indexes(int64_t base, int64_t inc, int count, long max, std::vector<long>& results);
     std::vector<long> get_hash_buckets(const bytes_view& key, int hash_count, long max);
     std::vector<long> indexes(const bytes_view& key);
 
 public:
+    // The bits of a key, of the two halves of its hash.
+    static void set_indexes(int64_t base, int64_t inc, int count, long max, std::vector<long>& results);
+
     int num_hashes() { return _hash_count; }
     bitmap& bits() { return _bitset; }
 
@@ -111,6 +117,39 @@ struct murmur3_bloom_filter: public bloom_filter {
     }
 };
 
+// A murmur3_bloom_filter tested in place in the mapping of its Filter.db,
+// whose words are big-endian, rather than loaded into a large_bitset. Keys
+// can't be added to it.
+class mapped_murmur3_bloom_filter: public i_filter {
+    lw_shared_ptr<mapped_file> _file;
+    const uint64_t* _words;
+    long _nr_bits;
+    int _hash_count;
+public:
+    mapped_murmur3_bloom_filter(int hashes, lw_shared_ptr<mapped_file> file, const uint64_t* words, size_t nr_words)
+        : _file(std::move(file)), _words(words), _nr_bits(nr_words * 64), _hash_count(hashes) {
+    }
+
+    int num_hashes() { return _hash_count; }
+
+    virtual void add(const bytes_view& key) override {
+        throw std::logic_error("keys can't be added to a mapped bloom filter");
+    }
+
+    virtual bool is_present(const bytes_view& key) override;
+
+    virtual void clear() override {
+        throw std::logic_error("a mapped bloom filter can't be cleared");
+    }
+
+    virtual void close() override { }
+
+    // The mapped words are the page cache's.
+    virtual size_t memory_size() override {
+        return sizeof(*this);
+    }
+};
+
 struct always_present_filter: public i_filter {
 
     virtual bool is_present(const bytes_view& key) override {
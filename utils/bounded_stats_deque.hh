@@ -38,9 +38,10 @@
 
 #pragma once
 
-namespace utils {
-
 #include <deque>
+#include <algorithm>
+
+namespace utils {
 
 /**
  * bounded threadsafe deque
@@ -49,6 +50,9 @@ class bounded_stats_deque {
 private:
     std::deque<long> _deque;
     long _sum = 0;
+    // Kept as a double, since the squares of nanosecond intervals overflow
+    // a long.
+    double _sum_of_squares = 0;
     int _max_size;
 public:
     bounded_stats_deque(int size)
@@ -64,9 +68,11 @@ class bounded_stats_deque {
             auto removed = _deque.front();
             _deque.pop_front();
             _sum -= removed;
+            _sum_of_squares -= double(removed) * removed;
         }
         _deque.push_back(i);
         _sum += i;
+        _sum_of_squares += double(i) * i;
     }
 
     long sum() {
@@ -77,6 +83,15 @@ class bounded_stats_deque {
         return size() > 0 ? ((double) sum()) / size() : 0;
     }
 
+    double variance() {
+        if (size() == 0) {
+            return 0;
+        }
+        auto m = mean();
+        // Rounding may take the difference slightly below zero.
+        return std::max(_sum_of_squares / size() - m * m, 0.0);
+    }
+
     const std::deque<long>& deque() const {
         return _deque;
     }
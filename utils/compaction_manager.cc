@@ -168,6 +168,7 @@ void compaction_manager::start(int task_nr) {
 
 future<> compaction_manager::stop() {
     _registrations.clear();
+    _throttle.stop();
     return do_for_each(_tasks, [this] (auto& task) {
         return this->task_stop(task);
     }).then([this] {
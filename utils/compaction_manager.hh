@@ -27,9 +27,11 @@
 #include "core/gate.hh"
 #include "log.hh"
 #include "utils/exponential_backoff_retry.hh"
+#include "utils/compaction_throttle.hh"
 #include <deque>
 #include <vector>
 #include <functional>
+#include <limits>
 
 class column_family;
 
@@ -66,6 +68,15 @@ class compaction_manager {
 
     stats _stats;
     std::vector<scollectd::registration> _registrations;
+
+    // Number of disjoint token sub-ranges a major compaction is split into.
+    unsigned _major_compaction_parallelism = 1;
+
+    // Size of the sstables a major compaction writes.
+    uint64_t _major_compaction_sstable_size = std::numeric_limits<uint64_t>::max();
+
+    // Shared by all compactions running on this shard.
+    compaction_throttle _throttle;
 private:
     void task_start(lw_shared_ptr<task>& task);
     future<> task_stop(lw_shared_ptr<task>& task);
@@ -94,5 +105,35 @@ class compaction_manager {
     const stats& get_stats() const {
         return _stats;
     }
+
+    // A major compaction splits the token range of its input sstables into
+    // this many disjoint sub-ranges, and compacts them concurrently into
+    // non-overlapping output sstables.
+    void set_major_compaction_parallelism(unsigned parallelism) {
+        _major_compaction_parallelism = std::max(parallelism, 1U);
+    }
+
+    unsigned major_compaction_parallelism() const {
+        return _major_compaction_parallelism;
+    }
+
+    // A major compaction splits its output into sstables of about this
+    // size, which lets it release input sstables before it completes.
+    // Zero leaves the size unbounded.
+    void set_major_compaction_sstable_size(uint64_t size) {
+        _major_compaction_sstable_size = size ? size : std::numeric_limits<uint64_t>::max();
+    }
+
+    uint64_t major_compaction_sstable_size() const {
+        return _major_compaction_sstable_size;
+    }
+
+    compaction_throttle& throttle() {
+        return _throttle;
+    }
+
+    const compaction_throttle& throttle() const {
+        return _throttle;
+    }
 };
 
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compaction_throttle.hh"
+#include "log.hh"
+#include <algorithm>
+
+static logging::logger ctlog("compaction_throttle");
+
+constexpr double compaction_throttle::min_factor;
+constexpr double compaction_throttle::factor_increase;
+constexpr std::chrono::milliseconds compaction_throttle::adjust_period;
+
+// Sleeping for less than this isn't worth a timer; the debt is carried
+// over to the next call instead.
+static constexpr auto min_sleep = std::chrono::milliseconds(1);
+
+compaction_throttle::compaction_throttle()
+    : _adjust_timer([this] { adjust(); })
+{ }
+
+future<> compaction_throttle::throttle(uint64_t bytes) {
+    auto rate = effective_bytes_per_second();
+    if (!rate || _stopped) {
+        return make_ready_future<>();
+    }
+    auto now = clock::now();
+    // Time not used while idle is not banked, so a compaction starting
+    // after a quiet period doesn't get to burst.
+    _next_free = std::max(_next_free, now);
+    auto delay = _next_free - now;
+    _next_free += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(double(bytes) / rate));
+    if (delay < min_sleep) {
+        return make_ready_future<>();
+    }
+    _sleepers.emplace_front();
+    auto it = _sleepers.begin();
+    it->tmr.arm(delay);
+    return it->done.get_future().then([this, it] {
+        _sleepers.erase(it);
+    });
+}
+
+void compaction_throttle::stop() {
+    _stopped = true;
+    _adjust_timer.cancel();
+    for (auto&& s : _sleepers) {
+        if (s.tmr.cancel()) {
+            s.done.set_value();
+        }
+    }
+}
+
+void compaction_throttle::set_adaptive(bool adaptive) {
+    _adaptive = adaptive;
+    if (_adaptive && _load_source) {
+        _last_load = _load_source();
+        if (!_adjust_timer.armed()) {
+            _adjust_timer.arm_periodic(adjust_period);
+        }
+    } else {
+        _adjust_timer.cancel();
+        _factor = 1.0;
+    }
+}
+
+void compaction_throttle::set_load_source(load_source source) {
+    _load_source = std::move(source);
+    set_adaptive(_adaptive);
+}
+
+void compaction_throttle::adjust() {
+    if (!_adaptive || !_load_source) {
+        return;
+    }
+    auto load = _load_source();
+    auto reads = load.sampled_reads - _last_load.sampled_reads;
+    auto latency_sum = load.read_latency_sum - _last_load.read_latency_sum;
+    _last_load = load;
+
+    // Counters go backwards when a column family is dropped; such an
+    // interval tells nothing about latency.
+    bool slow_reads = reads > 0 && latency_sum > 0
+            && std::chrono::nanoseconds(latency_sum / reads) > _read_latency_target;
+    bool queued_reads = load.pending_reads > _pending_reads_target;
+
+    auto old_factor = _factor;
+    if (slow_reads || queued_reads) {
+        _factor = std::max(_factor / 2, min_factor);
+    } else {
+        _factor = std::min(_factor + factor_increase, 1.0);
+    }
+    if (_factor != old_factor) {
+        ctlog.debug("Compaction throughput scaled to {} bytes/s (slow reads: {}, pending reads: {})",
+                effective_bytes_per_second(), slow_reads, load.pending_reads);
+    }
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/future.hh"
+#include "core/timer.hh"
+#include <chrono>
+#include <functional>
+#include <list>
+
+// Limits the rate at which compaction consumes its input, so that it
+// doesn't starve foreground reads of disk bandwidth.
+//
+// The limit is enforced by compaction calling throttle() with the number
+// of bytes it is about to process; the returned future is resolved once
+// processing those bytes fits into the configured rate.
+//
+// In adaptive mode, the configured rate is only an upper bound: a feedback
+// controller samples foreground read load periodically and scales the
+// effective rate down (multiplicatively) while reads are suffering, and
+// back up (additively) once they are not.
+//
+// stop() ends the sleeps in progress, and later calls to throttle() don't
+// sleep, so that stopping compaction doesn't wait for the debt to be paid.
+class compaction_throttle {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Cumulative foreground read counters, as provided by the load source.
+    // The controller works on the difference between two samples.
+    struct foreground_load {
+        // Number of reads whose latency was sampled.
+        int64_t sampled_reads = 0;
+        // Sum of the sampled read latencies, in nanoseconds.
+        int64_t read_latency_sum = 0;
+        // Number of reads in progress at the time of sampling.
+        int64_t pending_reads = 0;
+    };
+    using load_source = std::function<foreground_load()>;
+
+    static constexpr double min_factor = 1.0 / 16;
+    static constexpr double factor_increase = 1.0 / 16;
+    static constexpr std::chrono::milliseconds adjust_period{100};
+private:
+    struct sleeper {
+        promise<> done;
+        timer<> tmr;
+        sleeper() : tmr([this] { done.set_value(); }) {}
+    };
+
+    // 0 means unthrottled.
+    uint64_t _bytes_per_second = 0;
+    clock::time_point _next_free = clock::time_point::min();
+    std::list<sleeper> _sleepers;
+    bool _stopped = false;
+
+    bool _adaptive = false;
+    double _factor = 1.0;
+    std::chrono::nanoseconds _read_latency_target = std::chrono::milliseconds(10);
+    int64_t _pending_reads_target = 64;
+    load_source _load_source;
+    foreground_load _last_load;
+    timer<> _adjust_timer;
+public:
+    compaction_throttle();
+
+    // Resolves once processing the given amount of bytes fits into the
+    // effective rate.
+    future<> throttle(uint64_t bytes);
+
+    void set_bytes_per_second(uint64_t bytes_per_second) {
+        _bytes_per_second = bytes_per_second;
+    }
+
+    uint64_t bytes_per_second() const {
+        return _bytes_per_second;
+    }
+
+    // Rate currently enforced, after adaptive scaling.
+    uint64_t effective_bytes_per_second() const {
+        return _bytes_per_second * _factor;
+    }
+
+    void set_adaptive(bool adaptive);
+
+    bool adaptive() const {
+        return _adaptive;
+    }
+
+    void set_read_latency_target(std::chrono::nanoseconds target) {
+        _read_latency_target = target;
+    }
+
+    void set_pending_reads_target(int64_t target) {
+        _pending_reads_target = target;
+    }
+
+    void set_load_source(load_source source);
+
+    double factor() const {
+        return _factor;
+    }
+
+    // Runs one step of the feedback controller. Called periodically while
+    // in adaptive mode.
+    void adjust();
+
+    void stop();
+};
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "cpu_scheduler.hh"
+#include "core/reactor.hh"
+#include "core/sleep.hh"
+#include "core/future-util.hh"
+
+constexpr cpu_scheduler::clock::duration cpu_scheduler::timeslice;
+constexpr cpu_scheduler::clock::duration cpu_scheduler::max_sleep;
+
+scheduling_group cpu_scheduler::register_group(sstring name, uint32_t shares) {
+    group_data g;
+    g.name = std::move(name);
+    g.shares = std::max(shares, 1u);
+    _groups.push_back(std::move(g));
+    return scheduling_group(_groups.size() - 1);
+}
+
+std::vector<scheduling_group> cpu_scheduler::groups() const {
+    std::vector<scheduling_group> groups;
+    for (unsigned id = 0; id < _groups.size(); ++id) {
+        groups.emplace_back(id);
+    }
+    return groups;
+}
+
+future<> cpu_scheduler::yield(const scheduling_group& sg, clock::duration ran) {
+    auto& g = _groups[sg.id()];
+    g.stats.runtime_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(ran).count();
+    ++g.stats.slices;
+    auto statement_shares = _groups[_statement.id()].shares;
+    if (!_foreground || g.shares >= statement_shares) {
+        g.debt = clock::duration();
+        return later();
+    }
+    g.debt += ran * statement_shares / g.shares;
+    if (g.debt < timeslice) {
+        return later();
+    }
+    return sleep_off_debt(sg.id());
+}
+
+future<> cpu_scheduler::sleep_off_debt(unsigned id) {
+    auto start = clock::now();
+    return repeat([this, id] {
+        auto& g = _groups[id];
+        if (!_foreground) {
+            g.debt = clock::duration();
+        }
+        if (g.debt <= clock::duration()) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        auto slept_from = clock::now();
+        return sleep(std::min(g.debt, max_sleep)).then([this, id, slept_from] {
+            _groups[id].debt -= clock::now() - slept_from;
+            return stop_iteration::no;
+        });
+    }).then([this, id, start] {
+        _groups[id].stats.deferred_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    });
+}
+
+namespace {
+
+struct local_scheduler {
+    cpu_scheduler scheduler;
+    scheduling_group compaction = scheduler.register_group("compaction", 200);
+    scheduling_group streaming = scheduler.register_group("streaming", 200);
+    scheduling_group memtable_flush = scheduler.register_group("memtable_flush", 250);
+    scheduling_group maintenance = scheduler.register_group("maintenance", 100);
+};
+
+local_scheduler& local() {
+    static thread_local local_scheduler s;
+    return s;
+}
+
+}
+
+cpu_scheduler& local_cpu_scheduler() {
+    return local().scheduler;
+}
+
+const scheduling_group& statement_group() {
+    return local().scheduler.statement_group();
+}
+
+const scheduling_group& compaction_group() {
+    return local().compaction;
+}
+
+const scheduling_group& streaming_group() {
+    return local().streaming;
+}
+
+const scheduling_group& memtable_flush_group() {
+    return local().memtable_flush;
+}
+
+const scheduling_group& maintenance_group() {
+    return local().maintenance;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/future.hh"
+#include "core/sstring.hh"
+#include "util/defer.hh"
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+// A group of the CPU work of a cpu_scheduler, such as compaction.
+class scheduling_group {
+    unsigned _id;
+public:
+    explicit scheduling_group(unsigned id) : _id(id) { }
+
+    unsigned id() const {
+        return _id;
+    }
+};
+
+// Per-shard scheduler of the background CPU work of the shard.
+//
+// The reactor runs all tasks from one queue, so background work is
+// scheduled cooperatively: it runs in timeslices, and yields between them
+// through yield(), which charges the group for the time the slice took.
+// While foreground requests are in progress, a group with fewer shares than
+// the statement group then sleeps off its debt, the time the statements are
+// due for the group to have had its share, so the CPU is divided in
+// proportion to the shares. With no foreground request in progress, the
+// group just lets the reactor run what is pending and goes on, taking the
+// cycles nobody else wants; the debt is forgiven.
+class cpu_scheduler {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // How long background work should run before it yields.
+    static constexpr clock::duration timeslice = std::chrono::microseconds(500);
+    // The longest a group sleeps before checking whether the foreground
+    // went idle.
+    static constexpr clock::duration max_sleep = std::chrono::milliseconds(1);
+
+    struct group_stats {
+        uint64_t runtime_ns = 0;
+        // Time the group slept off its debt.
+        uint64_t deferred_ns = 0;
+        uint64_t slices = 0;
+    };
+
+    // Counts a foreground request in progress while it lives.
+    class foreground_request {
+        cpu_scheduler* _s;
+    public:
+        explicit foreground_request(cpu_scheduler& s) : _s(&s) {
+            ++_s->_foreground;
+        }
+        foreground_request(foreground_request&& o) noexcept : _s(std::exchange(o._s, nullptr)) { }
+        foreground_request& operator=(foreground_request&&) = delete;
+        ~foreground_request() {
+            if (_s) {
+                --_s->_foreground;
+            }
+        }
+    };
+private:
+    struct group_data {
+        sstring name;
+        uint32_t shares;
+        clock::duration debt{};
+        group_stats stats;
+    };
+    std::vector<group_data> _groups;
+    unsigned _foreground = 0;
+    scheduling_group _statement;
+private:
+    future<> sleep_off_debt(unsigned id);
+public:
+    cpu_scheduler()
+        : _statement(register_group("statement", 1000))
+    { }
+
+    scheduling_group register_group(sstring name, uint32_t shares);
+
+    // The group foreground requests run in, to whose shares the shares of
+    // the others are relative.
+    const scheduling_group& statement_group() const {
+        return _statement;
+    }
+
+    foreground_request start_foreground() {
+        return foreground_request(*this);
+    }
+
+    bool foreground_busy() const {
+        return _foreground;
+    }
+
+    // Charges the group for a timeslice which ran for ran, and resolves
+    // when the group may start the next one.
+    future<> yield(const scheduling_group& sg, clock::duration ran);
+
+    void set_shares(const scheduling_group& sg, uint32_t shares) {
+        _groups[sg.id()].shares = std::max(shares, 1u);
+    }
+
+    uint32_t shares(const scheduling_group& sg) const {
+        return _groups[sg.id()].shares;
+    }
+
+    const sstring& name(const scheduling_group& sg) const {
+        return _groups[sg.id()].name;
+    }
+
+    const group_stats& get_stats(const scheduling_group& sg) const {
+        return _groups[sg.id()].stats;
+    }
+
+    std::vector<scheduling_group> groups() const;
+};
+
+// The scheduler of this shard.
+cpu_scheduler& local_cpu_scheduler();
+
+// The groups of the background work of this shard, registered with
+// local_cpu_scheduler().
+const scheduling_group& statement_group();
+const scheduling_group& compaction_group();
+const scheduling_group& streaming_group();
+const scheduling_group& memtable_flush_group();
+const scheduling_group& maintenance_group();
+
+// Accounts the CPU time of background work of a group, in the synchronous
+// stretches it is run through run(), and yields to the scheduler once it
+// used up a timeslice.
+class cpu_timeslice {
+    scheduling_group _sg;
+    cpu_scheduler::clock::duration _ran{};
+public:
+    explicit cpu_timeslice(const scheduling_group& sg) : _sg(sg) { }
+
+    template <typename Func>
+    std::result_of_t<Func()> run(Func&& func) {
+        auto start = cpu_scheduler::clock::now();
+        auto charge = defer([this, start] {
+            _ran += cpu_scheduler::clock::now() - start;
+        });
+        return func();
+    }
+
+    // Charges work timed by the caller.
+    void charge(cpu_scheduler::clock::duration ran) {
+        _ran += ran;
+    }
+
+    bool expired() const {
+        return _ran >= cpu_scheduler::timeslice;
+    }
+
+    // Yields to the scheduler, charging it what ran since the last yield.
+    future<> yield() {
+        auto ran = std::exchange(_ran, cpu_scheduler::clock::duration());
+        return local_cpu_scheduler().yield(_sg, ran);
+    }
+
+    // Yields if the timeslice is used up.
+    future<> maybe_yield() {
+        if (!expired()) {
+            return make_ready_future<>();
+        }
+        return yield();
+    }
+};
@@ -124,6 +124,10 @@ class data_output {
         _ptr = std::copy(s, e, _ptr);
         return *this;
     }
+    // bytes_view iterators; copied at once rather than byte by byte.
+    data_output& write(const int8_t* s, const int8_t* e) {
+        return write(reinterpret_cast<const char*>(s), reinterpret_cast<const char*>(e));
+    }
     template<typename T>
     data_output& write(T t, size_t n) {
         while (n-- > 0) {
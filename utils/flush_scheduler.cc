@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "flush_scheduler.hh"
+#include <algorithm>
+
+future<> flush_scheduler::schedule(size_t memory, db::replay_position rp, std::function<future<>()> func) {
+    return acquire(memory, rp).then([this, memory, func = std::move(func)] {
+        auto start = clock::now();
+        return func().finally([this, memory, start] {
+            release(memory, start);
+        });
+    });
+}
+
+future<> flush_scheduler::acquire(size_t memory, db::replay_position rp) {
+    if (_stats.running < _max_concurrent && _waiters.empty()) {
+        ++_stats.running;
+        return make_ready_future<>();
+    }
+    _waiters.push_back(waiter{memory, rp, promise<>()});
+    ++_stats.queued;
+    return _waiters.back().pr.get_future();
+}
+
+void flush_scheduler::release(size_t memory, clock::time_point start) {
+    --_stats.running;
+    ++_stats.completed;
+    _stats.bytes_flushed += memory;
+    _stats.flush_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    run_waiters();
+}
+
+void flush_scheduler::run_waiters() {
+    while (_stats.running < _max_concurrent && !_waiters.empty()) {
+        auto i = _waiters.begin();
+        if (_pressure_source && _pressure_source()) {
+            i = std::max_element(_waiters.begin(), _waiters.end(), [] (const waiter& a, const waiter& b) {
+                return a.memory < b.memory;
+            });
+        } else {
+            // Memtables of tables without commitlog pin no segment.
+            i = std::min_element(_waiters.begin(), _waiters.end(), [] (const waiter& a, const waiter& b) {
+                if (a.rp == db::replay_position()) {
+                    return false;
+                }
+                return b.rp == db::replay_position() || a.rp < b.rp;
+            });
+        }
+        auto pr = std::move(i->pr);
+        _waiters.erase(i);
+        --_stats.queued;
+        ++_stats.running;
+        pr.set_value();
+    }
+}
+
+void flush_scheduler::set_max_concurrent(unsigned max_concurrent) {
+    _max_concurrent = std::max(max_concurrent, 1u);
+    run_waiters();
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/future.hh"
+#include "db/commitlog/replay_position.hh"
+#include <chrono>
+#include <functional>
+#include <vector>
+
+// Per-shard scheduler of memtable flushes, shared by all the column
+// families of the shard.
+//
+// At most max_concurrent flushes run at a time. When one completes, its
+// slot goes to the waiting flush which frees the most memory if writers
+// are short of memtable memory, and otherwise to the one holding the
+// oldest replay position, i.e. pinning the oldest commitlog segment.
+class flush_scheduler {
+public:
+    using clock = std::chrono::steady_clock;
+    // Tells whether writers are waiting for memtable memory.
+    using pressure_source = std::function<bool()>;
+
+    struct stats {
+        uint64_t queued = 0;
+        uint64_t running = 0;
+        uint64_t completed = 0;
+        // Memtable memory flushed, and the time the flushes took.
+        uint64_t bytes_flushed = 0;
+        uint64_t flush_time_ns = 0;
+    };
+private:
+    struct waiter {
+        size_t memory;
+        db::replay_position rp;
+        promise<> pr;
+    };
+    unsigned _max_concurrent;
+    std::vector<waiter> _waiters;
+    pressure_source _pressure_source;
+    stats _stats;
+private:
+    future<> acquire(size_t memory, db::replay_position rp);
+    void release(size_t memory, clock::time_point start);
+    void run_waiters();
+public:
+    explicit flush_scheduler(unsigned max_concurrent = 1)
+        : _max_concurrent(std::max(max_concurrent, 1u))
+    { }
+
+    // Runs func, which flushes a memtable of the given size and replay
+    // position, once it gets a flush slot.
+    future<> schedule(size_t memory, db::replay_position rp, std::function<future<>()> func);
+
+    void set_max_concurrent(unsigned max_concurrent);
+
+    unsigned max_concurrent() const {
+        return _max_concurrent;
+    }
+
+    void set_pressure_source(pressure_source source) {
+        _pressure_source = std::move(source);
+    }
+
+    const stats& get_stats() const {
+        return _stats;
+    }
+};
@@ -22,6 +22,10 @@
 #pragma once
 
 #include <boost/circular_buffer.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
 #include "latency.hh"
 
 namespace utils {
@@ -104,4 +108,109 @@ class ihistogram {
     }
 };
 
+/**
+ * A histogram for estimating percentiles of recent values, like latencies,
+ * in the manner of HdrHistogram.
+ *
+ * Buckets are log-linear: values below 2^sub_bucket_bits get one each, and
+ * every power of two above is split into 2^sub_bucket_bits buckets, so that
+ * a percentile is over-estimated by less than 1/2^sub_bucket_bits of it.
+ * Values of max_value_bits bits or more share the last bucket. Recording a
+ * value takes a few bit operations and an increment, with no allocation,
+ * so every value can be recorded rather than a sample.
+ *
+ * Counts are halved every decay period, so that estimates follow what
+ * happened lately rather than since startup. Histograms merge by adding up
+ * their buckets, e.g. to combine those of all shards.
+ */
+class decaying_histogram {
+public:
+    using clock = std::chrono::steady_clock;
+    static constexpr unsigned sub_bucket_bits = 4;
+    static constexpr unsigned max_value_bits = 40;
+    static constexpr unsigned bucket_count = (max_value_bits - sub_bucket_bits + 1) << sub_bucket_bits;
+private:
+    std::array<uint32_t, bucket_count> _buckets{};
+    uint64_t _count = 0;
+    clock::duration _decay_period;
+    clock::time_point _last_decay;
+
+    static unsigned bucket_of(uint64_t value) {
+        if (value < (1 << sub_bucket_bits)) {
+            return value;
+        }
+        unsigned msb = 63 - __builtin_clzll(value);
+        if (msb >= max_value_bits) {
+            return bucket_count - 1;
+        }
+        return ((msb - sub_bucket_bits + 1) << sub_bucket_bits)
+                | ((value >> (msb - sub_bucket_bits)) & ((1 << sub_bucket_bits) - 1));
+    }
+    // The smallest value falling into bucket b.
+    static uint64_t lower_bound_of(unsigned b) {
+        if (b < (1 << sub_bucket_bits)) {
+            return b;
+        }
+        unsigned msb = (b >> sub_bucket_bits) + sub_bucket_bits - 1;
+        uint64_t mantissa = (1 << sub_bucket_bits) | (b & ((1 << sub_bucket_bits) - 1));
+        return mantissa << (msb - sub_bucket_bits);
+    }
+public:
+    explicit decaying_histogram(clock::duration decay_period = std::chrono::seconds(60))
+        : _decay_period(decay_period)
+        , _last_decay(clock::now())
+    { }
+
+    void mark(uint64_t value, clock::time_point now = clock::now()) {
+        decay(now);
+        ++_buckets[bucket_of(value)];
+        ++_count;
+    }
+
+    // Ages the counts up to now, as marking does. Percentiles of a
+    // histogram nothing was marked into lately are otherwise stale.
+    void decay(clock::time_point now = clock::now()) {
+        auto periods = (now - _last_decay) / _decay_period;
+        if (periods <= 0) {
+            return;
+        }
+        _last_decay += periods * _decay_period;
+        _count = 0;
+        for (auto& b : _buckets) {
+            b = periods < 32 ? b >> periods : 0;
+            _count += b;
+        }
+    }
+
+    // Adds the values of another histogram, both aged up to now.
+    decaying_histogram& merge(decaying_histogram other, clock::time_point now = clock::now()) {
+        decay(now);
+        other.decay(now);
+        for (unsigned b = 0; b < bucket_count; ++b) {
+            _buckets[b] += other._buckets[b];
+        }
+        _count += other._count;
+        return *this;
+    }
+
+    // Number of values recorded, as decayed.
+    uint64_t count() const {
+        return _count;
+    }
+
+    // Returns a value which at least a fraction p of the recorded values
+    // don't exceed, or 0 if nothing has been recorded.
+    uint64_t percentile(double p) const {
+        uint64_t rank = std::max<uint64_t>(1, std::ceil(p * _count));
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < bucket_count - 1; ++b) {
+            seen += _buckets[b];
+            if (seen >= rank) {
+                return lower_bound_of(b + 1) - 1;
+            }
+        }
+        return _count ? lower_bound_of(bucket_count - 1) : 0;
+    }
+};
+
 }
@@ -22,12 +22,30 @@
 
 #include "log.hh"
 #include "bloom_filter.hh"
+#include "blocked_bloom_filter.hh"
 #include "bloom_calculations.hh"
 
 namespace utils {
 static logging::logger filterlog("bloom_filter");
 
-filter_ptr i_filter::get_filter(long num_elements, double max_false_pos_probability) {
+sstring to_sstring(filter_format format) {
+    switch (format) {
+    case filter_format::murmur3: return "murmur3";
+    case filter_format::blocked: return "blocked";
+    }
+    abort();
+}
+
+filter_format filter_format_from_sstring(const sstring& name) {
+    if (name == "murmur3") {
+        return filter_format::murmur3;
+    } else if (name == "blocked") {
+        return filter_format::blocked;
+    }
+    throw std::invalid_argument(sprint("Invalid bloom filter format %s", name));
+}
+
+filter_ptr i_filter::get_filter(long num_elements, double max_false_pos_probability, filter_format format) {
     if (max_false_pos_probability > 1.0) {
         throw std::invalid_argument(sprint("Invalid probability %f: must be lower than 1.0", max_false_pos_probability));
     }
@@ -38,6 +56,9 @@ filter_ptr i_filter::get_filter(long num_elements, double max_false_pos_probabil
 
     int buckets_per_element = bloom_calculations::max_buckets_per_element(num_elements);
     auto spec = bloom_calculations::compute_bloom_spec(buckets_per_element, max_false_pos_probability);
+    if (format == filter_format::blocked) {
+        return filter::create_blocked_filter(spec.K, num_elements, spec.buckets_per_element);
+    }
     return filter::create_filter(spec.K, num_elements, spec.buckets_per_element);
 }
 
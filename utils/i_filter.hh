@@ -48,6 +48,18 @@ namespace utils {
 struct i_filter;
 using filter_ptr = std::unique_ptr<i_filter>;
 
+// Layout of a bloom filter, selectable per table.
+enum class filter_format {
+    // Bits of a key spread over the whole bitmap, as in Origin.
+    murmur3,
+    // Bits of a key confined to one cache line, see blocked_bloom_filter.
+    blocked,
+};
+
+sstring to_sstring(filter_format format);
+// Throws std::invalid_argument for an unknown name.
+filter_format filter_format_from_sstring(const sstring& name);
+
 // FIXME: serialize() and serialized_size() not implemented. We should only be serializing to
 // disk, not in the wire.
 struct i_filter {
@@ -67,7 +79,8 @@ struct i_filter {
      *         Asserts that the given probability can be satisfied using this
      *         filter.
      */
-    static filter_ptr get_filter(long num_elements, double max_false_pos_prob);
+    static filter_ptr get_filter(long num_elements, double max_false_pos_prob,
+            filter_format format = filter_format::murmur3);
     /**
      * @return A bloom_filter with the lowest practical false positive
      *         probability for the given number of elements.
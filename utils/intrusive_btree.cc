@@ -0,0 +1,626 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "utils/intrusive_btree.hh"
+#include "utils/allocation_strategy.hh"
+
+intrusive_btree_hook::intrusive_btree_hook(intrusive_btree_hook&& o) noexcept
+    : _node(o._node)
+{
+    if (_node) {
+        auto i = _node->index_of(&o);
+        _node->_items[i] = this;
+        if (i == 0) {
+            btree_detail::tree_base::update_leftmost(_node);
+        }
+        o._node = nullptr;
+    }
+}
+
+namespace btree_detail {
+
+void node_base::relink(node_base* old) noexcept {
+    if (_parent) {
+        _parent->_children[_parent->index_of(old)] = this;
+    } else {
+        _tree->_root = this;
+    }
+}
+
+leaf_node::leaf_node(leaf_node&& o) noexcept
+    : node_base(std::move(o))
+    , _prev(o._prev)
+    , _next(o._next)
+{
+    std::copy_n(o._items, _count, _items);
+    adopt(0, _count);
+    if (_prev) {
+        _prev->_next = this;
+    }
+    if (_next) {
+        _next->_prev = this;
+    }
+    relink(&o);
+}
+
+prefixed_leaf_node::prefixed_leaf_node(prefixed_leaf_node&& o) noexcept
+    : leaf_node(std::move(o))
+{
+    std::copy_n(o._prefixes, _count, _prefixes);
+}
+
+void leaf_node::adopt(unsigned begin, unsigned end) noexcept {
+    for (unsigned i = begin; i < end; ++i) {
+        _items[i]->_node = this;
+    }
+}
+
+inner_node::inner_node(inner_node&& o) noexcept
+    : node_base(std::move(o))
+{
+    std::copy_n(o._keys, _count, _keys);
+    std::copy_n(o._children, _count, _children);
+    for (unsigned i = 0; i < _count; ++i) {
+        _children[i]->_parent = this;
+    }
+    relink(&o);
+}
+
+prefixed_inner_node::prefixed_inner_node(prefixed_inner_node&& o) noexcept
+    : inner_node(std::move(o))
+{
+    std::copy_n(o._prefixes, _count, _prefixes);
+}
+
+static leaf_node* new_leaf(bool prefixed) {
+    if (prefixed) {
+        return current_allocator().construct<prefixed_leaf_node>();
+    }
+    return current_allocator().construct<leaf_node>();
+}
+
+static inner_node* new_inner(bool prefixed) {
+    if (prefixed) {
+        return current_allocator().construct<prefixed_inner_node>();
+    }
+    return current_allocator().construct<inner_node>();
+}
+
+static void free_node(leaf_node* n) noexcept {
+    if (n->_prefixed) {
+        current_allocator().destroy(static_cast<prefixed_leaf_node*>(n));
+    } else {
+        current_allocator().destroy(n);
+    }
+}
+
+static void free_node(inner_node* n) noexcept {
+    if (n->_prefixed) {
+        current_allocator().destroy(static_cast<prefixed_inner_node*>(n));
+    } else {
+        current_allocator().destroy(n);
+    }
+}
+
+template <typename T>
+static void move_array(T* src, unsigned s, T* dst, unsigned d, unsigned n) noexcept {
+    std::memmove(dst + d, src + s, n * sizeof(T));
+}
+
+// Moves n entries of src starting at s to dst starting at d, leaving
+// parent and leaf pointers to the caller. The ranges may overlap.
+static void move_entries(leaf_node& src, unsigned s, leaf_node& dst, unsigned d, unsigned n) noexcept {
+    move_array(src._items, s, dst._items, d, n);
+    if (dst._prefixed) {
+        move_array(src.prefixes(), s, dst.prefixes(), d, n);
+    }
+}
+
+static void move_entries(inner_node& src, unsigned s, inner_node& dst, unsigned d, unsigned n) noexcept {
+    move_array(src._keys, s, dst._keys, d, n);
+    move_array(src._children, s, dst._children, d, n);
+    if (dst._prefixed) {
+        move_array(src.prefixes(), s, dst.prefixes(), d, n);
+    }
+}
+
+// Points p's key for child i at the leftmost element of that child.
+static void set_key(inner_node& p, unsigned i) noexcept {
+    auto child = p._children[i];
+    p._keys[i] = child->leftmost();
+    if (p._prefixed) {
+        p.prefixes()[i] = child->leftmost_prefix();
+    }
+}
+
+// Moves the last n entries of left to the front of right.
+static void shift_right(leaf_node& left, leaf_node& right, unsigned n) noexcept {
+    move_entries(right, 0, right, n, right._count);
+    move_entries(left, left._count - n, right, 0, n);
+    right.adopt(0, n);
+    left._count -= n;
+    right._count += n;
+}
+
+static void shift_right(inner_node& left, inner_node& right, unsigned n) noexcept {
+    move_entries(right, 0, right, n, right._count);
+    move_entries(left, left._count - n, right, 0, n);
+    for (unsigned i = 0; i < n; ++i) {
+        right._children[i]->_parent = &right;
+    }
+    left._count -= n;
+    right._count += n;
+}
+
+// Moves the first n entries of right to the back of left.
+static void shift_left(leaf_node& left, leaf_node& right, unsigned n) noexcept {
+    move_entries(right, 0, left, left._count, n);
+    move_entries(right, n, right, 0, right._count - n);
+    left.adopt(left._count, left._count + n);
+    left._count += n;
+    right._count -= n;
+}
+
+static void shift_left(inner_node& left, inner_node& right, unsigned n) noexcept {
+    move_entries(right, 0, left, left._count, n);
+    move_entries(right, n, right, 0, right._count - n);
+    for (unsigned i = left._count; i < left._count + n; ++i) {
+        left._children[i]->_parent = &left;
+    }
+    left._count += n;
+    right._count -= n;
+}
+
+template <typename Node>
+static void shift_right(node_base& left, node_base& right, unsigned n) noexcept {
+    shift_right(static_cast<Node&>(left), static_cast<Node&>(right), n);
+}
+
+template <typename Node>
+static void shift_left(node_base& left, node_base& right, unsigned n) noexcept {
+    shift_left(static_cast<Node&>(left), static_cast<Node&>(right), n);
+}
+
+static void destroy_node(node_base* n) noexcept {
+    if (n->_leaf) {
+        auto leaf = static_cast<leaf_node*>(n);
+        if (leaf->_prev) {
+            leaf->_prev->_next = leaf->_next;
+        }
+        if (leaf->_next) {
+            leaf->_next->_prev = leaf->_prev;
+        }
+        free_node(leaf);
+    } else {
+        free_node(static_cast<inner_node*>(n));
+    }
+}
+
+// Nodes allocated upfront by an insertion, so that linking can't fail.
+struct tree_base::reserve {
+    // Enough for any tree which fits in memory.
+    static constexpr unsigned max_depth = 32;
+
+    leaf_node* leaf = nullptr;
+    inner_node* inner[max_depth];
+    unsigned inner_count = 0;
+
+    reserve(bool prefixed, bool need_leaf, unsigned need_inner) {
+        assert(need_inner <= max_depth);
+        try {
+            if (need_leaf) {
+                leaf = new_leaf(prefixed);
+            }
+            while (inner_count < need_inner) {
+                inner[inner_count] = new_inner(prefixed);
+                ++inner_count;
+            }
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+    ~reserve() {
+        release();
+    }
+    void release() noexcept {
+        if (leaf) {
+            free_node(leaf);
+            leaf = nullptr;
+        }
+        while (inner_count) {
+            free_node(inner[--inner_count]);
+        }
+    }
+    leaf_node* take_leaf() {
+        return std::exchange(leaf, nullptr);
+    }
+    inner_node* take_inner() {
+        return inner[--inner_count];
+    }
+};
+
+tree_base::tree_base(tree_base&& o) noexcept
+    : _root(std::exchange(o._root, nullptr))
+    , _size(std::exchange(o._size, 0))
+    , _prefixed(o._prefixed)
+{
+    if (_root) {
+        _root->_tree = this;
+    }
+}
+
+tree_base::~tree_base() {
+    clear();
+}
+
+void tree_base::swap(tree_base& o) noexcept {
+    std::swap(_root, o._root);
+    std::swap(_size, o._size);
+    if (_root) {
+        _root->_tree = this;
+    }
+    if (o._root) {
+        o._root->_tree = &o;
+    }
+}
+
+leaf_node* tree_base::first_leaf() const {
+    auto n = _root;
+    if (!n) {
+        return nullptr;
+    }
+    while (!n->_leaf) {
+        n = static_cast<inner_node*>(n)->_children[0];
+    }
+    return static_cast<leaf_node*>(n);
+}
+
+leaf_node* tree_base::last_leaf() const {
+    auto n = _root;
+    if (!n) {
+        return nullptr;
+    }
+    while (!n->_leaf) {
+        auto in = static_cast<inner_node*>(n);
+        n = in->_children[in->_count - 1];
+    }
+    return static_cast<leaf_node*>(n);
+}
+
+intrusive_btree_hook* tree_base::first() const {
+    auto leaf = first_leaf();
+    return leaf ? leaf->_items[0] : nullptr;
+}
+
+intrusive_btree_hook* tree_base::last() const {
+    auto leaf = last_leaf();
+    return leaf ? leaf->_items[leaf->_count - 1] : nullptr;
+}
+
+intrusive_btree_hook* tree_base::next(const intrusive_btree_hook* h) {
+    auto leaf = h->_node;
+    auto i = leaf->index_of(h) + 1;
+    if (i < leaf->_count) {
+        return leaf->_items[i];
+    }
+    return leaf->_next ? leaf->_next->_items[0] : nullptr;
+}
+
+intrusive_btree_hook* tree_base::prev(const intrusive_btree_hook* h) {
+    auto leaf = h->_node;
+    auto i = leaf->index_of(h);
+    if (i) {
+        return leaf->_items[i - 1];
+    }
+    return leaf->_prev ? leaf->_prev->_items[leaf->_prev->_count - 1] : nullptr;
+}
+
+// Propagates a change of the leftmost element of n to the keys of its
+// ancestors.
+void tree_base::update_leftmost(node_base* n) noexcept {
+    while (n->_parent) {
+        auto p = n->_parent;
+        auto i = p->index_of(n);
+        set_key(*p, i);
+        if (i) {
+            break;
+        }
+        n = p;
+    }
+}
+
+void tree_base::insert_before(intrusive_btree_hook* pos, intrusive_btree_hook* h, uint64_t prefix, tree_base* from) {
+    if (!_root) {
+        auto leaf = new_leaf(_prefixed);
+        if (from) {
+            from->erase(h);
+        }
+        leaf->_tree = this;
+        leaf->_items[0] = h;
+        if (_prefixed) {
+            leaf->prefixes()[0] = prefix;
+        }
+        leaf->_count = 1;
+        h->_node = leaf;
+        _root = leaf;
+        ++_size;
+        return;
+    }
+
+    leaf_node* leaf;
+    unsigned idx;
+    if (pos) {
+        leaf = pos->_node;
+        idx = leaf->index_of(pos);
+    } else {
+        leaf = last_leaf();
+        idx = leaf->_count;
+    }
+
+    // Every full node on the way up splits, and a full root gets a new
+    // parent on top.
+    bool leaf_splits = leaf->_count == node_size;
+    unsigned inner_splits = 0;
+    if (leaf_splits) {
+        node_base* n = leaf;
+        while (n->_parent && n->_parent->_count == node_size) {
+            n = n->_parent;
+            ++inner_splits;
+        }
+        if (!n->_parent) {
+            ++inner_splits;
+        }
+    }
+    reserve r(_prefixed, leaf_splits, inner_splits);
+
+    if (from) {
+        from->erase(h);
+    }
+    ++_size;
+
+    auto link = [h, prefix] (leaf_node& l, unsigned i) {
+        move_entries(l, i, l, i + 1, l._count - i);
+        l._items[i] = h;
+        if (l._prefixed) {
+            l.prefixes()[i] = prefix;
+        }
+        h->_node = &l;
+        ++l._count;
+        if (i == 0) {
+            update_leftmost(&l);
+        }
+    };
+
+    if (!leaf_splits) {
+        link(*leaf, idx);
+        return;
+    }
+
+    // When appending, which is how partitions get built from sorted
+    // input, keep the left node full instead of leaving two half-full ones.
+    bool appending = idx == node_size && !leaf->_next;
+    unsigned split = appending ? node_size : node_size / 2;
+    auto right = r.take_leaf();
+    shift_right(*leaf, *right, node_size - split);
+    right->_prev = leaf;
+    right->_next = leaf->_next;
+    if (leaf->_next) {
+        leaf->_next->_prev = right;
+    }
+    leaf->_next = right;
+    if (idx < split || (idx == split && split < node_size)) {
+        link(*leaf, idx);
+    } else {
+        link(*right, idx - split);
+    }
+    insert_child(leaf, right, r, appending);
+}
+
+// Links right as the next sibling of left, splitting the parent if needed.
+void tree_base::insert_child(node_base* left, node_base* right, reserve& r, bool appending) {
+    if (!left->_parent) {
+        auto root = r.take_inner();
+        root->_tree = this;
+        left->_tree = nullptr;
+        left->_parent = root;
+        right->_parent = root;
+        root->_children[0] = left;
+        root->_children[1] = right;
+        set_key(*root, 0);
+        set_key(*root, 1);
+        root->_count = 2;
+        _root = root;
+        return;
+    }
+
+    auto link = [right] (inner_node& p, unsigned i) {
+        move_entries(p, i, p, i + 1, p._count - i);
+        p._children[i] = right;
+        set_key(p, i);
+        right->_parent = &p;
+        ++p._count;
+    };
+
+    auto p = left->_parent;
+    auto idx = p->index_of(left) + 1;
+    if (p->_count < node_size) {
+        link(*p, idx);
+        return;
+    }
+
+    unsigned split = appending ? node_size : node_size / 2;
+    auto p_right = r.take_inner();
+    shift_right(*p, *p_right, node_size - split);
+    if (idx <= split && split < node_size) {
+        link(*p, idx);
+    } else {
+        link(*p_right, idx - split);
+    }
+    insert_child(p, p_right, r, appending);
+}
+
+void tree_base::remove_child(inner_node* p, unsigned i) noexcept {
+    move_entries(*p, i + 1, *p, i, p->_count - i - 1);
+    --p->_count;
+    if (i == 0 && p->_count) {
+        update_leftmost(p);
+    }
+}
+
+void tree_base::erase(intrusive_btree_hook* h) noexcept {
+    auto leaf = h->_node;
+    auto i = leaf->index_of(h);
+    move_entries(*leaf, i + 1, *leaf, i, leaf->_count - i - 1);
+    --leaf->_count;
+    h->_node = nullptr;
+    --_size;
+    if (i == 0 && leaf->_count) {
+        update_leftmost(leaf);
+    }
+    rebalance(leaf);
+}
+
+void tree_base::unlink(intrusive_btree_hook* h) noexcept {
+    node_base* n = h->_node;
+    while (n->_parent) {
+        n = n->_parent;
+    }
+    n->_tree->erase(h);
+}
+
+// Restores the fill of n after it lost an entry, by merging it with a
+// sibling when both fit in one node, or else by moving entries over from
+// the sibling. Collapses the root when it's left with a single child.
+void tree_base::rebalance(node_base* n) noexcept {
+    if (!n->_parent) {
+        if (!n->_count) {
+            destroy_node(n);
+            _root = nullptr;
+        } else if (!n->_leaf && n->_count == 1) {
+            auto child = static_cast<inner_node*>(n)->_children[0];
+            child->_parent = nullptr;
+            child->_tree = this;
+            _root = child;
+            destroy_node(n);
+            rebalance(child);
+        }
+        return;
+    }
+    if (n->_count >= min_fill) {
+        return;
+    }
+
+    auto p = n->_parent;
+    auto i = p->index_of(n);
+    if (p->_count == 1) {
+        // No siblings; an empty node just goes away.
+        if (!n->_count) {
+            remove_child(p, i);
+            destroy_node(n);
+            rebalance(p);
+        }
+        return;
+    }
+
+    auto do_shift_left = n->_leaf ? shift_left<leaf_node> : shift_left<inner_node>;
+    auto do_shift_right = n->_leaf ? shift_right<leaf_node> : shift_right<inner_node>;
+
+    if (i > 0) {
+        auto left = p->_children[i - 1];
+        if (left->_count + n->_count <= node_size) {
+            do_shift_left(*left, *n, n->_count);
+            remove_child(p, i);
+            destroy_node(n);
+            rebalance(p);
+            return;
+        }
+    }
+    if (i + 1 < p->_count) {
+        auto right = p->_children[i + 1];
+        if (n->_count + right->_count <= node_size) {
+            bool was_empty = !n->_count;
+            do_shift_left(*n, *right, right->_count);
+            remove_child(p, i + 1);
+            destroy_node(right);
+            if (was_empty) {
+                update_leftmost(n);
+            }
+            rebalance(p);
+            return;
+        }
+    }
+
+    // A sibling has enough entries to share; even the two out.
+    if (i > 0) {
+        auto left = p->_children[i - 1];
+        do_shift_right(*left, *n, (left->_count - n->_count) / 2);
+        update_leftmost(n);
+    } else {
+        auto right = p->_children[i + 1];
+        bool was_empty = !n->_count;
+        do_shift_left(*n, *right, (right->_count - n->_count) / 2);
+        update_leftmost(right);
+        if (was_empty) {
+            update_leftmost(n);
+        }
+    }
+}
+
+void tree_base::destroy_subtree(node_base* n, bool unlink_elements) noexcept {
+    if (n->_leaf) {
+        auto leaf = static_cast<leaf_node*>(n);
+        if (unlink_elements) {
+            for (unsigned i = 0; i < leaf->_count; ++i) {
+                leaf->_items[i]->_node = nullptr;
+            }
+        }
+        // Siblings go away too, no need to unlink.
+        free_node(leaf);
+    } else {
+        auto in = static_cast<inner_node*>(n);
+        for (unsigned i = 0; i < in->_count; ++i) {
+            destroy_subtree(in->_children[i], unlink_elements);
+        }
+        free_node(in);
+    }
+}
+
+void tree_base::destroy_nodes() noexcept {
+    if (_root) {
+        destroy_subtree(_root, false);
+        _root = nullptr;
+        _size = 0;
+    }
+}
+
+void tree_base::clear() noexcept {
+    if (_root) {
+        destroy_subtree(_root, true);
+        _root = nullptr;
+        _size = 0;
+    }
+}
+
+}
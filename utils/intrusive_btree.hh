@@ -0,0 +1,572 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <boost/intrusive/parent_from_member.hpp>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+//
+// An intrusive B+-tree, to be used instead of boost::intrusive::set for
+// ordered collections which can grow large, like the clustering rows of a
+// partition.
+//
+// Elements are linked through a hook member, as with boost::intrusive, but
+// tree nodes are separate objects holding up to node_size pointers to the
+// hooks. Leaves are linked for iteration, and inner nodes keep, for every
+// child, a pointer to the leftmost element of its subtree, against which
+// lookups binary search. A lookup thus touches log_8(n) to log_16(n) nodes
+// instead of the log_2(n) elements of a red-black tree, and elements no
+// longer carry three tree pointers each.
+//
+// Nodes are allocated with current_allocator() and are nothrow movable, and
+// hooks follow their elements when those are moved, so the tree can be kept
+// in an LSA region. As with any LSA object, iterators and element
+// references are invalidated by compaction of the region.
+//
+// Iterators point at elements, so they stay valid across insertion and
+// erasure of other elements. Unlike with boost::intrusive::set, inserting
+// allocates and may throw, in which case the tree is left unchanged.
+// Destroying a linked element unlinks it, like auto_unlink hooks do.
+//
+// A tree may also keep, next to each element and key pointer, a 64-bit
+// prefix of the element's key, given by the KeyPrefix function. Lookups
+// then compare prefixes first and only look at the elements on ties, so
+// that they mostly compare integers in cache-resident nodes.
+//
+
+class intrusive_btree_hook;
+
+namespace btree_detail {
+
+static constexpr unsigned node_size = 16;
+// Nodes with fewer entries get merged with, or refilled from, a sibling.
+static constexpr unsigned min_fill = node_size / 2;
+
+class tree_base;
+struct inner_node;
+
+// The KeyPrefix of trees which don't keep key prefixes.
+struct no_prefix {
+    template <typename Key>
+    uint64_t operator()(const Key&) const {
+        return 0;
+    }
+};
+
+struct node_base {
+    inner_node* _parent = nullptr;
+    // Set for the root only.
+    tree_base* _tree = nullptr;
+    uint16_t _count = 0;
+    const bool _leaf;
+    // Whether the node is a prefixed_leaf_node or a prefixed_inner_node.
+    const bool _prefixed;
+
+    node_base(bool leaf, bool prefixed) : _leaf(leaf), _prefixed(prefixed) { }
+    node_base(const node_base&) = delete;
+    node_base(node_base&& o) noexcept
+        : _parent(o._parent)
+        , _tree(o._tree)
+        , _count(o._count)
+        , _leaf(o._leaf)
+        , _prefixed(o._prefixed)
+    { }
+
+    bool is_root() const {
+        return !_parent;
+    }
+
+    // The leftmost element of the subtree, and its prefix. The node must
+    // not be empty.
+    intrusive_btree_hook* leftmost() const;
+    uint64_t leftmost_prefix() const;
+
+    // Makes whatever pointed to old, the tree or the parent, point to this.
+    void relink(node_base* old) noexcept;
+};
+
+struct leaf_node : node_base {
+    leaf_node* _prev = nullptr;
+    leaf_node* _next = nullptr;
+    intrusive_btree_hook* _items[node_size];
+
+    explicit leaf_node(bool prefixed = false) : node_base(true, prefixed) { }
+    leaf_node(leaf_node&&) noexcept;
+
+    // Prefixes of the items, or nullptr if the node doesn't keep them.
+    uint64_t* prefixes();
+    const uint64_t* prefixes() const;
+
+    // Points the hooks of items [begin, end) at this node.
+    void adopt(unsigned begin, unsigned end) noexcept;
+
+    unsigned index_of(const intrusive_btree_hook* h) const {
+        unsigned i = 0;
+        while (_items[i] != h) {
+            ++i;
+        }
+        return i;
+    }
+};
+
+struct inner_node : node_base {
+    // _keys[i] is the leftmost element under _children[i].
+    intrusive_btree_hook* _keys[node_size];
+    node_base* _children[node_size];
+
+    explicit inner_node(bool prefixed = false) : node_base(false, prefixed) { }
+    inner_node(inner_node&&) noexcept;
+
+    // Prefixes of the keys, or nullptr if the node doesn't keep them.
+    uint64_t* prefixes();
+    const uint64_t* prefixes() const;
+
+    unsigned index_of(const node_base* child) const {
+        unsigned i = 0;
+        while (_children[i] != child) {
+            ++i;
+        }
+        return i;
+    }
+};
+
+struct prefixed_leaf_node : leaf_node {
+    uint64_t _prefixes[node_size];
+
+    prefixed_leaf_node() : leaf_node(true) { }
+    prefixed_leaf_node(prefixed_leaf_node&&) noexcept;
+};
+
+struct prefixed_inner_node : inner_node {
+    uint64_t _prefixes[node_size];
+
+    prefixed_inner_node() : inner_node(true) { }
+    prefixed_inner_node(prefixed_inner_node&&) noexcept;
+};
+
+inline uint64_t* leaf_node::prefixes() {
+    return _prefixed ? static_cast<prefixed_leaf_node*>(this)->_prefixes : nullptr;
+}
+
+inline const uint64_t* leaf_node::prefixes() const {
+    return _prefixed ? static_cast<const prefixed_leaf_node*>(this)->_prefixes : nullptr;
+}
+
+inline uint64_t* inner_node::prefixes() {
+    return _prefixed ? static_cast<prefixed_inner_node*>(this)->_prefixes : nullptr;
+}
+
+inline const uint64_t* inner_node::prefixes() const {
+    return _prefixed ? static_cast<const prefixed_inner_node*>(this)->_prefixes : nullptr;
+}
+
+inline intrusive_btree_hook* node_base::leftmost() const {
+    return _leaf ? static_cast<const leaf_node*>(this)->_items[0] : static_cast<const inner_node*>(this)->_keys[0];
+}
+
+inline uint64_t node_base::leftmost_prefix() const {
+    if (!_prefixed) {
+        return 0;
+    }
+    return _leaf ? static_cast<const leaf_node*>(this)->prefixes()[0] : static_cast<const inner_node*>(this)->prefixes()[0];
+}
+
+// The part of the tree which doesn't depend on the element type: keeps the
+// structure balanced given positions, leaving ordering to intrusive_btree.
+class tree_base {
+protected:
+    node_base* _root = nullptr;
+    size_t _size = 0;
+    // Whether nodes keep key prefixes.
+    const bool _prefixed;
+public:
+    explicit tree_base(bool prefixed) : _prefixed(prefixed) { }
+    tree_base(const tree_base&) = delete;
+    tree_base(tree_base&&) noexcept;
+    ~tree_base();
+    void swap(tree_base&) noexcept;
+
+    size_t size() const {
+        return _size;
+    }
+    bool empty() const {
+        return !_size;
+    }
+
+    intrusive_btree_hook* first() const;
+    intrusive_btree_hook* last() const;
+    static intrusive_btree_hook* next(const intrusive_btree_hook*);
+    static intrusive_btree_hook* prev(const intrusive_btree_hook*);
+
+    // Links h, whose key has the given prefix, before pos, or at the end if
+    // pos is null; the caller maintains the ordering. If from is given, h
+    // is linked in it and gets unlinked from it only once nothing can fail
+    // anymore. Strong exception guarantee.
+    void insert_before(intrusive_btree_hook* pos, intrusive_btree_hook* h, uint64_t prefix, tree_base* from = nullptr);
+
+    void erase(intrusive_btree_hook* h) noexcept;
+
+    // Erases h from whichever tree it is in.
+    static void unlink(intrusive_btree_hook* h) noexcept;
+
+    // Unlinks all the elements.
+    void clear() noexcept;
+
+    static void update_leftmost(node_base* n) noexcept;
+protected:
+    leaf_node* first_leaf() const;
+    leaf_node* last_leaf() const;
+    // Frees the nodes, leaving the elements alone.
+    void destroy_nodes() noexcept;
+private:
+    friend struct node_base;
+    struct reserve;
+    void insert_child(node_base* left, node_base* right, reserve& r, bool appending);
+    void rebalance(node_base* n) noexcept;
+    void remove_child(inner_node* p, unsigned i) noexcept;
+    static void destroy_subtree(node_base* n, bool unlink_elements) noexcept;
+};
+
+}
+
+class intrusive_btree_hook {
+    btree_detail::leaf_node* _node = nullptr;
+    friend struct btree_detail::leaf_node;
+    friend class btree_detail::tree_base;
+    template <typename T, intrusive_btree_hook T::*, typename, typename> friend class intrusive_btree;
+public:
+    intrusive_btree_hook() = default;
+    // Copies of an element are not linked anywhere.
+    intrusive_btree_hook(const intrusive_btree_hook&) noexcept { }
+    // The new element takes the place of the old one in its tree.
+    intrusive_btree_hook(intrusive_btree_hook&&) noexcept;
+    intrusive_btree_hook& operator=(const intrusive_btree_hook&) = delete;
+    ~intrusive_btree_hook() {
+        if (_node) {
+            btree_detail::tree_base::unlink(this);
+        }
+    }
+
+    bool is_linked() const {
+        return _node;
+    }
+};
+
+// Ordered set of T, linked through the Hook member. Compare is a
+// strict weak ordering over T; lookups take comparators which also
+// compare T with keys.
+//
+// If given, KeyPrefix maps elements, and the keys they are looked up by, to
+// integers in a way consistent with the ordering: if a sorts before b, then
+// prefix(a) <= prefix(b).
+template <typename T, intrusive_btree_hook T::*Hook, typename Compare, typename KeyPrefix = btree_detail::no_prefix>
+class intrusive_btree : private btree_detail::tree_base {
+    using hook = intrusive_btree_hook;
+    using leaf_node = btree_detail::leaf_node;
+    using inner_node = btree_detail::inner_node;
+    using node_base = btree_detail::node_base;
+
+    static constexpr bool prefixed = !std::is_same<KeyPrefix, btree_detail::no_prefix>::value;
+
+    Compare _cmp;
+    KeyPrefix _prefix;
+private:
+    static T& element(hook* h) {
+        return *boost::intrusive::get_parent_from_member<T>(h, Hook);
+    }
+    static hook* hook_of(const T& v) {
+        return const_cast<hook*>(&(v.*Hook));
+    }
+
+    // Returns the first element for which before() is false, or nullptr.
+    // before() must be true for a prefix of the elements. prefix is that
+    // of the key before() compares with, which sorts after the elements of
+    // lower prefixes and before those of higher ones.
+    template <typename Before>
+    hook* partition_point(uint64_t prefix, Before&& before) const {
+        auto is_before = [&] (hook* const* hooks, const uint64_t* prefixes, unsigned i) {
+            if (prefixed && prefixes[i] != prefix) {
+                return prefixes[i] < prefix;
+            }
+            return before(element(hooks[i]));
+        };
+        node_base* n = _root;
+        if (!n) {
+            return nullptr;
+        }
+        while (!n->_leaf) {
+            auto in = static_cast<inner_node*>(n);
+            auto prefixes = in->prefixes();
+            unsigned lo = 1, hi = in->_count;
+            while (lo < hi) {
+                auto mid = (lo + hi) / 2;
+                if (is_before(in->_keys, prefixes, mid)) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            n = in->_children[lo - 1];
+        }
+        auto leaf = static_cast<leaf_node*>(n);
+        auto prefixes = leaf->prefixes();
+        unsigned lo = 0, hi = leaf->_count;
+        while (lo < hi) {
+            auto mid = (lo + hi) / 2;
+            if (is_before(leaf->_items, prefixes, mid)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo < leaf->_count) {
+            return leaf->_items[lo];
+        }
+        return leaf->_next ? leaf->_next->_items[0] : nullptr;
+    }
+public:
+    template <bool Const>
+    class iterator_base : public std::iterator<std::bidirectional_iterator_tag, T, std::ptrdiff_t,
+            std::conditional_t<Const, const T*, T*>, std::conditional_t<Const, const T&, T&>> {
+        using tree_ptr = const btree_detail::tree_base*;
+        tree_ptr _tree = nullptr;
+        // nullptr for end()
+        hook* _hook = nullptr;
+        friend class intrusive_btree;
+        template <bool> friend class iterator_base;
+    public:
+        using reference = std::conditional_t<Const, const T&, T&>;
+        using pointer = std::conditional_t<Const, const T*, T*>;
+
+        iterator_base() = default;
+        iterator_base(tree_ptr t, hook* h) : _tree(t), _hook(h) { }
+
+        // Allows iterator to const_iterator conversion.
+        operator iterator_base<true>() const {
+            return iterator_base<true>(_tree, _hook);
+        }
+
+        reference operator*() const {
+            return element(_hook);
+        }
+        pointer operator->() const {
+            return &element(_hook);
+        }
+        iterator_base& operator++() {
+            _hook = btree_detail::tree_base::next(_hook);
+            return *this;
+        }
+        iterator_base operator++(int) {
+            auto i = *this;
+            operator++();
+            return i;
+        }
+        iterator_base& operator--() {
+            _hook = _hook ? btree_detail::tree_base::prev(_hook) : _tree->last();
+            return *this;
+        }
+        iterator_base operator--(int) {
+            auto i = *this;
+            operator--();
+            return i;
+        }
+        template <bool C>
+        bool operator==(const iterator_base<C>& o) const {
+            return _hook == o._hook;
+        }
+        template <bool C>
+        bool operator!=(const iterator_base<C>& o) const {
+            return !(*this == o);
+        }
+    };
+    using value_type = T;
+    using value_compare = Compare;
+    using iterator = iterator_base<false>;
+    using const_iterator = iterator_base<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+public:
+    explicit intrusive_btree(Compare cmp, KeyPrefix prefix = KeyPrefix())
+        : tree_base(prefixed)
+        , _cmp(std::move(cmp))
+        , _prefix(std::move(prefix))
+    { }
+    intrusive_btree(intrusive_btree&& o) = default;
+    intrusive_btree& operator=(intrusive_btree&& o) noexcept {
+        swap(o);
+        return *this;
+    }
+    // Elements still in the tree are unlinked, not disposed.
+    ~intrusive_btree() = default;
+
+    void swap(intrusive_btree& o) noexcept {
+        tree_base::swap(o);
+        std::swap(_cmp, o._cmp);
+        std::swap(_prefix, o._prefix);
+    }
+
+    const Compare& value_comp() const {
+        return _cmp;
+    }
+
+    using tree_base::size;
+    using tree_base::empty;
+
+    iterator begin() { return iterator(this, first()); }
+    iterator end() { return iterator(this, nullptr); }
+    const_iterator begin() const { return const_iterator(this, first()); }
+    const_iterator end() const { return const_iterator(this, nullptr); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    iterator iterator_to(T& v) {
+        return iterator(this, hook_of(v));
+    }
+    const_iterator iterator_to(const T& v) const {
+        return const_iterator(this, hook_of(v));
+    }
+
+    template <typename Key, typename KeyCompare>
+    iterator lower_bound(const Key& key, KeyCompare&& cmp) {
+        return iterator(this, partition_point(_prefix(key), [&] (const T& e) { return cmp(e, key); }));
+    }
+    template <typename Key, typename KeyCompare>
+    const_iterator lower_bound(const Key& key, KeyCompare&& cmp) const {
+        return const_iterator(this, partition_point(_prefix(key), [&] (const T& e) { return cmp(e, key); }));
+    }
+    iterator lower_bound(const T& v) { return lower_bound(v, _cmp); }
+    const_iterator lower_bound(const T& v) const { return lower_bound(v, _cmp); }
+
+    template <typename Key, typename KeyCompare>
+    iterator upper_bound(const Key& key, KeyCompare&& cmp) {
+        return iterator(this, partition_point(_prefix(key), [&] (const T& e) { return !cmp(key, e); }));
+    }
+    template <typename Key, typename KeyCompare>
+    const_iterator upper_bound(const Key& key, KeyCompare&& cmp) const {
+        return const_iterator(this, partition_point(_prefix(key), [&] (const T& e) { return !cmp(key, e); }));
+    }
+    iterator upper_bound(const T& v) { return upper_bound(v, _cmp); }
+    const_iterator upper_bound(const T& v) const { return upper_bound(v, _cmp); }
+
+    template <typename Key, typename KeyCompare>
+    iterator find(const Key& key, KeyCompare&& cmp) {
+        auto i = lower_bound(key, cmp);
+        return i != end() && !cmp(key, *i) ? i : end();
+    }
+    template <typename Key, typename KeyCompare>
+    const_iterator find(const Key& key, KeyCompare&& cmp) const {
+        auto i = lower_bound(key, cmp);
+        return i != end() && !cmp(key, *i) ? i : end();
+    }
+    iterator find(const T& v) { return find(v, _cmp); }
+    const_iterator find(const T& v) const { return find(v, _cmp); }
+
+    // Links v before pos, which must be where v belongs.
+    iterator insert_before(const_iterator pos, T& v) {
+        tree_base::insert_before(pos._hook, hook_of(v), _prefix(v));
+        return iterator(this, hook_of(v));
+    }
+
+    // Links v unless an equivalent element is already present.
+    std::pair<iterator, bool> insert(T& v) {
+        auto i = lower_bound(v);
+        if (i != end() && !_cmp(v, *i)) {
+            return { i, false };
+        }
+        return { insert_before(i, v), true };
+    }
+
+    // Moves the element at it from other to this tree, before pos. If that
+    // fails, the element stays in other.
+    void splice(const_iterator pos, intrusive_btree& other, iterator it) {
+        assert(&other != this);
+        tree_base::insert_before(pos._hook, it._hook, _prefix(*it), &other);
+    }
+
+    // Returns the iterator following the erased element.
+    iterator erase(const_iterator it) noexcept {
+        auto next = tree_base::next(it._hook);
+        tree_base::erase(it._hook);
+        return iterator(this, next);
+    }
+
+    template <typename Disposer>
+    iterator erase_and_dispose(const_iterator it, Disposer&& disposer) noexcept {
+        auto& e = element(it._hook);
+        auto i = erase(it);
+        disposer(&e);
+        return i;
+    }
+
+    template <typename Disposer>
+    iterator erase_and_dispose(const_iterator first, const_iterator last, Disposer&& disposer) noexcept {
+        while (first != last) {
+            first = erase_and_dispose(first, disposer);
+        }
+        return iterator(this, last._hook);
+    }
+
+    // Unlinks all the elements.
+    void clear() noexcept {
+        tree_base::clear();
+    }
+
+    // The disposer gets the elements already unlinked.
+    template <typename Disposer>
+    void clear_and_dispose(Disposer&& disposer) noexcept {
+        for (auto leaf = first_leaf(); leaf; leaf = leaf->_next) {
+            for (unsigned i = 0; i < leaf->_count; ++i) {
+                auto h = leaf->_items[i];
+                h->_node = nullptr;
+                disposer(&element(h));
+            }
+        }
+        destroy_nodes();
+    }
+
+    // Replaces the contents with clones of the elements of other. On
+    // failure, leaves the tree empty.
+    template <typename Cloner, typename Disposer>
+    void clone_from(const intrusive_btree& other, Cloner&& cloner, Disposer&& disposer) {
+        clear_and_dispose(disposer);
+        _cmp = other._cmp;
+        _prefix = other._prefix;
+        for (auto&& e : other) {
+            T* clone = cloner(e);
+            try {
+                tree_base::insert_before(nullptr, hook_of(*clone), _prefix(*clone));
+            } catch (...) {
+                disposer(clone);
+                clear_and_dispose(disposer);
+                throw;
+            }
+        }
+    }
+};
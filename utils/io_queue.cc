@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "io_queue.hh"
+#include <memory>
+
+io_priority_class io_queue::register_priority_class(sstring name, uint32_t shares) {
+    priority_class_data c;
+    c.name = std::move(name);
+    c.shares = std::max(shares, 1u);
+    _classes.push_back(std::move(c));
+    return io_priority_class(_classes.size() - 1);
+}
+
+std::vector<io_priority_class> io_queue::priority_classes() const {
+    std::vector<io_priority_class> classes;
+    for (unsigned id = 0; id < _classes.size(); ++id) {
+        classes.emplace_back(id);
+    }
+    return classes;
+}
+
+future<> io_queue::acquire(const io_priority_class& pc, size_t len) {
+    auto& c = _classes[pc.id()];
+    if (c.queue.empty()) {
+        c.accumulated = std::max(c.accumulated, _virtual_time);
+    }
+    c.queue.push_back(request{1 + double(len) / cost_unit, len, clock::now(), promise<>()});
+    ++c.stats.queued;
+    auto f = c.queue.back().pr.get_future();
+    dispatch();
+    return f;
+}
+
+void io_queue::release() {
+    --_outstanding;
+    dispatch();
+}
+
+void io_queue::dispatch() {
+    while (_outstanding < _max_outstanding) {
+        priority_class_data* next = nullptr;
+        for (auto&& c : _classes) {
+            if (!c.queue.empty() && (!next || c.accumulated < next->accumulated)) {
+                next = &c;
+            }
+        }
+        if (!next) {
+            return;
+        }
+        auto& r = next->queue.front();
+        _virtual_time = next->accumulated;
+        next->accumulated += r.cost / next->shares;
+        --next->stats.queued;
+        ++next->stats.requests;
+        next->stats.bytes += r.len;
+        next->stats.queue_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - r.queued_at).count();
+        ++_outstanding;
+        auto pr = std::move(r.pr);
+        next->queue.pop_front();
+        pr.set_value();
+    }
+}
+
+void io_queue::set_max_outstanding(unsigned max_outstanding) {
+    _max_outstanding = std::max(max_outstanding, 1u);
+    dispatch();
+}
+
+namespace {
+
+struct local_queue {
+    io_queue queue;
+    io_priority_class query = queue.register_priority_class("query", 1000);
+    io_priority_class commitlog = queue.register_priority_class("commitlog", 1000);
+    io_priority_class memtable_flush = queue.register_priority_class("memtable_flush", 1000);
+    io_priority_class compaction = queue.register_priority_class("compaction", 200);
+    io_priority_class streaming = queue.register_priority_class("streaming", 200);
+    // Their classes are registered in the order of those of queue, so that
+    // the classes above are theirs too.
+    std::vector<std::pair<sstring, std::unique_ptr<io_queue>>> directories;
+};
+
+local_queue& local() {
+    static thread_local local_queue q;
+    return q;
+}
+
+}
+
+io_queue& local_io_queue() {
+    return local().queue;
+}
+
+static bool is_under(const sstring& path, const sstring& dir) {
+    return path.size() >= dir.size() && std::equal(dir.begin(), dir.end(), path.begin())
+        && (path.size() == dir.size() || path[dir.size()] == '/');
+}
+
+void add_directory_io_queue(sstring dir) {
+    while (dir.size() > 1 && dir[dir.size() - 1] == '/') {
+        dir.resize(dir.size() - 1);
+    }
+    auto& l = local();
+    for (auto&& d : l.directories) {
+        if (d.first == dir) {
+            return;
+        }
+    }
+    auto queue = std::make_unique<io_queue>(l.queue.max_outstanding());
+    for (auto pc : l.queue.priority_classes()) {
+        queue->register_priority_class(l.queue.name(pc), l.queue.shares(pc));
+    }
+    l.directories.emplace_back(std::move(dir), std::move(queue));
+}
+
+io_queue& local_io_queue(const sstring& path) {
+    auto& l = local();
+    for (auto&& d : l.directories) {
+        if (is_under(path, d.first)) {
+            return *d.second;
+        }
+    }
+    return l.queue;
+}
+
+std::vector<std::pair<sstring, io_queue*>> directory_io_queues() {
+    std::vector<std::pair<sstring, io_queue*>> queues;
+    for (auto&& d : local().directories) {
+        queues.emplace_back(d.first, d.second.get());
+    }
+    return queues;
+}
+
+const io_priority_class& query_priority() {
+    return local().query;
+}
+
+const io_priority_class& commitlog_priority() {
+    return local().commitlog;
+}
+
+const io_priority_class& memtable_flush_priority() {
+    return local().memtable_flush;
+}
+
+const io_priority_class& compaction_priority() {
+    return local().compaction;
+}
+
+const io_priority_class& streaming_priority() {
+    return local().streaming;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/future.hh"
+#include "core/sstring.hh"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+// A class of disk I/O, such as compaction, of an io_queue.
+class io_priority_class {
+    unsigned _id;
+public:
+    explicit io_priority_class(unsigned id) : _id(id) { }
+
+    unsigned id() const {
+        return _id;
+    }
+};
+
+// Per-shard queue of the disk I/O of the shard.
+//
+// At most max_outstanding requests are in flight at a time, so that the
+// disk is kept at its optimal queue depth rather than queuing the rest
+// itself, where the classes of the requests can't be told apart. Queued
+// requests are dispatched by start-time fair queueing: each class
+// accumulates the cost of the requests it dispatched divided by its shares,
+// and the class which accumulated the least goes first. A class which was
+// idle resumes from where the busy ones are, so that it can't save up for a
+// burst.
+class io_queue {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Requests of this many bytes cost twice as much as empty ones.
+    static constexpr size_t cost_unit = 128 * 1024;
+
+    struct class_stats {
+        uint64_t requests = 0;
+        uint64_t bytes = 0;
+        uint64_t queued = 0;
+        // Time the dispatched requests spent queued.
+        uint64_t queue_time_ns = 0;
+    };
+private:
+    struct request {
+        double cost;
+        size_t len;
+        clock::time_point queued_at;
+        promise<> pr;
+    };
+    struct priority_class_data {
+        sstring name;
+        uint32_t shares;
+        double accumulated = 0;
+        std::deque<request> queue;
+        class_stats stats;
+    };
+    std::vector<priority_class_data> _classes;
+    unsigned _max_outstanding;
+    unsigned _outstanding = 0;
+    // Accumulated cost of the class last dispatched from, when it was.
+    double _virtual_time = 0;
+private:
+    future<> acquire(const io_priority_class& pc, size_t len);
+    void release();
+    void dispatch();
+public:
+    explicit io_queue(unsigned max_outstanding = 128)
+        : _max_outstanding(std::max(max_outstanding, 1u))
+    { }
+
+    io_priority_class register_priority_class(sstring name, uint32_t shares);
+
+    // Runs func, which issues I/O of about len bytes, once the queue
+    // dispatches it, and counts it outstanding until its future resolves.
+    template <typename Func>
+    std::result_of_t<Func()> queue_request(const io_priority_class& pc, size_t len, Func&& func) {
+        return acquire(pc, len).then([this, func = std::forward<Func>(func)] () mutable {
+            return func().finally([this] {
+                release();
+            });
+        });
+    }
+
+    void set_shares(const io_priority_class& pc, uint32_t shares) {
+        _classes[pc.id()].shares = std::max(shares, 1u);
+    }
+
+    uint32_t shares(const io_priority_class& pc) const {
+        return _classes[pc.id()].shares;
+    }
+
+    void set_max_outstanding(unsigned max_outstanding);
+
+    unsigned max_outstanding() const {
+        return _max_outstanding;
+    }
+
+    unsigned outstanding() const {
+        return _outstanding;
+    }
+
+    const sstring& name(const io_priority_class& pc) const {
+        return _classes[pc.id()].name;
+    }
+
+    const class_stats& get_stats(const io_priority_class& pc) const {
+        return _classes[pc.id()].stats;
+    }
+
+    std::vector<io_priority_class> priority_classes() const;
+};
+
+// The queue of this shard, through which all of its disk I/O goes, but for
+// that of the directories with a queue of their own.
+io_queue& local_io_queue();
+
+// Gives the files under the directory, such as a data directory on a disk
+// of its own, a queue of their own on this shard, with the classes, shares
+// and depth of local_io_queue(). Adding a directory again does nothing.
+void add_directory_io_queue(sstring dir);
+
+// The queue of the files under the directory the path is in, if it has one
+// of its own, local_io_queue() otherwise.
+io_queue& local_io_queue(const sstring& path);
+
+// The directories with a queue of their own on this shard, and their queues.
+std::vector<std::pair<sstring, io_queue*>> directory_io_queues();
+
+// The classes of the I/O of this shard, registered with local_io_queue().
+const io_priority_class& query_priority();
+const io_priority_class& commitlog_priority();
+const io_priority_class& memtable_flush_priority();
+const io_priority_class& compaction_priority();
+const io_priority_class& streaming_priority();
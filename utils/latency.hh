@@ -68,6 +68,10 @@ class latency_counter {
         return std::chrono::duration_cast<std::chrono::nanoseconds>(latency()).count();
     }
 
+    int64_t latency_in_micro() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(latency()).count();
+    }
+
     static time_point now() {
         return std::chrono::system_clock::now();
     }
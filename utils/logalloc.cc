@@ -47,6 +47,8 @@ class tracker::impl {
     std::vector<region::impl*> _regions;
     scollectd::registrations _collectd_registrations;
     bool _reclaiming_enabled = true;
+    utils::ihistogram _reclaim_time;
+    utils::ihistogram _background_reclaim_time;
 private:
     // Prevents tracker's reclaimer from running while live. Reclaimer may be
     // invoked synchronously with allocator. This guard ensures that this
@@ -65,6 +67,7 @@ class tracker::impl {
         }
     };
     void register_collectd_metrics();
+    size_t compact_and_evict(size_t bytes);
 public:
     impl() {
         register_collectd_metrics();
@@ -75,8 +78,12 @@ class tracker::impl {
     void register_region(region::impl*);
     void unregister_region(region::impl*);
     size_t reclaim(size_t bytes);
+    size_t reclaim_in_background(size_t reserve, std::chrono::microseconds budget);
+    const utils::ihistogram& reclaim_histogram() const { return _reclaim_time; }
+    const utils::ihistogram& background_reclaim_histogram() const { return _background_reclaim_time; }
     void full_compaction();
     occupancy_stats occupancy();
+    occupancy_stats segment_occupancy();
 };
 
 tracker::tracker()
@@ -95,6 +102,18 @@ size_t tracker::reclaim(size_t bytes) {
     return _impl->reclaim(bytes);
 }
 
+size_t tracker::reclaim_in_background(size_t reserve, std::chrono::microseconds budget) {
+    return _impl->reclaim_in_background(reserve, budget);
+}
+
+const utils::ihistogram& tracker::reclaim_histogram() const {
+    return _impl->reclaim_histogram();
+}
+
+const utils::ihistogram& tracker::background_reclaim_histogram() const {
+    return _impl->background_reclaim_histogram();
+}
+
 occupancy_stats tracker::occupancy() {
     return _impl->occupancy();
 }
@@ -103,6 +122,10 @@ void tracker::full_compaction() {
     return _impl->full_compaction();
 }
 
+occupancy_stats tracker::segment_occupancy() {
+    return _impl->segment_occupancy();
+}
+
 tracker& shard_tracker() {
     return tracker_instance;
 }
@@ -451,6 +474,26 @@ segment::heap_handle() {
     return shard_segment_pool.descriptor(this)._heap_handle;
 }
 
+// Objects too large to be managed inside segments are allocated using the
+// standard allocator, each preceded by a header recording its footprint, so
+// that the memory they take can be accounted for. They are never moved.
+struct large_object_header {
+    uint32_t size; // Of the whole allocation, including the header and padding
+    uint32_t offset; // Of the object from the start of the allocation
+};
+
+struct large_object_stats {
+    size_t objects = 0;
+    size_t space = 0;
+};
+
+static thread_local large_object_stats shard_large_objects;
+
+// Memory taken by LSA, both by segments and by large objects.
+static size_t lsa_memory_in_use() {
+    return shard_segment_pool.segments_in_use() * segment::size + shard_large_objects.space;
+}
+
 //
 // For interface documentation see logalloc::region and allocation_strategy.
 //
@@ -462,7 +505,7 @@ segment::heap_handle() {
 // active segment fills up, it is closed. Closed segments are kept in a heap
 // which orders them by occupancy. As objects are freed, the segment become
 // sparser and are eventually released. Objects which are too large are
-// allocated using standard allocator.
+// allocated using standard allocator, but still accounted to the region.
 //
 // Segment layout.
 //
@@ -592,6 +635,7 @@ class region_impl : public allocation_strategy {
     size_t _active_offset;
     segment_heap _segments; // Contains only closed segments
     occupancy_stats _closed_occupancy;
+    size_t _large_objects_space = 0;
     bool _reclaiming_enabled = true;
     bool _evictable = false;
     uint64_t _id;
@@ -637,6 +681,33 @@ class region_impl : public allocation_strategy {
         return obj;
     }
 
+    void* alloc_large(size_t size, size_t alignment) {
+        auto offset = align_up(sizeof(large_object_header), alignment);
+        auto total = offset + size;
+        auto p = static_cast<char*>(standard_allocator().alloc(nullptr, total, std::max(alignment, alignof(large_object_header))));
+        auto obj = p + offset;
+        new (obj - sizeof(large_object_header)) large_object_header{uint32_t(total), uint32_t(offset)};
+        _large_objects_space += total;
+        ++shard_large_objects.objects;
+        shard_large_objects.space += total;
+        if (_group) {
+            _group->update(total);
+        }
+        return obj;
+    }
+
+    void free_large(void* obj) noexcept {
+        auto h = reinterpret_cast<large_object_header*>(static_cast<char*>(obj) - sizeof(large_object_header));
+        auto total = h->size;
+        _large_objects_space -= total;
+        --shard_large_objects.objects;
+        shard_large_objects.space -= total;
+        if (_group) {
+            _group->update(-ssize_t(total));
+        }
+        standard_allocator().free(static_cast<char*>(obj) - h->offset);
+    }
+
     template<typename Func>
     void for_each_live(segment* seg, Func&& func) {
         static_assert(std::is_same<void, std::result_of_t<Func(object_descriptor*, void*)>>::value, "bad Func signature");
@@ -760,6 +831,12 @@ class region_impl : public allocation_strategy {
     }
 
     occupancy_stats occupancy() const {
+        occupancy_stats total = segment_occupancy();
+        total += occupancy_stats(0, _large_objects_space);
+        return total;
+    }
+
+    occupancy_stats segment_occupancy() const {
         occupancy_stats total{};
         total += _closed_occupancy;
         if (_active) {
@@ -768,6 +845,10 @@ class region_impl : public allocation_strategy {
         return total;
     }
 
+    size_t large_objects_space() const {
+        return _large_objects_space;
+    }
+
     occupancy_stats compactible_occupancy() const {
         return _closed_occupancy;
     }
@@ -788,7 +869,7 @@ class region_impl : public allocation_strategy {
     virtual void* alloc(allocation_strategy::migrate_fn migrator, size_t size, size_t alignment) override {
         compaction_lock _(*this);
         if (size > max_managed_object_size) {
-            return standard_allocator().alloc(migrator, size, alignment);
+            return alloc_large(size, alignment);
         } else {
             return alloc_small(migrator, (segment::size_type) size, alignment);
         }
@@ -799,7 +880,7 @@ class region_impl : public allocation_strategy {
         segment* seg = shard_segment_pool.containing_segment(obj);
 
         if (!seg) {
-            standard_allocator().free(obj);
+            free_large(obj);
             return;
         }
 
@@ -851,6 +932,9 @@ class region_impl : public allocation_strategy {
         _closed_occupancy += other._closed_occupancy;
         other._closed_occupancy = {};
 
+        _large_objects_space += other._large_objects_space;
+        other._large_objects_space = 0;
+
         // Make sure both regions will notice a future increment
         // to the reclaim counter
         _reclaim_counter = std::max(_reclaim_counter, other._reclaim_counter);
@@ -883,6 +967,22 @@ class region_impl : public allocation_strategy {
         }
     }
 
+    // Compacts the segments less than max_used_fraction full, sparsest first.
+    // Invalidates references to allocated objects.
+    void compact_sparse(float max_used_fraction, size_t max_segments) {
+        if (!_reclaiming_enabled) {
+            return;
+        }
+        compaction_lock _(*this);
+        while (max_segments-- && !_segments.empty() && _segments.top()->occupancy().used_fraction() < max_used_fraction) {
+            segment* seg = _segments.top();
+            logger.debug("Compacting sparse segment {} from region {}, {}", seg, id(), seg->occupancy());
+            _segments.pop();
+            _closed_occupancy -= seg->occupancy();
+            compact(seg);
+        }
+    }
+
     // Compacts everything. Mainly for testing.
     // Invalidates references to allocated objects.
     void full_compaction() {
@@ -958,6 +1058,18 @@ occupancy_stats region::occupancy() const {
     return _impl->occupancy();
 }
 
+size_t region::large_objects_space() const {
+    return _impl->large_objects_space();
+}
+
+size_t tracker::large_objects_space() const {
+    return shard_large_objects.space;
+}
+
+size_t tracker::large_objects() const {
+    return shard_large_objects.objects;
+}
+
 void region::merge(region& other) {
     if (_impl != other._impl) {
         _impl->merge(*other._impl);
@@ -965,6 +1077,10 @@ void region::merge(region& other) {
     }
 }
 
+void region::compact_sparse(float max_used_fraction, size_t max_segments) {
+    _impl->compact_sparse(max_used_fraction, max_segments);
+}
+
 void region::full_compaction() {
     _impl->full_compaction();
 }
@@ -1003,6 +1119,15 @@ occupancy_stats tracker::impl::occupancy() {
     return total;
 }
 
+occupancy_stats tracker::impl::segment_occupancy() {
+    reclaiming_lock _(*this);
+    occupancy_stats total{};
+    for (auto&& r: _regions) {
+        total += r->segment_occupancy();
+    }
+    return total;
+}
+
 void tracker::impl::full_compaction() {
     reclaiming_lock _(*this);
 
@@ -1017,21 +1142,18 @@ void tracker::impl::full_compaction() {
     logger.debug("Compaction done, {}", occupancy());
 }
 
-static void reclaim_from_evictable(region::impl& r, size_t target_segments_in_use) {
+// Evicts from the region until LSA memory in use, see lsa_memory_in_use(),
+// drops to target_memory.
+static void reclaim_from_evictable(region::impl& r, size_t target_memory) {
     while (true) {
-        auto deficit = (shard_segment_pool.segments_in_use() - target_segments_in_use) * segment::size;
+        auto in_use = lsa_memory_in_use();
+        if (in_use <= target_memory) {
+            break;
+        }
+        auto deficit = in_use - target_memory;
         auto occupancy = r.occupancy();
         auto used = occupancy.used_space();
         if (used == 0) {
-            // FIXME: There could be still some objects which are allocated
-            // using that region but were too large and are not managed by
-            // LSA. We should avoid having large objects in the first place,
-            // and make the managed_blob object fracture them internally. To
-            // handle eviction of large objects we should first move the
-            // segment pool service into the seastar allocator, so that
-            // evicting large objects counts towards that pool. It also makes
-            // sense to have the reclaimer coupled with that segment pool, and
-            // not with the page pool like it is now.
             break;
         }
         auto used_target = used - std::min(used, deficit - std::min(deficit, occupancy.free_space()));
@@ -1041,7 +1163,7 @@ static void reclaim_from_evictable(region::impl& r, size_t target_segments_in_us
                 logger.debug("Unable to evict more, evicted {} bytes", used - r.occupancy().used_space());
                 return;
             }
-            if (shard_segment_pool.segments_in_use() <= target_segments_in_use) {
+            if (lsa_memory_in_use() <= target_memory) {
                 logger.debug("Target met after evicting {} bytes", used - r.occupancy().used_space());
                 return;
             }
@@ -1055,19 +1177,16 @@ static void reclaim_from_evictable(region::impl& r, size_t target_segments_in_us
 }
 
 struct reclaim_timer {
+    utils::ihistogram& histogram;
     clock::time_point start;
-    bool enabled;
-    reclaim_timer() {
-        if (timing_logger.is_enabled(logging::log_level::debug)) {
-            start = clock::now();
-            enabled = true;
-        } else {
-            enabled = false;
-        }
-    }
+    reclaim_timer(utils::ihistogram& h)
+        : histogram(h)
+        , start(clock::now())
+    { }
     ~reclaim_timer() {
-        if (enabled) {
-            auto duration = clock::now() - start;
+        auto duration = clock::now() - start;
+        histogram.mark(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+        if (timing_logger.is_enabled(logging::log_level::debug)) {
             timing_logger.debug("Reclamation cycle took {} us.",
                 std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(duration).count());
         }
@@ -1075,6 +1194,30 @@ struct reclaim_timer {
 };
 
 size_t tracker::impl::reclaim(size_t bytes) {
+    reclaim_timer timing_guard(_reclaim_time);
+    return compact_and_evict(bytes);
+}
+
+size_t tracker::impl::reclaim_in_background(size_t reserve, std::chrono::microseconds budget) {
+    if (memory::stats().free_memory() >= reserve || !_reclaiming_enabled) {
+        return 0;
+    }
+    reclaim_timer timing_guard(_background_reclaim_time);
+    auto deadline = clock::now() + budget;
+    size_t released = 0;
+    // Going a segment at a time lets us stop close to the deadline.
+    do {
+        auto r = compact_and_evict(segment::size);
+        if (!r) {
+            break;
+        }
+        released += r;
+    } while (memory::stats().free_memory() < reserve && clock::now() < deadline);
+    logger.debug("Reclaimed {} bytes in the background, {} bytes free", released, memory::stats().free_memory());
+    return released;
+}
+
+size_t tracker::impl::compact_and_evict(size_t bytes) {
     //
     // Algorithm outline.
     //
@@ -1109,7 +1252,6 @@ size_t tracker::impl::reclaim(size_t bytes) {
     }
 
     reclaiming_lock _(*this);
-    reclaim_timer timing_guard;
 
     size_t in_use = shard_segment_pool.segments_in_use();
     auto target = in_use - std::min(in_use, segments_to_release - nr_released);
@@ -1151,26 +1293,33 @@ size_t tracker::impl::reclaim(size_t bytes) {
     }
 
     auto released_during_compaction = in_use - shard_segment_pool.segments_in_use();
+    size_t released_by_eviction = 0;
 
     if (shard_segment_pool.segments_in_use() > target) {
         logger.debug("Considering evictable regions.");
+        // Freeing large objects counts towards the goal as much as freeing
+        // segments does.
+        auto memory_before = lsa_memory_in_use();
+        auto target_memory = memory_before - std::min(memory_before,
+            (shard_segment_pool.segments_in_use() - target) * segment::size);
         // FIXME: Fair eviction
         for (region::impl* r : _regions) {
             if (r->is_evictable()) {
-                reclaim_from_evictable(*r, target);
-                if (shard_segment_pool.segments_in_use() <= target) {
+                reclaim_from_evictable(*r, target_memory);
+                if (lsa_memory_in_use() <= target_memory) {
                     break;
                 }
             }
         }
+        released_by_eviction = memory_before - std::min(memory_before, lsa_memory_in_use());
     }
 
-    nr_released += in_use - shard_segment_pool.segments_in_use();
+    nr_released += released_during_compaction;
 
-    logger.debug("Released {} segments (wanted {}), {} during compaction, {} from reserve",
-        nr_released, segments_to_release, released_during_compaction, released_from_reserve);
+    logger.debug("Released {} segments (wanted {}), {} during compaction, {} from reserve, and {} bytes by eviction",
+        nr_released, segments_to_release, released_during_compaction, released_from_reserve, released_by_eviction);
 
-    return nr_released * segment::size;
+    return nr_released * segment::size + released_by_eviction;
 }
 
 void tracker::impl::register_region(region::impl* r) {
@@ -1203,6 +1352,18 @@ void tracker::impl::register_collectd_metrics() {
             scollectd::type_instance_id("lsa", scollectd::per_cpu_plugin_instance, "percent", "occupancy"),
             scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return occupancy().used_fraction() * 100; })
         ),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("lsa", scollectd::per_cpu_plugin_instance, "bytes", "large_objects_space"),
+            scollectd::make_typed(scollectd::data_type::GAUGE, [] { return shard_large_objects.space; })
+        ),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("lsa", scollectd::per_cpu_plugin_instance, "objects", "large_objects"),
+            scollectd::make_typed(scollectd::data_type::GAUGE, [] { return shard_large_objects.objects; })
+        ),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("lsa", scollectd::per_cpu_plugin_instance, "percent", "segment_occupancy"),
+            scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return segment_occupancy().used_fraction() * 100; })
+        ),
     });
 }
 
@@ -25,7 +25,10 @@
 #include <seastar/core/scollectd.hh>
 #include <seastar/core/memory.hh>
 #include <seastar/core/shared_ptr.hh>
+#include <chrono>
+#include <limits>
 #include "allocation_strategy.hh"
+#include "utils/histogram.hh"
 
 namespace logalloc {
 
@@ -109,12 +112,36 @@ class tracker {
     //
     size_t reclaim(size_t bytes);
 
+    //
+    // Reclaims until at least reserve bytes of memory are free or the budget
+    // runs out, whichever comes first. Meant to be called periodically from
+    // the background, to keep free memory ahead of demand so that
+    // allocations rarely have to reclaim synchronously.
+    //
+    // Returns the number of bytes reclaimed.
+    //
+    // Invalidates references to objects in all compactible and evictable regions.
+    //
+    size_t reclaim_in_background(size_t reserve, std::chrono::microseconds budget);
+
+    // Durations, in nanoseconds, of calls to reclaim(), which mostly run
+    // synchronously with allocation, and of background reclamation steps.
+    const utils::ihistogram& reclaim_histogram() const;
+    const utils::ihistogram& background_reclaim_histogram() const;
+
     // Compacts as much as possible. Very expensive, mainly for testing.
     // Invalidates references to objects in all compactible and evictable regions.
     void full_compaction();
 
     // Returns aggregate statistics for all pools.
     occupancy_stats occupancy();
+
+    // Returns aggregate statistics of objects kept in segments.
+    occupancy_stats segment_occupancy();
+
+    // Objects too large to be kept in segments, see region::large_objects_space().
+    size_t large_objects_space() const;
+    size_t large_objects() const;
 };
 
 tracker& shard_tracker();
@@ -206,14 +233,27 @@ class region {
     region& operator=(region&& other);
     region(const region& other) = delete;
 
+    // Includes objects too large to be kept in segments, which are
+    // allocated from the standard allocator. Those count as fully used.
     occupancy_stats occupancy() const;
 
+    // Memory taken by objects too large to be kept in segments. They can
+    // be evicted like any other object, but are never compacted.
+    size_t large_objects_space() const;
+
     allocation_strategy& allocator();
 
     // Merges another region into this region. The other region is left empty.
     // Doesn't invalidate references to allocated objects.
     void merge(region& other);
 
+    // Compacts the segments of the region which are less than
+    // max_used_fraction full, at most max_segments of them, the sparsest
+    // first, so that the space of the objects freed in them is returned.
+    // Does nothing if reclaiming is disabled.
+    // Invalidates references to allocated objects.
+    void compact_sparse(float max_used_fraction, size_t max_segments = std::numeric_limits<size_t>::max());
+
     // Compacts everything. Mainly for testing.
     // Invalidates references to allocated objects.
     void full_compaction();
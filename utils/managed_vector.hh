@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <type_traits>
 
@@ -197,6 +198,13 @@ class managed_vector {
         return it;
     }
 
+    iterator insert(iterator it, T&& value) {
+        auto pos = it - begin();
+        emplace_back(std::move(value));
+        std::rotate(begin() + pos, end() - 1, end());
+        return begin() + pos;
+    }
+
     void push_back(const T& value) {
         emplace_back(value);
     }
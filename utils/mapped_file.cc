@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <system_error>
+
+#include "utils/mapped_file.hh"
+
+namespace utils {
+
+static std::system_error error(const char* what, const sstring& path) {
+    return std::system_error(errno, std::system_category(), sstring(what) + " " + path);
+}
+
+mapped_file::mapped_file(const sstring& path, int advice) {
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw error("open", path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+        auto e = error("fstat", path);
+        ::close(fd);
+        throw e;
+    }
+    _size = st.st_size;
+    if (_size) {
+        auto p = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            auto e = error("mmap", path);
+            ::close(fd);
+            throw e;
+        }
+        _data = static_cast<const char*>(p);
+        ::madvise(p, _size, advice);
+    }
+    // The mapping keeps the file open.
+    ::close(fd);
+}
+
+mapped_file::~mapped_file() {
+    if (_data) {
+        ::munmap(const_cast<char*>(_data), _size);
+    }
+}
+
+}
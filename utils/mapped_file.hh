@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+#include "core/sstring.hh"
+
+namespace utils {
+
+// A file mapped read-only into memory, unmapped when destroyed.
+//
+// The mapped pages belong to the page cache rather than to the heap: they
+// are read in when first touched, and under memory pressure the kernel may
+// drop them and read them back when touched again. Touching a page which
+// isn't in memory blocks the shard until it is read, so only small, hot
+// files should be mapped.
+class mapped_file {
+    const char* _data = nullptr;
+    size_t _size = 0;
+public:
+    // The advice is passed to madvise(). Throws std::system_error.
+    explicit mapped_file(const sstring& path, int advice = MADV_NORMAL);
+    ~mapped_file();
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const char* data() const {
+        return _data;
+    }
+    size_t size() const {
+        return _size;
+    }
+};
+
+}
@@ -39,6 +39,10 @@
 
 #include "murmur_hash.hh"
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 namespace utils {
 
 namespace murmur_hash {
@@ -246,5 +250,118 @@ void hash3_x64_128(bytes_view key, uint64_t seed, std::array<uint64_t,2> &result
     result[1] = h2;
 }
 
+#ifdef __AVX2__
+
+// AVX2 has no 64-bit multiplication, so it is made of 32-bit ones.
+static inline __m256i mul64(__m256i a, __m256i b)
+{
+    auto lo = _mm256_mul_epu32(a, b);
+    auto cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                  _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+template <int N>
+static inline __m256i rotl64(__m256i v)
+{
+    return _mm256_or_si256(_mm256_slli_epi64(v, N), _mm256_srli_epi64(v, 64 - N));
+}
+
+static inline __m256i fmix(__m256i k)
+{
+    k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+    k = mul64(k, _mm256_set1_epi64x(0xff51afd7ed558ccdL));
+    k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+    k = mul64(k, _mm256_set1_epi64x(0xc4ceb9fe1a85ec53L));
+    k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+    return k;
+}
+
+// h * 5 + c
+static inline __m256i mul5_add(__m256i h, uint64_t c)
+{
+    return _mm256_add_epi64(_mm256_add_epi64(_mm256_slli_epi64(h, 2), h), _mm256_set1_epi64x(c));
+}
+
+// Hashes four keys of the same length, a multiple of 16, at once, one in each
+// 64-bit lane. The tails of other keys are read a byte at a time, which costs
+// more than the lanes save.
+static void hash3_x64_128_x4(const bytes_view* keys, uint64_t seed, std::array<uint64_t, 2>* results)
+{
+    uint32_t length = keys[0].size();
+    const uint32_t nblocks = length >> 4;
+
+    auto h1 = _mm256_set1_epi64x(seed);
+    auto h2 = _mm256_set1_epi64x(seed);
+
+    auto c1 = _mm256_set1_epi64x(0x87c37b91114253d5L);
+    auto c2 = _mm256_set1_epi64x(0x4cf5ad432745937fL);
+
+    auto block = [keys] (uint32_t index) {
+        return _mm256_set_epi64x(getblock(keys[3], index), getblock(keys[2], index),
+                                 getblock(keys[1], index), getblock(keys[0], index));
+    };
+
+    for(uint32_t i = 0; i < nblocks; i++)
+    {
+        auto k1 = block(i*2+0);
+        auto k2 = block(i*2+1);
+
+        k1 = mul64(k1, c1); k1 = rotl64<31>(k1); k1 = mul64(k1, c2); h1 = _mm256_xor_si256(h1, k1);
+
+        h1 = rotl64<27>(h1); h1 = _mm256_add_epi64(h1, h2); h1 = mul5_add(h1, 0x52dce729);
+
+        k2 = mul64(k2, c2); k2 = rotl64<33>(k2); k2 = mul64(k2, c1); h2 = _mm256_xor_si256(h2, k2);
+
+        h2 = rotl64<31>(h2); h2 = _mm256_add_epi64(h2, h1); h2 = mul5_add(h2, 0x38495ab5);
+    }
+
+    auto len = _mm256_set1_epi64x(length);
+    h1 = _mm256_xor_si256(h1, len); h2 = _mm256_xor_si256(h2, len);
+
+    h1 = _mm256_add_epi64(h1, h2);
+    h2 = _mm256_add_epi64(h2, h1);
+
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+
+    h1 = _mm256_add_epi64(h1, h2);
+    h2 = _mm256_add_epi64(h2, h1);
+
+    uint64_t r1[4], r2[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(r1), h1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(r2), h2);
+    for (int l = 0; l < 4; ++l) {
+        results[l][0] = r1[l];
+        results[l][1] = r2[l];
+    }
+}
+
+#endif
+
+void hash3_x64_128(const std::vector<bytes_view>& keys, uint64_t seed, std::vector<std::array<uint64_t, 2>>& results)
+{
+    results.resize(keys.size());
+    size_t i = 0;
+#ifdef __AVX2__
+    // Keys of a table often have the same length, like those of uuids: the
+    // runs of four keys of the same length without a tail are hashed together.
+    for (; i + 4 <= keys.size(); ) {
+        auto size = keys[i].size();
+        if (size && !(size & 15)
+                && keys[i + 1].size() == size && keys[i + 2].size() == size && keys[i + 3].size() == size) {
+            hash3_x64_128_x4(&keys[i], seed, &results[i]);
+            i += 4;
+        } else {
+            hash3_x64_128(keys[i], seed, results[i]);
+            ++i;
+        }
+    }
+#endif
+    for (; i < keys.size(); ++i) {
+        hash3_x64_128(keys[i], seed, results[i]);
+    }
+}
+
 } // namespace murmur_hash
 } // namespace utils
@@ -40,6 +40,7 @@
 
 #include <cstdint>
 #include <array>
+#include <vector>
 
 #include "bytes.hh"
 
@@ -167,6 +168,10 @@ void hash3_x64_128(InputIterator in, uint32_t length, uint64_t seed, std::array<
 
 void hash3_x64_128(bytes_view key, uint64_t seed, std::array<uint64_t, 2>& result);
 
+// Hashes each of the keys as the above does, several at a time where the CPU
+// allows it.
+void hash3_x64_128(const std::vector<bytes_view>& keys, uint64_t seed, std::vector<std::array<uint64_t, 2>>& results);
+
 } // namespace murmur_hash
 
 } // namespace utils
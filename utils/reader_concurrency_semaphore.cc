@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "reader_concurrency_semaphore.hh"
+#include <algorithm>
+#include <iterator>
+
+reader_concurrency_semaphore::reader_concurrency_semaphore(unsigned max_count, size_t max_memory,
+        size_t max_queue_length, clock::duration timeout)
+    : _max_count(std::max(max_count, 1u))
+    , _max_memory(max_memory)
+    , _max_queue_length(max_queue_length)
+    , _timeout(timeout)
+    , _expiry_timer([this] { expire_waiters(); })
+{ }
+
+bool reader_concurrency_semaphore::may_admit(size_t memory) const {
+    return !_stats.active || (_stats.active < _max_count && _stats.memory + memory <= _max_memory);
+}
+
+void reader_concurrency_semaphore::admit(size_t memory) {
+    ++_stats.active;
+    ++_stats.admitted;
+    _stats.memory += memory;
+}
+
+future<> reader_concurrency_semaphore::wait_admission(size_t memory, std::experimental::optional<clock::time_point> deadline) {
+    if (_waiters.empty() && may_admit(memory)) {
+        admit(memory);
+        return make_ready_future<>();
+    }
+    if (_waiters.size() >= _max_queue_length) {
+        ++_stats.rejected;
+        return make_exception_future<>(read_admission_exception("Too many reads queued for admission"));
+    }
+    auto expiry = clock::now() + _timeout;
+    if (deadline) {
+        expiry = std::min(expiry, *deadline);
+    }
+    _waiters.push_back(waiter{memory, expiry, promise<>()});
+    ++_stats.queued;
+    if (!_expiry_timer.armed() || expiry < _next_expiry) {
+        _next_expiry = expiry;
+        _expiry_timer.cancel();
+        _expiry_timer.arm(expiry);
+    }
+    return _waiters.back().pr.get_future();
+}
+
+void reader_concurrency_semaphore::signal(size_t memory) {
+    --_stats.active;
+    _stats.memory -= memory;
+    run_waiters();
+}
+
+void reader_concurrency_semaphore::run_waiters() {
+    while (!_waiters.empty() && may_admit(_waiters.front().memory)) {
+        auto& w = _waiters.front();
+        admit(w.memory);
+        auto pr = std::move(w.pr);
+        _waiters.pop_front();
+        --_stats.queued;
+        pr.set_value();
+    }
+    if (_waiters.empty()) {
+        _expiry_timer.cancel();
+    }
+}
+
+void reader_concurrency_semaphore::expire_waiters() {
+    // Reads with deadlines of their own may expire out of order.
+    auto now = clock::now();
+    auto i = std::stable_partition(_waiters.begin(), _waiters.end(), [now] (const waiter& w) {
+        return w.deadline > now;
+    });
+    std::deque<waiter> expired;
+    std::move(i, _waiters.end(), std::back_inserter(expired));
+    _waiters.erase(i, _waiters.end());
+    if (!_waiters.empty()) {
+        _next_expiry = std::min_element(_waiters.begin(), _waiters.end(), [] (const waiter& a, const waiter& b) {
+            return a.deadline < b.deadline;
+        })->deadline;
+        _expiry_timer.arm(_next_expiry);
+    }
+    for (auto&& w : expired) {
+        --_stats.queued;
+        ++_stats.timed_out;
+        w.pr.set_exception(read_admission_exception("Timed out waiting for read admission"));
+    }
+}
+
+void reader_concurrency_semaphore::set_limits(unsigned max_count, size_t max_memory) {
+    _max_count = std::max(max_count, 1u);
+    _max_memory = max_memory;
+    run_waiters();
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/future.hh"
+#include "core/future-util.hh"
+#include "core/timer.hh"
+#include <chrono>
+#include <deque>
+#include <stdexcept>
+#include <experimental/optional>
+
+// Failure of a read the shard had no room for: one which found the queue of
+// reads waiting for admission full, or waited in it for too long.
+class read_admission_exception : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Per-shard admission control of reads, shared by all the column families
+// of the shard.
+//
+// At most max_count reads run at a time, holding at most max_memory bytes
+// of reader buffers between them; a read which needs more than max_memory
+// alone runs when no other does. The others wait in FIFO order, at most
+// max_queue_length of them, each for at most timeout or until the deadline
+// of its read.
+class reader_concurrency_semaphore {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct stats {
+        uint64_t active = 0;
+        uint64_t memory = 0;
+        uint64_t queued = 0;
+        uint64_t admitted = 0;
+        // Reads failed for finding the queue full, and for waiting too long.
+        uint64_t rejected = 0;
+        uint64_t timed_out = 0;
+    };
+private:
+    struct waiter {
+        size_t memory;
+        clock::time_point deadline;
+        promise<> pr;
+    };
+    unsigned _max_count;
+    size_t _max_memory;
+    size_t _max_queue_length;
+    clock::duration _timeout;
+    std::deque<waiter> _waiters;
+    timer<clock> _expiry_timer;
+    clock::time_point _next_expiry;
+    stats _stats;
+private:
+    bool may_admit(size_t memory) const;
+    void admit(size_t memory);
+    void run_waiters();
+    void expire_waiters();
+public:
+    reader_concurrency_semaphore(unsigned max_count, size_t max_memory, size_t max_queue_length, clock::duration timeout);
+
+    // Resolves once the read, whose readers hold the given memory, may run,
+    // or fails with read_admission_exception.
+    future<> wait_admission(size_t memory, std::experimental::optional<clock::time_point> deadline = {});
+    // Ends a read wait_admission() admitted.
+    void signal(size_t memory);
+
+    // Runs func, a read whose readers hold the given memory, once it is
+    // admitted.
+    template <typename Func>
+    futurize_t<std::result_of_t<Func()>> with_admission(size_t memory, std::experimental::optional<clock::time_point> deadline, Func func) {
+        return wait_admission(memory, deadline).then([this, memory, func = std::move(func)] () mutable {
+            return futurize<std::result_of_t<Func()>>::apply(std::move(func)).finally([this, memory] {
+                signal(memory);
+            });
+        });
+    }
+
+    void set_limits(unsigned max_count, size_t max_memory);
+
+    size_t max_memory() const {
+        return _max_memory;
+    }
+
+    const stats& get_stats() const {
+        return _stats;
+    }
+};
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace utils {
+
+/**
+ * Finds the most frequent keys of a stream in bounded memory, with the
+ * Space-Saving algorithm (Metwally, Agrawal and El Abbadi, "Efficient
+ * Computation of Frequent and Top-k Elements in Data Streams").
+ *
+ * At most capacity keys are counted. A key which isn't one of them takes
+ * over the counter of the least counted key, and is charged with its count
+ * as a possible overestimate, the error. Any key occurring more often than
+ * the number of keys added divided by the capacity is guaranteed to be
+ * counted.
+ *
+ * Adding a key costs a hash lookup and, as the counters are kept in a
+ * min-heap, O(log capacity) swaps.
+ */
+template <typename Key, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class space_saving {
+public:
+    struct counter {
+        Key key;
+        uint64_t count;
+        // How much of the count may have been other keys'.
+        uint64_t error;
+    };
+private:
+    size_t _capacity;
+    // A min-heap, by count.
+    std::vector<counter> _heap;
+    // The position of each counted key in the heap.
+    std::unordered_map<Key, size_t, Hash, KeyEqual> _index;
+private:
+    void swap_counters(size_t a, size_t b) {
+        std::swap(_heap[a], _heap[b]);
+        _index[_heap[a].key] = a;
+        _index[_heap[b].key] = b;
+    }
+    void sift_up(size_t i) {
+        while (i > 0) {
+            auto parent = (i - 1) / 2;
+            if (_heap[parent].count <= _heap[i].count) {
+                break;
+            }
+            swap_counters(i, parent);
+            i = parent;
+        }
+    }
+    void sift_down(size_t i) {
+        for (;;) {
+            auto smallest = i;
+            for (auto child : { 2 * i + 1, 2 * i + 2 }) {
+                if (child < _heap.size() && _heap[child].count < _heap[smallest].count) {
+                    smallest = child;
+                }
+            }
+            if (smallest == i) {
+                break;
+            }
+            swap_counters(i, smallest);
+            i = smallest;
+        }
+    }
+public:
+    explicit space_saving(size_t capacity)
+        : _capacity(std::max(capacity, size_t(1)))
+    {
+        _heap.reserve(_capacity);
+        _index.reserve(_capacity);
+    }
+
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    void add(const Key& key, uint64_t n = 1) {
+        auto i = _index.find(key);
+        if (i != _index.end()) {
+            _heap[i->second].count += n;
+            sift_down(i->second);
+        } else if (_heap.size() < _capacity) {
+            _heap.push_back(counter{key, n, 0});
+            _index.emplace(key, _heap.size() - 1);
+            sift_up(_heap.size() - 1);
+        } else {
+            auto& least = _heap[0];
+            _index.erase(least.key);
+            least.error = least.count;
+            least.count += n;
+            least.key = key;
+            _index.emplace(key, 0);
+            sift_down(0);
+        }
+    }
+
+    // The counted keys, most frequent first.
+    std::vector<counter> top(size_t k) const {
+        auto res = _heap;
+        std::sort(res.begin(), res.end(), [] (const counter& a, const counter& b) {
+            return a.count > b.count;
+        });
+        if (res.size() > k) {
+            res.resize(k);
+        }
+        return res;
+    }
+};
+
+}
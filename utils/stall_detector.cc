@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <execinfo.h>
+#include <mutex>
+#include <system_error>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "utils/stall_detector.hh"
+#include "core/reactor.hh"
+#include "log.hh"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace utils {
+
+static logging::logger logger("stall_detector");
+
+distributed<stall_detector> _the_stall_detector;
+
+static thread_local stall_detector* local_detector = nullptr;
+
+// A real-time signal, which the reactor leaves alone.
+static int stall_signal() {
+    return SIGRTMIN + 5;
+}
+
+static constexpr auto report_interval = std::chrono::seconds(1);
+
+int64_t stall_detector::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+}
+
+void stall_detector::signal_handler(int, siginfo_t*, void*) {
+    if (local_detector) {
+        local_detector->on_signal();
+    }
+}
+
+stall_detector::stall_detector(std::chrono::milliseconds threshold)
+    : _threshold(0)
+    , _period(0)
+    , _heartbeat_ns(now_ns())
+    , _heartbeat_timer([this] { heartbeat(); })
+{
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        struct sigaction sa = {};
+        sa.sa_sigaction = signal_handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(stall_signal(), &sa, nullptr) == -1) {
+            throw std::system_error(errno, std::system_category(), "sigaction");
+        }
+    });
+    // Reactor threads start with all signals blocked.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, stall_signal());
+    pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+
+    sigevent sev = {};
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = stall_signal();
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &_cpu_timer) == -1) {
+        throw std::system_error(errno, std::system_category(), "timer_create");
+    }
+    // The first backtrace loads what it needs, which the signal handler
+    // mustn't.
+    void* frames[max_frames];
+    ::backtrace(frames, max_frames);
+
+    local_detector = this;
+    set_threshold(threshold);
+}
+
+stall_detector::~stall_detector() {
+    local_detector = nullptr;
+    timer_delete(_cpu_timer);
+}
+
+future<> stall_detector::stop() {
+    set_threshold(std::chrono::milliseconds(0));
+    local_detector = nullptr;
+    return make_ready_future<>();
+}
+
+void stall_detector::arm() {
+    _heartbeat_timer.cancel();
+    itimerspec its = {};
+    if (_threshold.count()) {
+        _heartbeat_ns.store(now_ns(), std::memory_order_relaxed);
+        _heartbeat_timer.arm_periodic(std::chrono::duration_cast<clock::duration>(_period));
+        // Several signals per threshold, so that a stall gets one while it
+        // lasts.
+        auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(_threshold / 4);
+        its.it_interval.tv_sec = interval.count() / 1000000000;
+        its.it_interval.tv_nsec = interval.count() % 1000000000;
+        its.it_value = its.it_interval;
+    }
+    timer_settime(_cpu_timer, 0, &its, nullptr);
+}
+
+void stall_detector::set_threshold(std::chrono::milliseconds threshold) {
+    _threshold = std::max(threshold, std::chrono::milliseconds(0));
+    _period = std::max<std::chrono::nanoseconds>(_threshold / 2, std::chrono::milliseconds(1));
+    arm();
+}
+
+// Runs in the signal handler, so it mustn't allocate nor take locks.
+void stall_detector::on_signal() noexcept {
+    auto heartbeat = _heartbeat_ns.load(std::memory_order_relaxed);
+    if (!_threshold.count() || heartbeat == _sampled_heartbeat_ns
+            || now_ns() - heartbeat < (_period + _threshold).count()) {
+        return;
+    }
+    _sampled_heartbeat_ns = heartbeat;
+    auto produced = _produced.load(std::memory_order_relaxed);
+    if (produced - _consumed.load(std::memory_order_relaxed) == max_pending_samples) {
+        _samples_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto& s = _samples[produced % max_pending_samples];
+    s.depth = ::backtrace(s.frames, max_frames);
+    _produced.store(produced + 1, std::memory_order_release);
+}
+
+void stall_detector::heartbeat() {
+    auto now = now_ns();
+    auto late = std::chrono::nanoseconds(now - _heartbeat_ns.load(std::memory_order_relaxed)) - _period;
+    _heartbeat_ns.store(now, std::memory_order_relaxed);
+    auto stall = std::chrono::duration_cast<clock::duration>(late);
+    auto consumed = _consumed.load(std::memory_order_relaxed);
+    if (consumed == _produced.load(std::memory_order_acquire)) {
+        if (late >= _threshold) {
+            // Stalled without a backtrace to show for it, like on a
+            // blocking system call, which takes no CPU time.
+            ++_stats.stalls;
+            ++_stats.unattributed;
+        }
+        return;
+    }
+    // A stall is sampled once, and the heartbeat comes right after it.
+    for (; consumed != _produced.load(std::memory_order_acquire); ++consumed) {
+        record(_samples[consumed % max_pending_samples], stall);
+        _consumed.store(consumed + 1, std::memory_order_relaxed);
+    }
+}
+
+void stall_detector::record(const sample& s, clock::duration stall) {
+    ++_stats.stalls;
+    sstring backtrace;
+    for (int i = 0; i < s.depth; ++i) {
+        backtrace += sprint("%s0x%x", i ? " " : "", reinterpret_cast<uintptr_t>(s.frames[i]));
+    }
+    auto i = _sites.find(backtrace);
+    if (i == _sites.end()) {
+        if (_sites.size() == max_sites) {
+            ++_stats.unattributed;
+        } else {
+            i = _sites.emplace(backtrace, site()).first;
+        }
+    }
+    if (i != _sites.end()) {
+        ++i->second.count;
+        i->second.total += stall;
+        i->second.max = std::max(i->second.max, stall);
+    }
+
+    auto now = clock::now();
+    if (now - _last_report < report_interval) {
+        ++_unreported;
+        return;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(stall).count();
+    if (_unreported) {
+        logger.warn("Reactor stalled for {} ms ({} more stalls since the last report), backtrace: {}", ms, _unreported, backtrace);
+    } else {
+        logger.warn("Reactor stalled for {} ms, backtrace: {}", ms, backtrace);
+    }
+    _last_report = now;
+    _unreported = 0;
+}
+
+void stall_detector::reset() {
+    _sites.clear();
+    _stats = stats();
+    _samples_dropped.store(0, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <time.h>
+#include <signal.h>
+
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/sstring.hh>
+#include <seastar/core/timer.hh>
+
+namespace utils {
+
+// Detects tasks running so long without yielding that they stall the
+// reactor, and where they do.
+//
+// A timer on the reactor beats a heartbeat. A timer on the CPU time of the
+// shard's thread signals it periodically, and if the heartbeat is then
+// older than the threshold, the signal handler takes the backtrace of the
+// stalled task. Once the reactor gets to run again, it aggregates the
+// backtraces by call site and logs them.
+//
+// Only the signal, taken a few times per threshold of CPU time, costs
+// anything while the reactor runs normally.
+class stall_detector {
+public:
+    using clock = std::chrono::steady_clock;
+    static constexpr size_t max_frames = 32;
+    // Call sites aggregated, beyond which stalls are counted but not
+    // attributed.
+    static constexpr size_t max_sites = 1000;
+
+    struct site {
+        uint64_t count = 0;
+        clock::duration total{0};
+        clock::duration max{0};
+    };
+    struct stats {
+        uint64_t stalls = 0;
+        // Stalls not attributed, either because their backtraces couldn't
+        // be taken in time or because there were too many call sites.
+        uint64_t unattributed = 0;
+    };
+private:
+    struct sample {
+        int depth;
+        void* frames[max_frames];
+    };
+    static constexpr size_t max_pending_samples = 8;
+
+    std::chrono::nanoseconds _threshold;
+    // Of the heartbeat; a stall is a heartbeat late by the threshold.
+    std::chrono::nanoseconds _period;
+    // Written by the reactor, read by the signal handler.
+    std::atomic<int64_t> _heartbeat_ns;
+    // Only accessed by the signal handler.
+    int64_t _sampled_heartbeat_ns = 0;
+    sample _samples[max_pending_samples];
+    std::atomic<uint64_t> _produced{0};
+    std::atomic<uint64_t> _consumed{0};
+    std::atomic<uint64_t> _samples_dropped{0};
+    timer<> _heartbeat_timer;
+    timer_t _cpu_timer;
+    // Keyed by backtrace.
+    std::unordered_map<sstring, site> _sites;
+    clock::time_point _last_report;
+    uint64_t _unreported = 0;
+    stats _stats;
+private:
+    static int64_t now_ns();
+    static void signal_handler(int, siginfo_t*, void*);
+    void on_signal() noexcept;
+    void heartbeat();
+    void record(const sample& s, clock::duration stall);
+    void arm();
+public:
+    // A threshold of zero disables the detector.
+    explicit stall_detector(std::chrono::milliseconds threshold);
+    ~stall_detector();
+    future<> stop();
+
+    void set_threshold(std::chrono::milliseconds threshold);
+    std::chrono::milliseconds get_threshold() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(_threshold);
+    }
+    // The call sites of the stalls seen, by backtrace.
+    const std::unordered_map<sstring, site>& sites() const {
+        return _sites;
+    }
+    void reset();
+    stats get_stats() const {
+        auto s = _stats;
+        s.unattributed += _samples_dropped.load(std::memory_order_relaxed);
+        return s;
+    }
+};
+
+extern distributed<stall_detector> _the_stall_detector;
+
+inline distributed<stall_detector>& get_stall_detector() {
+    return _the_stall_detector;
+}
+
+}
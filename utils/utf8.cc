@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <smmintrin.h>
+
+#include "utils/utf8.hh"
+
+namespace utils {
+
+namespace ascii {
+
+bool validate(const uint8_t* data, size_t size) {
+    auto bits = _mm_setzero_si128();
+    for (; size >= 16; data += 16, size -= 16) {
+        bits = _mm_or_si128(bits, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+    }
+    uint8_t tail = 0;
+    for (size_t i = 0; i < size; ++i) {
+        tail |= data[i];
+    }
+    return !_mm_movemask_epi8(bits) && tail < 0x80;
+}
+
+}
+
+namespace utf8 {
+
+// The validation of "Validating UTF-8 In Less Than One Instruction Per
+// Byte" (Keiser and Lemire): almost every error shows in a pair of
+// consecutive bytes, found by looking up the high nibble of the first, its
+// low nibble and the high nibble of the second in tables of the errors each
+// may take part in. The rest are continuation bytes where the lead two or
+// three bytes back doesn't expect them, or missing where it does.
+namespace {
+
+// 11______ followed by 0_______ or 11______
+constexpr uint8_t too_short = 1 << 0;
+// 0_______ followed by 10______
+constexpr uint8_t too_long = 1 << 1;
+// 11100000 100_____
+constexpr uint8_t overlong_3 = 1 << 2;
+// 11110100 1001____, 11110100 101_____, 11110101 1001____, ...
+constexpr uint8_t too_large = 1 << 3;
+// 11101101 101_____
+constexpr uint8_t surrogate = 1 << 4;
+// 1100000_ 10______
+constexpr uint8_t overlong_2 = 1 << 5;
+// 11110101 1000____, 1111011_ 1000____, 11111___ 1000____
+constexpr uint8_t too_large_1000 = 1 << 6;
+// 11110000 1000____
+constexpr uint8_t overlong_4 = 1 << 6;
+// 10______ followed by 10______
+constexpr uint8_t two_conts = 1 << 7;
+// Errors depending on the high nibble of the first byte only.
+constexpr uint8_t carry = too_short | too_long | two_conts;
+
+inline __m128i table(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4, uint8_t b5, uint8_t b6, uint8_t b7,
+        uint8_t b8, uint8_t b9, uint8_t b10, uint8_t b11, uint8_t b12, uint8_t b13, uint8_t b14, uint8_t b15) {
+    return _mm_setr_epi8(b0, b1, b2, b3, b4, b5, b6, b7, b8, b9, b10, b11, b12, b13, b14, b15);
+}
+
+inline __m128i high_nibbles(__m128i v) {
+    return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+}
+
+inline __m128i low_nibbles(__m128i v) {
+    return _mm_and_si128(v, _mm_set1_epi8(0x0f));
+}
+
+// The errors of each byte and the one before it, prev1 being the bytes
+// shifted by one.
+inline __m128i special_cases(__m128i input, __m128i prev1) {
+    const auto byte_1_high = table(
+        // 0_______ ________
+        too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+        // 10______ ________
+        two_conts, two_conts, two_conts, two_conts,
+        // 1100____ ________
+        too_short | overlong_2,
+        // 1101____ ________
+        too_short,
+        // 1110____ ________
+        too_short | overlong_3 | surrogate,
+        // 1111____ ________
+        too_short | too_large | too_large_1000 | overlong_4);
+    const auto byte_1_low = table(
+        // ____0000 ________
+        carry | overlong_3 | overlong_2 | overlong_4,
+        // ____0001 ________
+        carry | overlong_2,
+        // ____001_ ________
+        carry, carry,
+        // ____0100 ________
+        carry | too_large,
+        // ____0101 ________
+        carry | too_large | too_large_1000,
+        // ____011_ ________
+        carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+        // ____1___ ________
+        carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        // ____1101 ________
+        carry | too_large | too_large_1000 | surrogate,
+        carry | too_large | too_large_1000, carry | too_large | too_large_1000);
+    const auto byte_2_high = table(
+        // ________ 0_______
+        too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+        // ________ 1000____
+        too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+        // ________ 1001____
+        too_long | overlong_2 | two_conts | overlong_3 | too_large,
+        // ________ 101_____
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        // ________ 11______
+        too_short, too_short, too_short, too_short);
+    auto e1 = _mm_shuffle_epi8(byte_1_high, high_nibbles(prev1));
+    auto e2 = _mm_shuffle_epi8(byte_1_low, low_nibbles(prev1));
+    auto e3 = _mm_shuffle_epi8(byte_2_high, high_nibbles(input));
+    return _mm_and_si128(_mm_and_si128(e1, e2), e3);
+}
+
+// Continuations two and three bytes after three and four byte leads are the
+// only pairs of continuations allowed, so must match two_conts exactly.
+inline __m128i multibyte_lengths(__m128i input, __m128i prev, __m128i sc) {
+    auto prev2 = _mm_alignr_epi8(input, prev, 16 - 2);
+    auto prev3 = _mm_alignr_epi8(input, prev, 16 - 3);
+    // The high bit is set for bytes of at least 0xe0 and 0xf0.
+    auto third = _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xe0 - 0x80)));
+    auto fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xf0 - 0x80)));
+    auto must_be_23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(char(0x80)));
+    return _mm_xor_si128(must_be_23, sc);
+}
+
+// Non-zero if the last bytes start a sequence they don't finish.
+inline __m128i incomplete(__m128i input) {
+    const auto max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            char(0xf0 - 1), char(0xe0 - 1), char(0xc0 - 1));
+    return _mm_subs_epu8(input, max);
+}
+
+class checker {
+    __m128i _error = _mm_setzero_si128();
+    __m128i _prev = _mm_setzero_si128();
+    __m128i _prev_incomplete = _mm_setzero_si128();
+public:
+    void check(__m128i input) {
+        if (!_mm_movemask_epi8(input)) {
+            // All ASCII: only the previous bytes may be in error.
+            _error = _mm_or_si128(_error, _prev_incomplete);
+        } else {
+            auto prev1 = _mm_alignr_epi8(input, _prev, 16 - 1);
+            auto sc = special_cases(input, prev1);
+            _error = _mm_or_si128(_error, multibyte_lengths(input, _prev, sc));
+            _prev_incomplete = incomplete(input);
+        }
+        _prev = input;
+    }
+    bool ok() {
+        // A sequence left unfinished at the end.
+        check(_mm_setzero_si128());
+        return _mm_testz_si128(_error, _error);
+    }
+};
+
+}
+
+bool validate(const uint8_t* data, size_t size) {
+    checker c;
+    for (; size >= 16; data += 16, size -= 16) {
+        c.check(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+    }
+    if (size) {
+        uint8_t tail[16] = {};
+        std::memcpy(tail, data, size);
+        c.check(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)));
+    }
+    return c.ok();
+}
+
+}
+
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "bytes.hh"
+
+namespace utils {
+
+namespace ascii {
+
+// Whether all the bytes are below 0x80.
+bool validate(const uint8_t* data, size_t size);
+
+inline bool validate(bytes_view v) {
+    return validate(reinterpret_cast<const uint8_t*>(v.data()), v.size());
+}
+
+}
+
+namespace utf8 {
+
+// Whether the bytes are well-formed UTF-8: no overlong encodings, no
+// surrogates, no code points past U+10FFFF and no truncated sequences.
+// Checks 16 bytes at a time, and runs of ASCII at little more than the cost
+// of reading them.
+bool validate(const uint8_t* data, size_t size);
+
+inline bool validate(bytes_view v) {
+    return validate(reinterpret_cast<const uint8_t*>(v.data()), v.size());
+}
+
+}
+
+}